@@ -56,6 +56,7 @@ for i in $*; do
     *xcode*StdRedirect.dylib) OUTPUT_PATH=tools/objc/StdRedirect.dylib ;;
     *xcode*make_hashed_objlist.py) OUTPUT_PATH=tools/objc/make_hashed_objlist.py ;;
     *xcode*realpath) OUTPUT_PATH=tools/objc/realpath ;;
+    *xcode*xcrun_cache) OUTPUT_PATH=tools/objc/xcrun_cache ;;
     *xcode*xcode-locator) OUTPUT_PATH=tools/objc/xcode-locator ;;
     *src/tools/xcode/*.sh) OUTPUT_PATH=tools/objc/${i##*/} ;;
     *src/tools/xcode/*) OUTPUT_PATH=tools/objc/${i##*/}.sh ;;
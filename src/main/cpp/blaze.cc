@@ -46,7 +46,10 @@
 #include <grpc++/security/credentials.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>  // NOLINT (gRPC requires this)
+#include <condition_variable>  // NOLINT
+#include <deque>
 #include <mutex>  // NOLINT
 #include <set>
 #include <string>
@@ -58,6 +61,7 @@
 #include "src/main/cpp/blaze_abrupt_exit.h"
 #include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/blaze_util_platform.h"
+#include "src/main/cpp/client_lib.h"
 #include "src/main/cpp/global_variables.h"
 #include "src/main/cpp/option_processor.h"
 #include "src/main/cpp/startup_options.h"
@@ -71,6 +75,7 @@
 #include "src/main/cpp/util/strings.h"
 #include "src/main/cpp/workspace_layout.h"
 #include "third_party/ijar/zip.h"
+#include "third_party/ijar/zlib_client.h"
 
 #include "src/main/protobuf/command_server.grpc.pb.h"
 
@@ -175,15 +180,24 @@ class BlazeServer {
   // this object will be in connected state.
   virtual bool Connect() = 0;
 
+  // Like Connect(), but does not check that the server is alive and answers
+  // with the cookies in the server directory, which saves a round trip to the
+  // server. The first Communicate() checks it instead.
+  virtual bool ConnectOptimistically() = 0;
+
   // Disconnects from an existing server. Only call this when this object is in
   // connected state. After this call returns, the object will be in connected
   // state.
   virtual void Disconnect() = 0;
 
   // Send the command line to the server and forward whatever it says to stdout
-  // and stderr. Returns the desired exit code. Only call this when the server
-  // is in connected state.
-  virtual unsigned int Communicate() = 0;
+  // and stderr, and sets 'exit_code' to the desired exit code. Only call this
+  // when the server is in connected state. Returns false, with this object in
+  // disconnected state, if the connection was made by ConnectOptimistically()
+  // and the command provably did not reach the server it was meant for: the
+  // command can be sent again once connected the regular way. If it may have
+  // reached it, e.g. the server did not answer in time, it is not sent again.
+  virtual bool Communicate(unsigned int *exit_code) = 0;
 
   // Disconnects and kills an existing server. Only call this when this object
   // is in connected state.
@@ -194,6 +208,17 @@ class BlazeServer {
   // connected state.
   virtual void Cancel() = 0;
 
+  // Asks the server to load the packages of the command line in the
+  // background, and returns once it has taken the request. Only call this
+  // when the server is in connected state. Returns false, with this object in
+  // disconnected state, like Communicate().
+  virtual bool Warmup() = 0;
+
+  // Asks the server to shrink its heap once no command runs. Only call this
+  // when the server is in connected state. Returns false, with this object in
+  // disconnected state, like Communicate().
+  virtual bool TrimMemory() = 0;
+
  protected:
   BlazeLock blaze_lock_;
   bool connected_;
@@ -210,6 +235,119 @@ uint64_t BlazeServer::AcquireLock() {
       globals->options->block_for_lock, &blaze_lock_);
 }
 
+// Writes the output of the server to the standard output and error of the
+// client on a thread of its own, so that a slow terminal does not hold up
+// reading the responses and, through gRPC flow control, the server. Up to
+// kMaxBufferedBytes are buffered; the chunks written to the same stream in the
+// meantime are written at once. On a terminal, a redraw of the progress line
+// that is still waiting to be written when the next one arrives is dropped.
+class OutputRelay {
+ public:
+  OutputRelay()
+      : buffered_bytes_(0),
+        done_(false),
+        pipe_broken_(false),
+        drop_progress_(isatty(STDERR_FILENO)) {
+    thread_ = std::thread(&OutputRelay::Run, this);
+  }
+
+  // Writes out everything buffered.
+  ~OutputRelay() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+  }
+
+  // Queues 'data' to be written to 'fd'. Blocks while the buffer is full.
+  void Write(int fd, const string &data) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (drop_progress_ && fd == STDERR_FILENO && data[0] == '\r' &&
+        !chunks_.empty() && chunks_.back().fd == STDERR_FILENO &&
+        IsProgressLine(chunks_.back().data)) {
+      buffered_bytes_ -= chunks_.back().data.size();
+      chunks_.pop_back();
+    }
+    while (buffered_bytes_ >= kMaxBufferedBytes) {
+      changed_.wait(lock);
+    }
+    chunks_.push_back(Chunk{fd, data});
+    buffered_bytes_ += data.size();
+    changed_.notify_all();
+  }
+
+  // Whether the reader of the standard output or error went away.
+  bool PipeBroken() const { return pipe_broken_; }
+
+ private:
+  struct Chunk {
+    int fd;
+    string data;
+  };
+
+  static const size_t kMaxBufferedBytes = 4 * 1024 * 1024;
+
+  // Whether 's' only redraws the current line, which the next chunk, if it
+  // starts with a carriage return, overwrites anyway.
+  static bool IsProgressLine(const string &s) {
+    return s.find_first_of("\n\033") == string::npos;
+  }
+
+  void Run() {
+    while (true) {
+      string data;
+      int fd;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (chunks_.empty() && !done_) {
+          changed_.wait(lock);
+        }
+        if (chunks_.empty()) {
+          return;
+        }
+        fd = chunks_.front().fd;
+        data.swap(chunks_.front().data);
+        chunks_.pop_front();
+        while (!chunks_.empty() && chunks_.front().fd == fd) {
+          data += chunks_.front().data;
+          chunks_.pop_front();
+        }
+        buffered_bytes_ -= data.size();
+      }
+      changed_.notify_all();
+      WriteFully(fd, data);
+    }
+  }
+
+  void WriteFully(int fd, const string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+      ssize_t result = write(fd, data.data() + written, data.size() - written);
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EPIPE) {
+          pipe_broken_ = true;
+        }
+        return;
+      }
+      written += result;
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<Chunk> chunks_;
+  size_t buffered_bytes_;
+  bool done_;
+  std::atomic<bool> pipe_broken_;
+  const bool drop_progress_;
+  std::thread thread_;
+};
+
 // Communication method that uses gRPC on a socket bound to localhost. More
 // documentation is in command_server.proto .
 class GrpcBlazeServer : public BlazeServer {
@@ -218,10 +356,13 @@ class GrpcBlazeServer : public BlazeServer {
   virtual ~GrpcBlazeServer();
 
   virtual bool Connect();
+  virtual bool ConnectOptimistically();
   virtual void Disconnect();
-  virtual unsigned int Communicate();
+  virtual bool Communicate(unsigned int *exit_code);
   virtual void KillRunningServer();
   virtual void Cancel();
+  virtual bool Warmup();
+  virtual bool TrimMemory();
 
  private:
   enum CancelThreadAction { NOTHING, JOIN, CANCEL, COMMAND_ID_RECEIVED };
@@ -238,10 +379,26 @@ class GrpcBlazeServer : public BlazeServer {
 
   int connect_timeout_secs_;
 
+  // Whether the server was seen to answer with the cookies, see
+  // ConnectOptimistically().
+  bool verified_;
+
   // Pipe that the main thread sends actions to and the cancel thread receieves
   // actions from.
   blaze_util::IPipe* _pipe;
 
+  // What the first response to a command sent to an unverified server shows.
+  enum FirstResponse {
+    ACCEPTED,      // The server runs the command.
+    NOT_RECEIVED,  // The command provably did not run; it can be sent again.
+    UNKNOWN,       // The server may have started the command.
+  };
+
+  bool Connect(bool ping);
+  FirstResponse ReadFirstResponse(
+      grpc::ClientContext *context,
+      grpc::ClientReader<command_server::RunResponse> *reader,
+      command_server::RunResponse *response);
   void CancelThread();
   void SendAction(CancelThreadAction action);
   void SendCancelMessage();
@@ -292,10 +449,10 @@ class GetInstallKeyFileProcessor : public devtools_ijar::ZipExtractorProcessor {
   string *install_base_key_;
 };
 
-// Returns the install base (the root concatenated with the contents of the file
-// 'install_base_key' contained as a ZIP entry in the Blaze binary); as a side
-// effect, it also populates the extracted_binaries global variable.
-static string GetInstallBase(const string &root, const string &self_path) {
+// Goes through the whole zip in the Blaze binary to populate the
+// extracted_binaries global variable and install_md5 from the
+// 'install_base_key' entry.
+static void ScanBlazeZip(const string &self_path) {
   GetInstallKeyFileProcessor processor(&globals->install_md5);
   std::unique_ptr<devtools_ijar::ZipExtractor> extractor(
       devtools_ijar::ZipExtractor::Create(self_path.c_str(), &processor));
@@ -313,6 +470,61 @@ static string GetInstallBase(const string &root, const string &self_path) {
     die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
         "\nFailed to find install_base_key's in zip file");
   }
+}
+
+// Reads the install key from the comment of the zip in the Blaze binary,
+// where package-bazel.sh puts a copy of 'install_base_key'. The End of Central
+// Directory record with the comment is at the very end of the file, so this
+// is much cheaper than going through the zip. Returns false if the binary has
+// no such comment.
+static bool ReadInstallKeyFromZipComment(const string &self_path,
+                                         string *install_key) {
+  // The fixed part of the End of Central Directory record.
+  static const int kEcdSize = 22;
+  // The key is 32 hex digits, possibly followed by some whitespace.
+  static const int kMaxCommentSize = 64;
+  FILE *f = fopen(self_path.c_str(), "rb");
+  if (f == NULL) {
+    return false;
+  }
+  unsigned char buf[kEcdSize + kMaxCommentSize];
+  size_t size = 0;
+  if (fseek(f, 0, SEEK_END) == 0) {
+    long file_size = ftell(f);  // NOLINT
+    size = std::min(sizeof(buf), static_cast<size_t>(std::max(file_size, 0L)));
+    if (fseek(f, -static_cast<long>(size), SEEK_END) != 0 ||  // NOLINT
+        fread(buf, 1, size, f) != size) {
+      size = 0;
+    }
+  }
+  fclose(f);
+
+  for (int ecd = static_cast<int>(size) - kEcdSize; ecd >= 0; ecd--) {
+    const unsigned char *p = buf + ecd;
+    size_t comment_size = p[20] | (p[21] << 8);
+    if (p[0] == 'P' && p[1] == 'K' && p[2] == 5 && p[3] == 6 &&
+        ecd + kEcdSize + comment_size == size) {
+      string comment(reinterpret_cast<const char *>(p + kEcdSize),
+                     comment_size);
+      blaze_util::StripWhitespace(&comment);
+      if (comment.size() != 32) {
+        return false;
+      }
+      *install_key = comment;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the install base (the root concatenated with the contents of the file
+// 'install_base_key' contained as a ZIP entry in the Blaze binary). If the key
+// has to be looked up in the zip, this also populates the extracted_binaries
+// global variable as a side effect.
+static string GetInstallBase(const string &root, const string &self_path) {
+  if (!ReadInstallKeyFromZipComment(self_path, &globals->install_md5)) {
+    ScanBlazeZip(self_path);
+  }
   return root + "/" + globals->install_md5;
 }
 
@@ -325,12 +537,57 @@ static string EscapeForOptionSource(const string& input) {
   return result;
 }
 
+// Whether the install base is the one of --experimental_shared_install_root,
+// which only root can write to; see UseSharedInstallBase().
+static bool shared_install_base = false;
+
 // Returns the installed embedded binaries directory, under the shared
 // install_base location.
 string GetEmbeddedBinariesRoot(const string &install_base) {
   return blaze_util::JoinPath(install_base, "_embedded_binaries");
 }
 
+// Returns the file the version of the JVM is cached in. Running java takes
+// long, so the version is cached in the output root, which all output bases of
+// the user share.
+static string GetJvmVersionCacheFile() {
+  return blaze_util::JoinPath(globals->options->output_user_root,
+                              "java_version");
+}
+
+// Adds the flags for the class data sharing archive of the server, with
+// --experimental_server_class_archive. The archive is in the install base and
+// its name contains the JVM version, so it is specific to both. If it does not
+// exist yet, the JVM is told to dump the classes it loaded into it when it
+// exits, otherwise to map it in. The JVM checks the archive itself and falls
+// back to loading the classes from the jar if it does not match.
+static void AddClassArchiveArguments(vector<string> *result) {
+  string jvm_version =
+      GetCachedJvmVersion(globals->jvm_path, GetJvmVersionCacheFile());
+  // Dynamic archives of the application classes need JDK 13.
+  if (jvm_version.empty() || !CheckJavaVersionIsAtLeast(jvm_version, "13")) {
+    debug_log("Not using a class archive with Java version '%s'",
+              jvm_version.c_str());
+    return;
+  }
+  for (char &c : jvm_version) {
+    if (!isalnum(c) && c != '.' && c != '-') {
+      c = '_';
+    }
+  }
+  string archive = blaze_util::JoinPath(
+      globals->options->install_base, "_server_" + jvm_version + ".jsa");
+  if (blaze_util::PathExists(archive)) {
+    result->push_back("-XX:SharedArchiveFile=" + ConvertPath(archive));
+  } else if (shared_install_base) {
+    debug_log("Not dumping a class archive to the shared install base");
+    return;
+  } else {
+    result->push_back("-XX:ArchiveClassesAtExit=" + ConvertPath(archive));
+  }
+  result->push_back("-Xshare:auto");
+}
+
 // Returns the JVM command argument array.
 static vector<string> GetArgumentArray() {
   vector<string> result;
@@ -352,6 +609,16 @@ static vector<string> GetArgumentArray() {
 
   result.push_back("-Xverify:none");
 
+  if (globals->options->server_class_archive) {
+    AddClassArchiveArguments(&result);
+  }
+
+  // Before --host_jvm_args, so that those take precedence.
+  if (globals->options->machine_aware_jvm_args) {
+    AddMachineAwareJvmArguments(GetAvailableMemory(), GetAvailableCpus(),
+                                globals->options->host_jvm_args, &result);
+  }
+
   vector<string> user_options;
 
   user_options.insert(user_options.begin(),
@@ -419,6 +686,8 @@ static vector<string> GetArgumentArray() {
   if (!globals->options->batch) {
     result.push_back("--max_idle_secs=" +
                      ToString(globals->options->max_idle_secs));
+    result.push_back("--experimental_idle_trim_secs=" +
+                     ToString(globals->options->idle_trim_secs));
   } else {
     // --batch must come first in the arguments to Java main() because
     // the code expects it to be at args[0] if it's been set.
@@ -463,6 +732,12 @@ static vector<string> GetArgumentArray() {
   if (globals->options->watchfs) {
     result.push_back("--watchfs");
   }
+  if (globals->options->lazy_install_base) {
+    result.push_back("--experimental_lazy_install_base");
+  }
+  if (globals->options->command_server_unix_socket) {
+    result.push_back("--experimental_command_server_unix_socket");
+  }
   if (globals->options->fatal_event_bus_exceptions) {
     result.push_back("--fatal_event_bus_exceptions");
   } else {
@@ -495,6 +770,15 @@ static vector<string> GetArgumentArray() {
       result.push_back("--host_jvm_args=" + arg);
     }
   }
+  // Also for ServerNeedsToBeKilled(): a server in another cgroup, or with other
+  // settings for it, is restarted.
+  if (!globals->options->server_cgroup.empty()) {
+    result.push_back("--experimental_server_cgroup=" +
+                     globals->options->server_cgroup);
+    for (const auto &setting : globals->options->server_cgroup_settings) {
+      result.push_back("--experimental_server_cgroup_setting=" + setting);
+    }
+  }
 
   if (globals->options->invocation_policy != NULL &&
       strlen(globals->options->invocation_policy) > 0) {
@@ -524,9 +808,36 @@ static vector<string> GetArgumentArray() {
   return result;
 }
 
+// Records the time between its construction and its destruction as a phase
+// of the client startup.
+class StartupPhaseTimer {
+ public:
+  explicit StartupPhaseTimer(const char *description)
+      : description_(description),
+        start_(GetMillisecondsSinceProcessStart()) {}
+
+  ~StartupPhaseTimer() {
+    StartupPhase phase = {description_, start_,
+                          GetMillisecondsSinceProcessStart() - start_};
+    globals->startup_phases.push_back(phase);
+    // The startup benchmark reads these lines.
+    debug_log("Startup phase at %s ms took %s ms: %s",
+              ToString(phase.start).c_str(), ToString(phase.duration).c_str(),
+              description_);
+  }
+
+ private:
+  const char *description_;
+  uint64_t start_;
+};
+
 // Add common command options for logging to the given argument array.
 static void AddLoggingArgs(vector<string>* args) {
   args->push_back("--startup_time=" + ToString(globals->startup_time));
+  for (const StartupPhase &phase : globals->startup_phases) {
+    args->push_back("--client_startup_phase=" + ToString(phase.start) + ":" +
+                    ToString(phase.duration) + ":" + phase.description);
+  }
   if (globals->command_wait_time != 0) {
     args->push_back("--command_wait_time=" +
                     ToString(globals->command_wait_time));
@@ -563,6 +874,42 @@ static void GoToWorkspace() {
   }
 }
 
+// The version of the JVM, probed while the client waits for the output base
+// lock and checks the install base. None of them depends on the others, and
+// running java, unless its version is cached, can take longer than both.
+struct JvmVersionProbe {
+  string exe;
+  string version;
+  std::thread thread;
+};
+
+static JvmVersionProbe *jvm_version_probe = NULL;
+
+static void StartJvmVersionProbe() {
+  JvmVersionProbe *probe = new JvmVersionProbe();
+  probe->exe = globals->options->GetJvm();
+  string cache_file = GetJvmVersionCacheFile();
+  probe->thread = std::thread([probe, cache_file]() {
+    probe->version = GetCachedJvmVersion(probe->exe, cache_file);
+  });
+  jvm_version_probe = probe;
+}
+
+// Returns the version of the JVM at 'exe', from StartJvmVersionProbe() if it
+// probed that one.
+static string GetProbedJvmVersion(const string &exe) {
+  if (jvm_version_probe != NULL) {
+    jvm_version_probe->thread.join();
+    JvmVersionProbe *probe = jvm_version_probe;
+    jvm_version_probe = NULL;
+    std::unique_ptr<JvmVersionProbe> deleter(probe);
+    if (probe->exe == exe) {
+      return probe->version;
+    }
+  }
+  return GetCachedJvmVersion(exe, GetJvmVersionCacheFile());
+}
+
 // Check the java version if a java version specification is bundled. On
 // success, returns the executable path of the java command.
 static void VerifyJavaVersionAndSetJvm() {
@@ -574,7 +921,11 @@ static void VerifyJavaVersionAndSetJvm() {
   if (ReadFile(version_spec_file, &version_spec)) {
     blaze_util::StripWhitespace(&version_spec);
     // A version specification is given, get version of java.
-    string jvm_version = GetJvmVersion(exe);
+    string jvm_version;
+    {
+      StartupPhaseTimer timer("checking the Java version");
+      jvm_version = GetProbedJvmVersion(exe);
+    }
 
     // Compare that jvm_version is found and at least the one specified.
     if (jvm_version.size() == 0) {
@@ -588,6 +939,11 @@ static void VerifyJavaVersionAndSetJvm() {
            jvm_version.c_str(), version_spec.c_str());
     }
   }
+  // Without a version specification, the probe is only waited for, so that
+  // it does not outlive the client's use of the JVM.
+  if (jvm_version_probe != NULL) {
+    GetProbedJvmVersion(exe);
+  }
 
   globals->jvm_path = exe;
 }
@@ -616,8 +972,14 @@ static void StartServer(BlazeServerStartup** server_startup) {
   // we can still print errors to the terminal.
   GoToWorkspace();
 
+  string cgroup_dir;
+  if (!globals->options->server_cgroup.empty()) {
+    cgroup_dir = CreateServerCgroup(globals->options->server_cgroup,
+                                    globals->options->server_cgroup_settings);
+  }
+
   ExecuteDaemon(exe, jvm_args_vector, globals->jvm_log_file.c_str(),
-                server_dir, server_startup);
+                server_dir, cgroup_dir, server_startup);
 }
 
 // Replace this process with blaze in standalone/batch mode.
@@ -626,7 +988,15 @@ static void StartServer(BlazeServerStartup** server_startup) {
 // This function passes the commands array to the blaze process.
 // This array should start with a command ("build", "info", etc.).
 static void StartStandalone(BlazeServer* server) {
+  // The arguments of a batch run start with --batch, so they never match
+  // those of a running server: KillRunningServerIfDifferentStartupOptions()
+  // would always kill it, and is not called.
   if (server->Connected()) {
+    globals->restart_reason = NEW_OPTIONS;
+    fprintf(stderr,
+            "WARNING: Running %s server needs to be killed, because the "
+            "startup options are different.\n",
+            globals->options->product_name.c_str());
     server->KillRunningServer();
   }
 
@@ -718,6 +1088,7 @@ static int GetServerPid(const string &server_dir) {
 
 // Starts up a new server and connects to it. Exits if it didn't work not.
 static void StartServerAndConnect(BlazeServer *server) {
+  StartupPhaseTimer timer("starting the server");
   string server_dir = globals->options->output_base + "/server";
 
   // The server dir has the socket, so we don't allow access by other
@@ -753,10 +1124,9 @@ static void StartServerAndConnect(BlazeServer *server) {
   auto try_until_time(
       std::chrono::system_clock::now() + std::chrono::seconds(120));
   bool had_to_wait = false;
+  bool may_be_ready = true;
   while (std::chrono::system_clock::now() < try_until_time) {
-    auto next_attempt_time(
-        std::chrono::system_clock::now() + std::chrono::milliseconds(100));
-    if (server->Connect()) {
+    if (may_be_ready && server->Connect()) {
       if (had_to_wait && !globals->options->client_debug) {
         fputc('\n', stderr);
         fflush(stderr);
@@ -771,7 +1141,10 @@ static void StartServerAndConnect(BlazeServer *server) {
       fflush(stderr);
     }
 
-    std::this_thread::sleep_until(next_attempt_time);
+    // The server is ready once it has written its port and cookies into the
+    // server directory. Where the platform tells when it does, connect right
+    // then rather than at the next 100 ms tick.
+    may_be_ready = server_startup->WaitForStartupEvent(100);
     if (!server_startup->IsStillAlive()) {
       fprintf(stderr, "\nunexpected pipe read status: %s\n"
           "Server presumed dead. Now printing '%s':\n",
@@ -785,11 +1158,19 @@ static void StartServerAndConnect(BlazeServer *server) {
 }
 
 // A devtools_ijar::ZipExtractorProcessor to extract the files from the blaze
-// zip.
+// zip. The files are collected as they are stored in the zip by
+// ProcessStored(), and then extracted in parallel by ExtractFiles().
 class ExtractBlazeZipProcessor : public devtools_ijar::ZipExtractorProcessor {
  public:
-  explicit ExtractBlazeZipProcessor(const string &embedded_binaries)
-      : embedded_binaries_(embedded_binaries) {}
+  // If 'replace' is true, the files are written to a temporary file that is
+  // then renamed into place, for trees other processes may already read.
+  ExtractBlazeZipProcessor(const string &embedded_binaries, time_t mtime,
+                           bool replace)
+      : embedded_binaries_(embedded_binaries),
+        mtime_(mtime),
+        replace_(replace),
+        next_file_(0),
+        end_file_(0) {}
 
   virtual bool Accept(const char *filename, const devtools_ijar::u4 attr) {
     return !devtools_ijar::zipattr_is_dir(attr);
@@ -802,23 +1183,269 @@ class ExtractBlazeZipProcessor : public devtools_ijar::ZipExtractorProcessor {
       pdie(blaze_exit_code::INTERNAL_ERROR,
            "couldn't create '%s'", path.c_str());
     }
+    WriteExtractedFile(path, data, size);
+  }
+
+  virtual void ProcessStored(const char *filename,
+                             const devtools_ijar::u4 attr,
+                             const devtools_ijar::u1 *data,
+                             const size_t compressed_size,
+                             const size_t uncompressed_size,
+                             const bool compressed) {
+    StoredFile file = {filename, data, compressed_size, uncompressed_size,
+                       compressed};
+    directories_.insert(blaze_util::Dirname(
+        blaze_util::JoinPath(embedded_binaries_, filename)));
+    files_.push_back(file);
+    end_file_ = files_.size();
+  }
+
+  // Leaves the files for which 'needed' returns false out of the next
+  // ExtractFiles(). They are extracted by the one after Relocate().
+  void DeferFiles(bool (*needed)(const string &filename)) {
+    auto deferred = std::stable_partition(
+        files_.begin() + next_file_, files_.end(),
+        [needed](const StoredFile &file) { return needed(file.filename); });
+    end_file_ = deferred - files_.begin();
+  }
+
+  // The tree was renamed to 'embedded_binaries', where other processes may
+  // already read it: have the next ExtractFiles() write the deferred files
+  // there, each through a temporary file.
+  void Relocate(const string &embedded_binaries) {
+    embedded_binaries_ = embedded_binaries;
+    replace_ = true;
+    end_file_ = files_.size();
+  }
+
+  // Creates the directories of the files collected by ProcessStored(), then
+  // inflates and writes the files on the given number of threads.
+  void ExtractFiles(int threads) {
+    for (const auto &directory : directories_) {
+      if (!MakeDirectories(directory, 0777)) {
+        pdie(blaze_exit_code::INTERNAL_ERROR,
+             "couldn't create '%s'", directory.c_str());
+      }
+    }
+    directories_.clear();
+    vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+      workers.emplace_back(&ExtractBlazeZipProcessor::ExtractWorker, this);
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
 
-    if (!blaze::WriteFile(data, size, path)) {
+ private:
+  struct StoredFile {
+    string filename;
+    const devtools_ijar::u1 *data;
+    size_t compressed_size;
+    size_t uncompressed_size;
+    bool compressed;
+  };
+
+  // Set the time to a distantly futuristic value so we can observe tampering,
+  // see ActuallyExtractData().
+  void WriteExtractedFile(const string &path, const devtools_ijar::u1 *data,
+                          size_t size) {
+    string written_path =
+        replace_ ? path + ".tmp." + blaze::GetProcessIdAsString() : path;
+    if (!blaze::WriteFile(data, size, written_path, mtime_)) {
       die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-          "\nFailed to write zipped file \"%s\": %s", path.c_str(),
+          "\nFailed to write zipped file \"%s\": %s", written_path.c_str(),
           strerror(errno));
     }
+    if (replace_ && rename(written_path.c_str(), path.c_str()) == -1) {
+      pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+           "zipped file '%s' could not be renamed into place",
+           written_path.c_str());
+    }
+  }
+
+  // Extracts the files from next_file_ until end_file_.
+  void ExtractWorker() {
+    devtools_ijar::Decompressor decompressor;
+    for (;;) {
+      size_t index;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (next_file_ >= end_file_) {
+          return;
+        }
+        index = next_file_++;
+      }
+      const StoredFile &file = files_[index];
+      const devtools_ijar::u1 *data = file.data;
+      size_t size = file.uncompressed_size;
+      if (file.compressed) {
+        devtools_ijar::DecompressedFile *decompressed =
+            decompressor.UncompressFile(data, file.compressed_size);
+        if (decompressed == NULL) {
+          die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+              "\nFailed to extract %s as a zip file: %s",
+              globals->options->product_name.c_str(),
+              decompressor.GetError());
+        }
+        data = decompressed->uncompressed_data;
+        size = decompressed->uncompressed_size;
+        free(decompressed);
+      }
+      WriteExtractedFile(blaze_util::JoinPath(embedded_binaries_, file.filename),
+                         data, size);
+    }
+  }
+
+  string embedded_binaries_;
+  const time_t mtime_;
+  bool replace_;
+  set<string> directories_;
+  vector<StoredFile> files_;
+  // Guards next_file_.
+  std::mutex mutex_;
+  size_t next_file_;
+  size_t end_file_;
+};
+
+// Returns the number of threads the installation is extracted on.
+static int ExtractionThreads() {
+  return std::max(1, std::min(8, static_cast<int>(
+      std::thread::hardware_concurrency())));
+}
+
+// Returns whether the server cannot start up without the given embedded
+// binary: the server jar, the JNI libraries on its java.library.path and the
+// Java version specification checked by VerifyJavaVersionAndSetJvm().
+static bool IsNeededAtStartup(const string &filename) {
+  return filename == globals->extracted_binaries[0] ||
+         IsSharedLibrary(filename) || filename == "java.version";
+}
+
+// Returns the file that marks an installation as complete. It is created
+// once all the embedded binaries are in place, and the server started with
+// --experimental_lazy_install_base waits for it.
+static string GetExtractionCompleteMarker(const string &install_base) {
+  return blaze_util::JoinPath(install_base, "_extraction_complete");
+}
+
+// Returns the mtime the files of an installation get: a distantly futuristic
+// value so we can observe tampering.
+static time_t GetInstallationMtime() {
+  const time_t TEN_YEARS_IN_SEC = 3600 * 24 * 365 * 10;
+  return time(NULL) + TEN_YEARS_IN_SEC;
+}
+
+// The marker lists the embedded binaries, one per line, so that later clients
+// need not go through the zip to learn them.
+// It is renamed into place so that other clients never see it incomplete.
+static void MarkExtractionComplete(const string &install_base) {
+  string marker = GetExtractionCompleteMarker(install_base);
+  string tmp_marker = marker + ".tmp." + blaze::GetProcessIdAsString();
+  string content;
+  blaze_util::JoinStrings(globals->extracted_binaries, '\n', &content);
+  content += '\n';
+  if (!blaze::WriteFile(content.data(), content.size(), tmp_marker,
+                        GetInstallationMtime()) ||
+      rename(tmp_marker.c_str(), marker.c_str()) == -1) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+         "couldn't create '%s'", marker.c_str());
+  }
+}
+
+// Reads the embedded binaries listed in the marker of the complete
+// installation at 'install_base'. Returns false if there is no such marker or
+// it was written by a client that did not list the embedded binaries in it.
+static bool ReadExtractionCompleteMarker(const string &install_base,
+                                         vector<string> *binaries) {
+  string content;
+  if (!ReadFile(GetExtractionCompleteMarker(install_base), &content) ||
+      content.empty() || content[content.size() - 1] != '\n') {
+    return false;
+  }
+  *binaries = blaze_util::Split(content, '\n');
+  return true;
+}
+
+// Syncs the files and directories of a tree where they are, without making
+// up their paths.
+class SyncTreeVisitor : public blaze_util::DirectoryTreeVisitor {
+ public:
+  void VisitFile(int dir_fd, const char *name) override {
+// fsync always fails on Cygwin with "Permission denied" for some reason.
+#ifndef __CYGWIN__
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+           "failed to open '%s' for syncing", name);
+    }
+    Sync(fd, name);
+    close(fd);
+#endif
+  }
+
+  bool VisitDirectory(int dir_fd, const char *name, int fd) override {
+#ifndef __CYGWIN__
+    Sync(fd, name);
+#endif
+    return true;
   }
 
  private:
-  const string embedded_binaries_;
+  static void Sync(int fd, const char *name) {
+    if (fsync(fd) < 0) {
+      pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR, "failed to sync '%s'",
+           name);
+    }
+  }
+};
+
+// Makes sure (or at least as sure as we can...) that the files written under
+// 'embedded_binaries' are actually on the disk before the installation is
+// relied upon.
+static void SyncEmbeddedBinaries(const string &embedded_binaries) {
+  // Where the whole filesystem can be synced at once, that is much cheaper
+  // than syncing every file and directory.
+  if (blaze::SyncFileSystem(embedded_binaries)) {
+    return;
+  }
+
+  // Otherwise the syncs are issued from several threads, which lets the
+  // filesystem overlap them.
+  SyncTreeVisitor visitor;
+  blaze_util::WalkDirectoryTree(embedded_binaries, &visitor,
+                                ExtractionThreads());
+  blaze_util::SyncFile(embedded_binaries);
+}
+
+// The embedded binaries ExtractData() leaves to be extracted while the server
+// starts up, with --experimental_lazy_install_base.
+struct DeferredExtraction {
+  std::unique_ptr<ExtractBlazeZipProcessor> processor;
+  // Maps the blaze binary, which the files of the processor point into.
+  std::unique_ptr<devtools_ijar::ZipExtractor> extractor;
+  std::thread thread;
 };
 
+static DeferredExtraction *deferred_extraction = NULL;
+
 // Actually extracts the embedded data files into the tree whose root
-// is 'embedded_binaries'.
+// is 'embedded_binaries'. If 'deferred' is not NULL, only the files the
+// server needs to start up are extracted, the others are left to 'deferred'.
 static void ActuallyExtractData(const string &argv0,
-                                const string &embedded_binaries) {
-  ExtractBlazeZipProcessor processor(embedded_binaries);
+                                const string &embedded_binaries,
+                                bool replace,
+                                DeferredExtraction *deferred) {
+  // Set the time to a distantly futuristic value so we can observe tampering.
+  // Note that keeping the default timestamp set by unzip (1970-01-01) and
+  // using that to detect tampering is not enough, because we also need the
+  // timestamp to change between Blaze releases so that the metadata cache
+  // knows that the files may have changed. This is important for actions that
+  // use embedded binaries as artifacts.
+  time_t future_time = GetInstallationMtime();
+
+  std::unique_ptr<ExtractBlazeZipProcessor> processor(
+      new ExtractBlazeZipProcessor(embedded_binaries, future_time, replace));
   if (!MakeDirectories(embedded_binaries, 0777)) {
     pdie(blaze_exit_code::INTERNAL_ERROR, "couldn't create '%s'",
          embedded_binaries.c_str());
@@ -827,66 +1454,82 @@ static void ActuallyExtractData(const string &argv0,
   fprintf(stderr, "Extracting %s installation...\n",
           globals->options->product_name.c_str());
   std::unique_ptr<devtools_ijar::ZipExtractor> extractor(
-      devtools_ijar::ZipExtractor::Create(argv0.c_str(), &processor));
+      devtools_ijar::ZipExtractor::Create(argv0.c_str(), processor.get()));
   if (extractor.get() == NULL) {
     die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
         "\nFailed to open %s as a zip file: (%d) %s",
         globals->options->product_name.c_str(), errno, strerror(errno));
   }
-  if (extractor->ProcessAll() < 0) {
+  while (extractor->ProcessNextStored()) {}
+  if (extractor->GetError() != NULL) {
     die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
         "\nFailed to extract %s as a zip file: %s",
         globals->options->product_name.c_str(), extractor->GetError());
   }
+  if (deferred != NULL) {
+    processor->DeferFiles(IsNeededAtStartup);
+  }
+  processor->ExtractFiles(ExtractionThreads());
+  SyncEmbeddedBinaries(embedded_binaries);
 
-  const time_t TEN_YEARS_IN_SEC = 3600 * 24 * 365 * 10;
-  time_t future_time = time(NULL) + TEN_YEARS_IN_SEC;
-
-  // Set the timestamps of the extracted files to the future and make sure (or
-  // at least as sure as we can...) that the files we have written are actually
-  // on the disk.
-
-  vector<string> extracted_files;
-
-  // Walks the temporary directory recursively and collects full file paths.
-  blaze_util::GetAllFilesUnder(embedded_binaries, &extracted_files);
-
-  set<string> synced_directories;
-  for (const auto &it : extracted_files) {
-    const char *extracted_path = it.c_str();
-
-    // Set the time to a distantly futuristic value so we can observe tampering.
-    // Note that keeping the default timestamp set by unzip (1970-01-01) and
-    // using that to detect tampering is not enough, because we also need the
-    // timestamp to change between Blaze releases so that the metadata cache
-    // knows that the files may have changed. This is important for actions that
-    // use embedded binaries as artifacts.
-    if (!blaze_util::SetMtimeMillisec(it, future_time)) {
-      pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-           "failed to set timestamp on '%s'", extracted_path);
-    }
+  if (deferred != NULL) {
+    deferred->processor = std::move(processor);
+    deferred->extractor = std::move(extractor);
+  }
+}
 
-    blaze_util::SyncFile(it);
+// Starts extracting the files left to 'deferred' into the installation, now
+// that it is in place, and marks it complete when done.
+static void StartDeferredExtraction(DeferredExtraction *deferred) {
+  const string install_base = globals->options->install_base;
+  const string embedded_binaries = GetEmbeddedBinariesRoot(install_base);
+  deferred->processor->Relocate(embedded_binaries);
+  deferred->thread = std::thread([deferred, install_base, embedded_binaries]() {
+    deferred->processor->ExtractFiles(ExtractionThreads());
+    SyncEmbeddedBinaries(embedded_binaries);
+    MarkExtractionComplete(install_base);
+  });
+}
 
-    string directory = blaze_util::Dirname(extracted_path);
+// Waits for the extraction started by StartDeferredExtraction(), if any. The
+// client must not exit before, or the installation is left incomplete until
+// the next client completes it.
+static void WaitForDeferredExtraction() {
+  if (deferred_extraction == NULL) {
+    return;
+  }
+  deferred_extraction->thread.join();
+  delete deferred_extraction;
+  deferred_extraction = NULL;
+}
 
-    // Now walk up until embedded_binaries and sync every directory in between.
-    // synced_directories is used to avoid syncing the same directory twice.
-    // The !directory.empty() and directory != "/" conditions are not strictly
-    // needed, but it makes this loop more robust, because otherwise, if due to
-    // some glitch, directory was not under embedded_binaries, it would get
-    // into an infinite loop.
-    while (directory != embedded_binaries &&
-           synced_directories.count(directory) == 0 &&
-           !directory.empty() &&
-           directory != "/") {
-      blaze_util::SyncFile(directory);
-      synced_directories.insert(directory);
-      directory = blaze_util::Dirname(directory);
+// Dies unless the file at 'path' of the installation is in place and was not
+// modified since it was extracted.
+static void VerifyInstalledFile(const string &path, time_t time_now) {
+  // Check that the file exists and is readable.
+  if (!blaze_util::CanAccess(path, true, false, false)) {
+    die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+        "Error: corrupt installation: file '%s' missing."
+        " Please remove '%s' and try again.",
+        path.c_str(), globals->options->install_base.c_str());
+  }
+  // Check that the timestamp is in the future. A past timestamp would
+  // indicate that the file has been tampered with.
+  // See ActuallyExtractData().
+  if (!blaze_util::IsDirectory(path)) {
+    time_t mtime = blaze_util::GetMtimeMillisec(path);
+    if (mtime == -1) {
+      die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+          "Error: could not retrieve mtime of file '%s'. "
+          "Please remove '%s' and try again.",
+          path.c_str(), globals->options->install_base.c_str());
+    } else if (mtime <= time_now) {
+      die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+          "Error: corrupt installation: file '%s' "
+          "modified.  Please remove '%s' and try again.",
+          path.c_str(), globals->options->install_base.c_str());
     }
   }
-
-  blaze_util::SyncFile(embedded_binaries);
 }
 
 // Installs Blaze by extracting the embedded data files, iff necessary.
@@ -895,6 +1538,9 @@ static void ActuallyExtractData(const string &argv0,
 // it is in place. Concurrency during extraction is handled by
 // extracting in a tmp dir and then renaming it into place where it
 // becomes visible automically at the new path.
+// With --experimental_lazy_install_base, only the files the server needs to
+// start up are extracted before the rename, the others are extracted in the
+// background afterwards, see StartDeferredExtraction().
 // Populates globals->extracted_binaries with their extracted locations.
 static void ExtractData(const string &self_path) {
   // If the install dir doesn't exist, create it, if it does, we know it's good.
@@ -904,7 +1550,15 @@ static void ExtractData(const string &self_path) {
     string tmp_install = globals->options->install_base + ".tmp." +
                          blaze::GetProcessIdAsString();
     string tmp_binaries = tmp_install + "/_embedded_binaries";
-    ActuallyExtractData(self_path, tmp_binaries);
+    // In batch mode, the client is replaced by the server (and its threads
+    // with it) as soon as the extraction returns.
+    if (globals->options->lazy_install_base && !globals->options->batch) {
+      deferred_extraction = new DeferredExtraction();
+    }
+    ActuallyExtractData(self_path, tmp_binaries, false, deferred_extraction);
+    if (deferred_extraction == NULL) {
+      MarkExtractionComplete(tmp_install);
+    }
 
     uint64_t et = GetMillisecondsMonotonic();
     globals->extract_data_time = et - st;
@@ -918,6 +1572,9 @@ static void ExtractData(const string &self_path) {
            "install base directory '%s' could not be renamed into place",
            tmp_install.c_str());
     }
+    if (deferred_extraction != NULL) {
+      StartDeferredExtraction(deferred_extraction);
+    }
   } else {
     if (!blaze_util::IsDirectory(globals->options->install_base)) {
       die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
@@ -926,36 +1583,36 @@ static void ExtractData(const string &self_path) {
           globals->options->install_base.c_str());
     }
 
+    // The client that extracted the installation lazily either died before it
+    // was done or still is at it. Either way, extract what may be missing.
+    vector<string> installed_binaries;
+    if (!ReadExtractionCompleteMarker(globals->options->install_base,
+                                      &installed_binaries)) {
+      ActuallyExtractData(
+          self_path, GetEmbeddedBinariesRoot(globals->options->install_base),
+          true, NULL);
+      MarkExtractionComplete(globals->options->install_base);
+    }
+
+    // Checking every embedded binary would take hundreds of system calls on
+    // every invocation. The marker is written last, with the same futuristic
+    // mtime, so it stands for the installation as a whole, and the server jar
+    // and a few binaries, different ones on each run, are checked on top.
     const time_t time_now = time(NULL);
-    string real_install_dir = blaze_util::JoinPath(
-        globals->options->install_base,
-        "_embedded_binaries");
-    for (const auto& it : globals->extracted_binaries) {
-      string path = blaze_util::JoinPath(real_install_dir, it);
-      // Check that the file exists and is readable.
-      if (!blaze_util::CanAccess(path, true, false, false)) {
-        die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-            "Error: corrupt installation: file '%s' missing."
-            " Please remove '%s' and try again.",
-            path.c_str(), globals->options->install_base.c_str());
-      }
-      // Check that the timestamp is in the future. A past timestamp would
-      // indicate that the file has been tampered with.
-      // See ActuallyExtractData().
-      if (!blaze_util::IsDirectory(path)) {
-        time_t mtime = blaze_util::GetMtimeMillisec(path);
-        if (mtime == -1) {
-          die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-              "Error: could not retrieve mtime of file '%s'. "
-              "Please remove '%s' and try again.",
-              path.c_str(), globals->options->install_base.c_str());
-        } else if (mtime <= time_now) {
-          die(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
-              "Error: corrupt installation: file '%s' "
-              "modified.  Please remove '%s' and try again.",
-              path.c_str(), globals->options->install_base.c_str());
-        }
-      }
+    VerifyInstalledFile(
+        GetExtractionCompleteMarker(globals->options->install_base), time_now);
+    string real_install_dir =
+        GetEmbeddedBinariesRoot(globals->options->install_base);
+    const vector<string> &binaries = globals->extracted_binaries;
+    VerifyInstalledFile(blaze_util::JoinPath(real_install_dir, binaries[0]),
+                        time_now);
+    const size_t kSampledBinaries = 4;
+    size_t first = static_cast<size_t>(time_now) % binaries.size();
+    for (size_t i = 0; i < std::min(kSampledBinaries, binaries.size()); i++) {
+      VerifyInstalledFile(
+          blaze_util::JoinPath(real_install_dir,
+                               binaries[(first + i) % binaries.size()]),
+          time_now);
     }
   }
 }
@@ -963,11 +1620,20 @@ static void ExtractData(const string &self_path) {
 const char *volatile_startup_options[] = {
   "--option_sources=",
   "--max_idle_secs=",
+  "--experimental_idle_trim_secs=",
   "--connect_timeout_secs=",
   "--client_debug=",
   NULL,
 };
 
+// Returns whether the JVM argument selects the class archive. The server
+// dumps it at exit if it was not there when the server started, so the
+// argument changes between two starts without the server needing a restart.
+static bool IsClassArchiveArgument(const string &arg) {
+  return arg.compare(0, 22, "-XX:SharedArchiveFile=") == 0 ||
+         arg.compare(0, 25, "-XX:ArchiveClassesAtExit=") == 0;
+}
+
 // Returns true if the server needs to be restarted to accommodate changes
 // between the two argument lists.
 static bool ServerNeedsToBeKilled(const vector<string>& args1,
@@ -994,6 +1660,10 @@ static bool ServerNeedsToBeKilled(const vector<string>& args1,
       }
     }
 
+    if (IsClassArchiveArgument(args1[i]) && IsClassArchiveArgument(args2[i])) {
+      option_volatile = true;
+    }
+
     if (!option_volatile && args1[i] != args2[i]) {
       return true;
     }
@@ -1059,7 +1729,8 @@ static void EnsureCorrectRunningVersion(BlazeServer* server) {
            installation_path.c_str());
     }
     const time_t time_now = time(NULL);
-    if (!blaze_util::SetMtimeMillisec(globals->options->install_base,
+    if (!shared_install_base &&
+        !blaze_util::SetMtimeMillisec(globals->options->install_base,
                                       time_now)) {
       pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
            "failed to set timestamp on '%s'",
@@ -1128,7 +1799,9 @@ static void handler(int signum) {
 
 // Performs all I/O for a single client request to the server, and
 // shuts down the client (by exit or signal).
-static ATTRIBUTE_NORETURN void SendServerRequest(BlazeServer* server) {
+// Connects to the server, starting it if needed, and makes sure it runs in
+// the workspace.
+static void EnsureConnected(BlazeServer* server) {
   while (true) {
     if (!server->Connected()) {
       StartServerAndConnect(server);
@@ -1168,6 +1841,19 @@ static ATTRIBUTE_NORETURN void SendServerRequest(BlazeServer* server) {
   if (VerboseLogging()) {
     fprintf(stderr, "Connected (server pid=%d).\n", globals->server_pid);
   }
+}
+
+static ATTRIBUTE_NORETURN void SendServerRequest(BlazeServer* server) {
+  {
+    StartupPhaseTimer timer("connecting to the server");
+    EnsureConnected(server);
+  }
+
+  {
+    // The server waits for the installation to be complete before it uses it.
+    StartupPhaseTimer timer("waiting for the install base");
+    WaitForDeferredExtraction();
+  }
 
   // Wall clock time since process startup.
   globals->startup_time = GetMillisecondsSinceProcessStart();
@@ -1177,12 +1863,27 @@ static ATTRIBUTE_NORETURN void SendServerRequest(BlazeServer* server) {
   sigemptyset(&sigset);
   sigprocmask(SIG_SETMASK, &sigset, NULL);
 
-  signal(SIGINT,  handler);
-  signal(SIGTERM, handler);
-  signal(SIGPIPE, handler);
-  signal(SIGQUIT, handler);
+  unsigned int exit_code;
+  while (true) {
+    signal(SIGINT,  handler);
+    signal(SIGTERM, handler);
+    signal(SIGPIPE, handler);
+    signal(SIGQUIT, handler);
+
+    if (server->Communicate(&exit_code)) {
+      break;
+    }
+
+    // The server that Main() connected to without pinging it is gone, or
+    // another one listens on its port now, and did not run the command. Connect the slow way, possibly starting a new server, with the
+    // signals handled as they are until then, and send the command again.
+    signal(SIGINT,  SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    EnsureConnected(server);
+  }
 
-  int exit_code = server->Communicate();
   if (globals->received_signal) {
     // Kill ourselves with the same signal, so that callers see the
     // right WTERMSIG value.
@@ -1194,6 +1895,64 @@ static ATTRIBUTE_NORETURN void SendServerRequest(BlazeServer* server) {
   }
 }
 
+// Connects to the server, starting it if needed, and has it load the packages
+// of the targets of "warmup" the way "build" would.
+static ATTRIBUTE_NORETURN void SendWarmupRequest(BlazeServer* server) {
+  {
+    StartupPhaseTimer timer("connecting to the server");
+    EnsureConnected(server);
+  }
+
+  {
+    StartupPhaseTimer timer("waiting for the install base");
+    WaitForDeferredExtraction();
+  }
+
+  if (!server->Warmup()) {
+    // As in SendServerRequest(), the server that Main() connected to without
+    // pinging it did not take the request.
+    EnsureConnected(server);
+    if (!server->Warmup()) {
+      exit(blaze_exit_code::INTERNAL_ERROR);
+    }
+  }
+  exit(blaze_exit_code::SUCCESS);
+}
+
+// Has a running server shrink its heap, e.g. from a cron job on a machine
+// shared by the servers of many workspaces. Does not start a server.
+static ATTRIBUTE_NORETURN void SendTrimMemoryRequest(BlazeServer* server) {
+  if (server->Connected() && server->TrimMemory()) {
+    exit(blaze_exit_code::SUCCESS);
+  }
+  if (server->Connect() && !server->TrimMemory()) {
+    exit(blaze_exit_code::INTERNAL_ERROR);
+  }
+  exit(blaze_exit_code::SUCCESS);
+}
+
+// Goes on in a process of its own, detached from the terminal, so that
+// "warmup" returns right away, e.g. in a shell startup file or an IDE.
+static void ContinueInBackground() {
+  pid_t child = fork();
+  if (child < 0) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR, "fork() failed");
+  } else if (child > 0) {
+    exit(blaze_exit_code::SUCCESS);
+  }
+  setsid();
+
+  int devnull = open("/dev/null", O_RDWR);
+  if (devnull >= 0) {
+    dup2(devnull, STDIN_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    if (!globals->options->client_debug) {
+      dup2(devnull, STDERR_FILENO);
+    }
+    close(devnull);
+  }
+}
+
 // Parse the options, storing parsed values in globals.
 static void ParseOptions(int argc, const char *argv[]) {
   string error;
@@ -1225,6 +1984,91 @@ static void ComputeWorkspace() {
   globals->workspace = WorkspaceLayout::GetWorkspace(globals->cwd);
 }
 
+// With --experimental_shared_install_root, uses the installation of this
+// release there rather than extracting one in the output user root, if it is
+// complete and only root can change it, so that it is as trustworthy as one
+// the client extracted itself. Root puts it there by running the release with
+// --install_base=<root>/<install_base_key>. The client never writes to it: a
+// server started from it dumps no class archive, and it is not touched to mark
+// it as used.
+static void UseSharedInstallBase() {
+  StartupOptions *options = globals->options;
+  if (options->shared_install_root.empty()) {
+    return;
+  }
+  string shared = blaze_util::JoinPath(options->shared_install_root,
+                                       globals->install_md5);
+  if (!blaze_util::PathExists(shared)) {
+    debug_log("No shared install base '%s'", shared.c_str());
+    return;
+  }
+  string error;
+  vector<string> binaries;
+  if (!IsOwnedByRoot(shared, &error) ||
+      (blaze_util::PathExists(GetExtractionCompleteMarker(shared)) &&
+       !IsFileOwnedByRoot(GetExtractionCompleteMarker(shared), &error))) {
+    fprintf(stderr,
+            "WARNING: Not using the shared install base '%s': %s.\n",
+            shared.c_str(), error.c_str());
+    return;
+  }
+  if (!ReadExtractionCompleteMarker(shared, &binaries)) {
+    fprintf(stderr,
+            "WARNING: Not using the shared install base '%s': it is not "
+            "complete.\n",
+            shared.c_str());
+    return;
+  }
+  // A file or directory inside that another user can change could be swapped
+  // for one of theirs, so every binary and the directories between it and the
+  // install base are checked too. This is only done for the shared install
+  // base, where it is worth its few hundred system calls.
+  string binaries_root = GetEmbeddedBinariesRoot(shared);
+  set<string> entries;
+  for (const string &binary : binaries) {
+    for (string entry = blaze_util::JoinPath(binaries_root, binary);
+         entry != shared && entries.insert(entry).second;
+         entry = blaze_util::Dirname(entry)) {
+    }
+  }
+  for (const string &entry : entries) {
+    if (!IsFileOwnedByRoot(entry, &error)) {
+      fprintf(stderr,
+              "WARNING: Not using the shared install base '%s': %s.\n",
+              shared.c_str(), error.c_str());
+      return;
+    }
+  }
+  debug_log("Using the shared install base '%s'", shared.c_str());
+  options->install_base = shared;
+  globals->extracted_binaries = binaries;
+  shared_install_base = true;
+}
+
+// With --experimental_output_base_template, creates the output base, which does
+// not exist yet, as a clone of the template, so that a new workspace or CI job
+// starts with the external repositories and outputs of an earlier build rather
+// than fetching and building everything again. Where files cannot be cloned,
+// copying them would take as long as that, so the output base starts empty.
+// Returns true if the output base was created.
+static bool SeedOutputBase() {
+  StartupOptions *options = globals->options;
+  if (options->output_base_template.empty()) {
+    return false;
+  }
+  string error;
+  if (!CloneOutputBase(options->output_base_template, options->output_base,
+                       &error)) {
+    fprintf(stderr,
+            "WARNING: Not cloning the output base from '%s': %s.\n",
+            options->output_base_template.c_str(), error.c_str());
+    return false;
+  }
+  debug_log("Cloned the output base from '%s'",
+            options->output_base_template.c_str());
+  return true;
+}
+
 // Figure out the base directories based on embedded data, username, cwd, etc.
 // Sets globals->options->install_base, globals->options->output_base,
 // globals->lockfile, globals->jvm_log_file.
@@ -1242,20 +2086,42 @@ static void ComputeBaseDirectories(const string &self_path) {
     string install_user_root = globals->options->output_user_root + "/install";
     globals->options->install_base =
         GetInstallBase(install_user_root, self_path);
+    UseSharedInstallBase();
   } else {
-    // We call GetInstallBase anyway to populate extracted_binaries and
-    // install_md5.
+    // We call GetInstallBase anyway to populate install_md5.
     GetInstallBase("", self_path);
   }
 
-  if (globals->options->output_base.empty()) {
+  // A complete installation lists the embedded binaries, which is much
+  // cheaper than going through the zip.
+  if (globals->extracted_binaries.empty() &&
+      !ReadExtractionCompleteMarker(globals->options->install_base,
+                                    &globals->extracted_binaries)) {
+    ScanBlazeZip(self_path);
+  }
+
+  // Only an output base of the workspace is cloned from the template, not one
+  // given with --output_base.
+  bool hashed_output_base = globals->options->output_base.empty();
+  if (hashed_output_base) {
+    string key = globals->workspace;
+    if (globals->options->output_base_per_startup_options &&
+        !globals->options->server_startup_args.empty()) {
+      // A server for a set of startup options stays around (until
+      // --max_idle_secs) while another set is used in its own output base.
+      string startup_args;
+      blaze_util::JoinStrings(globals->options->server_startup_args, '\n',
+                              &startup_args);
+      key += "\n" + startup_args;
+    }
     globals->options->output_base = blaze::GetHashedBaseDir(
-        globals->options->output_user_root, globals->workspace);
+        globals->options->output_user_root, key);
   }
 
   const char *output_base = globals->options->output_base.c_str();
   if (!blaze_util::PathExists(globals->options->output_base)) {
-    if (!MakeDirectories(globals->options->output_base, 0777)) {
+    if (!(hashed_output_base && SeedOutputBase()) &&
+        !MakeDirectories(globals->options->output_base, 0777)) {
       pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
            "Output base directory '%s' could not be created",
            output_base);
@@ -1274,6 +2140,7 @@ static void ComputeBaseDirectories(const string &self_path) {
         output_base);
   }
   ExcludePathFromBackup(output_base);
+  ExcludePathFromIndexing(output_base);
 
   globals->options->output_base = MakeCanonical(output_base);
 
@@ -1281,6 +2148,71 @@ static void ComputeBaseDirectories(const string &self_path) {
   globals->jvm_log_file = globals->options->output_base + "/server/jvm.out";
 }
 
+// Output bases in a local output user root that have not been used for this
+// long are deleted, since a scratch volume is shared and its space is limited.
+static const int kStaleOutputBaseSecs = 30 * 24 * 3600;
+
+// With --experimental_local_output_user_root, moves the default output user
+// root there if it is on a network file system, where the output bases are
+// slow to work with. As home directories on NFS are shared between machines,
+// nothing is left behind to point at the local one. Returns true if the output
+// user root was moved, and has been created.
+static bool UseLocalOutputUserRoot() {
+  StartupOptions *options = globals->options;
+  if (options->local_output_user_root.empty() ||
+      options->option_sources.count("output_user_root") > 0) {
+    return false;
+  }
+  // The output user root need not exist yet.
+  string existing = options->output_user_root;
+  while (!blaze_util::PathExists(existing) && existing != "/") {
+    existing = blaze_util::Dirname(existing);
+  }
+  if (!IsNetworkFilesystem(existing)) {
+    return false;
+  }
+  string root = blaze_util::JoinPath(options->local_output_user_root,
+                                     blaze_util::Basename(
+                                         options->output_user_root));
+  string error;
+  if (!CreateLocalOutputRoot(options->local_output_user_root, root, &error)) {
+    fprintf(stderr,
+            "WARNING: Output user root '%s' is on a network file system, "
+            "but cannot be moved to --experimental_local_output_user_root: "
+            "%s.\n",
+            options->output_user_root.c_str(), error.c_str());
+    return false;
+  }
+  debug_log("Output user root '%s' is on a network file system, using '%s'",
+            options->output_user_root.c_str(), root.c_str());
+  options->output_user_root = root;
+  return true;
+}
+
+// With --experimental_output_user_root_volume, puts the default output user
+// root on that volume. Spotlight leaves a volume alone reliably, as opposed
+// to a directory, and a case-sensitive one matches what builds expect.
+static void UseOutputUserRootVolume() {
+  StartupOptions *options = globals->options;
+  if (options->output_user_root_volume.empty() ||
+      options->option_sources.count("output_user_root") > 0) {
+    return;
+  }
+  string mount_point;
+  string error;
+  if (!MountOutputVolume(options->output_user_root_volume, &mount_point,
+                         &error)) {
+    fprintf(stderr,
+            "WARNING: Cannot put the output user root on the volume '%s': "
+            "%s\n",
+            options->output_user_root_volume.c_str(), error.c_str());
+    return;
+  }
+  options->output_user_root = blaze_util::JoinPath(
+      mount_point, blaze_util::Basename(options->output_user_root));
+  debug_log("Using output user root '%s'", options->output_user_root.c_str());
+}
+
 static void CheckEnvironment() {
   if (!blaze::GetEnv("http_proxy").empty()) {
     fprintf(stderr, "Warning: ignoring http_proxy in environment.\n");
@@ -1368,34 +2300,74 @@ int Main(int argc, const char *argv[], OptionProcessor *option_processor,
   // Must be done before command line parsing.
   ComputeWorkspace();
   CheckBinaryPath(argv[0]);
-  ParseOptions(argc, argv);
+  {
+    StartupPhaseTimer timer("parsing options and rc files");
+    ParseOptions(argc, argv);
+  }
 
   debug_log("Debug logging active");
 
+  bool warmup = globals->option_processor->GetCommand() == "warmup";
+  if (warmup) {
+    if (globals->options->batch) {
+      die(blaze_exit_code::BAD_ARGV,
+          "'warmup' needs a server and does not work with --batch");
+    }
+    // Before taking the server lock, which another client may hold for long.
+    ContinueInBackground();
+  }
+
   CheckEnvironment();
-  blaze::CreateSecureOutputRoot(globals->options->output_user_root);
+  bool local_output_user_root = UseLocalOutputUserRoot();
+  if (!local_output_user_root) {
+    UseOutputUserRootVolume();
+    blaze::CreateSecureOutputRoot(globals->options->output_user_root);
+  }
 
   const string self_path = GetSelfPath();
   ComputeBaseDirectories(self_path);
+  if (local_output_user_root) {
+    DeleteStaleOutputBases(globals->options->output_user_root,
+                           globals->options->output_base,
+                           kStaleOutputBaseSecs);
+  }
+  StartJvmVersionProbe();
 
   blaze_server = static_cast<BlazeServer *>(new GrpcBlazeServer(
       globals->options->connect_timeout_secs));
 
-  globals->command_wait_time = blaze_server->AcquireLock();
+  {
+    StartupPhaseTimer timer("waiting for the server lock");
+    globals->command_wait_time = blaze_server->AcquireLock();
+  }
 
   WarnFilesystemType(globals->options->output_base);
 
-  ExtractData(self_path);
+  {
+    StartupPhaseTimer timer("checking the install base");
+    ExtractData(self_path);
+  }
   VerifyJavaVersionAndSetJvm();
 
-  blaze_server->Connect();
-  EnsureCorrectRunningVersion(blaze_server);
-  KillRunningServerIfDifferentStartupOptions(blaze_server);
+  {
+    StartupPhaseTimer timer("checking the running server");
+    blaze_server->ConnectOptimistically();
+    EnsureCorrectRunningVersion(blaze_server);
+    // In batch mode, StartStandalone() kills any server that still runs, as
+    // its startup options cannot match, so they are not compared.
+    if (!globals->options->batch) {
+      KillRunningServerIfDifferentStartupOptions(blaze_server);
+    }
+  }
 
   if (globals->options->batch) {
     SetScheduling(globals->options->batch_cpu_scheduling,
                   globals->options->io_nice_level);
     StartStandalone(blaze_server);
+  } else if (warmup) {
+    SendWarmupRequest(blaze_server);
+  } else if (globals->option_processor->GetCommand() == "trim-memory") {
+    SendTrimMemoryRequest(blaze_server);
   } else {
     SendServerRequest(blaze_server);
   }
@@ -1408,6 +2380,7 @@ static void null_grpc_log_function(gpr_log_func_args *args) {
 GrpcBlazeServer::GrpcBlazeServer(int connect_timeout_secs) {
   connected_ = false;
   connect_timeout_secs_ = connect_timeout_secs;
+  verified_ = false;
 
   gpr_set_log_function(null_grpc_log_function);
 
@@ -1423,38 +2396,41 @@ GrpcBlazeServer::~GrpcBlazeServer() {
 }
 
 bool GrpcBlazeServer::Connect() {
-  assert(!connected_);
-
-  std::string server_dir = globals->options->output_base + "/server";
-  std::string port;
-  std::string ipv4_prefix = "127.0.0.1:";
-  std::string ipv6_prefix_1 = "[0:0:0:0:0:0:0:1]:";
-  std::string ipv6_prefix_2 = "[::1]:";
-
-  if (!ReadFile(server_dir + "/command_port", &port)) {
-    return false;
-  }
+  return Connect(true);
+}
 
-  // Make sure that we are being directed to localhost
-  if (port.compare(0, ipv4_prefix.size(), ipv4_prefix)
-      && port.compare(0, ipv6_prefix_1.size(), ipv6_prefix_1)
-      && port.compare(0, ipv6_prefix_2.size(), ipv6_prefix_2)) {
-    return false;
-  }
+bool GrpcBlazeServer::ConnectOptimistically() {
+  return Connect(false);
+}
 
-  if (!ReadFile(server_dir + "/request_cookie", &request_cookie_)) {
-    return false;
-  }
+bool GrpcBlazeServer::Connect(bool ping) {
+  assert(!connected_);
 
-  if (!ReadFile(server_dir + "/response_cookie", &response_cookie_)) {
+  std::string server_dir = globals->options->output_base + "/server";
+  ServerAddress address;
+  if (!ReadServerAddress(globals->options->output_base, &address)) {
     return false;
   }
+  request_cookie_ = address.request_cookie;
+  response_cookie_ = address.response_cookie;
 
   std::shared_ptr<grpc::Channel> channel(grpc::CreateChannel(
-      port, grpc::InsecureChannelCredentials()));
+      address.target, grpc::InsecureChannelCredentials()));
   std::unique_ptr<command_server::CommandServer::Stub> client(
       command_server::CommandServer::NewStub(channel));
 
+  if (!ping) {
+    // A server that exited cleanly took its PID file with it.
+    globals->server_pid = GetServerPid(server_dir);
+    if (globals->server_pid <= 0) {
+      return false;
+    }
+    this->client_ = std::move(client);
+    verified_ = false;
+    connected_ = true;
+    return true;
+  }
+
   grpc::ClientContext context;
   context.set_deadline(
       std::chrono::system_clock::now() +
@@ -1482,6 +2458,7 @@ bool GrpcBlazeServer::Connect() {
   }
 
   this->client_ = std::move(client);
+  verified_ = true;
   connected_ = true;
   return true;
 }
@@ -1581,6 +2558,15 @@ void GrpcBlazeServer::KillRunningServer() {
   assert(connected_);
   assert(globals->server_pid > 0);
 
+  if (!verified_) {
+    // The server may not be there to shut down: see whether it answers a
+    // ping. If it does not, StartServerAndConnect() kills it.
+    Disconnect();
+    if (!Connect()) {
+      return;
+    }
+  }
+
   grpc::ClientContext context;
   command_server::RunRequest request;
   command_server::RunResponse response;
@@ -1603,7 +2589,67 @@ void GrpcBlazeServer::KillRunningServer() {
   connected_ = false;
 }
 
-unsigned int GrpcBlazeServer::Communicate() {
+// Reads the first response of a command sent over a connection made by
+// ConnectOptimistically(), which shows whether the server it was meant for
+// received it. The server answers right away, with the command id or with an
+// error for a wrong cookie; one that does not answer within the time given to
+// a ping is cancelled.
+//
+// Only a server that was not there (UNAVAILABLE) or that rejected the cookie
+// provably did not run the command. In any other case the server may have
+// started it, and sending it again could run it twice; the server does not run
+// a command whose id it could not send, but it may have sent it already.
+GrpcBlazeServer::FirstResponse GrpcBlazeServer::ReadFirstResponse(
+    grpc::ClientContext *context,
+    grpc::ClientReader<command_server::RunResponse> *reader,
+    command_server::RunResponse *response) {
+  std::mutex mutex;
+  std::condition_variable answered_condition;
+  bool answered = false;
+  bool cancelled = false;
+  std::thread watchdog([&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!answered_condition.wait_for(
+            lock, std::chrono::seconds(connect_timeout_secs_),
+            [&answered]() { return answered; })) {
+      cancelled = true;
+      context->TryCancel();
+    }
+  });
+  bool ok = reader->Read(response);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    answered = true;
+  }
+  answered_condition.notify_one();
+  watchdog.join();
+
+  if (cancelled) {
+    fprintf(stderr,
+            "\nServer did not answer within %d seconds, cancelled the "
+            "command\n",
+            connect_timeout_secs_);
+    return UNKNOWN;
+  }
+  if (ok) {
+    if (response->cookie() == response_cookie_) {
+      return ACCEPTED;
+    }
+    // Not the server the cookies in the server directory are for.
+    debug_log("Server rejected the command, reconnecting");
+    return NOT_RECEIVED;
+  }
+  grpc::Status status = reader->Finish();
+  if (status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+    debug_log("Server is not there, reconnecting");
+    return NOT_RECEIVED;
+  }
+  fprintf(stderr, "\nServer did not answer the command: %s\n",
+          status.error_message().c_str());
+  return UNKNOWN;
+}
+
+bool GrpcBlazeServer::Communicate(unsigned int *exit_code) {
   assert(connected_);
 
   vector<string> arg_vector;
@@ -1619,6 +2665,11 @@ unsigned int GrpcBlazeServer::Communicate() {
   request.set_cookie(request_cookie_);
   request.set_block_for_lock(globals->options->block_for_lock);
   request.set_client_description("pid=" + blaze::GetProcessIdAsString());
+  if (globals->options->direct_stdout) {
+    // Large outputs then do not have to go through this process.
+    request.set_stdout_path(blaze::GetOutputPipePath(STDOUT_FILENO));
+  }
+  request.set_client_can_exec(blaze::CanExecuteProgramWithEnvironment());
   for (const string& arg : arg_vector) {
     request.add_arg(arg);
   }
@@ -1628,6 +2679,24 @@ unsigned int GrpcBlazeServer::Communicate() {
   std::unique_ptr<grpc::ClientReader<command_server::RunResponse>> reader(
       client_->Run(&context, request));
 
+  bool have_response = false;
+  if (!verified_) {
+    switch (ReadFirstResponse(&context, reader.get(), &response)) {
+      case ACCEPTED:
+        break;
+      case NOT_RECEIVED:
+        // Keep the server lock: the slow way may have to start a new server.
+        reader.reset();
+        Disconnect();
+        return false;
+      case UNKNOWN:
+        *exit_code = blaze_exit_code::INTERNAL_ERROR;
+        return true;
+    }
+    verified_ = true;
+    have_response = true;
+  }
+
   // Release the server lock because the gRPC handles concurrent clients just
   // fine. Note that this may result in two "waiting for other client" messages
   // (one during server startup and one emitted by the server)
@@ -1636,30 +2705,25 @@ unsigned int GrpcBlazeServer::Communicate() {
   std::thread cancel_thread(&GrpcBlazeServer::CancelThread, this);
   bool command_id_set = false;
   bool pipe_broken = false;
-  while (reader->Read(&response)) {
+  std::unique_ptr<OutputRelay> output(new OutputRelay());
+  while (have_response || reader->Read(&response)) {
+    have_response = false;
     if (response.cookie() != response_cookie_) {
+      output.reset();
       fprintf(stderr, "\nServer response cookie invalid, exiting\n");
-      return blaze_exit_code::INTERNAL_ERROR;
+      *exit_code = blaze_exit_code::INTERNAL_ERROR;
+      return true;
     }
 
-    bool pipe_broken_now = false;
     if (response.standard_output().size() > 0) {
-      int result = write(STDOUT_FILENO, response.standard_output().c_str(),
-                         response.standard_output().size());
-      if (result < 0 && errno == EPIPE) {
-        pipe_broken_now = true;
-      }
+      output->Write(STDOUT_FILENO, response.standard_output());
     }
 
     if (response.standard_error().size() > 0) {
-      int result = write(STDERR_FILENO, response.standard_error().c_str(),
-                         response.standard_error().size());
-      if (result < 0 && errno == EPIPE) {
-        pipe_broken_now = true;
-      }
+      output->Write(STDERR_FILENO, response.standard_error());
     }
 
-    if (pipe_broken_now && !pipe_broken) {
+    if (output->PipeBroken() && !pipe_broken) {
       pipe_broken = true;
       Cancel();
     }
@@ -1672,15 +2736,96 @@ unsigned int GrpcBlazeServer::Communicate() {
     }
   }
 
+  // The output is complete before the client prints anything else or exits.
+  output.reset();
+
   SendAction(CancelThreadAction::JOIN);
   cancel_thread.join();
 
   if (!response.finished()) {
     fprintf(stderr, "\nServer finished RPC without an explicit exit code\n\n");
-    return GetExitCodeForAbruptExit(*globals);
+    *exit_code = GetExitCodeForAbruptExit(*globals);
+    return true;
+  }
+
+  *exit_code = response.exit_code();
+  if (*exit_code == 0 && response.exec_request().argv_size() > 0 &&
+      globals->received_signal == 0) {
+    // E.g. "bazel run": run the binary in place of this process, so that it
+    // has the terminal, the standard input and the signals of the client.
+    const command_server::ExecRequest& exec_request = response.exec_request();
+    vector<string> argv(exec_request.argv().begin(),
+                        exec_request.argv().end());
+    vector<string> env;
+    for (const auto& variable : exec_request.environment_variable()) {
+      env.push_back(variable.name() + "=" + variable.value());
+    }
+    reader.reset();
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    blaze::ExecuteProgramWithEnvironment(exec_request.working_directory(),
+                                         argv, env);
+  }
+  return true;
+}
+
+bool GrpcBlazeServer::Warmup() {
+  assert(connected_);
+
+  // The packages are loaded as "build" loads them, with the options the rc
+  // files give "build", so that the next build finds them in Skyframe.
+  vector<string> arg_vector;
+  arg_vector.push_back("build");
+  AddLoggingArgs(&arg_vector);
+  arg_vector.push_back("--nobuild");
+  globals->option_processor->GetCommandArguments(&arg_vector);
+
+  command_server::WarmupRequest request;
+  request.set_cookie(request_cookie_);
+  request.set_client_description("pid=" + blaze::GetProcessIdAsString());
+  for (const string& arg : arg_vector) {
+    request.add_arg(arg);
+  }
+
+  grpc::ClientContext context;
+  context.set_deadline(
+      std::chrono::system_clock::now() +
+      std::chrono::seconds(connect_timeout_secs_));
+  command_server::WarmupResponse response;
+  grpc::Status status = client_->Warmup(&context, request, &response);
+  if (!status.ok() || response.cookie() != response_cookie_) {
+    debug_log("Server did not accept the warmup request: %s",
+        status.error_message().c_str());
+    Disconnect();
+    return false;
+  }
+
+  blaze::ReleaseLock(&blaze_lock_);
+  return true;
+}
+
+bool GrpcBlazeServer::TrimMemory() {
+  assert(connected_);
+
+  grpc::ClientContext context;
+  context.set_deadline(
+      std::chrono::system_clock::now() +
+      std::chrono::seconds(connect_timeout_secs_));
+  command_server::TrimMemoryRequest request;
+  command_server::TrimMemoryResponse response;
+  request.set_cookie(request_cookie_);
+  grpc::Status status = client_->TrimMemory(&context, request, &response);
+  if (!status.ok() || response.cookie() != response_cookie_) {
+    debug_log("Server did not accept the request to trim its memory: %s",
+        status.error_message().c_str());
+    Disconnect();
+    return false;
   }
 
-  return response.exit_code();
+  blaze::ReleaseLock(&blaze_lock_);
+  return true;
 }
 
 void GrpcBlazeServer::Disconnect() {
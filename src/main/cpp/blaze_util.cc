@@ -25,9 +25,11 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <sstream>
 
 #include "src/main/cpp/blaze_util_platform.h"
@@ -115,6 +117,11 @@ bool WriteFile(const string &content, const string &filename) {
 }
 
 bool WriteFile(const void *data, size_t size, const std::string &filename) {
+  return WriteFile(data, size, filename, -1);
+}
+
+bool WriteFile(const void *data, size_t size, const std::string &filename,
+               time_t mtime) {
   UnlinkPath(filename);  // We don't care about the success of this.
   int fd = open(filename.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0755);  // chmod +x
   if (fd == -1) {
@@ -124,6 +131,13 @@ bool WriteFile(const void *data, size_t size, const std::string &filename) {
   if (r == -1) {
     return false;
   }
+  if (mtime != -1) {
+    struct timeval times[2] = {{mtime, 0}, {mtime, 0}};
+    if (futimes(fd, times) == -1) {
+      close(fd);
+      return false;
+    }
+  }
   int saved_errno = errno;
   if (close(fd)) {
     return false;  // Can fail on NFS.
@@ -237,6 +251,91 @@ string GetJvmVersion(const string &java_exe) {
   return ReadJvmVersion(version_string);
 }
 
+string DescribeFile(const string &path) {
+  struct stat buf;
+  if (stat(path.c_str(), &buf) < 0) {
+    return "";
+  }
+  return ToString(static_cast<uint64_t>(buf.st_dev)) + ":" +
+         ToString(static_cast<uint64_t>(buf.st_ino)) + ":" +
+         ToString(static_cast<uint64_t>(buf.st_size)) + ":" +
+         ToString(static_cast<uint64_t>(buf.st_mtime));
+}
+
+string GetCachedJvmVersion(const string &java_exe, const string &cache_file) {
+  string java_home = blaze_util::Dirname(blaze_util::Dirname(java_exe));
+  string key = java_exe + "\t" + DescribeFile(java_exe) + "\t" +
+               DescribeFile(blaze_util::JoinPath(java_home, "release"));
+
+  // The cache is the key and the version, each on a line of its own. A
+  // partially written cache lacks the final newline.
+  string cache;
+  if (ReadFile(cache_file, &cache)) {
+    vector<string> lines = blaze_util::Split(cache, '\n');
+    if (lines.size() == 2 && lines[0] == key && !lines[1].empty() &&
+        cache[cache.size() - 1] == '\n') {
+      return lines[1];
+    }
+  }
+
+  string version = GetJvmVersion(java_exe);
+  if (!version.empty()) {
+    // Failing to write the cache only costs running java again next time.
+    WriteFile(key + "\n" + version + "\n", cache_file);
+  }
+  return version;
+}
+
+// Returns whether one of `options` starts with `prefix` and ends with `suffix`.
+static bool HasOption(const vector<string> &options, const string &prefix,
+                      const string &suffix = "") {
+  for (const string &option : options) {
+    if (blaze_util::starts_with(option, prefix) &&
+        blaze_util::ends_with(option, suffix)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void AddMachineAwareJvmArguments(uint64_t memory, int cpus,
+                                 const vector<string> &user_options,
+                                 vector<string> *result) {
+  static const uint64_t kMiB = 1024 * 1024;
+  // Half of the memory, leaving the rest to the actions. Larger than 31 GiB,
+  // the JVM can no longer compress object pointers, so that the heap holds
+  // less than it does at 31 GiB.
+  uint64_t max_heap = std::min(memory / 2, 31 * 1024 * kMiB);
+  if (max_heap >= 512 * kMiB) {
+    // Sizes of the user are left alone, and get no size of ours next to them:
+    // the JVM refuses to start with an initial size above the maximum one.
+    if (!HasOption(user_options, "-Xmx") && !HasOption(user_options, "-Xms") &&
+        !HasOption(user_options, "-XX:MaxRAMPercentage=")) {
+      result->push_back("-Xmx" + ToString(max_heap / kMiB) + "m");
+      // Start out with a quarter of it so that the heap need not grow for
+      // small builds, without claiming all of it up front.
+      result->push_back("-Xms" + ToString(max_heap / 4 / kMiB) + "m");
+    }
+  } else {
+    max_heap = 0;
+  }
+
+  // Other options may only be combined with the collector they are for.
+  if (HasOption(user_options, "-XX:+Use", "GC")) {
+    return;
+  }
+  // The parallel collector has the highest throughput, but its full
+  // collections pause the server for seconds with a large heap.
+  if (max_heap >= 4 * 1024 * kMiB) {
+    result->push_back("-XX:+UseG1GC");
+  } else {
+    result->push_back("-XX:+UseParallelGC");
+  }
+  if (cpus > 0 && !HasOption(user_options, "-XX:ParallelGCThreads=")) {
+    result->push_back("-XX:ParallelGCThreads=" + ToString(cpus));
+  }
+}
+
 bool CheckJavaVersionIsAtLeast(const string &jvm_version,
                                const string &version_spec) {
   vector<string> jvm_version_vect = blaze_util::Split(jvm_version, '.');
@@ -287,6 +386,9 @@ uint64_t AcquireLock(const string& output_base, bool batch_mode, bool block,
   lock.l_start = 0;
   // This doesn't really matter now, but allows us to subdivide the lock
   // later if that becomes meaningful.  (Ranges beyond EOF can be locked.)
+  // Note that a client only holds the lock until it is connected to the
+  // server (see GrpcBlazeServer::Communicate()), so clients wait on each
+  // other here only in batch mode; the server serializes the commands itself.
   lock.l_len = 4096;
 
   uint64_t wait_time = 0;
@@ -62,6 +62,12 @@ bool WriteFile(const std::string &content, const std::string &filename);
 // Returns false on failure, sets errno.
 bool WriteFile(const void* data, size_t size, const std::string &filename);
 
+// Same as above, but also sets the modification time of the file to `mtime`
+// (see blaze_util::SetMtimeMillisec()) through the open file, rather than
+// looking its path up again.
+bool WriteFile(const void* data, size_t size, const std::string &filename,
+               time_t mtime);
+
 // Unlinks the file given by 'file_path'.
 // Returns true on success. In case of failure sets errno.
 bool UnlinkPath(const std::string &file_path);
@@ -103,6 +109,23 @@ std::string ReadJvmVersion(const std::string &version_string);
 // to match the good string.
 std::string GetJvmVersion(const std::string &java_exe);
 
+// Describes the file at `path` such that the description changes when the file
+// is modified or replaced. Returns the empty string if the file is missing.
+std::string DescribeFile(const std::string &path);
+
+// Like GetJvmVersion(), but remembers the version in `cache_file` and only
+// runs the java executable again once it or the release file of its JDK
+// changed, or the cache is for another executable.
+std::string GetCachedJvmVersion(const std::string &java_exe,
+                                const std::string &cache_file);
+
+// Adds JVM flags to `result` that fit the heap and the garbage collector of the
+// server to a machine with `memory` bytes (0 if unknown) and `cpus` processors
+// available, leaving out the settings that `user_options` already make.
+void AddMachineAwareJvmArguments(uint64_t memory, int cpus,
+                                 const std::vector<std::string> &user_options,
+                                 std::vector<std::string> *result);
+
 // Returns true iff jvm_version is at least the version specified by
 // version_spec.
 // jvm_version is supposed to be a string specifying a java runtime version
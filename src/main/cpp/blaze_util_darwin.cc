@@ -12,13 +12,21 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <errno.h>
+#include <fcntl.h>
 #include <libproc.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/clonefile.h>
+#include <sys/mount.h>
+#include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/sysctl.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <CoreFoundation/CoreFoundation.h>
+#include <algorithm>
 #include <cstdio>
 
 #include "src/main/cpp/blaze_util.h"
@@ -114,6 +122,20 @@ void WarnFilesystemType(const string& output_base) {
   }
 }
 
+bool IsNetworkFilesystem(const string& path) {
+  CFScopedReleaser<CFURLRef> cf_url(CFURLCreateFromFileSystemRepresentation(
+      kCFAllocatorDefault, reinterpret_cast<const UInt8 *>(path.c_str()),
+      path.length(), true));
+  CFBooleanRef cf_local = NULL;
+  if (!cf_url.isValid() ||
+      !CFURLCopyResourcePropertyForKey(cf_url, kCFURLVolumeIsLocalKey,
+                                       &cf_local, NULL)) {
+    return false;
+  }
+  CFScopedReleaser<CFBooleanRef> cf_local_releaser(cf_local);
+  return !CFBooleanGetValue(cf_local_releaser);
+}
+
 string GetSelfPath() {
   char pathbuf[PROC_PIDPATHINFO_MAXSIZE] = {};
   int len = proc_pidpath(getpid(), pathbuf, sizeof(pathbuf));
@@ -152,6 +174,41 @@ bool IsSharedLibrary(const string &filename) {
   return blaze_util::ends_with(filename, ".dylib");
 }
 
+bool SyncFileSystem(const string& path) {
+  // There is no syncfs(2).
+  return false;
+}
+
+bool CloneFile(const string& src, const string& dst) {
+  // Fails with ENOTSUP on file systems other than APFS.
+  return clonefile(src.c_str(), dst.c_str(), CLONE_NOFOLLOW) == 0;
+}
+
+string GetOutputPipePath(int fd) {
+  // /dev/fd only refers to the descriptors of the calling process.
+  return "";
+}
+
+uint64_t GetAvailableMemory() {
+  uint64_t memory;
+  size_t size = sizeof(memory);
+  if (sysctlbyname("hw.memsize", &memory, &size, NULL, 0) < 0) {
+    return 0;
+  }
+  return memory;
+}
+
+int GetAvailableCpus() {
+  return std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+string CreateServerCgroup(const string& cgroup,
+                          const vector<string>& settings) {
+  fprintf(stderr, "WARNING: --experimental_server_cgroup is only supported "
+          "on Linux.\n");
+  return "";
+}
+
 string GetDefaultHostJavabase() {
   string java_home = GetEnv("JAVA_HOME");
   if (!java_home.empty()) {
@@ -183,6 +240,13 @@ string GetDefaultHostJavabase() {
   return javabase.substr(0, javabase.length()-1);
 }
 
+int WatchServerDirectory(const string& server_dir) {
+  // Not watched: kqueue only reports that the entries of the directory
+  // changed, not that a file in it is completely written, so the client
+  // polls for the server instead.
+  return -1;
+}
+
 void WriteSystemSpecificProcessIdentifier(const string& server_dir) {
 }
 
@@ -224,4 +288,63 @@ void ExcludePathFromBackup(const string &path) {
   }
 }
 
+// There is no API to keep Spotlight out of a directory. It honors this marker
+// file at the root of a volume, and on older releases in any directory, which
+// is what a volume of its own for the output user root is for.
+void ExcludePathFromIndexing(const string &path) {
+  string marker = blaze_util::JoinPath(path, ".metadata_never_index");
+  int fd = open(marker.c_str(), O_CREAT | O_WRONLY, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Warning: unable to exclude '%s' from indexing: %s\n",
+            path.c_str(), strerror(errno));
+    return;
+  }
+  close(fd);
+}
+
+// Returns true if path is where an APFS volume is mounted.
+static bool IsApfsMountPoint(const string &path) {
+  struct statfs buf = {};
+  return statfs(path.c_str(), &buf) == 0 &&
+         strcmp(buf.f_fstypename, "apfs") == 0 && path == buf.f_mntonname;
+}
+
+bool MountOutputVolume(const string &name, string *mount_point,
+                       string *error) {
+  const string path = "/Volumes/" + name;
+  if (!IsApfsMountPoint(path)) {
+    // It may exist, but not be mounted.
+    RunProgram("/usr/sbin/diskutil", {"diskutil", "mount", name});
+  }
+  if (!IsApfsMountPoint(path)) {
+    // The boot volume is mounted from "/dev/disk1s1", or a snapshot of it like
+    // "/dev/disk1s1s1", in the container "disk1". Volumes in the same
+    // container share its free space.
+    struct statfs buf = {};
+    if (statfs("/", &buf) < 0) {
+      *error = string("statfs(\"/\"): ") + strerror(errno);
+      return false;
+    }
+    string container = buf.f_mntfromname;
+    if (container.compare(0, 5, "/dev/") == 0) {
+      container = container.substr(5);
+    }
+    container = container.substr(0, container.find('s', strlen("disk")));
+    string output = RunProgram(
+        "/usr/sbin/diskutil", {"diskutil", "apfs", "addVolume", container,
+                               "Case-sensitive APFS", name});
+    if (!IsApfsMountPoint(path)) {
+      *error = "creating the APFS volume '" + name + "' in '" + container +
+               "' failed: " + output;
+      return false;
+    }
+    fprintf(stderr, "INFO: Created the APFS volume '%s' for the output user "
+            "root.\n", name.c_str());
+  }
+  ExcludePathFromBackup(path);
+  ExcludePathFromIndexing(path);
+  *mount_point = path;
+  return true;
+}
+
 }   // namespace blaze.
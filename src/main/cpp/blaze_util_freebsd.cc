@@ -27,6 +27,8 @@
 #include <unistd.h>
 #include <libprocstat.h>  // must be included after <sys/...> headers
 
+#include <algorithm>
+
 #include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/blaze_util_platform.h"
 #include "src/main/cpp/util/errors.h"
@@ -40,6 +42,7 @@ namespace blaze {
 using blaze_util::die;
 using blaze_util::pdie;
 using std::string;
+using std::vector;
 
 string GetOutputRoot() {
   char buf[2048];
@@ -71,6 +74,11 @@ void WarnFilesystemType(const string &output_base) {
   }
 }
 
+bool IsNetworkFilesystem(const string& path) {
+  struct statfs buf = {};
+  return statfs(path.c_str(), &buf) == 0 && (buf.f_flags & MNT_LOCAL) == 0;
+}
+
 string GetSelfPath() {
   char buffer[PATH_MAX] = {};
   ssize_t bytes = readlink("/proc/curproc/file", buffer, sizeof(buffer));
@@ -143,12 +151,55 @@ bool IsSharedLibrary(const string &filename) {
   return blaze_util::ends_with(filename, ".so");
 }
 
+bool SyncFileSystem(const string& path) {
+  // There is no syncfs(2).
+  return false;
+}
+
+bool CloneFile(const string& src, const string& dst) {
+  // There is no way to clone a file.
+  errno = ENOTSUP;
+  return false;
+}
+
+string GetOutputPipePath(int fd) {
+  // /dev/fd only refers to the descriptors of the calling process.
+  return "";
+}
+
+uint64_t GetAvailableMemory() {
+  uint64_t memory;
+  size_t size = sizeof(memory);
+  if (sysctlbyname("hw.physmem", &memory, &size, NULL, 0) < 0) {
+    return 0;
+  }
+  return memory;
+}
+
+int GetAvailableCpus() {
+  return std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+string CreateServerCgroup(const string& cgroup,
+                          const vector<string>& settings) {
+  fprintf(stderr, "WARNING: --experimental_server_cgroup is only supported "
+          "on Linux.\n");
+  return "";
+}
+
 string GetDefaultHostJavabase() {
   // if JAVA_HOME is defined, then use it as default.
   string javahome = getenv("JAVA_HOME");
   return !javahome.empty() ? javahome : "/usr/local/openjdk8";
 }
 
+int WatchServerDirectory(const string& server_dir) {
+  // Not watched: kqueue only reports that the entries of the directory
+  // changed, not that a file in it is completely written, so the client
+  // polls for the server instead.
+  return -1;
+}
+
 void WriteSystemSpecificProcessIdentifier(const string& server_dir) {
 }
 
@@ -168,4 +219,14 @@ bool KillServerProcess(int pid) {
 void ExcludePathFromBackup(const string &path) {
 }
 
+// Not supported.
+void ExcludePathFromIndexing(const string& path) {
+}
+
+bool MountOutputVolume(const string& name, string* mount_point,
+                       string* error) {
+  *error = "only supported on macOS";
+  return false;
+}
+
 }  // namespace blaze
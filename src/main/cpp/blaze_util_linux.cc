@@ -12,19 +12,28 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <ctype.h>
 #include <errno.h>  // errno, ENAMETOOLONG
+#include <fcntl.h>
 #include <limits.h>
+#include <linux/fs.h>  // FICLONE
 #include <linux/magic.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>  // strerror
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/statfs.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/blaze_util_platform.h"
 #include "src/main/cpp/util/errors.h"
@@ -80,6 +89,30 @@ void WarnFilesystemType(const string& output_base) {
   }
 }
 
+bool IsNetworkFilesystem(const string& path) {
+  struct statfs buf = {};
+  if (statfs(path.c_str(), &buf) < 0) {
+    return false;
+  }
+  // Some of these are not in linux/magic.h.
+  switch (static_cast<uint32_t>(buf.f_type)) {
+    case NFS_SUPER_MAGIC:
+    case SMB_SUPER_MAGIC:
+    case AFS_SUPER_MAGIC:
+    case CODA_SUPER_MAGIC:
+    case NCP_SUPER_MAGIC:
+    case V9FS_MAGIC:
+    case 0xFF534D42:  // CIFS
+    case 0xFE534D42:  // SMB2
+    case 0x00C36400:  // Ceph
+    case 0x0BD00BD0:  // Lustre
+    case 0x47504653:  // GPFS
+      return true;
+    default:
+      return false;
+  }
+}
+
 string GetSelfPath() {
   char buffer[PATH_MAX] = {};
   ssize_t bytes = readlink("/proc/self/exe", buffer, sizeof(buffer));
@@ -143,6 +176,198 @@ bool IsSharedLibrary(const string &filename) {
   return blaze_util::ends_with(filename, ".so");
 }
 
+bool SyncFileSystem(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+         "failed to open '%s' for syncing", path.c_str());
+  }
+  if (syncfs(fd) < 0) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR, "failed to sync '%s'",
+         path.c_str());
+  }
+  close(fd);
+  return true;
+}
+
+bool CloneFile(const string& src, const string& dst) {
+#if defined(FICLONE)
+  int src_fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src_fd < 0) {
+    return false;
+  }
+  struct stat src_stat;
+  if (fstat(src_fd, &src_stat) < 0) {
+    int saved_errno = errno;
+    close(src_fd);
+    errno = saved_errno;
+    return false;
+  }
+  int dst_fd = open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                    0600);
+  if (dst_fd < 0) {
+    int saved_errno = errno;
+    close(src_fd);
+    errno = saved_errno;
+    return false;
+  }
+  // Only FICLONE: copy_file_range(2) would copy the contents where the file
+  // system cannot share them, like on ext4.
+  bool ok = ioctl(dst_fd, FICLONE, src_fd) == 0 &&
+            fchmod(dst_fd, src_stat.st_mode & 07777) == 0;
+  int saved_errno = errno;
+  close(dst_fd);
+  close(src_fd);
+  if (!ok) {
+    unlink(dst.c_str());
+  }
+  errno = saved_errno;
+  return ok;
+#else
+  errno = ENOTSUP;
+  return false;
+#endif
+}
+
+string GetOutputPipePath(int fd) {
+  struct stat buf;
+  if (fstat(fd, &buf) < 0 || !S_ISFIFO(buf.st_mode)) {
+    return "";
+  }
+  // Opening this gives another reference to the same pipe, unlike /dev/fd.
+  return "/proc/" + GetProcessIdAsString() + "/fd/" + ToString(fd);
+}
+
+// Reads the numbers on the first line of the cgroup control file at `path`.
+// A limit that is not set reads as "max" with cgroup v2, or as -1 for the CPU
+// quota with v1, neither of which is read as a number.
+static vector<uint64_t> ReadCgroupValues(const string &path) {
+  vector<uint64_t> values;
+  string content;
+  if (!ReadFile(path, &content)) {
+    return values;
+  }
+  for (const string &field : blaze_util::Split(content, ' ')) {
+    char *end;
+    uint64_t value = strtoull(field.c_str(), &end, 10);
+    if (!isdigit(field[0]) || (*end != '\0' && *end != '\n')) {
+      break;
+    }
+    values.push_back(value);
+  }
+  return values;
+}
+
+uint64_t GetAvailableMemory() {
+  long pages = sysconf(_SC_PHYS_PAGES);  // NOLINT
+  long page_size = sysconf(_SC_PAGESIZE);  // NOLINT
+  if (pages <= 0 || page_size <= 0) {
+    return 0;
+  }
+  uint64_t memory = static_cast<uint64_t>(pages) * page_size;
+  // The limit of the container, if any, with cgroup v2 or v1. Without a limit,
+  // v1 reports a number larger than the physical memory.
+  vector<uint64_t> limit = ReadCgroupValues("/sys/fs/cgroup/memory.max");
+  if (limit.empty()) {
+    limit = ReadCgroupValues("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+  }
+  if (!limit.empty() && limit[0] > 0 && limit[0] < memory) {
+    memory = limit[0];
+  }
+  return memory;
+}
+
+int GetAvailableCpus() {
+  int cpus = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+  // The CPU quota of the container, if any, as "<quota> <period>" with cgroup
+  // v2, or in two files with v1.
+  vector<uint64_t> quota = ReadCgroupValues("/sys/fs/cgroup/cpu.max");
+  if (quota.size() != 2) {
+    quota = ReadCgroupValues("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+    vector<uint64_t> period =
+        ReadCgroupValues("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+    if (quota.size() == 1 && period.size() == 1) {
+      quota.push_back(period[0]);
+    }
+  }
+  if (quota.size() == 2 && quota[0] > 0 && quota[1] > 0) {
+    // Round up: a quota of 1.5 CPUs still keeps two threads busy.
+    int quota_cpus = static_cast<int>((quota[0] + quota[1] - 1) / quota[1]);
+    cpus = std::min(cpus, quota_cpus);
+  }
+  return cpus;
+}
+
+static const char kCgroupRoot[] = "/sys/fs/cgroup";
+
+// Enables the "controller" for the children of the cgroup at "dir", unless it
+// already is.
+static bool EnableCgroupController(const string &dir,
+                                   const string &controller) {
+  string subtree_control = blaze_util::JoinPath(dir, "cgroup.subtree_control");
+  string enabled;
+  if (ReadFile(subtree_control, &enabled)) {
+    for (const string &c : blaze_util::Split(enabled, ' ')) {
+      string name = c;
+      blaze_util::StripWhitespace(&name);
+      if (name == controller) {
+        return true;
+      }
+    }
+  }
+  return WriteFile("+" + controller, subtree_control);
+}
+
+string CreateServerCgroup(const string &cgroup,
+                          const vector<string> &settings) {
+  if (!blaze_util::PathExists(
+          blaze_util::JoinPath(kCgroupRoot, "cgroup.controllers"))) {
+    fprintf(stderr, "WARNING: not using --experimental_server_cgroup, %s is "
+            "not a cgroup v2 hierarchy.\n", kCgroupRoot);
+    return "";
+  }
+
+  // The controllers of the settings, "cpu" for "cpu.weight", have to be
+  // enabled in every ancestor of the cgroup.
+  vector<string> controllers;
+  for (const string &setting : settings) {
+    string controller = setting.substr(0, setting.find('.'));
+    if (std::find(controllers.begin(), controllers.end(), controller) ==
+        controllers.end()) {
+      controllers.push_back(controller);
+    }
+  }
+
+  string dir = kCgroupRoot;
+  for (const string &component : blaze_util::Split(cgroup, '/')) {
+    for (const string &controller : controllers) {
+      if (!EnableCgroupController(dir, controller)) {
+        fprintf(stderr, "WARNING: cannot enable the %s controller in %s: %s\n",
+                controller.c_str(), dir.c_str(), strerror(errno));
+        return "";
+      }
+    }
+    dir = blaze_util::JoinPath(dir, component);
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+      fprintf(stderr, "WARNING: cannot create the cgroup %s: %s\n",
+              dir.c_str(), strerror(errno));
+      return "";
+    }
+  }
+
+  for (const string &setting : settings) {
+    size_t equals = setting.find('=');
+    string file = blaze_util::JoinPath(dir, setting.substr(0, equals));
+    if (!WriteFile(setting.substr(equals + 1), file)) {
+      fprintf(stderr, "WARNING: cannot write %s to %s: %s\n",
+              setting.substr(equals + 1).c_str(), file.c_str(),
+              strerror(errno));
+      return "";
+    }
+  }
+  return dir;
+}
+
 string GetDefaultHostJavabase() {
   // if JAVA_HOME is defined, then use it as default.
   const char *javahome = getenv("JAVA_HOME");
@@ -189,6 +414,19 @@ static bool GetStartTime(const string& pid, string* start_time) {
   return true;
 }
 
+int WatchServerDirectory(const string& server_dir) {
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  if (inotify_add_watch(fd, server_dir.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
 void WriteSystemSpecificProcessIdentifier(const string& server_dir) {
   string pid = ToString(getpid());
 
@@ -247,4 +485,14 @@ bool KillServerProcess(int pid) {
 void ExcludePathFromBackup(const string &path) {
 }
 
+// Not supported.
+void ExcludePathFromIndexing(const string& path) {
+}
+
+bool MountOutputVolume(const string& name, string* mount_point,
+                       string* error) {
+  *error = "only supported on macOS";
+  return false;
+}
+
 }  // namespace blaze
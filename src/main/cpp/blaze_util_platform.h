@@ -32,6 +32,10 @@ std::string GetOutputRoot();
 // Warn about dubious filesystem types, such as NFS, case-insensitive (?).
 void WarnFilesystemType(const std::string& output_base);
 
+// Returns true if path, which must exist, is on a network file system, like
+// NFS or SMB.
+bool IsNetworkFilesystem(const std::string& path);
+
 // Returns elapsed milliseconds since some unspecified start of time.
 // The results are monotonic, i.e. subsequent calls to this method never return
 // a value less than a previous result.
@@ -49,6 +53,32 @@ std::string GetProcessCWD(int pid);
 
 bool IsSharedLibrary(const std::string& filename);
 
+// Flushes everything written to the filesystem `path` is on to the disk, if
+// the platform can do that in one go. Returns false if it cannot, in which
+// case the files have to be synced one by one. pdie() if syncing fails.
+bool SyncFileSystem(const std::string& path);
+
+// Returns a path through which another process of the same user can open the
+// pipe `fd` of this process writes to, or the empty string if `fd` is not a
+// pipe or the platform has no such path.
+std::string GetOutputPipePath(int fd);
+
+// Returns the number of bytes of memory available to this process, taking
+// container limits into account where the platform has them, or 0 if unknown.
+uint64_t GetAvailableMemory();
+
+// Returns the number of processors available to this process, taking
+// container limits into account where the platform has them.
+int GetAvailableCpus();
+
+// Creates the cgroup v2 "cgroup" (a path below the root of the hierarchy),
+// enables the controllers for "settings" on the way there, and writes each
+// of the "settings", given as "<file>=<value>", into it. Returns the
+// directory of the cgroup, or prints a warning and returns the empty string
+// if the platform has no cgroups v2 or the cgroup cannot be set up.
+std::string CreateServerCgroup(const std::string& cgroup,
+                               const std::vector<std::string>& settings);
+
 // Return the default path to the JDK used to run Blaze itself
 // (must be an absolute directory).
 std::string GetDefaultHostJavabase();
@@ -59,21 +89,41 @@ std::string GetDefaultHostJavabase();
 void ExecuteProgram(const std::string& exe,
                     const std::vector<std::string>& args_vector);
 
+// Whether ExecuteProgramWithEnvironment() is supported on this platform.
+bool CanExecuteProgramWithEnvironment();
+
+// Replace the current process with the program args_vector[0] (an absolute
+// path), run in the directory cwd with the argument vector args_vector and
+// exactly the environment env, entries of the form "NAME=value".
+// This function does not return on success.
+void ExecuteProgramWithEnvironment(const std::string& cwd,
+                                   const std::vector<std::string>& args_vector,
+                                   const std::vector<std::string>& env);
+
 class BlazeServerStartup {
  public:
   virtual ~BlazeServerStartup() {}
   virtual bool IsStillAlive() = 0;
+
+  // Waits until the server writes a file in its server directory or exits,
+  // for at most 'timeout_msec' milliseconds. Returns false if it timed out
+  // and neither happened, that is, if connecting to the server again is not
+  // worth a try yet. Where the platform cannot tell, returns true after the
+  // timeout.
+  virtual bool WaitForStartupEvent(int timeout_msec) = 0;
 };
 
 // Starts a daemon process with its standard output and standard error
 // redirected to the file "daemon_output". Sets server_startup to an object
 // that can be used to query if the server is still alive. The PID of the
 // daemon started is written into server_dir, both as a symlink (for legacy
-// reasons) and as a file.
+// reasons) and as a file. Unless cgroup_dir is empty, the daemon is moved
+// into the cgroup there, see CreateServerCgroup().
 void ExecuteDaemon(const std::string& exe,
                    const std::vector<std::string>& args_vector,
                    const std::string& daemon_output,
                    const std::string& server_dir,
+                   const std::string& cgroup_dir,
                    BlazeServerStartup** server_startup);
 
 // Executes a subprocess and returns its standard output and standard error.
@@ -138,6 +188,18 @@ bool KillServerProcess(int pid);
 // Mark path as being excluded from backups (if supported by operating system).
 void ExcludePathFromBackup(const std::string& path);
 
+// Marks the directory path as one that file indexing services, like Spotlight,
+// should leave alone (if supported by operating system).
+void ExcludePathFromIndexing(const std::string& path);
+
+// Mounts the volume "name" for the output user root, and creates it first if
+// it does not exist yet: on macOS, a case-sensitive APFS volume in the
+// container of the boot volume, which is neither indexed nor backed up.
+// Sets mount_point to where it is mounted. Returns false and sets error if
+// that fails or is not supported by the operating system.
+bool MountOutputVolume(const std::string& name, std::string* mount_point,
+                       std::string* error);
+
 // Returns the canonical form of the base dir given a root and a hashable
 // string. The resulting dir is composed of the root + md5(hashable)
 std::string GetHashedBaseDir(const std::string& root,
@@ -148,6 +210,48 @@ std::string GetHashedBaseDir(const std::string& root,
 // user, and not accessible to anyone else.
 void CreateSecureOutputRoot(const std::string& path);
 
+// Creates the output user root "root" in "scratch_dir", a local directory that
+// other users may write to as well, like a scratch volume, as
+// CreateSecureOutputRoot() does, but only accessible to the current user.
+// Returns false and sets error if scratch_dir is not a directory on a local
+// file system, or if other users could replace the output user root in it,
+// which they can if it is writable to them and not sticky.
+bool CreateLocalOutputRoot(const std::string& scratch_dir,
+                           const std::string& root, std::string* error);
+
+// Returns whether only root can change what is in the directory 'path': it
+// and the directories above it are owned by root, it is not writable to other
+// users, and neither are the directories above it unless they are sticky, like
+// /tmp. Returns false and sets error if not.
+bool IsOwnedByRoot(const std::string& path, std::string* error);
+
+// Returns whether the file or directory 'path' itself, not what it links to,
+// is owned by root and not writable to other users. A symlink never is.
+// Returns false and sets error if not.
+bool IsFileOwnedByRoot(const std::string& path, std::string* error);
+
+// Creates the regular file 'dst' as a clone of 'src', with its mode, which
+// shares the contents of 'src' on a copy-on-write file system rather than
+// copying them. Returns false and sets errno if that fails, or if the file
+// system or the operating system cannot clone files.
+bool CloneFile(const std::string& src, const std::string& dst);
+
+// Creates the output base 'output_base', which must not exist, as a clone of
+// the output base 'template_base', with CloneFile(). What belongs to the server
+// and the client of the template, like server/ and the lock, is left out, and
+// symlinks into the template point into 'output_base' instead. The template
+// is locked meanwhile. Returns false and sets error if the template is in use,
+// or cannot be cloned; 'output_base' is not created then.
+bool CloneOutputBase(const std::string& template_base,
+                     const std::string& output_base, std::string* error);
+
+// Deletes the output bases in the output user root that have not been used
+// for max_age_secs, except for "keep", in a background process, at most once a
+// day. An output base whose lock is held or whose server runs is not deleted.
+// Must be called before the client starts threads.
+void DeleteStaleOutputBases(const std::string& output_user_root,
+                            const std::string& keep, int max_age_secs);
+
 // mkdir -p path. All newly created directories use the given mode.
 // `mode` should be an octal permission mask, e.g. 0755
 // Returns false on failure, sets errno.
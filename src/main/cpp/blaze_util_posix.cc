@@ -12,12 +12,18 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <ftw.h>
 #include <limits.h>  // PATH_MAX
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // strerror
 #include <sys/stat.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -66,6 +72,42 @@ void ExecuteProgram(const string &exe, const vector<string> &args_vector) {
   execv(exe.c_str(), const_cast<char **>(argv));
 }
 
+bool CanExecuteProgramWithEnvironment() { return true; }
+
+void ExecuteProgramWithEnvironment(const string &cwd,
+                                   const vector<string> &args_vector,
+                                   const vector<string> &env) {
+  if (VerboseLogging()) {
+    string dbg;
+    for (const auto &s : args_vector) {
+      dbg.append(s);
+      dbg.append(" ");
+    }
+    fprintf(stderr, "Invoking binary in %s:\n  %s\n", cwd.c_str(),
+            dbg.c_str());
+  }
+
+  if (chdir(cwd.c_str()) != 0) {
+    pdie(blaze_exit_code::INTERNAL_ERROR, "chdir(%s) failed", cwd.c_str());
+  }
+
+  int n = args_vector.size();
+  const char **argv = new const char *[n + 1];
+  for (int i = 0; i < n; ++i) {
+    argv[i] = args_vector[i].c_str();
+  }
+  argv[n] = NULL;
+  int m = env.size();
+  const char **envp = new const char *[m + 1];
+  for (int i = 0; i < m; ++i) {
+    envp[i] = env[i].c_str();
+  }
+  envp[m] = NULL;
+
+  execve(argv[0], const_cast<char **>(argv), const_cast<char **>(envp));
+  pdie(blaze_exit_code::INTERNAL_ERROR, "Cannot execute %s", argv[0]);
+}
+
 std::string ConvertPath(const std::string &path) { return path; }
 
 std::string ConvertPathList(const std::string& path_list) { return path_list; }
@@ -109,16 +151,19 @@ static void Daemonize(const string& daemon_output) {
 
 class PipeBlazeServerStartup : public BlazeServerStartup {
  public:
-  PipeBlazeServerStartup(int pipe_fd);
+  PipeBlazeServerStartup(int pipe_fd, int watch_fd);
   virtual ~PipeBlazeServerStartup();
   virtual bool IsStillAlive();
+  virtual bool WaitForStartupEvent(int timeout_msec);
 
  private:
   int pipe_fd;
+  int watch_fd;  // -1 if the server directory cannot be watched
 };
 
-PipeBlazeServerStartup::PipeBlazeServerStartup(int pipe_fd) {
+PipeBlazeServerStartup::PipeBlazeServerStartup(int pipe_fd, int watch_fd) {
   this->pipe_fd = pipe_fd;
+  this->watch_fd = watch_fd;
   if (fcntl(pipe_fd, F_SETFL, O_NONBLOCK | fcntl(pipe_fd, F_GETFL))) {
     pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
          "Failed: fcntl to enable O_NONBLOCK on pipe");
@@ -127,6 +172,9 @@ PipeBlazeServerStartup::PipeBlazeServerStartup(int pipe_fd) {
 
 PipeBlazeServerStartup::~PipeBlazeServerStartup() {
   close(pipe_fd);
+  if (watch_fd != -1) {
+    close(watch_fd);
+  }
 }
 
 bool PipeBlazeServerStartup::IsStillAlive() {
@@ -134,16 +182,41 @@ bool PipeBlazeServerStartup::IsStillAlive() {
   return read(this->pipe_fd, &c, 1) == -1 && errno == EAGAIN;
 }
 
+bool PipeBlazeServerStartup::WaitForStartupEvent(int timeout_msec) {
+  // The pipe becomes readable at end of file, when the server exits.
+  struct pollfd fds[2] = {{pipe_fd, POLLIN, 0}, {watch_fd, POLLIN, 0}};
+  int ready = poll(fds, watch_fd == -1 ? 1 : 2, timeout_msec);
+  if (ready == -1 && errno != EINTR) {
+    pdie(blaze_exit_code::INTERNAL_ERROR, "poll() failed");
+  }
+  if (watch_fd != -1 && (fds[1].revents & POLLIN)) {
+    // Which file was written does not matter, the server is connected to
+    // either way.
+    char events[4096];
+    while (read(watch_fd, events, sizeof(events)) > 0) {
+    }
+  }
+  return watch_fd == -1 || ready != 0;
+}
+
+// Returns a non-blocking file descriptor that becomes readable when a file is
+// written in 'server_dir', or -1 if the platform cannot tell. It is not
+// inherited by the server.
+int WatchServerDirectory(const string& server_dir);
+
 void WriteSystemSpecificProcessIdentifier(const string& server_dir);
 
 void ExecuteDaemon(const string& exe,
                    const std::vector<string>& args_vector,
                    const string& daemon_output, const string& server_dir,
+                   const string& cgroup_dir,
                    BlazeServerStartup** server_startup) {
   int fds[2];
   if (pipe(fds)) {
     pdie(blaze_exit_code::INTERNAL_ERROR, "pipe creation failed");
   }
+  // Watch before the server can write anything.
+  int watch_fd = WatchServerDirectory(server_dir);
   int child = fork();
   if (child == -1) {
     pdie(blaze_exit_code::INTERNAL_ERROR, "fork() failed");
@@ -151,12 +224,20 @@ void ExecuteDaemon(const string& exe,
     close(fds[1]);  // parent keeps only the reading side
     int unused_status;
     waitpid(child, &unused_status, 0);  // child double-forks
-    *server_startup = new PipeBlazeServerStartup(fds[0]);
+    *server_startup = new PipeBlazeServerStartup(fds[0], watch_fd);
     return;
   } else {
     close(fds[0]);  // child keeps only the writing side
   }
 
+  // Join the cgroup while errors still reach the terminal. The daemon, and
+  // the actions it runs, inherit it.
+  if (!cgroup_dir.empty() &&
+      !WriteFile("0", blaze_util::JoinPath(cgroup_dir, "cgroup.procs"))) {
+    fprintf(stderr, "WARNING: cannot move the server into the cgroup %s: %s\n",
+            cgroup_dir.c_str(), strerror(errno));
+  }
+
   Daemonize(daemon_output);
   string pid_string = GetProcessIdAsString();
   string pid_file = blaze_util::JoinPath(server_dir, kServerPidFile);
@@ -271,6 +352,373 @@ void CreateSecureOutputRoot(const string& path) {
   }
 
   ExcludePathFromBackup(root);
+  ExcludePathFromIndexing(root);
+}
+
+bool CreateLocalOutputRoot(const string& scratch_dir, const string& root,
+                           string* error) {
+  struct stat scratch_stat = {};
+  if (stat(scratch_dir.c_str(), &scratch_stat) < 0 ||
+      !S_ISDIR(scratch_stat.st_mode)) {
+    *error = "'" + scratch_dir + "' is not a directory";
+    return false;
+  }
+  if (IsNetworkFilesystem(scratch_dir)) {
+    *error = "'" + scratch_dir + "' is on a network file system as well";
+    return false;
+  }
+  if ((scratch_stat.st_mode & 022) != 0 &&
+      (scratch_stat.st_mode & S_ISVTX) == 0) {
+    *error = "'" + scratch_dir +
+             "' is writable to other users but not sticky, so they could "
+             "replace the output user root";
+    return false;
+  }
+
+  // Create it with the right mode, so that it is never accessible to others.
+  if (mkdir(root.c_str(), 0700) < 0 && errno != EEXIST) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR, "mkdir('%s')",
+         root.c_str());
+  }
+  CreateSecureOutputRoot(root);
+  struct stat root_stat = {};
+  if (stat(root.c_str(), &root_stat) < 0) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR, "stat('%s')",
+         root.c_str());
+  }
+  if ((root_stat.st_mode & 077) != 0 &&
+      chmod(root.c_str(), root_stat.st_mode & 07700) < 0) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR, "chmod('%s')",
+         root.c_str());
+  }
+  return true;
+}
+
+bool IsOwnedByRoot(const string& path, string* error) {
+  char *real_path = realpath(path.c_str(), NULL);
+  if (real_path == NULL) {
+    *error = "'" + path + "' does not exist";
+    return false;
+  }
+  string dir = real_path;
+  free(real_path);
+  for (bool top = true;; top = false) {
+    struct stat dir_stat = {};
+    if (stat(dir.c_str(), &dir_stat) < 0 || !S_ISDIR(dir_stat.st_mode)) {
+      *error = "'" + dir + "' is not a directory";
+      return false;
+    }
+    if (dir_stat.st_uid != 0) {
+      *error = "'" + dir + "' is not owned by root";
+      return false;
+    }
+    if ((dir_stat.st_mode & 022) != 0 &&
+        (top || (dir_stat.st_mode & S_ISVTX) == 0)) {
+      *error = "'" + dir + "' is writable to other users";
+      return false;
+    }
+    if (dir == "/") {
+      return true;
+    }
+    dir = blaze_util::Dirname(dir);
+  }
+}
+
+bool IsFileOwnedByRoot(const string& path, string* error) {
+  struct stat file_stat = {};
+  if (lstat(path.c_str(), &file_stat) < 0) {
+    *error = "'" + path + "' does not exist";
+    return false;
+  }
+  if (S_ISLNK(file_stat.st_mode)) {
+    *error = "'" + path + "' is a symlink";
+    return false;
+  }
+  if (file_stat.st_uid != 0) {
+    *error = "'" + path + "' is not owned by root";
+    return false;
+  }
+  if ((file_stat.st_mode & 022) != 0) {
+    *error = "'" + path + "' is writable to other users";
+    return false;
+  }
+  return true;
+}
+
+// The prefix of a stale output base that was moved out of the way to be
+// deleted.
+static const char kDeletedOutputBasePrefix[] = "deleted_output_base_";
+
+static int MakeDirectoryWritable(const char* path, const struct stat* st,
+                                 int type, struct FTW* ftw) {
+  if (type == FTW_D && (st->st_mode & 0700) != 0700) {
+    chmod(path, st->st_mode | 0700);
+  }
+  return 0;
+}
+
+static int RemovePath(const char* path, const struct stat* st, int type,
+                      struct FTW* ftw) {
+  remove(path);
+  return 0;
+}
+
+// Returns true if the output base is in use: a client holds its lock, or its
+// server is running.
+static bool IsOutputBaseInUse(const string& output_base, int lockfd) {
+  struct flock lock = {};
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 4096;
+  if (fcntl(lockfd, F_SETLK, &lock) == -1) {
+    return true;
+  }
+  string pid_file = blaze_util::JoinPath(
+      blaze_util::JoinPath(output_base, "server"), kServerPidFile);
+  string pid;
+  if (!ReadFile(pid_file, &pid)) {
+    return false;
+  }
+  int server_pid = atoi(pid.c_str());
+  return server_pid > 0 && (kill(server_pid, 0) == 0 || errno == EPERM);
+}
+
+// Returns whether the entry 'name' of an output base belongs to its server or
+// its client, which create it anew, rather than to the builds in it.
+static bool IsOutputBaseStateEntry(const string& name) {
+  return name == "server" || name == "lock" || name == "install" ||
+         name == "command.log" || name == "javalog.properties" ||
+         name.compare(0, strlen("java.log"), "java.log") == 0;
+}
+
+// Clones the directory tree 'src' to 'dst', which does not exist, with
+// CloneFile(). Symlinks to 'from' or below it point to the same path below 'to'
+// instead. Sockets and other special files are left out.
+static bool CloneTree(const string& src, const string& dst, const string& from,
+                      const string& to, bool top, string* error) {
+  struct stat src_stat;
+  if (lstat(src.c_str(), &src_stat) < 0) {
+    *error = "cannot stat '" + src + "': " + strerror(errno);
+    return false;
+  }
+  // Writable until its entries are in it.
+  if (mkdir(dst.c_str(), 0700) < 0) {
+    *error = "cannot create '" + dst + "': " + strerror(errno);
+    return false;
+  }
+  DIR* dir = opendir(src.c_str());
+  if (dir == NULL) {
+    *error = "cannot open '" + src + "': " + strerror(errno);
+    return false;
+  }
+  bool ok = true;
+  struct dirent* ent;
+  while (ok && (ent = readdir(dir)) != NULL) {
+    string name = ent->d_name;
+    if (name == "." || name == ".." || (top && IsOutputBaseStateEntry(name))) {
+      continue;
+    }
+    string src_path = blaze_util::JoinPath(src, name);
+    string dst_path = blaze_util::JoinPath(dst, name);
+    struct stat st;
+    if (lstat(src_path.c_str(), &st) < 0) {
+      *error = "cannot stat '" + src_path + "': " + strerror(errno);
+      ok = false;
+    } else if (S_ISDIR(st.st_mode)) {
+      ok = CloneTree(src_path, dst_path, from, to, false, error);
+    } else if (S_ISREG(st.st_mode)) {
+      if (!CloneFile(src_path, dst_path)) {
+        *error = "cannot clone '" + src_path + "': " + strerror(errno);
+        ok = false;
+      }
+    } else if (S_ISLNK(st.st_mode)) {
+      string target;
+      if (!ReadDirectorySymlink(src_path, &target)) {
+        *error = "cannot read the symlink '" + src_path + "'";
+        ok = false;
+        break;
+      }
+      if (target.compare(0, from.size(), from) == 0 &&
+          (target.size() == from.size() || target[from.size()] == '/')) {
+        target = to + target.substr(from.size());
+      }
+      if (symlink(target.c_str(), dst_path.c_str()) < 0) {
+        *error = "cannot create the symlink '" + dst_path + "': " +
+                 strerror(errno);
+        ok = false;
+      }
+    }
+  }
+  closedir(dir);
+  if (ok && chmod(dst.c_str(), src_stat.st_mode & 07777) < 0) {
+    *error = "cannot change the mode of '" + dst + "': " + strerror(errno);
+    ok = false;
+  }
+  return ok;
+}
+
+bool CloneOutputBase(const string& template_base, const string& output_base,
+                     string* error) {
+  // The symlinks in the template point to its canonical path, and those in
+  // the output base are to point to its own.
+  char* real_template = realpath(template_base.c_str(), NULL);
+  char* real_parent =
+      realpath(blaze_util::Dirname(output_base).c_str(), NULL);
+  if (real_template == NULL || real_parent == NULL) {
+    *error = "'" + (real_template == NULL ? template_base
+                                          : blaze_util::Dirname(output_base)) +
+             "' does not exist";
+    free(real_template);
+    free(real_parent);
+    return false;
+  }
+  string from = real_template;
+  string to =
+      blaze_util::JoinPath(real_parent, blaze_util::Basename(output_base));
+  free(real_template);
+  free(real_parent);
+
+  // Holding the lock of the template keeps clients from starting a command in
+  // it while it is cloned.
+  int lockfd = open(blaze_util::JoinPath(from, "lock").c_str(),
+                    O_RDWR | O_CLOEXEC);
+  if (lockfd < 0) {
+    *error = "'" + from + "' is not an output base";
+    return false;
+  }
+  if (IsOutputBaseInUse(from, lockfd)) {
+    close(lockfd);
+    *error = "'" + from + "' is in use";
+    return false;
+  }
+
+  // Cloned next to the output base and renamed, so that a client never finds
+  // a partial clone.
+  string clone = output_base + ".clone-" + GetProcessIdAsString();
+  bool ok = CloneTree(from, clone, from, to, true, error);
+  if (ok && rename(clone.c_str(), output_base.c_str()) < 0) {
+    *error = "cannot rename '" + clone + "': " + strerror(errno);
+    ok = false;
+  }
+  if (!ok) {
+    nftw(clone.c_str(), MakeDirectoryWritable, 16, FTW_PHYS);
+    nftw(clone.c_str(), RemovePath, 16, FTW_DEPTH | FTW_PHYS);
+  }
+  close(lockfd);
+  return ok;
+}
+
+void DeleteStaleOutputBases(const string& output_user_root, const string& keep,
+                            int max_age_secs) {
+  // Looking at the output bases is not free, so it is done once a day; an
+  // output base is deleted at most a day after it became stale.
+  string marker =
+      blaze_util::JoinPath(output_user_root, "stale_output_base_check");
+  time_t now = time(NULL);
+  struct stat marker_stat = {};
+  if (stat(marker.c_str(), &marker_stat) == 0 &&
+      now - marker_stat.st_mtime < 24 * 3600) {
+    return;
+  }
+  if (!WriteFile(ToString(now) + "\n", marker)) {
+    return;
+  }
+
+  DIR* dir = opendir(output_user_root.c_str());
+  if (dir == NULL) {
+    return;
+  }
+  bool deleted = false;
+  string keep_name = blaze_util::Basename(keep);
+  struct dirent* ent;
+  while ((ent = readdir(dir)) != NULL) {
+    string name = ent->d_name;
+    if (name.compare(0, strlen(kDeletedOutputBasePrefix),
+                     kDeletedOutputBasePrefix) == 0) {
+      // Left over by an interrupted deletion.
+      deleted = true;
+      continue;
+    }
+    // Output bases are named after an MD5 digest.
+    if (name.size() != 2 * blaze_util::Md5Digest::kDigestLength ||
+        name.find_first_not_of("0123456789abcdef") != string::npos ||
+        name == keep_name) {
+      continue;
+    }
+    string output_base = blaze_util::JoinPath(output_user_root, name);
+    // Every command rewrites the lock file.
+    struct stat lock_stat = {};
+    string lockfile = blaze_util::JoinPath(output_base, "lock");
+    if (stat(lockfile.c_str(), &lock_stat) < 0 ||
+        now - lock_stat.st_mtime < max_age_secs) {
+      continue;
+    }
+    int lockfd = open(lockfile.c_str(), O_RDWR);
+    if (lockfd < 0) {
+      continue;
+    }
+    // Moving the output base away while holding its lock makes sure no
+    // client uses it in the meantime; the next one creates a new one.
+    if (!IsOutputBaseInUse(output_base, lockfd) &&
+        rename(output_base.c_str(),
+               blaze_util::JoinPath(output_user_root,
+                                    kDeletedOutputBasePrefix + name)
+                   .c_str()) == 0) {
+      fprintf(stderr,
+              "INFO: Deleting output base '%s', unused for %d days, in the "
+              "background.\n",
+              output_base.c_str(),
+              static_cast<int>((now - lock_stat.st_mtime) / (24 * 3600)));
+      deleted = true;
+    }
+    close(lockfd);
+  }
+  closedir(dir);
+  if (!deleted) {
+    return;
+  }
+
+  // Delete them in a grandchild, so that neither this process nor the server
+  // that may replace it has to wait for it, and it is not left as a zombie.
+  pid_t child = fork();
+  if (child < 0) {
+    return;
+  } else if (child > 0) {
+    while (waitpid(child, NULL, 0) == -1 && errno == EINTR) {
+    }
+    return;
+  }
+  setsid();
+  if (fork() != 0) {
+    _exit(0);
+  }
+  // Do not keep a pipe on standard output or error open.
+  int devnull = open("/dev/null", O_RDWR);
+  if (devnull >= 0) {
+    dup2(devnull, STDIN_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+  }
+  nice(19);
+  dir = opendir(output_user_root.c_str());
+  if (dir == NULL) {
+    _exit(1);
+  }
+  vector<string> paths;
+  while ((ent = readdir(dir)) != NULL) {
+    if (strncmp(ent->d_name, kDeletedOutputBasePrefix,
+                strlen(kDeletedOutputBasePrefix)) == 0) {
+      paths.push_back(blaze_util::JoinPath(output_user_root, ent->d_name));
+    }
+  }
+  closedir(dir);
+  for (const string& path : paths) {
+    // Bazel makes parts of the output tree read-only.
+    nftw(path.c_str(), MakeDirectoryWritable, 16, FTW_PHYS);
+    nftw(path.c_str(), RemovePath, 16, FTW_DEPTH | FTW_PHYS);
+  }
+  _exit(0);
 }
 
 // Runs "stat" on `path`. Returns -1 and sets errno if stat fails or
@@ -25,6 +25,7 @@
 
 #include <windows.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstdio>
 #include <thread>  // NOLINT (to slience Google-internal linter)
@@ -94,6 +95,10 @@ static void PrintError(const string& op) {
 void WarnFilesystemType(const string& output_base) {
 }
 
+bool IsNetworkFilesystem(const string& path) {
+  return false;
+}
+
 string GetProcessIdAsString() {
   return ToString(GetCurrentProcessId());
 }
@@ -175,6 +180,69 @@ bool IsSharedLibrary(const string &filename) {
   return blaze_util::ends_with(filename, ".dll");
 }
 
+bool SyncFileSystem(const string& path) {
+  // FlushFileBuffers() on the handle of a volume flushes all of its files,
+  // but only administrators can open a volume for writing. For everyone else
+  // this returns false, which leaves the files unsynced, as fsync() fails on
+  // Cygwin (see SyncTreeVisitor in blaze.cc).
+  char mount_point[MAX_PATH];
+  char volume[MAX_PATH];
+  if (!GetVolumePathNameA(ConvertPath(path).c_str(), mount_point,
+                          sizeof(mount_point)) ||
+      !GetVolumeNameForVolumeMountPointA(mount_point, volume,
+                                         sizeof(volume))) {
+    return false;
+  }
+  // "\\?\Volume{GUID}\" names the root directory of the volume, without
+  // the trailing backslash it names the volume itself.
+  string volume_name(volume);
+  if (!volume_name.empty() && volume_name.back() == '\\') {
+    volume_name.pop_back();
+  }
+  HANDLE handle = CreateFileA(volume_name.c_str(),
+                              GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, 0, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  BOOL flushed = FlushFileBuffers(handle);
+  DWORD last_error = GetLastError();
+  CloseHandle(handle);
+  if (!flushed) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+         "Error %u syncing the volume of '%s'", last_error, path.c_str());
+  }
+  return true;
+}
+
+string GetOutputPipePath(int fd) {
+  // A pipe handle belongs to the process that holds it and has no path the
+  // server could open, so --experimental_direct_stdout has no effect here:
+  // the output goes through the client as without it.
+  return "";
+}
+
+uint64_t GetAvailableMemory() {
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status)) {
+    return 0;
+  }
+  return status.ullTotalPhys;
+}
+
+int GetAvailableCpus() {
+  return std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+string CreateServerCgroup(const string& cgroup,
+                          const vector<string>& settings) {
+  fprintf(stderr, "WARNING: --experimental_server_cgroup is only supported "
+          "on Linux.\n");
+  return "";
+}
+
 string GetDefaultHostJavabase() {
   const char *javahome = getenv("JAVA_HOME");
   if (javahome == NULL) {
@@ -322,15 +390,15 @@ string RunProgram(
   CloseHandle(pipe_write);
   std::string result = "";
   DWORD bytes_read;
-  CHAR buf[1024];
+  CHAR buf[4096];
 
   for (;;) {
-    ok = ::ReadFile(pipe_read, buf, 1023, &bytes_read, NULL);
+    ok = ::ReadFile(pipe_read, buf, sizeof(buf), &bytes_read, NULL);
     if (!ok || bytes_read == 0) {
       break;
     }
-    buf[bytes_read] = 0;
-    result = result + buf;
+    // Append in place rather than copying everything read so far.
+    result.append(buf, bytes_read);
   }
 
   CloseHandle(pipe_read);
@@ -371,7 +439,32 @@ static bool DaemonizeOnWindows() {
 #endif  // COMPILER_MSVC
 }
 
-// Keeping an eye on the server process on Windows is not implemented yet.
+#ifdef COMPILER_MSVC
+// Keeps an eye on the server process through its handle, which the client
+// itself created. A server that fails to start up is noticed as soon as it
+// exits rather than when connecting times out.
+class ProcessHandleBlazeServerStartup : public BlazeServerStartup {
+ public:
+  explicit ProcessHandleBlazeServerStartup(HANDLE process)
+      : process_(process) {}
+  virtual ~ProcessHandleBlazeServerStartup() { CloseHandle(process_); }
+  virtual bool IsStillAlive() {
+    return WaitForSingleObject(process_, 0) == WAIT_TIMEOUT;
+  }
+  virtual bool WaitForStartupEvent(int timeout_msec) {
+    // Returns as soon as the server exits; there is no cheap way to watch the
+    // server directory for it to become ready, so a timeout is worth a try.
+    WaitForSingleObject(process_, timeout_msec);
+    return true;
+  }
+
+ private:
+  HANDLE process_;
+};
+#endif  // COMPILER_MSVC
+
+// Keeping an eye on the server process is not implemented when the server is
+// started by a daemonized grandchild of the client, see DaemonizeOnWindows().
 // TODO(lberki): Implement this, because otherwise if we can't start up a server
 // process, the client will hang until it times out.
 class DummyBlazeServerStartup : public BlazeServerStartup {
@@ -379,10 +472,15 @@ class DummyBlazeServerStartup : public BlazeServerStartup {
   DummyBlazeServerStartup() {}
   virtual ~DummyBlazeServerStartup() {}
   virtual bool IsStillAlive() { return true; }
+  virtual bool WaitForStartupEvent(int timeout_msec) {
+    Sleep(timeout_msec);
+    return true;
+  }
 };
 
 void ExecuteDaemon(const string& exe, const std::vector<string>& args_vector,
                    const string& daemon_output, const string& server_dir,
+                   const string& cgroup_dir,
                    BlazeServerStartup** server_startup) {
   if (DaemonizeOnWindows()) {
     // We are the client process
@@ -466,10 +564,15 @@ void ExecuteDaemon(const string& exe, const std::vector<string>& args_vector,
     fprintf(stderr, "Cannot write PID file %s\n", pid_file.c_str());
   }
 
-  CloseHandle(processInfo.hProcess);
   CloseHandle(processInfo.hThread);
 
+#ifdef COMPILER_MSVC
+  // DaemonizeOnWindows() did not fork, this is still the client.
+  *server_startup = new ProcessHandleBlazeServerStartup(processInfo.hProcess);
+#else  // not COMPILER_MSVC
+  CloseHandle(processInfo.hProcess);
   exit(0);
+#endif  // COMPILER_MSVC
 }
 
 void BatchWaiterThread(HANDLE java_handle) {
@@ -606,6 +709,15 @@ void ExecuteProgram(
   exit(exit_code);
 }
 
+bool CanExecuteProgramWithEnvironment() { return false; }
+
+void ExecuteProgramWithEnvironment(const string& cwd,
+                                   const vector<string>& args_vector,
+                                   const vector<string>& env) {
+  pdie(blaze_exit_code::INTERNAL_ERROR,
+       "ExecuteProgramWithEnvironment is not supported on Windows");
+}
+
 string ListSeparator() { return ";"; }
 
 string ConvertPath(const string& path) {
@@ -867,6 +979,16 @@ bool KillServerProcess(int pid) {
 void ExcludePathFromBackup(const string &path) {
 }
 
+// Not supported.
+void ExcludePathFromIndexing(const string& path) {
+}
+
+bool MountOutputVolume(const string& name, string* mount_point,
+                       string* error) {
+  *error = "only supported on macOS";
+  return false;
+}
+
 string GetHashedBaseDir(const string& root, const string& hashable) {
   // Builds a shorter output base dir name for Windows.
   // This algorithm only uses 1/3 of the bits to get 8-char alphanumeric
@@ -936,9 +1058,41 @@ void CreateSecureOutputRoot(const string& path) {
   }
 
   ExcludePathFromBackup(root);
+  ExcludePathFromIndexing(root);
 #endif  // COMPILER_MSVC
 }
 
+bool CreateLocalOutputRoot(const string& scratch_dir, const string& root,
+                           string* error) {
+  *error = "not supported on Windows";
+  return false;
+}
+
+bool IsOwnedByRoot(const string& path, string* error) {
+  *error = "not supported on Windows";
+  return false;
+}
+
+bool IsFileOwnedByRoot(const string& path, string* error) {
+  *error = "not supported on Windows";
+  return false;
+}
+
+bool CloneFile(const string& src, const string& dst) {
+  errno = ENOTSUP;
+  return false;
+}
+
+bool CloneOutputBase(const string& template_base, const string& output_base,
+                     string* error) {
+  *error = "not supported on Windows";
+  return false;
+}
+
+void DeleteStaleOutputBases(const string& output_user_root, const string& keep,
+                            int max_age_secs) {
+}
+
 #ifdef COMPILER_MSVC
 bool MakeDirectories(const string& path, unsigned int mode) {
   // TODO(bazel-team): implement this.
@@ -0,0 +1,261 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/client_lib.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <grpc++/channel.h>
+#include <grpc++/client_context.h>
+#include <grpc++/create_channel.h>
+#include <grpc++/security/credentials.h>
+
+#include <chrono>  // NOLINT (gRPC requires this)
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/main/cpp/blaze_util.h"
+#include "src/main/cpp/blaze_util_platform.h"
+#include "src/main/cpp/util/strings.h"
+
+#include "src/main/protobuf/command_server.grpc.pb.h"
+
+namespace blaze {
+
+using std::string;
+using std::vector;
+
+struct BlazeClient::Stub {
+  std::unique_ptr<command_server::CommandServer::Stub> stub;
+};
+
+bool ReadServerAddress(const string &output_base, ServerAddress *address) {
+  const string server_dir = output_base + "/server";
+  const string ipv4_prefix = "127.0.0.1:";
+  const string ipv6_prefix_1 = "[0:0:0:0:0:0:0:1]:";
+  const string ipv6_prefix_2 = "[::1]:";
+  const string unix_prefix = "unix:";
+
+  string port;
+  if (!ReadFile(server_dir + "/command_port", &port)) {
+    return false;
+  }
+
+  if (port.compare(0, unix_prefix.size(), unix_prefix) == 0) {
+    // The server listens on a Unix domain socket. Only connect to the one in
+    // the server directory, which is not accessible to other users.
+    port = unix_prefix + server_dir + "/server.socket";
+  } else if (port.compare(0, ipv4_prefix.size(), ipv4_prefix) &&
+             port.compare(0, ipv6_prefix_1.size(), ipv6_prefix_1) &&
+             port.compare(0, ipv6_prefix_2.size(), ipv6_prefix_2)) {
+    // Make sure that we are being directed to localhost
+    return false;
+  }
+
+  ServerAddress result;
+  result.target = port;
+  if (!ReadFile(server_dir + "/request_cookie", &result.request_cookie) ||
+      !ReadFile(server_dir + "/response_cookie", &result.response_cookie)) {
+    return false;
+  }
+  *address = result;
+  return true;
+}
+
+// Runs the launcher in the workspace directory and returns what it wrote to
+// its standard output in *output. Its standard error goes to ours.
+static bool RunLauncher(const string &launcher_path, const string &workspace,
+                        const vector<string> &args, string *output,
+                        string *error) {
+  int fds[2];
+  if (pipe(fds) == -1) {
+    *error = string("pipe: ") + strerror(errno);
+    return false;
+  }
+
+  // Everything the child needs is allocated before fork(), as the other
+  // threads of the tool may hold the allocator lock.
+  vector<const char *> argv;
+  argv.push_back(launcher_path.c_str());
+  for (const string &arg : args) {
+    argv.push_back(arg.c_str());
+  }
+  argv.push_back(NULL);
+
+  pid_t child = fork();
+  if (child == -1) {
+    *error = string("fork: ") + strerror(errno);
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (child == 0) {
+    close(fds[0]);
+    if (dup2(fds[1], STDOUT_FILENO) == -1 ||
+        chdir(workspace.c_str()) == -1) {
+      _exit(127);
+    }
+    execv(argv[0], const_cast<char **>(argv.data()));
+    _exit(127);
+  }
+
+  close(fds[1]);
+  bool read_ok = ReadFileDescriptor(fds[0], output);
+  int status;
+  while (waitpid(child, &status, 0) == -1) {
+    if (errno != EINTR) {
+      *error = string("waitpid: ") + strerror(errno);
+      return false;
+    }
+  }
+  if (!read_ok) {
+    *error = "cannot read the output of " + launcher_path;
+    return false;
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    *error = launcher_path + " failed in " + workspace;
+    return false;
+  }
+  return true;
+}
+
+BlazeClient *BlazeClient::Connect(const string &output_base,
+                                  int connect_timeout_secs, string *error) {
+  ServerAddress address;
+  if (!ReadServerAddress(output_base, &address)) {
+    *error = "no server is running in " + output_base;
+    return NULL;
+  }
+
+  std::shared_ptr<grpc::Channel> channel(grpc::CreateChannel(
+      address.target, grpc::InsecureChannelCredentials()));
+  std::unique_ptr<Stub> stub(new Stub);
+  stub->stub = command_server::CommandServer::NewStub(channel);
+
+  grpc::ClientContext context;
+  context.set_deadline(std::chrono::system_clock::now() +
+                       std::chrono::seconds(connect_timeout_secs));
+  command_server::PingRequest request;
+  command_server::PingResponse response;
+  request.set_cookie(address.request_cookie);
+  grpc::Status status = stub->stub->Ping(&context, request, &response);
+  if (!status.ok()) {
+    *error = "cannot connect to the server of " + output_base + ": " +
+             status.error_message();
+    return NULL;
+  }
+  if (response.cookie() != address.response_cookie) {
+    *error = "the server of " + output_base + " answered with a wrong cookie";
+    return NULL;
+  }
+
+  return new BlazeClient(output_base, address, std::move(stub));
+}
+
+BlazeClient *BlazeClient::Start(const string &launcher_path,
+                                const string &workspace,
+                                const vector<string> &startup_options,
+                                string *error) {
+  // "info output_base" starts the server if it does not run yet.
+  vector<string> args(startup_options);
+  args.push_back("info");
+  args.push_back("output_base");
+  string output_base;
+  if (!RunLauncher(launcher_path, workspace, args, &output_base, error)) {
+    return NULL;
+  }
+  blaze_util::StripWhitespace(&output_base);
+  return Connect(output_base, 10, error);
+}
+
+BlazeClient::BlazeClient(const string &output_base,
+                         const ServerAddress &address,
+                         std::unique_ptr<Stub> stub)
+    : output_base_(output_base), address_(address), stub_(std::move(stub)) {}
+
+BlazeClient::~BlazeClient() {}
+
+bool BlazeClient::Run(const vector<string> &args, CommandOutput *output,
+                      int *exit_code, string *error) {
+  command_server::RunRequest request;
+  request.set_cookie(address_.request_cookie);
+  request.set_block_for_lock(true);
+  request.set_client_description("pid=" + GetProcessIdAsString() +
+                                 " (client library)");
+  for (const string &arg : args) {
+    request.add_arg(arg);
+  }
+
+  grpc::ClientContext context;
+  std::unique_ptr<grpc::ClientReader<command_server::RunResponse>> reader(
+      stub_->stub->Run(&context, request));
+
+  command_server::RunResponse response;
+  bool command_id_set = false;
+  bool finished = false;
+  while (reader->Read(&response)) {
+    if (response.cookie() != address_.response_cookie) {
+      context.TryCancel();
+      reader->Finish();
+      *error = "server response cookie invalid";
+      return false;
+    }
+    if (!command_id_set && !response.command_id().empty()) {
+      command_id_set = true;
+      output->OnCommandId(response.command_id());
+    }
+    if (!response.standard_output().empty()) {
+      output->OnStdout(response.standard_output());
+    }
+    if (!response.standard_error().empty()) {
+      output->OnStderr(response.standard_error());
+    }
+    if (response.finished()) {
+      finished = true;
+      *exit_code = response.exit_code();
+    }
+  }
+
+  grpc::Status status = reader->Finish();
+  if (!finished) {
+    *error = status.ok()
+                 ? "server finished RPC without an explicit exit code"
+                 : "server went away: " + status.error_message();
+    return false;
+  }
+  return true;
+}
+
+bool BlazeClient::Cancel(const string &command_id, string *error) {
+  command_server::CancelRequest request;
+  request.set_cookie(address_.request_cookie);
+  request.set_command_id(command_id);
+  grpc::ClientContext context;
+  context.set_deadline(std::chrono::system_clock::now() +
+                       std::chrono::seconds(10));
+  command_server::CancelResponse response;
+  grpc::Status status = stub_->stub->Cancel(&context, request, &response);
+  if (!status.ok()) {
+    *error = "could not interrupt server: " + status.error_message();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace blaze
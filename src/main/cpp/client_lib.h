@@ -0,0 +1,114 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+// client_lib.h: Runs commands on the Bazel server from other programs.
+//
+// Tools that run many commands, e.g. queries for an IDE, can keep a
+// connection to the server instead of starting the launcher for each:
+//
+//   std::string error;
+//   std::unique_ptr<blaze::BlazeClient> client(blaze::BlazeClient::Start(
+//       "/usr/bin/bazel", workspace, {}, &error));
+//   int exit_code;
+//   client->Run({"query", "//foo/..."}, &output, &exit_code, &error);
+//
+#ifndef BAZEL_SRC_MAIN_CPP_CLIENT_LIB_H_
+#define BAZEL_SRC_MAIN_CPP_CLIENT_LIB_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace blaze {
+
+// How to reach the server of an output base, as it wrote it into its server
+// directory.
+struct ServerAddress {
+  // The gRPC target: "127.0.0.1:<port>", an IPv6 localhost address or
+  // "unix:<server directory>/server.socket".
+  std::string target;
+  std::string request_cookie;
+  std::string response_cookie;
+};
+
+// Reads the address of the server of output_base. Returns false if there is
+// none, or if it listens on anything else than localhost.
+bool ReadServerAddress(const std::string &output_base, ServerAddress *address);
+
+// Receives what BlazeClient::Run() gets from the server. The callbacks run on
+// the thread that called Run().
+class CommandOutput {
+ public:
+  virtual ~CommandOutput() {}
+
+  // Called once, as soon as the server assigned the command its id, which
+  // BlazeClient::Cancel() takes.
+  virtual void OnCommandId(const std::string &command_id) {}
+
+  virtual void OnStdout(const std::string &data) = 0;
+  virtual void OnStderr(const std::string &data) = 0;
+};
+
+// A connection to the server of one output base. Any number of threads can
+// Run() commands over it at the same time; the server runs them one after the
+// other (see command_server.proto) and each can be cancelled on its own.
+class BlazeClient {
+ public:
+  // Connects to the running server of output_base. Returns NULL, with *error
+  // set, if there is none or it does not answer within connect_timeout_secs.
+  static BlazeClient *Connect(const std::string &output_base,
+                              int connect_timeout_secs, std::string *error);
+
+  // Runs the launcher at launcher_path in the workspace directory, with the
+  // startup options, to find the output base and start its server unless it
+  // already runs, then connects to the server. Returns NULL, with *error set,
+  // on failure.
+  static BlazeClient *Start(const std::string &launcher_path,
+                            const std::string &workspace,
+                            const std::vector<std::string> &startup_options,
+                            std::string *error);
+
+  ~BlazeClient();
+
+  const std::string &output_base() const { return output_base_; }
+
+  // Runs the command args, the name of the command followed by its options
+  // and arguments, waiting for the commands before it. Sets *exit_code to the
+  // exit code of the command, as the launcher would exit with. Returns false,
+  // with *error set, if the server could not be reached or went away before
+  // the end of the command.
+  bool Run(const std::vector<std::string> &args, CommandOutput *output,
+           int *exit_code, std::string *error);
+
+  // Cancels the command command_id, running or waiting. Returns false, with
+  // *error set, if the request did not reach the server.
+  bool Cancel(const std::string &command_id, std::string *error);
+
+ private:
+  // The gRPC stub, which keeps the channel, in a struct of its own so that
+  // this header does not need the gRPC ones.
+  struct Stub;
+
+  BlazeClient(const std::string &output_base, const ServerAddress &address,
+              std::unique_ptr<Stub> stub);
+
+  const std::string output_base_;
+  const ServerAddress address_;
+  std::unique_ptr<Stub> stub_;
+};
+
+}  // namespace blaze
+
+#endif  // BAZEL_SRC_MAIN_CPP_CLIENT_LIB_H_
@@ -32,6 +32,14 @@ class StartupOptions;
 // Keep in sync with logging.proto.
 enum RestartReason { NO_RESTART = 0, NO_DAEMON, NEW_VERSION, NEW_OPTIONS };
 
+// A phase of the client startup. The times are in ms since the start of the
+// process.
+struct StartupPhase {
+  std::string description;
+  uint64_t start;
+  uint64_t duration;
+};
+
 struct GlobalVariables {
   GlobalVariables(OptionProcessor *option_processor);
 
@@ -81,6 +89,10 @@ struct GlobalVariables {
   // This is part of startup_time.
   uint64_t command_wait_time;
 
+  // The phases of the client startup, in the order they ended. They are passed
+  // to the server, which adds them to its profile.
+  std::vector<StartupPhase> startup_phases;
+
   // The reason for the server restart.
   RestartReason restart_reason;
 
@@ -17,6 +17,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <algorithm>
 #include <cassert>
 #include <set>
@@ -27,6 +30,7 @@
 #include "src/main/cpp/util/file.h"
 #include "src/main/cpp/util/file_platform.h"
 #include "src/main/cpp/util/logging.h"
+#include "src/main/cpp/util/numbers.h"
 #include "src/main/cpp/util/strings.h"
 #include "src/main/cpp/workspace_layout.h"
 
@@ -55,12 +59,13 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
     const string& workspace,
     vector<RcFile*>* rcfiles,
     map<string, vector<RcOption> >* rcoptions,
+    vector<int>* startup_rcfiles,
     string* error) {
   list<string> initial_import_stack;
   initial_import_stack.push_back(filename_);
   return Parse(
-      workspace, filename_, index_, rcfiles, rcoptions, &initial_import_stack,
-      error);
+      workspace, filename_, index_, rcfiles, rcoptions, startup_rcfiles,
+      &initial_import_stack, error);
 }
 
 blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
@@ -69,6 +74,7 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
     const int index,
     vector<RcFile*>* rcfiles,
     map<string, vector<RcOption> >* rcoptions,
+    vector<int>* startup_rcfiles,
     list<string>* import_stack,
     string* error) {
   string filename(filename_ref);  // file
@@ -139,7 +145,8 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
       blaze_exit_code::ExitCode parse_exit_code =
         RcFile::Parse(workspace, rcfiles->back()->Filename(),
                       rcfiles->back()->Index(),
-                      rcfiles, rcoptions, import_stack, error);
+                      rcfiles, rcoptions, startup_rcfiles, import_stack,
+                      error);
       if (parse_exit_code != blaze_exit_code::SUCCESS) {
         return parse_exit_code;
       }
@@ -159,10 +166,162 @@ blaze_exit_code::ExitCode OptionProcessor::RcFile::Parse(
     blaze_util::JoinStrings(startup_options, ' ', &startup_args);
     fprintf(stderr, "INFO: Reading 'startup' options from %s: %s\n",
             filename.c_str(), startup_args.c_str());
+    startup_rcfiles->push_back(index);
   }
   return blaze_exit_code::SUCCESS;
 }
 
+// The rc cache is a line for each of the blazerc files in the order of their
+// indices, each of the options and each of the files that startup options
+// were reported for, followed by an end marker that a partially written cache
+// lacks:
+//   f <description> <path>
+//   o <index> <command> <option>
+//   s <index>
+//   end
+// The fields are separated by tabs. Neither paths nor options parsed from a
+// line can contain a newline.
+static const char kRcCacheVersion[] = "rc cache 1";
+
+string OptionProcessor::GetRcCacheFile(const vector<string>& args,
+                                       const string& workspace,
+                                       const vector<string>& blazerc_paths) {
+  // The startup options are not parsed yet, so the output user root is taken
+  // from the command line, where the last occurrence wins as it does later.
+  // One set in a blazerc is not known before reading the blazercs; the cache
+  // then stays under the one from the command line or the default.
+  string output_user_root = parsed_startup_options_->output_user_root;
+  for (size_t i = 1; i < args.size() && IsArg(args[i]); ++i) {
+    const char* next_arg = i + 1 < args.size() ? args[i + 1].c_str() : NULL;
+    const char* value =
+        GetUnaryOption(args[i].c_str(), next_arg, "--output_user_root");
+    if (value != NULL) {
+      output_user_root = MakeAbsolute(value);
+      if (value == next_arg) {
+        ++i;
+      }
+    }
+  }
+  string cache_dir = blaze_util::JoinPath(output_user_root, "rc_cache");
+  if (!blaze_util::PathExists(cache_dir) && !MakeDirectories(cache_dir, 0755)) {
+    return "";
+  }
+  string key = workspace;
+  for (const string& path : blazerc_paths) {
+    key += "\n" + path;
+  }
+  return GetHashedBaseDir(cache_dir, key);
+}
+
+bool OptionProcessor::ReadRcCache(const string& cache_file) {
+  string contents;
+  if (cache_file.empty() || !ReadFile(cache_file, &contents)) {
+    return false;
+  }
+  vector<string> lines = blaze_util::Split(contents, '\n');
+  if (lines.size() < 2 || lines[0] != kRcCacheVersion ||
+      lines.back() != "end" || contents[contents.size() - 1] != '\n') {
+    return false;
+  }
+
+  vector<RcFile*> blazercs;
+  map<string, vector<RcOption> > rcoptions;
+  vector<int> startup_rcfiles;
+  bool valid = true;
+  for (size_t i = 1; valid && i < lines.size() - 1; ++i) {
+    const string& line = lines[i];
+    size_t tab1 = line.find('\t');
+    size_t tab2 = tab1 == string::npos ? tab1 : line.find('\t', tab1 + 1);
+    size_t tab3 = tab2 == string::npos ? tab2 : line.find('\t', tab2 + 1);
+    int index;
+    if (line.compare(0, 2, "f\t") == 0 && tab2 != string::npos) {
+      string path = line.substr(tab2 + 1);
+      string description = line.substr(tab1 + 1, tab2 - tab1 - 1);
+      valid = !description.empty() && description == DescribeFile(path);
+      blazercs.push_back(new RcFile(path, blazercs.size()));
+    } else if (line.compare(0, 2, "o\t") == 0 && tab3 != string::npos &&
+               blaze_util::safe_strto32(line.substr(tab1 + 1, tab2 - tab1 - 1),
+                                        &index) &&
+               index >= 0 && static_cast<size_t>(index) < blazercs.size()) {
+      rcoptions[line.substr(tab2 + 1, tab3 - tab2 - 1)].push_back(
+          RcOption(index, line.substr(tab3 + 1)));
+    } else if (line.compare(0, 2, "s\t") == 0 &&
+               blaze_util::safe_strto32(line.substr(2), &index) &&
+               index >= 0 && static_cast<size_t>(index) < blazercs.size()) {
+      startup_rcfiles.push_back(index);
+    } else {
+      valid = false;
+    }
+  }
+  if (!valid) {
+    for (RcFile* blazerc : blazercs) {
+      delete blazerc;
+    }
+    return false;
+  }
+
+  BAZEL_LOG(INFO) << "Using the parsed RcFiles cached in " << cache_file;
+  blazercs_.swap(blazercs);
+  rcoptions_.swap(rcoptions);
+  const vector<RcOption>& startup_options = rcoptions_["startup"];
+  for (int index : startup_rcfiles) {
+    vector<string> options;
+    for (const RcOption& option : startup_options) {
+      if (option.rcfile_index() == index) {
+        options.push_back(option.option());
+      }
+    }
+    string startup_args;
+    blaze_util::JoinStrings(options, ' ', &startup_args);
+    fprintf(stderr, "INFO: Reading 'startup' options from %s: %s\n",
+            blazercs_[index]->Filename().c_str(), startup_args.c_str());
+  }
+  if (startup_options.empty()) {
+    rcoptions_.erase("startup");
+  }
+  return true;
+}
+
+void OptionProcessor::WriteRcCache(const string& cache_file,
+                                   const vector<int>& startup_rcfiles) {
+  if (cache_file.empty()) {
+    return;
+  }
+  string contents = string(kRcCacheVersion) + "\n";
+  // A file modified within the same second as it was read could change again
+  // without its description changing, so it is not cached until it settles.
+  time_t settled = time(NULL) - 1;
+  for (const RcFile* blazerc : blazercs_) {
+    struct stat buf;
+    if (stat(blazerc->Filename().c_str(), &buf) < 0 ||
+        buf.st_mtime >= settled) {
+      return;
+    }
+    contents += "f\t" + DescribeFile(blazerc->Filename()) + "\t" +
+                blazerc->Filename() + "\n";
+  }
+  for (const auto& it : rcoptions_) {
+    if (it.first.find('\t') != string::npos) {
+      return;
+    }
+    for (const RcOption& option : it.second) {
+      contents += "o\t" + ToString(option.rcfile_index()) + "\t" + it.first +
+                  "\t" + option.option() + "\n";
+    }
+  }
+  for (int index : startup_rcfiles) {
+    contents += "s\t" + ToString(index) + "\n";
+  }
+  contents += "end\n";
+
+  // Failing to write the cache only costs parsing the files again next time.
+  string tmp_file = cache_file + ".tmp." + GetProcessIdAsString();
+  if (!WriteFile(contents, tmp_file) ||
+      rename(tmp_file.c_str(), cache_file.c_str()) == -1) {
+    unlink(tmp_file.c_str());
+  }
+}
+
 OptionProcessor::OptionProcessor(
     std::unique_ptr<StartupOptions> default_startup_options) :
     initialized_(false),
@@ -349,18 +508,31 @@ blaze_exit_code::ExitCode OptionProcessor::ParseOptions(
   // Throw away missing files, dedupe candidate blazerc paths, and parse the
   // blazercs, all while preserving order. Duplicates can arise if e.g. the
   // binary's path *is* the depot path.
-  set<string> blazerc_paths;
+  set<string> blazerc_path_set;
+  vector<string> blazerc_paths;
   for (const auto& candidate_blazerc_path : candidate_blazerc_paths) {
     if (!candidate_blazerc_path.empty()
-        && (blazerc_paths.insert(candidate_blazerc_path).second)) {
-      blazercs_.push_back(
-          new RcFile(candidate_blazerc_path, blazercs_.size()));
+        && (blazerc_path_set.insert(candidate_blazerc_path).second)) {
+      blazerc_paths.push_back(candidate_blazerc_path);
+    }
+  }
+
+  // Shell completion and IDEs run the client often, and the blazercs rarely
+  // change in between, so their parsed contents are reused while none of the
+  // files, imported ones included, changes.
+  string rc_cache_file = GetRcCacheFile(args, workspace, blazerc_paths);
+  if (!ReadRcCache(rc_cache_file)) {
+    vector<int> startup_rcfiles;
+    for (const auto& blazerc_path : blazerc_paths) {
+      blazercs_.push_back(new RcFile(blazerc_path, blazercs_.size()));
       blaze_exit_code::ExitCode parse_exit_code =
-          blazercs_.back()->Parse(workspace, &blazercs_, &rcoptions_, error);
+          blazercs_.back()->Parse(workspace, &blazercs_, &rcoptions_,
+                                  &startup_rcfiles, error);
       if (parse_exit_code != blaze_exit_code::SUCCESS) {
         return parse_exit_code;
       }
     }
+    WriteRcCache(rc_cache_file, startup_rcfiles);
   }
 
   blaze_exit_code::ExitCode parse_startup_options_exit_code =
@@ -122,7 +122,7 @@ class OptionProcessor {
     blaze_exit_code::ExitCode Parse(
         const std::string& workspace, std::vector<RcFile*>* rcfiles,
         std::map<std::string, std::vector<RcOption> >* rcoptions,
-        std::string* error);
+        std::vector<int>* startup_rcfiles, std::string* error);
     const std::string& Filename() const { return filename_; }
     const int Index() const { return index_; }
 
@@ -131,12 +131,30 @@ class OptionProcessor {
         const std::string& workspace, const std::string& filename,
         const int index, std::vector<RcFile*>* rcfiles,
         std::map<std::string, std::vector<RcOption> >* rcoptions,
+        std::vector<int>* startup_rcfiles,
         std::list<std::string>* import_stack, std::string* error);
 
     std::string filename_;
     int index_;
   };
 
+  // Returns the file that caches the parsed contents of the given blazerc
+  // files and of the files they import, or "" if there is no place for it.
+  // The cache is under the output user root given by the startup options in
+  // args, if any.
+  std::string GetRcCacheFile(const std::vector<std::string>& args,
+                             const std::string& workspace,
+                             const std::vector<std::string>& blazerc_paths);
+
+  // Restores blazercs_ and rcoptions_ from the cache at cache_file and
+  // prints what parsing the files would. Returns false, changing nothing, if
+  // there is no cache or one of its files changed since it was written.
+  bool ReadRcCache(const std::string& cache_file);
+
+  // Writes blazercs_ and rcoptions_ to the cache at cache_file.
+  void WriteRcCache(const std::string& cache_file,
+                    const std::vector<int>& startup_rcfiles);
+
   void AddRcfileArgsAndOptions(bool batch, const std::string& cwd);
   blaze_exit_code::ExitCode ParseStartupOptions(std::string* error);
 
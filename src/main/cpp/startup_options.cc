@@ -48,6 +48,12 @@ StartupOptions::StartupOptions(const string &product_name)
       oom_more_eagerly_threshold(100),
       write_command_log(true),
       watchfs(false),
+      lazy_install_base(false),
+      command_server_unix_socket(false),
+      direct_stdout(false),
+      server_class_archive(false),
+      machine_aware_jvm_args(false),
+      output_base_per_startup_options(false),
       allow_configurable_attributes(false),
       fatal_event_bus_exceptions(false),
       command_port(0),
@@ -66,16 +72,27 @@ StartupOptions::StartupOptions(const string &product_name)
       output_root, "_" + product_name_lower + "_" + GetUserName());
   // 3 hours (but only 15 seconds if used within a test)
   max_idle_secs = testing ? 15 : (3 * 3600);
+  idle_trim_secs = 300;
   nullary_options = {"deep_execroot", "block_for_lock",
       "host_jvm_debug", "master_blazerc", "master_bazelrc", "batch",
       "batch_cpu_scheduling", "allow_configurable_attributes",
       "fatal_event_bus_exceptions", "experimental_oom_more_eagerly",
-      "write_command_log", "watchfs", "client_debug"};
+      "write_command_log", "watchfs", "client_debug",
+      "experimental_lazy_install_base",
+      "experimental_command_server_unix_socket",
+      "experimental_direct_stdout", "experimental_server_class_archive",
+      "experimental_machine_aware_host_jvm_args",
+      "experimental_output_base_per_startup_options"};
   unary_options = {"output_base", "install_base",
       "output_user_root", "host_jvm_profile", "host_javabase",
       "host_jvm_args", "bazelrc", "blazerc", "io_nice_level",
-      "max_idle_secs", "experimental_oom_more_eagerly_threshold",
-      "command_port", "invocation_policy", "connect_timeout_secs"};
+      "max_idle_secs", "experimental_idle_trim_secs",
+      "experimental_oom_more_eagerly_threshold", "command_port", "invocation_policy", "connect_timeout_secs",
+      "experimental_server_cgroup", "experimental_server_cgroup_setting",
+      "experimental_local_output_user_root",
+      "experimental_output_user_root_volume",
+      "experimental_shared_install_root",
+      "experimental_output_base_template"};
 }
 
 StartupOptions::~StartupOptions() {}
@@ -126,14 +143,41 @@ blaze_exit_code::ExitCode StartupOptions::ProcessArg(
   if ((value = GetUnaryOption(arg, next_arg, "--output_base")) != NULL) {
     output_base = MakeAbsolute(value);
     option_sources["output_base"] = rcfile;
+  } else if ((value = GetUnaryOption(arg, next_arg,
+                                     "--experimental_output_base_template")) !=
+             NULL) {
+    output_base_template = value[0] == '\0' ? "" : MakeAbsolute(value);
+    option_sources["experimental_output_base_template"] = rcfile;
   } else if ((value = GetUnaryOption(arg, next_arg,
                                      "--install_base")) != NULL) {
     install_base = MakeAbsolute(value);
     option_sources["install_base"] = rcfile;
+  } else if ((value = GetUnaryOption(arg, next_arg,
+                                     "--experimental_shared_install_root")) !=
+             NULL) {
+    shared_install_root = value[0] == '\0' ? "" : MakeAbsolute(value);
+    option_sources["experimental_shared_install_root"] = rcfile;
   } else if ((value = GetUnaryOption(arg, next_arg,
                                      "--output_user_root")) != NULL) {
     output_user_root = MakeAbsolute(value);
     option_sources["output_user_root"] = rcfile;
+  } else if ((value = GetUnaryOption(
+                  arg, next_arg, "--experimental_local_output_user_root")) !=
+             NULL) {
+    local_output_user_root = value[0] == '\0' ? "" : MakeAbsolute(value);
+    option_sources["experimental_local_output_user_root"] = rcfile;
+  } else if ((value = GetUnaryOption(
+                  arg, next_arg, "--experimental_output_user_root_volume")) !=
+             NULL) {
+    output_user_root_volume = value;
+    if (output_user_root_volume.find('/') != string::npos) {
+      blaze_util::StringPrintf(error,
+          "Invalid argument to --experimental_output_user_root_volume: '%s'.\n"
+          "Must be a volume name, without '/'.\n",
+          value);
+      return blaze_exit_code::BAD_ARGV;
+    }
+    option_sources["experimental_output_user_root_volume"] = rcfile;
   } else if (GetNullaryOption(arg, "--deep_execroot")) {
     deep_execroot = true;
     option_sources["deep_execroot"] = rcfile;
@@ -227,6 +271,16 @@ blaze_exit_code::ExitCode StartupOptions::ProcessArg(
       return blaze_exit_code::BAD_ARGV;
     }
     option_sources["max_idle_secs"] = rcfile;
+  } else if ((value = GetUnaryOption(arg, next_arg,
+                                     "--experimental_idle_trim_secs")) !=
+             NULL) {
+    if (!blaze_util::safe_strto32(value, &idle_trim_secs) ||
+        idle_trim_secs < 0) {
+      blaze_util::StringPrintf(error,
+          "Invalid argument to --experimental_idle_trim_secs: '%s'.", value);
+      return blaze_exit_code::BAD_ARGV;
+    }
+    option_sources["experimental_idle_trim_secs"] = rcfile;
   } else if (GetNullaryOption(arg, "-x")) {
     fprintf(stderr, "WARNING: The -x startup option is now ignored "
             "and will be removed in a future release\n");
@@ -261,6 +315,74 @@ blaze_exit_code::ExitCode StartupOptions::ProcessArg(
   } else if (GetNullaryOption(arg, "--nowatchfs")) {
     watchfs = false;
     option_sources["watchfs"] = rcfile;
+  } else if (GetNullaryOption(arg, "--experimental_lazy_install_base")) {
+    lazy_install_base = true;
+    option_sources["experimental_lazy_install_base"] = rcfile;
+  } else if (GetNullaryOption(arg, "--noexperimental_lazy_install_base")) {
+    lazy_install_base = false;
+    option_sources["experimental_lazy_install_base"] = rcfile;
+  } else if (GetNullaryOption(arg,
+                              "--experimental_command_server_unix_socket")) {
+    command_server_unix_socket = true;
+    option_sources["experimental_command_server_unix_socket"] = rcfile;
+  } else if (GetNullaryOption(arg,
+                              "--noexperimental_command_server_unix_socket")) {
+    command_server_unix_socket = false;
+    option_sources["experimental_command_server_unix_socket"] = rcfile;
+  } else if (GetNullaryOption(arg, "--experimental_direct_stdout")) {
+    direct_stdout = true;
+    option_sources["experimental_direct_stdout"] = rcfile;
+  } else if (GetNullaryOption(arg, "--noexperimental_direct_stdout")) {
+    direct_stdout = false;
+    option_sources["experimental_direct_stdout"] = rcfile;
+  } else if (GetNullaryOption(arg, "--experimental_server_class_archive")) {
+    server_class_archive = true;
+    option_sources["experimental_server_class_archive"] = rcfile;
+  } else if (GetNullaryOption(arg, "--noexperimental_server_class_archive")) {
+    server_class_archive = false;
+    option_sources["experimental_server_class_archive"] = rcfile;
+  } else if (GetNullaryOption(arg,
+                              "--experimental_machine_aware_host_jvm_args")) {
+    machine_aware_jvm_args = true;
+    option_sources["experimental_machine_aware_host_jvm_args"] = rcfile;
+  } else if (GetNullaryOption(
+                 arg, "--noexperimental_machine_aware_host_jvm_args")) {
+    machine_aware_jvm_args = false;
+    option_sources["experimental_machine_aware_host_jvm_args"] = rcfile;
+  } else if (GetNullaryOption(
+                 arg, "--experimental_output_base_per_startup_options")) {
+    output_base_per_startup_options = true;
+    option_sources["experimental_output_base_per_startup_options"] = rcfile;
+  } else if (GetNullaryOption(
+                 arg, "--noexperimental_output_base_per_startup_options")) {
+    output_base_per_startup_options = false;
+    option_sources["experimental_output_base_per_startup_options"] = rcfile;
+  } else if ((value = GetUnaryOption(
+      arg, next_arg, "--experimental_server_cgroup")) != NULL) {
+    server_cgroup = value;
+    if (!server_cgroup.empty() && server_cgroup[0] != '/') {
+      blaze_util::StringPrintf(error,
+          "Invalid argument to --experimental_server_cgroup: '%s'.\n"
+          "Must be an absolute path in the cgroup hierarchy.\n",
+          value);
+      return blaze_exit_code::BAD_ARGV;
+    }
+    option_sources["experimental_server_cgroup"] = rcfile;
+  } else if ((value = GetUnaryOption(
+      arg, next_arg, "--experimental_server_cgroup_setting")) != NULL) {
+    string setting = value;
+    size_t equals = setting.find('=');
+    if (equals == string::npos || setting.find('.') > equals ||
+        setting.find('/') < equals || setting[0] == '.') {
+      blaze_util::StringPrintf(error,
+          "Invalid argument to --experimental_server_cgroup_setting: '%s'.\n"
+          "Must be of the form <controller>.<file>=<value>, "
+          "e.g. cpu.weight=20.\n",
+          value);
+      return blaze_exit_code::BAD_ARGV;
+    }
+    server_cgroup_settings.push_back(setting);
+    option_sources["experimental_server_cgroup_setting"] = rcfile;
   } else if (GetNullaryOption(arg, "--client_debug")) {
     client_debug = true;
     option_sources["client_debug"] = rcfile;
@@ -317,9 +439,41 @@ blaze_exit_code::ExitCode StartupOptions::ProcessArg(
   }
 
   *is_space_separated = ((value == next_arg) && (value != NULL));
+  if (!IsClientOnlyOption(arg)) {
+    server_startup_args.push_back(
+        *is_space_separated ? string(arg) + "=" + next_arg : string(arg));
+  }
   return blaze_exit_code::SUCCESS;
 }
 
+// Options that choose the output base, or that are only used by the client
+// or can change without restarting the server, are not part of the identity
+// of a server.
+bool StartupOptions::IsClientOnlyOption(const string &arg) {
+  static const char *kClientOnlyOptions[] = {
+      "output_base", "experimental_output_base_template", "output_user_root",
+      "experimental_local_output_user_root",
+      "experimental_output_user_root_volume",
+      "experimental_shared_install_root", "max_idle_secs",
+      "experimental_idle_trim_secs",
+      "block_for_lock", "client_debug", "connect_timeout_secs",
+      "experimental_direct_stdout",
+      "experimental_output_base_per_startup_options", "bazelrc", "blazerc",
+      "master_bazelrc", "master_blazerc"};
+  string name = arg;
+  if (name.compare(0, 2, "--") != 0) {
+    return false;
+  }
+  name = name.substr(2, name.find('=') == string::npos
+                            ? string::npos : name.find('=') - 2);
+  for (const char *option : kClientOnlyOptions) {
+    if (name == option || name == string("no") + option) {
+      return true;
+    }
+  }
+  return false;
+}
+
 blaze_exit_code::ExitCode StartupOptions::ProcessArgExtra(
     const char *arg, const char *next_arg, const string &rcfile,
     const char **value, bool *is_processed, string *error) {
@@ -126,9 +126,18 @@ class StartupOptions {
   // the BlazeDirectories Java class for details.
   std::string output_base;
 
+  // An output base that a new output base is cloned from, rather than
+  // starting empty; see SeedOutputBase(). Empty means none.
+  std::string output_base_template;
+
   // Installation base for a specific release installation.
   std::string install_base;
 
+  // A directory, owned by root, of installations shared by all users, which
+  // the install base is taken from if it has the one of this release; see
+  // UseSharedInstallBase(). Empty means none.
+  std::string shared_install_root;
+
   // The toplevel directory containing Blaze's output.  When Blaze is
   // run by a test, we use TEST_TMPDIR, simplifying the correct
   // hermetic invocation of Blaze from tests.
@@ -138,6 +147,16 @@ class StartupOptions {
   // output_base.
   std::string output_user_root;
 
+  // A directory on a local file system, like a scratch volume on an SSD, that
+  // the output user root is moved to if it is on a network file system.
+  // Empty means leave it there. An explicit --output_user_root is not moved.
+  std::string local_output_user_root;
+
+  // The name of a volume of its own for the output user root, which is
+  // mounted, or created, as needed; see MountOutputVolume(). Empty means none.
+  // An explicit --output_user_root takes precedence.
+  std::string output_user_root_volume;
+
   // Whether to put the execroot at $OUTPUT_BASE/$WORKSPACE_NAME (if false) or
   // $OUTPUT_BASE/execroot/$WORKSPACE_NAME (if true).
   bool deep_execroot;
@@ -167,6 +186,10 @@ class StartupOptions {
 
   int max_idle_secs;
 
+  // The number of seconds after which an idle server trims its heap, see
+  // GrpcServerImpl. Zero means never.
+  int idle_trim_secs;
+
   bool oom_more_eagerly;
 
   int oom_more_eagerly_threshold;
@@ -176,6 +199,47 @@ class StartupOptions {
   // If true, Blaze will listen to OS-level file change notifications.
   bool watchfs;
 
+  // If true, only the files the server needs to start up are extracted before
+  // starting it, the rest of the installation is extracted meanwhile.
+  bool lazy_install_base;
+
+  // If true, the gRPC command server listens on a Unix domain socket in the
+  // server directory instead of a TCP port.
+  bool command_server_unix_socket;
+
+  // If true and standard output is a pipe, the server writes the standard
+  // output of commands to the pipe directly instead of sending it to the
+  // client. Only Linux can hand the pipe to the server (see
+  // GetOutputPipePath), elsewhere this has no effect.
+  bool direct_stdout;
+
+  // If true, the server JVM uses a class data sharing archive in the install
+  // base, which is created the first time it exits.
+  bool server_class_archive;
+
+  // If true, the heap and the garbage collector of the server are fitted to
+  // the memory and processors of the machine or container.
+  bool machine_aware_jvm_args;
+
+  // The cgroup v2, as a path below the root of the hierarchy, that the server
+  // and the actions it runs are placed in. Empty means the cgroup of the
+  // client.
+  std::string server_cgroup;
+
+  // The settings for server_cgroup, each as "<file>=<value>", for example
+  // "cpu.weight=20".
+  std::vector<std::string> server_cgroup_settings;
+
+  // If true and --output_base is not given, every distinct set of startup
+  // options gets an output base, and thus a server, of its own, so that
+  // alternating between them does not restart the server every time.
+  bool output_base_per_startup_options;
+
+  // The startup options that were given, in the order they were processed,
+  // without those that only affect the client or that the server does not
+  // need to be restarted for.
+  std::vector<std::string> server_startup_args;
+
   // Temporary experimental flag that permits configurable attribute syntax
   // in BUILD files. This will be removed when configurable attributes is
   // a more stable feature.
@@ -193,6 +257,9 @@ class StartupOptions {
   virtual blaze_exit_code::ExitCode ValidateStartupOptions(
       const std::vector<std::string> &args, std::string *error);
 
+  // Returns true if the startup option "arg" does not affect the server.
+  static bool IsClientOnlyOption(const std::string &arg);
+
   // Returns the GetHostJavabase. This should be called after parsing
   // the --host_javabase option.
   std::string GetHostJavabase();
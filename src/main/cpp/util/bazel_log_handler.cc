@@ -14,11 +14,14 @@
 
 #include "src/main/cpp/util/bazel_log_handler.h"
 
+#include <stdint.h>
+
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 #include "src/main/cpp/util/file.h"
 #include "src/main/cpp/util/logging.h"
@@ -26,11 +29,18 @@
 namespace blaze_util {
 
 BazelLogHandler::BazelLogHandler()
-    : output_dir_set_attempted_(false),
+    : write_position_(0),
+      read_position_(0),
+      output_dir_set_attempted_(false),
       buffer_stream_(new std::stringstream()),
-      logfile_stream_(nullptr) {}
+      logfile_stream_(nullptr) {
+  for (size_t i = 0; i < kRingSize; i++) {
+    ring_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
 
 BazelLogHandler::~BazelLogHandler() {
+  Drain();
   // If we never wrote the logs to a file, dump the buffer to stderr,
   // otherwise, flush the stream.
   if (logfile_stream_ != nullptr) {
@@ -45,20 +55,45 @@ BazelLogHandler::~BazelLogHandler() {
 
 void BazelLogHandler::HandleMessage(LogLevel level, const std::string& filename,
                                     int line, const std::string& message) {
-  // Select the appropriate stream to log to.
-  std::ostream* log_stream;
-  if (logfile_stream_ != nullptr) {
-    log_stream = logfile_stream_.get();
-  } else {
-    log_stream = buffer_stream_.get();
+  // Claim the record at the write position. The claim fails if another
+  // thread claimed it first, and the record is not free if the ring is full.
+  size_t position = write_position_.load(std::memory_order_relaxed);
+  Record* record;
+  while (true) {
+    record = &ring_[position % kRingSize];
+    size_t sequence = record->sequence.load(std::memory_order_acquire);
+    intptr_t difference =
+        static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+    if (difference == 0) {
+      if (write_position_.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+        break;
+      }
+    } else {
+      if (difference < 0) {
+        // Make room. If the oldest record is still being written, the ring
+        // is drained up to it, so try again after the writer.
+        Drain();
+        std::this_thread::yield();
+      }
+      position = write_position_.load(std::memory_order_relaxed);
+    }
   }
-  *log_stream << "[bazel " << LogLevelName(level) << " " << filename << ":"
-              << line << "] " << message << "\n";
+  record->level = level;
+  record->line = line;
+  record->filename = filename;
+  record->message = message;
+  record->sequence.store(position + 1, std::memory_order_release);
 
   // If we have a fatal message, we should abort and leave a stack trace -
-  // normal exit behavior will be lost, so print this log message out to
-  // stderr and avoid loosing the information.
+  // normal exit behavior will be lost, so write out the log and print this
+  // log message out to stderr and avoid loosing the information.
   if (level == LOGLEVEL_FATAL) {
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    DrainLocked();
+    if (logfile_stream_ != nullptr) {
+      logfile_stream_->flush();
+    }
     std::cerr << "[bazel " << LogLevelName(level) << " " << filename << ":"
               << line << "] " << message << "\n";
     std::abort();
@@ -75,20 +110,50 @@ void BazelLogHandler::SetOutputDir(const std::string& new_output_dir) {
   // Create a log file in the newly available directory, and flush the
   // buffer to it.
   const std::string logfile = JoinPath(new_output_dir, "bazel_client.log");
-  logfile_stream_ = std::unique_ptr<std::ofstream>(
+  std::unique_ptr<std::ofstream> logfile_stream(
       new std::ofstream(logfile, std::fstream::out));
-  if (logfile_stream_->fail()) {
+  if (logfile_stream->fail()) {
     // If opening the stream failed, continue buffering and have the logs
     // dump to stderr at shutdown.
-    logfile_stream_ = std::move(nullptr);
     BAZEL_LOG(ERROR) << "Opening the log file failed, in directory "
                      << new_output_dir;
   } else {
-    // Transfer the contents of the buffer to the logfile's stream before
-    // replacing it.
-    *logfile_stream_ << buffer_stream_->rdbuf();
+    // Transfer the contents of the ring and of the buffer to the logfile's
+    // stream before replacing it.
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    DrainLocked();
+    *logfile_stream << buffer_stream_->rdbuf();
     buffer_stream_ = std::move(nullptr);
-    logfile_stream_->flush();
+    logfile_stream->flush();
+    logfile_stream_ = std::move(logfile_stream);
+  }
+}
+
+void BazelLogHandler::Drain() {
+  std::lock_guard<std::mutex> lock(drain_mutex_);
+  DrainLocked();
+}
+
+void BazelLogHandler::DrainLocked() {
+  std::ostream* log_stream;
+  if (logfile_stream_ != nullptr) {
+    log_stream = logfile_stream_.get();
+  } else {
+    log_stream = buffer_stream_.get();
+  }
+  while (true) {
+    Record* record = &ring_[read_position_ % kRingSize];
+    if (record->sequence.load(std::memory_order_acquire) !=
+        read_position_ + 1) {
+      // Still being written or not claimed yet.
+      break;
+    }
+    *log_stream << "[bazel " << LogLevelName(record->level) << " "
+                << record->filename << ":" << record->line << "] "
+                << record->message << "\n";
+    record->sequence.store(read_position_ + kRingSize,
+                           std::memory_order_release);
+    read_position_++;
   }
 }
 
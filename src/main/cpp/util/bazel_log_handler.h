@@ -15,7 +15,10 @@
 #ifndef BAZEL_SRC_MAIN_CPP_BAZEL_LOG_HANDLER_H_
 #define BAZEL_SRC_MAIN_CPP_BAZEL_LOG_HANDLER_H_
 
+#include <atomic>
 #include <iostream>
+#include <mutex>
+#include <string>
 
 #include "src/main/cpp/util/logging.h"
 
@@ -26,6 +29,11 @@ namespace blaze_util {
 // unknown at the time of the client's creation, logs are buffered until
 // SetOutputDir is called. At that point, all past log statements are dumped
 // in the appropriate file, and all following statements are logged directly.
+//
+// HandleMessage only copies the message into a slot of a fixed-size ring,
+// without taking a lock; the "[bazel LEVEL file:line]" prefix is formatted
+// and written when the ring is drained: when it is full, by SetOutputDir,
+// at destruction and before a FATAL message aborts the client.
 class BazelLogHandler : public blaze_util::LogHandler {
  public:
   BazelLogHandler();
@@ -42,6 +50,31 @@ class BazelLogHandler : public blaze_util::LogHandler {
   void SetOutputDir(const std::string& new_output_dir) override;
 
  private:
+  // A message waiting in the ring. The strings keep their capacity when the
+  // slot is reused, so once the ring went around, logging does not allocate.
+  struct Record {
+    // Equal to the position of the record in the ring when it is free for
+    // it, to that plus one once the record is complete.
+    std::atomic<size_t> sequence;
+    LogLevel level;
+    int line;
+    std::string filename;
+    std::string message;
+  };
+
+  static const size_t kRingSize = 1024;
+
+  // Formats the complete records in the ring and writes them to the log file
+  // or to the buffer. Called with drain_mutex_ held.
+  void DrainLocked();
+  void Drain();
+
+  Record ring_[kRingSize];
+  // The position of the next record to write and to drain.
+  std::atomic<size_t> write_position_;
+  size_t read_position_;
+  std::mutex drain_mutex_;
+
   bool output_dir_set_attempted_;
   std::unique_ptr<std::stringstream> buffer_stream_;
   std::unique_ptr<std::ofstream> logfile_stream_;
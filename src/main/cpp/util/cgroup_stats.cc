@@ -0,0 +1,64 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/cgroup_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace blaze_util {
+
+using std::string;
+
+bool ReadCgroupFile(const string &dir, const char *name, string *contents) {
+  int fd = open((dir + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  contents->clear();
+  char buf[4096];
+  ssize_t r;
+  while ((r = read(fd, buf, sizeof(buf))) > 0 || (r < 0 && errno == EINTR)) {
+    if (r > 0) {
+      contents->append(buf, r);
+    }
+  }
+  close(fd);
+  return r == 0;
+}
+
+int64_t FindCgroupValue(const string &contents, const char *key) {
+  for (size_t pos = contents.find(key); pos != string::npos;
+       pos = contents.find(key, pos + 1)) {
+    if (pos == 0 || contents[pos - 1] == '\n') {
+      return strtoll(contents.c_str() + pos + strlen(key), NULL, 10);
+    }
+  }
+  return -1;
+}
+
+int64_t SumCgroupValues(const string &contents, const char *key) {
+  int64_t sum = -1;
+  for (size_t pos = contents.find(key); pos != string::npos;
+       pos = contents.find(key, pos + 1)) {
+    int64_t value = strtoll(contents.c_str() + pos + strlen(key), NULL, 10);
+    sum = (sum < 0 ? 0 : sum) + value;
+  }
+  return sum;
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,43 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Reads the resource usage files of a Linux cgroup, for linux-sandbox and for
+// the process JNI of libunix.
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_CGROUP_STATS_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_CGROUP_STATS_H_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace blaze_util {
+
+// Reads the file 'name' of the cgroup directory 'dir' into 'contents';
+// returns false if it cannot be read.
+bool ReadCgroupFile(const std::string &dir, const char *name,
+                    std::string *contents);
+
+// Returns the value of the line "<key><number>" of 'contents', as in cpu.stat
+// or memory.events, or -1 if there is no such line. 'key' only matches at the
+// start of a line, so "oom_kill " does not match "oom_group_kill ".
+int64_t FindCgroupValue(const std::string &contents, const char *key);
+
+// Returns the sum of the values of every "<key><number>" in 'contents', as in
+// the per-device lines of io.stat, or -1 if there are none.
+int64_t SumCgroupValues(const std::string &contents, const char *key);
+
+}  // namespace blaze_util
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_CGROUP_STATS_H_
@@ -55,23 +55,24 @@ string JoinPath(const string &path1, const string &path2) {
     return path2;
   }
 
-  if (path1[path1.size() - 1] == '/') {
-    if (path2.find('/') == 0) {
-      // foo/ + /bar
-      return path1 + path2.substr(1);
-    } else {
-      // foo/ + bar
-      return path1 + path2;
-    }
+  // Build the result in place rather than out of temporaries.
+  bool path1_slash = path1[path1.size() - 1] == '/';
+  bool path2_slash = !path2.empty() && path2[0] == '/';
+  string result;
+  result.reserve(path1.size() + path2.size() + 1);
+  result += path1;
+  if (path1_slash && path2_slash) {
+    // foo/ + /bar
+    result.append(path2, 1, string::npos);
   } else {
-    if (path2.find('/') == 0) {
-      // foo + /bar
-      return path1 + path2;
-    } else {
+    if (!path1_slash && !path2_slash) {
       // foo + bar
-      return path1 + "/" + path2;
+      result += '/';
     }
+    // foo/ + bar, foo + /bar
+    result += path2;
   }
+  return result;
 }
 
 class DirectoryTreeWalker : public DirectoryEntryConsumer {
@@ -83,6 +83,36 @@ class DirectoryEntryConsumer {
 void ForEachDirectoryEntry(const std::string &path,
                            DirectoryEntryConsumer *consume);
 
+// Interface to be implemented by WalkDirectoryTree clients.
+//
+// Entries are passed as the descriptor of the directory they are in and their
+// name in it, both only valid during the call, so that they can be acted upon
+// with the *at() functions (openat, fstatat, utimensat...) without building
+// their paths. With more than one thread, the methods are called concurrently.
+class DirectoryTreeVisitor {
+ public:
+  virtual ~DirectoryTreeVisitor() {}
+
+  // Called for each entry that is not a directory, symlinks to directories
+  // included.
+  virtual void VisitFile(int dir_fd, const char *name) = 0;
+
+  // Called for each directory below the root, with "fd" an open descriptor of
+  // it. Returns whether to walk the entries of the directory.
+  virtual bool VisitDirectory(int /*dir_fd*/, const char * /*name*/,
+                              int /*fd*/) {
+    return true;
+  }
+};
+
+// Walks the tree under `path` (which is not visited itself), splitting the
+// subtrees between `threads` threads. Dies if a directory of the tree cannot
+// be read.
+//
+// Returns false if `path` could not be opened as a directory.
+bool WalkDirectoryTree(const std::string &path, DirectoryTreeVisitor *visitor,
+                       int threads = 1);
+
 }  // namespace blaze_util
 
 #endif  // BAZEL_SRC_MAIN_CPP_UTIL_FILE_PLATFORM_H_
@@ -21,6 +21,9 @@
 #include <unistd.h>  // access, open, close, fsync
 #include <utime.h>   // utime
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "src/main/cpp/util/errors.h"
@@ -201,4 +204,139 @@ void ForEachDirectoryEntry(const string &path,
   closedir(dir);
 }
 
+namespace {
+
+// Walks the directories of a WalkDirectoryTree() call. With more than one
+// thread, a directory met while a thread is idle is left to that thread,
+// otherwise it is walked right away, which keeps the number of open
+// directories down to about the depth of the tree per thread.
+class TreeWalker {
+ public:
+  TreeWalker(DirectoryTreeVisitor *visitor, int threads)
+      : visitor_(visitor), threads_(threads), busy_(0) {}
+
+  // Walks the directory open as `fd`, and closes it.
+  void Walk(int fd);
+
+  // Walks the directories in the queue until there are none left and no
+  // thread can queue more.
+  void Work();
+
+  void Queue(int fd) { queue_.push_back(fd); }
+
+ private:
+  // Queues the directory open as `fd` for an idle thread, if there is one.
+  bool Share(int fd);
+
+  DirectoryTreeVisitor *visitor_;
+  const int threads_;
+  // Guards the following.
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<int> queue_;
+  // The number of the threads walking a directory.
+  int busy_;
+};
+
+void TreeWalker::Walk(int fd) {
+  DIR *dir = fdopendir(fd);
+  if (dir == NULL) {
+    pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR, "fdopendir() failed");
+  }
+  int dir_fd = dirfd(dir);
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    const char *name = ent->d_name;
+    if (!strcmp(name, ".") || !strcmp(name, "..")) {
+      continue;
+    }
+
+    bool is_directory;
+    if (ent->d_type == DT_UNKNOWN) {
+      struct stat buf;
+      if (fstatat(dir_fd, name, &buf, AT_SYMLINK_NOFOLLOW) == -1) {
+        pdie(blaze_exit_code::INTERNAL_ERROR, "stat of '%s' failed", name);
+      }
+      is_directory = S_ISDIR(buf.st_mode);
+    } else {
+      is_directory = (ent->d_type == DT_DIR);
+    }
+    if (!is_directory) {
+      visitor_->VisitFile(dir_fd, name);
+      continue;
+    }
+
+    int sub_fd =
+        openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (sub_fd == -1) {
+      pdie(blaze_exit_code::LOCAL_ENVIRONMENTAL_ERROR,
+           "cannot open directory '%s'", name);
+    }
+    if (!visitor_->VisitDirectory(dir_fd, name, sub_fd)) {
+      close(sub_fd);
+    } else if (!Share(sub_fd)) {
+      Walk(sub_fd);
+    }
+  }
+  closedir(dir);
+}
+
+bool TreeWalker::Share(int fd) {
+  if (threads_ == 1) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (busy_ + static_cast<int>(queue_.size()) >= threads_) {
+    return false;
+  }
+  queue_.push_back(fd);
+  changed_.notify_one();
+  return true;
+}
+
+void TreeWalker::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    changed_.wait(lock, [this]() { return !queue_.empty() || busy_ == 0; });
+    if (queue_.empty()) {
+      // No thread is busy, so none can queue a directory any more.
+      return;
+    }
+    int fd = queue_.back();
+    queue_.pop_back();
+    ++busy_;
+    lock.unlock();
+    Walk(fd);
+    lock.lock();
+    if (--busy_ == 0 && queue_.empty()) {
+      changed_.notify_all();
+    }
+  }
+}
+
+}  // namespace
+
+bool WalkDirectoryTree(const string &path, DirectoryTreeVisitor *visitor,
+                       int threads) {
+  int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  TreeWalker walker(visitor, threads);
+  if (threads <= 1) {
+    walker.Walk(fd);
+    return true;
+  }
+  walker.Queue(fd);
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i) {
+    workers.emplace_back(&TreeWalker::Work, &walker);
+  }
+  walker.Work();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  return true;
+}
+
 }  // namespace blaze_util
@@ -78,4 +78,11 @@ void ForEachDirectoryEntry(const string &path,
   pdie(255, "blaze_util::ForEachDirectoryEntry is not implemented on Windows");
 }
 
+bool WalkDirectoryTree(const string &path, DirectoryTreeVisitor *visitor,
+                       int threads) {
+  // TODO(bazel-team): implement this.
+  pdie(255, "blaze_util::WalkDirectoryTree is not implemented on Windows");
+  return false;
+}
+
 }  // namespace blaze_util
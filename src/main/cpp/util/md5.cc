@@ -43,16 +43,16 @@
 #include <string.h>  // for memcpy
 #include <stddef.h>  // for ofsetof
 
-#if !_STRING_ARCH_unaligned
-# ifdef _LP64
-#  define UNALIGNED_P(p) (reinterpret_cast<uint64_t>(p) % \
-                          __alignof__(uint32_t) != 0)  // NOLINT
-# else
-#  define UNALIGNED_P(p) (reinterpret_cast<uint32_t>(p) % \
-                          __alignof__(uint32_t) != 0)  // NOLINT
-# endif
+#if defined(__GNUC__) || defined(__clang__)
+// The lanes of GCC's generic vectors digest several messages at once. They
+// are SSE2 or NEON registers by default; wider ones are picked at run time.
+#define MD5_VECTOR_LANES 1
+#define MD5_ALWAYS_INLINE inline __attribute__((always_inline))
+#if defined(__x86_64__)
+#define MD5_X86_WIDE_LANES 1
+#endif
 #else
-#  define UNALIGNED_P(p) (0)
+#define MD5_ALWAYS_INLINE inline
 #endif
 
 namespace blaze_util {
@@ -68,6 +68,10 @@ static const unsigned char kPadding[64] = {
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+static const uint32_t kInitialState[4] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
 // Digit conversion.
 static char hex_char[] = "0123456789abcdef";
 
@@ -93,6 +97,254 @@ static void b2a_hex(const unsigned char* from, string* to, int num) {
   b2a_hex_t<string&>(from, *to, num);
 }
 
+// Loads a word of a block, wherever it is aligned. Like the rest of this
+// file, it assumes a little-endian CPU.
+static MD5_ALWAYS_INLINE uint32_t LoadWord(const unsigned char* p) {
+  uint32_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+// The 64 steps of the MD5 transform of the block "x" on the state "a" to
+// "d", which is to be added to the state by the caller. T is either a
+// uint32_t, or a vector of them that digests a block of a message in
+// each of its lanes.
+template <typename T>
+static MD5_ALWAYS_INLINE void Md5Steps(T& a, T& b, T& c, T& d, const T* x) {
+  // F, G, H and I are basic MD5 functions.
+/* These are the four functions used in the four steps of the MD5 algorithm
+   and defined in the RFC 1321.  The first function is a little bit optimized
+   (as found in Colin Plumbs public domain implementation).  */
+/* #define F(b, c, d) ((b & c) | (~b & d)) */
+#define F(x, y, z) (z ^ (x & (y ^ z)))
+#define G(x, y, z) F (z, x, y)
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define I(x, y, z) ((y) ^ ((x) | (~z)))
+
+  // STEP does one step with the basic function f, the word x[k], the shift
+  // s and the constant ac. Rotation is separate from addition to prevent
+  // recomputation.
+#define STEP(f, a, b, c, d, k, s, ac) { \
+      (a) += f((b), (c), (d)) + x[k] + static_cast<uint32_t>(ac); \
+      (a) = ((a) << (s)) | ((a) >> (32 - (s))); \
+      (a) += (b); \
+    }
+
+  // Round 1
+  STEP(F, a, b, c, d,  0,  7, 0xd76aa478);  // 1
+  STEP(F, d, a, b, c,  1, 12, 0xe8c7b756);  // 2
+  STEP(F, c, d, a, b,  2, 17, 0x242070db);  // 3
+  STEP(F, b, c, d, a,  3, 22, 0xc1bdceee);  // 4
+  STEP(F, a, b, c, d,  4,  7, 0xf57c0faf);  // 5
+  STEP(F, d, a, b, c,  5, 12, 0x4787c62a);  // 6
+  STEP(F, c, d, a, b,  6, 17, 0xa8304613);  // 7
+  STEP(F, b, c, d, a,  7, 22, 0xfd469501);  // 8
+  STEP(F, a, b, c, d,  8,  7, 0x698098d8);  // 9
+  STEP(F, d, a, b, c,  9, 12, 0x8b44f7af);  // 10
+  STEP(F, c, d, a, b, 10, 17, 0xffff5bb1);  // 11
+  STEP(F, b, c, d, a, 11, 22, 0x895cd7be);  // 12
+  STEP(F, a, b, c, d, 12,  7, 0x6b901122);  // 13
+  STEP(F, d, a, b, c, 13, 12, 0xfd987193);  // 14
+  STEP(F, c, d, a, b, 14, 17, 0xa679438e);  // 15
+  STEP(F, b, c, d, a, 15, 22, 0x49b40821);  // 16
+
+  // Round 2
+  // G(b, c, d) is (b & d) + (c & ~d), as the two never have a bit in common:
+  // adding them separately shortens the dependency on the latest word.
+#undef STEP
+#define STEP(f, a, b, c, d, k, s, ac) { \
+      (a) += ((c) & ~(d)) + x[k] + static_cast<uint32_t>(ac); \
+      (a) += (b) & (d); \
+      (a) = ((a) << (s)) | ((a) >> (32 - (s))); \
+      (a) += (b); \
+    }
+  STEP(G, a, b, c, d,  1,  5, 0xf61e2562);  // 17
+  STEP(G, d, a, b, c,  6,  9, 0xc040b340);  // 18
+  STEP(G, c, d, a, b, 11, 14, 0x265e5a51);  // 19
+  STEP(G, b, c, d, a,  0, 20, 0xe9b6c7aa);  // 20
+  STEP(G, a, b, c, d,  5,  5, 0xd62f105d);  // 21
+  STEP(G, d, a, b, c, 10,  9,  0x2441453);  // 22
+  STEP(G, c, d, a, b, 15, 14, 0xd8a1e681);  // 23
+  STEP(G, b, c, d, a,  4, 20, 0xe7d3fbc8);  // 24
+  STEP(G, a, b, c, d,  9,  5, 0x21e1cde6);  // 25
+  STEP(G, d, a, b, c, 14,  9, 0xc33707d6);  // 26
+  STEP(G, c, d, a, b,  3, 14, 0xf4d50d87);  // 27
+  STEP(G, b, c, d, a,  8, 20, 0x455a14ed);  // 28
+  STEP(G, a, b, c, d, 13,  5, 0xa9e3e905);  // 29
+  STEP(G, d, a, b, c,  2,  9, 0xfcefa3f8);  // 30
+  STEP(G, c, d, a, b,  7, 14, 0x676f02d9);  // 31
+  STEP(G, b, c, d, a, 12, 20, 0x8d2a4c8a);  // 32
+
+#undef STEP
+#define STEP(f, a, b, c, d, k, s, ac) { \
+      (a) += f((b), (c), (d)) + x[k] + static_cast<uint32_t>(ac); \
+      (a) = ((a) << (s)) | ((a) >> (32 - (s))); \
+      (a) += (b); \
+    }
+
+  // Round 3
+  STEP(H, a, b, c, d,  5,  4, 0xfffa3942);  // 33
+  STEP(H, d, a, b, c,  8, 11, 0x8771f681);  // 34
+  STEP(H, c, d, a, b, 11, 16, 0x6d9d6122);  // 35
+  STEP(H, b, c, d, a, 14, 23, 0xfde5380c);  // 36
+  STEP(H, a, b, c, d,  1,  4, 0xa4beea44);  // 37
+  STEP(H, d, a, b, c,  4, 11, 0x4bdecfa9);  // 38
+  STEP(H, c, d, a, b,  7, 16, 0xf6bb4b60);  // 39
+  STEP(H, b, c, d, a, 10, 23, 0xbebfbc70);  // 40
+  STEP(H, a, b, c, d, 13,  4, 0x289b7ec6);  // 41
+  STEP(H, d, a, b, c,  0, 11, 0xeaa127fa);  // 42
+  STEP(H, c, d, a, b,  3, 16, 0xd4ef3085);  // 43
+  STEP(H, b, c, d, a,  6, 23,  0x4881d05);  // 44
+  STEP(H, a, b, c, d,  9,  4, 0xd9d4d039);  // 45
+  STEP(H, d, a, b, c, 12, 11, 0xe6db99e5);  // 46
+  STEP(H, c, d, a, b, 15, 16, 0x1fa27cf8);  // 47
+  STEP(H, b, c, d, a,  2, 23, 0xc4ac5665);  // 48
+
+  // Round 4
+  STEP(I, a, b, c, d,  0,  6, 0xf4292244);  // 49
+  STEP(I, d, a, b, c,  7, 10, 0x432aff97);  // 50
+  STEP(I, c, d, a, b, 14, 15, 0xab9423a7);  // 51
+  STEP(I, b, c, d, a,  5, 21, 0xfc93a039);  // 52
+  STEP(I, a, b, c, d, 12,  6, 0x655b59c3);  // 53
+  STEP(I, d, a, b, c,  3, 10, 0x8f0ccc92);  // 54
+  STEP(I, c, d, a, b, 10, 15, 0xffeff47d);  // 55
+  STEP(I, b, c, d, a,  1, 21, 0x85845dd1);  // 56
+  STEP(I, a, b, c, d,  8,  6, 0x6fa87e4f);  // 57
+  STEP(I, d, a, b, c, 15, 10, 0xfe2ce6e0);  // 58
+  STEP(I, c, d, a, b,  6, 15, 0xa3014314);  // 59
+  STEP(I, b, c, d, a, 13, 21, 0x4e0811a1);  // 60
+  STEP(I, a, b, c, d,  4,  6, 0xf7537e82);  // 61
+  STEP(I, d, a, b, c, 11, 10, 0xbd3af235);  // 62
+  STEP(I, c, d, a, b,  2, 15, 0x2ad7d2bb);  // 63
+  STEP(I, b, c, d, a,  9, 21, 0xeb86d391);  // 64
+
+#undef STEP
+#undef I
+#undef H
+#undef G
+#undef F
+}
+
+// Digests "count" 64-byte blocks of a message into "state".
+static void Md5Blocks(uint32_t state[4], const unsigned char* data,
+                      size_t count) {
+  uint32_t a = state[0];
+  uint32_t b = state[1];
+  uint32_t c = state[2];
+  uint32_t d = state[3];
+  for (; count > 0; --count, data += k8Bytes) {
+    uint32_t x[16];
+    for (int i = 0; i < 16; ++i) {
+      x[i] = LoadWord(data + 4 * i);
+    }
+    uint32_t prev_a = a;
+    uint32_t prev_b = b;
+    uint32_t prev_c = c;
+    uint32_t prev_d = d;
+    Md5Steps(a, b, c, d, x);
+    a += prev_a;
+    b += prev_b;
+    c += prev_c;
+    d += prev_d;
+  }
+  state[0] = a;
+  state[1] = b;
+  state[2] = c;
+  state[3] = d;
+}
+
+// Digests a block of a message in each lane: "state" holds the A words of
+// all the lanes, then the B words and so on, and blocks[i] is the block of
+// lane i.
+typedef void (*Md5LanesFunction)(uint32_t* state,
+                                 const unsigned char* const* blocks);
+
+#if defined(MD5_VECTOR_LANES)
+template <typename V>
+static MD5_ALWAYS_INLINE void Md5Lanes(uint32_t* state,
+                                       const unsigned char* const* blocks) {
+  const int kLanes = sizeof(V) / sizeof(uint32_t);
+  // The words of the blocks are transposed, so that x[i] holds word i of
+  // each block.
+  uint32_t words[16][kLanes];
+  for (int lane = 0; lane < kLanes; ++lane) {
+    for (int i = 0; i < 16; ++i) {
+      words[i][lane] = LoadWord(blocks[lane] + 4 * i);
+    }
+  }
+  V x[16];
+  memcpy(x, words, sizeof(x));
+  V prev[4];
+  memcpy(prev, state, sizeof(prev));
+  V a = prev[0];
+  V b = prev[1];
+  V c = prev[2];
+  V d = prev[3];
+  Md5Steps(a, b, c, d, x);
+  prev[0] += a;
+  prev[1] += b;
+  prev[2] += c;
+  prev[3] += d;
+  memcpy(state, prev, sizeof(prev));
+}
+
+typedef uint32_t Md5Vector4 __attribute__((vector_size(16)));
+
+static void Md5Lanes4(uint32_t* state, const unsigned char* const* blocks) {
+  Md5Lanes<Md5Vector4>(state, blocks);
+}
+
+#if defined(MD5_X86_WIDE_LANES)
+typedef uint32_t Md5Vector8 __attribute__((vector_size(32)));
+typedef uint32_t Md5Vector16 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2")))
+static void Md5Lanes8(uint32_t* state, const unsigned char* const* blocks) {
+  Md5Lanes<Md5Vector8>(state, blocks);
+}
+
+__attribute__((target("avx512f")))
+static void Md5Lanes16(uint32_t* state, const unsigned char* const* blocks) {
+  Md5Lanes<Md5Vector16>(state, blocks);
+}
+#endif  // defined(MD5_X86_WIDE_LANES)
+
+// Returns the number of lanes of the widest vectors of the CPU, and sets
+// "function" to the function that digests them.
+static int WidestLanes(Md5LanesFunction* function) {
+#if defined(MD5_X86_WIDE_LANES)
+  static const bool has_avx512f = __builtin_cpu_supports("avx512f");
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx512f) {
+    *function = Md5Lanes16;
+    return 16;
+  }
+  if (has_avx2) {
+    *function = Md5Lanes8;
+    return 8;
+  }
+#endif
+  *function = Md5Lanes4;
+  return 4;
+}
+#endif  // defined(MD5_VECTOR_LANES)
+
+// Makes the one or two last blocks of a message of "length" bytes, whose
+// last length % 64 bytes are at "rest": the rest, the padding and the
+// length in bits. Returns the number of blocks.
+static size_t LastBlocks(const unsigned char* rest, uint64_t length,
+                         unsigned char blocks[128]) {
+  size_t rest_len = length & k8ByteMask;
+  size_t size = rest_len < 56 ? 64 : 128;
+  memcpy(blocks, rest, rest_len);
+  memcpy(blocks + rest_len, kPadding, size - 8 - rest_len);
+  uint64_t bits = length << 3;
+  for (int i = 0; i < 8; ++i) {
+    blocks[size - 8 + i] = static_cast<unsigned char>(bits >> (8 * i));
+  }
+  return size / k8Bytes;
+}
+
 Md5Digest::Md5Digest() {
   Reset();
 }
@@ -108,10 +360,7 @@ void Md5Digest::Reset() {
   count[0] = count[1] = 0;
   ctx_buffer_len = 0;
   // Load magic initialization constants.
-  state[0] = 0x67452301;
-  state[1] = 0xefcdab89;
-  state[2] = 0x98badcfe;
-  state[3] = 0x10325476;
+  memcpy(state, kInitialState, sizeof(state));
 }
 
 void Md5Digest::Update(const void *buf, unsigned int length) {
@@ -131,14 +380,8 @@ void Md5Digest::Update(const void *buf, unsigned int length) {
       ctx_buffer_len = 0;
     }
 
-    if (UNALIGNED_P(input)) {
-      while (length >= k8Bytes) {
-        memcpy(ctx_buffer, input, k8Bytes);
-        Transform(ctx_buffer, k8Bytes);
-        input += k8Bytes;
-        length -= k8Bytes;
-      }
-    } else if (length >= k8Bytes) {
+    // Whole blocks are digested in place, however they are aligned.
+    if (length >= k8Bytes) {
       Transform(input, length & ~k8ByteMask);
       input += length & ~k8ByteMask;
       length &= k8ByteMask;
@@ -174,165 +417,136 @@ void Md5Digest::Finish(unsigned char digest[16]) {
 
 void Md5Digest::Transform(
     const unsigned char* buffer, unsigned int len) {
-  // Constants for transform routine.
-#define S11 7
-#define S12 12
-#define S13 17
-#define S14 22
-#define S21 5
-#define S22 9
-#define S23 14
-#define S24 20
-#define S31 4
-#define S32 11
-#define S33 16
-#define S34 23
-#define S41 6
-#define S42 10
-#define S43 15
-#define S44 21
-
-  // F, G, H and I are basic MD5 functions.
-/* These are the four functions used in the four steps of the MD5 algorithm
-   and defined in the RFC 1321.  The first function is a little bit optimized
-   (as found in Colin Plumbs public domain implementation).  */
-/* #define F(b, c, d) ((b & c) | (~b & d)) */
-#define F(x, y, z) (z ^ (x & (y ^ z)))
-#define G(x, y, z) F (z, x, y)
-#define H(x, y, z) ((x) ^ (y) ^ (z))
-#define I(x, y, z) ((y) ^ ((x) | (~z)))
-
-  // ROTATE_LEFT rotates x left n bits.
-#define ROTATE_LEFT(x, n) (((x) << (n)) | ((x) >> (32-(n))))
-
-  // FF, GG, HH, and II transformations for rounds 1, 2, 3, and 4.
-  // Rotation is separate from addition to prevent recomputation.
-#define FF(a, b, c, d, s, ac) { \
-      (a) += F((b), (c), (d)) + ((*x_pos++ = *cur_word++)) + \
-          static_cast<uint32_t>(ac); \
-      (a) = ROTATE_LEFT((a), (s)); \
-      (a) += (b); \
-    }
-
-#define GG(a, b, c, d, x, s, ac) { \
-      (a) += G((b), (c), (d)) + (x) + static_cast<uint32_t>(ac); \
-      (a) = ROTATE_LEFT((a), (s)); \
-      (a) += (b); \
-     }
-#define HH(a, b, c, d, x, s, ac) { \
-      (a) += H((b), (c), (d)) + (x) + static_cast<uint32_t>(ac); \
-      (a) = ROTATE_LEFT((a), (s)); \
-      (a) += (b); \
-     }
-#define II(a, b, c, d, x, s, ac) { \
-      (a) += I((b), (c), (d)) + (x) + static_cast<uint32_t>(ac); \
-      (a) = ROTATE_LEFT((a), (s)); \
-      (a) += (b); \
-     }
-
   count[0] += len;
   if (count[0] < len) {
     ++count[1];
   }
+  Md5Blocks(state, buffer, len / k8Bytes);
+}
 
-  uint32_t a = state[0];
-  uint32_t b = state[1];
-  uint32_t c = state[2];
-  uint32_t d = state[3];
-  uint32_t x[16];
-
-  const uint32_t *cur_word = reinterpret_cast<const uint32_t*>(buffer);
-  const uint32_t *end_word = cur_word + (len / sizeof(uint32_t));
-
-  while (cur_word < end_word) {
-    uint32_t *x_pos = x;
-    uint32_t prev_a = a;
-    uint32_t prev_b = b;
-    uint32_t prev_c = c;
-    uint32_t prev_d = d;
-
-    // Round 1
-    FF(a, b, c, d, S11, 0xd76aa478);  // 1
-    FF(d, a, b, c, S12, 0xe8c7b756);  // 2
-    FF(c, d, a, b, S13, 0x242070db);  // 3
-    FF(b, c, d, a, S14, 0xc1bdceee);  // 4
-    FF(a, b, c, d, S11, 0xf57c0faf);  // 5
-    FF(d, a, b, c, S12, 0x4787c62a);  // 6
-    FF(c, d, a, b, S13, 0xa8304613);  // 7
-    FF(b, c, d, a, S14, 0xfd469501);  // 8
-    FF(a, b, c, d, S11, 0x698098d8);  // 9
-    FF(d, a, b, c, S12, 0x8b44f7af);  // 10
-    FF(c, d, a, b, S13, 0xffff5bb1);  // 11
-    FF(b, c, d, a, S14, 0x895cd7be);  // 12
-    FF(a, b, c, d, S11, 0x6b901122);  // 13
-    FF(d, a, b, c, S12, 0xfd987193);  // 14
-    FF(c, d, a, b, S13, 0xa679438e);  // 15
-    FF(b, c, d, a, S14, 0x49b40821);  // 16
-
-    // Round 2
-    GG(a, b, c, d, x[ 1], S21, 0xf61e2562);  // 17
-    GG(d, a, b, c, x[ 6], S22, 0xc040b340);  // 18
-    GG(c, d, a, b, x[11], S23, 0x265e5a51);  // 19
-    GG(b, c, d, a, x[ 0], S24, 0xe9b6c7aa);  // 20
-    GG(a, b, c, d, x[ 5], S21, 0xd62f105d);  // 21
-    GG(d, a, b, c, x[10], S22,  0x2441453);  // 22
-    GG(c, d, a, b, x[15], S23, 0xd8a1e681);  // 23
-    GG(b, c, d, a, x[ 4], S24, 0xe7d3fbc8);  // 24
-    GG(a, b, c, d, x[ 9], S21, 0x21e1cde6);  // 25
-    GG(d, a, b, c, x[14], S22, 0xc33707d6);  // 26
-    GG(c, d, a, b, x[ 3], S23, 0xf4d50d87);  // 27
-    GG(b, c, d, a, x[ 8], S24, 0x455a14ed);  // 28
-    GG(a, b, c, d, x[13], S21, 0xa9e3e905);  // 29
-    GG(d, a, b, c, x[ 2], S22, 0xfcefa3f8);  // 30
-    GG(c, d, a, b, x[ 7], S23, 0x676f02d9);  // 31
-    GG(b, c, d, a, x[12], S24, 0x8d2a4c8a);  // 32
-
-    // Round 3
-    HH(a, b, c, d, x[ 5], S31, 0xfffa3942);  // 33
-    HH(d, a, b, c, x[ 8], S32, 0x8771f681);  // 34
-    HH(c, d, a, b, x[11], S33, 0x6d9d6122);  // 35
-    HH(b, c, d, a, x[14], S34, 0xfde5380c);  // 36
-    HH(a, b, c, d, x[ 1], S31, 0xa4beea44);  // 37
-    HH(d, a, b, c, x[ 4], S32, 0x4bdecfa9);  // 38
-    HH(c, d, a, b, x[ 7], S33, 0xf6bb4b60);  // 39
-    HH(b, c, d, a, x[10], S34, 0xbebfbc70);  // 40
-    HH(a, b, c, d, x[13], S31, 0x289b7ec6);  // 41
-    HH(d, a, b, c, x[ 0], S32, 0xeaa127fa);  // 42
-    HH(c, d, a, b, x[ 3], S33, 0xd4ef3085);  // 43
-    HH(b, c, d, a, x[ 6], S34,  0x4881d05);  // 44
-    HH(a, b, c, d, x[ 9], S31, 0xd9d4d039);  // 45
-    HH(d, a, b, c, x[12], S32, 0xe6db99e5);  // 46
-    HH(c, d, a, b, x[15], S33, 0x1fa27cf8);  // 47
-    HH(b, c, d, a, x[ 2], S34, 0xc4ac5665);  // 48
-
-    // Round 4
-    II(a, b, c, d, x[ 0], S41, 0xf4292244);  // 49
-    II(d, a, b, c, x[ 7], S42, 0x432aff97);  // 50
-    II(c, d, a, b, x[14], S43, 0xab9423a7);  // 51
-    II(b, c, d, a, x[ 5], S44, 0xfc93a039);  // 52
-    II(a, b, c, d, x[12], S41, 0x655b59c3);  // 53
-    II(d, a, b, c, x[ 3], S42, 0x8f0ccc92);  // 54
-    II(c, d, a, b, x[10], S43, 0xffeff47d);  // 55
-    II(b, c, d, a, x[ 1], S44, 0x85845dd1);  // 56
-    II(a, b, c, d, x[ 8], S41, 0x6fa87e4f);  // 57
-    II(d, a, b, c, x[15], S42, 0xfe2ce6e0);  // 58
-    II(c, d, a, b, x[ 6], S43, 0xa3014314);  // 59
-    II(b, c, d, a, x[13], S44, 0x4e0811a1);  // 60
-    II(a, b, c, d, x[ 4], S41, 0xf7537e82);  // 61
-    II(d, a, b, c, x[11], S42, 0xbd3af235);  // 62
-    II(c, d, a, b, x[ 2], S43, 0x2ad7d2bb);  // 63
-    II(b, c, d, a, x[ 9], S44, 0xeb86d391);  // 64
+// Digests a message on its own.
+static void DigestOne(const void* message, size_t length,
+                      unsigned char* digest) {
+  const unsigned char* data = static_cast<const unsigned char*>(message);
+  uint32_t state[4];
+  memcpy(state, kInitialState, sizeof(state));
+  Md5Blocks(state, data, length / k8Bytes);
+  unsigned char last[128];
+  size_t last_count =
+      LastBlocks(data + (length & ~static_cast<size_t>(k8ByteMask)), length,
+                 last);
+  Md5Blocks(state, last, last_count);
+  memcpy(digest, state, Md5Digest::kDigestLength);
+}
 
-    a += prev_a;
-    b += prev_b;
-    c += prev_c;
-    d += prev_d;
+void Md5Digest::DigestMany(size_t count, const void* const* messages,
+                           const size_t* lengths, unsigned char* digests) {
+  if (count == 1) {
+    DigestOne(messages[0], lengths[0], digests);
+    return;
+  }
+#if defined(MD5_VECTOR_LANES)
+  Md5LanesFunction digest_lanes;
+  const int lanes = WidestLanes(&digest_lanes);
+  // What each lane digests: a block of a message, or of its last blocks,
+  // until there are no messages left.
+  struct Lane {
+    size_t message;  // count if the lane is idle
+    size_t block;
+    size_t full_blocks;
+    size_t blocks;
+    unsigned char last[128];
+  };
+  Lane lane[16];
+  uint32_t state[4 * 16];
+  static const unsigned char kIdleBlock[64] = {0};
+  const unsigned char* blocks[16];
+  size_t next = 0;
+  int active = 0;
+  for (int i = 0; i < lanes; ++i) {
+    lane[i].message = count;
   }
+  for (;;) {
+    // Idle lanes take the next messages.
+    for (int i = 0; i < lanes && next < count; ++i) {
+      if (lane[i].message != count) {
+        continue;
+      }
+      const unsigned char* data =
+          static_cast<const unsigned char*>(messages[next]);
+      size_t length = lengths[next];
+      lane[i].message = next++;
+      lane[i].block = 0;
+      lane[i].full_blocks = length / k8Bytes;
+      lane[i].blocks =
+          lane[i].full_blocks +
+          LastBlocks(data + (length & ~static_cast<size_t>(k8ByteMask)),
+                     length, lane[i].last);
+      for (int word = 0; word < 4; ++word) {
+        state[word * lanes + i] = kInitialState[word];
+      }
+      ++active;
+    }
+    if (active == 0) {
+      return;
+    }
+    if (active == 1 && next == count) {
+      // Vectors are wasted on a message left on its own.
+      for (int i = 0; i < lanes; ++i) {
+        if (lane[i].message == count) {
+          continue;
+        }
+        uint32_t one_state[4];
+        for (int word = 0; word < 4; ++word) {
+          one_state[word] = state[word * lanes + i];
+        }
+        const unsigned char* data =
+            static_cast<const unsigned char*>(messages[lane[i].message]);
+        if (lane[i].block < lane[i].full_blocks) {
+          Md5Blocks(one_state, data + lane[i].block * k8Bytes,
+                    lane[i].full_blocks - lane[i].block);
+          lane[i].block = lane[i].full_blocks;
+        }
+        Md5Blocks(one_state,
+                  lane[i].last + (lane[i].block - lane[i].full_blocks) *
+                      k8Bytes,
+                  lane[i].blocks - lane[i].block);
+        memcpy(digests + lane[i].message * kDigestLength, one_state,
+               kDigestLength);
+      }
+      return;
+    }
 
-  state[0] = a;
-  state[1] = b;
-  state[2] = c;
-  state[3] = d;
+    for (int i = 0; i < lanes; ++i) {
+      const Lane& l = lane[i];
+      if (l.message == count) {
+        blocks[i] = kIdleBlock;
+      } else if (l.block < l.full_blocks) {
+        blocks[i] = static_cast<const unsigned char*>(messages[l.message]) +
+                    l.block * k8Bytes;
+      } else {
+        blocks[i] = l.last + (l.block - l.full_blocks) * k8Bytes;
+      }
+    }
+    digest_lanes(state, blocks);
+    for (int i = 0; i < lanes; ++i) {
+      Lane& l = lane[i];
+      if (l.message == count || ++l.block < l.blocks) {
+        continue;
+      }
+      unsigned char* digest = digests + l.message * kDigestLength;
+      for (int word = 0; word < 4; ++word) {
+        memcpy(digest + 4 * word, &state[word * lanes + i], 4);
+      }
+      l.message = count;
+      --active;
+    }
+  }
+#else
+  for (size_t i = 0; i < count; ++i) {
+    DigestOne(messages[i], lengths[i], digests + i * kDigestLength);
+  }
+#endif  // defined(MD5_VECTOR_LANES)
 }
 
 string Md5Digest::String() const {
@@ -0,0 +1,143 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/output_digest.h"
+
+#include <errno.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+namespace blaze_util {
+
+using std::string;
+
+namespace {
+
+// The header of the attribute, as CachedDigestHeader() in unix_jni.cc
+// writes it: the version, the digest function, then the mtime (seconds and
+// nanoseconds), size, inode and device numbers of the file, each as 8
+// little-endian bytes.
+const uint8_t kCachedDigestVersion = 1;
+
+void AppendLittleEndian64(uint64_t value, std::vector<uint8_t> *out) {
+  for (int i = 0; i < 8; ++i) {
+    out->push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+}  // namespace
+
+OutputDigest::OutputDigest(Function function, const string &xattr)
+    : function_(function), xattr_(xattr) {}
+
+OutputDigest *OutputDigest::Parse(const string &spec) {
+  size_t colon = spec.find(':');
+  if (colon == string::npos || colon + 1 == spec.size()) {
+    return NULL;
+  }
+  string function = spec.substr(0, colon);
+  string xattr = spec.substr(colon + 1);
+  if (function == "md5") {
+    return new OutputDigest(kMd5, xattr);
+  } else if (function == "sha256") {
+    return new OutputDigest(kSha256, xattr);
+  }
+  return NULL;
+}
+
+void OutputDigest::Update(const void *buf, size_t length) {
+  if (function_ == kSha256) {
+    sha256_.Update(buf, length);
+    return;
+  }
+  // Md5Digest takes at most 4GB at a time.
+  const char *p = static_cast<const char *>(buf);
+  while (length > 0) {
+    unsigned int chunk =
+        static_cast<unsigned int>(std::min<size_t>(length, 1 << 30));
+    md5_.Update(p, chunk);
+    p += chunk;
+    length -= chunk;
+  }
+}
+
+bool OutputDigest::Store(int fd) {
+#ifdef _WIN32
+  errno = ENOTSUP;
+  return false;
+#else
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) == -1) {
+    return false;
+  }
+  std::vector<uint8_t> value;
+  value.push_back(kCachedDigestVersion);
+  value.push_back(static_cast<uint8_t>(function_));
+#ifdef __APPLE__
+  AppendLittleEndian64(statbuf.st_mtimespec.tv_sec, &value);
+  AppendLittleEndian64(statbuf.st_mtimespec.tv_nsec, &value);
+#else
+  AppendLittleEndian64(statbuf.st_mtim.tv_sec, &value);
+  AppendLittleEndian64(statbuf.st_mtim.tv_nsec, &value);
+#endif
+  AppendLittleEndian64(statbuf.st_size, &value);
+  AppendLittleEndian64(statbuf.st_ino, &value);
+  AppendLittleEndian64(statbuf.st_dev, &value);
+
+  unsigned char digest[Sha256Digest::kDigestLength];
+  size_t digest_length;
+  if (function_ == kSha256) {
+    sha256_.Finish(digest);
+    digest_length = Sha256Digest::kDigestLength;
+  } else {
+    md5_.Finish(digest);
+    digest_length = Md5Digest::kDigestLength;
+  }
+  value.insert(value.end(), digest, digest + digest_length);
+#ifdef __APPLE__
+  return fsetxattr(fd, xattr_.c_str(), value.data(), value.size(), 0, 0) == 0;
+#else
+  return fsetxattr(fd, xattr_.c_str(), value.data(), value.size(), 0) == 0;
+#endif
+#endif  // _WIN32
+}
+
+bool OutputDigest::Store(const string &path) {
+#ifdef _WIN32
+  errno = ENOTSUP;
+  return false;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  bool stored = Store(fd);
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return stored;
+#endif
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,72 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lets the tools writing large outputs (singlejar, ijar, zipper) digest them
+// as they write them, and store the digest where Bazel looks for it before
+// reading the file again: in the extended attribute Bazel is told about with
+// -Dbazel.DigestXattr, in the format of xattrCachedDigest() in
+// src/main/native/unix_jni.cc.
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_OUTPUT_DIGEST_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_OUTPUT_DIGEST_H_
+
+#include <stddef.h>
+
+#include <string>
+
+#include "src/main/cpp/util/md5.h"
+#include "src/main/cpp/util/sha256.h"
+
+namespace blaze_util {
+
+// Computes the digest of an output file incrementally, from the bytes of the
+// file in order, and stores it in an extended attribute of the file.
+class OutputDigest {
+ public:
+  // The digest functions; keep in sync with DigestFunction in unix_jni.cc.
+  enum Function {
+    kMd5 = 0,
+    kSha256 = 1,
+  };
+
+  OutputDigest(Function function, const std::string &xattr);
+
+  // Parses "<function>:<xattr>", where the function is "md5" or "sha256",
+  // the argument of the --output_digest option of the tools. Returns NULL if
+  // the argument is malformed.
+  static OutputDigest *Parse(const std::string &spec);
+
+  // Adds the next 'length' bytes of the output.
+  void Update(const void *buf, size_t length);
+
+  // Finishes the digest and stores it in the attribute of the file open as
+  // 'fd' (or at 'path'), along with the mtime, size, inode and device the
+  // file has now. The bytes added must be the whole contents of the file,
+  // and nothing may write the file afterwards: Bazel trusts the digest as
+  // long as those do not change. Returns false (and sets errno) if the file
+  // system does not support extended attributes or the file cannot be
+  // stat'ed, in which case Bazel just reads the file.
+  bool Store(int fd);
+  bool Store(const std::string &path);
+
+ private:
+  Function function_;
+  std::string xattr_;
+  Md5Digest md5_;
+  Sha256Digest sha256_;
+};
+
+}  // namespace blaze_util
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_OUTPUT_DIGEST_H_
@@ -0,0 +1,144 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/sha1.h"
+
+#include <string.h>
+
+namespace blaze_util {
+
+using std::string;
+
+namespace {
+
+inline uint32_t RotateLeft(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+inline uint32_t LoadBigEndian32(const uint8_t *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+}  // namespace
+
+Sha1Digest::Sha1Digest() { Reset(); }
+
+void Sha1Digest::Reset() {
+  static const uint32_t kInitialState[5] = {
+      0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+  };
+  memcpy(state_, kInitialState, sizeof(state_));
+  length_ = 0;
+  buffer_len_ = 0;
+}
+
+void Sha1Digest::Transform(const uint8_t *data, size_t count) {
+  for (; count > 0; --count, data += 64) {
+    // The message schedule is kept as a ring of 16 words.
+    uint32_t w[16];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = LoadBigEndian32(data + 4 * i);
+    }
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3],
+             e = state_[4];
+    for (int i = 0; i < 80; ++i) {
+      if (i >= 16) {
+        w[i & 15] = RotateLeft(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^
+                                   w[(i + 2) & 15] ^ w[i & 15],
+                               1);
+      }
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      uint32_t t = RotateLeft(a, 5) + f + e + k + w[i & 15];
+      e = d;
+      d = c;
+      c = RotateLeft(b, 30);
+      b = a;
+      a = t;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+  }
+}
+
+void Sha1Digest::Update(const void *buf, size_t length) {
+  const uint8_t *data = static_cast<const uint8_t *>(buf);
+  length_ += length;
+  if (buffer_len_ > 0) {
+    size_t n = 64 - buffer_len_ < length ? 64 - buffer_len_ : length;
+    memcpy(buffer_ + buffer_len_, data, n);
+    buffer_len_ += n;
+    data += n;
+    length -= n;
+    if (buffer_len_ < 64) {
+      return;
+    }
+    Transform(buffer_, 1);
+    buffer_len_ = 0;
+  }
+  // Whole blocks are digested in place, in one go.
+  if (length >= 64) {
+    Transform(data, length / 64);
+    data += length & ~static_cast<size_t>(63);
+    length &= 63;
+  }
+  memcpy(buffer_, data, length);
+  buffer_len_ = length;
+}
+
+void Sha1Digest::Finish(unsigned char *digest) {
+  uint64_t bit_length = length_ * 8;
+  uint8_t padding[72] = {0x80};
+  size_t padding_len = (buffer_len_ < 56 ? 56 : 120) - buffer_len_;
+  for (int i = 0; i < 8; ++i) {
+    padding[padding_len + i] = static_cast<uint8_t>(bit_length >> (56 - 8 * i));
+  }
+  Update(padding, padding_len + 8);
+  for (int i = 0; i < 5; ++i) {
+    digest_[4 * i] = static_cast<uint8_t>(state_[i] >> 24);
+    digest_[4 * i + 1] = static_cast<uint8_t>(state_[i] >> 16);
+    digest_[4 * i + 2] = static_cast<uint8_t>(state_[i] >> 8);
+    digest_[4 * i + 3] = static_cast<uint8_t>(state_[i]);
+  }
+  memcpy(digest, digest_, kDigestLength);
+}
+
+string Sha1Digest::String() const {
+  static const char kHexDigits[] = "0123456789abcdef";
+  string result;
+  for (int i = 0; i < kDigestLength; ++i) {
+    result.push_back(kHexDigits[digest_[i] >> 4]);
+    result.push_back(kHexDigits[digest_[i] & 0xf]);
+  }
+  return result;
+}
+
+}  // namespace blaze_util
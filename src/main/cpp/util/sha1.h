@@ -0,0 +1,64 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Provides a SHA-1 implementation, for the digests of the remote execution
+// protocol (src/main/protobuf/remote_protocol.proto).
+//
+// Like md5.h, this saves us from linking the huge OpenSSL library.
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_SHA1_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_SHA1_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace blaze_util {
+
+// Computes a SHA-1 digest incrementally.
+class Sha1Digest {
+ public:
+  Sha1Digest();
+
+  // the SHA-1 digest is always 160 bits = 20 bytes
+  static const int kDigestLength = 20;
+
+  // Resets the context so that it can be used to calculate another digest.
+  void Reset();
+
+  // Adds 'length' bytes of 'buf' to the digest.
+  void Update(const void *buf, size_t length);
+
+  // Retrieves the computed digest as a 20 byte array. The context must be
+  // Reset() before it is used again.
+  void Finish(unsigned char *digest);
+
+  // Produces a hexadecimal string representation of the digest retrieved by
+  // the last Finish(), in the form [0-9a-f]{40}.
+  std::string String() const;
+
+ private:
+  void Transform(const uint8_t *blocks, size_t count);
+
+  uint32_t state_[5];
+  uint64_t length_;          // number of bytes added so far
+  uint8_t buffer_[64];       // a partial block
+  size_t buffer_len_;
+  uint8_t digest_[kDigestLength];
+};
+
+}  // namespace blaze_util
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_SHA1_H_
@@ -26,8 +26,6 @@ namespace blaze_util {
 using std::string;
 using std::vector;
 
-static const char kSeparator[] = " \n\t\r";
-
 // # Table generated by this Python code (bit 0x02 is currently unused):
 // def Hex2(n):
 //   return '0x' + hex(n/16)[2:] + hex(n%16)[2:]
@@ -74,6 +72,11 @@ const unsigned char kAsciiPropertyBits[256] = {
 };
 
 
+// Whether ch separates the words for Tokenize().
+static inline bool IsSeparator(char ch) {
+  return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
+}
+
 bool starts_with(const string &haystack, const string &needle) {
   return (haystack.length() >= needle.length()) &&
       (memcmp(haystack.c_str(), needle.c_str(), needle.length()) == 0);
@@ -87,14 +90,23 @@ bool ends_with(const string &haystack, const string &needle) {
 
 void JoinStrings(
     const vector<string> &pieces, const char delimeter, string *output) {
+  if (pieces.empty()) {
+    return;
+  }
+  size_t size = pieces.size() - 1;
+  for (const auto &piece : pieces) {
+    size += piece.size();
+  }
+  output->clear();
+  output->reserve(size);
   bool first = true;
   for (const auto &piece : pieces) {
     if (first) {
-      *output = piece;
       first = false;
     } else {
-      *output += delimeter + piece;
+      *output += delimeter;
     }
+    *output += piece;
   }
 }
 
@@ -162,14 +174,28 @@ size_t SplitQuotedStringUsing(const string &contents, const char delimeter,
 }
 
 void Replace(const string &oldsub, const string &newsub, string *str) {
-  size_t start = 0;
-  // This is O(n^2) (the complexity of erase() is actually unspecified, but
-  // usually linear).
-  while ((start = str->find(oldsub, start)) != string::npos) {
-    str->erase(start, oldsub.length());
-    str->insert(start, newsub);
-    start += newsub.length();
+  if (oldsub.empty()) {
+    // It would be found at every position, past the last replacement too.
+    return;
+  }
+  size_t start = str->find(oldsub);
+  if (start == string::npos) {
+    // The common case: nothing to copy.
+    return;
+  }
+  // Copy the string once rather than erasing and inserting in place, which
+  // moves the rest of the string for every occurrence.
+  string result;
+  result.reserve(str->size());
+  size_t copied = 0;
+  while (start != string::npos) {
+    result.append(*str, copied, start - copied);
+    result += newsub;
+    copied = start + oldsub.length();
+    start = str->find(oldsub, copied);
   }
+  result.append(*str, copied, string::npos);
+  str->swap(result);
 }
 
 void StripWhitespace(string *str) {
@@ -185,19 +211,19 @@ void StripWhitespace(string *str) {
     str->clear();
     return;
   }
-  if (first > 0) {
-    str->erase(0, first);
-    str_length -= first;
-  }
 
-  // Strip off trailing whitespace.
+  // Strip off trailing whitespace before the leading whitespace, so that it is
+  // not moved along.
   int last = str_length - 1;
-  while (last >= 0 && ascii_isspace(str->at(last))) {
+  while (last > first && ascii_isspace(str->at(last))) {
     --last;
   }
-  if (last != (str_length - 1) && last >= 0) {
+  if (last != (str_length - 1)) {
     str->erase(last + 1, string::npos);
   }
+  if (first > 0) {
+    str->erase(0, first);
+  }
 }
 
 static void GetNextToken(const string &str, const char &comment,
@@ -206,7 +232,7 @@ static void GetNextToken(const string &str, const char &comment,
   auto last = *iter;
   char quote = '\0';
   // While not a delimiter.
-  while (last != str.end() && (quote || strchr(kSeparator, *last) == nullptr)) {
+  while (last != str.end() && (quote || !IsSeparator(*last))) {
     // Absorb escapes.
     if (*last == '\\') {
       ++last;
@@ -253,7 +279,7 @@ void Tokenize(const string &str, const char &comment, vector<string> *words) {
   string::const_iterator i = str.begin();
   while (i != str.end()) {
     // Skip whitespace.
-    while (i != str.end() && strchr(kSeparator, *i) != nullptr) {
+    while (i != str.end() && IsSeparator(*i)) {
       i++;
     }
     if (i != str.end() && *i == comment) {
@@ -300,11 +326,26 @@ void ToLower(string *str) {
     return;
   }
 
-  string temp = "";
-  for (auto ch : *str) {
-    temp += tolower(ch);
+  for (auto &ch : *str) {
+    ch = tolower(ch);
+  }
+}
+
+void AppendJsonString(string *out, const string &str) {
+  out->push_back('"');
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out->append(escaped);
+    } else {
+      out->push_back(c);
+    }
   }
-  *str = temp;
+  out->push_back('"');
 }
 
 }  // namespace blaze_util
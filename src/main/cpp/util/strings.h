@@ -84,7 +84,7 @@ void SplitStringUsing(const std::string &contents, const char delimeter,
 size_t SplitQuotedStringUsing(const std::string &contents, const char delimeter,
                               std::vector<std::string> *output);
 
-// Global replace of oldsub with newsub.
+// Global replace of oldsub with newsub. Does nothing if oldsub is empty.
 void Replace(const std::string &oldsub, const std::string &newsub,
              std::string *str);
 
@@ -105,6 +105,10 @@ void StringPrintf(std::string *str, const char *format, ...);
 // Convert str to lower case. No locale handling, this is just for ASCII.
 void ToLower(std::string *str);
 
+// Appends str to out as a JSON string literal, quotes included. The bytes
+// above 0x7f are copied as they are, i.e. str is expected to be UTF-8.
+void AppendJsonString(std::string *out, const std::string &str);
+
 }  // namespace blaze_util
 
 #endif  // BAZEL_SRC_MAIN_CPP_UTIL_STRINGS_H_
@@ -0,0 +1,255 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/cpp/util/trace_events.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <mutex>  // NOLINT
+#include <string>
+
+#include "src/main/cpp/util/strings.h"
+
+using blaze_util::AppendJsonString;
+
+namespace {
+
+// Set by BlazeTraceInit(), read without the lock.
+std::atomic<bool> enabled(false);
+std::atomic<int> owner_pid(0);
+
+// Guards the fields below it.
+std::mutex mutex;
+std::string *trace_file;
+std::string *process_name;
+// The events recorded since the last write, each followed by ",\n".
+std::string *events;
+
+int Pid() {
+#ifdef _WIN32
+  return _getpid();
+#else
+  return getpid();
+#endif
+}
+
+// Small numbers for the threads, in the order they record their first event.
+int Tid() {
+  static std::atomic<int> next_tid(1);
+  static thread_local int tid = next_tid++;
+  return tid;
+}
+
+// Appends the start of an event, up to its "args", without the lock.
+void AppendEventHeader(std::string *out, const char *name, char phase,
+                       uint64_t ts) {
+  char fields[128];
+  out->append("{\"name\":");
+  AppendJsonString(out, name);
+  snprintf(fields, sizeof(fields),
+           ",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":%d", phase,
+           static_cast<unsigned long long>(ts), Pid(), Tid());  // NOLINT
+  out->append(fields);
+}
+
+bool Recording() { return enabled && owner_pid == Pid(); }
+
+void Record(const std::string &event) {
+  std::lock_guard<std::mutex> lock(mutex);
+  events->append(event);
+  events->append(",\n");
+}
+
+bool WriteFully(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    int n = write(fd, data.data() + written,
+                  static_cast<unsigned>(data.size() - written));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+#ifdef _WIN32
+
+bool AppendToTraceFile(const std::string &path, const std::string &data) {
+  FILE *file = fopen(path.c_str(), "ab");
+  if (file == NULL) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  std::string out = ftell(file) == 0 ? "[\n" + data : data;
+  bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+  return fclose(file) == 0 && ok;
+}
+
+#else
+
+// The first process to write creates the file with the opening bracket and
+// its events; it is written aside then linked into place, so that the
+// others never see it empty. The others append their events, in one write
+// so that they do not interleave.
+bool AppendToTraceFile(const std::string &path, const std::string &data) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    std::string tmp = path + ".tmp." + std::to_string(Pid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    bool ok = WriteFully(fd, "[\n" + data);
+    ok = close(fd) == 0 && ok;
+    int link_errno = 0;
+    if (ok && link(tmp.c_str(), path.c_str()) != 0) {
+      link_errno = errno;
+    }
+    unlink(tmp.c_str());
+    if (!ok || link_errno == 0) {
+      return ok;
+    }
+    if (link_errno != EEXIST) {
+      errno = link_errno;
+      return false;
+    }
+    // Another process created it in the meantime.
+  }
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = WriteFully(fd, data);
+  return close(fd) == 0 && ok;
+}
+
+#endif  // _WIN32
+
+void WriteAtExit() {
+  if (BlazeTraceWrite() != 0) {
+    fprintf(stderr, "%s: cannot write the trace to %s: %s\n",
+            process_name->c_str(), trace_file->c_str(), strerror(errno));
+  }
+}
+
+}  // namespace
+
+void BlazeTraceInit(const char *name, const char *file) {
+  if (file == NULL) {
+    file = getenv("BAZEL_TRACE_FILE");
+  }
+  if (file == NULL || *file == '\0' || Recording()) {
+    return;
+  }
+  bool inherited = enabled;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (inherited) {
+      // In a child, whose parent's events are not its own.
+      *trace_file = file;
+      *process_name = name;
+      events->clear();
+    } else {
+      // Never freed: the events can be recorded until the very end.
+      trace_file = new std::string(file);
+      process_name = new std::string(name);
+      events = new std::string();
+    }
+    owner_pid = Pid();
+    std::string event;
+    AppendEventHeader(&event, "process_name", 'M', 0);
+    event.append(",\"args\":{\"name\":");
+    AppendJsonString(&event, name);
+    event.append("}}");
+    events->append(event);
+    events->append(",\n");
+  }
+  if (!inherited) {
+    enabled = true;
+    atexit(WriteAtExit);
+  }
+}
+
+int BlazeTraceEnabled(void) { return Recording(); }
+
+uint64_t BlazeTraceNow(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void BlazeTraceSpan(const char *name, const char *detail, uint64_t start_us) {
+  if (!Recording()) {
+    return;
+  }
+  uint64_t now = BlazeTraceNow();
+  std::string event;
+  AppendEventHeader(&event, name, 'X', start_us);
+  event.append(",\"dur\":");
+  event.append(std::to_string(now > start_us ? now - start_us : 0));
+  event.append(",\"cat\":");
+  AppendJsonString(&event, *process_name);
+  if (detail != NULL) {
+    event.append(",\"args\":{\"detail\":");
+    AppendJsonString(&event, detail);
+    event.append("}");
+  }
+  event.append("}");
+  Record(event);
+}
+
+void BlazeTraceCounter(const char *name, int64_t value) {
+  if (!Recording()) {
+    return;
+  }
+  std::string event;
+  AppendEventHeader(&event, name, 'C', BlazeTraceNow());
+  event.append(",\"args\":{\"value\":");
+  event.append(std::to_string(static_cast<long long>(value)));  // NOLINT
+  event.append("}}");
+  Record(event);
+}
+
+int BlazeTraceWrite(void) {
+  if (!Recording()) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  if (events->empty()) {
+    return 0;
+  }
+  if (!AppendToTraceFile(*trace_file, *events)) {
+    return -1;
+  }
+  events->clear();
+  return 0;
+}
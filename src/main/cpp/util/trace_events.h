@@ -0,0 +1,105 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// trace_events.h -- timed spans and counters of the native tools, in the
+// Chrome trace event format (chrome://tracing, about:tracing).
+//
+// A tool calls BlazeTraceInit() once at startup. If the trace file is given,
+// or the BAZEL_TRACE_FILE environment variable names one, the spans and
+// counters it records are kept in memory and appended to that file when the
+// process exits. Otherwise nothing is recorded, and each call costs a test of
+// a flag.
+//
+// Several processes can share the trace file, e.g. process-wrapper, the
+// sandbox and the tool running in it: each one appends its events in a
+// single write when it exits. The file is in the JSON array format without
+// the closing bracket, which the trace viewers accept. Timestamps are in
+// microseconds of the monotonic clock, the one the Java profiler uses, so
+// the events line up with those of the action that ran the tool.
+//
+// Only the process that called BlazeTraceInit() records events: a child it
+// forks without exec, e.g. the PID 1 of the sandbox, records nothing unless
+// it calls BlazeTraceInit() itself, and then only its own events.
+//
+// The functions are callable from C, for process-wrapper.
+
+#ifndef BAZEL_SRC_MAIN_CPP_UTIL_TRACE_EVENTS_H_
+#define BAZEL_SRC_MAIN_CPP_UTIL_TRACE_EVENTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starts recording if trace_file is not NULL, or else if BAZEL_TRACE_FILE is
+// set and not empty. The events are written when the process exits normally,
+// or by BlazeTraceWrite(). The process name labels the events in the viewer.
+void BlazeTraceInit(const char *process_name, const char *trace_file);
+
+// Returns whether the events are recorded.
+int BlazeTraceEnabled(void);
+
+// The current time, in microseconds, for BlazeTraceSpan().
+uint64_t BlazeTraceNow(void);
+
+// Records a span that started at start_us and ends now. The detail, if not
+// NULL, is shown with it, e.g. the file it processed.
+void BlazeTraceSpan(const char *name, const char *detail, uint64_t start_us);
+
+// Records the value of a counter at this time.
+void BlazeTraceCounter(const char *name, int64_t value);
+
+// Appends the events recorded so far to the trace file and forgets them.
+// Returns 0 on success, -1 on error with errno set.
+int BlazeTraceWrite(void);
+
+#ifdef __cplusplus
+}  // extern "C"
+
+namespace blaze_util {
+
+// Records a span for its lifetime:
+//
+//   {
+//     blaze_util::TraceSpan span("scan inputs");
+//     ...
+//   }
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char *name, const char *detail = NULL)
+      : name_(name),
+        detail_(detail),
+        start_(BlazeTraceEnabled() ? BlazeTraceNow() : 0) {}
+  ~TraceSpan() {
+    if (start_ != 0) {
+      BlazeTraceSpan(name_, detail_, start_);
+    }
+  }
+
+ private:
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+  const char *const name_;
+  const char *const detail_;
+  const uint64_t start_;
+};
+
+}  // namespace blaze_util
+
+#endif  // __cplusplus
+
+#endif  // BAZEL_SRC_MAIN_CPP_UTIL_TRACE_EVENTS_H_
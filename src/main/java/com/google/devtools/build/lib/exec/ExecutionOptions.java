@@ -118,6 +118,14 @@ public class ExecutionOptions extends OptionsBase {
       help = "Specifies the base temporary directory for 'blaze test' to use.")
   public PathFragment testTmpDir;
 
+  @Option(name = "experimental_native_test_setup",
+      defaultValue = "false",
+      category = "testing",
+      help = "If true, locally run tests are set up by the embedded test-setup binary rather than "
+          + "by tools/test/test-setup.sh, which saves starting a shell and its utilities for "
+          + "every test.")
+  public boolean nativeTestSetup;
+
   @Option(name = "test_output",
       defaultValue = "summary",
       category = "testing",
@@ -34,9 +34,11 @@ import com.google.devtools.build.lib.analysis.config.BuildConfiguration;
 import com.google.devtools.build.lib.events.Event;
 import com.google.devtools.build.lib.events.EventKind;
 import com.google.devtools.build.lib.events.Reporter;
+import com.google.devtools.build.lib.util.OS;
 import com.google.devtools.build.lib.util.io.FileOutErr;
 import com.google.devtools.build.lib.vfs.FileSystemUtils;
 import com.google.devtools.build.lib.vfs.Path;
+import com.google.devtools.build.lib.vfs.PathFragment;
 import com.google.devtools.build.lib.vfs.Symlinks;
 import com.google.devtools.build.lib.view.test.TestStatus.BlazeTestStatus;
 import com.google.devtools.build.lib.view.test.TestStatus.TestCase;
@@ -97,12 +99,11 @@ public class StandaloneTestStrategy extends TestStrategy {
     info.put("timeout", "" + getTimeout(action));
     info.putAll(action.getTestProperties().getExecutionInfo());
 
-    Artifact testSetup = action.getRuntimeArtifact(TEST_SETUP_BASENAME);
     Spawn spawn =
         new BaseSpawn(
             // Bazel lacks much of the tooling for coverage, so we don't attempt to pass a coverage
             // script here.
-            getArgs(testSetup.getExecPathString(), "", action),
+            getArgs(getTestSetup(action, execRoot), "", action),
             env,
             info,
             new RunfilesSupplierImpl(
@@ -147,6 +148,21 @@ public class StandaloneTestStrategy extends TestStrategy {
     }
   }
 
+  /**
+   * Returns the program that sets up the environment of the test and runs it: the embedded
+   * test-setup binary if --experimental_native_test_setup asks for it, test-setup.sh otherwise.
+   */
+  private String getTestSetup(TestRunnerAction action, Path execRoot) throws ExecException {
+    if (executionOptions.nativeTestSetup && OS.getCurrent() != OS.WINDOWS) {
+      PathFragment nativeTestSetup = binTools.getExecPath(NATIVE_TEST_SETUP);
+      if (nativeTestSetup != null) {
+        // Absolute, since the sandboxed exec roots have no _bin directory.
+        return execRoot.getRelative(nativeTestSetup).getPathString();
+      }
+    }
+    return action.getRuntimeArtifact(TEST_SETUP_BASENAME).getExecPathString();
+  }
+
   private Map<String, String> getEnv(
       TestRunnerAction action, Path execRoot, Path runfilesDir, Path tmpDir, Path xmlOutputPath) {
     Map<String, String> vars = getDefaultTestEnvironment(action);
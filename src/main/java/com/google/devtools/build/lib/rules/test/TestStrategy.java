@@ -59,6 +59,8 @@ import javax.annotation.Nullable;
  */
 public abstract class TestStrategy implements TestActionContext {
   public static final String TEST_SETUP_BASENAME = "test-setup.sh";
+  /** The embedded binary that does the work of test-setup.sh without a shell. */
+  public static final String NATIVE_TEST_SETUP = "test-setup";
 
   /**
    * Returns true if coverage data should be gathered.
@@ -32,6 +32,7 @@ import com.google.devtools.build.lib.events.EventHandler;
 import com.google.devtools.build.lib.events.Reporter;
 import com.google.devtools.build.lib.flags.InvocationPolicyEnforcer;
 import com.google.devtools.build.lib.runtime.commands.ProjectFileSupport;
+import com.google.devtools.build.lib.server.CommandProtos.ExecRequest;
 import com.google.devtools.build.lib.util.AbruptExitException;
 import com.google.devtools.build.lib.util.AnsiStrippingOutputStream;
 import com.google.devtools.build.lib.util.BlazeClock;
@@ -144,6 +145,11 @@ public class BlazeCommandDispatcher {
   }
 
   private final BlazeRuntime runtime;
+  // Commands run one at a time. Even commands that do not modify the build graph cannot share it:
+  // execExclusively() redirects System.out and System.err, replaces the command log and starts the
+  // profiler for the whole server, and the Skyframe executor takes the client environment and
+  // event bus of the current command. All of that would have to move into the CommandEnvironment
+  // before commands can be let through concurrently.
   private final Object commandLock;
   private String currentClientDescription = null;
   private String shutdownReason = null;
@@ -275,6 +281,17 @@ public class BlazeCommandDispatcher {
    */
   int exec(List<String> args, OutErr outErr, LockingMode lockingMode, String clientDescription,
       long firstContactTime) throws ShutdownBlazeServerException, InterruptedException {
+    return exec(args, outErr, lockingMode, clientDescription, firstContactTime, null);
+  }
+
+  /**
+   * Same as {@link #exec(List, OutErr, LockingMode, String, long)}, for a client that can run a
+   * program in place of itself once the command is done: the command describes the program in
+   * execRequest, see {@link CommandEnvironment#execInClient}.
+   */
+  int exec(List<String> args, OutErr outErr, LockingMode lockingMode, String clientDescription,
+      long firstContactTime, @Nullable ExecRequest.Builder execRequest)
+      throws ShutdownBlazeServerException, InterruptedException {
     Preconditions.checkNotNull(clientDescription);
     if (args.isEmpty()) { // Default to help command if no arguments specified.
       args = HELP_COMMAND;
@@ -329,7 +346,8 @@ public class BlazeCommandDispatcher {
         outErr.printErrLn("Server shut down " + shutdownReason);
         return ExitCode.LOCAL_ENVIRONMENTAL_ERROR.getNumericExitCode();
       }
-      return execExclusively(args, outErr, firstContactTime, commandName, command, waitTimeInMs);
+      return execExclusively(
+          args, outErr, firstContactTime, commandName, command, waitTimeInMs, execRequest);
     } catch (ShutdownBlazeServerException e) {
       shutdownReason = "explicitly by client " + currentClientDescription;
       throw e;
@@ -342,8 +360,8 @@ public class BlazeCommandDispatcher {
   }
 
   private int execExclusively(List<String> args, OutErr outErr, long firstContactTime,
-      String commandName, BlazeCommand command, long waitTimeInMs)
-      throws ShutdownBlazeServerException {
+      String commandName, BlazeCommand command, long waitTimeInMs,
+      @Nullable ExecRequest.Builder execRequest) throws ShutdownBlazeServerException {
     Command commandAnnotation = command.getClass().getAnnotation(Command.class);
 
     // Record the start time for the profiler. Do not put anything before this!
@@ -353,6 +371,7 @@ public class BlazeCommandDispatcher {
     CommandEnvironment env = runtime.getWorkspace().initCommand();
     // Record the command's starting time for use by the commands themselves.
     env.recordCommandStartTime(firstContactTime);
+    env.setExecRequest(execRequest);
 
     AbruptExitException exitCausingException = null;
     for (BlazeModule module : runtime.getBlazeModules()) {
@@ -16,6 +16,7 @@ package com.google.devtools.build.lib.runtime;
 
 import com.google.common.annotations.VisibleForTesting;
 import com.google.common.base.Function;
+import com.google.common.base.Splitter;
 import com.google.common.collect.ImmutableList;
 import com.google.common.collect.ImmutableMap;
 import com.google.common.collect.Lists;
@@ -55,6 +56,7 @@ import com.google.devtools.build.lib.server.signal.InterruptSignalHandler;
 import com.google.devtools.build.lib.shell.JavaSubprocessFactory;
 import com.google.devtools.build.lib.shell.Subprocess;
 import com.google.devtools.build.lib.shell.SubprocessBuilder;
+import com.google.devtools.build.lib.unix.NativeSubprocessFactory;
 import com.google.devtools.build.lib.util.AbruptExitException;
 import com.google.devtools.build.lib.util.BlazeClock;
 import com.google.devtools.build.lib.util.Clock;
@@ -359,6 +361,29 @@ public final class BlazeRuntime {
     return projectFileProvider;
   }
 
+  /**
+   * Adds the phases of the launcher startup to the profile. Each one is given as
+   * {@code <start ms>:<duration ms>:<description>}, the start relative to the launcher start.
+   */
+  private static void logClientStartupPhases(
+      Profiler profiler, long launchTimeNanos, List<String> phases) {
+    for (String phase : phases) {
+      List<String> fields = Splitter.on(':').limit(3).splitToList(phase);
+      if (fields.size() != 3) {
+        LOG.warning("Ignoring malformed launcher startup phase '" + phase + "'");
+        continue;
+      }
+      try {
+        long startNanos = Long.parseLong(fields.get(0)) * 1000000L;
+        long durationNanos = Long.parseLong(fields.get(1)) * 1000000L;
+        profiler.logSimpleTaskDuration(launchTimeNanos + startNanos, durationNanos,
+            ProfilerTask.CLIENT_STARTUP, fields.get(2));
+      } catch (NumberFormatException e) {
+        LOG.warning("Ignoring malformed launcher startup phase '" + phase + "'");
+      }
+    }
+  }
+
   /**
    * Hook method called by the BlazeCommandDispatcher prior to the dispatch of
    * each command.
@@ -379,6 +404,8 @@ public final class BlazeRuntime {
       // phase.
       profiler.logSimpleTaskDuration(execStartTimeNanos - startupTimeNanos, 0, ProfilerTask.PHASE,
           ProfilePhase.LAUNCH.description);
+      logClientStartupPhases(
+          profiler, execStartTimeNanos - startupTimeNanos, options.clientStartupPhases);
       profiler.logSimpleTaskDuration(execStartTimeNanos, 0, ProfilerTask.PHASE,
           ProfilePhase.INIT.description);
     }
@@ -789,6 +816,29 @@ public final class BlazeRuntime {
     }
   }
 
+  /**
+   * Waits for the client to finish extracting the embedded binaries it left to extract while the
+   * server starts up with --experimental_lazy_install_base. The client creates the marker file
+   * once they are all in place.
+   */
+  private static void waitForInstallation(ServerDirectories serverDirectories)
+      throws IOException {
+    Path marker = serverDirectories.getInstallBase().getChild("_extraction_complete");
+    long deadline = BlazeClock.nanoTime() + TimeUnit.SECONDS.toNanos(120);
+    while (!marker.exists()) {
+      if (BlazeClock.nanoTime() > deadline) {
+        throw new IOException(
+            "the installation in " + serverDirectories.getInstallBase() + " is incomplete");
+      }
+      try {
+        Thread.sleep(10);
+      } catch (InterruptedException e) {
+        Thread.currentThread().interrupt();
+        throw new IOException("interrupted while waiting for " + marker);
+      }
+    }
+  }
+
   private static FileSystem fileSystemImplementation() {
     if ("0".equals(System.getProperty("io.bazel.EnableJni"))) {
       // Ignore UnixFileSystem, to be used for bootstrapping.
@@ -801,6 +851,10 @@ public final class BlazeRuntime {
   private static Subprocess.Factory subprocessFactoryImplementation() {
     if (!"0".equals(System.getProperty("io.bazel.EnableJni")) && OS.getCurrent() == OS.WINDOWS) {
       return WindowsSubprocessFactory.INSTANCE;
+    } else if (!"0".equals(System.getProperty("io.bazel.EnableJni"))
+        && "1".equals(System.getProperty("io.bazel.NativeSubprocesses"))) {
+      // Starts processes without forking the JVM, which gets expensive with a large heap.
+      return NativeSubprocessFactory.INSTANCE;
     } else {
       return JavaSubprocessFactory.INSTANCE;
     }
@@ -825,8 +879,9 @@ public final class BlazeRuntime {
           "com.google.devtools.build.lib.server.GrpcServerImpl$Factory");
     RPCServer.Factory factory = (RPCServer.Factory) factoryClass.getConstructor().newInstance();
     return factory.create(commandExecutor, runtime.getClock(),
-        startupOptions.commandPort, runtime.getServerDirectory(),
-        startupOptions.maxIdleSeconds);
+        startupOptions.commandPort, startupOptions.commandServerUnixSocket,
+        runtime.getServerDirectory(),
+        startupOptions.maxIdleSeconds, startupOptions.idleTrimSeconds);
     } catch (ReflectiveOperationException | IllegalArgumentException e) {
       throw new AbruptExitException("gRPC server not compiled in", ExitCode.BLAZE_INTERNAL_ERROR);
     }
@@ -976,6 +1031,9 @@ public final class BlazeRuntime {
             serverDirectories, workspaceDirectoryPath, startupOptions.deepExecRoot, productName);
     BinTools binTools;
     try {
+      if (startupOptions.lazyInstallBase) {
+        waitForInstallation(serverDirectories);
+      }
       binTools = BinTools.forProduction(directories);
     } catch (IOException e) {
       throw new AbruptExitException(
@@ -19,6 +19,7 @@ import com.google.devtools.build.lib.vfs.PathFragment;
 import com.google.devtools.common.options.Converter;
 import com.google.devtools.common.options.Option;
 import com.google.devtools.common.options.OptionsBase;
+import java.util.List;
 import java.util.Map;
 
 /**
@@ -126,6 +127,50 @@ public class BlazeServerStartupOptions extends OptionsBase {
           + "can be shared between collaborating users.")
   public PathFragment outputUserRoot;
 
+  @Option(name = "experimental_local_output_user_root",
+      defaultValue = "", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      valueHelp = "<path>",
+      help = "A directory on a local file system, like a scratch SSD, that the output user root "
+          + "is created in instead if the default one is on a network file system, e.g. an NFS "
+          + "home directory. It must not be writable by other users unless it is sticky, like "
+          + "/tmp. Output bases in it that were not used for 30 days are deleted. Has no effect "
+          + "with --output_user_root.")
+  public String localOutputUserRoot;
+
+  @Option(name = "experimental_output_user_root_volume",
+      defaultValue = "", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      valueHelp = "<name>",
+      help = "Only on macOS; the name of a volume that the output user root is created on "
+          + "instead of the default location. If it does not exist, a case-sensitive APFS "
+          + "volume of that name is added to the container of the boot volume, which shares "
+          + "its free space. Spotlight and Time Machine are told to leave it alone. Has no "
+          + "effect with --output_user_root.")
+  public String outputUserRootVolume;
+
+  @Option(name = "experimental_shared_install_root",
+      defaultValue = "", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      valueHelp = "<path>",
+      help = "A directory of installations shared by all users of the machine, each named after "
+          + "the install_base_key of its release, which root populates by running the release "
+          + "with --install_base=<path>/<install_base_key>. If it has a complete installation of "
+          + "this release and only root can change it, that is used instead of extracting one "
+          + "in the output user root. Has no effect with --install_base.")
+  public String sharedInstallRoot;
+
+  @Option(name = "experimental_output_base_template",
+      defaultValue = "", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      valueHelp = "<path>",
+      help = "An output base, such as that of an earlier build of the same workspace, that a new "
+          + "output base is cloned from instead of starting empty, so that its external "
+          + "repositories and outputs are reused. Only done where the file system can clone "
+          + "files without copying their contents, and not while a command runs in the "
+          + "template. Has no effect with --output_base.")
+  public String outputBaseTemplate;
+
   @Option(name = "workspace_directory",
       defaultValue = "",
       category = "hidden",
@@ -142,6 +187,15 @@ public class BlazeServerStartupOptions extends OptionsBase {
           + "means that the server will never shutdown.")
   public int maxIdleSeconds;
 
+  @Option(name = "experimental_idle_trim_secs",
+      defaultValue = "300", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      valueHelp = "<integer>",
+      help = "The number of seconds the build server will wait idling before it shrinks its heap "
+          + "with a full garbage collection, so that the JVM can return memory to the operating "
+          + "system. Zero means never.")
+  public int idleTrimSeconds;
+
   @Option(name = "batch",
       defaultValue = "false", // NOTE: purely decorative!  See class docstring.
       category = "server startup",
@@ -241,6 +295,58 @@ public class BlazeServerStartupOptions extends OptionsBase {
   )
   public boolean watchFS;
 
+  @Option(name = "experimental_lazy_install_base",
+      defaultValue = "false", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      help = "If true, the client extracts only the files the server needs to start up before "
+          + "starting it, and the rest of the installation while the server starts up. The "
+          + "server waits for the installation to be complete before using it.")
+  public boolean lazyInstallBase;
+
+  @Option(name = "experimental_server_class_archive",
+      defaultValue = "false", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      help = "If true, the server JVM dumps the classes it loaded into a class data sharing "
+          + "archive in the install base when it exits, and maps them in from there on later "
+          + "starts. Needs Java 13 or newer.")
+  public boolean serverClassArchive;
+
+  @Option(name = "experimental_machine_aware_host_jvm_args",
+      defaultValue = "false", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      help = "If true, the maximum and initial heap size and the garbage collector of the server "
+          + "JVM are chosen to fit the memory and processors available to the machine or "
+          + "container, including cgroup limits. --host_jvm_args take precedence.")
+  public boolean machineAwareHostJvmArgs;
+
+  @Option(name = "experimental_server_cgroup",
+      defaultValue = "", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      valueHelp = "<path>",
+      help = "Only on Linux with cgroups v2; the cgroup, as an absolute path in the cgroup "
+          + "hierarchy, that the server and the actions it runs are placed in. It is created "
+          + "if needed, which requires write access to its parent. If empty, the server stays "
+          + "in the cgroup of the client that started it.")
+  public String serverCgroup;
+
+  @Option(name = "experimental_server_cgroup_setting",
+      defaultValue = "", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      allowMultiple = true,
+      valueHelp = "<controller>.<file>=<value>",
+      help = "A setting for --experimental_server_cgroup, for example cpu.weight=20, "
+          + "memory.high=8G or io.weight=50. The controllers are enabled in the parent "
+          + "cgroups as needed.")
+  public List<String> serverCgroupSettings;
+
+  @Option(name = "experimental_output_base_per_startup_options",
+      defaultValue = "false", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      help = "If true and --output_base is not set, each distinct set of startup options gets "
+          + "an output base and a server of its own, so switching between them does not "
+          + "restart the server. Idle servers exit after --max_idle_secs.")
+  public boolean outputBasePerStartupOptions;
+
   @Option(name = "invocation_policy",
       defaultValue = "",
       category = "undocumented",
@@ -255,6 +361,13 @@ public class BlazeServerStartupOptions extends OptionsBase {
       help = "Port to start up the gRPC command server on. If 0, let the kernel choose.")
   public int commandPort;
 
+  @Option(name = "experimental_command_server_unix_socket",
+      defaultValue = "false", // NOTE: purely decorative!  See class docstring.
+      category = "server startup",
+      help = "If true, the gRPC command server listens on a Unix domain socket in the server "
+          + "directory instead of a TCP port on localhost, if the platform supports it.")
+  public boolean commandServerUnixSocket;
+
   @Option(name = "product_name",
       defaultValue = "bazel", // NOTE: purely decorative!
       category = "hidden",
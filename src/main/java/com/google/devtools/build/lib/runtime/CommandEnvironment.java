@@ -41,6 +41,8 @@ import com.google.devtools.build.lib.pkgcache.PackageManager;
 import com.google.devtools.build.lib.pkgcache.TargetPatternEvaluator;
 import com.google.devtools.build.lib.profiler.AutoProfiler;
 import com.google.devtools.build.lib.profiler.ProfilerTask;
+import com.google.devtools.build.lib.server.CommandProtos.EnvironmentVariable;
+import com.google.devtools.build.lib.server.CommandProtos.ExecRequest;
 import com.google.devtools.build.lib.skyframe.SkyframeBuildView;
 import com.google.devtools.build.lib.skyframe.SkyframeExecutor;
 import com.google.devtools.build.lib.util.AbruptExitException;
@@ -55,7 +57,9 @@ import com.google.devtools.common.options.OptionsClassProvider;
 import com.google.devtools.common.options.OptionsParser;
 import com.google.devtools.common.options.OptionsParsingException;
 import com.google.devtools.common.options.OptionsProvider;
+import com.google.protobuf.ByteString;
 import java.io.IOException;
+import java.nio.charset.StandardCharsets;
 import java.util.Collection;
 import java.util.Collections;
 import java.util.List;
@@ -95,6 +99,7 @@ public final class CommandEnvironment {
 
   private String commandName;
   private OptionsProvider options;
+  @Nullable private ExecRequest.Builder execRequest;
 
   private AtomicReference<AbruptExitException> pendingException = new AtomicReference<>();
 
@@ -501,6 +506,40 @@ public final class CommandEnvironment {
     return commandStartTime;
   }
 
+  void setExecRequest(@Nullable ExecRequest.Builder execRequest) {
+    this.execRequest = execRequest;
+  }
+
+  /**
+   * Returns whether the client can run a program in place of itself once the command is done, see
+   * {@link #execInClient}.
+   */
+  public boolean canExecInClient() {
+    return execRequest != null;
+  }
+
+  /**
+   * Has the client run argv in workingDirectory with exactly the given environment once the command
+   * finished successfully, by executing it in place of itself. Only valid if {@link
+   * #canExecInClient}.
+   */
+  public void execInClient(
+      Path workingDirectory, List<String> argv, Map<String, String> environment) {
+    Preconditions.checkState(execRequest != null);
+    execRequest.clear();
+    execRequest.setWorkingDirectory(
+        ByteString.copyFrom(workingDirectory.getPathString(), StandardCharsets.ISO_8859_1));
+    for (String arg : argv) {
+      execRequest.addArgv(ByteString.copyFrom(arg, StandardCharsets.ISO_8859_1));
+    }
+    for (Map.Entry<String, String> variable : environment.entrySet()) {
+      execRequest.addEnvironmentVariable(
+          EnvironmentVariable.newBuilder()
+              .setName(ByteString.copyFrom(variable.getKey(), StandardCharsets.ISO_8859_1))
+              .setValue(ByteString.copyFrom(variable.getValue(), StandardCharsets.ISO_8859_1)));
+    }
+  }
+
   void setWorkingDirectory(Path workingDirectory) {
     this.workingDirectory = workingDirectory;
   }
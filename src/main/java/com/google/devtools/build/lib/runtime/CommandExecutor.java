@@ -14,6 +14,7 @@
 package com.google.devtools.build.lib.runtime;
 
 import com.google.devtools.build.lib.runtime.BlazeCommandDispatcher.ShutdownMethod;
+import com.google.devtools.build.lib.server.CommandProtos.ExecRequest;
 import com.google.devtools.build.lib.server.ServerCommand;
 import com.google.devtools.build.lib.util.io.OutErr;
 
@@ -21,6 +22,7 @@ import java.io.PrintWriter;
 import java.io.StringWriter;
 import java.util.List;
 import java.util.logging.Logger;
+import javax.annotation.Nullable;
 
 /**
  * Executes a Blaze command.
@@ -43,10 +45,21 @@ public class CommandExecutor implements ServerCommand {
   @Override
   public int exec(List<String> args, OutErr outErr, BlazeCommandDispatcher.LockingMode lockingMode,
       String clientDescription, long firstContactTime) throws InterruptedException {
+    return exec(args, outErr, lockingMode, clientDescription, firstContactTime, null);
+  }
+
+  /**
+   * Same as {@link #exec(List, OutErr, BlazeCommandDispatcher.LockingMode, String, long)}, for a
+   * client that can run the program the command describes in execRequest in place of itself.
+   */
+  public int exec(List<String> args, OutErr outErr, BlazeCommandDispatcher.LockingMode lockingMode,
+      String clientDescription, long firstContactTime, @Nullable ExecRequest.Builder execRequest)
+      throws InterruptedException {
     LOG.info(BlazeRuntime.getRequestLogString(args));
 
     try {
-      return dispatcher.exec(args, outErr, lockingMode, clientDescription, firstContactTime);
+      return dispatcher.exec(
+          args, outErr, lockingMode, clientDescription, firstContactTime, execRequest);
     } catch (BlazeCommandDispatcher.ShutdownBlazeServerException e) {
       if (e.getCause() != null) {
         StringWriter message = new StringWriter();
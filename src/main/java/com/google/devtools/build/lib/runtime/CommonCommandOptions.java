@@ -212,6 +212,14 @@ public class CommonCommandOptions extends OptionsBase {
       help = "The time in ms the launcher spends before sending the request to the blaze server.")
   public long startupTime;
 
+  @Option(name = "client_startup_phase",
+      defaultValue = "",
+      category = "hidden",
+      allowMultiple = true,
+      help = "A system-generated parameter which specifies a phase of the launcher startup as "
+          + "<start ms>:<duration ms>:<description>, the start relative to the launcher start.")
+  public List<String> clientStartupPhases;
+
   @Option(
     name = "extract_data_time",
     defaultValue = "0",
@@ -246,7 +246,10 @@ public class RunCommand implements BlazeCommand  {
             options.getOptions(BuildRequestOptions.class).getSymlinkPrefix(productName),
             productName);
     List<String> cmdLine = new ArrayList<>();
-    if (runOptions.scriptPath == null) {
+    // A client that executes the binary in place of itself needs no process wrapper: the binary
+    // gets the terminal and the signals of the client directly.
+    boolean execInClient = runOptions.scriptPath == null && env.canExecInClient();
+    if (runOptions.scriptPath == null && !execInClient) {
       PathFragment processWrapperPath =
           env.getBlazeWorkspace().getBinTools().getExecPath(PROCESS_WRAPPER);
       Preconditions.checkNotNull(
@@ -307,6 +310,11 @@ public class RunCommand implements BlazeCommand  {
     env.getReporter().handle(Event.info(
         null, "Running command line: " + ShellEscaper.escapeJoinAll(prettyCmdLine)));
 
+    if (execInClient) {
+      env.execInClient(workingDir, cmdLine, env.getClientEnv());
+      return ExitCode.SUCCESS;
+    }
+
     com.google.devtools.build.lib.shell.Command command = new CommandBuilder()
         .addArgs(cmdLine).setEnv(env.getClientEnv()).setWorkingDir(workingDir).build();
 
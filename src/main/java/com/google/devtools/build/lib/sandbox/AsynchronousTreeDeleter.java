@@ -0,0 +1,91 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.sandbox;
+
+import com.google.common.util.concurrent.ThreadFactoryBuilder;
+import com.google.devtools.build.lib.vfs.FileSystemUtils;
+import com.google.devtools.build.lib.vfs.Path;
+import java.io.IOException;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.logging.Logger;
+
+/**
+ * Deletes the sandbox directories of finished spawns in the background. A directory is first
+ * renamed into a trash directory, which is cheap, so that the spawn is done at once; deleting a
+ * large tree takes much longer.
+ *
+ * <p>One thread deletes one tree at a time: {@link FileSystemUtils#deleteTree} is parallel itself.
+ */
+final class AsynchronousTreeDeleter {
+  private static final Logger LOG = Logger.getLogger(AsynchronousTreeDeleter.class.getName());
+
+  private final Path trashDir;
+  private final ExecutorService service =
+      Executors.newSingleThreadExecutor(
+          new ThreadFactoryBuilder().setNameFormat("sandbox-tree-deleter").setDaemon(true).build());
+
+  /**
+   * Creates a deleter that moves the trees into {@code trashDir}, which must be on the same file
+   * system. Whatever is left in there, e.g. by a server that died, is deleted in the background,
+   * too.
+   */
+  AsynchronousTreeDeleter(Path trashDir) {
+    this.trashDir = trashDir;
+    try {
+      if (trashDir.exists()) {
+        for (Path leftover : trashDir.getDirectoryEntries()) {
+          deleteInBackground(leftover);
+        }
+      }
+    } catch (IOException e) {
+      LOG.warning("Cannot list " + trashDir + ": " + e);
+    }
+  }
+
+  /**
+   * Moves {@code tree} out of the way and deletes it in the background. If it cannot be moved,
+   * deletes it right away.
+   */
+  void deleteTree(Path tree) throws IOException {
+    Path trash = trashDir.getRelative(tree.getBaseName());
+    try {
+      FileSystemUtils.createDirectoryAndParents(trashDir);
+      tree.renameTo(trash);
+    } catch (IOException e) {
+      FileSystemUtils.deleteTree(tree);
+      return;
+    }
+    deleteInBackground(trash);
+  }
+
+  private void deleteInBackground(final Path trash) {
+    service.execute(
+        new Runnable() {
+          @Override
+          public void run() {
+            try {
+              FileSystemUtils.deleteTree(trash);
+            } catch (IOException e) {
+              LOG.warning("Cannot delete sandbox directory " + trash + ": " + e);
+            }
+          }
+        });
+  }
+
+  /** Stops deleting; the trees that are left are deleted by the next deleter of the trash. */
+  void shutdown() {
+    service.shutdownNow();
+  }
+}
@@ -14,21 +14,31 @@
 
 package com.google.devtools.build.lib.sandbox;
 
+import static java.nio.charset.StandardCharsets.UTF_8;
+
 import com.google.common.collect.ImmutableMap;
 import com.google.common.io.ByteStreams;
+import com.google.devtools.build.lib.runtime.CommandEnvironment;
 import com.google.devtools.build.lib.shell.Command;
 import com.google.devtools.build.lib.shell.CommandException;
 import com.google.devtools.build.lib.shell.KillableObserver;
 import com.google.devtools.build.lib.shell.TimeoutKillableObserver;
+import com.google.devtools.build.lib.util.Fingerprint;
 import com.google.devtools.build.lib.util.OS;
+import com.google.devtools.build.lib.vfs.FileSystemUtils;
 import com.google.devtools.build.lib.vfs.Path;
+import com.google.devtools.build.lib.vfs.PathFragment;
 import java.io.File;
 import java.io.IOException;
 import java.io.PrintWriter;
+import java.io.StringWriter;
 import java.util.ArrayList;
 import java.util.List;
 import java.util.Map;
 import java.util.Set;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.ConcurrentMap;
+import javax.annotation.Nullable;
 
 /**
  * Helper class for running the namespace sandbox. This runner prepares environment inside the
@@ -36,12 +46,50 @@ import java.util.Set;
  */
 final class DarwinSandboxRunner extends SandboxRunner {
   private static final String SANDBOX_EXEC = "/usr/bin/sandbox-exec";
+  private static final String DARWIN_SANDBOX = "darwin-sandbox";
+
+  // The profile parameters the native helper gets the paths of the sandbox exec root in.
+  private static final String EXEC_ROOT_PARAM = "EXEC_ROOT";
+  private static final String RESOLVED_EXEC_ROOT_PARAM = "RESOLVED_EXEC_ROOT";
+
+  /**
+   * The darwin-sandbox helper, and the profiles written for it so far. Each distinct profile is
+   * written once, to a file named after its digest, and shared by all the actions it applies to.
+   */
+  static final class NativeHelper {
+    private final Path binary;
+    private final Path profileDir;
+    private final ConcurrentMap<String, Path> profiles = new ConcurrentHashMap<>();
+
+    NativeHelper(Path binary, Path profileDir) {
+      this.binary = binary;
+      this.profileDir = profileDir;
+    }
+
+    private Path getProfileFile(String profile) throws IOException {
+      Path file = profiles.get(profile);
+      if (file == null) {
+        file = profileDir.getRelative(Fingerprint.md5Digest(profile) + ".sb");
+        if (!file.exists()) {
+          // Written aside and renamed, so that an action never sees a partial profile.
+          FileSystemUtils.createDirectoryAndParents(profileDir);
+          Path temp =
+              profileDir.getRelative(file.getBaseName() + "." + Thread.currentThread().getId());
+          FileSystemUtils.writeContent(temp, UTF_8, profile);
+          temp.renameTo(file);
+        }
+        profiles.put(profile, file);
+      }
+      return file;
+    }
+  }
 
   private final Path sandboxExecRoot;
   private final Path argumentsFilePath;
   private final Set<Path> writableDirs;
   private final Set<Path> inaccessiblePaths;
   private final Path runUnderPath;
+  @Nullable private final NativeHelper nativeHelper;
 
   DarwinSandboxRunner(
       Path sandboxPath,
@@ -49,6 +97,7 @@ final class DarwinSandboxRunner extends SandboxRunner {
       Set<Path> writableDirs,
       Set<Path> inaccessiblePaths,
       Path runUnderPath,
+      @Nullable NativeHelper nativeHelper,
       boolean verboseFailures) {
     super(sandboxExecRoot, verboseFailures);
     this.sandboxExecRoot = sandboxExecRoot;
@@ -56,6 +105,7 @@ final class DarwinSandboxRunner extends SandboxRunner {
     this.writableDirs = writableDirs;
     this.inaccessiblePaths = inaccessiblePaths;
     this.runUnderPath = runUnderPath;
+    this.nativeHelper = nativeHelper;
   }
 
   static boolean isSupported() {
@@ -101,23 +151,79 @@ final class DarwinSandboxRunner extends SandboxRunner {
     return true;
   }
 
+  /**
+   * Returns the darwin-sandbox helper embedded in the binary, or null if there is none or it
+   * cannot apply a profile, in which case actions go through sandbox-exec.
+   */
+  @Nullable
+  static Path getNativeHelper(CommandEnvironment commandEnv) {
+    PathFragment embeddedTool =
+        commandEnv.getBlazeWorkspace().getBinTools().getExecPath(DARWIN_SANDBOX);
+    if (embeddedTool == null) {
+      return null;
+    }
+    Path helper = commandEnv.getExecRoot().getRelative(embeddedTool);
+
+    List<String> args = new ArrayList<>();
+    args.add(helper.getPathString());
+    args.add("-C");
+
+    ImmutableMap<String, String> env = ImmutableMap.of();
+    File cwd = new File("/usr/bin");
+
+    Command cmd = new Command(args.toArray(new String[0]), env, cwd);
+    try {
+      cmd.execute(
+          /* stdin */ new byte[] {},
+          Command.NO_OBSERVER,
+          ByteStreams.nullOutputStream(),
+          ByteStreams.nullOutputStream(),
+          /* killSubprocessOnInterrupt */ true);
+    } catch (CommandException e) {
+      return null;
+    }
+
+    return helper;
+  }
+
   @Override
   protected Command getCommand(
       List<String> arguments, Map<String, String> environment, int timeout, boolean allowNetwork)
       throws IOException {
-    writeConfig(allowNetwork);
-
     List<String> commandLineArgs = new ArrayList<>();
-    commandLineArgs.add(SANDBOX_EXEC);
-    commandLineArgs.add("-f");
-    commandLineArgs.add(argumentsFilePath.getPathString());
+    if (nativeHelper != null) {
+      // The profile refers to the exec root through parameters, so that it is the same for all
+      // the actions with the same paths relative to it.
+      Path resolvedExecRoot = sandboxExecRoot.resolveSymbolicLinks();
+      String profile = getProfile(allowNetwork, resolvedExecRoot, true);
+      commandLineArgs.add(nativeHelper.binary.getPathString());
+      commandLineArgs.add("-f");
+      commandLineArgs.add(nativeHelper.getProfileFile(profile).getPathString());
+      commandLineArgs.add("-D");
+      commandLineArgs.add(EXEC_ROOT_PARAM + "=" + sandboxExecRoot.getPathString());
+      commandLineArgs.add("-D");
+      commandLineArgs.add(RESOLVED_EXEC_ROOT_PARAM + "=" + resolvedExecRoot.getPathString());
+      commandLineArgs.add("--");
+    } else {
+      FileSystemUtils.writeContent(
+          argumentsFilePath, UTF_8, getProfile(allowNetwork, sandboxExecRoot, false));
+      commandLineArgs.add(SANDBOX_EXEC);
+      commandLineArgs.add("-f");
+      commandLineArgs.add(argumentsFilePath.getPathString());
+    }
     commandLineArgs.addAll(arguments);
     return new Command(
         commandLineArgs.toArray(new String[0]), environment, sandboxExecRoot.getPathFile());
   }
 
-  private void writeConfig(boolean allowNetwork) throws IOException {
-    try (PrintWriter out = new PrintWriter(argumentsFilePath.getOutputStream())) {
+  /**
+   * Returns the sandbox profile. If parameterized, the paths below the exec root and below
+   * resolvedExecRoot, what it resolves to, are relative to the parameters of the native helper.
+   */
+  private String getProfile(boolean allowNetwork, Path resolvedExecRoot, boolean parameterized)
+      throws IOException {
+    StringWriter profile = new StringWriter();
+    try (PrintWriter out = new PrintWriter(profile)) {
       // Note: In Apple's sandbox configuration language, the *last* matching rule wins.
       out.println("(version 1)");
       out.println("(debug deny)");
@@ -140,19 +246,47 @@ final class DarwinSandboxRunner extends SandboxRunner {
       // Almost everything else is read-only.
       out.println("(deny file-write* (subpath \"/\"))");
 
-      allowWriteSubpath(out, sandboxExecRoot);
+      allowWriteSubpath(out, sandboxExecRoot, resolvedExecRoot, parameterized);
       for (Path path : writableDirs) {
-        allowWriteSubpath(out, path);
+        allowWriteSubpath(out, path, resolvedExecRoot, parameterized);
       }
     }
+    return profile.toString();
   }
 
-  private void allowWriteSubpath(PrintWriter out, Path path) throws IOException {
-    out.println("(allow file-write* (subpath \"" + path.getPathString() + "\"))");
+  private void allowWriteSubpath(
+      PrintWriter out, Path path, Path resolvedExecRoot, boolean parameterized)
+      throws IOException {
+    out.println(
+        "(allow file-write* "
+            + subpath(path, sandboxExecRoot, parameterized ? EXEC_ROOT_PARAM : null)
+            + ")");
     Path resolvedPath = path.resolveSymbolicLinks();
     if (!resolvedPath.equals(path)) {
-      out.println("(allow file-write* (subpath \"" + resolvedPath.getPathString() + "\"))");
+      out.println(
+          "(allow file-write* "
+              + subpath(
+                  resolvedPath, resolvedExecRoot, parameterized ? RESOLVED_EXEC_ROOT_PARAM : null)
+              + ")");
+    }
+  }
+
+  /**
+   * Returns the filter for path and what is below it. If root, a prefix of path, is given as the
+   * parameter, the filter reads the parameter instead of hardcoding root.
+   */
+  private static String subpath(Path path, Path root, @Nullable String param) {
+    if (param == null || !path.startsWith(root)) {
+      return "(subpath \"" + path.getPathString() + "\")";
+    }
+    if (path.equals(root)) {
+      return "(subpath (param \"" + param + "\"))";
     }
+    return "(subpath (string-append (param \""
+        + param
+        + "\") \"/"
+        + path.relativeTo(root).getPathString()
+        + "\"))";
   }
 
   @Override
@@ -54,6 +54,7 @@ import java.util.Set;
 import java.util.UUID;
 import java.util.concurrent.atomic.AtomicInteger;
 import java.util.concurrent.atomic.AtomicReference;
+import javax.annotation.Nullable;
 
 /** Strategy that uses sandboxing to execute a process, for Darwin */
 @ExecutionStrategy(
@@ -70,6 +71,7 @@ public class DarwinSandboxedStrategy extends SandboxStrategy {
   private final String productName;
   private final ImmutableList<Path> confPaths;
   private final SpawnHelpers spawnHelpers;
+  @Nullable private final DarwinSandboxRunner.NativeHelper nativeHelper;
 
   private final UUID uuid = UUID.randomUUID();
   private final AtomicInteger execCounter = new AtomicInteger();
@@ -81,12 +83,15 @@ public class DarwinSandboxedStrategy extends SandboxStrategy {
       boolean verboseFailures,
       String productName,
       ImmutableList<Path> confPaths,
-      SpawnHelpers spawnHelpers) {
+      SpawnHelpers spawnHelpers,
+      @Nullable DarwinSandboxRunner.NativeHelper nativeHelper,
+      AsynchronousTreeDeleter treeDeleter) {
     super(
         buildRequest,
         blazeDirs,
         verboseFailures,
-        buildRequest.getOptions(SandboxOptions.class));
+        buildRequest.getOptions(SandboxOptions.class),
+        treeDeleter);
     this.clientEnv = ImmutableMap.copyOf(clientEnv);
     this.blazeDirs = blazeDirs;
     this.execRoot = blazeDirs.getExecRoot();
@@ -95,6 +100,7 @@ public class DarwinSandboxedStrategy extends SandboxStrategy {
     this.productName = productName;
     this.confPaths = confPaths;
     this.spawnHelpers = spawnHelpers;
+    this.nativeHelper = nativeHelper;
   }
 
   public static DarwinSandboxedStrategy create(
@@ -102,7 +108,9 @@ public class DarwinSandboxedStrategy extends SandboxStrategy {
       Map<String, String> clientEnv,
       BlazeDirectories blazeDirs,
       boolean verboseFailures,
-      String productName)
+      String productName,
+      @Nullable Path nativeHelperBinary,
+      AsynchronousTreeDeleter treeDeleter)
       throws IOException {
     // On OS X, in addition to what is specified in $TMPDIR, two other temporary directories may be
     // written to by processes. We have to get their location by calling "getconf".
@@ -122,7 +130,12 @@ public class DarwinSandboxedStrategy extends SandboxStrategy {
         verboseFailures,
         productName,
         writablePaths.build(),
-        new SpawnHelpers(blazeDirs.getExecRoot()));
+        new SpawnHelpers(blazeDirs.getExecRoot()),
+        nativeHelperBinary == null
+            ? null
+            : new DarwinSandboxRunner.NativeHelper(
+                nativeHelperBinary, SandboxHelpers.getSandboxProfiles(blazeDirs, productName)),
+        treeDeleter);
   }
 
   /**
@@ -208,6 +221,7 @@ public class DarwinSandboxedStrategy extends SandboxStrategy {
             getWritableDirs(sandboxExecRoot, spawnEnvironment),
             getInaccessiblePaths(),
             runUnderPath,
+            nativeHelper,
             verboseFailures);
     try {
       runSpawn(
@@ -221,7 +235,7 @@ public class DarwinSandboxedStrategy extends SandboxStrategy {
     } finally {
       if (!sandboxDebug) {
         try {
-          FileSystemUtils.deleteTree(sandboxPath);
+          deleteSandbox(sandboxPath);
         } catch (IOException e) {
           executor
               .getEventHandler()
@@ -16,6 +16,7 @@ package com.google.devtools.build.lib.sandbox;
 
 import com.google.common.collect.ImmutableMap;
 import com.google.common.io.ByteStreams;
+import com.google.devtools.build.lib.profiler.Profiler;
 import com.google.devtools.build.lib.runtime.CommandEnvironment;
 import com.google.devtools.build.lib.shell.Command;
 import com.google.devtools.build.lib.shell.CommandException;
@@ -42,11 +43,20 @@ final class LinuxSandboxRunner extends SandboxRunner {
   private final Path sandboxExecRoot;
   private final Path sandboxTempDir;
   private final Path argumentsFilePath;
+  private final Path statisticsPath;
+  private final Path timingsPath;
+  private final Path changesPath;
   private final Set<Path> writableDirs;
   private final Set<Path> inaccessiblePaths;
   private final Set<Path> tmpfsPaths;
   private final Set<Path> bindMounts;
   private final boolean sandboxDebug;
+  private final boolean sandboxDaemon;
+  private final Path inputManifest;
+  private final String cgroup;
+  private final List<String> cgroupSettings;
+  private final String scratchSize;
+  private final Set<PathFragment> outputs;
 
   LinuxSandboxRunner(
       Path execRoot,
@@ -58,17 +68,32 @@ final class LinuxSandboxRunner extends SandboxRunner {
       Set<Path> tmpfsPaths,
       Set<Path> bindMounts,
       boolean verboseFailures,
-      boolean sandboxDebug) {
+      boolean sandboxDebug,
+      boolean sandboxDaemon,
+      Path inputManifest,
+      String cgroup,
+      List<String> cgroupSettings,
+      String scratchSize,
+      Set<PathFragment> outputs) {
     super(sandboxExecRoot, verboseFailures);
     this.execRoot = execRoot;
     this.sandboxExecRoot = sandboxExecRoot;
     this.sandboxTempDir = sandboxTempDir;
     this.argumentsFilePath = sandboxPath.getRelative("linux-sandbox.params");
+    this.statisticsPath = sandboxPath.getRelative("stats.out");
+    this.timingsPath = sandboxPath.getRelative("timings.out");
+    this.changesPath = sandboxPath.getRelative("changes.out");
     this.writableDirs = writableDirs;
     this.inaccessiblePaths = inaccessiblePaths;
     this.tmpfsPaths = tmpfsPaths;
     this.bindMounts = bindMounts;
     this.sandboxDebug = sandboxDebug;
+    this.sandboxDaemon = sandboxDaemon;
+    this.inputManifest = inputManifest;
+    this.cgroup = cgroup;
+    this.cgroupSettings = cgroupSettings;
+    this.scratchSize = scratchSize;
+    this.outputs = outputs;
   }
 
   static boolean isSupported(CommandEnvironment commandEnv) {
@@ -118,6 +143,21 @@ final class LinuxSandboxRunner extends SandboxRunner {
     return new Command(commandLineArgs.toArray(new String[0]), env, sandboxExecRoot.getPathFile());
   }
 
+  @Override
+  protected Path getStatisticsPath() {
+    return statisticsPath;
+  }
+
+  @Override
+  protected Path getTimingsPath() {
+    return timingsPath;
+  }
+
+  @Override
+  protected Path getChangesPath() {
+    return inputManifest != null || !scratchSize.isEmpty() ? changesPath : null;
+  }
+
   private void writeConfig(int timeout, boolean allowNetwork) throws IOException {
     List<String> fileArgs = new ArrayList<>();
 
@@ -125,6 +165,12 @@ final class LinuxSandboxRunner extends SandboxRunner {
       fileArgs.add("-D");
     }
 
+    // Share one sandbox daemon between the actions of an exec root.
+    if (sandboxDaemon) {
+      fileArgs.add("-d");
+      fileArgs.add(execRoot.getPathString());
+    }
+
     // Temporary directory of the sandbox.
     fileArgs.add("-S");
     fileArgs.add(sandboxTempDir.toString());
@@ -133,6 +179,26 @@ final class LinuxSandboxRunner extends SandboxRunner {
     fileArgs.add("-W");
     fileArgs.add(sandboxExecRoot.toString());
 
+    // Resource usage of the spawn.
+    fileArgs.add("-s");
+    fileArgs.add(statisticsPath.getPathString());
+
+    // Time of each step of the sandbox, for the profile.
+    if (Profiler.instance().isActive()) {
+      fileArgs.add("-p");
+      fileArgs.add(timingsPath.getPathString());
+    }
+
+    // A cgroup of its own for the spawn, with its settings.
+    if (!cgroup.isEmpty()) {
+      fileArgs.add("-G");
+      fileArgs.add(cgroup);
+      for (String setting : cgroupSettings) {
+        fileArgs.add("-g");
+        fileArgs.add(setting);
+      }
+    }
+
     // Kill the process after a timeout.
     if (timeout != -1) {
       fileArgs.add("-T");
@@ -140,6 +206,28 @@ final class LinuxSandboxRunner extends SandboxRunner {
     }
 
     // Create all needed directories.
+    // Inputs for linux-sandbox to create in the working directory.
+    if (inputManifest != null) {
+      fileArgs.add("-M");
+      fileArgs.add(inputManifest.getPathString());
+    }
+
+    // Writes to the working directory go to a tmpfs, and only the outputs make it to the disk.
+    if (!scratchSize.isEmpty()) {
+      fileArgs.add("-x");
+      fileArgs.add(scratchSize);
+      for (PathFragment output : outputs) {
+        fileArgs.add("-O");
+        fileArgs.add(output.getPathString());
+      }
+    }
+
+    // What the spawn wrote to the working directory, so that only those outputs are moved out.
+    if (getChangesPath() != null) {
+      fileArgs.add("-F");
+      fileArgs.add(changesPath.getPathString());
+    }
+
     for (Path writablePath : writableDirs) {
       fileArgs.add("-w");
       fileArgs.add(writablePath.getPathString());
@@ -26,7 +26,6 @@ import com.google.devtools.build.lib.analysis.BlazeDirectories;
 import com.google.devtools.build.lib.buildtool.BuildRequest;
 import com.google.devtools.build.lib.events.Event;
 import com.google.devtools.build.lib.runtime.CommandEnvironment;
-import com.google.devtools.build.lib.vfs.FileSystemUtils;
 import com.google.devtools.build.lib.vfs.Path;
 import com.google.devtools.build.lib.vfs.PathFragment;
 import java.io.IOException;
@@ -66,12 +65,14 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
       BlazeDirectories blazeDirs,
       boolean verboseFailures,
       String productName,
-      boolean fullySupported) {
+      boolean fullySupported,
+      AsynchronousTreeDeleter treeDeleter) {
     super(
         buildRequest,
         blazeDirs,
         verboseFailures,
-        buildRequest.getOptions(SandboxOptions.class));
+        buildRequest.getOptions(SandboxOptions.class),
+        treeDeleter);
     this.sandboxOptions = buildRequest.getOptions(SandboxOptions.class);
     this.blazeDirs = blazeDirs;
     this.execRoot = blazeDirs.getExecRoot();
@@ -111,7 +112,12 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
 
     Set<Path> writableDirs = getWritableDirs(sandboxExecRoot, spawn.getEnvironment());
 
-    SymlinkedExecRoot symlinkedExecRoot = new SymlinkedExecRoot(sandboxExecRoot);
+    // Only linux-sandbox can create the inputs from a manifest.
+    Path inputManifest =
+        fullySupported && sandboxOptions.sandboxInputManifest
+            ? sandboxPath.getRelative("inputs.manifest")
+            : null;
+    SymlinkedExecRoot symlinkedExecRoot = new SymlinkedExecRoot(sandboxExecRoot, inputManifest);
     ImmutableSet<PathFragment> outputs = SandboxHelpers.getOutputFiles(spawn);
     try {
       symlinkedExecRoot.createFileSystem(
@@ -121,7 +127,9 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
       throw new UserExecException("I/O error during sandboxed execution", e);
     }
 
-    SandboxRunner runner = getSandboxRunner(spawn, sandboxPath, sandboxExecRoot, sandboxTempDir);
+    SandboxRunner runner =
+        getSandboxRunner(
+            spawn, sandboxPath, sandboxExecRoot, sandboxTempDir, inputManifest, outputs);
     try {
       runSpawn(
           spawn,
@@ -134,7 +142,7 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
     } finally {
       if (!sandboxOptions.sandboxDebug) {
         try {
-          FileSystemUtils.deleteTree(sandboxPath);
+          deleteSandbox(sandboxPath);
         } catch (IOException e) {
           executor
               .getEventHandler()
@@ -149,7 +157,12 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
   }
 
   private SandboxRunner getSandboxRunner(
-      Spawn spawn, Path sandboxPath, Path sandboxExecRoot, Path sandboxTempDir) {
+      Spawn spawn,
+      Path sandboxPath,
+      Path sandboxExecRoot,
+      Path sandboxTempDir,
+      Path inputManifest,
+      Set<PathFragment> outputs) {
     if (fullySupported) {
       return new LinuxSandboxRunner(
           execRoot,
@@ -161,9 +174,20 @@ public class LinuxSandboxedStrategy extends SandboxStrategy {
           getTmpfsPaths(),
           getBindMounts(blazeDirs),
           verboseFailures,
-          sandboxOptions.sandboxDebug);
+          sandboxOptions.sandboxDebug,
+          sandboxOptions.sandboxDaemon,
+          inputManifest,
+          sandboxOptions.sandboxCgroup,
+          sandboxOptions.sandboxCgroupSettings,
+          sandboxOptions.sandboxScratchSize,
+          outputs);
     } else {
-      return new ProcessWrapperRunner(execRoot, sandboxPath, sandboxExecRoot, verboseFailures);
+      return new ProcessWrapperRunner(
+          execRoot,
+          sandboxPath,
+          sandboxExecRoot,
+          verboseFailures,
+          sandboxOptions.sandboxOutputLimit);
     }
   }
 
@@ -30,12 +30,20 @@ import java.util.Map;
 final class ProcessWrapperRunner extends SandboxRunner {
   private final Path execRoot;
   private final Path sandboxExecRoot;
+  private final Path statisticsPath;
+  private final int outputLimit;
 
   ProcessWrapperRunner(
-      Path execRoot, Path sandboxPath, Path sandboxExecRoot, boolean verboseFailures) {
+      Path execRoot,
+      Path sandboxPath,
+      Path sandboxExecRoot,
+      boolean verboseFailures,
+      int outputLimit) {
     super(sandboxExecRoot, verboseFailures);
     this.execRoot = execRoot;
     this.sandboxExecRoot = sandboxExecRoot;
+    this.statisticsPath = sandboxPath.getRelative("stats.out");
+    this.outputLimit = outputLimit;
   }
 
   static boolean isSupported(CommandEnvironment commandEnv) {
@@ -55,8 +63,12 @@ final class ProcessWrapperRunner extends SandboxRunner {
   @Override
   protected Command getCommand(
       List<String> spawnArguments, Map<String, String> env, int timeout, boolean allowNetwork) {
-    List<String> commandLineArgs = new ArrayList<>(5 + spawnArguments.size());
+    List<String> commandLineArgs = new ArrayList<>(7 + spawnArguments.size());
     commandLineArgs.add(execRoot.getRelative("_bin/process-wrapper").getPathString());
+    commandLineArgs.add("--stats=" + statisticsPath.getPathString());
+    if (outputLimit > 0) {
+      commandLineArgs.add("--output_limit=" + outputLimit);
+    }
     commandLineArgs.add(Integer.toString(timeout));
     commandLineArgs.add("5"); /* kill delay: give some time to print stacktraces and whatnot. */
     commandLineArgs.add("-"); /* stdout. */
@@ -65,4 +77,9 @@ final class ProcessWrapperRunner extends SandboxRunner {
 
     return new Command(commandLineArgs.toArray(new String[0]), env, sandboxExecRoot.getPathFile());
   }
+
+  @Override
+  protected Path getStatisticsPath() {
+    return statisticsPath;
+  }
 }
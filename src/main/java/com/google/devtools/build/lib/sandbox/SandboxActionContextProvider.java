@@ -41,8 +41,13 @@ final class SandboxActionContextProvider extends ActionContextProvider {
     this.contexts = contexts;
   }
 
+  /**
+   * @param treeDeleter deletes the sandbox directories in the background, or null to delete them
+   *     before the spawn counts as done
+   */
   public static SandboxActionContextProvider create(
-      CommandEnvironment env, BuildRequest buildRequest) throws IOException {
+      CommandEnvironment env, BuildRequest buildRequest, AsynchronousTreeDeleter treeDeleter)
+      throws IOException {
     boolean verboseFailures = buildRequest.getOptions(ExecutionOptions.class).verboseFailures;
     ImmutableList.Builder<ActionContext> contexts = ImmutableList.builder();
 
@@ -60,7 +65,8 @@ final class SandboxActionContextProvider extends ActionContextProvider {
                   env.getDirectories(),
                   verboseFailures,
                   env.getRuntime().getProductName(),
-                  fullySupported));
+                  fullySupported,
+                  treeDeleter));
         }
         break;
       case DARWIN:
@@ -71,7 +77,9 @@ final class SandboxActionContextProvider extends ActionContextProvider {
                   env.getClientEnv(),
                   env.getDirectories(),
                   verboseFailures,
-                  env.getRuntime().getProductName()));
+                  env.getRuntime().getProductName(),
+                  DarwinSandboxRunner.getNativeHelper(env),
+                  treeDeleter));
         } else {
           if (!buildRequest.getOptions(SandboxOptions.class).ignoreUnsupportedSandboxing) {
             env.getReporter().handle(Event.warn(SANDBOX_NOT_SUPPORTED_MESSAGE));
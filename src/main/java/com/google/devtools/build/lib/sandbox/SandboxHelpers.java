@@ -100,4 +100,17 @@ public final class SandboxHelpers {
         .getRelative(productName + "-sandbox")
         .getRelative(uuid + "-" + execCounter.getAndIncrement());
   }
+
+  /** Returns the directory the sandbox profiles for darwin-sandbox are written to. */
+  static Path getSandboxProfiles(BlazeDirectories blazeDirs, String productName) {
+    return blazeDirs
+        .getOutputBase()
+        .getRelative(productName + "-sandbox")
+        .getRelative("_profiles");
+  }
+
+  /** Returns the directory {@link AsynchronousTreeDeleter} moves the sandbox directories to. */
+  static Path getSandboxTrash(BlazeDirectories blazeDirs, String productName) {
+    return blazeDirs.getOutputBase().getRelative(productName + "-sandbox").getRelative("_trash");
+  }
 }
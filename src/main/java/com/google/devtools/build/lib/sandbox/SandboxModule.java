@@ -27,6 +27,9 @@ import java.io.IOException;
  * This module provides the Sandbox spawn strategy.
  */
 public final class SandboxModule extends BlazeModule {
+  // Created by the first build that asks for it, and kept for the lifetime of the server.
+  private AsynchronousTreeDeleter treeDeleter;
+
   @Override
   public Iterable<Class<? extends OptionsBase>> getCommandOptions(Command command) {
     return "build".equals(command.name())
@@ -36,11 +39,28 @@ public final class SandboxModule extends BlazeModule {
 
   @Override
   public void executorInit(CommandEnvironment env, BuildRequest request, ExecutorBuilder builder) {
+    AsynchronousTreeDeleter deleter = null;
+    if (request.getOptions(SandboxOptions.class).sandboxAsyncTreeDelete) {
+      if (treeDeleter == null) {
+        treeDeleter =
+            new AsynchronousTreeDeleter(
+                SandboxHelpers.getSandboxTrash(
+                    env.getDirectories(), env.getRuntime().getProductName()));
+      }
+      deleter = treeDeleter;
+    }
     try {
-      builder.addActionContextProvider(SandboxActionContextProvider.create(env, request));
+      builder.addActionContextProvider(SandboxActionContextProvider.create(env, request, deleter));
     } catch (IOException e) {
       throw new IllegalStateException(e);
     }
     builder.addActionContextConsumer(new SandboxActionContextConsumer(env));
   }
+
+  @Override
+  public void blazeShutdown() {
+    if (treeDeleter != null) {
+      treeDeleter.shutdown();
+    }
+  }
 }
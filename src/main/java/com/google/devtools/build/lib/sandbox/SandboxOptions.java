@@ -59,4 +59,87 @@ public class SandboxOptions extends OptionsBase {
           + " (if supported by the sandboxing implementation, ignored otherwise)."
   )
   public List<String> sandboxTmpfsPath;
+
+  @Option(
+    name = "experimental_sandbox_daemon",
+    defaultValue = "false",
+    category = "strategy",
+    help =
+        "Run sandboxed actions through a long-lived linux-sandbox daemon, which sets up the "
+            + "namespaces and the read-only view of the file system once rather than for every "
+            + "action."
+  )
+  public boolean sandboxDaemon;
+
+  @Option(
+    name = "experimental_sandbox_input_manifest",
+    defaultValue = "false",
+    category = "strategy",
+    help =
+        "Pass the inputs of sandboxed actions to linux-sandbox as a manifest, which creates them "
+            + "on a tmpfs inside the sandbox, rather than creating a symlink per input in the "
+            + "output base before running the action."
+  )
+  public boolean sandboxInputManifest;
+
+  @Option(
+    name = "experimental_sandbox_scratch_size",
+    defaultValue = "",
+    category = "strategy",
+    valueHelp = "<size>",
+    help =
+        "Only with linux-sandbox: send what sandboxed actions write to their exec root to a tmpfs "
+            + "of this size, e.g. 512m or 2g, rather than to the disk, and copy only their outputs "
+            + "to the disk. Actions that write more fail with ENOSPC. If empty, the writes go to "
+            + "the disk."
+  )
+  public String sandboxScratchSize;
+
+  @Option(
+    name = "experimental_sandbox_async_tree_delete",
+    defaultValue = "false",
+    category = "strategy",
+    help =
+        "Move the sandbox directory of a finished action out of the way and delete it in the "
+            + "background, rather than making the action wait for the deletion."
+  )
+  public boolean sandboxAsyncTreeDelete;
+
+  @Option(
+    name = "experimental_sandbox_cgroup",
+    defaultValue = "",
+    category = "strategy",
+    valueHelp = "<path>",
+    help =
+        "Only with linux-sandbox and cgroups v2: the directory of a cgroup, e.g. "
+            + "/sys/fs/cgroup/bazel, to run each sandboxed action in a cgroup of its own below. "
+            + "Its resource usage is logged with that of the action. If empty, actions stay in "
+            + "the cgroup of Bazel."
+  )
+  public String sandboxCgroup;
+
+  @Option(
+    name = "experimental_sandbox_cgroup_setting",
+    allowMultiple = true,
+    defaultValue = "",
+    category = "strategy",
+    valueHelp = "<controller>.<file>=<value>",
+    help =
+        "A setting for the cgroup of each action of --experimental_sandbox_cgroup, for example "
+            + "memory.max=4G, cpu.max=\"200000 100000\" or pids.max=1000. The controllers are "
+            + "enabled in the cgroup of --experimental_sandbox_cgroup as needed."
+  )
+  public List<String> sandboxCgroupSettings;
+
+  @Option(
+    name = "experimental_sandbox_output_limit",
+    defaultValue = "0",
+    category = "strategy",
+    valueHelp = "<bytes>",
+    help =
+        "Only with process-wrapper on Linux: keep at most this many bytes of each of stdout and "
+            + "stderr of a sandboxed action, the first and the last half, and discard the rest "
+            + "before it reaches Bazel. If 0, all of the output is kept."
+  )
+  public int sandboxOutputLimit;
 }
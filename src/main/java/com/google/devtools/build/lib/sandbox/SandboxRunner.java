@@ -14,26 +14,42 @@
 
 package com.google.devtools.build.lib.sandbox;
 
+import com.google.common.annotations.VisibleForTesting;
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.ImmutableMap;
+import com.google.common.collect.ImmutableSet;
 import com.google.devtools.build.lib.actions.ExecException;
 import com.google.devtools.build.lib.actions.UserExecException;
+import com.google.devtools.build.lib.profiler.Profiler;
+import com.google.devtools.build.lib.profiler.ProfilerTask;
 import com.google.devtools.build.lib.shell.AbnormalTerminationException;
 import com.google.devtools.build.lib.shell.Command;
 import com.google.devtools.build.lib.shell.CommandException;
 import com.google.devtools.build.lib.shell.KillableObserver;
 import com.google.devtools.build.lib.shell.TerminationStatus;
 import com.google.devtools.build.lib.util.CommandFailureUtils;
+import com.google.devtools.build.lib.unix.NativeSubprocess.CgroupStatistics;
+import com.google.devtools.build.lib.unix.NativeSubprocess.ResourceUsage;
 import com.google.devtools.build.lib.util.io.OutErr;
+import com.google.devtools.build.lib.vfs.FileSystemUtils;
 import com.google.devtools.build.lib.vfs.Path;
+import com.google.devtools.build.lib.vfs.PathFragment;
 import java.io.IOException;
+import java.nio.charset.StandardCharsets;
 import java.util.Arrays;
+import java.util.Collection;
 import java.util.List;
 import java.util.Map;
+import java.util.concurrent.TimeUnit;
 
 /** A common interface of all sandbox runners, no matter which platform they're working on. */
 abstract class SandboxRunner {
 
   private final boolean verboseFailures;
   private final Path sandboxExecRoot;
+  private ResourceUsage resourceUsage;
+  private CgroupStatistics cgroupStatistics;
+  private ImmutableSet<PathFragment> changes;
 
   SandboxRunner(Path sandboxExecRoot, boolean verboseFailures) {
     this.sandboxExecRoot = sandboxExecRoot;
@@ -63,6 +79,7 @@ abstract class SandboxRunner {
       throw new UserExecException("I/O error during sandboxed execution", e);
     }
 
+    long startTime = Profiler.nanoTimeMaybe();
     try {
       cmd.execute(
           /* stdin */ new byte[] {},
@@ -70,7 +87,13 @@ abstract class SandboxRunner {
           outErr.getOutputStream(),
           outErr.getErrorStream(),
           /* killSubprocessOnInterrupt */ true);
+      readStatistics();
+      readTimings(startTime);
+      readChanges();
     } catch (CommandException e) {
+      readStatistics();
+      readTimings(startTime);
+      readChanges();
       boolean timedOut = false;
       if (e instanceof AbnormalTerminationException) {
         TerminationStatus status =
@@ -87,6 +110,139 @@ abstract class SandboxRunner {
     }
   }
 
+  private void readStatistics() {
+    Path statisticsPath = getStatisticsPath();
+    if (statisticsPath == null) {
+      return;
+    }
+    try {
+      String statistics = FileSystemUtils.readContent(statisticsPath, StandardCharsets.ISO_8859_1);
+      resourceUsage = ResourceUsage.parseStatistics(statistics);
+      cgroupStatistics = CgroupStatistics.parseStatistics(statistics);
+    } catch (IOException e) {
+      // The command did not get as far as running the spawn.
+    }
+  }
+
+  /**
+   * Adds the steps of setting up and tearing down the sandbox to the profile, one after the other
+   * from when the command started.
+   */
+  private void readTimings(long startTime) {
+    Path timingsPath = getTimingsPath();
+    if (timingsPath == null || !Profiler.instance().isActive()) {
+      return;
+    }
+    ImmutableMap<String, Long> timings;
+    try {
+      timings =
+          parseTimings(FileSystemUtils.readContent(timingsPath, StandardCharsets.ISO_8859_1));
+    } catch (IOException e) {
+      // The command did not get as far as setting up the sandbox.
+      return;
+    }
+    long stepStartTime = startTime;
+    for (Map.Entry<String, Long> timing : timings.entrySet()) {
+      long duration = TimeUnit.MICROSECONDS.toNanos(timing.getValue());
+      Profiler.instance()
+          .logSimpleTaskDuration(
+              stepStartTime, duration, ProfilerTask.SANDBOX_STEP, timing.getKey());
+      stepStartTime += duration;
+    }
+  }
+
+  /**
+   * Parses the lines {@code <step>_micros <time>} of the file of {@link #getTimingsPath}, in the
+   * order of the steps, into the time in microseconds of each step. Ignores the lines it does not
+   * know.
+   */
+  @VisibleForTesting
+  static ImmutableMap<String, Long> parseTimings(String timings) {
+    ImmutableMap.Builder<String, Long> steps = ImmutableMap.builder();
+    for (String line : timings.split("\n")) {
+      int space = line.indexOf(' ');
+      if (space < 0 || !line.substring(0, space).endsWith("_micros")) {
+        continue;
+      }
+      try {
+        steps.put(
+            line.substring(0, space - "_micros".length()),
+            Long.parseLong(line.substring(space + 1).trim()));
+      } catch (NumberFormatException e) {
+        // Not a line of ours.
+      }
+    }
+    return steps.build();
+  }
+
+  private void readChanges() {
+    changes = null;
+    Path changesPath = getChangesPath();
+    if (changesPath == null) {
+      return;
+    }
+    try {
+      changes =
+          parseChanges(FileSystemUtils.readContent(changesPath, StandardCharsets.ISO_8859_1));
+    } catch (IOException e) {
+      // The command did not get as far as setting up the sandbox.
+    }
+  }
+
+  /**
+   * Parses the lines {@code <type> <path>} of the file of {@link #getChangesPath} into the paths
+   * of the files, symlinks and directories the spawn created or changed, or returns null if the
+   * file does not end with the line {@code .}, that is, if the changes are not known.
+   */
+  @VisibleForTesting
+  static ImmutableSet<PathFragment> parseChanges(String changes) {
+    if (!changes.equals(".\n") && !changes.endsWith("\n.\n")) {
+      return null;
+    }
+    ImmutableSet.Builder<PathFragment> paths = ImmutableSet.builder();
+    for (String line : changes.split("\n")) {
+      if (line.length() > 2
+          && line.charAt(1) == ' '
+          && (line.charAt(0) == 'f' || line.charAt(0) == 'l' || line.charAt(0) == 'd')) {
+        paths.add(new PathFragment(line.substring(2)));
+      }
+    }
+    return paths.build();
+  }
+
+  /**
+   * Returns the {@code outputs} that the spawn of the last {@link #run} wrote, as far as the
+   * sandbox knows, so that collecting the outputs does not look at the others; all of them if it
+   * does not know.
+   */
+  Collection<PathFragment> getWrittenOutputs(Collection<PathFragment> outputs) {
+    if (changes == null) {
+      return outputs;
+    }
+    ImmutableList.Builder<PathFragment> written = ImmutableList.builder();
+    for (PathFragment output : outputs) {
+      if (changes.contains(output)) {
+        written.add(output);
+      }
+    }
+    return written.build();
+  }
+
+  /**
+   * Returns the resources the spawn used in the last {@link #run}, or null if they are not known.
+   */
+  ResourceUsage getResourceUsage() {
+    return resourceUsage;
+  }
+
+  /**
+   * Returns the resources the cgroup of the spawn used in the last {@link #run}, or null if the
+   * spawn did not run in a cgroup of its own.
+   */
+  CgroupStatistics getCgroupStatistics() {
+    return cgroupStatistics;
+  }
+
   /**
    * Returns the {@link Command} that the {@link #run} method will execute inside the sandbox.
    *
@@ -107,6 +263,32 @@ abstract class SandboxRunner {
     return Command.NO_OBSERVER;
   }
 
+  /**
+   * Returns the file the command returned by {@link #getCommand} writes the resource usage of the
+   * spawn to, in the format of {@link ResourceUsage#parseStatistics}, or null if it does not.
+   */
+  protected Path getStatisticsPath() {
+    return null;
+  }
+
+  /**
+   * Returns the file the command returned by {@link #getCommand} writes the time the steps of
+   * setting up and tearing down the sandbox took to, in the format of {@link #parseTimings}, or
+   * null if it does not.
+   */
+  protected Path getTimingsPath() {
+    return null;
+  }
+
+  /**
+   * Returns the file the command returned by {@link #getCommand} writes what the spawn changed in
+   * the sandboxed execution root to, in the format of {@link #parseChanges}, or null if it does
+   * not.
+   */
+  protected Path getChangesPath() {
+    return null;
+  }
+
   /**
    * Returns the signal code that the command returned by {@link #getCommand} exits with in case of
    * a timeout.
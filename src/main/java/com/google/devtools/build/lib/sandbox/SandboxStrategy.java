@@ -28,15 +28,18 @@ import com.google.devtools.build.lib.analysis.BlazeDirectories;
 import com.google.devtools.build.lib.buildtool.BuildRequest;
 import com.google.devtools.build.lib.events.Event;
 import com.google.devtools.build.lib.events.EventHandler;
+import com.google.devtools.build.lib.vfs.FileSystemUtils;
 import com.google.devtools.build.lib.vfs.Path;
 import com.google.devtools.build.lib.vfs.PathFragment;
 import java.io.IOException;
 import java.util.Map;
 import java.util.Set;
 import java.util.concurrent.atomic.AtomicReference;
+import java.util.logging.Logger;
 
 /** Abstract common ancestor for sandbox strategies implementing the common parts. */
 abstract class SandboxStrategy implements SandboxedSpawnActionContext {
+  private static final Logger LOG = Logger.getLogger(SandboxStrategy.class.getName());
 
   private final BuildRequest buildRequest;
   private final BlazeDirectories blazeDirs;
@@ -44,18 +47,34 @@ abstract class SandboxStrategy implements SandboxedSpawnActionContext {
   private final boolean verboseFailures;
   private final SandboxOptions sandboxOptions;
   private final SpawnHelpers spawnHelpers;
+  private final AsynchronousTreeDeleter treeDeleter;
 
+  /**
+   * @param treeDeleter deletes the sandbox directories in the background, or null to delete them
+   *     before the spawn counts as done
+   */
   public SandboxStrategy(
       BuildRequest buildRequest,
       BlazeDirectories blazeDirs,
       boolean verboseFailures,
-      SandboxOptions sandboxOptions) {
+      SandboxOptions sandboxOptions,
+      AsynchronousTreeDeleter treeDeleter) {
     this.buildRequest = buildRequest;
     this.blazeDirs = blazeDirs;
     this.execRoot = blazeDirs.getExecRoot();
     this.verboseFailures = verboseFailures;
     this.sandboxOptions = sandboxOptions;
     this.spawnHelpers = new SpawnHelpers(blazeDirs.getExecRoot());
+    this.treeDeleter = treeDeleter;
+  }
+
+  /** Deletes the sandbox directory of a spawn, in the background if possible. */
+  protected void deleteSandbox(Path sandboxPath) throws IOException {
+    if (treeDeleter != null) {
+      treeDeleter.deleteTree(sandboxPath);
+    } else {
+      FileSystemUtils.deleteTree(sandboxPath);
+    }
   }
 
   protected void runSpawn(
@@ -79,6 +98,16 @@ abstract class SandboxStrategy implements SandboxedSpawnActionContext {
     } catch (ExecException e) {
       execException = e;
     }
+    if (runner.getResourceUsage() != null) {
+      LOG.fine(
+          "Resource usage of " + spawn.getResourceOwner().prettyPrint() + ": "
+              + runner.getResourceUsage());
+    }
+    if (runner.getCgroupStatistics() != null) {
+      LOG.fine(
+          "Cgroup statistics of " + spawn.getResourceOwner().prettyPrint() + ": "
+              + runner.getCgroupStatistics());
+    }
 
     if (writeOutputFiles != null && !writeOutputFiles.compareAndSet(null, SandboxStrategy.class)) {
       throw new InterruptedException();
@@ -88,7 +117,7 @@ abstract class SandboxStrategy implements SandboxedSpawnActionContext {
       // We copy the outputs even when the command failed, otherwise StandaloneTestStrategy
       // won't be able to get the test logs of a failed test. (We should probably do this in
       // some better way.)
-      sandboxExecRoot.copyOutputs(execRoot, outputs);
+      sandboxExecRoot.copyOutputs(execRoot, runner.getWrittenOutputs(outputs));
     } catch (IOException e) {
       if (execException == null) {
         throw new UserExecException("Could not move output artifacts from sandboxed execution", e);
@@ -22,8 +22,13 @@ import com.google.devtools.build.lib.vfs.Path;
 import com.google.devtools.build.lib.vfs.PathFragment;
 import com.google.devtools.build.lib.vfs.Symlinks;
 import java.io.IOException;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
 import java.util.Collection;
+import java.util.Collections;
 import java.util.HashSet;
+import java.util.LinkedHashMap;
+import java.util.List;
 import java.util.Map;
 import java.util.Map.Entry;
 import java.util.Set;
@@ -31,13 +36,26 @@ import java.util.Set;
 /**
  * Creates an execRoot for a Spawn that contains input files as symlinks to their original
  * destination.
+ *
+ * <p>With an input manifest, the symlinks are not created here: their paths and targets go into
+ * the manifest instead, for linux-sandbox to create inside the sandbox (-M).
  */
 public final class SymlinkedExecRoot implements SandboxExecRoot {
 
   private final Path sandboxExecRoot;
+  private final Path inputManifest;
 
   public SymlinkedExecRoot(Path sandboxExecRoot) {
+    this(sandboxExecRoot, null);
+  }
+
+  /**
+   * Creates an execRoot whose inputs are written to {@code inputManifest} rather than created as
+   * symlinks, unless {@code inputManifest} is null.
+   */
+  public SymlinkedExecRoot(Path sandboxExecRoot, Path inputManifest) {
     this.sandboxExecRoot = sandboxExecRoot;
+    this.inputManifest = inputManifest;
   }
 
   @Override
@@ -45,30 +63,40 @@ public final class SymlinkedExecRoot implements SandboxExecRoot {
       Map<PathFragment, Path> inputs, Collection<PathFragment> outputs, Set<Path> writableDirs)
       throws IOException {
     Set<Path> createdDirs = new HashSet<>();
-    cleanFileSystem(inputs.keySet());
-    FileSystemUtils.createDirectoryAndParentsWithCache(createdDirs, sandboxExecRoot);
-    createParentDirectoriesForInputs(createdDirs, inputs.keySet());
-    createSymlinksForInputs(inputs);
+    if (inputManifest != null) {
+      cleanFileSystem(Collections.<PathFragment>emptySet());
+      FileSystemUtils.createDirectoryAndParentsWithCache(createdDirs, sandboxExecRoot);
+      writeInputManifest(inputs);
+    } else {
+      Set<Path> remainingFiles = cleanFileSystem(inputs.keySet());
+      FileSystemUtils.createDirectoryAndParentsWithCache(createdDirs, sandboxExecRoot);
+      createInputs(createdDirs, remainingFiles, inputs);
+    }
     createWritableDirectories(createdDirs, writableDirs);
     createDirectoriesForOutputs(createdDirs, outputs);
   }
 
-  private void cleanFileSystem(Set<PathFragment> allowedFiles) throws IOException {
+  /** Returns the allowed files that are left from a previous spawn. */
+  private Set<Path> cleanFileSystem(Set<PathFragment> allowedFiles) throws IOException {
+    Set<Path> remainingFiles = new HashSet<>();
     if (sandboxExecRoot.exists(Symlinks.NOFOLLOW)) {
-      deleteExceptAllowedFiles(sandboxExecRoot, allowedFiles);
+      deleteExceptAllowedFiles(sandboxExecRoot, allowedFiles, remainingFiles);
     }
+    return remainingFiles;
   }
 
-  private void deleteExceptAllowedFiles(Path root, Set<PathFragment> allowedFiles)
-      throws IOException {
+  private void deleteExceptAllowedFiles(
+      Path root, Set<PathFragment> allowedFiles, Set<Path> remainingFiles) throws IOException {
     for (Path p : root.getDirectoryEntries()) {
       FileStatus stat = p.stat(Symlinks.NOFOLLOW);
       if (!stat.isDirectory()) {
         if (!allowedFiles.contains(p.relativeTo(sandboxExecRoot))) {
           p.delete();
+        } else {
+          remainingFiles.add(p);
         }
       } else {
-        deleteExceptAllowedFiles(p, allowedFiles);
+        deleteExceptAllowedFiles(p, allowedFiles, remainingFiles);
         if (p.readdir(Symlinks.NOFOLLOW).isEmpty()) {
           p.delete();
         }
@@ -87,29 +115,57 @@ public final class SymlinkedExecRoot implements SandboxExecRoot {
    * <p>Creating all parent directories first ensures that we can safely create symlinks to
    * directories, too, because we'll get an IOException with EEXIST if inputs happen to be nested
    * once we start creating the symlinks for all inputs.
+   *
+   * <p>The directories and symlinks are created in one go, as a large action can have tens of
+   * thousands of inputs. Only the files left from a previous spawn need looking at first.
    */
-  private void createParentDirectoriesForInputs(Set<Path> createdDirs, Set<PathFragment> inputs)
+  private void createInputs(
+      Set<Path> createdDirs, Set<Path> remainingFiles, Map<PathFragment, Path> inputs)
       throws IOException {
-    for (PathFragment inputPath : inputs) {
-      Path dir = sandboxExecRoot.getRelative(inputPath).getParentDirectory();
-      Preconditions.checkArgument(dir.startsWith(sandboxExecRoot));
-      FileSystemUtils.createDirectoryAndParentsWithCache(createdDirs, dir);
-    }
-  }
-
-  private void createSymlinksForInputs(Map<PathFragment, Path> inputs) throws IOException {
+    List<Path> dirs = new ArrayList<>();
+    Map<Path, PathFragment> symlinks = new LinkedHashMap<>();
     // All input files are relative to the execroot.
     for (Entry<PathFragment, Path> entry : inputs.entrySet()) {
       Path key = sandboxExecRoot.getRelative(entry.getKey());
-      FileStatus keyStat = key.statNullable(Symlinks.NOFOLLOW);
-      if (keyStat != null) {
+      Path dir = key.getParentDirectory();
+      Preconditions.checkArgument(dir.startsWith(sandboxExecRoot));
+      addDirectoryAndParents(createdDirs, dir, dirs);
+      if (remainingFiles.contains(key)) {
+        FileStatus keyStat = key.stat(Symlinks.NOFOLLOW);
         if (keyStat.isSymbolicLink()
             && key.readSymbolicLink().equals(entry.getValue().asFragment())) {
           continue;
         }
         key.delete();
       }
-      key.createSymbolicLink(entry.getValue());
+      symlinks.put(key, entry.getValue().asFragment());
+    }
+    FileSystemUtils.createSymlinkForest(sandboxExecRoot.getFileSystem(), dirs, symlinks);
+  }
+
+  /**
+   * Writes the inputs to the manifest: per input, a line with its path relative to the execRoot
+   * and a line with the path it is a symlink to.
+   */
+  private void writeInputManifest(Map<PathFragment, Path> inputs) throws IOException {
+    List<String> lines = new ArrayList<>(inputs.size() * 2);
+    for (Entry<PathFragment, Path> entry : inputs.entrySet()) {
+      Preconditions.checkArgument(
+          sandboxExecRoot.getRelative(entry.getKey()).startsWith(sandboxExecRoot));
+      lines.add(entry.getKey().getPathString());
+      lines.add(entry.getValue().getPathString());
+    }
+    FileSystemUtils.writeLinesAs(inputManifest, StandardCharsets.ISO_8859_1, lines);
+  }
+
+  /**
+   * Adds {@code dir} and its parents that are not in {@code createdDirs} to {@code dirs}, parents
+   * first, and to {@code createdDirs}.
+   */
+  private static void addDirectoryAndParents(Set<Path> createdDirs, Path dir, List<Path> dirs) {
+    if (createdDirs.add(dir)) {
+      addDirectoryAndParents(createdDirs, dir.getParentDirectory(), dirs);
+      dirs.add(dir);
     }
   }
 
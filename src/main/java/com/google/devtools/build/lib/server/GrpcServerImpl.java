@@ -15,9 +15,9 @@
 package com.google.devtools.build.lib.server;
 
 import com.google.common.annotations.VisibleForTesting;
-import com.google.common.base.Verify;
 import com.google.common.collect.ImmutableList;
 import com.google.common.collect.ImmutableSet;
+import com.google.common.io.ByteStreams;
 import com.google.common.net.InetAddresses;
 import com.google.common.util.concurrent.ThreadFactoryBuilder;
 import com.google.common.util.concurrent.Uninterruptibles;
@@ -26,10 +26,15 @@ import com.google.devtools.build.lib.runtime.BlazeCommandDispatcher.LockingMode;
 import com.google.devtools.build.lib.runtime.CommandExecutor;
 import com.google.devtools.build.lib.server.CommandProtos.CancelRequest;
 import com.google.devtools.build.lib.server.CommandProtos.CancelResponse;
+import com.google.devtools.build.lib.server.CommandProtos.ExecRequest;
 import com.google.devtools.build.lib.server.CommandProtos.PingRequest;
 import com.google.devtools.build.lib.server.CommandProtos.PingResponse;
 import com.google.devtools.build.lib.server.CommandProtos.RunRequest;
 import com.google.devtools.build.lib.server.CommandProtos.RunResponse;
+import com.google.devtools.build.lib.server.CommandProtos.TrimMemoryRequest;
+import com.google.devtools.build.lib.server.CommandProtos.TrimMemoryResponse;
+import com.google.devtools.build.lib.server.CommandProtos.WarmupRequest;
+import com.google.devtools.build.lib.server.CommandProtos.WarmupResponse;
 import com.google.devtools.build.lib.util.BlazeClock;
 import com.google.devtools.build.lib.util.Clock;
 import com.google.devtools.build.lib.util.ExitCode;
@@ -44,6 +49,11 @@ import io.grpc.StatusRuntimeException;
 import io.grpc.netty.NettyServerBuilder;
 import io.grpc.stub.ServerCallStreamObserver;
 import io.grpc.stub.StreamObserver;
+import io.netty.channel.epoll.Epoll;
+import io.netty.channel.epoll.EpollEventLoopGroup;
+import io.netty.channel.epoll.EpollServerDomainSocketChannel;
+import io.netty.channel.unix.DomainSocketAddress;
+import java.io.FileOutputStream;
 import java.io.IOException;
 import java.io.OutputStream;
 import java.io.PrintWriter;
@@ -66,6 +76,7 @@ import java.util.concurrent.atomic.AtomicBoolean;
 import java.util.concurrent.atomic.AtomicLong;
 import java.util.concurrent.atomic.AtomicReference;
 import java.util.logging.Logger;
+import javax.annotation.Nullable;
 import javax.annotation.concurrent.GuardedBy;
 
 /**
@@ -142,8 +153,10 @@ public class GrpcServerImpl implements RPCServer {
   public static class Factory implements RPCServer.Factory {
     @Override
     public RPCServer create(CommandExecutor commandExecutor, Clock clock, int port,
-      Path serverDirectory, int maxIdleSeconds) throws IOException {
-      return new GrpcServerImpl(commandExecutor, clock, port, serverDirectory, maxIdleSeconds);
+      boolean unixSocket, Path serverDirectory, int maxIdleSeconds, int idleTrimSeconds)
+        throws IOException {
+      return new GrpcServerImpl(commandExecutor, clock, port, unixSocket, serverDirectory,
+          maxIdleSeconds, idleTrimSeconds);
     }
   }
 
@@ -437,10 +450,52 @@ public class GrpcServerImpl implements RPCServer {
     }
   }
 
+  /**
+   * An output stream that writes straight to the pipe the standard output of the client goes to,
+   * so that large outputs are neither copied into RPC messages nor relayed by the client.
+   *
+   * <p>When the reader of the pipe goes away, the command is interrupted, just like the client
+   * cancels it when it cannot write its standard output any more.
+   */
+  private static class PipeOutputStream extends OutputStream {
+    private final FileOutputStream out;
+    private final Thread commandThread;
+    private final AtomicBoolean broken = new AtomicBoolean(false);
+
+    PipeOutputStream(String path, Thread commandThread) throws IOException {
+      this.out = new FileOutputStream(path);
+      this.commandThread = commandThread;
+    }
+
+    @Override
+    public void write(byte[] b, int off, int len) throws IOException {
+      try {
+        out.write(b, off, len);
+      } catch (IOException e) {
+        if (broken.compareAndSet(false, true)) {
+          log.info("Cannot write to the standard output of the client: " + e.getMessage());
+          commandThread.interrupt();
+        }
+        throw e;
+      }
+    }
+
+    @Override
+    public void write(int byteAsInt) throws IOException {
+      write(new byte[] {(byte) byteAsInt}, 0, 1);
+    }
+
+    @Override
+    public void close() throws IOException {
+      out.close();
+    }
+  }
+
   // These paths are all relative to the server directory
   private static final String PORT_FILE = "command_port";
   private static final String REQUEST_COOKIE_FILE = "request_cookie";
   private static final String RESPONSE_COOKIE_FILE = "response_cookie";
+  private static final String SOCKET_FILE = "server.socket";
 
   private static final AtomicBoolean runShutdownHooks = new AtomicBoolean(true);
 
@@ -455,13 +510,16 @@ public class GrpcServerImpl implements RPCServer {
   private final String responseCookie;
   private final AtomicLong interruptCounter = new AtomicLong(0);
   private final int maxIdleSeconds;
+  private final int idleTrimSeconds;
 
   private Server server;
   private final int port;
+  private final boolean unixSocket;
   boolean serving;
 
   public GrpcServerImpl(CommandExecutor commandExecutor, Clock clock, int port,
-      Path serverDirectory, int maxIdleSeconds) throws IOException {
+      boolean unixSocket, Path serverDirectory, int maxIdleSeconds, int idleTrimSeconds)
+      throws IOException {
     // server.pid was written in the C++ launcher after fork() but before exec() .
     // The client only accesses the pid file after connecting to the socket
     // which ensures that it gets the correct pid value.
@@ -474,7 +532,9 @@ public class GrpcServerImpl implements RPCServer {
     this.clock = clock;
     this.serverDirectory = serverDirectory;
     this.port = port;
+    this.unixSocket = unixSocket;
     this.maxIdleSeconds = maxIdleSeconds;
+    this.idleTrimSeconds = idleTrimSeconds;
     this.serving = false;
 
     this.streamExecutorPool =
@@ -490,6 +550,11 @@ public class GrpcServerImpl implements RPCServer {
     responseCookie = generateCookie(random, 16);
   }
 
+  @VisibleForTesting
+  String getRequestCookie() {
+    return requestCookie;
+  }
+
   private static String generateCookie(SecureRandom random, int byteCount) {
     byte[] bytes = new byte[byteCount];
     random.nextBytes(bytes);
@@ -531,21 +596,48 @@ public class GrpcServerImpl implements RPCServer {
     interruptWatcherThread.start();
   }
 
+  /**
+   * Shrinks the heap with a full garbage collection, after which the JVM returns the memory it no
+   * longer needs to the operating system, so that the idle servers of several workspaces fit into
+   * the memory of one machine. Does nothing while a command runs.
+   */
+  private void trimMemory() {
+    synchronized (runningCommands) {
+      if (!runningCommands.isEmpty()) {
+        return;
+      }
+    }
+
+    Runtime runtime = Runtime.getRuntime();
+    long committedBefore = runtime.totalMemory();
+    System.gc();
+    log.info(String.format(
+        "Trimmed the heap from %d to %d bytes", committedBefore, runtime.totalMemory()));
+  }
+
   private void timeoutThread() {
     synchronized (runningCommands) {
       boolean idle = runningCommands.isEmpty();
       boolean wasIdle = false;
       long shutdownTime = -1;
+      long trimTime = -1;
 
       while (true) {
         if (!wasIdle && idle) {
-          shutdownTime = BlazeClock.nanoTime() + maxIdleSeconds * 1000L * NANOSECONDS_IN_MS;
+          long now = BlazeClock.nanoTime();
+          shutdownTime =
+              maxIdleSeconds > 0 ? now + maxIdleSeconds * 1000L * NANOSECONDS_IN_MS : -1;
+          trimTime = idleTrimSeconds > 0 ? now + idleTrimSeconds * 1000L * NANOSECONDS_IN_MS : -1;
+        }
+
+        long wakeUpTime = shutdownTime;
+        if (trimTime > 0 && (wakeUpTime < 0 || trimTime < wakeUpTime)) {
+          wakeUpTime = trimTime;
         }
 
         try {
-          if (idle) {
-            Verify.verify(shutdownTime > 0);
-            long waitTime = shutdownTime - BlazeClock.nanoTime();
+          if (idle && wakeUpTime > 0) {
+            long waitTime = wakeUpTime - BlazeClock.nanoTime();
             if (waitTime > 0) {
               // Round upwards so that we don't busy-wait in the last millisecond
               runningCommands.wait((waitTime + NANOSECONDS_IN_MS - 1) / NANOSECONDS_IN_MS);
@@ -559,8 +651,22 @@ public class GrpcServerImpl implements RPCServer {
 
         wasIdle = idle;
         idle = runningCommands.isEmpty();
-        if (wasIdle && idle && BlazeClock.nanoTime() >= shutdownTime) {
-          break;
+        if (wasIdle && idle) {
+          long now = BlazeClock.nanoTime();
+          if (shutdownTime > 0 && now >= shutdownTime) {
+            break;
+          }
+          if (trimTime > 0 && now >= trimTime) {
+            // Once per idle period, and not while holding the lock, which commands need to start.
+            trimTime = -1;
+            commandExecutorPool.execute(
+                new Runnable() {
+                  @Override
+                  public void run() {
+                    trimMemory();
+                  }
+                });
+          }
         }
       }
     }
@@ -579,10 +685,8 @@ public class GrpcServerImpl implements RPCServer {
     }
   }
 
-  @Override
-  public void serve() throws IOException {
-    Preconditions.checkState(!serving);
-
+  /** Starts serving on a TCP port on localhost. Returns the address to write into the port file. */
+  private String serveOnLocalhost() throws IOException {
     // For reasons only Apple knows, you cannot bind to IPv4-localhost when you run in a sandbox
     // that only allows loopback traffic, but binding to IPv6-localhost works fine. This would
     // however break on systems that don't support IPv6. So what we'll do is to try to bind to IPv6
@@ -604,8 +708,53 @@ public class GrpcServerImpl implements RPCServer {
               .build()
               .start();
     }
+    return InetAddresses.toUriString(address.getAddress()) + ":" + server.getPort();
+  }
+
+  /**
+   * Starts serving on a Unix domain socket in the server directory, which only the user can
+   * access. Returns the address to write into the port file, or null if the socket cannot be
+   * served on, e.g. because the native transport is not available on this platform or the path
+   * is too long for a socket address.
+   */
+  @Nullable
+  private String serveOnUnixSocket() {
+    if (!Epoll.isAvailable()) {
+      log.info("Cannot serve on a Unix domain socket: " + Epoll.unavailabilityCause());
+      return null;
+    }
+
+    Path socket = serverDirectory.getChild(SOCKET_FILE);
+    try {
+      // A server that did not exit cleanly leaves its socket behind.
+      socket.delete();
+      server =
+          NettyServerBuilder.forAddress(new DomainSocketAddress(socket.getPathString()))
+              .channelType(EpollServerDomainSocketChannel.class)
+              .bossEventLoopGroup(new EpollEventLoopGroup(1))
+              .workerEventLoopGroup(new EpollEventLoopGroup())
+              .addService(commandServer)
+              .directExecutor()
+              .build()
+              .start();
+    } catch (IOException e) {
+      log.info("Cannot serve on Unix domain socket " + socket + ": " + e.getMessage());
+      return null;
+    }
+    deleteAtExit(socket, false);
+    return "unix:" + socket.getPathString();
+  }
+
+  @Override
+  public void serve() throws IOException {
+    Preconditions.checkState(!serving);
+
+    String serverAddress = unixSocket ? serveOnUnixSocket() : null;
+    if (serverAddress == null) {
+      serverAddress = serveOnLocalhost();
+    }
 
-    if (maxIdleSeconds > 0) {
+    if (maxIdleSeconds > 0 || idleTrimSeconds > 0) {
       Thread timeoutThread =
           new Thread(
               new Runnable() {
@@ -621,8 +770,7 @@ public class GrpcServerImpl implements RPCServer {
     }
     serving = true;
 
-    writeServerFile(
-        PORT_FILE, InetAddresses.toUriString(address.getAddress()) + ":" + server.getPort());
+    writeServerFile(PORT_FILE, serverAddress);
     writeServerFile(REQUEST_COOKIE_FILE, requestCookie);
     writeServerFile(RESPONSE_COOKIE_FILE, responseCookie);
 
@@ -680,8 +828,16 @@ public class GrpcServerImpl implements RPCServer {
     log.severe(err.toString());
   }
 
-  private void executeCommand(
-      RunRequest request, StreamObserver<RunResponse> observer, GrpcSink sink) {
+  private static void closePipe(PipeOutputStream pipeOut) {
+    try {
+      pipeOut.close();
+    } catch (IOException e) {
+      log.info("Cannot close the standard output of the client: " + e.getMessage());
+    }
+  }
+
+  @VisibleForTesting
+  void executeCommand(RunRequest request, StreamObserver<RunResponse> observer, GrpcSink sink) {
     sink.setCommandThread(Thread.currentThread());
 
     if (!request.getCookie().equals(requestCookie) || request.getClientDescription().isEmpty()) {
@@ -711,10 +867,13 @@ public class GrpcServerImpl implements RPCServer {
 
     String commandId;
     int exitCode;
+    ExecRequest.Builder execRequest =
+        request.getClientCanExec() ? ExecRequest.newBuilder() : null;
 
     try (RunningCommand command = new RunningCommand()) {
       commandId = command.id;
 
+      boolean cancelled = false;
       try {
         // Send the client the command id as soon as we know it.
         observer.onNext(
@@ -725,19 +884,48 @@ public class GrpcServerImpl implements RPCServer {
       } catch (StatusRuntimeException e) {
         log.info(
             "The client cancelled the command before receiving the command id: " + e.getMessage());
+        cancelled = true;
+      }
+
+      // A client that did not get the command id cannot tell whether the command ran. Do not run
+      // it, so that it does not run twice if the client sends it again.
+      if (cancelled || sink.disconnected()) {
+        log.info(String.format("Not running command %s, the client is gone", commandId));
+        sink.finish();
+        return;
+      }
+
+      PipeOutputStream pipeOut = null;
+      if (!request.getStdoutPath().isEmpty()) {
+        try {
+          pipeOut = new PipeOutputStream(request.getStdoutPath(), command.thread);
+        } catch (IOException e) {
+          log.info("Cannot open the standard output of the client, sending it instead: "
+              + e.getMessage());
+        }
       }
 
       OutErr rpcOutErr = OutErr.create(
-          new RpcOutputStream(command.id, responseCookie, StreamType.STDOUT, sink),
+          pipeOut != null
+              ? pipeOut
+              : new RpcOutputStream(command.id, responseCookie, StreamType.STDOUT, sink),
           new RpcOutputStream(command.id, responseCookie, StreamType.STDERR, sink));
 
-      exitCode =
-          commandExecutor.exec(
-              args.build(),
-              rpcOutErr,
-              request.getBlockForLock() ? LockingMode.WAIT : LockingMode.ERROR_OUT,
-              request.getClientDescription(),
-              clock.currentTimeMillis());
+      try {
+        exitCode =
+            commandExecutor.exec(
+                args.build(),
+                rpcOutErr,
+                request.getBlockForLock() ? LockingMode.WAIT : LockingMode.ERROR_OUT,
+                request.getClientDescription(),
+                clock.currentTimeMillis(),
+                execRequest);
+      } finally {
+        // The reader of the pipe only sees the end of the output once every writer closed it.
+        if (pipeOut != null) {
+          closePipe(pipeOut);
+        }
+      }
 
     } catch (InterruptedException e) {
       exitCode = ExitCode.INTERRUPTED.getNumericExitCode();
@@ -755,16 +943,18 @@ public class GrpcServerImpl implements RPCServer {
     // the cancel request won't find the thread to interrupt)
     Thread.interrupted();
 
-    RunResponse response =
+    RunResponse.Builder response =
         RunResponse.newBuilder()
             .setCookie(responseCookie)
             .setCommandId(commandId)
             .setFinished(true)
-            .setExitCode(exitCode)
-            .build();
+            .setExitCode(exitCode);
+    if (exitCode == 0 && execRequest != null && execRequest.getArgvCount() > 0) {
+      response.setExecRequest(execRequest);
+    }
 
     try {
-      observer.onNext(response);
+      observer.onNext(response.build());
       observer.onCompleted();
     } catch (StatusRuntimeException e) {
       // The client cancelled the call. Log an error and go on.
@@ -787,6 +977,35 @@ public class GrpcServerImpl implements RPCServer {
     }
   }
 
+  /**
+   * Runs the command of a warmup request, discarding its output. It does not wait for other
+   * commands: if one runs, the server is warm already, or is about to be.
+   */
+  private void executeWarmup(WarmupRequest request) {
+    ImmutableList.Builder<String> args = ImmutableList.builder();
+    for (ByteString requestArg : request.getArgList()) {
+      args.add(requestArg.toString(CHARSET));
+    }
+
+    try (RunningCommand command = new RunningCommand()) {
+      OutErr nullOutErr =
+          OutErr.create(ByteStreams.nullOutputStream(), ByteStreams.nullOutputStream());
+      int exitCode =
+          commandExecutor.exec(
+              args.build(),
+              nullOutErr,
+              LockingMode.ERROR_OUT,
+              request.getClientDescription(),
+              clock.currentTimeMillis());
+      log.info(String.format("Warmup command %s exited with %d", command.id, exitCode));
+    } catch (InterruptedException e) {
+      log.info("Warmup command interrupted");
+    }
+
+    // Do not leave the interrupt bit set on this pool thread, see executeCommand().
+    Thread.interrupted();
+  }
+
   private final CommandServerGrpc.CommandServerImplBase commandServer =
       new CommandServerGrpc.CommandServerImplBase() {
         @Override
@@ -804,6 +1023,49 @@ public class GrpcServerImpl implements RPCServer {
               });
         }
 
+        @Override
+        public void warmup(
+            final WarmupRequest request, final StreamObserver<WarmupResponse> streamObserver) {
+          if (!request.getCookie().equals(requestCookie)
+              || request.getClientDescription().isEmpty()) {
+            streamObserver.onNext(WarmupResponse.getDefaultInstance());
+            streamObserver.onCompleted();
+            return;
+          }
+
+          // The client does not wait for the command.
+          streamObserver.onNext(WarmupResponse.newBuilder().setCookie(responseCookie).build());
+          streamObserver.onCompleted();
+          commandExecutorPool.execute(
+              new Runnable() {
+                @Override
+                public void run() {
+                  executeWarmup(request);
+                }
+              });
+        }
+
+        @Override
+        public void trimMemory(
+            TrimMemoryRequest request, StreamObserver<TrimMemoryResponse> streamObserver) {
+          TrimMemoryResponse.Builder response = TrimMemoryResponse.newBuilder();
+          if (!request.getCookie().equals(requestCookie)) {
+            streamObserver.onNext(response.build());
+            streamObserver.onCompleted();
+            return;
+          }
+
+          streamObserver.onNext(response.setCookie(responseCookie).build());
+          streamObserver.onCompleted();
+          commandExecutorPool.execute(
+              new Runnable() {
+                @Override
+                public void run() {
+                  GrpcServerImpl.this.trimMemory();
+                }
+              });
+        }
+
         @Override
         public void ping(PingRequest pingRequest, StreamObserver<PingResponse> streamObserver) {
           Preconditions.checkState(serving);
@@ -102,6 +102,12 @@ public class JavaSubprocessFactory implements Subprocess.Factory {
     if (params.getTimeoutMillis() >= 0) {
       throw new UnsupportedOperationException("Timeouts are not supported");
     }
+    if (params.getCgroup() != null) {
+      throw new UnsupportedOperationException("Cgroups are not supported");
+    }
+    if (params.getMemoryLimit() != 0 || params.getCpuRateLimit() != 0) {
+      throw new UnsupportedOperationException("Resource limits are not supported");
+    }
     ProcessBuilder builder = new ProcessBuilder();
     builder.command(params.getArgv());
     if (params.getEnv() != null) {
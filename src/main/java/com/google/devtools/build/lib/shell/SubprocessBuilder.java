@@ -45,6 +45,9 @@ public class SubprocessBuilder {
   private StreamAction stderrAction;
   private File stderrFile;
   private File workingDirectory;
+  private File cgroup;
+  private long memoryLimit;
+  private int cpuRateLimit;
   private long timeoutMillis = -1;
 
   private static Subprocess.Factory factory = JavaSubprocessFactory.INSTANCE;
@@ -169,6 +172,47 @@ public class SubprocessBuilder {
     return this;
   }
 
+  public File getCgroup() {
+    return cgroup;
+  }
+
+  /**
+   * Sets the directory of the cgroup the process is started in, e.g.
+   * {@code /sys/fs/cgroup/memory/bazel/action}. If null, that of this process. Not every
+   * {@link Subprocess.Factory} supports cgroups.
+   */
+  public SubprocessBuilder setCgroup(File cgroup) {
+    this.cgroup = cgroup;
+    return this;
+  }
+
+  public long getMemoryLimit() {
+    return memoryLimit;
+  }
+
+  /**
+   * Sets the most memory, in bytes, the process and the processes it starts may use together. 0
+   * means no limit. Not every {@link Subprocess.Factory} supports resource limits.
+   */
+  public SubprocessBuilder setMemoryLimit(long memoryLimit) {
+    this.memoryLimit = memoryLimit;
+    return this;
+  }
+
+  public int getCpuRateLimit() {
+    return cpuRateLimit;
+  }
+
+  /**
+   * Sets the percentage of the cycles of all processors the process and the processes it starts
+   * may use together. 0 means no limit. Not every {@link Subprocess.Factory} supports resource
+   * limits.
+   */
+  public SubprocessBuilder setCpuRateLimit(int cpuRateLimit) {
+    this.cpuRateLimit = cpuRateLimit;
+    return this;
+  }
+
   public Subprocess start() throws IOException {
     return factory.create(this);
   }
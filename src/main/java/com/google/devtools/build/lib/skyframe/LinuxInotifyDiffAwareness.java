@@ -0,0 +1,77 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.skyframe;
+
+import com.google.devtools.build.lib.UnixJniLoader;
+
+/**
+ * A {@link DiffAwareness} that uses inotify directly to watch the filesystem, in lieu of
+ * {@link WatchServiceDiffAwareness}.
+ *
+ * <p>The JDK WatchService registers every directory of the tree from Java and hands each event to
+ * a Java thread, which makes the first build after enabling --watchfs slow on large workspaces.
+ * Here both the registration and the reading of the events happen in native code; the events are
+ * read as they come, so that the kernel queue does not overflow between two builds. If changes may
+ * have been missed (queue overflow, out of watches, the root went away), the next view is broken
+ * and every file is looked at again.
+ */
+public final class LinuxInotifyDiffAwareness extends NativeWatcherDiffAwareness {
+  // Keep a pointer to a native structure in the JNI code (the event reading thread shares that
+  // structure).
+  private long nativePointer;
+
+  /** Watch changes on the file system under <code>watchRoot</code>. */
+  LinuxInotifyDiffAwareness(String watchRoot) {
+    super(watchRoot, "inotify-diff-awareness");
+  }
+
+  /** JNI code adding a watch for <code>root</code> and each directory below it. */
+  @Override
+  protected native void create(String root);
+
+  /** JNI code reading the events until {@link #doClose} is called. */
+  @Override
+  protected native void run();
+
+  /** JNI code stopping the event reading thread and releasing the watches. */
+  @Override
+  protected native void doClose();
+
+  /**
+   * JNI code returning the list of absolute paths modified since last call, or null if changes
+   * may have been missed.
+   */
+  @Override
+  protected native String[] poll();
+
+  private static final boolean JNI_AVAILABLE;
+
+  static {
+    boolean loadJniWorked = false;
+    try {
+      UnixJniLoader.loadJni();
+      loadJniWorked = true;
+    } catch (UnsatisfiedLinkError ignored) {
+      // The Bazel bootstrap binary doesn't have access to the JNI code; see
+      // MacOSXFsEventsDiffAwareness.
+    }
+    JNI_AVAILABLE = loadJniWorked;
+  }
+
+  /** Whether the native code is available, so that this class can be used. */
+  static boolean isAvailable() {
+    return JNI_AVAILABLE;
+  }
+}
@@ -32,11 +32,14 @@ import java.util.Set;
 
 /**
  * File system watcher for local filesystems. It's able to provide a list of changed files between
- * two consecutive calls. On Linux, uses the standard Java WatchService, which uses 'inotify' and,
- * on OS X, uses {@link MacOSXFsEventsDiffAwareness}, which use FSEvents.
+ * two consecutive calls. On Linux, uses {@link LinuxInotifyDiffAwareness}, which uses 'inotify'
+ * directly, on OS X, uses {@link MacOSXFsEventsDiffAwareness}, which use FSEvents, on Windows,
+ * uses {@link WindowsDiffAwareness}, which uses ReadDirectoryChangesW, and elsewhere (or without
+ * the native code), the standard Java WatchService.
  *
  * <p>
- * This is an abstract class, specialized by {@link MacOSXFsEventsDiffAwareness} and
+ * This is an abstract class, specialized by {@link LinuxInotifyDiffAwareness},
+ * {@link MacOSXFsEventsDiffAwareness}, {@link WindowsDiffAwareness} and
  * {@link WatchServiceDiffAwareness}.
  */
 public abstract class LocalDiffAwareness implements DiffAwareness {
@@ -87,6 +90,12 @@ public abstract class LocalDiffAwareness implements DiffAwareness {
       if (OS.getCurrent() == OS.DARWIN) {
         return new MacOSXFsEventsDiffAwareness(resolvedPathEntryFragment.toString());
       }
+      if (OS.getCurrent() == OS.LINUX && LinuxInotifyDiffAwareness.isAvailable()) {
+        return new LinuxInotifyDiffAwareness(resolvedPathEntryFragment.toString());
+      }
+      if (OS.getCurrent() == OS.WINDOWS && WindowsDiffAwareness.isAvailable()) {
+        return new WindowsDiffAwareness(resolvedPathEntryFragment.toString());
+      }
 
       return new WatchServiceDiffAwareness(resolvedPathEntryFragment.toString());
     }
@@ -56,7 +56,8 @@ public final class MacOSXFsEventsDiffAwareness extends LocalDiffAwareness {
   }
 
   /**
-   * Helper function to start the watch of <code>paths</code>, called by the constructor.
+   * Helper function to start the watch of <code>paths</code>, all in one FSEvents stream, called
+   * by the constructor.
    */
   private native void create(String[] paths, double latency);
 
@@ -102,7 +103,8 @@ public final class MacOSXFsEventsDiffAwareness extends LocalDiffAwareness {
   private native void doClose();
 
   /**
-   * JNI code returning the list of absolute path modified since last call.
+   * JNI code returning the list of absolute paths modified since last call, each once, or null if
+   * changes may have been missed, e.g. because FSEvents asked for a directory to be scanned again.
    */
   private native String[] poll();
 
@@ -138,8 +140,14 @@ public final class MacOSXFsEventsDiffAwareness extends LocalDiffAwareness {
       return EVERYTHING_MODIFIED;
     }
     Preconditions.checkState(!closed);
+    String[] modified = poll();
+    if (modified == null) {
+      close();
+      throw new BrokenDiffAwarenessException(
+          "Overflow when watching local filesystem for changes");
+    }
     ImmutableSet.Builder<Path> paths = ImmutableSet.builder();
-    for (String path : poll()) {
+    for (String path : modified) {
       paths.add(new File(path).toPath());
     }
     return newView(paths.build());
@@ -0,0 +1,115 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.skyframe;
+
+import com.google.devtools.build.lib.UnixJniLoader;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
+
+/**
+ * The history of the changes to the files of a volume that FSEvents keeps whether or not a process
+ * is watching.
+ *
+ * <p>A server that saves the {@link Position} of the history when it shuts down can learn, when it
+ * starts again, which paths below a directory changed in between, rather than looking at every
+ * file. If the history of the volume was purged or does not go back that far, the changes cannot
+ * be told, and every file has to be looked at.
+ */
+public final class MacOSXFsEventsHistory {
+
+  static {
+    UnixJniLoader.loadJni();
+  }
+
+  private MacOSXFsEventsHistory() {
+    // Prevent construction
+  }
+
+  /** A point in the FSEvents history of a volume. */
+  public static final class Position {
+    private final String volumeUuid;
+    private final long eventId;
+
+    public Position(String volumeUuid, long eventId) {
+      this.volumeUuid = volumeUuid;
+      this.eventId = eventId;
+    }
+
+    /** Returns the identifier of the history of the volume, which changes when it is purged. */
+    public String getVolumeUuid() {
+      return volumeUuid;
+    }
+
+    /** Returns the id of the last event up to this point. */
+    public long getEventId() {
+      return eventId;
+    }
+
+    /** Writes this position to {@code file}. */
+    public void writeTo(File file) throws IOException {
+      try (DataOutputStream out = new DataOutputStream(new FileOutputStream(file))) {
+        out.writeUTF(volumeUuid);
+        out.writeLong(eventId);
+      }
+    }
+
+    /** Reads a position {@link #writeTo} wrote to {@code file}. */
+    public static Position readFrom(File file) throws IOException {
+      try (DataInputStream in = new DataInputStream(new FileInputStream(file))) {
+        return new Position(in.readUTF(), in.readLong());
+      }
+    }
+  }
+
+  private static native String volumeUuid(String path);
+
+  private static native long currentEventId();
+
+  private static native String[] changesSince(String[] paths, long eventId, String[] error);
+
+  /** Returns the current position of the FSEvents history of the volume of {@code root}. */
+  public static Position getPosition(String root) throws IOException {
+    String uuid = volumeUuid(root);
+    if (uuid == null) {
+      throw new IOException("The volume of " + root + " has no FSEvents history");
+    }
+    return new Position(uuid, currentEventId());
+  }
+
+  /**
+   * Returns the absolute paths below {@code root}, which is absolute, that changed from {@code
+   * position} up to now.
+   *
+   * @throws IOException if the changes cannot be told: {@code root} is now on another volume, the
+   *     history of the volume was purged or no longer goes back to {@code position}, or there are
+   *     too many changes
+   */
+  public static String[] getChangesSince(String root, Position position) throws IOException {
+    String uuid = volumeUuid(root);
+    if (uuid == null || !uuid.equals(position.getVolumeUuid())) {
+      throw new IOException("The FSEvents history of the volume of " + root + " changed");
+    }
+    String[] error = new String[] {null};
+    String[] paths = changesSince(new String[] {root}, position.getEventId(), error);
+    if (paths == null) {
+      throw new IOException(error[0]);
+    }
+    return paths;
+  }
+}
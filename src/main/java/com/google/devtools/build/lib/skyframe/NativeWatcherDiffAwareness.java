@@ -0,0 +1,125 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.skyframe;
+
+import com.google.common.base.Preconditions;
+import com.google.common.collect.ImmutableSet;
+import com.google.devtools.common.options.OptionsClassProvider;
+import java.io.File;
+import java.nio.file.Path;
+
+/**
+ * A {@link DiffAwareness} whose watch is kept in native code, where a thread of its own reads the
+ * changes as they come, so that the queue of the operating system does not overflow between two
+ * builds. Subclasses only provide the native hooks; the lifecycle and the views are here.
+ *
+ * <p>The watch is opened by the first view with --watchfs, and closed when --watchfs is switched
+ * off or changes may have been missed, after which the next view is broken and every file is
+ * looked at again.
+ */
+abstract class NativeWatcherDiffAwareness extends LocalDiffAwareness {
+  private final String threadName;
+
+  private boolean closed;
+
+  private boolean opened;
+
+  /**
+   * Watch changes on the file system under <code>watchRoot</code>, reading them on a thread named
+   * <code>threadName</code>.
+   */
+  NativeWatcherDiffAwareness(String watchRoot, String threadName) {
+    super(watchRoot);
+    this.threadName = threadName;
+  }
+
+  /**
+   * Starts the watch of <code>root</code> and the directories below it, called by {@link #init}.
+   */
+  protected abstract void create(String root);
+
+  /**
+   * Reads the changes until {@link #doClose} is called. Runs on a thread of its own.
+   */
+  protected abstract void run();
+
+  /**
+   * Stops the thread reading the changes and releases the watch.
+   */
+  protected abstract void doClose();
+
+  /**
+   * Returns the list of absolute paths modified since the last call, or null if changes may have
+   * been missed.
+   */
+  protected abstract String[] poll();
+
+  private void init() {
+    // As for MacOSXFsEventsDiffAwareness, init() can never fail: a failure to watch surfaces as an
+    // overflow from the first poll() instead.
+    Preconditions.checkState(!opened);
+    opened = true;
+    create(watchRootPath.toAbsolutePath().toString());
+    Thread thread =
+        new Thread(
+            new Runnable() {
+              @Override
+              public void run() {
+                NativeWatcherDiffAwareness.this.run();
+              }
+            },
+            threadName);
+    thread.setDaemon(true);
+    thread.start();
+  }
+
+  /**
+   * Close this watch service, this service should not be used any longer after closing.
+   */
+  @Override
+  public final void close() {
+    if (opened && !closed) {
+      closed = true;
+      doClose();
+    }
+  }
+
+  @Override
+  public final View getCurrentView(OptionsClassProvider options)
+      throws BrokenDiffAwarenessException {
+    // See WatchServiceDiffAwareness#getCurrentView for an explanation of this logic.
+    boolean watchFs = options.getOptions(Options.class).watchFS;
+    if (watchFs && !opened) {
+      init();
+    } else if (!watchFs && opened) {
+      close();
+      throw new BrokenDiffAwarenessException("Switched off --watchfs again");
+    } else if (!opened) {
+      return EVERYTHING_MODIFIED;
+    }
+    Preconditions.checkState(!closed);
+    String[] modified = poll();
+    if (modified == null) {
+      close();
+      throw new BrokenDiffAwarenessException(
+          "Overflow when watching local filesystem for changes");
+    }
+    ImmutableSet.Builder<Path> paths = ImmutableSet.builder();
+    for (String path : modified) {
+      paths.add(new File(path).toPath());
+    }
+    return newView(paths.build());
+  }
+}
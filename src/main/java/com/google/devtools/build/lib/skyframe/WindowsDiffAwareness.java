@@ -0,0 +1,76 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.skyframe;
+
+import com.google.devtools.build.lib.windows.WindowsJniLoader;
+
+/**
+ * A {@link DiffAwareness} that uses ReadDirectoryChangesW on the watch root, recursively, in lieu
+ * of {@link WatchServiceDiffAwareness}.
+ *
+ * <p>The JDK WatchService on Windows watches each registered directory on its own, which does not
+ * scale to large workspaces; ReadDirectoryChangesW watches the whole tree with a single handle.
+ * As for {@link LinuxInotifyDiffAwareness}, the changes are read by a native thread as they come.
+ * If changes may have been missed (the buffer of the handle overflowed, the root went away), the
+ * next view is broken and every file is looked at again.
+ */
+public final class WindowsDiffAwareness extends NativeWatcherDiffAwareness {
+  // Keep a pointer to a native structure in the JNI code (the change reading thread shares that
+  // structure).
+  private long nativePointer;
+
+  /** Watch changes on the file system under <code>watchRoot</code>. */
+  WindowsDiffAwareness(String watchRoot) {
+    super(watchRoot, "windows-diff-awareness");
+  }
+
+  /** JNI code opening the directory handle of <code>root</code>, which watches the whole tree. */
+  @Override
+  protected native void create(String root);
+
+  /** JNI code reading the changes until {@link #doClose} is called. */
+  @Override
+  protected native void run();
+
+  /** JNI code stopping the change reading thread and releasing the directory handle. */
+  @Override
+  protected native void doClose();
+
+  /**
+   * JNI code returning the list of absolute paths modified since last call, or null if changes
+   * may have been missed.
+   */
+  @Override
+  protected native String[] poll();
+
+  private static final boolean JNI_AVAILABLE;
+
+  static {
+    boolean loadJniWorked = false;
+    try {
+      WindowsJniLoader.loadJni();
+      loadJniWorked = true;
+    } catch (UnsatisfiedLinkError ignored) {
+      // The Bazel bootstrap binary doesn't have access to the JNI code; see
+      // MacOSXFsEventsDiffAwareness.
+    }
+    JNI_AVAILABLE = loadJniWorked;
+  }
+
+  /** Whether the native code is available, so that this class can be used. */
+  static boolean isAvailable() {
+    return JNI_AVAILABLE;
+  }
+}
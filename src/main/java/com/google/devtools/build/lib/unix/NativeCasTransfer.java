@@ -0,0 +1,81 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.unix;
+
+import com.google.devtools.build.lib.UnixJniLoader;
+import java.io.IOException;
+
+/**
+ * Transfers files between the local disk and the CAS of a remote cache, the {@code CasService} of
+ * remote_protocol.proto, without copying their contents through the Java heap.
+ *
+ * <p>The files are passed in the packed form of {@link NativePosixFiles#merkleTree}: the paths as
+ * Latin-1 bytes, each followed by a NUL byte, the SHA-1 digests of the contents, 20 bytes each,
+ * and the sizes. They are grouped into batches like {@code GrpcActionCache} groups them, and each
+ * batch is streamed in one call; up to {@code streams} calls run at the same time.
+ */
+public final class NativeCasTransfer {
+
+  static {
+    if (!"0".equals(System.getProperty("io.bazel.EnableJni"))) {
+      UnixJniLoader.loadJni();
+    }
+  }
+
+  private NativeCasTransfer() {
+    // Prevent construction
+  }
+
+  /**
+   * Uploads files with {@code UploadBlob} calls. Each chunk is read straight into its request.
+   *
+   * @param target the address of the remote cache, as for {@code --remote_cache}
+   * @param paths the absolute paths of the files, each followed by a NUL byte
+   * @param digests the SHA-1 digests of the contents of the files
+   * @param sizes the sizes of the files
+   * @param maxChunkSizeBytes the most bytes of a file sent in one chunk
+   * @param maxBatchInputs the most files uploaded in one call
+   * @param maxBatchSizeBytes the most bytes uploaded in one call, unless a file is larger
+   * @param streams the most calls at the same time
+   * @param timeoutSeconds the deadline of each call
+   * @throws IOException if a file could not be read, or has changed size, or a call failed
+   */
+  public static native void upload(String target, byte[] paths, byte[] digests, long[] sizes,
+      int maxChunkSizeBytes, int maxBatchInputs, int maxBatchSizeBytes, int streams,
+      int timeoutSeconds) throws IOException;
+
+  /**
+   * Downloads files with {@code DownloadBlob} calls. Each file is created or truncated, allocated
+   * at its full size, written in large aligned blocks and digested as it arrives. A file whose
+   * contents do not match its digest is removed.
+   *
+   * @param target the address of the remote cache, as for {@code --remote_cache}
+   * @param paths the absolute paths of the files, each followed by a NUL byte
+   * @param digests the SHA-1 digests of the contents of the files
+   * @param sizes the sizes of the files
+   * @param executable whether each file is made executable
+   * @param maxBatchInputs the most files downloaded in one call
+   * @param maxBatchSizeBytes the most bytes downloaded in one call, unless a file is larger
+   * @param streams the most calls at the same time
+   * @param timeoutSeconds the deadline of each call
+   * @return the index of a file the remote cache does not have, which stopped the download, or -1
+   *     if all the files were downloaded
+   * @throws IOException if a file could not be written, its contents do not match its digest, or
+   *     a call failed
+   */
+  public static native int download(String target, byte[] paths, byte[] digests, long[] sizes,
+      boolean[] executable, int maxBatchInputs, int maxBatchSizeBytes, int streams,
+      int timeoutSeconds) throws IOException;
+}
@@ -0,0 +1,197 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.unix;
+
+import com.google.common.base.Preconditions;
+import com.google.devtools.build.lib.UnixJniLoader;
+import java.io.Closeable;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * A persistent hash table from byte string keys to values of a fixed size, kept in memory-mapped
+ * files rather than on the Java heap, for caches that would otherwise be read as a whole when the
+ * server starts and written as a whole when it stops.
+ *
+ * <p>Opening a table costs the same however many entries it has. The keys are appended to a log
+ * and the values live in fixed-size slots of an open-addressing table; a process that dies, or a
+ * machine that goes down with the {@link SyncPolicy} allowing it, may lose entries but never
+ * returns a torn one (see hash_table.cc). Keys and values are passed in direct {@link ByteBuffer}s,
+ * from their position, and are copied by the native code.
+ *
+ * <p>The methods are thread-safe. The table must not be changed during a {@link #scan}.
+ */
+public final class NativeHashTable implements Closeable {
+
+  static {
+    if (!"0".equals(System.getProperty("io.bazel.EnableJni"))) {
+      UnixJniLoader.loadJni();
+    }
+  }
+
+  /** When the table is written to disk. Keep in sync with SyncPolicy in hash_table.cc. */
+  public enum SyncPolicy {
+    /** When the kernel gets to it: only a crash of the machine may lose entries. */
+    NEVER,
+    /** On {@link #close} and {@link #sync}. */
+    ON_CLOSE,
+    /** After every {@link #put} and {@link #remove}. */
+    ALWAYS,
+  }
+
+  /** Receives the entries of a {@link #scan}. */
+  public interface Visitor {
+    /**
+     * Visits an entry. The buffers hold the key and the value from their position to their limit,
+     * and are only valid during the call.
+     */
+    void visit(ByteBuffer key, ByteBuffer value);
+  }
+
+  private static final int SCAN_BUFFER_SIZE = 1 << 20;
+
+  private final int valueSize;
+  private long handle;
+
+  private NativeHashTable(long handle, int valueSize) {
+    this.handle = handle;
+    this.valueSize = valueSize;
+  }
+
+  /**
+   * Opens the table at {@code path}, or creates it. A table that was not closed is checked for the
+   * entries a crash may have torn first.
+   *
+   * @throws IOException if the table cannot be opened or created, or holds values of another size
+   */
+  public static NativeHashTable open(String path, int valueSize, SyncPolicy syncPolicy)
+      throws IOException {
+    Preconditions.checkArgument(valueSize >= 0, valueSize);
+    return new NativeHashTable(nativeOpen(path, valueSize, syncPolicy.ordinal()), valueSize);
+  }
+
+  /** Returns the size of the values, in bytes. */
+  public int getValueSize() {
+    return valueSize;
+  }
+
+  /**
+   * Copies the value of {@code key} into {@code value}, from its position, and returns true, or
+   * returns false if the table does not have the key. The positions are not changed.
+   */
+  public synchronized boolean get(ByteBuffer key, ByteBuffer value) {
+    checkKey(key);
+    checkValue(value);
+    return nativeGet(checkOpen(), key, key.position(), key.remaining(), value, value.position());
+  }
+
+  /** Sets the value of {@code key} to the {@link #getValueSize} bytes of {@code value}. */
+  public synchronized void put(ByteBuffer key, ByteBuffer value) throws IOException {
+    checkKey(key);
+    checkValue(value);
+    nativePut(checkOpen(), key, key.position(), key.remaining(), value, value.position());
+  }
+
+  /** Removes {@code key}, and returns whether the table had it. */
+  public synchronized boolean remove(ByteBuffer key) throws IOException {
+    checkKey(key);
+    return nativeRemove(checkOpen(), key, key.position(), key.remaining());
+  }
+
+  /** Returns the number of entries. */
+  public synchronized long size() {
+    return nativeSize(checkOpen());
+  }
+
+  /** Writes the table to disk, whatever the {@link SyncPolicy}. */
+  public synchronized void sync() throws IOException {
+    nativeSync(checkOpen());
+  }
+
+  /** Passes every entry to {@code visitor}, in no particular order. */
+  public synchronized void scan(Visitor visitor) {
+    ByteBuffer buffer = ByteBuffer.allocateDirect(SCAN_BUFFER_SIZE).order(ByteOrder.nativeOrder());
+    long cursor = 0;
+    while (cursor != -1) {
+      long next = nativeScan(checkOpen(), cursor, buffer, buffer.capacity());
+      if (next == -2) {
+        // The key at the cursor does not fit.
+        buffer = ByteBuffer.allocateDirect(buffer.capacity() * 2).order(ByteOrder.nativeOrder());
+        continue;
+      }
+      cursor = next;
+      int position = 0;
+      int keyLength;
+      while ((keyLength = buffer.getInt(position)) != -1) {
+        position += 4;
+        ByteBuffer key = buffer.duplicate();
+        key.limit(position + keyLength).position(position);
+        position += keyLength;
+        ByteBuffer value = buffer.duplicate();
+        value.limit(position + valueSize).position(position);
+        position += valueSize;
+        visitor.visit(key, value);
+      }
+    }
+  }
+
+  /** Closes the table, writing it to disk unless the {@link SyncPolicy} is {@code NEVER}. */
+  @Override
+  public synchronized void close() throws IOException {
+    if (handle != 0) {
+      long closing = handle;
+      handle = 0;
+      nativeClose(closing);
+    }
+  }
+
+  private long checkOpen() {
+    Preconditions.checkState(handle != 0, "the table is closed");
+    return handle;
+  }
+
+  private static void checkKey(ByteBuffer key) {
+    Preconditions.checkArgument(key.isDirect(), "the key is not in a direct buffer");
+  }
+
+  private void checkValue(ByteBuffer value) {
+    Preconditions.checkArgument(value.isDirect(), "the value is not in a direct buffer");
+    Preconditions.checkArgument(
+        value.remaining() >= valueSize, "the value has fewer than %s bytes", valueSize);
+  }
+
+  private static native long nativeOpen(String path, int valueSize, int syncPolicy)
+      throws IOException;
+
+  private static native void nativeClose(long handle) throws IOException;
+
+  private static native boolean nativeGet(
+      long handle, ByteBuffer key, int keyOffset, int keyLength, ByteBuffer value,
+      int valueOffset);
+
+  private static native void nativePut(
+      long handle, ByteBuffer key, int keyOffset, int keyLength, ByteBuffer value,
+      int valueOffset) throws IOException;
+
+  private static native boolean nativeRemove(
+      long handle, ByteBuffer key, int keyOffset, int keyLength) throws IOException;
+
+  private static native long nativeSize(long handle);
+
+  private static native void nativeSync(long handle) throws IOException;
+
+  private static native long nativeScan(long handle, long cursor, ByteBuffer buffer, int capacity);
+}
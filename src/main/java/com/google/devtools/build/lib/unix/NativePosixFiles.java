@@ -15,12 +15,14 @@
 package com.google.devtools.build.lib.unix;
 
 import com.google.common.annotations.VisibleForTesting;
+import com.google.common.base.Preconditions;
 import com.google.common.hash.HashCode;
 import com.google.devtools.build.lib.UnixJniLoader;
 
 import java.io.File;
 import java.io.FileNotFoundException;
 import java.io.IOException;
+import java.nio.charset.StandardCharsets;
 import java.util.logging.Level;
 import java.util.logging.LogManager;
 import java.util.logging.Logger;
@@ -166,6 +168,18 @@ public final class NativePosixFiles {
   public static native void symlink(String oldpath, String newpath)
       throws IOException;
 
+  /**
+   * Creates the directories {@code directories}, in order, then the symlinks
+   * {@code links[i]} to {@code targets[i]}, in one call. Directories that exist
+   * already are fine; the parent of each entry must exist by the time it is
+   * created. All entries are attempted, whatever fails.
+   *
+   * @return the error number of each directory, then of each link; 0 for
+   *     success.
+   */
+  public static native int[] createSymlinkForest(
+      String[] directories, String[] links, String[] targets);
+
   /**
    * Native wrapper around POSIX link(2) syscall.
    *
@@ -213,6 +227,59 @@ public final class NativePosixFiles {
    */
   public static native ErrnoFileStatus errnoLstat(String path);
 
+  // The *Bytes variants below take the path as the first {@code length} bytes of {@code path},
+  // encoded in Latin-1, e.g. by {@link #encodePath}. Unlike a String, they need no conversion on
+  // the native side, and the array can be reused from one call to the next.
+
+  /** Like {@link #stat}, for a path encoded as described above. */
+  public static native FileStatus statBytes(byte[] path, int length) throws IOException;
+
+  /** Like {@link #lstat}, for a path encoded as described above. */
+  public static native FileStatus lstatBytes(byte[] path, int length) throws IOException;
+
+  /** Like {@link #errnoStat}, for a path encoded as described above. */
+  public static native ErrnoFileStatus errnoStatBytes(byte[] path, int length);
+
+  /** Like {@link #errnoLstat}, for a path encoded as described above. */
+  public static native ErrnoFileStatus errnoLstatBytes(byte[] path, int length);
+
+  /**
+   * Encodes {@code path} for the *Bytes methods, replacing the characters Latin-1 cannot
+   * represent with '?', like the native side does with Strings.
+   */
+  public static byte[] encodePath(String path) {
+    return path.getBytes(StandardCharsets.ISO_8859_1);
+  }
+
+  /** For {@link #errnoStatx}: the file type, as in {@link FileStatus#isDirectory} etc. */
+  public static final int STAT_TYPE = 1 << 0;
+  /** For {@link #errnoStatx}: the permissions, as in {@link FileStatus#getPermissions}. */
+  public static final int STAT_MODE = 1 << 1;
+  /** For {@link #errnoStatx}: the size. */
+  public static final int STAT_SIZE = 1 << 2;
+  /** For {@link #errnoStatx}: the access, modification and change times. */
+  public static final int STAT_TIMES = 1 << 3;
+  /** For {@link #errnoStatx}: the device and inode numbers. */
+  public static final int STAT_INO = 1 << 4;
+
+  /**
+   * Like {@link #errnoStat} or {@link #errnoLstat}, but only the {@code fields} (a combination of
+   * the {@code STAT_*} constants) of the result are meaningful, the others are zero. On Linux,
+   * this uses statx(2), so that a file system need not fetch what is not asked for: on NFS, the
+   * type alone never needs a round trip to the server.
+   *
+   * @param path the file to stat.
+   * @param followSymlinks whether to stat the target of a symlink rather than the symlink.
+   * @param fields the fields needed.
+   * @param dontSync whether a network file system may answer from its attribute cache, without
+   *   revalidating with the server (AT_STATX_DONT_SYNC). The result may then be stale.
+   * @return an ErrnoFileStatus instance containing the metadata.
+   *   If there was an error, the return value's hasError() method
+   *   will return true, and all stat information is undefined.
+   */
+  public static native ErrnoFileStatus errnoStatx(
+      String path, boolean followSymlinks, int fields, boolean dontSync);
+
   /**
    * Native wrapper around POSIX utime(2) syscall.
    *
@@ -362,6 +429,195 @@ public final class NativePosixFiles {
   private static native Dirents readdir(String path, char typeCode)
       throws IOException;
 
+  /**
+   * A compound return type for {@link #readdirPacked}: the names of the entries packed into one
+   * Latin-1 array, so that reading a directory allocates the same few objects however many
+   * entries it has. Names are only decoded on demand.
+   */
+  public static final class PackedDirents {
+    /** The names, each followed by a NUL byte. */
+    private final byte[] names;
+    /** Where each name starts in "names", plus where the last one ends. */
+    private final int[] offsets;
+    /** As in {@link Dirents}. */
+    private final byte[] types;
+
+    /** called from JNI */
+    public PackedDirents(byte[] names, int[] offsets, byte[] types) {
+      this.names = names;
+      this.offsets = offsets;
+      this.types = types;
+    }
+
+    public int size() {
+      return offsets.length - 1;
+    }
+
+    public boolean hasTypes() {
+      return types != null;
+    }
+
+    public String getName(int i) {
+      return new String(names, offsets[i], getNameLength(i), StandardCharsets.ISO_8859_1);
+    }
+
+    /** Returns the length in bytes of the i-th name, which starts at {@link #getNameOffset}. */
+    public int getNameLength(int i) {
+      return offsets[i + 1] - offsets[i] - 1;
+    }
+
+    public int getNameOffset(int i) {
+      return offsets[i];
+    }
+
+    /** The array all the names are in, NUL-terminated; callers must not modify it. */
+    public byte[] getNameBytes() {
+      return names;
+    }
+
+    public Dirents.Type getType(int i) {
+      return Dirents.Type.forChar((char) types[i]);
+    }
+  }
+
+  /**
+   * Like {@link #readdir(String, ReadTypes)}, for a path encoded as for {@link #statBytes}, and
+   * with the names packed rather than one String each.
+   */
+  public static PackedDirents readdirPacked(byte[] path, int length, ReadTypes readTypes)
+      throws IOException {
+    return readdirPacked(path, length, readTypes.getCode());
+  }
+
+  private static native PackedDirents readdirPacked(byte[] path, int length, char typeCode)
+      throws IOException;
+
+  /**
+   * A compound return type for readdirWithStats(): the entries of a directory together with their
+   * stat(2) metadata, packed into a single array so that reading a directory costs one JNI call
+   * rather than one per entry. {@link FileStatus} objects are only created on demand.
+   */
+  public static final class DirentsWithStats {
+    /** The names of the entries in a directory. */
+    private final String[] names;
+    /**
+     * Packed as by {@link #unpackStatus}; st_mode is -1 if the entry could not be stat()ed,
+     * e.g. because it was deleted meanwhile or is a dangling symlink.
+     */
+    private final long[] stats;
+
+    /** called from JNI */
+    public DirentsWithStats(String[] names, long[] stats) {
+      this.names = names;
+      this.stats = stats;
+    }
+
+    public int size() {
+      return names.length;
+    }
+
+    public String getName(int i) {
+      return names[i];
+    }
+
+    /** Returns the status of the i-th entry, or null if it could not be stat()ed. */
+    public FileStatus getStatus(int i) {
+      return stats[i * STAT_FIELDS] == -1 ? null : unpackStatus(stats, i);
+    }
+  }
+
+  // The number of longs per entry in packed stats, in the order of the FileStatus constructor
+  // arguments. Keep in sync with unix_jni.cc.
+  private static final int STAT_FIELDS = 10;
+
+  /**
+   * Returns the i-th of the statuses packed into {@code stats}, STAT_FIELDS longs each: st_mode,
+   * st_atime, st_atimensec, st_mtime, st_mtimensec, st_ctime, st_ctimensec, st_size, st_dev,
+   * st_ino.
+   */
+  private static FileStatus unpackStatus(long[] stats, int i) {
+    int base = i * STAT_FIELDS;
+    return new FileStatus(
+        (int) stats[base],
+        (int) stats[base + 1],
+        (int) stats[base + 2],
+        (int) stats[base + 3],
+        (int) stats[base + 4],
+        (int) stats[base + 5],
+        (int) stats[base + 6],
+        stats[base + 7],
+        (int) stats[base + 8],
+        stats[base + 9]);
+  }
+
+  /**
+   * Native wrapper around POSIX opendir(2)/readdir(3)/closedir(3) and fstatat(2): reads a
+   * directory and stats each of its entries relative to it.
+   *
+   * @param path the directory to read.
+   * @param followSymlinks whether to report the status of the targets of symlinks rather than
+   *   of the symlinks themselves.
+   * @return the entries (excluding "." and "..") in the order they were returned by the system,
+   *   and their status.
+   * @throws IOException if the directory could not be read.
+   */
+  public static native DirentsWithStats readdirWithStats(String path, boolean followSymlinks)
+      throws IOException;
+
+  /** For {@link #batch}: stat(2) the path. */
+  public static final byte BATCH_STAT = 0;
+  /** For {@link #batch}: lstat(2) the path. */
+  public static final byte BATCH_LSTAT = 1;
+  /** For {@link #batch}: unlink(2) the path. */
+  public static final byte BATCH_UNLINK = 2;
+  /** For {@link #batch}: rmdir(2) the path. */
+  public static final byte BATCH_RMDIR = 3;
+  /** For {@link #batch}: mkdir(2) the path, with mode 0777 (less the umask). */
+  public static final byte BATCH_MKDIR = 4;
+
+  /** The outcome of {@link #batch}, positionally corresponding to its operations. */
+  public static final class BatchResults {
+    private final int[] errnos;
+    private final long[] stats;
+
+    private BatchResults(int size) {
+      this.errnos = new int[size];
+      this.stats = new long[size * STAT_FIELDS];
+    }
+
+    /** Returns 0 if the i-th operation succeeded, otherwise its error number. */
+    public int getErrno(int i) {
+      return errnos[i];
+    }
+
+    /**
+     * Returns the status found by the i-th operation, or null if it failed or was not a
+     * {@link #BATCH_STAT} or {@link #BATCH_LSTAT}.
+     */
+    public FileStatus getStatus(int i) {
+      return errnos[i] != 0 || stats[i * STAT_FIELDS] == 0 ? null : unpackStatus(stats, i);
+    }
+  }
+
+  /**
+   * Runs many independent file system operations in one go: one JNI call, and, on Linux kernels
+   * that support it, a few io_uring(7) submissions rather than a system call each. Otherwise a
+   * few native threads run them. As the operations may run concurrently and in any order, none of
+   * them may depend on another (e.g. mkdir of a directory and of its child).
+   *
+   * @param paths the paths to operate on.
+   * @param ops the {@code BATCH_*} operation for each path.
+   * @return the outcome of each operation. Failures are reported there rather than thrown.
+   */
+  public static BatchResults batch(String[] paths, byte[] ops) {
+    Preconditions.checkArgument(paths.length == ops.length);
+    BatchResults results = new BatchResults(paths.length);
+    batch(paths, ops, results.errnos, results.stats);
+    return results;
+  }
+
+  private static native void batch(String[] paths, byte[] ops, int[] errnos, long[] stats);
+
   /**
    * Native wrapper around POSIX rename(2) syscall.
    *
@@ -442,6 +698,186 @@ public final class NativePosixFiles {
     return HashCode.fromBytes(md5sumAsBytes(path));
   }
 
+  /**
+   * Returns the SHA-256 digest of the specified file, following symbolic links.
+   *
+   * @param path the file whose SHA-256 digest is required.
+   * @return the SHA-256 digest, as a 32-byte array.
+   * @throws IOException if the call failed for any reason.
+   */
+  static native byte[] sha256sumAsBytes(String path) throws IOException;
+
+  /**
+   * Returns the SHA-256 digest of the specified file, following symbolic links. Uses the SHA
+   * extensions of x86 CPUs where available.
+   *
+   * @param path the file whose SHA-256 digest is required.
+   * @return the SHA-256 digest, as a {@link HashCode}
+   * @throws IOException if the call failed for any reason.
+   */
+  public static HashCode sha256sum(String path) throws IOException {
+    return HashCode.fromBytes(sha256sumAsBytes(path));
+  }
+
+  /** For {@link #digestAll}: MD5. */
+  public static final int DIGEST_MD5 = 0;
+  /** For {@link #digestAll}: SHA-256. */
+  public static final int DIGEST_SHA256 = 1;
+
+  /**
+   * Digests many files at once, on a few native threads, following symbolic links.
+   *
+   * @param paths the files whose digests are required.
+   * @param function {@link #DIGEST_MD5} or {@link #DIGEST_SHA256}.
+   * @return the digests, positionally corresponding to {@code paths}.
+   * @throws IOException if any of the files could not be digested.
+   */
+  public static native byte[][] digestAll(String[] paths, int function) throws IOException;
+
+  /** The size of a node of {@link #merkleTree}: parent index, SHA-1 digest and size. */
+  public static final int MERKLE_NODE_SIZE = 4 + 20 + 8;
+
+  /**
+   * Computes the Merkle tree of the inputs of a remote action, like {@code TreeNodeRepository}:
+   * every input and every directory is a {@code FileNode} of remote_protocol.proto, and its digest
+   * is the SHA-1 of the serialized message, with its size. The directories are digested bottom up,
+   * one level at a time, on a few native threads.
+   *
+   * <p>The result has a node of {@link #MERKLE_NODE_SIZE} bytes for every input, in the order of
+   * {@code paths}, then for every directory, the root first. A node is the index of its parent
+   * directory (-1 for the root) as 4 little-endian bytes, the digest of its {@code FileNode}, then
+   * the size of that as 8 little-endian bytes. The names of the directories but the root follow,
+   * in the same order, each followed by a NUL byte.
+   *
+   * @param paths the relative paths of the inputs, as Latin-1 bytes, each followed by a NUL byte.
+   * @param digests the SHA-1 digests of the contents of the inputs, 20 bytes each.
+   * @param sizes the sizes of the inputs.
+   * @param executable whether each input is executable.
+   * @throws IOException if a path is malformed, or an input appears twice or is also a directory.
+   */
+  public static native byte[] merkleTree(
+      byte[] paths, byte[] digests, long[] sizes, boolean[] executable) throws IOException;
+
+  /**
+   * The size of an entry of {@link #listJarEntries}: local header offset, compressed size,
+   * uncompressed size, CRC-32 and compression method.
+   */
+  public static final int JAR_ENTRY_SIZE = 8 + 8 + 8 + 4 + 4;
+
+  /**
+   * Lists the entries of a jar from its Central Directory, read from a mapping of the file, without
+   * creating an object per entry like {@link java.util.zip.ZipFile} does.
+   *
+   * <p>The result starts with the number of entries listed as 4 little-endian bytes, followed by
+   * an entry of {@link #JAR_ENTRY_SIZE} bytes for each of them, in the Central Directory order: the
+   * offset of its local header in the file and its compressed and uncompressed sizes as 8
+   * little-endian bytes each, then its CRC-32 and its compression method as 4 little-endian bytes
+   * each. The names of the entries follow, in the same order, each followed by a NUL byte.
+   *
+   * @param path the jar.
+   * @param prefix if not null, only the entries whose names start with these bytes are listed.
+   * @throws IOException if the jar could not be read, or is not a valid zip file.
+   */
+  public static native byte[] listJarEntries(String path, byte[] prefix) throws IOException;
+
+  /**
+   * Asks the kernel to read the contents of the files into the page cache, e.g. the inputs of
+   * actions about to run, so that reading them later does not wait for the disk. Returns at once:
+   * one native thread opens the files in turn and advises the kernel (posix_fadvise(2) with
+   * POSIX_FADV_WILLNEED, or F_RDADVISE on macOS), which reads them in the background. Files that
+   * cannot be opened, and anything other than regular files, are skipped.
+   *
+   * @param paths the files to prefetch, in the order they are needed.
+   * @return how many of {@code paths} were queued; the rest were dropped, because too many files
+   *     are still waiting to be prefetched.
+   */
+  public static native int prefetch(String[] paths);
+
+  /**
+   * Returns the digest of the specified file, following symbolic links, from the extended
+   * attribute {@code name} if the digest stored there is still valid: it is stored together with
+   * the mtime, size, inode and device numbers of the file. Otherwise the file is read, and the
+   * digest is stored in the attribute for next time, if the file system and permissions allow.
+   * Files modified in the last few seconds are not cached.
+   *
+   * @param path the file whose digest is required.
+   * @param name the extended attribute, e.g. "user.bazel.digest" on Linux.
+   * @param function {@link #DIGEST_MD5} or {@link #DIGEST_SHA256}.
+   * @return the digest.
+   * @throws IOException if the file could not be read.
+   */
+  public static native byte[] xattrCachedDigest(String path, String name, int function)
+      throws IOException;
+
+  /**
+   * Evaluates a glob below {@code root} in a single call: the tree is walked natively, and the
+   * matches cross the JNI boundary at once. The patterns are those of UnixGlob, which must have
+   * checked them: the segments may contain "*" and "?" wildcards, and a segment of "**" matches
+   * any number of directories. Symbolic links are followed, and entries other than files and
+   * directories are skipped. A path is excluded if it matches any of {@code excludes}; the
+   * directories matched by an exclude pattern ending in "/**" are not entered at all.
+   *
+   * @param root the directory to glob below.
+   * @param includes the patterns to match, relative to {@code root}.
+   * @param excludes the patterns of the paths to leave out, relative to {@code root}.
+   * @param excludeDirectories whether directories are left out of the result.
+   * @return the matching paths relative to {@code root}, sorted; {@code root} itself is never
+   *     among them. Empty if {@code root} is not a directory.
+   * @throws IOException if a directory could not be read.
+   */
+  public static String[] glob(
+      String root, String[] includes, String[] excludes, boolean excludeDirectories)
+      throws IOException {
+    byte[] packed = nativeGlob(root, includes, excludes, excludeDirectories);
+    int count = 0;
+    for (byte b : packed) {
+      if (b == 0) {
+        count++;
+      }
+    }
+    String[] result = new String[count];
+    int start = 0;
+    for (int i = 0; i < count; i++) {
+      int end = start;
+      while (packed[end] != 0) {
+        end++;
+      }
+      result[i] = new String(packed, start, end - start, StandardCharsets.ISO_8859_1);
+      start = end + 1;
+    }
+    return result;
+  }
+
+  /** Returns the paths for {@link #glob}, each followed by a NUL byte. */
+  private static native byte[] nativeGlob(
+      String root, String[] includes, String[] excludes, boolean excludeDirectories)
+      throws IOException;
+
+  /**
+   * Copies the regular file {@code src} to {@code dst}, replacing {@code dst}, with the same
+   * permission bits. The copy shares the data of the original where the file system can
+   * (clonefile(2) on APFS, FICLONE on btrfs and XFS), so that it is a metadata operation;
+   * otherwise the data is copied within the kernel (copy_file_range(2) or sendfile(2) on Linux)
+   * where possible, and through a buffer only as a last resort.
+   *
+   * @param src the file to copy, following symbolic links.
+   * @param dst the copy.
+   * @throws IOException if the copy failed, e.g. because {@code src} is not a regular file.
+   */
+  public static native void copyFile(String src, String dst) throws IOException;
+
+  /**
+   * Removes entire directory tree. Doesn't follow symlinks. Directories are
+   * made readable, writable and searchable by their owner as needed, and the
+   * subdirectories are deleted on a few threads.
+   *
+   * @param path the file or directory to remove.
+   * @return true iff the file existed.
+   * @throws IOException if the remove failed; the first failure is reported,
+   *     after as much of the tree as possible was removed.
+   */
+  public static native boolean deleteTree(String path) throws IOException;
+
   /**
    * Removes entire directory tree. Doesn't follow symlinks.
    *
@@ -449,12 +885,6 @@ public final class NativePosixFiles {
    * @throws IOException if the remove failed.
    */
   public static void rmTree(String path) throws IOException {
-    if (isDirectory(path)) {
-      String[] contents = readdir(path);
-      for (String entry : contents) {
-        rmTree(path + "/" + entry);
-      }
-    }
-    remove(path.toString());
+    deleteTree(path);
   }
 }
@@ -40,4 +40,35 @@ public class NativePosixSystem {
    * @throws IOException iff the sysctlbyname() syscall failed.
    */
   public static native long sysctlbynameGetLong(String name) throws IOException;
+
+  /** The fields of each thread in {@link #threadCpuTimes}. */
+  public static final int THREAD_ID = 0;
+  public static final int USER_TIME_MICROS = 1;
+  public static final int SYSTEM_TIME_MICROS = 2;
+  public static final int THREAD_CPU_TIME_FIELDS = 3;
+
+  /**
+   * Returns the CPU time every thread of this process has used so far, {@link
+   * #THREAD_CPU_TIME_FIELDS} longs per thread, in no particular order. A call takes a single pass
+   * over the threads, without opening files for the threads an earlier call has seen (on Linux,
+   * where the times have the resolution of the clock tick) or creating a Java object per thread,
+   * so a profiler can take samples often.
+   *
+   * @throws IOException if the times cannot be read, or the operating system is not supported
+   */
+  public static long[] threadCpuTimes() throws IOException {
+    return nativeThreadCpuTimes();
+  }
+
+  /**
+   * Returns the identifier the operating system has for the calling thread, as in {@link
+   * #threadCpuTimes}, or -1 if it is not supported. It is not the same as {@link Thread#getId}.
+   */
+  public static long currentThreadId() {
+    return nativeCurrentThreadId();
+  }
+
+  private static native long[] nativeThreadCpuTimes() throws IOException;
+
+  private static native long nativeCurrentThreadId();
 }
@@ -0,0 +1,159 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.unix;
+
+import com.google.devtools.build.lib.UnixJniLoader;
+import java.io.IOException;
+
+/**
+ * Process management on Unix, without forking the JVM: children are started with vfork(2) and
+ * execve(2).
+ */
+public class NativeProcesses {
+  public static final long INVALID = 0;
+
+  /** The streams of a process, as passed to {@link #nativeReadStream}. */
+  static final int STDIN = 0;
+  static final int STDOUT = 1;
+  static final int STDERR = 2;
+
+  /** The fields of {@link #nativeGetResourceUsage}. */
+  static final int USER_TIME_MICROS = 0;
+  static final int SYSTEM_TIME_MICROS = 1;
+  static final int MAX_RESIDENT_SET_KILOBYTES = 2;
+  static final int MINOR_PAGE_FAULTS = 3;
+  static final int MAJOR_PAGE_FAULTS = 4;
+  static final int VOLUNTARY_CONTEXT_SWITCHES = 5;
+  static final int INVOLUNTARY_CONTEXT_SWITCHES = 6;
+  static final int BLOCK_INPUT_OPERATIONS = 7;
+  static final int BLOCK_OUTPUT_OPERATIONS = 8;
+
+  /** The fields of {@link #nativeGetCgroupStats}. */
+  static final int CGROUP_CPU_TIME_MICROS = 0;
+  static final int CGROUP_MEMORY_PEAK_BYTES = 1;
+  static final int CGROUP_IO_READ_BYTES = 2;
+  static final int CGROUP_IO_WRITE_BYTES = 3;
+
+  static {
+    if (!"0".equals(System.getProperty("io.bazel.EnableJni"))) {
+      UnixJniLoader.loadJni();
+    }
+  }
+
+  private NativeProcesses() {
+    // Prevent construction
+  }
+
+  /**
+   * Creates a process. It is the leader of a new process group, so that {@link #nativeTerminate}
+   * reaches the processes it starts, too.
+   *
+   * @param argv the arguments, including argv[0], which is looked up in the PATH of the Bazel
+   *     server unless it contains a slash
+   * @param env the environment of the new process, as "NAME=value" strings. null means inherit
+   *     that of the Bazel server
+   * @param cwd the working directory of the new process. if null, the same as that of the current
+   *     process
+   * @param stdoutFile the file the stdout should be redirected to, truncated first. if null,
+   *     {@link #nativeReadStream} with {@link #STDOUT} will work.
+   * @param stderrFile the file the stderr should be redirected to, truncated first. if null,
+   *     {@link #nativeReadStream} with {@link #STDERR} will work.
+   * @param cgroup the directory of the cgroup to start the process in, or null
+   * @return the opaque identifier of the created process
+   * @throws IOException if the process could not be created, including if the program could not
+   *     be executed
+   */
+  static native long nativeCreateProcess(String[] argv, String[] env, String cwd,
+      String stdoutFile, String stderrFile, String cgroup) throws IOException;
+
+  /**
+   * Writes data from the given array to the stdin of the specified process.
+   *
+   * <p>Blocks until some data was written.
+   *
+   * @return the number of bytes written
+   */
+  static native int nativeWriteStdin(long process, byte[] bytes, int offset, int length)
+      throws IOException;
+
+  /**
+   * Reads data from {@link #STDOUT} or {@link #STDERR} of the process into the given array.
+   *
+   * <p>Blocks until either some data was read or the stream is closed by the process.
+   *
+   * @return the number of bytes read, 0 on EOF
+   */
+  static native int nativeReadStream(long process, int stream, byte[] bytes, int offset,
+      int length) throws IOException;
+
+  /**
+   * Appends everything the process writes to {@link #STDOUT} or {@link #STDERR} to the file
+   * {@code logFile}, creating it if needed, and returns the last {@code tailBytes} of it.
+   *
+   * <p>Blocks until the stream is closed by the process. On Linux the data is moved from the pipe
+   * to the file with splice(2) and only the tail is copied out of the kernel.
+   */
+  static native byte[] nativeTeeStream(long process, int stream, String logFile, int tailBytes)
+      throws IOException;
+
+  /** Closes {@link #STDIN}, {@link #STDOUT} or {@link #STDERR} of the process. */
+  static native void nativeCloseStream(long process, int stream);
+
+  /**
+   * Waits until the given process terminates. If timeout is non-negative, it indicates the number
+   * of milliseconds before the call times out.
+   *
+   * @return true if the process terminated, false on timeout
+   */
+  static native boolean nativeWaitFor(long process, long timeout);
+
+  /**
+   * Returns the exit code of the process, or 128 plus the signal number if a signal terminated
+   * it, like {@link Process#exitValue}; -1 if it has not been waited for.
+   */
+  static native int nativeGetExitValue(long process);
+
+  /**
+   * Returns the resource usage of the process, all zero until it has been waited for. Indexed by
+   * {@link #USER_TIME_MICROS} and the other constants above.
+   */
+  static native long[] nativeGetResourceUsage(long process);
+
+  /**
+   * Returns the statistics of the cgroup at the given directory, indexed by {@link
+   * #CGROUP_CPU_TIME_MICROS} and the other constants above; -1 for the values that are not
+   * available. Reads the cgroup v2 files (cpu.stat, memory.peak, io.stat) and otherwise those of
+   * the v1 controllers mounted at the directory.
+   */
+  static native long[] nativeGetCgroupStats(String cgroup);
+
+  /** Returns the process ID of the given process. */
+  static native int nativeGetPid(long process);
+
+  /**
+   * Sends the process group of the given process SIGTERM, or SIGKILL if {@code force}. Returns
+   * true if the signal was sent, false if the process has been waited for already.
+   */
+  static native boolean nativeTerminate(long process, boolean force);
+
+  /**
+   * Releases the native data structures associated with the process, killing and waiting for it
+   * if it has not been waited for.
+   *
+   * <p>Calling any other method on the same process after this call will result in the JVM crashing
+   * or worse.
+   */
+  static native void nativeDeleteProcess(long process);
+}
@@ -0,0 +1,458 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.unix;
+
+import com.google.common.base.Preconditions;
+import com.google.devtools.build.lib.shell.Subprocess;
+import java.io.File;
+import java.io.IOException;
+import java.io.InputStream;
+import java.io.OutputStream;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.ThreadFactory;
+import java.util.concurrent.atomic.AtomicBoolean;
+import java.util.concurrent.atomic.AtomicInteger;
+
+/**
+ * A Unix subprocess backed by a native object, see {@link NativeProcesses}.
+ */
+public class NativeSubprocess implements Subprocess {
+
+  /** The resources used by a process that terminated. */
+  public static final class ResourceUsage {
+    /**
+     * The names of the values in the statistics files of process-wrapper and linux-sandbox,
+     * indexed by {@link NativeProcesses#USER_TIME_MICROS} and the other constants.
+     */
+    private static final String[] STATISTICS_NAMES = {
+      "user_time_micros",
+      "system_time_micros",
+      "max_resident_set_kilobytes",
+      "minor_page_faults",
+      "major_page_faults",
+      "voluntary_context_switches",
+      "involuntary_context_switches",
+      "block_input_operations",
+      "block_output_operations",
+    };
+
+    private final long[] values;
+
+    private ResourceUsage(long[] values) {
+      this.values = values;
+    }
+
+    /**
+     * Parses the statistics written by {@code process-wrapper --stats} or {@code linux-sandbox
+     * -s}: one "name value" pair per line. Missing values are zero, unknown names are ignored.
+     */
+    public static ResourceUsage parseStatistics(String contents) {
+      long[] values = new long[STATISTICS_NAMES.length];
+      for (String line : contents.split("\n")) {
+        String[] fields = line.trim().split(" +");
+        if (fields.length != 2) {
+          continue;
+        }
+        for (int i = 0; i < STATISTICS_NAMES.length; i++) {
+          if (STATISTICS_NAMES[i].equals(fields[0])) {
+            try {
+              values[i] = Long.parseLong(fields[1]);
+            } catch (NumberFormatException e) {
+              // Leave it at zero.
+            }
+          }
+        }
+      }
+      return new ResourceUsage(values);
+    }
+
+    public long getUserTimeMicros() {
+      return values[NativeProcesses.USER_TIME_MICROS];
+    }
+
+    public long getSystemTimeMicros() {
+      return values[NativeProcesses.SYSTEM_TIME_MICROS];
+    }
+
+    public long getMaxResidentSetKilobytes() {
+      return values[NativeProcesses.MAX_RESIDENT_SET_KILOBYTES];
+    }
+
+    public long getMinorPageFaults() {
+      return values[NativeProcesses.MINOR_PAGE_FAULTS];
+    }
+
+    public long getMajorPageFaults() {
+      return values[NativeProcesses.MAJOR_PAGE_FAULTS];
+    }
+
+    public long getVoluntaryContextSwitches() {
+      return values[NativeProcesses.VOLUNTARY_CONTEXT_SWITCHES];
+    }
+
+    public long getInvoluntaryContextSwitches() {
+      return values[NativeProcesses.INVOLUNTARY_CONTEXT_SWITCHES];
+    }
+
+    public long getBlockInputOperations() {
+      return values[NativeProcesses.BLOCK_INPUT_OPERATIONS];
+    }
+
+    public long getBlockOutputOperations() {
+      return values[NativeProcesses.BLOCK_OUTPUT_OPERATIONS];
+    }
+
+    @Override
+    public String toString() {
+      StringBuilder result = new StringBuilder();
+      for (int i = 0; i < STATISTICS_NAMES.length; i++) {
+        result.append(i == 0 ? "" : ", ").append(STATISTICS_NAMES[i]).append('=').append(values[i]);
+      }
+      return result.toString();
+    }
+  }
+
+  /**
+   * The accumulated statistics of a cgroup, as read by {@link #getCgroupStatistics}. Values that
+   * are not available are -1.
+   */
+  public static final class CgroupStatistics {
+    /**
+     * The names of the values in the statistics file of {@code linux-sandbox -G}, indexed by
+     * {@link NativeProcesses#CGROUP_CPU_TIME_MICROS} and the other constants.
+     */
+    private static final String[] STATISTICS_NAMES = {
+      "cgroup_cpu_time_micros",
+      "cgroup_memory_peak_bytes",
+      "cgroup_io_read_bytes",
+      "cgroup_io_write_bytes",
+    };
+
+    private final long[] values;
+
+    private CgroupStatistics(long[] values) {
+      this.values = values;
+    }
+
+    /**
+     * Parses the cgroup statistics {@code linux-sandbox -G} adds to the file of {@code -s}, or
+     * returns null if there are none. See {@link ResourceUsage#parseStatistics} for the format.
+     */
+    public static CgroupStatistics parseStatistics(String contents) {
+      long[] values = {-1, -1, -1, -1};
+      boolean found = false;
+      for (String line : contents.split("\n")) {
+        String[] fields = line.trim().split(" +");
+        if (fields.length != 2) {
+          continue;
+        }
+        for (int i = 0; i < STATISTICS_NAMES.length; i++) {
+          if (STATISTICS_NAMES[i].equals(fields[0])) {
+            try {
+              values[i] = Long.parseLong(fields[1]);
+              found = true;
+            } catch (NumberFormatException e) {
+              // Leave it unavailable.
+            }
+          }
+        }
+      }
+      return found ? new CgroupStatistics(values) : null;
+    }
+
+    public long getCpuTimeMicros() {
+      return values[NativeProcesses.CGROUP_CPU_TIME_MICROS];
+    }
+
+    public long getMemoryPeakBytes() {
+      return values[NativeProcesses.CGROUP_MEMORY_PEAK_BYTES];
+    }
+
+    public long getIoReadBytes() {
+      return values[NativeProcesses.CGROUP_IO_READ_BYTES];
+    }
+
+    public long getIoWriteBytes() {
+      return values[NativeProcesses.CGROUP_IO_WRITE_BYTES];
+    }
+
+    @Override
+    public String toString() {
+      StringBuilder result = new StringBuilder();
+      for (int i = 0; i < STATISTICS_NAMES.length; i++) {
+        result.append(i == 0 ? "" : ", ").append(STATISTICS_NAMES[i]).append('=').append(values[i]);
+      }
+      return result.toString();
+    }
+  }
+
+  /**
+   * Returns the statistics of the cgroup at the given directory, e.g. the one passed to {@link
+   * com.google.devtools.build.lib.shell.SubprocessBuilder#setCgroup} after the processes in it
+   * are done.
+   */
+  public static CgroupStatistics getCgroupStatistics(String cgroup) {
+    return new CgroupStatistics(NativeProcesses.nativeGetCgroupStats(cgroup));
+  }
+
+  /** Output stream for writing to the stdin of the process. */
+  private class ProcessOutputStream extends OutputStream {
+    private boolean closed;
+
+    @Override
+    public void write(int b) throws IOException {
+      write(new byte[] {(byte) b}, 0, 1);
+    }
+
+    @Override
+    public synchronized void write(byte[] b, int off, int len) throws IOException {
+      if (closed || nativeProcess == NativeProcesses.INVALID) {
+        throw new IOException("stdin is closed");
+      }
+      while (len > 0) {
+        int written = NativeProcesses.nativeWriteStdin(nativeProcess, b, off, len);
+        off += written;
+        len -= written;
+      }
+    }
+
+    @Override
+    public synchronized void close() {
+      if (!closed && nativeProcess != NativeProcesses.INVALID) {
+        closed = true;
+        NativeProcesses.nativeCloseStream(nativeProcess, NativeProcesses.STDIN);
+      }
+    }
+  }
+
+  /** Input stream for reading the stdout or stderr of the process. */
+  private class ProcessInputStream extends InputStream {
+    private final int stream;
+    private boolean closed;
+
+    ProcessInputStream(int stream) {
+      this.stream = stream;
+    }
+
+    @Override
+    public int read() throws IOException {
+      byte[] buf = new byte[1];
+      if (read(buf, 0, 1) != 1) {
+        return -1;
+      } else {
+        return buf[0] & 0xff;
+      }
+    }
+
+    @Override
+    public synchronized int read(byte[] b, int off, int len) throws IOException {
+      if (closed || nativeProcess == NativeProcesses.INVALID) {
+        throw new IOException("stream is closed");
+      }
+      if (len == 0) {
+        return 0;
+      }
+      int result = NativeProcesses.nativeReadStream(nativeProcess, stream, b, off, len);
+      return result == 0 ? -1 : result; // EOF
+    }
+
+    synchronized byte[] tee(File logFile, int tailBytes) throws IOException {
+      if (closed || nativeProcess == NativeProcesses.INVALID) {
+        throw new IOException("stream is closed");
+      }
+      return NativeProcesses.nativeTeeStream(nativeProcess, stream, logFile.getPath(), tailBytes);
+    }
+
+    @Override
+    public synchronized void close() {
+      if (!closed && nativeProcess != NativeProcesses.INVALID) {
+        closed = true;
+        NativeProcesses.nativeCloseStream(nativeProcess, stream);
+      }
+    }
+  }
+
+  private static final AtomicInteger THREAD_SEQUENCE_NUMBER = new AtomicInteger(1);
+  private static final ExecutorService WAITER_POOL = Executors.newCachedThreadPool(
+      new ThreadFactory() {
+        @Override
+        public Thread newThread(Runnable runnable) {
+          Thread thread = new Thread(null, runnable,
+              "Native-Process-Waiter-Thread-" + THREAD_SEQUENCE_NUMBER.getAndIncrement(),
+              16 * 1024);
+          thread.setDaemon(true);
+          return thread;
+        }
+      });
+
+  // For debugging purposes.
+  private final String program;
+  private volatile long nativeProcess;
+  private final ProcessOutputStream stdinStream;
+  private final ProcessInputStream stdoutStream;
+  private final ProcessInputStream stderrStream;
+  private final CountDownLatch waitLatch = new CountDownLatch(1);
+  private final long timeoutMillis;
+  private final AtomicBoolean timedout = new AtomicBoolean(false);
+
+  NativeSubprocess(long nativeProcess, String program, boolean stdoutRedirected,
+      boolean stderrRedirected, long timeoutMillis) {
+    this.program = program;
+    this.nativeProcess = nativeProcess;
+    this.timeoutMillis = timeoutMillis;
+    stdinStream = new ProcessOutputStream();
+    stdoutStream = stdoutRedirected ? null : new ProcessInputStream(NativeProcesses.STDOUT);
+    stderrStream = stderrRedirected ? null : new ProcessInputStream(NativeProcesses.STDERR);
+    // Every process we start consumes a thread here, blocked in the kernel without a timeout.
+    WAITER_POOL.submit(new Runnable() {
+        @Override public void run() {
+          waiterThreadFunc();
+        }
+    });
+  }
+
+  private void waiterThreadFunc() {
+    if (!NativeProcesses.nativeWaitFor(nativeProcess, timeoutMillis)) {
+      // Timeout.
+      timedout.set(true);
+      NativeProcesses.nativeTerminate(nativeProcess, true);
+      NativeProcesses.nativeWaitFor(nativeProcess, -1);
+    }
+    waitLatch.countDown();
+  }
+
+  @Override
+  public synchronized void finalize() throws Throwable {
+    close();
+    super.finalize();
+  }
+
+  @Override
+  public synchronized boolean destroy() {
+    checkLiveness();
+    return NativeProcesses.nativeTerminate(nativeProcess, false);
+  }
+
+  @Override
+  public synchronized int exitValue() {
+    checkLiveness();
+    if (!finished()) {
+      throw new IllegalThreadStateException("process has not exited");
+    }
+    return NativeProcesses.nativeGetExitValue(nativeProcess);
+  }
+
+  /**
+   * Returns the resources used by the process, which must have finished.
+   */
+  public synchronized ResourceUsage getResourceUsage() {
+    checkLiveness();
+    if (!finished()) {
+      throw new IllegalThreadStateException("process has not exited");
+    }
+    return new ResourceUsage(NativeProcesses.nativeGetResourceUsage(nativeProcess));
+  }
+
+  /** Returns the process ID. */
+  public synchronized int getPid() {
+    checkLiveness();
+    return NativeProcesses.nativeGetPid(nativeProcess);
+  }
+
+  @Override
+  public boolean finished() {
+    return waitLatch.getCount() == 0;
+  }
+
+  @Override
+  public boolean timedout() {
+    return timedout.get();
+  }
+
+  @Override
+  public void waitFor() throws InterruptedException {
+    waitLatch.await();
+  }
+
+  @Override
+  public synchronized void close() {
+    if (nativeProcess == NativeProcesses.INVALID) {
+      return;
+    }
+    // The waiter thread uses the native object until the process is gone.
+    NativeProcesses.nativeTerminate(nativeProcess, true);
+    boolean interrupted = false;
+    while (true) {
+      try {
+        waitLatch.await();
+        break;
+      } catch (InterruptedException e) {
+        interrupted = true;
+      }
+    }
+    long process = nativeProcess;
+    nativeProcess = NativeProcesses.INVALID;
+    NativeProcesses.nativeDeleteProcess(process);
+    if (interrupted) {
+      Thread.currentThread().interrupt();
+    }
+  }
+
+  /**
+   * Appends the rest of the standard output of the process to {@code logFile} until the process
+   * closes it, without passing it through the JVM, and returns the last {@code tailBytes} of it,
+   * e.g. to show on the console.
+   *
+   * @throws IllegalStateException if the standard output is redirected
+   */
+  public byte[] teeStdout(File logFile, int tailBytes) throws IOException {
+    Preconditions.checkState(stdoutStream != null, "stdout of %s is redirected", program);
+    return stdoutStream.tee(logFile, tailBytes);
+  }
+
+  /** Like {@link #teeStdout}, for the standard error. */
+  public byte[] teeStderr(File logFile, int tailBytes) throws IOException {
+    Preconditions.checkState(stderrStream != null, "stderr of %s is redirected", program);
+    return stderrStream.tee(logFile, tailBytes);
+  }
+
+  @Override
+  public OutputStream getOutputStream() {
+    return stdinStream;
+  }
+
+  @Override
+  public InputStream getInputStream() {
+    return stdoutStream;
+  }
+
+  @Override
+  public InputStream getErrorStream() {
+    return stderrStream;
+  }
+
+  private void checkLiveness() {
+    if (nativeProcess == NativeProcesses.INVALID) {
+      throw new IllegalStateException();
+    }
+  }
+
+  @Override
+  public String toString() {
+    return String.format("%s:[%s]", super.toString(), program);
+  }
+}
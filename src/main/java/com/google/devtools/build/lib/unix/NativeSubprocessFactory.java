@@ -0,0 +1,84 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.unix;
+
+import com.google.devtools.build.lib.shell.Subprocess;
+import com.google.devtools.build.lib.shell.SubprocessBuilder;
+import com.google.devtools.build.lib.shell.SubprocessBuilder.StreamAction;
+import java.io.File;
+import java.io.IOException;
+import java.util.Map;
+
+/**
+ * A subprocess factory that starts processes with vfork(2), rather than forking the JVM. Supports
+ * timeouts and cgroups.
+ */
+public class NativeSubprocessFactory implements Subprocess.Factory {
+  public static final NativeSubprocessFactory INSTANCE = new NativeSubprocessFactory();
+
+  private NativeSubprocessFactory() {
+    // Singleton
+  }
+
+  @Override
+  public Subprocess create(SubprocessBuilder builder) throws IOException {
+    if (builder.getMemoryLimit() != 0 || builder.getCpuRateLimit() != 0) {
+      // Set them on the cgroup instead.
+      throw new UnsupportedOperationException("Resource limits are not supported");
+    }
+    String[] argv = builder.getArgv().toArray(new String[0]);
+    String[] env = null;
+    if (builder.getEnv() != null) {
+      env = new String[builder.getEnv().size()];
+      int i = 0;
+      for (Map.Entry<String, String> entry : builder.getEnv().entrySet()) {
+        env[i++] = entry.getKey() + "=" + entry.getValue();
+      }
+    }
+    String stdoutPath = getRedirectPath(builder.getStdout(), builder.getStdoutFile());
+    String stderrPath = getRedirectPath(builder.getStderr(), builder.getStderrFile());
+
+    long nativeProcess =
+        NativeProcesses.nativeCreateProcess(
+            argv,
+            env,
+            getPath(builder.getWorkingDirectory()),
+            stdoutPath,
+            stderrPath,
+            getPath(builder.getCgroup()));
+    return new NativeSubprocess(nativeProcess, argv[0], stdoutPath != null, stderrPath != null,
+        builder.getTimeoutMillis());
+  }
+
+  private static String getPath(File file) {
+    return file == null ? null : file.getPath();
+  }
+
+  private static String getRedirectPath(StreamAction action, File file) {
+    switch (action) {
+      case DISCARD:
+        return "/dev/null";
+
+      case REDIRECT:
+        return file.getPath();
+
+      case STREAM:
+        return null;
+
+      default:
+        throw new IllegalStateException();
+    }
+  }
+}
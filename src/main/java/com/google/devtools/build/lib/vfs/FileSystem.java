@@ -35,6 +35,7 @@ import java.io.OutputStream;
 import java.nio.file.FileAlreadyExistsException;
 import java.util.Collection;
 import java.util.List;
+import java.util.Map;
 
 /**
  * This interface models a file system using UNIX the naming scheme.
@@ -45,7 +46,8 @@ public abstract class FileSystem {
   /** Type of hash function to use for digesting files. */
   public enum HashFunction {
     MD5(16),
-    SHA1(20);
+    SHA1(20),
+    SHA256(32);
 
     private final int digestSize;
 
@@ -269,6 +271,30 @@ public abstract class FileSystem {
    */
   protected abstract boolean delete(Path path) throws IOException;
 
+  /**
+   * Deletes the file or directory tree denoted by {@code path}. See
+   * {@link FileSystemUtils#deleteTree} for specification.
+   *
+   * <p>The default implementation deletes the entries one by one through
+   * {@link Path}; file systems that can do better should override it.
+   */
+  protected void deleteTree(Path path) throws IOException {
+    FileSystemUtils.deleteTreesBelow(path);
+    path.delete();
+  }
+
+  /**
+   * Copies the contents of the file {@code from} to {@code to}, which does
+   * not exist. Used by {@link FileSystemUtils#copyFile}, which sees to the
+   * metadata.
+   *
+   * <p>The default implementation copies through streams; file systems that
+   * can do better should override it.
+   */
+  protected void copyFile(Path from, Path to) throws IOException {
+    FileSystemUtils.asByteSource(from).copyTo(FileSystemUtils.asByteSink(to));
+  }
+
   /**
    * Returns the last modification time of the file denoted by {@code path}.
    * See {@link Path#getLastModifiedTime(Symlinks)} for specification.
@@ -344,6 +370,8 @@ public abstract class FileSystem {
         return getMD5Digest(path);
       case SHA1:
         return getSHA1Digest(path);
+      case SHA256:
+        return getSHA256Digest(path);
       default:
         throw new IOException("Unsupported hash function: " + hashFunction);
     }
@@ -388,6 +416,20 @@ public abstract class FileSystem {
     }.hash(Hashing.sha1()).asBytes();
   }
 
+  /**
+   * Returns the SHA-256 digest of the file denoted by {@code path}. See
+   * {@link Path#getSHA256Digest} for specification.
+   */
+  protected byte[] getSHA256Digest(final Path path) throws IOException {
+    // Naive I/O implementation.  Subclasses may optimize.
+    return new ByteSource() {
+      @Override
+      public InputStream openStream() throws IOException {
+        return getInputStream(path);
+      }
+    }.hash(Hashing.sha256()).asBytes();
+  }
+
   /**
    * Returns true if "path" denotes an existing symbolic link. See
    * {@link Path#isSymbolicLink} for specification.
@@ -609,6 +651,23 @@ public abstract class FileSystem {
   protected abstract void createSymbolicLink(Path linkPath, PathFragment targetFragment)
       throws IOException;
 
+  /**
+   * Creates directories and symbolic links in bulk. See
+   * {@link FileSystemUtils#createSymlinkForest} for specification.
+   *
+   * <p>The default implementation creates them one by one; file systems that
+   * can do better should override it.
+   */
+  protected void createSymlinkForest(List<Path> directories, Map<Path, PathFragment> symlinks)
+      throws IOException {
+    for (Path directory : directories) {
+      directory.createDirectory();
+    }
+    for (Map.Entry<Path, PathFragment> symlink : symlinks.entrySet()) {
+      symlink.getKey().createSymbolicLink(symlink.getValue());
+    }
+  }
+
   /**
    * Returns the target of a symbolic link. See {@link Path#readSymbolicLink}
    * for specification.
@@ -31,6 +31,7 @@ import java.util.ArrayList;
 import java.util.Arrays;
 import java.util.Collection;
 import java.util.List;
+import java.util.Map;
 import java.util.Set;
 
 /**
@@ -435,7 +436,12 @@ public class FileSystemUtils {
       throw new IOException("error copying file: "
           + "couldn't delete destination: " + e.getMessage());
     }
-    asByteSource(from).copyTo(asByteSink(to));
+    if (from.getFileSystem() == to.getFileSystem()) {
+      // Which may share the data rather than copy it.
+      from.getFileSystem().copyFile(from, to);
+    } else {
+      asByteSource(from).copyTo(asByteSink(to));
+    }
     to.setLastModifiedTime(from.getLastModifiedTime()); // Preserve mtime.
     if (!from.isWritable()) {
       to.setWritable(false); // Make file read-only if original was read-only.
@@ -550,8 +556,23 @@ public class FileSystemUtils {
    */
   @ThreadSafe
   public static void deleteTree(Path p) throws IOException {
-    deleteTreesBelow(p);
-    p.delete();
+    p.getFileSystem().deleteTree(p);
+  }
+
+  /**
+   * Creates the directories {@code directories}, in order, then the symbolic links in
+   * {@code symlinks}, each mapped to its target, all on {@code fs}. Directories that exist
+   * already are fine; the parent of each entry must exist by the time it is created, so list
+   * parents first. Meant for symlink forests with many entries, which some file systems create
+   * in bulk.
+   *
+   * @throws IOException if any entry could not be created
+   */
+  @ThreadSafe
+  public static void createSymlinkForest(
+      FileSystem fs, List<Path> directories, Map<Path, PathFragment> symlinks)
+      throws IOException {
+    fs.createSymlinkForest(directories, symlinks);
   }
 
   /**
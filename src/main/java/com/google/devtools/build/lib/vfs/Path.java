@@ -1090,6 +1090,21 @@ public class Path implements Comparable<Path>, Serializable {
     return fileSystem.getSHA1Digest(this);
   }
 
+  /**
+   * Returns the SHA-256 digest of the file denoted by the current path,
+   * following symbolic links.
+   *
+   * <p>This method runs in O(n) time where n is the length of the file, but
+   * certain implementations may be much faster than the worst case.
+   *
+   * @return a new 32-byte array containing the file's SHA-256 digest
+   * @throws IOException if the SHA-256 digest could not be computed for any
+   *     reason
+   */
+  public byte[] getSHA256Digest() throws IOException {
+    return fileSystem.getSHA256Digest(this);
+  }
+
   /**
    * Returns the digest of the file denoted by the current path,
    * following symbolic links.
@@ -195,6 +195,12 @@ public class UnionFileSystem extends FileSystem {
     return delegate.getMD5Digest(adjustPath(path, delegate));
   }
 
+  @Override
+  protected byte[] getSHA256Digest(Path path) throws IOException {
+    FileSystem delegate = getDelegate(path);
+    return delegate.getSHA256Digest(adjustPath(path, delegate));
+  }
+
   @Override
   protected boolean createDirectory(Path path) throws IOException {
     checkModifiable();
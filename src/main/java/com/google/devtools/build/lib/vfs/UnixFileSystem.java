@@ -27,12 +27,19 @@ import java.io.IOException;
 import java.util.ArrayList;
 import java.util.Collection;
 import java.util.List;
+import java.util.Map;
 
 /**
  * This class implements the FileSystem interface using direct calls to the UNIX filesystem.
  */
 @ThreadSafe
 public class UnixFileSystem extends AbstractFileSystemWithCustomStat {
+  /**
+   * The extended attribute in which file digests are cached across server restarts, or null. Set
+   * with -Dbazel.DigestXattr=user.bazel.digest, for instance.
+   */
+  private static final String DIGEST_XATTR = System.getProperty("bazel.DigestXattr");
+
   public UnixFileSystem() {
   }
 
@@ -192,7 +199,16 @@ public class UnixFileSystem extends AbstractFileSystemWithCustomStat {
 
   @Override
   protected boolean exists(Path path, boolean followSymlinks) {
-    return statNullable(path, followSymlinks) != null;
+    String name = path.getPathString();
+    long startTime = Profiler.nanoTimeMaybe();
+    try {
+      // Only ask for the type, so that network file systems need not revalidate the rest.
+      return !NativePosixFiles.errnoStatx(
+              name, followSymlinks, NativePosixFiles.STAT_TYPE, /*dontSync=*/ false)
+          .hasError();
+    } finally {
+      profiler.logSimpleTask(startTime, ProfilerTask.VFS_STAT, name);
+    }
   }
 
   /**
@@ -324,6 +340,37 @@ public class UnixFileSystem extends AbstractFileSystemWithCustomStat {
     }
   }
 
+  @Override
+  protected void createSymlinkForest(List<Path> directories, Map<Path, PathFragment> symlinks)
+      throws IOException {
+    String[] directoryNames = new String[directories.size()];
+    for (int i = 0; i < directoryNames.length; i++) {
+      directoryNames[i] = directories.get(i).toString();
+    }
+    List<Path> links = new ArrayList<>(symlinks.keySet());
+    String[] linkNames = new String[links.size()];
+    String[] targetNames = new String[links.size()];
+    for (int i = 0; i < linkNames.length; i++) {
+      linkNames[i] = links.get(i).toString();
+      targetNames[i] = symlinks.get(links.get(i)).toString();
+    }
+    int[] errors =
+        NativePosixFiles.createSymlinkForest(directoryNames, linkNames, targetNames);
+    // Failures are rare: redo the failed entries one at a time, which throws the usual
+    // exception for the error.
+    for (int i = 0; i < errors.length; i++) {
+      if (errors[i] == 0) {
+        continue;
+      }
+      if (i < directoryNames.length) {
+        createDirectory(directories.get(i));
+      } else {
+        Path link = links.get(i - directoryNames.length);
+        createSymbolicLink(link, symlinks.get(link));
+      }
+    }
+  }
+
   @Override
   protected PathFragment readSymbolicLink(Path path) throws IOException {
     // Note that the default implementation of readSymbolicLinkUnchecked calls this method and thus
@@ -403,12 +450,49 @@ public class UnixFileSystem extends AbstractFileSystemWithCustomStat {
     String name = path.toString();
     long startTime = Profiler.nanoTimeMaybe();
     try {
-      return NativePosixFiles.md5sum(name).asBytes();
+      return DIGEST_XATTR != null
+          ? NativePosixFiles.xattrCachedDigest(name, DIGEST_XATTR, NativePosixFiles.DIGEST_MD5)
+          : NativePosixFiles.md5sum(name).asBytes();
     } finally {
       profiler.logSimpleTask(startTime, ProfilerTask.VFS_MD5, name);
     }
   }
 
+  @Override
+  protected byte[] getSHA256Digest(Path path) throws IOException {
+    String name = path.toString();
+    long startTime = Profiler.nanoTimeMaybe();
+    try {
+      return DIGEST_XATTR != null
+          ? NativePosixFiles.xattrCachedDigest(name, DIGEST_XATTR, NativePosixFiles.DIGEST_SHA256)
+          : NativePosixFiles.sha256sum(name).asBytes();
+    } finally {
+      profiler.logSimpleTask(startTime, ProfilerTask.VFS_MD5, name);
+    }
+  }
+
+  @Override
+  protected void deleteTree(Path path) throws IOException {
+    String name = path.toString();
+    long startTime = Profiler.nanoTimeMaybe();
+    try {
+      NativePosixFiles.deleteTree(name);
+    } finally {
+      profiler.logSimpleTask(startTime, ProfilerTask.VFS_DELETE, name);
+    }
+  }
+
+  @Override
+  protected void copyFile(Path from, Path to) throws IOException {
+    String name = to.toString();
+    long startTime = Profiler.nanoTimeMaybe();
+    try {
+      NativePosixFiles.copyFile(from.toString(), name);
+    } finally {
+      profiler.logSimpleTask(startTime, ProfilerTask.VFS_WRITE, name);
+    }
+  }
+
   @Override
   protected void createFSDependentHardLink(Path linkPath, Path originalPath)
       throws IOException {
@@ -15,8 +15,12 @@ package com.google.devtools.build.lib.vfs;
 
 import com.google.common.annotations.VisibleForTesting;
 import com.google.devtools.build.lib.concurrent.ThreadSafety.ThreadSafe;
+import com.google.devtools.build.lib.profiler.Profiler;
+import com.google.devtools.build.lib.profiler.ProfilerTask;
 import com.google.devtools.build.lib.util.Preconditions;
 import com.google.devtools.build.lib.vfs.Path.PathFactory;
+import com.google.devtools.build.lib.windows.WindowsFileOperations;
+import com.google.devtools.build.lib.windows.WindowsJniLoader;
 import java.io.File;
 import java.io.FileNotFoundException;
 import java.io.IOException;
@@ -25,7 +29,10 @@ import java.io.InputStreamReader;
 import java.nio.file.Files;
 import java.nio.file.LinkOption;
 import java.nio.file.attribute.DosFileAttributes;
+import java.util.ArrayList;
 import java.util.Arrays;
+import java.util.Collection;
+import java.util.List;
 import java.util.concurrent.TimeUnit;
 
 /** Jury-rigged file system for Windows. */
@@ -197,6 +204,21 @@ public class WindowsFileSystem extends JavaIoFileSystem {
   private static final PathFragment UNIX_ROOT =
       determineUnixRoot(WINDOWS_UNIX_ROOT_JVM_ARG, BAZEL_SH_ENV_VAR);
 
+  private static final boolean JNI_AVAILABLE = loadJni();
+
+  /**
+   * The native code is not available everywhere this file system is used, see
+   * https://github.com/bazelbuild/bazel/issues/1735.
+   */
+  private static boolean loadJni() {
+    try {
+      WindowsJniLoader.loadJni();
+      return true;
+    } catch (UnsatisfiedLinkError e) {
+      return false;
+    }
+  }
+
   public static final LinkOption[] NO_OPTIONS = new LinkOption[0];
   public static final LinkOption[] NO_FOLLOW = new LinkOption[] {LinkOption.NOFOLLOW_LINKS};
 
@@ -340,6 +362,40 @@ public class WindowsFileSystem extends JavaIoFileSystem {
     return status;
   }
 
+  /**
+   * Lists the directory with its metadata in one native call instead of one stat per entry, which
+   * is what makes globbing and package loading slow otherwise.
+   */
+  @Override
+  protected Collection<Dirent> readdir(Path path, boolean followSymlinks) throws IOException {
+    if (!JNI_AVAILABLE) {
+      return super.readdir(path, followSymlinks);
+    }
+    WindowsFileOperations.DirectoryEntry[] entries;
+    long startTime = Profiler.nanoTimeMaybe();
+    try {
+      entries = WindowsFileOperations.readDirectory(getIoFile(path).getPath());
+    } finally {
+      profiler.logSimpleTask(startTime, ProfilerTask.VFS_DIR, path.toString());
+    }
+    List<Dirent> dirents = new ArrayList<>(entries.length);
+    for (WindowsFileOperations.DirectoryEntry entry : entries) {
+      Dirent.Type type;
+      if (entry.isSymbolicLink()) {
+        type =
+            followSymlinks
+                ? direntFromStat(statNullable(path.getChild(entry.getName()), true))
+                : Dirent.Type.SYMLINK;
+      } else if (entry.isDirectory()) {
+        type = Dirent.Type.DIRECTORY;
+      } else {
+        type = Dirent.Type.FILE;
+      }
+      dirents.add(new Dirent(entry.getName(), type));
+    }
+    return dirents;
+  }
+
   @Override
   protected boolean isDirectory(Path path, boolean followSymlinks) {
     if (!followSymlinks) {
@@ -0,0 +1,111 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.devtools.build.lib.windows;
+
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
+
+/**
+ * The NTFS change journal of the volume of a directory, which records the changes to the files
+ * whether or not a process is watching.
+ *
+ * <p>A server that saves the {@link Position} of the journal when it shuts down can learn, when
+ * it starts again, which paths below the directory changed in between, rather than looking at
+ * every file. Reading the journal takes administrator rights; without them, or if the journal
+ * does not go back far enough any more, the changes cannot be told, and every file has to be
+ * looked at.
+ */
+public final class WindowsChangeJournal {
+
+  private WindowsChangeJournal() {
+    // Prevent construction
+  }
+
+  /** A point in the change journal of a volume. */
+  public static final class Position {
+    private final long journalId;
+    private final long usn;
+
+    public Position(long journalId, long usn) {
+      this.journalId = journalId;
+      this.usn = usn;
+    }
+
+    /** Returns the identifier of the journal, which changes when it is created again. */
+    public long getJournalId() {
+      return journalId;
+    }
+
+    /** Returns the update sequence number of the next change. */
+    public long getUsn() {
+      return usn;
+    }
+
+    /** Writes this position to {@code file}. */
+    public void writeTo(File file) throws IOException {
+      try (DataOutputStream out = new DataOutputStream(new FileOutputStream(file))) {
+        out.writeLong(journalId);
+        out.writeLong(usn);
+      }
+    }
+
+    /** Reads a position {@link #writeTo} wrote to {@code file}. */
+    public static Position readFrom(File file) throws IOException {
+      try (DataInputStream in = new DataInputStream(new FileInputStream(file))) {
+        return new Position(in.readLong(), in.readLong());
+      }
+    }
+  }
+
+  static native long[] nativeGetPosition(String root, String[] error);
+
+  static native String[] nativeGetChangesSince(
+      String root, long journalId, long usn, String[] error);
+
+  /** Returns the current position of the change journal of the volume of {@code root}. */
+  public static Position getPosition(String root) throws IOException {
+    WindowsJniLoader.loadJni();
+    String[] error = new String[] {null};
+    long[] position = nativeGetPosition(root, error);
+    if (position == null) {
+      throw new IOException(error[0]);
+    }
+    return new Position(position[0], position[1]);
+  }
+
+  /**
+   * Returns the absolute paths below {@code root}, which is absolute, that changed from {@code
+   * position} up to now: those of the files and directories created, deleted, renamed (both
+   * names), written to or whose metadata changed, and of the entries below directories that were
+   * moved below {@code root}. Paths longer than MAX_PATH are supported.
+   *
+   * @throws IOException if the changes cannot be told: the journal no longer goes back to {@code
+   *     position}, was created again, cannot be read, or there are too many changes
+   */
+  public static String[] getChangesSince(String root, Position position) throws IOException {
+    WindowsJniLoader.loadJni();
+    String[] error = new String[] {null};
+    String[] paths =
+        nativeGetChangesSince(root, position.getJournalId(), position.getUsn(), error);
+    if (paths == null) {
+      throw new IOException(error[0]);
+    }
+    return paths;
+  }
+}
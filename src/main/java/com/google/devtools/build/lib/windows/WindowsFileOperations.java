@@ -14,6 +14,8 @@
 
 package com.google.devtools.build.lib.windows;
 
+import java.io.File;
+import java.io.FileNotFoundException;
 import java.io.IOException;
 
 /** File operations on Windows. */
@@ -30,6 +32,91 @@ public class WindowsFileOperations {
 
   static native int nativeIsJunction(String path, String[] error);
 
+  static native DirectoryEntry[] nativeReadDirectory(String path, String[] error);
+
+  /** An entry of a directory with its metadata, as returned by {@link #readDirectory}. */
+  public static final class DirectoryEntry {
+    // Values of the Windows API, see winnt.h.
+    private static final int FILE_ATTRIBUTE_DIRECTORY = 0x10;
+    private static final int FILE_ATTRIBUTE_REPARSE_POINT = 0x400;
+    private static final int IO_REPARSE_TAG_MOUNT_POINT = 0xA0000003;
+    private static final int IO_REPARSE_TAG_SYMLINK = 0xA000000C;
+
+    private final String name;
+    private final int attributes;
+    private final int reparseTag;
+    private final long size;
+    private final long creationTime;
+    private final long lastAccessTime;
+    private final long lastWriteTime;
+
+    // Called from JNI code.
+    DirectoryEntry(
+        String name,
+        int attributes,
+        int reparseTag,
+        long size,
+        long creationTime,
+        long lastAccessTime,
+        long lastWriteTime) {
+      this.name = name;
+      this.attributes = attributes;
+      this.reparseTag = reparseTag;
+      this.size = size;
+      this.creationTime = creationTime;
+      this.lastAccessTime = lastAccessTime;
+      this.lastWriteTime = lastWriteTime;
+    }
+
+    public String getName() {
+      return name;
+    }
+
+    /** Returns the FILE_ATTRIBUTE_* flags of the entry. */
+    public int getAttributes() {
+      return attributes;
+    }
+
+    /** Returns the IO_REPARSE_TAG_* value of a reparse point, 0 for other entries. */
+    public int getReparseTag() {
+      return reparseTag;
+    }
+
+    public boolean isDirectory() {
+      return (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    }
+
+    public boolean isReparsePoint() {
+      return (attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+    }
+
+    /** Returns whether the entry is a junction or a symlink, to a file or to a directory. */
+    public boolean isSymbolicLink() {
+      return isReparsePoint()
+          && (reparseTag == IO_REPARSE_TAG_MOUNT_POINT || reparseTag == IO_REPARSE_TAG_SYMLINK);
+    }
+
+    /** Returns the size of the file in bytes; that of the link itself for a reparse point. */
+    public long getSize() {
+      return size;
+    }
+
+    /** Returns the creation time in milliseconds since the epoch. */
+    public long getCreationTime() {
+      return creationTime;
+    }
+
+    /** Returns the last access time in milliseconds since the epoch. */
+    public long getLastAccessTime() {
+      return lastAccessTime;
+    }
+
+    /** Returns the last modification time in milliseconds since the epoch. */
+    public long getLastWriteTime() {
+      return lastWriteTime;
+    }
+  }
+
   /** Determines whether `path` is a junction point or directory symlink. */
   public static boolean isJunction(String path) throws IOException {
     WindowsJniLoader.loadJni();
@@ -43,4 +130,21 @@ public class WindowsFileOperations {
         throw new IOException(error[0]);
     }
   }
+
+  /**
+   * Lists the entries of the directory `path` with their metadata, except "." and "..", without
+   * following the reparse points among them. Paths longer than MAX_PATH are supported.
+   */
+  public static DirectoryEntry[] readDirectory(String path) throws IOException {
+    WindowsJniLoader.loadJni();
+    String[] error = new String[] {null};
+    DirectoryEntry[] result = nativeReadDirectory(path, error);
+    if (result == null) {
+      if (!new File(path).exists()) {
+        throw new FileNotFoundException(path + " (No such file or directory)");
+      }
+      throw new IOException(error[0]);
+    }
+    return result;
+  }
 }
@@ -44,10 +44,20 @@ public class WindowsProcesses {
    *     work.
    * @param stderrFile the file the stdout should be redirected to. if null, nativeReadStderr will
    *     work.
+   * @param memoryLimit the most memory, in bytes, the processes of the job of the new process may
+   *     commit together, or 0 for no limit
+   * @param cpuRateLimit the percentage of the cycles of all processors the job of the new process
+   *     may use, or 0 for no limit. Needs Windows 8 or later.
    * @return the opaque identifier of the created process
    */
   static native long nativeCreateProcess(String commandLine, byte[] env,
-      String cwd, String stdoutFile, String stderrFile);
+      String cwd, String stdoutFile, String stderrFile, long memoryLimit, int cpuRateLimit);
+
+  /** Like the above, without resource limits. */
+  static long nativeCreateProcess(String commandLine, byte[] env,
+      String cwd, String stdoutFile, String stderrFile) {
+    return nativeCreateProcess(commandLine, env, cwd, stdoutFile, stderrFile, 0, 0);
+  }
 
   /**
    * Writes data from the given array to the stdin of the specified process.
@@ -91,6 +101,25 @@ public class WindowsProcesses {
    */
   static native int nativeGetExitCode(long process);
 
+  // Keep USAGE_* values in sync with src/main/native/windows_processes.cc.
+  static final int USAGE_USER_TIME_MICROS = 0;
+  static final int USAGE_KERNEL_TIME_MICROS = 1;
+  static final int USAGE_PEAK_PROCESS_MEMORY_BYTES = 2;
+  static final int USAGE_PEAK_JOB_MEMORY_BYTES = 3;
+  static final int USAGE_PAGE_FAULTS = 4;
+  static final int USAGE_READ_OPERATIONS = 5;
+  static final int USAGE_WRITE_OPERATIONS = 6;
+  static final int USAGE_READ_BYTES = 7;
+  static final int USAGE_WRITE_BYTES = 8;
+
+  /**
+   * Returns the resources used so far by the job of the given process, which covers the processes
+   * it started, indexed by {@link #USAGE_USER_TIME_MICROS} and the other constants above. If the
+   * process could not be put in a job of its own, only its own usage; -1 for what is not known
+   * then.
+   */
+  static native long[] nativeGetResourceUsage(long process);
+
   /**
    * Returns the process ID of the given process or -1 if there was an error.
    */
@@ -32,6 +32,56 @@ public class WindowsSubprocess implements Subprocess {
   // For debugging purposes.
   private String commandLine;
 
+  /**
+   * The resources used by the job of a process, which covers the processes it started. Values
+   * that are not known are -1.
+   */
+  public static final class ResourceUsage {
+    private final long[] values;
+
+    private ResourceUsage(long[] values) {
+      this.values = values;
+    }
+
+    public long getUserTimeMicros() {
+      return values[WindowsProcesses.USAGE_USER_TIME_MICROS];
+    }
+
+    public long getKernelTimeMicros() {
+      return values[WindowsProcesses.USAGE_KERNEL_TIME_MICROS];
+    }
+
+    /** Returns the most memory any single process of the job committed. */
+    public long getPeakProcessMemoryBytes() {
+      return values[WindowsProcesses.USAGE_PEAK_PROCESS_MEMORY_BYTES];
+    }
+
+    /** Returns the most memory the processes of the job committed together. */
+    public long getPeakJobMemoryBytes() {
+      return values[WindowsProcesses.USAGE_PEAK_JOB_MEMORY_BYTES];
+    }
+
+    public long getPageFaults() {
+      return values[WindowsProcesses.USAGE_PAGE_FAULTS];
+    }
+
+    public long getReadOperations() {
+      return values[WindowsProcesses.USAGE_READ_OPERATIONS];
+    }
+
+    public long getWriteOperations() {
+      return values[WindowsProcesses.USAGE_WRITE_OPERATIONS];
+    }
+
+    public long getReadBytes() {
+      return values[WindowsProcesses.USAGE_READ_BYTES];
+    }
+
+    public long getWriteBytes() {
+      return values[WindowsProcesses.USAGE_WRITE_BYTES];
+    }
+  }
+
   /**
    * Output stream for writing to the stdin of a Windows process.
    */
@@ -207,6 +257,15 @@ public class WindowsSubprocess implements Subprocess {
     return result;
   }
 
+  /**
+   * Returns the resources used by the process and the processes it started so far; the totals
+   * once it has finished.
+   */
+  public synchronized ResourceUsage getResourceUsage() {
+    checkLiveness();
+    return new ResourceUsage(WindowsProcesses.nativeGetResourceUsage(nativeProcess));
+  }
+
   @Override
   public boolean finished() {
     return waitLatch.getCount() == 0;
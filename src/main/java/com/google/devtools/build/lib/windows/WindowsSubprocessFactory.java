@@ -37,6 +37,9 @@ public class WindowsSubprocessFactory implements Subprocess.Factory {
   @Override
   public Subprocess create(SubprocessBuilder builder) throws IOException {
     WindowsJniLoader.loadJni();
+    if (builder.getCgroup() != null) {
+      throw new UnsupportedOperationException("Cgroups are not supported");
+    }
 
     String commandLine = WindowsProcesses.quoteCommandLine(builder.getArgv());
     byte[] env = builder.getEnv() == null ? null : convertEnvToNative(builder.getEnv());
@@ -45,7 +48,8 @@ public class WindowsSubprocessFactory implements Subprocess.Factory {
     String stderrPath = getRedirectPath(builder.getStderr(), builder.getStderrFile());
 
     long nativeProcess = WindowsProcesses.nativeCreateProcess(
-        commandLine, env, builder.getWorkingDirectory().getPath(), stdoutPath, stderrPath);
+        commandLine, env, builder.getWorkingDirectory().getPath(), stdoutPath, stderrPath,
+        builder.getMemoryLimit(), builder.getCpuRateLimit());
     String error = WindowsProcesses.nativeProcessGetLastError(nativeProcess);
     if (!error.isEmpty()) {
       WindowsProcesses.nativeDeleteProcess(nativeProcess);
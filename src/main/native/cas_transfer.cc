@@ -0,0 +1,742 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Streams files between the local disk and the CAS of a remote cache, the
+// CasService of src/main/protobuf/remote_protocol.proto, for
+// com.google.devtools.build.lib.unix.NativeCasTransfer.
+//
+// The contents never go through the Java heap: uploads read the chunks
+// straight into the requests, downloads write the chunks
+// into the preallocated file and digest them as they arrive. The batches of
+// blobs are streamed side by side, one call each, on a few native threads.
+
+#include "src/main/native/unix_jni.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <jni.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include <grpc++/channel.h>
+#include <grpc++/client_context.h>
+#include <grpc++/create_channel.h>
+#include <grpc++/security/credentials.h>
+
+#include "src/main/cpp/util/sha1.h"
+#include "src/main/protobuf/remote_protocol.grpc.pb.h"
+
+namespace {
+
+using blaze_util::Sha1Digest;
+using build::remote::BlobChunk;
+using build::remote::CasDownloadBlobRequest;
+using build::remote::CasDownloadReply;
+using build::remote::CasService;
+using build::remote::CasStatus;
+using build::remote::CasUploadBlobReply;
+using build::remote::CasUploadBlobRequest;
+using build::remote::ContentDigest;
+
+// Downloads are written in blocks of this size, at offsets that are multiples
+// of it, except for the last one of each file.
+const size_t kWriteBlockSize = 1 << 20;
+const size_t kWriteAlignment = 4096;
+
+// A file to upload or download, with the digest of its contents.
+struct Blob {
+  const char *path;
+  const jbyte *digest;  // Sha1Digest::kDigestLength bytes
+  int64_t size;
+  bool executable;
+};
+
+struct TransferOptions {
+  int max_chunk_size_bytes;
+  int max_batch_inputs;
+  int64_t max_batch_size_bytes;
+  int streams;
+  int timeout_seconds;
+};
+
+// One upload or download: its blobs, in batches of consecutive ones, each
+// streamed in one call. The first error stops it.
+class Transfer {
+ public:
+  Transfer(const std::string &target, const std::vector<Blob> &blobs,
+           const TransferOptions &options);
+
+  // Streams the batches with stream_fn, on up to options.streams threads.
+  void Run(bool (*stream_fn)(Transfer *, size_t, size_t));
+
+  const std::vector<Blob> &blobs() const { return blobs_; }
+  const TransferOptions &options() const { return options_; }
+  CasService::Stub *stub() { return stub_.get(); }
+
+  // Sets the deadline of a call, like the timeout of GrpcActionCache.
+  void SetDeadline(grpc::ClientContext *context) const;
+
+  // Records the first error, which stops the remaining batches. A path makes
+  // it a file error, with the message of the error number.
+  void Fail(int error_number, const std::string &message,
+            const char *path = NULL);
+  // Records that the cache does not have the contents of a blob.
+  void Missing(size_t blob);
+  bool failed() const { return failed_; }
+
+  // Throws the error as an exception, or returns the index of the missing
+  // blob, or else -1.
+  jint Report(JNIEnv *env);
+
+ private:
+  void RunBatches(bool (*stream_fn)(Transfer *, size_t, size_t));
+
+  const std::vector<Blob> &blobs_;
+  const TransferOptions options_;
+  std::unique_ptr<CasService::Stub> stub_;
+  // The first blob of each batch, then the end of the last one.
+  std::vector<size_t> batches_;
+  std::atomic<size_t> next_batch_;
+  std::atomic<bool> failed_;
+
+  std::mutex mutex_;  // Guards the error.
+  int error_number_;
+  std::string error_;
+  std::string error_path_;
+  jint missing_;
+};
+
+// The channels stay open for the later transfers to the same cache.
+std::shared_ptr<grpc::Channel> GetChannel(const std::string &target) {
+  static std::mutex mutex;
+  static std::map<std::string, std::shared_ptr<grpc::Channel> > *channels =
+      new std::map<std::string, std::shared_ptr<grpc::Channel> >();
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<grpc::Channel> &channel = (*channels)[target];
+  if (channel == NULL) {
+    channel = grpc::CreateChannel(target, grpc::InsecureChannelCredentials());
+  }
+  return channel;
+}
+
+Transfer::Transfer(const std::string &target, const std::vector<Blob> &blobs,
+                   const TransferOptions &options)
+    : blobs_(blobs),
+      options_(options),
+      stub_(CasService::NewStub(GetChannel(target))),
+      next_batch_(0),
+      failed_(false),
+      error_number_(0),
+      missing_(-1) {
+  // The same batches as GrpcActionCache.uploadChunks().
+  int64_t batch_size = 0;
+  int batch_inputs = 0;
+  for (size_t i = 0; i < blobs.size(); ++i) {
+    if (i == 0 || batch_inputs == options.max_batch_inputs ||
+        batch_size + blobs[i].size > options.max_batch_size_bytes) {
+      batches_.push_back(i);
+      batch_size = 0;
+      batch_inputs = 0;
+    }
+    batch_size += blobs[i].size;
+    ++batch_inputs;
+  }
+  batches_.push_back(blobs.size());
+}
+
+void Transfer::Run(bool (*stream_fn)(Transfer *, size_t, size_t)) {
+  size_t threads = std::min(batches_.size() - 1,
+                            static_cast<size_t>(std::max(options_.streams, 1)));
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; ++i) {
+    workers.push_back(std::thread(&Transfer::RunBatches, this, stream_fn));
+  }
+  RunBatches(stream_fn);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void Transfer::RunBatches(bool (*stream_fn)(Transfer *, size_t, size_t)) {
+  for (size_t batch = next_batch_++; batch + 1 < batches_.size() && !failed_;
+       batch = next_batch_++) {
+    if (!stream_fn(this, batches_[batch], batches_[batch + 1])) {
+      Fail(EIO, "transfer failed");  // unless it says why
+    }
+  }
+}
+
+void Transfer::SetDeadline(grpc::ClientContext *context) const {
+  context->set_deadline(std::chrono::system_clock::now() +
+                        std::chrono::seconds(options_.timeout_seconds));
+}
+
+void Transfer::Fail(int error_number, const std::string &message,
+                    const char *path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!failed_) {
+    failed_ = true;
+    error_number_ = error_number;
+    error_ = message;
+    error_path_ = path != NULL ? path : "";
+  }
+}
+
+void Transfer::Missing(size_t blob) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!failed_) {
+    failed_ = true;
+    missing_ = static_cast<jint>(blob);
+  }
+}
+
+jint Transfer::Report(JNIEnv *env) {
+  if (!error_path_.empty()) {
+    ::PostFileException(env, error_number_, error_path_.c_str());
+  } else if (!error_.empty()) {
+    ::PostException(env, error_number_, error_);
+  }
+  return missing_;
+}
+
+std::string Hex(const jbyte *bytes, size_t length) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string hex;
+  for (size_t i = 0; i < length; ++i) {
+    hex.push_back(kHexDigits[(bytes[i] >> 4) & 0xf]);
+    hex.push_back(kHexDigits[bytes[i] & 0xf]);
+  }
+  return hex;
+}
+
+void SetDigest(const Blob &blob, ContentDigest *digest) {
+  digest->set_digest(blob.digest, Sha1Digest::kDigestLength);
+  digest->set_size_bytes(blob.size);
+}
+
+bool SameDigest(const Blob &blob, const ContentDigest &digest) {
+  return digest.size_bytes() == blob.size &&
+         digest.digest().size() == Sha1Digest::kDigestLength &&
+         memcmp(digest.digest().data(), blob.digest,
+                Sha1Digest::kDigestLength) == 0;
+}
+
+std::string StatusMessage(const char *call, const grpc::Status &status) {
+  return std::string(call) + " failed: " + status.error_message();
+}
+
+// Reads up to size bytes at offset. Returns the number of bytes read, which
+// is less only at the end of the file, or -1 and sets errno.
+ssize_t ReadFully(int fd, char *data, size_t size, int64_t offset) {
+  size_t total = 0;
+  while (total < size) {
+    ssize_t n = pread(fd, data + total, size - total, offset + total);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += n;
+  }
+  return total;
+}
+
+// Sends the chunks of a file on an UploadBlob stream, reading each one
+// straight into the request, whose buffers are reused. The file is read
+// rather than mapped, so one truncated during the upload is an error instead
+// of a SIGBUS. Returns false on errors, which are recorded, or if the stream
+// broke, which is not.
+bool UploadBlob(Transfer *transfer, const Blob &blob,
+                grpc::ClientWriter<CasUploadBlobRequest> *writer,
+                CasUploadBlobRequest *request) {
+  int fd;
+  while ((fd = open(blob.path, O_RDONLY)) == -1 && errno == EINTR) { }
+  if (fd == -1) {
+    transfer->Fail(errno, "", blob.path);
+    return false;
+  }
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) == -1) {
+    transfer->Fail(errno, "", blob.path);
+    close(fd);
+    return false;
+  }
+  if (statbuf.st_size != blob.size) {
+    close(fd);
+    transfer->Fail(EIO, std::string(blob.path) +
+                            " changed since it was digested");
+    return false;
+  }
+#ifdef __linux__
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  bool ok = true;
+  int64_t offset = 0;
+  BlobChunk *chunk = request->mutable_data();
+  do {
+    chunk->Clear();
+    if (offset == 0) {
+      SetDigest(blob, chunk->mutable_digest());
+    } else {
+      chunk->set_offset(offset);
+    }
+    size_t size = static_cast<size_t>(
+        std::min(blob.size - offset,
+                 static_cast<int64_t>(
+                     transfer->options().max_chunk_size_bytes)));
+    std::string *data = chunk->mutable_data();
+    data->resize(size);
+    ssize_t n = ReadFully(fd, &(*data)[0], size, offset);
+    if (n == -1) {
+      transfer->Fail(errno, "", blob.path);
+      ok = false;
+      break;
+    }
+    if (static_cast<size_t>(n) < size) {
+      transfer->Fail(EIO, std::string(blob.path) +
+                              " changed since it was digested");
+      ok = false;
+      break;
+    }
+    offset += size;
+    ok = writer->Write(*request);
+  } while (ok && offset < blob.size);
+
+  close(fd);
+  return ok;
+}
+
+bool UploadBatch(Transfer *transfer, size_t begin, size_t end) {
+  grpc::ClientContext context;
+  transfer->SetDeadline(&context);
+  CasUploadBlobReply reply;
+  std::unique_ptr<grpc::ClientWriter<CasUploadBlobRequest> > writer(
+      transfer->stub()->UploadBlob(&context, &reply));
+  CasUploadBlobRequest request;
+  for (size_t i = begin; i < end; ++i) {
+    if (!UploadBlob(transfer, transfer->blobs()[i], writer.get(), &request)) {
+      break;
+    }
+  }
+  if (transfer->failed()) {
+    context.TryCancel();
+    writer->Finish();
+    return false;
+  }
+  writer->WritesDone();
+  grpc::Status status = writer->Finish();
+  if (!status.ok()) {
+    transfer->Fail(EIO, StatusMessage("UploadBlob", status));
+    return false;
+  }
+  if (!reply.status().succeeded()) {
+    transfer->Fail(EIO, reply.status().error_detail());
+    return false;
+  }
+  return true;
+}
+
+// Writes a download in large blocks at aligned offsets, after allocating its
+// space at once, and digests it on the way.
+class BlobWriter {
+ public:
+  BlobWriter() : buffer_(NULL), fd_(-1) {}
+  ~BlobWriter() {
+    if (fd_ != -1) {
+      close(fd_);
+    }
+    free(buffer_);
+  }
+
+  // Creates or truncates the file. Returns false and sets errno on errors.
+  bool Open(const Blob &blob);
+  bool Write(const char *data, size_t size);
+  // Writes the rest, sets the permissions, closes the file and finishes the
+  // digest.
+  bool Close(unsigned char *digest);
+
+ private:
+  bool WriteFully(const char *data, size_t size);
+
+  char *buffer_;
+  size_t buffered_;
+  int fd_;
+  bool executable_;
+  Sha1Digest sha1_;
+};
+
+bool BlobWriter::Open(const Blob &blob) {
+  if (buffer_ == NULL) {
+    void *buffer;
+    int error = posix_memalign(&buffer, kWriteAlignment, kWriteBlockSize);
+    if (error != 0) {
+      errno = error;
+      return false;
+    }
+    buffer_ = static_cast<char *>(buffer);
+  }
+  buffered_ = 0;
+  executable_ = blob.executable;
+  sha1_.Reset();
+  fd_ = open(blob.path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd_ == -1) {
+    return false;
+  }
+#ifdef __linux__
+  // Not all file systems can, and then it only costs the fragmentation.
+  if (blob.size > 0) {
+    fallocate(fd_, 0, 0, blob.size);
+  }
+#endif
+  return true;
+}
+
+bool BlobWriter::Write(const char *data, size_t size) {
+  sha1_.Update(data, size);
+  // A large chunk at a block boundary goes to the file as it is.
+  if (buffered_ == 0 && size >= kWriteBlockSize) {
+    size_t direct = size - size % kWriteBlockSize;
+    if (!WriteFully(data, direct)) {
+      return false;
+    }
+    data += direct;
+    size -= direct;
+  }
+  while (size > 0) {
+    size_t n = std::min(size, kWriteBlockSize - buffered_);
+    memcpy(buffer_ + buffered_, data, n);
+    buffered_ += n;
+    data += n;
+    size -= n;
+    if (buffered_ == kWriteBlockSize) {
+      if (!WriteFully(buffer_, buffered_)) {
+        return false;
+      }
+      buffered_ = 0;
+    }
+  }
+  return true;
+}
+
+bool BlobWriter::Close(unsigned char *digest) {
+  bool ok = WriteFully(buffer_, buffered_) &&
+            fchmod(fd_, executable_ ? 0755 : 0644) == 0;
+  int error = ok ? 0 : errno;
+  if (close(fd_) != 0 && ok) {
+    ok = false;
+    error = errno;
+  }
+  fd_ = -1;
+  sha1_.Finish(digest);
+  errno = error;
+  return ok;
+}
+
+bool BlobWriter::WriteFully(const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd_, data, size);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Reads the next reply of a DownloadBlob stream, and checks its status.
+// Returns false on errors, which are recorded, or at the end of the stream,
+// which is not.
+bool ReadReply(Transfer *transfer, size_t blob,
+               grpc::ClientReader<CasDownloadReply> *reader,
+               CasDownloadReply *reply) {
+  if (!reader->Read(reply)) {
+    return false;
+  }
+  if (reply->has_status() && !reply->status().succeeded()) {
+    const CasStatus &status = reply->status();
+    if (status.error() == CasStatus::MISSING_DIGEST) {
+      size_t missing = blob;
+      if (status.missing_digest_size() > 0) {
+        for (size_t i = 0; i < transfer->blobs().size(); ++i) {
+          if (SameDigest(transfer->blobs()[i], status.missing_digest(0))) {
+            missing = i;
+            break;
+          }
+        }
+      }
+      transfer->Missing(missing);
+    } else {
+      transfer->Fail(EIO, status.error_detail());
+    }
+    return false;
+  }
+  return true;
+}
+
+// Receives the chunks of a blob from a DownloadBlob stream into its file,
+// which is removed unless its contents match the digest.
+bool DownloadBlob(Transfer *transfer, size_t index,
+                  grpc::ClientReader<CasDownloadReply> *reader,
+                  CasDownloadReply *reply, BlobWriter *writer) {
+  const Blob &blob = transfer->blobs()[index];
+  if (!ReadReply(transfer, index, reader, reply)) {
+    return false;
+  }
+  const BlobChunk &first = reply->data();
+  if (!SameDigest(blob, first.digest())) {
+    transfer->Fail(EIO, "DownloadBlob sent " +
+                            Hex(reinterpret_cast<const jbyte *>(
+                                    first.digest().digest().data()),
+                                first.digest().digest().size()) +
+                            " instead of " +
+                            Hex(blob.digest, Sha1Digest::kDigestLength));
+    return false;
+  }
+  if (!writer->Open(blob)) {
+    transfer->Fail(errno, "", blob.path);
+    return false;
+  }
+  bool ok = writer->Write(first.data().data(), first.data().size());
+  int64_t received = first.data().size();
+  while (ok && received < blob.size) {
+    if (!ReadReply(transfer, index, reader, reply)) {
+      break;
+    }
+    const BlobChunk &chunk = reply->data();
+    if (chunk.has_digest() || chunk.offset() != received ||
+        received + static_cast<int64_t>(chunk.data().size()) > blob.size) {
+      transfer->Fail(EIO, "DownloadBlob sent a chunk out of order for " +
+                              std::string(blob.path));
+      break;
+    }
+    ok = writer->Write(chunk.data().data(), chunk.data().size());
+    received += chunk.data().size();
+  }
+  if (!ok) {
+    transfer->Fail(errno, "", blob.path);
+  }
+
+  unsigned char digest[Sha1Digest::kDigestLength];
+  if (!writer->Close(digest)) {
+    if (ok) {
+      transfer->Fail(errno, "", blob.path);
+    }
+    ok = false;
+  }
+  if (ok && received < blob.size) {
+    // The stream ended early, or failed.
+    ok = false;
+  }
+  if (ok && memcmp(digest, blob.digest, sizeof(digest)) != 0) {
+    transfer->Fail(EIO, std::string(blob.path) + ": the download has digest " +
+                            Hex(reinterpret_cast<jbyte *>(digest),
+                                sizeof(digest)) +
+                            " instead of " +
+                            Hex(blob.digest, Sha1Digest::kDigestLength));
+    ok = false;
+  }
+  if (!ok) {
+    unlink(blob.path);
+  }
+  return ok;
+}
+
+bool DownloadBatch(Transfer *transfer, size_t begin, size_t end) {
+  CasDownloadBlobRequest request;
+  for (size_t i = begin; i < end; ++i) {
+    SetDigest(transfer->blobs()[i], request.add_digest());
+  }
+  grpc::ClientContext context;
+  transfer->SetDeadline(&context);
+  std::unique_ptr<grpc::ClientReader<CasDownloadReply> > reader(
+      transfer->stub()->DownloadBlob(&context, request));
+  CasDownloadReply reply;
+  BlobWriter writer;
+  size_t i = begin;
+  while (i < end && DownloadBlob(transfer, i, reader.get(), &reply, &writer)) {
+    ++i;
+  }
+  if (transfer->failed()) {
+    context.TryCancel();
+    reader->Finish();
+    return false;
+  }
+  if (i < end) {
+    // The stream ended before the blob it was reading.
+    grpc::Status status = reader->Finish();
+    transfer->Fail(EIO, status.ok()
+                            ? "DownloadBlob ended before " +
+                                  std::string(transfer->blobs()[i].path)
+                            : StatusMessage("DownloadBlob", status));
+    return false;
+  }
+  // The server may still have to say that the call is over.
+  while (reader->Read(&reply)) {
+  }
+  grpc::Status status = reader->Finish();
+  if (!status.ok()) {
+    transfer->Fail(EIO, StatusMessage("DownloadBlob", status));
+    return false;
+  }
+  return true;
+}
+
+// Decodes the arguments shared by upload() and download() into blobs, or
+// throws an exception and returns false.
+bool GetBlobs(JNIEnv *env, jbyteArray paths, jbyteArray digests,
+              jlongArray sizes, jbooleanArray executable,
+              const TransferOptions &options, std::vector<char> *path_bytes,
+              std::vector<jbyte> *digest_bytes, std::vector<Blob> *blobs) {
+  jsize count = env->GetArrayLength(sizes);
+  path_bytes->resize(env->GetArrayLength(paths));
+  digest_bytes->resize(env->GetArrayLength(digests));
+  if (digest_bytes->size() !=
+          static_cast<size_t>(count) * Sha1Digest::kDigestLength ||
+      (executable != NULL && env->GetArrayLength(executable) != count) ||
+      options.max_chunk_size_bytes <= 0 || options.max_batch_inputs <= 0 ||
+      options.timeout_seconds <= 0) {
+    ::PostException(env, EINVAL, "invalid arguments");
+    return false;
+  }
+  env->GetByteArrayRegion(paths, 0, path_bytes->size(),
+                          reinterpret_cast<jbyte *>(path_bytes->data()));
+  if (!digest_bytes->empty()) {
+    env->GetByteArrayRegion(digests, 0, digest_bytes->size(),
+                            digest_bytes->data());
+  }
+  std::vector<jlong> size_values(count);
+  std::vector<jboolean> executable_values(count);
+  if (count > 0) {
+    env->GetLongArrayRegion(sizes, 0, count, size_values.data());
+    if (executable != NULL) {
+      env->GetBooleanArrayRegion(executable, 0, count,
+                                 executable_values.data());
+    }
+  }
+
+  size_t path = 0;
+  for (jsize i = 0; i < count; ++i) {
+    const char *end = static_cast<const char *>(
+        memchr(path_bytes->data() + path, '\0', path_bytes->size() - path));
+    if (end == NULL || size_values[i] < 0) {
+      ::PostException(env, EINVAL, "invalid arguments");
+      return false;
+    }
+    Blob blob = {path_bytes->data() + path,
+                 digest_bytes->data() + i * Sha1Digest::kDigestLength,
+                 size_values[i], executable_values[i] != JNI_FALSE};
+    blobs->push_back(blob);
+    path = end + 1 - path_bytes->data();
+  }
+  if (path != path_bytes->size()) {
+    ::PostException(env, EINVAL, "invalid arguments");
+    return false;
+  }
+  return true;
+}
+
+std::string GetTarget(JNIEnv *env, jstring target) {
+  const char *chars = env->GetStringUTFChars(target, NULL);
+  if (chars == NULL) {
+    return "";  // the exception is pending
+  }
+  std::string result(chars);
+  env->ReleaseStringUTFChars(target, chars);
+  return result;
+}
+
+}  // namespace
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeCasTransfer
+ * Method:    upload
+ * Signature: (Ljava/lang/String;[B[B[JIIIII)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativeCasTransfer_upload(
+    JNIEnv *env, jclass clazz, jstring target, jbyteArray paths,
+    jbyteArray digests, jlongArray sizes, jint max_chunk_size_bytes,
+    jint max_batch_inputs, jint max_batch_size_bytes, jint streams,
+    jint timeout_seconds) {
+  TransferOptions options = {max_chunk_size_bytes, max_batch_inputs,
+                             max_batch_size_bytes, streams, timeout_seconds};
+  std::vector<char> path_bytes;
+  std::vector<jbyte> digest_bytes;
+  std::vector<Blob> blobs;
+  if (!GetBlobs(env, paths, digests, sizes, NULL, options, &path_bytes,
+                &digest_bytes, &blobs)) {
+    return;
+  }
+  std::string target_chars = GetTarget(env, target);
+  if (env->ExceptionOccurred() || blobs.empty()) {
+    return;
+  }
+  Transfer transfer(target_chars, blobs, options);
+  transfer.Run(UploadBatch);
+  transfer.Report(env);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeCasTransfer
+ * Method:    download
+ * Signature: (Ljava/lang/String;[B[B[J[ZIIII)I
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_google_devtools_build_lib_unix_NativeCasTransfer_download(
+    JNIEnv *env, jclass clazz, jstring target, jbyteArray paths,
+    jbyteArray digests, jlongArray sizes, jbooleanArray executable,
+    jint max_batch_inputs, jint max_batch_size_bytes, jint streams,
+    jint timeout_seconds) {
+  // The chunk size is the server's choice.
+  TransferOptions options = {1, max_batch_inputs, max_batch_size_bytes,
+                             streams, timeout_seconds};
+  std::vector<char> path_bytes;
+  std::vector<jbyte> digest_bytes;
+  std::vector<Blob> blobs;
+  if (!GetBlobs(env, paths, digests, sizes, executable, options, &path_bytes,
+                &digest_bytes, &blobs)) {
+    return -1;
+  }
+  std::string target_chars = GetTarget(env, target);
+  if (env->ExceptionOccurred() || blobs.empty()) {
+    return -1;
+  }
+  Transfer transfer(target_chars, blobs, options);
+  transfer.Run(DownloadBatch);
+  return transfer.Report(env);
+}
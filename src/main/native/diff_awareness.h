@@ -0,0 +1,28 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// INTERNAL header file for use by C++ code in this package: what the native
+// file watchers behind the DiffAwareness implementations share.
+
+#ifndef BAZEL_SRC_MAIN_NATIVE_DIFF_AWARENESS_H__
+#define BAZEL_SRC_MAIN_NATIVE_DIFF_AWARENESS_H__
+
+#include <stddef.h>
+
+// Beyond this many changed paths between two polls, looking at every file
+// again is about as cheap as invalidating them one by one, so a watcher
+// reports an overflow instead.
+const size_t kMaxChangedPaths = 1 << 20;
+
+#endif  // BAZEL_SRC_MAIN_NATIVE_DIFF_AWARENESS_H__
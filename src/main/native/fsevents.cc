@@ -15,8 +15,45 @@
 #include <jni.h>
 #include <pthread.h>
 #include <stdlib.h>
-#include <list>
+#include <sys/stat.h>
 #include <string>
+#include <unordered_set>
+
+#include "src/main/native/diff_awareness.h"
+
+namespace {
+
+// The events after which the changes below a path are not known one by one:
+// the stream or the kernel dropped some, a directory has to be scanned again
+// as a whole, or a root was moved.
+const FSEventStreamEventFlags kOverflowFlags =
+    kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagUserDropped |
+    kFSEventStreamEventFlagKernelDropped | kFSEventStreamEventFlagRootChanged;
+
+// The longest a replay of the history may take.
+const CFTimeInterval kHistoryTimeout = 60;
+
+// Creates a CFArrayRef of CFStringRef from the Java array of String 'paths'.
+CFArrayRef CreatePathArray(JNIEnv *env, jobjectArray paths) {
+  jsize length = env->GetArrayLength(paths);
+  CFStringRef *pathsArray = new CFStringRef[length];
+  for (int i = 0; i < length; i++) {
+    jstring path = (jstring)env->GetObjectArrayElement(paths, i);
+    const char *pathCStr = env->GetStringUTFChars(path, NULL);
+    pathsArray[i] =
+        CFStringCreateWithCString(NULL, pathCStr, kCFStringEncodingUTF8);
+    env->ReleaseStringUTFChars(path, pathCStr);
+  }
+  CFArrayRef result = CFArrayCreate(NULL, (const void **)pathsArray, length,
+                                    &kCFTypeArrayCallBacks);
+  for (int i = 0; i < length; i++) {
+    CFRelease(pathsArray[i]);
+  }
+  delete[] pathsArray;
+  return result;
+}
+
+}  // namespace
 
 // A structure to pass around the FSEvents info and the list of paths.
 struct JNIEventsDiffAwareness {
@@ -24,14 +61,18 @@ struct JNIEventsDiffAwareness {
   CFRunLoopRef runLoop;
   // FSEvents stream reference (reference to the listened stream)
   FSEventStreamRef stream;
-  // List of paths that have been changed since last polling
-  std::list<std::string> paths;
-  // Mutex to protect concurrent access of paths.
-  // FsEventsDiffAwarenessCallback fill that list which is emptied
+  // Mutex to protect concurrent access of the fields below.
+  // FsEventsDiffAwarenessCallback fills the paths which are emptied
   // by the MacOSXEventsDiffAwareness#poll() method.
   // The former is called inside the FsEvents run loop and the latter
   // from Java threads.
   pthread_mutex_t mutex;
+  // The paths that have been changed since last polling. A path changes
+  // many times during a large checkout, but is reported once.
+  std::unordered_set<std::string> paths;
+  // Whether changes may have been missed, so that everything has to be
+  // looked at again.
+  bool overflow;
 };
 
 // Callback called when an event is reported by the FSEvents API
@@ -53,8 +94,18 @@ void FsEventsDiffAwarenessCallback(ConstFSEventStreamRef streamRef,
   JNIEventsDiffAwareness *info =
       static_cast<JNIEventsDiffAwareness *>(clientCallBackInfo);
   pthread_mutex_lock(&(info->mutex));
-  for (int i = 0; i < numEvents; i++) {
-    info->paths.push_back(std::string(paths[i]));
+  // Reporting a directory alone would not invalidate what is below it, so
+  // after an event that stands for a whole subtree, everything is.
+  for (size_t i = 0; i < numEvents && !info->overflow; i++) {
+    if (eventFlags[i] & kOverflowFlags) {
+      info->overflow = true;
+    } else {
+      info->paths.insert(std::string(paths[i]));
+      info->overflow = info->paths.size() > kMaxChangedPaths;
+    }
+  }
+  if (info->overflow) {
+    info->paths.clear();
   }
   pthread_mutex_unlock(&(info->mutex));
 }
@@ -65,6 +116,8 @@ Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsDiffAwareness_create(
     jdouble latency) {
   // Create a FSEventStreamContext to pass around (env, fsEventsDiffAwareness)
   JNIEventsDiffAwareness *info = new JNIEventsDiffAwareness;
+  pthread_mutex_init(&info->mutex, NULL);
+  info->overflow = false;
 
   FSEventStreamContext context;
   context.version = 0;
@@ -73,23 +126,14 @@ Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsDiffAwareness_create(
   context.release = NULL;
   context.copyDescription = NULL;
 
-  // Create an CFArrayRef of CFStringRef from the Java array of String
-  jsize length = env->GetArrayLength(paths);
-  CFStringRef *pathsArray = new CFStringRef[length];
-  for (int i = 0; i < length; i++) {
-    jstring path = (jstring)env->GetObjectArrayElement(paths, i);
-    const char *pathCStr = env->GetStringUTFChars(path, NULL);
-    pathsArray[i] =
-        CFStringCreateWithCString(NULL, pathCStr, kCFStringEncodingUTF8);
-    env->ReleaseStringUTFChars(path, pathCStr);
-  }
-  CFArrayRef pathsToWatch =
-      CFArrayCreate(NULL, (const void **)pathsArray, 1, NULL);
-  delete[] pathsArray;
+  // All the roots are watched by the one stream.
+  CFArrayRef pathsToWatch = CreatePathArray(env, paths);
   info->stream = FSEventStreamCreate(
       NULL, &FsEventsDiffAwarenessCallback, &context, pathsToWatch,
       kFSEventStreamEventIdSinceNow, static_cast<CFAbsoluteTime>(latency),
-      kFSEventStreamCreateFlagNoDefer | kFSEventStreamCreateFlagFileEvents);
+      kFSEventStreamCreateFlagNoDefer | kFSEventStreamCreateFlagFileEvents |
+          kFSEventStreamCreateFlagWatchRoot);
+  CFRelease(pathsToWatch);
 
   // Save the info pointer to FSEventsDiffAwareness#nativePointer
   jbyteArray array = env->NewByteArray(sizeof(info));
@@ -123,13 +167,19 @@ Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsDiffAwareness_poll(
     JNIEnv *env, jobject fsEventsDiffAwareness) {
   JNIEventsDiffAwareness *info = GetInfo(env, fsEventsDiffAwareness);
   pthread_mutex_lock(&(info->mutex));
+  if (info->overflow) {
+    pthread_mutex_unlock(&(info->mutex));
+    return NULL;
+  }
 
   jclass classString = env->FindClass("java/lang/String");
   jobjectArray result =
       env->NewObjectArray(info->paths.size(), classString, NULL);
   int i = 0;
   for (auto it = info->paths.begin(); it != info->paths.end(); it++, i++) {
-    env->SetObjectArrayElement(result, i, env->NewStringUTF(it->c_str()));
+    jstring path = env->NewStringUTF(it->c_str());
+    env->SetObjectArrayElement(result, i, path);
+    env->DeleteLocalRef(path);
   }
   info->paths.clear();
   pthread_mutex_unlock(&(info->mutex));
@@ -146,5 +196,136 @@ Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsDiffAwareness_doClose(
                                      kCFRunLoopDefaultMode);
   FSEventStreamInvalidate(info->stream);
   FSEventStreamRelease(info->stream);
+  pthread_mutex_destroy(&info->mutex);
   delete info;
 }
+
+// The changes a replay of the history reported, up to the end of the history.
+struct JNIEventsHistory {
+  std::unordered_set<std::string> paths;
+  // Whether the changes cannot be told one by one: the history of the volume
+  // does not go back that far, or events were dropped.
+  bool overflow;
+  // Whether the history has been replayed up to the present.
+  bool done;
+};
+
+void FsEventsHistoryCallback(ConstFSEventStreamRef streamRef,
+                             void *clientCallBackInfo, size_t numEvents,
+                             void *eventPaths,
+                             const FSEventStreamEventFlags eventFlags[],
+                             const FSEventStreamEventId eventIds[]) {
+  char **paths = static_cast<char **>(eventPaths);
+  JNIEventsHistory *history =
+      static_cast<JNIEventsHistory *>(clientCallBackInfo);
+  for (size_t i = 0; i < numEvents; i++) {
+    if (eventFlags[i] & kFSEventStreamEventFlagHistoryDone) {
+      history->done = true;
+    } else if (eventFlags[i] &
+               (kOverflowFlags | kFSEventStreamEventFlagEventIdsWrapped)) {
+      history->overflow = true;
+    } else if (!history->overflow) {
+      history->paths.insert(std::string(paths[i]));
+      history->overflow = history->paths.size() > kMaxChangedPaths;
+    }
+  }
+  if (history->overflow) {
+    history->paths.clear();
+  }
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsHistory_volumeUuid(
+    JNIEnv *env, jclass clazz, jstring path) {
+  const char *pathCStr = env->GetStringUTFChars(path, NULL);
+  struct stat st;
+  int stat_result = stat(pathCStr, &st);
+  env->ReleaseStringUTFChars(path, pathCStr);
+  if (stat_result != 0) {
+    return NULL;
+  }
+  // There is none for a volume without a history, e.g. a read-only one.
+  CFUUIDRef uuid = FSEventsCopyUUIDForDevice(st.st_dev);
+  if (uuid == NULL) {
+    return NULL;
+  }
+  CFStringRef uuidString = CFUUIDCreateString(NULL, uuid);
+  CFRelease(uuid);
+  char buffer[64];
+  bool converted = CFStringGetCString(uuidString, buffer, sizeof(buffer),
+                                      kCFStringEncodingUTF8);
+  CFRelease(uuidString);
+  return converted ? env->NewStringUTF(buffer) : NULL;
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsHistory_currentEventId(
+    JNIEnv *env, jclass clazz) {
+  return static_cast<jlong>(FSEventsGetCurrentEventId());
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_google_devtools_build_lib_skyframe_MacOSXFsEventsHistory_changesSince(
+    JNIEnv *env, jclass clazz, jobjectArray paths, jlong eventId,
+    jobjectArray errorHolder) {
+  JNIEventsHistory history;
+  history.overflow = false;
+  history.done = false;
+
+  FSEventStreamContext context;
+  context.version = 0;
+  context.info = static_cast<void *>(&history);
+  context.retain = NULL;
+  context.release = NULL;
+  context.copyDescription = NULL;
+
+  CFArrayRef pathsToWatch = CreatePathArray(env, paths);
+  FSEventStreamRef stream = FSEventStreamCreate(
+      NULL, &FsEventsHistoryCallback, &context, pathsToWatch,
+      static_cast<FSEventStreamEventId>(eventId), 0,
+      kFSEventStreamCreateFlagNoDefer | kFSEventStreamCreateFlagFileEvents);
+  CFRelease(pathsToWatch);
+
+  // The events are delivered on the run loop of this thread, until the one
+  // that says the history is done.
+  CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+  FSEventStreamScheduleWithRunLoop(stream, runLoop, kCFRunLoopDefaultMode);
+  const char *error = NULL;
+  if (!FSEventStreamStart(stream)) {
+    error = "Cannot start an FSEvents stream";
+  } else {
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + kHistoryTimeout;
+    while (!history.done && !history.overflow &&
+           CFAbsoluteTimeGetCurrent() < deadline) {
+      CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1, true);
+    }
+    FSEventStreamStop(stream);
+    if (history.overflow) {
+      error = "The FSEvents history does not tell the changes one by one";
+    } else if (!history.done) {
+      error = "Timed out replaying the FSEvents history";
+    }
+  }
+  FSEventStreamUnscheduleFromRunLoop(stream, runLoop, kCFRunLoopDefaultMode);
+  FSEventStreamInvalidate(stream);
+  FSEventStreamRelease(stream);
+
+  if (error != NULL) {
+    if (errorHolder != NULL && env->GetArrayLength(errorHolder) > 0) {
+      jstring errorMsg = env->NewStringUTF(error);
+      env->SetObjectArrayElement(errorHolder, 0, errorMsg);
+    }
+    return NULL;
+  }
+
+  jclass classString = env->FindClass("java/lang/String");
+  jobjectArray result =
+      env->NewObjectArray(history.paths.size(), classString, NULL);
+  int i = 0;
+  for (auto it = history.paths.begin(); it != history.paths.end(); it++, i++) {
+    jstring path = env->NewStringUTF(it->c_str());
+    env->SetObjectArrayElement(result, i, path);
+    env->DeleteLocalRef(path);
+  }
+  return result;
+}
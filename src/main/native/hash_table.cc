@@ -0,0 +1,817 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A persistent hash table from byte string keys to fixed-size values, for
+// com.google.devtools.build.lib.unix.NativeHashTable.
+//
+// The table lives in two memory-mapped files, so that opening it costs
+// nothing however many entries it has, and its entries stay off the Java
+// heap:
+//
+//   <path>             a header page, then an open-addressing table of
+//                      fixed-size slots, probed linearly;
+//   <path>.log.<gen>   the keys, appended to as new keys are put, and
+//                      never written in place.
+//
+// A slot holds the hash of its key, the offset and length of the key in the
+// log, a checksum and the value. A new key is appended to the log before its
+// slot is filled in, and the hash of the slot is written last, so a process
+// that dies in the middle of a put leaves either an empty slot or a complete
+// one. A value overwritten in place, or a write the kernel did not get to
+// disk before the machine went down, may leave a torn slot; the checksums
+// catch those when the table is opened after an unclean close, and the
+// slots are dropped. This is a cache: losing an entry only costs the work
+// of computing it again.
+//
+// Growing the table (or dropping its tombstones) writes a new table and a
+// new log next to the old ones, and renames the new table over the old one.
+
+#include "src/main/native/unix_jni.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <jni.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>  // NOLINT
+#include <string>
+#include <utility>
+
+namespace {
+
+const char kMagic[8] = {'B', 'Z', 'L', 'H', 'T', 'A', 'B', '\0'};
+const uint32_t kVersion = 1;
+
+// The header takes the first page of the table file, the slots follow.
+const size_t kHeaderSize = 4096;
+// The hash, key offset, key length and checksum of a slot, then the value,
+// padded to a multiple of 8 bytes.
+const size_t kSlotHeaderSize = 24;
+const uint64_t kInitialCapacity = 1024;
+const size_t kInitialLogSize = 1 << 20;
+
+// The hash of an empty slot, and that of a slot whose entry was removed,
+// which probing goes past. The hashes of keys are never either.
+const uint64_t kEmpty = 0;
+const uint64_t kTombstone = 1;
+
+// When to write the table to disk. Keep in sync with
+// NativeHashTable.SyncPolicy.
+enum SyncPolicy {
+  // Only when the kernel gets to it; the process may still die at any time.
+  SYNC_NEVER = 0,
+  // When the table is closed, and on sync().
+  SYNC_ON_CLOSE = 1,
+  // After every put and remove.
+  SYNC_ALWAYS = 2,
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t value_size;
+  uint64_t capacity;  // the number of slots, a power of 2
+  uint64_t log_generation;
+  uint64_t log_end;  // the end of the last key of the log
+  uint64_t count;
+  uint64_t tombstones;
+  // Whether the table was closed cleanly, so that it need not be checked.
+  uint32_t clean;
+};
+
+struct Slot {
+  uint64_t hash;
+  uint64_t key_offset;
+  uint32_t key_length;
+  uint32_t checksum;
+};
+
+uint64_t HashKey(const uint8_t *key, size_t length) {
+  // FNV-1a, then the finalizer of MurmurHash3, so that the low bits the
+  // table is indexed with depend on every byte.
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ key[i]) * 0x100000001b3ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash <= kTombstone ? hash + 2 : hash;
+}
+
+uint32_t Checksum(const Slot *slot, const uint8_t *value, size_t value_size) {
+  uint32_t sum = 0x811c9dc5;
+  const uint8_t *fields = reinterpret_cast<const uint8_t *>(slot);
+  for (size_t i = 0; i < offsetof(Slot, checksum); ++i) {
+    sum = (sum ^ fields[i]) * 0x01000193;
+  }
+  for (size_t i = 0; i < value_size; ++i) {
+    sum = (sum ^ value[i]) * 0x01000193;
+  }
+  return sum;
+}
+
+// Runs msync(MS_SYNC) on the pages the 'size' bytes at 'address' span.
+int SyncRange(const void *address, size_t size) {
+  static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t start = reinterpret_cast<uintptr_t>(address) & ~(page_size - 1);
+  uintptr_t end = reinterpret_cast<uintptr_t>(address) + size;
+  return msync(reinterpret_cast<void *>(start), end - start, MS_SYNC);
+}
+
+// Maps 'size' bytes of 'fd', or returns NULL (and sets errno).
+uint8_t *Map(int fd, size_t size) {
+  void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  return mapped == MAP_FAILED ? NULL : static_cast<uint8_t *>(mapped);
+}
+
+// A table open in this process. Every method returns zero on success, or
+// -1 (and sets errno) otherwise, unless it says differently.
+class HashTable {
+ public:
+  HashTable(const std::string &path, uint32_t value_size, int sync_policy)
+      : path_(path),
+        value_size_(value_size),
+        slot_size_(kSlotHeaderSize + ((value_size + 7) & ~7)),
+        sync_policy_(sync_policy),
+        table_fd_(-1),
+        table_(NULL),
+        table_size_(0),
+        log_fd_(-1),
+        log_(NULL),
+        log_size_(0) {}
+
+  ~HashTable() { Unmap(); }
+
+  // Opens the table at path_, or creates it. Fails with EINVAL if the file
+  // is not a table with values of value_size_ bytes.
+  int Open();
+
+  // Writes the table to disk if the policy says so, marks it clean, and
+  // unmaps it.
+  int Close();
+
+  // Copies the value of 'key' to 'value' and returns 1, or returns 0 if the
+  // table does not have the key.
+  int Get(const uint8_t *key, size_t length, uint8_t *value);
+
+  int Put(const uint8_t *key, size_t length, const uint8_t *value);
+
+  // Returns 1 if the table had the key, 0 otherwise.
+  int Remove(const uint8_t *key, size_t length);
+
+  // Writes the table to disk.
+  int Sync();
+
+  uint64_t Size() const { return header()->count; }
+  uint64_t Capacity() const { return header()->capacity; }
+
+  // Copies the entries from slot 'cursor' on to 'out' while they fit in
+  // 'capacity' bytes, each as the key length (a native int), the key and
+  // the value, followed by a key length of -1. Returns the slot to continue
+  // from, which is the capacity of the table once the whole table has been
+  // copied. Fails with ENOBUFS if not even the first entry fits.
+  int64_t Scan(int64_t cursor, uint8_t *out, size_t capacity);
+
+  std::mutex mu_;
+
+ private:
+  Header *header() const { return reinterpret_cast<Header *>(table_); }
+  Slot *slot(uint64_t i) const {
+    return reinterpret_cast<Slot *>(table_ + kHeaderSize + i * slot_size_);
+  }
+  uint8_t *value(Slot *s) const {
+    return reinterpret_cast<uint8_t *>(s) + kSlotHeaderSize;
+  }
+  const uint8_t *key(const Slot *s) const {
+    return log_ + s->key_offset + sizeof(uint32_t);
+  }
+  std::string LogPath(uint64_t generation) const {
+    return path_ + ".log." + std::to_string(generation);
+  }
+
+  int Create();
+  int MapLog(uint64_t generation, bool create);
+  // Drops the slots a crash left torn, and recounts the entries.
+  void Recover();
+  // Finds the slot of 'key', or the slot to put it in: the first tombstone
+  // on the way, or the empty slot that ends the probe.
+  Slot *Find(const uint8_t *key, size_t length, uint64_t hash, bool *found);
+  // Appends 'key' to the log, and returns its offset in *offset.
+  int AppendKey(const uint8_t *key, size_t length, uint64_t *offset);
+  // Writes the table and log to 'capacity' slots in the next generation.
+  int Rehash(uint64_t capacity);
+  int SyncSlot(Slot *s);
+  void Unmap();
+
+  const std::string path_;
+  const uint32_t value_size_;
+  const size_t slot_size_;
+  const int sync_policy_;
+  int table_fd_;
+  uint8_t *table_;
+  size_t table_size_;
+  int log_fd_;
+  uint8_t *log_;
+  size_t log_size_;
+};
+
+int HashTable::Open() {
+  // A leftover of a rehash that did not finish.
+  unlink((path_ + ".tmp").c_str());
+  table_fd_ = open(path_.c_str(), O_RDWR | O_CLOEXEC);
+  if (table_fd_ == -1) {
+    return errno == ENOENT ? Create() : -1;
+  }
+  struct stat statbuf;
+  if (fstat(table_fd_, &statbuf) == -1) {
+    return -1;
+  }
+  table_size_ = statbuf.st_size;
+  if (table_size_ < kHeaderSize) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((table_ = Map(table_fd_, table_size_)) == NULL) {
+    return -1;
+  }
+  Header *h = header();
+  if (memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 ||
+      h->version != kVersion || h->value_size != value_size_ ||
+      h->capacity == 0 || (h->capacity & (h->capacity - 1)) != 0 ||
+      table_size_ != kHeaderSize + h->capacity * slot_size_) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (MapLog(h->log_generation, false) == -1) {
+    return -1;
+  }
+  if (!h->clean) {
+    Recover();
+  }
+  // Until Close(), a crash leaves the table to be checked. This must reach
+  // the disk before any slot written from now on.
+  h->clean = 0;
+  return SyncRange(table_, sizeof(Header));
+}
+
+int HashTable::Create() {
+  std::string temp = path_ + ".tmp";
+  table_fd_ = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (table_fd_ == -1) {
+    return -1;
+  }
+  table_size_ = kHeaderSize + kInitialCapacity * slot_size_;
+  if (ftruncate(table_fd_, table_size_) == -1 ||
+      (table_ = Map(table_fd_, table_size_)) == NULL ||
+      MapLog(0, true) == -1) {
+    return -1;
+  }
+  Header *h = header();
+  memcpy(h->magic, kMagic, sizeof(kMagic));
+  h->version = kVersion;
+  h->value_size = value_size_;
+  h->capacity = kInitialCapacity;
+  h->log_generation = 0;
+  h->log_end = 0;
+  h->count = 0;
+  h->tombstones = 0;
+  h->clean = 0;
+  if (SyncRange(table_, sizeof(Header)) == -1 ||
+      rename(temp.c_str(), path_.c_str()) == -1) {
+    return -1;
+  }
+  return 0;
+}
+
+int HashTable::MapLog(uint64_t generation, bool create) {
+  int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0);
+  log_fd_ = open(LogPath(generation).c_str(), flags, 0644);
+  if (log_fd_ == -1) {
+    return -1;
+  }
+  struct stat statbuf;
+  if (fstat(log_fd_, &statbuf) == -1) {
+    return -1;
+  }
+  log_size_ = statbuf.st_size;
+  if (log_size_ < kInitialLogSize) {
+    log_size_ = kInitialLogSize;
+    if (ftruncate(log_fd_, log_size_) == -1) {
+      return -1;
+    }
+  }
+  return (log_ = Map(log_fd_, log_size_)) == NULL ? -1 : 0;
+}
+
+void HashTable::Recover() {
+  Header *h = header();
+  uint64_t count = 0;
+  uint64_t tombstones = 0;
+  uint64_t log_end = 0;
+  for (uint64_t i = 0; i < h->capacity; ++i) {
+    Slot *s = slot(i);
+    if (s->hash == kEmpty) {
+      continue;
+    }
+    uint32_t logged_length = 0;
+    bool valid =
+        s->hash != kTombstone && s->key_offset < log_size_ &&
+        log_size_ - s->key_offset >= sizeof(uint32_t) + s->key_length &&
+        s->checksum == Checksum(s, value(s), value_size_);
+    if (valid) {
+      memcpy(&logged_length, log_ + s->key_offset, sizeof(logged_length));
+      valid = logged_length == s->key_length &&
+              HashKey(key(s), s->key_length) == s->hash;
+    }
+    if (valid) {
+      ++count;
+      log_end = std::max<uint64_t>(
+          log_end, s->key_offset + sizeof(uint32_t) + s->key_length);
+    } else {
+      s->hash = kTombstone;
+      ++tombstones;
+    }
+  }
+  h->count = count;
+  h->tombstones = tombstones;
+  // Keys past the last one a slot refers to are garbage from puts that did
+  // not finish.
+  h->log_end = log_end;
+}
+
+Slot *HashTable::Find(const uint8_t *key, size_t length, uint64_t hash,
+                      bool *found) {
+  uint64_t mask = header()->capacity - 1;
+  Slot *tombstone = NULL;
+  for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+    Slot *s = slot(i);
+    if (s->hash == kEmpty) {
+      *found = false;
+      return tombstone != NULL ? tombstone : s;
+    } else if (s->hash == kTombstone) {
+      if (tombstone == NULL) {
+        tombstone = s;
+      }
+    } else if (s->hash == hash && s->key_length == length &&
+               memcmp(this->key(s), key, length) == 0) {
+      *found = true;
+      return s;
+    }
+  }
+}
+
+int HashTable::AppendKey(const uint8_t *key, size_t length,
+                         uint64_t *offset) {
+  Header *h = header();
+  uint64_t end = h->log_end + sizeof(uint32_t) + length;
+  if (end > log_size_) {
+    size_t size = log_size_;
+    while (size < end) {
+      size *= 2;
+    }
+    if (ftruncate(log_fd_, size) == -1) {
+      return -1;
+    }
+    munmap(log_, log_size_);
+    log_size_ = size;
+    if ((log_ = Map(log_fd_, log_size_)) == NULL) {
+      return -1;
+    }
+  }
+  uint32_t length32 = static_cast<uint32_t>(length);
+  memcpy(log_ + h->log_end, &length32, sizeof(length32));
+  memcpy(log_ + h->log_end + sizeof(length32), key, length);
+  if (sync_policy_ == SYNC_ALWAYS &&
+      SyncRange(log_ + h->log_end, end - h->log_end) == -1) {
+    return -1;
+  }
+  *offset = h->log_end;
+  h->log_end = end;
+  return 0;
+}
+
+int HashTable::SyncSlot(Slot *s) {
+  if (sync_policy_ != SYNC_ALWAYS) {
+    return 0;
+  }
+  if (SyncRange(s, slot_size_) == -1) {
+    return -1;
+  }
+  return SyncRange(table_, sizeof(Header));
+}
+
+int HashTable::Get(const uint8_t *key, size_t length, uint8_t *value) {
+  bool found;
+  Slot *s = Find(key, length, HashKey(key, length), &found);
+  if (found) {
+    memcpy(value, this->value(s), value_size_);
+  }
+  return found ? 1 : 0;
+}
+
+int HashTable::Put(const uint8_t *key, size_t length, const uint8_t *value) {
+  if (length > UINT32_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  uint64_t hash = HashKey(key, length);
+  bool found;
+  Slot *s = Find(key, length, hash, &found);
+  if (found) {
+    memcpy(this->value(s), value, value_size_);
+    s->checksum = Checksum(s, this->value(s), value_size_);
+    return SyncSlot(s);
+  }
+
+  // Keep the table at most 70% full, counting the tombstones, which would
+  // otherwise make every probe for a missing key longer.
+  Header *h = header();
+  if ((h->count + h->tombstones + 1) * 10 > h->capacity * 7) {
+    uint64_t capacity = h->capacity;
+    while ((h->count + 1) * 10 > capacity * 5) {
+      capacity *= 2;
+    }
+    if (Rehash(capacity) == -1) {
+      return -1;
+    }
+    h = header();
+    s = Find(key, length, hash, &found);
+  }
+
+  uint64_t offset;
+  if (AppendKey(key, length, &offset) == -1) {
+    return -1;
+  }
+  if (s->hash == kTombstone) {
+    --h->tombstones;
+  }
+  // The hash goes last: until it is written, the slot is still empty (or a
+  // tombstone) to anyone who reads the table after a crash.
+  s->hash = kTombstone;
+  s->key_offset = offset;
+  s->key_length = static_cast<uint32_t>(length);
+  memcpy(this->value(s), value, value_size_);
+  Slot filled = *s;
+  filled.hash = hash;
+  s->checksum = Checksum(&filled, this->value(s), value_size_);
+  __atomic_store_n(&s->hash, hash, __ATOMIC_RELEASE);
+  ++h->count;
+  return SyncSlot(s);
+}
+
+int HashTable::Remove(const uint8_t *key, size_t length) {
+  bool found;
+  Slot *s = Find(key, length, HashKey(key, length), &found);
+  if (!found) {
+    return 0;
+  }
+  s->hash = kTombstone;
+  Header *h = header();
+  --h->count;
+  ++h->tombstones;
+  return SyncSlot(s) == -1 ? -1 : 1;
+}
+
+int HashTable::Rehash(uint64_t capacity) {
+  Header *old_header = header();
+  uint64_t generation = old_header->log_generation + 1;
+  HashTable next(path_, value_size_, SYNC_NEVER);
+  std::string temp = path_ + ".tmp";
+  next.table_fd_ =
+      open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (next.table_fd_ == -1) {
+    return -1;
+  }
+  next.table_size_ = kHeaderSize + capacity * slot_size_;
+  if (ftruncate(next.table_fd_, next.table_size_) == -1 ||
+      (next.table_ = Map(next.table_fd_, next.table_size_)) == NULL ||
+      next.MapLog(generation, true) == -1) {
+    unlink(temp.c_str());
+    return -1;
+  }
+  Header *h = next.header();
+  *h = *old_header;
+  h->capacity = capacity;
+  h->log_generation = generation;
+  h->log_end = 0;
+  h->count = 0;
+  h->tombstones = 0;
+  h->clean = 0;
+  for (uint64_t i = 0; i < old_header->capacity; ++i) {
+    Slot *s = slot(i);
+    if (s->hash == kEmpty || s->hash == kTombstone) {
+      continue;
+    }
+    bool found;
+    Slot *t = next.Find(key(s), s->key_length, s->hash, &found);
+    uint64_t offset;
+    if (next.AppendKey(key(s), s->key_length, &offset) == -1) {
+      unlink(temp.c_str());
+      return -1;
+    }
+    *t = *s;
+    t->key_offset = offset;
+    memcpy(next.value(t), value(s), value_size_);
+    t->checksum = Checksum(t, next.value(t), value_size_);
+    ++h->count;
+  }
+  // The new table must be complete on disk before it replaces the old one.
+  if (msync(next.log_, next.log_size_, MS_SYNC) == -1 ||
+      msync(next.table_, next.table_size_, MS_SYNC) == -1 ||
+      rename(temp.c_str(), path_.c_str()) == -1) {
+    unlink(temp.c_str());
+    return -1;
+  }
+  unlink(LogPath(old_header->log_generation).c_str());
+  Unmap();
+  std::swap(table_fd_, next.table_fd_);
+  std::swap(table_, next.table_);
+  std::swap(table_size_, next.table_size_);
+  std::swap(log_fd_, next.log_fd_);
+  std::swap(log_, next.log_);
+  std::swap(log_size_, next.log_size_);
+  return 0;
+}
+
+int HashTable::Sync() {
+  if (msync(log_, log_size_, MS_SYNC) == -1) {
+    return -1;
+  }
+  return msync(table_, table_size_, MS_SYNC);
+}
+
+int HashTable::Close() {
+  if (sync_policy_ != SYNC_NEVER && Sync() == -1) {
+    return -1;
+  }
+  header()->clean = 1;
+  if (sync_policy_ != SYNC_NEVER && SyncRange(table_, sizeof(Header)) == -1) {
+    return -1;
+  }
+  Unmap();
+  return 0;
+}
+
+int64_t HashTable::Scan(int64_t cursor, uint8_t *out, size_t capacity) {
+  Header *h = header();
+  size_t used = 0;
+  // Leave room for the terminating key length.
+  size_t room = capacity < sizeof(int32_t) ? 0 : capacity - sizeof(int32_t);
+  uint64_t i = cursor < 0 ? 0 : cursor;
+  for (; i < h->capacity; ++i) {
+    Slot *s = slot(i);
+    if (s->hash == kEmpty || s->hash == kTombstone) {
+      continue;
+    }
+    size_t size = sizeof(int32_t) + s->key_length + value_size_;
+    if (used + size > room) {
+      if (used == 0) {
+        errno = ENOBUFS;
+        return -1;
+      }
+      break;
+    }
+    int32_t length = s->key_length;
+    memcpy(out + used, &length, sizeof(length));
+    memcpy(out + used + sizeof(length), key(s), s->key_length);
+    memcpy(out + used + sizeof(length) + s->key_length, value(s), value_size_);
+    used += size;
+  }
+  int32_t end = -1;
+  memcpy(out + used, &end, sizeof(end));
+  return i;
+}
+
+void HashTable::Unmap() {
+  if (table_ != NULL) {
+    munmap(table_, table_size_);
+    table_ = NULL;
+  }
+  if (log_ != NULL) {
+    munmap(log_, log_size_);
+    log_ = NULL;
+  }
+  if (table_fd_ != -1) {
+    close(table_fd_);
+    table_fd_ = -1;
+  }
+  if (log_fd_ != -1) {
+    close(log_fd_);
+    log_fd_ = -1;
+  }
+}
+
+HashTable *GetTable(jlong handle) {
+  return reinterpret_cast<HashTable *>(handle);
+}
+
+// Returns the address of 'offset' in the direct buffer 'buffer', or posts an
+// exception and returns NULL if it is not a direct buffer.
+uint8_t *BufferAddress(JNIEnv *env, jobject buffer, jint offset) {
+  void *address = env->GetDirectBufferAddress(buffer);
+  if (address == NULL) {
+    ::PostException(env, EINVAL, "not a direct buffer");
+    return NULL;
+  }
+  return static_cast<uint8_t *>(address) + offset;
+}
+
+}  // namespace
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeHashTable
+ * Method:    nativeOpen
+ * Signature: (Ljava/lang/String;II)J
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_unix_NativeHashTable_nativeOpen(
+    JNIEnv *env, jclass clazz, jstring path, jint value_size,
+    jint sync_policy) {
+  const char *path_chars = env->GetStringUTFChars(path, NULL);
+  if (path_chars == NULL) {
+    return 0;  // the exception is pending
+  }
+  HashTable *table = new HashTable(path_chars, value_size, sync_policy);
+  if (table->Open() == -1) {
+    int error = errno;
+    ::PostException(env, error,
+                    std::string(path_chars) + " (" + ErrorMessage(error) + ")");
+    delete table;
+    table = NULL;
+  }
+  env->ReleaseStringUTFChars(path, path_chars);
+  return reinterpret_cast<jlong>(table);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeHashTable
+ * Method:    nativeClose
+ * Signature: (J)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativeHashTable_nativeClose(
+    JNIEnv *env, jclass clazz, jlong handle) {
+  HashTable *table = GetTable(handle);
+  int r;
+  {
+    std::lock_guard<std::mutex> lock(table->mu_);
+    r = table->Close();
+  }
+  if (r == -1) {
+    ::PostSystemException(env, errno, "close");
+  }
+  delete table;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeHashTable
+ * Method:    nativeGet
+ * Signature: (JLjava/nio/ByteBuffer;IILjava/nio/ByteBuffer;I)Z
+ */
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_google_devtools_build_lib_unix_NativeHashTable_nativeGet(
+    JNIEnv *env, jclass clazz, jlong handle, jobject key, jint key_offset,
+    jint key_length, jobject value, jint value_offset) {
+  uint8_t *key_address = BufferAddress(env, key, key_offset);
+  uint8_t *value_address = BufferAddress(env, value, value_offset);
+  if (key_address == NULL || value_address == NULL) {
+    return false;
+  }
+  HashTable *table = GetTable(handle);
+  std::lock_guard<std::mutex> lock(table->mu_);
+  return table->Get(key_address, key_length, value_address) == 1;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeHashTable
+ * Method:    nativePut
+ * Signature: (JLjava/nio/ByteBuffer;IILjava/nio/ByteBuffer;I)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativeHashTable_nativePut(
+    JNIEnv *env, jclass clazz, jlong handle, jobject key, jint key_offset,
+    jint key_length, jobject value, jint value_offset) {
+  uint8_t *key_address = BufferAddress(env, key, key_offset);
+  uint8_t *value_address = BufferAddress(env, value, value_offset);
+  if (key_address == NULL || value_address == NULL) {
+    return;
+  }
+  HashTable *table = GetTable(handle);
+  int r;
+  {
+    std::lock_guard<std::mutex> lock(table->mu_);
+    r = table->Put(key_address, key_length, value_address);
+  }
+  if (r == -1) {
+    ::PostSystemException(env, errno, "put");
+  }
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeHashTable
+ * Method:    nativeRemove
+ * Signature: (JLjava/nio/ByteBuffer;II)Z
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_google_devtools_build_lib_unix_NativeHashTable_nativeRemove(
+    JNIEnv *env, jclass clazz, jlong handle, jobject key, jint key_offset,
+    jint key_length) {
+  uint8_t *key_address = BufferAddress(env, key, key_offset);
+  if (key_address == NULL) {
+    return false;
+  }
+  HashTable *table = GetTable(handle);
+  int r;
+  {
+    std::lock_guard<std::mutex> lock(table->mu_);
+    r = table->Remove(key_address, key_length);
+  }
+  if (r == -1) {
+    ::PostSystemException(env, errno, "remove");
+  }
+  return r == 1;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeHashTable
+ * Method:    nativeSize
+ * Signature: (J)J
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_unix_NativeHashTable_nativeSize(
+    JNIEnv *env, jclass clazz, jlong handle) {
+  HashTable *table = GetTable(handle);
+  std::lock_guard<std::mutex> lock(table->mu_);
+  return table->Size();
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeHashTable
+ * Method:    nativeSync
+ * Signature: (J)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativeHashTable_nativeSync(
+    JNIEnv *env, jclass clazz, jlong handle) {
+  HashTable *table = GetTable(handle);
+  int r;
+  {
+    std::lock_guard<std::mutex> lock(table->mu_);
+    r = table->Sync();
+  }
+  if (r == -1) {
+    ::PostSystemException(env, errno, "sync");
+  }
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeHashTable
+ * Method:    nativeScan
+ * Signature: (JJLjava/nio/ByteBuffer;I)J
+ * Returns the cursor to continue from, -1 at the end of the table, or -2 if
+ * the buffer is too small for the entry at the cursor.
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_unix_NativeHashTable_nativeScan(
+    JNIEnv *env, jclass clazz, jlong handle, jlong cursor, jobject buffer,
+    jint capacity) {
+  uint8_t *address = BufferAddress(env, buffer, 0);
+  if (address == NULL) {
+    return -1;
+  }
+  HashTable *table = GetTable(handle);
+  std::lock_guard<std::mutex> lock(table->mu_);
+  int64_t next = table->Scan(cursor, address, capacity);
+  if (next == -1) {
+    next = -2;
+  } else if (static_cast<uint64_t>(next) >= table->Capacity()) {
+    next = -1;
+  }
+  return next;
+}
@@ -0,0 +1,311 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <dirent.h>
+#include <errno.h>
+#include <jni.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "src/main/native/diff_awareness.h"
+
+namespace {
+
+// The events that change the contents or the metadata of a directory entry.
+// Directories are watched themselves rather than through their parents, so
+// symlinks to directories are not followed.
+const uint32_t kWatchMask = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                            IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM |
+                            IN_MOVED_TO | IN_DONT_FOLLOW | IN_EXCL_UNLINK |
+                            IN_ONLYDIR;
+
+// The state of a recursive inotify watch, shared by
+// LinuxInotifyDiffAwareness#run(), which reads the events, and the Java
+// threads calling #poll().
+struct JNIInotifyDiffAwareness {
+  int inotify_fd;
+  // Written to by #doClose() to stop #run().
+  int wakeup_pipe[2];
+  // The watched directory of each watch descriptor. Only used by #create()
+  // and, after it, #run().
+  std::unordered_map<int, std::string> watches;
+  int root_watch;
+
+  // Protects the fields below.
+  pthread_mutex_t mutex;
+  // The paths that changed since the last #poll().
+  std::unordered_set<std::string> paths;
+  // Whether changes may have been missed, so that everything has to be
+  // looked at again.
+  bool overflow;
+  bool closed;
+  // The Java object and #run() each hold a reference; the last one to let
+  // go frees the structure.
+  int references;
+};
+
+void Release(JNIInotifyDiffAwareness *info) {
+  pthread_mutex_lock(&info->mutex);
+  bool last = --info->references == 0;
+  pthread_mutex_unlock(&info->mutex);
+  if (last) {
+    close(info->inotify_fd);
+    close(info->wakeup_pipe[0]);
+    close(info->wakeup_pipe[1]);
+    pthread_mutex_destroy(&info->mutex);
+    delete info;
+  }
+}
+
+// Adds the path of a change. Called with info->mutex held.
+void AddPath(JNIInotifyDiffAwareness *info, const std::string &path) {
+  if (info->overflow) {
+    return;
+  }
+  info->paths.insert(path);
+  if (info->paths.size() > kMaxChangedPaths) {
+    info->overflow = true;
+    info->paths.clear();
+  }
+}
+
+// Watches 'dir' and the directories below it. The watch of a directory is
+// added before its entries are listed, so that an entry created meanwhile is
+// either listed or reported. If 'report' is true, every path found is added
+// to the changed paths: the directory is new, and what was created in it
+// before it was watched would otherwise be missed. Returns the watch
+// descriptor of 'dir', or -1 if it cannot be watched.
+int AddWatches(JNIInotifyDiffAwareness *info, const std::string &dir,
+               bool report) {
+  int wd = inotify_add_watch(info->inotify_fd, dir.c_str(), kWatchMask);
+  if (wd < 0) {
+    if (errno == ENOSPC || errno == ENOMEM) {
+      // Out of watches (fs.inotify.max_user_watches).
+      pthread_mutex_lock(&info->mutex);
+      info->overflow = true;
+      pthread_mutex_unlock(&info->mutex);
+    }
+    // Otherwise the directory is gone already, or not accessible.
+    return -1;
+  }
+  // Re-adding a directory moved within the tree updates its path.
+  info->watches[wd] = dir;
+
+  DIR *entries = opendir(dir.c_str());
+  if (entries == NULL) {
+    return wd;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(entries)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    std::string path = dir + "/" + entry->d_name;
+    if (report) {
+      pthread_mutex_lock(&info->mutex);
+      AddPath(info, path);
+      pthread_mutex_unlock(&info->mutex);
+    }
+    bool is_dir = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat statbuf;
+      is_dir = lstat(path.c_str(), &statbuf) == 0 && S_ISDIR(statbuf.st_mode);
+    }
+    if (is_dir) {
+      AddWatches(info, path, report);
+    }
+  }
+  closedir(entries);
+  return wd;
+}
+
+// Stops watching 'dir' and the directories below it, which were moved away.
+void RemoveWatches(JNIInotifyDiffAwareness *info, const std::string &dir) {
+  std::string prefix = dir + "/";
+  for (auto it = info->watches.begin(); it != info->watches.end();) {
+    if (it->second == dir || it->second.compare(0, prefix.size(), prefix) == 0) {
+      inotify_rm_watch(info->inotify_fd, it->first);
+      it = info->watches.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void HandleEvent(JNIInotifyDiffAwareness *info,
+                 const struct inotify_event *event) {
+  if (event->mask & IN_Q_OVERFLOW) {
+    pthread_mutex_lock(&info->mutex);
+    info->overflow = true;
+    pthread_mutex_unlock(&info->mutex);
+    return;
+  }
+  auto watch = info->watches.find(event->wd);
+  if (watch == info->watches.end()) {
+    return;
+  }
+  if (event->wd == info->root_watch &&
+      (event->mask & (IN_IGNORED | IN_MOVE_SELF))) {
+    // The root itself went away.
+    pthread_mutex_lock(&info->mutex);
+    info->overflow = true;
+    pthread_mutex_unlock(&info->mutex);
+    return;
+  }
+  if (event->mask & IN_IGNORED) {
+    info->watches.erase(watch);
+    return;
+  }
+  if (event->len == 0) {
+    // An event on the directory itself, which its parent reports, too.
+    return;
+  }
+
+  std::string path = watch->second + "/" + event->name;
+  pthread_mutex_lock(&info->mutex);
+  AddPath(info, path);
+  pthread_mutex_unlock(&info->mutex);
+  if (event->mask & IN_ISDIR) {
+    if (event->mask & IN_MOVED_FROM) {
+      RemoveWatches(info, path);
+    } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+      AddWatches(info, path, true);
+    }
+  }
+}
+
+}  // namespace
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_LinuxInotifyDiffAwareness_create(
+    JNIEnv *env, jobject diffAwareness, jstring root) {
+  JNIInotifyDiffAwareness *info = new JNIInotifyDiffAwareness;
+  info->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (pipe(info->wakeup_pipe) < 0) {
+    info->wakeup_pipe[0] = info->wakeup_pipe[1] = -1;
+  }
+  pthread_mutex_init(&info->mutex, NULL);
+  info->overflow = info->inotify_fd < 0 || info->wakeup_pipe[0] < 0;
+  info->closed = false;
+  info->references = 2;
+  info->root_watch = -1;
+
+  const char *root_chars = env->GetStringUTFChars(root, NULL);
+  std::string root_path(root_chars);
+  env->ReleaseStringUTFChars(root, root_chars);
+  if (!info->overflow) {
+    info->root_watch = AddWatches(info, root_path, false);
+    if (info->root_watch < 0) {
+      info->overflow = true;
+    }
+  }
+
+  jclass clazz = env->GetObjectClass(diffAwareness);
+  jfieldID fid = env->GetFieldID(clazz, "nativePointer", "J");
+  env->SetLongField(diffAwareness, fid, reinterpret_cast<jlong>(info));
+}
+
+static JNIInotifyDiffAwareness *GetInfo(JNIEnv *env, jobject diffAwareness) {
+  jclass clazz = env->GetObjectClass(diffAwareness);
+  jfieldID fid = env->GetFieldID(clazz, "nativePointer", "J");
+  jlong field = env->GetLongField(diffAwareness, fid);
+  return reinterpret_cast<JNIInotifyDiffAwareness *>(field);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_LinuxInotifyDiffAwareness_run(
+    JNIEnv *env, jobject diffAwareness) {
+  JNIInotifyDiffAwareness *info = GetInfo(env, diffAwareness);
+  // Events are read as they come rather than when polled, so that the kernel
+  // queue (fs.inotify.max_queued_events) does not overflow between builds.
+  alignas(struct inotify_event) char buffer[64 * 1024];
+  while (info->inotify_fd >= 0 && info->wakeup_pipe[0] >= 0) {
+    pthread_mutex_lock(&info->mutex);
+    bool closed = info->closed;
+    pthread_mutex_unlock(&info->mutex);
+    if (closed) {
+      break;
+    }
+
+    struct pollfd fds[2] = {{info->inotify_fd, POLLIN, 0},
+                            {info->wakeup_pipe[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[1].revents != 0) {
+      break;
+    }
+    ssize_t size;
+    while ((size = read(info->inotify_fd, buffer, sizeof(buffer))) > 0) {
+      for (char *p = buffer; p < buffer + size;) {
+        const struct inotify_event *event =
+            reinterpret_cast<const struct inotify_event *>(p);
+        HandleEvent(info, event);
+        p += sizeof(struct inotify_event) + event->len;
+      }
+    }
+  }
+  Release(info);
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_google_devtools_build_lib_skyframe_LinuxInotifyDiffAwareness_poll(
+    JNIEnv *env, jobject diffAwareness) {
+  JNIInotifyDiffAwareness *info = GetInfo(env, diffAwareness);
+  pthread_mutex_lock(&info->mutex);
+  if (info->overflow) {
+    pthread_mutex_unlock(&info->mutex);
+    return NULL;
+  }
+
+  jclass classString = env->FindClass("java/lang/String");
+  jobjectArray result =
+      env->NewObjectArray(info->paths.size(), classString, NULL);
+  int i = 0;
+  for (auto it = info->paths.begin(); it != info->paths.end(); it++, i++) {
+    jstring path = env->NewStringUTF(it->c_str());
+    env->SetObjectArrayElement(result, i, path);
+    env->DeleteLocalRef(path);
+  }
+  info->paths.clear();
+  pthread_mutex_unlock(&info->mutex);
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_LinuxInotifyDiffAwareness_doClose(
+    JNIEnv *env, jobject diffAwareness) {
+  JNIInotifyDiffAwareness *info = GetInfo(env, diffAwareness);
+  pthread_mutex_lock(&info->mutex);
+  info->closed = true;
+  pthread_mutex_unlock(&info->mutex);
+  if (info->wakeup_pipe[1] >= 0) {
+    char c = 0;
+    if (write(info->wakeup_pipe[1], &c, 1) < 0) {
+      // #run() then still stops at its next event.
+    }
+  }
+  Release(info);
+}
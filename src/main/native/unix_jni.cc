@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
@@ -26,17 +27,29 @@
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "src/main/native/macros.h"
 #include "src/main/cpp/util/md5.h"
+#include "src/main/cpp/util/sha1.h"
+#include "src/main/cpp/util/sha256.h"
 #include "src/main/cpp/util/port.h"
+#include "src/tools/singlejar/input_jar.h"
 
 using blaze_util::Md5Digest;
+using blaze_util::Sha1Digest;
+using blaze_util::Sha256Digest;
 
 ////////////////////////////////////////////////////////////////////////
 // Latin1 <--> java.lang.String conversion functions.
@@ -115,6 +128,45 @@ static void ReleaseStringLatin1Chars(const char *s) {
   }
 }
 
+namespace {
+/**
+ * The first 'length' bytes of a byte[] the Java side encoded a path into, as
+ * a nul-terminated string. Unlike GetStringLatin1Chars, this costs one copy,
+ * into a buffer on the stack unless the path is long, and no malloc.
+ */
+class BytePath {
+ public:
+  BytePath(JNIEnv *env, jbyteArray path, jint length) : chars_(buffer_) {
+    if (length < 0 || length > env->GetArrayLength(path)) {
+      ::PostException(env, EINVAL, "Path length out of bounds");
+      chars_ = NULL;
+      return;
+    }
+    if (static_cast<size_t>(length) >= sizeof(buffer_)) {
+      chars_ = new char[length + 1];
+    }
+    env->GetByteArrayRegion(path, 0, length, reinterpret_cast<jbyte *>(chars_));
+    chars_[length] = '\0';
+  }
+
+  ~BytePath() {
+    if (chars_ != buffer_) {
+      delete[] chars_;
+    }
+  }
+
+  // NULL if the length was out of bounds; the exception is then pending.
+  const char *c_str() const { return chars_; }
+
+ private:
+  char buffer_[PATH_MAX];
+  char *chars_;
+
+  BytePath(const BytePath &);
+  void operator=(const BytePath &);
+};
+}  // namespace
+
 ////////////////////////////////////////////////////////////////////////
 
 // See unix_jni.h.
@@ -348,7 +400,7 @@ static jobject NewErrnoFileStatus(JNIEnv *env,
   }
 
   if (saved_errno != 0) {
-    return env->NewObject(errno_file_status_class, errorno_ctor, errno);
+    return env->NewObject(errno_file_status_class, errorno_ctor, saved_errno);
   }
   return env->NewObject(
       errno_file_status_class, no_error_ctor, stat_ref.st_mode,
@@ -380,12 +432,11 @@ Java_com_google_devtools_build_lib_unix_ErrnoFileStatus_00024ErrnoConstants_init
   SetIntField(env, clazz, errno_constants, "ENAMETOOLONG", ENAMETOOLONG);
 }
 
-static jobject StatCommon(JNIEnv *env,
-                          jstring path,
-                          int (*stat_function)(const char *, portable_stat_struct *),
-                          bool should_throw) {
+static jobject StatChars(
+    JNIEnv *env, const char *path_chars,
+    int (*stat_function)(const char *, portable_stat_struct *),
+    bool should_throw) {
   portable_stat_struct statbuf;
-  const char *path_chars = GetStringLatin1Chars(env, path);
   int r;
   int saved_errno = 0;
   while ((r = stat_function(path_chars, &statbuf)) == -1 && errno == EINTR) { }
@@ -395,23 +446,41 @@ static jobject StatCommon(JNIEnv *env,
     // ENOMEM                      -> OutOfMemoryError
 
     if (PostRuntimeException(env, errno, path_chars)) {
-      ::ReleaseStringLatin1Chars(path_chars);
       return NULL;
     } else if (should_throw) {
       ::PostFileException(env, errno, path_chars);
-      ::ReleaseStringLatin1Chars(path_chars);
       return NULL;
     } else {
       saved_errno = errno;
     }
   }
-  ::ReleaseStringLatin1Chars(path_chars);
 
   return should_throw
     ? NewFileStatus(env, statbuf)
     : NewErrnoFileStatus(env, saved_errno, statbuf);
 }
 
+static jobject StatCommon(JNIEnv *env,
+                          jstring path,
+                          int (*stat_function)(const char *, portable_stat_struct *),
+                          bool should_throw) {
+  const char *path_chars = GetStringLatin1Chars(env, path);
+  jobject result = StatChars(env, path_chars, stat_function, should_throw);
+  ::ReleaseStringLatin1Chars(path_chars);
+  return result;
+}
+
+static jobject StatBytes(
+    JNIEnv *env, jbyteArray path, jint length,
+    int (*stat_function)(const char *, portable_stat_struct *),
+    bool should_throw) {
+  BytePath path_chars(env, path, length);
+  if (path_chars.c_str() == NULL) {
+    return NULL;
+  }
+  return StatChars(env, path_chars.c_str(), stat_function, should_throw);
+}
+
 /*
  * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
  * Method:    stat
@@ -462,6 +531,79 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_errnoLstat(JNIEnv *env,
   return ::StatCommon(env, path, portable_lstat, false);
 }
 
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    statBytes
+ * Signature: ([BI)Lcom/google/devtools/build/lib/unix/FileStatus;
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_statBytes(
+    JNIEnv *env, jclass clazz, jbyteArray path, jint length) {
+  return ::StatBytes(env, path, length, portable_stat, true);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    lstatBytes
+ * Signature: ([BI)Lcom/google/devtools/build/lib/unix/FileStatus;
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_lstatBytes(
+    JNIEnv *env, jclass clazz, jbyteArray path, jint length) {
+  return ::StatBytes(env, path, length, portable_lstat, true);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    errnoStatBytes
+ * Signature: ([BI)Lcom/google/devtools/build/lib/unix/ErrnoFileStatus;
+ */
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_errnoStatBytes(
+    JNIEnv *env, jclass clazz, jbyteArray path, jint length) {
+  return ::StatBytes(env, path, length, portable_stat, false);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    errnoLstatBytes
+ * Signature: ([BI)Lcom/google/devtools/build/lib/unix/ErrnoFileStatus;
+ */
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_errnoLstatBytes(
+    JNIEnv *env, jclass clazz, jbyteArray path, jint length) {
+  return ::StatBytes(env, path, length, portable_lstat, false);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    errnoStatx
+ * Signature: (Ljava/lang/String;ZIZ)Lcom/google/devtools/build/lib/unix/ErrnoFileStatus;
+ */
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_errnoStatx(
+    JNIEnv *env, jclass clazz, jstring path, jboolean follow_symlinks,
+    jint fields, jboolean dont_sync) {
+  portable_stat_struct statbuf;
+  const char *path_chars = GetStringLatin1Chars(env, path);
+  int r;
+  while ((r = portable_statx(path_chars, &statbuf, follow_symlinks, fields,
+                             dont_sync)) == -1 &&
+         errno == EINTR) { }
+  int saved_errno = 0;
+  if (r == -1) {
+    if (PostRuntimeException(env, errno, path_chars)) {
+      ::ReleaseStringLatin1Chars(path_chars);
+      return NULL;
+    }
+    saved_errno = errno;
+  }
+  ::ReleaseStringLatin1Chars(path_chars);
+  return NewErrnoFileStatus(env, saved_errno, statbuf);
+}
+
 /*
  * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
  * Method:    utime
@@ -534,6 +676,144 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_mkdir(JNIEnv *env,
   return result;
 }
 
+namespace {
+// The directories the entries of a symlink forest are created in, kept open
+// so that each entry only costs one system call.
+class ParentDirCache {
+ public:
+  ParentDirCache() {}
+  ~ParentDirCache() { Clear(); }
+
+  // Returns an fd of the parent directory of 'path', setting 'name' to the
+  // last segment of 'path', or -1 with errno set.
+  int Get(const char *path, const char **name) {
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+      *name = path;
+      return AT_FDCWD;
+    }
+    *name = slash + 1;
+    std::string parent(path, slash == path ? 1 : slash - path);
+    std::unordered_map<std::string, int>::iterator it = fds_.find(parent);
+    if (it != fds_.end()) {
+      return it->second;
+    }
+    int fd = open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+      return -1;
+    }
+    if (fds_.size() >= kMaxFds) {
+      // The entries usually come grouped by directory, so there is little
+      // to lose by starting over.
+      Clear();
+    }
+    fds_[parent] = fd;
+    return fd;
+  }
+
+ private:
+  static const size_t kMaxFds = 256;
+
+  void Clear() {
+    for (std::unordered_map<std::string, int>::iterator it = fds_.begin();
+         it != fds_.end(); ++it) {
+      close(it->second);
+    }
+    fds_.clear();
+  }
+
+  std::unordered_map<std::string, int> fds_;
+
+  ParentDirCache(const ParentDirCache &);
+  void operator=(const ParentDirCache &);
+};
+}  // namespace
+
+// Creates the directory 'path' unless it is there already. Returns 0 or an
+// error number.
+static int MakeForestDir(ParentDirCache *parents, const char *path) {
+  const char *name;
+  int dirfd = parents->Get(path, &name);
+  if (dirfd == -1) {
+    return errno;
+  }
+  if (mkdirat(dirfd, name, 0777) == 0) {
+    return 0;
+  }
+  int error = errno;
+  portable_stat_struct statbuf;
+  if (error == EEXIST &&
+      portable_fstatat(dirfd, const_cast<char *>(name), &statbuf,
+                       AT_SYMLINK_NOFOLLOW) == 0 &&
+      S_ISDIR(statbuf.st_mode)) {
+    return 0;
+  }
+  return error;
+}
+
+// Creates the symlink 'path' to 'target'. Returns 0 or an error number.
+static int MakeForestSymlink(ParentDirCache *parents, const char *path,
+                             const char *target) {
+  const char *name;
+  int dirfd = parents->Get(path, &name);
+  if (dirfd == -1) {
+    return errno;
+  }
+  return symlinkat(target, dirfd, name) == 0 ? 0 : errno;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    createSymlinkForest
+ * Signature: ([Ljava/lang/String;[Ljava/lang/String;[Ljava/lang/String;)[I
+ */
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_createSymlinkForest(
+    JNIEnv *env, jclass clazz, jobjectArray directories, jobjectArray links,
+    jobjectArray targets) {
+  jsize dir_count = env->GetArrayLength(directories);
+  jsize link_count = env->GetArrayLength(links);
+  std::vector<jint> errors(dir_count + link_count);
+  ParentDirCache parents;
+  // The local references are dropped as we go: a forest can be larger than
+  // the local reference table.
+  for (jsize i = 0; i < dir_count; ++i) {
+    jstring path =
+        static_cast<jstring>(env->GetObjectArrayElement(directories, i));
+    const char *path_chars = GetStringLatin1Chars(env, path);
+    env->DeleteLocalRef(path);
+    if (path_chars == NULL) {
+      return NULL;  // the exception is pending
+    }
+    errors[i] = MakeForestDir(&parents, path_chars);
+    ReleaseStringLatin1Chars(path_chars);
+  }
+  for (jsize i = 0; i < link_count; ++i) {
+    jstring path = static_cast<jstring>(env->GetObjectArrayElement(links, i));
+    jstring target =
+        static_cast<jstring>(env->GetObjectArrayElement(targets, i));
+    const char *path_chars = GetStringLatin1Chars(env, path);
+    const char *target_chars =
+        path_chars == NULL ? NULL : GetStringLatin1Chars(env, target);
+    env->DeleteLocalRef(path);
+    env->DeleteLocalRef(target);
+    if (target_chars == NULL) {
+      ReleaseStringLatin1Chars(path_chars);
+      return NULL;  // the exception is pending
+    }
+    errors[dir_count + i] =
+        MakeForestSymlink(&parents, path_chars, target_chars);
+    ReleaseStringLatin1Chars(path_chars);
+    ReleaseStringLatin1Chars(target_chars);
+  }
+
+  jintArray result = env->NewIntArray(errors.size());
+  if (result != NULL && !errors.empty()) {
+    env->SetIntArrayRegion(result, 0, errors.size(), &errors[0]);
+  }
+  return result;
+}
+
 static jobject NewDirents(JNIEnv *env,
                           jobjectArray names,
                           jbyteArray types) {
@@ -580,33 +860,23 @@ static char GetDirentType(struct dirent *entry,
   }
 }
 
-/*
- * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
- * Method:    readdir
- * Signature: (Ljava/lang/String;Z)Lcom/google/devtools/build/lib/unix/Dirents;
- * Throws:    java.io.IOException
- */
-extern "C" JNIEXPORT jobject JNICALL
-Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdir(JNIEnv *env,
-                                                    jclass clazz,
-                                                    jstring path,
-                                                    jchar read_types) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
+// Reads the entries of 'path' other than . and .., appending each name and a
+// NUL to 'names' and its offset there to 'offsets'. Unless 'read_types' is
+// 'n', the type of each entry is appended to 'types'. Returns false if an
+// exception is pending.
+static bool ReadDirents(JNIEnv *env, const char *path_chars, jchar read_types,
+                        std::vector<jbyte> *names, std::vector<jint> *offsets,
+                        std::vector<jbyte> *types) {
   DIR *dirh;
   while ((dirh = ::opendir(path_chars)) == NULL && errno == EINTR) { }
   if (dirh == NULL) {
     // EACCES EMFILE ENFILE ENOENT ENOTDIR -> IOException
     // ENOMEM                              -> OutOfMemoryError
     ::PostFileException(env, errno, path_chars);
-  }
-  ReleaseStringLatin1Chars(path_chars);
-  if (dirh == NULL) {
-    return NULL;
+    return false;
   }
   int fd = dirfd(dirh);
 
-  std::vector<std::string> entries;
-  std::vector<jbyte> types;
   for (;;) {
     // Clear errno beforehand.  Because readdir() is not required to clear it at
     // EOF, this is the only way to reliably distinguish EOF from error.
@@ -621,25 +891,64 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdir(JNIEnv *env,
       // Otherwise, this is a real error we should report.
       ::PostFileException(env, errno, path_chars);
       ::closedir(dirh);
-      return NULL;
+      return false;
     }
     // Omit . and .. from results.
     if (entry->d_name[0] == '.') {
       if (entry->d_name[1] == '\0') continue;
       if (entry->d_name[1] == '.' && entry->d_name[2] == '\0') continue;
     }
-    entries.push_back(entry->d_name);
+    offsets->push_back(names->size());
+    names->insert(names->end(), entry->d_name,
+                  entry->d_name + strlen(entry->d_name) + 1);
     if (read_types != 'n') {
-      types.push_back(GetDirentType(entry, fd, read_types == 'f'));
+      types->push_back(GetDirentType(entry, fd, read_types == 'f'));
     }
   }
 
   if (::closedir(dirh) < 0 && errno != EINTR) {
     ::PostFileException(env, errno, path_chars);
+    return false;
+  }
+  return true;
+}
+
+static jbyteArray NewDirentTypes(JNIEnv *env, jchar read_types,
+                                 const std::vector<jbyte> &types) {
+  if (read_types == 'n') {
     return NULL;
   }
+  jbyteArray types_obj = env->NewByteArray(types.size());
+  CHECK(types_obj);
+  if (!types.empty()) {
+    env->SetByteArrayRegion(types_obj, 0, types.size(), &types[0]);
+  }
+  return types_obj;
+}
 
-  size_t len = entries.size();
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    readdir
+ * Signature: (Ljava/lang/String;Z)Lcom/google/devtools/build/lib/unix/Dirents;
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdir(JNIEnv *env,
+                                                    jclass clazz,
+                                                    jstring path,
+                                                    jchar read_types) {
+  const char *path_chars = GetStringLatin1Chars(env, path);
+  // The names go into one buffer rather than a std::string each.
+  std::vector<jbyte> names;
+  std::vector<jint> offsets;
+  std::vector<jbyte> types;
+  bool ok = ReadDirents(env, path_chars, read_types, &names, &offsets, &types);
+  ReleaseStringLatin1Chars(path_chars);
+  if (!ok) {
+    return NULL;
+  }
+
+  size_t len = offsets.size();
   jclass jlStringClass = env->GetObjectClass(path);
   jobjectArray names_obj = env->NewObjectArray(len, jlStringClass, NULL);
   if (names_obj == NULL && env->ExceptionOccurred()) {
@@ -647,112 +956,438 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdir(JNIEnv *env,
   }
 
   for (size_t ii = 0; ii < len; ++ii) {
-    jstring s = NewStringLatin1(env, entries[ii].c_str());
+    jstring s = NewStringLatin1(
+        env, reinterpret_cast<const char *>(&names[offsets[ii]]));
     if (s == NULL && env->ExceptionOccurred()) {
       return NULL;  // async exception!
     }
     env->SetObjectArrayElement(names_obj, ii, s);
+    env->DeleteLocalRef(s);
   }
 
-  jbyteArray types_obj = NULL;
-  if (read_types != 'n') {
-    CHECK(len == types.size());
-    types_obj = env->NewByteArray(len);
-    CHECK(types_obj);
-    if (len > 0) {
-      env->SetByteArrayRegion(types_obj, 0, len, &types[0]);
-    }
+  return NewDirents(env, names_obj, NewDirentTypes(env, read_types, types));
+}
+
+static jobject NewPackedDirents(JNIEnv *env, jbyteArray names,
+                                jintArray offsets, jbyteArray types) {
+  static jclass dirents_class = NULL;
+  if (dirents_class == NULL) {  // note: harmless race condition
+    jclass local = env->FindClass(
+        "com/google/devtools/build/lib/unix/NativePosixFiles$PackedDirents");
+    CHECK(local != NULL);
+    dirents_class = static_cast<jclass>(env->NewGlobalRef(local));
+  }
+
+  static jmethodID ctor = NULL;
+  if (ctor == NULL) {  // note: harmless race condition
+    ctor = env->GetMethodID(dirents_class, "<init>", "([B[I[B)V");
+    CHECK(ctor != NULL);
   }
 
-  return NewDirents(env, names_obj, types_obj);
+  return env->NewObject(dirents_class, ctor, names, offsets, types);
 }
 
 /*
  * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
- * Method:    rename
- * Signature: (Ljava/lang/String;Ljava/lang/String;)V
+ * Method:    readdirPacked
+ * Signature: ([BIC)Lcom/google/devtools/build/lib/unix/NativePosixFiles$PackedDirents;
  * Throws:    java.io.IOException
  */
-extern "C" JNIEXPORT void JNICALL
-Java_com_google_devtools_build_lib_unix_NativePosixFiles_rename(JNIEnv *env,
-                                                   jclass clazz,
-                                                   jstring oldpath,
-                                                   jstring newpath) {
-  const char *oldpath_chars = GetStringLatin1Chars(env, oldpath);
-  const char *newpath_chars = GetStringLatin1Chars(env, newpath);
-  if (::rename(oldpath_chars, newpath_chars) == -1) {
-    // EISDIR EXDEV ENOTEMPTY EEXIST EBUSY
-    // EINVAL EMLINK ENOTDIR EACCES EPERM
-    // ENOENT EROFS ELOOP ENOSPC           -> IOException
-    // EFAULT ENAMETOOLONG                 -> RuntimeException
-    // ENOMEM                              -> OutOfMemoryError
-    std::string filename(std::string(oldpath_chars) + " -> " + newpath_chars);
-    ::PostFileException(env, errno, filename.c_str());
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdirPacked(
+    JNIEnv *env, jclass clazz, jbyteArray path, jint length,
+    jchar read_types) {
+  BytePath path_chars(env, path, length);
+  if (path_chars.c_str() == NULL) {
+    return NULL;
   }
-  ReleaseStringLatin1Chars(oldpath_chars);
-  ReleaseStringLatin1Chars(newpath_chars);
-}
+  std::vector<jbyte> names;
+  std::vector<jint> offsets;
+  std::vector<jbyte> types;
+  if (!ReadDirents(env, path_chars.c_str(), read_types, &names, &offsets,
+                   &types)) {
+    return NULL;
+  }
+  // The end of the last name, so that entry i is [offsets[i], offsets[i+1]).
+  offsets.push_back(names.size());
 
-static bool delete_common(JNIEnv *env,
-                          jstring path,
-                          int (*delete_function)(const char *),
-                          bool (*error_function)(int)) {
-  const char *path_chars = GetStringLatin1Chars(env, path);
-  if (path_chars == NULL) {
-      return false;
+  jbyteArray names_obj = env->NewByteArray(names.size());
+  if (names_obj == NULL) {
+    return NULL;  // async exception!
   }
-  bool ok = delete_function(path_chars) != -1;
-  if (!ok) {
-    if (!error_function(errno)) {
-      ::PostFileException(env, errno, path_chars);
-    }
+  if (!names.empty()) {
+    env->SetByteArrayRegion(names_obj, 0, names.size(), &names[0]);
   }
-  ReleaseStringLatin1Chars(path_chars);
-  return ok;
+  jintArray offsets_obj = env->NewIntArray(offsets.size());
+  if (offsets_obj == NULL) {
+    return NULL;  // async exception!
+  }
+  env->SetIntArrayRegion(offsets_obj, 0, offsets.size(), &offsets[0]);
+  return NewPackedDirents(env, names_obj, offsets_obj,
+                          NewDirentTypes(env, read_types, types));
 }
 
-static bool unlink_err(int err) { return err == ENOENT; }
-static bool remove_err(int err) { return err == ENOENT || err == ENOTDIR; }
-
-/*
- * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
- * Method:    unlink
- * Signature: (Ljava/lang/String;)V
- * Throws:    java.io.IOException
- */
-extern "C" JNIEXPORT bool JNICALL
-Java_com_google_devtools_build_lib_unix_NativePosixFiles_unlink(JNIEnv *env,
-                                                   jclass clazz,
-                                                   jstring path) {
-  return ::delete_common(env, path, ::unlink, ::unlink_err);
+// The number of jlongs per entry in the stats of readdirWithStats() and
+// batch(), in the order of the FileStatus constructor arguments. Keep in sync
+// with NativePosixFiles.STAT_FIELDS.
+static const int kDirentStatFields = 10;
+
+static void PackStat(const portable_stat_struct &statbuf, jlong *out) {
+  out[0] = statbuf.st_mode;
+  out[1] = StatSeconds(statbuf, STAT_ATIME);
+  out[2] = StatNanoSeconds(statbuf, STAT_ATIME);
+  out[3] = StatSeconds(statbuf, STAT_MTIME);
+  out[4] = StatNanoSeconds(statbuf, STAT_MTIME);
+  out[5] = StatSeconds(statbuf, STAT_CTIME);
+  out[6] = StatNanoSeconds(statbuf, STAT_CTIME);
+  out[7] = static_cast<jlong>(statbuf.st_size);
+  out[8] = static_cast<int>(statbuf.st_dev);
+  out[9] = static_cast<jlong>(statbuf.st_ino);
 }
 
-/*
- * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
- * Method:    remove
- * Signature: (Ljava/lang/String;)V
- * Throws:    java.io.IOException
- */
-extern "C" JNIEXPORT bool JNICALL
-Java_com_google_devtools_build_lib_unix_NativePosixFiles_remove(JNIEnv *env,
-                                                   jclass clazz,
-                                                   jstring path) {
-  return ::delete_common(env, path, ::remove, ::remove_err);
+static jobject NewDirentsWithStats(JNIEnv *env,
+                                   jobjectArray names,
+                                   jlongArray stats) {
+  static jclass dirents_class = NULL;
+  if (dirents_class == NULL) {  // note: harmless race condition
+    jclass local = env->FindClass(
+        "com/google/devtools/build/lib/unix/NativePosixFiles$DirentsWithStats");
+    CHECK(local != NULL);
+    dirents_class = static_cast<jclass>(env->NewGlobalRef(local));
+  }
+
+  static jmethodID ctor = NULL;
+  if (ctor == NULL) {  // note: harmless race condition
+    ctor = env->GetMethodID(dirents_class, "<init>", "([Ljava/lang/String;[J)V");
+    CHECK(ctor != NULL);
+  }
+
+  return env->NewObject(dirents_class, ctor, names, stats);
 }
 
 /*
  * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
- * Method:    mkfifo
- * Signature: (Ljava/lang/String;I)V
+ * Method:    readdirWithStats
+ * Signature: (Ljava/lang/String;Z)Lcom/google/devtools/build/lib/unix/NativePosixFiles$DirentsWithStats;
  * Throws:    java.io.IOException
  */
-extern "C" JNIEXPORT void JNICALL
-Java_com_google_devtools_build_lib_unix_NativePosixFiles_mkfifo(JNIEnv *env,
-                                                   jclass clazz,
-                                                   jstring path,
-                                                   jint mode) {
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_readdirWithStats(
+    JNIEnv *env, jclass clazz, jstring path, jboolean follow_symlinks) {
   const char *path_chars = GetStringLatin1Chars(env, path);
-  if (mkfifo(path_chars, mode) == -1) {
+  DIR *dirh;
+  while ((dirh = ::opendir(path_chars)) == NULL && errno == EINTR) { }
+  if (dirh == NULL) {
+    ::PostFileException(env, errno, path_chars);
+    ReleaseStringLatin1Chars(path_chars);
+    return NULL;
+  }
+  int fd = dirfd(dirh);
+  int flags = follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+
+  // Each entry is stat()ed relative to the open directory, so that the kernel
+  // does not walk the whole path again, and everything crosses the JNI
+  // boundary in two arrays rather than one FileStatus object per entry.
+  std::vector<std::string> entries;
+  std::vector<jlong> stats;
+  for (;;) {
+    errno = 0;
+    struct dirent *entry = ::readdir(dirh);
+    if (entry == NULL) {
+      if (errno == 0) break;  // EOF
+      if (errno == EINTR) continue;  // interrupted by a signal
+      if (errno == EIO) continue;  // glibc returns this on transient errors
+      ::PostFileException(env, errno, path_chars);
+      ::closedir(dirh);
+      ReleaseStringLatin1Chars(path_chars);
+      return NULL;
+    }
+    if (entry->d_name[0] == '.') {
+      if (entry->d_name[1] == '\0') continue;
+      if (entry->d_name[1] == '.' && entry->d_name[2] == '\0') continue;
+    }
+    entries.push_back(entry->d_name);
+    portable_stat_struct statbuf;
+    int r;
+    while ((r = portable_fstatat(fd, entry->d_name, &statbuf, flags)) == -1 &&
+           errno == EINTR) { }
+    if (r == -1) {
+      // Gone meanwhile, or a dangling symlink: no status, like errnoStat().
+      stats.insert(stats.end(), kDirentStatFields, 0);
+      stats[stats.size() - kDirentStatFields] = -1;
+      continue;
+    }
+    stats.resize(stats.size() + kDirentStatFields);
+    PackStat(statbuf, &stats[stats.size() - kDirentStatFields]);
+  }
+
+  if (::closedir(dirh) < 0 && errno != EINTR) {
+    ::PostFileException(env, errno, path_chars);
+    ReleaseStringLatin1Chars(path_chars);
+    return NULL;
+  }
+  ReleaseStringLatin1Chars(path_chars);
+
+  size_t len = entries.size();
+  jclass jlStringClass = env->GetObjectClass(path);
+  jobjectArray names_obj = env->NewObjectArray(len, jlStringClass, NULL);
+  if (names_obj == NULL && env->ExceptionOccurred()) {
+    return NULL;  // async exception!
+  }
+  for (size_t ii = 0; ii < len; ++ii) {
+    jstring s = NewStringLatin1(env, entries[ii].c_str());
+    if (s == NULL && env->ExceptionOccurred()) {
+      return NULL;  // async exception!
+    }
+    env->SetObjectArrayElement(names_obj, ii, s);
+    env->DeleteLocalRef(s);
+  }
+
+  jlongArray stats_obj = env->NewLongArray(stats.size());
+  if (stats_obj == NULL && env->ExceptionOccurred()) {
+    return NULL;  // async exception!
+  }
+  if (!stats.empty()) {
+    env->SetLongArrayRegion(stats_obj, 0, stats.size(), &stats[0]);
+  }
+
+  return NewDirentsWithStats(env, names_obj, stats_obj);
+}
+
+void RunBatchOp(BatchOp *op) {
+  int r;
+  do {
+    switch (op->op) {
+      case BATCH_STAT:
+        r = portable_stat(op->path, &op->statbuf);
+        break;
+      case BATCH_LSTAT:
+        r = portable_lstat(op->path, &op->statbuf);
+        break;
+      case BATCH_UNLINK:
+        r = ::unlink(op->path);
+        break;
+      case BATCH_RMDIR:
+        r = ::rmdir(op->path);
+        break;
+      case BATCH_MKDIR:
+        r = ::mkdir(op->path, 0777);
+        break;
+      default:
+        r = -1;
+        errno = EINVAL;
+    }
+  } while (r == -1 && errno == EINTR);
+  op->error = r == -1 ? errno : 0;
+}
+
+namespace {
+struct ParallelWork {
+  void (*fn)(void *arg, size_t i);
+  void *arg;
+  size_t count;
+  size_t chunk;
+  pthread_mutex_t mutex;
+  size_t next;  // guarded by mutex
+};
+}  // namespace
+
+static void *RunParallelWorker(void *arg) {
+  ParallelWork *work = static_cast<ParallelWork *>(arg);
+  for (;;) {
+    pthread_mutex_lock(&work->mutex);
+    size_t begin = work->next;
+    size_t end =
+        begin + work->chunk < work->count ? begin + work->chunk : work->count;
+    work->next = end;
+    pthread_mutex_unlock(&work->mutex);
+    if (begin >= end) {
+      return NULL;
+    }
+    for (size_t i = begin; i < end; ++i) {
+      work->fn(work->arg, i);
+    }
+  }
+}
+
+// Calls fn(arg, i) for each i in [0, count), on up to 8 threads, each taking
+// 'chunk' indices at a time; one thread per 'per_thread' indices is started.
+static void ParallelFor(size_t count, size_t chunk, size_t per_thread,
+                        void (*fn)(void *arg, size_t i), void *arg) {
+  // The work mostly waits for the file system, so a few threads overlap that
+  // latency; many more would just contend on the directory locks.
+  const size_t kMaxThreads = 8;
+  size_t threads = count / per_thread;
+  if (threads > kMaxThreads) threads = kMaxThreads;
+
+  ParallelWork work;
+  work.fn = fn;
+  work.arg = arg;
+  work.count = count;
+  work.chunk = chunk;
+  work.next = 0;
+  pthread_mutex_init(&work.mutex, NULL);
+  std::vector<pthread_t> ids;
+  // This thread helps, and does it all if no thread could be started.
+  for (size_t i = 1; i < threads; ++i) {
+    pthread_t id;
+    if (pthread_create(&id, NULL, RunParallelWorker, &work) == 0) {
+      ids.push_back(id);
+    }
+  }
+  RunParallelWorker(&work);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    pthread_join(ids[i], NULL);
+  }
+  pthread_mutex_destroy(&work.mutex);
+}
+
+static void RunBatchOpAt(void *ops, size_t i) {
+  RunBatchOp(static_cast<BatchOp *>(ops) + i);
+}
+
+void RunBatchOnThreads(BatchOp *ops, size_t count) {
+  // Grabbing a few operations at a time keeps contention on the mutex low.
+  ParallelFor(count, 16, 64, RunBatchOpAt, ops);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    batch
+ * Signature: ([Ljava/lang/String;[B[I[J)V
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_batch(
+    JNIEnv *env, jclass clazz, jobjectArray paths, jbyteArray op_codes,
+    jintArray errors, jlongArray stats) {
+  jsize count = env->GetArrayLength(paths);
+  std::vector<jbyte> codes(count);
+  if (count > 0) {
+    env->GetByteArrayRegion(op_codes, 0, count, &codes[0]);
+  }
+  std::vector<BatchOp> ops(count);
+  for (jsize i = 0; i < count; ++i) {
+    // The local references are dropped as we go: a batch can be larger than
+    // the local reference table.
+    jstring path = static_cast<jstring>(env->GetObjectArrayElement(paths, i));
+    ops[i].op = static_cast<BatchOpCode>(codes[i]);
+    ops[i].path = GetStringLatin1Chars(env, path);
+    ops[i].error = 0;
+    env->DeleteLocalRef(path);
+    if (ops[i].path == NULL) {
+      // Out of memory; the exception is pending.
+      for (jsize j = 0; j < i; ++j) {
+        ReleaseStringLatin1Chars(ops[j].path);
+      }
+      return;
+    }
+  }
+
+  portable_run_batch(count > 0 ? &ops[0] : NULL, count);
+
+  std::vector<jint> error_values(count);
+  std::vector<jlong> stat_values(count * kDirentStatFields);
+  for (jsize i = 0; i < count; ++i) {
+    ReleaseStringLatin1Chars(ops[i].path);
+    error_values[i] = ops[i].error;
+    if (ops[i].error == 0 &&
+        (ops[i].op == BATCH_STAT || ops[i].op == BATCH_LSTAT)) {
+      PackStat(ops[i].statbuf, &stat_values[i * kDirentStatFields]);
+    }
+  }
+  if (count > 0) {
+    env->SetIntArrayRegion(errors, 0, count, &error_values[0]);
+    env->SetLongArrayRegion(stats, 0, count * kDirentStatFields,
+                            &stat_values[0]);
+  }
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    rename
+ * Signature: (Ljava/lang/String;Ljava/lang/String;)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_rename(JNIEnv *env,
+                                                   jclass clazz,
+                                                   jstring oldpath,
+                                                   jstring newpath) {
+  const char *oldpath_chars = GetStringLatin1Chars(env, oldpath);
+  const char *newpath_chars = GetStringLatin1Chars(env, newpath);
+  if (::rename(oldpath_chars, newpath_chars) == -1) {
+    // EISDIR EXDEV ENOTEMPTY EEXIST EBUSY
+    // EINVAL EMLINK ENOTDIR EACCES EPERM
+    // ENOENT EROFS ELOOP ENOSPC           -> IOException
+    // EFAULT ENAMETOOLONG                 -> RuntimeException
+    // ENOMEM                              -> OutOfMemoryError
+    std::string filename(std::string(oldpath_chars) + " -> " + newpath_chars);
+    ::PostFileException(env, errno, filename.c_str());
+  }
+  ReleaseStringLatin1Chars(oldpath_chars);
+  ReleaseStringLatin1Chars(newpath_chars);
+}
+
+static bool delete_common(JNIEnv *env,
+                          jstring path,
+                          int (*delete_function)(const char *),
+                          bool (*error_function)(int)) {
+  const char *path_chars = GetStringLatin1Chars(env, path);
+  if (path_chars == NULL) {
+      return false;
+  }
+  bool ok = delete_function(path_chars) != -1;
+  if (!ok) {
+    if (!error_function(errno)) {
+      ::PostFileException(env, errno, path_chars);
+    }
+  }
+  ReleaseStringLatin1Chars(path_chars);
+  return ok;
+}
+
+static bool unlink_err(int err) { return err == ENOENT; }
+static bool remove_err(int err) { return err == ENOENT || err == ENOTDIR; }
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    unlink
+ * Signature: (Ljava/lang/String;)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT bool JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_unlink(JNIEnv *env,
+                                                   jclass clazz,
+                                                   jstring path) {
+  return ::delete_common(env, path, ::unlink, ::unlink_err);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    remove
+ * Signature: (Ljava/lang/String;)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT bool JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_remove(JNIEnv *env,
+                                                   jclass clazz,
+                                                   jstring path) {
+  return ::delete_common(env, path, ::remove, ::remove_err);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    mkfifo
+ * Signature: (Ljava/lang/String;I)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_mkfifo(JNIEnv *env,
+                                                   jclass clazz,
+                                                   jstring path,
+                                                   jint mode) {
+  const char *path_chars = GetStringLatin1Chars(env, path);
+  if (mkfifo(path_chars, mode) == -1) {
     ::PostFileException(env, errno, path_chars);
   }
   ReleaseStringLatin1Chars(path_chars);
@@ -805,68 +1440,1631 @@ Java_com_google_devtools_build_lib_unix_NativePosixFiles_lgetxattr(JNIEnv *env,
 }
 
 
-// Computes MD5 digest of "file", writes result in "result", which
-// must be of length Md5Digest::kDigestLength.  Returns zero on success, or
-// -1 (and sets errno) otherwise.
-static int md5sumAsBytes(const char *file,
-                         jbyte result[Md5Digest::kDigestLength]) {
-  Md5Digest digest;
-  // OPT: Using a 32k buffer would give marginally better performance,
-  // but what is the stack size here?
-  jbyte buf[4096];
-  int fd;
-  while ((fd = open(file, O_RDONLY)) == -1 && errno == EINTR) { }
-  if (fd == -1) {
+// Computes the digest of the open file "fd", from its current offset, with a
+// 'Digest' (Md5Digest or Sha256Digest), writes the result in "result", which
+// must be of length Digest::kDigestLength.  Returns zero on success, or -1
+// (and sets errno) otherwise.
+template <typename Digest>
+static int DigestFd(int fd, jbyte *result) {
+  // Large reads make for few system calls on multi-GB files; the buffer is on
+  // the heap, as digests run on the Java threads and on ParallelFor() threads
+  // alike. Reading beats mmap() here: a file truncated meanwhile is an error
+  // rather than a SIGBUS.
+  const size_t kBufferSize = 256 * 1024;
+  jbyte *buf = static_cast<jbyte *>(malloc(kBufferSize));
+  if (buf == NULL) {
+    errno = ENOMEM;
     return -1;
   }
-  for (ssize_t len = read(fd, buf, arraysize(buf));
+#if defined(POSIX_FADV_SEQUENTIAL)
+  // Have the kernel read ahead further.
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  Digest digest;
+  for (ssize_t len = read(fd, buf, kBufferSize);
        len != 0;
-       len = read(fd, buf, arraysize(buf))) {
+       len = read(fd, buf, kBufferSize)) {
     if (len == -1) {
       if (errno == EINTR) {
         continue;
       } else {
-        int read_errno = errno;
-        close(fd);  // prefer read() errors over close().
-        errno = read_errno;
+        free(buf);
         return -1;
       }
     }
     digest.Update(buf, len);
   }
+  free(buf);
+  digest.Finish(reinterpret_cast<unsigned char*>(result));
+  return 0;
+}
+
+// Like DigestFd(), but opens "file".
+template <typename Digest>
+static int DigestFile(const char *file, jbyte *result) {
+  int fd;
+  while ((fd = open(file, O_RDONLY)) == -1 && errno == EINTR) { }
+  if (fd == -1) {
+    return -1;
+  }
+  if (DigestFd<Digest>(fd, result) == -1) {
+    int read_errno = errno;
+    close(fd);  // prefer read() errors over close().
+    errno = read_errno;
+    return -1;
+  }
   if (close(fd) < 0 && errno != EINTR) {
     return -1;
   }
-  digest.Finish(reinterpret_cast<unsigned char*>(result));
   return 0;
 }
 
+template <typename Digest>
+static jbyteArray DigestFileAsBytes(JNIEnv *env, jstring path) {
+  const char *path_chars = GetStringLatin1Chars(env, path);
+  jbyte value[Digest::kDigestLength];
+  jbyteArray result = NULL;
+  if (DigestFile<Digest>(path_chars, value) == 0) {
+    result = env->NewByteArray(Digest::kDigestLength);
+    env->SetByteArrayRegion(result, 0, Digest::kDigestLength, value);
+  } else {
+    ::PostFileException(env, errno, path_chars);
+  }
+  ReleaseStringLatin1Chars(path_chars);
+  return result;
+}
 
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_devtools_build_lib_unix_NativePosixFiles_md5sumAsBytes(
     JNIEnv *env, jclass clazz, jstring path) {
+  return DigestFileAsBytes<Md5Digest>(env, path);
+}
+
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_sha256sumAsBytes(
+    JNIEnv *env, jclass clazz, jstring path) {
+  return DigestFileAsBytes<Sha256Digest>(env, path);
+}
+
+// The digest functions of digestAll() and xattrCachedDigest(). Keep in sync
+// with NativePosixFiles.DIGEST_*.
+enum DigestFunction {
+  DIGEST_MD5 = 0,
+  DIGEST_SHA256 = 1,
+};
+
+// A digest cached in an extended attribute: kCachedDigestVersion, the digest
+// function, then the mtime (seconds and nanoseconds), size, inode and device
+// numbers the file had when it was digested, each as 8 little-endian bytes,
+// then the digest itself. The ctime cannot be part of it: writing the
+// attribute changes it.
+static const uint8_t kCachedDigestVersion = 1;
+static const size_t kCachedDigestHeaderSize = 2 + 5 * 8;
+
+static void AppendLittleEndian64(uint64_t value, std::vector<uint8_t> *out) {
+  for (int i = 0; i < 8; ++i) {
+    out->push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+static std::vector<uint8_t> CachedDigestHeader(
+    DigestFunction function, const portable_stat_struct &statbuf) {
+  std::vector<uint8_t> header;
+  header.push_back(kCachedDigestVersion);
+  header.push_back(static_cast<uint8_t>(function));
+  AppendLittleEndian64(StatSeconds(statbuf, STAT_MTIME), &header);
+  AppendLittleEndian64(StatNanoSeconds(statbuf, STAT_MTIME), &header);
+  AppendLittleEndian64(statbuf.st_size, &header);
+  AppendLittleEndian64(statbuf.st_ino, &header);
+  AppendLittleEndian64(statbuf.st_dev, &header);
+  return header;
+}
+
+// Digests the open file "fd" into "result": from the extended attribute
+// "xattr" if it holds a digest of the current contents, otherwise by reading
+// the file, and then stores the digest in the attribute for next time, as far
+// as the file system and the permissions allow. Returns zero on success, or
+// -1 (and sets errno) otherwise.
+template <typename Digest>
+static int XattrCachedDigestFd(int fd, const char *xattr,
+                               DigestFunction function, jbyte *result) {
+  portable_stat_struct before;
+  if (portable_fstat(fd, &before) == -1) {
+    return -1;
+  }
+  std::vector<uint8_t> header = CachedDigestHeader(function, before);
+  uint8_t cached[kCachedDigestHeaderSize + Digest::kDigestLength];
+  ssize_t size = portable_fgetxattr(fd, xattr, cached, sizeof(cached));
+  if (size == static_cast<ssize_t>(sizeof(cached)) &&
+      memcmp(cached, &header[0], kCachedDigestHeaderSize) == 0) {
+    memcpy(result, cached + kCachedDigestHeaderSize, Digest::kDigestLength);
+    return 0;
+  }
+
+  if (DigestFd<Digest>(fd, result) == -1) {
+    return -1;
+  }
+
+  // Only files that did not change while being read, and that were not
+  // modified within the last seconds, are cached: a write within the mtime
+  // granularity of the file system could otherwise go unnoticed.
+  portable_stat_struct after;
+  if (portable_fstat(fd, &after) == -1 ||
+      CachedDigestHeader(function, after) != header ||
+      StatSeconds(after, STAT_MTIME) >= time(NULL) - 2) {
+    return 0;
+  }
+  memcpy(cached, &header[0], kCachedDigestHeaderSize);
+  memcpy(cached + kCachedDigestHeaderSize, result, Digest::kDigestLength);
+  // Read-only files, and file systems without extended attributes, just
+  // cannot keep the digest.
+  portable_fsetxattr(fd, xattr, cached, sizeof(cached));
+  return 0;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    xattrCachedDigest
+ * Signature: (Ljava/lang/String;Ljava/lang/String;I)[B
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_xattrCachedDigest(
+    JNIEnv *env, jclass clazz, jstring path, jstring name, jint function) {
+  if (function != DIGEST_MD5 && function != DIGEST_SHA256) {
+    ::PostException(env, EINVAL, "Unknown digest function");
+    return NULL;
+  }
+  int digest_length = function == DIGEST_SHA256 ? Sha256Digest::kDigestLength
+                                                : Md5Digest::kDigestLength;
   const char *path_chars = GetStringLatin1Chars(env, path);
-  jbyte value[Md5Digest::kDigestLength];
+  const char *name_chars = GetStringLatin1Chars(env, name);
+  jbyte value[Sha256Digest::kDigestLength];
   jbyteArray result = NULL;
-  if (md5sumAsBytes(path_chars, value) == 0) {
-    result = env->NewByteArray(Md5Digest::kDigestLength);
-    env->SetByteArrayRegion(result, 0, Md5Digest::kDigestLength, value);
+  int fd;
+  while ((fd = open(path_chars, O_RDONLY)) == -1 && errno == EINTR) { }
+  int r = -1;
+  if (fd != -1) {
+    r = function == DIGEST_SHA256
+            ? XattrCachedDigestFd<Sha256Digest>(fd, name_chars, DIGEST_SHA256,
+                                                value)
+            : XattrCachedDigestFd<Md5Digest>(fd, name_chars, DIGEST_MD5,
+                                             value);
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+  }
+  if (r == 0) {
+    result = env->NewByteArray(digest_length);
+    env->SetByteArrayRegion(result, 0, digest_length, value);
   } else {
     ::PostFileException(env, errno, path_chars);
   }
   ReleaseStringLatin1Chars(path_chars);
+  ReleaseStringLatin1Chars(name_chars);
   return result;
 }
 
-extern "C" JNIEXPORT jlong JNICALL
-Java_com_google_devtools_build_lib_unix_NativePosixSystem_sysctlbynameGetLong(
-    JNIEnv *env, jclass clazz, jstring name) {
-  const char *name_chars = GetStringLatin1Chars(env, name);
-  long r;
-  size_t len = sizeof(r);
-  if (portable_sysctlbyname(name_chars, &r, &len) == -1) {
-    ::PostSystemException(env, errno, "sysctlbyname", name_chars);
+namespace {
+struct DigestAllWork {
+  DigestFunction function;
+  int digest_length;
+  std::vector<const char *> paths;
+  std::vector<jbyte> digests;  // digest_length bytes per path
+  std::vector<int> errors;
+};
+}  // namespace
+
+static void DigestOne(void *arg, size_t i) {
+  DigestAllWork *work = static_cast<DigestAllWork *>(arg);
+  jbyte *result = &work->digests[i * work->digest_length];
+  int r = work->function == DIGEST_SHA256
+              ? DigestFile<Sha256Digest>(work->paths[i], result)
+              : DigestFile<Md5Digest>(work->paths[i], result);
+  work->errors[i] = r == 0 ? 0 : errno;
+}
+
+// The MD5 digests of the files up to this size are computed together, with
+// Md5Digest::DigestMany(), from their whole contents; the larger ones are
+// read and digested one buffer at a time as usual.
+static const size_t kSmallFileSize = 64 * 1024;
+// The files digested together: enough to fill the widest vectors.
+static const size_t kMd5GroupSize = 16;
+
+// Reads the rest of the open file "fd", which is expected to be "size"
+// bytes, into "contents". Returns zero on success, or -1 (and sets errno)
+// otherwise.
+static int ReadContents(int fd, size_t size, std::string *contents) {
+  // One more byte tells a file that grew meanwhile without another read.
+  contents->resize(size + 1);
+  size_t done = 0;
+  for (;;) {
+    if (done == contents->size()) {
+      contents->resize(done * 2);
+    }
+    ssize_t len = read(fd, &(*contents)[done], contents->size() - done);
+    if (len == 0) {
+      break;
+    }
+    if (len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    done += len;
   }
-  ReleaseStringLatin1Chars(name_chars);
-  return (jlong)r;
+  contents->resize(done);
+  return 0;
+}
+
+// Computes the MD5 digests of the files of group "group" of
+// kMd5GroupSize files.
+static void DigestMd5Group(void *arg, size_t group) {
+  DigestAllWork *work = static_cast<DigestAllWork *>(arg);
+  size_t begin = group * kMd5GroupSize;
+  size_t end = std::min(begin + kMd5GroupSize, work->paths.size());
+  std::string contents[kMd5GroupSize];
+  std::vector<const void *> messages;
+  std::vector<size_t> lengths;
+  std::vector<size_t> small_files;
+  for (size_t i = begin; i < end; ++i) {
+    jbyte *result = &work->digests[i * work->digest_length];
+    int fd;
+    while ((fd = open(work->paths[i], O_RDONLY)) == -1 && errno == EINTR) { }
+    if (fd == -1) {
+      work->errors[i] = errno;
+      continue;
+    }
+    portable_stat_struct statbuf;
+    int r;
+    if (portable_fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode) &&
+        static_cast<size_t>(statbuf.st_size) <= kSmallFileSize) {
+      r = ReadContents(fd, statbuf.st_size, &contents[i - begin]);
+      if (r == 0) {
+        messages.push_back(contents[i - begin].data());
+        lengths.push_back(contents[i - begin].size());
+        small_files.push_back(i);
+      }
+    } else {
+      r = DigestFd<Md5Digest>(fd, result);
+    }
+    int read_errno = errno;
+    // Like DigestFile(), prefer read() errors over close().
+    if (close(fd) < 0 && errno != EINTR && r == 0) {
+      r = -1;
+      read_errno = errno;
+    }
+    work->errors[i] = r == 0 ? 0 : read_errno;
+  }
+  if (small_files.empty()) {
+    return;
+  }
+  unsigned char digests[kMd5GroupSize * Md5Digest::kDigestLength];
+  Md5Digest::DigestMany(small_files.size(), &messages[0], &lengths[0],
+                        digests);
+  for (size_t j = 0; j < small_files.size(); ++j) {
+    if (work->errors[small_files[j]] == 0) {
+      memcpy(&work->digests[small_files[j] * work->digest_length],
+             digests + j * Md5Digest::kDigestLength, Md5Digest::kDigestLength);
+    }
+  }
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    digestAll
+ * Signature: ([Ljava/lang/String;I)[[B
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_digestAll(
+    JNIEnv *env, jclass clazz, jobjectArray paths, jint function) {
+  if (function != DIGEST_MD5 && function != DIGEST_SHA256) {
+    ::PostException(env, EINVAL, "Unknown digest function");
+    return NULL;
+  }
+  jsize count = env->GetArrayLength(paths);
+  DigestAllWork work;
+  work.function = static_cast<DigestFunction>(function);
+  work.digest_length = function == DIGEST_SHA256 ? Sha256Digest::kDigestLength
+                                                 : Md5Digest::kDigestLength;
+  work.digests.resize(count * work.digest_length);
+  work.errors.resize(count);
+  for (jsize i = 0; i < count; ++i) {
+    jstring path = static_cast<jstring>(env->GetObjectArrayElement(paths, i));
+    const char *path_chars = GetStringLatin1Chars(env, path);
+    env->DeleteLocalRef(path);
+    if (path_chars == NULL) {
+      for (size_t j = 0; j < work.paths.size(); ++j) {
+        ReleaseStringLatin1Chars(work.paths[j]);
+      }
+      return NULL;  // the exception is pending
+    }
+    work.paths.push_back(path_chars);
+  }
+
+  if (work.function == DIGEST_MD5) {
+    // The small files of a group are digested side by side.
+    ParallelFor((count + kMd5GroupSize - 1) / kMd5GroupSize, 1, 1,
+                DigestMd5Group, &work);
+  } else {
+    // Each file is a good chunk of work of its own.
+    ParallelFor(count, 1, 1, DigestOne, &work);
+  }
+
+  jobjectArray result = NULL;
+  for (jsize i = 0; i < count; ++i) {
+    if (work.errors[i] != 0) {
+      ::PostFileException(env, work.errors[i], work.paths[i]);
+      break;
+    }
+  }
+  if (!env->ExceptionOccurred()) {
+    jclass byte_array_class = env->FindClass("[B");
+    result = env->NewObjectArray(count, byte_array_class, NULL);
+    for (jsize i = 0; result != NULL && i < count; ++i) {
+      jbyteArray digest = env->NewByteArray(work.digest_length);
+      if (digest == NULL) {
+        result = NULL;  // async exception!
+        break;
+      }
+      env->SetByteArrayRegion(digest, 0, work.digest_length,
+                              &work.digests[i * work.digest_length]);
+      env->SetObjectArrayElement(result, i, digest);
+      env->DeleteLocalRef(digest);
+    }
+  }
+  for (jsize i = 0; i < count; ++i) {
+    ReleaseStringLatin1Chars(work.paths[i]);
+  }
+  return result;
+}
+
+// The Merkle tree of the inputs of a remote action (see merkleTree() in
+// NativePosixFiles.java, and TreeNodeRepository.java, which it mirrors).
+// Every input and every directory is a FileNode of remote_protocol.proto,
+// whose ContentDigest is the SHA-1 of its serialization and its size. The
+// nodes are in one flat array: first the inputs, in their order, then the
+// directories, the root first. The messages are encoded here, like the
+// protobuf Java code encodes them, rather than with generated code this
+// library does not link.
+struct MerkleNode {
+  int32_t parent;
+  // Directories only: the children in order, through next_sibling, and
+  // the depth, 0 for the root.
+  int32_t first_child;
+  int32_t last_child;
+  int32_t next_sibling;
+  int32_t depth;
+  // The path segment it is known as in its parent.
+  const char *name;
+  size_t name_length;
+  // Inputs only.
+  const jbyte *content_digest;
+  int64_t content_size;
+  bool executable;
+  // The digest of its FileNode, and the length of that.
+  unsigned char digest[Sha1Digest::kDigestLength];
+  int64_t size;
+};
+
+static void AppendVarint(uint64_t value, std::string *out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Appends field 'field' of wire type 2 with its length.
+static void AppendLengthDelimited(int field, const std::string &value,
+                                  std::string *out) {
+  out->push_back(static_cast<char>(field << 3 | 2));
+  AppendVarint(value.size(), out);
+  out->append(value);
+}
+
+static std::string ContentDigestMessage(const void *digest, int64_t size) {
+  std::string message;
+  AppendLengthDelimited(
+      1,
+      std::string(static_cast<const char *>(digest), Sha1Digest::kDigestLength),
+      &message);
+  // Fields with the default value are left out, as in proto3.
+  if (size != 0) {
+    message.push_back(2 << 3);
+    AppendVarint(size, &message);
+  }
+  return message;
+}
+
+static void DigestMerkleNode(void *arg, size_t i) {
+  std::vector<MerkleNode> &nodes = *static_cast<std::vector<MerkleNode> *>(arg);
+  MerkleNode &node = nodes[i];
+  std::string file_node;
+  if (node.content_digest != NULL) {
+    std::string metadata;
+    AppendLengthDelimited(
+        1, ContentDigestMessage(node.content_digest, node.content_size),
+        &metadata);
+    if (node.executable) {
+      metadata.push_back(3 << 3);
+      metadata.push_back(1);
+    }
+    AppendLengthDelimited(1, metadata, &file_node);
+  } else {
+    for (int32_t c = node.first_child; c != -1; c = nodes[c].next_sibling) {
+      std::string child;
+      AppendLengthDelimited(1, std::string(nodes[c].name, nodes[c].name_length),
+                            &child);
+      AppendLengthDelimited(
+          2, ContentDigestMessage(nodes[c].digest, nodes[c].size), &child);
+      AppendLengthDelimited(2, child, &file_node);
+    }
+  }
+  Sha1Digest digest;
+  digest.Update(file_node.data(), file_node.size());
+  digest.Finish(node.digest);
+  node.size = file_node.size();
+}
+
+// Orders paths segment by segment, like PathFragment does: "a/b" sorts
+// before "a.b".
+struct MerklePathLess {
+  const std::vector<const char *> *paths;
+  bool operator()(int32_t a, int32_t b) const {
+    typedef const unsigned char *Chars;
+    Chars p = reinterpret_cast<Chars>((*paths)[a]);
+    Chars q = reinterpret_cast<Chars>((*paths)[b]);
+    for (; *p != '\0' && *p == *q; ++p, ++q) {
+    }
+    unsigned pc = *p == '/' ? 1 : *p;
+    unsigned qc = *q == '/' ? 1 : *q;
+    return pc < qc;
+  }
+};
+
+// Adds a child named 'name' to the directory 'parent', returns its index or
+// -1 if the directory already has one by that name.
+static int32_t AddMerkleChild(std::vector<MerkleNode> *nodes, int32_t parent,
+                              int32_t child, const char *name,
+                              size_t name_length) {
+  MerkleNode &dir = (*nodes)[parent];
+  if (dir.last_child != -1) {
+    const MerkleNode &last = (*nodes)[dir.last_child];
+    if (last.name_length == name_length &&
+        memcmp(last.name, name, name_length) == 0) {
+      return -1;
+    }
+    (*nodes)[dir.last_child].next_sibling = child;
+  } else {
+    dir.first_child = child;
+  }
+  dir.last_child = child;
+  MerkleNode &node = (*nodes)[child];
+  node.parent = parent;
+  node.name = name;
+  node.name_length = name_length;
+  return child;
+}
+
+static MerkleNode NewMerkleNode() {
+  MerkleNode node;
+  memset(&node, 0, sizeof(node));
+  node.parent = node.first_child = node.last_child = node.next_sibling = -1;
+  return node;
+}
+
+// Builds the tree of the NUL-terminated 'paths', in 'nodes'. Returns false
+// with a message in 'error' if a path is malformed, or is an input twice, or
+// is both an input and a directory.
+static bool BuildMerkleTree(const std::vector<const char *> &paths,
+                            std::vector<MerkleNode> *nodes,
+                            std::string *error) {
+  int32_t count = paths.size();
+  nodes->assign(count + 1, NewMerkleNode());
+  std::vector<int32_t> order(count);
+  for (int32_t i = 0; i < count; ++i) {
+    order[i] = i;
+  }
+  MerklePathLess less = {&paths};
+  std::sort(order.begin(), order.end(), less);
+
+  // The directories of the previous input, from the root down.
+  std::vector<int32_t> dirs(1, count);
+  for (int32_t input : order) {
+    const char *path = paths[input];
+    // Its segments but the last are the directories.
+    size_t depth = 0;
+    const char *segment = path;
+    for (;;) {
+      const char *end = strchr(segment, '/');
+      size_t length = end != NULL ? end - segment : strlen(segment);
+      if (length == 0 || (length == 1 && segment[0] == '.') ||
+          (length == 2 && segment[0] == '.' && segment[1] == '.')) {
+        *error = std::string("malformed input path: ") + path;
+        return false;
+      }
+      if (end == NULL) {
+        if (AddMerkleChild(nodes, dirs[depth], input, segment, length) < 0) {
+          *error = std::string("conflicting input path: ") + path;
+          return false;
+        }
+        break;
+      }
+      ++depth;
+      if (depth < dirs.size()) {
+        const MerkleNode &dir = (*nodes)[dirs[depth]];
+        if (dir.name_length == length &&
+            memcmp(dir.name, segment, length) == 0) {
+          segment = end + 1;
+          continue;
+        }
+        dirs.resize(depth);
+      }
+      int32_t dir = nodes->size();
+      nodes->push_back(NewMerkleNode());
+      if (AddMerkleChild(nodes, dirs[depth - 1], dir, segment, length) < 0) {
+        *error = std::string("conflicting input path: ") + path;
+        return false;
+      }
+      (*nodes)[dir].depth = depth;
+      dirs.push_back(dir);
+      segment = end + 1;
+    }
+    if (depth + 1 < dirs.size()) {
+      dirs.resize(depth + 1);
+    }
+  }
+  return true;
+}
+
+// Digests the nodes bottom up: the inputs, then the directories one level at
+// a time, from the deepest, each level in parallel.
+static void DigestMerkleTree(int32_t count, std::vector<MerkleNode> *nodes) {
+  ParallelFor(count, 64, 256, DigestMerkleNode, nodes);
+  std::vector<std::vector<size_t> > levels;
+  for (size_t i = count; i < nodes->size(); ++i) {
+    size_t depth = (*nodes)[i].depth;
+    if (levels.size() <= depth) {
+      levels.resize(depth + 1);
+    }
+    levels[depth].push_back(i);
+  }
+  for (size_t depth = levels.size(); depth-- > 0;) {
+    struct Level {
+      std::vector<MerkleNode> *nodes;
+      const std::vector<size_t> *indices;
+      static void Digest(void *arg, size_t i) {
+        Level *level = static_cast<Level *>(arg);
+        DigestMerkleNode(level->nodes, (*level->indices)[i]);
+      }
+    } level = {nodes, &levels[depth]};
+    ParallelFor(levels[depth].size(), 64, 256, Level::Digest, &level);
+  }
+}
+
+static void AppendLittleEndian(uint64_t value, int bytes, std::string *out) {
+  for (int i = 0; i < bytes; ++i) {
+    out->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    merkleTree
+ * Signature: ([B[B[J[Z)[B
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_merkleTree(
+    JNIEnv *env, jclass clazz, jbyteArray paths, jbyteArray digests,
+    jlongArray sizes, jbooleanArray executable) {
+  jsize count = env->GetArrayLength(sizes);
+  jsize paths_length = env->GetArrayLength(paths);
+  if (env->GetArrayLength(digests) != count * Sha1Digest::kDigestLength ||
+      env->GetArrayLength(executable) != count) {
+    ::PostException(env, EINVAL, "merkleTree: array lengths differ");
+    return NULL;
+  }
+  std::vector<jbyte> path_bytes(paths_length + 1);
+  env->GetByteArrayRegion(paths, 0, paths_length, &path_bytes[0]);
+  std::vector<jbyte> digest_bytes(count * Sha1Digest::kDigestLength + 1);
+  env->GetByteArrayRegion(digests, 0, count * Sha1Digest::kDigestLength,
+                          &digest_bytes[0]);
+  std::vector<jlong> size_values(count + 1);
+  env->GetLongArrayRegion(sizes, 0, count, &size_values[0]);
+  std::vector<jboolean> executable_values(count + 1);
+  env->GetBooleanArrayRegion(executable, 0, count, &executable_values[0]);
+
+  // The paths are NUL-terminated in the array already.
+  std::vector<const char *> path_chars;
+  const char *chars = reinterpret_cast<const char *>(&path_bytes[0]);
+  for (jsize start = 0, i = 0; i < paths_length; ++i) {
+    if (chars[i] == '\0') {
+      path_chars.push_back(chars + start);
+      start = i + 1;
+    }
+  }
+  if (static_cast<jsize>(path_chars.size()) != count ||
+      (paths_length > 0 && chars[paths_length - 1] != '\0')) {
+    ::PostException(env, EINVAL, "merkleTree: path count differs");
+    return NULL;
+  }
+
+  std::vector<MerkleNode> nodes;
+  std::string error;
+  if (!BuildMerkleTree(path_chars, &nodes, &error)) {
+    ::PostException(env, EINVAL, error);
+    return NULL;
+  }
+  for (jsize i = 0; i < count; ++i) {
+    nodes[i].content_digest = &digest_bytes[i * Sha1Digest::kDigestLength];
+    nodes[i].content_size = size_values[i];
+    nodes[i].executable = executable_values[i];
+  }
+  DigestMerkleTree(count, &nodes);
+
+  // For every node, the index of its parent (-1 for the root), its digest
+  // and its size; then the names of the directories but the root.
+  std::string table;
+  table.reserve(nodes.size() * (8 + Sha1Digest::kDigestLength + 8));
+  for (const MerkleNode &node : nodes) {
+    AppendLittleEndian(node.parent, 4, &table);
+    table.append(reinterpret_cast<const char *>(node.digest),
+                 Sha1Digest::kDigestLength);
+    AppendLittleEndian(node.size, 8, &table);
+  }
+  for (size_t i = count + 1; i < nodes.size(); ++i) {
+    table.append(nodes[i].name, nodes[i].name_length);
+    table.push_back('\0');
+  }
+  jbyteArray result = env->NewByteArray(table.size());
+  if (result != NULL) {
+    env->SetByteArrayRegion(result, 0, table.size(),
+                            reinterpret_cast<const jbyte *>(table.data()));
+  }
+  return result;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    listJarEntries
+ * Signature: (Ljava/lang/String;[B)[B
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_listJarEntries(
+    JNIEnv *env, jclass clazz, jstring path, jbyteArray prefix) {
+  std::string prefix_bytes;
+  if (prefix != NULL) {
+    prefix_bytes.resize(env->GetArrayLength(prefix));
+    env->GetByteArrayRegion(prefix, 0, prefix_bytes.size(),
+                            reinterpret_cast<jbyte *>(&prefix_bytes[0]));
+  }
+  const char *path_chars = GetStringLatin1Chars(env, path);
+  if (path_chars == NULL) {
+    return NULL;
+  }
+  std::string jar_path(path_chars);
+  ReleaseStringLatin1Chars(path_chars);
+
+  InputJar input_jar;
+  errno = 0;
+  if (!input_jar.Open(jar_path)) {
+    ::PostFileException(env, errno != 0 ? errno : EINVAL, jar_path.c_str());
+    return NULL;
+  }
+
+  // Walk the Central Directory ourselves rather than with NextEntry(), which
+  // exits the process on a malformed record.
+  const uint8_t *start = input_jar.mapped_start();
+  const uint8_t *end = start + input_jar.mapped_size();
+  const uint8_t *p = start + input_jar.CentralDirectoryOffset();
+  std::string table;
+  std::string names;
+  uint32_t count = 0;
+  table.resize(4);
+  while (p + sizeof(CDH) <= end && reinterpret_cast<const CDH *>(p)->is()) {
+    const CDH *cdh = reinterpret_cast<const CDH *>(p);
+    if (p + cdh->size() > end) {
+      ::PostException(env, EINVAL,
+                      jar_path + " (bad Central Directory record)");
+      return NULL;
+    }
+    p += cdh->size();
+    size_t name_length = cdh->file_name_length();
+    if (name_length < prefix_bytes.size() ||
+        memcmp(cdh->file_name(), prefix_bytes.data(), prefix_bytes.size()) !=
+            0) {
+      continue;
+    }
+    AppendLittleEndian(input_jar.LocalHeaderOffset(input_jar.LocalHeader(cdh)),
+                       8, &table);
+    AppendLittleEndian(cdh->compressed_file_size(), 8, &table);
+    AppendLittleEndian(cdh->uncompressed_file_size(), 8, &table);
+    AppendLittleEndian(cdh->crc32(), 4, &table);
+    AppendLittleEndian(cdh->compression_method(), 4, &table);
+    names.append(cdh->file_name(), name_length);
+    names.push_back('\0');
+    ++count;
+  }
+  for (int i = 0; i < 4; ++i) {
+    table[i] = static_cast<char>(count >> (8 * i));
+  }
+  table.append(names);
+
+  jbyteArray result = env->NewByteArray(table.size());
+  if (result != NULL) {
+    env->SetByteArrayRegion(result, 0, table.size(),
+                            reinterpret_cast<const jbyte *>(table.data()));
+  }
+  return result;
+}
+
+// Copies the contents of 'src_fd' to 'dst_fd' through a buffer. Returns 0, or
+// -1 with errno set.
+static int ReadWriteContents(int src_fd, int dst_fd) {
+  char buf[128 * 1024];
+  for (;;) {
+    ssize_t r = read(src_fd, buf, sizeof(buf));
+    if (r == 0) {
+      return 0;
+    }
+    if (r == -1) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    for (ssize_t done = 0; done < r;) {
+      ssize_t w = write(dst_fd, buf + done, r - done);
+      if (w == -1) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      done += w;
+    }
+  }
+}
+
+// Copies 'src' to 'dst', see NativePosixFiles.copyFile(). Returns 0, or -1
+// with errno set and 'error_path' to the file at fault.
+static int CopyFile(const char *src, const char *dst, const char **error_path) {
+  *error_path = src;
+  int src_fd;
+  while ((src_fd = open(src, O_RDONLY | O_CLOEXEC)) == -1 && errno == EINTR) {
+  }
+  if (src_fd == -1) {
+    return -1;
+  }
+  portable_stat_struct statbuf;
+  if (portable_fstat(src_fd, &statbuf) == -1) {
+    int saved_errno = errno;
+    close(src_fd);
+    errno = saved_errno;
+    return -1;
+  }
+  if (!S_ISREG(statbuf.st_mode)) {
+    close(src_fd);
+    errno = S_ISDIR(statbuf.st_mode) ? EISDIR : EINVAL;
+    return -1;
+  }
+
+  *error_path = dst;
+  if (portable_clone_file(src, dst) == 0) {
+    close(src_fd);
+    return 0;
+  }
+  if (errno != ENOTSUP && errno != EXDEV) {
+    int saved_errno = errno;
+    close(src_fd);
+    errno = saved_errno;
+    return -1;
+  }
+
+  mode_t mode = statbuf.st_mode & 07777;
+  int dst_fd;
+  while ((dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        mode)) == -1 &&
+         errno == EINTR) {
+  }
+  int r = dst_fd == -1 ? -1 : 0;
+  if (r == 0) {
+    // The umask, or a previous file, may have left other bits.
+    r = fchmod(dst_fd, mode);
+  }
+  if (r == 0) {
+    r = portable_copy_contents(src_fd, dst_fd);
+    if (r == -1 && errno == ENOSYS) {
+      r = ReadWriteContents(src_fd, dst_fd);
+    }
+  }
+  int saved_errno = errno;
+  close(src_fd);
+  if (dst_fd != -1 && close(dst_fd) == -1 && r == 0) {
+    r = -1;
+    saved_errno = errno;
+  }
+  errno = saved_errno;
+  return r;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    copyFile
+ * Signature: (Ljava/lang/String;Ljava/lang/String;)V
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_copyFile(
+    JNIEnv *env, jclass clazz, jstring src, jstring dst) {
+  const char *src_chars = GetStringLatin1Chars(env, src);
+  const char *dst_chars = GetStringLatin1Chars(env, dst);
+  const char *error_path;
+  if (CopyFile(src_chars, dst_chars, &error_path) == -1) {
+    ::PostFileException(env, errno, error_path);
+  }
+  ReleaseStringLatin1Chars(src_chars);
+  ReleaseStringLatin1Chars(dst_chars);
+}
+
+namespace {
+// The files prefetch() was asked to read in, and the one thread doing it, so
+// that prefetching does not compete with itself for the disk.
+pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+// Guarded by prefetch_mutex. Never freed, so that the thread can still use
+// it while the process exits.
+std::deque<std::string> *prefetch_paths = NULL;
+
+// Beyond this many files not prefetched yet, more are not taken: the disk is
+// behind already, and the ones asked for first are needed first.
+const size_t kMaxPendingPrefetches = 64 * 1024;
+}  // namespace
+
+static void *RunPrefetchThread(void *arg) {
+  pthread_mutex_lock(&prefetch_mutex);
+  for (;;) {
+    while (prefetch_paths->empty()) {
+      pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+    }
+    std::string path;
+    path.swap(prefetch_paths->front());
+    prefetch_paths->pop_front();
+    pthread_mutex_unlock(&prefetch_mutex);
+
+    // Failures do not matter: whoever reads the file later sees them.
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd != -1) {
+      portable_stat_struct statbuf;
+      if (portable_fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode) &&
+          statbuf.st_size > 0) {
+        portable_prefetch(fd, statbuf.st_size);
+      }
+      close(fd);
+    }
+    pthread_mutex_lock(&prefetch_mutex);
+  }
+  return NULL;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    prefetch
+ * Signature: ([Ljava/lang/String;)I
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_prefetch(
+    JNIEnv *env, jclass clazz, jobjectArray paths) {
+  jsize count = env->GetArrayLength(paths);
+  std::vector<std::string> strings;
+  strings.reserve(count);
+  for (jsize i = 0; i < count; ++i) {
+    jstring path = static_cast<jstring>(env->GetObjectArrayElement(paths, i));
+    const char *path_chars = GetStringLatin1Chars(env, path);
+    env->DeleteLocalRef(path);
+    if (path_chars == NULL) {
+      return -1;  // the exception is pending
+    }
+    strings.push_back(path_chars);
+    ReleaseStringLatin1Chars(path_chars);
+  }
+
+  jint queued = 0;
+  pthread_mutex_lock(&prefetch_mutex);
+  if (prefetch_paths == NULL) {
+    pthread_t id;
+    if (pthread_create(&id, NULL, RunPrefetchThread, NULL) == 0) {
+      pthread_detach(id);
+      prefetch_paths = new std::deque<std::string>;
+    }
+  }
+  if (prefetch_paths != NULL) {
+    for (size_t i = 0; i < strings.size() &&
+                       prefetch_paths->size() < kMaxPendingPrefetches;
+         ++i, ++queued) {
+      prefetch_paths->push_back(std::string());
+      prefetch_paths->back().swap(strings[i]);
+    }
+    if (queued > 0) {
+      pthread_cond_signal(&prefetch_cond);
+    }
+  }
+  pthread_mutex_unlock(&prefetch_mutex);
+  return queued;
+}
+
+namespace {
+// A directory being deleted by deleteTree(). It is removed once it has been
+// listed and all its subdirectories are gone.
+struct DeleteTreeDir {
+  std::string path;
+  DeleteTreeDir *parent;
+  int pending;  // the listing plus the subdirectories left; guarded by mutex
+};
+
+// The directories left to list, shared by the deleteTree() threads. Every
+// thread takes the most recently found directory, so that the tree is walked
+// mostly depth first and only a few directories are pending at any time.
+struct DeleteTreeWork {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  // Guarded by mutex.
+  std::vector<DeleteTreeDir *> stack;
+  std::vector<pthread_t> threads;
+  int busy;  // the threads listing a directory
+  int error;
+  std::string error_path;
+};
+}  // namespace
+
+static void *RunDeleteTreeWorker(void *arg);
+
+// Records the first failure. Called with work->mutex held.
+static void SetDeleteTreeError(DeleteTreeWork *work, int error,
+                               const std::string &path) {
+  if (work->error == 0) {
+    work->error = error;
+    work->error_path = path;
+  }
+}
+
+// Removes 'dir' and, in turn, the parents it was the last subdirectory of.
+// Called with work->mutex held, which is dropped around the rmdir().
+static void FinishDeleteTreeDir(DeleteTreeWork *work, DeleteTreeDir *dir) {
+  while (dir != NULL && --dir->pending == 0) {
+    pthread_mutex_unlock(&work->mutex);
+    int r = unlinkat(AT_FDCWD, dir->path.c_str(), AT_REMOVEDIR);
+    int error = r == -1 && errno != ENOENT ? errno : 0;
+    pthread_mutex_lock(&work->mutex);
+    if (error != 0) {
+      SetDeleteTreeError(work, error, dir->path);
+    }
+    DeleteTreeDir *parent = dir->parent;
+    delete dir;
+    dir = parent;
+  }
+}
+
+// Opens 'path' for listing and removing its entries, adding the owner's
+// read, write and search permissions first if they are missing, like
+// build-runfiles does.
+static int OpenDirForDelete(const char *path) {
+  const int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+  int fd = open(path, flags);
+  if (fd == -1 && errno == EACCES) {
+    portable_stat_struct statbuf;
+    if (portable_lstat(path, &statbuf) == 0 &&
+        chmod(path, statbuf.st_mode | S_IRWXU) == 0) {
+      fd = open(path, flags);
+    } else {
+      errno = EACCES;
+    }
+  }
+  if (fd == -1) {
+    return -1;
+  }
+  portable_stat_struct statbuf;
+  if (portable_fstat(fd, &statbuf) == 0 &&
+      (statbuf.st_mode & S_IRWXU) != S_IRWXU) {
+    fchmod(fd, statbuf.st_mode | S_IRWXU);
+  }
+  return fd;
+}
+
+// Unlinks the entries of 'dir' other than directories, and queues the
+// directories. Called without work->mutex held.
+static void ListDeleteTreeDir(DeleteTreeWork *work, DeleteTreeDir *dir) {
+  std::vector<DeleteTreeDir *> subdirs;
+  int error = 0;
+  std::string error_path = dir->path;
+  int fd = OpenDirForDelete(dir->path.c_str());
+  DIR *entries = fd == -1 ? NULL : fdopendir(fd);
+  if (entries == NULL) {
+    if (errno != ENOENT) {
+      error = errno;
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+  } else {
+    struct dirent *entry;
+    while ((errno = 0, entry = readdir(entries)) != NULL) {
+      const char *name = entry->d_name;
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        continue;
+      }
+      bool is_dir = entry->d_type == DT_DIR;
+      if (entry->d_type == DT_UNKNOWN) {
+        portable_stat_struct statbuf;
+        is_dir = portable_fstatat(fd, const_cast<char *>(name), &statbuf,
+                                   AT_SYMLINK_NOFOLLOW) == 0 &&
+                 S_ISDIR(statbuf.st_mode);
+      }
+      if (is_dir) {
+        DeleteTreeDir *subdir = new DeleteTreeDir;
+        subdir->path = dir->path + "/" + name;
+        subdir->parent = dir;
+        subdir->pending = 1;
+        subdirs.push_back(subdir);
+      } else if (unlinkat(fd, name, 0) == -1 && errno != ENOENT &&
+                 error == 0) {
+        error = errno;
+        error_path = dir->path + "/" + name;
+      }
+    }
+    if (errno != 0 && error == 0) {
+      error = errno;
+    }
+    closedir(entries);
+  }
+
+  pthread_mutex_lock(&work->mutex);
+  if (error != 0) {
+    SetDeleteTreeError(work, error, error_path);
+  }
+  dir->pending += subdirs.size();
+  work->stack.insert(work->stack.end(), subdirs.begin(), subdirs.end());
+  // More directories than this thread is about to take: have another thread
+  // help, up to a few, as the work mostly waits for the file system.
+  const size_t kMaxThreads = 7;
+  for (size_t i = 1; i < subdirs.size() && work->threads.size() < kMaxThreads;
+       ++i) {
+    pthread_t id;
+    if (pthread_create(&id, NULL, RunDeleteTreeWorker, work) != 0) {
+      break;
+    }
+    work->threads.push_back(id);
+  }
+  if (subdirs.size() > 1) {
+    pthread_cond_broadcast(&work->cond);
+  }
+  FinishDeleteTreeDir(work, dir);
+  pthread_mutex_unlock(&work->mutex);
+}
+
+static void *RunDeleteTreeWorker(void *arg) {
+  DeleteTreeWork *work = static_cast<DeleteTreeWork *>(arg);
+  pthread_mutex_lock(&work->mutex);
+  for (;;) {
+    while (work->stack.empty() && work->busy > 0) {
+      pthread_cond_wait(&work->cond, &work->mutex);
+    }
+    if (work->stack.empty()) {
+      // Nothing left, and nobody is going to find more.
+      pthread_cond_broadcast(&work->cond);
+      break;
+    }
+    DeleteTreeDir *dir = work->stack.back();
+    work->stack.pop_back();
+    ++work->busy;
+    pthread_mutex_unlock(&work->mutex);
+    ListDeleteTreeDir(work, dir);
+    pthread_mutex_lock(&work->mutex);
+    --work->busy;
+  }
+  pthread_mutex_unlock(&work->mutex);
+  return NULL;
+}
+
+// Deletes the directory 'path' and everything below it, on this thread and
+// a few more started as subdirectories turn up. Returns 0, or the error
+// number of the first failure, setting 'error_path'.
+static int DeleteTreeBelow(const char *path, std::string *error_path) {
+  DeleteTreeWork work;
+  pthread_mutex_init(&work.mutex, NULL);
+  pthread_cond_init(&work.cond, NULL);
+  work.busy = 0;
+  work.error = 0;
+  DeleteTreeDir *root = new DeleteTreeDir;
+  root->path = path;
+  root->parent = NULL;
+  root->pending = 1;
+  work.stack.push_back(root);
+
+  RunDeleteTreeWorker(&work);
+  // No thread is started once the stack ran dry, so the list is final.
+  for (size_t i = 0; i < work.threads.size(); ++i) {
+    pthread_join(work.threads[i], NULL);
+  }
+  pthread_cond_destroy(&work.cond);
+  pthread_mutex_destroy(&work.mutex);
+  *error_path = work.error_path;
+  return work.error;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    deleteTree
+ * Signature: (Ljava/lang/String;)Z
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_deleteTree(
+    JNIEnv *env, jclass clazz, jstring path) {
+  const char *path_chars = GetStringLatin1Chars(env, path);
+  if (path_chars == NULL) {
+    return false;
+  }
+  portable_stat_struct statbuf;
+  bool existed = true;
+  if (portable_lstat(path_chars, &statbuf) == -1) {
+    if (errno == ENOENT) {
+      existed = false;
+    } else {
+      ::PostFileException(env, errno, path_chars);
+    }
+  } else if (!S_ISDIR(statbuf.st_mode)) {
+    if (::unlink(path_chars) == -1) {
+      existed = errno != ENOENT;
+      if (existed) {
+        ::PostFileException(env, errno, path_chars);
+      }
+    }
+  } else {
+    std::string error_path;
+    int error = DeleteTreeBelow(path_chars, &error_path);
+    if (error != 0) {
+      ::PostFileException(env, error, error_path.c_str());
+    }
+  }
+  ReleaseStringLatin1Chars(path_chars);
+  return existed;
+}
+
+namespace {
+// A glob pattern, split into its segments.
+typedef std::vector<std::string> GlobPattern;
+
+// How far an include pattern got to a directory: the index of the pattern,
+// and the number of its segments the path of the directory matched.
+typedef std::pair<size_t, size_t> GlobState;
+
+// An entry of a directory being globbed, with the states it leads to.
+struct GlobChild {
+  bool is_dir;
+  std::set<GlobState> states;
+};
+
+struct GlobWork {
+  std::vector<GlobPattern> includes;
+  std::vector<GlobPattern> excludes;
+  // The exclude patterns ending in "**", without it: the directories they
+  // match are not entered at all.
+  std::vector<GlobPattern> excluded_trees;
+  bool exclude_directories;
+  // Sorted, as std::string compares like Java strings of Latin-1 characters.
+  std::set<std::string> results;
+  // The directories being walked, to stop at symlink cycles.
+  std::vector<std::pair<dev_t, ino_t> > ancestors;
+  int error;
+  std::string error_path;
+};
+}  // namespace
+
+static void SplitGlobPattern(const char *pattern, GlobPattern *segments) {
+  const char *begin = pattern;
+  for (const char *p = pattern;; ++p) {
+    if (*p == '/' || *p == '\0') {
+      segments->push_back(std::string(begin, p - begin));
+      if (*p == '\0') {
+        return;
+      }
+      begin = p + 1;
+    }
+  }
+}
+
+// Matches 'name' against 'pattern', in which "*" and "?" are wildcards.
+static bool MatchWildcard(const char *pattern, const char *name) {
+  // The position after the last "*", and where its match ends so far.
+  const char *star = NULL;
+  const char *star_name = NULL;
+  while (*name != '\0') {
+    if (*pattern == '*') {
+      star = ++pattern;
+      star_name = name;
+    } else if (*pattern == '?' || *pattern == *name) {
+      ++pattern;
+      ++name;
+    } else if (star != NULL) {
+      // Have the last "*" match one more character.
+      pattern = star;
+      name = ++star_name;
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '*') {
+    ++pattern;
+  }
+  return *pattern == '\0';
+}
+
+// Matches a directory entry against one segment of a pattern, like
+// UnixGlob.matches().
+static bool MatchGlobSegment(const std::string &segment,
+                             const std::string &name) {
+  if (segment.empty() || name.empty()) {
+    return false;
+  }
+  if (segment == "*" || segment == "**") {
+    return true;
+  }
+  // A leading '.' must be matched explicitly.
+  if (name[0] == '.' && segment[0] != '.') {
+    return false;
+  }
+  return MatchWildcard(segment.c_str(), name.c_str());
+}
+
+// Matches the segments from 'pattern_begin' on against the components of
+// 'path' from 'path_begin' on, "**" matching any number of them.
+static bool MatchGlobPath(const GlobPattern &pattern, size_t pattern_begin,
+                          const std::vector<std::string> &path,
+                          size_t path_begin) {
+  if (pattern_begin == pattern.size()) {
+    return path_begin == path.size();
+  }
+  if (pattern[pattern_begin] == "**") {
+    for (size_t i = path_begin; i <= path.size(); ++i) {
+      if (MatchGlobPath(pattern, pattern_begin + 1, path, i)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return path_begin < path.size() &&
+         MatchGlobSegment(pattern[pattern_begin], path[path_begin]) &&
+         MatchGlobPath(pattern, pattern_begin + 1, path, path_begin + 1);
+}
+
+static bool IsGlobWildcard(const std::string &segment) {
+  return segment.find_first_of("*?") != std::string::npos;
+}
+
+static std::string JoinGlobPath(const std::vector<std::string> &components) {
+  std::string path;
+  for (size_t i = 0; i < components.size(); ++i) {
+    if (i > 0) {
+      path += '/';
+    }
+    path += components[i];
+  }
+  return path;
+}
+
+// Adds the path made of 'components' to the results, unless it is excluded.
+static void AddGlobResult(GlobWork *work,
+                          const std::vector<std::string> &components) {
+  for (size_t i = 0; i < work->excludes.size(); ++i) {
+    if (MatchGlobPath(work->excludes[i], 0, components, 0)) {
+      return;
+    }
+  }
+  work->results.insert(JoinGlobPath(components));
+}
+
+// Returns whether 'name' in 'fd' is a directory or a file, following
+// symlinks, setting 'is_dir'. Anything else, including dangling symlinks,
+// is not globbed, like by UnixGlob.
+static bool GlobEntryType(int fd, const char *name, unsigned char d_type,
+                          bool *is_dir) {
+  if (d_type == DT_DIR || d_type == DT_REG) {
+    *is_dir = d_type == DT_DIR;
+    return true;
+  }
+  if (d_type != DT_LNK && d_type != DT_UNKNOWN) {
+    return false;
+  }
+  portable_stat_struct statbuf;
+  if (portable_fstatat(fd, const_cast<char *>(name), &statbuf, 0) != 0 ||
+      !(S_ISDIR(statbuf.st_mode) || S_ISREG(statbuf.st_mode))) {
+    return false;
+  }
+  *is_dir = S_ISDIR(statbuf.st_mode);
+  return true;
+}
+
+// Records the first failure.
+static void SetGlobError(GlobWork *work, int error,
+                         const std::vector<std::string> &components) {
+  if (work->error == 0) {
+    work->error = error;
+    work->error_path = JoinGlobPath(components);
+  }
+}
+
+// Globs the directory open as 'fd', which is closed, at 'components' below
+// the root, for the include patterns that got to it as 'states'. Nothing is
+// found in a directory reached again through a symlink below it.
+static void GlobDir(GlobWork *work, int fd,
+                    std::vector<std::string> *components,
+                    std::set<GlobState> states) {
+  portable_stat_struct statbuf;
+  if (portable_fstat(fd, &statbuf) == 0) {
+    std::pair<dev_t, ino_t> id(statbuf.st_dev, statbuf.st_ino);
+    for (size_t i = 0; i < work->ancestors.size(); ++i) {
+      if (work->ancestors[i] == id) {
+        close(fd);
+        return;
+      }
+    }
+    work->ancestors.push_back(id);
+  } else {
+    work->ancestors.push_back(std::pair<dev_t, ino_t>(0, 0));
+  }
+
+  // "**" can match nothing at all, so x/**/y gets to x/y, too.
+  std::vector<GlobState> pending(states.begin(), states.end());
+  while (!pending.empty()) {
+    GlobState state = pending.back();
+    pending.pop_back();
+    const GlobPattern &pattern = work->includes[state.first];
+    if (state.second < pattern.size() && pattern[state.second] == "**" &&
+        states.insert(GlobState(state.first, state.second + 1)).second) {
+      pending.push_back(GlobState(state.first, state.second + 1));
+    }
+  }
+
+  bool list = false;
+  std::map<std::string, GlobChild> children;
+  for (std::set<GlobState>::const_iterator it = states.begin();
+       it != states.end(); ++it) {
+    const GlobPattern &pattern = work->includes[it->first];
+    if (it->second == pattern.size()) {
+      // The root itself is not a result: it has no relative path.
+      if (!work->exclude_directories && !components->empty()) {
+        AddGlobResult(work, *components);
+      }
+    } else if (IsGlobWildcard(pattern[it->second])) {
+      list = true;
+    } else {
+      // No need to list the directory for this one, just look the name up.
+      const std::string &name = pattern[it->second];
+      bool is_dir;
+      if (!GlobEntryType(fd, name.c_str(), DT_UNKNOWN, &is_dir)) {
+        continue;
+      }
+      GlobChild &child = children[name];
+      child.is_dir = is_dir;
+      child.states.insert(GlobState(it->first, it->second + 1));
+    }
+  }
+
+  DIR *dirh = NULL;
+  if (list) {
+    dirh = fdopendir(fd);
+    if (dirh == NULL) {
+      SetGlobError(work, errno, *components);
+      close(fd);
+      return;
+    }
+    struct dirent *entry;
+    while ((errno = 0, entry = readdir(dirh)) != NULL) {
+      std::string name = entry->d_name;
+      if (name == "." || name == "..") {
+        continue;
+      }
+      bool is_dir;
+      bool typed = false;
+      GlobChild *child = NULL;
+      for (std::set<GlobState>::const_iterator it = states.begin();
+           it != states.end(); ++it) {
+        const GlobPattern &pattern = work->includes[it->first];
+        if (it->second == pattern.size() ||
+            !IsGlobWildcard(pattern[it->second]) ||
+            !MatchGlobSegment(pattern[it->second], name)) {
+          continue;
+        }
+        // The type is only needed, at the cost of a stat() for symlinks,
+        // once something matched.
+        if (!typed) {
+          if (!GlobEntryType(fd, entry->d_name, entry->d_type, &is_dir)) {
+            break;
+          }
+          typed = true;
+          child = &children[name];
+          child->is_dir = is_dir;
+        }
+        child->states.insert(GlobState(it->first, it->second + 1));
+        if (pattern[it->second] == "**" && is_dir) {
+          // Recurse without consuming the segment.
+          child->states.insert(*it);
+        }
+      }
+    }
+    if (errno != 0) {
+      SetGlobError(work, errno, *components);
+    }
+  }
+
+  for (std::map<std::string, GlobChild>::const_iterator it = children.begin();
+       it != children.end(); ++it) {
+    components->push_back(it->first);
+    if (!it->second.is_dir) {
+      for (std::set<GlobState>::const_iterator s = it->second.states.begin();
+           s != it->second.states.end(); ++s) {
+        if (s->second == work->includes[s->first].size()) {
+          AddGlobResult(work, *components);
+          break;
+        }
+      }
+      components->pop_back();
+      continue;
+    }
+    bool excluded = false;
+    for (size_t i = 0; !excluded && i < work->excluded_trees.size(); ++i) {
+      excluded = MatchGlobPath(work->excluded_trees[i], 0, *components, 0);
+    }
+    int child_fd = excluded ? -1
+                            : openat(fd, it->first.c_str(),
+                                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (child_fd != -1) {
+      GlobDir(work, child_fd, components, it->second.states);
+    } else if (!excluded && errno != ENOENT && errno != ENOTDIR) {
+      // Otherwise the directory is gone already.
+      SetGlobError(work, errno, *components);
+    }
+    components->pop_back();
+  }
+
+  if (dirh != NULL) {
+    closedir(dirh);
+  } else {
+    close(fd);
+  }
+  work->ancestors.pop_back();
+}
+
+// Converts the Java strings in 'patterns' to their segments. Returns false
+// if an exception is pending.
+static bool GetGlobPatterns(JNIEnv *env, jobjectArray patterns,
+                            std::vector<GlobPattern> *result) {
+  jsize count = env->GetArrayLength(patterns);
+  result->resize(count);
+  for (jsize i = 0; i < count; ++i) {
+    jstring pattern =
+        static_cast<jstring>(env->GetObjectArrayElement(patterns, i));
+    const char *pattern_chars = GetStringLatin1Chars(env, pattern);
+    env->DeleteLocalRef(pattern);
+    if (pattern_chars == NULL) {
+      return false;
+    }
+    SplitGlobPattern(pattern_chars, &(*result)[i]);
+    ReleaseStringLatin1Chars(pattern_chars);
+  }
+  return true;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativePosixFiles
+ * Method:    nativeGlob
+ * Signature: (Ljava/lang/String;[Ljava/lang/String;[Ljava/lang/String;Z)[B
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixFiles_nativeGlob(
+    JNIEnv *env, jclass clazz, jstring root, jobjectArray includes,
+    jobjectArray excludes, jboolean exclude_directories) {
+  GlobWork work;
+  if (!GetGlobPatterns(env, includes, &work.includes) ||
+      !GetGlobPatterns(env, excludes, &work.excludes)) {
+    return NULL;
+  }
+  for (size_t i = 0; i < work.excludes.size(); ++i) {
+    if (work.excludes[i].back() == "**") {
+      work.excluded_trees.push_back(work.excludes[i]);
+      work.excluded_trees.back().pop_back();
+    }
+  }
+  work.exclude_directories = exclude_directories;
+  work.error = 0;
+
+  const char *root_chars = GetStringLatin1Chars(env, root);
+  if (root_chars == NULL) {
+    return NULL;
+  }
+  int fd = open(root_chars, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    // Like UnixGlob, there is nothing to find below what is not a directory.
+    if (errno != ENOENT && errno != ENOTDIR) {
+      ::PostFileException(env, errno, root_chars);
+    }
+  } else {
+    std::set<GlobState> states;
+    for (size_t i = 0; i < work.includes.size(); ++i) {
+      states.insert(GlobState(i, 0));
+    }
+    std::vector<std::string> components;
+    GlobDir(&work, fd, &components, states);
+    if (work.error != 0) {
+      std::string path = root_chars;
+      if (!work.error_path.empty()) {
+        path += "/" + work.error_path;
+      }
+      ::PostFileException(env, work.error, path.c_str());
+    }
+  }
+  ReleaseStringLatin1Chars(root_chars);
+  if (env->ExceptionOccurred()) {
+    return NULL;
+  }
+
+  // All the paths cross the JNI boundary at once, each followed by a NUL.
+  std::vector<jbyte> packed;
+  for (std::set<std::string>::const_iterator it = work.results.begin();
+       it != work.results.end(); ++it) {
+    packed.insert(packed.end(), it->begin(), it->end());
+    packed.push_back(0);
+  }
+  jbyteArray result = env->NewByteArray(packed.size());
+  if (result != NULL && !packed.empty()) {
+    env->SetByteArrayRegion(result, 0, packed.size(), &packed[0]);
+  }
+  return result;
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixSystem_sysctlbynameGetLong(
+    JNIEnv *env, jclass clazz, jstring name) {
+  const char *name_chars = GetStringLatin1Chars(env, name);
+  long r;
+  size_t len = sizeof(r);
+  if (portable_sysctlbyname(name_chars, &r, &len) == -1) {
+    ::PostSystemException(env, errno, "sysctlbyname", name_chars);
+  }
+  ReleaseStringLatin1Chars(name_chars);
+  return (jlong)r;
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixSystem_nativeThreadCpuTimes(
+    JNIEnv *env, jclass clazz) {
+  // Reused, so that a sample allocates nothing in the steady state but the
+  // array it returns.
+  static thread_local std::vector<ThreadCpuTime> times;
+  static thread_local std::vector<jlong> packed;
+  times.clear();
+  if (portable_thread_cpu_times(&times) == -1) {
+    ::PostSystemException(env, errno, "threadCpuTimes", "self");
+    return NULL;
+  }
+  packed.clear();
+  for (const ThreadCpuTime &time : times) {
+    packed.push_back(time.thread_id);
+    packed.push_back(time.user_micros);
+    packed.push_back(time.system_micros);
+  }
+  jlongArray result = env->NewLongArray(packed.size());
+  if (result != NULL && !packed.empty()) {
+    env->SetLongArrayRegion(result, 0, packed.size(), &packed[0]);
+  }
+  return result;
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_unix_NativePosixSystem_nativeCurrentThreadId(
+    JNIEnv *env, jclass clazz) {
+  return portable_thread_id();
 }
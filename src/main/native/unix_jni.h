@@ -18,9 +18,11 @@
 #define BAZEL_SRC_MAIN_NATIVE_UNIX_JNI_H__
 
 #include <jni.h>
+#include <stdint.h>
 #include <sys/stat.h>
 
 #include <string>
+#include <vector>
 
 #define CHECK(condition) \
     do { \
@@ -36,10 +38,12 @@
 typedef struct stat portable_stat_struct;
 #define portable_stat ::stat
 #define portable_lstat ::lstat
+#define portable_fstat ::fstat
 #else
 typedef struct stat64 portable_stat_struct;
 #define portable_stat ::stat64
 #define portable_lstat ::lstat64
+#define portable_fstat ::fstat64
 #endif
 
 #if defined(__FreeBSD__)
@@ -70,6 +74,24 @@ extern std::string ErrorMessage(int error_number);
 int portable_fstatat(int dirfd, char *name, portable_stat_struct *statbuf,
                      int flags);
 
+// The fields of a stat buffer a caller of portable_statx() needs. Keep in sync
+// with NativePosixFiles.STAT_*.
+enum StatFields {
+  STAT_FIELD_TYPE = 1 << 0,   // the file type bits of st_mode
+  STAT_FIELD_MODE = 1 << 1,   // the permission bits of st_mode
+  STAT_FIELD_SIZE = 1 << 2,   // st_size
+  STAT_FIELD_TIMES = 1 << 3,  // st_atim, st_mtim and st_ctim
+  STAT_FIELD_INO = 1 << 4,    // st_dev and st_ino
+};
+
+// Like stat(2), or lstat(2) unless 'follow', but only the 'fields'
+// (StatFields) of 'statbuf' are filled in, the others are zero. Where
+// statx(2) is available, the file system may then skip fetching the rest, and
+// with 'dont_sync', a network file system may answer from its attribute cache
+// rather than revalidate with the server. Elsewhere, this is a plain stat().
+int portable_statx(const char *path, portable_stat_struct *statbuf,
+                   bool follow, int fields, bool dont_sync);
+
 // Encoding for different timestamps in a struct stat{}.
 enum StatTimes {
   STAT_ATIME,  // access
@@ -91,6 +113,81 @@ ssize_t portable_getxattr(const char *path, const char *name, void *value,
 ssize_t portable_lgetxattr(const char *path, const char *name, void *value,
                            size_t size);
 
+// The operations of a batch. Keep in sync with NativePosixFiles.BATCH_*.
+enum BatchOpCode {
+  BATCH_STAT = 0,
+  BATCH_LSTAT = 1,
+  BATCH_UNLINK = 2,
+  BATCH_RMDIR = 3,
+  BATCH_MKDIR = 4,
+};
+
+// One operation of a batch, and its outcome.
+struct BatchOp {
+  BatchOpCode op;
+  const char *path;
+  // 0 on success, otherwise the error number.
+  int error;
+  // For BATCH_STAT and BATCH_LSTAT, the status, on success.
+  portable_stat_struct statbuf;
+};
+
+// Runs the 'count' independent operations 'ops'. They may run concurrently
+// and in any order. On Linux, they are submitted to io_uring(7) a few hundred
+// at a time where the kernel supports it; elsewhere, a few threads run them.
+void portable_run_batch(BatchOp *ops, size_t count);
+
+// Runs a single operation of a batch, synchronously.
+void RunBatchOp(BatchOp *op);
+
+// Runs 'ops' on a few threads. The fallback of portable_run_batch().
+void RunBatchOnThreads(BatchOp *ops, size_t count);
+
+// Runs fgetxattr(2), if available. If not, sets errno to ENOSYS. On FreeBSD,
+// 'name' is in the user namespace.
+ssize_t portable_fgetxattr(int fd, const char *name, void *value, size_t size);
+
+// Runs fsetxattr(2), if available. If not, sets errno to ENOSYS. On FreeBSD,
+// 'name' is in the user namespace.
+int portable_fsetxattr(int fd, const char *name, const void *value,
+                       size_t size);
+
+// Asks the kernel to start reading the first 'size' bytes of the file open as
+// 'fd' into the page cache, without waiting for them. Returns 0 or an error
+// number; the advice is only a hint either way.
+int portable_prefetch(int fd, off_t size);
+
+// Makes 'dst' a copy-on-write clone of 'src', replacing it, with the same
+// mode, where the file system supports that for whole files by path (APFS).
+// Returns 0, or -1 with errno set; ENOTSUP and EXDEV mean the caller should
+// copy the contents instead.
+int portable_clone_file(const char *src, const char *dst);
+
+// Copies the contents of 'src_fd' to 'dst_fd', an empty file, without them
+// passing through user space: by sharing extents where the file system can
+// (FICLONE), otherwise in the kernel. Returns 0, or -1 with errno set; ENOSYS
+// means the caller should read and write the contents itself.
+int portable_copy_contents(int src_fd, int dst_fd);
+
+// The CPU time a thread of this process has used so far.
+struct ThreadCpuTime {
+  // The identifier of the thread, as returned by portable_thread_id().
+  int64_t thread_id;
+  int64_t user_micros;
+  int64_t system_micros;
+};
+
+// Appends the CPU times of all threads of this process to 'times', in no
+// particular order. On Linux, the stat file of each thread stays open between
+// calls, so that a call does not open, close or allocate anything for the
+// threads it has seen before. Returns 0, or -1 with errno set; ENOSYS means
+// the operating system is not supported.
+int portable_thread_cpu_times(std::vector<ThreadCpuTime> *times);
+
+// Returns the identifier of the calling thread among those of
+// portable_thread_cpu_times(), or -1 with errno set to ENOSYS.
+int64_t portable_thread_id();
+
 // Run sysctlbyname(3), only available on darwin
 int portable_sysctlbyname(const char *name_chars, long *mibp, size_t *sizep);
 
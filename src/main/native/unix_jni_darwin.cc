@@ -15,15 +15,21 @@
 #include "src/main/native/unix_jni.h"
 
 #include <assert.h>
+#include <copyfile.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <mach/mach.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/sysctl.h>
 #include <sys/syslimits.h>
 #include <sys/types.h>
+#include <sys/clonefile.h>
 #include <sys/xattr.h>
+#include <unistd.h>
 
 #include <string>
 
@@ -77,6 +83,12 @@ int portable_fstatat(
   return r;
 }
 
+int portable_statx(const char *path, portable_stat_struct *statbuf,
+                   bool follow, int fields, bool dont_sync) {
+  // No statx(2): every field is filled in, and always revalidated.
+  return follow ? portable_stat(path, statbuf) : portable_lstat(path, statbuf);
+}
+
 int StatSeconds(const portable_stat_struct &statbuf, StatTimes t) {
   switch (t) {
     case STAT_ATIME:
@@ -113,6 +125,80 @@ ssize_t portable_lgetxattr(const char *path, const char *name, void *value,
   return getxattr(path, name, value, size, 0, XATTR_NOFOLLOW);
 }
 
+ssize_t portable_fgetxattr(int fd, const char *name, void *value,
+                           size_t size) {
+  return fgetxattr(fd, name, value, size, 0, 0);
+}
+
+int portable_fsetxattr(int fd, const char *name, const void *value,
+                       size_t size) {
+  return fsetxattr(fd, name, value, size, 0, 0);
+}
+
+void portable_run_batch(BatchOp *ops, size_t count) {
+  RunBatchOnThreads(ops, count);
+}
+
+int portable_prefetch(int fd, off_t size) {
+  // There is no posix_fadvise(), but F_RDADVISE does the same.
+  struct radvisory advice;
+  advice.ra_offset = 0;
+  advice.ra_count = size > INT_MAX ? INT_MAX : static_cast<int>(size);
+  return fcntl(fd, F_RDADVISE, &advice) == -1 ? errno : 0;
+}
+
+int portable_clone_file(const char *src, const char *dst) {
+  // clonefile() does not replace, and copies the mode with the extents.
+  if (unlink(dst) == -1 && errno != ENOENT) {
+    return -1;
+  }
+  return clonefile(src, dst, 0);
+}
+
+int portable_copy_contents(int src_fd, int dst_fd) {
+  return fcopyfile(src_fd, dst_fd, NULL, COPYFILE_DATA) == 0 ? 0 : -1;
+}
+
+int portable_thread_cpu_times(std::vector<ThreadCpuTime> *times) {
+  // There is no /proc: thread_info() asks the kernel for each thread.
+  thread_act_array_t threads;
+  mach_msg_type_number_t count;
+  if (task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS) {
+    errno = EIO;
+    return -1;
+  }
+  for (mach_msg_type_number_t i = 0; i < count; i++) {
+    thread_basic_info_data_t basic;
+    mach_msg_type_number_t basic_count = THREAD_BASIC_INFO_COUNT;
+    thread_identifier_info_data_t identifier;
+    mach_msg_type_number_t identifier_count = THREAD_IDENTIFIER_INFO_COUNT;
+    // A thread that has exited meanwhile is left out.
+    if (thread_info(threads[i], THREAD_BASIC_INFO,
+                    reinterpret_cast<thread_info_t>(&basic),
+                    &basic_count) == KERN_SUCCESS &&
+        thread_info(threads[i], THREAD_IDENTIFIER_INFO,
+                    reinterpret_cast<thread_info_t>(&identifier),
+                    &identifier_count) == KERN_SUCCESS) {
+      times->push_back(ThreadCpuTime{
+          static_cast<int64_t>(identifier.thread_id),
+          basic.user_time.seconds * 1000000LL + basic.user_time.microseconds,
+          basic.system_time.seconds * 1000000LL +
+              basic.system_time.microseconds});
+    }
+    mach_port_deallocate(mach_task_self(), threads[i]);
+  }
+  vm_deallocate(mach_task_self(), reinterpret_cast<vm_address_t>(threads),
+                count * sizeof(thread_act_t));
+  return 0;
+}
+
+int64_t portable_thread_id() {
+  // The identifier THREAD_IDENTIFIER_INFO returns.
+  uint64_t thread_id;
+  pthread_threadid_np(NULL, &thread_id);
+  return static_cast<int64_t>(thread_id);
+}
+
 int portable_sysctlbyname(const char *name_chars, long *mibp, size_t *sizep) {
   return sysctlbyname(name_chars, mibp, sizep, NULL, 0);
 }
@@ -44,6 +44,12 @@ int portable_fstatat(int dirfd, char *name, portable_stat_struct *statbuf,
   return fstatat(dirfd, name, statbuf, flags);
 }
 
+int portable_statx(const char *path, portable_stat_struct *statbuf,
+                   bool follow, int fields, bool dont_sync) {
+  // No statx(2): every field is filled in, and always revalidated.
+  return follow ? portable_stat(path, statbuf) : portable_lstat(path, statbuf);
+}
+
 int StatSeconds(const portable_stat_struct &statbuf, StatTimes t) {
   switch (t) {
     case STAT_ATIME:
@@ -80,6 +86,45 @@ ssize_t portable_lgetxattr(const char *path, const char *name, void *value,
   return extattr_get_link(path, EXTATTR_NAMESPACE_SYSTEM, name, value, size);
 }
 
+ssize_t portable_fgetxattr(int fd, const char *name, void *value,
+                           size_t size) {
+  return extattr_get_fd(fd, EXTATTR_NAMESPACE_USER, name, value, size);
+}
+
+int portable_fsetxattr(int fd, const char *name, const void *value,
+                       size_t size) {
+  ssize_t r = extattr_set_fd(fd, EXTATTR_NAMESPACE_USER, name, value, size);
+  return r < 0 ? -1 : 0;
+}
+
+void portable_run_batch(BatchOp *ops, size_t count) {
+  RunBatchOnThreads(ops, count);
+}
+
+int portable_prefetch(int fd, off_t size) {
+  return posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+}
+
+int portable_clone_file(const char *src, const char *dst) {
+  errno = ENOTSUP;
+  return -1;
+}
+
+int portable_copy_contents(int src_fd, int dst_fd) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int portable_thread_cpu_times(std::vector<ThreadCpuTime> *times) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int64_t portable_thread_id() {
+  errno = ENOSYS;
+  return -1;
+}
+
 int portable_sysctlbyname(const char *name_chars, long *mibp, size_t *sizep) {
   return sysctlbyname(name_chars, mibp, sizep, NULL, 0);
 }
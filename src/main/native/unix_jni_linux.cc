@@ -14,13 +14,36 @@
 
 #include "src/main/native/unix_jni.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <sys/xattr.h>
+#include <unistd.h>
 
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+// The headers know IORING_OP_MKDIRAT (5.15) if they know this (5.17).
+#if defined(IORING_FEAT_CQE_SKIP) && defined(STATX_TYPE)
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
 
 std::string ErrorMessage(int error_number) {
   char buf[1024] = "";
@@ -45,6 +68,53 @@ int portable_fstatat(
   return fstatat64(dirfd, name, statbuf, flags);
 }
 
+#if defined(STATX_TYPE)
+static void StatxToStat(const struct statx &buf,
+                        portable_stat_struct *statbuf) {
+  memset(statbuf, 0, sizeof(*statbuf));
+  statbuf->st_mode = buf.stx_mode;
+  statbuf->st_size = buf.stx_size;
+  statbuf->st_atim.tv_sec = buf.stx_atime.tv_sec;
+  statbuf->st_atim.tv_nsec = buf.stx_atime.tv_nsec;
+  statbuf->st_mtim.tv_sec = buf.stx_mtime.tv_sec;
+  statbuf->st_mtim.tv_nsec = buf.stx_mtime.tv_nsec;
+  statbuf->st_ctim.tv_sec = buf.stx_ctime.tv_sec;
+  statbuf->st_ctim.tv_nsec = buf.stx_ctime.tv_nsec;
+  statbuf->st_dev = makedev(buf.stx_dev_major, buf.stx_dev_minor);
+  statbuf->st_ino = buf.stx_ino;
+}
+#endif
+
+int portable_statx(const char *path, portable_stat_struct *statbuf,
+                   bool follow, int fields, bool dont_sync) {
+#if defined(STATX_TYPE)
+  static bool statx_unavailable = false;  // note: harmless race condition
+  if (!statx_unavailable) {
+    unsigned int mask = 0;
+    if (fields & STAT_FIELD_TYPE) mask |= STATX_TYPE;
+    if (fields & STAT_FIELD_MODE) mask |= STATX_MODE;
+    if (fields & STAT_FIELD_SIZE) mask |= STATX_SIZE;
+    if (fields & STAT_FIELD_TIMES) {
+      mask |= STATX_ATIME | STATX_MTIME | STATX_CTIME;
+    }
+    if (fields & STAT_FIELD_INO) mask |= STATX_INO;
+    int flags = (follow ? 0 : AT_SYMLINK_NOFOLLOW) |
+                (dont_sync ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT);
+    struct statx buf;
+    if (::statx(AT_FDCWD, path, flags, mask, &buf) == 0) {
+      StatxToStat(buf, statbuf);
+      return 0;
+    }
+    if (errno != ENOSYS) {
+      return -1;
+    }
+    // Kernels before 4.11.
+    statx_unavailable = true;
+  }
+#endif
+  return follow ? portable_stat(path, statbuf) : portable_lstat(path, statbuf);
+}
+
 int StatSeconds(const portable_stat_struct &statbuf, StatTimes t) {
   switch (t) {
     case STAT_ATIME:
@@ -83,6 +153,436 @@ ssize_t portable_lgetxattr(const char *path, const char *name, void *value,
   return ::lgetxattr(path, name, value, size);
 }
 
+#if defined(HAVE_IO_URING)
+namespace {
+
+// An io_uring(7) instance, set up with the raw system calls, as liburing is
+// not available everywhere this is built.
+struct Ring {
+  int fd;
+  unsigned entries;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+void RingDestroy(Ring *ring) {
+  if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+  if (ring->fd >= 0) close(ring->fd);
+}
+
+// Whether the kernel implements the operations of a batch (5.15 and later).
+bool RingSupportsBatchOps(const Ring &ring) {
+  const int kOps = 256;
+  std::vector<char> buffer(sizeof(struct io_uring_probe) +
+                           kOps * sizeof(struct io_uring_probe_op));
+  struct io_uring_probe *probe =
+      reinterpret_cast<struct io_uring_probe *>(&buffer[0]);
+  if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe,
+              kOps) < 0) {
+    return false;
+  }
+  const int needed[] = {IORING_OP_STATX, IORING_OP_UNLINKAT,
+                        IORING_OP_MKDIRAT};
+  for (int op : needed) {
+    if (op > probe->last_op ||
+        !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Sets up 'ring'. On failure, it still has to be destroyed.
+bool RingInit(Ring *ring, unsigned entries) {
+  memset(ring, 0, sizeof(*ring));
+  ring->sq_ring = ring->cq_ring = MAP_FAILED;
+  ring->sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) {
+    // ENOSYS before 5.1, or EPERM if disabled (kernel.io_uring_disabled).
+    return false;
+  }
+  ring->entries = params.sq_entries;
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+    ring->sq_ring_size = ring->cq_ring_size;
+  }
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) {
+    return false;
+  }
+  if (single_mmap) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring =
+        mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) {
+      return false;
+    }
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = static_cast<struct io_uring_sqe *>(
+      mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES));
+  if (ring->sqes == MAP_FAILED) {
+    return false;
+  }
+  char *sq = static_cast<char *>(ring->sq_ring);
+  char *cq = static_cast<char *>(ring->cq_ring);
+  ring->sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  ring->sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  ring->sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  ring->sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  ring->cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  ring->cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  ring->cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  ring->cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+  return RingSupportsBatchOps(*ring);
+}
+
+// Fills in the submission for 'op', or returns false if io_uring cannot run
+// it.
+bool PrepareBatchOp(const BatchOp &op, struct statx *statx_buf,
+                    struct io_uring_sqe *sqe) {
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = AT_FDCWD;
+  sqe->addr = reinterpret_cast<uintptr_t>(op.path);
+  switch (op.op) {
+    case BATCH_STAT:
+    case BATCH_LSTAT:
+      sqe->opcode = IORING_OP_STATX;
+      sqe->len = STATX_BASIC_STATS;
+      sqe->off = reinterpret_cast<uintptr_t>(statx_buf);
+      sqe->statx_flags = op.op == BATCH_LSTAT ? AT_SYMLINK_NOFOLLOW : 0;
+      return true;
+    case BATCH_UNLINK:
+    case BATCH_RMDIR:
+      sqe->opcode = IORING_OP_UNLINKAT;
+      sqe->unlink_flags = op.op == BATCH_RMDIR ? AT_REMOVEDIR : 0;
+      return true;
+    case BATCH_MKDIR:
+      sqe->opcode = IORING_OP_MKDIRAT;
+      sqe->len = 0777;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Runs 'ops' through 'ring', at most ring.entries at a time. Returns false,
+// with the outcome of the operations undefined, if the ring failed.
+bool RunBatchOnRing(Ring *ring, BatchOp *ops, size_t count) {
+  // Each operation in flight holds one slot, with its statx buffer.
+  struct statx *statx_bufs = new struct statx[ring->entries];
+  std::vector<size_t> slot_ops(ring->entries);
+  std::vector<unsigned> free_slots;
+  for (unsigned slot = 0; slot < ring->entries; ++slot) {
+    free_slots.push_back(ring->entries - 1 - slot);
+  }
+
+  size_t next = 0;
+  size_t in_flight = 0;
+  unsigned sq_tail = *ring->sq_tail;
+  while (next < count || in_flight > 0) {
+    while (next < count && !free_slots.empty()) {
+      BatchOp *op = &ops[next++];
+      unsigned slot = free_slots.back();
+      struct io_uring_sqe *sqe = &ring->sqes[sq_tail & *ring->sq_mask];
+      if (!PrepareBatchOp(*op, &statx_bufs[slot], sqe)) {
+        RunBatchOp(op);
+        continue;
+      }
+      free_slots.pop_back();
+      slot_ops[slot] = op - ops;
+      sqe->user_data = slot;
+      ring->sq_array[sq_tail & *ring->sq_mask] = sq_tail & *ring->sq_mask;
+      ++sq_tail;
+      ++in_flight;
+    }
+    __atomic_store_n(ring->sq_tail, sq_tail, __ATOMIC_RELEASE);
+
+    // Whatever the kernel has not consumed yet, including after an EINTR.
+    unsigned to_submit =
+        sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (in_flight > 0 &&
+        syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      // The kernel may still write to the statx buffers of the operations in
+      // flight, so they are leaked.
+      return false;
+    }
+
+    unsigned cq_head = *ring->cq_head;
+    unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; cq_head != cq_tail; ++cq_head) {
+      const struct io_uring_cqe &cqe = ring->cqes[cq_head & *ring->cq_mask];
+      unsigned slot = cqe.user_data;
+      BatchOp *op = &ops[slot_ops[slot]];
+      if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+        RunBatchOp(op);
+      } else {
+        op->error = cqe.res < 0 ? -cqe.res : 0;
+        if (op->error == 0 && (op->op == BATCH_STAT || op->op == BATCH_LSTAT)) {
+          StatxToStat(statx_bufs[slot], &op->statbuf);
+        }
+      }
+      free_slots.push_back(slot);
+      --in_flight;
+    }
+    __atomic_store_n(ring->cq_head, cq_head, __ATOMIC_RELEASE);
+  }
+  delete[] statx_bufs;
+  return true;
+}
+
+}  // namespace
+#endif  // defined(HAVE_IO_URING)
+
+ssize_t portable_fgetxattr(int fd, const char *name, void *value,
+                           size_t size) {
+  return ::fgetxattr(fd, name, value, size);
+}
+
+int portable_fsetxattr(int fd, const char *name, const void *value,
+                       size_t size) {
+  return ::fsetxattr(fd, name, value, size, 0);
+}
+
+void portable_run_batch(BatchOp *ops, size_t count) {
+#if defined(HAVE_IO_URING)
+  // Below this, setting up a ring costs about as much as it saves.
+  const size_t kMinRingBatch = 16;
+  // Enough operations in flight to keep a disk or a network file system
+  // busy.
+  const unsigned kRingEntries = 256;
+  if (count >= kMinRingBatch) {
+    static bool ring_unavailable = false;  // note: harmless race condition
+    if (!ring_unavailable) {
+      Ring ring;
+      bool ok = RingInit(&ring, kRingEntries);
+      if (!ok) {
+        ring_unavailable = true;
+      } else {
+        ok = RunBatchOnRing(&ring, ops, count);
+      }
+      RingDestroy(&ring);
+      if (ok) {
+        return;
+      }
+      // If the ring broke midway, the operations are run again: an unlink or
+      // mkdir that already happened then reports ENOENT or EEXIST.
+      ring_unavailable = true;
+    }
+  }
+#endif
+  RunBatchOnThreads(ops, count);
+}
+
+int portable_prefetch(int fd, off_t size) {
+  // Starts readahead of the range, which readahead(2) would do, too, but
+  // without reading the metadata synchronously first.
+  return posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+}
+
+int portable_clone_file(const char *src, const char *dst) {
+  // Cloning goes through the file descriptors, see portable_copy_contents().
+  errno = ENOTSUP;
+  return -1;
+}
+
+int portable_copy_contents(int src_fd, int dst_fd) {
+#if defined(FICLONE)
+  // btrfs and XFS share the extents: no data is copied at all.
+  if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+    return 0;
+  }
+#endif
+
+  // Otherwise copy_file_range(2), which may still clone on NFS 4.2 or
+  // copy on the server; failing that for the first chunk, sendfile(2).
+  // Either fails without having copied anything if the kernel or the file
+  // systems do not support it.
+  const size_t kChunk = 1 << 30;
+  bool copied = false;
+#if defined(__NR_copy_file_range)
+  for (;;) {
+    ssize_t r = syscall(__NR_copy_file_range, src_fd, NULL, dst_fd, NULL,
+                        kChunk, 0);
+    if (r == 0) {
+      return 0;
+    }
+    if (r == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (copied || (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+                     errno != EOPNOTSUPP)) {
+        return -1;
+      }
+      break;
+    }
+    copied = true;
+  }
+#endif
+  for (;;) {
+    ssize_t r = sendfile(dst_fd, src_fd, NULL, kChunk);
+    if (r == 0) {
+      return 0;
+    }
+    if (r == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (!copied && (errno == EINVAL || errno == ENOSYS)) {
+        errno = ENOSYS;
+      }
+      return -1;
+    }
+    copied = true;
+  }
+}
+
+// The stat file of a thread, open in /proc/self/task.
+struct TaskStatFile {
+  int fd;
+  // The call of portable_thread_cpu_times() that last found the thread.
+  uint64_t generation;
+};
+
+// What portable_thread_cpu_times() keeps open between calls.
+static pthread_mutex_t task_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int task_dir_fd = -1;
+static uint64_t task_generation = 0;
+static std::unordered_map<pid_t, TaskStatFile> *task_stat_files = NULL;
+
+// Parses the user and system time, in clock ticks, out of the contents of a
+// /proc/<pid>/task/<tid>/stat file.
+static bool ParseTaskStat(const char *stat, int64_t *utime, int64_t *stime) {
+  // The name of the thread, in parentheses, may contain anything; utime and
+  // stime are the 12th and 13th fields after it (see proc(5)).
+  const char *p = strrchr(stat, ')');
+  for (int i = 0; p != NULL && i < 12; i++) {
+    p = strchr(p + 1, ' ');
+  }
+  if (p == NULL) {
+    return false;
+  }
+  char *end;
+  *utime = strtoll(p + 1, &end, 10);
+  if (*end != ' ') {
+    return false;
+  }
+  *stime = strtoll(end + 1, &end, 10);
+  return *end == ' ';
+}
+
+static int ThreadCpuTimesLocked(std::vector<ThreadCpuTime> *times) {
+  static const int64_t ticks_per_second = sysconf(_SC_CLK_TCK);
+  if (task_dir_fd == -1) {
+    task_dir_fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (task_dir_fd == -1) {
+      return -1;
+    }
+    task_stat_files = new std::unordered_map<pid_t, TaskStatFile>();
+  }
+  uint64_t generation = ++task_generation;
+
+  // The directory is listed again from the start, without reopening it.
+  if (lseek(task_dir_fd, 0, SEEK_SET) == -1) {
+    return -1;
+  }
+  alignas(struct dirent64) char entries[16384];
+  for (;;) {
+    long size = syscall(SYS_getdents64, task_dir_fd, entries, sizeof(entries));
+    if (size == -1) {
+      return -1;
+    } else if (size == 0) {
+      break;
+    }
+    for (long pos = 0; pos < size;) {
+      const struct dirent64 *ent =
+          reinterpret_cast<const struct dirent64 *>(entries + pos);
+      pos += ent->d_reclen;
+      if (ent->d_name[0] == '.') {
+        continue;
+      }
+      pid_t tid = atoi(ent->d_name);
+      auto it = task_stat_files->find(tid);
+      if (it == task_stat_files->end()) {
+        char path[32];
+        snprintf(path, sizeof(path), "%d/stat", tid);
+        int fd = openat(task_dir_fd, path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+          // The thread has exited meanwhile.
+          continue;
+        }
+        it = task_stat_files->emplace(tid, TaskStatFile{fd, 0}).first;
+      }
+      it->second.generation = generation;
+      char stat[1024];
+      ssize_t r = pread(it->second.fd, stat, sizeof(stat) - 1, 0);
+      int64_t utime, stime;
+      if (r <= 0) {
+        continue;
+      }
+      stat[r] = '\0';
+      if (!ParseTaskStat(stat, &utime, &stime)) {
+        continue;
+      }
+      times->push_back(ThreadCpuTime{tid, utime * 1000000 / ticks_per_second,
+                                     stime * 1000000 / ticks_per_second});
+    }
+  }
+
+  // The threads that were not found have exited.
+  for (auto it = task_stat_files->begin(); it != task_stat_files->end();) {
+    if (it->second.generation != generation) {
+      close(it->second.fd);
+      it = task_stat_files->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return 0;
+}
+
+int portable_thread_cpu_times(std::vector<ThreadCpuTime> *times) {
+  pthread_mutex_lock(&task_mutex);
+  int result = ThreadCpuTimesLocked(times);
+  int saved_errno = errno;
+  pthread_mutex_unlock(&task_mutex);
+  errno = saved_errno;
+  return result;
+}
+
+int64_t portable_thread_id() {
+  return syscall(SYS_gettid);
+}
+
 int portable_sysctlbyname(const char *name_chars, long *mibp, size_t *sizep) {
   errno = ENOSYS;
   return -1;
@@ -0,0 +1,838 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Subprocesses started without going through java.lang.Process, which forks
+// the whole JVM (or spawns a helper that does). Children are created with
+// vfork(), which neither copies the page tables of the heap nor runs
+// anything but the few system calls below before execve().
+
+#include <errno.h>
+#include <fcntl.h>
+#include <jni.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "src/main/cpp/util/cgroup_stats.h"
+#include "src/main/native/unix_jni.h"
+
+using blaze_util::FindCgroupValue;
+using blaze_util::ReadCgroupFile;
+using blaze_util::SumCgroupValues;
+
+extern char **environ;
+
+namespace {
+
+// The streams of a process, as numbered by NativeProcesses.
+enum StreamId { STREAM_STDIN = 0, STREAM_STDOUT = 1, STREAM_STDERR = 2 };
+
+struct NativeProcess {
+  pid_t pid;
+  // The parent's ends of the pipes, or -1 if the stream was redirected to a
+  // file or was closed.
+  int fds[3];
+
+  // Protects the fields below. The pid is only signalled while the process
+  // is not reaped, so that it cannot have been reused meanwhile.
+  pthread_mutex_t mutex;
+  bool reaped;
+  int exit_value;
+  struct rusage rusage;
+};
+
+// The arguments of a child, prepared before vfork(): the child must not
+// allocate memory.
+struct SpawnParams {
+  const char *path;
+  char *const *argv;
+  char *const *envp;
+  const char *cwd;    // or NULL
+  int fds[3];         // the child's stdin, stdout and stderr
+  int cgroup_fd;      // cgroup.procs of the child's cgroup, or -1
+};
+
+// Holds a Java string as modified UTF-8.
+class JavaChars {
+ public:
+  JavaChars(JNIEnv *env, jstring str)
+      : env_(env),
+        str_(str),
+        chars_(str == NULL ? NULL : env->GetStringUTFChars(str, NULL)) {}
+  ~JavaChars() {
+    if (chars_ != NULL) {
+      env_->ReleaseStringUTFChars(str_, chars_);
+    }
+  }
+  const char *get() const { return chars_; }
+
+ private:
+  JNIEnv *env_;
+  jstring str_;
+  const char *chars_;
+
+  JavaChars(const JavaChars &);
+  void operator=(const JavaChars &);
+};
+
+}  // namespace
+
+// Copies the strings of 'array'; returns false on an out-of-memory error,
+// which is then pending.
+static bool GetStrings(JNIEnv *env, jobjectArray array,
+                       std::vector<std::string> *result) {
+  jsize count = env->GetArrayLength(array);
+  for (jsize i = 0; i < count; ++i) {
+    jstring str = static_cast<jstring>(env->GetObjectArrayElement(array, i));
+    const char *chars = env->GetStringUTFChars(str, NULL);
+    if (chars == NULL) {
+      return false;
+    }
+    result->push_back(chars);
+    env->ReleaseStringUTFChars(str, chars);
+    env->DeleteLocalRef(str);
+  }
+  return true;
+}
+
+static std::vector<char *> ToCharPointers(std::vector<std::string> *strings) {
+  std::vector<char *> result;
+  for (size_t i = 0; i < strings->size(); ++i) {
+    result.push_back(&(*strings)[i][0]);
+  }
+  result.push_back(NULL);
+  return result;
+}
+
+// Looks 'file' up in the PATH of this process, like java.lang.ProcessBuilder
+// does, returning the path to execute.
+static std::string FindExecutable(const std::string &file) {
+  if (file.find('/') != std::string::npos) {
+    return file;
+  }
+  const char *path = getenv("PATH");
+  std::string dirs = path != NULL ? path : "/bin:/usr/bin";
+  for (size_t begin = 0; begin <= dirs.size();) {
+    size_t end = dirs.find(':', begin);
+    if (end == std::string::npos) {
+      end = dirs.size();
+    }
+    std::string dir = dirs.substr(begin, end - begin);
+    std::string candidate = (dir.empty() ? "." : dir) + "/" + file;
+    struct stat statbuf;
+    if (access(candidate.c_str(), X_OK) == 0 &&
+        stat(candidate.c_str(), &statbuf) == 0 && S_ISREG(statbuf.st_mode)) {
+      return candidate;
+    }
+    begin = end + 1;
+  }
+  return file;  // execve() then fails with ENOENT
+}
+
+// Returns a close-on-exec copy of 'fd' above the standard streams, which the
+// child's dup2()s would otherwise clobber, closing 'fd'.
+static int MoveAboveStandardStreams(int fd) {
+  if (fd < 0 || fd > STDERR_FILENO) {
+    return fd;
+  }
+  int moved = fcntl(fd, F_DUPFD, STDERR_FILENO + 1);
+  if (moved >= 0) {
+    fcntl(moved, F_SETFD, FD_CLOEXEC);
+  }
+  close(fd);
+  return moved;
+}
+
+static int OpenCloexec(const char *path, int flags, mode_t mode) {
+  int fd = open(path, flags | O_CLOEXEC, mode);
+  return MoveAboveStandardStreams(fd);
+}
+
+// Creates a pipe whose ends are close-on-exec; the child's copies are made
+// by dup2(), which clears the flag.
+static int MakePipe(int fds[2]) {
+  if (pipe(fds) == -1) {
+    return -1;
+  }
+  for (int i = 0; i < 2; ++i) {
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    fds[i] = MoveAboveStandardStreams(fds[i]);
+  }
+  return fds[0] >= 0 && fds[1] >= 0 ? 0 : -1;
+}
+
+// Starts the child. Returns its pid, or -1 with errno set, also if the
+// child failed before execve().
+static pid_t Spawn(const SpawnParams &params) {
+  // A signal must not run a JVM handler in the child, which shares the
+  // memory of this process until it calls execve().
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+  volatile int child_error = 0;
+  pid_t pid = vfork();
+  if (pid == 0) {
+    // Only system calls from here on. Dispositions other than the default
+    // and ignoring survive execve(), so reset them all.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    for (int sig = 1; sig < NSIG; ++sig) {
+      sigaction(sig, &action, NULL);
+    }
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+
+    // Its own process group, so that the process can be killed with the
+    // processes it started.
+    if (setpgid(0, 0) == -1) {
+      child_error = errno;
+      _exit(127);
+    }
+    // Writing 0 moves the writer itself.
+    if (params.cgroup_fd >= 0 && write(params.cgroup_fd, "0", 1) != 1) {
+      child_error = errno;
+      _exit(127);
+    }
+    for (int i = 0; i < 3; ++i) {
+      if (dup2(params.fds[i], i) == -1) {
+        child_error = errno;
+        _exit(127);
+      }
+    }
+    if (params.cwd != NULL && chdir(params.cwd) == -1) {
+      child_error = errno;
+      _exit(127);
+    }
+    sigprocmask(SIG_SETMASK, &no_signals, NULL);
+    execve(params.path, params.argv, params.envp);
+    child_error = errno;
+    _exit(127);
+  }
+
+  int error = pid == -1 ? errno : child_error;
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  if (pid != -1 && error != 0) {
+    // The child is gone already.
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {
+    }
+    pid = -1;
+  }
+  errno = error;
+  return pid;
+}
+
+static NativeProcess *GetProcess(jlong process) {
+  return reinterpret_cast<NativeProcess *>(process);
+}
+
+// Reaps the process, which has terminated. Called with process->mutex held.
+static void Reap(NativeProcess *process) {
+  if (process->reaped) {
+    return;
+  }
+  int status;
+  pid_t r;
+  while ((r = wait4(process->pid, &status, 0, &process->rusage)) == -1 &&
+         errno == EINTR) {
+  }
+  if (r == -1) {
+    // Someone else reaped it.
+    process->exit_value = -1;
+    memset(&process->rusage, 0, sizeof(process->rusage));
+  } else if (WIFEXITED(status)) {
+    process->exit_value = WEXITSTATUS(status);
+  } else {
+    // Like java.lang.Process on Unix.
+    process->exit_value = 128 + WTERMSIG(status);
+  }
+  process->reaped = true;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeCreateProcess
+ * Signature: ([Ljava/lang/String;[Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)J
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeCreateProcess(
+    JNIEnv *env, jclass clazz, jobjectArray argv, jobjectArray environment,
+    jstring cwd, jstring stdout_file, jstring stderr_file, jstring cgroup) {
+  std::vector<std::string> args, vars;
+  if (!GetStrings(env, argv, &args) ||
+      (environment != NULL && !GetStrings(env, environment, &vars))) {
+    return 0;  // the exception is pending
+  }
+  if (args.empty()) {
+    ::PostException(env, EINVAL, "empty argv");
+    return 0;
+  }
+  std::vector<char *> arg_pointers = ToCharPointers(&args);
+  std::vector<char *> var_pointers = ToCharPointers(&vars);
+  char *const *envp = environment != NULL ? &var_pointers[0] : environ;
+  std::string path = FindExecutable(args[0]);
+  JavaChars cwd_chars(env, cwd);
+  JavaChars stdout_chars(env, stdout_file);
+  JavaChars stderr_chars(env, stderr_file);
+  JavaChars cgroup_chars(env, cgroup);
+  const char *files[3] = {NULL, stdout_chars.get(), stderr_chars.get()};
+
+  NativeProcess *process = new NativeProcess();
+  // The loop below stops at the first failure; the streams it did not get to
+  // must not be closed on the error path.
+  for (int i = 0; i < 3; ++i) {
+    process->fds[i] = -1;
+  }
+  SpawnParams params;
+  params.path = path.c_str();
+  params.argv = &arg_pointers[0];
+  params.envp = envp;
+  params.cwd = cwd_chars.get();
+  params.cgroup_fd = -1;
+  int child_fds[3] = {-1, -1, -1};
+  int error = 0;
+  std::string error_path;
+  for (int i = 0; i < 3 && error == 0; ++i) {
+    if (files[i] != NULL) {
+      // Appending keeps the writes of a process and its children atomic,
+      // which they are not with a plain offset on older Linux kernels.
+      child_fds[i] = OpenCloexec(files[i],
+                                 O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+      if (child_fds[i] == -1) {
+        error = errno;
+        error_path = files[i];
+      }
+    } else {
+      int pipe_fds[2];
+      if (MakePipe(pipe_fds) == -1) {
+        error = errno;
+        error_path = "pipe";
+      } else {
+        // The child reads stdin and writes the others.
+        child_fds[i] = pipe_fds[i == STREAM_STDIN ? 0 : 1];
+        process->fds[i] = pipe_fds[i == STREAM_STDIN ? 1 : 0];
+      }
+    }
+  }
+  if (error == 0 && cgroup_chars.get() != NULL) {
+    error_path = std::string(cgroup_chars.get()) + "/cgroup.procs";
+    params.cgroup_fd = OpenCloexec(error_path.c_str(), O_WRONLY, 0);
+    if (params.cgroup_fd == -1) {
+      error = errno;
+    }
+  }
+  if (error == 0) {
+    memcpy(params.fds, child_fds, sizeof(child_fds));
+    process->pid = Spawn(params);
+    if (process->pid == -1) {
+      error = errno;
+      error_path = args[0];
+    }
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    if (child_fds[i] >= 0) {
+      close(child_fds[i]);
+    }
+  }
+  if (params.cgroup_fd >= 0) {
+    close(params.cgroup_fd);
+  }
+  if (error != 0) {
+    for (int i = 0; i < 3; ++i) {
+      if (process->fds[i] >= 0) {
+        close(process->fds[i]);
+      }
+    }
+    delete process;
+    ::PostFileException(env, error, error_path.c_str());
+    return 0;
+  }
+  pthread_mutex_init(&process->mutex, NULL);
+  process->reaped = false;
+  process->exit_value = -1;
+  memset(&process->rusage, 0, sizeof(process->rusage));
+  return reinterpret_cast<jlong>(process);
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeWriteStdin
+ * Signature: (J[BII)I
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeWriteStdin(
+    JNIEnv *env, jclass clazz, jlong process, jbyteArray bytes, jint offset,
+    jint length) {
+  int fd = GetProcess(process)->fds[STREAM_STDIN];
+  jbyte buffer[16 * 1024];
+  if (length > static_cast<jint>(sizeof(buffer))) {
+    length = sizeof(buffer);
+  }
+  env->GetByteArrayRegion(bytes, offset, length, buffer);
+  ssize_t r;
+  while ((r = write(fd, buffer, length)) == -1 && errno == EINTR) {
+  }
+  if (r == -1) {
+    ::PostException(env, fd == -1 ? EBADF : errno, "stdin");
+  }
+  return r;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeReadStream
+ * Signature: (JI[BII)I
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeReadStream(
+    JNIEnv *env, jclass clazz, jlong process, jint stream, jbyteArray bytes,
+    jint offset, jint length) {
+  int fd = GetProcess(process)->fds[stream];
+  jbyte buffer[16 * 1024];
+  if (length > static_cast<jint>(sizeof(buffer))) {
+    length = sizeof(buffer);
+  }
+  ssize_t r;
+  while ((r = read(fd, buffer, length)) == -1 && errno == EINTR) {
+  }
+  if (r == -1) {
+    ::PostException(env, fd == -1 ? EBADF : errno,
+                    stream == STREAM_STDOUT ? "stdout" : "stderr");
+  } else if (r > 0) {
+    env->SetByteArrayRegion(bytes, offset, r, buffer);
+  }
+  return r;
+}
+
+// Keeps the last 'capacity' bytes appended to it.
+class TailBuffer {
+ public:
+  explicit TailBuffer(size_t capacity) : capacity_(capacity) {}
+
+  void Append(const char *bytes, size_t length) {
+    data_.append(bytes, length);
+    // Trims only once in a while, to not move the data on every append.
+    if (data_.size() > 2 * capacity_) {
+      data_.erase(0, data_.size() - capacity_);
+    }
+  }
+
+  std::string Get() const {
+    return data_.size() > capacity_ ? data_.substr(data_.size() - capacity_)
+                                    : data_;
+  }
+
+ private:
+  const size_t capacity_;
+  std::string data_;
+};
+
+static bool WriteFully(int fd, const char *bytes, size_t length) {
+  while (length > 0) {
+    ssize_t r = write(fd, bytes, length);
+    if (r == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += r;
+    length -= r;
+  }
+  return true;
+}
+
+// Copies 'in' to 'out' until EOF with read() and write(), adding what passes
+// to 'tail'. Returns 0, or the errno of the failure.
+static int CopyStream(int in, int out, TailBuffer *tail) {
+  char buffer[64 * 1024];
+  for (;;) {
+    ssize_t r = read(in, buffer, sizeof(buffer));
+    if (r == 0) {
+      return 0;
+    } else if (r == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    if (!WriteFully(out, buffer, r)) {
+      return errno;
+    }
+    tail->Append(buffer, r);
+  }
+}
+
+#if defined(__linux__)
+// Like CopyStream(), but moves the data from the pipe 'in' to 'out' inside
+// the kernel with splice(), after duplicating it into a pipe of its own with
+// tee() to keep the tail. Returns EINVAL before copying anything if 'in' or
+// 'out' does not support that, e.g. for a file system without splice().
+static int SpliceStream(int in, int out, TailBuffer *tail) {
+  int tail_pipe[2];
+  if (MakePipe(tail_pipe) == -1) {
+    return errno;
+  }
+  int error = 0;
+  bool copied = false;
+  char buffer[64 * 1024];
+  for (;;) {
+    // Blocks until the child writes, or closes its end.
+    ssize_t teed = tee(in, tail_pipe[1], sizeof(buffer), 0);
+    if (teed == -1 && errno == EINTR) {
+      continue;
+    }
+    if (teed <= 0) {
+      error = teed == 0 ? 0 : errno;
+      break;
+    }
+    ssize_t remaining = teed;
+    while (remaining > 0) {
+      ssize_t moved = splice(in, NULL, out, NULL, remaining, SPLICE_F_MOVE);
+      if (moved == -1 && errno == EINTR) {
+        continue;
+      }
+      if (moved <= 0) {
+        error = moved == 0 ? EIO : errno;
+        break;
+      }
+      remaining -= moved;
+    }
+    if (error != 0) {
+      if (!copied && error == EINVAL) {
+        // Nothing left 'in' yet; the caller falls back to CopyStream(),
+        // which reads the same data again.
+        break;
+      }
+      error = error == EINVAL ? EIO : error;
+      break;
+    }
+    copied = true;
+    // Drain what tee() duplicated, which fits in the pipe.
+    for (ssize_t left = teed; left > 0;) {
+      ssize_t r = read(tail_pipe[0], buffer, left);
+      if (r == -1 && errno == EINTR) {
+        continue;
+      }
+      if (r <= 0) {
+        break;
+      }
+      tail->Append(buffer, r);
+      left -= r;
+    }
+  }
+  close(tail_pipe[0]);
+  close(tail_pipe[1]);
+  return error;
+}
+#endif
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeTeeStream
+ * Signature: (JILjava/lang/String;I)[B
+ * Throws:    java.io.IOException
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeTeeStream(
+    JNIEnv *env, jclass clazz, jlong process, jint stream, jstring log_file,
+    jint tail_bytes) {
+  NativeProcess *p = GetProcess(process);
+  int fd = p->fds[stream];
+  const char *name = stream == STREAM_STDOUT ? "stdout" : "stderr";
+  if (fd == -1) {
+    ::PostException(env, EBADF, name);
+    return NULL;
+  }
+  JavaChars log_chars(env, log_file);
+  // Not O_APPEND, which splice() rejects: the earlier contents are kept by
+  // starting at the end.
+  int log_fd = OpenCloexec(log_chars.get(), O_WRONLY | O_CREAT, 0666);
+  if (log_fd == -1 || lseek(log_fd, 0, SEEK_END) == -1) {
+    int error = errno;
+    if (log_fd != -1) {
+      close(log_fd);
+    }
+    ::PostFileException(env, error, log_chars.get());
+    return NULL;
+  }
+
+  TailBuffer tail(tail_bytes > 0 ? tail_bytes : 0);
+  int error = EINVAL;
+#if defined(__linux__)
+  error = SpliceStream(fd, log_fd, &tail);
+#endif
+  if (error == EINVAL) {
+    error = CopyStream(fd, log_fd, &tail);
+  }
+  if (close(log_fd) == -1 && error == 0) {
+    error = errno;
+  }
+  if (error != 0) {
+    ::PostFileException(env, error, log_chars.get());
+    return NULL;
+  }
+
+  std::string contents = tail.Get();
+  jbyteArray result = env->NewByteArray(contents.size());
+  if (result != NULL) {
+    env->SetByteArrayRegion(result, 0, contents.size(),
+                            reinterpret_cast<const jbyte *>(contents.data()));
+  }
+  return result;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeCloseStream
+ * Signature: (JI)V
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeCloseStream(
+    JNIEnv *env, jclass clazz, jlong process, jint stream) {
+  NativeProcess *p = GetProcess(process);
+  pthread_mutex_lock(&p->mutex);
+  int fd = p->fds[stream];
+  p->fds[stream] = -1;
+  pthread_mutex_unlock(&p->mutex);
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+// Returns whether the process terminated, without reaping it; waits up to
+// 'timeout_millis' for it if that is not negative, indefinitely otherwise.
+static bool WaitForTermination(NativeProcess *process, jlong timeout_millis) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_millis / 1000;
+  deadline.tv_nsec += (timeout_millis % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  // There is no portable way to wait for a child with a timeout, so poll,
+  // less and less often.
+  long sleep_nanos = 1000000;
+  for (;;) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    int options = WEXITED | WNOWAIT | (timeout_millis >= 0 ? WNOHANG : 0);
+    int r = waitid(P_PID, process->pid, &info, options);
+    if (r == -1 && errno == EINTR) {
+      continue;
+    }
+    if (r == -1 || info.si_pid != 0) {
+      // Terminated; or reaped already, and ECHILD.
+      return true;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long remaining =
+        (deadline.tv_sec - now.tv_sec) * 1000000000LL +
+        (deadline.tv_nsec - now.tv_nsec);
+    if (remaining <= 0) {
+      return false;
+    }
+    struct timespec sleep_time = {0, sleep_nanos < remaining ? sleep_nanos
+                                                             : remaining};
+    nanosleep(&sleep_time, NULL);
+    if (sleep_nanos < 100000000) {
+      sleep_nanos *= 2;
+    }
+  }
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeWaitFor
+ * Signature: (JJ)Z
+ */
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeWaitFor(
+    JNIEnv *env, jclass clazz, jlong process, jlong timeout_millis) {
+  NativeProcess *p = GetProcess(process);
+  pthread_mutex_lock(&p->mutex);
+  bool reaped = p->reaped;
+  pthread_mutex_unlock(&p->mutex);
+  if (!reaped && !WaitForTermination(p, timeout_millis)) {
+    return false;
+  }
+  pthread_mutex_lock(&p->mutex);
+  Reap(p);
+  pthread_mutex_unlock(&p->mutex);
+  return true;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeGetExitValue
+ * Signature: (J)I
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeGetExitValue(
+    JNIEnv *env, jclass clazz, jlong process) {
+  NativeProcess *p = GetProcess(process);
+  pthread_mutex_lock(&p->mutex);
+  int exit_value = p->reaped ? p->exit_value : -1;
+  pthread_mutex_unlock(&p->mutex);
+  return exit_value;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeGetResourceUsage
+ * Signature: (J)[J
+ */
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeGetResourceUsage(
+    JNIEnv *env, jclass clazz, jlong process) {
+  NativeProcess *p = GetProcess(process);
+  pthread_mutex_lock(&p->mutex);
+  const struct rusage &ru = p->rusage;
+  jlong values[] = {
+      ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec,
+      ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec,
+#if defined(__APPLE__)
+      ru.ru_maxrss / 1024,  // bytes there
+#else
+      ru.ru_maxrss,
+#endif
+      ru.ru_minflt,
+      ru.ru_majflt,
+      ru.ru_nvcsw,
+      ru.ru_nivcsw,
+      ru.ru_inblock,
+      ru.ru_oublock,
+  };
+  pthread_mutex_unlock(&p->mutex);
+  const jsize count = sizeof(values) / sizeof(values[0]);
+  jlongArray result = env->NewLongArray(count);
+  if (result != NULL) {
+    env->SetLongArrayRegion(result, 0, count, values);
+  }
+  return result;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeGetPid
+ * Signature: (J)I
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeGetPid(
+    JNIEnv *env, jclass clazz, jlong process) {
+  return GetProcess(process)->pid;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeTerminate
+ * Signature: (JZ)Z
+ */
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeTerminate(
+    JNIEnv *env, jclass clazz, jlong process, jboolean force) {
+  NativeProcess *p = GetProcess(process);
+  pthread_mutex_lock(&p->mutex);
+  // The whole process group, which the child leads.
+  bool signalled = !p->reaped && kill(-p->pid, force ? SIGKILL : SIGTERM) == 0;
+  pthread_mutex_unlock(&p->mutex);
+  return signalled;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeDeleteProcess
+ * Signature: (J)V
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeDeleteProcess(
+    JNIEnv *env, jclass clazz, jlong process) {
+  NativeProcess *p = GetProcess(process);
+  for (int i = 0; i < 3; ++i) {
+    if (p->fds[i] >= 0) {
+      close(p->fds[i]);
+    }
+  }
+  pthread_mutex_lock(&p->mutex);
+  if (!p->reaped) {
+    // Leave no zombie behind.
+    kill(-p->pid, SIGKILL);
+    Reap(p);
+  }
+  pthread_mutex_unlock(&p->mutex);
+  pthread_mutex_destroy(&p->mutex);
+  delete p;
+}
+
+/*
+ * Class:     com.google.devtools.build.lib.unix.NativeProcesses
+ * Method:    nativeGetCgroupStats
+ * Signature: (Ljava/lang/String;)[J
+ */
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_google_devtools_build_lib_unix_NativeProcesses_nativeGetCgroupStats(
+    JNIEnv *env, jclass clazz, jstring cgroup) {
+  JavaChars cgroup_chars(env, cgroup);
+  if (cgroup_chars.get() == NULL) {
+    return NULL;
+  }
+  std::string dir(cgroup_chars.get());
+  jlong values[] = {-1, -1, -1, -1};
+  std::string contents;
+
+  // The unified hierarchy (cgroup v2) first, then the files of the v1
+  // controllers that may be mounted at 'dir'.
+  if (ReadCgroupFile(dir, "cpu.stat", &contents)) {
+    values[0] = FindCgroupValue(contents, "usage_usec ");
+  } else if (ReadCgroupFile(dir, "cpuacct.usage", &contents)) {
+    values[0] = strtoll(contents.c_str(), NULL, 10) / 1000;  // nanoseconds
+  }
+  if (ReadCgroupFile(dir, "memory.peak", &contents) ||
+      ReadCgroupFile(dir, "memory.max_usage_in_bytes", &contents)) {
+    values[1] = strtoll(contents.c_str(), NULL, 10);
+  }
+  if (ReadCgroupFile(dir, "io.stat", &contents)) {
+    values[2] = SumCgroupValues(contents, " rbytes=");
+    values[3] = SumCgroupValues(contents, " wbytes=");
+  } else if (ReadCgroupFile(dir, "blkio.throttle.io_service_bytes",
+                            &contents)) {
+    values[2] = SumCgroupValues(contents, " Read ");
+    values[3] = SumCgroupValues(contents, " Write ");
+  }
+
+  const jsize count = sizeof(values) / sizeof(values[0]);
+  jlongArray result = env->NewLongArray(count);
+  if (result != NULL) {
+    env->SetLongArrayRegion(result, 0, count, values);
+  }
+  return result;
+}
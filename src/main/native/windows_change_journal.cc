@@ -0,0 +1,439 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define WINVER 0x0601
+#define _WIN32_WINNT 0x0601
+
+#include <jni.h>
+#include <windows.h>
+#include <winioctl.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "src/main/native/diff_awareness.h"
+#include "src/main/native/windows_error_handling.h"
+
+namespace {
+
+// The size of the buffer FSCTL_READ_USN_JOURNAL fills in.
+const DWORD kBufferSize = 64 * 1024;
+
+// The most levels of deleted directories a path is looked up through.
+const int kMaxDepth = 1024;
+
+// Converts a Java path to the form of the root: backslashes, none trailing.
+std::wstring ToWindowsPath(const jchar *chars, jsize length) {
+  std::wstring path(reinterpret_cast<const wchar_t *>(chars), length);
+  for (size_t i = 0; i < path.size(); ++i) {
+    if (path[i] == L'/') {
+      path[i] = L'\\';
+    }
+  }
+  while (path.size() > 1 && path[path.size() - 1] == L'\\') {
+    path.erase(path.size() - 1);
+  }
+  return path;
+}
+
+// Returns the path of the open file 'handle', without the "\\?\" prefix, or
+// "" if it cannot be told.
+std::wstring FinalPath(HANDLE handle) {
+  std::vector<WCHAR> buffer(MAX_PATH);
+  DWORD size;
+  while (true) {
+    size = GetFinalPathNameByHandleW(handle, buffer.data(), buffer.size(),
+                                     FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+    if (size == 0) {
+      return L"";
+    } else if (size < buffer.size()) {
+      break;
+    }
+    buffer.resize(size);
+  }
+  std::wstring path(buffer.data(), size);
+  if (path.compare(0, 4, L"\\\\?\\") == 0) {
+    path.erase(0, 4);
+  }
+  return path;
+}
+
+// The change journal of the volume of a directory, the root, as far as the
+// changes below the root are concerned.
+class ChangeJournal {
+ public:
+  ChangeJournal() : volume_(INVALID_HANDLE_VALUE), overflow_(false) {}
+
+  ~ChangeJournal() {
+    if (volume_ != INVALID_HANDLE_VALUE) {
+      CloseHandle(volume_);
+    }
+  }
+
+  // Opens the volume of 'root', which takes administrator rights. Returns
+  // false with the reason in 'error' if that fails.
+  bool Open(const std::wstring &root, std::string *error) {
+    root_ = root;
+    // "C:" alone would be the current directory of the drive.
+    const std::wstring dir_path =
+        root.size() == 2 && root[1] == L':' ? root + L"\\" : root;
+    // The root as paths on the volume name it, through junctions and subst
+    // drives.
+    HANDLE dir = CreateFileW(
+        dir_path.c_str(), FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (dir == INVALID_HANDLE_VALUE) {
+      *error = GetLastErrorString("CreateFileW(root)");
+      return false;
+    }
+    final_root_ = FinalPath(dir);
+    CloseHandle(dir);
+    if (final_root_.empty()) {
+      *error = GetLastErrorString("GetFinalPathNameByHandleW(root)");
+      return false;
+    }
+    std::wstring volume_root = final_root_;
+    if (final_root_[final_root_.size() - 1] == L'\\') {
+      final_root_.erase(final_root_.size() - 1);
+    } else {
+      volume_root += L'\\';
+    }
+
+    WCHAR volume_path[MAX_PATH];
+    WCHAR volume_name[MAX_PATH];
+    if (!GetVolumePathNameW(volume_root.c_str(), volume_path, MAX_PATH)) {
+      *error = GetLastErrorString("GetVolumePathNameW");
+      return false;
+    }
+    if (!GetVolumeNameForVolumeMountPointW(volume_path, volume_name,
+                                           MAX_PATH)) {
+      *error = GetLastErrorString("GetVolumeNameForVolumeMountPointW");
+      return false;
+    }
+    // Without the trailing backslash, the name is that of the volume rather
+    // than of its root directory.
+    std::wstring device(volume_name);
+    if (!device.empty() && device[device.size() - 1] == L'\\') {
+      device.erase(device.size() - 1);
+    }
+    volume_ = CreateFileW(device.c_str(), GENERIC_READ,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                          OPEN_EXISTING, 0, NULL);
+    if (volume_ == INVALID_HANDLE_VALUE) {
+      *error = GetLastErrorString("CreateFileW(volume)");
+      return false;
+    }
+    return true;
+  }
+
+  // Gets the identifier of the journal and the USN the next change will have.
+  bool Query(USN_JOURNAL_DATA *data, std::string *error) {
+    DWORD bytes;
+    if (!DeviceIoControl(volume_, FSCTL_QUERY_USN_JOURNAL, NULL, 0, data,
+                         sizeof(*data), &bytes, NULL)) {
+      *error = GetLastErrorString("FSCTL_QUERY_USN_JOURNAL");
+      return false;
+    }
+    return true;
+  }
+
+  // Reads the changes from 'usn' on of the journal 'journal_id' into paths(),
+  // the paths below the root they were made to, as the root was given.
+  // Returns false with the reason in 'error' if the journal does not go back
+  // that far any more, or the changes cannot be told.
+  bool Read(DWORDLONG journal_id, USN usn, std::string *error) {
+    USN_JOURNAL_DATA data;
+    if (!Query(&data, error)) {
+      return false;
+    }
+    if (data.UsnJournalID != journal_id) {
+      *error = "The change journal was deleted and created again";
+      return false;
+    } else if (usn < data.FirstUsn || usn > data.NextUsn) {
+      *error = "The change journal does not go back that far";
+      return false;
+    }
+
+    // The records must be DWORDLONG-aligned.
+    std::vector<DWORDLONG> buffer(kBufferSize / sizeof(DWORDLONG));
+    READ_USN_JOURNAL_DATA read = {0};
+    read.StartUsn = usn;
+    read.ReasonMask = 0xFFFFFFFF;
+    read.UsnJournalID = journal_id;
+    // Only up to where it was when we started: what comes after is for a
+    // watch of the root to tell.
+    while (read.StartUsn < data.NextUsn) {
+      DWORD bytes;
+      if (!DeviceIoControl(volume_, FSCTL_READ_USN_JOURNAL, &read,
+                           sizeof(read), buffer.data(), kBufferSize, &bytes,
+                           NULL)) {
+        *error = GetLastErrorString("FSCTL_READ_USN_JOURNAL");
+        return false;
+      }
+      if (bytes <= sizeof(USN)) {
+        break;
+      }
+      const char *records = reinterpret_cast<const char *>(buffer.data());
+      DWORD offset = sizeof(USN);
+      while (offset < bytes) {
+        const USN_RECORD *record =
+            reinterpret_cast<const USN_RECORD *>(records + offset);
+        if (record->MajorVersion != 2) {
+          // ReFS, with 128-bit file identifiers.
+          *error = "Unsupported change journal records";
+          return false;
+        }
+        Add(record);
+        offset += record->RecordLength;
+      }
+      USN next = *reinterpret_cast<const USN *>(records);
+      if (next <= read.StartUsn) {
+        break;
+      }
+      read.StartUsn = next;
+      if (overflow_) {
+        *error = "Too many changes";
+        return false;
+      }
+    }
+
+    // The changes in directories that are gone now, which the records of
+    // those directories place.
+    for (size_t i = 0; i < deferred_.size(); ++i) {
+      std::wstring dir_path;
+      if (!PathOf(deferred_[i].parent, 0, &dir_path)) {
+        *error = "The change journal does not tell where a change was made";
+        return false;
+      }
+      AddPath(dir_path + L"\\" + deferred_[i].name);
+    }
+    if (overflow_) {
+      *error = "Too many changes";
+      return false;
+    }
+    return true;
+  }
+
+  const std::unordered_set<std::wstring> &paths() const { return paths_; }
+
+ private:
+  // A change in a directory that was not there any more when it was read.
+  struct Change {
+    DWORDLONG parent;
+    std::wstring name;
+  };
+
+  // Where a directory was, as the last record of it said.
+  struct DirRecord {
+    DWORDLONG parent;
+    std::wstring name;
+  };
+
+  void Add(const USN_RECORD *record) {
+    std::wstring name(
+        reinterpret_cast<const WCHAR *>(
+            reinterpret_cast<const char *>(record) + record->FileNameOffset),
+        record->FileNameLength / sizeof(WCHAR));
+    bool is_dir = (record->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    if (is_dir) {
+      DirRecord &dir_record = dir_records_[record->FileReferenceNumber];
+      dir_record.parent = record->ParentFileReferenceNumber;
+      dir_record.name = name;
+    }
+
+    std::wstring dir_path;
+    if (!LivePathOf(record->ParentFileReferenceNumber, &dir_path)) {
+      Change change;
+      change.parent = record->ParentFileReferenceNumber;
+      change.name = name;
+      deferred_.push_back(change);
+      return;
+    }
+    std::wstring path = dir_path + L"\\" + name;
+    AddPath(path);
+    // A directory moved in from elsewhere brings entries that have no records
+    // below the root.
+    if (is_dir && (record->Reason & USN_REASON_RENAME_NEW_NAME) != 0) {
+      AddEntriesBelow(path);
+    }
+  }
+
+  // Gets the path of the directory 'id' now. Returns false if it is gone.
+  bool LivePathOf(DWORDLONG id, std::wstring *path) {
+    auto it = live_dirs_.find(id);
+    if (it != live_dirs_.end()) {
+      *path = it->second;
+      return !path->empty();
+    }
+    FILE_ID_DESCRIPTOR descriptor = {0};
+    descriptor.dwSize = sizeof(descriptor);
+    descriptor.Type = FileIdType;
+    descriptor.FileId.QuadPart = static_cast<LONGLONG>(id);
+    HANDLE dir = OpenFileById(
+        volume_, &descriptor, FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        FILE_FLAG_BACKUP_SEMANTICS);
+    if (dir == INVALID_HANDLE_VALUE) {
+      path->clear();
+    } else {
+      *path = FinalPath(dir);
+      CloseHandle(dir);
+    }
+    live_dirs_[id] = *path;
+    return !path->empty();
+  }
+
+  // Gets the path of the directory 'id', now if it is there, else where the
+  // journal last saw it.
+  bool PathOf(DWORDLONG id, int depth, std::wstring *path) {
+    if (LivePathOf(id, path)) {
+      return true;
+    }
+    auto it = dir_records_.find(id);
+    if (it == dir_records_.end() || depth > kMaxDepth ||
+        !PathOf(it->second.parent, depth + 1, path)) {
+      return false;
+    }
+    *path += L"\\" + it->second.name;
+    return true;
+  }
+
+  // Adds 'path', a final path, if it is below the root.
+  void AddPath(const std::wstring &path) {
+    if (overflow_ || path.size() < final_root_.size() ||
+        CompareStringOrdinal(path.c_str(), final_root_.size(),
+                             final_root_.c_str(), final_root_.size(),
+                             TRUE) != CSTR_EQUAL ||
+        (path.size() > final_root_.size() &&
+         path[final_root_.size()] != L'\\')) {
+      return;
+    }
+    paths_.insert(root_ + path.substr(final_root_.size()));
+    if (paths_.size() > kMaxChangedPaths) {
+      overflow_ = true;
+      paths_.clear();
+    }
+  }
+
+  // Adds the entries below 'dir'. Junctions and directory symlinks are not
+  // followed.
+  void AddEntriesBelow(const std::wstring &dir) {
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileExW((L"\\\\?\\" + dir + L"\\*").c_str(),
+                                   FindExInfoBasic, &data,
+                                   FindExSearchNameMatch, NULL,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE) {
+      // Gone already, or not accessible; nothing to report below it.
+      return;
+    }
+    do {
+      if (wcscmp(data.cFileName, L".") == 0 ||
+          wcscmp(data.cFileName, L"..") == 0) {
+        continue;
+      }
+      std::wstring path = dir + L"\\" + data.cFileName;
+      AddPath(path);
+      if (overflow_) {
+        break;
+      }
+      if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+          !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+        AddEntriesBelow(path);
+      }
+    } while (FindNextFileW(find, &data));
+    FindClose(find);
+  }
+
+  HANDLE volume_;
+  // The root as given, and as the final paths of the files below it start.
+  std::wstring root_;
+  std::wstring final_root_;
+
+  std::unordered_set<std::wstring> paths_;
+  bool overflow_;
+  // The final paths of the directories looked up, "" for those gone.
+  std::unordered_map<DWORDLONG, std::wstring> live_dirs_;
+  std::unordered_map<DWORDLONG, DirRecord> dir_records_;
+  std::vector<Change> deferred_;
+};
+
+void SetError(JNIEnv *env, jobjectArray error_msg_holder,
+              const std::string &error) {
+  if (error_msg_holder != NULL && env->GetArrayLength(error_msg_holder) > 0) {
+    jstring error_msg = env->NewStringUTF(error.c_str());
+    env->SetObjectArrayElement(error_msg_holder, 0, error_msg);
+  }
+}
+
+std::wstring GetRoot(JNIEnv *env, jstring root) {
+  const jchar *root_chars = env->GetStringChars(root, NULL);
+  std::wstring result = ToWindowsPath(root_chars, env->GetStringLength(root));
+  env->ReleaseStringChars(root, root_chars);
+  return result;
+}
+
+}  // namespace
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_google_devtools_build_lib_windows_WindowsChangeJournal_nativeGetPosition(
+    JNIEnv *env, jclass clazz, jstring root, jobjectArray error_msg_holder) {
+  ChangeJournal journal;
+  USN_JOURNAL_DATA data;
+  std::string error;
+  if (!journal.Open(GetRoot(env, root), &error) ||
+      !journal.Query(&data, &error)) {
+    SetError(env, error_msg_holder, error);
+    return NULL;
+  }
+  jlong position[] = {static_cast<jlong>(data.UsnJournalID),
+                      static_cast<jlong>(data.NextUsn)};
+  jlongArray result = env->NewLongArray(2);
+  if (result != NULL) {
+    env->SetLongArrayRegion(result, 0, 2, position);
+  }
+  return result;
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_google_devtools_build_lib_windows_WindowsChangeJournal_nativeGetChangesSince(
+    JNIEnv *env, jclass clazz, jstring root, jlong journal_id, jlong usn,
+    jobjectArray error_msg_holder) {
+  ChangeJournal journal;
+  std::string error;
+  if (!journal.Open(GetRoot(env, root), &error) ||
+      !journal.Read(static_cast<DWORDLONG>(journal_id), static_cast<USN>(usn),
+                    &error)) {
+    SetError(env, error_msg_holder, error);
+    return NULL;
+  }
+
+  const std::unordered_set<std::wstring> &paths = journal.paths();
+  jclass classString = env->FindClass("java/lang/String");
+  jobjectArray result = env->NewObjectArray(paths.size(), classString, NULL);
+  if (result == NULL) {
+    return NULL;
+  }
+  int i = 0;
+  for (auto it = paths.begin(); it != paths.end(); it++, i++) {
+    jstring path = env->NewString(reinterpret_cast<const jchar *>(it->c_str()),
+                                  static_cast<jsize>(it->size()));
+    env->SetObjectArrayElement(result, i, path);
+    env->DeleteLocalRef(path);
+  }
+  return result;
+}
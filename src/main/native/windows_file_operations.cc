@@ -16,6 +16,7 @@
 #include <windows.h>
 
 #include <string>
+#include <vector>
 
 #include "src/main/native/windows_error_handling.h"
 
@@ -71,3 +72,117 @@ Java_com_google_devtools_build_lib_windows_WindowsFileOperations_nativeIsJunctio
   env->ReleaseStringUTFChars(path, path_cstr);
   return result;
 }
+
+// The difference between the FILETIME epoch (1601) and the Java one (1970),
+// in 100 nanosecond units.
+static const ULONGLONG kFiletimeToJavaEpoch = 116444736000000000ULL;
+
+static jlong FiletimeToJavaMillis(const FILETIME& time) {
+  ULARGE_INTEGER value;
+  value.LowPart = time.dwLowDateTime;
+  value.HighPart = time.dwHighDateTime;
+  return static_cast<jlong>((value.QuadPart - kFiletimeToJavaEpoch) / 10000);
+}
+
+// Returns the pattern that lists the entries of `dir`, with the prefix that
+// lifts the MAX_PATH limit where it applies.
+static std::wstring ListingPattern(const jchar* chars, jsize length) {
+  std::wstring dir(reinterpret_cast<const wchar_t*>(chars), length);
+  for (size_t i = 0; i < dir.size(); ++i) {
+    if (dir[i] == L'/') {
+      dir[i] = L'\\';
+    }
+  }
+  if (dir.empty() || dir[dir.size() - 1] != L'\\') {
+    dir += L'\\';
+  }
+  dir += L'*';
+  // "\\?\" only works with absolute paths, and UNC paths need a different
+  // one.
+  if (dir.size() > 2 && dir[1] == L':' && dir[2] == L'\\') {
+    return L"\\\\?\\" + dir;
+  }
+  return dir;
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_google_devtools_build_lib_windows_WindowsFileOperations_nativeReadDirectory(
+    JNIEnv* env, jclass clazz, jstring path, jobjectArray error_msg_holder) {
+  const jchar* path_chars = env->GetStringChars(path, NULL);
+  std::wstring pattern = ListingPattern(path_chars, env->GetStringLength(path));
+  env->ReleaseStringChars(path, path_chars);
+
+  // FindExInfoBasic skips the short names, and FIND_FIRST_EX_LARGE_FETCH
+  // fetches many entries per system call.
+  WIN32_FIND_DATAW data;
+  HANDLE find = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &data,
+                                 FindExSearchNameMatch, NULL,
+                                 FIND_FIRST_EX_LARGE_FETCH);
+  std::vector<WIN32_FIND_DATAW> entries;
+  if (find == INVALID_HANDLE_VALUE) {
+    // The root directory of a drive has no "." and "..", so it can be empty.
+    if (GetLastError() != ERROR_FILE_NOT_FOUND) {
+      if (error_msg_holder != NULL &&
+          env->GetArrayLength(error_msg_holder) > 0) {
+        std::string error_str = GetLastErrorString("FindFirstFileExW");
+        jstring error_msg = env->NewStringUTF(error_str.c_str());
+        env->SetObjectArrayElement(error_msg_holder, 0, error_msg);
+      }
+      return NULL;
+    }
+  } else {
+    do {
+      if (wcscmp(data.cFileName, L".") != 0 &&
+          wcscmp(data.cFileName, L"..") != 0) {
+        entries.push_back(data);
+      }
+    } while (FindNextFileW(find, &data));
+    FindClose(find);
+  }
+
+  jclass entry_class = env->FindClass(
+      "com/google/devtools/build/lib/windows/"
+      "WindowsFileOperations$DirectoryEntry");
+  if (entry_class == NULL) {
+    return NULL;
+  }
+  jmethodID entry_ctor = env->GetMethodID(entry_class, "<init>",
+                                          "(Ljava/lang/String;IIJJJJ)V");
+  if (entry_ctor == NULL) {
+    return NULL;
+  }
+  jobjectArray result = env->NewObjectArray(
+      static_cast<jsize>(entries.size()), entry_class, NULL);
+  if (result == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const WIN32_FIND_DATAW& entry = entries[i];
+    jstring name = env->NewString(
+        reinterpret_cast<const jchar*>(entry.cFileName),
+        static_cast<jsize>(wcslen(entry.cFileName)));
+    if (name == NULL) {
+      return NULL;
+    }
+    // dwReserved0 holds the reparse tag for reparse points.
+    jint reparse_tag =
+        (entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+            ? static_cast<jint>(entry.dwReserved0)
+            : 0;
+    jlong size = (static_cast<jlong>(entry.nFileSizeHigh) << 32) |
+                 entry.nFileSizeLow;
+    jobject java_entry = env->NewObject(
+        entry_class, entry_ctor, name,
+        static_cast<jint>(entry.dwFileAttributes), reparse_tag, size,
+        FiletimeToJavaMillis(entry.ftCreationTime),
+        FiletimeToJavaMillis(entry.ftLastAccessTime),
+        FiletimeToJavaMillis(entry.ftLastWriteTime));
+    if (java_entry == NULL) {
+      return NULL;
+    }
+    env->SetObjectArrayElement(result, static_cast<jsize>(i), java_entry);
+    env->DeleteLocalRef(java_entry);
+    env->DeleteLocalRef(name);
+  }
+  return result;
+}
@@ -0,0 +1,300 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <jni.h>
+#include <windows.h>
+
+#include <string>
+#include <unordered_set>
+
+#include "src/main/native/diff_awareness.h"
+
+namespace {
+
+// The changes to the names, contents and metadata of the entries below the
+// watched directory.
+const DWORD kNotifyFilter =
+    FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+    FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
+    FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_CREATION |
+    FILE_NOTIFY_CHANGE_SECURITY;
+
+// The size of the buffer ReadDirectoryChangesW() fills in. Above 64k it fails
+// for directories on network shares.
+const DWORD kBufferSize = 64 * 1024;
+
+// The state of a recursive ReadDirectoryChangesW() watch, shared by
+// WindowsDiffAwareness#run(), which reads the changes, and the Java threads
+// calling #poll().
+struct JNIWindowsDiffAwareness {
+  // The watched directory, without a trailing backslash.
+  std::wstring root;
+  // The directory handle, opened for overlapped I/O, or INVALID_HANDLE_VALUE.
+  HANDLE dir;
+  // Set by #doClose() to stop #run().
+  HANDLE stop_event;
+
+  // Protects the fields below.
+  CRITICAL_SECTION lock;
+  // The paths that changed since the last #poll().
+  std::unordered_set<std::wstring> paths;
+  // Whether changes may have been missed, so that everything has to be
+  // looked at again.
+  bool overflow;
+  // The Java object and #run() each hold a reference; the last one to let
+  // go frees the structure.
+  LONG references;
+};
+
+void Release(JNIWindowsDiffAwareness *info) {
+  if (InterlockedDecrement(&info->references) == 0) {
+    if (info->dir != INVALID_HANDLE_VALUE) {
+      CloseHandle(info->dir);
+    }
+    if (info->stop_event != NULL) {
+      CloseHandle(info->stop_event);
+    }
+    DeleteCriticalSection(&info->lock);
+    delete info;
+  }
+}
+
+void SetOverflow(JNIWindowsDiffAwareness *info) {
+  EnterCriticalSection(&info->lock);
+  info->overflow = true;
+  info->paths.clear();
+  LeaveCriticalSection(&info->lock);
+}
+
+// Returns 'path' with the prefix that lifts the MAX_PATH limit, unless it is
+// a UNC path.
+std::wstring LongPath(const std::wstring &path) {
+  if (path.compare(0, 2, L"\\\\") == 0) {
+    return path;
+  }
+  return L"\\\\?\\" + path;
+}
+
+// Adds the path of a change. Called with info->lock held.
+void AddPath(JNIWindowsDiffAwareness *info, const std::wstring &path) {
+  if (info->overflow) {
+    return;
+  }
+  info->paths.insert(path);
+  if (info->paths.size() > kMaxChangedPaths) {
+    info->overflow = true;
+    info->paths.clear();
+  }
+}
+
+// Adds the entries below 'dir', which was created or moved into the watched
+// tree: the notification names only the directory itself. Junctions and
+// directory symlinks are not followed.
+void AddEntriesBelow(JNIWindowsDiffAwareness *info, const std::wstring &dir) {
+  WIN32_FIND_DATAW data;
+  HANDLE find = FindFirstFileExW(LongPath(dir + L"\\*").c_str(),
+                                 FindExInfoBasic, &data, FindExSearchNameMatch,
+                                 NULL, FIND_FIRST_EX_LARGE_FETCH);
+  if (find == INVALID_HANDLE_VALUE) {
+    // Gone already, or not accessible; nothing to report below it.
+    return;
+  }
+  do {
+    if (wcscmp(data.cFileName, L".") == 0 ||
+        wcscmp(data.cFileName, L"..") == 0) {
+      continue;
+    }
+    std::wstring path = dir + L"\\" + data.cFileName;
+    EnterCriticalSection(&info->lock);
+    AddPath(info, path);
+    bool overflow = info->overflow;
+    LeaveCriticalSection(&info->lock);
+    if (overflow) {
+      break;
+    }
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+        !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+      AddEntriesBelow(info, path);
+    }
+  } while (FindNextFileW(find, &data));
+  FindClose(find);
+}
+
+// Handles the notifications ReadDirectoryChangesW() returned in 'buffer'.
+void HandleNotifications(JNIWindowsDiffAwareness *info, const char *buffer) {
+  const FILE_NOTIFY_INFORMATION *notification;
+  do {
+    notification = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(buffer);
+    std::wstring path =
+        info->root + L"\\" +
+        std::wstring(notification->FileName,
+                     notification->FileNameLength / sizeof(WCHAR));
+    EnterCriticalSection(&info->lock);
+    AddPath(info, path);
+    LeaveCriticalSection(&info->lock);
+
+    if (notification->Action == FILE_ACTION_ADDED ||
+        notification->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+      DWORD attrs = GetFileAttributesW(LongPath(path).c_str());
+      if (attrs != INVALID_FILE_ATTRIBUTES &&
+          (attrs & FILE_ATTRIBUTE_DIRECTORY) &&
+          !(attrs & FILE_ATTRIBUTE_REPARSE_POINT)) {
+        AddEntriesBelow(info, path);
+      }
+    }
+    buffer += notification->NextEntryOffset;
+  } while (notification->NextEntryOffset != 0);
+}
+
+// Converts a Java path to the form of the root: backslashes, none trailing.
+std::wstring ToWindowsPath(const jchar *chars, jsize length) {
+  std::wstring path(reinterpret_cast<const wchar_t *>(chars), length);
+  for (size_t i = 0; i < path.size(); ++i) {
+    if (path[i] == L'/') {
+      path[i] = L'\\';
+    }
+  }
+  while (path.size() > 1 && path[path.size() - 1] == L'\\') {
+    path.erase(path.size() - 1);
+  }
+  return path;
+}
+
+}  // namespace
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_WindowsDiffAwareness_create(
+    JNIEnv *env, jobject diffAwareness, jstring root) {
+  JNIWindowsDiffAwareness *info = new JNIWindowsDiffAwareness;
+  const jchar *root_chars = env->GetStringChars(root, NULL);
+  info->root = ToWindowsPath(root_chars, env->GetStringLength(root));
+  env->ReleaseStringChars(root, root_chars);
+
+  InitializeCriticalSection(&info->lock);
+  info->references = 2;
+  info->stop_event = CreateEventW(NULL, TRUE, FALSE, NULL);
+  // Share everything, so that the watch does not get in the way of deleting
+  // or renaming the files below.
+  info->dir = CreateFileW(
+      LongPath(info->root).c_str(), FILE_LIST_DIRECTORY,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+  info->overflow =
+      info->dir == INVALID_HANDLE_VALUE || info->stop_event == NULL;
+
+  jclass clazz = env->GetObjectClass(diffAwareness);
+  jfieldID fid = env->GetFieldID(clazz, "nativePointer", "J");
+  env->SetLongField(diffAwareness, fid, reinterpret_cast<jlong>(info));
+}
+
+static JNIWindowsDiffAwareness *GetInfo(JNIEnv *env, jobject diffAwareness) {
+  jclass clazz = env->GetObjectClass(diffAwareness);
+  jfieldID fid = env->GetFieldID(clazz, "nativePointer", "J");
+  jlong field = env->GetLongField(diffAwareness, fid);
+  return reinterpret_cast<JNIWindowsDiffAwareness *>(field);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_WindowsDiffAwareness_run(
+    JNIEnv *env, jobject diffAwareness) {
+  JNIWindowsDiffAwareness *info = GetInfo(env, diffAwareness);
+  // Changes are read as they come rather than when polled, so that the
+  // kernel buffer of the handle does not overflow between builds. The buffer
+  // must be DWORD-aligned.
+  DWORD *buffer = new DWORD[kBufferSize / sizeof(DWORD)];
+  OVERLAPPED overlapped;
+  HANDLE changed_event = CreateEventW(NULL, TRUE, FALSE, NULL);
+  if (changed_event == NULL) {
+    SetOverflow(info);
+  }
+
+  while (info->dir != INVALID_HANDLE_VALUE && info->stop_event != NULL &&
+         changed_event != NULL) {
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.hEvent = changed_event;
+    if (!ReadDirectoryChangesW(info->dir, buffer, kBufferSize,
+                               /* bWatchSubtree */ TRUE, kNotifyFilter, NULL,
+                               &overlapped, NULL)) {
+      SetOverflow(info);
+      break;
+    }
+
+    HANDLE events[] = {changed_event, info->stop_event};
+    DWORD waited = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+    DWORD size = 0;
+    if (waited != WAIT_OBJECT_0) {
+      // Stopped by #doClose() (or the wait failed): cancel the read, which
+      // must be over before the buffer goes away.
+      CancelIoEx(info->dir, &overlapped);
+      GetOverlappedResult(info->dir, &overlapped, &size, TRUE);
+      break;
+    }
+    if (!GetOverlappedResult(info->dir, &overlapped, &size, FALSE)) {
+      // ERROR_NOTIFY_ENUM_DIR: too many changes for the buffer. Otherwise
+      // the root itself went away, or became inaccessible.
+      SetOverflow(info);
+      if (GetLastError() == ERROR_NOTIFY_ENUM_DIR) {
+        continue;
+      }
+      break;
+    }
+    if (size == 0) {
+      // The changes did not fit in the buffer.
+      SetOverflow(info);
+      continue;
+    }
+    HandleNotifications(info, reinterpret_cast<const char *>(buffer));
+  }
+
+  if (changed_event != NULL) {
+    CloseHandle(changed_event);
+  }
+  delete[] buffer;
+  Release(info);
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_google_devtools_build_lib_skyframe_WindowsDiffAwareness_poll(
+    JNIEnv *env, jobject diffAwareness) {
+  JNIWindowsDiffAwareness *info = GetInfo(env, diffAwareness);
+  EnterCriticalSection(&info->lock);
+  if (info->overflow) {
+    LeaveCriticalSection(&info->lock);
+    return NULL;
+  }
+
+  jclass classString = env->FindClass("java/lang/String");
+  jobjectArray result =
+      env->NewObjectArray(info->paths.size(), classString, NULL);
+  int i = 0;
+  for (auto it = info->paths.begin(); it != info->paths.end(); it++, i++) {
+    jstring path = env->NewString(reinterpret_cast<const jchar *>(it->c_str()),
+                                  static_cast<jsize>(it->size()));
+    env->SetObjectArrayElement(result, i, path);
+    env->DeleteLocalRef(path);
+  }
+  info->paths.clear();
+  LeaveCriticalSection(&info->lock);
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_devtools_build_lib_skyframe_WindowsDiffAwareness_doClose(
+    JNIEnv *env, jobject diffAwareness) {
+  JNIWindowsDiffAwareness *info = GetInfo(env, diffAwareness);
+  if (info->stop_event != NULL) {
+    SetEvent(info->stop_event);
+  }
+  Release(info);
+}
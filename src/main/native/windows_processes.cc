@@ -19,8 +19,10 @@
 #include <string.h>
 #include <windows.h>
 
+#include <algorithm>
 #include <atomic>
 #include <string>
+#include <vector>
 
 #include "src/main/native/windows_error_handling.h"
 
@@ -30,10 +32,18 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeGetpid(
   return GetCurrentProcessId();
 }
 
+// The most nativeReadStream() reads at once. A pipe read returns what is
+// available, which is at most the pipe buffer (4k by default), so a larger
+// buffer would only be wasted.
+static const jint kMaxReadSize = 64 * 1024;
+
 struct NativeOutputStream {
   HANDLE handle_;
   std::string error_;
   std::atomic<bool> closed_;
+  // What ReadFile() reads into before it is copied to the Java array. Only
+  // used by the thread reading the stream.
+  std::vector<jbyte> buffer_;
   NativeOutputStream()
       : handle_(INVALID_HANDLE_VALUE),
         error_(""),
@@ -69,6 +79,17 @@ struct NativeProcess {
         error_("") {}
 };
 
+// JOBOBJECT_CPU_RATE_CONTROL_INFORMATION and its constants, which the headers
+// only define when targeting Windows 8 (and which only work there).
+static const JOBOBJECTINFOCLASS kJobObjectCpuRateControlInformation =
+    static_cast<JOBOBJECTINFOCLASS>(15);
+static const DWORD kCpuRateControlEnable = 0x1;
+static const DWORD kCpuRateControlHardCap = 0x4;
+struct CpuRateControlInformation {
+  DWORD control_flags;
+  DWORD cpu_rate;  // in 1/100 percent of the cycles of all processors
+};
+
 static bool NestedJobsSupported() {
   OSVERSIONINFOEX version_info;
   version_info.dwOSVersionInfoSize = sizeof(version_info);
@@ -84,7 +105,7 @@ extern "C" JNIEXPORT jlong JNICALL
 Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
   JNIEnv *env, jclass clazz, jstring java_commandline, jbyteArray java_env,
   jstring java_cwd, jstring java_stdout_redirect,
-  jstring java_stderr_redirect) {
+  jstring java_stderr_redirect, jlong memory_limit, jint cpu_rate_limit) {
   const char* commandline = env->GetStringUTFChars(java_commandline, NULL);
   const char* stdout_redirect = NULL;
   const char* stderr_redirect = NULL;
@@ -121,8 +142,14 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
   HANDLE thread = INVALID_HANDLE_VALUE;
   HANDLE event = INVALID_HANDLE_VALUE;
   PROCESS_INFORMATION process_info = {0};
-  STARTUPINFO startup_info = {0};
+  STARTUPINFOEX startup_info = {0};
   JOBOBJECT_EXTENDED_LIMIT_INFORMATION job_info = {0};
+  // The handles the process inherits, and the attribute list naming them.
+  HANDLE inherited_handles[3];
+  DWORD inherited_count = 0;
+  std::vector<char> attribute_list_buffer;
+  LPPROC_THREAD_ATTRIBUTE_LIST attribute_list = NULL;
+  SIZE_T attribute_list_size = 0;
 
   if (java_env != NULL) {
     env_size = env->GetArrayLength(java_env);
@@ -137,10 +164,16 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
     }
   }
 
+  // Pipes are created inheritable at both ends; our ends are not for any
+  // process to inherit.
   if (!CreatePipe(&stdin_process, &result->stdin_, &sa, 0)) {
     result->error_ = GetLastErrorString("CreatePipe(stdin)");
     goto cleanup;
   }
+  if (!SetHandleInformation(result->stdin_, HANDLE_FLAG_INHERIT, 0)) {
+    result->error_ = GetLastErrorString("SetHandleInformation(stdin)");
+    goto cleanup;
+  }
 
   if (stdout_redirect != NULL) {
     result->stdout_.close();
@@ -163,6 +196,11 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
       result->error_ = GetLastErrorString("CreatePipe(stdout)");
       goto cleanup;
     }
+    if (!SetHandleInformation(result->stdout_.handle_, HANDLE_FLAG_INHERIT,
+                              0)) {
+      result->error_ = GetLastErrorString("SetHandleInformation(stdout)");
+      goto cleanup;
+    }
   }
 
   if (stderr_redirect != NULL) {
@@ -189,6 +227,11 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
       result->error_ = GetLastErrorString("CreatePipe(stderr)");
       goto cleanup;
     }
+    if (!SetHandleInformation(result->stderr_.handle_, HANDLE_FLAG_INHERIT,
+                              0)) {
+      result->error_ = GetLastErrorString("SetHandleInformation(stderr)");
+      goto cleanup;
+    }
   }
 
 
@@ -204,6 +247,12 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
 
   job_info.BasicLimitInformation.LimitFlags =
       JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+  if (memory_limit > 0) {
+    // Allocations beyond the limit fail in whichever process of the job
+    // makes them.
+    job_info.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+    job_info.JobMemoryLimit = static_cast<SIZE_T>(memory_limit);
+  }
   if (!SetInformationJobObject(
       job,
       JobObjectExtendedLimitInformation,
@@ -213,10 +262,52 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
       goto cleanup;
   }
 
-  startup_info.hStdInput = stdin_process;
-  startup_info.hStdOutput = stdout_process;
-  startup_info.hStdError = stderr_process;
-  startup_info.dwFlags |= STARTF_USESTDHANDLES;
+  if (cpu_rate_limit > 0) {
+    CpuRateControlInformation cpu_rate_info = {
+        kCpuRateControlEnable | kCpuRateControlHardCap,
+        static_cast<DWORD>(cpu_rate_limit) * 100};
+    if (!SetInformationJobObject(job, kJobObjectCpuRateControlInformation,
+                                 &cpu_rate_info, sizeof(cpu_rate_info))) {
+      result->error_ =
+          GetLastErrorString("SetInformationJobObject(CpuRateControl)");
+      goto cleanup;
+    }
+  }
+
+  // The process inherits its standard handles and nothing else, in particular
+  // not those of a process another thread is creating at the same time. So
+  // processes can be created concurrently without leaking handles into each
+  // other, which would keep their pipes open.
+  inherited_handles[inherited_count++] = stdin_process;
+  inherited_handles[inherited_count++] = stdout_process;
+  if (stderr_process != stdout_process) {
+    // The list must not name a handle twice.
+    inherited_handles[inherited_count++] = stderr_process;
+  }
+  InitializeProcThreadAttributeList(NULL, 1, 0, &attribute_list_size);
+  attribute_list_buffer.resize(attribute_list_size);
+  if (!InitializeProcThreadAttributeList(
+      reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(
+          attribute_list_buffer.data()),
+      1, 0, &attribute_list_size)) {
+    result->error_ = GetLastErrorString("InitializeProcThreadAttributeList()");
+    goto cleanup;
+  }
+  attribute_list = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(
+      attribute_list_buffer.data());
+  if (!UpdateProcThreadAttribute(
+      attribute_list, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherited_handles,
+      inherited_count * sizeof(HANDLE), NULL, NULL)) {
+    result->error_ = GetLastErrorString("UpdateProcThreadAttribute()");
+    goto cleanup;
+  }
+
+  startup_info.StartupInfo.cb = sizeof(startup_info);
+  startup_info.StartupInfo.hStdInput = stdin_process;
+  startup_info.StartupInfo.hStdOutput = stdout_process;
+  startup_info.StartupInfo.hStdError = stderr_process;
+  startup_info.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+  startup_info.lpAttributeList = attribute_list;
 
   BOOL ok = CreateProcess(
       NULL,
@@ -226,10 +317,11 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
       TRUE,
       CREATE_NO_WINDOW  // Don't create a console window
           | CREATE_NEW_PROCESS_GROUP   // So that Ctrl-Break is not propagated
-          | CREATE_SUSPENDED,  // So that it doesn't start a new job itself
+          | CREATE_SUSPENDED  // So that it doesn't start a new job itself
+          | EXTENDED_STARTUPINFO_PRESENT,  // For the handle list
       env_bytes,
       cwd,
-      &startup_info,
+      &startup_info.StartupInfo,
       &process_info);
 
   if (!ok) {
@@ -245,7 +337,10 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeCreateProcess(
     BOOL is_in_job = false;
     if (IsProcessInJob(result->process_, NULL, &is_in_job)
         && is_in_job
-        && !NestedJobsSupported()) {
+        && !NestedJobsSupported()
+        && memory_limit <= 0 && cpu_rate_limit <= 0) {
+      // (Resource limits need the job, so creating the process fails if
+      // there are any.)
       // We are on a pre-Windows 8 system and the Bazel is already in a job.
       // We can't create nested jobs, so just revert to TerminateProcess() and
       // hope for the best. In batch mode, the launcher puts Bazel in a job so
@@ -287,6 +382,10 @@ cleanup:
     CloseHandle(thread);
   }
 
+  if (attribute_list != NULL) {
+    DeleteProcThreadAttributeList(attribute_list);
+  }
+
   delete[] mutable_commandline;
   if (env_bytes != NULL) {
     env->ReleaseByteArrayElements(java_env, env_bytes, 0);
@@ -320,16 +419,18 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeWriteStdin(
     return -1;
   }
 
-  jbyte* bytes = env->GetByteArrayElements(java_bytes, NULL);
+  // Copy just the bytes to write: GetByteArrayElements() may copy the whole
+  // array, and copy it back on release.
+  std::vector<jbyte> bytes(length);
+  env->GetByteArrayRegion(java_bytes, offset, length, bytes.data());
   DWORD bytes_written;
 
-  if (!WriteFile(process->stdin_, bytes + offset, length, &bytes_written,
+  if (!WriteFile(process->stdin_, bytes.data(), length, &bytes_written,
       NULL)) {
     process->error_ = GetLastErrorString("WriteFile()");
-    bytes_written = -1;
+    return -1;
   }
 
-  env->ReleaseByteArrayElements(java_bytes, bytes, 0);
   process->error_ = "";
   return bytes_written;
 }
@@ -366,9 +467,17 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeReadStream(
     return 0;
   }
 
-  jbyte* bytes = env->GetByteArrayElements(java_bytes, NULL);
+  // Read into a native buffer and copy only what was read to the Java array.
+  // GetByteArrayElements() may copy the whole array in and out again, and
+  // GetPrimitiveArrayCritical() must not be held across a blocking ReadFile(),
+  // which would stall the garbage collector.
+  length = std::min(length, kMaxReadSize);
+  if (stream->buffer_.size() < static_cast<size_t>(length)) {
+    stream->buffer_.resize(length);
+  }
   DWORD bytes_read;
-  if (!ReadFile(stream->handle_, bytes + offset, length, &bytes_read, NULL)) {
+  if (!ReadFile(stream->handle_, stream->buffer_.data(), length, &bytes_read,
+                NULL)) {
     // Check if either the other end closed the pipe or we did it with
     // NativeOutputStream.close() . In the latter case, we'll get a "system
     // call interrupted" error.
@@ -378,16 +487,94 @@ Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeReadStream(
       bytes_read = 0;
     } else {
       stream->error_ = GetLastErrorString("ReadFile()");
-      bytes_read = -1;
+      return -1;
     }
   } else {
     stream->error_ = "";
+    env->SetByteArrayRegion(java_bytes, offset, bytes_read,
+                            stream->buffer_.data());
   }
 
-  env->ReleaseByteArrayElements(java_bytes, bytes, 0);
   return bytes_read;
 }
 
+static jlong FiletimeToMicros(const FILETIME& time) {
+  ULARGE_INTEGER value;
+  value.LowPart = time.dwLowDateTime;
+  value.HighPart = time.dwHighDateTime;
+  return static_cast<jlong>(value.QuadPart / 10);
+}
+
+// Keep in sync with j.c.g.devtools.build.lib.windows.WindowsProcesses.
+enum {
+  USAGE_USER_TIME_MICROS = 0,
+  USAGE_KERNEL_TIME_MICROS = 1,
+  USAGE_PEAK_PROCESS_MEMORY_BYTES = 2,
+  USAGE_PEAK_JOB_MEMORY_BYTES = 3,
+  USAGE_PAGE_FAULTS = 4,
+  USAGE_READ_OPERATIONS = 5,
+  USAGE_WRITE_OPERATIONS = 6,
+  USAGE_READ_BYTES = 7,
+  USAGE_WRITE_BYTES = 8,
+  USAGE_COUNT = 9,
+};
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeGetResourceUsage(
+    JNIEnv* env, jclass clazz, jlong process_long) {
+  NativeProcess* process = reinterpret_cast<NativeProcess*>(process_long);
+  jlong values[USAGE_COUNT];
+  for (int i = 0; i < USAGE_COUNT; ++i) {
+    values[i] = -1;
+  }
+
+  JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION accounting;
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+  if (process->job_ != INVALID_HANDLE_VALUE &&
+      QueryInformationJobObject(process->job_,
+                                JobObjectBasicAndIoAccountingInformation,
+                                &accounting, sizeof(accounting), NULL) &&
+      QueryInformationJobObject(process->job_,
+                                JobObjectExtendedLimitInformation, &limits,
+                                sizeof(limits), NULL)) {
+    // Covers every process of the job, including the ones that exited.
+    // The times are in 100 nanosecond units.
+    values[USAGE_USER_TIME_MICROS] =
+        accounting.BasicInfo.TotalUserTime.QuadPart / 10;
+    values[USAGE_KERNEL_TIME_MICROS] =
+        accounting.BasicInfo.TotalKernelTime.QuadPart / 10;
+    values[USAGE_PEAK_PROCESS_MEMORY_BYTES] = limits.PeakProcessMemoryUsed;
+    values[USAGE_PEAK_JOB_MEMORY_BYTES] = limits.PeakJobMemoryUsed;
+    values[USAGE_PAGE_FAULTS] = accounting.BasicInfo.TotalPageFaultCount;
+    values[USAGE_READ_OPERATIONS] = accounting.IoInfo.ReadOperationCount;
+    values[USAGE_WRITE_OPERATIONS] = accounting.IoInfo.WriteOperationCount;
+    values[USAGE_READ_BYTES] = accounting.IoInfo.ReadTransferCount;
+    values[USAGE_WRITE_BYTES] = accounting.IoInfo.WriteTransferCount;
+  } else {
+    // Not in a job of its own (see nativeCreateProcess): only the process
+    // itself is accounted for.
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (GetProcessTimes(process->process_, &creation_time, &exit_time,
+                        &kernel_time, &user_time)) {
+      values[USAGE_USER_TIME_MICROS] = FiletimeToMicros(user_time);
+      values[USAGE_KERNEL_TIME_MICROS] = FiletimeToMicros(kernel_time);
+    }
+    IO_COUNTERS io;
+    if (GetProcessIoCounters(process->process_, &io)) {
+      values[USAGE_READ_OPERATIONS] = io.ReadOperationCount;
+      values[USAGE_WRITE_OPERATIONS] = io.WriteOperationCount;
+      values[USAGE_READ_BYTES] = io.ReadTransferCount;
+      values[USAGE_WRITE_BYTES] = io.WriteTransferCount;
+    }
+  }
+
+  jlongArray result = env->NewLongArray(USAGE_COUNT);
+  if (result != NULL) {
+    env->SetLongArrayRegion(result, 0, USAGE_COUNT, values);
+  }
+  return result;
+}
+
 extern "C" JNIEXPORT jint JNICALL
 Java_com_google_devtools_build_lib_windows_WindowsProcesses_nativeGetExitCode(
     JNIEnv *env, jclass clazz, jlong process_long) {
@@ -0,0 +1,113 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/main/tools/benchmark-util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sstream>
+
+namespace benchmark_util {
+
+using std::string;
+using std::vector;
+
+int RunProcess(const string &cwd, const vector<string> &args, string *err) {
+  int fds[2];
+  if (pipe(fds) == -1) {
+    return -1;
+  }
+  vector<const char *> argv;
+  for (const string &arg : args) {
+    argv.push_back(arg.c_str());
+  }
+  argv.push_back(NULL);
+
+  pid_t child = fork();
+  if (child == -1) {
+    int fork_errno = errno;
+    close(fds[0]);
+    close(fds[1]);
+    errno = fork_errno;
+    return -1;
+  }
+  if (child == 0) {
+    int devnull = open("/dev/null", O_RDWR);
+    dup2(devnull, STDIN_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    if (chdir(cwd.c_str()) == -1) {
+      _exit(127);
+    }
+    execv(argv[0], const_cast<char **>(argv.data()));
+    _exit(127);
+  }
+
+  close(fds[1]);
+  string output;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) != 0) {
+    if (n > 0) {
+      output.append(buf, n);
+    } else if (errno != EINTR) {
+      break;
+    }
+  }
+  close(fds[0]);
+  int status;
+  while (waitpid(child, &status, 0) == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  if (err != NULL) {
+    *err = output;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+double Percentile(const vector<double> &sorted, int p) {
+  size_t rank = (sorted.size() * p + 99) / 100;
+  return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+vector<string> Split(const string &s, char separator) {
+  vector<string> result;
+  std::istringstream stream(s);
+  string part;
+  while (std::getline(stream, part, separator)) {
+    if (!part.empty()) {
+      result.push_back(part);
+    }
+  }
+  return result;
+}
+
+bool Flag(const string &arg, const string &name, string *value) {
+  string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  *value = arg.substr(prefix.size());
+  return true;
+}
+
+}  // namespace benchmark_util
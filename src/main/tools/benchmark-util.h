@@ -0,0 +1,45 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// What the benchmark binaries (startup_benchmark, linux-sandbox-benchmark and
+// tree-benchmark) share: running the tools they time, parsing their flags and
+// reporting percentiles.
+
+#ifndef BENCHMARK_UTIL_H__
+#define BENCHMARK_UTIL_H__
+
+#include <string>
+#include <vector>
+
+namespace benchmark_util {
+
+// Runs argv in 'cwd' with the standard output discarded, and returns its exit
+// code, or -1 and sets errno if it could not be run or waited for. The
+// standard error is returned in *err if err is not NULL, and discarded
+// otherwise.
+int RunProcess(const std::string &cwd, const std::vector<std::string> &args,
+               std::string *err);
+
+// The nearest-rank percentile p of the sorted values.
+double Percentile(const std::vector<double> &sorted, int p);
+
+// The non-empty parts of 's' between the separators.
+std::vector<std::string> Split(const std::string &s, char separator);
+
+// Sets *value to the value of 'arg' and returns true if it is --<name>=value.
+bool Flag(const std::string &arg, const std::string &name, std::string *value);
+
+}  // namespace benchmark_util
+
+#endif  // BENCHMARK_UTIL_H__
@@ -0,0 +1,854 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This program writes the interface of an ELF shared object:
+//
+//   build-interface-so <so> <interface so>
+//
+// Like ijar for jars, the interface has only what linking against the shared
+// object needs: the dynamic symbols it defines, their versions, its SONAME,
+// DT_NEEDED and run path. The code and data are gone. It is the same for any
+// two builds of a library with the same ABI, so that what links against it
+// need not be linked again when only the implementation changed.
+//
+// The interface is itself an ELF shared object of the same class, byte order
+// and machine, with the sections .dynsym, .dynstr, .gnu.version,
+// .gnu.version_d and .dynamic, and NOBITS sections for the symbols defined in
+// code, data and thread-local storage to be in. The symbols are sorted by
+// name and version. Their values are made up, but symbols that were at the
+// same address still are (e.g. "environ" and "__environ"), and the alignment
+// of their section is kept, as linkers look at both for copy relocations.
+// So are the sizes of the data and thread-local symbols, for the same reason;
+// the functions have no size, which would change with their code.
+// The symbols the object only uses are left out; they are not part of its
+// interface, and linkers only look at them to check that they resolve.
+//
+// Any other file, e.g. a Mach-O dynamic library, is copied as it is.
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+// The parts of the ELF specification used here, which <elf.h> has on Linux
+// only.
+const uint16_t ET_DYN = 3;
+const uint32_t PT_LOAD = 1;
+const uint32_t PT_DYNAMIC = 2;
+const uint32_t PT_TLS = 7;
+const uint32_t PF_W = 2;
+const uint32_t PF_R = 4;
+const uint32_t SHT_STRTAB = 3;
+const uint32_t SHT_DYNAMIC = 6;
+const uint32_t SHT_NOBITS = 8;
+const uint32_t SHT_DYNSYM = 11;
+const uint32_t SHT_GNU_VERDEF = 0x6ffffffd;
+const uint32_t SHT_GNU_VERSYM = 0x6fffffff;
+const uint64_t SHF_WRITE = 0x1;
+const uint64_t SHF_ALLOC = 0x2;
+const uint64_t SHF_EXECINSTR = 0x4;
+const uint64_t SHF_TLS = 0x400;
+const uint16_t SHN_UNDEF = 0;
+const uint16_t SHN_LORESERVE = 0xff00;
+const uint16_t SHN_ABS = 0xfff1;
+const uint16_t SHN_XINDEX = 0xffff;
+const int STB_GLOBAL = 1;
+const int STB_WEAK = 2;
+const int STB_GNU_UNIQUE = 10;
+const int STT_FUNC = 2;
+const int STT_GNU_IFUNC = 10;
+const int STV_DEFAULT = 0;
+const int STV_PROTECTED = 3;
+const int64_t DT_NULL = 0;
+const int64_t DT_NEEDED = 1;
+const int64_t DT_STRTAB = 5;
+const int64_t DT_SYMTAB = 6;
+const int64_t DT_STRSZ = 10;
+const int64_t DT_SYMENT = 11;
+const int64_t DT_SONAME = 14;
+const int64_t DT_RPATH = 15;
+const int64_t DT_RUNPATH = 29;
+const int64_t DT_VERSYM = 0x6ffffff0;
+const int64_t DT_VERDEF = 0x6ffffffc;
+const int64_t DT_VERDEFNUM = 0x6ffffffd;
+
+const char *input_path;
+
+void Die(const char *format, ...) {
+  fprintf(stderr, "build-interface-so: %s: ", input_path);
+  va_list ap;
+  va_start(ap, format);
+  vfprintf(stderr, format, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+  exit(1);
+}
+
+// The layout of ELF structures differs between ELFCLASS32 and ELFCLASS64 in
+// the size and position of their fields; their contents are in the byte order
+// of the file.
+struct Format {
+  bool is64;
+  bool big_endian;
+
+  size_t word() const { return is64 ? 8 : 4; }
+  size_t ehdr_size() const { return is64 ? 64 : 52; }
+  size_t phdr_size() const { return is64 ? 56 : 32; }
+  size_t shdr_size() const { return is64 ? 64 : 40; }
+  size_t sym_size() const { return is64 ? 24 : 16; }
+  size_t dyn_size() const { return is64 ? 16 : 8; }
+};
+
+class Reader {
+ public:
+  Reader(const std::string &data, const Format &format)
+      : data_(data), format_(format) {}
+
+  uint64_t Get(uint64_t offset, size_t bytes) const {
+    if (offset > data_.size() || bytes > data_.size() - offset) {
+      Die("truncated at offset %llu", static_cast<unsigned long long>(offset));
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      size_t index = format_.big_endian ? i : bytes - 1 - i;
+      value = (value << 8) | static_cast<uint8_t>(data_[offset + index]);
+    }
+    return value;
+  }
+
+  uint64_t Word(uint64_t offset) const {
+    return Get(offset, format_.word());
+  }
+
+  // Returns the NUL-terminated string at 'offset'.
+  std::string String(uint64_t offset) const {
+    if (offset >= data_.size()) {
+      Die("string at offset %llu is out of bounds",
+          static_cast<unsigned long long>(offset));
+    }
+    size_t end = data_.find('\0', offset);
+    if (end == std::string::npos) {
+      Die("unterminated string at offset %llu",
+          static_cast<unsigned long long>(offset));
+    }
+    return data_.substr(offset, end - offset);
+  }
+
+ private:
+  const std::string &data_;
+  const Format &format_;
+};
+
+class Writer {
+ public:
+  explicit Writer(const Format &format) : format_(format) {}
+
+  void Put(uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      size_t shift = 8 * (format_.big_endian ? bytes - 1 - i : i);
+      data_.push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+  }
+
+  void Word(uint64_t value) { Put(value, format_.word()); }
+
+  void Bytes(const std::string &bytes) { data_.append(bytes); }
+
+  void Align(size_t alignment) {
+    while (data_.size() % alignment != 0) {
+      data_.push_back('\0');
+    }
+  }
+
+  size_t size() const { return data_.size(); }
+  const std::string &data() const { return data_; }
+
+ private:
+  const Format &format_;
+  std::string data_;
+};
+
+struct Section {
+  uint32_t name;
+  uint32_t type;
+  uint64_t flags;
+  uint64_t addr;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t link;
+  uint32_t info;
+  uint64_t addralign;
+  uint64_t entsize;
+};
+
+struct Symbol {
+  std::string name;
+  uint8_t info;
+  uint8_t other;
+  uint16_t shndx;
+  uint64_t value;
+  uint64_t size;
+  uint16_t versym;
+};
+
+struct VersionDefinition {
+  uint16_t flags;
+  uint16_t ndx;
+  uint32_t hash;
+  std::vector<std::string> names;  // The version, then its parents.
+};
+
+// A string table that has every string once, in the order they were added.
+class StringTable {
+ public:
+  StringTable() : data_(1, '\0') {}
+
+  uint32_t Add(const std::string &s) {
+    std::map<std::string, uint32_t>::const_iterator it = offsets_.find(s);
+    if (it != offsets_.end()) {
+      return it->second;
+    }
+    uint32_t offset = data_.size();
+    data_.append(s);
+    data_.push_back('\0');
+    offsets_[s] = offset;
+    return offset;
+  }
+
+  const std::string &data() const { return data_; }
+
+ private:
+  std::string data_;
+  std::map<std::string, uint32_t> offsets_;
+};
+
+bool ReadFile(const char *path, std::string *contents) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  char buffer[64 * 1024];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents->append(buffer, n);
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+void WriteFile(const char *path, const std::string &contents) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL ||
+      fwrite(contents.data(), 1, contents.size(), file) != contents.size() ||
+      fclose(file) != 0) {
+    fprintf(stderr, "build-interface-so: %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+}
+
+uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+  return alignment == 0 ? value : (value + alignment - 1) / alignment * alignment;
+}
+
+// Where the interface puts a defined symbol.
+enum Placement { kAbsolute, kText, kData, kTls, kNumPlacements };
+
+class InterfaceBuilder {
+ public:
+  InterfaceBuilder(const std::string &input, const Format &format)
+      : input_(input), format_(format), reader_(input, format) {}
+
+  std::string Build() {
+    ReadSections();
+    ReadSymbols();
+    ReadVersionDefinitions();
+    ReadDynamic();
+    return Write();
+  }
+
+ private:
+  void ReadSections() {
+    const Reader &r = reader_;
+    e_machine_ = r.Get(18, 2);
+    e_flags_ = r.Get(format_.is64 ? 48 : 36, 4);
+    uint64_t shoff = r.Word(format_.is64 ? 40 : 32);
+    uint64_t shentsize = r.Get(format_.is64 ? 58 : 46, 2);
+    uint64_t shnum = r.Get(format_.is64 ? 60 : 48, 2);
+    if (shoff == 0) {
+      Die("has no section headers");
+    }
+    if (shentsize != format_.shdr_size()) {
+      Die("has section headers of size %llu",
+          static_cast<unsigned long long>(shentsize));
+    }
+    if (shnum == 0) {
+      // More than SHN_LORESERVE sections; the count is in the first header.
+      shnum = r.Word(shoff + (format_.is64 ? 32 : 20));
+    }
+    for (uint64_t i = 0; i < shnum; ++i) {
+      uint64_t p = shoff + i * shentsize;
+      Section s;
+      s.name = r.Get(p, 4);
+      s.type = r.Get(p + 4, 4);
+      if (format_.is64) {
+        s.flags = r.Get(p + 8, 8);
+        s.addr = r.Get(p + 16, 8);
+        s.offset = r.Get(p + 24, 8);
+        s.size = r.Get(p + 32, 8);
+        s.link = r.Get(p + 40, 4);
+        s.info = r.Get(p + 44, 4);
+        s.addralign = r.Get(p + 48, 8);
+        s.entsize = r.Get(p + 56, 8);
+      } else {
+        s.flags = r.Get(p + 8, 4);
+        s.addr = r.Get(p + 12, 4);
+        s.offset = r.Get(p + 16, 4);
+        s.size = r.Get(p + 20, 4);
+        s.link = r.Get(p + 24, 4);
+        s.info = r.Get(p + 28, 4);
+        s.addralign = r.Get(p + 32, 4);
+        s.entsize = r.Get(p + 36, 4);
+      }
+      if (s.type != SHT_NOBITS && s.size > 0) {
+        r.Get(s.offset + s.size - 1, 1);  // Dies if it is out of bounds.
+      }
+      sections_.push_back(s);
+    }
+  }
+
+  // Returns the only section of the type, or NULL. Dies if there are more.
+  const Section *FindSection(uint32_t type) const {
+    const Section *result = NULL;
+    for (size_t i = 0; i < sections_.size(); ++i) {
+      if (sections_[i].type == type) {
+        if (result != NULL) {
+          Die("has more than one section of type 0x%x", type);
+        }
+        result = &sections_[i];
+      }
+    }
+    return result;
+  }
+
+  const Section &LinkedStrings(const Section &section) const {
+    if (section.link >= sections_.size() ||
+        sections_[section.link].type != SHT_STRTAB) {
+      Die("section of type 0x%x is not linked to a string table",
+          section.type);
+    }
+    return sections_[section.link];
+  }
+
+  std::string StringIn(const Section &strings, uint64_t offset) const {
+    if (offset >= strings.size) {
+      Die("string %llu is out of bounds",
+          static_cast<unsigned long long>(offset));
+    }
+    return reader_.String(strings.offset + offset);
+  }
+
+  void ReadSymbols() {
+    const Section *dynsym = FindSection(SHT_DYNSYM);
+    if (dynsym == NULL) {
+      Die("has no dynamic symbol table");
+    }
+    const Section &strings = LinkedStrings(*dynsym);
+    const Section *versym = FindSection(SHT_GNU_VERSYM);
+    has_versions_ = versym != NULL;
+    uint64_t count = dynsym->size / format_.sym_size();
+    const Reader &r = reader_;
+    for (uint64_t i = 1; i < count; ++i) {
+      uint64_t p = dynsym->offset + i * format_.sym_size();
+      Symbol s;
+      uint32_t name;
+      if (format_.is64) {
+        name = r.Get(p, 4);
+        s.info = r.Get(p + 4, 1);
+        s.other = r.Get(p + 5, 1);
+        s.shndx = r.Get(p + 6, 2);
+        s.value = r.Get(p + 8, 8);
+        s.size = r.Get(p + 16, 8);
+      } else {
+        name = r.Get(p, 4);
+        s.value = r.Get(p + 4, 4);
+        s.size = r.Get(p + 8, 4);
+        s.info = r.Get(p + 12, 1);
+        s.other = r.Get(p + 13, 1);
+        s.shndx = r.Get(p + 14, 2);
+      }
+      int bind = s.info >> 4;
+      int visibility = s.other & 0x3;
+      if (s.shndx == SHN_UNDEF ||
+          (bind != STB_GLOBAL && bind != STB_WEAK && bind != STB_GNU_UNIQUE) ||
+          (visibility != STV_DEFAULT && visibility != STV_PROTECTED)) {
+        continue;
+      }
+      if (s.shndx == SHN_XINDEX ||
+          (s.shndx >= SHN_LORESERVE && s.shndx != SHN_ABS) ||
+          (s.shndx < SHN_LORESERVE && s.shndx >= sections_.size())) {
+        Die("symbol %llu has an unsupported section index 0x%x",
+            static_cast<unsigned long long>(i), s.shndx);
+      }
+      int type = s.info & 0xf;
+      if (type == STT_FUNC || type == STT_GNU_IFUNC) {
+        // Only the symbols a program may copy need a size. The functions
+        // are thus laid out in the order of their names alone.
+        s.size = 0;
+      }
+      s.name = StringIn(strings, name);
+      s.versym = has_versions_ ? r.Get(versym->offset + 2 * i, 2) : 0;
+      symbols_.push_back(s);
+    }
+    std::sort(symbols_.begin(), symbols_.end(), SymbolOrder);
+  }
+
+  static bool SymbolOrder(const Symbol &a, const Symbol &b) {
+    if (a.name != b.name) {
+      return a.name < b.name;
+    }
+    return a.versym < b.versym;
+  }
+
+  void ReadVersionDefinitions() {
+    const Section *verdef = FindSection(SHT_GNU_VERDEF);
+    if (verdef == NULL) {
+      return;
+    }
+    const Section &strings = LinkedStrings(*verdef);
+    const Reader &r = reader_;
+    uint64_t p = verdef->offset;
+    for (uint32_t i = 0; i < verdef->info; ++i) {
+      VersionDefinition d;
+      d.flags = r.Get(p + 2, 2);
+      d.ndx = r.Get(p + 4, 2);
+      uint16_t cnt = r.Get(p + 6, 2);
+      d.hash = r.Get(p + 8, 4);
+      uint64_t aux = p + r.Get(p + 12, 4);
+      for (uint16_t j = 0; j < cnt; ++j) {
+        d.names.push_back(StringIn(strings, r.Get(aux, 4)));
+        aux += r.Get(aux + 4, 4);
+      }
+      version_definitions_.push_back(d);
+      uint32_t next = r.Get(p + 16, 4);
+      if (next == 0) {
+        break;
+      }
+      p += next;
+    }
+  }
+
+  void ReadDynamic() {
+    const Section *dynamic = FindSection(SHT_DYNAMIC);
+    if (dynamic == NULL) {
+      Die("has no dynamic section");
+    }
+    const Section &strings = LinkedStrings(*dynamic);
+    const Reader &r = reader_;
+    for (uint64_t p = dynamic->offset;
+         p + format_.dyn_size() <= dynamic->offset + dynamic->size;
+         p += format_.dyn_size()) {
+      int64_t tag = r.Word(p);
+      uint64_t value = r.Word(p + format_.word());
+      if (!format_.is64) {
+        tag = static_cast<int32_t>(tag);
+      }
+      if (tag == DT_NULL) {
+        break;
+      }
+      if (tag == DT_NEEDED || tag == DT_SONAME || tag == DT_RPATH ||
+          tag == DT_RUNPATH) {
+        dynamic_strings_.push_back(
+            std::make_pair(tag, StringIn(strings, value)));
+      }
+    }
+  }
+
+  Placement PlacementOf(const Symbol &symbol) const {
+    if (symbol.shndx == SHN_ABS) {
+      return kAbsolute;
+    }
+    uint64_t flags = sections_[symbol.shndx].flags;
+    if (flags & SHF_TLS) {
+      return kTls;
+    }
+    return (flags & SHF_EXECINSTR) ? kText : kData;
+  }
+
+  // Lays the symbols out in the placeholder sections: those at the same
+  // address in the same section stay together, and the groups follow each
+  // other in the order of their first symbol, aligned like their sections.
+  void Place(std::vector<uint64_t> *offsets) {
+    for (int i = 0; i < kNumPlacements; ++i) {
+      placeholder_align_[i] = 1;
+      placeholder_size_[i] = 0;
+    }
+    for (size_t i = 0; i < symbols_.size(); ++i) {
+      Placement placement = PlacementOf(symbols_[i]);
+      if (placement != kAbsolute) {
+        placeholder_align_[placement] =
+            std::max(placeholder_align_[placement],
+                     sections_[symbols_[i].shndx].addralign);
+      }
+    }
+    std::map<std::pair<uint16_t, uint64_t>, uint64_t> group_offsets;
+    std::map<std::pair<uint16_t, uint64_t>, uint64_t> group_sizes;
+    for (size_t i = 0; i < symbols_.size(); ++i) {
+      std::pair<uint16_t, uint64_t> key(symbols_[i].shndx, symbols_[i].value);
+      group_sizes[key] = std::max(group_sizes[key], symbols_[i].size);
+    }
+    for (size_t i = 0; i < symbols_.size(); ++i) {
+      const Symbol &s = symbols_[i];
+      Placement placement = PlacementOf(s);
+      if (placement == kAbsolute) {
+        offsets->push_back(s.value);
+        continue;
+      }
+      std::pair<uint16_t, uint64_t> key(s.shndx, s.value);
+      if (group_offsets.find(key) == group_offsets.end()) {
+        uint64_t offset = AlignUp(placeholder_size_[placement],
+                                  placeholder_align_[placement]);
+        group_offsets[key] = offset;
+        placeholder_size_[placement] =
+            offset + std::max<uint64_t>(group_sizes[key], 1);
+      }
+      offsets->push_back(group_offsets[key]);
+    }
+  }
+
+  void PutSection(Writer *w, uint32_t name, uint32_t type, uint64_t flags,
+                  uint64_t addr, uint64_t size, uint32_t link, uint32_t info,
+                  uint64_t addralign, uint64_t entsize) {
+    w->Put(name, 4);
+    w->Put(type, 4);
+    w->Word(flags);
+    w->Word(addr);
+    w->Word(type == SHT_NOBITS ? 0 : addr);  // The offset is the address.
+    w->Word(size);
+    w->Put(link, 4);
+    w->Put(info, 4);
+    w->Word(addralign);
+    w->Word(entsize);
+  }
+
+  std::string Write() {
+    std::vector<uint64_t> offsets;
+    Place(&offsets);
+
+    StringTable dynstr;
+    for (size_t i = 0; i < dynamic_strings_.size(); ++i) {
+      dynstr.Add(dynamic_strings_[i].second);
+    }
+    for (size_t i = 0; i < version_definitions_.size(); ++i) {
+      for (size_t j = 0; j < version_definitions_[i].names.size(); ++j) {
+        dynstr.Add(version_definitions_[i].names[j]);
+      }
+    }
+    for (size_t i = 0; i < symbols_.size(); ++i) {
+      dynstr.Add(symbols_[i].name);
+    }
+
+    const size_t word = format_.word();
+    bool has_tls = placeholder_size_[kTls] > 0;
+    int phnum = has_tls ? 3 : 2;
+
+    // The contents of the allocated sections, at addresses equal to their
+    // offsets in the file.
+    Writer w(format_);
+    w.Bytes(std::string(format_.ehdr_size() + phnum * format_.phdr_size(),
+                        '\0'));
+
+    w.Align(word);
+    uint64_t dynsym_addr = w.size();
+    w.Bytes(std::string(format_.sym_size(), '\0'));
+    uint64_t placeholder_addr[kNumPlacements] = {0, 0, 0, 0};
+    // The placeholders follow the contents; their addresses are only known
+    // once those are laid out, so the symbols are written below.
+    uint64_t dynsym_size = format_.sym_size() * (symbols_.size() + 1);
+    w.Bytes(std::string(dynsym_size - format_.sym_size(), '\0'));
+
+    uint64_t dynstr_addr = w.size();
+    w.Bytes(dynstr.data());
+
+    uint64_t versym_addr = 0;
+    if (has_versions_) {
+      w.Align(2);
+      versym_addr = w.size();
+      w.Put(0, 2);
+      for (size_t i = 0; i < symbols_.size(); ++i) {
+        w.Put(symbols_[i].versym, 2);
+      }
+    }
+
+    uint64_t verdef_addr = 0;
+    if (!version_definitions_.empty()) {
+      w.Align(word);
+      verdef_addr = w.size();
+      for (size_t i = 0; i < version_definitions_.size(); ++i) {
+        const VersionDefinition &d = version_definitions_[i];
+        bool last = i + 1 == version_definitions_.size();
+        w.Put(1, 2);  // vd_version
+        w.Put(d.flags, 2);
+        w.Put(d.ndx, 2);
+        w.Put(d.names.size(), 2);
+        w.Put(d.hash, 4);
+        w.Put(20, 4);  // vd_aux: the auxiliary entries follow.
+        w.Put(last ? 0 : 20 + 8 * d.names.size(), 4);
+        for (size_t j = 0; j < d.names.size(); ++j) {
+          w.Put(dynstr.Add(d.names[j]), 4);
+          w.Put(j + 1 == d.names.size() ? 0 : 8, 4);
+        }
+      }
+    }
+    uint64_t verdef_size = w.size() - verdef_addr;
+
+    w.Align(word);
+    uint64_t dynamic_addr = w.size();
+    for (size_t i = 0; i < dynamic_strings_.size(); ++i) {
+      w.Word(dynamic_strings_[i].first);
+      w.Word(dynstr.Add(dynamic_strings_[i].second));
+    }
+    w.Word(DT_STRTAB);
+    w.Word(dynstr_addr);
+    w.Word(DT_SYMTAB);
+    w.Word(dynsym_addr);
+    w.Word(DT_STRSZ);
+    w.Word(dynstr.data().size());
+    w.Word(DT_SYMENT);
+    w.Word(format_.sym_size());
+    if (has_versions_) {
+      w.Word(DT_VERSYM);
+      w.Word(versym_addr);
+    }
+    if (!version_definitions_.empty()) {
+      w.Word(DT_VERDEF);
+      w.Word(verdef_addr);
+      w.Word(DT_VERDEFNUM);
+      w.Word(version_definitions_.size());
+    }
+    w.Word(DT_NULL);
+    w.Word(0);
+    uint64_t dynamic_size = w.size() - dynamic_addr;
+    uint64_t file_size = w.size();
+
+    uint64_t memory_end = file_size;
+    for (int p = kText; p < kNumPlacements; ++p) {
+      if (placeholder_size_[p] > 0) {
+        placeholder_addr[p] = AlignUp(memory_end, placeholder_align_[p]);
+        if (p != kTls) {
+          memory_end = placeholder_addr[p] + placeholder_size_[p];
+        }
+      }
+    }
+    if (has_tls) {
+      // Any non-TLS address does, as the TLS symbols are offsets in the block.
+      placeholder_addr[kTls] = AlignUp(memory_end, placeholder_align_[kTls]);
+    }
+
+    // The section headers, after the section names.
+    StringTable shstrtab;
+    Writer sh(format_);
+    uint32_t shndx[kNumPlacements] = {SHN_ABS, 0, 0, 0};
+    PutSection(&sh, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    uint32_t shnum = 1;
+    const uint32_t dynsym_index = shnum++;
+    const uint32_t dynstr_index = shnum++;
+    PutSection(&sh, shstrtab.Add(".dynsym"), SHT_DYNSYM, SHF_ALLOC, dynsym_addr,
+               dynsym_size, dynstr_index, 1, word, format_.sym_size());
+    PutSection(&sh, shstrtab.Add(".dynstr"), SHT_STRTAB, SHF_ALLOC, dynstr_addr,
+               dynstr.data().size(), 0, 0, 1, 0);
+    if (has_versions_) {
+      PutSection(&sh, shstrtab.Add(".gnu.version"), SHT_GNU_VERSYM, SHF_ALLOC,
+                 versym_addr, 2 * (symbols_.size() + 1), dynsym_index, 0, 2, 2);
+      shnum++;
+    }
+    if (!version_definitions_.empty()) {
+      PutSection(&sh, shstrtab.Add(".gnu.version_d"), SHT_GNU_VERDEF,
+                 SHF_ALLOC, verdef_addr, verdef_size, dynstr_index,
+                 version_definitions_.size(), word, 0);
+      shnum++;
+    }
+    PutSection(&sh, shstrtab.Add(".dynamic"), SHT_DYNAMIC,
+               SHF_ALLOC | SHF_WRITE, dynamic_addr, dynamic_size,
+               dynstr_index, 0, word, format_.dyn_size());
+    shnum++;
+    static const char *const kPlaceholderNames[] = {NULL, ".text", ".data",
+                                                    ".tbss"};
+    static const uint64_t kPlaceholderFlags[] = {
+        0, SHF_ALLOC | SHF_EXECINSTR, SHF_ALLOC | SHF_WRITE,
+        SHF_ALLOC | SHF_WRITE | SHF_TLS};
+    for (int p = kText; p < kNumPlacements; ++p) {
+      if (placeholder_size_[p] > 0) {
+        PutSection(&sh, shstrtab.Add(kPlaceholderNames[p]), SHT_NOBITS,
+                   kPlaceholderFlags[p], placeholder_addr[p],
+                   placeholder_size_[p], 0, 0, placeholder_align_[p], 0);
+        shndx[p] = shnum++;
+      }
+    }
+    const uint32_t shstrtab_index = shnum++;
+    uint32_t shstrtab_name = shstrtab.Add(".shstrtab");
+    uint64_t shstrtab_offset = file_size;
+    uint64_t shoff = AlignUp(shstrtab_offset + shstrtab.data().size(), word);
+    // Not allocated, so its offset is not its address.
+    sh.Put(shstrtab_name, 4);
+    sh.Put(SHT_STRTAB, 4);
+    sh.Word(0);
+    sh.Word(0);
+    sh.Word(shstrtab_offset);
+    sh.Word(shstrtab.data().size());
+    sh.Put(0, 4);
+    sh.Put(0, 4);
+    sh.Word(1);
+    sh.Word(0);
+
+    // The symbols.
+    Writer syms(format_);
+    for (size_t i = 0; i < symbols_.size(); ++i) {
+      const Symbol &s = symbols_[i];
+      Placement placement = PlacementOf(s);
+      uint64_t value = offsets[i];
+      if (placement == kText || placement == kData) {
+        value += placeholder_addr[placement];
+      }
+      uint32_t name = dynstr.Add(s.name);
+      if (format_.is64) {
+        syms.Put(name, 4);
+        syms.Put(s.info, 1);
+        syms.Put(s.other, 1);
+        syms.Put(shndx[placement], 2);
+        syms.Put(value, 8);
+        syms.Put(s.size, 8);
+      } else {
+        syms.Put(name, 4);
+        syms.Put(value, 4);
+        syms.Put(s.size, 4);
+        syms.Put(s.info, 1);
+        syms.Put(s.other, 1);
+        syms.Put(shndx[placement], 2);
+      }
+    }
+
+    // The headers.
+    Writer h(format_);
+    h.Bytes(input_.substr(0, 16));
+    h.Put(ET_DYN, 2);
+    h.Put(e_machine_, 2);
+    h.Put(1, 4);  // e_version
+    h.Word(0);    // e_entry
+    h.Word(format_.ehdr_size());
+    h.Word(shoff);
+    h.Put(e_flags_, 4);
+    h.Put(format_.ehdr_size(), 2);
+    h.Put(format_.phdr_size(), 2);
+    h.Put(phnum, 2);
+    h.Put(format_.shdr_size(), 2);
+    h.Put(shnum, 2);
+    h.Put(shstrtab_index, 2);
+    PutSegment(&h, PT_LOAD, PF_R | PF_W, 0, file_size, memory_end, 0x1000);
+    PutSegment(&h, PT_DYNAMIC, PF_R | PF_W, dynamic_addr, dynamic_size,
+               dynamic_size, word);
+    if (has_tls) {
+      PutSegment(&h, PT_TLS, PF_R, placeholder_addr[kTls], 0,
+                 placeholder_size_[kTls], placeholder_align_[kTls]);
+    }
+
+    std::string result = w.data();
+    result.replace(0, h.size(), h.data());
+    result.replace(dynsym_addr + format_.sym_size(), syms.size(), syms.data());
+    result.append(shstrtab.data());
+    result.append(shoff - result.size(), '\0');
+    result.append(sh.data());
+    return result;
+  }
+
+  void PutSegment(Writer *w, uint32_t type, uint32_t flags, uint64_t addr,
+                  uint64_t filesz, uint64_t memsz, uint64_t align) {
+    // A NOBITS segment has no file contents to be at its address.
+    uint64_t offset = filesz == 0 ? 0 : addr;
+    w->Put(type, 4);
+    if (format_.is64) {
+      w->Put(flags, 4);
+      w->Word(offset);
+      w->Word(addr);
+      w->Word(addr);
+      w->Word(filesz);
+      w->Word(memsz);
+      w->Word(align);
+    } else {
+      w->Word(offset);
+      w->Word(addr);
+      w->Word(addr);
+      w->Word(filesz);
+      w->Word(memsz);
+      w->Put(flags, 4);
+      w->Word(align);
+    }
+  }
+
+  const std::string &input_;
+  const Format &format_;
+  const Reader reader_;
+
+  uint16_t e_machine_;
+  uint32_t e_flags_;
+  std::vector<Section> sections_;
+  std::vector<Symbol> symbols_;
+  bool has_versions_;
+  std::vector<VersionDefinition> version_definitions_;
+  // DT_NEEDED, DT_SONAME, DT_RPATH and DT_RUNPATH, in their order.
+  std::vector<std::pair<int64_t, std::string> > dynamic_strings_;
+  uint64_t placeholder_align_[kNumPlacements];
+  uint64_t placeholder_size_[kNumPlacements];
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <so> <interface so>\n", argv[0]);
+    return 1;
+  }
+  input_path = argv[1];
+  std::string input;
+  if (!ReadFile(input_path, &input)) {
+    fprintf(stderr, "build-interface-so: %s: %s\n", input_path,
+            strerror(errno));
+    return 1;
+  }
+
+  if (input.size() < 16 || input.compare(0, 4, "\x7f" "ELF") != 0) {
+    WriteFile(argv[2], input);
+    return 0;
+  }
+  Format format;
+  if ((input[4] != 1 && input[4] != 2) || (input[5] != 1 && input[5] != 2)) {
+    Die("has an unknown ELF class or byte order");
+  }
+  format.is64 = input[4] == 2;
+  format.big_endian = input[5] == 2;
+  if (Reader(input, format).Get(16, 2) != ET_DYN) {
+    Die("is not a shared object");
+  }
+  WriteFile(argv[2], InterfaceBuilder(input, format).Build());
+  return 0;
+}
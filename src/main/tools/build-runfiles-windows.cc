@@ -0,0 +1,750 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The Windows version of build-runfiles.cc, on the Win32 API rather than a
+// POSIX emulation. It takes the same arguments and manifests, but for
+// --index_only, and likewise keeps the entries of RUNFILES that are what the
+// manifest asks for, deleting and creating only the others.
+//
+// A symlink of the manifest becomes the first of these that the system allows:
+//   a symbolic link, which takes either the privilege to create them or, with
+//     the unprivileged flag of Windows 10, developer mode;
+//   a directory junction, if the target is a directory;
+//   a hard link, if the target is a file on the same volume;
+//   a copy.
+// An entry on disk is such a symlink if it leads to the same file as the
+// target, or, if it is a plain file, has the size and the time of the last
+// write of the target, as a copy would. So a hard link or a copy of a file
+// that was rebuilt since is replaced.
+
+#define WINVER 0x0601
+#define _WIN32_WINNT 0x0601
+
+#include <windows.h>
+#include <winioctl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/main/cpp/util/trace_events.h"
+
+static const char *argv0;
+
+const char *input_filename;
+const char *output_base_dir;
+
+static std::string ErrorMessage(DWORD error);
+
+#define LOG() { \
+  fprintf(stderr, "%s (args %s %s): ", \
+          argv0, input_filename, output_base_dir); \
+}
+
+#define DIE(...) { \
+  LOG(); \
+  fprintf(stderr, __VA_ARGS__); \
+  fprintf(stderr, "\n"); \
+  exit(1); \
+}
+
+// Like DIE(), with the error of the Win32 call that failed last.
+#define PDIE(...) { \
+  DWORD saved_error = GetLastError(); \
+  LOG(); \
+  fprintf(stderr, __VA_ARGS__); \
+  fprintf(stderr, ": %s [%lu]\n", ErrorMessage(saved_error).c_str(), \
+          saved_error); \
+  exit(1); \
+}
+
+// SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE, which the headers only define
+// when targeting Windows 10 (and which only works there, in developer mode).
+static const DWORD kSymbolicLinkAllowUnprivileged = 0x2;
+
+// FILE_DISPOSITION_INFO_EX and its flags, which the headers only define when
+// targeting Windows 10 (and which only work there, from version 1809).
+static const FILE_INFO_BY_HANDLE_CLASS kFileDispositionInfoEx =
+    static_cast<FILE_INFO_BY_HANDLE_CLASS>(21);
+static const DWORD kDispositionDelete = 0x1;
+static const DWORD kDispositionPosixSemantics = 0x2;
+static const DWORD kDispositionIgnoreReadonly = 0x10;
+struct FileDispositionInformationEx {
+  DWORD flags;
+};
+
+// The reparse data of a directory junction, which the headers only define for
+// drivers.
+struct MountPointReparseBuffer {
+  DWORD reparse_tag;
+  USHORT reparse_data_length;
+  USHORT reserved;
+  USHORT substitute_name_offset;
+  USHORT substitute_name_length;
+  USHORT print_name_offset;
+  USHORT print_name_length;
+  WCHAR path_buffer[1];
+};
+
+// The longest path the Win32 API handles, with the "\\?\" prefix.
+static const size_t kMaxPath = 32768;
+
+static std::string ErrorMessage(DWORD error) {
+  char *message = NULL;
+  DWORD size = FormatMessageA(
+      FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM |
+          FORMAT_MESSAGE_IGNORE_INSERTS,
+      NULL, error, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+      reinterpret_cast<LPSTR>(&message), 0, NULL);
+  if (size == 0) {
+    return "unknown error";
+  }
+  std::string result(message, size);
+  LocalFree(message);
+  while (!result.empty() &&
+         (result.back() == '\n' || result.back() == '\r' ||
+          result.back() == '.')) {
+    result.pop_back();
+  }
+  return result;
+}
+
+// Converts the UTF-8 'path' to UTF-16, with backslashes for slashes.
+static std::wstring Widen(const std::string &path) {
+  std::wstring result;
+  if (!path.empty()) {
+    int size = MultiByteToWideChar(CP_UTF8, 0, path.data(), path.size(),
+                                   NULL, 0);
+    result.resize(size);
+    MultiByteToWideChar(CP_UTF8, 0, path.data(), path.size(), &result[0],
+                        size);
+  }
+  for (size_t i = 0; i < result.size(); ++i) {
+    if (result[i] == L'/') {
+      result[i] = L'\\';
+    }
+  }
+  return result;
+}
+
+// Converts the UTF-16 'path' to UTF-8, for messages.
+static std::string Narrow(const std::wstring &path) {
+  std::string result;
+  if (!path.empty()) {
+    int size = WideCharToMultiByte(CP_UTF8, 0, path.data(), path.size(), NULL,
+                                   0, NULL, NULL);
+    result.resize(size);
+    WideCharToMultiByte(CP_UTF8, 0, path.data(), path.size(), &result[0],
+                        size, NULL, NULL);
+  }
+  return result;
+}
+
+// Returns the absolute, normalized form of 'path'.
+static std::wstring FullPath(const std::wstring &path) {
+  std::vector<WCHAR> buffer(kMaxPath);
+  DWORD size = GetFullPathNameW(path.c_str(), buffer.size(), buffer.data(),
+                                NULL);
+  if (size == 0 || size >= buffer.size()) {
+    PDIE("resolving '%s'", Narrow(path).c_str());
+  }
+  return std::wstring(buffer.data(), size);
+}
+
+// Returns the full path 'path' with the "\\?\" prefix, which lifts the limit
+// of MAX_PATH characters.
+static std::wstring LongPath(const std::wstring &path) {
+  if (path.compare(0, 4, L"\\\\?\\") == 0) {
+    return path;
+  } else if (path.compare(0, 2, L"\\\\") == 0) {
+    return L"\\\\?\\UNC\\" + path.substr(2);
+  } else {
+    return L"\\\\?\\" + path;
+  }
+}
+
+static bool IsAbsolute(const std::wstring &path) {
+  return (path.size() >= 2 && path[1] == L':') ||
+         (!path.empty() && path[0] == L'\\');
+}
+
+enum FileType {
+  FILE_TYPE_REGULAR,
+  FILE_TYPE_DIRECTORY,
+  FILE_TYPE_SYMLINK
+};
+
+// An entry of the runfiles tree, with the entries below it if it is a
+// directory.
+struct TreeNode {
+  FileType type;
+  // The target of a symlink, as in the manifest.
+  std::string target;
+  // Whether the entry is on disk already, as the scan of the directory it is
+  // in found.
+  bool exists;
+  std::map<std::wstring, std::unique_ptr<TreeNode> > children;
+
+  explicit TreeNode(FileType type) : type(type), exists(false) {}
+};
+
+// An entry of a directory on disk.
+struct DirEntry {
+  std::wstring name;
+  DWORD attributes;
+  // The reparse tag, if attributes has FILE_ATTRIBUTE_REPARSE_POINT.
+  DWORD reparse_tag;
+};
+
+class RunfilesCreator {
+ public:
+  explicit RunfilesCreator(const std::string &output_base)
+      : output_base_(output_base),
+        root_path_(FullPath(Widen(output_base))),
+        manifest_path_(root_path_ + L"\\MANIFEST"),
+        temp_name_(L"MANIFEST.tmp"),
+        temp_path_(root_path_ + L"\\" + temp_name_),
+        root_(FILE_TYPE_DIRECTORY),
+        symlinks_allowed_(true) {
+    SetupOutputBase();
+  }
+
+  void ReadManifest(const std::string &manifest_file, bool allow_relative,
+                    bool use_metadata) {
+    // Binary, so that the copy has the same line ends.
+    FILE *outfile = _wfopen(LongPath(temp_path_).c_str(), L"wb");
+    if (!outfile) {
+      DIE("opening '%s/MANIFEST.tmp' for writing", output_base_.c_str());
+    }
+    FILE *infile =
+        _wfopen(LongPath(FullPath(Widen(manifest_file))).c_str(), L"rb");
+    if (!infile) {
+      DIE("opening '%s' for reading", manifest_file.c_str());
+    }
+
+    int lineno = 0;
+    std::vector<char> buffer(3 * kMaxPath);
+    char *buf = buffer.data();
+    while (fgets(buf, static_cast<int>(buffer.size()), infile)) {
+      // copy line to output manifest
+      if (fputs(buf, outfile) == EOF) {
+        DIE("writing to '%s/MANIFEST.tmp'", output_base_.c_str());
+      }
+
+      // parse line
+      ++lineno;
+      // Skip metadata lines. They are used solely for
+      // dependency checking.
+      if (use_metadata && lineno % 2 == 0) continue;
+
+      int n = strlen(buf)-1;
+      if (!n || buf[n] != '\n') {
+        DIE("missing terminator at line %d: '%s'\n", lineno, buf);
+      }
+      buf[n] = '\0';
+      if (buf[0] ==  '/') {
+        DIE("paths must not be absolute: line %d: '%s'\n", lineno, buf);
+      }
+      const char *s = strchr(buf, ' ');
+      if (!s) {
+        DIE("missing field delimiter at line %d: '%s'\n", lineno, buf);
+      } else if (strchr(s+1, ' ')) {
+        DIE("link or target filename contains space on line %d: '%s'\n",
+            lineno, buf);
+      }
+      const char *target = s+1;
+      if (!allow_relative && target[0] != '\0' && target[0] != '/'
+          && target[1] != ':') {  // Match Windows paths, e.g. C:\foo or C:/foo.
+        DIE("expected absolute path at line %d: '%s'\n", lineno, buf);
+      }
+
+      Add(std::string(buf, s - buf), target);
+    }
+    if (fclose(outfile) != 0) {
+      DIE("writing to '%s/MANIFEST.tmp'", output_base_.c_str());
+    }
+    fclose(infile);
+
+    // Don't delete the temp manifest file.
+    root_.children[temp_name_].reset(new TreeNode(FILE_TYPE_REGULAR));
+  }
+
+  void CreateRunfiles() {
+    // Without the manifest, the next run cannot trust the tree until it is
+    // renamed into place again.
+    if (!DeleteFileW(LongPath(manifest_path_).c_str()) &&
+        GetLastError() != ERROR_FILE_NOT_FOUND) {
+      PDIE("removing previous file at '%s/MANIFEST'", output_base_.c_str());
+    }
+
+    {
+      blaze_util::TraceSpan span("process tree");
+      ProcessDirectory(root_path_, "", &root_);
+    }
+
+    // rename output file into place
+    if (!MoveFileExW(LongPath(temp_path_).c_str(),
+                     LongPath(manifest_path_).c_str(),
+                     MOVEFILE_REPLACE_EXISTING)) {
+      PDIE("renaming '%s/MANIFEST.tmp' to '%s/MANIFEST'", output_base_.c_str(),
+           output_base_.c_str());
+    }
+  }
+
+ private:
+  // Adds the entry 'path' of the manifest, a symlink to 'target', or an empty
+  // file if that is "", and the directories it is in. Of the entries with the
+  // same path, the last one counts.
+  void Add(const std::string &path, const std::string &target) {
+    TreeNode *dir = &root_;
+    size_t start = 0;
+    while (true) {
+      size_t slash = path.find('/', start);
+      const std::wstring name = Widen(
+          path.substr(start, slash == std::string::npos ? slash
+                                                        : slash - start));
+      std::unique_ptr<TreeNode> &child = dir->children[name];
+      if (slash == std::string::npos) {
+        if (child && child->type == FILE_TYPE_DIRECTORY) {
+          DIE("'%s' is not a directory, but there are paths below it",
+              path.c_str());
+        }
+        // No target means an empty file.
+        child.reset(new TreeNode(target.empty() ? FILE_TYPE_REGULAR
+                                                : FILE_TYPE_SYMLINK));
+        child->target = target;
+        return;
+      }
+      if (!child) {
+        child.reset(new TreeNode(FILE_TYPE_DIRECTORY));
+      } else if (child->type != FILE_TYPE_DIRECTORY) {
+        DIE("'%s' is not a directory, but there are paths below it",
+            path.substr(0, slash).c_str());
+      }
+      dir = child.get();
+      start = slash + 1;
+    }
+  }
+
+  void SetupOutputBase() {
+    DWORD attributes = GetFileAttributesW(LongPath(root_path_).c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+      if (!CreateDirectoryW(LongPath(root_path_).c_str(), NULL)) {
+        PDIE("creating directory '%s'", output_base_.c_str());
+      }
+    } else {
+      root_.exists = true;
+    }
+  }
+
+  // Brings the directory 'dir_path' in line with 'node': its entries are
+  // scanned and pruned, those missing created, and then the directories in it
+  // are done the same way. 'prefix' is its path relative to the tree, with a
+  // slash, for messages.
+  void ProcessDirectory(const std::wstring &dir_path, const std::string &prefix,
+                        TreeNode *node) {
+    if (node->exists) {
+      ScanAndPrune(dir_path, prefix, node);
+    }
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      TreeNode *child = it->second.get();
+      const std::wstring child_path = dir_path + L"\\" + it->first;
+      const std::string child_name = prefix + Narrow(it->first);
+      if (!child->exists) {
+        CreateEntry(dir_path, child_path, child_name, child);
+      }
+      if (child->type == FILE_TYPE_DIRECTORY) {
+        ProcessDirectory(child_path, child_name + "/", child);
+      }
+    }
+  }
+
+  // Deletes the entries of the directory 'dir_path' that are not in 'node' or
+  // differ from it, and marks those of 'node' that are there.
+  void ScanAndPrune(const std::wstring &dir_path, const std::string &prefix,
+                    TreeNode *node) {
+    // A note on non-empty files:
+    // We don't distinguish between empty and non-empty files. That is, if
+    // there's a file that has contents, we don't truncate it here, even though
+    // the manifest supports creation of empty files, only. Given that
+    // .runfiles are *supposed* to be immutable, this shouldn't be a problem.
+    std::vector<DirEntry> entries;
+    ReadDirectory(dir_path, prefix, &entries);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const DirEntry &entry = entries[i];
+      const std::wstring entry_path = dir_path + L"\\" + entry.name;
+      auto expected_it = node->children.find(entry.name);
+      if (expected_it != node->children.end() &&
+          Matches(dir_path, entry_path, entry, *expected_it->second)) {
+        expected_it->second->exists = true;
+      } else {
+        Delete(entry_path, prefix + Narrow(entry.name), entry);
+      }
+    }
+  }
+
+  // Lists the entries of the directory 'path' into 'entries'.
+  void ReadDirectory(const std::wstring &path, const std::string &name,
+                     std::vector<DirEntry> *entries) {
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileExW(LongPath(path + L"\\*").c_str(),
+                                   FindExInfoBasic, &data,
+                                   FindExSearchNameMatch, NULL,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE) {
+      PDIE("opendir '%s'", name.c_str());
+    }
+    do {
+      if (wcscmp(data.cFileName, L".") == 0 ||
+          wcscmp(data.cFileName, L"..") == 0) {
+        continue;
+      }
+      DirEntry entry;
+      entry.name = data.cFileName;
+      entry.attributes = data.dwFileAttributes;
+      entry.reparse_tag = data.dwReserved0;
+      entries->push_back(entry);
+    } while (FindNextFileW(find, &data));
+    if (GetLastError() != ERROR_NO_MORE_FILES) {
+      PDIE("reading directory '%s'", name.c_str());
+    }
+    FindClose(find);
+  }
+
+  // Whether the entry 'entry' of the directory 'dir_path' is what 'node' asks
+  // for.
+  bool Matches(const std::wstring &dir_path, const std::wstring &entry_path,
+               const DirEntry &entry, const TreeNode &node) {
+    bool is_dir = (entry.attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    bool is_reparse = (entry.attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+    switch (node.type) {
+      case FILE_TYPE_DIRECTORY:
+        return is_dir && !is_reparse;
+      case FILE_TYPE_REGULAR:
+        return !is_dir && !is_reparse;
+      case FILE_TYPE_SYMLINK:
+        if (is_reparse) {
+          if (entry.reparse_tag != IO_REPARSE_TAG_SYMLINK &&
+              entry.reparse_tag != IO_REPARSE_TAG_MOUNT_POINT) {
+            return false;
+          }
+        } else if (is_dir) {
+          return false;
+        }
+        return LeadsTo(entry_path, TargetPath(dir_path, node.target),
+                       !is_reparse);
+    }
+    return false;
+  }
+
+  // Whether 'path' leads to the same file as 'target', or, if 'may_be_copy',
+  // is a file with the size and the time of the last write of 'target'.
+  static bool LeadsTo(const std::wstring &path, const std::wstring &target,
+                      bool may_be_copy) {
+    BY_HANDLE_FILE_INFORMATION info;
+    BY_HANDLE_FILE_INFORMATION target_info;
+    if (!GetInfo(path, &info) || !GetInfo(target, &target_info)) {
+      return false;
+    }
+    if (info.dwVolumeSerialNumber == target_info.dwVolumeSerialNumber &&
+        info.nFileIndexHigh == target_info.nFileIndexHigh &&
+        info.nFileIndexLow == target_info.nFileIndexLow) {
+      return true;
+    }
+    return may_be_copy &&
+           (target_info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 &&
+           info.nFileSizeHigh == target_info.nFileSizeHigh &&
+           info.nFileSizeLow == target_info.nFileSizeLow &&
+           CompareFileTime(&info.ftLastWriteTime,
+                           &target_info.ftLastWriteTime) == 0;
+  }
+
+  // Gets the information of the file 'path' leads to. Returns false if there
+  // is none.
+  static bool GetInfo(const std::wstring &path,
+                      BY_HANDLE_FILE_INFORMATION *info) {
+    HANDLE handle = CreateFileW(
+        LongPath(path).c_str(), FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    bool ok = GetFileInformationByHandle(handle, info) != 0;
+    CloseHandle(handle);
+    return ok;
+  }
+
+  // Returns the full path of the target 'target' of a symlink in the
+  // directory 'dir_path'.
+  static std::wstring TargetPath(const std::wstring &dir_path,
+                                 const std::string &target) {
+    std::wstring path = Widen(target);
+    return FullPath(IsAbsolute(path) ? path : dir_path + L"\\" + path);
+  }
+
+  void CreateEntry(const std::wstring &dir_path, const std::wstring &path,
+                   const std::string &name, const TreeNode *node) {
+    switch (node->type) {
+      case FILE_TYPE_DIRECTORY:
+        if (!CreateDirectoryW(LongPath(path).c_str(), NULL)) {
+          PDIE("mkdir '%s'", name.c_str());
+        }
+        break;
+      case FILE_TYPE_REGULAR:
+        {
+          HANDLE handle = CreateFileW(LongPath(path).c_str(), GENERIC_WRITE, 0,
+                                      NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL,
+                                      NULL);
+          if (handle == INVALID_HANDLE_VALUE) {
+            PDIE("creating empty file '%s'", name.c_str());
+          }
+          CloseHandle(handle);
+        }
+        break;
+      case FILE_TYPE_SYMLINK:
+        CreateLink(dir_path, path, name, node->target);
+        break;
+    }
+  }
+
+  // Creates 'path' as the symlink to 'target' of the manifest, see the top of
+  // the file.
+  void CreateLink(const std::wstring &dir_path, const std::wstring &path,
+                  const std::string &name, const std::string &target) {
+    const std::wstring target_path = TargetPath(dir_path, target);
+    DWORD attributes = GetFileAttributesW(LongPath(target_path).c_str());
+    bool is_dir = attributes != INVALID_FILE_ATTRIBUTES &&
+                  (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+    if (symlinks_allowed_) {
+      std::wstring link_target = Widen(target);
+      if (IsAbsolute(link_target)) {
+        link_target = target_path;
+      }
+      DWORD flags = is_dir ? SYMBOLIC_LINK_FLAG_DIRECTORY : 0;
+      if (CreateSymbolicLinkW(LongPath(path).c_str(), link_target.c_str(),
+                              flags | kSymbolicLinkAllowUnprivileged)) {
+        return;
+      }
+      // Windows before 10 does not know the flag.
+      if (GetLastError() == ERROR_INVALID_PARAMETER &&
+          CreateSymbolicLinkW(LongPath(path).c_str(), link_target.c_str(),
+                              flags)) {
+        return;
+      }
+      if (GetLastError() != ERROR_PRIVILEGE_NOT_HELD) {
+        PDIE("symlinking '%s' -> '%s'", name.c_str(), target.c_str());
+      }
+      // Not for this process: don't try again.
+      symlinks_allowed_ = false;
+    }
+
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+      DIE("symlinking '%s' -> '%s': the target does not exist, and this "
+          "process may not create symbolic links", name.c_str(),
+          target.c_str());
+    } else if (is_dir) {
+      if (!CreateJunction(path, target_path)) {
+        PDIE("creating junction '%s' -> '%s'", name.c_str(), target.c_str());
+      }
+    } else if (!CreateHardLinkW(LongPath(path).c_str(),
+                                LongPath(target_path).c_str(), NULL) &&
+               !CopyFileW(LongPath(target_path).c_str(),
+                          LongPath(path).c_str(), TRUE)) {
+      PDIE("copying '%s' to '%s'", target.c_str(), name.c_str());
+    }
+  }
+
+  // Creates the directory junction 'path' to the directory 'target', a full
+  // path. Returns false with the error for GetLastError() if that fails.
+  static bool CreateJunction(const std::wstring &path,
+                             const std::wstring &target) {
+    // The name the file system resolves, in the NT namespace, and the one
+    // tools show.
+    const std::wstring substitute_name =
+        target.compare(0, 2, L"\\\\") == 0 ? L"\\??\\UNC\\" + target.substr(2)
+                                           : L"\\??\\" + target;
+    const std::wstring &print_name = target;
+    size_t path_bytes =
+        (substitute_name.size() + 1 + print_name.size() + 1) * sizeof(WCHAR);
+    size_t size =
+        offsetof(MountPointReparseBuffer, path_buffer) + path_bytes;
+    if (size > MAXIMUM_REPARSE_DATA_BUFFER_SIZE) {
+      SetLastError(ERROR_FILENAME_EXCED_RANGE);
+      return false;
+    }
+    std::vector<char> buffer(size);
+    MountPointReparseBuffer *reparse =
+        reinterpret_cast<MountPointReparseBuffer *>(buffer.data());
+    reparse->reparse_tag = IO_REPARSE_TAG_MOUNT_POINT;
+    reparse->reparse_data_length = static_cast<USHORT>(
+        size - offsetof(MountPointReparseBuffer, substitute_name_offset));
+    reparse->substitute_name_offset = 0;
+    reparse->substitute_name_length =
+        static_cast<USHORT>(substitute_name.size() * sizeof(WCHAR));
+    reparse->print_name_offset =
+        static_cast<USHORT>((substitute_name.size() + 1) * sizeof(WCHAR));
+    reparse->print_name_length =
+        static_cast<USHORT>(print_name.size() * sizeof(WCHAR));
+    memcpy(reparse->path_buffer, substitute_name.c_str(),
+           (substitute_name.size() + 1) * sizeof(WCHAR));
+    memcpy(reparse->path_buffer + substitute_name.size() + 1,
+           print_name.c_str(), (print_name.size() + 1) * sizeof(WCHAR));
+
+    if (!CreateDirectoryW(LongPath(path).c_str(), NULL)) {
+      return false;
+    }
+    HANDLE handle = CreateFileW(
+        LongPath(path).c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+        FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    DWORD bytes;
+    if (handle == INVALID_HANDLE_VALUE ||
+        !DeviceIoControl(handle, FSCTL_SET_REPARSE_POINT, buffer.data(),
+                         buffer.size(), NULL, 0, &bytes, NULL)) {
+      DWORD error = GetLastError();
+      if (handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(handle);
+      }
+      RemoveDirectoryW(LongPath(path).c_str());
+      SetLastError(error);
+      return false;
+    }
+    CloseHandle(handle);
+    return true;
+  }
+
+  // Deletes the entry 'entry' at 'path', with everything below it if it is a
+  // directory. A symbolic link or a junction is deleted itself, not what it
+  // leads to.
+  void Delete(const std::wstring &path, const std::string &name,
+              const DirEntry &entry) {
+    if ((entry.attributes & FILE_ATTRIBUTE_DIRECTORY) != 0 &&
+        (entry.attributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0) {
+      std::vector<DirEntry> entries;
+      ReadDirectory(path, name, &entries);
+      for (size_t i = 0; i < entries.size(); ++i) {
+        Delete(path + L"\\" + entries[i].name,
+               name + "/" + Narrow(entries[i].name), entries[i]);
+      }
+    }
+
+    HANDLE handle = CreateFileW(
+        LongPath(path).c_str(),
+        DELETE | FILE_READ_ATTRIBUTES | FILE_WRITE_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING,
+        FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+      PDIE("opening '%s' to delete it", name.c_str());
+    }
+    // The name goes away at once, even if another process has the file open,
+    // so that it can be created again right away; and read-only files, like
+    // hard links of outputs, need not be made writable first.
+    FileDispositionInformationEx disposition_ex = {
+        kDispositionDelete | kDispositionPosixSemantics |
+        kDispositionIgnoreReadonly};
+    if (!SetFileInformationByHandle(handle, kFileDispositionInfoEx,
+                                    &disposition_ex, sizeof(disposition_ex))) {
+      // Before Windows 10 1809, or not on NTFS.
+      FILE_BASIC_INFO basic;
+      if (!GetFileInformationByHandleEx(handle, FileBasicInfo, &basic,
+                                        sizeof(basic))) {
+        PDIE("deleting '%s'", name.c_str());
+      }
+      DWORD attributes = basic.FileAttributes;
+      if ((attributes & FILE_ATTRIBUTE_READONLY) != 0) {
+        basic.FileAttributes &= ~FILE_ATTRIBUTE_READONLY;
+        if (basic.FileAttributes == 0) {
+          basic.FileAttributes = FILE_ATTRIBUTE_NORMAL;
+        }
+        if (!SetFileInformationByHandle(handle, FileBasicInfo, &basic,
+                                        sizeof(basic))) {
+          PDIE("deleting '%s'", name.c_str());
+        }
+      }
+      FILE_DISPOSITION_INFO disposition = {TRUE};
+      if (!SetFileInformationByHandle(handle, FileDispositionInfo,
+                                      &disposition, sizeof(disposition))) {
+        PDIE("deleting '%s'", name.c_str());
+      }
+      if ((attributes & FILE_ATTRIBUTE_READONLY) != 0) {
+        // For the other hard links of the file.
+        basic.FileAttributes = attributes;
+        SetFileInformationByHandle(handle, FileBasicInfo, &basic,
+                                   sizeof(basic));
+      }
+    }
+    CloseHandle(handle);
+  }
+
+  std::string output_base_;
+  std::wstring root_path_;
+  std::wstring manifest_path_;
+  std::wstring temp_name_;
+  std::wstring temp_path_;
+
+  TreeNode root_;
+  // Whether this process may create symbolic links, as far as we know.
+  bool symlinks_allowed_;
+};
+
+int main(int argc, char **argv) {
+  argv0 = argv[0];
+  BlazeTraceInit("build-runfiles", NULL);
+
+  argc--; argv++;
+  bool allow_relative = false;
+  bool use_metadata = false;
+
+  while (argc >= 1) {
+    if (strcmp(argv[0], "--allow_relative") == 0) {
+      allow_relative = true;
+      argc--; argv++;
+    } else if (strcmp(argv[0], "--use_metadata") == 0) {
+      use_metadata = true;
+      argc--; argv++;
+    } else {
+      break;
+    }
+  }
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s "
+            "[--allow_relative] [--use_metadata] "
+            "INPUT RUNFILES\n",
+            argv0);
+    return 1;
+  }
+
+  input_filename = argv[0];
+  output_base_dir = argv[1];
+
+  RunfilesCreator runfiles_creator(output_base_dir);
+  {
+    blaze_util::TraceSpan span("read manifest", input_filename);
+    runfiles_creator.ReadManifest(input_filename, allow_relative,
+                                  use_metadata);
+  }
+  blaze_util::TraceSpan span("create runfiles", output_base_dir);
+  runfiles_creator.CreateRunfiles();
+
+  return 0;
+}
@@ -40,6 +40,17 @@
 // All output paths must be relative and generally (but not always) begin with
 // <workspace root>. No output path may be equal to another.  No output path may
 // be a path prefix of another.
+//
+// If --index_only is supplied, no tree is created: RUNFILES is left with just
+// the MANIFEST and a binary index of it, RUNFILES/MANIFEST.index, meant to be
+// mapped into memory and binary searched, which costs the same for any number
+// of runfiles. It consists of, with all integers 32-bit little-endian:
+//   the magic "RFINDEX1"
+//   the number of entries, N
+//   N offsets from the start of the file of the entries, sorted by path
+//   N entries, each a type byte ('d'irectory, 'f'ile or 's'ymlink), the path,
+//     a NUL, the target ("" but for symlinks) and a NUL
+// The directories the paths of the manifest are in are entries, too.
 
 #define _FILE_OFFSET_BITS 64
 
@@ -47,14 +58,26 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#include <map>
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "src/main/cpp/util/trace_events.h"
 
 // program_invocation_short_name is not portable.
 static const char *argv0;
@@ -101,14 +124,221 @@ struct FileInfo {
   }
 };
 
-typedef std::map<std::string, FileInfo> FileInfoMap;
+// Hands out NUL-terminated copies of strings from large blocks, which all go
+// away with it.
+class Arena {
+ public:
+  Arena() : next_(NULL), left_(0) {}
+
+  const char *Copy(const char *s, size_t length) {
+    if (length + 1 > left_) {
+      size_t size = length + 1 > kBlockSize ? length + 1 : kBlockSize;
+      blocks_.push_back(std::unique_ptr<char[]>(new char[size]));
+      next_ = blocks_.back().get();
+      left_ = size;
+    }
+    char *copy = next_;
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+    next_ += length + 1;
+    left_ -= length + 1;
+    return copy;
+  }
+
+  void Clear() {
+    blocks_.clear();
+    next_ = NULL;
+    left_ = 0;
+  }
+
+ private:
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  static const size_t kBlockSize = 1 << 20;
+
+  std::vector<std::unique_ptr<char[]> > blocks_;
+  char *next_;
+  size_t left_;
+};
+
+// The entries of a manifest and the directories they are in, sorted by path
+// the way std::string compares, so that a directory comes before the paths
+// below it. The paths and the targets are in an arena.
+class Manifest {
+ public:
+  struct Entry {
+    const char *path;
+    size_t length;
+    FileType type;
+    // The target of a symlink, "" otherwise.
+    const char *target;
+
+    bool operator==(const Entry &other) const {
+      return length == other.length && type == other.type &&
+             memcmp(path, other.path, length) == 0 &&
+             strcmp(target, other.target) == 0;
+    }
+
+    bool operator!=(const Entry &other) const {
+      return !(*this == other);
+    }
+  };
+
+  // Adds the path 'length' bytes long at 'path', a symlink to 'target', or an
+  // empty file if that is "". Of the entries with the same path, the last one
+  // counts.
+  void Add(const char *path, size_t length, const char *target) {
+    Entry entry;
+    entry.path = arena_.Copy(path, length);
+    entry.length = length;
+    if (target[0] == '\0') {
+      // No target means an empty file.
+      entry.type = FILE_TYPE_REGULAR;
+      entry.target = "";
+    } else {
+      entry.type = FILE_TYPE_SYMLINK;
+      entry.target = arena_.Copy(target, strlen(target));
+    }
+    entries_.push_back(entry);
+  }
+
+  // Sorts the entries added and adds the directories they are in. Returns
+  // false with the reason in 'error' if a path is below one that is not a
+  // directory.
+  bool Finish(std::string *error) {
+    // Manifests are usually sorted already.
+    if (!std::is_sorted(entries_.begin(), entries_.end(), Less)) {
+      std::stable_sort(entries_.begin(), entries_.end(), Less);
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      if (i + 1 == entries_.size() || Less(entries_[i], entries_[i + 1])) {
+        entries_[kept++] = entries_[i];
+      }
+    }
+    entries_.resize(kept);
+
+    // All paths below a directory are next to each other, so the directories
+    // of a path that the path before is not below are new.
+    std::vector<Entry> dirs;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      const Entry &entry = entries_[i];
+      size_t first = dirs.size();
+      size_t k = entry.length;
+      while (true) {
+        while (k > 0 && entry.path[k - 1] != '/') --k;
+        if (k == 0) break;
+        size_t dir_length = k - 1;
+        if (i > 0 && IsBelow(entries_[i - 1], entry.path, dir_length)) break;
+        Entry dir;
+        dir.path = arena_.Copy(entry.path, dir_length);
+        dir.length = dir_length;
+        dir.type = FILE_TYPE_DIRECTORY;
+        dir.target = "";
+        dirs.push_back(dir);
+        k = dir_length;
+      }
+      std::reverse(dirs.begin() + first, dirs.end());
+    }
+    // Only out of order where "a/b-c/d" sorts before "a/b/e".
+    if (!std::is_sorted(dirs.begin(), dirs.end(), Less)) {
+      std::sort(dirs.begin(), dirs.end(), Less);
+    }
+
+    std::vector<Entry> merged;
+    merged.reserve(entries_.size() + dirs.size());
+    size_t d = 0;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      while (d < dirs.size() && Less(dirs[d], entries_[i])) {
+        merged.push_back(dirs[d++]);
+      }
+      if (d < dirs.size() && !Less(entries_[i], dirs[d])) {
+        *error = std::string("'") + entries_[i].path +
+                 "' is not a directory, but there are paths below it";
+        return false;
+      }
+      merged.push_back(entries_[i]);
+    }
+    merged.insert(merged.end(), dirs.begin() + d, dirs.end());
+    entries_.swap(merged);
+    return true;
+  }
+
+  const std::vector<Entry> &entries() const { return entries_; }
+
+  void Clear() {
+    entries_.clear();
+    arena_.Clear();
+  }
+
+  static bool Less(const Entry &a, const Entry &b) {
+    int order = memcmp(a.path, b.path, std::min(a.length, b.length));
+    return order < 0 || (order == 0 && a.length < b.length);
+  }
+
+ private:
+  // Whether 'entry' is below the directory 'length' bytes long at 'dir'.
+  static bool IsBelow(const Entry &entry, const char *dir, size_t length) {
+    return entry.length > length && entry.path[length] == '/' &&
+           memcmp(entry.path, dir, length) == 0;
+  }
+
+  Arena arena_;
+  std::vector<Entry> entries_;
+};
+
+// An entry of the runfiles tree, with the entries below it if it is a
+// directory.
+struct TreeNode {
+  FileInfo info;
+  // Whether the entry is on disk already, as the scan of the directory it is
+  // in found.
+  bool exists;
+  std::unordered_map<std::string, std::unique_ptr<TreeNode> > children;
+
+  TreeNode() : exists(false) {}
+};
+
+// An open directory. The tasks for the directories in it share it until they
+// opened theirs.
+class DirFd {
+ public:
+  explicit DirFd(int fd) : fd_(fd) {}
+  ~DirFd() { close(fd_); }
+  int fd() const { return fd_; }
+
+ private:
+  DirFd(const DirFd &) = delete;
+  DirFd &operator=(const DirFd &) = delete;
+
+  int fd_;
+};
+
+// A directory of the runfiles tree to bring in line with the manifest.
+struct DirTask {
+  // The directory it is in, or null for the root of the runfiles tree.
+  std::shared_ptr<DirFd> parent;
+  std::string name;
+  // The path relative to the runfiles tree, "." for its root.
+  std::string path;
+  TreeNode *node;
+};
+
+// The most threads to work on the runfiles tree with.
+static const unsigned kMaxThreads = 16;
+
+// The trash of a run is this followed by its pid, see OpenTrash().
+static const char kTrashPrefix[] = ".build-runfiles-trash.";
 
 class RunfilesCreator {
  public:
   explicit RunfilesCreator(const std::string &output_base)
       : output_base_(output_base),
         output_filename_("MANIFEST"),
-        temp_filename_(output_filename_ + ".tmp") {
+        temp_filename_(output_filename_ + ".tmp"),
+        index_filename_(output_filename_ + ".index"),
+        index_temp_filename_(index_filename_ + ".tmp") {
     SetupOutputBase();
     if (chdir(output_base_.c_str()) != 0) {
       PDIE("chdir '%s'", output_base_.c_str());
@@ -116,7 +346,12 @@ class RunfilesCreator {
   }
 
   void ReadManifest(const std::string &manifest_file, bool allow_relative,
-                    bool use_metadata) {
+                    bool use_metadata, bool index_only) {
+    index_only_ = index_only;
+    // Before writing the new manifest changes the directory.
+    have_previous_manifest_ =
+        ReadPreviousManifest(allow_relative, use_metadata);
+
     FILE *outfile = fopen(temp_filename_.c_str(), "w");
     if (!outfile) {
       PDIE("opening '%s/%s' for writing", output_base_.c_str(),
@@ -127,12 +362,94 @@ class RunfilesCreator {
       PDIE("opening '%s' for reading", manifest_file.c_str());
     }
 
-    // read input manifest
+    std::string error;
+    if (!ParseManifest(infile, outfile, allow_relative, use_metadata,
+                       &manifest_, &error)) {
+      DIE("%s", error.c_str());
+    }
+    if (fclose(outfile) != 0) {
+      PDIE("writing to '%s/%s'", output_base_.c_str(),
+           temp_filename_.c_str());
+    }
+    fclose(infile);
+
+    if (index_only_) {
+      if (!manifest_.Finish(&error)) {
+        DIE("%s", error.c_str());
+      }
+      WriteIndex();
+      // The tree is just the index.
+      manifest_.Clear();
+      manifest_.Add(index_temp_filename_.data(), index_temp_filename_.size(),
+                    "");
+    }
+    // Don't delete the temp manifest file.
+    manifest_.Add(temp_filename_.data(), temp_filename_.size(), "");
+    if (!manifest_.Finish(&error)) {
+      DIE("%s", error.c_str());
+    }
+  }
+
+  void CreateRunfiles() {
+    // Without the manifest, the next run cannot trust the tree until it is
+    // renamed into place again.
+    if (unlink(output_filename_.c_str()) != 0 && errno != ENOENT) {
+      PDIE("removing previous file at '%s/%s'", output_base_.c_str(),
+           output_filename_.c_str());
+    }
+    SweepStaleTrash();
+
+    if (have_previous_manifest_) {
+      blaze_util::TraceSpan span("apply manifest diff");
+      ApplyManifestDiff();
+    } else {
+      TreeNode root;
+      root.info.type = FILE_TYPE_DIRECTORY;
+      root.exists = true;
+      {
+        blaze_util::TraceSpan span("build tree");
+        BuildTree(&root);
+      }
+      blaze_util::TraceSpan span("process tree");
+      DirTask task;
+      task.name = ".";
+      task.path = ".";
+      task.node = &root;
+      ProcessTree(task);
+    }
+    {
+      blaze_util::TraceSpan span("remove trash");
+      RemoveTrash();
+    }
+
+    if (index_only_ &&
+        rename(index_temp_filename_.c_str(), index_filename_.c_str()) != 0) {
+      PDIE("renaming '%s/%s' to '%s/%s'",
+           output_base_.c_str(), index_temp_filename_.c_str(),
+           output_base_.c_str(), index_filename_.c_str());
+    }
+
+    // rename output file into place
+    if (rename(temp_filename_.c_str(), output_filename_.c_str()) != 0) {
+      PDIE("renaming '%s/%s' to '%s/%s'",
+           output_base_.c_str(), temp_filename_.c_str(),
+           output_base_.c_str(), output_filename_.c_str());
+    }
+  }
+
+ private:
+  // Adds the entries of the manifest 'infile' to 'manifest', copying it to
+  // 'outfile' unless that is null. Returns false with the reason in 'error' if
+  // the manifest is malformed.
+  bool ParseManifest(FILE *infile, FILE *outfile, bool allow_relative,
+                     bool use_metadata, Manifest *manifest,
+                     std::string *error) {
     int lineno = 0;
     char buf[3 * PATH_MAX];
+    char message[sizeof(buf) + 100];
     while (fgets(buf, sizeof buf, infile)) {
       // copy line to output manifest
-      if (fputs(buf, outfile) == EOF) {
+      if (outfile != NULL && fputs(buf, outfile) == EOF) {
         PDIE("writing to '%s/%s'", output_base_.c_str(),
              temp_filename_.c_str());
       }
@@ -145,73 +462,227 @@ class RunfilesCreator {
 
       int n = strlen(buf)-1;
       if (!n || buf[n] != '\n') {
-        DIE("missing terminator at line %d: '%s'\n", lineno, buf);
+        snprintf(message, sizeof(message),
+                 "missing terminator at line %d: '%s'\n", lineno, buf);
+        error->assign(message);
+        return false;
       }
       buf[n] = '\0';
       if (buf[0] ==  '/') {
-        DIE("paths must not be absolute: line %d: '%s'\n", lineno, buf);
+        snprintf(message, sizeof(message),
+                 "paths must not be absolute: line %d: '%s'\n", lineno, buf);
+        error->assign(message);
+        return false;
       }
       const char *s = strchr(buf, ' ');
       if (!s) {
-        DIE("missing field delimiter at line %d: '%s'\n", lineno, buf);
+        snprintf(message, sizeof(message),
+                 "missing field delimiter at line %d: '%s'\n", lineno, buf);
+        error->assign(message);
+        return false;
       } else if (strchr(s+1, ' ')) {
-        DIE("link or target filename contains space on line %d: '%s'\n",
-            lineno, buf);
+        snprintf(message, sizeof(message),
+                 "link or target filename contains space on line %d: '%s'\n",
+                 lineno, buf);
+        error->assign(message);
+        return false;
       }
-      std::string link(buf, s-buf);
       const char *target = s+1;
       if (!allow_relative && target[0] != '\0' && target[0] != '/'
           && target[1] != ':') {  // Match Windows paths, e.g. C:\foo or C:/foo.
-        DIE("expected absolute path at line %d: '%s'\n", lineno, buf);
+        snprintf(message, sizeof(message),
+                 "expected absolute path at line %d: '%s'\n", lineno, buf);
+        error->assign(message);
+        return false;
       }
 
-      FileInfo *info = &manifest_[link];
-      if (target[0] == '\0') {
-        // No target means an empty file.
-        info->type = FILE_TYPE_REGULAR;
-      } else {
-        info->type = FILE_TYPE_SYMLINK;
-        info->symlink_target = target;
-      }
+      manifest->Add(buf, s - buf, target);
+    }
+    return true;
+  }
 
-      FileInfo parent_info;
-      parent_info.type = FILE_TYPE_DIRECTORY;
+  // Reads the manifest the last run renamed into place into
+  // previous_manifest_, if the tree is still the way that run left it, so
+  // that only the differences to the new manifest need to touch the disk.
+  // Every directory of the tree must not have changed since the manifest was
+  // renamed: an entry created, deleted or renamed in it, or a chmod of it,
+  // would have set its ctime. Otherwise only a full scan can tell what is on
+  // disk.
+  bool ReadPreviousManifest(bool allow_relative, bool use_metadata) {
+#if defined(__CYGWIN__)
+    // Deleting does not always work there, see ScanAndPrune().
+    return false;
+#else
+    struct stat manifest_st;
+    if (lstat(output_filename_.c_str(), &manifest_st) != 0 ||
+        !S_ISREG(manifest_st.st_mode)) {
+      return false;
+    }
+    // The manifest is that of the index, not of a tree.
+    struct stat index_st;
+    if (lstat(index_filename_.c_str(), &index_st) == 0) {
+      return false;
+    }
+    FILE *infile = fopen(output_filename_.c_str(), "r");
+    if (!infile) {
+      return false;
+    }
+    std::string error;
+    bool parsed = ParseManifest(infile, NULL, allow_relative, use_metadata,
+                                &previous_manifest_, &error);
+    fclose(infile);
+    // The new manifest, and index, which are there already.
+    previous_manifest_.Add(temp_filename_.data(), temp_filename_.size(), "");
+    if (index_only_) {
+      previous_manifest_.Add(index_temp_filename_.data(),
+                             index_temp_filename_.size(), "");
+    }
+    if (!parsed || !previous_manifest_.Finish(&error)) {
+      previous_manifest_.Clear();
+      return false;
+    }
 
-      while (true) {
-        int k = link.rfind('/');
-        if (k < 0) break;
-        link.erase(k, std::string::npos);
-        if (!manifest_.insert(std::make_pair(link, parent_info)).second) break;
+    // The renaming set the ctime of the manifest and of the root of the tree
+    // at once; nothing that happened within the same tick of the clock can be
+    // told apart.
+    const struct timespec renamed = ChangeTime(manifest_st);
+    std::vector<const char *> dirs;
+    dirs.push_back(".");
+    const std::vector<Manifest::Entry> &entries = previous_manifest_.entries();
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].type == FILE_TYPE_DIRECTORY) {
+        dirs.push_back(entries[i].path);
       }
     }
-    if (fclose(outfile) != 0) {
-      PDIE("writing to '%s/%s'", output_base_.c_str(),
-           temp_filename_.c_str());
+    for (size_t i = 0; i < dirs.size(); ++i) {
+      struct stat st;
+      if (lstat(dirs[i], &st) != 0 || !S_ISDIR(st.st_mode) ||
+          (st.st_mode & 0700) != 0700 || IsLater(ChangeTime(st), renamed)) {
+        previous_manifest_.Clear();
+        return false;
+      }
     }
-    fclose(infile);
+    return true;
+#endif
+  }
 
-    // Don't delete the temp manifest file.
-    manifest_[temp_filename_].type = FILE_TYPE_REGULAR;
+  static struct timespec ChangeTime(const struct stat &st) {
+#if defined(__APPLE__)
+    return st.st_ctimespec;
+#else
+    return st.st_ctim;
+#endif
   }
 
-  void CreateRunfiles() {
-    if (unlink(output_filename_.c_str()) != 0 && errno != ENOENT) {
-      PDIE("removing previous file at '%s/%s'", output_base_.c_str(),
-           output_filename_.c_str());
+  static bool IsLater(const struct timespec &a, const struct timespec &b) {
+    return a.tv_sec > b.tv_sec ||
+           (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+  }
+
+  // Brings the tree in line with the manifest by deleting and creating only
+  // the entries that differ from previous_manifest_. Both are sorted, and a
+  // directory sorts before the paths below it.
+  void ApplyManifestDiff() {
+    // The directories deleted with everything below them.
+    std::unordered_set<std::string> deleted_dirs;
+    const std::vector<Manifest::Entry> &old_entries =
+        previous_manifest_.entries();
+    const std::vector<Manifest::Entry> &new_entries = manifest_.entries();
+    size_t old_i = 0;
+    size_t new_i = 0;
+    while (old_i < old_entries.size() || new_i < new_entries.size()) {
+      int order;
+      if (old_i == old_entries.size()) {
+        order = 1;
+      } else if (new_i == new_entries.size()) {
+        order = -1;
+      } else if (Manifest::Less(old_entries[old_i], new_entries[new_i])) {
+        order = -1;
+      } else if (Manifest::Less(new_entries[new_i], old_entries[old_i])) {
+        order = 1;
+      } else {
+        order = 0;
+      }
+      if (order == 0 && old_entries[old_i] == new_entries[new_i]) {
+        ++old_i;
+        ++new_i;
+        continue;
+      }
+
+      if (order <= 0) {
+        // Gone, or not the same any more.
+        const Manifest::Entry &entry = old_entries[old_i];
+        const std::string path(entry.path, entry.length);
+        size_t slash = path.rfind('/');
+        if (slash == std::string::npos ||
+            deleted_dirs.count(path.substr(0, slash)) == 0) {
+          Delete(AT_FDCWD, entry.path, path, entry.type);
+        }
+        if (entry.type == FILE_TYPE_DIRECTORY) {
+          deleted_dirs.insert(path);
+        }
+        ++old_i;
+      }
+      if (order >= 0) {
+        // New, or not the same any more.
+        const Manifest::Entry &entry = new_entries[new_i];
+        CreateEntry(AT_FDCWD, entry.path, entry.path, entry.type,
+                    entry.target);
+        ++new_i;
+      }
+    }
+    if (!trash_tasks_.empty()) {
+      RunWorkers();
     }
+  }
 
-    ScanTreeAndPrune(".");
-    CreateFiles();
+  // Writes the index of manifest_ to index_temp_filename_, see the top of the
+  // file.
+  void WriteIndex() {
+    const std::vector<Manifest::Entry> &entries = manifest_.entries();
+    uint64_t offset = 8 + 4 + 4 * static_cast<uint64_t>(entries.size());
+    std::vector<uint32_t> offsets;
+    offsets.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (offset > UINT32_MAX) {
+        DIE("manifest too large for an index");
+      }
+      offsets.push_back(static_cast<uint32_t>(offset));
+      offset += 1 + entries[i].length + 1 + strlen(entries[i].target) + 1;
+    }
 
-    // rename output file into place
-    if (rename(temp_filename_.c_str(), output_filename_.c_str()) != 0) {
-      PDIE("renaming '%s/%s' to '%s/%s'",
-           output_base_.c_str(), temp_filename_.c_str(),
-           output_base_.c_str(), output_filename_.c_str());
+    FILE *outfile = fopen(index_temp_filename_.c_str(), "w");
+    if (!outfile) {
+      PDIE("opening '%s/%s' for writing", output_base_.c_str(),
+           index_temp_filename_.c_str());
+    }
+    fputs("RFINDEX1", outfile);
+    PutUint32(outfile, entries.size());
+    for (size_t i = 0; i < offsets.size(); ++i) {
+      PutUint32(outfile, offsets[i]);
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const Manifest::Entry &entry = entries[i];
+      switch (entry.type) {
+        case FILE_TYPE_DIRECTORY: fputc('d', outfile); break;
+        case FILE_TYPE_REGULAR: fputc('f', outfile); break;
+        case FILE_TYPE_SYMLINK: fputc('s', outfile); break;
+      }
+      fwrite(entry.path, 1, entry.length + 1, outfile);
+      fwrite(entry.target, 1, strlen(entry.target) + 1, outfile);
+    }
+    if (ferror(outfile) || fclose(outfile) != 0) {
+      PDIE("writing to '%s/%s'", output_base_.c_str(),
+           index_temp_filename_.c_str());
+    }
+  }
+
+  static void PutUint32(FILE *outfile, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      fputc((value >> (8 * i)) & 0xff, outfile);
     }
   }
 
- private:
   void SetupOutputBase() {
     struct stat st;
     if (stat(output_base_.c_str(), &st) != 0) {
@@ -221,54 +692,188 @@ class RunfilesCreator {
         PDIE("creating directory '%s'", output_base_.c_str());
       }
     } else {
-      EnsureDirReadAndWritePerms(output_base_);
+      EnsureDirReadAndWritePerms(AT_FDCWD, output_base_, output_base_);
     }
   }
 
-  void ScanTreeAndPrune(const std::string &path) {
+  // Turns the manifest into a tree of the entries of each directory.
+  void BuildTree(TreeNode *root) {
+    std::unordered_map<std::string, TreeNode *> dirs;
+    dirs[""] = root;
+    // A directory sorts before the paths below it.
+    const std::vector<Manifest::Entry> &entries = manifest_.entries();
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const std::string path(entries[i].path, entries[i].length);
+      size_t slash = path.rfind('/');
+      std::string parent =
+          slash == std::string::npos ? "" : path.substr(0, slash);
+      std::unordered_map<std::string, TreeNode *>::iterator parent_it =
+          dirs.find(parent);
+      if (parent_it == dirs.end()) {
+        DIE("'%s' is below '%s', which is not a directory", path.c_str(),
+            parent.c_str());
+      }
+      TreeNode *node = new TreeNode();
+      node->info.type = entries[i].type;
+      node->info.symlink_target = entries[i].target;
+      parent_it->second->children[path.substr(slash + 1)].reset(node);
+      if (node->info.type == FILE_TYPE_DIRECTORY) {
+        dirs[path] = node;
+      }
+    }
+  }
+
+  // Brings the tree below the directory of 'root' in line with the manifest,
+  // a directory at a time: each is scanned, pruned and completed against its
+  // own file descriptor, and the directories in it are left to the next free
+  // one of the threads.
+  void ProcessTree(const DirTask &root) {
+    Submit(root);
+    RunWorkers();
+  }
+
+  // Runs the tasks submitted, and those they submit, on the threads.
+  void RunWorkers() {
+    // Every thread may keep a few directories open, and the directories with
+    // subdirectories waiting for a thread stay open.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+        limit.rlim_cur < limit.rlim_max) {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    unsigned threads =
+        std::max(1u, std::min(std::thread::hardware_concurrency(),
+                              kMaxThreads));
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; ++i) {
+      workers.push_back(std::thread(&RunfilesCreator::Work, this));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+      workers[i].join();
+    }
+  }
+
+  void Submit(const DirTask &task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(task);
+    ++pending_tasks_;
+    task_or_done_.notify_one();
+  }
+
+  // Runs the tasks until there are none left and none running, which could
+  // add more. The last one to come is the first one to run, so that the
+  // directories with subdirectories still to do, which stay open, are few.
+  // The trash is only deleted when there is nothing to do for the tree.
+  void Work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      while (tasks_.empty() && trash_tasks_.empty() && pending_tasks_ > 0) {
+        task_or_done_.wait(lock);
+      }
+      if (!tasks_.empty()) {
+        DirTask task = tasks_.back();
+        tasks_.pop_back();
+        lock.unlock();
+        ProcessDirectory(&task);
+        task.parent.reset();
+      } else if (!trash_tasks_.empty()) {
+        std::string name = trash_tasks_.back();
+        trash_tasks_.pop_back();
+        lock.unlock();
+        DeleteTrash(name);
+      } else {
+        return;
+      }
+      lock.lock();
+      if (--pending_tasks_ == 0) {
+        task_or_done_.notify_all();
+      }
+    }
+  }
+
+  void ProcessDirectory(DirTask *task) {
+    TreeNode *node = task->node;
+    int parent_fd = task->parent ? task->parent->fd() : AT_FDCWD;
+    if (node->exists) {
+      EnsureDirReadAndWritePerms(parent_fd, task->name, task->path);
+    }
+    int fd = openat(parent_fd, task->name.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+      PDIE("opendir '%s'", task->path.c_str());
+    }
+    task->parent.reset();
+    std::shared_ptr<DirFd> dir(new DirFd(fd));
+
+    const std::string prefix = (task->path == "." ? "" : task->path + "/");
+    if (node->exists) {
+      ScanAndPrune(fd, prefix, task->path, node);
+    }
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      TreeNode *child = it->second.get();
+      const std::string child_path = prefix + it->first;
+      if (!child->exists) {
+        CreateEntry(fd, it->first.c_str(), child_path.c_str(),
+                    child->info.type, child->info.symlink_target.c_str());
+      }
+      if (child->info.type == FILE_TYPE_DIRECTORY) {
+        DirTask child_task;
+        child_task.parent = dir;
+        child_task.name = it->first;
+        child_task.path = child_path;
+        child_task.node = child;
+        Submit(child_task);
+      }
+    }
+  }
+
+  // Deletes the entries of the directory 'dir_fd' that are not in 'node' or
+  // differ from it, and marks those of 'node' that are there.
+  void ScanAndPrune(int dir_fd, const std::string &prefix,
+                    const std::string &path, TreeNode *node) {
     // A note on non-empty files:
     // We don't distinguish between empty and non-empty files. That is, if
     // there's a file that has contents, we don't truncate it here, even though
     // the manifest supports creation of empty files, only. Given that
     // .runfiles are *supposed* to be immutable, this shouldn't be a problem.
-    EnsureDirReadAndWritePerms(path);
-
-    struct dirent *entry;
-    DIR *dh = opendir(path.c_str());
+    int scan_fd = dup(dir_fd);
+    DIR *dh = scan_fd < 0 ? NULL : fdopendir(scan_fd);
     if (!dh) {
       PDIE("opendir '%s'", path.c_str());
     }
 
+    struct dirent *entry;
     errno = 0;
-    const std::string prefix = (path == "." ? "" : path + "/");
     while ((entry = readdir(dh)) != NULL) {
       if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
 
       std::string entry_path = prefix + entry->d_name;
       FileInfo actual_info;
-      actual_info.type = DentryToFileType(entry_path, entry->d_type);
+      actual_info.type =
+          DentryToFileType(dir_fd, entry->d_name, entry_path, entry->d_type);
 
       if (actual_info.type == FILE_TYPE_SYMLINK) {
-        ReadLinkOrDie(entry_path, &actual_info.symlink_target);
+        ReadLinkOrDie(dir_fd, entry->d_name, entry_path,
+                      &actual_info.symlink_target);
       }
 
-      FileInfoMap::iterator expected_it = manifest_.find(entry_path);
-      if (expected_it == manifest_.end() ||
-          expected_it->second != actual_info) {
+      auto expected_it = node->children.find(entry->d_name);
+      if (expected_it == node->children.end() ||
+          expected_it->second->info != actual_info) {
 #if !defined(__CYGWIN__)
-        DelTree(entry_path, actual_info.type);
+        Delete(dir_fd, entry->d_name, entry_path, actual_info.type);
 #else
         // On Windows, if deleting failed, lamely assume that
         // the link points to the right place.
-        if (!DelTree(entry_path, actual_info.type)) {
-          manifest_.erase(expected_it);
+        if (!DelTree(dir_fd, entry->d_name, entry_path, actual_info.type) &&
+            expected_it != node->children.end()) {
+          expected_it->second->exists = true;
         }
 #endif
       } else {
-        manifest_.erase(expected_it);
-        if (actual_info.type == FILE_TYPE_DIRECTORY) {
-          ScanTreeAndPrune(entry_path);
-        }
+        expected_it->second->exists = true;
       }
 
       errno = 0;
@@ -279,41 +884,37 @@ class RunfilesCreator {
     closedir(dh);
   }
 
-  void CreateFiles() {
-    for (FileInfoMap::const_iterator it = manifest_.begin();
-         it != manifest_.end(); ++it) {
-      const std::string &path = it->first;
-      switch (it->second.type) {
-        case FILE_TYPE_DIRECTORY:
-          if (mkdir(path.c_str(), 0777) != 0) {
-            PDIE("mkdir '%s'", path.c_str());
-          }
-          break;
-        case FILE_TYPE_REGULAR:
-          {
-            int fd = open(path.c_str(), O_CREAT|O_EXCL|O_WRONLY, 0555);
-            if (fd < 0) {
-              PDIE("creating empty file '%s'", path.c_str());
-            }
-            close(fd);
-          }
-          break;
-        case FILE_TYPE_SYMLINK:
-          {
-            const std::string& target = it->second.symlink_target;
-            if (symlink(target.c_str(), path.c_str()) != 0) {
-              PDIE("symlinking '%s' -> '%s'", path.c_str(), target.c_str());
-            }
+  void CreateEntry(int dir_fd, const char *name, const char *path,
+                   FileType type, const char *target) {
+    switch (type) {
+      case FILE_TYPE_DIRECTORY:
+        if (mkdirat(dir_fd, name, 0777) != 0) {
+          PDIE("mkdir '%s'", path);
+        }
+        break;
+      case FILE_TYPE_REGULAR:
+        {
+          int fd = openat(dir_fd, name,
+                          O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0555);
+          if (fd < 0) {
+            PDIE("creating empty file '%s'", path);
           }
-          break;
-      }
+          close(fd);
+        }
+        break;
+      case FILE_TYPE_SYMLINK:
+        if (symlinkat(target, dir_fd, name) != 0) {
+          PDIE("symlinking '%s' -> '%s'", path, target);
+        }
+        break;
     }
   }
 
-  FileType DentryToFileType(const std::string &path, char d_type) {
+  FileType DentryToFileType(int dir_fd, const char *name,
+                            const std::string &path, char d_type) {
     if (d_type == DT_UNKNOWN) {
       struct stat st;
-      LStatOrDie(path, &st);
+      LStatOrDie(dir_fd, name, path, &st);
       if (S_ISDIR(st.st_mode)) {
         return FILE_TYPE_DIRECTORY;
       } else if (S_ISLNK(st.st_mode)) {
@@ -330,21 +931,17 @@ class RunfilesCreator {
     }
   }
 
-  void LStatOrDie(const std::string &path, struct stat *st) {
-    if (lstat(path.c_str(), st) != 0) {
+  void LStatOrDie(int dir_fd, const char *name, const std::string &path,
+                  struct stat *st) {
+    if (fstatat(dir_fd, name, st, AT_SYMLINK_NOFOLLOW) != 0) {
       PDIE("lstating file '%s'", path.c_str());
     }
   }
 
-  void StatOrDie(const std::string &path, struct stat *st) {
-    if (stat(path.c_str(), st) != 0) {
-      PDIE("stating file '%s'", path.c_str());
-    }
-  }
-
-  void ReadLinkOrDie(const std::string &path, std::string *output) {
+  void ReadLinkOrDie(int dir_fd, const char *name, const std::string &path,
+                     std::string *output) {
     char readlink_buffer[PATH_MAX];
-    int sz = readlink(path.c_str(), readlink_buffer, sizeof(readlink_buffer));
+    int sz = readlinkat(dir_fd, name, readlink_buffer, sizeof(readlink_buffer));
     if (sz < 0) {
       PDIE("reading symlink '%s'", path.c_str());
     }
@@ -352,21 +949,182 @@ class RunfilesCreator {
     std::string(readlink_buffer, sz).swap(*output);
   }
 
-  void EnsureDirReadAndWritePerms(const std::string &path) {
+  void EnsureDirReadAndWritePerms(int dir_fd, const std::string &name,
+                                  const std::string &path) {
     const int kMode = 0700;
     struct stat st;
-    LStatOrDie(path, &st);
+    LStatOrDie(dir_fd, name.c_str(), path, &st);
     if ((st.st_mode & kMode) != kMode) {
       int new_mode = st.st_mode | kMode;
-      if (chmod(path.c_str(), new_mode) != 0) {
+      if (fchmodat(dir_fd, name.c_str(), new_mode, 0) != 0) {
         PDIE("chmod '%s'", path.c_str());
       }
     }
   }
 
-  bool DelTree(const std::string &path, FileType file_type) {
+  // Deletes the entry 'name' of 'dir_fd': a directory is only moved into the
+  // trash, for the threads to delete while the tree is being built.
+  void Delete(int dir_fd, const char *name, const std::string &path,
+              FileType file_type) {
+    if (file_type != FILE_TYPE_DIRECTORY ||
+        !MoveToTrash(dir_fd, name, path)) {
+      DelTree(dir_fd, name, path, file_type);
+    }
+  }
+
+  // Moves the directory 'name' of 'dir_fd' into the trash and submits it for
+  // deletion. Returns false if there is no trash or it is on another file
+  // system.
+  bool MoveToTrash(int dir_fd, const char *name, const std::string &path) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (trash_fd_ == -1) {
+      OpenTrash();
+    }
+    if (trash_fd_ < 0) {
+      return false;
+    }
+    std::string trash_name = std::to_string(trash_entries_++);
+    lock.unlock();
+    // Moving a directory to another one writes its "..".
+    EnsureDirReadAndWritePerms(dir_fd, name, path);
+    if (renameat(dir_fd, name, trash_fd_, trash_name.c_str()) != 0) {
+      if (errno == EXDEV) {
+        return false;
+      }
+      PDIE("moving '%s' to '%s/%s'", path.c_str(), trash_path_.c_str(),
+           trash_name.c_str());
+    }
+    lock.lock();
+    trash_tasks_.push_back(trash_name);
+    ++pending_tasks_;
+    task_or_done_.notify_one();
+    return true;
+  }
+
+  // Creates the trash next to the runfiles tree, so that neither the scans
+  // nor the ctimes of the tree see it. Called with mutex_ held; sets
+  // trash_fd_ to -2 if there can be none.
+  void OpenTrash() {
+    trash_fd_ = -2;
+    struct stat st;
+    struct stat parent_st;
+    int parent_fd = open("..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd < 0) {
+      return;
+    }
+    // Not the root of a file system or a mount point.
+    if (stat(".", &st) != 0 || fstat(parent_fd, &parent_st) != 0 ||
+        st.st_dev != parent_st.st_dev || st.st_ino == parent_st.st_ino) {
+      close(parent_fd);
+      return;
+    }
+    std::string name =
+        kTrashPrefix + std::to_string(static_cast<long>(getpid()));
+    if (mkdirat(parent_fd, name.c_str(), 0700) == 0) {
+      trash_fd_ = openat(parent_fd, name.c_str(),
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (trash_fd_ >= 0) {
+        trash_parent_fd_ = parent_fd;
+        trash_name_ = name;
+        trash_path_ = output_base_ + "/../" + name;
+        return;
+      }
+      unlinkat(parent_fd, name.c_str(), AT_REMOVEDIR);
+      trash_fd_ = -2;
+    }
+    close(parent_fd);
+  }
+
+  // Moves the trashes left next to the runfiles tree by the runs which died
+  // before removing them into the trash of this run, for the threads to
+  // delete. The trash of a process still alive may be in use by a concurrent
+  // run for another tree of the same directory, and is left alone.
+  void SweepStaleTrash() {
+    int parent_fd = open("..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dh = parent_fd < 0 ? NULL : fdopendir(parent_fd);
+    if (!dh) {
+      if (parent_fd >= 0) {
+        close(parent_fd);
+      }
+      return;
+    }
+    const size_t prefix_length = strlen(kTrashPrefix);
+    struct dirent *entry;
+    while ((entry = readdir(dh)) != NULL) {
+      if (strncmp(entry->d_name, kTrashPrefix, prefix_length) != 0) {
+        continue;
+      }
+      const char *pid_string = entry->d_name + prefix_length;
+      char *end;
+      long pid = strtol(pid_string, &end, 10);
+      if (end == pid_string || *end != '\0' || pid <= 0 || pid == getpid() ||
+          kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (trash_fd_ == -1) {
+        OpenTrash();
+      }
+      if (trash_fd_ < 0) {
+        break;
+      }
+      std::string trash_name = std::to_string(trash_entries_++);
+      // Another run may have swept it first.
+      if (renameat(parent_fd, entry->d_name, trash_fd_, trash_name.c_str()) ==
+          0) {
+        trash_tasks_.push_back(trash_name);
+        ++pending_tasks_;
+      }
+    }
+    closedir(dh);
+  }
+
+  // Deletes the entry 'name' of the trash. The directories in it are moved
+  // into the trash on their own, for the other threads to delete.
+  void DeleteTrash(const std::string &name) {
+    const std::string path = trash_path_ + "/" + name;
+    int fd = openat(trash_fd_, name.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dh = fd < 0 ? NULL : fdopendir(fd);
+    if (!dh) {
+      PDIE("opendir '%s'", path.c_str());
+    }
+    struct dirent *entry;
+    errno = 0;
+    while ((entry = readdir(dh)) != NULL) {
+      if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+      const std::string entry_path = path + '/' + entry->d_name;
+      FileType entry_file_type =
+          DentryToFileType(fd, entry->d_name, entry_path, entry->d_type);
+      Delete(fd, entry->d_name, entry_path, entry_file_type);
+      errno = 0;
+    }
+    if (errno != 0) {
+      PDIE("readdir '%s'", path.c_str());
+    }
+    closedir(dh);
+    if (unlinkat(trash_fd_, name.c_str(), AT_REMOVEDIR) != 0) {
+      PDIE("rmdir '%s'", path.c_str());
+    }
+  }
+
+  // Removes the trash, which the threads have emptied.
+  void RemoveTrash() {
+    if (trash_fd_ < 0) {
+      return;
+    }
+    close(trash_fd_);
+    if (unlinkat(trash_parent_fd_, trash_name_.c_str(), AT_REMOVEDIR) != 0) {
+      PDIE("rmdir '%s'", trash_path_.c_str());
+    }
+    close(trash_parent_fd_);
+    trash_fd_ = -1;
+  }
+
+  bool DelTree(int dir_fd, const char *name, const std::string &path,
+               FileType file_type) {
     if (file_type != FILE_TYPE_DIRECTORY) {
-      if (unlink(path.c_str()) != 0) {
+      if (unlinkat(dir_fd, name, 0) != 0) {
 #if !defined(__CYGWIN__)
         PDIE("unlinking '%s'", path.c_str());
 #endif
@@ -375,10 +1133,12 @@ class RunfilesCreator {
       return true;
     }
 
-    EnsureDirReadAndWritePerms(path);
+    EnsureDirReadAndWritePerms(dir_fd, name, path);
 
     struct dirent *entry;
-    DIR *dh = opendir(path.c_str());
+    int fd =
+        openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dh = fd < 0 ? NULL : fdopendir(fd);
     if (!dh) {
       PDIE("opendir '%s'", path.c_str());
     }
@@ -386,15 +1146,16 @@ class RunfilesCreator {
     while ((entry = readdir(dh)) != NULL) {
       if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
       const std::string entry_path = path + '/' + entry->d_name;
-      FileType entry_file_type = DentryToFileType(entry_path, entry->d_type);
-      DelTree(entry_path, entry_file_type);
+      FileType entry_file_type =
+          DentryToFileType(fd, entry->d_name, entry_path, entry->d_type);
+      DelTree(fd, entry->d_name, entry_path, entry_file_type);
       errno = 0;
     }
     if (errno != 0) {
       PDIE("readdir '%s'", path.c_str());
     }
     closedir(dh);
-    if (rmdir(path.c_str()) != 0) {
+    if (unlinkat(dir_fd, name, AT_REMOVEDIR) != 0) {
       PDIE("rmdir '%s'", path.c_str());
     }
     return true;
@@ -404,16 +1165,41 @@ class RunfilesCreator {
   std::string output_base_;
   std::string output_filename_;
   std::string temp_filename_;
+  std::string index_filename_;
+  std::string index_temp_filename_;
+  bool index_only_ = false;
+
+  Manifest manifest_;
+  // The manifest of the tree as the last run left it, if
+  // have_previous_manifest_.
+  Manifest previous_manifest_;
+  bool have_previous_manifest_ = false;
 
-  FileInfoMap manifest_;
+  // The directories for ProcessTree() still to do, their number plus that of
+  // those being done, and the condition of either a new one or all done.
+  std::mutex mutex_;
+  std::vector<DirTask> tasks_;
+  size_t pending_tasks_ = 0;
+  std::condition_variable task_or_done_;
+  // The directories set aside to delete, by their names in the trash, which
+  // is opened the first time there is one: -1 before that, -2 if there is
+  // none.
+  std::vector<std::string> trash_tasks_;
+  size_t trash_entries_ = 0;
+  int trash_fd_ = -1;
+  int trash_parent_fd_ = -1;
+  std::string trash_name_;
+  std::string trash_path_;
 };
 
 int main(int argc, char **argv) {
   argv0 = argv[0];
+  BlazeTraceInit("build-runfiles", NULL);
 
   argc--; argv++;
   bool allow_relative = false;
   bool use_metadata = false;
+  bool index_only = false;
 
   while (argc >= 1) {
     if (strcmp(argv[0], "--allow_relative") == 0) {
@@ -422,6 +1208,9 @@ int main(int argc, char **argv) {
     } else if (strcmp(argv[0], "--use_metadata") == 0) {
       use_metadata = true;
       argc--; argv++;
+    } else if (strcmp(argv[0], "--index_only") == 0) {
+      index_only = true;
+      argc--; argv++;
     } else {
       break;
     }
@@ -429,7 +1218,7 @@ int main(int argc, char **argv) {
 
   if (argc != 2) {
     fprintf(stderr, "usage: %s "
-            "[--allow_relative] [--use_metadata] "
+            "[--allow_relative] [--use_metadata] [--index_only] "
             "INPUT RUNFILES\n",
             argv0);
     return 1;
@@ -448,7 +1237,12 @@ int main(int argc, char **argv) {
   }
 
   RunfilesCreator runfiles_creator(output_base_dir);
-  runfiles_creator.ReadManifest(manifest_file, allow_relative, use_metadata);
+  {
+    blaze_util::TraceSpan span("read manifest", input_filename);
+    runfiles_creator.ReadManifest(manifest_file, allow_relative, use_metadata,
+                                  index_only);
+  }
+  blaze_util::TraceSpan span("create runfiles", output_base_dir);
   runfiles_creator.CreateRunfiles();
 
   return 0;
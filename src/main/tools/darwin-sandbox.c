@@ -0,0 +1,135 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// darwin-sandbox runs a command under a macOS sandbox profile. The profile
+// is applied to this process with sandbox_init_with_parameters() right before
+// the exec, which saves going through /usr/bin/sandbox-exec for every action.
+//
+// Usage: darwin-sandbox -f <profile> [-D <name>=<value>]... -- <command> ...
+//
+// Each -D defines a parameter that the profile reads with (param "<name>").
+// Bazel writes one profile per set of paths and passes what differs between
+// actions, like the sandbox exec root, as parameters, so that the profile
+// file is written once and then shared.
+//
+// "darwin-sandbox -C" only checks that a trivial profile can be applied.
+//
+// The exit status is 1 if the profile cannot be read or applied, or the
+// command cannot be executed; otherwise the command replaces this process.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "process-tools.h"
+
+// Part of libsandbox, but not declared in the public sandbox.h.
+int sandbox_init_with_parameters(const char *profile, uint64_t flags,
+                                 const char *const parameters[],
+                                 char **errorbuf);
+void sandbox_free_error(char *errorbuf);
+
+static void Usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s -f <profile> [-D <name>=<value>]... -- <command> ...\n"
+          "       %s -C\n",
+          program, program);
+  exit(EXIT_FAILURE);
+}
+
+// Returns the contents of the file at path, NUL-terminated.
+static char *ReadFile(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    DIE("fopen(\"%s\"): %s\n", path, strerror(errno));
+  }
+  size_t capacity = 4096;
+  size_t size = 0;
+  char *contents = malloc(capacity);
+  CHECK_NOT_NULL(contents);
+  size_t n;
+  while ((n = fread(contents + size, 1, capacity - size - 1, file)) > 0) {
+    size += n;
+    if (capacity - size == 1) {
+      capacity *= 2;
+      contents = realloc(contents, capacity);
+      CHECK_NOT_NULL(contents);
+    }
+  }
+  if (ferror(file)) {
+    DIE("fread(\"%s\"): %s\n", path, strerror(errno));
+  }
+  fclose(file);
+  contents[size] = '\0';
+  return contents;
+}
+
+// Applies the profile to this process, with parameters, a NULL-terminated
+// array of alternating names and values.
+static void ApplyProfile(const char *profile, const char *const parameters[]) {
+  char *error = NULL;
+  if (sandbox_init_with_parameters(profile, 0, parameters, &error) != 0) {
+    fprintf(stderr, "sandbox_init_with_parameters: %s\n",
+            error != NULL ? error : "unknown error");
+    if (error != NULL) {
+      sandbox_free_error(error);
+    }
+    exit(EXIT_FAILURE);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *profile_path = NULL;
+  // At most one name and one value per argument, and the terminating NULL.
+  const char **parameters = calloc(argc * 2 + 1, sizeof(const char *));
+  CHECK_NOT_NULL(parameters);
+  int num_parameters = 0;
+
+  int i = 1;
+  for (; i < argc; i++) {
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    } else if (strcmp(argv[i], "-C") == 0 && argc == 2) {
+      ApplyProfile("(version 1) (allow default)", parameters);
+      return 0;
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      profile_path = argv[++i];
+    } else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+      char *name = argv[++i];
+      char *equals = strchr(name, '=');
+      if (equals == NULL) {
+        Usage(argv[0]);
+      }
+      *equals = '\0';
+      parameters[num_parameters++] = name;
+      parameters[num_parameters++] = equals + 1;
+    } else {
+      Usage(argv[0]);
+    }
+  }
+  if (profile_path == NULL || i >= argc) {
+    Usage(argv[0]);
+  }
+
+  char *profile = ReadFile(profile_path);
+  ApplyProfile(profile, parameters);
+  free(profile);
+
+  execvp(argv[i], argv + i);
+  DIE("execvp(\"%s\", ...): %s\n", argv[i], strerror(errno));
+}
@@ -0,0 +1,308 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the overhead linux-sandbox adds to a spawn:
+//
+//   linux-sandbox-benchmark --linux_sandbox=<path> --process_wrapper=<path>
+//       [--runs=N] [--mounts=N] [--scratch=<dir>]
+//       [--configs=plain,netns,fake_root,bind_mounts,inaccessible,tmpfs]
+//       [--commands=noop,io]
+//
+// It runs each command under process-wrapper, the baseline, then under
+// linux-sandbox with each configuration of options:
+//
+//   plain:        only a writable working directory (-W, -w);
+//   netns:        a new network namespace (-N);
+//   fake_root:    root as the user and group (-R);
+//   bind_mounts:  --mounts bind mounts (-b);
+//   inaccessible: --mounts inaccessible files (-i);
+//   tmpfs:        --mounts tmpfs directories (-e).
+//
+// The commands are "noop", /bin/true, and "io", which writes and reads back a
+// small file in the working directory. For each combination it prints the
+// percentiles of the wall time from fork() to the exit of the sandbox over the
+// runs, the overhead over process-wrapper at the same percentile, and those of
+// every step of the sandbox (see the -p option of linux-sandbox). Run it before
+// and after a change to the sandbox to see what the change saves.
+//
+// The scratch directory, by default the current one, must not be below /tmp:
+// the sandbox mounts its own files there.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "src/main/tools/benchmark-util.h"
+
+namespace {
+
+using benchmark_util::Flag;
+using benchmark_util::Percentile;
+using benchmark_util::RunProcess;
+using benchmark_util::Split;
+using std::map;
+using std::string;
+using std::vector;
+
+struct Options {
+  string linux_sandbox;
+  string process_wrapper;
+  string scratch;
+  vector<string> configs = {"plain",        "netns",        "fake_root",
+                            "bind_mounts",  "inaccessible", "tmpfs"};
+  vector<string> commands = {"noop", "io"};
+  int runs = 100;
+  int mounts = 100;
+};
+
+// The wall time of one run and the steps the sandbox timed in it.
+struct Run {
+  double wall_ms;
+  map<string, double> steps;
+};
+
+void Die(const char *format, const string &arg) {
+  fprintf(stderr, "linux-sandbox-benchmark: ");
+  fprintf(stderr, format, arg.c_str());
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+void MakeDirectory(const string &path) {
+  if (mkdir(path.c_str(), 0755) == -1 && errno != EEXIST) {
+    Die("mkdir(%s) failed", path);
+  }
+}
+
+void MakeFile(const string &path) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    Die("open(%s) failed", path);
+  }
+  close(fd);
+}
+
+// Parses the "<step>_micros <time>" lines of the -p file of linux-sandbox.
+map<string, double> ParseSteps(const string &path) {
+  map<string, double> steps;
+  std::ifstream file(path);
+  string name;
+  double micros;
+  while (file >> name >> micros) {
+    const string suffix = "_micros";
+    if (name.size() > suffix.size() &&
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) ==
+            0) {
+      steps[name.substr(0, name.size() - suffix.size())] += micros / 1000;
+    }
+  }
+  return steps;
+}
+
+Run TimeRun(const string &cwd, const vector<string> &args,
+            const string &timings) {
+  string err;
+  auto start = std::chrono::steady_clock::now();
+  int exit_code = RunProcess(cwd, args, &err);
+  auto end = std::chrono::steady_clock::now();
+  if (exit_code == -1) {
+    Die("running a process failed: %s", strerror(errno));
+  }
+  if (exit_code != 0) {
+    fprintf(stderr, "%s", err.c_str());
+    Die("%s failed", args[0]);
+  }
+  Run run;
+  run.wall_ms =
+      std::chrono::duration<double, std::milli>(end - start).count();
+  if (!timings.empty()) {
+    run.steps = ParseSteps(timings);
+  }
+  return run;
+}
+
+// The arguments of linux-sandbox for a configuration, up to the "--".
+vector<string> SandboxArgs(const Options &options, const string &config,
+                           const string &work, const string &timings) {
+  vector<string> args = {options.linux_sandbox, "-W", work, "-w", work,
+                         "-p", timings};
+  if (config == "netns") {
+    args.push_back("-N");
+  } else if (config == "fake_root") {
+    args.push_back("-R");
+  } else if (config == "bind_mounts" || config == "inaccessible" ||
+             config == "tmpfs") {
+    string dir = options.scratch + "/" + config;
+    MakeDirectory(dir);
+    const char *flag =
+        config == "bind_mounts" ? "-b" : config == "inaccessible" ? "-i" : "-e";
+    for (int i = 0; i < options.mounts; ++i) {
+      string path = dir + "/" + std::to_string(i);
+      if (config == "inaccessible") {
+        MakeFile(path);
+      } else {
+        MakeDirectory(path);
+      }
+      args.push_back(flag);
+      args.push_back(path);
+    }
+  } else if (config != "plain") {
+    Die("unknown configuration %s", config);
+  }
+  args.push_back("--");
+  return args;
+}
+
+vector<Run> RunConfig(const Options &options, const vector<string> &prefix,
+                      const vector<string> &command, const string &work,
+                      const string &timings) {
+  vector<string> args = prefix;
+  args.insert(args.end(), command.begin(), command.end());
+  // Warm up the page cache and the dynamic loader.
+  TimeRun(work, args, timings);
+  vector<Run> runs;
+  for (int i = 0; i < options.runs; ++i) {
+    runs.push_back(TimeRun(work, args, timings));
+  }
+  return runs;
+}
+
+const int kPercentiles[] = {50, 90, 99, 100};
+
+void PrintRow(const string &name, vector<double> values,
+              const vector<double> *baseline) {
+  std::sort(values.begin(), values.end());
+  printf("  %-38s", name.c_str());
+  for (int p : kPercentiles) {
+    double value = Percentile(values, p);
+    if (baseline != NULL) {
+      value -= Percentile(*baseline, p);
+    }
+    printf(" %9.2f", value);
+  }
+  printf("\n");
+}
+
+vector<double> WallTimes(const vector<Run> &runs) {
+  vector<double> wall;
+  for (const Run &run : runs) {
+    wall.push_back(run.wall_ms);
+  }
+  std::sort(wall.begin(), wall.end());
+  return wall;
+}
+
+void Report(const string &config, const string &command,
+            const vector<Run> &runs, const vector<double> &baseline) {
+  printf("%s %s, %zu runs\n", config.c_str(), command.c_str(), runs.size());
+  printf("  %-38s %9s %9s %9s %9s\n", "", "p50 ms", "p90 ms", "p99 ms",
+         "max ms");
+  map<string, vector<double>> steps;
+  for (const Run &run : runs) {
+    for (const auto &step : run.steps) {
+      steps[step.first].push_back(step.second);
+    }
+  }
+  vector<double> wall = WallTimes(runs);
+  PrintRow("wall time", wall, NULL);
+  if (!baseline.empty()) {
+    PrintRow("overhead over process-wrapper", wall, &baseline);
+  }
+  for (auto &step : steps) {
+    // A step that some runs skipped counts as 0 ms in them.
+    step.second.resize(runs.size(), 0);
+    PrintRow(step.first, step.second, NULL);
+  }
+  printf("\n");
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    Die("getcwd: %s", strerror(errno));
+  }
+  options.scratch = cwd;
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (Flag(argv[i], "linux_sandbox", &options.linux_sandbox)) {
+    } else if (Flag(argv[i], "process_wrapper", &options.process_wrapper)) {
+    } else if (Flag(argv[i], "scratch", &options.scratch)) {
+    } else if (Flag(argv[i], "runs", &value)) {
+      options.runs = atoi(value.c_str());
+    } else if (Flag(argv[i], "mounts", &value)) {
+      options.mounts = atoi(value.c_str());
+    } else if (Flag(argv[i], "configs", &value)) {
+      options.configs = Split(value, ',');
+    } else if (Flag(argv[i], "commands", &value)) {
+      options.commands = Split(value, ',');
+    } else {
+      Die("unknown argument %s", argv[i]);
+    }
+  }
+  if (options.linux_sandbox.empty() || options.process_wrapper.empty() ||
+      options.runs < 1 || options.mounts < 0) {
+    Die("usage: %s --linux_sandbox=<path> --process_wrapper=<path> "
+        "[--runs=N] ...",
+        argv[0]);
+  }
+  options.scratch += "/linux-sandbox-benchmark";
+  MakeDirectory(options.scratch);
+  string work = options.scratch + "/work";
+  MakeDirectory(work);
+  string timings = options.scratch + "/timings";
+
+  for (const string &command_name : options.commands) {
+    vector<string> command;
+    if (command_name == "noop") {
+      command = {"/bin/true"};
+    } else if (command_name == "io") {
+      command = {"/bin/sh", "-c",
+                 "head -c 65536 /dev/zero > out && cat out > /dev/null"};
+    } else {
+      Die("unknown command %s", command_name);
+    }
+
+    vector<Run> baseline_runs =
+        RunConfig(options, {options.process_wrapper, "0", "0", "-", "-"},
+                  command, work, "");
+    Report("process-wrapper", command_name, baseline_runs, {});
+    vector<double> baseline = WallTimes(baseline_runs);
+    for (const string &config : options.configs) {
+      Report(config, command_name,
+             RunConfig(options, SandboxArgs(options, config, work, timings),
+                       command, work, timings),
+             baseline);
+    }
+  }
+
+  string err;
+  RunProcess("/", {"/bin/rm", "-rf", options.scratch}, &err);
+  return 0;
+}
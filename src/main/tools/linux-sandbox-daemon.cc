@@ -0,0 +1,684 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * The sandbox daemon sets up what the sandboxed commands have in common once
+ * for all of them rather than for each: the user namespace, and the sandbox
+ * root, a read-only bind mount of /. Making every mount read-only one by one is
+ * what costs the most when linux-sandbox starts.
+ *
+ * There are four kinds of processes:
+ *
+ *  - The client, "linux-sandbox -d <name> ...", sends its working directory,
+ *    arguments and environment to the daemon, along with its stdin, stdout and
+ *    stderr, and waits for the exit code of the command. If there is no daemon
+ *    yet, it starts one.
+ *  - The daemon accepts the connections of the clients. It stays in the initial
+ *    namespaces, where SO_PEERCRED tells whether a client is the same user.
+ *  - The template process, in the user and mount namespace of the sandbox
+ *    root, forks a request handler for every connection the daemon hands it.
+ *  - The request handler runs the command just like linux-sandbox without -d,
+ *    except that the mount namespace of its PID 1 is a copy of the template's,
+ *    so that all that is left to do are the mounts of the command itself.
+ *
+ * The commands that run without network access (-N) and as nobody share a
+ * pool of network namespaces, which the request handlers create on demand and
+ * keep for the next command: creating and destroying a network namespace
+ * serializes on a kernel-wide lock. Nobody cannot change the namespace, and
+ * none of its sockets outlive the PID namespace of the command.
+ *
+ * The daemon exits once it has not received a request for kIdleTimeoutSecs.
+ */
+
+#include "linux-sandbox-daemon.h"
+#include "linux-sandbox-options.h"
+#include "linux-sandbox-pid1.h"
+#include "linux-sandbox-utils.h"
+#include "linux-sandbox.h"
+
+#define DIE(args...)                                     \
+  {                                                      \
+    fprintf(stderr, __FILE__ ":" S__LINE__ ": \"" args); \
+    fprintf(stderr, "\": ");                             \
+    perror(NULL);                                        \
+    exit(EXIT_FAILURE);                                  \
+  }
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+// The daemon exits after this long without a request.
+static const int kIdleTimeoutSecs = 10 * 60;
+
+// How often a client tries to connect while another client starts the daemon.
+static const int kMaxConnectAttempts = 1000;
+
+// The most network namespaces in the pool; beyond that many commands with -N
+// at once, each gets a new one.
+static const int kMaxPooledNetns = 1024;
+
+static char global_template_root[] = "/tmp/sandbox.XXXXXX";
+
+// The directory, a tmpfs in the mount namespace of the template, where the
+// network namespaces of the pool are bind mounted to keep them alive. Next to
+// each one is a file a request handler holds a lock on while it uses it.
+static std::string global_netns_pool;
+
+// A request starts with this header, followed by 'size' bytes of
+// NUL-terminated strings: the working directory, 'argc' arguments and 'envc'
+// environment variables. The header comes with the stdin, stdout and stderr of
+// the client as SCM_RIGHTS. The exit code of the command, an int32_t, is the
+// response.
+struct RequestHeader {
+  uint32_t size;
+  uint32_t argc;
+  uint32_t envc;
+};
+
+// What the template process needs from the daemon.
+struct TemplateArgs {
+  int sync_pipe[2];
+  // Written to once the template is set up.
+  int ready_fd;
+  // The connections of the clients arrive on requests_fd[1].
+  int requests_fd[2];
+  int listen_fd;
+};
+
+static bool WriteAll(int fd, const void *data, size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t r = send(fd, p, size, MSG_NOSIGNAL);
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += r;
+    size -= r;
+  }
+  return true;
+}
+
+static bool ReadAll(int fd, void *data, size_t size) {
+  char *p = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t r = read(fd, p, size);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    size -= r;
+  }
+  return true;
+}
+
+// Sends 'size' bytes of 'data' over the socket 'fd', along with 'num_fds' file
+// descriptors.
+static bool SendWithFds(int fd, const void *data, size_t size, const int *fds,
+                        int num_fds) {
+  struct iovec iov;
+  iov.iov_base = const_cast<void *>(data);
+  iov.iov_len = size;
+  std::vector<char> control(CMSG_SPACE(num_fds * sizeof(int)));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+
+  ssize_t r;
+  do {
+    r = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (r < 0 && errno == EINTR);
+  return r == static_cast<ssize_t>(size);
+}
+
+// Receives what SendWithFds() sent: exactly 'size' bytes and 'num_fds' file
+// descriptors, which are close-on-exec.
+static bool ReceiveWithFds(int fd, void *data, size_t size, int *fds,
+                           int num_fds) {
+  struct iovec iov;
+  iov.iov_base = data;
+  iov.iov_len = size;
+  std::vector<char> control(CMSG_SPACE(num_fds * sizeof(int)));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  ssize_t r;
+  do {
+    r = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (r < 0 && errno == EINTR);
+
+  int received = 0;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cmsg), received * sizeof(int));
+    }
+  }
+  if (r != static_cast<ssize_t>(size) || received != num_fds ||
+      (msg.msg_flags & MSG_CTRUNC)) {
+    for (int i = 0; i < received; i++) {
+      close(fds[i]);
+    }
+    return false;
+  }
+  return true;
+}
+
+// Returns the abstract socket address of the daemon in 'addr', and its length.
+// There is one daemon per user, name and -R, because the commands run in the
+// user namespace of the daemon.
+static socklen_t GetDaemonAddress(struct sockaddr_un *addr) {
+  // The name, an arbitrary string, may be longer than fits in an address, so
+  // the address has its 64-bit FNV-1a hash.
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char *p = opt.daemon_name; *p != '\0'; p++) {
+    hash = (hash ^ static_cast<unsigned char>(*p)) * 1099511628211ULL;
+  }
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  // The leading NUL of sun_path makes the address abstract: there is no socket
+  // file to clean up, but then there are no file permissions, either.
+  int length = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                        "linux-sandbox-%d-%016llx%s", global_outer_uid,
+                        static_cast<unsigned long long>(hash),
+                        opt.fake_root ? "-root" : "");
+  return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+// Stops using the stdin, stdout and stderr of the client that started the
+// daemon, which would otherwise see them open until the daemon exits.
+static void DetachFromClient() {
+  int null_fd = open("/dev/null", O_RDWR);
+  if (null_fd < 0) {
+    DIE("open(/dev/null)");
+  }
+  for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+    if (dup2(null_fd, fd) < 0) {
+      DIE("dup2");
+    }
+  }
+  if (close(null_fd) < 0) {
+    DIE("close");
+  }
+}
+
+// Moves the request handler into a network namespace of the pool that is not
+// in use, or into a new one it adds to the pool. Returns false if the pool is
+// full.
+static bool JoinPooledNetns() {
+  for (int i = 0; i < kMaxPooledNetns; i++) {
+    std::string netns_path = global_netns_pool + "/" + std::to_string(i);
+    std::string lock_path = netns_path + ".lock";
+    // Held until the handler exits, however it does.
+    int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0) {
+      DIE("open(%s)", lock_path.c_str());
+    }
+    if (flock(lock_fd, LOCK_EX | LOCK_NB) < 0) {
+      if (errno != EWOULDBLOCK) {
+        DIE("flock(%s)", lock_path.c_str());
+      }
+      if (close(lock_fd) < 0) {
+        DIE("close");
+      }
+      continue;
+    }
+
+    int netns_fd = open(netns_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (netns_fd >= 0) {
+      // A handler that died before it bound the namespace leaves a plain
+      // file, which setns() rejects.
+      bool joined = setns(netns_fd, CLONE_NEWNET) == 0;
+      if (close(netns_fd) < 0) {
+        DIE("close");
+      }
+      if (joined) {
+        PRINT_DEBUG("network namespace: %s", netns_path.c_str());
+        return true;
+      }
+    } else if (errno != ENOENT) {
+      DIE("open(%s)", netns_path.c_str());
+    }
+
+    PRINT_DEBUG("new network namespace: %s", netns_path.c_str());
+    if (unshare(CLONE_NEWNET) < 0) {
+      DIE("unshare(CLONE_NEWNET)");
+    }
+    SetupLoopback();
+    int fd = open(netns_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0 || close(fd) < 0) {
+      DIE("open(%s)", netns_path.c_str());
+    }
+    if (mount("/proc/self/ns/net", netns_path.c_str(), NULL, MS_BIND, NULL) <
+        0) {
+      DIE("mount(/proc/self/ns/net, %s)", netns_path.c_str());
+    }
+    return true;
+  }
+  return false;
+}
+
+// Runs the command of a client in a new request handler process and returns
+// its exit code.
+static int HandleRequest(int client_fd) {
+  RequestHeader header;
+  int fds[3];
+  if (!ReceiveWithFds(client_fd, &header, sizeof(header), fds, 3)) {
+    return EXIT_FAILURE;
+  }
+  // From now on, errors go to the client.
+  for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+    if (dup2(fds[fd], fd) < 0) {
+      DIE("dup2");
+    }
+    if (close(fds[fd]) < 0) {
+      DIE("close");
+    }
+  }
+
+  std::vector<char> strings(header.size);
+  if (!ReadAll(client_fd, strings.data(), strings.size())) {
+    return EXIT_FAILURE;
+  }
+  std::vector<char *> values;
+  if (!strings.empty() && strings.back() == '\0') {
+    for (size_t i = 0; i < strings.size(); i += strlen(&strings[i]) + 1) {
+      values.push_back(&strings[i]);
+    }
+  }
+  if (values.size() != 1 + static_cast<size_t>(header.argc) + header.envc) {
+    fprintf(stderr, "Malformed request to the sandbox daemon\n");
+    return EXIT_FAILURE;
+  }
+
+  if (chdir(values[0]) < 0) {
+    DIE("chdir(%s)", values[0]);
+  }
+  std::vector<char *> args(values.begin() + 1,
+                           values.begin() + 1 + header.argc);
+  std::vector<char *> env(values.begin() + 1 + header.argc, values.end());
+  env.push_back(nullptr);
+  environ = env.data();
+
+  // Start over with the options of the client.
+  opt = Options();
+  optind = 1;
+  ParseOptions(static_cast<int>(args.size()), args.data());
+  opt.sandbox_root_dir = global_template_root;
+  // With -R, the command could reconfigure the network namespace.
+  if (opt.create_netns && !opt.fake_root && JoinPooledNetns()) {
+    // PID 1 inherits the namespace of the handler.
+    opt.create_netns = false;
+  }
+
+  int32_t exit_code = RunSandboxedCommand(client_fd);
+  // The client may be gone already.
+  WriteAll(client_fd, &exit_code, sizeof(exit_code));
+  return exit_code;
+}
+
+static int TemplateMain(void *param) {
+  TemplateArgs *args = static_cast<TemplateArgs *>(param);
+  // The request handlers must not keep the daemon's address bound.
+  if (close(args->listen_fd) < 0 || close(args->requests_fd[0]) < 0) {
+    DIE("close");
+  }
+
+  SetupSandboxTemplate(args->sync_pipe);
+  if (mount("tmpfs", global_netns_pool.c_str(), "tmpfs",
+            MS_NOSUID | MS_NODEV | MS_NOEXEC, "mode=0700") < 0) {
+    DIE("mount(tmpfs, %s)", global_netns_pool.c_str());
+  }
+
+  char ready = 0;
+  if (write(args->ready_fd, &ready, 1) < 0 || close(args->ready_fd) < 0) {
+    DIE("write");
+  }
+  DetachFromClient();
+
+  // Let the kernel reap the request handlers.
+  if (signal(SIGCHLD, SIG_IGN) == SIG_ERR) {
+    DIE("signal");
+  }
+  while (true) {
+    char buf;
+    int client_fd;
+    if (!ReceiveWithFds(args->requests_fd[1], &buf, 1, &client_fd, 1)) {
+      // The daemon exited.
+      exit(EXIT_SUCCESS);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      DIE("fork");
+    } else if (pid == 0) {
+      if (close(args->requests_fd[1]) < 0) {
+        DIE("close");
+      }
+      if (signal(SIGCHLD, SIG_DFL) == SIG_ERR) {
+        DIE("signal");
+      }
+      exit(HandleRequest(client_fd));
+    }
+    if (close(client_fd) < 0) {
+      DIE("close");
+    }
+  }
+}
+
+// Hands the connections of the clients to the template process until there are
+// none for kIdleTimeoutSecs, or the template process is gone.
+static void ServeRequests(int listen_fd, int requests_fd) {
+  while (true) {
+    struct pollfd fds = {listen_fd, POLLIN, 0};
+    int r = poll(&fds, 1, kIdleTimeoutSecs * 1000);
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      DIE("poll");
+    }
+    if (r == 0) {
+      return;
+    }
+
+    int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client_fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      DIE("accept4");
+    }
+    // Anyone can connect to an abstract address.
+    struct ucred cred;
+    socklen_t cred_length = sizeof(cred);
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_length) <
+            0 ||
+        cred.uid != static_cast<uid_t>(global_outer_uid)) {
+      close(client_fd);
+      continue;
+    }
+
+    char buf = 0;
+    bool sent = SendWithFds(requests_fd, &buf, 1, &client_fd, 1);
+    if (close(client_fd) < 0) {
+      DIE("close");
+    }
+    if (!sent) {
+      return;
+    }
+  }
+}
+
+// The daemon: sets up the template process, then serves requests until it has
+// been idle for long enough. Writes to 'ready_fd' once it is ready to serve.
+static void RunDaemon(int listen_fd, int ready_fd) {
+  if (chdir("/") < 0) {
+    DIE("chdir(/)");
+  }
+  if (mkdtemp(global_template_root) == NULL) {
+    DIE("mkdtemp(%s)", global_template_root);
+  }
+  global_netns_pool = std::string(global_template_root) + "-netns";
+  if (mkdir(global_netns_pool.c_str(), 0700) < 0) {
+    DIE("mkdir(%s)", global_netns_pool.c_str());
+  }
+  // The template does not depend on the options of the client that happens to
+  // start the daemon, except for -R. Nothing in it is writable: the tmpfs
+  // instances are mounted for each command.
+  opt.sandbox_root_dir = global_template_root;
+  opt.working_dir = NULL;
+  opt.writable_files.clear();
+  opt.tmpfs_dirs.clear();
+
+  TemplateArgs args;
+  int template_ready[2];
+  // The template process inherits all of them, and the commands must not.
+  if (pipe2(args.sync_pipe, O_CLOEXEC) < 0 ||
+      pipe2(template_ready, O_CLOEXEC) < 0 ||
+      socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, args.requests_fd) <
+          0) {
+    DIE("pipe");
+  }
+  args.ready_fd = template_ready[1];
+  args.listen_fd = listen_fd;
+
+  const int kStackSize = 1024 * 1024;
+  std::vector<char> child_stack(kStackSize);
+  pid_t template_pid = clone(TemplateMain, child_stack.data() + kStackSize,
+                             CLONE_NEWUSER | CLONE_NEWNS | SIGCHLD, &args);
+  if (template_pid < 0) {
+    DIE("clone");
+  }
+
+  // As in SpawnPid1(), prove that we still existed after the template process
+  // ran prctl(PR_SET_PDEATHSIG, SIGKILL).
+  char buf;
+  if (close(args.sync_pipe[1]) < 0 || read(args.sync_pipe[0], &buf, 1) < 0 ||
+      close(args.sync_pipe[0]) < 0) {
+    DIE("sync pipe");
+  }
+  if (close(template_ready[1]) < 0 || close(args.requests_fd[1]) < 0) {
+    DIE("close");
+  }
+  // If the template could not be set up, the client that started us has the
+  // error on its stderr, and fails.
+  if (read(template_ready[0], &buf, 1) == 1) {
+    if (write(ready_fd, &buf, 1) < 0) {
+      DIE("write");
+    }
+    if (close(ready_fd) < 0 || close(template_ready[0]) < 0) {
+      DIE("close");
+    }
+    DetachFromClient();
+    ServeRequests(listen_fd, args.requests_fd[0]);
+  }
+
+  // Running request handlers are not affected: they hold on to the namespaces
+  // of the template, and the sandbox root is a mount point in there only.
+  kill(template_pid, SIGKILL);
+  while (waitpid(template_pid, NULL, 0) < 0 && errno == EINTR) {
+  }
+  rmdir(global_template_root);
+  rmdir(global_netns_pool.c_str());
+  exit(EXIT_SUCCESS);
+}
+
+// Starts the daemon, which serves the connections to 'listen_fd', and waits
+// until it is ready.
+static void StartDaemon(int listen_fd) {
+  int ready_pipe[2];
+  if (pipe2(ready_pipe, O_CLOEXEC) < 0) {
+    DIE("pipe");
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    DIE("fork");
+  } else if (pid == 0) {
+    // Leave our session and let init adopt the daemon, so that it outlives us.
+    if (setsid() < 0) {
+      DIE("setsid");
+    }
+    pid = fork();
+    if (pid < 0) {
+      DIE("fork");
+    } else if (pid > 0) {
+      _exit(EXIT_SUCCESS);
+    }
+    if (close(ready_pipe[0]) < 0) {
+      DIE("close");
+    }
+    RunDaemon(listen_fd, ready_pipe[1]);
+  }
+
+  if (close(ready_pipe[1]) < 0) {
+    DIE("close");
+  }
+  int err;
+  do {
+    err = waitpid(pid, NULL, 0);
+  } while (err < 0 && errno == EINTR);
+  if (err < 0) {
+    DIE("waitpid");
+  }
+
+  char buf;
+  if (!ReadAll(ready_pipe[0], &buf, 1)) {
+    fprintf(stderr, "The sandbox daemon %s failed to start\n",
+            opt.daemon_name);
+    exit(EXIT_FAILURE);
+  }
+  if (close(ready_pipe[0]) < 0) {
+    DIE("close");
+  }
+}
+
+// Connects to the daemon, starting it if there is none.
+static int ConnectToDaemon() {
+  struct sockaddr_un addr;
+  socklen_t addr_length = GetDaemonAddress(&addr);
+  const struct sockaddr *address = reinterpret_cast<struct sockaddr *>(&addr);
+
+  for (int attempt = 0; attempt < kMaxConnectAttempts; attempt++) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      DIE("socket");
+    }
+    if (connect(fd, address, addr_length) == 0) {
+      return fd;
+    }
+    if (errno != ECONNREFUSED) {
+      DIE("connect");
+    }
+    if (close(fd) < 0) {
+      DIE("close");
+    }
+
+    // Listen on the address ourselves before starting the daemon, so that our
+    // next connection is queued until the daemon accepts it. If the address is
+    // in use, another client is starting the daemon right now.
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      DIE("socket");
+    }
+    if (bind(fd, address, addr_length) == 0) {
+      if (listen(fd, SOMAXCONN) < 0) {
+        DIE("listen");
+      }
+      PRINT_DEBUG("starting the sandbox daemon %s", opt.daemon_name);
+      StartDaemon(fd);
+    } else if (errno == EADDRINUSE) {
+      usleep(1000);
+    } else {
+      DIE("bind");
+    }
+    if (close(fd) < 0) {
+      DIE("close");
+    }
+  }
+  DIE("connect(%s)", addr.sun_path + 1);
+}
+
+// Sends the request for the command of 'argv'. Returns false if the daemon
+// closed the connection: it exited before accepting it.
+static bool SendRequest(int fd, int argc, char *argv[]) {
+  std::string strings;
+  char *cwd = getcwd(NULL, 0);
+  if (cwd == NULL) {
+    DIE("getcwd");
+  }
+  strings.append(cwd);
+  strings.push_back('\0');
+  free(cwd);
+  for (int i = 0; i < argc; i++) {
+    strings.append(argv[i]);
+    strings.push_back('\0');
+  }
+  uint32_t envc = 0;
+  for (char **var = environ; *var != NULL; var++, envc++) {
+    strings.append(*var);
+    strings.push_back('\0');
+  }
+
+  RequestHeader header;
+  header.size = strings.size();
+  header.argc = argc;
+  header.envc = envc;
+  int fds[] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  return SendWithFds(fd, &header, sizeof(header), fds, 3) &&
+         WriteAll(fd, strings.data(), strings.size());
+}
+
+int RunInDaemon(int argc, char *argv[]) {
+  for (int attempt = 0; attempt < kMaxConnectAttempts; attempt++) {
+    int fd = ConnectToDaemon();
+    int32_t exit_code;
+    bool sent = SendRequest(fd, argc, argv);
+    errno = 0;
+    if (sent && ReadAll(fd, &exit_code, sizeof(exit_code))) {
+      return exit_code;
+    }
+    // A connection the daemon never accepted is reset when it exits, after
+    // having been idle. Otherwise the request handler failed, and told us why
+    // on stderr.
+    if (sent && errno != ECONNRESET) {
+      PRINT_DEBUG("the sandbox daemon did not report an exit code");
+      return EXIT_FAILURE;
+    }
+    if (close(fd) < 0) {
+      DIE("close");
+    }
+  }
+  DIE("the sandbox daemon %s keeps going away", opt.daemon_name);
+}
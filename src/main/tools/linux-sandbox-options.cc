@@ -64,15 +64,53 @@ static void Usage(char *program_name, const char *fmt, ...) {
           "killing the child with SIGKILL\n"
           "  -l <file>  redirect stdout to a file\n"
           "  -L <file>  redirect stderr to a file\n"
+          "  -s <file>  write the resource usage of the child to a file\n"
+          "  -p <file>  write the time each step of the sandbox took to a "
+          "file, a line \"<step>_micros <time>\" per step: "
+          "setup_sandbox_root, create_cgroup, spawn_pid1, setup_namespaces, "
+          "mount_filesystems, make_filesystem_read_only, mount_proc, "
+          "setup_networking, enter_sandbox, command, copy_outputs, "
+          "write_changes, write_accesses and teardown\n"
           "  -w <file>  make a file or directory writable for the sandboxed "
           "process\n"
           "  -i <file>  make a file or directory inaccessible for the "
           "sandboxed process\n"
           "  -e <dir>  mount an empty tmpfs on a directory\n"
           "  -b <dir>  bind mount a file or directory inside the sandbox\n"
+          "  -M <file>  create the inputs in <file> in the working directory: "
+          "per input, a line with its path relative to the working directory "
+          "and a line with the file it is a symlink to\n"
+          "  -x <size>  send the writes to the working directory to a tmpfs "
+          "of <size>, e.g. 512m, and discard them but the outputs of -O\n"
+          "  -O <path>  with -x, copy the file or directory <path>, relative "
+          "to the working directory, to the working directory on exit\n"
+          "  -F <file>  with -M or -x, write what the command changed in the "
+          "working directory to a file, a line \"<type> <path>\" per file "
+          "(f), symlink (l) or directory (d) it created or changed and per "
+          "path it deleted (x), followed by a line \".\"; the file has no "
+          "\".\" line if the changes could not be tracked\n"
+          "  -A <file>  with -M, write the inputs the command opened to a "
+          "file, a line with the path of each relative to the working "
+          "directory, followed by a line \".\"; the file has no \".\" "
+          "line if the opens could not be traced\n"
           "  -N  if set, a new network namespace will be created\n"
           "  -R  if set, make the uid/gid be root, otherwise use nobody\n"
           "  -D  if set, debug info will be printed\n"
+          "  -d <name>  run the command through the sandbox daemon <name>, "
+          "starting it if needed\n"
+          "  -G <dir>  run the command in a new cgroup below the cgroup v2 "
+          "<dir>, and add its resource usage to the -s file\n"
+          "  -g <file>=<value>  write <value> to <file> of the cgroup of -G, "
+          "e.g. memory.max=1G, cpu.max=\"200000 100000\" or pids.max=1000\n"
+          "  -c <cpus>  run the command on the CPUs of the list <cpus>, e.g. "
+          "0-15,64-79\n"
+          "  -m <node>  allocate the memory of the command on the NUMA node "
+          "<node> while it has free memory\n"
+          "  -I <socket>  run the command as a persistent worker: the working "
+          "directory is a tmpfs with the entries of -W mounted in it, and "
+          "every connection to the unix socket <socket> sends the path of a "
+          "directory whose entries replace them, followed by a newline, and "
+          "gets back 0 or an errno, followed by a newline\n"
           "  @FILE  read newline-separated arguments from FILE\n"
           "  --  command to run inside sandbox, followed by arguments\n");
   exit(EXIT_FAILURE);
@@ -106,6 +144,40 @@ static int CheckNamespacesSupported() {
   return EXIT_SUCCESS;
 }
 
+// Parses a list of CPUs like the ones of cpuset(7), e.g. "0-3,8,10-11", into
+// 'cpus'. Returns false if it is malformed.
+static bool ParseCpuList(const char *list, vector<int> *cpus) {
+  const char *p = list;
+  while (true) {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p || first < 0) {
+      return false;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first) {
+        return false;
+      }
+    }
+    if (last >= kMaxCpus) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+    if (*end == '\0') {
+      return true;
+    }
+    if (*end != ',') {
+      return false;
+    }
+    p = end + 1;
+  }
+}
+
 // Parses command line flags from an argv array and puts the results into an
 // Options structure passed in as an argument.
 static void ParseCommandLine(unique_ptr<vector<char *>> args) {
@@ -114,7 +186,7 @@ static void ParseCommandLine(unique_ptr<vector<char *>> args) {
   int c;
 
   while ((c = getopt(args->size(), args->data(),
-                     ":CS:W:T:t:l:L:w:i:e:b:NRD")) != -1) {
+                     ":CS:W:T:t:l:L:s:p:w:i:e:b:M:x:O:F:A:NRDd:G:g:c:m:I:")) != -1) {
     switch (c) {
       case 'C':
         // Shortcut for the "does this system support sandboxing" check.
@@ -172,6 +244,22 @@ static void ParseCommandLine(unique_ptr<vector<char *>> args) {
                 "Cannot redirect stderr to more than one destination.");
         }
         break;
+      case 's':
+        if (opt.stats_path == NULL) {
+          opt.stats_path = optarg;
+        } else {
+          Usage(args->front(),
+                "Cannot write statistics to more than one destination.");
+        }
+        break;
+      case 'p':
+        if (opt.timings_path == NULL) {
+          opt.timings_path = optarg;
+        } else {
+          Usage(args->front(),
+                "Cannot write timings to more than one destination.");
+        }
+        break;
       case 'w':
         if (optarg[0] != '/') {
           Usage(args->front(),
@@ -200,6 +288,45 @@ static void ParseCommandLine(unique_ptr<vector<char *>> args) {
         }
         opt.bind_mounts.push_back(strdup(optarg));
         break;
+      case 'M':
+        if (opt.input_manifest == NULL) {
+          opt.input_manifest = strdup(optarg);
+        } else {
+          Usage(args->front(),
+                "Multiple input manifests (-M) specified, expected one.");
+        }
+        break;
+      case 'x':
+        if (opt.scratch_size == NULL) {
+          opt.scratch_size = strdup(optarg);
+        } else {
+          Usage(args->front(),
+                "Multiple scratch sizes (-x) specified, expected one.");
+        }
+        break;
+      case 'O':
+        if (optarg[0] == '/') {
+          Usage(args->front(),
+                "The -O option must be used with relative paths only.");
+        }
+        opt.outputs.push_back(strdup(optarg));
+        break;
+      case 'F':
+        if (opt.changes_path == NULL) {
+          opt.changes_path = strdup(optarg);
+        } else {
+          Usage(args->front(),
+                "Cannot write changes to more than one destination.");
+        }
+        break;
+      case 'A':
+        if (opt.accesses_path == NULL) {
+          opt.accesses_path = strdup(optarg);
+        } else {
+          Usage(args->front(),
+                "Cannot write accesses to more than one destination.");
+        }
+        break;
       case 'N':
         opt.create_netns = true;
         break;
@@ -209,6 +336,54 @@ static void ParseCommandLine(unique_ptr<vector<char *>> args) {
       case 'D':
         opt.debug = true;
         break;
+      case 'd':
+        if (opt.daemon_name == NULL) {
+          opt.daemon_name = strdup(optarg);
+        } else {
+          Usage(args->front(),
+                "Multiple sandbox daemons (-d) specified, expected one.");
+        }
+        break;
+      case 'G':
+        if (opt.cgroup_parent == NULL) {
+          opt.cgroup_parent = strdup(optarg);
+        } else {
+          Usage(args->front(), "Multiple cgroups (-G) specified, expected one.");
+        }
+        break;
+      case 'g':
+        if (strchr(optarg, '=') == NULL || strchr(optarg, '/') != NULL) {
+          Usage(args->front(),
+                "The -g option must be of the form <file>=<value>.");
+        }
+        opt.cgroup_settings.push_back(strdup(optarg));
+        break;
+      case 'c':
+        if (!opt.cpus.empty()) {
+          Usage(args->front(), "Multiple CPU lists (-c) specified, expected one.");
+        }
+        if (!ParseCpuList(optarg, &opt.cpus)) {
+          Usage(args->front(), "Invalid CPU list (-c): %s", optarg);
+        }
+        break;
+      case 'm':
+        if (opt.numa_node >= 0) {
+          Usage(args->front(),
+                "Multiple NUMA nodes (-m) specified, expected one.");
+        }
+        if (sscanf(optarg, "%d", &opt.numa_node) != 1 || opt.numa_node < 0 ||
+            opt.numa_node >= kMaxNumaNodes) {
+          Usage(args->front(), "Invalid NUMA node (-m) value: %s", optarg);
+        }
+        break;
+      case 'I':
+        if (opt.worker_socket == NULL) {
+          opt.worker_socket = strdup(optarg);
+        } else {
+          Usage(args->front(),
+                "Multiple worker sockets (-I) specified, expected one.");
+        }
+        break;
       case '?':
         Usage(args->front(), "Unrecognized argument: -%c (%d)", optopt, optind);
         break;
@@ -275,12 +450,36 @@ unique_ptr<vector<char *>> ExpandArguments(const vector<char *> &args) {
 // Handles parsing all command line flags and populates the global opt struct.
 void ParseOptions(int argc, char *argv[]) {
   vector<char *> args(argv, argv + argc);
+  opt.numa_node = -1;
   ParseCommandLine(ExpandArguments(args));
 
   if (opt.args.empty()) {
     Usage(args.front(), "No command specified.");
   }
 
+  if (!opt.cgroup_settings.empty() && opt.cgroup_parent == NULL) {
+    Usage(args.front(), "The -g option requires -G.");
+  }
+
+  if (!opt.outputs.empty() && opt.scratch_size == NULL) {
+    Usage(args.front(), "The -O option requires -x.");
+  }
+
+  if (opt.changes_path != NULL && opt.input_manifest == NULL &&
+      opt.scratch_size == NULL) {
+    Usage(args.front(), "The -F option requires -M or -x.");
+  }
+
+  if (opt.accesses_path != NULL && opt.input_manifest == NULL) {
+    Usage(args.front(), "The -A option requires -M.");
+  }
+
+  if (opt.worker_socket != NULL &&
+      (opt.daemon_name != NULL || opt.input_manifest != NULL ||
+       opt.scratch_size != NULL)) {
+    Usage(args.front(), "The -I option cannot be combined with -d, -M or -x.");
+  }
+
   opt.tmpfs_dirs.push_back("/tmp");
 
   if (opt.working_dir == NULL) {
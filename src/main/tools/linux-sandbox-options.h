@@ -34,6 +34,10 @@ struct Options {
   const char *stdout_path;
   // Where to redirect stderr (-L)
   const char *stderr_path;
+  // Where to write the resource usage of the child (-s)
+  const char *stats_path;
+  // Where to write the time the steps of the sandbox took (-p)
+  const char *timings_path;
   // Files or directories to make writable for the sandboxed process (-w)
   std::vector<const char *> writable_files;
   // Files or directories to make inaccessible for the sandboxed process (-i)
@@ -42,18 +46,44 @@ struct Options {
   std::vector<const char *> tmpfs_dirs;
   // Files or directories to explicitly bind mount into the sandbox (-b)
   std::vector<const char *> bind_mounts;
+  // The inputs to create in the working directory (-M)
+  const char *input_manifest;
+  // The size of the tmpfs that takes the writes to the working directory (-x)
+  const char *scratch_size;
+  // The outputs to copy from that tmpfs to the working directory (-O)
+  std::vector<const char *> outputs;
+  // Where to write what the command changed in the working directory (-F)
+  const char *changes_path;
+  // Where to write the inputs of -M the command opened (-A)
+  const char *accesses_path;
   // Create a new network namespace (-N)
   bool create_netns;
   // Pretend to be root inside the namespace (-R)
   bool fake_root;
   // Print debugging messages (-D)
   bool debug;
+  // Run the command through the sandbox daemon of this name (-d)
+  const char *daemon_name;
+  // The cgroup v2 to create the cgroup of the command in (-G)
+  const char *cgroup_parent;
+  // Settings of the cgroup of the command, "<file>=<value>" (-g)
+  std::vector<const char *> cgroup_settings;
+  // The socket to serve the input swaps of a persistent worker on (-I)
+  const char *worker_socket;
+  // The CPUs to run the command on (-c)
+  std::vector<int> cpus;
+  // The NUMA node to allocate the memory of the command on, or -1 (-m)
+  int numa_node;
   // Command to run (--)
   std::vector<char *> args;
 };
 
 extern struct Options opt;
 
+// The most CPUs and NUMA nodes of -c and -m.
+const int kMaxCpus = 1024;
+const int kMaxNumaNodes = 1024;
+
 void ParseOptions(int argc, char *argv[]);
 
 #endif
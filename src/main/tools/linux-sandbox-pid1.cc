@@ -14,7 +14,10 @@
 
 /**
  * This is PID 1 inside the sandbox environment and runs in a separate user,
- * mount, UTS, IPC and PID namespace.
+ * mount, UTS, IPC and PID namespace. Under the sandbox daemon, the user
+ * namespace and the read-only bind mount of / are the daemon's, see
+ * SetupSandboxTemplate(). For a persistent worker (-I), it also swaps the
+ * inputs of the worker between requests, see ServeWorker().
  */
 
 #include "linux-sandbox-options.h"
@@ -32,31 +35,116 @@
     _exit(EXIT_FAILURE);                                 \
   }
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
 #include <math.h>
 #include <mntent.h>
 #include <net/if.h>
+#include <poll.h>
 #include <pwd.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
+#include <sys/fanotify.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/statvfs.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// mount_setattr(2) is new in Linux 5.12; older headers do not know it.
+#ifndef SYS_mount_setattr
+#define SYS_mount_setattr 442
+#endif
+#ifndef MOUNT_ATTR_RDONLY
+#define MOUNT_ATTR_RDONLY 0x00000001
+#endif
+#ifndef AT_RECURSIVE
+#define AT_RECURSIVE 0x8000
+#endif
+// open_tree(2) and move_mount(2) are new in Linux 5.2.
+#ifndef SYS_open_tree
+#define SYS_open_tree 428
+#endif
+#ifndef SYS_move_mount
+#define SYS_move_mount 429
+#endif
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE 1
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+// fanotify file ids are new in Linux 5.1.
+#ifndef FAN_REPORT_FID
+#define FAN_REPORT_FID 0x00000200
+#endif
+#ifndef FAN_EVENT_INFO_TYPE_FID
+#define FAN_EVENT_INFO_TYPE_FID 1
+#endif
+// The mode of set_mempolicy(2), from <linux/mempolicy.h>.
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+// The struct fanotify_event_info_fid of a fanotify event with
+// FAN_REPORT_FID, which older headers do not know, up to the struct
+// file_handle.
+struct FanotifyFidInfo {
+  uint8_t info_type;
+  uint8_t pad;
+  uint16_t len;
+  int32_t fsid[2];
+  uint32_t handle_bytes;
+  int32_t handle_type;
+};
+
+// The struct mount_attr of mount_setattr(2).
+struct MountAttr {
+  uint64_t attr_set;
+  uint64_t attr_clr;
+  uint64_t propagation;
+  uint64_t userns_fd;
+};
+
 static int global_child_pid;
 static char global_inaccessible_directory[] = "tmp/empty.XXXXXX";
 static char global_inaccessible_file[] = "tmp/empty.XXXXXX";
+// The working directory below the scratch tmpfs (-x), which the outputs are
+// copied to, or -1.
+static int global_working_dir_fd = -1;
+// The upper directory of the overlay mount on the working directory, which
+// holds what the command changed in it, or -1 (-F).
+static int global_upper_dir_fd = -1;
+// The fanotify group that sees the inputs of -M being opened, or -1 if they
+// are not traced (-A).
+static int global_fanotify_fd = -1;
+// The inputs of -M that are traced, by the file id of what they link to (see
+// FileId()), and those that are not (directories), which count as opened.
+static std::unordered_map<std::string, std::vector<std::string>>
+    global_traced_inputs;
+static std::vector<std::string> global_untraced_inputs;
+// The working directory below the tmpfs of a persistent worker (-I), whose
+// entries are the first inputs of the worker, or -1.
+static int global_worker_inputs_fd = -1;
 
 static void SetupSelfDestruction(int *sync_pipe) {
   // We could also poll() on the pipe fd to find out when the parent goes away,
@@ -228,10 +316,305 @@ static int CreateTarget(const char *path, bool is_directory) {
   return 0;
 }
 
-static void MountFilesystems() {
+static bool IsUnderTmpDir(const char *mnt_dir) {
+  for (const char *tmpfs_dir : opt.tmpfs_dirs) {
+    if (strstr(mnt_dir, tmpfs_dir) == mnt_dir) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns where to create the mount point for 'path' inside the sandbox root,
+// relative to it. Under the sandbox daemon, the sandbox root is read-only
+// already, so the mount point is created through the real filesystem instead,
+// unless it is on one of the new tmpfs instances.
+static const char *MountPointToCreate(const char *path) {
+  if (opt.daemon_name != NULL && !IsUnderTmpDir(path)) {
+    return path;
+  }
+  return path + 1;
+}
+
+static void MountRoot() {
   if (mount("/", opt.sandbox_root_dir, NULL, MS_BIND | MS_REC, NULL) < 0) {
     DIE("mount(/, %s, NULL, MS_BIND | MS_REC, NULL)", opt.sandbox_root_dir);
   }
+}
+
+// Creates the parent directories of 'path', relative to 'dir_fd', that are not
+// in 'dirs' yet.
+static void CreateParentDirectories(int dir_fd, const std::string &path,
+                                    std::unordered_set<std::string> *dirs) {
+  size_t last_slash = path.rfind('/');
+  if (last_slash == std::string::npos || dirs->count(path.substr(0, last_slash))) {
+    return;
+  }
+  for (size_t slash = path.find('/'); slash != std::string::npos;
+       slash = path.find('/', slash + 1)) {
+    std::string dir = path.substr(0, slash);
+    if (dirs->insert(dir).second && mkdirat(dir_fd, dir.c_str(), 0755) < 0 &&
+        errno != EEXIST) {
+      DIE("mkdirat(%s)", dir.c_str());
+    }
+  }
+}
+
+// Creates the symlinks of the input manifest (-M) below 'dir_fd', and their
+// parent directories. Every path is one system call, relative to 'dir_fd'.
+// Starts tracing the opens of the inputs of -M (-A), see TraceInput(). Where
+// fanotify does not work without privileges (before Linux 5.13), the opens are
+// not traced.
+static void StartTracingInputs() {
+  global_fanotify_fd = fanotify_init(
+      FAN_CLASS_NOTIF | FAN_REPORT_FID | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY);
+  if (global_fanotify_fd < 0) {
+    PRINT_DEBUG("fanotify_init: %s", strerror(errno));
+  }
+}
+
+static void StopTracingInputs() {
+  close(global_fanotify_fd);
+  global_fanotify_fd = -1;
+  global_traced_inputs.clear();
+  global_untraced_inputs.clear();
+}
+
+// Returns the id fanotify reports the file at 'path' by: the id of its file
+// system followed by its file handle.
+static bool FileId(const char *path, std::string *id) {
+  struct statfs sfs;
+  if (statfs(path, &sfs) < 0) {
+    return false;
+  }
+  union {
+    struct file_handle handle;
+    char buf[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+  } fh;
+  fh.handle.handle_bytes = MAX_HANDLE_SZ;
+  int mount_id;
+  if (name_to_handle_at(AT_FDCWD, path, &fh.handle, &mount_id,
+                        AT_SYMLINK_FOLLOW) < 0) {
+    return false;
+  }
+  id->assign(reinterpret_cast<const char *>(&sfs.f_fsid), sizeof(sfs.f_fsid));
+  id->append(reinterpret_cast<const char *>(&fh.handle.handle_type),
+             sizeof(fh.handle.handle_type));
+  id->append(reinterpret_cast<const char *>(fh.handle.f_handle),
+             fh.handle.handle_bytes);
+  return true;
+}
+
+// Marks the file the input 'link' is a symlink to, 'target', so that the
+// fanotify group of StartTracingInputs() sees it being opened. The mark is on
+// the file, not on the sandbox, so opens from outside the sandbox count, too.
+// If the file cannot be marked (e.g. once there are fs.fanotify.max_user_marks
+// of them), none of the opens are traced.
+static void TraceInput(const std::string &link, const char *target) {
+  if (global_fanotify_fd < 0) {
+    return;
+  }
+  struct stat sb;
+  if (stat(target, &sb) < 0 || S_ISDIR(sb.st_mode)) {
+    // Opening the files below a directory does not open the directory.
+    global_untraced_inputs.push_back(link);
+    return;
+  }
+  std::string id;
+  if (!FileId(target, &id) ||
+      fanotify_mark(global_fanotify_fd, FAN_MARK_ADD, FAN_OPEN, AT_FDCWD,
+                    target) < 0) {
+    PRINT_DEBUG("cannot trace %s: %s", target, strerror(errno));
+    StopTracingInputs();
+    return;
+  }
+  global_traced_inputs[id].push_back(link);
+}
+
+static void CreateInputs(int dir_fd) {
+  FILE *manifest = fopen(opt.input_manifest, "r");
+  if (manifest == NULL) {
+    DIE("fopen(%s)", opt.input_manifest);
+  }
+
+  std::unordered_set<std::string> created_dirs;
+  std::string link;
+  bool have_link = false;
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  while ((length = getline(&line, &capacity, manifest)) >= 0) {
+    if (length > 0 && line[length - 1] == '\n') {
+      line[--length] = '\0';
+    }
+    if (!have_link) {
+      link.assign(line, length);
+      have_link = true;
+      continue;
+    }
+    have_link = false;
+    CreateParentDirectories(dir_fd, link, &created_dirs);
+    if (symlinkat(line, dir_fd, link.c_str()) < 0) {
+      DIE("symlinkat(%s, %s)", line, link.c_str());
+    }
+    TraceInput(link, line);
+  }
+  if (ferror(manifest)) {
+    DIE("getline(%s)", opt.input_manifest);
+  }
+  if (have_link) {
+    errno = EINVAL;
+    DIE("%s lacks the target of %s", opt.input_manifest, link.c_str());
+  }
+  free(line);
+  fclose(manifest);
+}
+
+// Returns whether 'path' can go into the options of an overlay mount.
+static bool IsOverlayPath(const std::string &path) {
+  return path.find_first_of(",:\\") == std::string::npos;
+}
+
+// Creates the inputs of the manifest (-M) below the directory 'dir'.
+static void CreateInputsIn(const char *dir) {
+  int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    DIE("open(%s)", dir);
+  }
+  CreateInputs(dir_fd);
+  if (close(dir_fd) < 0) {
+    DIE("close(%s)", dir);
+  }
+}
+
+// Puts an overlay mount on the working directory, for the inputs of the
+// manifest (-M) and for the scratch tmpfs (-x). The inputs go into a new
+// directory on the tmpfs of /tmp, the lowest layer, so that they never touch
+// the disk and go away with the sandbox. With -x, the writes go to a tmpfs of
+// that size, on top of the working directory itself, and only the outputs
+// (-O) make it to the disk, see CopyOutputs(); without, the working directory
+// is the upper layer. Where overlayfs is not available (in user namespaces, it
+// is since Linux 5.11), the inputs go into the working directory itself, and
+// so do the writes.
+static void MountWorkingDirectory() {
+  std::string layer_dir;
+  if (opt.input_manifest != NULL) {
+    char layer[] = "tmp/inputs.XXXXXX";
+    if (mkdtemp(layer) == NULL) {
+      DIE("mkdtemp(%s)", layer);
+    }
+    layer_dir = std::string(opt.sandbox_root_dir) + "/" + layer;
+  }
+
+  std::string lower_dir, upper_dir, work_dir;
+  if (opt.scratch_size != NULL) {
+    char scratch[] = "tmp/scratch.XXXXXX";
+    std::string size = std::string("size=") + opt.scratch_size;
+    if (mkdtemp(scratch) == NULL) {
+      DIE("mkdtemp(%s)", scratch);
+    }
+    if (mount("tmpfs", scratch, "tmpfs", MS_NOSUID | MS_NODEV | MS_NOATIME,
+              size.c_str()) < 0) {
+      DIE("mount(tmpfs, %s, tmpfs, MS_NOSUID | MS_NODEV | MS_NOATIME, %s)",
+          scratch, size.c_str());
+    }
+    // The root of the overlay mount has the mode of the upper directory.
+    struct stat sb;
+    if (stat(opt.working_dir, &sb) < 0) {
+      DIE("stat(%s)", opt.working_dir);
+    }
+    upper_dir = std::string(opt.sandbox_root_dir) + "/" + scratch + "/upper";
+    work_dir = std::string(opt.sandbox_root_dir) + "/" + scratch + "/work";
+    if (mkdir(upper_dir.c_str(), sb.st_mode & 07777) < 0 ||
+        chmod(upper_dir.c_str(), sb.st_mode & 07777) < 0) {
+      DIE("mkdir(%s)", upper_dir.c_str());
+    }
+    if (mkdir(work_dir.c_str(), 0700) < 0) {
+      DIE("mkdir(%s)", work_dir.c_str());
+    }
+    lower_dir = layer_dir.empty() ? std::string(opt.working_dir)
+                                  : layer_dir + ":" + opt.working_dir;
+  } else {
+    lower_dir = layer_dir;
+    upper_dir = opt.working_dir;
+    work_dir = std::string(dirname(strdupa(opt.working_dir))) +
+               "/overlay-work.XXXXXX";
+    if (mkdtemp(&work_dir[0]) == NULL) {
+      PRINT_DEBUG("mkdtemp(%s): %s", work_dir.c_str(), strerror(errno));
+      work_dir.clear();
+    }
+  }
+
+  if (!work_dir.empty() && IsOverlayPath(layer_dir) &&
+      IsOverlayPath(opt.working_dir) && IsOverlayPath(work_dir)) {
+    if (!layer_dir.empty()) {
+      CreateInputsIn(layer_dir.c_str());
+    }
+    if (opt.scratch_size != NULL) {
+      global_working_dir_fd =
+          open(opt.working_dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+      if (global_working_dir_fd < 0) {
+        DIE("open(%s)", opt.working_dir);
+      }
+    }
+    if (global_changes_fd >= 0) {
+      global_upper_dir_fd =
+          open(upper_dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+      if (global_upper_dir_fd < 0) {
+        DIE("open(%s)", upper_dir.c_str());
+      }
+    }
+
+    std::string options = "lowerdir=" + lower_dir + ",upperdir=" + upper_dir +
+                          ",workdir=" + work_dir;
+    PRINT_DEBUG("working dir: overlay %s", options.c_str());
+    if (mount("overlay", opt.working_dir + 1, "overlay", 0, options.c_str()) ==
+        0) {
+      return;
+    }
+    PRINT_DEBUG("mount(overlay, %s, overlay, 0, %s): %s", opt.working_dir + 1,
+                options.c_str(), strerror(errno));
+    if (global_working_dir_fd >= 0) {
+      close(global_working_dir_fd);
+      global_working_dir_fd = -1;
+    }
+    if (global_upper_dir_fd >= 0) {
+      close(global_upper_dir_fd);
+      global_upper_dir_fd = -1;
+    }
+  }
+  if (opt.scratch_size == NULL && !work_dir.empty()) {
+    rmdir(work_dir.c_str());
+  }
+
+  if (opt.input_manifest != NULL) {
+    PRINT_DEBUG("inputs: %s", opt.working_dir);
+    CreateInputsIn(opt.working_dir + 1);
+  }
+}
+
+// Puts a tmpfs on the working directory of a persistent worker (-I). The
+// worker keeps it as its working directory for as long as it runs, while the
+// inputs of each request are mounted in it, see MountInputs(). The first ones
+// are the entries of the working directory itself.
+static void MountWorkerDirectory() {
+  global_worker_inputs_fd =
+      open(opt.working_dir + 1, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (global_worker_inputs_fd < 0) {
+    DIE("open(%s)", opt.working_dir + 1);
+  }
+  PRINT_DEBUG("worker dir: tmpfs %s", opt.working_dir);
+  if (mount("tmpfs", opt.working_dir + 1, "tmpfs",
+            MS_NOSUID | MS_NODEV | MS_NOATIME, NULL) < 0) {
+    DIE("mount(tmpfs, %s, tmpfs, MS_NOSUID | MS_NODEV | MS_NOATIME, NULL)",
+        opt.working_dir + 1);
+  }
+}
+
+static void MountFilesystems() {
+  if (opt.daemon_name == NULL) {
+    MountRoot();
+  }
 
   if (chdir(opt.sandbox_root_dir) < 0) {
     DIE("chdir(%s)", opt.sandbox_root_dir);
@@ -249,15 +632,25 @@ static void MountFilesystems() {
   // Make sure that our working directory is a mount point. The easiest way to
   // do this is by bind-mounting it upon itself.
   PRINT_DEBUG("working dir: %s", opt.working_dir);
-  CreateTarget(opt.working_dir + 1, true);
+  CreateTarget(MountPointToCreate(opt.working_dir), true);
   if (mount(opt.working_dir, opt.working_dir + 1, NULL, MS_BIND, NULL) < 0) {
     DIE("mount(%s, %s, NULL, MS_BIND, NULL)", opt.working_dir,
         opt.working_dir + 1);
   }
 
+  if (global_accesses_fd >= 0) {
+    StartTracingInputs();
+  }
+  if (opt.input_manifest != NULL || opt.scratch_size != NULL) {
+    MountWorkingDirectory();
+  }
+  if (opt.worker_socket != NULL) {
+    MountWorkerDirectory();
+  }
+
   for (const char *bind_mount : opt.bind_mounts) {
     PRINT_DEBUG("bind mount: %s", bind_mount);
-    CreateTarget(bind_mount + 1, IsDirectory(bind_mount));
+    CreateTarget(MountPointToCreate(bind_mount), IsDirectory(bind_mount));
     if (mount(bind_mount, bind_mount + 1, NULL, MS_BIND, NULL) < 0) {
       DIE("mount(%s, %s, NULL, MS_BIND, NULL)", bind_mount, bind_mount + 1);
     }
@@ -302,7 +695,8 @@ static void MountFilesystems() {
 static bool ShouldBeWritable(char *mnt_dir) {
   mnt_dir += strlen(opt.sandbox_root_dir);
 
-  if (strcmp(mnt_dir, opt.working_dir) == 0) {
+  // There is no working directory yet while setting up the sandbox daemon.
+  if (opt.working_dir != NULL && strcmp(mnt_dir, opt.working_dir) == 0) {
     return true;
   }
 
@@ -321,18 +715,62 @@ static bool ShouldBeWritable(char *mnt_dir) {
   return false;
 }
 
-static bool IsUnderTmpDir(const char *mnt_dir) {
-  for (const char *tmpfs_dir : opt.tmpfs_dirs) {
-    if (strstr(mnt_dir, tmpfs_dir) == mnt_dir) {
-      return true;
+// Sets the MOUNT_ATTR_* flags 'attr_set' and clears 'attr_clr' on the mount
+// at 'path', and with AT_RECURSIVE in 'flags' on all the mounts below it, too.
+// Either all of them change, or none does.
+static int MountSetattr(const char *path, unsigned int flags,
+                        uint64_t attr_set, uint64_t attr_clr) {
+  struct MountAttr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.attr_set = attr_set;
+  attr.attr_clr = attr_clr;
+  return syscall(SYS_mount_setattr, AT_FDCWD, path, flags, &attr,
+                 sizeof(attr));
+}
+
+static void MakeWritable(const char *path) {
+  std::string mnt_dir = std::string(opt.sandbox_root_dir) + path;
+  PRINT_DEBUG("remount rw: %s", mnt_dir.c_str());
+  if (MountSetattr(mnt_dir.c_str(), 0, 0, MOUNT_ATTR_RDONLY) < 0) {
+    // See MakeFilesystemMostlyReadOnly() for why these are fine.
+    if (errno != EACCES && errno != EINVAL) {
+      DIE("mount_setattr(%s, 0, 0, MOUNT_ATTR_RDONLY)", mnt_dir.c_str());
     }
   }
-  return false;
+}
+
+// Like MakeFilesystemMostlyReadOnly(), but with a single mount_setattr(2) for
+// all the mounts in the sandbox, rather than one remount for each, then one for
+// each writable path. Returns false if the kernel does not support this.
+static bool MakeFilesystemMostlyReadOnlyAtOnce() {
+  if (MountSetattr(opt.sandbox_root_dir, AT_RECURSIVE, MOUNT_ATTR_RDONLY, 0) <
+      0) {
+    PRINT_DEBUG("mount_setattr(%s, AT_RECURSIVE, MOUNT_ATTR_RDONLY): %s",
+                opt.sandbox_root_dir, strerror(errno));
+    return false;
+  }
+
+  // These are all mount points, which MountFilesystems() created: making a
+  // path that is not one writable would make the mount it is on writable.
+  if (opt.working_dir != NULL) {
+    MakeWritable(opt.working_dir);
+  }
+  for (const char *writable_file : opt.writable_files) {
+    MakeWritable(writable_file);
+  }
+  for (const char *tmpfs_dir : opt.tmpfs_dirs) {
+    MakeWritable(tmpfs_dir);
+  }
+  return true;
 }
 
 // Makes the whole filesystem read-only, except for the paths for which
 // ShouldBeWritable returns true.
 static void MakeFilesystemMostlyReadOnly() {
+  if (MakeFilesystemMostlyReadOnlyAtOnce()) {
+    return;
+  }
+
   FILE *mounts = setmntent("/proc/self/mounts", "r");
   if (mounts == NULL) {
     DIE("setmntent");
@@ -400,6 +838,52 @@ static void MakeFilesystemMostlyReadOnly() {
   endmntent(mounts);
 }
 
+// Remounts the bind mount on 'path' read-only or writable, keeping the flags
+// remounting does not allow to change.
+static void RemountBind(const char *path, bool read_only) {
+  struct statvfs sv;
+  if (statvfs(path, &sv) < 0) {
+    DIE("statvfs(%s)", path);
+  }
+
+  int mountFlags = MS_BIND | MS_REMOUNT | (read_only ? MS_RDONLY : 0);
+  if (sv.f_flag & ST_NODEV) {
+    mountFlags |= MS_NODEV;
+  }
+  if (sv.f_flag & ST_NOEXEC) {
+    mountFlags |= MS_NOEXEC;
+  }
+  if (sv.f_flag & ST_NOSUID) {
+    mountFlags |= MS_NOSUID;
+  }
+  if (sv.f_flag & ST_NOATIME) {
+    mountFlags |= MS_NOATIME;
+  }
+  if (sv.f_flag & ST_NODIRATIME) {
+    mountFlags |= MS_NODIRATIME;
+  }
+  if (sv.f_flag & ST_RELATIME) {
+    mountFlags |= MS_RELATIME;
+  }
+
+  PRINT_DEBUG("remount %s: %s", read_only ? "ro" : "rw", path);
+  if (mount(NULL, path, NULL, mountFlags, NULL) < 0) {
+    DIE("remount(NULL, %s, NULL, %d, NULL)", path, mountFlags);
+  }
+}
+
+// Under the sandbox daemon, everything but the mounts MountFilesystems() added
+// is read-only already. Of those, makes the ones read-only that
+// MakeFilesystemMostlyReadOnly() would.
+static void MakeBindMountsReadOnly() {
+  for (const char *bind_mount : opt.bind_mounts) {
+    RemountBind(bind_mount + 1, true);
+  }
+  for (const char *inaccessible_file : opt.inaccessible_files) {
+    RemountBind(inaccessible_file + 1, true);
+  }
+}
+
 static void MountProc() {
   // Mount a new proc on top of the old one, because the old one still refers to
   // our parent PID namespace.
@@ -409,34 +893,38 @@ static void MountProc() {
   }
 }
 
-static void SetupNetworking() {
-  // When running in a separate network namespace, enable the loopback interface
-  // because some application may want to use it.
-  if (opt.create_netns) {
-    int fd;
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-      DIE("socket");
-    }
+void SetupLoopback() {
+  int fd;
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    DIE("socket");
+  }
 
-    struct ifreq ifr;
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(ifr.ifr_name, "lo", IF_NAMESIZE);
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, "lo", IF_NAMESIZE);
 
-    // Verify that name is valid.
-    if (if_nametoindex(ifr.ifr_name) == 0) {
-      DIE("if_nametoindex");
-    }
+  // Verify that name is valid.
+  if (if_nametoindex(ifr.ifr_name) == 0) {
+    DIE("if_nametoindex");
+  }
 
-    // Enable the interface.
-    ifr.ifr_flags |= IFF_UP;
-    if (ioctl(fd, SIOCSIFFLAGS, &ifr) < 0) {
-      DIE("ioctl");
-    }
+  // Enable the interface.
+  ifr.ifr_flags |= IFF_UP;
+  if (ioctl(fd, SIOCSIFFLAGS, &ifr) < 0) {
+    DIE("ioctl");
+  }
 
-    if (close(fd) < 0) {
-      DIE("close");
-    }
+  if (close(fd) < 0) {
+    DIE("close");
+  }
+}
+
+static void SetupNetworking() {
+  // When running in a separate network namespace, enable the loopback interface
+  // because some application may want to use it.
+  if (opt.create_netns) {
+    SetupLoopback();
   }
 }
 
@@ -495,9 +983,8 @@ static void InstallSignalHandler(int signum, void (*handler)(int)) {
 
 static void IgnoreSignal(int signum) { InstallSignalHandler(signum, SIG_IGN); }
 
-// Reset the signal mask and restore the default handler for all signals.
-static void RestoreSignalHandlersAndMask() {
-  // Use an empty signal mask for the process (= unblock all signals).
+// Use an empty signal mask for the process (= unblock all signals).
+static void ClearSignalMask() {
   sigset_t empty_set;
   if (sigemptyset(&empty_set) < 0) {
     DIE("sigemptyset");
@@ -505,19 +992,6 @@ static void RestoreSignalHandlersAndMask() {
   if (sigprocmask(SIG_SETMASK, &empty_set, nullptr) < 0) {
     DIE("sigprocmask(SIG_SETMASK, <empty set>, nullptr)");
   }
-
-  // Set the default signal handler for all signals.
-  struct sigaction sa;
-  memset(&sa, 0, sizeof(sa));
-  if (sigemptyset(&sa.sa_mask) < 0) {
-    DIE("sigemptyset");
-  }
-  sa.sa_handler = SIG_DFL;
-  for (int i = 1; i < NSIG; ++i) {
-    // Ignore possible errors, because we might not be allowed to set the
-    // handler for certain signals, but we still want to try.
-    sigaction(i, &sa, nullptr);
-  }
 }
 
 static void ForwardSignal(int signum) {
@@ -525,8 +999,10 @@ static void ForwardSignal(int signum) {
   kill(-global_child_pid, signum);
 }
 
+// Sets the handler of every signal, one sigaction() each: whatever we
+// inherited is replaced, so there is no need to restore the defaults first.
 static void SetupSignalHandlers() {
-  RestoreSignalHandlersAndMask();
+  ClearSignalMask();
 
   for (int signum = 1; signum < NSIG; signum++) {
     switch (signum) {
@@ -539,10 +1015,10 @@ static void SetupSignalHandlers() {
       case SIGSEGV:
       case SIGSYS:
       case SIGTRAP:
-        break;
       // It's fine to use the default handler for SIGCHLD, because we use
       // waitpid() in the main loop to wait for children to die anyway.
       case SIGCHLD:
+        InstallSignalHandler(signum, SIG_DFL);
         break;
       // One does not simply install a signal handler for these two signals
       case SIGKILL:
@@ -562,7 +1038,34 @@ static void SetupSignalHandlers() {
   }
 }
 
+// Pins the calling process, and all the processes it starts, to the CPUs of
+// -c, and has their memory allocated on the NUMA node of -m.
+static void SetupPlacement() {
+  if (!opt.cpus.empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : opt.cpus) {
+      CPU_SET(cpu, &cpus);
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+      DIE("sched_setaffinity");
+    }
+  }
+  if (opt.numa_node >= 0) {
+    unsigned long nodes[kMaxNumaNodes / (8 * sizeof(unsigned long))] = {0};
+    const int kBits = 8 * sizeof(nodes[0]);
+    nodes[opt.numa_node / kBits] |= 1UL << (opt.numa_node % kBits);
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes, kMaxNumaNodes) < 0) {
+      DIE("set_mempolicy(MPOL_PREFERRED, %d)", opt.numa_node);
+    }
+  }
+}
+
 static void SpawnChild() {
+  // argv[] passed to execve() must be a null-terminated array. This is done
+  // before fork(), so that the child does not have to allocate.
+  opt.args.push_back(nullptr);
+
   global_child_pid = fork();
 
   if (global_child_pid < 0) {
@@ -578,15 +1081,17 @@ static void SpawnChild() {
       DIE("tcsetpgrp")
     }
 
-    // Unblock all signals, restore default handlers.
-    RestoreSignalHandlersAndMask();
+    // Restore the default handlers. execvp() does that for the signals we
+    // forward, so only the ones we ignore are left. The signal mask is empty
+    // already, see SetupSignalHandlers().
+    InstallSignalHandler(SIGTTIN, SIG_DFL);
+    InstallSignalHandler(SIGTTOU, SIG_DFL);
 
     // Force umask to include read and execute for everyone, to make output
     // permissions predictable.
     umask(022);
 
-    // argv[] passed to execve() must be a null-terminated array.
-    opt.args.push_back(nullptr);
+    SetupPlacement();
 
     if (execvp(opt.args[0], opt.args.data()) < 0) {
       DIE("execvp(%s, %p)", opt.args[0], opt.args.data());
@@ -594,6 +1099,486 @@ static void SpawnChild() {
   }
 }
 
+// Copies the regular file 'path' from 'src_dir_fd' to 'dst_dir_fd'. The copy
+// goes to a temporary file first, which then replaces the destination, so that
+// copying a file onto itself does not truncate it.
+static void CopyFile(int src_dir_fd, int dst_dir_fd, const std::string &path,
+                     mode_t mode) {
+  std::string tmp_path = path + ".linux-sandbox-tmp";
+  int src_fd = openat(src_dir_fd, path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src_fd < 0) {
+    DIE("openat(%s)", path.c_str());
+  }
+  int dst_fd = openat(dst_dir_fd, tmp_path.c_str(),
+                      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (dst_fd < 0) {
+    DIE("openat(%s)", tmp_path.c_str());
+  }
+
+  // copy_file_range(2) copies in the kernel, but not between all kinds of
+  // filesystems; read(2) and write(2) do.
+  bool in_kernel = true;
+  while (true) {
+    ssize_t copied;
+    if (in_kernel) {
+      copied = copy_file_range(src_fd, NULL, dst_fd, NULL, 1 << 30, 0);
+      if (copied < 0 && (errno == EXDEV || errno == EINVAL ||
+                         errno == ENOSYS || errno == EOPNOTSUPP)) {
+        in_kernel = false;
+        continue;
+      }
+    } else {
+      char buffer[64 * 1024];
+      copied = read(src_fd, buffer, sizeof(buffer));
+      for (ssize_t written = 0, n; written < copied; written += n) {
+        n = write(dst_fd, buffer + written, copied - written);
+        if (n < 0) {
+          if (errno == EINTR) {
+            n = 0;
+            continue;
+          }
+          DIE("write(%s)", tmp_path.c_str());
+        }
+      }
+    }
+    if (copied == 0) {
+      break;
+    }
+    if (copied < 0 && errno != EINTR) {
+      DIE("copying %s", path.c_str());
+    }
+  }
+
+  if (fchmod(dst_fd, mode & 07777) < 0) {
+    DIE("fchmod(%s)", tmp_path.c_str());
+  }
+  if (close(dst_fd) < 0) {
+    DIE("close(%s)", tmp_path.c_str());
+  }
+  close(src_fd);
+  if (renameat(dst_dir_fd, tmp_path.c_str(), dst_dir_fd, path.c_str()) < 0) {
+    DIE("renameat(%s, %s)", tmp_path.c_str(), path.c_str());
+  }
+}
+
+// Copies the file, symlink or directory 'path' from 'src_dir_fd' to
+// 'dst_dir_fd', with everything below it. 'dirs' are the directories that
+// exist below 'dst_dir_fd' already.
+static void CopyOutput(int src_dir_fd, int dst_dir_fd, const std::string &path,
+                       std::unordered_set<std::string> *dirs) {
+  struct stat sb;
+  if (fstatat(src_dir_fd, path.c_str(), &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+    if (errno == ENOENT || errno == ENOTDIR) {
+      PRINT_DEBUG("output %s was not created", path.c_str());
+      return;
+    }
+    DIE("fstatat(%s)", path.c_str());
+  }
+  CreateParentDirectories(dst_dir_fd, path, dirs);
+
+  if (S_ISDIR(sb.st_mode)) {
+    if (mkdirat(dst_dir_fd, path.c_str(), sb.st_mode & 07777) < 0 &&
+        errno != EEXIST) {
+      DIE("mkdirat(%s)", path.c_str());
+    }
+    dirs->insert(path);
+    int dir_fd =
+        openat(src_dir_fd, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = dir_fd < 0 ? NULL : fdopendir(dir_fd);
+    if (dir == NULL) {
+      DIE("opendir(%s)", path.c_str());
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+        CopyOutput(src_dir_fd, dst_dir_fd, path + "/" + entry->d_name, dirs);
+      }
+    }
+    closedir(dir);
+  } else if (S_ISLNK(sb.st_mode)) {
+    std::string target(sb.st_size + 1, '\0');
+    ssize_t length =
+        readlinkat(src_dir_fd, path.c_str(), &target[0], target.size());
+    if (length < 0 || length > sb.st_size) {
+      DIE("readlinkat(%s)", path.c_str());
+    }
+    target.resize(length);
+    if (unlinkat(dst_dir_fd, path.c_str(), 0) < 0 && errno != ENOENT) {
+      DIE("unlinkat(%s)", path.c_str());
+    }
+    if (symlinkat(target.c_str(), dst_dir_fd, path.c_str()) < 0) {
+      DIE("symlinkat(%s, %s)", target.c_str(), path.c_str());
+    }
+  } else if (S_ISREG(sb.st_mode)) {
+    CopyFile(src_dir_fd, dst_dir_fd, path, sb.st_mode);
+  } else {
+    PRINT_DEBUG("output %s is not a file, symlink or directory", path.c_str());
+  }
+}
+
+// Kills and reaps what is left of the processes in the sandbox.
+static void KillAllProcesses() {
+  kill(-1, SIGKILL);
+  while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {
+  }
+}
+
+// Copies the outputs (-O) from the scratch tmpfs of MountWorkingDirectory() to
+// the working directory below it; the rest of what the command wrote goes away
+// with the sandbox. What is left of the processes in the sandbox is killed and
+// reaped first, so that nothing changes the outputs meanwhile.
+static void CopyOutputs() {
+  if (global_working_dir_fd < 0) {
+    return;
+  }
+  KillAllProcesses();
+
+  std::unordered_set<std::string> dirs;
+  for (const char *output : opt.outputs) {
+    PRINT_DEBUG("output: %s", output);
+    CopyOutput(AT_FDCWD, global_working_dir_fd, output, &dirs);
+  }
+  EndStep("copy_outputs");
+}
+
+// Writes a line "<type> <path>" to 'out' for 'path' below 'dir_fd', and for
+// everything below it if it is a directory, see WriteChanges().
+static void WriteChange(int dir_fd, const std::string &path, FILE *out) {
+  struct stat sb;
+  if (fstatat(dir_fd, path.c_str(), &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+    DIE("fstatat(%s)", path.c_str());
+  }
+  if (S_ISREG(sb.st_mode)) {
+    fprintf(out, "f %s\n", path.c_str());
+  } else if (S_ISLNK(sb.st_mode)) {
+    fprintf(out, "l %s\n", path.c_str());
+  } else if (S_ISCHR(sb.st_mode) && sb.st_rdev == 0) {
+    // A whiteout: the command deleted the entry of a lower layer.
+    fprintf(out, "x %s\n", path.c_str());
+  } else if (!S_ISDIR(sb.st_mode)) {
+    PRINT_DEBUG("change %s is not a file, symlink or directory",
+                path.c_str());
+  } else {
+    fprintf(out, "d %s\n", path.c_str());
+    int fd = openat(dir_fd, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+      DIE("opendir(%s)", path.c_str());
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+        WriteChange(dir_fd, path + "/" + entry->d_name, out);
+      }
+    }
+    closedir(dir);
+  }
+}
+
+// Writes what the command changed in the working directory to the file of -F:
+// the entries of the upper directory of the overlay mount, which are exactly
+// the files the command created or changed, the directories they are in, and
+// the whiteouts of what it deleted (with -M and without -x, they also include
+// what was in the working directory before). The writable paths (-w) in the
+// working directory are mounted over the overlay mount, so everything in them
+// counts as changed. Bazel then only looks at those rather than at the whole
+// tree. Without the overlay mount, the file stays without its last line ".",
+// and Bazel looks at the whole tree.
+static void WriteChanges() {
+  if (global_upper_dir_fd < 0) {
+    return;
+  }
+  KillAllProcesses();
+
+  FILE *out = fdopen(global_changes_fd, "w");
+  if (out == NULL) {
+    DIE("fdopen(%s)", opt.changes_path);
+  }
+  int upper_fd =
+      openat(global_upper_dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  DIR *upper = upper_fd < 0 ? NULL : fdopendir(upper_fd);
+  if (upper == NULL) {
+    DIE("opendir(upper dir)");
+  }
+  struct dirent *entry;
+  while ((entry = readdir(upper)) != NULL) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+      WriteChange(dirfd(upper), entry->d_name, out);
+    }
+  }
+  closedir(upper);
+
+  std::string prefix = std::string(opt.working_dir) + "/";
+  for (const char *writable_file : opt.writable_files) {
+    if (strncmp(writable_file, prefix.c_str(), prefix.size()) != 0) {
+      continue;
+    }
+    std::string path = writable_file + prefix.size();
+    for (size_t slash = path.find('/'); slash != std::string::npos;
+         slash = path.find('/', slash + 1)) {
+      fprintf(out, "d %s\n", path.substr(0, slash).c_str());
+    }
+    WriteChange(AT_FDCWD, path, out);
+  }
+
+  fprintf(out, ".\n");
+  if (fclose(out) != 0) {
+    DIE("fclose(%s)", opt.changes_path);
+  }
+  EndStep("write_changes");
+}
+
+// Writes the inputs the command opened to the file of -A, from the events of
+// the fanotify group of StartTracingInputs(): there is an event per file, as
+// fanotify merges the events of a file until they are read. If they were too
+// many for its queue, or the opens were not traced, the file stays without its
+// last line ".".
+static void WriteAccesses() {
+  if (global_accesses_fd < 0) {
+    return;
+  }
+  FILE *out = fdopen(global_accesses_fd, "w");
+  if (out == NULL) {
+    DIE("fdopen(%s)", opt.accesses_path);
+  }
+  if (global_fanotify_fd >= 0) {
+    KillAllProcesses();
+    bool overflow = false;
+    alignas(struct fanotify_event_metadata) char buf[65536];
+    ssize_t n;
+    while ((n = read(global_fanotify_fd, buf, sizeof(buf))) > 0) {
+      struct fanotify_event_metadata *event =
+          reinterpret_cast<struct fanotify_event_metadata *>(buf);
+      for (; FAN_EVENT_OK(event, n); event = FAN_EVENT_NEXT(event, n)) {
+        if (event->mask & FAN_Q_OVERFLOW) {
+          overflow = true;
+          continue;
+        }
+        const char *p = reinterpret_cast<const char *>(event);
+        FanotifyFidInfo info;
+        if (event->event_len < event->metadata_len + sizeof(info)) {
+          continue;
+        }
+        memcpy(&info, p + event->metadata_len, sizeof(info));
+        if (info.info_type != FAN_EVENT_INFO_TYPE_FID ||
+            info.len < sizeof(info) + info.handle_bytes) {
+          continue;
+        }
+        std::string id(reinterpret_cast<const char *>(info.fsid),
+                       sizeof(info.fsid));
+        id.append(reinterpret_cast<const char *>(&info.handle_type),
+                  sizeof(info.handle_type));
+        id.append(p + event->metadata_len + sizeof(info), info.handle_bytes);
+        auto inputs = global_traced_inputs.find(id);
+        if (inputs != global_traced_inputs.end()) {
+          for (const std::string &input : inputs->second) {
+            fprintf(out, "%s\n", input.c_str());
+          }
+          global_traced_inputs.erase(inputs);
+        }
+      }
+    }
+    if (n < 0 && errno != EAGAIN) {
+      DIE("read(fanotify)");
+    }
+    if (overflow) {
+      PRINT_DEBUG("the fanotify queue overflowed");
+    } else {
+      for (const std::string &input : global_untraced_inputs) {
+        fprintf(out, "%s\n", input.c_str());
+      }
+      fprintf(out, ".\n");
+    }
+  }
+  if (fclose(out) != 0) {
+    DIE("fclose(%s)", opt.accesses_path);
+  }
+  EndStep("write_accesses");
+}
+
+// Removes the file, symlink or directory 'name' below 'dir_fd', with
+// everything below it.
+static void RemoveTree(int dir_fd, const char *name) {
+  if (unlinkat(dir_fd, name, 0) == 0) {
+    return;
+  }
+  if (errno != EISDIR) {
+    DIE("unlinkat(%s)", name);
+  }
+  int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+  if (dir == NULL) {
+    DIE("opendir(%s)", name);
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+      RemoveTree(dirfd(dir), entry->d_name);
+    }
+  }
+  closedir(dir);
+  if (unlinkat(dir_fd, name, AT_REMOVEDIR) < 0) {
+    DIE("unlinkat(%s)", name);
+  }
+}
+
+// Returns the names of the entries of the directory 'dir_fd', which stays
+// open.
+static std::vector<std::string> ListDirectory(int dir_fd) {
+  int fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+  if (dir == NULL) {
+    DIE("opendir");
+  }
+  std::vector<std::string> names;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  return names;
+}
+
+// Mounts 'name' of the directory 'src_fd' on 'name' in the working directory,
+// writable. A clone of the mount is prepared with open_tree(2), then attached
+// in one go with move_mount(2); older kernels bind mount it instead.
+static void MountInput(int src_fd, const char *name) {
+  int tree_fd = syscall(SYS_open_tree, src_fd, name,
+                        OPEN_TREE_CLONE | O_CLOEXEC | AT_RECURSIVE);
+  if (tree_fd >= 0) {
+    struct MountAttr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.attr_clr = MOUNT_ATTR_RDONLY;
+    // A mount that is read-only outside of the sandbox stays so.
+    if (syscall(SYS_mount_setattr, tree_fd, "", AT_EMPTY_PATH | AT_RECURSIVE,
+                &attr, sizeof(attr)) < 0) {
+      if (errno != EPERM) {
+        DIE("mount_setattr(%s)", name);
+      }
+      PRINT_DEBUG("mount_setattr(%s): %s", name, strerror(errno));
+    }
+    if (syscall(SYS_move_mount, tree_fd, "", AT_FDCWD, name,
+                MOVE_MOUNT_F_EMPTY_PATH) < 0) {
+      DIE("move_mount(%s)", name);
+    }
+    if (close(tree_fd) < 0) {
+      DIE("close");
+    }
+    return;
+  }
+  if (errno != ENOSYS) {
+    DIE("open_tree(%s)", name);
+  }
+  std::string source = "/proc/self/fd/" + std::to_string(src_fd) + "/" + name;
+  if (mount(source.c_str(), name, NULL, MS_BIND | MS_REC, NULL) < 0) {
+    DIE("mount(%s, %s, NULL, MS_BIND | MS_REC, NULL)", source.c_str(), name);
+  }
+  RemountBind(name, false);
+}
+
+// Replaces the inputs of the persistent worker in the working directory, the
+// current directory, with the entries of the directory 'src_fd'. Every
+// directory and file is a mount of its own, so that the worker can keep the
+// working directory open; symlinks are copied.
+static void MountInputs(int src_fd) {
+  for (const std::string &name : ListDirectory(AT_FDCWD)) {
+    // Either a previous input or something the worker created.
+    if (umount2(name.c_str(), MNT_DETACH | UMOUNT_NOFOLLOW) < 0 &&
+        errno != EINVAL) {
+      DIE("umount2(%s)", name.c_str());
+    }
+    RemoveTree(AT_FDCWD, name.c_str());
+  }
+
+  for (const std::string &name : ListDirectory(src_fd)) {
+    struct stat sb;
+    if (fstatat(src_fd, name.c_str(), &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+      DIE("fstatat(%s)", name.c_str());
+    }
+    PRINT_DEBUG("worker input: %s", name.c_str());
+    if (S_ISLNK(sb.st_mode)) {
+      std::string target(sb.st_size + 1, '\0');
+      ssize_t length =
+          readlinkat(src_fd, name.c_str(), &target[0], target.size());
+      if (length < 0 || length > sb.st_size) {
+        DIE("readlinkat(%s)", name.c_str());
+      }
+      target.resize(length);
+      if (symlink(target.c_str(), name.c_str()) < 0) {
+        DIE("symlink(%s, %s)", target.c_str(), name.c_str());
+      }
+      continue;
+    }
+    if (S_ISDIR(sb.st_mode)) {
+      if (mkdir(name.c_str(), 0755) < 0) {
+        DIE("mkdir(%s)", name.c_str());
+      }
+    } else {
+      int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+      if (fd < 0 || close(fd) < 0) {
+        DIE("open(%s)", name.c_str());
+      }
+    }
+    MountInput(src_fd, name.c_str());
+  }
+}
+
+// Swaps in the inputs of the next request of the persistent worker on a
+// connection to the socket of -I, which names the directory they are in: it
+// has to be visible in the sandbox, e.g. below a directory of -b or -w. The
+// worker is idle meanwhile. If the directory cannot be opened, the error goes
+// back to the client; if the inputs cannot be mounted, the sandbox exits.
+static void HandleWorkerConnection(int client_fd) {
+  std::string path;
+  char c;
+  ssize_t r;
+  while ((r = read(client_fd, &c, 1)) == 1 && c != '\n') {
+    path.push_back(c);
+  }
+  if (r != 1) {
+    PRINT_DEBUG("malformed input swap request");
+    return;
+  }
+
+  int err = 0;
+  int src_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (src_fd < 0) {
+    err = errno;
+    PRINT_DEBUG("open(%s): %s", path.c_str(), strerror(err));
+  } else {
+    PRINT_DEBUG("worker inputs: %s", path.c_str());
+    MountInputs(src_fd);
+    if (close(src_fd) < 0) {
+      DIE("close");
+    }
+  }
+  std::string response = std::to_string(err) + "\n";
+  if (send(client_fd, response.data(), response.size(), MSG_NOSIGNAL) < 0) {
+    PRINT_DEBUG("send: %s", strerror(errno));
+  }
+}
+
+static void OnWorkerChild(int signum) {}
+
+// Exits like the child we spawned earlier, which terminated with 'status'. We
+// can simply _exit() here, because the Linux kernel will kindly SIGKILL all
+// remaining processes in our PID namespace once we exit.
+static void ExitWithChild(int status) {
+  EndStep("command");
+  CopyOutputs();
+  WriteChanges();
+  WriteAccesses();
+  if (WIFSIGNALED(status)) {
+    PRINT_DEBUG("child died due to signal %d", WTERMSIG(status));
+    _exit(128 + WTERMSIG(status));
+  } else {
+    PRINT_DEBUG("child exited with code %d", WEXITSTATUS(status));
+    _exit(WEXITSTATUS(status));
+  }
+}
+
 static void WaitForChild() {
   while (1) {
     // Check for zombies to be reaped and exit, if our own child exited.
@@ -611,38 +1596,115 @@ static void WaitForChild() {
       DIE("waitpid")
     } else {
       if (killed_pid == global_child_pid) {
-        // If the child process we spawned earlier terminated, we'll also
-        // terminate. We can simply _exit() here, because the Linux kernel will
-        // kindly SIGKILL all remaining processes in our PID namespace once we
-        // exit.
-        if (WIFSIGNALED(status)) {
-          PRINT_DEBUG("child died due to signal %d", WTERMSIG(status));
-          _exit(128 + WTERMSIG(status));
-        } else {
-          PRINT_DEBUG("child exited with code %d", WEXITSTATUS(status));
-          _exit(WEXITSTATUS(status));
-        }
+        ExitWithChild(status);
       }
     }
   }
 }
 
+// Like WaitForChild(), but meanwhile swaps the inputs of the persistent worker
+// whenever asked to on the socket of -I.
+static void ServeWorker() {
+  sigset_t child_set, wait_set;
+  if (sigemptyset(&child_set) < 0 || sigaddset(&child_set, SIGCHLD) < 0) {
+    DIE("sigaddset");
+  }
+  // SIGCHLD interrupts ppoll(), and only ppoll().
+  if (sigprocmask(SIG_BLOCK, &child_set, &wait_set) < 0) {
+    DIE("sigprocmask");
+  }
+  InstallSignalHandler(SIGCHLD, OnWorkerChild);
+
+  while (1) {
+    int status;
+    pid_t killed_pid;
+    while ((killed_pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      PRINT_DEBUG("waitpid returned %d", killed_pid);
+      if (killed_pid == global_child_pid) {
+        ExitWithChild(status);
+      }
+    }
+    if (killed_pid < 0 && errno != ECHILD) {
+      DIE("waitpid");
+    }
+
+    struct pollfd fds = {global_worker_socket_fd, POLLIN, 0};
+    if (ppoll(&fds, 1, NULL, &wait_set) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      DIE("ppoll");
+    }
+    int client_fd = accept4(global_worker_socket_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client_fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      DIE("accept4");
+    }
+    HandleWorkerConnection(client_fd);
+    if (close(client_fd) < 0) {
+      DIE("close");
+    }
+  }
+}
+
+void SetupSandboxTemplate(int *sync_pipe) {
+  SetupSelfDestruction(sync_pipe);
+  SetupMountNamespace();
+  SetupUserNamespace();
+  MountRoot();
+  MakeFilesystemMostlyReadOnly();
+}
+
 int Pid1Main(void *sync_pipe_param) {
   if (getpid() != 1) {
     DIE("Using PID namespaces, but we are not PID 1");
   }
+  EndStep("spawn_pid1");
+
+  // Before it can fork, so that every process of the command is in there.
+  if (global_cgroup_procs_fd >= 0) {
+    if (write(global_cgroup_procs_fd, "0", 1) != 1) {
+      DIE("write(cgroup.procs)");
+    }
+    if (close(global_cgroup_procs_fd) < 0) {
+      DIE("close");
+    }
+  }
 
   SetupSelfDestruction(reinterpret_cast<int *>(sync_pipe_param));
-  SetupMountNamespace();
-  SetupUserNamespace();
+  if (opt.daemon_name == NULL) {
+    SetupMountNamespace();
+    SetupUserNamespace();
+  }
   SetupUtsNamespace();
+  EndStep("setup_namespaces");
   MountFilesystems();
-  MakeFilesystemMostlyReadOnly();
+  EndStep("mount_filesystems");
+  if (opt.daemon_name == NULL) {
+    MakeFilesystemMostlyReadOnly();
+  } else {
+    MakeBindMountsReadOnly();
+  }
+  EndStep("make_filesystem_read_only");
   MountProc();
+  EndStep("mount_proc");
   SetupNetworking();
+  EndStep("setup_networking");
   EnterSandbox();
+  if (global_worker_inputs_fd >= 0) {
+    MountInputs(global_worker_inputs_fd);
+    if (close(global_worker_inputs_fd) < 0) {
+      DIE("close");
+    }
+  }
   SetupSignalHandlers();
+  EndStep("enter_sandbox");
   SpawnChild();
+  if (global_worker_socket_fd >= 0) {
+    ServeWorker();
+  }
   WaitForChild();
   _exit(EXIT_FAILURE);
 }
@@ -17,4 +17,12 @@
 
 int Pid1Main(void *sync_pipe_param);
 
+// Sets up the user and mount namespace of the sandbox daemon, which the
+// commands it runs share: the sandbox root is a read-only bind mount of /. The
+// calling process was cloned into these namespaces, like Pid1Main().
+void SetupSandboxTemplate(int *sync_pipe);
+
+// Enables the loopback interface of the network namespace of the caller.
+void SetupLoopback();
+
 #endif
@@ -36,8 +36,19 @@
  *  - The hostname and domainname will be set to "sandbox".
  *  - The process runs in its own PID namespace, so other processes on the
  *    system are invisible.
+ *  - The resource usage of the process and all of its children can be written
+ *    to a file (-s) when it exits.
+ *  - A persistent worker can keep running while its inputs change from one
+ *    request to the next (-I): PID 1 mounts the inputs of the next request in
+ *    place of the previous ones whenever it is asked to on a unix socket.
+ *
+ * With -d, the command runs through a long-lived sandbox daemon instead, which
+ * sets up the user namespace and the read-only view of the filesystem once for
+ * all the commands it runs (see linux-sandbox-daemon.cc).
  */
 
+#include "linux-sandbox.h"
+#include "linux-sandbox-daemon.h"
 #include "linux-sandbox-options.h"
 #include "linux-sandbox-pid1.h"
 #include "linux-sandbox-utils.h"
@@ -62,27 +73,133 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <string>
 #include <vector>
 
+#include "src/main/cpp/util/cgroup_stats.h"
+#include "src/main/cpp/util/trace_events.h"
+
+using blaze_util::FindCgroupValue;
+using blaze_util::ReadCgroupFile;
+using blaze_util::SumCgroupValues;
+
+// close_range(2) is new in Linux 5.9; older headers do not know it.
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
 int global_outer_uid;
 int global_outer_gid;
+int global_cgroup_procs_fd = -1;
+int global_changes_fd = -1;
+int global_accesses_fd = -1;
+int global_worker_socket_fd = -1;
 
 static char global_sandbox_root[] = "/tmp/sandbox.XXXXXX";
 static int global_child_pid;
 
+// The cgroup of the command (-G).
+static std::string global_cgroup_dir;
+
 // The signal that will be sent to the child when a timeout occurs.
 static volatile sig_atomic_t global_next_timeout_signal = SIGTERM;
 
 // The signal that caused us to kill the child (e.g. on timeout).
 static volatile sig_atomic_t global_signal;
 
+// The connection to the client the sandbox daemon runs the command for, or -1.
+static int global_client_fd = -1;
+
+// The file of -p, or -1, and when the step being timed started.
+static int global_timings_fd = -1;
+static struct timespec global_step_start;
+
+// When PID 1 was spawned, for its span in the trace.
+static uint64_t global_pid1_start;
+
+void StartStep() {
+  if (global_timings_fd >= 0 || BlazeTraceEnabled()) {
+    clock_gettime(CLOCK_MONOTONIC, &global_step_start);
+  }
+}
+
+void EndStep(const char *step) {
+  if (global_timings_fd < 0 && !BlazeTraceEnabled()) {
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  // The trace is on the same clock.
+  BlazeTraceSpan(step, NULL,
+                 global_step_start.tv_sec * 1000000ULL +
+                     global_step_start.tv_nsec / 1000);
+  long long micros = (now.tv_sec - global_step_start.tv_sec) * 1000000LL +
+                     (now.tv_nsec - global_step_start.tv_nsec) / 1000;
+  global_step_start = now;
+  if (global_timings_fd < 0) {
+    return;
+  }
+  // A single write(2) of the whole line, as PID 1 appends to the same file.
+  char line[64];
+  int length = snprintf(line, sizeof(line), "%s_micros %lld\n", step, micros);
+  if (write(global_timings_fd, line, length) != length) {
+    PRINT_DEBUG("write(%s): %s", opt.timings_path, strerror(errno));
+  }
+}
+
+static void EndTeardown() { EndStep("teardown"); }
+
+// Opens the file of -p, which PID 1 inherits.
+static void SetupTimings() {
+  global_timings_fd = open(opt.timings_path,
+                           O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                           0666);
+  if (global_timings_fd < 0) {
+    DIE("open(%s)", opt.timings_path);
+  }
+}
+
+// Opens the file of -F, which PID 1 inherits.
+static void SetupChanges() {
+  global_changes_fd =
+      open(opt.changes_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (global_changes_fd < 0) {
+    DIE("open(%s)", opt.changes_path);
+  }
+}
+
+// Opens the file of -A, which PID 1 inherits.
+static void SetupAccesses() {
+  global_accesses_fd =
+      open(opt.accesses_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (global_accesses_fd < 0) {
+    DIE("open(%s)", opt.accesses_path);
+  }
+}
+
+// Closes all file descriptors but stdin, stdout and stderr. They are closed
+// rather than marked close-on-exec, because the sandbox daemon does not exec
+// and would otherwise hold on to whatever its first client inherited.
 static void CloseFds() {
+  if (syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 0) == 0) {
+    return;
+  }
+  if (errno != ENOSYS && errno != EINVAL) {
+    DIE("close_range");
+  }
+
+  // Older kernels: close them one by one.
   DIR *fds = opendir("/proc/self/fd");
   if (fds == NULL) {
     DIE("opendir");
@@ -135,6 +252,36 @@ static void SetupSandboxRoot() {
   }
 }
 
+static void RemoveWorkerSocket() { unlink(opt.worker_socket); }
+
+// Listens on the socket of -I, which only the user can connect to. PID 1
+// inherits it; the command does not.
+static void CreateWorkerSocket() {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(opt.worker_socket) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    DIE("socket(%s)", opt.worker_socket);
+  }
+  strncpy(addr.sun_path, opt.worker_socket, sizeof(addr.sun_path) - 1);
+
+  global_worker_socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (global_worker_socket_fd < 0) {
+    DIE("socket");
+  }
+  mode_t old_umask = umask(0077);
+  if (bind(global_worker_socket_fd, reinterpret_cast<struct sockaddr *>(&addr),
+           sizeof(addr)) < 0) {
+    DIE("bind(%s)", opt.worker_socket);
+  }
+  umask(old_umask);
+  atexit(RemoveWorkerSocket);
+  if (listen(global_worker_socket_fd, SOMAXCONN) < 0) {
+    DIE("listen(%s)", opt.worker_socket);
+  }
+}
+
 static void HandleSignal(int signum, void (*handler)(int)) {
   struct sigaction sa;
   memset(&sa, 0, sizeof(sa));
@@ -165,8 +312,13 @@ static void SpawnPid1() {
     DIE("pipe");
   }
 
-  int clone_flags = CLONE_NEWUSER | CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC |
-                    CLONE_NEWPID | SIGCHLD;
+  int clone_flags =
+      CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWPID | SIGCHLD;
+  if (opt.daemon_name == NULL) {
+    // The sandbox daemon runs every command in the user namespace it created
+    // when it started.
+    clone_flags |= CLONE_NEWUSER;
+  }
   if (opt.create_netns) {
     clone_flags |= CLONE_NEWNET;
   }
@@ -198,14 +350,174 @@ static void SpawnPid1() {
   }
 }
 
+// Kills the child once the client went away, just like it gets killed when
+// linux-sandbox itself does.
+static void OnClientEvent(int sig) {
+  int saved_errno = errno;
+  char buf;
+  ssize_t r = recv(global_client_fd, &buf, 1, MSG_DONTWAIT);
+  if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+    global_signal = SIGKILL;
+    kill(global_child_pid, SIGKILL);
+  }
+  errno = saved_errno;
+}
+
+static void WatchClient(int client_fd) {
+  global_client_fd = client_fd;
+  HandleSignal(SIGIO, OnClientEvent);
+  int flags = fcntl(client_fd, F_GETFL);
+  if (flags < 0 || fcntl(client_fd, F_SETOWN, getpid()) < 0 ||
+      fcntl(client_fd, F_SETFL, flags | O_ASYNC) < 0) {
+    DIE("fcntl");
+  }
+  // The client may have gone away before SIGIO was set up.
+  OnClientEvent(SIGIO);
+}
+
+// Writes 'value' to the file 'name' of the cgroup directory 'dir'.
+static bool WriteCgroupFile(const std::string &dir, const std::string &name,
+                            const char *value) {
+  int fd = open((dir + "/" + name).c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  size_t size = strlen(value);
+  bool written = write(fd, value, size) == static_cast<ssize_t>(size);
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return written;
+}
+
+static void RemoveCgroup() {
+  // The processes of the command are gone once PID 1 is, but the kernel may
+  // take a moment to notice.
+  for (int attempt = 0; rmdir(global_cgroup_dir.c_str()) < 0; attempt++) {
+    if (errno != EBUSY || attempt == 100) {
+      PRINT_DEBUG("rmdir(%s): %s", global_cgroup_dir.c_str(), strerror(errno));
+      return;
+    }
+    usleep(1000);
+  }
+}
+
+// Creates the cgroup of the command below the one of -G, with the settings of
+// -g, and opens its cgroup.procs for PID 1. Enables the controllers of the
+// settings in the parent cgroup, and, if it can, those of memory.peak and
+// io.stat.
+static void CreateCgroup() {
+  std::string parent = opt.cgroup_parent;
+  std::string dir = parent + "/linux-sandbox.XXXXXX";
+  if (mkdtemp(&dir[0]) == NULL) {
+    DIE("mkdtemp(%s)", dir.c_str());
+  }
+  global_cgroup_dir = dir;
+  atexit(RemoveCgroup);
+  PRINT_DEBUG("cgroup: %s", dir.c_str());
+
+  WriteCgroupFile(parent, "cgroup.subtree_control", "+memory");
+  WriteCgroupFile(parent, "cgroup.subtree_control", "+io");
+  for (const char *setting : opt.cgroup_settings) {
+    const char *equals = strchr(setting, '=');
+    std::string file(setting, equals - setting);
+    std::string controller = file.substr(0, file.find('.'));
+    // Writing an enabled controller again is fine.
+    if (!WriteCgroupFile(parent, "cgroup.subtree_control",
+                         ("+" + controller).c_str())) {
+      DIE("enable %s in %s/cgroup.subtree_control", controller.c_str(),
+          parent.c_str());
+    }
+    if (!WriteCgroupFile(dir, file, equals + 1)) {
+      DIE("write(%s/%s, %s)", dir.c_str(), file.c_str(), equals + 1);
+    }
+  }
+
+  global_cgroup_procs_fd =
+      open((dir + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+  if (global_cgroup_procs_fd < 0) {
+    DIE("open(%s/cgroup.procs)", dir.c_str());
+  }
+}
+
+// Appends the resource usage of the cgroup of the command to 'stats', for the
+// files the cgroup has.
+static void WriteCgroupStats(FILE *stats) {
+  std::string contents;
+  if (ReadCgroupFile(global_cgroup_dir, "cpu.stat", &contents)) {
+    fprintf(stats, "cgroup_cpu_time_micros %lld\n",
+            static_cast<long long>(FindCgroupValue(contents, "usage_usec ")));
+  }
+  if (ReadCgroupFile(global_cgroup_dir, "memory.peak", &contents)) {
+    fprintf(stats, "cgroup_memory_peak_bytes %lld\n",
+            strtoll(contents.c_str(), NULL, 10));
+  }
+  if (ReadCgroupFile(global_cgroup_dir, "memory.events", &contents)) {
+    fprintf(stats, "cgroup_oom_kills %lld\n",
+            static_cast<long long>(FindCgroupValue(contents, "oom_kill ")));
+  }
+  if (ReadCgroupFile(global_cgroup_dir, "io.stat", &contents)) {
+    // No line at all if there was no I/O.
+    long long read_bytes = SumCgroupValues(contents, " rbytes=");
+    long long write_bytes = SumCgroupValues(contents, " wbytes=");
+    fprintf(stats,
+            "cgroup_io_read_bytes %lld\n"
+            "cgroup_io_write_bytes %lld\n",
+            read_bytes < 0 ? 0 : read_bytes, write_bytes < 0 ? 0 : write_bytes);
+  }
+}
+
+static long long TimevalToMicros(const struct timeval &tv) {
+  return static_cast<long long>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+// Writes the resource usage in the format of process-wrapper's --stats.
+static void WriteStats(const struct rusage &rusage, const char *stats_path) {
+  FILE *stats = fopen(stats_path, "w");
+  if (stats == NULL) {
+    DIE("fopen(%s)", stats_path);
+  }
+  fprintf(stats,
+          "user_time_micros %lld\n"
+          "system_time_micros %lld\n"
+          "max_resident_set_kilobytes %ld\n"
+          "minor_page_faults %ld\n"
+          "major_page_faults %ld\n"
+          "block_input_operations %ld\n"
+          "block_output_operations %ld\n"
+          "voluntary_context_switches %ld\n"
+          "involuntary_context_switches %ld\n",
+          TimevalToMicros(rusage.ru_utime), TimevalToMicros(rusage.ru_stime),
+          rusage.ru_maxrss, rusage.ru_minflt, rusage.ru_majflt,
+          rusage.ru_inblock, rusage.ru_oublock, rusage.ru_nvcsw,
+          rusage.ru_nivcsw);
+  if (!global_cgroup_dir.empty()) {
+    WriteCgroupStats(stats);
+  }
+  if (fclose(stats) != 0) {
+    DIE("fclose(%s)", stats_path);
+  }
+}
+
 static int WaitForPid1() {
   int err, status;
+  // PID 1 of the namespace reaps all the processes in it, so its resource
+  // usage covers all of them.
+  struct rusage rusage;
   do {
-    err = waitpid(global_child_pid, &status, 0);
+    err = wait4(global_child_pid, &status, 0, &rusage);
   } while (err < 0 && errno == EINTR);
 
   if (err < 0) {
-    DIE("waitpid");
+    DIE("wait4");
+  }
+  // PID 1 only writes the timings of its steps: the trace is not necessarily
+  // in the sandbox.
+  BlazeTraceSpan("pid1", NULL, global_pid1_start);
+  StartStep();
+
+  if (opt.stats_path != NULL) {
+    WriteStats(rusage, opt.stats_path);
   }
 
   if (global_signal > 0) {
@@ -258,6 +570,63 @@ static void RedirectStderr(const char *stderr_path) {
   Redirect(stderr_path, STDERR_FILENO, "stderr");
 }
 
+int RunSandboxedCommand(int client_fd) {
+  RedirectStdout(opt.stdout_path);
+  RedirectStderr(opt.stderr_path);
+  BlazeTraceInit("linux-sandbox", NULL);
+  if (opt.timings_path != NULL) {
+    SetupTimings();
+  }
+  // Tearing down the sandbox is the last step, only over once all the other
+  // exit handlers ran, but before the trace is written.
+  if (opt.timings_path != NULL || BlazeTraceEnabled()) {
+    atexit(EndTeardown);
+  }
+
+  StartStep();
+  SetupSandboxRoot();
+  EndStep("setup_sandbox_root");
+  if (opt.cgroup_parent != NULL) {
+    CreateCgroup();
+    EndStep("create_cgroup");
+  }
+
+  HandleSignal(SIGALRM, OnTimeout);
+  if (opt.timeout_secs > 0) {
+    alarm(opt.timeout_secs);
+  }
+
+  if (opt.worker_socket != NULL) {
+    CreateWorkerSocket();
+  }
+  if (opt.changes_path != NULL) {
+    SetupChanges();
+  }
+  if (opt.accesses_path != NULL) {
+    SetupAccesses();
+  }
+
+  StartStep();
+  global_pid1_start = BlazeTraceNow();
+  SpawnPid1();
+  if (global_cgroup_procs_fd >= 0 && close(global_cgroup_procs_fd) < 0) {
+    DIE("close");
+  }
+  if (global_worker_socket_fd >= 0 && close(global_worker_socket_fd) < 0) {
+    DIE("close");
+  }
+  if (global_changes_fd >= 0 && close(global_changes_fd) < 0) {
+    DIE("close");
+  }
+  if (global_accesses_fd >= 0 && close(global_accesses_fd) < 0) {
+    DIE("close");
+  }
+  if (client_fd >= 0) {
+    WatchClient(client_fd);
+  }
+  return WaitForPid1();
+}
+
 int main(int argc, char *argv[]) {
   // Ask the kernel to kill us with SIGKILL if our parent dies.
   if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0) {
@@ -266,9 +635,6 @@ int main(int argc, char *argv[]) {
 
   ParseOptions(argc, argv);
 
-  RedirectStdout(opt.stdout_path);
-  RedirectStderr(opt.stderr_path);
-
   // This should never be called as a setuid binary, drop privileges just in
   // case. We don't need to be root, because we use user namespaces anyway.
   if (setuid(getuid()) < 0) {
@@ -282,13 +648,8 @@ int main(int argc, char *argv[]) {
   // file handles from our parent.
   CloseFds();
 
-  SetupSandboxRoot();
-
-  HandleSignal(SIGALRM, OnTimeout);
-  if (opt.timeout_secs > 0) {
-    alarm(opt.timeout_secs);
+  if (opt.daemon_name != NULL) {
+    return RunInDaemon(argc, argv);
   }
-
-  SpawnPid1();
-  return WaitForPid1();
+  return RunSandboxedCommand(-1);
 }
@@ -18,4 +18,33 @@
 extern int global_outer_uid;
 extern int global_outer_gid;
 
+// The cgroup.procs file of the cgroup of the command (-G), or -1. PID 1 moves
+// itself there before anything else.
+extern int global_cgroup_procs_fd;
+
+// The file of -F, or -1. PID 1 writes the changes to it when the command
+// exits.
+extern int global_changes_fd;
+
+// The file of -A, or -1. PID 1 writes the inputs the command opened to it when
+// the command exits.
+extern int global_accesses_fd;
+
+// The listening socket of -I, or -1. PID 1 serves the input swaps on it.
+extern int global_worker_socket_fd;
+
+// Starts timing the next step of setting up or tearing down the sandbox.
+void StartStep();
+
+// Appends "<step>_micros <time>" to the file of -p, if any, with the time since
+// StartStep() or the last EndStep(), and starts timing the next step. PID 1
+// inherits the time the step of spawning it started with. Outside of PID 1,
+// the step is also a span of the trace (see trace_events.h).
+void EndStep(const char *step);
+
+// Runs the command of the options in the sandbox and returns its exit code.
+// If 'client_fd' is not -1, the command is killed once that connection is
+// closed: it is the client the sandbox daemon runs the command for.
+int RunSandboxedCommand(int client_fd);
+
 #endif
@@ -15,6 +15,7 @@
 #define _GNU_SOURCE
 
 #include <unistd.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -137,10 +138,15 @@ void SetTimeout(double timeout_secs) {
 }
 
 int WaitChild(pid_t pid, const char *name) {
+  struct rusage rusage;
+  return WaitChildWithRusage(pid, name, &rusage);
+}
+
+int WaitChildWithRusage(pid_t pid, const char *name, struct rusage *rusage) {
   int err, status;
 
   do {
-    err = waitpid(pid, &status, 0);
+    err = wait4(pid, &status, 0, rusage);
   } while (err == -1 && errno == EINTR);
 
   if (err == -1) {
@@ -149,3 +155,39 @@ int WaitChild(pid_t pid, const char *name) {
 
   return status;
 }
+
+static long long TimevalToMicros(const struct timeval *tv) {
+  return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+void WriteStatsToFile(long long wall_time_micros, const struct rusage *rusage,
+                      const char *stats_path) {
+  FILE *stats = fopen(stats_path, "w");
+  if (stats == NULL) {
+    DIE("fopen(%s) failed: %s\n", stats_path, strerror(errno));
+  }
+#ifdef __APPLE__
+  // ru_maxrss is in bytes on OS X, kilobytes elsewhere.
+  long long max_rss_kilobytes = rusage->ru_maxrss / 1024;
+#else
+  long long max_rss_kilobytes = rusage->ru_maxrss;
+#endif
+  fprintf(stats,
+          "wall_time_micros %lld\n"
+          "user_time_micros %lld\n"
+          "system_time_micros %lld\n"
+          "max_resident_set_kilobytes %lld\n"
+          "minor_page_faults %ld\n"
+          "major_page_faults %ld\n"
+          "block_input_operations %ld\n"
+          "block_output_operations %ld\n"
+          "voluntary_context_switches %ld\n"
+          "involuntary_context_switches %ld\n",
+          wall_time_micros, TimevalToMicros(&rusage->ru_utime),
+          TimevalToMicros(&rusage->ru_stime), max_rss_kilobytes,
+          rusage->ru_minflt, rusage->ru_majflt, rusage->ru_inblock,
+          rusage->ru_oublock, rusage->ru_nvcsw, rusage->ru_nivcsw);
+  if (fclose(stats) != 0) {
+    DIE("fclose(%s) failed: %s\n", stats_path, strerror(errno));
+  }
+}
@@ -15,6 +15,7 @@
 #ifndef PROCESS_TOOLS_H__
 #define PROCESS_TOOLS_H__
 
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <stdbool.h>
 
@@ -82,4 +83,14 @@ void SetTimeout(double timeout_secs);
 // "name" is used for the error message only.
 int WaitChild(pid_t pid, const char *name);
 
+// Like WaitChild, but also stores the resource usage of "pid" and of the
+// descendants it waited for in "rusage".
+int WaitChildWithRusage(pid_t pid, const char *name, struct rusage *rusage);
+
+// Write the wall time "wall_time_micros" and the resource usage in "rusage" to
+// the file "stats_path", one "<name> <value>" line per field. Times are in
+// microseconds, the maximum resident set size is in kilobytes.
+void WriteStatsToFile(long long wall_time_micros, const struct rusage *rusage,
+                      const char *stats_path);
+
 #endif  // PROCESS_TOOLS_H__
@@ -17,6 +17,23 @@
 // from normal termination or timeout, the subprocess (and any of its children)
 // is killed.
 //
+// If "--stats=<file>" is given before the other arguments, the wall time and
+// the resource usage of the subprocess (see WriteStatsToFile) are written to
+// that file when it exits, and the number of bytes it wrote to stdout and
+// stderr, as far as they are known. On Linux, the resource usage includes
+// that of the descendants that outlived the subprocess.
+//
+// If "--output_limit=<bytes>" is given, on Linux, at most that many bytes of
+// each of stdout and stderr are kept: the first half, a line saying how many
+// bytes were discarded, and the last half. The output goes through a pipe, so
+// that it is capped before it reaches the disk, and never more than half the
+// limit per stream is held in memory.
+//
+// If "--cgroup=<dir>" is given, on Linux, the subprocess runs in a new cgroup
+// below the cgroup v2 <dir>. Then killing it kills every process in there,
+// including the ones that left its process group, and process-wrapper exits
+// once they are all gone rather than after a fixed delay.
+//
 // The exit status of this program is whatever the child process returned,
 // unless process-wrapper receives a signal. ie, on SIGTERM this program will
 // die with raise(SIGTERM) even if the child process handles SIGTERM with
@@ -26,31 +43,95 @@
 
 #include <err.h>
 #include <errno.h>
+#include <math.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+// pidfd_open(2) is new in Linux 5.3; older headers do not know it.
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#endif
+
 #include "process-tools.h"
+#include "src/main/cpp/util/trace_events.h"
 
 // Not in headers on OSX.
 extern char **environ;
 
+// posix_spawn(3) and its helpers return the error rather than set errno.
+#define CHECK_SPAWN_CALL(x)                     \
+  {                                             \
+    int spawn_error = (x);                      \
+    if (spawn_error != 0) {                     \
+      DIE(#x ": %s\n", strerror(spawn_error));  \
+    }                                           \
+  }
+
 static double global_kill_delay;
 static int global_child_pid;
 static volatile sig_atomic_t global_signal;
 
+// The cgroup.procs file of the cgroup of the child (--cgroup), or -1.
+static int global_cgroup_procs_fd = -1;
+
+#ifdef __linux__
+// The output of the child to one stream, read from a pipe. The first
+// "head_size" bytes go to "out_fd" right away, the last "tail_size" bytes of
+// the rest are kept in "tail", a ring buffer, until the child is done.
+struct Capture {
+  const char *name;
+  // The read end of the pipe, -1 once it is at its end or not in use.
+  int pipe_fd;
+  // The write end, for the child.
+  int child_fd;
+  int out_fd;
+  uint64_t head_size;
+  size_t tail_size;
+  char *tail;
+  // The bytes the child wrote so far.
+  uint64_t total;
+};
+
+static struct Capture global_captures[2] = {
+    {"stdout", -1, -1, STDOUT_FILENO, 0, 0, NULL, 0},
+    {"stderr", -1, -1, STDERR_FILENO, 0, 0, NULL, 0},
+};
+
+// The cgroup of the child, and its cgroup.events file, or -1.
+static char *global_cgroup_dir;
+static int global_cgroup_events_fd = -1;
+#endif
+
 // Options parsing result.
 struct Options {
   double timeout_secs;
   double kill_delay_secs;
   const char *stdout_path;
   const char *stderr_path;
+  const char *stats_path;
+  uint64_t output_limit;
+  const char *cgroup_parent;
   char *const *args;
 };
 
@@ -59,7 +140,8 @@ struct Options {
 // string for the error message to print.
 static void Usage(char *const *argv) {
   fprintf(stderr,
-          "Usage: %s <timeout-secs> <kill-delay-secs> <stdout-redirect> "
+          "Usage: %s [--stats=<file>] [--output_limit=<bytes>] [--cgroup=<dir>] "
+          "<timeout-secs> <kill-delay-secs> <stdout-redirect> "
           "<stderr-redirect> <command> [args] ...\n",
           argv[0]);
   exit(EXIT_FAILURE);
@@ -68,11 +150,38 @@ static void Usage(char *const *argv) {
 // Parse the command line flags and return the result in an Options structure
 // passed as argument.
 static void ParseCommandLine(int argc, char *const *argv, struct Options *opt) {
-  if (argc <= 5) {
-    Usage(argv);
+  char *const *program = argv;
+  argv++;
+  argc--;
+  while (argc > 0 && strncmp(*argv, "--", 2) == 0) {
+    if (strncmp(*argv, "--stats=", 8) == 0) {
+      opt->stats_path = *argv + 8;
+    } else if (strncmp(*argv, "--output_limit=", 15) == 0) {
+      char *end;
+      errno = 0;
+      opt->output_limit = strtoull(*argv + 15, &end, 10);
+      if (errno != 0 || end == *argv + 15 || *end != '\0' ||
+          opt->output_limit == 0) {
+        DIE("output_limit is not a positive number of bytes.\n");
+      }
+#ifndef __linux__
+      DIE("--output_limit is only supported on Linux.\n");
+#endif
+    } else if (strncmp(*argv, "--cgroup=", 9) == 0) {
+      opt->cgroup_parent = *argv + 9;
+#ifndef __linux__
+      DIE("--cgroup is only supported on Linux.\n");
+#endif
+    } else {
+      break;
+    }
+    argv++;
+    argc--;
+  }
+  if (argc <= 4) {
+    Usage(program);
   }
 
-  argv++;
   if (sscanf(*argv++, "%lf", &opt->timeout_secs) != 1) {
     DIE("timeout_secs is not a real number.\n");
   }
@@ -104,14 +213,487 @@ void OnSignal(int sig) {
   }
 }
 
-// Run the command specified by the argv array and kill it after timeout
-// seconds.
-static void SpawnCommand(char *const *argv, double timeout_secs) {
+#ifdef __linux__
+// Arms 'timer_fd' to expire once, 'secs' seconds from now.
+static void ArmTimer(int timer_fd, double secs) {
+  double int_val;
+  double fraction_val = modf(secs, &int_val);
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = (time_t)int_val;
+  spec.it_value.tv_nsec = (long)(fraction_val * 1e9);
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+    // A zero expiration would disarm the timer.
+    spec.it_value.tv_nsec = 1;
+  }
+  CHECK_CALL(timerfd_settime(timer_fd, 0, &spec, NULL));
+}
+
+static void AddToEpoll(int epoll_fd, int fd) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  CHECK_CALL(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event));
+}
+
+// Writes all of "buf" to "fd". Like the writes of the child would, a full
+// disk loses the output, but not the child.
+static void WriteFully(int fd, const char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, buf, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    buf += written;
+    size -= written;
+  }
+}
+
+// Sets up the pipe of "capture" for an output limit of "limit" bytes.
+static void StartCapture(struct Capture *capture, uint64_t limit) {
+  int fds[2];
+  CHECK_CALL(pipe2(fds, O_CLOEXEC));
+  capture->pipe_fd = fds[0];
+  capture->child_fd = fds[1];
+  capture->head_size = limit / 2;
+  capture->tail_size = limit - capture->head_size;
+}
+
+// Adds the "size" bytes at "buf" that the child wrote to "capture".
+static void AddOutput(struct Capture *capture, const char *buf, size_t size) {
+  if (capture->total < capture->head_size) {
+    size_t head = capture->head_size - capture->total;
+    if (head > size) {
+      head = size;
+    }
+    WriteFully(capture->out_fd, buf, head);
+    capture->total += head;
+    buf += head;
+    size -= head;
+  }
+  if (size == 0) {
+    return;
+  }
+  if (capture->tail == NULL) {
+    capture->tail = malloc(capture->tail_size);
+    CHECK_NOT_NULL(capture->tail);
+  }
+  if (size > capture->tail_size) {
+    // Only the end of it stays.
+    capture->total += size - capture->tail_size;
+    buf += size - capture->tail_size;
+    size = capture->tail_size;
+  }
+  while (size > 0) {
+    size_t pos = (capture->total - capture->head_size) % capture->tail_size;
+    size_t chunk = capture->tail_size - pos;
+    if (chunk > size) {
+      chunk = size;
+    }
+    memcpy(capture->tail + pos, buf, chunk);
+    capture->total += chunk;
+    buf += chunk;
+    size -= chunk;
+  }
+}
+
+// Reads what there is in the pipe of "capture", and closes it at its end.
+static void ReadOutput(struct Capture *capture) {
+  char buf[64 * 1024];
+  ssize_t size = read(capture->pipe_fd, buf, sizeof(buf));
+  if (size > 0) {
+    AddOutput(capture, buf, size);
+  } else if (size == 0 || (errno != EINTR && errno != EAGAIN)) {
+    // Closing it takes it out of the epoll set, too.
+    CHECK_CALL(close(capture->pipe_fd));
+    capture->pipe_fd = -1;
+  }
+}
+
+// Writes the tail of "capture" after the line about what is missing, if
+// anything is.
+static void FinishCapture(struct Capture *capture) {
+  if (capture->total <= capture->head_size) {
+    return;
+  }
+  uint64_t rest = capture->total - capture->head_size;
+  if (rest <= capture->tail_size) {
+    WriteFully(capture->out_fd, capture->tail, rest);
+  } else {
+    char line[100];
+    int length = snprintf(
+        line, sizeof(line),
+        "\n[process-wrapper: %llu bytes of %s discarded]\n",
+        (unsigned long long)(rest - capture->tail_size), capture->name);
+    WriteFully(capture->out_fd, line, length);
+    size_t pos = rest % capture->tail_size;
+    WriteFully(capture->out_fd, capture->tail + pos, capture->tail_size - pos);
+    WriteFully(capture->out_fd, capture->tail, pos);
+  }
+  free(capture->tail);
+  capture->tail = NULL;
+}
+
+// Creates the cgroup of the child below "parent", and opens its cgroup.procs,
+// which the child moves itself to before it runs the command, and its
+// cgroup.events.
+static void CreateCgroup(const char *parent) {
+  size_t size = strlen(parent) + sizeof("/process-wrapper.XXXXXX");
+  global_cgroup_dir = malloc(size);
+  CHECK_NOT_NULL(global_cgroup_dir);
+  snprintf(global_cgroup_dir, size, "%s/process-wrapper.XXXXXX", parent);
+  if (mkdtemp(global_cgroup_dir) == NULL) {
+    DIE("mkdtemp(%s) failed: %s\n", global_cgroup_dir, strerror(errno));
+  }
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/cgroup.procs", global_cgroup_dir);
+  CHECK_CALL(global_cgroup_procs_fd = open(path, O_WRONLY | O_CLOEXEC));
+  snprintf(path, sizeof(path), "%s/cgroup.events", global_cgroup_dir);
+  CHECK_CALL(global_cgroup_events_fd = open(path, O_RDONLY | O_CLOEXEC));
+}
+
+// Returns whether there is no process left in the cgroup of the child.
+static bool CgroupIsEmpty() {
+  char buf[256];
+  ssize_t size;
+  CHECK_CALL(size = pread(global_cgroup_events_fd, buf, sizeof(buf) - 1, 0));
+  buf[size] = '\0';
+  return strstr(buf, "populated 0") != NULL;
+}
+
+// Sends SIGKILL to every process in the cgroup of the child, wherever it is in
+// the process tree: all at once with cgroup.kill (Linux 5.14), else one by one
+// from cgroup.procs until there are none.
+static void KillCgroup() {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/cgroup.kill", global_cgroup_dir);
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    bool killed = write(fd, "1", 1) == 1;
+    CHECK_CALL(close(fd));
+    if (killed) {
+      return;
+    }
+  }
+
+  snprintf(path, sizeof(path), "%s/cgroup.procs", global_cgroup_dir);
+  bool found = true;
+  while (found) {
+    FILE *procs = fopen(path, "r");
+    if (procs == NULL) {
+      return;
+    }
+    found = false;
+    int pid;
+    while (fscanf(procs, "%d", &pid) == 1) {
+      kill(pid, SIGKILL);
+      found = true;
+    }
+    fclose(procs);
+  }
+}
+
+// Kills the process group of the child "pid" with "sig"; with SIGKILL, also
+// what is in its cgroup, if it has one.
+static void KillChild(pid_t pid, int sig) {
+  kill(-pid, sig);
+  if (sig == SIGKILL && global_cgroup_events_fd >= 0) {
+    KillCgroup();
+  }
+}
+
+// Returns whether the processes of the child "pid" are gone: those in its
+// cgroup, if it has one, else those in its process group.
+static bool ChildIsGone(pid_t pid) {
+  if (global_cgroup_events_fd >= 0) {
+    return CgroupIsEmpty();
+  }
+  return kill(-pid, 0) == -1 && errno == ESRCH;
+}
+
+// Kills what is left in the cgroup of the child, waits until it is empty, which
+// cgroup.events tells with POLLPRI, and removes it.
+static void RemoveCgroup() {
+  KillCgroup();
+  struct pollfd fds = {global_cgroup_events_fd, POLLPRI, 0};
+  while (!CgroupIsEmpty()) {
+    if (poll(&fds, 1, -1) == -1 && errno != EINTR) {
+      DIE("poll failed: %s\n", strerror(errno));
+    }
+    // We are the subreaper of what was killed.
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+    }
+  }
+  CHECK_CALL(close(global_cgroup_events_fd));
+  CHECK_CALL(close(global_cgroup_procs_fd));
+  if (rmdir(global_cgroup_dir) == -1) {
+    fprintf(stderr, "rmdir(%s) failed: %s\n", global_cgroup_dir,
+            strerror(errno));
+  }
+}
+
+// Waits for the child "pid" to exit and returns its status, killing its
+// process group on a timeout (gracefully, see KillEverything()) or on SIGTERM
+// or SIGINT (right away). Everything is one epoll(7) loop: the exit of the
+// child comes on a pidfd, the timeout and the kill delay on a timerfd, and the
+// signals, which "signals" are and which must have been blocked before the
+// fork, on a signalfd. So there is no signal handler to race with, and a
+// graceful kill is over as soon as the whole process group is gone, which
+// SIGCHLD tells about, as process-wrapper is the subreaper of the group.
+static int WaitChildWithTimeout(pid_t pid, double timeout_secs,
+                                const sigset_t *signals,
+                                struct rusage *rusage) {
+  int signal_fd, timer_fd, epoll_fd;
+  CHECK_CALL(signal_fd = signalfd(-1, signals, SFD_CLOEXEC));
+  CHECK_CALL(timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+  CHECK_CALL(epoll_fd = epoll_create1(EPOLL_CLOEXEC));
+  AddToEpoll(epoll_fd, signal_fd);
+  AddToEpoll(epoll_fd, timer_fd);
+  // Without pidfd_open(2), SIGCHLD tells about the exit of the child as well.
+  int pid_fd = syscall(SYS_pidfd_open, pid, 0);
+  if (pid_fd >= 0) {
+    AddToEpoll(epoll_fd, pid_fd);
+  }
+  if (timeout_secs > 0) {
+    ArmTimer(timer_fd, timeout_secs);
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (global_captures[i].pipe_fd >= 0) {
+      AddToEpoll(epoll_fd, global_captures[i].pipe_fd);
+    }
+  }
+  if (global_cgroup_events_fd >= 0) {
+    // The file is always readable; a change of its contents is EPOLLPRI.
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLPRI;
+    event.data.fd = global_cgroup_events_fd;
+    CHECK_CALL(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, global_cgroup_events_fd,
+                         &event));
+  }
+
+  int status = 0;
+  bool child_exited = false;
+  // Whether the process group got SIGTERM on a timeout, and not SIGKILL yet.
+  bool terminating = false;
+  while (true) {
+    if (!child_exited) {
+      pid_t reaped = wait4(pid, &status, WNOHANG, rusage);
+      if (reaped == -1 && errno != EINTR) {
+        DIE("wait on pid %d failed\n", pid);
+      }
+      child_exited = reaped == pid;
+      if (child_exited && pid_fd >= 0) {
+        // It would stay readable.
+        CHECK_CALL(close(pid_fd));
+        pid_fd = -1;
+      }
+    }
+    if (child_exited) {
+      // What is left of the process group, reparented to us.
+      while (waitpid(-1, NULL, WNOHANG) > 0) {
+      }
+      if (!terminating || ChildIsGone(pid)) {
+        break;
+      }
+    }
+
+    struct epoll_event event;
+    int ready = epoll_wait(epoll_fd, &event, 1, -1);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      DIE("epoll_wait failed: %s\n", strerror(errno));
+    }
+    if (ready == 0) {
+      continue;
+    }
+
+    if (event.data.fd == signal_fd) {
+      struct signalfd_siginfo info;
+      CHECK_CALL(read(signal_fd, &info, sizeof(info)));
+      if (info.ssi_signo != SIGCHLD) {
+        // Signals should kill the process quickly, as it's typically blocking
+        // the return of the prompt after a user hits "Ctrl-C".
+        global_signal = info.ssi_signo;
+        terminating = false;
+        KillChild(pid, SIGKILL);
+      }
+    } else if (event.data.fd == timer_fd) {
+      uint64_t expirations;
+      CHECK_CALL(read(timer_fd, &expirations, sizeof(expirations)));
+      if (!terminating && global_signal == 0) {
+        // A timeout, so we should give the process a bit of time to die
+        // gracefully if it needs it.
+        global_signal = SIGALRM;
+        kill(-pid, SIGTERM);
+        if (global_kill_delay > 0) {
+          terminating = true;
+          ArmTimer(timer_fd, global_kill_delay);
+        } else {
+          KillChild(pid, SIGKILL);
+        }
+      } else {
+        terminating = false;
+        KillChild(pid, SIGKILL);
+      }
+    } else if (event.data.fd == global_cgroup_events_fd) {
+      // Reading it is what clears the EPOLLPRI; whether the cgroup emptied is
+      // looked at above.
+      CgroupIsEmpty();
+    }
+    for (int i = 0; i < 2; ++i) {
+      if (event.data.fd == global_captures[i].pipe_fd) {
+        ReadOutput(&global_captures[i]);
+      }
+    }
+    // The pidfd is readable once the child exited; it is reaped above.
+  }
+
+  // What the child wrote before it exited is in the pipes. What is left of
+  // the process group may hold them open, but its output does not count.
+  for (int i = 0; i < 2; ++i) {
+    struct Capture *capture = &global_captures[i];
+    if (capture->pipe_fd >= 0) {
+      CHECK_CALL(fcntl(capture->pipe_fd, F_SETFL, O_NONBLOCK));
+      while (capture->pipe_fd >= 0) {
+        uint64_t before = capture->total;
+        ReadOutput(capture);
+        if (capture->pipe_fd >= 0 && capture->total == before) {
+          CHECK_CALL(close(capture->pipe_fd));
+          capture->pipe_fd = -1;
+        }
+      }
+    }
+    FinishCapture(capture);
+  }
+
+  if (pid_fd >= 0) {
+    CHECK_CALL(close(pid_fd));
+  }
+  CHECK_CALL(close(epoll_fd));
+  CHECK_CALL(close(timer_fd));
+  CHECK_CALL(close(signal_fd));
+  return status;
+}
+#endif
+
+// Appends the number of bytes the child wrote to stdout and stderr to the
+// file "stats_path": all of them, and those beyond the output limit. Without
+// a limit, they are only known for files.
+static void WriteOutputStatsToFile(const char *stats_path) {
+  FILE *stats = fopen(stats_path, "a");
+  if (stats == NULL) {
+    DIE("fopen(%s) failed: %s\n", stats_path, strerror(errno));
+  }
+  const char *names[] = {"stdout", "stderr"};
+  const int fds[] = {STDOUT_FILENO, STDERR_FILENO};
+  for (int i = 0; i < 2; ++i) {
+    unsigned long long total;
+    unsigned long long discarded = 0;
+#ifdef __linux__
+    const struct Capture *capture = &global_captures[i];
+    if (capture->child_fd >= 0) {
+      total = capture->total;
+      if (total > capture->head_size + capture->tail_size) {
+        discarded = total - capture->head_size - capture->tail_size;
+      }
+    } else
+#endif
+    {
+      struct stat st;
+      if (fstat(fds[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      total = st.st_size;
+    }
+    fprintf(stats, "%s_bytes %llu\n%s_discarded_bytes %llu\n", names[i],
+            total, names[i], discarded);
+  }
+  if (fclose(stats) != 0) {
+    DIE("fclose(%s) failed: %s\n", stats_path, strerror(errno));
+  }
+}
+
+#ifdef POSIX_SPAWN_SETSID
+// Spawns the command of "argv" as global_child_pid, like StartChild() does.
+static void SpawnChild(char *const *argv) {
+  // Inherited by the child; process-wrapper itself creates no files that
+  // would care.
+  umask(022);
+  posix_spawnattr_t attr;
+  CHECK_SPAWN_CALL(posix_spawnattr_init(&attr));
+  sigset_t signals;
+  CHECK_CALL(sigemptyset(&signals));
+  CHECK_SPAWN_CALL(posix_spawnattr_setsigmask(&attr, &signals));
+  CHECK_CALL(sigfillset(&signals));
+  CHECK_SPAWN_CALL(posix_spawnattr_setsigdefault(&attr, &signals));
+  CHECK_SPAWN_CALL(posix_spawnattr_setflags(
+      &attr,
+      POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF));
+  posix_spawn_file_actions_t actions;
+  CHECK_SPAWN_CALL(posix_spawn_file_actions_init(&actions));
+#ifdef __linux__
+  for (int i = 0; i < 2; ++i) {
+    if (global_captures[i].child_fd >= 0) {
+      CHECK_SPAWN_CALL(posix_spawn_file_actions_adddup2(
+          &actions, global_captures[i].child_fd, global_captures[i].out_fd));
+    }
+  }
+#endif
+
+  pid_t pid;
+  int error;
+  if (strchr(argv[0], '/') != NULL) {
+    error = posix_spawn(&pid, argv[0], &actions, &attr, argv, environ);
+  } else {
+    error = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+  }
+  if (error != 0) {
+    errno = error;
+    err(EXIT_FAILURE, "execvp(\"%s\", ...)", argv[0]);
+  }
+  global_child_pid = pid;
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+}
+#endif
+
+// Starts the command of "argv" as global_child_pid, in a session of its own,
+// with an empty signal mask, the default signal dispositions and umask 022,
+// so that output permissions are predictable. Where posix_spawn(3) can make a
+// session, the child is spawned without copying the page tables, and without
+// a PATH search for an absolute path, which adds up for large processes;
+// unless it has to move to a cgroup first.
+static void StartChild(char *const *argv) {
+#ifdef POSIX_SPAWN_SETSID
+  if (global_cgroup_procs_fd < 0) {
+    SpawnChild(argv);
+    return;
+  }
+#endif
   CHECK_CALL(global_child_pid = fork());
   if (global_child_pid == 0) {
     // In child.
+    if (global_cgroup_procs_fd >= 0) {
+      CHECK_CALL(write(global_cgroup_procs_fd, "0", 1));
+    }
     CHECK_CALL(setsid());
     ClearSignalMask();
+#ifdef __linux__
+    for (int i = 0; i < 2; ++i) {
+      if (global_captures[i].child_fd >= 0) {
+        CHECK_CALL(dup2(global_captures[i].child_fd,
+                        global_captures[i].out_fd));
+      }
+    }
+#endif
 
     // Force umask to include read and execute for everyone, to make
     // output permissions predictable.
@@ -120,34 +702,103 @@ static void SpawnCommand(char *const *argv, double timeout_secs) {
     // Does not return unless something went wrong.
     execvp(argv[0], argv);
     err(EXIT_FAILURE, "execvp(\"%s\", ...)", argv[0]);
-  } else {
-    // In parent.
+  }
+}
 
-    // Set up a signal handler which kills all subprocesses when the given
-    // signal is triggered.
-    HandleSignal(SIGALRM, OnSignal);
-    HandleSignal(SIGTERM, OnSignal);
-    HandleSignal(SIGINT, OnSignal);
-    SetTimeout(timeout_secs);
+// Run the command specified by the argv array and kill it after timeout
+// seconds.
+static void SpawnCommand(char *const *argv, double timeout_secs,
+                         const char *stats_path, uint64_t output_limit,
+                         const char *cgroup_parent) {
+#ifdef __linux__
+  if (output_limit > 0) {
+    for (int i = 0; i < 2; ++i) {
+      StartCapture(&global_captures[i], output_limit);
+    }
+  }
+  if (cgroup_parent != NULL) {
+    CreateCgroup(cgroup_parent);
+  }
 
-    int status = WaitChild(global_child_pid, argv[0]);
+  // Blocked before the fork, so that none goes missing before the signalfd
+  // exists; the child unblocks them.
+  sigset_t signals;
+  CHECK_CALL(sigemptyset(&signals));
+  CHECK_CALL(sigaddset(&signals, SIGTERM));
+  CHECK_CALL(sigaddset(&signals, SIGINT));
+  CHECK_CALL(sigaddset(&signals, SIGCHLD));
+  CHECK_CALL(sigprocmask(SIG_BLOCK, &signals, NULL));
+  // The processes of the group that outlive their parent become ours, so that
+  // SIGCHLD tells when they are gone.
+  CHECK_CALL(prctl(PR_SET_CHILD_SUBREAPER, 1));
+#endif
 
-    // The child is done for, but may have grandchildren that we still have to
-    // kill.
-    kill(-global_child_pid, SIGKILL);
+  struct timespec start;
+  CHECK_CALL(clock_gettime(CLOCK_MONOTONIC, &start));
+  uint64_t phase_start = BlazeTraceNow();
+  StartChild(argv);
+  BlazeTraceSpan("spawn", argv[0], phase_start);
+  phase_start = BlazeTraceNow();
 
-    if (global_signal > 0) {
-      // Don't trust the exit code if we got a timeout or signal.
-      UnHandle(global_signal);
-      raise(global_signal);
-    } else if (WIFEXITED(status)) {
-      exit(WEXITSTATUS(status));
-    } else {
-      int sig = WTERMSIG(status);
-      UnHandle(sig);
-      raise(sig);
+  struct rusage rusage;
+#ifdef __linux__
+  for (int i = 0; i < 2; ++i) {
+    if (global_captures[i].child_fd >= 0) {
+      CHECK_CALL(close(global_captures[i].child_fd));
     }
   }
+  int status =
+      WaitChildWithTimeout(global_child_pid, timeout_secs, &signals, &rusage);
+  CHECK_CALL(sigprocmask(SIG_UNBLOCK, &signals, NULL));
+  // The child and the descendants it waited for, and those we reaped as
+  // their subreaper.
+  CHECK_CALL(getrusage(RUSAGE_CHILDREN, &rusage));
+#else
+  // Set up a signal handler which kills all subprocesses when the given
+  // signal is triggered.
+  HandleSignal(SIGALRM, OnSignal);
+  HandleSignal(SIGTERM, OnSignal);
+  HandleSignal(SIGINT, OnSignal);
+  SetTimeout(timeout_secs);
+
+  int status = WaitChildWithRusage(global_child_pid, argv[0], &rusage);
+#endif
+  struct timespec end;
+  CHECK_CALL(clock_gettime(CLOCK_MONOTONIC, &end));
+  BlazeTraceSpan("wait", argv[0], phase_start);
+  if (stats_path != NULL) {
+    long long wall_time_micros =
+        (end.tv_sec - start.tv_sec) * 1000000LL +
+        (end.tv_nsec - start.tv_nsec) / 1000;
+    WriteStatsToFile(wall_time_micros, &rusage, stats_path);
+    WriteOutputStatsToFile(stats_path);
+  }
+
+  // The child is done for, but may have grandchildren that we still have to
+  // kill.
+#ifdef __linux__
+  if (global_cgroup_events_fd >= 0) {
+    RemoveCgroup();
+  } else {
+    kill(-global_child_pid, SIGKILL);
+  }
+#else
+  kill(-global_child_pid, SIGKILL);
+#endif
+
+  // Neither raise() nor a signal runs the atexit handlers.
+  BlazeTraceWrite();
+  if (global_signal > 0) {
+    // Don't trust the exit code if we got a timeout or signal.
+    UnHandle(global_signal);
+    raise(global_signal);
+  } else if (WIFEXITED(status)) {
+    exit(WEXITSTATUS(status));
+  } else {
+    int sig = WTERMSIG(status);
+    UnHandle(sig);
+    raise(sig);
+  }
 }
 
 int main(int argc, char *argv[]) {
@@ -155,6 +806,7 @@ int main(int argc, char *argv[]) {
   memset(&opt, 0, sizeof(opt));
 
   ParseCommandLine(argc, argv, &opt);
+  BlazeTraceInit("process-wrapper", NULL);
   global_kill_delay = opt.kill_delay_secs;
 
   SwitchToEuid();
@@ -163,7 +815,8 @@ int main(int argc, char *argv[]) {
   RedirectStdout(opt.stdout_path);
   RedirectStderr(opt.stderr_path);
 
-  SpawnCommand(opt.args, opt.timeout_secs);
+  SpawnCommand(opt.args, opt.timeout_secs, opt.stats_path, opt.output_limit,
+               opt.cgroup_parent);
 
   return 0;
 }
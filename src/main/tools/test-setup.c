@@ -0,0 +1,265 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// test-setup does what tools/test/test-setup.sh does before and after a test,
+// without starting a shell and the utilities it calls:
+//
+//   test-setup <test> [<args>...]
+//
+// It makes the paths in TEST_SRCDIR, JAVA_RUNFILES, PYTHON_RUNFILES,
+// TEST_TMPDIR and XML_OUTPUT_FILE absolute, passes the sharding to googletest,
+// exports RUNFILES_MANIFEST_FILE and the rlocation shell function, changes to
+// the runfiles directory of the workspace and runs the test, found through
+// the runfiles. If the test did not write XML_OUTPUT_FILE, a default one is
+// written. The exit status is that of the test, or 128 plus the signal that
+// killed it, as with the script.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "process-tools.h"
+
+// Not in headers on OSX.
+extern char **environ;
+
+// The rlocation() bash function of test-setup.sh, in the form bash imports
+// exported functions from the environment in.
+#define RLOCATION_FUNCTION_VARIABLE "BASH_FUNC_rlocation%%"
+static const char kRlocation[] =
+    "() {  if [[ \"$1\" = /* ]]; then\n"
+    " echo $1;\n"
+    " else\n"
+    " echo \"$(dirname $RUNFILES_MANIFEST_FILE)/$1\";\n"
+    " fi\n"
+    "}";
+static const char kRlocationManifestOnly[] =
+    "() {  if [[ \"$1\" = /* ]]; then\n"
+    " echo $1;\n"
+    " else\n"
+    " echo $(grep \"^$1 \" $RUNFILES_MANIFEST_FILE | awk '{ print $2 }');\n"
+    " fi\n"
+    "}";
+
+// Returns the concatenation of a, b and c, to be freed by the caller.
+static char *Concat(const char *a, const char *b, const char *c) {
+  size_t a_len = strlen(a), b_len = strlen(b), c_len = strlen(c);
+  char *result = malloc(a_len + b_len + c_len + 1);
+  CHECK_NOT_NULL(result);
+  memcpy(result, a, a_len);
+  memcpy(result + a_len, b, b_len);
+  memcpy(result + a_len + b_len, c, c_len + 1);
+  return result;
+}
+
+static const char *GetEnv(const char *name) {
+  const char *value = getenv(name);
+  return value == NULL ? "" : value;
+}
+
+static void SetEnv(const char *name, const char *value) {
+  CHECK_CALL(setenv(name, value, 1));
+}
+
+// Returns the working directory the way bash sets $PWD: $PWD from the
+// environment if it is an absolute name of the working directory, which
+// keeps the symlinks in it, the physical path otherwise.
+static char *GetWorkingDirectory() {
+  const char *pwd = getenv("PWD");
+  struct stat pwd_stat, dot_stat;
+  if (pwd != NULL && pwd[0] == '/' && stat(pwd, &pwd_stat) == 0 &&
+      stat(".", &dot_stat) == 0 && pwd_stat.st_dev == dot_stat.st_dev &&
+      pwd_stat.st_ino == dot_stat.st_ino) {
+    return Concat(pwd, "", "");
+  }
+  char *cwd = getcwd(NULL, 0);
+  CHECK_NOT_NULL(cwd);
+  return cwd;
+}
+
+// Makes the path in the environment variable name absolute, relative to cwd.
+static void MakeAbsolute(const char *name, const char *cwd) {
+  const char *value = GetEnv(name);
+  if (value[0] != '/') {
+    char *absolute = Concat(cwd, "/", value);
+    SetEnv(name, absolute);
+    free(absolute);
+  }
+}
+
+// Returns the second field of the line of the runfiles manifest that starts
+// with path, like rlocation() does with RUNFILES_MANIFEST_ONLY set, or an
+// empty string.
+static char *LookUpManifest(const char *manifest, const char *path) {
+  FILE *file = fopen(manifest, "r");
+  if (file == NULL) {
+    fprintf(stderr, "%s: %s\n", manifest, strerror(errno));
+    return Concat("", "", "");
+  }
+  size_t path_len = strlen(path);
+  char *line = NULL;
+  size_t capacity = 0;
+  char *result = NULL;
+  while (result == NULL && getline(&line, &capacity, file) != -1) {
+    if (strncmp(line, path, path_len) == 0 && line[path_len] == ' ') {
+      char *target = line + path_len + strspn(line + path_len, " \t");
+      target[strcspn(target, " \t\n")] = '\0';
+      result = Concat(target, "", "");
+    }
+  }
+  free(line);
+  fclose(file);
+  return result == NULL ? Concat("", "", "") : result;
+}
+
+// Runs the test and returns its exit status the way the shell reports it.
+static int RunTest(const char *exe, char *argv[]) {
+  argv[0] = (char *)exe;
+  pid_t pid;
+  int error = posix_spawnp(&pid, exe, NULL, NULL, argv, environ);
+  if (error != 0) {
+    fprintf(stderr, "%s: %s\n", exe, strerror(error));
+    return error == ENOENT ? 127 : 126;
+  }
+  int status;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      DIE("waitpid: %s\n", strerror(errno));
+    }
+  }
+  return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+// Writes the XML output file to report the result of a test that did not
+// write one itself.
+static void WriteDefaultXml(const char *path, const char *test_name,
+                            int exit_code) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return;
+  }
+  fprintf(file,
+          "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          "<testsuites>\n"
+          "  <testsuite name=\"%s\" tests=\"1\" failures=\"0\" "
+          "errors=\"%d\">\n",
+          test_name, exit_code != 0);
+  fprintf(file, "    <testcase name=\"%s\" status=\"run\">", test_name);
+  if (exit_code != 0) {
+    fprintf(file, "<error message=\"exited with error code %d\"></error>",
+            exit_code);
+  }
+  fprintf(file, "</testcase>\n  </testsuite>\n</testsuites>\n");
+  fclose(file);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    DIE("Usage: %s <test> [<args>...]\n", argv[0]);
+  }
+
+  // Shift stderr to stdout.
+  CHECK_CALL(dup2(STDOUT_FILENO, STDERR_FILENO));
+
+  // Executing the test log will page it.
+  printf("exec ${PAGER:-/usr/bin/less} \"$0\" || exit 1\n");
+
+  // Bazel sets some environment variables to paths relative to the exec
+  // root.
+  char *cwd = GetWorkingDirectory();
+  MakeAbsolute("TEST_SRCDIR", cwd);
+  MakeAbsolute("JAVA_RUNFILES", cwd);
+  MakeAbsolute("PYTHON_RUNFILES", cwd);
+  MakeAbsolute("TEST_TMPDIR", cwd);
+  MakeAbsolute("XML_OUTPUT_FILE", cwd);
+  free(cwd);
+
+  // Tell googletest about Bazel sharding.
+  const char *total_shards = getenv("TEST_TOTAL_SHARDS");
+  if (total_shards != NULL && strtol(total_shards, NULL, 10) != 0) {
+    SetEnv("GTEST_SHARD_INDEX", GetEnv("TEST_SHARD_INDEX"));
+    SetEnv("GTEST_TOTAL_SHARDS", total_shards);
+  }
+  SetEnv("GTEST_TMP_DIR", GetEnv("TEST_TMPDIR"));
+
+  char *manifest = Concat(GetEnv("TEST_SRCDIR"), "/MANIFEST", "");
+  bool manifest_only = GetEnv("RUNFILES_MANIFEST_ONLY")[0] != '\0';
+  SetEnv(RLOCATION_FUNCTION_VARIABLE,
+         manifest_only ? kRlocationManifestOnly : kRlocation);
+  SetEnv("RUNFILES_MANIFEST_FILE", manifest);
+
+  // Tests run in the runfiles directory of their workspace, so that they only
+  // have direct access to their declared dependencies.
+  const char *workspace = GetEnv("TEST_WORKSPACE");
+  char *dir = workspace[0] == '\0'
+                  ? Concat(GetEnv("TEST_SRCDIR"), "", "")
+                  : Concat(GetEnv("TEST_SRCDIR"), "/", workspace);
+  if (chdir(dir) == -1) {
+    printf("Could not chdir %s\n", dir);
+    return 1;
+  }
+  free(dir);
+
+  // This header marks where --test_output=streamed will start being printed.
+  printf(
+      "-------------------------------------------------------------------"
+      "----------\n");
+  fflush(stdout);
+
+  // If the test is at the top of the tree, it is found through ".".
+  char *path = Concat(".:", GetEnv("PATH"), "");
+  SetEnv("PATH", path);
+  free(path);
+
+  // The test is usually a path below the runfiles of the workspace, but with
+  // --run_under it can be a "/bin/bash -c" command line.
+  const char *test_name = argv[1];
+  char *exe;
+  if (test_name[0] == '/') {
+    exe = Concat(test_name, "", "");
+  } else {
+    char *runfile = Concat(workspace, "/", test_name);
+    if (manifest_only) {
+      exe = LookUpManifest(manifest, runfile);
+    } else {
+      // dirname $RUNFILES_MANIFEST_FILE is TEST_SRCDIR.
+      exe = Concat(GetEnv("TEST_SRCDIR"), "/", runfile);
+    }
+    free(runfile);
+  }
+  free(manifest);
+
+  int exit_code = RunTest(exe, argv + 1);
+
+  const char *xml_output_file = GetEnv("XML_OUTPUT_FILE");
+  struct stat xml_stat;
+  if (xml_output_file[0] != '\0' &&
+      !(stat(xml_output_file, &xml_stat) == 0 && S_ISREG(xml_stat.st_mode))) {
+    WriteDefaultXml(xml_output_file, test_name, exit_code);
+  }
+
+  free(exe);
+  return exit_code;
+}
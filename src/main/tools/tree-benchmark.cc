@@ -0,0 +1,320 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures build-runfiles and zipper on a large synthetic tree:
+//
+//   tree-benchmark [--build_runfiles=<path>] [--zipper=<path>]
+//       [--files=N] [--depth=N] [--size=<bytes>] [--runs=N] [--scratch=<dir>]
+//       [--scenarios=fresh,noop,churn_1,churn_50]
+//       [--build_runfiles_flags="<flags>"] [--zipper_threads=N]
+//
+// It creates --files files of --size bytes, spread over directories --depth
+// levels deep, and a runfiles manifest of them. For build-runfiles, it times
+// one of the scenarios per run:
+//
+//   fresh:    the runfiles tree is deleted before every run;
+//   noop:     the manifest is the same as in the run before;
+//   churn_N:  N% of the entries point elsewhere than in the run before.
+//
+// For zipper, it times the creation of a zip of the tree, with the files
+// stored and compressed, and its extraction into an empty directory. For each
+// it prints the percentiles of the wall time over the runs. Run it before and
+// after a change to either tool, e.g. to compare its parallel or incremental
+// modes with the serial code.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <string>
+#include <vector>
+
+#include "src/main/tools/benchmark-util.h"
+
+namespace {
+
+using benchmark_util::Flag;
+using benchmark_util::Percentile;
+using benchmark_util::RunProcess;
+using benchmark_util::Split;
+using std::string;
+using std::vector;
+
+struct Options {
+  string build_runfiles;
+  string zipper;
+  string scratch;
+  vector<string> scenarios = {"fresh", "noop", "churn_1", "churn_50"};
+  vector<string> build_runfiles_flags;
+  int files = 100000;
+  int depth = 4;
+  int size = 100;
+  int runs = 10;
+  int zipper_threads = 1;
+};
+
+void Die(const char *format, const string &arg) {
+  fprintf(stderr, "tree-benchmark: ");
+  fprintf(stderr, format, arg.c_str());
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+void DeleteTree(const string &path) {
+  string err;
+  RunProcess("/", {"/bin/rm", "-rf", path}, &err);
+}
+
+void MakeDirectory(const string &path) {
+  if (mkdir(path.c_str(), 0755) == -1 && errno != EEXIST) {
+    Die("mkdir(%s) failed", path);
+  }
+}
+
+void WriteFile(const string &path, const string &content) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    Die("open(%s) failed", path);
+  }
+  if (write(fd, content.data(), content.size()) !=
+      static_cast<ssize_t>(content.size())) {
+    Die("write(%s) failed", path);
+  }
+  close(fd);
+}
+
+// The paths of the files of the tree, relative to its root, in the order of
+// their creation: the directories of a level have 'fanout' entries each.
+vector<string> TreePaths(const Options &options) {
+  int fanout = static_cast<int>(
+      ceil(pow(options.files, 1.0 / (options.depth + 1))));
+  vector<string> paths;
+  for (int i = 0; i < options.files; ++i) {
+    string path;
+    int rest = i / fanout;
+    for (int level = 0; level < options.depth; ++level) {
+      path = "d" + std::to_string(rest % fanout) + "/" + path;
+      rest /= fanout;
+    }
+    paths.push_back(path + "f" + std::to_string(i));
+  }
+  return paths;
+}
+
+void CreateTree(const string &root, const vector<string> &paths, int size) {
+  string content(size, 'x');
+  for (const string &path : paths) {
+    // Create the parent directories on the way.
+    for (size_t slash = path.find('/'); slash != string::npos;
+         slash = path.find('/', slash + 1)) {
+      MakeDirectory(root + "/" + path.substr(0, slash));
+    }
+    WriteFile(root + "/" + path, content + path);
+  }
+}
+
+// Writes the runfiles manifest of the tree. The entries whose index modulo 100
+// is below 'churn' point to 'other' rather than to their file.
+void WriteManifest(const string &manifest, const string &root,
+                   const vector<string> &paths, int churn,
+                   const string &other) {
+  string content;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    content += "__main__/" + paths[i] + " " +
+               (static_cast<int>(i % 100) < churn ? other
+                                                  : root + "/" + paths[i]) +
+               "\n";
+  }
+  WriteFile(manifest, content);
+}
+
+double TimeProcess(const string &cwd, const vector<string> &args) {
+  string err;
+  auto start = std::chrono::steady_clock::now();
+  int exit_code = RunProcess(cwd, args, &err);
+  auto end = std::chrono::steady_clock::now();
+  if (exit_code == -1) {
+    Die("running a process failed: %s", strerror(errno));
+  }
+  if (exit_code != 0) {
+    fprintf(stderr, "%s", err.c_str());
+    Die("%s failed", args[0]);
+  }
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void Report(const string &name, vector<double> values) {
+  std::sort(values.begin(), values.end());
+  printf("%-38s %9.1f %9.1f %9.1f %9.1f\n", name.c_str(),
+         Percentile(values, 50), Percentile(values, 90),
+         Percentile(values, 99), values.back());
+}
+
+vector<double> RunBuildRunfiles(const Options &options,
+                                const string &scenario, const string &root,
+                                const vector<string> &paths) {
+  string manifest = options.scratch + "/MANIFEST";
+  string runfiles = options.scratch + "/runfiles";
+  vector<string> args = {options.build_runfiles};
+  args.insert(args.end(), options.build_runfiles_flags.begin(),
+              options.build_runfiles_flags.end());
+  args.push_back(manifest);
+  args.push_back(runfiles);
+
+  int churn = 0;
+  if (scenario.compare(0, 6, "churn_") == 0) {
+    churn = atoi(scenario.c_str() + 6);
+  } else if (scenario != "fresh" && scenario != "noop") {
+    Die("unknown scenario %s", scenario);
+  }
+
+  DeleteTree(runfiles);
+  WriteManifest(manifest, root, paths, 0, "");
+  TimeProcess(options.scratch, args);
+  vector<double> times;
+  for (int i = 0; i < options.runs; ++i) {
+    if (scenario == "fresh") {
+      DeleteTree(runfiles);
+    } else if (churn > 0) {
+      // Flip the churned entries between their file and the manifest itself.
+      WriteManifest(manifest, root, paths, i % 2 == 0 ? churn : 0, manifest);
+    }
+    times.push_back(TimeProcess(options.scratch, args));
+  }
+  DeleteTree(runfiles);
+  return times;
+}
+
+void RunZipper(const Options &options, const string &root,
+               const vector<string> &paths) {
+  string filelist = options.scratch + "/filelist";
+  string content;
+  for (const string &path : paths) {
+    if (!content.empty()) {
+      content += "\n";
+    }
+    content += path + "=" + root + "/" + path;
+  }
+  WriteFile(filelist, content);
+
+  string zip = options.scratch + "/tree.zip";
+  string threads = std::to_string(options.zipper_threads);
+  for (const char *mode : {"c", "cC"}) {
+    vector<double> create;
+    vector<double> extract;
+    for (int i = 0; i < options.runs; ++i) {
+      unlink(zip.c_str());
+      create.push_back(TimeProcess(
+          options.scratch,
+          {options.zipper, mode, zip, "-j", threads, "@" + filelist}));
+      // The directory of -d is relative to the current one.
+      DeleteTree(options.scratch + "/extracted");
+      MakeDirectory(options.scratch + "/extracted");
+      extract.push_back(TimeProcess(
+          options.scratch,
+          {options.zipper, "x", zip, "-j", threads, "-d", "extracted"}));
+    }
+    bool compressed = mode[1] == 'C';
+    Report(compressed ? "zipper create, compressed" : "zipper create, stored",
+           create);
+    Report(compressed ? "zipper extract, compressed" : "zipper extract, stored",
+           extract);
+  }
+  DeleteTree(options.scratch + "/extracted");
+  unlink(zip.c_str());
+  unlink(filelist.c_str());
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  const char *tmp_dir = getenv("TEST_TMPDIR");
+  options.scratch = tmp_dir != NULL ? tmp_dir : "/tmp";
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (Flag(argv[i], "build_runfiles", &options.build_runfiles)) {
+    } else if (Flag(argv[i], "zipper", &options.zipper)) {
+    } else if (Flag(argv[i], "scratch", &options.scratch)) {
+    } else if (Flag(argv[i], "files", &value)) {
+      options.files = atoi(value.c_str());
+    } else if (Flag(argv[i], "depth", &value)) {
+      options.depth = atoi(value.c_str());
+    } else if (Flag(argv[i], "size", &value)) {
+      options.size = atoi(value.c_str());
+    } else if (Flag(argv[i], "runs", &value)) {
+      options.runs = atoi(value.c_str());
+    } else if (Flag(argv[i], "zipper_threads", &value)) {
+      options.zipper_threads = atoi(value.c_str());
+    } else if (Flag(argv[i], "scenarios", &value)) {
+      options.scenarios = Split(value, ',');
+    } else if (Flag(argv[i], "build_runfiles_flags", &value)) {
+      options.build_runfiles_flags = Split(value, ' ');
+    } else {
+      Die("unknown argument %s", argv[i]);
+    }
+  }
+  if ((options.build_runfiles.empty() && options.zipper.empty()) ||
+      options.files < 1 || options.depth < 0 || options.size < 0 ||
+      options.runs < 1 || options.zipper_threads < 1) {
+    Die("usage: %s [--build_runfiles=<path>] [--zipper=<path>] [--files=N] "
+        "...",
+        argv[0]);
+  }
+  // The tools run in the scratch directory, so their paths must not be
+  // relative.
+  for (string *tool : {&options.build_runfiles, &options.zipper}) {
+    if (!tool->empty() && (*tool)[0] != '/') {
+      char cwd[PATH_MAX];
+      if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        Die("getcwd: %s", strerror(errno));
+      }
+      *tool = string(cwd) + "/" + *tool;
+    }
+  }
+  options.scratch += "/tree-benchmark";
+  DeleteTree(options.scratch);
+  MakeDirectory(options.scratch);
+
+  string root = options.scratch + "/tree";
+  MakeDirectory(root);
+  vector<string> paths = TreePaths(options);
+  CreateTree(root, paths, options.size);
+
+  printf("%d files of %d bytes, %d levels deep, %d runs\n", options.files,
+         options.size, options.depth, options.runs);
+  printf("%-38s %9s %9s %9s %9s\n", "", "p50 ms", "p90 ms", "p99 ms",
+         "max ms");
+  if (!options.build_runfiles.empty()) {
+    for (const string &scenario : options.scenarios) {
+      Report("build-runfiles " + scenario,
+             RunBuildRunfiles(options, scenario, root, paths));
+    }
+  }
+  if (!options.zipper.empty()) {
+    RunZipper(options, root, paths);
+  }
+
+  DeleteTree(options.scratch);
+  return 0;
+}
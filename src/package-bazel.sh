@@ -45,3 +45,6 @@ if [ -n "${EMBEDDED_TOOLS}" ]; then
 fi
 
 (cd ${PACKAGE_DIR} && find . -type f | sort | zip -qDX@ ${WORKDIR}/${OUT})
+# The client reads the install base key from the zip comment, which is at the
+# very end of the binary, so that it need not go through the whole zip.
+zip -qz ${WORKDIR}/${OUT} < ${INSTALL_BASE_KEY}
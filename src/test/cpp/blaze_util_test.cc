@@ -16,6 +16,9 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <string>
 #include <vector>
@@ -23,6 +26,7 @@
 #include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/blaze_util_platform.h"
 #include "src/main/cpp/util/file.h"
+#include "src/main/cpp/util/file_platform.h"
 #include "gtest/gtest.h"
 
 namespace blaze {
@@ -237,6 +241,252 @@ TEST_F(BlazeUtilTest, MakeDirectories) {
   ASSERT_EQ(EACCES, errno);
 }
 
+TEST_F(BlazeUtilTest, GetCachedJvmVersion) {
+  const char* tmp_dir = getenv("TEST_TMPDIR");
+  ASSERT_STRNE(tmp_dir, NULL);
+
+  string java_home = blaze_util::JoinPath(tmp_dir, "jdk");
+  ASSERT_TRUE(MakeDirectories(blaze_util::JoinPath(java_home, "bin"), 0755));
+  string java = blaze_util::JoinPath(java_home, "bin/java");
+  string runs = blaze_util::JoinPath(tmp_dir, "java_runs");
+  string cache = blaze_util::JoinPath(tmp_dir, "java_version");
+  ASSERT_TRUE(WriteFile("#!/bin/sh\necho x >> " + runs +
+                        "\necho 'java version \"1.8.0\"' >&2\n", java));
+  ASSERT_EQ(0, chmod(java.c_str(), 0755));
+
+  // The second probe is answered from the cache.
+  ASSERT_EQ("1.8.0", GetCachedJvmVersion(java, cache));
+  ASSERT_EQ("1.8.0", GetCachedJvmVersion(java, cache));
+  string content;
+  ASSERT_TRUE(ReadFile(runs, &content));
+  ASSERT_EQ("x\n", content);
+
+  // Replacing the JDK invalidates the cache.
+  ASSERT_TRUE(WriteFile("java 9", blaze_util::JoinPath(java_home, "release")));
+  ASSERT_TRUE(WriteFile("#!/bin/sh\necho x >> " + runs +
+                        "\necho 'java version \"9\"' >&2\n", java));
+  ASSERT_EQ("9", GetCachedJvmVersion(java, cache));
+  ASSERT_TRUE(ReadFile(runs, &content));
+  ASSERT_EQ("x\nx\n", content);
+}
+
+TEST_F(BlazeUtilTest, AddMachineAwareJvmArguments) {
+  const uint64_t kGiB = 1024 * 1024 * 1024;
+  std::vector<string> result;
+  AddMachineAwareJvmArguments(4 * kGiB, 2, {}, &result);
+  ASSERT_EQ(std::vector<string>({"-Xmx2048m", "-Xms512m", "-XX:+UseParallelGC",
+                                 "-XX:ParallelGCThreads=2"}),
+            result);
+
+  // Large heaps are capped below the limit of compressed pointers.
+  result.clear();
+  AddMachineAwareJvmArguments(256 * kGiB, 64, {}, &result);
+  ASSERT_EQ(std::vector<string>({"-Xmx31744m", "-Xms7936m", "-XX:+UseG1GC",
+                                 "-XX:ParallelGCThreads=64"}),
+            result);
+
+  // The settings of the user are left alone, and a heap size of the user gets
+  // no other size that could contradict it.
+  result.clear();
+  AddMachineAwareJvmArguments(16 * kGiB, 8, {"-Xmx1g", "-XX:+UseSerialGC"},
+                              &result);
+  ASSERT_EQ(std::vector<string>(), result);
+  result.clear();
+  AddMachineAwareJvmArguments(16 * kGiB, 8, {"-XX:MaxRAMPercentage=10"},
+                              &result);
+  ASSERT_EQ(std::vector<string>({"-XX:+UseG1GC", "-XX:ParallelGCThreads=8"}),
+            result);
+  result.clear();
+  AddMachineAwareJvmArguments(16 * kGiB, 8, {"-Xms1g"}, &result);
+  ASSERT_EQ(std::vector<string>({"-XX:+UseG1GC", "-XX:ParallelGCThreads=8"}),
+            result);
+
+  // Too little or unknown memory only gets the collector.
+  result.clear();
+  AddMachineAwareJvmArguments(0, 1, {}, &result);
+  ASSERT_EQ(std::vector<string>({"-XX:+UseParallelGC",
+                                 "-XX:ParallelGCThreads=1"}),
+            result);
+}
+
+TEST_F(BlazeUtilTest, CreateLocalOutputRoot) {
+  const char* tmp_dir = getenv("TEST_TMPDIR");
+  ASSERT_STRNE(tmp_dir, NULL);
+
+  // Others could replace the output user root in a shared directory that is
+  // not sticky.
+  string shared = blaze_util::JoinPath(tmp_dir, "scratch");
+  ASSERT_TRUE(MakeDirectories(shared, 0755));
+  ASSERT_EQ(0, chmod(shared.c_str(), 0777));
+  string root = blaze_util::JoinPath(shared, "_bazel_me");
+  string error;
+  ASSERT_FALSE(CreateLocalOutputRoot(shared, root, &error));
+  ASSERT_NE(string::npos, error.find("not sticky")) << error;
+  ASSERT_FALSE(blaze_util::PathExists(root));
+
+  ASSERT_EQ(0, chmod(shared.c_str(), 01777));
+  ASSERT_TRUE(CreateLocalOutputRoot(shared, root, &error)) << error;
+  struct stat filestat = {};
+  ASSERT_EQ(0, stat(root.c_str(), &filestat));
+  ASSERT_EQ(0700, filestat.st_mode & 0777);
+
+  ASSERT_FALSE(CreateLocalOutputRoot(
+      blaze_util::JoinPath(tmp_dir, "nonexistent"), root, &error));
+}
+
+TEST_F(BlazeUtilTest, IsOwnedByRoot) {
+  const char* tmp_dir = getenv("TEST_TMPDIR");
+  ASSERT_STRNE(tmp_dir, NULL);
+
+  string error;
+  ASSERT_FALSE(
+      IsOwnedByRoot(blaze_util::JoinPath(tmp_dir, "nonexistent"), &error));
+  ASSERT_NE(string::npos, error.find("does not exist")) << error;
+
+  string dir = blaze_util::JoinPath(tmp_dir, "shared_install_root");
+  ASSERT_TRUE(MakeDirectories(dir, 0755));
+  if (getuid() != 0) {
+    ASSERT_FALSE(IsOwnedByRoot(dir, &error));
+    ASSERT_NE(string::npos, error.find("not owned by root")) << error;
+  }
+  // Whoever owns it, others could change what is in it.
+  ASSERT_EQ(0, chmod(dir.c_str(), 01777));
+  ASSERT_FALSE(IsOwnedByRoot(dir, &error));
+  ASSERT_EQ(0, chmod(dir.c_str(), 0755));
+
+  string file = blaze_util::JoinPath(dir, "file");
+  ASSERT_TRUE(CreateEmptyFile(file));
+  ASSERT_FALSE(IsOwnedByRoot(file, &error));
+  ASSERT_NE(string::npos, error.find("not a directory")) << error;
+}
+
+TEST_F(BlazeUtilTest, IsFileOwnedByRoot) {
+  const char* tmp_dir = getenv("TEST_TMPDIR");
+  ASSERT_STRNE(tmp_dir, NULL);
+
+  string error;
+  ASSERT_FALSE(IsFileOwnedByRoot(
+      blaze_util::JoinPath(tmp_dir, "nonexistent_file"), &error));
+  ASSERT_NE(string::npos, error.find("does not exist")) << error;
+
+  string file = blaze_util::JoinPath(tmp_dir, "root_file");
+  ASSERT_TRUE(CreateEmptyFile(file));
+  ASSERT_EQ(0, chmod(file.c_str(), 0644));
+  if (getuid() == 0) {
+    ASSERT_TRUE(IsFileOwnedByRoot(file, &error)) << error;
+  } else {
+    ASSERT_FALSE(IsFileOwnedByRoot(file, &error));
+    ASSERT_NE(string::npos, error.find("not owned by root")) << error;
+  }
+  // Whoever owns it, others could change it.
+  ASSERT_EQ(0, chmod(file.c_str(), 0664));
+  ASSERT_FALSE(IsFileOwnedByRoot(file, &error));
+
+  string link = blaze_util::JoinPath(tmp_dir, "root_file_link");
+  ASSERT_EQ(0, symlink(file.c_str(), link.c_str()));
+  ASSERT_FALSE(IsFileOwnedByRoot(link, &error));
+  ASSERT_NE(string::npos, error.find("is a symlink")) << error;
+}
+
+TEST_F(BlazeUtilTest, CloneOutputBase) {
+  const char* tmp_dir = getenv("TEST_TMPDIR");
+  ASSERT_STRNE(tmp_dir, NULL);
+
+  char* real_tmp_dir = realpath(tmp_dir, NULL);
+  ASSERT_STRNE(real_tmp_dir, NULL);
+  string root = blaze_util::JoinPath(real_tmp_dir, "clone_root");
+  free(real_tmp_dir);
+  string from = blaze_util::JoinPath(root, "template");
+  string to = blaze_util::JoinPath(root, "output_base");
+  ASSERT_TRUE(MakeDirectories(blaze_util::JoinPath(from, "server"), 0755));
+  ASSERT_TRUE(MakeDirectories(blaze_util::JoinPath(from, "external/repo"),
+                              0755));
+  ASSERT_TRUE(CreateEmptyFile(blaze_util::JoinPath(from, "lock")));
+  string file = blaze_util::JoinPath(from, "external/repo/file");
+  ASSERT_TRUE(WriteFile("contents", file));
+  ASSERT_EQ(0, chmod(file.c_str(), 0555));
+  ASSERT_EQ(0, chmod(blaze_util::JoinPath(from, "external/repo").c_str(),
+                     0555));
+  ASSERT_TRUE(Symlink(blaze_util::JoinPath(from, "external/repo"),
+                      blaze_util::JoinPath(from, "repo")));
+  ASSERT_TRUE(Symlink("/elsewhere", blaze_util::JoinPath(from, "other")));
+
+  // Not while its server runs.
+  string pid_file = blaze_util::JoinPath(from, "server/server.pid.txt");
+  ASSERT_TRUE(WriteFile(GetProcessIdAsString(), pid_file));
+  string error;
+  ASSERT_FALSE(CloneOutputBase(from, to, &error));
+  ASSERT_NE(string::npos, error.find("in use")) << error;
+  ASSERT_FALSE(blaze_util::PathExists(to));
+  ASSERT_EQ(0, unlink(pid_file.c_str()));
+
+  if (!CloneOutputBase(from, to, &error)) {
+    // The file system of the test cannot clone files.
+    ASSERT_NE(string::npos, error.find("cannot clone")) << error;
+    ASSERT_FALSE(blaze_util::PathExists(to));
+    return;
+  }
+  string contents;
+  ASSERT_TRUE(ReadFile(blaze_util::JoinPath(to, "external/repo/file"),
+                       &contents));
+  ASSERT_EQ("contents", contents);
+  struct stat filestat = {};
+  ASSERT_EQ(0, stat(blaze_util::JoinPath(to, "external/repo/file").c_str(),
+                    &filestat));
+  ASSERT_EQ(0555, filestat.st_mode & 0777);
+  ASSERT_EQ(0, stat(blaze_util::JoinPath(to, "external/repo").c_str(),
+                    &filestat));
+  ASSERT_EQ(0555, filestat.st_mode & 0777);
+  string target;
+  ASSERT_TRUE(ReadDirectorySymlink(blaze_util::JoinPath(to, "repo"), &target));
+  ASSERT_EQ(blaze_util::JoinPath(to, "external/repo"), target);
+  ASSERT_TRUE(
+      ReadDirectorySymlink(blaze_util::JoinPath(to, "other"), &target));
+  ASSERT_EQ("/elsewhere", target);
+  ASSERT_FALSE(blaze_util::PathExists(blaze_util::JoinPath(to, "server")));
+  ASSERT_FALSE(blaze_util::PathExists(blaze_util::JoinPath(to, "lock")));
+}
+
+TEST_F(BlazeUtilTest, DeleteStaleOutputBases) {
+  const char* tmp_dir = getenv("TEST_TMPDIR");
+  ASSERT_STRNE(tmp_dir, NULL);
+
+  string root = blaze_util::JoinPath(tmp_dir, "stale_root");
+  string stale = blaze_util::JoinPath(root, "0123456789abcdef0123456789abcdef");
+  string recent = blaze_util::JoinPath(root, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+  string keep = blaze_util::JoinPath(root, "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb");
+  string other = blaze_util::JoinPath(root, "install");
+  for (const string& dir : {stale, recent, keep, other}) {
+    // Bazel makes parts of the output tree read-only.
+    string read_only = blaze_util::JoinPath(dir, "execroot/read_only");
+    ASSERT_TRUE(MakeDirectories(read_only, 0755));
+    ASSERT_TRUE(CreateEmptyFile(blaze_util::JoinPath(read_only, "file")));
+    ASSERT_EQ(0, chmod(read_only.c_str(), 0555));
+    ASSERT_TRUE(CreateEmptyFile(blaze_util::JoinPath(dir, "lock")));
+  }
+  // A month and a day ago.
+  struct timeval times[2] = {{time(NULL) - 31 * 24 * 3600, 0},
+                             {time(NULL) - 31 * 24 * 3600, 0}};
+  for (const string& dir : {stale, keep, other}) {
+    ASSERT_EQ(0, utimes(blaze_util::JoinPath(dir, "lock").c_str(), times));
+  }
+
+  DeleteStaleOutputBases(root, keep, 30 * 24 * 3600);
+  ASSERT_FALSE(blaze_util::PathExists(stale));
+  // It is moved out of the way, then deleted in the background.
+  string deleted = blaze_util::JoinPath(
+      root, "deleted_output_base_0123456789abcdef0123456789abcdef");
+  for (int i = 0; i < 100 && blaze_util::PathExists(deleted); i++) {
+    usleep(50000);
+  }
+  ASSERT_FALSE(blaze_util::PathExists(deleted));
+  ASSERT_TRUE(blaze_util::PathExists(recent));
+  ASSERT_TRUE(blaze_util::PathExists(keep));
+  ASSERT_TRUE(blaze_util::PathExists(other));
+  ASSERT_TRUE(blaze_util::PathExists(
+      blaze_util::JoinPath(root, "stale_output_base_check")));
+}
+
 TEST_F(BlazeUtilTest, HammerMakeDirectories) {
   const char* tmp_dir = getenv("TEST_TMPDIR");
   ASSERT_STRNE(tmp_dir, NULL);
@@ -0,0 +1,103 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/main/cpp/blaze_util.h"
+#include "src/main/cpp/blaze_util_platform.h"
+#include "src/main/cpp/client_lib.h"
+#include "src/main/cpp/util/file.h"
+#include "gtest/gtest.h"
+
+namespace blaze {
+
+using std::string;
+
+class ClientLibTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    const char* tmp_dir = getenv("TEST_TMPDIR");
+    ASSERT_STRNE(NULL, tmp_dir);
+    output_base_ = blaze_util::JoinPath(tmp_dir, "client_lib_output_base");
+    server_dir_ = blaze_util::JoinPath(output_base_, "server");
+    ASSERT_TRUE(MakeDirectories(server_dir_, 0700));
+  }
+
+  void WriteServerFiles(const string& port) {
+    ASSERT_TRUE(WriteFile(port, server_dir_ + "/command_port"));
+    ASSERT_TRUE(WriteFile("request", server_dir_ + "/request_cookie"));
+    ASSERT_TRUE(WriteFile("response", server_dir_ + "/response_cookie"));
+  }
+
+  string output_base_;
+  string server_dir_;
+};
+
+TEST_F(ClientLibTest, ReadServerAddressOfLocalhost) {
+  WriteServerFiles("127.0.0.1:4711");
+  ServerAddress address;
+  ASSERT_TRUE(ReadServerAddress(output_base_, &address));
+  ASSERT_EQ("127.0.0.1:4711", address.target);
+  ASSERT_EQ("request", address.request_cookie);
+  ASSERT_EQ("response", address.response_cookie);
+
+  WriteServerFiles("[::1]:4711");
+  ASSERT_TRUE(ReadServerAddress(output_base_, &address));
+  ASSERT_EQ("[::1]:4711", address.target);
+}
+
+TEST_F(ClientLibTest, ReadServerAddressOfUnixSocket) {
+  // Only the socket in the server directory is trusted.
+  WriteServerFiles("unix:/elsewhere/server.socket");
+  ServerAddress address;
+  ASSERT_TRUE(ReadServerAddress(output_base_, &address));
+  ASSERT_EQ("unix:" + server_dir_ + "/server.socket", address.target);
+}
+
+TEST_F(ClientLibTest, ReadServerAddressRejectsOtherHosts) {
+  WriteServerFiles("10.0.0.1:4711");
+  ServerAddress address;
+  ASSERT_FALSE(ReadServerAddress(output_base_, &address));
+}
+
+TEST_F(ClientLibTest, ReadServerAddressWithoutServer) {
+  ServerAddress address;
+  ASSERT_FALSE(ReadServerAddress(output_base_ + "/none", &address));
+}
+
+TEST_F(ClientLibTest, StartRunsTheLauncherInTheWorkspace) {
+  // The launcher prints the output base of the workspace it runs in, where no
+  // server is running.
+  string launcher = output_base_ + "/launcher";
+  ASSERT_TRUE(WriteFile("#!/bin/sh\n[ \"$*\" = \"--foo info output_base\" ] &&"
+                        " echo \"$(pwd)\"/none",
+                        launcher));
+  ASSERT_EQ(0, chmod(launcher.c_str(), 0755));
+  string error;
+  std::unique_ptr<BlazeClient> client(
+      BlazeClient::Start(launcher, output_base_, {"--foo"}, &error));
+  ASSERT_EQ(nullptr, client.get());
+  ASSERT_NE(string::npos, error.find("no server is running in "));
+  ASSERT_NE(string::npos, error.find("/none"));
+
+  client.reset(BlazeClient::Start(launcher, output_base_, {}, &error));
+  ASSERT_EQ(nullptr, client.get());
+  ASSERT_EQ(launcher + " failed in " + output_base_, error);
+}
+
+}  // namespace blaze
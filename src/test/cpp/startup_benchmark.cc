@@ -0,0 +1,244 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the end-to-end latency of the launcher:
+//
+//   startup_benchmark --bazel=<launcher> --workspace=<dir> [--runs=N]
+//       [--scenarios=cold,warm,hot] [--commands=version,info,build]
+//       [--targets=//...] [--scratch=<dir>] [--startup_options="<opts>"]
+//
+// in three scenarios:
+//
+//   cold: a new --output_user_root for every run, so the install base is
+//         extracted and the server started each time;
+//   warm: the install base is there, but the server is shut down before every
+//         run;
+//   hot:  the server is running.
+//
+// and for the commands "version", "info" and "build --nobuild <targets>". For
+// each combination it prints the percentiles of the wall time over the runs,
+// then those of every startup phase the client logged with --client_debug
+// (see StartupPhaseTimer in blaze.cc). Run it on each platform to compare
+// them, and before and after a change to the client to catch regressions.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <map>
+#include <string>
+#include <vector>
+
+#include "src/main/tools/benchmark-util.h"
+
+namespace {
+
+using benchmark_util::Flag;
+using benchmark_util::Percentile;
+using benchmark_util::RunProcess;
+using benchmark_util::Split;
+using std::map;
+using std::string;
+using std::vector;
+
+struct Options {
+  string bazel;
+  string workspace;
+  string scratch;
+  string targets = "//...";
+  vector<string> startup_options;
+  vector<string> scenarios = {"cold", "warm", "hot"};
+  vector<string> commands = {"version", "info", "build"};
+  int runs = 10;
+};
+
+// The wall time of one run and the startup phases the client logged in it.
+struct Run {
+  double wall_ms;
+  map<string, double> phases;
+};
+
+void Die(const char *format, const string &arg) {
+  fprintf(stderr, "startup_benchmark: ");
+  fprintf(stderr, format, arg.c_str());
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+vector<string> BazelArgs(const Options &options, const string &user_root,
+                         const vector<string> &command) {
+  vector<string> args = {options.bazel, "--output_user_root=" + user_root};
+  args.insert(args.end(), options.startup_options.begin(),
+              options.startup_options.end());
+  args.insert(args.end(), command.begin(), command.end());
+  return args;
+}
+
+void Shutdown(const Options &options, const string &user_root) {
+  RunProcess(options.workspace, BazelArgs(options, user_root, {"shutdown"}),
+             NULL);
+}
+
+void DeleteTree(const Options &options, const string &path) {
+  // The install base is read-only.
+  RunProcess(options.workspace, {"/bin/chmod", "-R", "u+w", path}, NULL);
+  RunProcess(options.workspace, {"/bin/rm", "-rf", path}, NULL);
+}
+
+// Parses the "CLIENT: Startup phase at <start> ms took <duration> ms: <name>"
+// lines the client writes with --client_debug.
+map<string, double> ParsePhases(const string &err) {
+  map<string, double> phases;
+  const string marker = "Startup phase at ";
+  for (const string &line : Split(err, '\n')) {
+    size_t pos = line.find(marker);
+    if (pos == string::npos) {
+      continue;
+    }
+    unsigned long long start, duration;  // NOLINT
+    int name_offset;
+    if (sscanf(line.c_str() + pos + marker.size(), "%llu ms took %llu ms: %n",
+               &start, &duration, &name_offset) == 2) {
+      phases[line.substr(pos + marker.size() + name_offset)] += duration;
+    }
+  }
+  return phases;
+}
+
+Run TimeRun(const Options &options, const string &user_root,
+            const vector<string> &command) {
+  vector<string> args = BazelArgs(options, user_root, {"--client_debug"});
+  args.insert(args.end(), command.begin(), command.end());
+  string err;
+  auto start = std::chrono::steady_clock::now();
+  int exit_code = RunProcess(options.workspace, args, &err);
+  auto end = std::chrono::steady_clock::now();
+  if (exit_code == -1) {
+    Die("running a process failed: %s", strerror(errno));
+  }
+  if (exit_code != 0) {
+    fprintf(stderr, "%s", err.c_str());
+    Die("%s failed", command[0]);
+  }
+  Run run;
+  run.wall_ms =
+      std::chrono::duration<double, std::milli>(end - start).count();
+  run.phases = ParsePhases(err);
+  return run;
+}
+
+vector<Run> RunScenario(const Options &options, const string &scenario,
+                        const vector<string> &command) {
+  vector<Run> runs;
+  string user_root = options.scratch + "/" + scenario;
+  if (scenario != "cold") {
+    // Extract the install base, and for "hot", start the server.
+    TimeRun(options, user_root, command);
+  }
+  for (int i = 0; i < options.runs; ++i) {
+    if (scenario == "cold") {
+      DeleteTree(options, user_root);
+    } else if (scenario == "warm") {
+      Shutdown(options, user_root);
+    }
+    runs.push_back(TimeRun(options, user_root, command));
+    if (scenario == "cold") {
+      Shutdown(options, user_root);
+    }
+  }
+  Shutdown(options, user_root);
+  DeleteTree(options, user_root);
+  return runs;
+}
+
+void PrintRow(const string &name, vector<double> values) {
+  std::sort(values.begin(), values.end());
+  printf("  %-38s %9.1f %9.1f %9.1f %9.1f\n", name.c_str(),
+         Percentile(values, 50), Percentile(values, 90),
+         Percentile(values, 99), values.back());
+}
+
+void Report(const string &scenario, const string &command,
+            const vector<Run> &runs) {
+  printf("%s %s, %zu runs\n", scenario.c_str(), command.c_str(), runs.size());
+  printf("  %-38s %9s %9s %9s %9s\n", "", "p50 ms", "p90 ms", "p99 ms",
+         "max ms");
+  vector<double> wall;
+  map<string, vector<double>> phases;
+  for (const Run &run : runs) {
+    wall.push_back(run.wall_ms);
+    for (const auto &phase : run.phases) {
+      phases[phase.first].push_back(phase.second);
+    }
+  }
+  PrintRow("wall time", wall);
+  for (auto &phase : phases) {
+    // A phase that some runs skipped counts as 0 ms in them.
+    phase.second.resize(runs.size(), 0);
+    PrintRow(phase.first, phase.second);
+  }
+  printf("\n");
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  const char *tmp_dir = getenv("TEST_TMPDIR");
+  options.scratch = tmp_dir != NULL ? tmp_dir : "/tmp";
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (Flag(argv[i], "bazel", &options.bazel)) {
+    } else if (Flag(argv[i], "workspace", &options.workspace)) {
+    } else if (Flag(argv[i], "scratch", &options.scratch)) {
+    } else if (Flag(argv[i], "targets", &options.targets)) {
+    } else if (Flag(argv[i], "runs", &value)) {
+      options.runs = atoi(value.c_str());
+    } else if (Flag(argv[i], "scenarios", &value)) {
+      options.scenarios = Split(value, ',');
+    } else if (Flag(argv[i], "commands", &value)) {
+      options.commands = Split(value, ',');
+    } else if (Flag(argv[i], "startup_options", &value)) {
+      options.startup_options = Split(value, ' ');
+    } else {
+      Die("unknown argument %s", argv[i]);
+    }
+  }
+  if (options.bazel.empty() || options.workspace.empty() || options.runs < 1) {
+    Die("usage: %s --bazel=<launcher> --workspace=<dir> [--runs=N] ...",
+        argv[0]);
+  }
+  options.scratch += "/startup_benchmark";
+
+  for (const string &scenario : options.scenarios) {
+    if (scenario != "cold" && scenario != "warm" && scenario != "hot") {
+      Die("unknown scenario %s", scenario);
+    }
+    for (const string &command : options.commands) {
+      vector<string> args;
+      if (command == "build") {
+        args = {"build", "--nobuild", options.targets};
+      } else if (command == "version" || command == "info") {
+        args = {command};
+      } else {
+        Die("unknown command %s", command);
+      }
+      Report(scenario, command, RunScenario(options, scenario, args));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "src/main/cpp/util/cgroup_stats.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+TEST(CgroupStatsTest, FindsValueOfMemoryEvents) {
+  const std::string events =
+      "low 0\n"
+      "high 0\n"
+      "max 12\n"
+      "oom 2\n"
+      "oom_group_kill 5\n"
+      "oom_kill 1\n";
+  EXPECT_EQ(1, FindCgroupValue(events, "oom_kill "));
+  EXPECT_EQ(2, FindCgroupValue(events, "oom "));
+  EXPECT_EQ(0, FindCgroupValue(events, "low "));
+  EXPECT_EQ(-1, FindCgroupValue(events, "kill "));
+  EXPECT_EQ(-1, FindCgroupValue("", "oom_kill "));
+}
+
+TEST(CgroupStatsTest, FindsValueOfCpuStat) {
+  const std::string stat =
+      "usage_usec 123456789012\n"
+      "user_usec 100\n"
+      "system_usec 23\n";
+  EXPECT_EQ(123456789012LL, FindCgroupValue(stat, "usage_usec "));
+  EXPECT_EQ(23, FindCgroupValue(stat, "system_usec "));
+}
+
+TEST(CgroupStatsTest, SumsValuesOfIoStat) {
+  const std::string stat =
+      "8:0 rbytes=4096 wbytes=8192 rios=1 wios=2 dbytes=0 dios=0\n"
+      "8:16 rbytes=100 wbytes=0 rios=3 wios=0 dbytes=0 dios=0\n"
+      "253:0 rbytes=5000000000 wbytes=7 rios=4 wios=1 dbytes=0 dios=0\n";
+  EXPECT_EQ(4096 + 100 + 5000000000LL, SumCgroupValues(stat, " rbytes="));
+  EXPECT_EQ(8192 + 0 + 7, SumCgroupValues(stat, " wbytes="));
+  EXPECT_EQ(-1, SumCgroupValues(stat, " cbytes="));
+  // No line at all if there was no I/O.
+  EXPECT_EQ(-1, SumCgroupValues("", " rbytes="));
+}
+
+TEST(CgroupStatsTest, SumsValuesOfBlkio) {
+  const std::string stat =
+      "8:0 Read 4096\n"
+      "8:0 Write 512\n"
+      "8:0 Total 4608\n"
+      "8:16 Read 10\n"
+      "8:16 Write 0\n"
+      "8:16 Total 10\n"
+      "Total 4618\n";
+  EXPECT_EQ(4106, SumCgroupValues(stat, " Read "));
+  EXPECT_EQ(512, SumCgroupValues(stat, " Write "));
+}
+
+TEST(CgroupStatsTest, ReadsCgroupFile) {
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  ASSERT_NE(nullptr, tmpdir);
+  std::string dir(tmpdir);
+  FILE *f = fopen((dir + "/memory.events").c_str(), "w");
+  ASSERT_NE(nullptr, f);
+  fputs("oom 0\noom_kill 3\n", f);
+  fclose(f);
+
+  std::string contents = "stale";
+  ASSERT_TRUE(ReadCgroupFile(dir, "memory.events", &contents));
+  EXPECT_EQ("oom 0\noom_kill 3\n", contents);
+  EXPECT_EQ(3, FindCgroupValue(contents, "oom_kill "));
+  EXPECT_FALSE(ReadCgroupFile(dir, "io.stat", &contents));
+}
+
+}  // namespace blaze_util
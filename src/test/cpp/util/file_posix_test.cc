@@ -12,9 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <mutex>
 
 #include "src/main/cpp/util/file_platform.h"
 #include "gtest/gtest.h"
@@ -221,4 +223,91 @@ TEST(FilePosixTest, ForEachDirectoryEntry) {
   rmdir(root.c_str());
 }
 
+// Records the names of the entries, and checks that the files can be
+// accessed through the directory descriptor while they are visited.
+class MockDirectoryTreeVisitor : public DirectoryTreeVisitor {
+ public:
+  void VisitFile(int dir_fd, const char *name) override {
+    struct stat buf;
+    ASSERT_EQ(0, fstatat(dir_fd, name, &buf, AT_SYMLINK_NOFOLLOW));
+    std::lock_guard<std::mutex> lock(mutex);
+    files.push_back(name);
+  }
+
+  bool VisitDirectory(int dir_fd, const char *name, int fd) override {
+    struct stat buf;
+    EXPECT_EQ(0, fstat(fd, &buf));
+    EXPECT_TRUE(S_ISDIR(buf.st_mode));
+    std::lock_guard<std::mutex> lock(mutex);
+    directories.push_back(name);
+    return string(name) != "skipped";
+  }
+
+  std::mutex mutex;
+  vector<string> files;
+  vector<string> directories;
+};
+
+TEST(FilePosixTest, WalkDirectoryTree) {
+  char* tmpdir_cstr = getenv("TEST_TMPDIR");
+  ASSERT_FALSE(tmpdir_cstr == NULL);
+  string root = string(tmpdir_cstr) + "/FilePosixTest.WalkDirectoryTree.root";
+  ASSERT_EQ(0, mkdir(root.c_str(), 0700));
+
+  // root/dir<i>/file<i> and root/dir<i>/sub/subfile<i> for 10 i, a symlink
+  // to a directory, and a directory that the visitor does not walk.
+  vector<string> expected_files;
+  vector<string> expected_directories;
+  vector<string> paths;
+  for (int i = 0; i < 10; ++i) {
+    string dir = root + "/dir" + std::to_string(i);
+    ASSERT_EQ(0, mkdir(dir.c_str(), 0700));
+    ASSERT_EQ(0, mkdir((dir + "/sub").c_str(), 0700));
+    string file = dir + "/file" + std::to_string(i);
+    string subfile = dir + "/sub/subfile" + std::to_string(i);
+    for (const string &path : {file, subfile}) {
+      int fd = open(path.c_str(), O_CREAT, 0700);
+      ASSERT_GT(fd, 0);
+      close(fd);
+    }
+    expected_directories.push_back("dir" + std::to_string(i));
+    expected_directories.push_back("sub");
+    expected_files.push_back("file" + std::to_string(i));
+    expected_files.push_back("subfile" + std::to_string(i));
+    paths.insert(paths.end(), {subfile, file, dir + "/sub", dir});
+  }
+  ASSERT_EQ(0, symlink("dir0", (root + "/dir_sym").c_str()));
+  expected_files.push_back("dir_sym");
+  ASSERT_EQ(0, mkdir((root + "/skipped").c_str(), 0700));
+  int fd = open((root + "/skipped/file").c_str(), O_CREAT, 0700);
+  ASSERT_GT(fd, 0);
+  close(fd);
+  expected_directories.push_back("skipped");
+  std::sort(expected_files.begin(), expected_files.end());
+  std::sort(expected_directories.begin(), expected_directories.end());
+
+  for (int threads : {1, 4}) {
+    MockDirectoryTreeVisitor visitor;
+    ASSERT_TRUE(WalkDirectoryTree(root, &visitor, threads));
+    std::sort(visitor.files.begin(), visitor.files.end());
+    std::sort(visitor.directories.begin(), visitor.directories.end());
+    ASSERT_EQ(expected_files, visitor.files);
+    ASSERT_EQ(expected_directories, visitor.directories);
+  }
+
+  // A path that's actually a file, not a directory, is not walked.
+  MockDirectoryTreeVisitor visitor;
+  ASSERT_FALSE(WalkDirectoryTree(root + "/skipped/file", &visitor));
+  ASSERT_TRUE(visitor.files.empty());
+
+  // Cleanup: delete mock directory tree.
+  for (const string &path : paths) {
+    remove(path.c_str());
+  }
+  unlink((root + "/dir_sym").c_str());
+  unlink((root + "/skipped/file").c_str());
+  rmdir((root + "/skipped").c_str());
+  rmdir(root.c_str());
+}
+
 }  // namespace blaze_util
@@ -40,6 +40,12 @@ TEST(FileTest, JoinPath) {
 
   path = JoinPath("/", "/");
   ASSERT_EQ("/", path);
+
+  path = JoinPath("a", "");
+  ASSERT_EQ("a/", path);
+
+  path = JoinPath("a", "b/c/");
+  ASSERT_EQ("a/b/c/", path);
 }
 
 void MockDirectoryListingFunction(const string &path,
@@ -11,11 +11,19 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "src/main/cpp/util/bazel_log_handler.h"
+#include "src/main/cpp/util/file.h"
 #include "src/main/cpp/util/logging.h"
 #include "gtest/gtest.h"
 
@@ -43,6 +51,78 @@ TEST(LoggingTest, BazelLogHandlerDumpsToCerrAtFail) {
   ASSERT_TRUE(output.find(teststring) != std::string::npos);
 }
 
+TEST(LoggingTest, BazelLogHandlerKeepsOrderPastTheRing) {
+  testing::internal::CaptureStderr();
+  std::unique_ptr<blaze_util::BazelLogHandler> handler(
+      new blaze_util::BazelLogHandler());
+  blaze_util::SetLogHandler(std::move(handler));
+
+  // More messages than fit in the ring before there is a log file.
+  for (int i = 0; i < 5000; i++) {
+    BAZEL_LOG(INFO) << "message " << i;
+  }
+  blaze_util::SetLogHandler(nullptr);
+  std::string output = testing::internal::GetCapturedStderr();
+
+  std::istringstream lines(output);
+  std::string line;
+  int i = 0;
+  while (std::getline(lines, line)) {
+    std::ostringstream ending;
+    ending << "] message " << i;
+    ASSERT_EQ(line.size() - ending.str().size(), line.rfind(ending.str()))
+        << line;
+    ASSERT_EQ(0, line.find("[bazel INFO "));
+    i++;
+  }
+  EXPECT_EQ(5000, i);
+}
+
+TEST(LoggingTest, BazelLogHandlerWritesAllThreadsToTheLogfile) {
+  const char* tmpdir = getenv("TEST_TMPDIR");
+  ASSERT_NE(nullptr, tmpdir);
+  std::unique_ptr<blaze_util::BazelLogHandler> handler(
+      new blaze_util::BazelLogHandler());
+  blaze_util::SetLogHandler(std::move(handler));
+  BAZEL_LOG(INFO) << "before the output dir";
+  blaze_util::SetLogfileDirectory(tmpdir);
+
+  const int kThreads = 8;
+  const int kMessages = 2000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.push_back(std::thread([t] {
+      for (int i = 0; i < kMessages; i++) {
+        BAZEL_LOG(WARNING) << "thread " << t << " message " << i;
+      }
+    }));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  blaze_util::SetLogHandler(nullptr);
+
+  std::ifstream logfile(JoinPath(tmpdir, "bazel_client.log"));
+  std::string line;
+  ASSERT_TRUE(std::getline(logfile, line).good());
+  EXPECT_NE(std::string::npos, line.find("] before the output dir"));
+  // Each thread's messages are in its order.
+  std::vector<int> next(kThreads, 0);
+  int count = 0;
+  while (std::getline(logfile, line)) {
+    int t, i;
+    size_t prefix = line.find("] thread ");
+    ASSERT_NE(std::string::npos, prefix) << line;
+    ASSERT_EQ(2, sscanf(line.c_str() + prefix, "] thread %d message %d", &t,
+                        &i))
+        << line;
+    ASSERT_EQ(next[t], i) << line;
+    next[t]++;
+    count++;
+  }
+  EXPECT_EQ(kThreads * kMessages, count);
+}
+
 TEST(LoggingTest, LogLevelNamesMatch) {
   EXPECT_STREQ("INFO", LogLevelName(LOGLEVEL_INFO));
   EXPECT_STREQ("WARNING", LogLevelName(LOGLEVEL_WARNING));
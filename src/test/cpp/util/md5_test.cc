@@ -11,6 +11,11 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <string.h>
+
+#include <string>
+#include <vector>
+
 #include "src/main/cpp/util/md5.h"
 #include "src/main/cpp/util/port.h"
 #include "gtest/gtest.h"
@@ -49,4 +54,43 @@ TEST(BlazeUtil, Basic) {
   }
 }
 
+TEST(BlazeUtil, DigestMany) {
+  // Lengths around the block and padding boundaries, and longer messages
+  // that keep some lanes busy after the others are done.
+  std::vector<std::string> messages;
+  for (size_t length = 0; length < 300; length++) {
+    messages.push_back(
+        std::string(length, static_cast<char>('a' + length % 26)));
+  }
+  for (size_t length = 1000; length < 9000; length += 1531) {
+    std::string message;
+    for (size_t i = 0; i < length; i++) {
+      message.push_back(static_cast<char>(i * 31 + length));
+    }
+    messages.push_back(message);
+  }
+
+  std::vector<const void *> data;
+  std::vector<size_t> lengths;
+  for (const std::string &message : messages) {
+    data.push_back(message.data());
+    lengths.push_back(message.size());
+  }
+  std::vector<unsigned char> digests(messages.size() *
+                                     Md5Digest::kDigestLength);
+  Md5Digest::DigestMany(messages.size(), data.data(), lengths.data(),
+                        digests.data());
+
+  unsigned char buf[Md5Digest::kDigestLength];
+  Md5Digest digest;
+  for (size_t i = 0; i < messages.size(); i++) {
+    digest.Reset();
+    digest.Update(messages[i].data(), messages[i].size());
+    digest.Finish(buf);
+    ASSERT_EQ(0, memcmp(buf, &digests[i * Md5Digest::kDigestLength],
+                        Md5Digest::kDigestLength))
+        << "length " << messages[i].size();
+  }
+}
+
 }  // namespace blaze_util
@@ -0,0 +1,138 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "src/main/cpp/util/md5.h"
+#include "src/main/cpp/util/output_digest.h"
+#include "src/main/cpp/util/sha256.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+static const char kXattr[] = "user.bazel.test_digest";
+// The version and function bytes, then five 8-byte fields.
+static const int kHeaderSize = 2 + 5 * 8;
+
+static uint64_t GetLittleEndian64(const uint8_t *p) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = value << 8 | p[i];
+  }
+  return value;
+}
+
+static std::string WriteFile(const char *name, const std::string &contents) {
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  std::string path = std::string(tmpdir != NULL ? tmpdir : "/tmp") + "/" +
+                     name;
+  int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  EXPECT_NE(-1, fd);
+  EXPECT_EQ(static_cast<ssize_t>(contents.size()),
+            write(fd, contents.data(), contents.size()));
+  close(fd);
+  return path;
+}
+
+TEST(OutputDigestTest, Parse) {
+  EXPECT_EQ(NULL, OutputDigest::Parse(""));
+  EXPECT_EQ(NULL, OutputDigest::Parse("md5"));
+  EXPECT_EQ(NULL, OutputDigest::Parse("md5:"));
+  EXPECT_EQ(NULL, OutputDigest::Parse("sha1:user.digest"));
+  std::unique_ptr<OutputDigest> md5(OutputDigest::Parse("md5:user.digest"));
+  EXPECT_NE(nullptr, md5.get());
+  std::unique_ptr<OutputDigest> sha256(
+      OutputDigest::Parse("sha256:user.digest"));
+  EXPECT_NE(nullptr, sha256.get());
+}
+
+// The attribute is what xattrCachedDigest() in unix_jni.cc expects.
+TEST(OutputDigestTest, StoresTheDigestWithTheStatOfTheFile) {
+  std::string contents(100000, 'x');
+  std::string path = WriteFile("output_digest_test", contents);
+  OutputDigest output_digest(OutputDigest::kSha256, kXattr);
+  // The chunks do not matter.
+  output_digest.Update(contents.data(), 1);
+  output_digest.Update(contents.data() + 1, contents.size() - 1);
+  if (!output_digest.Store(path)) {
+    // The file system of the test does not support user attributes.
+    ASSERT_TRUE(errno == ENOTSUP || errno == EPERM) << strerror(errno);
+    return;
+  }
+
+  uint8_t value[128];
+  ssize_t size = getxattr(path.c_str(), kXattr, value, sizeof(value)
+#ifdef __APPLE__
+                          , 0, 0
+#endif
+                          );
+  ASSERT_EQ(kHeaderSize + Sha256Digest::kDigestLength, size);
+  struct stat statbuf;
+  ASSERT_EQ(0, stat(path.c_str(), &statbuf));
+  EXPECT_EQ(1, value[0]);
+  EXPECT_EQ(OutputDigest::kSha256, value[1]);
+  EXPECT_EQ(static_cast<uint64_t>(statbuf.st_size),
+            GetLittleEndian64(value + 2 + 2 * 8));
+  EXPECT_EQ(static_cast<uint64_t>(statbuf.st_ino),
+            GetLittleEndian64(value + 2 + 3 * 8));
+  EXPECT_EQ(static_cast<uint64_t>(statbuf.st_dev),
+            GetLittleEndian64(value + 2 + 4 * 8));
+
+  Sha256Digest expected;
+  expected.Update(contents.data(), contents.size());
+  unsigned char expected_digest[Sha256Digest::kDigestLength];
+  expected.Finish(expected_digest);
+  EXPECT_EQ(0, memcmp(expected_digest, value + kHeaderSize,
+                      Sha256Digest::kDigestLength));
+  unlink(path.c_str());
+}
+
+TEST(OutputDigestTest, Md5) {
+  std::string contents = "hello";
+  std::string path = WriteFile("output_digest_test_md5", contents);
+  OutputDigest output_digest(OutputDigest::kMd5, kXattr);
+  output_digest.Update(contents.data(), contents.size());
+  if (!output_digest.Store(path)) {
+    ASSERT_TRUE(errno == ENOTSUP || errno == EPERM) << strerror(errno);
+    return;
+  }
+
+  uint8_t value[128];
+  ssize_t size = getxattr(path.c_str(), kXattr, value, sizeof(value)
+#ifdef __APPLE__
+                          , 0, 0
+#endif
+                          );
+  ASSERT_EQ(kHeaderSize + Md5Digest::kDigestLength, size);
+  EXPECT_EQ(OutputDigest::kMd5, value[1]);
+  Md5Digest expected;
+  expected.Update(contents.data(), contents.size());
+  unsigned char expected_digest[Md5Digest::kDigestLength];
+  expected.Finish(expected_digest);
+  EXPECT_EQ(0, memcmp(expected_digest, value + kHeaderSize,
+                      Md5Digest::kDigestLength));
+  unlink(path.c_str());
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,71 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <string>
+
+#include "src/main/cpp/util/sha1.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+static std::string Sha1(const std::string &data, size_t chunk) {
+  Sha1Digest digest;
+  for (size_t i = 0; i < data.size(); i += chunk) {
+    digest.Update(data.data() + i,
+                  chunk < data.size() - i ? chunk : data.size() - i);
+  }
+  unsigned char buf[Sha1Digest::kDigestLength];
+  digest.Finish(buf);
+  return digest.String();
+}
+
+TEST(Sha1Test, TestVectors) {
+  // From FIPS 180-2.
+  EXPECT_EQ("da39a3ee5e6b4b0d3255bfef95601890afd80709",
+            Sha1("", 1));
+  EXPECT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d",
+            Sha1("abc", 1));
+  EXPECT_EQ("84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+            Sha1("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+                   64));
+  EXPECT_EQ("34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+            Sha1(std::string(1000000, 'a'), 1000000));
+}
+
+TEST(Sha1Test, ChunkingDoesNotMatter) {
+  std::string data;
+  for (int i = 0; i < 1000; i++) {
+    data.push_back(static_cast<char>(i * 7));
+  }
+  std::string expected = Sha1(data, data.size());
+  for (size_t chunk : {1, 3, 55, 63, 64, 65, 128, 999}) {
+    EXPECT_EQ(expected, Sha1(data, chunk)) << "chunk " << chunk;
+  }
+}
+
+TEST(Sha1Test, Reset) {
+  Sha1Digest digest;
+  unsigned char buf[Sha1Digest::kDigestLength];
+  digest.Update("garbage", 7);
+  digest.Finish(buf);
+  digest.Reset();
+  digest.Update("abc", 3);
+  digest.Finish(buf);
+  EXPECT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d",
+            digest.String());
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,71 @@
+// Copyright 2014 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <string>
+
+#include "src/main/cpp/util/sha256.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+static std::string Sha256(const std::string &data, size_t chunk) {
+  Sha256Digest digest;
+  for (size_t i = 0; i < data.size(); i += chunk) {
+    digest.Update(data.data() + i,
+                  chunk < data.size() - i ? chunk : data.size() - i);
+  }
+  unsigned char buf[Sha256Digest::kDigestLength];
+  digest.Finish(buf);
+  return digest.String();
+}
+
+TEST(Sha256Test, TestVectors) {
+  // From FIPS 180-2 and NIST's examples.
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            Sha256("", 1));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            Sha256("abc", 1));
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            Sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+                   64));
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            Sha256(std::string(1000000, 'a'), 1000000));
+}
+
+TEST(Sha256Test, ChunkingDoesNotMatter) {
+  std::string data;
+  for (int i = 0; i < 1000; i++) {
+    data.push_back(static_cast<char>(i * 7));
+  }
+  std::string expected = Sha256(data, data.size());
+  for (size_t chunk : {1, 3, 55, 63, 64, 65, 128, 999}) {
+    EXPECT_EQ(expected, Sha256(data, chunk)) << "chunk " << chunk;
+  }
+}
+
+TEST(Sha256Test, Reset) {
+  Sha256Digest digest;
+  unsigned char buf[Sha256Digest::kDigestLength];
+  digest.Update("garbage", 7);
+  digest.Finish(buf);
+  digest.Reset();
+  digest.Update("abc", 3);
+  digest.Finish(buf);
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            digest.String());
+}
+
+}  // namespace blaze_util
@@ -107,6 +107,22 @@ TEST(BlazeUtil, Replace) {
   Replace("_", "_U", &line);
   Replace(":", "_C", &line);
   ASSERT_EQ("x_U_C_Cy_U_C_U_Uz", line);
+
+  line = "aaa";
+  Replace("aa", "a", &line);
+  ASSERT_EQ("aa", line);
+
+  line = "abc";
+  Replace("x", "y", &line);
+  ASSERT_EQ("abc", line);
+  Replace("abc", "", &line);
+  ASSERT_EQ("", line);
+
+  line = "abc";
+  Replace("", "x", &line);
+  ASSERT_EQ("abc", line);
+  Replace("", "", &line);
+  ASSERT_EQ("abc", line);
 }
 
 TEST(BlazeUtil, StripWhitespace) {
@@ -121,6 +137,14 @@ TEST(BlazeUtil, StripWhitespace) {
   str = "abc";
   StripWhitespace(&str);
   ASSERT_EQ("abc", str);
+
+  str = " a b\t\n";
+  StripWhitespace(&str);
+  ASSERT_EQ("a b", str);
+
+  str = "\ta";
+  StripWhitespace(&str);
+  ASSERT_EQ("a", str);
 }
 
 TEST(BlazeUtil, Tokenize) {
@@ -295,4 +319,14 @@ TEST(BlazeUtil, StringPrintf) {
   EXPECT_EQ("a b", out);
 }
 
+TEST(BlazeUtil, AppendJsonString) {
+  string out = "x=";
+  AppendJsonString(&out, "a \"b\" c\\d\n\x01\xc3\xa9");
+  EXPECT_EQ("x=\"a \\\"b\\\" c\\\\d\\u000a\\u0001\xc3\xa9\"", out);
+
+  out.clear();
+  AppendJsonString(&out, "");
+  EXPECT_EQ("\"\"", out);
+}
+
 }  // namespace blaze_util
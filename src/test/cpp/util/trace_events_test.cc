@@ -0,0 +1,149 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "src/main/cpp/util/trace_events.h"
+#include "gtest/gtest.h"
+
+namespace blaze_util {
+
+// The tracing state is per process, so each "tool" runs in a child.
+template <typename F>
+void RunTool(F tool) {
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    tool();
+    exit(0);
+  }
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+}
+
+// Returns the path of a new trace file.
+std::string TraceFile(const char *name) {
+  std::string path = std::string(getenv("TEST_TMPDIR")) + "/" + name;
+  unlink(path.c_str());
+  return path;
+}
+
+std::string ReadFile(const std::string &path) {
+  std::ifstream in(path);
+  std::stringstream content;
+  content << in.rdbuf();
+  return content.str();
+}
+
+int Count(const std::string &s, const std::string &what) {
+  int count = 0;
+  for (size_t pos = s.find(what); pos != std::string::npos;
+       pos = s.find(what, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(TraceEventsTest, Disabled) {
+  std::string path = TraceFile("disabled.json");
+  RunTool([] {
+    unsetenv("BAZEL_TRACE_FILE");
+    BlazeTraceInit("tool", NULL);
+    EXPECT_FALSE(BlazeTraceEnabled());
+    TraceSpan span("phase");
+    BlazeTraceCounter("count", 1);
+    EXPECT_EQ(0, BlazeTraceWrite());
+  });
+  EXPECT_NE(0, access(path.c_str(), F_OK));
+}
+
+TEST(TraceEventsTest, SpansAndCounters) {
+  std::string path = TraceFile("spans.json");
+  RunTool([&path] {
+    BlazeTraceInit("tool \"one\"", path.c_str());
+    EXPECT_TRUE(BlazeTraceEnabled());
+    {
+      TraceSpan span("phase", "in\\file");
+      usleep(1000);
+    }
+    BlazeTraceCounter("count", -42);
+  });
+  std::string trace = ReadFile(path);
+  EXPECT_EQ(0, trace.find("[\n{\"name\":\"process_name\",\"ph\":\"M\""))
+      << trace;
+  EXPECT_NE(std::string::npos,
+            trace.find("\"args\":{\"name\":\"tool \\\"one\\\"\"}"))
+      << trace;
+  EXPECT_NE(std::string::npos, trace.find("{\"name\":\"phase\",\"ph\":\"X\""))
+      << trace;
+  EXPECT_NE(std::string::npos, trace.find("\"args\":{\"detail\":\"in\\\\file\"}"))
+      << trace;
+  EXPECT_EQ(std::string::npos, trace.find("\"dur\":0,")) << trace;
+  EXPECT_NE(std::string::npos,
+            trace.find("{\"name\":\"count\",\"ph\":\"C\""))
+      << trace;
+  EXPECT_NE(std::string::npos, trace.find("\"args\":{\"value\":-42}}"))
+      << trace;
+  EXPECT_EQ(3, Count(trace, ",\n")) << trace;
+}
+
+// The processes sharing a file append to it, after a single bracket.
+TEST(TraceEventsTest, Appends) {
+  std::string path = TraceFile("appends.json");
+  setenv("BAZEL_TRACE_FILE", path.c_str(), 1);
+  for (int i = 0; i < 3; ++i) {
+    RunTool([] {
+      BlazeTraceInit("tool", NULL);
+      TraceSpan span("phase");
+    });
+  }
+  unsetenv("BAZEL_TRACE_FILE");
+  std::string trace = ReadFile(path);
+  EXPECT_EQ(1, Count(trace, "[")) << trace;
+  EXPECT_EQ(3, Count(trace, "\"process_name\"")) << trace;
+  EXPECT_EQ(3, Count(trace, "\"phase\"")) << trace;
+}
+
+// A child forked without exec records nothing until it starts its own trace.
+TEST(TraceEventsTest, ForkedChild) {
+  std::string path = TraceFile("forked.json");
+  RunTool([&path] {
+    BlazeTraceInit("parent", path.c_str());
+    RunTool([] {
+      EXPECT_FALSE(BlazeTraceEnabled());
+      TraceSpan span("inherited");
+    });
+    RunTool([&path] {
+      BlazeTraceInit("child", path.c_str());
+      TraceSpan span("own");
+    });
+    TraceSpan span("parent");
+  });
+  std::string trace = ReadFile(path);
+  EXPECT_EQ(1, Count(trace, "[")) << trace;
+  EXPECT_EQ(2, Count(trace, "\"process_name\"")) << trace;
+  EXPECT_EQ(std::string::npos, trace.find("\"inherited\"")) << trace;
+  EXPECT_EQ(1, Count(trace, "\"own\",\"ph\":\"X\"")) << trace;
+  EXPECT_EQ(1, Count(trace, "\"parent\",\"ph\":\"X\"")) << trace;
+}
+
+}  // namespace blaze_util
@@ -0,0 +1,78 @@
+// Copyright 2015 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.sandbox;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import com.google.devtools.build.lib.vfs.FileSystemUtils;
+import com.google.devtools.build.lib.vfs.Path;
+import java.io.IOException;
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link AsynchronousTreeDeleter}. */
+@RunWith(JUnit4.class)
+public class AsynchronousTreeDeleterTest extends SandboxTestCase {
+  private Path trashDir;
+  private AsynchronousTreeDeleter deleter;
+
+  @Before
+  public final void createTrashDir() throws IOException {
+    trashDir = testRoot.getRelative("trash");
+  }
+
+  @After
+  public final void shutdownDeleter() {
+    if (deleter != null) {
+      deleter.shutdown();
+    }
+  }
+
+  private static Path createTree(Path root) throws IOException {
+    FileSystemUtils.createDirectoryAndParents(root.getRelative("a/b"));
+    FileSystemUtils.createEmptyFile(root.getRelative("a/b/file"));
+    FileSystemUtils.createEmptyFile(root.getRelative("file"));
+    return root;
+  }
+
+  private void awaitEmptyTrash() throws Exception {
+    for (int i = 0; i < 1000 && !trashDir.getDirectoryEntries().isEmpty(); i++) {
+      Thread.sleep(10);
+    }
+    assertThat(trashDir.getDirectoryEntries()).isEmpty();
+  }
+
+  @Test
+  public void deleteTree() throws Exception {
+    Path tree = createTree(testRoot.getRelative("sandbox/1"));
+    deleter = new AsynchronousTreeDeleter(trashDir);
+
+    deleter.deleteTree(tree);
+
+    assertThat(tree.exists()).isFalse();
+    awaitEmptyTrash();
+  }
+
+  @Test
+  public void deletesLeftoversOfEarlierDeleter() throws Exception {
+    createTree(trashDir.getRelative("leftover"));
+
+    deleter = new AsynchronousTreeDeleter(trashDir);
+
+    awaitEmptyTrash();
+  }
+}
@@ -0,0 +1,67 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.sandbox;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import com.google.common.collect.ImmutableMap;
+import com.google.devtools.build.lib.vfs.PathFragment;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link SandboxRunner}. */
+@RunWith(JUnit4.class)
+public class SandboxRunnerTest {
+
+  @Test
+  public void parseTimings() {
+    ImmutableMap<String, Long> timings =
+        SandboxRunner.parseTimings(
+            "setup_sandbox_root_micros 39\n"
+                + "spawn_pid1_micros 1186\n"
+                + "not a timing\n"
+                + "command_micros x\n"
+                + "mount_filesystems_micros 249\n");
+    assertThat(timings)
+        .isEqualTo(
+            ImmutableMap.of(
+                "setup_sandbox_root", 39L, "spawn_pid1", 1186L, "mount_filesystems", 249L));
+    assertThat(timings.keySet())
+        .containsExactly("setup_sandbox_root", "spawn_pid1", "mount_filesystems")
+        .inOrder();
+    assertThat(SandboxRunner.parseTimings("")).isEqualTo(ImmutableMap.of());
+  }
+
+  @Test
+  public void parseChanges() {
+    assertThat(
+            SandboxRunner.parseChanges(
+                "x deleted\n"
+                    + "d out\n"
+                    + "l out/link\n"
+                    + "d out/dir\n"
+                    + "f out/dir/file\n"
+                    + ".\n"))
+        .containsExactly(
+            new PathFragment("out"),
+            new PathFragment("out/link"),
+            new PathFragment("out/dir"),
+            new PathFragment("out/dir/file"));
+    assertThat(SandboxRunner.parseChanges(".\n")).isEmpty();
+    // The changes could not be tracked, or the sandbox died while writing them.
+    assertThat(SandboxRunner.parseChanges("")).isNull();
+    assertThat(SandboxRunner.parseChanges("d out\nf out/fi")).isNull();
+  }
+}
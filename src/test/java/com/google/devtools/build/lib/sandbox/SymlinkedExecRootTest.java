@@ -23,6 +23,7 @@ import com.google.devtools.build.lib.vfs.Path;
 import com.google.devtools.build.lib.vfs.PathFragment;
 import com.google.devtools.build.lib.vfs.Symlinks;
 import java.io.IOException;
+import java.nio.charset.StandardCharsets;
 import org.junit.Before;
 import org.junit.Test;
 import org.junit.runner.RunWith;
@@ -62,6 +63,26 @@ public class SymlinkedExecRootTest extends SandboxTestCase {
     assertThat(execRoot.getRelative("wow/writable").isDirectory()).isTrue();
   }
 
+  @Test
+  public void createFileSystemWithInputManifest() throws Exception {
+    Path helloTxt = workspaceDir.getRelative("hello.txt");
+    FileSystemUtils.createEmptyFile(helloTxt);
+    Path manifest = testRoot.getRelative("inputs.manifest");
+
+    SymlinkedExecRoot symlinkedExecRoot = new SymlinkedExecRoot(execRoot, manifest);
+    symlinkedExecRoot.createFileSystem(
+        ImmutableMap.of(new PathFragment("such/input.txt"), helloTxt),
+        ImmutableSet.of(new PathFragment("very/output.txt")),
+        ImmutableSet.of(execRoot.getRelative("wow/writable")));
+
+    assertThat(execRoot.getRelative("such").exists()).isFalse();
+    assertThat(FileSystemUtils.readLines(manifest, StandardCharsets.ISO_8859_1))
+        .containsExactly("such/input.txt", helloTxt.getPathString())
+        .inOrder();
+    assertThat(execRoot.getRelative("very").isDirectory()).isTrue();
+    assertThat(execRoot.getRelative("wow/writable").isDirectory()).isTrue();
+  }
+
   @Test
   public void cleanFileSystem() throws Exception {
     Path helloTxt = workspaceDir.getRelative("hello.txt");
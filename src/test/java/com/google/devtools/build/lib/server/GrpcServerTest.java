@@ -16,20 +16,33 @@ package com.google.devtools.build.lib.server;
 import static com.google.common.truth.Truth.assertThat;
 import static junit.framework.TestCase.fail;
 import static org.mockito.Matchers.any;
+import static org.mockito.Matchers.anyListOf;
+import static org.mockito.Matchers.anyLong;
+import static org.mockito.Matchers.anyString;
 import static org.mockito.Mockito.inOrder;
 import static org.mockito.Mockito.mock;
+import static org.mockito.Mockito.verify;
+import static org.mockito.Mockito.verifyZeroInteractions;
 import static org.mockito.Mockito.when;
 
 import com.google.common.base.Strings;
 import com.google.common.util.concurrent.ThreadFactoryBuilder;
 import com.google.common.util.concurrent.Uninterruptibles;
+import com.google.devtools.build.lib.runtime.BlazeCommandDispatcher.LockingMode;
+import com.google.devtools.build.lib.runtime.BlazeCommandDispatcher.ShutdownMethod;
+import com.google.devtools.build.lib.runtime.CommandExecutor;
+import com.google.devtools.build.lib.server.CommandProtos.ExecRequest;
+import com.google.devtools.build.lib.server.CommandProtos.RunRequest;
 import com.google.devtools.build.lib.server.CommandProtos.RunResponse;
 import com.google.devtools.build.lib.server.GrpcServerImpl.StreamType;
 import com.google.devtools.build.lib.testutil.Suite;
 import com.google.devtools.build.lib.testutil.TestSpec;
 import com.google.devtools.build.lib.testutil.TestThread;
 import com.google.devtools.build.lib.testutil.TestUtils;
+import com.google.devtools.build.lib.util.BlazeClock;
 import com.google.devtools.build.lib.util.Preconditions;
+import com.google.devtools.build.lib.util.io.OutErr;
+import com.google.devtools.build.lib.vfs.inmemoryfs.InMemoryFileSystem;
 import com.google.protobuf.ByteString;
 import io.grpc.Status;
 import io.grpc.StatusRuntimeException;
@@ -166,6 +179,65 @@ public class GrpcServerTest {
     return RunResponse.newBuilder().setStandardError(ByteString.copyFromUtf8("hello")).build();
   }
 
+  private GrpcServerImpl createServer(CommandExecutor commandExecutor) throws Exception {
+    return new GrpcServerImpl(
+        commandExecutor,
+        BlazeClock.instance(),
+        /*port=*/ 0,
+        /*unixSocket=*/ false,
+        new InMemoryFileSystem(BlazeClock.instance()).getPath("/server"),
+        /*maxIdleSeconds=*/ 0,
+        /*idleTrimSeconds=*/ 0);
+  }
+
+  private RunRequest runRequest(GrpcServerImpl server) {
+    return RunRequest.newBuilder()
+        .setCookie(server.getRequestCookie())
+        .setClientDescription("test")
+        .addArg(ByteString.copyFromUtf8("info"))
+        .build();
+  }
+
+  private void verifyCommandRan(CommandExecutor commandExecutor) throws Exception {
+    verify(commandExecutor)
+        .exec(
+            anyListOf(String.class),
+            any(OutErr.class),
+            any(LockingMode.class),
+            anyString(),
+            anyLong(),
+            any(ExecRequest.Builder.class));
+  }
+
+  @Test
+  public void testRunsCommand() throws Exception {
+    CommandExecutor commandExecutor = mock(CommandExecutor.class);
+    when(commandExecutor.shutdown()).thenReturn(ShutdownMethod.NONE);
+    GrpcServerImpl server = createServer(commandExecutor);
+    MockObserver observer = new MockObserver();
+    GrpcServerImpl.GrpcSink sink = new GrpcServerImpl.GrpcSink(observer, executor);
+
+    server.executeCommand(runRequest(server), observer, sink);
+    verifyCommandRan(commandExecutor);
+    // The command id, then the exit code.
+    assertThat(observer.getMessageCount()).isEqualTo(2);
+  }
+
+  @Test
+  public void testDoesNotRunCommandIfCommandIdCannotBeSent() throws Exception {
+    // The client gave up before the command id arrived, and sends the command again. It must not
+    // run twice.
+    CommandExecutor commandExecutor = mock(CommandExecutor.class);
+    GrpcServerImpl server = createServer(commandExecutor);
+    MockObserver observer = new MockObserver();
+    GrpcServerImpl.GrpcSink sink = new GrpcServerImpl.GrpcSink(observer, executor);
+    observer.cancelled.set(true);
+
+    server.executeCommand(runRequest(server), observer, sink);
+    verifyZeroInteractions(commandExecutor);
+    assertThat(observer.getMessageCount()).isEqualTo(1);
+  }
+
   @Test
   public void testSendingSimpleMessage() {
     MockObserver observer = new MockObserver();
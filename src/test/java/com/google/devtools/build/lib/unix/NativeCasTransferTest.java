@@ -0,0 +1,283 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.unix;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.ISO_8859_1;
+import static org.junit.Assert.fail;
+
+import com.google.common.collect.Maps;
+import com.google.common.hash.HashCode;
+import com.google.common.hash.Hashing;
+import com.google.devtools.build.lib.remote.CasServiceGrpc.CasServiceImplBase;
+import com.google.devtools.build.lib.remote.RemoteProtocol.BlobChunk;
+import com.google.devtools.build.lib.remote.RemoteProtocol.CasDownloadBlobRequest;
+import com.google.devtools.build.lib.remote.RemoteProtocol.CasDownloadReply;
+import com.google.devtools.build.lib.remote.RemoteProtocol.CasStatus;
+import com.google.devtools.build.lib.remote.RemoteProtocol.CasUploadBlobReply;
+import com.google.devtools.build.lib.remote.RemoteProtocol.CasUploadBlobRequest;
+import com.google.devtools.build.lib.remote.RemoteProtocol.ContentDigest;
+import com.google.devtools.build.lib.testutil.TestUtils;
+import com.google.protobuf.ByteString;
+import io.grpc.Server;
+import io.grpc.netty.NettyServerBuilder;
+import io.grpc.stub.StreamObserver;
+import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.IOException;
+import java.nio.file.Files;
+import java.util.Arrays;
+import java.util.concurrent.ConcurrentMap;
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/**
+ * Tests for {@link NativeCasTransfer}, against a CAS served on a local port: the native code opens
+ * its own channel, so the in-process transport of {@code GrpcActionCacheTest} cannot be used.
+ */
+@RunWith(JUnit4.class)
+public class NativeCasTransferTest {
+  private static final int TIMEOUT_SECONDS = 60;
+
+  private final FakeCasService cas = new FakeCasService();
+  private Server server;
+  private String target;
+  private File dir;
+
+  @Before
+  public final void startServer() throws Exception {
+    server = NettyServerBuilder.forPort(0).addService(cas).build().start();
+    target = "localhost:" + server.getPort();
+    dir = Files.createTempDirectory(new File(TestUtils.tmpDir()).toPath(), "cas").toFile();
+  }
+
+  @After
+  public final void stopServer() {
+    server.shutdownNow();
+  }
+
+  private File writeFile(String name, byte[] contents) throws IOException {
+    File file = new File(dir, name);
+    Files.write(file.toPath(), contents);
+    return file;
+  }
+
+  private static byte[] contents(int size) {
+    byte[] contents = new byte[size];
+    for (int i = 0; i < size; i++) {
+      contents[i] = (byte) (i * 31 + 7);
+    }
+    return contents;
+  }
+
+  /** The files of one transfer, in the packed form {@link NativeCasTransfer} takes. */
+  private static final class Blobs {
+    private final ByteArrayOutputStream paths = new ByteArrayOutputStream();
+    private final ByteArrayOutputStream digests = new ByteArrayOutputStream();
+    private long[] sizes = new long[0];
+
+    Blobs add(File file, byte[] contents) {
+      byte[] path = file.getPath().getBytes(ISO_8859_1);
+      paths.write(path, 0, path.length);
+      paths.write(0);
+      byte[] digest = Hashing.sha1().hashBytes(contents).asBytes();
+      digests.write(digest, 0, digest.length);
+      sizes = Arrays.copyOf(sizes, sizes.length + 1);
+      sizes[sizes.length - 1] = contents.length;
+      return this;
+    }
+
+    void upload(String target, int maxChunkSizeBytes) throws IOException {
+      NativeCasTransfer.upload(target, paths.toByteArray(), digests.toByteArray(), sizes,
+          maxChunkSizeBytes, 2, 1 << 20, 2, TIMEOUT_SECONDS);
+    }
+
+    int download(String target, boolean[] executable) throws IOException {
+      return NativeCasTransfer.download(target, paths.toByteArray(), digests.toByteArray(), sizes,
+          executable, 2, 1 << 20, 2, TIMEOUT_SECONDS);
+    }
+  }
+
+  @Test
+  public void testUpload() throws Exception {
+    byte[] large = contents(1000);
+    byte[] small = contents(10);
+    byte[] empty = new byte[0];
+    Blobs blobs = new Blobs()
+        .add(writeFile("large", large), large)
+        .add(writeFile("small", small), small)
+        .add(writeFile("empty", empty), empty);
+    blobs.upload(target, 64);
+    assertThat(cas.get(large)).isEqualTo(large);
+    assertThat(cas.get(small)).isEqualTo(small);
+    assertThat(cas.get(empty)).isEqualTo(empty);
+  }
+
+  @Test
+  public void testUploadOfChangedFileFails() throws Exception {
+    byte[] digested = contents(100);
+    File file = writeFile("changed", contents(50));
+    try {
+      new Blobs().add(file, digested).upload(target, 64);
+      fail("Expected IOException");
+    } catch (IOException e) {
+      assertThat(e.getMessage()).contains("changed since it was digested");
+    }
+    assertThat(cas.get(digested)).isNull();
+  }
+
+  @Test
+  public void testDownload() throws Exception {
+    byte[] large = contents(1000);
+    byte[] empty = new byte[0];
+    cas.put(large);
+    cas.put(empty);
+    File largeFile = new File(dir, "large");
+    File emptyFile = new File(dir, "empty");
+    int missing = new Blobs()
+        .add(largeFile, large)
+        .add(emptyFile, empty)
+        .download(target, new boolean[] {true, false});
+    assertThat(missing).isEqualTo(-1);
+    assertThat(Files.readAllBytes(largeFile.toPath())).isEqualTo(large);
+    assertThat(largeFile.canExecute()).isTrue();
+    assertThat(Files.readAllBytes(emptyFile.toPath())).isEqualTo(empty);
+    assertThat(emptyFile.canExecute()).isFalse();
+  }
+
+  @Test
+  public void testDownloadReportsMissingBlob() throws Exception {
+    byte[] present = contents(10);
+    byte[] absent = contents(20);
+    cas.put(present);
+    int missing = new Blobs()
+        .add(new File(dir, "present"), present)
+        .add(new File(dir, "absent"), absent)
+        .download(target, new boolean[] {false, false});
+    assertThat(missing).isEqualTo(1);
+    assertThat(new File(dir, "absent").exists()).isFalse();
+  }
+
+  /** Stores the blobs in memory; sends the downloads in chunks of CHUNK_SIZE bytes. */
+  private static class FakeCasService extends CasServiceImplBase {
+    private static final int CHUNK_SIZE = 100;
+
+    private final ConcurrentMap<String, byte[]> cache = Maps.newConcurrentMap();
+
+    private static String key(byte[] digest) {
+      return HashCode.fromBytes(digest).toString();
+    }
+
+    void put(byte[] blob) {
+      cache.put(key(Hashing.sha1().hashBytes(blob).asBytes()), blob);
+    }
+
+    byte[] get(byte[] blob) {
+      return cache.get(key(Hashing.sha1().hashBytes(blob).asBytes()));
+    }
+
+    @Override
+    public void downloadBlob(
+        CasDownloadBlobRequest request, StreamObserver<CasDownloadReply> observer) {
+      CasStatus.Builder missing = CasStatus.newBuilder();
+      for (ContentDigest digest : request.getDigestList()) {
+        if (!cache.containsKey(key(digest.getDigest().toByteArray()))) {
+          missing.addMissingDigest(digest);
+        }
+      }
+      if (missing.getMissingDigestCount() > 0) {
+        missing.setSucceeded(false).setError(CasStatus.ErrorCode.MISSING_DIGEST);
+        observer.onNext(CasDownloadReply.newBuilder().setStatus(missing).build());
+        observer.onCompleted();
+        return;
+      }
+      for (ContentDigest digest : request.getDigestList()) {
+        byte[] blob = cache.get(key(digest.getDigest().toByteArray()));
+        int offset = 0;
+        do {
+          int size = Math.min(CHUNK_SIZE, blob.length - offset);
+          BlobChunk.Builder chunk = BlobChunk.newBuilder();
+          if (offset == 0) {
+            chunk.setDigest(digest);
+          } else {
+            chunk.setOffset(offset);
+          }
+          chunk.setData(ByteString.copyFrom(blob, offset, size));
+          observer.onNext(
+              CasDownloadReply.newBuilder()
+                  .setStatus(CasStatus.newBuilder().setSucceeded(true))
+                  .setData(chunk)
+                  .build());
+          offset += size;
+        } while (offset < blob.length);
+      }
+      observer.onCompleted();
+    }
+
+    @Override
+    public StreamObserver<CasUploadBlobRequest> uploadBlob(
+        final StreamObserver<CasUploadBlobReply> observer) {
+      return new StreamObserver<CasUploadBlobRequest>() {
+        private ContentDigest digest;
+        private ByteArrayOutputStream blob;
+        private String error;
+
+        private void store() {
+          if (digest == null) {
+            return;
+          }
+          byte[] contents = blob.toByteArray();
+          if (!key(Hashing.sha1().hashBytes(contents).asBytes())
+              .equals(key(digest.getDigest().toByteArray()))) {
+            error = "digest mismatch";
+          } else {
+            put(contents);
+          }
+        }
+
+        @Override
+        public void onNext(CasUploadBlobRequest request) {
+          BlobChunk chunk = request.getData();
+          if (chunk.hasDigest()) {
+            store();
+            digest = chunk.getDigest();
+            blob = new ByteArrayOutputStream();
+          } else if (digest == null || chunk.getOffset() != blob.size()) {
+            error = "chunk out of order";
+            return;
+          }
+          byte[] data = chunk.getData().toByteArray();
+          blob.write(data, 0, data.length);
+        }
+
+        @Override
+        public void onError(Throwable t) {}
+
+        @Override
+        public void onCompleted() {
+          store();
+          CasStatus.Builder status = CasStatus.newBuilder().setSucceeded(error == null);
+          if (error != null) {
+            status.setError(CasStatus.ErrorCode.INVALID_ARGUMENT).setErrorDetail(error);
+          }
+          observer.onNext(CasUploadBlobReply.newBuilder().setStatus(status).build());
+          observer.onCompleted();
+        }
+      };
+    }
+  }
+}
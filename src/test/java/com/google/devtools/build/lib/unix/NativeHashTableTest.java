@@ -0,0 +1,176 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.unix;
+
+import static com.google.common.truth.Truth.assertThat;
+import static org.junit.Assert.fail;
+
+import com.google.devtools.build.lib.testutil.TestUtils;
+import com.google.devtools.build.lib.unix.NativeHashTable.SyncPolicy;
+import java.io.File;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.charset.StandardCharsets;
+import java.util.HashMap;
+import java.util.Map;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link NativeHashTable}. */
+@RunWith(JUnit4.class)
+public class NativeHashTableTest {
+  private static final int VALUE_SIZE = 8;
+
+  private String path;
+
+  @Before
+  public final void createPath() throws Exception {
+    File dir = new File(TestUtils.tmpDir(), "native_hash_table_test");
+    dir.mkdirs();
+    File table = File.createTempFile("table", "", dir);
+    table.delete();
+    path = table.getPath();
+  }
+
+  private static ByteBuffer key(String key) {
+    byte[] bytes = key.getBytes(StandardCharsets.UTF_8);
+    ByteBuffer buffer = ByteBuffer.allocateDirect(bytes.length);
+    buffer.put(bytes).flip();
+    return buffer;
+  }
+
+  private static ByteBuffer value(long value) {
+    ByteBuffer buffer = ByteBuffer.allocateDirect(VALUE_SIZE);
+    buffer.putLong(0, value);
+    return buffer;
+  }
+
+  private static Long get(NativeHashTable table, String key) {
+    ByteBuffer value = ByteBuffer.allocateDirect(VALUE_SIZE);
+    return table.get(key(key), value) ? value.getLong(0) : null;
+  }
+
+  @Test
+  public void testPutGetRemove() throws Exception {
+    try (NativeHashTable table = NativeHashTable.open(path, VALUE_SIZE, SyncPolicy.ON_CLOSE)) {
+      assertThat(get(table, "a")).isNull();
+      table.put(key("a"), value(1));
+      table.put(key("b"), value(2));
+      assertThat(get(table, "a")).isEqualTo(1L);
+      assertThat(get(table, "b")).isEqualTo(2L);
+      assertThat(table.size()).isEqualTo(2);
+
+      table.put(key("a"), value(3));
+      assertThat(get(table, "a")).isEqualTo(3L);
+      assertThat(table.size()).isEqualTo(2);
+
+      assertThat(table.remove(key("a"))).isTrue();
+      assertThat(table.remove(key("a"))).isFalse();
+      assertThat(get(table, "a")).isNull();
+      assertThat(get(table, "b")).isEqualTo(2L);
+      assertThat(table.size()).isEqualTo(1);
+    }
+  }
+
+  @Test
+  public void testEmptyKey() throws Exception {
+    try (NativeHashTable table = NativeHashTable.open(path, VALUE_SIZE, SyncPolicy.NEVER)) {
+      table.put(key(""), value(7));
+      assertThat(get(table, "")).isEqualTo(7L);
+    }
+  }
+
+  @Test
+  public void testKeyAndValueFromTheirPosition() throws Exception {
+    try (NativeHashTable table = NativeHashTable.open(path, VALUE_SIZE, SyncPolicy.NEVER)) {
+      ByteBuffer key = key("xxkey");
+      key.position(2);
+      ByteBuffer value = ByteBuffer.allocateDirect(4 + VALUE_SIZE);
+      value.putLong(4, 42).position(4);
+      table.put(key, value);
+      assertThat(get(table, "key")).isEqualTo(42L);
+      assertThat(key.position()).isEqualTo(2);
+      assertThat(value.position()).isEqualTo(4);
+    }
+  }
+
+  @Test
+  public void testReopen() throws Exception {
+    try (NativeHashTable table = NativeHashTable.open(path, VALUE_SIZE, SyncPolicy.ON_CLOSE)) {
+      for (int i = 0; i < 1000; i++) {
+        table.put(key("key" + i), value(i));
+      }
+      table.remove(key("key0"));
+    }
+    try (NativeHashTable table = NativeHashTable.open(path, VALUE_SIZE, SyncPolicy.ON_CLOSE)) {
+      assertThat(table.size()).isEqualTo(999);
+      assertThat(get(table, "key0")).isNull();
+      for (int i = 1; i < 1000; i++) {
+        assertThat(get(table, "key" + i)).isEqualTo((long) i);
+      }
+    }
+  }
+
+  @Test
+  public void testOtherValueSizeFails() throws Exception {
+    NativeHashTable.open(path, VALUE_SIZE, SyncPolicy.ON_CLOSE).close();
+    try {
+      NativeHashTable.open(path, VALUE_SIZE + 1, SyncPolicy.ON_CLOSE);
+      fail();
+    } catch (IOException expected) {
+    }
+  }
+
+  @Test
+  public void testGrowsAndScans() throws Exception {
+    try (NativeHashTable table = NativeHashTable.open(path, VALUE_SIZE, SyncPolicy.NEVER)) {
+      Map<String, Long> expected = new HashMap<>();
+      for (int i = 0; i < 100000; i++) {
+        table.put(key("key" + i), value(i));
+        expected.put("key" + i, (long) i);
+      }
+      // A key too long for the first scan buffer.
+      String longKey = new String(new char[3 << 20]).replace('\0', 'k');
+      table.put(key(longKey), value(-1));
+      expected.put(longKey, -1L);
+
+      final Map<String, Long> scanned = new HashMap<>();
+      table.scan(
+          new NativeHashTable.Visitor() {
+            @Override
+            public void visit(ByteBuffer key, ByteBuffer value) {
+              byte[] bytes = new byte[key.remaining()];
+              key.get(bytes);
+              assertThat(value.remaining()).isEqualTo(VALUE_SIZE);
+              scanned.put(new String(bytes, StandardCharsets.UTF_8), value.getLong());
+            }
+          });
+      assertThat(scanned).isEqualTo(expected);
+    }
+  }
+
+  @Test
+  public void testClosedTableFails() throws Exception {
+    NativeHashTable table = NativeHashTable.open(path, VALUE_SIZE, SyncPolicy.NEVER);
+    table.close();
+    table.close();
+    try {
+      table.size();
+      fail();
+    } catch (IllegalStateException expected) {
+    }
+  }
+}
@@ -0,0 +1,289 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.unix;
+
+import java.io.File;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Map;
+
+/**
+ * Measures the per-call latency and the throughput of the file system primitives of {@link
+ * NativePosixFiles}, JNI crossing included, on a synthetic tree generated reproducibly: {@code
+ * --depth} levels of {@code --fanout} directories, each with {@code --files} small files.
+ *
+ * <p>Usage:
+ *
+ * <pre>
+ *   NativePosixFilesBenchmark [--dir DIR] [--fanout N] [--depth N] [--files N]
+ *                             [--runs N] [--benchmarks NAME,...]
+ * </pre>
+ *
+ * prints a line per benchmark: the best time per operation out of N runs over the whole tree, and
+ * the operations per second. The per-call and the batched variant of an operation are next to
+ * each other, e.g. "stat" and "batch_stat". The tree is generated into DIR (the default is
+ * $TEST_TMPDIR or java.io.tmpdir): to compare local disk and tmpfs, run once with each, e.g.
+ * {@code --dir /dev/shm}. Note that the page cache is warm after the first run.
+ */
+public final class NativePosixFilesBenchmark {
+
+  /** One benchmark: runs its operation over the whole tree, returns the number of operations. */
+  private interface Benchmark {
+    int run() throws IOException;
+  }
+
+  private final List<String> dirs = new ArrayList<>();
+  private final List<String> files = new ArrayList<>();
+  private final String scratch;
+
+  private NativePosixFilesBenchmark(File root, int fanout, int depth, int filesPerDir)
+      throws IOException {
+    createTree(root, fanout, depth, filesPerDir);
+    File scratchDir = new File(root, "scratch");
+    if (!scratchDir.mkdir() && !scratchDir.isDirectory()) {
+      throw new IOException("Cannot create " + scratchDir);
+    }
+    scratch = scratchDir.getPath();
+  }
+
+  private void createTree(File dir, int fanout, int depth, int filesPerDir) throws IOException {
+    if (!dir.mkdirs() && !dir.isDirectory()) {
+      throw new IOException("Cannot create " + dir);
+    }
+    dirs.add(dir.getPath());
+    byte[] contents = new byte[4096];
+    for (int i = 0; i < filesPerDir; i++) {
+      File file = new File(dir, "file" + i);
+      Arrays.fill(contents, (byte) (i + depth));
+      try (OutputStream out = new FileOutputStream(file)) {
+        out.write(contents, 0, 100 + 97 * i % contents.length);
+      }
+      files.add(file.getPath());
+    }
+    if (depth > 0) {
+      for (int i = 0; i < fanout; i++) {
+        createTree(new File(dir, "dir" + i), fanout, depth - 1, filesPerDir);
+      }
+    }
+  }
+
+  private Map<String, Benchmark> benchmarks() {
+    Map<String, Benchmark> benchmarks = new LinkedHashMap<>();
+    final String[] filePaths = files.toArray(new String[0]);
+    final byte[][] encodedFiles = new byte[filePaths.length][];
+    for (int i = 0; i < filePaths.length; i++) {
+      encodedFiles[i] = NativePosixFiles.encodePath(filePaths[i]);
+    }
+    final String[] links = new String[filePaths.length];
+    for (int i = 0; i < links.length; i++) {
+      links[i] = scratch + "/link" + i;
+    }
+
+    benchmarks.put(
+        "stat",
+        new Benchmark() {
+          @Override
+          public int run() throws IOException {
+            for (String file : filePaths) {
+              NativePosixFiles.stat(file);
+            }
+            return filePaths.length;
+          }
+        });
+    benchmarks.put(
+        "stat_bytes",
+        new Benchmark() {
+          @Override
+          public int run() throws IOException {
+            for (byte[] file : encodedFiles) {
+              NativePosixFiles.statBytes(file, file.length);
+            }
+            return encodedFiles.length;
+          }
+        });
+    benchmarks.put("batch_stat", batch(filePaths, NativePosixFiles.BATCH_STAT));
+    benchmarks.put(
+        "lstat",
+        new Benchmark() {
+          @Override
+          public int run() throws IOException {
+            for (String file : filePaths) {
+              NativePosixFiles.lstat(file);
+            }
+            return filePaths.length;
+          }
+        });
+    benchmarks.put("batch_lstat", batch(filePaths, NativePosixFiles.BATCH_LSTAT));
+    for (final NativePosixFiles.ReadTypes readTypes : NativePosixFiles.ReadTypes.values()) {
+      benchmarks.put(
+          "readdir_" + readTypes.name().toLowerCase(),
+          new Benchmark() {
+            @Override
+            public int run() throws IOException {
+              for (String dir : dirs) {
+                NativePosixFiles.readdir(dir, readTypes);
+              }
+              return dirs.size();
+            }
+          });
+    }
+    benchmarks.put(
+        "readdir_packed",
+        new Benchmark() {
+          @Override
+          public int run() throws IOException {
+            for (String dir : dirs) {
+              byte[] path = NativePosixFiles.encodePath(dir);
+              NativePosixFiles.readdirPacked(path, path.length, NativePosixFiles.ReadTypes.FOLLOW);
+            }
+            return dirs.size();
+          }
+        });
+    benchmarks.put(
+        "readdir_with_stats",
+        new Benchmark() {
+          @Override
+          public int run() throws IOException {
+            for (String dir : dirs) {
+              NativePosixFiles.readdirWithStats(dir, true);
+            }
+            return dirs.size();
+          }
+        });
+    benchmarks.put(
+        "md5sum",
+        new Benchmark() {
+          @Override
+          public int run() throws IOException {
+            for (String file : filePaths) {
+              NativePosixFiles.md5sumAsBytes(file);
+            }
+            return filePaths.length;
+          }
+        });
+    benchmarks.put(
+        "digest_all_md5",
+        new Benchmark() {
+          @Override
+          public int run() throws IOException {
+            NativePosixFiles.digestAll(filePaths, NativePosixFiles.DIGEST_MD5);
+            return filePaths.length;
+          }
+        });
+    // Creating the symlinks is part of the unlink benchmarks, and the other way round, but it
+    // costs the same for the per-call and the batched variant.
+    benchmarks.put(
+        "symlink_unlink",
+        new Benchmark() {
+          @Override
+          public int run() throws IOException {
+            for (int i = 0; i < links.length; i++) {
+              NativePosixFiles.symlink(filePaths[i], links[i]);
+            }
+            for (String link : links) {
+              NativePosixFiles.remove(link);
+            }
+            return links.length * 2;
+          }
+        });
+    benchmarks.put(
+        "symlink_batch_unlink",
+        new Benchmark() {
+          @Override
+          public int run() throws IOException {
+            for (int i = 0; i < links.length; i++) {
+              NativePosixFiles.symlink(filePaths[i], links[i]);
+            }
+            byte[] ops = new byte[links.length];
+            Arrays.fill(ops, NativePosixFiles.BATCH_UNLINK);
+            checkBatch(links, NativePosixFiles.batch(links, ops));
+            return links.length * 2;
+          }
+        });
+    return benchmarks;
+  }
+
+  private static Benchmark batch(final String[] paths, byte op) {
+    final byte[] ops = new byte[paths.length];
+    Arrays.fill(ops, op);
+    return new Benchmark() {
+      @Override
+      public int run() throws IOException {
+        checkBatch(paths, NativePosixFiles.batch(paths, ops));
+        return paths.length;
+      }
+    };
+  }
+
+  private static void checkBatch(String[] paths, NativePosixFiles.BatchResults results)
+      throws IOException {
+    for (int i = 0; i < paths.length; i++) {
+      if (results.getErrno(i) != 0) {
+        throw new IOException(paths[i] + ": errno " + results.getErrno(i));
+      }
+    }
+  }
+
+  private static String flag(String[] args, String name, String defaultValue) {
+    for (int i = 0; i + 1 < args.length; i++) {
+      if (args[i].equals(name)) {
+        return args[i + 1];
+      }
+    }
+    return defaultValue;
+  }
+
+  public static void main(String[] args) throws Exception {
+    String tmpDir = System.getenv("TEST_TMPDIR");
+    if (tmpDir == null) {
+      tmpDir = System.getProperty("java.io.tmpdir");
+    }
+    File dir = new File(flag(args, "--dir", tmpDir), "native_posix_files_benchmark");
+    int fanout = Integer.parseInt(flag(args, "--fanout", "10"));
+    int depth = Integer.parseInt(flag(args, "--depth", "3"));
+    int filesPerDir = Integer.parseInt(flag(args, "--files", "10"));
+    int runs = Integer.parseInt(flag(args, "--runs", "5"));
+    String only = flag(args, "--benchmarks", null);
+
+    NativePosixFiles.deleteTree(dir.getPath());
+    NativePosixFilesBenchmark tree =
+        new NativePosixFilesBenchmark(dir, fanout, depth, filesPerDir);
+    System.out.printf(
+        "%s: %d directories, %d files%n", dir, tree.dirs.size(), tree.files.size());
+    try {
+      for (Map.Entry<String, Benchmark> entry : tree.benchmarks().entrySet()) {
+        if (only != null && !Arrays.asList(only.split(",")).contains(entry.getKey())) {
+          continue;
+        }
+        long best = Long.MAX_VALUE;
+        int ops = 0;
+        for (int i = 0; i < runs; i++) {
+          long start = System.nanoTime();
+          ops = entry.getValue().run();
+          best = Math.min(best, System.nanoTime() - start);
+        }
+        System.out.printf(
+            "%-22s %10.0f ns/op %12.0f ops/s%n",
+            entry.getKey(), (double) best / ops, ops * 1e9 / best);
+      }
+    } finally {
+      NativePosixFiles.deleteTree(dir.getPath());
+    }
+  }
+}
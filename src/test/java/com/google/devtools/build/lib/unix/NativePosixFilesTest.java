@@ -18,14 +18,26 @@ import static org.junit.Assert.fail;
 
 import com.google.common.collect.ImmutableMap;
 import com.google.common.hash.HashCode;
+import com.google.common.hash.Hashing;
 import com.google.devtools.build.lib.testutil.TestUtils;
 import com.google.devtools.build.lib.vfs.FileSystem;
 import com.google.devtools.build.lib.vfs.FileSystemUtils;
 import com.google.devtools.build.lib.vfs.Path;
+import com.google.devtools.build.lib.vfs.PathFragment;
+import com.google.devtools.build.lib.vfs.Symlinks;
 import com.google.devtools.build.lib.vfs.UnixFileSystem;
 import java.io.File;
 import java.io.FileNotFoundException;
+import java.io.FileOutputStream;
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.util.Arrays;
+import java.util.zip.CRC32;
+import java.util.zip.ZipEntry;
+import java.util.zip.ZipOutputStream;
 import org.junit.Before;
 import org.junit.Test;
 import org.junit.runner.RunWith;
@@ -75,6 +87,184 @@ public class NativePosixFilesTest {
     }
   }
 
+  @Test
+  public void testSha256Sum() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "abc");
+    assertThat(NativePosixFiles.sha256sum(testFile.getPathString()).toString())
+        .isEqualTo("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  }
+
+  @Test
+  public void testXattrCachedDigest() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "abc");
+    // Too recent to be cached.
+    byte[] digest =
+        NativePosixFiles.xattrCachedDigest(
+            testFile.getPathString(), "user.bazel.digest", NativePosixFiles.DIGEST_SHA256);
+    assertThat(digest).isEqualTo(NativePosixFiles.sha256sum(testFile.getPathString()).asBytes());
+
+    testFile.setLastModifiedTime(1000000000000L);
+    digest =
+        NativePosixFiles.xattrCachedDigest(
+            testFile.getPathString(), "user.bazel.digest", NativePosixFiles.DIGEST_MD5);
+    assertThat(digest).isEqualTo(NativePosixFiles.md5sum(testFile.getPathString()).asBytes());
+    // Whether or not the file system could keep it, the digest is the same the next time, and
+    // after the file changed.
+    assertThat(
+            NativePosixFiles.xattrCachedDigest(
+                testFile.getPathString(), "user.bazel.digest", NativePosixFiles.DIGEST_MD5))
+        .isEqualTo(digest);
+    FileSystemUtils.writeContentAsLatin1(testFile, "abd");
+    testFile.setLastModifiedTime(1000000000000L);
+    assertThat(
+            NativePosixFiles.xattrCachedDigest(
+                testFile.getPathString(), "user.bazel.digest", NativePosixFiles.DIGEST_MD5))
+        .isEqualTo(NativePosixFiles.md5sum(testFile.getPathString()).asBytes());
+  }
+
+  @Test
+  public void testDigestAll() throws Exception {
+    String[] paths = new String[20];
+    for (int i = 0; i < paths.length; i++) {
+      Path file = workingDir.getRelative("digest" + i);
+      FileSystemUtils.writeContentAsLatin1(file, "content " + i);
+      paths[i] = file.getPathString();
+    }
+    byte[][] md5s = NativePosixFiles.digestAll(paths, NativePosixFiles.DIGEST_MD5);
+    byte[][] sha256s = NativePosixFiles.digestAll(paths, NativePosixFiles.DIGEST_SHA256);
+    for (int i = 0; i < paths.length; i++) {
+      assertThat(md5s[i]).isEqualTo(NativePosixFiles.md5sum(paths[i]).asBytes());
+      assertThat(sha256s[i]).isEqualTo(NativePosixFiles.sha256sum(paths[i]).asBytes());
+    }
+
+    paths[7] = workingDir.getRelative("missing").getPathString();
+    try {
+      NativePosixFiles.digestAll(paths, NativePosixFiles.DIGEST_SHA256);
+      fail("Expected FileNotFoundException, but wasn't thrown.");
+    } catch (FileNotFoundException e) {
+      assertThat(e).hasMessage(paths[7] + " (No such file or directory)");
+    }
+  }
+
+  @Test
+  public void testMerkleTree() throws Exception {
+    byte[] contentDigest = new byte[20];
+    Arrays.fill(contentDigest, (byte) 7);
+    byte[] digests = new byte[40];
+    System.arraycopy(contentDigest, 0, digests, 0, 20);
+    System.arraycopy(contentDigest, 0, digests, 20, 20);
+    byte[] table =
+        NativePosixFiles.merkleTree(
+            "b/x\0a/x\0".getBytes(StandardCharsets.ISO_8859_1),
+            digests,
+            new long[] {3, 3},
+            new boolean[] {true, true});
+    // The inputs, the root, and the directories in path order.
+    int nodes = 5;
+    assertThat(table.length).isEqualTo(nodes * NativePosixFiles.MERKLE_NODE_SIZE + 4);
+    ByteBuffer buffer = ByteBuffer.wrap(table).order(ByteOrder.LITTLE_ENDIAN);
+    int[] parents = new int[nodes];
+    byte[][] nodeDigests = new byte[nodes][20];
+    long[] sizes = new long[nodes];
+    for (int i = 0; i < nodes; i++) {
+      parents[i] = buffer.getInt();
+      buffer.get(nodeDigests[i]);
+      sizes[i] = buffer.getLong();
+    }
+    assertThat(parents).isEqualTo(new int[] {4, 3, -1, 2, 2});
+    int namesStart = nodes * NativePosixFiles.MERKLE_NODE_SIZE;
+    assertThat(new String(table, namesStart, 4, StandardCharsets.ISO_8859_1)).isEqualTo("a\0b\0");
+
+    // FileNode { file_metadata { digest { digest: contentDigest size_bytes: 3 }
+    // executable: true } }
+    byte[] leaf = new byte[30];
+    leaf[0] = 0x0A;
+    leaf[1] = 28;
+    leaf[2] = 0x0A;
+    leaf[3] = 24;
+    leaf[4] = 0x0A;
+    leaf[5] = 20;
+    System.arraycopy(contentDigest, 0, leaf, 6, 20);
+    leaf[26] = 0x10;
+    leaf[27] = 3;
+    leaf[28] = 0x18;
+    leaf[29] = 1;
+    assertThat(nodeDigests[0]).isEqualTo(Hashing.sha1().hashBytes(leaf).asBytes());
+    assertThat(sizes[0]).isEqualTo(leaf.length);
+    assertThat(nodeDigests[1]).isEqualTo(nodeDigests[0]);
+    // Same contents, same digest.
+    assertThat(nodeDigests[3]).isEqualTo(nodeDigests[4]);
+    assertThat(nodeDigests[2]).isNotEqualTo(nodeDigests[3]);
+
+    try {
+      NativePosixFiles.merkleTree(
+          "a\0a/x\0".getBytes(StandardCharsets.ISO_8859_1),
+          digests,
+          new long[] {3, 3},
+          new boolean[] {false, false});
+      fail("Expected IOException, but wasn't thrown.");
+    } catch (IOException e) {
+      assertThat(e).hasMessage("conflicting input path: a/x");
+    }
+  }
+
+  @Test
+  public void testListJarEntries() throws Exception {
+    File jar = new File(workingDir.getRelative("test.jar").getPathString());
+    byte[] content = "content".getBytes(StandardCharsets.ISO_8859_1);
+    CRC32 crc = new CRC32();
+    crc.update(content);
+    try (ZipOutputStream out = new ZipOutputStream(new FileOutputStream(jar))) {
+      out.putNextEntry(new ZipEntry("META-INF/MANIFEST.MF"));
+      out.write("Manifest-Version: 1.0\n".getBytes(StandardCharsets.ISO_8859_1));
+      ZipEntry stored = new ZipEntry("a/b.txt");
+      stored.setMethod(ZipEntry.STORED);
+      stored.setSize(content.length);
+      stored.setCrc(crc.getValue());
+      out.putNextEntry(stored);
+      out.write(content);
+      out.putNextEntry(new ZipEntry("a/c.txt"));
+      out.write(content);
+    }
+
+    byte[] table = NativePosixFiles.listJarEntries(jar.getPath(), null);
+    ByteBuffer buffer = ByteBuffer.wrap(table).order(ByteOrder.LITTLE_ENDIAN);
+    assertThat(buffer.getInt()).isEqualTo(3);
+    int namesStart = 4 + 3 * NativePosixFiles.JAR_ENTRY_SIZE;
+    assertThat(new String(table, namesStart, table.length - namesStart, StandardCharsets.UTF_8))
+        .isEqualTo("META-INF/MANIFEST.MF\0a/b.txt\0a/c.txt\0");
+
+    table = NativePosixFiles.listJarEntries(
+        jar.getPath(), "a/".getBytes(StandardCharsets.ISO_8859_1));
+    buffer = ByteBuffer.wrap(table).order(ByteOrder.LITTLE_ENDIAN);
+    assertThat(buffer.getInt()).isEqualTo(2);
+    long offset = buffer.getLong();
+    assertThat(buffer.getLong()).isEqualTo(content.length);
+    assertThat(buffer.getLong()).isEqualTo(content.length);
+    assertThat(buffer.getInt() & 0xFFFFFFFFL).isEqualTo(crc.getValue());
+    assertThat(buffer.getInt()).isEqualTo(ZipEntry.STORED);
+    // The local header starts with its signature.
+    byte[] bytes = Files.readAllBytes(jar.toPath());
+    assertThat(ByteBuffer.wrap(bytes, (int) offset, 4).order(ByteOrder.LITTLE_ENDIAN).getInt())
+        .isEqualTo(0x04034b50);
+    buffer.getLong();
+    buffer.getLong();
+    assertThat(buffer.getLong()).isEqualTo(content.length);
+    assertThat(buffer.getInt() & 0xFFFFFFFFL).isEqualTo(crc.getValue());
+    assertThat(buffer.getInt()).isEqualTo(ZipEntry.DEFLATED);
+    namesStart = 4 + 2 * NativePosixFiles.JAR_ENTRY_SIZE;
+    assertThat(new String(table, namesStart, table.length - namesStart, StandardCharsets.UTF_8))
+        .isEqualTo("a/b.txt\0a/c.txt\0");
+
+    FileSystemUtils.writeContentAsLatin1(testFile, "not a jar");
+    try {
+      NativePosixFiles.listJarEntries(testFile.getPathString(), null);
+      fail("Expected IOException, but wasn't thrown.");
+    } catch (IOException e) {
+      // Expected.
+    }
+  }
+
   @Test
   public void throwsFileAccessException() throws Exception {
     FileSystemUtils.createEmptyFile(testFile);
@@ -98,6 +288,285 @@ public class NativePosixFilesTest {
     }
   }
 
+  @Test
+  public void testErrnoStatx() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "content");
+    FileStatus expected = NativePosixFiles.stat(testFile.getPathString());
+
+    ErrnoFileStatus status =
+        NativePosixFiles.errnoStatx(
+            testFile.getPathString(), true, NativePosixFiles.STAT_TYPE, false);
+    assertThat(status.hasError()).isFalse();
+    assertThat(status.isRegularFile()).isTrue();
+
+    status =
+        NativePosixFiles.errnoStatx(
+            testFile.getPathString(),
+            true,
+            NativePosixFiles.STAT_SIZE | NativePosixFiles.STAT_TIMES | NativePosixFiles.STAT_INO,
+            true);
+    assertThat(status.getSize()).isEqualTo(7);
+    assertThat(status.getLastModifiedTime()).isEqualTo(expected.getLastModifiedTime());
+    assertThat(status.getInodeNumber()).isEqualTo(expected.getInodeNumber());
+
+    status =
+        NativePosixFiles.errnoStatx(
+            workingDir.getRelative("missing").getPathString(),
+            true,
+            NativePosixFiles.STAT_TYPE,
+            false);
+    assertThat(status.hasError()).isTrue();
+    assertThat(status.getErrno()).isEqualTo(ErrnoFileStatus.ENOENT);
+  }
+
+  @Test
+  public void testReaddirWithStats() throws Exception {
+    Path dir = workingDir.getRelative("dir");
+    dir.createDirectory();
+    FileSystemUtils.writeContentAsLatin1(dir.getRelative("file"), "content");
+    dir.getRelative("subdir").createDirectory();
+    dir.getRelative("link").createSymbolicLink(new PathFragment("file"));
+    dir.getRelative("dangling").createSymbolicLink(new PathFragment("missing"));
+
+    NativePosixFiles.DirentsWithStats dirents =
+        NativePosixFiles.readdirWithStats(dir.getPathString(), false);
+    assertThat(dirents.size()).isEqualTo(4);
+    for (int i = 0; i < dirents.size(); i++) {
+      String name = dirents.getName(i);
+      FileStatus status = dirents.getStatus(i);
+      FileStatus expected = NativePosixFiles.lstat(dir.getRelative(name).getPathString());
+      assertThat(status.getInodeNumber()).isEqualTo(expected.getInodeNumber());
+      assertThat(status.getSize()).isEqualTo(expected.getSize());
+      assertThat(status.getLastModifiedTime()).isEqualTo(expected.getLastModifiedTime());
+      assertThat(status.isSymbolicLink()).isEqualTo(expected.isSymbolicLink());
+    }
+
+    dirents = NativePosixFiles.readdirWithStats(dir.getPathString(), true);
+    for (int i = 0; i < dirents.size(); i++) {
+      FileStatus status = dirents.getStatus(i);
+      switch (dirents.getName(i)) {
+        case "file":
+        case "link":
+          assertThat(status.isRegularFile()).isTrue();
+          assertThat(status.getSize()).isEqualTo(7);
+          break;
+        case "subdir":
+          assertThat(status.isDirectory()).isTrue();
+          break;
+        case "dangling":
+          assertThat(status).isNull();
+          break;
+        default:
+          fail("Unexpected entry " + dirents.getName(i));
+      }
+    }
+  }
+
+  @Test
+  public void testBatch() throws Exception {
+    // Enough operations for the io_uring path, where the kernel has it.
+    int count = 100;
+    String[] paths = new String[count];
+    byte[] ops = new byte[count];
+    for (int i = 0; i < count; i++) {
+      paths[i] = workingDir.getRelative("batch" + i).getPathString();
+    }
+
+    Arrays.fill(ops, NativePosixFiles.BATCH_MKDIR);
+    NativePosixFiles.BatchResults results = NativePosixFiles.batch(paths, ops);
+    for (int i = 0; i < count; i++) {
+      assertThat(results.getErrno(i)).isEqualTo(0);
+      assertThat(results.getStatus(i)).isNull();
+    }
+
+    Arrays.fill(ops, NativePosixFiles.BATCH_LSTAT);
+    results = NativePosixFiles.batch(paths, ops);
+    for (int i = 0; i < count; i++) {
+      assertThat(results.getStatus(i).isDirectory()).isTrue();
+      assertThat(results.getStatus(i).getInodeNumber())
+          .isEqualTo(NativePosixFiles.lstat(paths[i]).getInodeNumber());
+    }
+
+    Arrays.fill(ops, NativePosixFiles.BATCH_RMDIR);
+    results = NativePosixFiles.batch(paths, ops);
+    for (int i = 0; i < count; i++) {
+      assertThat(results.getErrno(i)).isEqualTo(0);
+    }
+
+    Arrays.fill(ops, NativePosixFiles.BATCH_STAT);
+    results = NativePosixFiles.batch(paths, ops);
+    for (int i = 0; i < count; i++) {
+      assertThat(results.getErrno(i)).isEqualTo(ErrnoFileStatus.ENOENT);
+      assertThat(results.getStatus(i)).isNull();
+    }
+  }
+
+  @Test
+  public void testCreateSymlinkForest() throws Exception {
+    String root = workingDir.getRelative("forest").getPathString();
+    FileSystemUtils.createDirectoryAndParents(workingDir.getRelative("forest/existing"));
+    int[] errors =
+        NativePosixFiles.createSymlinkForest(
+            new String[] {root + "/existing", root + "/a", root + "/a/b", root + "/x/y"},
+            new String[] {root + "/a/b/link", root + "/a/link", root + "/a/link"},
+            new String[] {"/target", "b", "other"});
+    assertThat(Arrays.copyOf(errors, 6))
+        .asList()
+        .containsExactly(0, 0, 0, ErrnoFileStatus.ENOENT, 0, 0)
+        .inOrder();
+    assertThat(errors[6]).isNotEqualTo(0); // EEXIST
+    assertThat(NativePosixFiles.readlink(root + "/a/b/link")).isEqualTo("/target");
+    assertThat(NativePosixFiles.readlink(root + "/a/link")).isEqualTo("b");
+  }
+
+  @Test
+  public void testDeleteTree() throws Exception {
+    Path root = workingDir.getRelative("tree");
+    for (int i = 0; i < 20; i++) {
+      Path dir = root.getRelative("d" + i + "/a/b");
+      FileSystemUtils.createDirectoryAndParents(dir);
+      FileSystemUtils.writeContentAsLatin1(dir.getRelative("file"), "contents");
+      root.getRelative("d" + i + "/link").createSymbolicLink(workingDir);
+    }
+    Path readOnly = root.getRelative("d0/a");
+    readOnly.setWritable(false);
+    readOnly.setExecutable(false);
+
+    assertThat(NativePosixFiles.deleteTree(root.getPathString())).isTrue();
+    assertThat(root.exists(Symlinks.NOFOLLOW)).isFalse();
+    assertThat(workingDir.exists()).isTrue();
+    assertThat(NativePosixFiles.deleteTree(root.getPathString())).isFalse();
+
+    FileSystemUtils.writeContentAsLatin1(testFile, "contents");
+    assertThat(NativePosixFiles.deleteTree(testFile.getPathString())).isTrue();
+    assertThat(testFile.exists()).isFalse();
+  }
+
+  @Test
+  public void testCopyFile() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "contents");
+    testFile.chmod(0750);
+    Path copy = workingDir.getRelative("copy");
+    FileSystemUtils.writeContentAsLatin1(copy, "previous, longer contents");
+    copy.chmod(0600);
+
+    NativePosixFiles.copyFile(testFile.getPathString(), copy.getPathString());
+    assertThat(FileSystemUtils.readContentAsLatin1(copy)).isEqualTo("contents".toCharArray());
+    assertThat(NativePosixFiles.stat(copy.getPathString()).getPermissions()).isEqualTo(0750);
+
+    try {
+      NativePosixFiles.copyFile(workingDir.getRelative("missing").getPathString(),
+          copy.getPathString());
+      fail();
+    } catch (FileNotFoundException e) {
+      // Expected.
+    }
+    try {
+      NativePosixFiles.copyFile(workingDir.getPathString(), copy.getPathString());
+      fail();
+    } catch (IOException e) {
+      assertThat(e).hasMessage(workingDir + " (Is a directory)");
+    }
+  }
+
+  @Test
+  public void testPrefetch() throws Exception {
+    FileSystemUtils.writeContentAsLatin1(testFile, "contents");
+    String[] paths = {
+      testFile.getPathString(),
+      workingDir.getPathString(),
+      workingDir.getRelative("missing").getPathString()
+    };
+    assertThat(NativePosixFiles.prefetch(paths)).isEqualTo(3);
+    assertThat(NativePosixFiles.prefetch(new String[0])).isEqualTo(0);
+    // Prefetching is only a hint, the contents are as they were.
+    assertThat(FileSystemUtils.readContentAsLatin1(testFile)).isEqualTo("contents".toCharArray());
+  }
+
+  @Test
+  public void testBytePaths() throws Exception {
+    Path dir = workingDir.getRelative("bytes");
+    dir.createDirectory();
+    FileSystemUtils.writeContentAsLatin1(dir.getRelative("file"), "abc");
+    dir.getRelative("link").createSymbolicLink(new PathFragment("file"));
+    FileSystemUtils.createEmptyFile(dir.getRelative("caf\u00e9"));
+
+    // A longer, reused array is fine: only the first bytes are the path.
+    byte[] buffer = new byte[1024];
+    byte[] path = NativePosixFiles.encodePath(dir.getRelative("link").getPathString());
+    System.arraycopy(path, 0, buffer, 0, path.length);
+    assertThat(NativePosixFiles.statBytes(buffer, path.length).getSize()).isEqualTo(3);
+    assertThat(NativePosixFiles.lstatBytes(buffer, path.length).isSymbolicLink()).isTrue();
+    assertThat(NativePosixFiles.errnoStatBytes(buffer, path.length - 1).hasError()).isTrue();
+    assertThat(NativePosixFiles.errnoLstatBytes(buffer, path.length).hasError()).isFalse();
+    try {
+      NativePosixFiles.statBytes(buffer, path.length - 1);
+      fail();
+    } catch (FileNotFoundException e) {
+      // Expected.
+    }
+
+    path = NativePosixFiles.encodePath(dir.getPathString());
+    NativePosixFiles.PackedDirents dirents =
+        NativePosixFiles.readdirPacked(path, path.length, NativePosixFiles.ReadTypes.NOFOLLOW);
+    assertThat(dirents.size()).isEqualTo(3);
+    String[] names = new String[dirents.size()];
+    for (int i = 0; i < dirents.size(); i++) {
+      names[i] = dirents.getName(i);
+      assertThat(dirents.getType(i))
+          .isEqualTo(
+              names[i].equals("link")
+                  ? NativePosixFiles.Dirents.Type.SYMLINK
+                  : NativePosixFiles.Dirents.Type.FILE);
+    }
+    assertThat(names).asList().containsExactly("file", "link", "caf\u00e9");
+  }
+
+  @Test
+  public void testGlob() throws Exception {
+    Path root = workingDir.getRelative("glob");
+    FileSystemUtils.createDirectoryAndParents(root.getRelative("a/b"));
+    FileSystemUtils.createDirectoryAndParents(root.getRelative("a/.hidden"));
+    FileSystemUtils.createDirectoryAndParents(root.getRelative("gen/c"));
+    FileSystemUtils.createEmptyFile(root.getRelative("top.java"));
+    FileSystemUtils.createEmptyFile(root.getRelative("a/x.java"));
+    FileSystemUtils.createEmptyFile(root.getRelative("a/b/y.java"));
+    FileSystemUtils.createEmptyFile(root.getRelative("a/b/y.txt"));
+    FileSystemUtils.createEmptyFile(root.getRelative("a/.hidden/z.java"));
+    FileSystemUtils.createEmptyFile(root.getRelative("gen/c/g.java"));
+    root.getRelative("link").createSymbolicLink(new PathFragment("a/b"));
+    root.getRelative("dangling.java").createSymbolicLink(new PathFragment("nowhere"));
+    // A cycle, which is not followed.
+    root.getRelative("a/b/up").createSymbolicLink(new PathFragment("../.."));
+    String rootPath = root.getPathString();
+
+    assertThat(
+            NativePosixFiles.glob(
+                rootPath, new String[] {"**/*.java"}, new String[] {"gen/**"}, true))
+        .asList()
+        .containsExactly(
+            "a/.hidden/z.java", "a/b/y.java", "a/x.java", "link/y.java", "top.java")
+        .inOrder();
+    assertThat(NativePosixFiles.glob(rootPath, new String[] {"*"}, new String[0], false))
+        .asList()
+        .containsExactly("a", "gen", "link", "top.java")
+        .inOrder();
+    assertThat(
+            NativePosixFiles.glob(
+                rootPath, new String[] {"a/**", "link/y.*"}, new String[] {"**/*.txt"}, false))
+        .asList()
+        .containsExactly(
+            "a", "a/.hidden", "a/.hidden/z.java", "a/b", "a/b/y.java", "a/x.java", "link/y.java")
+        .inOrder();
+    assertThat(
+            NativePosixFiles.glob(
+                root.getRelative("missing").getPathString(),
+                new String[] {"**"},
+                new String[0],
+                false))
+        .isEmpty();
+  }
+
   @Test
   public void throwsFilePermissionException() throws Exception {
     File foo = new File("/bin");
@@ -0,0 +1,79 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.unix;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.atomic.AtomicLong;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link NativePosixSystem}. */
+@RunWith(JUnit4.class)
+public class NativePosixSystemTest {
+
+  /** Returns the fields of the thread {@code threadId} in {@code times}, or null. */
+  private static long[] find(long[] times, long threadId) {
+    assertThat(times.length % NativePosixSystem.THREAD_CPU_TIME_FIELDS).isEqualTo(0);
+    for (int i = 0; i < times.length; i += NativePosixSystem.THREAD_CPU_TIME_FIELDS) {
+      if (times[i + NativePosixSystem.THREAD_ID] == threadId) {
+        return new long[] {
+          times[i + NativePosixSystem.USER_TIME_MICROS],
+          times[i + NativePosixSystem.SYSTEM_TIME_MICROS]
+        };
+      }
+    }
+    return null;
+  }
+
+  @Test
+  public void testThreadCpuTimes() throws Exception {
+    final AtomicLong busyThreadId = new AtomicLong();
+    final CountDownLatch spun = new CountDownLatch(1);
+    final CountDownLatch sampled = new CountDownLatch(1);
+    Thread busy =
+        new Thread(
+            new Runnable() {
+              @Override
+              public void run() {
+                busyThreadId.set(NativePosixSystem.currentThreadId());
+                long end = System.nanoTime() + 300_000_000L;
+                while (System.nanoTime() < end) {}
+                spun.countDown();
+                try {
+                  sampled.await();
+                } catch (InterruptedException e) {
+                  Thread.currentThread().interrupt();
+                }
+              }
+            });
+    busy.start();
+    spun.await();
+
+    long[] times = NativePosixSystem.threadCpuTimes();
+    assertThat(find(times, NativePosixSystem.currentThreadId())).isNotNull();
+    long[] busyTimes = find(times, busyThreadId.get());
+    assertThat(busyTimes).isNotNull();
+    assertThat(busyTimes[0] + busyTimes[1]).isAtLeast(100_000L);
+
+    // A thread that has exited is left out, and the others are still there.
+    sampled.countDown();
+    busy.join();
+    times = NativePosixSystem.threadCpuTimes();
+    assertThat(find(times, busyThreadId.get())).isNull();
+    assertThat(find(times, NativePosixSystem.currentThreadId())).isNotNull();
+  }
+}
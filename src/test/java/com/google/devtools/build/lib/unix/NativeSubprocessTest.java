@@ -0,0 +1,177 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+package com.google.devtools.build.lib.unix;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.UTF_8;
+import static org.junit.Assert.fail;
+
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.ImmutableMap;
+import com.google.common.io.ByteStreams;
+import com.google.common.io.Files;
+import com.google.devtools.build.lib.shell.Subprocess;
+import com.google.devtools.build.lib.shell.SubprocessBuilder;
+import com.google.devtools.build.lib.testutil.TestUtils;
+import java.io.File;
+import java.io.IOException;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link NativeSubprocessFactory}. */
+@RunWith(JUnit4.class)
+public class NativeSubprocessTest {
+
+  private static Subprocess start(SubprocessBuilder builder) throws IOException {
+    return NativeSubprocessFactory.INSTANCE.create(builder);
+  }
+
+  private static SubprocessBuilder shell(String script) {
+    return new SubprocessBuilder().setArgv(ImmutableList.of("sh", "-c", script));
+  }
+
+  @Test
+  public void testStreams() throws Exception {
+    File workingDirectory = new File(TestUtils.tmpDir()).getCanonicalFile();
+    Subprocess process =
+        start(
+            shell("read line; echo \"$line $VAR $(pwd)\"; echo error >&2; exit 3")
+                .setEnv(ImmutableMap.of("VAR", "value"))
+                .setWorkingDirectory(workingDirectory));
+    try {
+      process.getOutputStream().write("input\n".getBytes(UTF_8));
+      process.getOutputStream().close();
+      assertThat(new String(ByteStreams.toByteArray(process.getInputStream()), UTF_8))
+          .isEqualTo("input value " + workingDirectory + "\n");
+      assertThat(new String(ByteStreams.toByteArray(process.getErrorStream()), UTF_8))
+          .isEqualTo("error\n");
+      process.waitFor();
+      assertThat(process.finished()).isTrue();
+      assertThat(process.timedout()).isFalse();
+      assertThat(process.exitValue()).isEqualTo(3);
+      assertThat(((NativeSubprocess) process).getResourceUsage().getMaxResidentSetKilobytes())
+          .isGreaterThan(0L);
+    } finally {
+      process.close();
+    }
+  }
+
+  @Test
+  public void testRedirect() throws Exception {
+    File stdout = new File(TestUtils.tmpDir(), "stdout");
+    Files.write("previous contents", stdout, UTF_8);
+    Subprocess process =
+        start(
+            shell("echo out; echo err >&2")
+                .setStdout(stdout)
+                .setStderr(SubprocessBuilder.StreamAction.DISCARD));
+    try {
+      assertThat(process.getInputStream()).isNull();
+      assertThat(process.getErrorStream()).isNull();
+      process.waitFor();
+      assertThat(process.exitValue()).isEqualTo(0);
+      assertThat(Files.toString(stdout, UTF_8)).isEqualTo("out\n");
+    } finally {
+      process.close();
+    }
+  }
+
+  @Test
+  public void testTee() throws Exception {
+    File log = new File(TestUtils.tmpDir(), "tee.log");
+    Files.write("previous contents\n", log, UTF_8);
+    NativeSubprocess process =
+        (NativeSubprocess) start(shell("seq 1 20000; echo err >&2"));
+    try {
+      assertThat(new String(process.teeStdout(log, 12), UTF_8)).isEqualTo("19999\n20000\n");
+      assertThat(new String(ByteStreams.toByteArray(process.getErrorStream()), UTF_8))
+          .isEqualTo("err\n");
+      process.waitFor();
+      assertThat(process.exitValue()).isEqualTo(0);
+      String contents = Files.toString(log, UTF_8);
+      assertThat(contents).startsWith("previous contents\n1\n2\n");
+      assertThat(contents).endsWith("\n19999\n20000\n");
+      assertThat(contents.split("\n")).hasLength(20001);
+    } finally {
+      process.close();
+    }
+  }
+
+  @Test
+  public void testTimeout() throws Exception {
+    Subprocess process = start(shell("sleep 100").setTimeoutMillis(50));
+    try {
+      process.waitFor();
+      assertThat(process.timedout()).isTrue();
+      assertThat(process.exitValue()).isEqualTo(128 + 9); // SIGKILL
+    } finally {
+      process.close();
+    }
+  }
+
+  @Test
+  public void testDestroy() throws Exception {
+    Subprocess process = start(shell("sleep 100"));
+    try {
+      assertThat(process.destroy()).isTrue();
+      process.waitFor();
+      assertThat(process.timedout()).isFalse();
+      assertThat(process.exitValue()).isEqualTo(128 + 15); // SIGTERM
+    } finally {
+      process.close();
+    }
+  }
+
+  @Test
+  public void testExecFailure() throws Exception {
+    try {
+      start(new SubprocessBuilder().setArgv(ImmutableList.of("/does/not/exist")));
+      fail();
+    } catch (IOException e) {
+      assertThat(e).hasMessage("/does/not/exist (No such file or directory)");
+    }
+  }
+
+  @Test
+  public void testParseStatistics() {
+    NativeSubprocess.ResourceUsage usage =
+        NativeSubprocess.ResourceUsage.parseStatistics(
+            "user_time_micros 1200\n"
+                + "system_time_micros 300\n"
+                + "max_resident_set_kilobytes 4096\n"
+                + "block_output_operations 8\n"
+                + "some_future_field 5\n");
+    assertThat(usage.getUserTimeMicros()).isEqualTo(1200L);
+    assertThat(usage.getSystemTimeMicros()).isEqualTo(300L);
+    assertThat(usage.getMaxResidentSetKilobytes()).isEqualTo(4096L);
+    assertThat(usage.getBlockOutputOperations()).isEqualTo(8L);
+    assertThat(usage.getBlockInputOperations()).isEqualTo(0L);
+  }
+
+  @Test
+  public void testParseCgroupStatistics() {
+    NativeSubprocess.CgroupStatistics stats =
+        NativeSubprocess.CgroupStatistics.parseStatistics(
+            "user_time_micros 1200\n"
+                + "cgroup_cpu_time_micros 1500\n"
+                + "cgroup_memory_peak_bytes 1048576\n"
+                + "cgroup_oom_kills 0\n");
+    assertThat(stats.getCpuTimeMicros()).isEqualTo(1500L);
+    assertThat(stats.getMemoryPeakBytes()).isEqualTo(1048576L);
+    assertThat(stats.getIoReadBytes()).isEqualTo(-1L);
+    assertThat(NativeSubprocess.CgroupStatistics.parseStatistics("user_time_micros 1200\n"))
+        .isNull();
+  }
+}
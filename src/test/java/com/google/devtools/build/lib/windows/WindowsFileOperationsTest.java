@@ -23,6 +23,7 @@ import com.google.devtools.build.lib.util.OS;
 import com.google.devtools.build.lib.vfs.WindowsFileSystem;
 import com.google.devtools.build.lib.windows.util.WindowsTestUtil;
 import java.io.File;
+import java.io.FileNotFoundException;
 import java.io.IOException;
 import java.nio.file.Files;
 import java.util.Arrays;
@@ -159,4 +160,34 @@ public class WindowsFileOperationsTest {
                 linkPath.toPath(), WindowsFileSystem.symlinkOpts(/* followSymlinks */ true)))
         .isFalse();
   }
+
+  @Test
+  public void testReadDirectory() throws Exception {
+    String root = testUtil.scratchDir("dir").toAbsolutePath().toString();
+    testUtil.scratchFile("dir/file.txt", "hello");
+    testUtil.scratchDir("dir/sub");
+    testUtil.createJunctions(ImmutableMap.of("dir/junc", "dir/sub"));
+
+    Map<String, WindowsFileOperations.DirectoryEntry> entries = new HashMap<>();
+    for (WindowsFileOperations.DirectoryEntry entry : WindowsFileOperations.readDirectory(root)) {
+      entries.put(entry.getName(), entry);
+    }
+    assertThat(entries.keySet()).containsExactly("file.txt", "sub", "junc");
+
+    WindowsFileOperations.DirectoryEntry file = entries.get("file.txt");
+    assertThat(file.isDirectory()).isFalse();
+    assertThat(file.isSymbolicLink()).isFalse();
+    assertThat(file.getSize()).isEqualTo(5L);
+    assertThat(file.getLastWriteTime()).isEqualTo(new File(root, "file.txt").lastModified());
+    assertThat(entries.get("sub").isDirectory()).isTrue();
+    assertThat(entries.get("sub").isSymbolicLink()).isFalse();
+    assertThat(entries.get("junc").isSymbolicLink()).isTrue();
+
+    try {
+      WindowsFileOperations.readDirectory(root + "/non-existent");
+      fail("expected to throw");
+    } catch (FileNotFoundException e) {
+      // Expected.
+    }
+  }
 }
@@ -138,6 +138,18 @@ public class WindowsProcessesTest {
     assertNoProcessError();
   }
 
+  @Test
+  public void testResourceUsage() throws Exception {
+    process = WindowsProcesses.nativeCreateProcess(
+        mockArgs("O-HELLO"), null, null, null, null, 1L << 30, 0);
+    assertNoProcessError();
+    assertThat(WindowsProcesses.nativeWaitFor(process, -1)).isEqualTo(0);
+    long[] usage = WindowsProcesses.nativeGetResourceUsage(process);
+    assertThat(usage[WindowsProcesses.USAGE_USER_TIME_MICROS]).isAtLeast(0L);
+    assertThat(usage[WindowsProcesses.USAGE_PEAK_PROCESS_MEMORY_BYTES]).isGreaterThan(0L);
+    assertThat(usage[WindowsProcesses.USAGE_PEAK_JOB_MEMORY_BYTES]).isAtMost(1L << 30);
+  }
+
   @Test
   public void testPartialRead() throws Exception {
     process = WindowsProcesses.nativeCreateProcess(mockArgs("O-HELLO"), null, null, null, null);
@@ -358,6 +358,42 @@ EOF
   expect_log "name=\"dir/fail\""
 }
 
+function test_native_test_setup() {
+  cat > WORKSPACE <<EOF
+workspace(name = "bar")
+EOF
+  mkdir -p foo
+  cat > foo/testenv.sh <<'EOF'
+#!/bin/bash
+echo "pwd: $PWD"
+echo "src: $TEST_SRCDIR"
+echo "tmp: $TEST_TMPDIR"
+echo "xml: $XML_OUTPUT_FILE"
+echo "self: $(rlocation bar/foo/testenv.sh)"
+exit 1
+EOF
+  chmod +x foo/testenv.sh
+  cat > foo/BUILD <<EOF
+sh_test(
+    name = "foo",
+    srcs = ["testenv.sh"],
+)
+EOF
+
+  bazel test --experimental_native_test_setup --test_output=all //foo &> $TEST_log \
+    && fail "Test should have failed"
+  expect_log "pwd: .*/foo.runfiles/bar$"
+  expect_log "src: /.*/foo.runfiles$"
+  expect_log "tmp: /.*"
+  expect_log "xml: /.*/test.xml$"
+  expect_log "self: /.*/foo.runfiles/bar/foo/testenv.sh$"
+
+  cat bazel-testlogs/foo/foo/test.xml >$TEST_log
+  expect_log "errors=\"1\""
+  expect_log "exited with error code 1"
+  expect_log "name=\"foo/foo\""
+}
+
 function test_detailed_test_summary() {
   copy_examples
   cat > WORKSPACE <<EOF
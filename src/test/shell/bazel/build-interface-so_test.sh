@@ -0,0 +1,118 @@
+#!/bin/bash
+#
+# Copyright 2016 The Bazel Authors. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Tests the interface shared objects of build-interface-so.
+#
+
+# Load the test setup defined in the parent directory
+CURRENT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+source "${CURRENT_DIR}/../integration_test_setup.sh" \
+  || { echo "integration_test_setup.sh not found!" >&2; exit 1; }
+
+readonly DIR="${TEST_TMPDIR}/ifso"
+
+function set_up() {
+  rm -rf $DIR
+  mkdir -p $DIR/real $DIR/interface
+  cat > $DIR/lib.c <<'EOF2'
+int counter = 5;
+extern int alias __attribute__((weak, alias("counter")));
+__thread int tls = 3;
+static int helper(int x) { return x * FACTOR; }
+int foo(int x) {
+#ifdef LONG_BODY
+  for (int i = 0; i < x; ++i) {
+    counter += helper(i);
+  }
+#endif
+  return helper(x) + counter;
+}
+EOF2
+  cat > $DIR/main.c <<'EOF2'
+#include <stdio.h>
+extern int counter;
+extern int alias;
+extern __thread int tls;
+int foo(int x);
+int main() {
+  counter++;
+  printf("%d %d %d %d\n", foo(2), counter, alias, tls);
+  return 0;
+}
+EOF2
+}
+
+# Builds $DIR/<name>.so with the FACTOR and extra flags given.
+function build_so() {
+  local name=$1 factor=$2
+  shift 2
+  cc -shared -fPIC -DFACTOR=$factor -Wl,-soname,libx.so -o $DIR/$name.so \
+    $DIR/lib.c "$@" &> $TEST_log || fail "cc failed"
+  $build_interface_so $DIR/$name.so $DIR/$name.ifso &> $TEST_log \
+    || fail "build-interface-so failed"
+}
+
+function test_interface_ignores_implementation() {
+  build_so a 1
+  build_so b 7
+  cmp -s $DIR/a.so $DIR/b.so && fail "the shared objects should differ"
+  cmp $DIR/a.ifso $DIR/b.ifso || fail "the interfaces should be the same"
+}
+
+function test_interface_ignores_function_size() {
+  build_so a 1
+  build_so b 1 -DLONG_BODY
+  readelf --dyn-syms -W $DIR/a.so | grep ' foo$' > $DIR/a.foo
+  readelf --dyn-syms -W $DIR/b.so | grep ' foo$' > $DIR/b.foo
+  cmp -s $DIR/a.foo $DIR/b.foo && fail "foo should have another size"
+  cmp $DIR/a.ifso $DIR/b.ifso || fail "the interfaces should be the same"
+}
+
+function test_interface_changes_with_abi() {
+  build_so a 1
+  echo "int bar(void) { return 1; }" >> $DIR/lib.c
+  build_so b 1
+  cmp -s $DIR/a.ifso $DIR/b.ifso && fail "the interfaces should differ"
+  true
+}
+
+function test_link_against_interface() {
+  build_so a 1
+  build_so b 7
+  cp $DIR/a.ifso $DIR/interface/libx.so
+  cp $DIR/b.so $DIR/real/libx.so
+  cc -o $DIR/main $DIR/main.c -L$DIR/interface -lx &> $TEST_log \
+    || fail "linking against the interface failed"
+  LD_LIBRARY_PATH=$DIR/real $DIR/main > $DIR/out 2>> $TEST_log \
+    || fail "running against the shared object failed"
+  assert_equals "20 6 6 3" "$(cat $DIR/out)"
+}
+
+function test_keeps_dynamic_strings() {
+  build_so a 1 -Wl,-rpath,/opt/x -lm -Wl,--no-as-needed
+  readelf -d $DIR/a.ifso > $TEST_log || fail "readelf failed"
+  expect_log "Library soname: \[libx.so\]"
+  expect_log "Library runpath: \[/opt/x\]"
+  expect_log "Shared library: \[libc.so"
+}
+
+function test_copies_other_files() {
+  echo "not an ELF file" > $DIR/a.dylib
+  $build_interface_so $DIR/a.dylib $DIR/a.ifso &> $TEST_log || fail
+  cmp $DIR/a.dylib $DIR/a.ifso || fail "the file should be copied"
+}
+
+run_suite "build-interface-so"
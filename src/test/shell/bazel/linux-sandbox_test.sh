@@ -72,6 +72,16 @@ function test_exit_code() {
   assert_equals 71 "$code"
 }
 
+function test_stats() {
+  local stats="${TEST_TMPDIR}/stats.out"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -s "$stats" -- /bin/bash -c "exit 71" \
+    &> $TEST_log || code=$?
+  assert_equals 71 "$code"
+  assert_contains "^user_time_micros [0-9]" "$stats"
+  assert_contains "^max_resident_set_kilobytes [1-9]" "$stats"
+  assert_contains "^involuntary_context_switches [0-9]" "$stats"
+}
+
 function test_signal_death() {
   $linux_sandbox $SANDBOX_DEFAULT_OPTS -- /bin/bash -c 'kill -ABRT $$' &> $TEST_log || code=$?
   assert_equals 134 "$code" # SIGNAL_BASE + SIGABRT = 128 + 6
@@ -117,6 +127,178 @@ function test_redirect_output() {
   assert_equals "err" "$(cat $ERR)"
 }
 
+function test_file_descriptors_are_closed() {
+  local daemon="$TEST_TMPDIR/daemon.$$"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -- /bin/ls /proc/self/fd 7>/dev/null &> $TEST_log || fail
+  expect_not_log "^7$"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -d "$daemon" -- /bin/ls /proc/self/fd 7>/dev/null &> $TEST_log || fail
+  expect_not_log "^[4-9]$"
+}
+
+function test_daemon() {
+  local daemon="$TEST_TMPDIR/daemon.$$"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -d "$daemon" -- /bin/echo hi there &> $TEST_log || fail
+  expect_log "hi there"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -d "$daemon" -- /bin/bash -c "exit 71" &> $TEST_log || code=$?
+  assert_equals 71 "$code"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -d "$daemon" -- /usr/bin/id &> $TEST_log || fail
+  expect_log "uid=65534(nobody) gid=65534(nogroup) groups=65534(nogroup)"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -d "$daemon" -R -- /usr/bin/id &> $TEST_log || fail
+  expect_log "uid=0(root) gid=0(root)"
+}
+
+function test_daemon_network_namespace() {
+  local daemon="$TEST_TMPDIR/daemon.$$"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -d "$daemon" -N -- /bin/ip link ls &> $TEST_log || fail
+  expect_log "LOOPBACK,UP"
+  local first=$($linux_sandbox $SANDBOX_DEFAULT_OPTS -d "$daemon" -N -- /bin/readlink /proc/self/ns/net)
+  local second=$($linux_sandbox $SANDBOX_DEFAULT_OPTS -d "$daemon" -N -- /bin/readlink /proc/self/ns/net)
+  assert_equals "$first" "$second"
+  [ "$first" != "$(readlink /proc/self/ns/net)" ] || fail "network is not isolated"
+}
+
+function test_daemon_read_only() {
+  local daemon="$TEST_TMPDIR/daemon.$$"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -d "$daemon" -- /bin/bash -c \
+    "touch $SANDBOX_DIR/writable && touch /etc/linux-sandbox-test" &> $TEST_log && fail
+  expect_log "Read-only file system"
+  [ -f "$SANDBOX_DIR/writable" ] || fail "working directory is not writable"
+}
+
+function test_input_manifest() {
+  local manifest="$TEST_TMPDIR/inputs.manifest"
+  echo "input contents" > "$TEST_TMPDIR/input.txt"
+  printf '%s\n' "such/input.txt" "$TEST_TMPDIR/input.txt" > "$manifest"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -M "$manifest" -- /bin/bash -c \
+    "cat such/input.txt && readlink such/input.txt" &> $TEST_log || fail
+  expect_log "input contents"
+  expect_log "^$TEST_TMPDIR/input.txt\$"
+}
+
+function test_accesses() {
+  local manifest="$TEST_TMPDIR/inputs.manifest"
+  local accesses="$TEST_TMPDIR/accesses.out"
+  echo "read" > "$TEST_TMPDIR/read.txt"
+  echo "unread" > "$TEST_TMPDIR/unread.txt"
+  printf '%s\n' "in/read.txt" "$TEST_TMPDIR/read.txt" \
+    "in/unread.txt" "$TEST_TMPDIR/unread.txt" > "$manifest"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -M "$manifest" -A "$accesses" -- \
+    /bin/bash -c "cat in/read.txt && ls -l in/unread.txt" &> $TEST_log || fail
+  cp "$accesses" $TEST_log
+  if ! grep -q '^\.$' "$accesses"; then
+    echo "fanotify is not available here, the opens are not traced"
+    return 0
+  fi
+  expect_log "^in/read.txt$"
+  expect_not_log "unread"
+}
+
+function test_timings() {
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -p "$TEST_TMPDIR/timings.out" -- \
+    /bin/true || fail
+  cp "$TEST_TMPDIR/timings.out" $TEST_log
+  expect_log "^spawn_pid1_micros [0-9]*$"
+  expect_log "^mount_filesystems_micros [0-9]*$"
+  expect_log "^command_micros [0-9]*$"
+  expect_log "^teardown_micros [0-9]*$"
+}
+
+function test_scratch_tmpfs() {
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -x 1m -O out/file -O out/dir -- \
+    /bin/bash -c "mkdir -p out/dir && echo file > out/file && \
+      echo dir > out/dir/file && echo scratch > scratch" || fail
+  assert_equals "file" "$(cat $SANDBOX_DIR/out/file)"
+  assert_equals "dir" "$(cat $SANDBOX_DIR/out/dir/file)"
+  [ ! -e "$SANDBOX_DIR/scratch" ] || fail "scratch file reached the disk"
+
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -x 1m -O big -- /bin/bash -c \
+    "head -c 2000000 /dev/zero > big" &> $TEST_log && fail
+  expect_log "No space left on device"
+}
+
+function test_changes() {
+  local changes="$TEST_TMPDIR/changes.out"
+  echo old > "$SANDBOX_DIR/deleted"
+  mkdir -p "$SANDBOX_DIR/logs"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -x 1m -O out -w "$SANDBOX_DIR/logs" \
+    -F "$changes" -- /bin/bash -c "mkdir -p out/dir && \
+      echo file > out/dir/file && ln -s file out/link && rm deleted && \
+      echo log > logs/test.log" || fail
+  cp "$changes" $TEST_log
+  if ! grep -q '^\.$' "$changes"; then
+    echo "overlayfs is not available here, the changes are not tracked"
+    return 0
+  fi
+  expect_log "^d out$"
+  expect_log "^d out/dir$"
+  expect_log "^f out/dir/file$"
+  expect_log "^l out/link$"
+  expect_log "^x deleted$"
+  expect_log "^f logs/test.log$"
+}
+
+function test_cpu_affinity() {
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -c 0 -- /bin/grep Cpus_allowed_list \
+    /proc/self/status &> $TEST_log || fail
+  expect_log "Cpus_allowed_list:.0$"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -c 0-1,x -- /bin/true &> $TEST_log && fail
+  expect_log "Invalid CPU list (-c): 0-1,x"
+}
+
+# Waits up to 10 seconds for the file $1 to exist.
+function wait_for_file() {
+  for i in $(seq 100); do
+    [ -e "$1" ] && return 0
+    sleep 0.1
+  done
+  fail "$1 does not exist"
+}
+
+# Asks the sandbox of the persistent worker listening on $1 to swap in the
+# inputs of the directory $2, and prints the response.
+function swap_worker_inputs() {
+  python -c 'import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall((sys.argv[2] + "\n").encode())
+print(s.makefile().readline().strip())' "$1" "$2"
+}
+
+function test_worker_input_swaps() {
+  local inputs="$TEST_TMPDIR/inputs"
+  local socket="$(mktemp -u /tmp/linux-sandbox-test.XXXXXX)"
+  mkdir -p "$inputs/first/dir" "$inputs/second/dir"
+  echo first > "$inputs/first/dir/input"
+  echo second > "$inputs/second/dir/input"
+  echo initial > "$SANDBOX_DIR/input"
+  mkfifo "$TEST_TMPDIR/requests"
+  $linux_sandbox $SANDBOX_DEFAULT_OPTS -b "$inputs" -I "$socket" -- \
+    /bin/bash -c 'cp input initial; while read request; do
+      cat dir/input > dir/output; ls > dir/listing; done' \
+    < "$TEST_TMPDIR/requests" &> $TEST_log &
+  local pid=$!
+  exec 3> "$TEST_TMPDIR/requests"
+  wait_for_file "$socket"
+
+  assert_equals 0 "$(swap_worker_inputs "$socket" "$inputs/first")"
+  echo request >&3
+  wait_for_file "$inputs/first/dir/listing"
+  assert_equals first "$(cat "$inputs/first/dir/output")"
+  # What the worker wrote outside of the inputs is gone.
+  assert_equals dir "$(cat "$inputs/first/dir/listing")"
+
+  assert_equals 0 "$(swap_worker_inputs "$socket" "$inputs/second")"
+  echo request >&3
+  wait_for_file "$inputs/second/dir/listing"
+  assert_equals second "$(cat "$inputs/second/dir/output")"
+
+  assert_equals 2 "$(swap_worker_inputs "$socket" "$inputs/missing")"
+  exec 3>&-
+  wait $pid || fail "the worker failed"
+  [ ! -e "$SANDBOX_DIR/initial" ] || fail "the worker wrote to the disk"
+  [ ! -e "$socket" ] || fail "$socket was not removed"
+}
+
 # The test shouldn't fail if the environment doesn't support running it.
 check_supported_platform || exit 0
 check_sandbox_allowed || exit 0
@@ -56,6 +56,41 @@ function test_exit_code() {
   assert_equals 71 "$code"
 }
 
+function test_stats() {
+  local code=0
+  local stats="${OUT_DIR}/stats.out"
+  $process_wrapper --stats="$stats" -1 0 $OUT $ERR /bin/bash -c "exit 71" \
+    &> $TEST_log || code=$?
+  assert_equals 71 "$code"
+  assert_contains "^wall_time_micros [0-9]" "$stats"
+  assert_contains "^user_time_micros [0-9]" "$stats"
+  assert_contains "^max_resident_set_kilobytes [1-9]" "$stats"
+  assert_contains "^block_output_operations [0-9]" "$stats"
+}
+
+function test_stats_output_bytes() {
+  local stats="${OUT_DIR}/stats.out"
+  $process_wrapper --stats="$stats" -1 0 $OUT $ERR /bin/bash -c \
+    "echo hello; echo world >&2" &> $TEST_log || fail
+  assert_contains "^stdout_bytes 6$" "$stats"
+  assert_contains "^stdout_discarded_bytes 0$" "$stats"
+  assert_contains "^stderr_bytes 6$" "$stats"
+}
+
+function test_output_limit() {
+  local stats="${OUT_DIR}/stats.out"
+  $process_wrapper --stats="$stats" --output_limit=20 -1 0 $OUT $ERR \
+    /bin/bash -c 'for i in $(seq 1 100); do echo line$i; done; echo short >&2' \
+    &> $TEST_log || fail
+  assert_equals "line1" "$(head -1 $OUT)"
+  assert_contains "^\[process-wrapper: 672 bytes of stdout discarded\]$" "$OUT"
+  assert_equals "line100" "$(tail -1 $OUT)"
+  assert_equals "short" "$(cat $ERR)"
+  assert_contains "^stdout_bytes 692$" "$stats"
+  assert_contains "^stdout_discarded_bytes 672$" "$stats"
+  assert_contains "^stderr_discarded_bytes 0$" "$stats"
+}
+
 function test_signal_death() {
   local code=0
   $process_wrapper -1 0 $OUT $ERR /bin/bash -c 'kill -ABRT $$' &> $TEST_log || code=$?
@@ -101,6 +136,38 @@ function test_timeout_kill() {
   assert_stdout "before"
 }
 
+# Tests that the grace period of a timeout is over as soon as the process
+# group exited, rather than after the whole kill delay.
+function test_timeout_grace_ends_early() {
+  local code=0
+  local start=$SECONDS
+  $process_wrapper 1 30 $OUT $ERR /bin/bash -c \
+    '(sleep 1; echo grandchild) & trap "wait; exit 0" SIGTERM; sleep 10' \
+    &> $TEST_log || code=$?
+  assert_equals 142 "$code" # SIGNAL_BASE + SIGALRM = 128 + 14
+  [ $((SECONDS - start)) -lt 10 ] || fail "waited for the whole kill delay"
+}
+
+# Tests that with --cgroup, a grandchild that left the process group is killed
+# along with the rest, and the cgroup is removed.
+function test_cgroup_kill() {
+  local cgroup
+  cgroup=$(awk '$3 == "cgroup2" { print $2; exit }' /proc/mounts)
+  if [ -z "$cgroup" ] || [ ! -w "$cgroup" ]; then
+    echo "No writable cgroup v2 hierarchy on this system, skipping..."
+    return 0
+  fi
+  cgroup=$(mktemp -d "$cgroup/process-wrapper_test.XXXXXX")
+
+  local code=0
+  $process_wrapper --cgroup="$cgroup" -1 0 $OUT $ERR /bin/bash -c \
+    'setsid sleep 100 & echo $!' &> $TEST_log || code=$?
+  assert_equals 0 "$code"
+  local pid=$(cat $OUT)
+  kill -0 "$pid" 2> /dev/null && fail "the grandchild $pid is still alive"
+  rmdir "$cgroup" || fail "the cgroup of the command was not removed"
+}
+
 function test_execvp_error_message() {
   local code=0
   $process_wrapper -1 0 $OUT $ERR /bin/notexisting &> $TEST_log || code=$?
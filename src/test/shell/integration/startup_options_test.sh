@@ -32,4 +32,13 @@ function test_different_startup_options() {
   true
 }
 
+function test_batch_without_server() {
+  bazel shutdown >& $TEST_log || fail "Couldn't shut down ${PRODUCT_NAME}"
+  pid=$(bazel --batch info server_pid 2> $TEST_log)
+  [[ -n $pid ]] || fail "Couldn't run ${PRODUCT_NAME} in batch mode"
+  expect_not_log "needs to be killed"
+  kill -0 $pid 2> /dev/null && fail "$pid not dead"
+  true
+}
+
 run_suite "${PRODUCT_NAME} startup options test"
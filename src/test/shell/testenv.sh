@@ -90,6 +90,9 @@ genclass_path="${BAZEL_RUNFILES}/src/java_tools/buildjar/java/com/google/devtool
 junitrunner_path="${BAZEL_RUNFILES}/src/java_tools/junitrunner/java/com/google/testing/junit/runner/Runner_deploy.jar"
 ijar_path="${BAZEL_RUNFILES}/third_party/ijar/ijar"
 
+# C++ tooling
+build_interface_so="${BAZEL_RUNFILES}/src/main/tools/build-interface-so"
+
 # Sandbox tools
 process_wrapper="${BAZEL_RUNFILES}/src/main/tools/process-wrapper"
 linux_sandbox="${BAZEL_RUNFILES}/src/main/tools/linux-sandbox"
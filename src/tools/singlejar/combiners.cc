@@ -28,10 +28,8 @@ bool Concatenator::Merge(const CDH *cdh, const LH *lh) {
   if (Z_NO_COMPRESSION == lh->compression_method()) {
     buffer_->ReadEntryContents(lh);
   } else if (Z_DEFLATED == lh->compression_method()) {
-    if (!inflater_.get()) {
-      inflater_.reset(new Inflater());
-    }
-    buffer_->DecompressEntryContents(cdh, lh, inflater_.get());
+    ZStreamPool<Inflater>::Ptr inflater = ZStreamPool<Inflater>::Acquire();
+    buffer_->DecompressEntryContents(cdh, lh, inflater.get());
   } else {
     errx(2, "%s is neither stored nor deflated", filename_.c_str());
   }
@@ -119,23 +117,22 @@ void *NullCombiner::OutputEntry(bool compress) { return nullptr; }
 XmlCombiner::~XmlCombiner() {}
 
 bool XmlCombiner::Merge(const CDH *cdh, const LH *lh) {
-  if (!concatenator_.get()) {
-    concatenator_.reset(new Concatenator(filename_, false));
-    concatenator_->Append("<");
-    concatenator_->Append(xml_tag_);
-    concatenator_->Append(">\n");
+  if (!concatenator_.has_contents()) {
+    concatenator_.Append("<");
+    concatenator_.Append(xml_tag_);
+    concatenator_.Append(">\n");
   }
-  return concatenator_->Merge(cdh, lh);
+  return concatenator_.Merge(cdh, lh);
 }
 
 void *XmlCombiner::OutputEntry(bool compress) {
-  if (!concatenator_.get()) {
+  if (!concatenator_.has_contents()) {
     return nullptr;
   }
-  concatenator_->Append("</");
-  concatenator_->Append(xml_tag_);
-  concatenator_->Append(">\n");
-  return concatenator_->OutputEntry(compress);
+  concatenator_.Append("</");
+  concatenator_.Append(xml_tag_);
+  concatenator_.Append(">\n");
+  return concatenator_.OutputEntry(compress);
 }
 
 PropertyCombiner::~PropertyCombiner() {}
@@ -143,3 +140,33 @@ PropertyCombiner::~PropertyCombiner() {}
 bool PropertyCombiner::Merge(const CDH *cdh, const LH *lh) {
   return false;  // This should not be called.
 }
+
+void *PropertyCombiner::OutputEntry(bool compress) {
+  for (auto &line : lines_) {
+    Append(line);
+    Append("\n", 1);
+  }
+  lines_.clear();
+  property_lines_.clear();
+  return Concatenator::OutputEntry(compress);
+}
+
+bool PropertyCombiner::AddProperty(const std::string &key,
+                                   const std::string &value) {
+  auto got = property_lines_.emplace(key, lines_.size());
+  if (!got.second) {
+    lines_[got.first->second] = key + "=" + value;
+    return false;
+  }
+  lines_.push_back(key + "=" + value);
+  return true;
+}
+
+void PropertyCombiner::AddLine(const std::string &line) {
+  size_t separator = line.find('=');
+  if (separator == std::string::npos || line[0] == '#' || line[0] == '!') {
+    lines_.push_back(line);
+  } else {
+    AddProperty(line.substr(0, separator), line.substr(separator + 1));
+  }
+}
@@ -17,6 +17,8 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "src/tools/singlejar/transient_bytes.h"
 #include "src/tools/singlejar/zip_headers.h"
@@ -59,6 +61,9 @@ class Concatenator : public Combiner {
 
   const std::string &filename() const { return filename_; }
 
+  // Whether anything has been merged or appended.
+  bool has_contents() const { return buffer_.get() != nullptr; }
+
  private:
   void CreateBuffer() {
     if (!buffer_.get()) {
@@ -67,7 +72,6 @@ class Concatenator : public Combiner {
   }
   const std::string filename_;
   std::unique_ptr<TransientBytes> buffer_;
-  std::unique_ptr<Inflater> inflater_;
   bool insert_newlines_;
 };
 
@@ -83,28 +87,31 @@ class NullCombiner : public Combiner {
 
 // Combines the contents of the multiple input entries which are XML
 // files into a single XML output entry with given top level XML tag.
+// The contents of each input entry is decompressed straight into the
+// output buffer, following the opening tag.
 class XmlCombiner : public Combiner {
  public:
   XmlCombiner(const std::string &filename, const char *xml_tag)
-      : filename_(filename), xml_tag_(xml_tag) {}
+      : concatenator_(filename, false), xml_tag_(xml_tag) {}
   ~XmlCombiner() override;
 
   bool Merge(const CDH *cdh, const LH *lh) override;
 
   void *OutputEntry(bool compress) override;
 
-  const std::string filename() const { return filename_; }
+  const std::string filename() const { return concatenator_.filename(); }
 
  private:
-  const std::string filename_;
+  Concatenator concatenator_;
   const char *xml_tag_;
-  std::unique_ptr<Concatenator> concatenator_;
-  std::unique_ptr<Inflater> inflater_;
 };
 
 // A wrapper around Concatenator allowing to append
 //   NAME=VALUE
-// lines to the contents.
+// lines to the contents. A property is written only once, where it has been
+// added first, with the value it has been added with last: java.util.Properties
+// would read the same value from the lines as they were added.
+// The lines are appended to the contents by OutputEntry().
 // NOTE that it does not allow merging existing entries.
 class PropertyCombiner : public Concatenator {
  public:
@@ -113,21 +120,25 @@ class PropertyCombiner : public Concatenator {
 
   bool Merge(const CDH *cdh, const LH *lh) override;
 
-  void AddProperty(const char *key, const char *value) {
-    // TODO(asmundak): deduplicate properties.
-    Append(key);
-    Append("=", 1);
-    Append(value);
-    Append("\n", 1);
-  }
+  void *OutputEntry(bool compress) override;
 
-  void AddProperty(const std::string &key, const std::string &value) {
-    // TODO(asmundak): deduplicate properties.
-    Append(key);
-    Append("=", 1);
-    Append(value);
-    Append("\n", 1);
+  // Returns false if the property has been added already, in which case its
+  // value is replaced.
+  bool AddProperty(const char *key, const char *value) {
+    return AddProperty(std::string(key), std::string(value));
   }
+
+  bool AddProperty(const std::string &key, const std::string &value);
+
+  // Adds a line of a properties file: a NAME=VALUE line is added as a
+  // property, any other line (e.g., a comment) is kept as it is.
+  void AddLine(const std::string &line);
+
+ private:
+  // The lines to output, without their line terminators.
+  std::vector<std::string> lines_;
+  // The index in lines_ of each property.
+  std::unordered_map<std::string, size_t> property_lines_;
 };
 
 #endif  //  SRC_TOOLS_SINGLEJAR_COMBINERS_H_
@@ -196,11 +196,21 @@ TEST_F(CombinersTest, XmlCombiner) {
 // Test PropertyCombiner.
 TEST_F(CombinersTest, PropertyCombiner) {
   static char kProperties[] =
-      "name=value\n"
-      "name_str=value_str\n";
+      "name=value2\n"
+      "name_str=value_str\n"
+      "# comment\n"
+      "no_value\n"
+      "line=value\n";
   PropertyCombiner property_combiner("properties");
-  property_combiner.AddProperty("name", "value");
-  property_combiner.AddProperty(string("name_str"), string("value_str"));
+  EXPECT_TRUE(property_combiner.AddProperty("name", "value"));
+  EXPECT_TRUE(
+      property_combiner.AddProperty(string("name_str"), string("value_str")));
+  property_combiner.AddLine("# comment");
+  property_combiner.AddLine("no_value");
+  property_combiner.AddLine("line=value0");
+  // A duplicate replaces the value, in place.
+  EXPECT_FALSE(property_combiner.AddProperty("name", "value2"));
+  property_combiner.AddLine("line=value");
 
   // Merge should not be called.
   ASSERT_FALSE(property_combiner.Merge(nullptr, nullptr));
@@ -0,0 +1,162 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/crc32.h"
+
+#include <zlib.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SINGLEJAR_CRC32_PCLMUL 1
+#elif defined(__aarch64__) && defined(__GNUC__) && defined(__linux)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <string.h>
+#include <sys/auxv.h>
+#define SINGLEJAR_CRC32_ARMV8 1
+#endif
+
+// The software fallback. zlib's crc32() takes a 32-bit length.
+static uint32_t ZlibCrc32(uint32_t crc, const uint8_t *data, size_t size) {
+  static const size_t kChunkSize = 1 << 30;
+  while (size > 0) {
+    size_t chunk_size = size < kChunkSize ? size : kChunkSize;
+    crc = crc32(crc, data, chunk_size);
+    data += chunk_size;
+    size -= chunk_size;
+  }
+  return crc;
+}
+
+#if defined(SINGLEJAR_CRC32_PCLMUL)
+
+// Folds 64-byte blocks with carry-less multiplication, then reduces the
+// result with Barrett reduction, after Intel's "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction". The constants are for
+// the bit-reflected CRC-32 polynomial. Takes and returns the inverted CRC.
+// 'size' is at least 64 and a multiple of 16.
+__attribute__((target("pclmul,sse4.1"))) static uint32_t PclmulCrc32(
+    uint32_t crc, const uint8_t *data, size_t size) {
+  alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+  alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+  alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+  alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+  const __m128i *p = reinterpret_cast<const __m128i *>(data);
+  __m128i x1 = _mm_loadu_si128(p);
+  __m128i x2 = _mm_loadu_si128(p + 1);
+  __m128i x3 = _mm_loadu_si128(p + 2);
+  __m128i x4 = _mm_loadu_si128(p + 3);
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  __m128i k = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+  p += 4;
+  size -= 64;
+
+  // Fold four 128-bit lanes in parallel.
+  for (; size >= 64; size -= 64, p += 4) {
+    __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    __m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+    __m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+    __m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(p));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(p + 1));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(p + 2));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(p + 3));
+  }
+
+  // Fold the lanes into one.
+  k = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+  __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // Fold the remaining 16-byte blocks.
+  for (; size >= 16; size -= 16, ++p) {
+    x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(p)), x5);
+  }
+
+  // Fold 128 bits to 64 bits.
+  x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+  __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  k = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x00), x2);
+
+  // Barrett reduction to 32 bits.
+  k = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return _mm_extract_epi32(x1, 1);
+}
+
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size) {
+  static const bool has_pclmul =
+      __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+  if (has_pclmul && size >= 64) {
+    size_t folded_size = size & ~static_cast<size_t>(15);
+    crc = ~PclmulCrc32(~crc, data, folded_size);
+    data += folded_size;
+    size -= folded_size;
+  }
+  return ZlibCrc32(crc, data, size);
+}
+
+#elif defined(SINGLEJAR_CRC32_ARMV8)
+
+// Takes and returns the inverted CRC.
+__attribute__((target("+crc"))) static uint32_t Armv8Crc32(
+    uint32_t crc, const uint8_t *data, size_t size) {
+  for (; size >= 8; size -= 8, data += 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc = __crc32d(crc, word);
+  }
+  for (; size > 0; --size, ++data) {
+    crc = __crc32b(crc, *data);
+  }
+  return crc;
+}
+
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size) {
+  static const bool has_crc32 = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+  if (has_crc32) {
+    return ~Armv8Crc32(~crc, data, size);
+  }
+  return ZlibCrc32(crc, data, size);
+}
+
+#else
+
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size) {
+  return ZlibCrc32(crc, data, size);
+}
+
+#endif
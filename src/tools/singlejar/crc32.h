@@ -0,0 +1,27 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_TOOLS_SINGLEJAR_CRC32_H_
+#define BAZEL_SRC_TOOLS_SINGLEJAR_CRC32_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Updates the running CRC-32 (the Zip one, same as zlib's crc32()) with
+// given bytes and returns it. Uses carry-less multiplication (PCLMULQDQ) on
+// x86-64 and the CRC32 instructions on ARMv8 if the CPU supports them.
+// The checksums of adjacent pieces can be combined with crc32_combine().
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+#endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_CRC32_H_
@@ -0,0 +1,59 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "src/tools/singlejar/crc32.h"
+#include "gtest/gtest.h"
+#include <zlib.h>
+
+namespace {
+
+TEST(Crc32Test, KnownValues) {
+  EXPECT_EQ(0, Crc32(0, nullptr, 0));
+  EXPECT_EQ(0xCBF43926,
+            Crc32(0, reinterpret_cast<const uint8_t *>("123456789"), 9));
+}
+
+// Same as zlib's crc32() for all sizes, alignments and initial values.
+TEST(Crc32Test, MatchesZlib) {
+  std::vector<uint8_t> data(4096 + 16);
+  srand(42);
+  for (auto &byte : data) {
+    byte = rand();
+  }
+  for (size_t offset = 0; offset < 16; offset += 3) {
+    for (size_t size = 0; size <= 4096; size += (size < 300 ? 1 : 97)) {
+      uint32_t initial = size * 2654435761U;
+      ASSERT_EQ(crc32(initial, &data[offset], size),
+                Crc32(initial, &data[offset], size))
+          << "offset " << offset << ", size " << size;
+    }
+  }
+}
+
+TEST(Crc32Test, Combine) {
+  std::vector<uint8_t> data(100000, 'x');
+  for (size_t i = 0; i < data.size(); i += 7) {
+    data[i] = i;
+  }
+  uint32_t crc1 = Crc32(0, data.data(), 30000);
+  uint32_t crc2 = Crc32(0, data.data() + 30000, data.size() - 30000);
+  EXPECT_EQ(Crc32(0, data.data(), data.size()),
+            crc32_combine(crc1, crc2, data.size() - 30000));
+}
+
+}  // namespace
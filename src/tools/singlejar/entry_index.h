@@ -0,0 +1,168 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_TOOLS_SINGLEJAR_ENTRY_INDEX_H_
+#define BAZEL_SRC_TOOLS_SINGLEJAR_ENTRY_INDEX_H_ 1
+
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * A map from the entry names to the values of type V, which has to be
+ * default constructible and copyable. It is designed for the output jar
+ * which looks up every entry of every input jar: a name is passed as a
+ * pointer and a length, so that it can point directly into the Central
+ * Directory of a memory mapped input jar, and it is copied (to an arena)
+ * only when it is inserted. The lookups and insertions thus do not allocate
+ * anything on the heap except when the table grows.
+ *
+ * The implementation is an open addressing hash table with linear probing.
+ * There is no way to remove a name.
+ */
+template <class V>
+class EntryIndex {
+ public:
+  EntryIndex()
+      : slots_(new Slot[kInitialCapacity]),
+        capacity_(kInitialCapacity),
+        size_(0),
+        arena_free_(0),
+        arena_next_(nullptr) {}
+
+  // Returns the pointer to the value associated with given name, or nullptr
+  // if there is no such name. The pointer remains valid until the next
+  // insertion.
+  V *Find(const char *name, size_t name_length) const {
+    Slot *slot = Lookup(name, name_length, Hash(name, name_length));
+    return slot->name ? &slot->value : nullptr;
+  }
+
+  V *Find(const std::string &name) const {
+    return Find(name.c_str(), name.size());
+  }
+
+  // Associates the value with given name unless the name is already present.
+  // Returns the pointer to the value associated with the name (which remains
+  // valid until the next insertion) and whether the insertion took place.
+  std::pair<V *, bool> Insert(const char *name, size_t name_length,
+                              const V &value) {
+    uint32_t hash = Hash(name, name_length);
+    Slot *slot = Lookup(name, name_length, hash);
+    if (slot->name) {
+      return std::make_pair(&slot->value, false);
+    }
+    if (2 * (size_ + 1) > capacity_) {
+      Grow();
+      slot = Lookup(name, name_length, hash);
+    }
+    slot->name = SaveName(name, name_length);
+    slot->name_length = name_length;
+    slot->hash = hash;
+    slot->value = value;
+    ++size_;
+    return std::make_pair(&slot->value, true);
+  }
+
+  std::pair<V *, bool> Insert(const std::string &name, const V &value) {
+    return Insert(name.c_str(), name.size(), value);
+  }
+
+  // The number of names.
+  size_t size() const { return size_; }
+
+ private:
+  static const size_t kInitialCapacity = 1 << 12;
+  static const size_t kArenaChunkSize = 1 << 20;
+
+  struct Slot {
+    Slot() : name(nullptr), name_length(0), hash(0) {}
+    const char *name;  // nullptr if this slot is free.
+    uint32_t name_length;
+    uint32_t hash;
+    V value;
+  };
+
+  // FNV-1a.
+  static uint32_t Hash(const char *name, size_t name_length) {
+    uint32_t hash = 2166136261U;
+    for (const char *end = name + name_length; name < end; ++name) {
+      hash = (hash ^ static_cast<uint8_t>(*name)) * 16777619U;
+    }
+    return hash;
+  }
+
+  // Returns the slot holding given name or the free slot where it should
+  // be inserted.
+  Slot *Lookup(const char *name, size_t name_length, uint32_t hash) const {
+    size_t mask = capacity_ - 1;
+    for (size_t index = hash & mask;; index = (index + 1) & mask) {
+      Slot *slot = &slots_[index];
+      if (slot->name == nullptr ||
+          (slot->hash == hash && slot->name_length == name_length &&
+           !memcmp(slot->name, name, name_length))) {
+        return slot;
+      }
+    }
+  }
+
+  // Doubles the capacity of the table.
+  void Grow() {
+    std::unique_ptr<Slot[]> old_slots(new Slot[2 * capacity_]);
+    old_slots.swap(slots_);
+    size_t old_capacity = capacity_;
+    capacity_ *= 2;
+    size_t mask = capacity_ - 1;
+    for (size_t i = 0; i < old_capacity; ++i) {
+      Slot &old_slot = old_slots[i];
+      if (old_slot.name == nullptr) {
+        continue;
+      }
+      size_t index = old_slot.hash & mask;
+      while (slots_[index].name != nullptr) {
+        index = (index + 1) & mask;
+      }
+      slots_[index] = old_slot;
+    }
+  }
+
+  // Copies the name to the arena.
+  const char *SaveName(const char *name, size_t name_length) {
+    if (arena_next_ == nullptr || name_length > arena_free_) {
+      size_t chunk_size =
+          name_length > kArenaChunkSize ? name_length : kArenaChunkSize;
+      arena_.emplace_back(new char[chunk_size]);
+      arena_next_ = arena_.back().get();
+      arena_free_ = chunk_size;
+    }
+    char *saved_name = arena_next_;
+    memcpy(saved_name, name, name_length);
+    arena_next_ += name_length;
+    arena_free_ -= name_length;
+    return saved_name;
+  }
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t capacity_;  // Always a power of 2.
+  size_t size_;
+  std::vector<std::unique_ptr<char[]> > arena_;
+  size_t arena_free_;
+  char *arena_next_;
+};
+
+#endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_ENTRY_INDEX_H_
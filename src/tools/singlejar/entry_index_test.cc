@@ -0,0 +1,77 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string>
+
+#include "src/tools/singlejar/entry_index.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(EntryIndexTest, InsertAndFind) {
+  EntryIndex<int> index;
+  EXPECT_EQ(0, index.size());
+  EXPECT_EQ(nullptr, index.Find("foo"));
+
+  auto got = index.Insert("foo", 1);
+  ASSERT_TRUE(got.second);
+  EXPECT_EQ(1, *got.first);
+  got = index.Insert("foo", 2);
+  ASSERT_FALSE(got.second);
+  EXPECT_EQ(1, *got.first);
+  EXPECT_EQ(1, index.size());
+
+  ASSERT_NE(nullptr, index.Find("foo"));
+  EXPECT_EQ(1, *index.Find("foo"));
+  EXPECT_EQ(nullptr, index.Find("fo"));
+  EXPECT_EQ(nullptr, index.Find("foo/"));
+}
+
+// The names are looked up by (pointer, length), and the index keeps its
+// own copy of the inserted name.
+TEST(EntryIndexTest, NamesAreCopied) {
+  EntryIndex<int> index;
+  char buffer[] = "META-INF/MANIFEST.MFxyz";
+  ASSERT_TRUE(index.Insert(buffer, 20, 42).second);
+  EXPECT_FALSE(index.Insert(buffer, 20, 43).second);
+  memset(buffer, 'x', sizeof(buffer) - 1);
+  EXPECT_EQ(nullptr, index.Find(buffer, 20));
+  ASSERT_NE(nullptr, index.Find("META-INF/MANIFEST.MF"));
+  EXPECT_EQ(42, *index.Find("META-INF/MANIFEST.MF"));
+}
+
+// Insert enough names to have the table grow a few times.
+TEST(EntryIndexTest, Grow) {
+  const int kCount = 100000;
+  EntryIndex<int> index;
+  char name[100];
+  for (int i = 0; i < kCount; ++i) {
+    int n = snprintf(name, sizeof(name), "com/google/pkg%d/Class%d.class",
+                     i % 97, i);
+    ASSERT_TRUE(index.Insert(name, n, i).second) << name;
+  }
+  EXPECT_EQ(kCount, index.size());
+  for (int i = 0; i < kCount; ++i) {
+    int n = snprintf(name, sizeof(name), "com/google/pkg%d/Class%d.class",
+                     i % 97, i);
+    int *value = index.Find(name, n);
+    ASSERT_NE(nullptr, value) << name;
+    EXPECT_EQ(i, *value);
+    EXPECT_FALSE(index.Insert(name, n, -1).second) << name;
+  }
+  EXPECT_EQ(kCount, index.size());
+}
+
+}  // namespace
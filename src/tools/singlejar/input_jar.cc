@@ -83,7 +83,7 @@ bool InputJar::Open(const std::string &path) {
       mapped_file_.Close();
       return false;
     }
-    if (mapped_file_.offset(ecd) < cen_position) {
+    if (static_cast<uint64_t>(mapped_file_.offset(ecd)) < cen_position) {
       diag_warnx("%s:%d: %s is corrupt: End of Central Directory at 0x%" PRIx64
                  " precedes Central Directory at 0x%" PRIx64,
                  __FILE__, __LINE__, path.c_str(), mapped_file_.offset(ecd),
@@ -94,7 +94,7 @@ bool InputJar::Open(const std::string &path) {
   }
   uint64_t cen_size = ecd->cen_size32();
   if (cen_size != 0xFFFFFFFF) {
-    if (cen_size > mapped_file_.offset(ecd)) {
+    if (cen_size > static_cast<uint64_t>(mapped_file_.offset(ecd))) {
       diag_warnx("%s:%d: %s is corrupt: Central Directory size 0x%" PRIx64
                  " is too large",
                  __FILE__, __LINE__, path.c_str(), cen_size);
@@ -109,7 +109,9 @@ bool InputJar::Open(const std::string &path) {
   } else {
     auto ecd64loc = reinterpret_cast<const ECD64Locator *>(
         byte_ptr(ecd) - sizeof(ECD64Locator));
-    if (ecd64loc->is()) {
+    if (static_cast<uint64_t>(mapped_file_.offset(ecd)) >=
+            sizeof(ECD64Locator) + sizeof(ECD64) &&
+        ecd64loc->is()) {
       auto ecd64 =
           reinterpret_cast<const ECD64 *>(byte_ptr(ecd64loc) - sizeof(ECD64));
       if (!ecd64->is()) {
@@ -120,6 +122,16 @@ bool InputJar::Open(const std::string &path) {
         mapped_file_.Close();
         return false;
       }
+      uint64_t ecd64_offset = mapped_file_.offset(ecd64);
+      if (ecd64->cen_size() > ecd64_offset ||
+          ecd64->cen_offset() > ecd64_offset - ecd64->cen_size()) {
+        diag_warnx("%s:%d: %s is corrupt: Central Directory size 0x%" PRIx64
+                   " or offset 0x%" PRIx64 " in the ECD64 record is invalid",
+                   __FILE__, __LINE__, path.c_str(), ecd64->cen_size(),
+                   ecd64->cen_offset());
+        mapped_file_.Close();
+        return false;
+      }
       cdh_ = reinterpret_cast<const CDH *>(byte_ptr(ecd64) - ecd64->cen_size());
       preamble_size_ = mapped_file_.offset(cdh_) - ecd64->cen_offset();
       // Find CEN and preamble size.
@@ -143,7 +155,14 @@ bool InputJar::Open(const std::string &path) {
       return false;
     }
   }
+  first_cdh_ = cdh_;
   path_ = path;
+  // The Central Directory is scanned right away, have it read in one go
+  // rather than fault it in page by page. The entries are usually copied in
+  // the order they are stored in.
+  mapped_file_.Advise(mapped_file_.offset(cdh_),
+                      mapped_file_.end() - byte_ptr(cdh_), MADV_WILLNEED);
+  mapped_file_.Advise(0, mapped_file_.offset(cdh_), MADV_SEQUENTIAL);
   return true;
 }
 
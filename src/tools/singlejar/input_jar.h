@@ -70,6 +70,10 @@ class InputJar {
     return current_cdh;
   }
 
+  // Restarts the iteration: the next call to NextEntry() will return
+  // the first Central Directory Header again.
+  void Rewind() { cdh_ = first_cdh_; }
+
   // Closes the file.
   bool Close();
 
@@ -77,6 +81,11 @@ class InputJar {
     return mapped_file_.offset(cdr);
   }
 
+  // The offset of the Central Directory in the file.
+  uint64_t CentralDirectoryOffset() const {
+    return mapped_file_.offset(first_cdh_);
+  }
+
   const LH *LocalHeader(const CDH *cdh) const {
     return reinterpret_cast<const LH *>(
         mapped_file_.address(cdh->local_header_offset() + preamble_size_));
@@ -90,10 +99,25 @@ class InputJar {
     return mapped_file_.address(0);
   }
 
+  size_t mapped_size() const { return mapped_file_.size(); }
+
+  // Have the kernel start reading given range of the file in.
+  void Prefetch(uint64_t offset, size_t count) const {
+    mapped_file_.Advise(offset, count, MADV_WILLNEED);
+  }
+
+  // Tells the kernel given range of the file is no longer needed, so that
+  // its pages do not linger in the process's memory. The range can still
+  // be accessed, it is then read in again.
+  void Release(uint64_t offset, size_t count) const {
+    mapped_file_.Advise(offset, count, MADV_DONTNEED);
+  }
+
  private:
   std::string path_;
   MappedFile mapped_file_;
   const CDH *cdh_;  // current directory entry
+  const CDH *first_cdh_;  // the first directory entry
   uint64_t preamble_size_;  // Bytes before the Zip proper.
 };
 
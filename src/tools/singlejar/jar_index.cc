@@ -0,0 +1,193 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/jar_index.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "src/main/cpp/util/md5.h"
+#include "src/tools/singlejar/diag.h"
+
+const char JarIndex::kSuffix[] = ".sjindex";
+
+static const char kMagic[] = "singlejar-index\x01";
+static const size_t kMagicLength = sizeof(kMagic) - 1;
+static const size_t kDigestLength = 32;
+static const size_t kHeaderSize = kMagicLength + 3 * 8 + kDigestLength;
+static const size_t kEntrySize = 8 + 4 + 8 + 8;
+
+static void Put32(uint32_t value, std::string *out) {
+  value = htole32(value);
+  out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void Put64(uint64_t value, std::string *out) {
+  value = htole64(value);
+  out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static uint32_t Get32(const uint8_t **in) {
+  uint32_t value;
+  memcpy(&value, *in, sizeof(value));
+  *in += sizeof(value);
+  return le32toh(value);
+}
+
+static uint64_t Get64(const uint8_t **in) {
+  uint64_t value;
+  memcpy(&value, *in, sizeof(value));
+  *in += sizeof(value);
+  return le64toh(value);
+}
+
+std::string JarIndex::Digest(const uint8_t *data, size_t size) {
+  blaze_util::Md5Digest md5;
+  // Md5Digest::Update() takes 32-bit length.
+  static const size_t kChunkSize = 1 << 30;
+  for (size_t offset = 0; offset < size; offset += kChunkSize) {
+    md5.Update(data + offset, std::min(kChunkSize, size - offset));
+  }
+  unsigned char buf[blaze_util::Md5Digest::kDigestLength];
+  md5.Finish(buf);
+  return md5.String();
+}
+
+void JarIndex::Build(InputJar *input_jar) {
+  jar_size_ = input_jar->mapped_size();
+  cen_offset_ = input_jar->CentralDirectoryOffset();
+  digest_ = Digest(input_jar->mapped_start(), input_jar->mapped_size());
+  entries_.clear();
+  input_jar->Rewind();
+  const CDH *cdh;
+  const LH *lh;
+  while ((cdh = input_jar->NextEntry(&lh))) {
+    entries_.push_back(
+        Entry{NameHash(cdh->file_name(), cdh->file_name_length()),
+              cdh->crc32(), cdh->uncompressed_file_size(),
+              input_jar->LocalHeaderOffset(lh)});
+  }
+  input_jar->Rewind();
+}
+
+bool JarIndex::Describes(InputJar *input_jar) const {
+  if (jar_size_ != input_jar->mapped_size() ||
+      cen_offset_ != input_jar->CentralDirectoryOffset()) {
+    return false;
+  }
+  // An entry rewritten with the same size has another CRC-32.
+  input_jar->Rewind();
+  const CDH *cdh;
+  const LH *lh;
+  size_t entry_count = 0;
+  bool matches = true;
+  while (matches && (cdh = input_jar->NextEntry(&lh))) {
+    matches = entry_count < entries_.size();
+    if (matches) {
+      const Entry &entry = entries_[entry_count++];
+      matches =
+          entry.name_hash ==
+              NameHash(cdh->file_name(), cdh->file_name_length()) &&
+          entry.crc32 == cdh->crc32() &&
+          entry.size == cdh->uncompressed_file_size() &&
+          entry.local_header_offset == input_jar->LocalHeaderOffset(lh);
+    }
+  }
+  input_jar->Rewind();
+  return matches && entry_count == entries_.size();
+}
+
+bool JarIndex::Read(const std::string &path) {
+  jar_size_ = cen_offset_ = 0;
+  digest_.clear();
+  entries_.clear();
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp == nullptr) {
+    if (errno != ENOENT) {
+      diag_warn("%s:%d: %s", __FILE__, __LINE__, path.c_str());
+    }
+    return false;
+  }
+  std::string contents;
+  char buffer[64 << 10];
+  size_t n_read;
+  while ((n_read = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    contents.append(buffer, n_read);
+  }
+  bool ok = !ferror(fp);
+  fclose(fp);
+
+  const uint8_t *in = reinterpret_cast<const uint8_t *>(contents.data());
+  uint64_t entry_count = 0;
+  if (ok && contents.size() >= kHeaderSize &&
+      !memcmp(in, kMagic, kMagicLength)) {
+    in += kMagicLength;
+    jar_size_ = Get64(&in);
+    cen_offset_ = Get64(&in);
+    entry_count = Get64(&in);
+    digest_.assign(reinterpret_cast<const char *>(in), kDigestLength);
+    in += kDigestLength;
+    ok = entry_count == (contents.size() - kHeaderSize) / kEntrySize &&
+         (contents.size() - kHeaderSize) % kEntrySize == 0;
+  } else {
+    ok = false;
+  }
+  if (!ok) {
+    diag_warnx("%s:%d: %s is not a valid jar index", __FILE__, __LINE__,
+               path.c_str());
+    jar_size_ = cen_offset_ = 0;
+    digest_.clear();
+    return false;
+  }
+  entries_.reserve(entry_count);
+  for (uint64_t i = 0; i < entry_count; ++i) {
+    Entry entry;
+    entry.name_hash = Get64(&in);
+    entry.crc32 = Get32(&in);
+    entry.size = Get64(&in);
+    entry.local_header_offset = Get64(&in);
+    entries_.push_back(entry);
+  }
+  return true;
+}
+
+bool JarIndex::Write(const std::string &path) const {
+  std::string out(kMagic, kMagicLength);
+  Put64(jar_size_, &out);
+  Put64(cen_offset_, &out);
+  Put64(entries_.size(), &out);
+  std::string digest = digest_;
+  digest.resize(kDigestLength, ' ');
+  out += digest;
+  for (auto &entry : entries_) {
+    Put64(entry.name_hash, &out);
+    Put32(entry.crc32, &out);
+    Put64(entry.size, &out);
+    Put64(entry.local_header_offset, &out);
+  }
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (fp == nullptr) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path.c_str());
+    return false;
+  }
+  bool ok = fwrite(out.data(), out.size(), 1, fp) == 1;
+  if (fclose(fp) || !ok) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,98 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_TOOLS_SINGLEJAR_JAR_INDEX_H_
+#define BAZEL_SRC_TOOLS_SINGLEJAR_JAR_INDEX_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/input_jar.h"
+
+/*
+ * The sidecar index of a jar, <JAR>.sjindex, which the producer of the jar
+ * may write next to it (singlejar does with --emit_index), so that the
+ * consumers can learn about the jar without reading all of it.
+ *
+ * The index holds the digest of the jar, its size and the offset of its
+ * Central Directory, and for each entry, in the Central Directory order,
+ * the hash of its name, its CRC-32, uncompressed size and the offset of
+ * its local header. The index is not an output the build system knows
+ * about, so it may be left over from an earlier version of the jar: it is
+ * trusted only if all of that matches the Central Directory of the jar.
+ *
+ * The index is a binary file, all numbers are little-endian:
+ *   "singlejar-index\x01"
+ *   u64 jar size, u64 Central Directory offset, u64 entry count
+ *   32-character hex digest
+ *   u64 name hash, u32 CRC-32, u64 size, u64 local header offset
+ *   ...
+ */
+class JarIndex {
+ public:
+  struct Entry {
+    uint64_t name_hash;
+    uint32_t crc32;
+    uint64_t size;
+    uint64_t local_header_offset;
+  };
+
+  // The suffix appended to the jar path to get the index path.
+  static const char kSuffix[];
+
+  JarIndex() : jar_size_(0), cen_offset_(0) {}
+
+  // Indexes the given open jar.
+  void Build(InputJar *input_jar);
+
+  // Reads the index from the file. Returns false if it does not exist or
+  // cannot be read, and warns in the latter case.
+  bool Read(const std::string &path);
+
+  // Writes the index to the file, returns false on error.
+  bool Write(const std::string &path) const;
+
+  // Returns true if the index matches the size, the Central Directory offset
+  // and the Central Directory entries of the given open jar. Only reads the
+  // Central Directory, and rewinds the jar.
+  bool Describes(InputJar *input_jar) const;
+
+  // The digest of the jar.
+  const std::string &digest() const { return digest_; }
+
+  const std::vector<Entry> &entries() const { return entries_; }
+
+  // Returns the digest of the given bytes.
+  static std::string Digest(const uint8_t *data, size_t size);
+
+  // Returns the hash of the entry name (64-bit FNV-1a).
+  static uint64_t NameHash(const char *name, size_t name_length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *end = name + name_length; name < end; ++name) {
+      hash = (hash ^ static_cast<uint8_t>(*name)) * 1099511628211ULL;
+    }
+    return hash;
+  }
+
+ private:
+  uint64_t jar_size_;
+  uint64_t cen_offset_;
+  std::string digest_;
+  std::vector<Entry> entries_;
+};
+
+#endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_JAR_INDEX_H_
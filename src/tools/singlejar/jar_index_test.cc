@@ -0,0 +1,121 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include "src/tools/singlejar/input_jar.h"
+#include "src/tools/singlejar/jar_index.h"
+#include "src/tools/singlejar/test_util.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using singlejar_test_util::CreateTextFile;
+using singlejar_test_util::OutputFilePath;
+using singlejar_test_util::RunCommand;
+
+using std::string;
+
+// Creates a zip with two entries, returns its path.
+static string CreateZip(const string &name, const char *contents) {
+  string out_dir = OutputFilePath("");
+  string zip_path = OutputFilePath(name);
+  unlink(zip_path.c_str());
+  CreateTextFile("indexed/a.txt", contents);
+  CreateTextFile("indexed/b.txt", "b\n");
+  EXPECT_EQ(0, RunCommand("cd", out_dir.c_str(), ";", "zip", "-mr",
+                          name.c_str(), "indexed", nullptr));
+  return zip_path;
+}
+
+// Written index is read back and describes the jar it has been built for.
+TEST(JarIndexTest, BuildWriteRead) {
+  string zip_path = CreateZip("indexed.zip", "aaaa\n");
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(zip_path));
+  JarIndex index;
+  index.Build(&input_jar);
+  EXPECT_EQ(JarIndex::Digest(input_jar.mapped_start(), input_jar.mapped_size()),
+            index.digest());
+  EXPECT_EQ(32, index.digest().size());
+  ASSERT_EQ(3, index.entries().size());
+  ASSERT_TRUE(index.Write(zip_path + JarIndex::kSuffix));
+
+  JarIndex read_index;
+  ASSERT_TRUE(read_index.Read(zip_path + JarIndex::kSuffix));
+  EXPECT_TRUE(read_index.Describes(&input_jar));
+  EXPECT_EQ(index.digest(), read_index.digest());
+  ASSERT_EQ(3, read_index.entries().size());
+
+  // The entries follow the Central Directory.
+  const LH *lh;
+  const CDH *cdh;
+  for (auto &entry : read_index.entries()) {
+    ASSERT_NE(nullptr, cdh = input_jar.NextEntry(&lh));
+    EXPECT_EQ(JarIndex::NameHash(cdh->file_name(), cdh->file_name_length()),
+              entry.name_hash);
+    EXPECT_EQ(cdh->crc32(), entry.crc32);
+    EXPECT_EQ(cdh->uncompressed_file_size(), entry.size);
+    EXPECT_EQ(input_jar.LocalHeaderOffset(lh), entry.local_header_offset);
+  }
+  EXPECT_EQ(nullptr, input_jar.NextEntry(&lh));
+}
+
+// The index of another jar does not describe this one.
+TEST(JarIndexTest, Stale) {
+  string zip_path = CreateZip("stale.zip", "aaaa\n");
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(zip_path));
+  JarIndex index;
+  index.Build(&input_jar);
+  input_jar.Close();
+  ASSERT_TRUE(input_jar.Open(CreateZip("stale.zip", "aaaaaaaa\n")));
+  EXPECT_FALSE(index.Describes(&input_jar));
+}
+
+// The index of a jar of the same size whose entry has other contents of the
+// same size does not describe it either.
+TEST(JarIndexTest, StaleSameSize) {
+  string zip_path = CreateZip("same_size.zip", "aaaa\n");
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(zip_path));
+  JarIndex index;
+  index.Build(&input_jar);
+  ASSERT_TRUE(index.Write(zip_path + JarIndex::kSuffix));
+  uint64_t jar_size = input_jar.mapped_size();
+  uint64_t cen_offset = input_jar.CentralDirectoryOffset();
+  input_jar.Close();
+
+  ASSERT_TRUE(input_jar.Open(CreateZip("same_size.zip", "bbbb\n")));
+  ASSERT_EQ(jar_size, input_jar.mapped_size());
+  ASSERT_EQ(cen_offset, input_jar.CentralDirectoryOffset());
+  JarIndex stale_index;
+  ASSERT_TRUE(stale_index.Read(zip_path + JarIndex::kSuffix));
+  EXPECT_FALSE(stale_index.Describes(&input_jar));
+  EXPECT_NE(stale_index.digest(), JarIndex::Digest(input_jar.mapped_start(),
+                                                   input_jar.mapped_size()));
+}
+
+// Malformed index is rejected.
+TEST(JarIndexTest, BadIndex) {
+  JarIndex index;
+  EXPECT_FALSE(index.Read(OutputFilePath("no_such_index")));
+  EXPECT_FALSE(index.Read(CreateTextFile("bad_header", "index 1\n")));
+  string truncated(CreateTextFile("truncated", "singlejar-index\x01"));
+  EXPECT_FALSE(index.Read(truncated));
+  EXPECT_TRUE(index.entries().empty());
+}
+
+}  // namespace
@@ -0,0 +1,506 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/jar_verify.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "src/main/cpp/util/strings.h"
+#include "src/tools/singlejar/crc32.h"
+#include "src/tools/singlejar/input_jar.h"
+#include "src/tools/singlejar/zip_headers.h"
+#include "src/tools/singlejar/zlib_interface.h"
+
+using blaze_util::AppendJsonString;
+
+void JarVerifyResult::AddError(const char *format, ...) {
+  if (++error_count > kMaxErrors) {
+    return;
+  }
+  char buffer[1024];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  errors.push_back(buffer);
+}
+
+namespace {
+
+// Returns the Zip64 extra field among the given extra fields if it holds
+// at least the given number of values, or nullptr.
+const Zip64ExtraField *FindZip64ExtraField(const uint8_t *start,
+                                           const uint8_t *end, int values) {
+  const Zip64ExtraField *z64 = Zip64ExtraField::find(start, end);
+  if (z64 == nullptr || z64->payload_size() < 8 * values ||
+      end - byte_ptr(z64) < z64->size()) {
+    return nullptr;
+  }
+  return z64;
+}
+
+// The pages of the jar that have been checked are released every this many
+// bytes, so that checking large jars does not fill the memory.
+const uint64_t kReleaseInterval = 64 << 20;
+
+// The buffer the entries are inflated to.
+const uint32_t kInflateBufferSize = 256 << 10;
+
+class JarVerifier {
+ public:
+  JarVerifier(const InputJar &jar, JarVerifyResult *result)
+      : jar_(jar),
+        result_(result),
+        start_(jar.mapped_start()),
+        end_(jar.mapped_start() + jar.mapped_size()),
+        cen_offset_(jar.CentralDirectoryOffset()),
+        preamble_size_(0),
+        released_(0) {}
+
+  void Verify() {
+    std::vector<const CDH *> entries;
+    const uint8_t *cen_end = ScanCentralDirectory(&entries);
+    if (cen_end == nullptr || !VerifyEndRecords(cen_end, entries.size())) {
+      return;
+    }
+    result_->entries = entries.size();
+    buffer_.reset(new uint8_t[kInflateBufferSize]);
+    for (const CDH *cdh : entries) {
+      VerifyEntry(cdh);
+    }
+  }
+
+ private:
+  // Collects the Central Directory entries, and returns the end of the last
+  // one, or nullptr if it does not fit in the file.
+  const uint8_t *ScanCentralDirectory(std::vector<const CDH *> *entries) {
+    const uint8_t *p = start_ + cen_offset_;
+    while (static_cast<size_t>(end_ - p) >= sizeof(CDH) &&
+           reinterpret_cast<const CDH *>(p)->is()) {
+      const CDH *cdh = reinterpret_cast<const CDH *>(p);
+      if (static_cast<size_t>(end_ - p) < cdh->size()) {
+        result_->AddError("Central Directory entry at 0x%" PRIx64
+                          " extends past the end of the file",
+                          Offset(p));
+        return nullptr;
+      }
+      entries->push_back(cdh);
+      p += cdh->size();
+    }
+    return p;
+  }
+
+  // Checks the End of Central Directory records following the Central
+  // Directory against it, and finds the size of the preamble.
+  bool VerifyEndRecords(const uint8_t *cen_end, uint64_t entry_count) {
+    const ECD64 *ecd64 = nullptr;
+    const ECD64Locator *ecd64_locator = nullptr;
+    const uint8_t *p = cen_end;
+    if (static_cast<size_t>(end_ - p) >= sizeof(ECD64) &&
+        reinterpret_cast<const ECD64 *>(p)->is()) {
+      ecd64 = reinterpret_cast<const ECD64 *>(p);
+      // The record size does not count the first 12 bytes.
+      uint64_t ecd64_size = ecd64->remaining_size() + 12;
+      if (ecd64_size < sizeof(ECD64) ||
+          static_cast<uint64_t>(end_ - p) - sizeof(ECD64Locator) <
+              ecd64_size) {
+        result_->AddError("Zip64 End of Central Directory at 0x%" PRIx64
+                          " has invalid size 0x%" PRIx64,
+                          Offset(p), ecd64_size);
+        return false;
+      }
+      p += ecd64_size;
+      ecd64_locator = reinterpret_cast<const ECD64Locator *>(p);
+      if (!ecd64_locator->is()) {
+        result_->AddError("Expected Zip64 End of Central Directory locator "
+                          "at 0x%" PRIx64, Offset(p));
+        return false;
+      }
+      p += sizeof(ECD64Locator);
+    }
+    const ECD *ecd = reinterpret_cast<const ECD *>(p);
+    if (static_cast<size_t>(end_ - p) < sizeof(ECD) || !ecd->is()) {
+      result_->AddError("Expected End of Central Directory at 0x%" PRIx64,
+                        Offset(p));
+      return false;
+    }
+    if (static_cast<size_t>(end_ - p) != sizeof(ECD) + ecd->comment_length()) {
+      result_->AddError("End of Central Directory at 0x%" PRIx64
+                        " is followed by 0x%" PRIx64 " bytes, expected 0x%x",
+                        Offset(p),
+                        static_cast<uint64_t>(end_ - p - sizeof(ECD)),
+                        ecd->comment_length());
+    }
+    if (ecd->this_disk_nr() != 0 || ecd->cen_disk_nr() != 0 ||
+        (ecd64 != nullptr &&
+         (ecd64->this_disk_nr() != 0 || ecd64->cen_disk_nr() != 0 ||
+          ecd64_locator->ecd64_disk_nr() != 0))) {
+      result_->AddError("Multi-disk archives are not supported");
+      return false;
+    }
+
+    uint64_t cen_size = cen_end - (start_ + cen_offset_);
+    uint64_t stated_cen_offset;
+    if (ecd64 == nullptr) {
+      if (ecd->total_entries16() != entry_count ||
+          ecd->this_disk_entries16() != entry_count) {
+        result_->AddError("End of Central Directory lists %u entries, the "
+                          "Central Directory has %" PRIu64,
+                          ecd->total_entries16(), entry_count);
+      }
+      if (ecd->cen_size32() != cen_size) {
+        result_->AddError("End of Central Directory gives Central Directory "
+                          "size 0x%x, it is 0x%" PRIx64,
+                          ecd->cen_size32(), cen_size);
+      }
+      stated_cen_offset = ecd->cen_offset32();
+    } else {
+      if (ecd64->total_entries() != entry_count ||
+          ecd64->this_disk_entries() != entry_count ||
+          (ecd->total_entries16() != 0xFFFF &&
+           ecd->total_entries16() != entry_count)) {
+        result_->AddError("End of Central Directory records list %" PRIu64
+                          " (Zip64) and %u entries, the Central Directory "
+                          "has %" PRIu64,
+                          ecd64->total_entries(), ecd->total_entries16(),
+                          entry_count);
+      }
+      if (ecd64->cen_size() != cen_size ||
+          (ecd->cen_size32() != 0xFFFFFFFF &&
+           ecd->cen_size32() != cen_size)) {
+        result_->AddError("End of Central Directory records give Central "
+                          "Directory sizes 0x%" PRIx64 " (Zip64) and 0x%x, "
+                          "it is 0x%" PRIx64,
+                          ecd64->cen_size(), ecd->cen_size32(), cen_size);
+      }
+      stated_cen_offset = ecd64->cen_offset();
+      if (ecd->cen_offset32() != 0xFFFFFFFF &&
+          ecd->cen_offset32() != stated_cen_offset) {
+        result_->AddError("End of Central Directory records give Central "
+                          "Directory offsets 0x%" PRIx64 " (Zip64) and 0x%x",
+                          stated_cen_offset, ecd->cen_offset32());
+      }
+    }
+    if (stated_cen_offset > cen_offset_) {
+      result_->AddError("Central Directory is at 0x%" PRIx64
+                        ", not at 0x%" PRIx64,
+                        cen_offset_, stated_cen_offset);
+      return false;
+    }
+    // Any data before the first entry shifts all the offsets.
+    preamble_size_ = cen_offset_ - stated_cen_offset;
+    if (ecd64 != nullptr &&
+        ecd64_locator->ecd64_offset() + preamble_size_ != Offset(ecd64)) {
+      result_->AddError("Zip64 End of Central Directory locator points to "
+                        "0x%" PRIx64 ", the record is at 0x%" PRIx64,
+                        ecd64_locator->ecd64_offset() + preamble_size_,
+                        Offset(ecd64));
+    }
+    return true;
+  }
+
+  void VerifyEntry(const CDH *cdh) {
+    std::string name = cdh->file_name_string();
+    const char *entry = name.c_str();
+    const uint8_t *extra_fields = cdh->extra_fields();
+    const uint8_t *extra_fields_end =
+        extra_fields + cdh->extra_fields_length();
+    int zip64_values = (cdh->uncompressed_file_size32() == 0xFFFFFFFF) +
+                       (cdh->compressed_file_size32() == 0xFFFFFFFF) +
+                       (cdh->local_header_offset32() == 0xFFFFFFFF);
+    if (zip64_values > 0 &&
+        FindZip64ExtraField(extra_fields, extra_fields_end, zip64_values) ==
+            nullptr) {
+      result_->AddError("%s: Zip64 extra field missing or shorter than %d "
+                        "values", entry, zip64_values);
+      return;
+    }
+    if (cdh->bit_flag() & 0x01) {
+      result_->AddError("%s: encrypted, cannot be checked", entry);
+      return;
+    }
+    if (cdh->compression_method() != Z_NO_COMPRESSION &&
+        cdh->compression_method() != Z_DEFLATED) {
+      result_->AddError("%s: unsupported compression method %u", entry,
+                        cdh->compression_method());
+      return;
+    }
+
+    // The local header, and the data after it, must precede the Central
+    // Directory.
+    uint64_t lh_offset = cdh->local_header_offset() + preamble_size_;
+    if (lh_offset > cen_offset_ || cen_offset_ - lh_offset < sizeof(LH)) {
+      result_->AddError("%s: local header offset 0x%" PRIx64
+                        " is past the entries", entry, lh_offset);
+      return;
+    }
+    const LH *lh = reinterpret_cast<const LH *>(start_ + lh_offset);
+    if (!lh->is()) {
+      result_->AddError("%s: no local header at 0x%" PRIx64, entry, lh_offset);
+      return;
+    }
+    if (cen_offset_ - lh_offset < lh->size()) {
+      result_->AddError("%s: local header at 0x%" PRIx64
+                        " overlaps the Central Directory", entry, lh_offset);
+      return;
+    }
+    if (lh->file_name_length() != cdh->file_name_length() ||
+        memcmp(lh->file_name(), cdh->file_name(), cdh->file_name_length())) {
+      result_->AddError("%s: local header at 0x%" PRIx64 " is for %s", entry,
+                        lh_offset, lh->file_name_string().c_str());
+      return;
+    }
+    if (lh->compression_method() != cdh->compression_method()) {
+      result_->AddError("%s: compression method is %u in the local header, "
+                        "%u in the Central Directory", entry,
+                        lh->compression_method(), cdh->compression_method());
+      return;
+    }
+
+    uint64_t compressed_size = cdh->compressed_file_size();
+    uint64_t uncompressed_size = cdh->uncompressed_file_size();
+    uint64_t data_offset = lh_offset + lh->size();
+    if (cen_offset_ - data_offset < compressed_size) {
+      result_->AddError("%s: 0x%" PRIx64 " bytes of data at 0x%" PRIx64
+                        " overlap the Central Directory",
+                        entry, compressed_size, data_offset);
+      return;
+    }
+    if (cdh->no_size_in_local_header()) {
+      VerifyDataDescriptor(cdh, data_offset + compressed_size);
+    } else {
+      bool lh_zip64 = lh->compressed_file_size32() == 0xFFFFFFFF ||
+                      lh->uncompressed_file_size32() == 0xFFFFFFFF;
+      if (lh_zip64 &&
+          FindZip64ExtraField(lh->extra_fields(),
+                              lh->extra_fields() + lh->extra_fields_length(),
+                              2) == nullptr) {
+        result_->AddError("%s: local header Zip64 extra field missing or "
+                          "shorter than 2 values", entry);
+        return;
+      }
+      if (lh->crc32() != cdh->crc32() ||
+          lh->compressed_file_size() != compressed_size ||
+          lh->uncompressed_file_size() != uncompressed_size) {
+        result_->AddError("%s: local header has CRC-32 %08x and sizes 0x%" PRIx64
+                          "/0x%" PRIx64 ", the Central Directory %08x and "
+                          "0x%" PRIx64 "/0x%" PRIx64,
+                          entry, lh->crc32(),
+                          static_cast<uint64_t>(lh->compressed_file_size()),
+                          static_cast<uint64_t>(lh->uncompressed_file_size()),
+                          cdh->crc32(), compressed_size, uncompressed_size);
+      }
+    }
+
+    const uint8_t *data = start_ + data_offset;
+    uint32_t checksum = 0;
+    if (cdh->compression_method() == Z_NO_COMPRESSION) {
+      if (compressed_size != uncompressed_size) {
+        result_->AddError("%s: stored with sizes 0x%" PRIx64 "/0x%" PRIx64,
+                          entry, compressed_size, uncompressed_size);
+        return;
+      }
+      checksum = Crc32(0, data, uncompressed_size);
+    } else if (!Inflate(entry, data, compressed_size, uncompressed_size,
+                        &checksum)) {
+      return;
+    }
+    if (checksum != cdh->crc32()) {
+      result_->AddError("%s: CRC-32 is %08x, expected %08x", entry, checksum,
+                        cdh->crc32());
+    }
+    result_->bytes += uncompressed_size;
+
+    uint64_t checked = data_offset + compressed_size;
+    if (checked - std::min(checked, released_) >= kReleaseInterval) {
+      jar_.Release(released_, checked - released_);
+      released_ = checked;
+    }
+  }
+
+  // Checks the CRC-32 and the sizes in the data descriptor at the given
+  // offset against the Central Directory entry.
+  void VerifyDataDescriptor(const CDH *cdh, uint64_t offset) {
+    bool compressed_size_is_64bits = cdh->compressed_file_size32() == 0xFFFFFFFF;
+    bool original_size_is_64bits = cdh->uncompressed_file_size32() == 0xFFFFFFFF;
+    const DDR *ddr = reinterpret_cast<const DDR *>(start_ + offset);
+    if (cen_offset_ - offset < sizeof(uint32_t) ||
+        cen_offset_ - offset <
+            ddr->size(compressed_size_is_64bits, original_size_is_64bits)) {
+      result_->AddError("%s: data descriptor at 0x%" PRIx64
+                        " overlaps the Central Directory",
+                        cdh->file_name_string().c_str(), offset);
+      return;
+    }
+    const uint8_t *p = start_ + offset;
+    if (ReadLE32(p) == 0x08074b50) {
+      p += 4;
+    }
+    uint32_t crc32 = ReadLE32(p);
+    p += 4;
+    uint64_t compressed_size =
+        compressed_size_is_64bits ? ReadLE64(p) : ReadLE32(p);
+    p += compressed_size_is_64bits ? 8 : 4;
+    uint64_t uncompressed_size =
+        original_size_is_64bits ? ReadLE64(p) : ReadLE32(p);
+    if (crc32 != cdh->crc32() ||
+        compressed_size != cdh->compressed_file_size() ||
+        uncompressed_size != cdh->uncompressed_file_size()) {
+      result_->AddError("%s: data descriptor has CRC-32 %08x and sizes 0x%" PRIx64
+                        "/0x%" PRIx64 ", the Central Directory %08x and "
+                        "0x%" PRIx64 "/0x%" PRIx64,
+                        cdh->file_name_string().c_str(), crc32,
+                        compressed_size, uncompressed_size, cdh->crc32(),
+                        static_cast<uint64_t>(cdh->compressed_file_size()),
+                        static_cast<uint64_t>(cdh->uncompressed_file_size()));
+    }
+  }
+
+  // Inflates the entry data a buffer at a time, and computes its CRC-32.
+  // Returns false, having recorded why, if it does not inflate to the given
+  // size.
+  bool Inflate(const char *entry, const uint8_t *data, uint64_t in_size,
+               uint64_t out_size, uint32_t *checksum) {
+    // A single region to inflate cannot exceed 4GB-1.
+    static const uint32_t kChunkSize = 1 << 30;
+    ZStreamPool<Inflater>::Ptr inflater = ZStreamPool<Inflater>::Acquire();
+    uint32_t crc = 0;
+    int ret;
+    do {
+      if (inflater->available_in() == 0 && in_size > 0) {
+        uint32_t chunk_size = std::min<uint64_t>(in_size, kChunkSize);
+        inflater->DataToInflate(data, chunk_size);
+        data += chunk_size;
+        in_size -= chunk_size;
+      }
+      ret = inflater->Inflate(buffer_.get(), kInflateBufferSize);
+      if (ret != Z_OK && ret != Z_STREAM_END) {
+        result_->AddError("%s: does not inflate: %s", entry,
+                          ret == Z_BUF_ERROR ? "truncated data"
+                          : inflater->error_message() != nullptr
+                              ? inflater->error_message()
+                              : "zlib error");
+        return false;
+      }
+      crc = Crc32(crc, buffer_.get(),
+                  kInflateBufferSize - inflater->available_out());
+      if (inflater->total_out() > out_size) {
+        break;
+      }
+    } while (ret != Z_STREAM_END);
+    if (inflater->total_out() != out_size) {
+      result_->AddError("%s: inflates to %s0x%" PRIx64 " bytes, expected 0x%"
+                        PRIx64, entry, ret == Z_STREAM_END ? "" : "over ",
+                        inflater->total_out(), out_size);
+      return false;
+    }
+    *checksum = crc;
+    return true;
+  }
+
+  static uint32_t ReadLE32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return le32toh(value);
+  }
+
+  static uint64_t ReadLE64(const uint8_t *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return le64toh(value);
+  }
+
+  uint64_t Offset(const void *p) const { return byte_ptr(p) - start_; }
+
+  const InputJar &jar_;
+  JarVerifyResult *result_;
+  const uint8_t *start_;
+  const uint8_t *end_;
+  uint64_t cen_offset_;
+  uint64_t preamble_size_;
+  uint64_t released_;  // The pages before this offset have been released.
+  std::unique_ptr<uint8_t[]> buffer_;
+};
+
+}  // namespace
+
+void VerifyJar(const std::string &path, JarVerifyResult *result) {
+  result->path = path;
+  InputJar jar;
+  if (!jar.Open(path)) {
+    result->AddError("Cannot open it or locate its Central Directory");
+    return;
+  }
+  JarVerifier(jar, result).Verify();
+}
+
+std::vector<JarVerifyResult> VerifyJars(const std::vector<std::string> &paths,
+                                        int thread_count) {
+  std::vector<JarVerifyResult> results(paths.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&paths, &results, &next]() {
+    size_t index;
+    while ((index = next++) < paths.size()) {
+      VerifyJar(paths[index], &results[index]);
+    }
+  };
+  std::vector<std::thread> threads;
+  size_t thread_limit = std::min<size_t>(std::max(thread_count, 1),
+                                         paths.size());
+  for (size_t i = 1; i < thread_limit; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return results;
+}
+
+void WriteJarVerifyReport(FILE *fp, const std::vector<JarVerifyResult> &results,
+                          double wall_time_ms) {
+  size_t failed = std::count_if(
+      results.begin(), results.end(),
+      [](const JarVerifyResult &result) { return !result.ok(); });
+  fprintf(fp, "{\n  \"jars_checked\": %zu,\n", results.size());
+  fprintf(fp, "  \"jars_failed\": %zu,\n", failed);
+  fprintf(fp, "  \"wall_time_ms\": %.3f,\n", wall_time_ms);
+  fprintf(fp, "  \"jars\": [");
+  std::string literal;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const JarVerifyResult &result = results[i];
+    literal.clear();
+    AppendJsonString(&literal, result.path);
+    fprintf(fp, "%s\n    {\"path\": %s", i ? "," : "", literal.c_str());
+    fprintf(fp,
+            ", \"ok\": %s, \"entries\": %" PRIu64 ", \"bytes\": %" PRIu64
+            ", \"error_count\": %" PRIu64 ", \"errors\": [",
+            result.ok() ? "true" : "false", result.entries, result.bytes,
+            result.error_count);
+    for (size_t j = 0; j < result.errors.size(); ++j) {
+      literal.clear();
+      AppendJsonString(&literal, result.errors[j]);
+      fprintf(fp, "%s%s", j ? ", " : "", literal.c_str());
+    }
+    fprintf(fp, "]}");
+  }
+  fprintf(fp, "%s]\n}\n", results.empty() ? "" : "\n  ");
+}
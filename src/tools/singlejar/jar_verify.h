@@ -0,0 +1,72 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_TOOLS_SINGLEJAR_JAR_VERIFY_H_
+#define BAZEL_SRC_TOOLS_SINGLEJAR_JAR_VERIFY_H_ 1
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * The result of checking a jar:
+ *  - the End of Central Directory records, the Zip64 ones included, agree
+ *    with each other and with the Central Directory they describe;
+ *  - each Central Directory entry lies within the file, with well-formed
+ *    extra fields, and has the Zip64 fields its 32-bit fields call for;
+ *  - the local header of each entry is where the entry says, and agrees with
+ *    it on the name, the compression method, the CRC-32 and the sizes (or
+ *    the data descriptor does);
+ *  - the data of each entry lies before the Central Directory, inflates to
+ *    the recorded size and has the recorded CRC-32.
+ */
+struct JarVerifyResult {
+  // The most errors recorded for a jar; the rest are only counted.
+  static const int kMaxErrors = 20;
+
+  std::string path;
+  uint64_t entries = 0;  // Entries in the Central Directory.
+  uint64_t bytes = 0;    // Uncompressed bytes checked.
+  uint64_t error_count = 0;
+  std::vector<std::string> errors;
+
+  bool ok() const { return error_count == 0; }
+  void AddError(const char *format, ...)
+      __attribute__((format(printf, 2, 3)));
+};
+
+// Checks the jar at the given path. Unlike InputJar::NextEntry(), does not
+// exit on a malformed jar, but records what is wrong with it.
+void VerifyJar(const std::string &path, JarVerifyResult *result);
+
+// Checks the jars on the given number of threads. The results are in the
+// order of the jars.
+std::vector<JarVerifyResult> VerifyJars(const std::vector<std::string> &paths,
+                                        int thread_count);
+
+// Writes the results as a JSON report:
+//   {
+//     "jars_checked": <N>,
+//     "jars_failed": <N>,
+//     "wall_time_ms": <MS>,
+//     "jars": [{"path": "<PATH>", "ok": <BOOL>, "entries": <N>,
+//               "bytes": <N>, "error_count": <N>,
+//               "errors": ["<ERROR>", ...]}, ...]
+//   }
+void WriteJarVerifyReport(FILE *fp, const std::vector<JarVerifyResult> &results,
+                          double wall_time_ms);
+
+#endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_JAR_VERIFY_H_
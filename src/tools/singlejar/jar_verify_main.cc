@@ -0,0 +1,73 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks the structure and the CRC-32 of every entry of the given jars, and
+// writes a JSON report (see jar_verify.h). Usage:
+//   jar_verify [--jobs N] [--report FILE] JAR... [@PARAMS_FILE]
+// Exits with 0 if all the jars are fine, with 1 if any is not.
+
+#include <stdio.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/tools/singlejar/diag.h"
+#include "src/tools/singlejar/jar_verify.h"
+#include "src/tools/singlejar/token_stream.h"
+
+int main(int argc, char *argv[]) {
+  int jobs = std::thread::hardware_concurrency();
+  std::string report_path;
+  std::vector<std::string> jars;
+  ArgTokenStream tokens(argc - 1, argv + 1);
+  while (!tokens.AtEnd()) {
+    if (tokens.MatchAndSet("--jobs", &jobs) ||
+        tokens.MatchAndSet("--report", &report_path)) {
+      continue;
+    }
+    if (tokens.token().compare(0, 2, "--") == 0) {
+      diag_errx(1, "Bad command line argument %s", tokens.token().c_str());
+    }
+    jars.push_back(tokens.token());
+    tokens.next();
+  }
+  if (jars.empty()) {
+    diag_errx(1, "Usage: %s [--jobs N] [--report FILE] JAR...", argv[0]);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<JarVerifyResult> results =
+      VerifyJars(jars, jobs > 0 ? jobs : 1);
+  double wall_time_ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+
+  FILE *fp = stdout;
+  if (!report_path.empty() &&
+      (fp = fopen(report_path.c_str(), "w")) == nullptr) {
+    diag_err(1, "%s", report_path.c_str());
+  }
+  WriteJarVerifyReport(fp, results, wall_time_ms);
+  if (fp != stdout ? fclose(fp) : fflush(fp)) {
+    diag_err(1, "%s", report_path.empty() ? "stdout" : report_path.c_str());
+  }
+  for (const JarVerifyResult &result : results) {
+    if (!result.ok()) {
+      return 1;
+    }
+  }
+  return 0;
+}
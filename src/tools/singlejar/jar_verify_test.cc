@@ -0,0 +1,157 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/jar_verify.h"
+#include "src/tools/singlejar/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using singlejar_test_util::AllocateFile;
+using singlejar_test_util::CreateTextFile;
+using singlejar_test_util::OutputFilePath;
+using singlejar_test_util::RunCommand;
+
+using std::string;
+
+const char kContents[] =
+    "The quick brown fox jumps over the lazy dog. "
+    "The quick brown fox jumps over the lazy dog. "
+    "The quick brown fox jumps over the lazy dog.\n";
+
+class JarVerifyTest : public ::testing::Test {
+ protected:
+  // Creates a jar with two entries, stored if `compress` is false.
+  string CreateJar(const char *name, bool compress) {
+    string jar_path = OutputFilePath(name);
+    unlink(jar_path.c_str());
+    CreateTextFile("jar_verify/a.txt", kContents);
+    CreateTextFile("jar_verify/b.txt", "b\n");
+    string command = "cd " + OutputFilePath("jar_verify") + " && zip -q " +
+                     (compress ? "-9" : "-0") + " " + jar_path;
+    EXPECT_EQ(0, RunCommand(command.c_str(), "a.txt", "b.txt", nullptr));
+    return jar_path;
+  }
+
+  // Flips a bit of the byte at the given offset from the first occurrence of
+  // `what` in the file, or at the given offset if `what` is empty.
+  void Corrupt(const string &path, const string &what, long offset) {
+    FILE *fp = fopen(path.c_str(), "r+b");
+    ASSERT_NE(nullptr, fp);
+    string contents;
+    char buffer[4096];
+    size_t n_read;
+    while ((n_read = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+      contents.append(buffer, n_read);
+    }
+    size_t pos = what.empty() ? 0 : contents.find(what);
+    ASSERT_NE(string::npos, pos);
+    pos += offset;
+    ASSERT_LT(pos, contents.size());
+    ASSERT_EQ(0, fseek(fp, pos, SEEK_SET));
+    fputc(contents[pos] ^ 1, fp);
+    ASSERT_EQ(0, fclose(fp));
+  }
+};
+
+TEST_F(JarVerifyTest, StoredJar) {
+  string jar_path = CreateJar("stored.jar", false);
+  JarVerifyResult result;
+  VerifyJar(jar_path, &result);
+  EXPECT_TRUE(result.ok()) << (result.errors.empty() ? "" : result.errors[0]);
+  EXPECT_EQ(jar_path, result.path);
+  EXPECT_EQ(2, result.entries);
+  EXPECT_EQ(sizeof(kContents) - 1 + 2, result.bytes);
+}
+
+TEST_F(JarVerifyTest, DeflatedJar) {
+  string jar_path = CreateJar("deflated.jar", true);
+  JarVerifyResult result;
+  VerifyJar(jar_path, &result);
+  EXPECT_TRUE(result.ok()) << (result.errors.empty() ? "" : result.errors[0]);
+  EXPECT_EQ(2, result.entries);
+  EXPECT_EQ(sizeof(kContents) - 1 + 2, result.bytes);
+}
+
+TEST_F(JarVerifyTest, CorruptStoredData) {
+  string jar_path = CreateJar("corrupt_stored.jar", false);
+  Corrupt(jar_path, "lazy dog", 0);
+  JarVerifyResult result;
+  VerifyJar(jar_path, &result);
+  EXPECT_FALSE(result.ok());
+  EXPECT_EQ(1, result.error_count);
+  ASSERT_EQ(1, result.errors.size());
+  EXPECT_NE(string::npos, result.errors[0].find("a.txt: CRC-32"))
+      << result.errors[0];
+}
+
+TEST_F(JarVerifyTest, CorruptLocalHeader) {
+  string jar_path = CreateJar("corrupt_header.jar", false);
+  // The first local header is at the start of the file; its CRC-32 is at 14.
+  Corrupt(jar_path, "", 14);
+  JarVerifyResult result;
+  VerifyJar(jar_path, &result);
+  EXPECT_FALSE(result.ok());
+  ASSERT_EQ(1, result.errors.size());
+  EXPECT_NE(string::npos, result.errors[0].find("a.txt: local header"))
+      << result.errors[0];
+}
+
+TEST_F(JarVerifyTest, NotAJar) {
+  string path = OutputFilePath("not_a.jar");
+  ASSERT_TRUE(AllocateFile(path, 1000));
+  JarVerifyResult result;
+  VerifyJar(path, &result);
+  EXPECT_FALSE(result.ok());
+  EXPECT_EQ(0, result.entries);
+}
+
+TEST_F(JarVerifyTest, VerifyJarsAndReport) {
+  std::vector<string> paths = {CreateJar("good1.jar", true),
+                               OutputFilePath("missing.jar"),
+                               CreateJar("good2.jar", false)};
+  std::vector<JarVerifyResult> results = VerifyJars(paths, 4);
+  ASSERT_EQ(3, results.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    EXPECT_EQ(paths[i], results[i].path);
+  }
+  EXPECT_TRUE(results[0].ok());
+  EXPECT_FALSE(results[1].ok());
+  EXPECT_TRUE(results[2].ok());
+
+  string report_path = OutputFilePath("report.json");
+  FILE *fp = fopen(report_path.c_str(), "w");
+  ASSERT_NE(nullptr, fp);
+  WriteJarVerifyReport(fp, results, 1.5);
+  ASSERT_EQ(0, fclose(fp));
+  fp = fopen(report_path.c_str(), "r");
+  ASSERT_NE(nullptr, fp);
+  char buffer[8192];
+  string report(buffer, fread(buffer, 1, sizeof(buffer), fp));
+  fclose(fp);
+  EXPECT_NE(string::npos, report.find("\"jars_checked\": 3,")) << report;
+  EXPECT_NE(string::npos, report.find("\"jars_failed\": 1,")) << report;
+  EXPECT_NE(string::npos, report.find("\"wall_time_ms\": 1.500,")) << report;
+  EXPECT_NE(string::npos,
+            report.find("\"ok\": true, \"entries\": 2, \"bytes\": 137"))
+      << report;
+}
+
+}  // namespace
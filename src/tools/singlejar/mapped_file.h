@@ -16,6 +16,7 @@
 #define BAZEL_SRC_TOOLS_SINGLEJAR_MAPPED_FILE_H_ 1
 
 #include <fcntl.h>
+#include <stdint.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -93,6 +94,23 @@ class MappedFile {
   size_t size() const { return mapped_end_ - mapped_start_; }
   bool is_open() { return fd_ >= 0; }
 
+  // Passes the advice (MADV_WILLNEED, MADV_SEQUENTIAL, etc.) about the given
+  // range of the file, extended to the page boundaries, to the kernel. It is
+  // only a hint, so the errors are ignored.
+  void Advise(off_t offset, size_t count, int advice) const {
+    if (offset < 0 || static_cast<size_t>(offset) >= size()) {
+      return;
+    }
+    if (count > size() - offset) {
+      count = size() - offset;
+    }
+    static const uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t start =
+        reinterpret_cast<uintptr_t>(mapped_start_ + offset) & ~page_mask;
+    uintptr_t end = reinterpret_cast<uintptr_t>(mapped_start_ + offset + count);
+    madvise(reinterpret_cast<void *>(start), end - start, advice);
+  }
+
  private:
   unsigned char *mapped_start_;
   unsigned char *mapped_end_;
@@ -0,0 +1,110 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_TOOLS_SINGLEJAR_NAME_FILTER_H_
+#define BAZEL_SRC_TOOLS_SINGLEJAR_NAME_FILTER_H_ 1
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * A set of strings matching the entry names which begin (or, for a suffix
+ * filter, end) with any of them. The strings are compiled into a trie (of
+ * the reversed strings for a suffix filter), so that a name is matched in
+ * a single pass over at most its length, regardless of the number of the
+ * strings in the set.
+ */
+class NameFilter {
+ public:
+  enum Kind { kPrefix, kSuffix };
+
+  explicit NameFilter(Kind kind = kPrefix)
+      : kind_(kind), empty_(true), nodes_(1) {}
+
+  // Adds a string to the set.
+  void Add(const std::string &s) {
+    uint32_t node = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+      char c = kind_ == kPrefix ? s[i] : s[s.size() - 1 - i];
+      uint32_t child = Child(node, c);
+      if (child == 0) {
+        child = nodes_.size();
+        nodes_.push_back(Node(c, nodes_[node].first_child));
+        nodes_[node].first_child = child;
+      }
+      node = child;
+    }
+    nodes_[node].terminal = true;
+    empty_ = false;
+  }
+
+  void Add(const std::vector<std::string> &strings) {
+    for (auto &s : strings) {
+      Add(s);
+    }
+  }
+
+  // True if no string has been added.
+  bool empty() const { return empty_; }
+
+  // Returns true if the name begins (or ends) with any of the strings.
+  bool Matches(const char *name, size_t name_length) const {
+    uint32_t node = 0;
+    for (size_t i = 0;; ++i) {
+      if (nodes_[node].terminal) {
+        return true;
+      }
+      if (i == name_length) {
+        return false;
+      }
+      node = Child(node, kind_ == kPrefix ? name[i]
+                                          : name[name_length - 1 - i]);
+      if (node == 0) {
+        return false;
+      }
+    }
+  }
+
+  bool Matches(const std::string &name) const {
+    return Matches(name.c_str(), name.size());
+  }
+
+ private:
+  // The children of a node are a linked list of its siblings. The root is
+  // node 0, which is never anyone's child, so 0 denotes the end of a list.
+  struct Node {
+    explicit Node(char c = 0, uint32_t next = 0)
+        : first_child(0), next_sibling(next), c(c), terminal(false) {}
+    uint32_t first_child;
+    uint32_t next_sibling;
+    char c;
+    bool terminal;
+  };
+
+  uint32_t Child(uint32_t node, char c) const {
+    uint32_t child = nodes_[node].first_child;
+    while (child != 0 && nodes_[child].c != c) {
+      child = nodes_[child].next_sibling;
+    }
+    return child;
+  }
+
+  Kind kind_;
+  bool empty_;
+  std::vector<Node> nodes_;
+};
+
+#endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_NAME_FILTER_H_
@@ -0,0 +1,70 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/name_filter.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(NameFilterTest, Empty) {
+  NameFilter filter;
+  EXPECT_TRUE(filter.empty());
+  EXPECT_FALSE(filter.Matches("foo"));
+  EXPECT_FALSE(filter.Matches(""));
+}
+
+TEST(NameFilterTest, Prefixes) {
+  NameFilter filter;
+  filter.Add(std::vector<std::string>{"com/google/", "com/goo", "org/x", "a"});
+  EXPECT_FALSE(filter.empty());
+  EXPECT_TRUE(filter.Matches("com/google/Foo.class"));
+  EXPECT_TRUE(filter.Matches("com/goo"));
+  EXPECT_TRUE(filter.Matches("com/goodbye"));
+  EXPECT_TRUE(filter.Matches("org/x/y"));
+  EXPECT_TRUE(filter.Matches("abc"));
+  EXPECT_FALSE(filter.Matches("com/go"));
+  EXPECT_FALSE(filter.Matches("org/"));
+  EXPECT_FALSE(filter.Matches("b/a"));
+  EXPECT_FALSE(filter.Matches(""));
+  // The name does not have to be NUL-terminated.
+  EXPECT_FALSE(filter.Matches("org/xyz", 4));
+  EXPECT_TRUE(filter.Matches("org/xyz", 5));
+}
+
+TEST(NameFilterTest, Suffixes) {
+  NameFilter filter(NameFilter::kSuffix);
+  filter.Add(".SF");
+  filter.Add(".RSA");
+  filter.Add(".png");
+  EXPECT_TRUE(filter.Matches("META-INF/CERT.SF"));
+  EXPECT_TRUE(filter.Matches("META-INF/CERT.RSA"));
+  EXPECT_TRUE(filter.Matches(".png"));
+  EXPECT_FALSE(filter.Matches("png"));
+  EXPECT_FALSE(filter.Matches("META-INF/CERT.SF/"));
+  EXPECT_FALSE(filter.Matches("res/icon.png.txt"));
+  EXPECT_TRUE(filter.Matches("res/icon.png.txt", 12));
+}
+
+// The empty string matches any name.
+TEST(NameFilterTest, EmptyString) {
+  NameFilter filter;
+  filter.Add("");
+  EXPECT_TRUE(filter.Matches(""));
+  EXPECT_TRUE(filter.Matches("foo"));
+}
+
+}  // namespace
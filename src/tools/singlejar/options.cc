@@ -21,9 +21,32 @@ void Options::ParseCommandLine(int argc, const char * const argv[]) {
   ArgTokenStream tokens(argc, argv);
   std::string optarg;
   while (!tokens.AtEnd()) {
+    if (tokens.MatchAndSet("--also_output", &optarg)) {
+      also_outputs.emplace_back();
+      also_outputs.back().output_jar = optarg;
+      continue;
+    }
+    if (!also_outputs.empty()) {
+      AlsoOutput &also_output = also_outputs.back();
+      if (tokens.MatchAndSet("--include_prefixes",
+                             &also_output.include_prefixes) ||
+          tokens.MatchAndSet("--nocompress_suffixes",
+                             &also_output.nocompress_suffixes) ||
+          tokens.MatchAndSet("--exclude_build_data",
+                             &also_output.exclude_build_data) ||
+          tokens.MatchAndSet("--compression",
+                             &also_output.force_compression) ||
+          tokens.MatchAndSet("--dont_change_compression",
+                             &also_output.preserve_compression) ||
+          tokens.MatchAndSet("--output_digest", &also_output.output_digest)) {
+        continue;
+      }
+    }
     if (tokens.MatchAndSet("--output", &output_jar) ||
         tokens.MatchAndSet("--main_class", &main_class) ||
         tokens.MatchAndSet("--java_launcher", &java_launcher) ||
+        tokens.MatchAndSet("--launcher_descriptor", &launcher_descriptor) ||
+        tokens.MatchAndSet("--assemble", &assemble) ||
         tokens.MatchAndSet("--deploy_manifest_lines", &manifest_lines) ||
         tokens.MatchAndSet("--sources", &input_jars) ||
         tokens.MatchAndSet("--resources", &resources) ||
@@ -38,11 +61,39 @@ void Options::ParseCommandLine(int argc, const char * const argv[]) {
         tokens.MatchAndSet("--verbose", &verbose) ||
         tokens.MatchAndSet("--warn_duplicate_resources",
                            &warn_duplicate_resources) ||
-        tokens.MatchAndSet("--nocompress_suffixes", &nocompress_suffixes)) {
+        tokens.MatchAndSet("--nocompress_suffixes", &nocompress_suffixes) ||
+        tokens.MatchAndSet("--jobs", &jobs) ||
+        tokens.MatchAndSet("--memory_budget", &memory_budget) ||
+        tokens.MatchAndSet("--stored_alignment", &stored_alignment) ||
+        tokens.MatchAndSet("--page_align_native_libs",
+                           &page_align_native_libs) ||
+        tokens.MatchAndSet("--output_index", &output_index) ||
+        tokens.MatchAndSet("--previous_output", &previous_output) ||
+        tokens.MatchAndSet("--previous_index", &previous_index) ||
+        tokens.MatchAndSet("--duplicates_report", &duplicates_report) ||
+        tokens.MatchAndSet("--profile", &profile) ||
+        tokens.MatchAndSet("--output_digest", &output_digest) ||
+        tokens.MatchAndSet("--verify_crc", &verify_crc) ||
+        tokens.MatchAndSet("--emit_index", &emit_index) ||
+        tokens.MatchAndSet("--emit_index_list", &emit_index_list) ||
+        tokens.MatchAndSet("--allow_identical_duplicates",
+                           &allow_identical_duplicates)) {
       continue;
     } else if (tokens.MatchAndSet("--build_info_file", &optarg)) {
       build_info_files.push_back(optarg);
       continue;
+    } else if (tokens.MatchAndSet("--entry_order", &optarg)) {
+      if (optarg == "input") {
+        entry_order = kInputOrder;
+      } else if (optarg == "name") {
+        entry_order = kNameOrder;
+      } else if (optarg == "package") {
+        entry_order = kPackageOrder;
+      } else {
+        diag_errx(1, "--entry_order argument should be input, name or "
+                     "package, got %s", optarg.c_str());
+      }
+      continue;
     } else if (tokens.MatchAndSet("--extra_build_info", &optarg)) {
       build_info_lines.push_back(optarg);
       continue;
@@ -59,4 +110,52 @@ void Options::ParseCommandLine(int argc, const char * const argv[]) {
         1,
         "--compression and --dont_change_compression are mutually exclusive");
   }
+  if (jobs < 1) {
+    diag_errx(1, "--jobs argument should be positive, got %d", jobs);
+  }
+  if (memory_budget < 0) {
+    diag_errx(1, "--memory_budget argument should not be negative, got %d",
+              memory_budget);
+  }
+  if (stored_alignment < 0 || stored_alignment > 4096 ||
+      (stored_alignment & (stored_alignment - 1)) != 0) {
+    diag_errx(1, "--stored_alignment argument should be a power of 2 not "
+                 "larger than 4096, got %d", stored_alignment);
+  }
+  if (!launcher_descriptor.empty() && java_launcher.empty()) {
+    diag_errx(1, "--launcher_descriptor requires --java_launcher");
+  }
+  if (assemble && (java_launcher.empty() || input_jars.size() != 1 ||
+                   !launcher_descriptor.empty())) {
+    diag_errx(1, "--assemble requires --java_launcher and a single --sources "
+                 "jar, and cannot be used with --launcher_descriptor");
+  }
+  if (assemble && emit_index_list) {
+    diag_errx(1, "--emit_index_list cannot be used with --assemble, which "
+                 "copies the entries of the jar as is");
+  }
+  if (entry_order != kInputOrder &&
+      (!output_index.empty() || !previous_output.empty())) {
+    diag_errx(1, "--output_index and --previous_output require the input "
+                 "--entry_order");
+  }
+  if (entry_order != kInputOrder && memory_budget) {
+    diag_errx(1, "--memory_budget requires the input --entry_order: the other "
+                 "orders keep all the input jars mapped until the end");
+  }
+  for (auto &also_output : also_outputs) {
+    if (also_output.force_compression && also_output.preserve_compression) {
+      diag_errx(1, "--compression and --dont_change_compression are mutually "
+                   "exclusive for --also_output %s",
+                also_output.output_jar.c_str());
+    }
+  }
+  if (!also_outputs.empty() && (assemble || entry_order != kInputOrder)) {
+    diag_errx(1, "--also_output requires the input --entry_order, and cannot "
+                 "be used with --assemble");
+  }
+  if (previous_output.empty() != previous_index.empty()) {
+    diag_errx(1, "--previous_output and --previous_index should be used "
+                 "together");
+  }
 }
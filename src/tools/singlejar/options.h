@@ -21,15 +21,54 @@
 /* Command line options. */
 class Options {
  public:
+  // The order of the entries copied from the input jars on output.
+  enum EntryOrder {
+    // The order of the input jars, and that of the entries in each of them.
+    kInputOrder,
+    // Sorted by name.
+    kNameOrder,
+    // Grouped by directory (package), sorted by name in each directory. The
+    // directories are sorted by name, too.
+    kPackageOrder,
+  };
+
   Options()
       : exclude_build_data(false),
         force_compression(false),
         normalize_timestamps(false),
         no_duplicates(false),
         no_duplicate_classes(false),
+        allow_identical_duplicates(false),
         preserve_compression(false),
         verbose(false),
-        warn_duplicate_resources(false) {}
+        warn_duplicate_resources(false),
+        verify_crc(false),
+        emit_index(false),
+        emit_index_list(false),
+        jobs(1),
+        memory_budget(0),
+        stored_alignment(0),
+        page_align_native_libs(false),
+        assemble(false),
+        entry_order(kInputOrder) {}
+
+  // An output written in the same pass over the input jars as the main one,
+  // with its own filter and compression (--also_output). The options setting
+  // these fields that follow --also_output apply to it rather than to the
+  // main output; everything else is shared.
+  struct AlsoOutput {
+    AlsoOutput()
+        : exclude_build_data(false),
+          force_compression(false),
+          preserve_compression(false) {}
+    std::string output_jar;
+    std::string output_digest;
+    std::vector<std::string> include_prefixes;
+    std::vector<std::string> nocompress_suffixes;
+    bool exclude_build_data;
+    bool force_compression;
+    bool preserve_compression;
+  };
 
   // Parses command line arguments into the fields of this instance.
   void ParseCommandLine(int argc, const char * const argv[]);
@@ -37,6 +76,23 @@ class Options {
   std::string output_jar;
   std::string main_class;
   std::string java_launcher;
+  // The file to describe the --java_launcher in, which is then not written
+  // to the output jar: the executable is assembled later with --assemble.
+  std::string launcher_descriptor;
+  // The relink index to write for the output jar, and the output jar and
+  // relink index from the previous run to reuse the unchanged parts of.
+  std::string output_index;
+  std::string previous_output;
+  std::string previous_index;
+  // The file listing the duplicate entries whose contents differ from that of
+  // the first entry with the same name, one per line:
+  //   NAME<TAB>JAR<TAB>CRC32<TAB>SIZE<TAB>DUPLICATE_JAR<TAB>CRC32<TAB>SIZE
+  std::string duplicates_report;
+  // The file to write the JSON profile of the run to (see Profiler).
+  std::string profile;
+  // "<function>:<xattr>": the output is digested as it is written, and the
+  // digest stored in the extended attribute <xattr> (see OutputDigest).
+  std::string output_digest;
   std::vector<std::string> manifest_lines;
   std::vector<std::string> input_jars;
   std::vector<std::string> resources;
@@ -45,14 +101,44 @@ class Options {
   std::vector<std::string> build_info_lines;
   std::vector<std::string> include_prefixes;
   std::vector<std::string> nocompress_suffixes;
+  std::vector<AlsoOutput> also_outputs;
   bool exclude_build_data;
   bool force_compression;
   bool normalize_timestamps;
   bool no_duplicates;
   bool no_duplicate_classes;
+  // Whether --no_duplicates allows the duplicates identical to the first
+  // entry.
+  bool allow_identical_duplicates;
   bool preserve_compression;
   bool verbose;
   bool warn_duplicate_resources;
+  // Whether to check the checksums of the input entries copied to the
+  // output as is.
+  bool verify_crc;
+  // Whether to write the jar index (see JarIndex) next to the output jar.
+  bool emit_index;
+  // Whether to write META-INF/INDEX.LIST, the JarIndex of the JAR File
+  // Specification, into the output jar.
+  bool emit_index_list;
+  // The number of threads preparing input jars (opening them and
+  // recompressing their entries) ahead of the writer, and compressing
+  // each large entry.
+  int jobs;
+  // The memory, in megabytes, the combined and recompressed contents may
+  // take before they are spilled to a temporary file. 0 means no limit.
+  // Requires the input entry_order.
+  int memory_budget;
+  // The alignment of the data of the stored (uncompressed) entries on
+  // output, like zipalign's, a power of 2. 0 means no alignment.
+  int stored_alignment;
+  // Whether the data of the stored .so entries is aligned to 4096, so that
+  // Android can map native libraries straight from the APK.
+  bool page_align_native_libs;
+  // Whether the output is the --java_launcher followed by the single
+  // --sources jar, whose entries are copied as is.
+  bool assemble;
+  EntryOrder entry_order;
 };
 
 #endif  // THIRD_PARTY_BAZEL_SRC_TOOLS_SINGLEJAR_OPTIONS_H_
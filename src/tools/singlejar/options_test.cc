@@ -56,6 +56,72 @@ TEST(OptionsTest, Flags2) {
   ASSERT_TRUE(options.warn_duplicate_resources);
 }
 
+TEST(OptionsTest, Jobs) {
+  const char *args[] = {"--output", "output_jar", "--jobs", "8"};
+  Options options;
+  EXPECT_EQ(1, options.jobs);
+  options.ParseCommandLine(arraysize(args), args);
+  EXPECT_EQ(8, options.jobs);
+}
+
+TEST(OptionsTest, MemoryBudget) {
+  const char *args[] = {"--output", "output_jar", "--memory_budget", "512"};
+  Options options;
+  EXPECT_EQ(0, options.memory_budget);
+  options.ParseCommandLine(arraysize(args), args);
+  EXPECT_EQ(512, options.memory_budget);
+}
+
+TEST(OptionsTest, Relink) {
+  const char *args[] = {"--output", "output_jar",
+                        "--output_index", "output_index",
+                        "--previous_output", "previous_jar",
+                        "--previous_index", "previous_index",
+                        "--emit_index"};
+  Options options;
+  EXPECT_FALSE(options.emit_index);
+  options.ParseCommandLine(arraysize(args), args);
+  EXPECT_TRUE(options.emit_index);
+  EXPECT_EQ("output_index", options.output_index);
+  EXPECT_EQ("previous_jar", options.previous_output);
+  EXPECT_EQ("previous_index", options.previous_index);
+}
+
+TEST(OptionsTest, EmitIndexList) {
+  const char *args[] = {"--output", "output_jar", "--emit_index_list"};
+  Options options;
+  EXPECT_FALSE(options.emit_index_list);
+  options.ParseCommandLine(arraysize(args), args);
+  EXPECT_TRUE(options.emit_index_list);
+}
+
+TEST(OptionsTest, Duplicates) {
+  const char *args[] = {"--output", "output_jar",
+                        "--duplicates_report", "report",
+                        "--allow_identical_duplicates"};
+  Options options;
+  EXPECT_FALSE(options.allow_identical_duplicates);
+  options.ParseCommandLine(arraysize(args), args);
+  EXPECT_EQ("report", options.duplicates_report);
+  EXPECT_TRUE(options.allow_identical_duplicates);
+}
+
+TEST(OptionsTest, VerifyCrc) {
+  const char *args[] = {"--output", "output_jar", "--verify_crc"};
+  Options options;
+  EXPECT_FALSE(options.verify_crc);
+  options.ParseCommandLine(arraysize(args), args);
+  EXPECT_TRUE(options.verify_crc);
+}
+
+TEST(OptionsTest, OutputDigest) {
+  const char *args[] = {"--output", "output_jar",
+                        "--output_digest", "sha256:user.bazel.digest"};
+  Options options;
+  options.ParseCommandLine(arraysize(args), args);
+  EXPECT_EQ("sha256:user.bazel.digest", options.output_digest);
+}
+
 TEST(OptionsTest, SingleOptargs) {
   const char *args[] = {"--output", "output_jar",
                         "--main_class", "com.google.Main",
@@ -123,3 +189,46 @@ TEST(OptionsTest, EmptyMultiOptargs) {
   EXPECT_EQ(0, options.classpath_resources.size());
   EXPECT_EQ(1, options.include_prefixes.size());
 }
+
+TEST(OptionsTest, AlsoOutput) {
+  const char *args[] = {"--output", "output_jar",
+                        "--compression",
+                        "--sources", "jar1", "jar2",
+                        "--also_output", "classes_jar",
+                        "--include_prefixes", "com", "org",
+                        "--exclude_build_data",
+                        "--normalize",
+                        "--also_output", "resources_jar",
+                        "--dont_change_compression",
+                        "--nocompress_suffixes", ".png",
+                        "--output_digest", "sha256:user.digest"};
+  Options options;
+  options.ParseCommandLine(arraysize(args), args);
+
+  // The options of a single output that follow --also_output are its own.
+  EXPECT_EQ("output_jar", options.output_jar);
+  EXPECT_TRUE(options.force_compression);
+  EXPECT_TRUE(options.include_prefixes.empty());
+  EXPECT_FALSE(options.exclude_build_data);
+  EXPECT_TRUE(options.output_digest.empty());
+  // The others are shared.
+  EXPECT_TRUE(options.normalize_timestamps);
+  EXPECT_EQ(2, options.input_jars.size());
+
+  ASSERT_EQ(2, options.also_outputs.size());
+  const Options::AlsoOutput &classes = options.also_outputs[0];
+  EXPECT_EQ("classes_jar", classes.output_jar);
+  ASSERT_EQ(2, classes.include_prefixes.size());
+  EXPECT_EQ("com", classes.include_prefixes[0]);
+  EXPECT_EQ("org", classes.include_prefixes[1]);
+  EXPECT_TRUE(classes.exclude_build_data);
+  EXPECT_FALSE(classes.force_compression);
+  EXPECT_FALSE(classes.preserve_compression);
+  const Options::AlsoOutput &resources = options.also_outputs[1];
+  EXPECT_EQ("resources_jar", resources.output_jar);
+  EXPECT_TRUE(resources.preserve_compression);
+  ASSERT_EQ(1, resources.nocompress_suffixes.size());
+  EXPECT_EQ(".png", resources.nocompress_suffixes[0]);
+  EXPECT_EQ("sha256:user.digest", resources.output_digest);
+  EXPECT_TRUE(resources.include_prefixes.empty());
+}
@@ -21,16 +21,36 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
+#if defined(__linux)
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
 
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <numeric>
+#include <set>
+
+#include "src/main/cpp/util/md5.h"
+#include "src/main/cpp/util/trace_events.h"
 #include "src/tools/singlejar/combiners.h"
+#include "src/tools/singlejar/crc32.h"
 #include "src/tools/singlejar/diag.h"
 #include "src/tools/singlejar/input_jar.h"
+#include "src/tools/singlejar/jar_index.h"
 #include "src/tools/singlejar/mapped_file.h"
 #include "src/tools/singlejar/options.h"
+#include "src/tools/singlejar/thread_pool.h"
 #include "src/tools/singlejar/zip_headers.h"
+#include "src/tools/singlejar/zlib_interface.h"
 
 #include <zlib.h>
 
@@ -41,31 +61,49 @@
 
 OutputJar::OutputJar()
     : options_(nullptr),
+      signature_suffixes_(NameFilter::kSuffix),
+      nocompress_suffixes_(NameFilter::kSuffix),
+      fd_(-1),
       file_(nullptr),
+      mapped_output_(nullptr),
+      mapped_size_(0),
       outpos_(0),
       buffer_(nullptr),
       entries_(0),
       duplicate_entries_(0),
-      cen_(nullptr),
+      conflicting_entries_(0),
       cen_size_(0),
-      cen_capacity_(0),
+      use_copy_file_range_(true),
+      use_sendfile_(true),
+      duplicates_report_(nullptr),
+      relink_(false),
+      reused_jars_(0),
       spring_handlers_("META-INF/spring.handlers"),
       spring_schemas_("META-INF/spring.schemas"),
       protobuf_meta_handler_("protobuf.meta", false),
       manifest_("META-INF/MANIFEST.MF"),
       build_properties_("build-data.properties") {
-  known_members_.emplace(spring_handlers_.filename(),
-                         EntryInfo{&spring_handlers_});
-  known_members_.emplace(spring_schemas_.filename(),
-                         EntryInfo{&spring_schemas_});
-  known_members_.emplace(manifest_.filename(), EntryInfo{&manifest_});
-  known_members_.emplace(protobuf_meta_handler_.filename(),
-                         EntryInfo{&protobuf_meta_handler_});
+  known_members_.Insert(spring_handlers_.filename(),
+                        EntryInfo{&spring_handlers_});
+  known_members_.Insert(spring_schemas_.filename(),
+                        EntryInfo{&spring_schemas_});
+  known_members_.Insert(manifest_.filename(), EntryInfo{&manifest_});
+  known_members_.Insert(protobuf_meta_handler_.filename(),
+                        EntryInfo{&protobuf_meta_handler_});
   manifest_.Append(
       "Manifest-Version: 1.0\r\n"
       "Created-By: singlejar\r\n");
+  // Special files that cannot be handled by looking up known_members_ map:
+  // * ignore *.SF, *.RSA, *.DSA
+  //   (TODO(asmundak): should this be done only in META-INF?
+  //
+  signature_suffixes_.Add(".SF");
+  signature_suffixes_.Add(".RSA");
+  signature_suffixes_.Add(".DSA");
 }
 
+static const char kIndexListName[] = "META-INF/INDEX.LIST";
+
 static std::string Basename(const std::string& path) {
   size_t pos = path.rfind('/');
   if (pos == std::string::npos) {
@@ -75,18 +113,318 @@ static std::string Basename(const std::string& path) {
   }
 }
 
+bool OutputJar::IgnoredEntry(const char *file_name,
+                             size_t file_name_length) const {
+  return signature_suffixes_.Matches(file_name, file_name_length) ||
+         (!include_prefixes_.empty() &&
+          !include_prefixes_.Matches(file_name, file_name_length));
+}
+
+bool OutputJar::OutputCompressed(const CDH *jar_entry) const {
+  bool input_compressed = jar_entry->compression_method() != Z_NO_COMPRESSION;
+  bool output_compressed =
+      options_->force_compression ||
+      (options_->preserve_compression && input_compressed);
+  return output_compressed &&
+         !NoCompress(jar_entry->file_name(), jar_entry->file_name_length());
+}
+
+void *OutputJar::Recompress(const CDH *jar_entry, const LH *lh,
+                            bool output_compressed, Profiler *profiler) {
+  Concatenator combiner(jar_entry->file_name_string());
+  {
+    Profiler::Timer timer(profiler, Profiler::kInflate);
+    if (!combiner.Merge(jar_entry, lh)) {
+      diag_err(1, "%s:%d: cannot add %.*s", __FILE__, __LINE__,
+               jar_entry->file_name_length(), jar_entry->file_name());
+    }
+  }
+  Profiler::Timer timer(profiler, Profiler::kDeflate);
+  return combiner.OutputEntry(output_compressed);
+}
+
+// Returns true if the checksum and size of the contents of the given plain
+// file entry match those in its Central Directory Header. Deflated contents
+// are inflated piecemeal to a scratch buffer.
+static bool EntryChecksumMatches(const CDH *jar_entry, const LH *lh) {
+  const uint8_t *data = lh->data();
+  size_t uncompressed_size = jar_entry->uncompressed_file_size();
+  uint32_t checksum = 0;
+  if (jar_entry->compression_method() == Z_NO_COMPRESSION) {
+    checksum = Crc32(0, data, uncompressed_size);
+  } else if (jar_entry->compression_method() == Z_DEFLATED) {
+    static const uint32_t kChunkSize = 1 << 30;
+    static const uint32_t kScratchSize = 256 << 10;
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[kScratchSize]);
+    ZStreamPool<Inflater>::Ptr inflater = ZStreamPool<Inflater>::Acquire();
+    size_t to_inflate = jar_entry->compressed_file_size();
+    int ret;
+    do {
+      if (inflater->available_in() == 0 && to_inflate > 0) {
+        uint32_t chunk_size = std::min<size_t>(to_inflate, kChunkSize);
+        inflater->DataToInflate(data, chunk_size);
+        data += chunk_size;
+        to_inflate -= chunk_size;
+      }
+      ret = inflater->Inflate(buffer.get(), kScratchSize);
+      if (ret != Z_OK && ret != Z_STREAM_END) {
+        return false;
+      }
+      checksum = Crc32(checksum, buffer.get(),
+                       kScratchSize - inflater->available_out());
+    } while (ret != Z_STREAM_END);
+    if (inflater->total_out() != uncompressed_size) {
+      return false;
+    }
+  } else {
+    // Cannot check it.
+    return true;
+  }
+  return checksum == jar_entry->crc32();
+}
+
+// Returns the digest of the options affecting the output of the input jar
+// entries.
+static std::string OptionsDigest(const Options &options) {
+  std::string flags;
+  flags += options.normalize_timestamps ? 'n' : '-';
+  flags += options.force_compression ? 'c' : '-';
+  flags += options.preserve_compression ? 'p' : '-';
+  flags += '\0';
+  for (auto &prefix : options.include_prefixes) {
+    flags += prefix;
+    flags += '\0';
+  }
+  flags += '\0';
+  for (auto &suffix : options.nocompress_suffixes) {
+    flags += suffix;
+    flags += '\0';
+  }
+  flags += std::to_string(options.stored_alignment);
+  flags += options.page_align_native_libs ? 'a' : '-';
+  return JarIndex::Digest(reinterpret_cast<const uint8_t *>(flags.data()),
+                          flags.size());
+}
+
+/*
+ * An input jar opened ahead of the time it is written out.
+ */
+struct PreparedJar {
+  PreparedJar() : opened(false) {}
+  ~PreparedJar() {
+    for (auto entry : recompressed) {
+      free(entry);
+    }
+  }
+  InputJar input_jar;
+  bool opened;
+  // Indexed by the entry's position in the Central Directory. For each plain
+  // file entry whose compression has to be changed on output, contains the
+  // output entry as returned by Combiner::OutputEntry. The writer takes
+  // ownership of the entries it uses, the rest are freed on destruction.
+  std::vector<void *> recompressed;
+};
+
+/*
+ * Prepares input jars on the worker threads. A jar is prepared by opening it,
+ * scanning its Central Directory and recompressing the entries for which the
+ * compression on output differs from that on input. Whether an entry ends up
+ * in the output (which depends on the entries seen before) is decided later
+ * by the writer, so the work done for duplicate entries is wasted.
+ * At most kWindow jars per thread can be prepared but not yet consumed.
+ * The workers run on the shared ThreadPool; if it has no room for any, the
+ * jars are prepared by Get() itself.
+ */
+class JarPrefetcher {
+ public:
+  JarPrefetcher(const OutputJar *output_jar, const Options *options,
+                Profiler *profiler, int thread_count)
+      : output_jar_(output_jar),
+        options_(options),
+        profiler_(profiler),
+        jars_(options->input_jars.size()),
+        next_to_prepare_(0),
+        next_to_consume_(0),
+        window_(kWindow * thread_count),
+        worker_count_(0),
+        workers_(&ThreadPool::Shared()) {
+    while (worker_count_ < static_cast<size_t>(thread_count) &&
+           worker_count_ < jars_.size() &&
+           workers_.TryStart([this] { Worker(); })) {
+      ++worker_count_;
+    }
+  }
+
+  ~JarPrefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Make the workers exit once they are done with the current jar.
+      next_to_prepare_ = jars_.size();
+    }
+    has_room_.notify_all();
+    workers_.Wait();
+  }
+
+  // Returns the prepared jar with given index, waiting for it if necessary.
+  // The jars should be retrieved in the input order.
+  PreparedJar *Get(size_t index) {
+    if (worker_count_ == 0) {
+      PreparedJar *prepared_jar = new PreparedJar();
+      Prepare(index, prepared_jar);
+      return prepared_jar;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait(lock, [this, index] { return jars_[index] != nullptr; });
+    PreparedJar *prepared_jar = jars_[index].release();
+    next_to_consume_ = index + 1;
+    lock.unlock();
+    has_room_.notify_all();
+    return prepared_jar;
+  }
+
+ private:
+  static const size_t kWindow = 2;
+
+  void Worker() {
+    for (;;) {
+      size_t index;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        has_room_.wait(lock, [this] {
+          return next_to_prepare_ >= jars_.size() ||
+                 next_to_prepare_ < next_to_consume_ + window_;
+        });
+        if (next_to_prepare_ >= jars_.size()) {
+          return;
+        }
+        index = next_to_prepare_++;
+      }
+      std::unique_ptr<PreparedJar> prepared_jar(new PreparedJar());
+      Prepare(index, prepared_jar.get());
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jars_[index] = std::move(prepared_jar);
+      }
+      ready_.notify_all();
+    }
+  }
+
+  void Prepare(size_t index, PreparedJar *prepared_jar) {
+    InputJar &input_jar = prepared_jar->input_jar;
+    {
+      Profiler::Timer timer(profiler_, Profiler::kOpen);
+      if (!input_jar.Open(options_->input_jars[index])) {
+        return;
+      }
+    }
+    prepared_jar->opened = true;
+    const CDH *jar_entry;
+    const LH *lh;
+    while ((jar_entry = input_jar.NextEntry(&lh))) {
+      const char *file_name = jar_entry->file_name();
+      auto file_name_length = jar_entry->file_name_length();
+      void *output_entry = nullptr;
+      if (file_name_length && file_name[file_name_length - 1] != '/' &&
+          !output_jar_->IgnoredEntry(file_name, file_name_length)) {
+        bool input_compressed =
+            jar_entry->compression_method() != Z_NO_COMPRESSION;
+        bool output_compressed = output_jar_->OutputCompressed(jar_entry);
+        if (input_compressed != output_compressed) {
+          output_entry = OutputJar::Recompress(jar_entry, lh,
+                                               output_compressed, profiler_);
+        }
+      }
+      prepared_jar->recompressed.push_back(output_entry);
+    }
+    input_jar.Rewind();
+  }
+
+  const OutputJar *output_jar_;
+  const Options *options_;
+  Profiler *profiler_;
+  std::mutex mutex_;
+  std::condition_variable ready_;     // Signalled when a jar is prepared.
+  std::condition_variable has_room_;  // Signalled when a jar is consumed.
+  std::vector<std::unique_ptr<PreparedJar> > jars_;
+  size_t next_to_prepare_;
+  size_t next_to_consume_;
+  const size_t window_;
+  size_t worker_count_;
+  ThreadPool::Group workers_;
+};
+
 int OutputJar::Doit(Options *options) {
   if (nullptr != options_) {
     diag_errx(1, "%s:%d: Doit() can be called only once.", __FILE__, __LINE__);
   }
   options_ = options;
+  if (!options_->profile.empty()) {
+    profiler_.Enable();
+  }
+  ThreadPool::Shared().SetSize(options_->jobs);
+  TransientBytes::SetMemoryBudget(static_cast<uint64_t>(options_->memory_budget)
+                                  << 20);
+  Begin();
+
+  if (options_->assemble) {
+    {
+      blaze_util::TraceSpan span("assemble");
+      Assemble();
+    }
+    TracedClose();
+    return 0;
+  }
+
+  WriteLeadingEntries();
+  BeginAlsoOutputs();
+
+  // Then copy source files' contents. With --jobs, the input jars are opened
+  // and the entries that need recompression are recompressed by the worker
+  // threads, while this thread writes them out in the input order, so that
+  // the output is the same as that of the serial run.
+  uint64_t phase_start = BlazeTraceNow();
+  if (options_->entry_order != Options::kInputOrder) {
+    AddJarsInEntryOrder();
+  } else if (options_->jobs > 1 && options_->input_jars.size() > 1) {
+    JarPrefetcher prefetcher(this, options_, &profiler_, options_->jobs);
+    for (size_t ix = 0; ix < options_->input_jars.size(); ++ix) {
+      std::unique_ptr<PreparedJar> prepared_jar(prefetcher.Get(ix));
+      if (!AddJar(ix, prepared_jar.get())) {
+        exit(1);
+      }
+    }
+  } else {
+    for (size_t ix = 0; ix < options_->input_jars.size(); ++ix) {
+      if (!AddJar(ix)) {
+        exit(1);
+      }
+    }
+  }
+
+  BlazeTraceSpan("add jars", NULL, phase_start);
+
+  // All entries written, write Central Directory and close.
+  TracedClose();
+  for (auto &also_output : also_outputs_) {
+    also_output->TracedClose();
+  }
+  return 0;
+}
+
+void OutputJar::Begin() {
+  include_prefixes_.Add(options_->include_prefixes);
+  nocompress_suffixes_.Add(options_->nocompress_suffixes);
 
   // Register the handler for the build-data.properties file unless
   // --exclude_build_data is present. Otherwise we do not generate this file,
   // and it will be copied from the first source archive containing it.
   if (!options_->exclude_build_data) {
-    known_members_.emplace(build_properties_.filename(),
-                           EntryInfo{&build_properties_});
+    known_members_.Insert(build_properties_.filename(),
+                          EntryInfo{&build_properties_});
+  }
+  // The index of an input jar does not describe the output one.
+  if (options_->emit_index_list) {
+    known_members_.Insert(kIndexListName, EntryInfo{&null_combiner_});
   }
 
   build_properties_.AddProperty("build.target", options_->output_jar.c_str());
@@ -103,36 +441,35 @@ int OutputJar::Doit(Options *options) {
     fprintf(stderr, "%ld manifest lines\n", options_->manifest_lines.size());
   }
 
+  uint64_t phase_start = BlazeTraceNow();
+  if (!options_->previous_output.empty()) {
+    OpenPrevious();
+  }
+  relink_ = previous_output_.is_open() || !options_->output_index.empty();
+
   if (!Open()) {
     exit(1);
   }
+  BlazeTraceSpan("open output", options_->output_jar.c_str(), phase_start);
+  if (!options_->duplicates_report.empty()) {
+    duplicates_report_ = fopen(options_->duplicates_report.c_str(), "w");
+    if (duplicates_report_ == nullptr) {
+      diag_err(1, "%s:%d: %s", __FILE__, __LINE__,
+               options_->duplicates_report.c_str());
+    }
+  }
 
-  // Copy launcher if it is set.
+  // Copy launcher if it is set, unless it is only to be described.
   if (!options_->java_launcher.empty()) {
-    const char *const launcher_path = options_->java_launcher.c_str();
-    int in_fd = open(launcher_path, O_RDONLY);
-    struct stat statbuf;
-    if (file_ == nullptr || fstat(in_fd, &statbuf)) {
-      diag_err(1, "%s", launcher_path);
-    }
-    // TODO(asmundak):  Consider going back to sendfile() or reflink
-    // (BTRFS_IOC_CLONE/XFS_IOC_CLONE) here.  The launcher preamble can
-    // be very large for targets with many native deps.
-    ssize_t byte_count = AppendFile(in_fd, 0, statbuf.st_size);
-    if (byte_count < 0) {
-      diag_err(1, "%s:%d: Cannot copy %s to %s", __FILE__, __LINE__,
-               launcher_path, options_->output_jar.c_str());
-    } else if (byte_count != statbuf.st_size) {
-      diag_err(1, "%s:%d: Copied only %ld bytes out of %" PRIu64 " from %s",
-               __FILE__, __LINE__, byte_count, statbuf.st_size, launcher_path);
-    }
-    close(in_fd);
-    if (options_->verbose) {
-      fprintf(stderr, "Prepended %s (%" PRIu64 " bytes)\n", launcher_path,
-              statbuf.st_size);
+    if (options_->launcher_descriptor.empty()) {
+      AppendLauncher();
+    } else {
+      WriteLauncherDescriptor();
     }
   }
+}
 
+void OutputJar::WriteLeadingEntries() {
   if (!options_->main_class.empty()) {
     build_properties_.AddProperty("main.class", options_->main_class);
     manifest_.Append("Main-Class: ");
@@ -149,9 +486,10 @@ int OutputJar::Doit(Options *options) {
     }
   }
 
+  // A property set again by --extra_build_info or --build_info_file takes
+  // the last value it is given.
   for (auto &build_info_line : options_->build_info_lines) {
-    build_properties_.Append(build_info_line);
-    build_properties_.Append("\n");
+    build_properties_.AddLine(build_info_line);
   }
 
   for (auto &build_info_file : options_->build_info_files) {
@@ -164,13 +502,16 @@ int OutputJar::Doit(Options *options) {
     const char *data_end = reinterpret_cast<const char *>(mapped_file.end());
     // TODO(asmundak): this isn't right, we should parse properties file.
     while (data < data_end) {
-      const char *next_data = strchr(static_cast<const char *>(data), '\n');
-      if (next_data) {
-        ++next_data;
-      } else {
-        next_data = data_end;
+      const char *line_end = static_cast<const char *>(
+          memchr(data, '\n', data_end - data));
+      if (line_end == nullptr) {
+        line_end = data_end;
       }
-      build_properties_.Append(data, next_data - data);
+      const char *next_data = line_end < data_end ? line_end + 1 : data_end;
+      if (line_end > data && line_end[-1] == '\r') {
+        --line_end;
+      }
+      build_properties_.AddLine(std::string(data, line_end - data));
       data = next_data;
     }
     mapped_file.Close();
@@ -196,72 +537,151 @@ int OutputJar::Doit(Options *options) {
 
   // Ready to write zip entries. Decide whether created entries should be
   // compressed.
+  uint64_t phase_start = BlazeTraceNow();
   bool compress = options_->force_compression || options_->preserve_compression;
   // First, write a directory entry for the META-INF, followed by the manifest
   // file, followed by the build properties file.
   WriteMetaInf();
   manifest_.Append("\r\n");
-  WriteEntry(manifest_.OutputEntry(compress));
+  WriteCombinedEntry(&manifest_, compress);
   if (!options_->exclude_build_data) {
-    WriteEntry(build_properties_.OutputEntry(compress));
+    WriteCombinedEntry(&build_properties_, compress);
   }
 
   // Then classpath resources.
   for (auto &classpath_resource : classpath_resources_) {
-    bool do_compress = compress;
-    if (do_compress && !options_->nocompress_suffixes.empty()) {
-      for (auto &suffix : options_->nocompress_suffixes) {
-        auto entry_name = classpath_resource->filename();
-        if (entry_name.length() >= suffix.size() &&
-            !entry_name.compare(entry_name.length() - suffix.size(),
-                                suffix.size(), suffix)) {
-          do_compress = false;
-          break;
-        }
-      }
-    }
-    WriteEntry(classpath_resource->OutputEntry(do_compress));
+    const std::string &entry_name = classpath_resource->filename();
+    WriteCombinedEntry(
+        classpath_resource.get(),
+        compress && !NoCompress(entry_name.c_str(), entry_name.size()));
   }
 
-  // Then copy source files' contents.
-  for (int ix = 0; ix < options_->input_jars.size(); ++ix) {
-    if (!AddJar(ix)) {
-      exit(1);
-    }
+  BlazeTraceSpan("write combined entries", NULL, phase_start);
+}
+
+// Each --also_output gets the inputs and the settings of the main output, but
+// its own filter and compression. Only the main output is relinked, indexed,
+// profiled and has the launcher.
+void OutputJar::BeginAlsoOutputs() {
+  for (auto &also_output : options_->also_outputs) {
+    Options *options = new Options(*options_);
+    also_options_.emplace_back(options);
+    options->output_jar = also_output.output_jar;
+    options->output_digest = also_output.output_digest;
+    options->include_prefixes = also_output.include_prefixes;
+    options->nocompress_suffixes = also_output.nocompress_suffixes;
+    options->exclude_build_data = also_output.exclude_build_data;
+    options->force_compression = also_output.force_compression;
+    options->preserve_compression = also_output.preserve_compression;
+    options->java_launcher.clear();
+    options->launcher_descriptor.clear();
+    options->output_index.clear();
+    options->previous_output.clear();
+    options->previous_index.clear();
+    options->duplicates_report.clear();
+    options->profile.clear();
+    options->emit_index = false;
+    options->also_outputs.clear();
+
+    OutputJar *output_jar = new OutputJar();
+    also_outputs_.emplace_back(output_jar);
+    output_jar->options_ = options;
+    output_jar->Begin();
+    output_jar->WriteLeadingEntries();
   }
+}
 
-  // All entries written, write Central Directory and close.
-  Close();
-  return 0;
+void OutputJar::TracedClose() {
+  {
+    blaze_util::TraceSpan span("close", options_->output_jar.c_str());
+    Close();
+  }
+  BlazeTraceCounter("entries", entries_);
+  BlazeTraceCounter("duplicate entries", duplicate_entries_);
 }
 
 OutputJar::~OutputJar() {
-  if (file_) {
+  if (fd_ >= 0) {
     diag_warnx("%s:%d: Close() should be called first", __FILE__, __LINE__);
   }
 }
 
+// Read the input entries ahead in units of this size.
+static const size_t kPrefetchSize = 4 << 20;
+
 // Try to perform I/O in units of this size.
 // (128KB is the default max request size for fuse filesystems.)
 static const size_t kBufferSize = 128<<10;
 
+// The output consists mostly of the verbatim copies of the input entries,
+// so its size is close to the total size of the inputs.
+static size_t EstimatedOutputSize(const Options &options) {
+  size_t size = 1 << 20;  // Room for the combined entries and the CEN.
+  struct stat statbuf;
+  if (!options.java_launcher.empty() && options.launcher_descriptor.empty() &&
+      stat(options.java_launcher.c_str(), &statbuf) == 0) {
+    size += statbuf.st_size;
+  }
+  for (auto &input_jar : options.input_jars) {
+    if (stat(input_jar.c_str(), &statbuf) == 0) {
+      size += statbuf.st_size;
+    }
+  }
+  return size;
+}
+
 bool OutputJar::Open() {
-  if (file_) {
+  if (fd_ >= 0) {
     diag_errx(1, "%s:%d: Cannot open output archive twice", __FILE__, __LINE__);
   }
   // Set execute bits since we may produce an executable output file.
-  int fd = open(path(), O_CREAT|O_WRONLY|O_TRUNC, 0777);
+  // Mapping the output for writing requires read access, too, but a pipe
+  // opened for reading and writing would not wait for the reader.
+  struct stat statbuf;
+  int fd = -1;
+  if (stat(path(), &statbuf) || S_ISREG(statbuf.st_mode)) {
+    fd = open(path(), O_CREAT|O_RDWR|O_TRUNC, 0777);
+  }
+  if (fd < 0) {
+    fd = open(path(), O_CREAT|O_WRONLY|O_TRUNC, 0777);
+  }
   if (fd < 0) {
     diag_warn("%s:%d: %s", __FILE__, __LINE__, path());
     return false;
   }
+  fd_ = fd;
+  outpos_ = 0;
+  if (!options_->output_digest.empty()) {
+    digest_.reset(blaze_util::OutputDigest::Parse(options_->output_digest));
+    if (digest_ == nullptr) {
+      diag_errx(1, "--output_digest argument should be md5:<xattr> or "
+                   "sha256:<xattr>, got %s", options_->output_digest.c_str());
+    }
+    use_copy_file_range_ = false;
+    use_sendfile_ = false;
+  }
+  // Only a regular file can be mapped, write pipes and devices through stdio.
+  bool regular_file = fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode);
+  if (regular_file && ResizeMappedOutput(EstimatedOutputSize(*options_))) {
+    if (options_->verbose) {
+      fprintf(stderr, "Writing to %s (mapped)\n", path());
+    }
+    return true;
+  }
+  // Discard whatever the failed attempt to map the output has allocated.
+  if (regular_file && ftruncate(fd, 0)) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path());
+    close(fd);
+    fd_ = -1;
+    return false;
+  }
   file_ = fdopen(fd, "w");
   if (file_ == nullptr) {
     diag_warn("%s:%d: fdopen of %s", __FILE__, __LINE__, path());
     close(fd);
+    fd_ = -1;
     return false;
   }
-  outpos_ = 0;
   buffer_.reset(new char[kBufferSize]);
   setbuffer(file_, buffer_.get(), kBufferSize);
   if (options_->verbose) {
@@ -270,15 +690,334 @@ bool OutputJar::Open() {
   return true;
 }
 
-bool OutputJar::AddJar(int jar_path_index) {
-  const std::string& input_jar_path = options_->input_jars[jar_path_index];
+bool OutputJar::OpenPrevious() {
+  const char *previous_path = options_->previous_output.c_str();
+  if (!options_->normalize_timestamps) {
+    // Otherwise the entries written by the previous run have different
+    // timestamps.
+    diag_warnx("%s:%d: --previous_output requires --normalize, ignoring %s",
+               __FILE__, __LINE__, previous_path);
+    return false;
+  }
+  struct stat previous_stat;
+  struct stat output_stat;
+  if (stat(previous_path, &previous_stat) == 0 &&
+      stat(path(), &output_stat) == 0 &&
+      previous_stat.st_dev == output_stat.st_dev &&
+      previous_stat.st_ino == output_stat.st_ino) {
+    diag_warnx("%s:%d: %s will be overwritten and cannot be reused", __FILE__,
+               __LINE__, previous_path);
+    return false;
+  }
+  if (!previous_index_.Read(options_->previous_index)) {
+    return false;
+  }
+  if (previous_index_.options_digest() != OptionsDigest(*options_)) {
+    if (options_->verbose) {
+      fprintf(stderr, "Options have changed since %s was written\n",
+              previous_path);
+    }
+    return false;
+  }
+  if (!previous_output_.Open(previous_path)) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, previous_path);
+    return false;
+  }
+  return true;
+}
+
+void OutputJar::AppendLauncher() {
+  const char *const launcher_path = options_->java_launcher.c_str();
+  int in_fd = open(launcher_path, O_RDONLY);
+  struct stat statbuf;
+  if (in_fd < 0 || fstat(in_fd, &statbuf)) {
+    diag_err(1, "%s", launcher_path);
+  }
+  // The launcher preamble can be very large for targets with many native
+  // deps, so try to share its blocks with the launcher file first, and
+  // copy it kernel-side if the filesystem does not support that.
+  ssize_t byte_count = CloneFile(in_fd, statbuf.st_size)
+                           ? statbuf.st_size
+                           : AppendFile(in_fd, 0, statbuf.st_size);
+  if (byte_count < 0) {
+    diag_err(1, "%s:%d: Cannot copy %s to %s", __FILE__, __LINE__,
+             launcher_path, options_->output_jar.c_str());
+  } else if (byte_count != statbuf.st_size) {
+    diag_err(1, "%s:%d: Copied only %ld bytes out of %" PRIu64 " from %s",
+             __FILE__, __LINE__, byte_count, statbuf.st_size, launcher_path);
+  }
+  close(in_fd);
+  if (options_->verbose) {
+    fprintf(stderr, "Prepended %s (%" PRIu64 " bytes)\n", launcher_path,
+            statbuf.st_size);
+  }
+}
+
+// The descriptor names the launcher and records its size, which is all
+// --assemble needs to know, so it only changes when the launcher does.
+void OutputJar::WriteLauncherDescriptor() {
+  const char *const launcher_path = options_->java_launcher.c_str();
+  const char *const descriptor_path = options_->launcher_descriptor.c_str();
+  struct stat statbuf;
+  if (stat(launcher_path, &statbuf)) {
+    diag_err(1, "%s", launcher_path);
+  }
+  FILE *descriptor = fopen(descriptor_path, "w");
+  if (descriptor == nullptr ||
+      fprintf(descriptor, "java_launcher=%s\njava_launcher_size=%" PRIu64 "\n",
+              launcher_path, static_cast<uint64_t>(statbuf.st_size)) < 0 ||
+      fclose(descriptor)) {
+    diag_err(1, "%s:%d: %s", __FILE__, __LINE__, descriptor_path);
+  }
+}
+
+void OutputJar::Assemble() {
+  const std::string &input_jar_path = options_->input_jars[0];
   InputJar input_jar;
   if (!input_jar.Open(input_jar_path)) {
-    return false;
+    exit(1);
   }
+  // The entries are copied kernel-side, and the blocks of the jar are
+  // shared with the output if the filesystem supports that.
+  off_t start = Position();
+  size_t size = input_jar.CentralDirectoryOffset();
+  if (AppendFile(input_jar.fd(), 0, size) != static_cast<ssize_t>(size)) {
+    diag_err(1, "%s:%d: Cannot copy %ld bytes from %s", __FILE__, __LINE__,
+             size, input_jar_path.c_str());
+  }
+  profiler_.AddBytes(Profiler::kBytesCopied, size);
   const CDH *jar_entry;
   const LH *lh;
   while ((jar_entry = input_jar.NextEntry(&lh))) {
+    off_t output_position = start + input_jar.LocalHeaderOffset(lh);
+    TODO(output_position < 0xFFFFFFFF, "Handle Zip64");
+    AppendToDirectoryBuffer(jar_entry)->local_header_offset32(output_position);
+    ++entries_;
+  }
+  input_jar.Close();
+}
+
+bool OutputJar::AddJar(int jar_path_index) {
+  PreparedJar prepared_jar;
+  {
+    Profiler::Timer timer(&profiler_, Profiler::kOpen);
+    if (!prepared_jar.input_jar.Open(options_->input_jars[jar_path_index])) {
+      return false;
+    }
+  }
+  prepared_jar.opened = true;
+  return AddJar(jar_path_index, &prepared_jar);
+}
+
+bool OutputJar::AddJar(int jar_path_index, PreparedJar *prepared_jar) {
+  if (!prepared_jar->opened) {
+    return false;
+  }
+  CopyJar(jar_path_index, prepared_jar);
+  // The --also_output jars scan the open jar again, rather than opening it and
+  // reading its Central Directory anew. They take the entries recompressed
+  // ahead of time that this output did not, which are compressed the way they
+  // need them if they need them recompressed at all.
+  for (auto &also_output : also_outputs_) {
+    prepared_jar->input_jar.Rewind();
+    also_output->CopyJar(jar_path_index, prepared_jar);
+  }
+  return prepared_jar->input_jar.Close();
+}
+
+void OutputJar::CopyJar(int jar_path_index, PreparedJar *prepared_jar) {
+  const std::string& input_jar_path = options_->input_jars[jar_path_index];
+  blaze_util::TraceSpan span("add jar", input_jar_path.c_str());
+  uint64_t jar_start = profiler_.Now();
+  InputJar &input_jar = prepared_jar->input_jar;
+
+  // First, decide which entries are to be copied, feeding the rest to the
+  // combiners. Nothing is written to the output until the list is complete:
+  // if the same list has been copied from the same input by the previous run,
+  // its output can be reused.
+  std::vector<KeptEntry> kept_entries;
+  ScanJar(jar_path_index, prepared_jar, &kept_entries);
+
+  RelinkIndex::JarSection section;
+  if (relink_) {
+    Profiler::Timer timer(&profiler_, Profiler::kHash);
+    section.path = input_jar_path;
+    // Hashing the whole jar is the bulk of the work here, the jar index
+    // spares it.
+    JarIndex jar_index;
+    if (jar_index.Read(input_jar_path + JarIndex::kSuffix) &&
+        jar_index.Describes(&input_jar)) {
+      section.digest = jar_index.digest();
+    } else {
+      section.digest =
+          JarIndex::Digest(input_jar.mapped_start(), input_jar.mapped_size());
+    }
+    blaze_util::Md5Digest entries_md5;
+    for (auto &kept_entry : kept_entries) {
+      uint32_t index = kept_entry.index;
+      entries_md5.Update(&index, sizeof(index));
+    }
+    unsigned char buf[blaze_util::Md5Digest::kDigestLength];
+    entries_md5.Finish(buf);
+    section.entries_digest = entries_md5.String();
+  }
+  section.start = Position();
+  section.cen_start = cen_size_;
+  int entries = entries_;
+  const RelinkIndex::JarSection *previous_section =
+      previous_output_.is_open()
+          ? previous_index_.Find(section.path, section.digest,
+                                 section.entries_digest)
+          : nullptr;
+  if (previous_section != nullptr && ReuseSection(*previous_section)) {
+    ++reused_jars_;
+    kept_entries.clear();
+  }
+  // The output headers are at most as large as the input ones.
+  size_t cen_size = 0;
+  for (auto &kept_entry : kept_entries) {
+    cen_size += kept_entry.cdh->size();
+  }
+  PreallocateCdr(cen_size);
+
+  WriteEntries(jar_path_index, prepared_jar, kept_entries.data(),
+               kept_entries.data() + kept_entries.size());
+  if (!options_->output_index.empty()) {
+    section.end = Position();
+    section.cen_end = cen_size_;
+    section.entry_count = entries_ - entries;
+    output_index_.Add(section);
+  }
+  profiler_.AddJar(input_jar_path, jar_start, entries_ - entries,
+                   Position() - section.start);
+}
+
+// Compares the entry names the way memcmp does.
+static int CompareNames(const char *name1, size_t length1, const char *name2,
+                        size_t length2) {
+  int result = memcmp(name1, name2, std::min(length1, length2));
+  return result ? result : (length1 > length2) - (length1 < length2);
+}
+
+// Returns the length of the directory part of the entry name, including its
+// trailing slash. The directory of the directory entry "a/b/" is "a/".
+static size_t DirectoryLength(const char *name, size_t length) {
+  size_t directory_length = length - 1;
+  while (directory_length > 0 && name[directory_length - 1] != '/') {
+    --directory_length;
+  }
+  return directory_length;
+}
+
+// Which entries are kept is decided for all input jars first, in the input
+// order, so that the first entry with given name wins as usual. Then the kept
+// entries are merged and written in the requested order, which is why all the
+// input jars are open at the same time (and why --memory_budget is rejected
+// with this order).
+void OutputJar::AddJarsInEntryOrder() {
+  // The descriptors of the output, the reports, the spill files...
+  static const size_t kOtherFiles = 32;
+  size_t jar_count = options_->input_jars.size();
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    if (limit.rlim_cur < limit.rlim_max) {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+      getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur != RLIM_INFINITY &&
+        jar_count + kOtherFiles > limit.rlim_cur) {
+      diag_errx(1, "%s:%d: --entry_order keeps all the %zu input jars open, "
+                   "which the limit of %" PRIu64 " open files does not allow; "
+                   "use the input --entry_order",
+                __FILE__, __LINE__, jar_count,
+                static_cast<uint64_t>(limit.rlim_cur));
+    }
+  }
+  std::vector<std::unique_ptr<PreparedJar> > jars(jar_count);
+  // The entries kept from all input jars, and the index of the jar of each.
+  std::vector<KeptEntry> entries;
+  std::vector<int> entry_jars;
+  {
+    std::unique_ptr<JarPrefetcher> prefetcher;
+    if (options_->jobs > 1 && jar_count > 1) {
+      prefetcher.reset(
+          new JarPrefetcher(this, options_, &profiler_, options_->jobs));
+    }
+    for (size_t ix = 0; ix < jar_count; ++ix) {
+      if (prefetcher) {
+        jars[ix].reset(prefetcher->Get(ix));
+      } else {
+        Profiler::Timer timer(&profiler_, Profiler::kOpen);
+        jars[ix].reset(new PreparedJar());
+        jars[ix]->opened =
+            jars[ix]->input_jar.Open(options_->input_jars[ix]);
+      }
+      if (!jars[ix]->opened) {
+        exit(1);
+      }
+      ScanJar(ix, jars[ix].get(), &entries);
+      entry_jars.resize(entries.size(), ix);
+    }
+  }
+
+  bool by_package = options_->entry_order == Options::kPackageOrder;
+  std::vector<size_t> order(entries.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t i1, size_t i2) {
+    const CDH *cdh1 = entries[i1].cdh;
+    const CDH *cdh2 = entries[i2].cdh;
+    int result = 0;
+    if (by_package) {
+      result = CompareNames(
+          cdh1->file_name(),
+          DirectoryLength(cdh1->file_name(), cdh1->file_name_length()),
+          cdh2->file_name(),
+          DirectoryLength(cdh2->file_name(), cdh2->file_name_length()));
+    }
+    if (result == 0) {
+      result = CompareNames(cdh1->file_name(), cdh1->file_name_length(),
+                            cdh2->file_name(), cdh2->file_name_length());
+    }
+    return result ? result < 0 : i1 < i2;
+  });
+  std::vector<KeptEntry> sorted_entries;
+  sorted_entries.reserve(entries.size());
+  size_t cen_size = 0;
+  for (size_t i : order) {
+    sorted_entries.push_back(entries[i]);
+    cen_size += entries[i].cdh->size();
+  }
+  PreallocateCdr(cen_size);
+
+  // Consecutive entries from the same jar are written together, so that the
+  // adjacent ones are still copied as a single range.
+  for (size_t begin = 0; begin < order.size();) {
+    int ix = entry_jars[order[begin]];
+    size_t end = begin + 1;
+    while (end < order.size() && entry_jars[order[end]] == ix) {
+      ++end;
+    }
+    WriteEntries(ix, jars[ix].get(), sorted_entries.data() + begin,
+                 sorted_entries.data() + end);
+    begin = end;
+  }
+  for (auto &jar : jars) {
+    if (!jar->input_jar.Close()) {
+      exit(1);
+    }
+  }
+}
+
+void OutputJar::ScanJar(int jar_path_index, PreparedJar *prepared_jar,
+                        std::vector<KeptEntry> *kept_entries) {
+  const std::string& input_jar_path = options_->input_jars[jar_path_index];
+  InputJar &input_jar = prepared_jar->input_jar;
+  const CDH *jar_entry;
+  const LH *lh;
+  uint64_t scan_start = profiler_.Now();
+  for (size_t entry_index = 0; (jar_entry = input_jar.NextEntry(&lh));
+       ++entry_index) {
     const char *file_name = jar_entry->file_name();
     auto file_name_length = jar_entry->file_name_length();
     if (!file_name_length) {
@@ -287,27 +1026,7 @@ bool OutputJar::AddJar(int jar_path_index) {
           __FILE__, __LINE__, input_jar_path.c_str(),
           input_jar.CentralDirectoryRecordOffset(jar_entry));
     }
-    // Special files that cannot be handled by looking up known_members_ map:
-    // * ignore *.SF, *.RSA, *.DSA
-    //   (TODO(asmundak): should this be done only in META-INF?
-    //
-    if (ends_with(file_name, file_name_length, ".SF") ||
-        ends_with(file_name, file_name_length, ".RSA") ||
-        ends_with(file_name, file_name_length, ".DSA")) {
-      continue;
-    }
-
-    bool include_entry = true;
-    if (!options_->include_prefixes.empty()) {
-      for (auto& prefix : options_->include_prefixes) {
-        if ((include_entry =
-                 (prefix.size() <= file_name_length &&
-                  0 == strncmp(file_name, prefix.c_str(), prefix.size())))) {
-          break;
-        }
-      }
-    }
-    if (!include_entry) {
+    if (IgnoredEntry(file_name, file_name_length)) {
       continue;
     }
 
@@ -322,7 +1041,7 @@ bool OutputJar::AddJar(int jar_path_index) {
         // The call to Merge() below will then take care of the rest.
         Concatenator *service_handler = new Concatenator(service_path);
         service_handlers_.emplace_back(service_handler);
-        known_members_.emplace(service_path, EntryInfo{service_handler});
+        known_members_.Insert(service_path, EntryInfo{service_handler});
       }
     } else {
       ExtraHandler(jar_entry);
@@ -333,66 +1052,149 @@ bool OutputJar::AddJar(int jar_path_index) {
     // will add either a directory entry whose handler will ignore subsequent
     // duplicates, or an ordinary plain entry, for which we save the index of
     // the first input jar (in order to provide diagnostics on duplicate).
-    auto got =
-        known_members_.emplace(std::string(file_name, file_name_length),
-                               EntryInfo{is_file ? nullptr : &null_combiner_,
-                                         is_file ? jar_path_index: -1});
+    auto got = known_members_.Insert(
+        file_name, file_name_length,
+        EntryInfo{is_file ? nullptr : &null_combiner_,
+                  is_file ? jar_path_index : -1, jar_entry->crc32(),
+                  jar_entry->uncompressed_file_size()});
     if (!got.second) {
-      auto &entry_info = got.first->second;
+      auto &entry_info = *got.first;
       // Handle special entries (the ones that have a combiner).
       if (entry_info.combiner_ != nullptr) {
+        uint64_t merge_start = profiler_.Now();
         entry_info.combiner_->Merge(jar_entry, lh);
+        profiler_.AddTime(Profiler::kMerge, merge_start);
+        // Do not count the merge time as the scan time.
+        scan_start += profiler_.Now() - merge_start;
         continue;
       }
 
-      // Plain file entry. If duplicates are not allowed, bail out. Otherwise
-      // just ignore this entry.
-      if (options_->no_duplicates ||
-          (options_->no_duplicate_classes &&
-           ends_with(file_name, file_name_length, ".class"))) {
+      // Plain file entry. The duplicate with the same checksum and size as
+      // the first one is considered identical to it.
+      bool identical =
+          jar_entry->crc32() == entry_info.crc32_ &&
+          jar_entry->uncompressed_file_size() == entry_info.size_;
+      if (!identical && duplicates_report_ != nullptr) {
+        fprintf(duplicates_report_,
+                "%.*s\t%s\t%08" PRIx32 "\t%" PRIu64 "\t%s\t%08" PRIx32
+                "\t%" PRIu64 "\n",
+                file_name_length, file_name,
+                options_->input_jars[entry_info.input_jar_index_].c_str(),
+                entry_info.crc32_, entry_info.size_, input_jar_path.c_str(),
+                jar_entry->crc32(),
+                static_cast<uint64_t>(jar_entry->uncompressed_file_size()));
+      }
+      // If duplicates are not allowed, bail out. Otherwise just ignore this
+      // entry.
+      if ((options_->no_duplicates ||
+           (options_->no_duplicate_classes &&
+            ends_with(file_name, file_name_length, ".class"))) &&
+          !(identical && options_->allow_identical_duplicates)) {
         diag_errx(1, "%s:%d: %.*s is present both in %s and %s", __FILE__,
                   __LINE__, file_name_length, file_name,
                   options_->input_jars[entry_info.input_jar_index_].c_str(),
                   input_jar_path.c_str());
       } else {
         duplicate_entries_++;
+        if (!identical) {
+          conflicting_entries_++;
+        }
         continue;
       }
     }
 
+    kept_entries->push_back(KeptEntry{jar_entry, lh, entry_index});
+  }
+  profiler_.AddTime(Profiler::kScan, scan_start);
+}
+
+void OutputJar::WriteEntries(int jar_path_index, PreparedJar *prepared_jar,
+                             const KeptEntry *begin, const KeptEntry *end) {
+  const std::string& input_jar_path = options_->input_jars[jar_path_index];
+  InputJar &input_jar = prepared_jar->input_jar;
+  std::vector<void *> &recompressed = prepared_jar->recompressed;
+  const CDH *jar_entry;
+  const LH *lh;
+
+  // The entries copied verbatim are copied by ranges: consecutive entries of
+  // the input jar are adjacent in it, so as long as we keep copying them
+  // unchanged, the range of input bytes to copy grows, and it is written out
+  // with a single copy when the run ends. [run_start, run_end) is the range
+  // of the input jar that has yet to be written out.
+  off_t run_start = 0;
+  off_t run_end = 0;
+  auto flush_run = [&]() {
+    size_t run_size = run_end - run_start;
+    // Large ranges are copied kernel-side, the small ones are not worth
+    // flushing the output buffer for.
+    bool written =
+        run_size >= kBufferSize
+            ? AppendFile(input_jar.fd(), run_start, run_size) ==
+                  static_cast<ssize_t>(run_size)
+            : WriteBytes(input_jar.mapped_start() + run_start, run_size);
+    if (!written) {
+      diag_err(1, "%s:%d: Cannot write %ld bytes from %s", __FILE__, __LINE__,
+               run_size, input_jar_path.c_str());
+    }
+    profiler_.AddBytes(Profiler::kBytesCopied, run_size);
+    if (options_->memory_budget) {
+      input_jar.Release(run_start, run_size);
+    }
+    run_start = run_end = 0;
+  };
+
+  // The entries are read ahead of the copying, so that on a slow (e.g.,
+  // network) filesystem the copying does not stall on every page fault.
+  // The window is advanced when the copying reaches its second half.
+  uint64_t prefetch_end = 0;
+  for (const KeptEntry *kept_entry = begin; kept_entry < end; ++kept_entry) {
+    jar_entry = kept_entry->cdh;
+    lh = kept_entry->lh;
+    size_t entry_index = kept_entry->index;
+    uint64_t entry_offset = input_jar.LocalHeaderOffset(lh);
+    if (entry_offset + kPrefetchSize / 2 >= prefetch_end) {
+      uint64_t prefetch_start = std::max(entry_offset, prefetch_end);
+      input_jar.Prefetch(prefetch_start, kPrefetchSize);
+      prefetch_end = prefetch_start + kPrefetchSize;
+    }
+    const char *file_name = jar_entry->file_name();
+    auto file_name_length = jar_entry->file_name_length();
+    bool is_file = (file_name[file_name_length - 1] != '/');
+
     // For the file entries, decide whether output should be compressed.
     if (is_file) {
       bool input_compressed =
           jar_entry->compression_method() != Z_NO_COMPRESSION;
-      bool output_compressed =
-          options_->force_compression ||
-          (options_->preserve_compression && input_compressed);
-      if (output_compressed && !options_->nocompress_suffixes.empty()) {
-        for (auto &suffix : options_->nocompress_suffixes) {
-          if (file_name_length >= suffix.size() &&
-              !strncmp(file_name + file_name_length - suffix.size(),
-                       suffix.c_str(), suffix.size())) {
-            output_compressed = false;
-            break;
-          }
-        }
-      }
+      bool output_compressed = OutputCompressed(jar_entry);
       if (input_compressed != output_compressed) {
-        Concatenator combiner(jar_entry->file_name_string());
-        if (!combiner.Merge(jar_entry, lh)) {
-          diag_err(1, "%s:%d: cannot add %.*s", __FILE__, __LINE__,
-                   jar_entry->file_name_length(), jar_entry->file_name());
+        void *output_entry = nullptr;
+        if (entry_index < recompressed.size()) {
+          std::swap(output_entry, recompressed[entry_index]);
+        }
+        if (output_entry == nullptr) {
+          output_entry =
+              Recompress(jar_entry, lh, output_compressed, &profiler_);
         }
-        WriteEntry(combiner.OutputEntry(output_compressed));
+        flush_run();
+        off_t entry_start = outpos_;
+        WriteEntry(output_entry);
+        profiler_.AddBytes(Profiler::kBytesRecompressed, outpos_ - entry_start);
         continue;
       }
     }
 
+    if (is_file && options_->verify_crc &&
+        !EntryChecksumMatches(jar_entry, lh)) {
+      diag_errx(1, "%s:%d: Checksum mismatch for %.*s in %s", __FILE__,
+                __LINE__, file_name_length, file_name,
+                input_jar_path.c_str());
+    }
+
     // Now we have to copy:
     //  local header
     //  file data
     //  data descriptor, if present.
-    off_t copy_from = jar_entry->local_header_offset();
+    off_t copy_from = input_jar.LocalHeaderOffset(lh);
     size_t num_bytes = lh->size();
     if (jar_entry->no_size_in_local_header()) {
       const DDR *ddr = reinterpret_cast<const DDR *>(
@@ -404,7 +1206,7 @@ bool OutputJar::AddJar(int jar_path_index) {
     } else {
       num_bytes += lh->compressed_file_size();
     }
-    off_t output_position = Position();
+    off_t output_position = Position() + (run_end - run_start);
 
     // When normalize_timestamps is set, entry's timestamp is to be set to
     // 01/01/1980 00:00:00 (or to 01/01/1980 00:00:02, if an entry is a .class
@@ -423,11 +1225,20 @@ bool OutputJar::AddJar(int jar_path_index) {
                       jar_entry->last_mod_file_time() != normalized_time ||
                       lh_field_to_remove != nullptr;
     }
-    if (fix_timestamp) {
+    // The data of a stored entry may have to be aligned, which is done by
+    // appending the padding to the extra fields of its local header, too.
+    size_t padding = 0;
+    if (is_file && jar_entry->compression_method() == Z_NO_COMPRESSION) {
+      size_t data_offset =
+          lh->size() -
+          (lh_field_to_remove != nullptr ? lh_field_to_remove->size() : 0);
+      padding = AlignmentPadding(lh, output_position + data_offset);
+    }
+    if (fix_timestamp || padding) {
       uint8_t lh_buffer[512];
       size_t lh_size = lh->size();
-      LH *lh_new = lh_size > sizeof(lh_buffer)
-                       ? reinterpret_cast<LH *>(malloc(lh_size))
+      LH *lh_new = lh_size + padding > sizeof(lh_buffer)
+                       ? reinterpret_cast<LH *>(malloc(lh_size + padding))
                        : reinterpret_cast<LH *>(lh_buffer);
       // Remove Unix timestamp field.
       if (lh_field_to_remove != nullptr) {
@@ -445,13 +1256,20 @@ bool OutputJar::AddJar(int jar_path_index) {
       } else {
         memcpy(lh_new, lh, lh_size);
       }
-      lh_new->last_mod_file_date(33);
-      lh_new->last_mod_file_time(normalized_time);
+      if (fix_timestamp) {
+        lh_new->last_mod_file_date(33);
+        lh_new->last_mod_file_time(normalized_time);
+      }
+      if (padding) {
+        PadLocalHeader(lh_new, padding);
+      }
       // Now write these few bytes and adjust read/write positions accordingly.
+      flush_run();
       if (!WriteBytes(lh_new, lh_new->size())) {
         diag_err(1, "%s:%d: Cannot copy modified local header for %.*s",
                  __FILE__, __LINE__, file_name_length, file_name);
       }
+      profiler_.AddBytes(Profiler::kBytesCopied, lh_new->size());
       copy_from += lh_size;
       num_bytes -= lh_size;
       if (reinterpret_cast<uint8_t *>(lh_new) != lh_buffer) {
@@ -459,12 +1277,12 @@ bool OutputJar::AddJar(int jar_path_index) {
       }
     }
 
-    // Do the actual copy.
-    if (!WriteBytes(input_jar.mapped_start() + copy_from, num_bytes)) {
-      diag_err(1, "%s:%d: Cannot write %ld bytes of %.*s from %s", __FILE__,
-               __LINE__, num_bytes, file_name_length, file_name,
-               input_jar_path.c_str());
+    // Do the actual copy, or rather add the bytes to the current run.
+    if (copy_from != run_end) {
+      flush_run();
+      run_start = run_end = copy_from;
     }
+    run_end += num_bytes;
 
     // Append central directory header for this file to the output central
     // directory we are building.
@@ -499,11 +1317,70 @@ bool OutputJar::AddJar(int jar_path_index) {
     }
     ++entries_;
   }
-  return input_jar.Close();
+  flush_run();
+}
+
+bool OutputJar::ReuseSection(const RelinkIndex::JarSection &section) {
+  // The aligned entries stay aligned only if the section moves by a multiple
+  // of the largest alignment.
+  off_t alignment = options_->page_align_native_libs
+                        ? 4096
+                        : options_->stored_alignment;
+  if (alignment && (Position() - section.start) % alignment) {
+    return false;
+  }
+  // Check the section against the previous output before writing anything.
+  uint64_t cen_offset = previous_index_.cen_offset();
+  if (section.start > section.end || section.end > cen_offset ||
+      section.cen_start > section.cen_end ||
+      cen_offset + section.cen_end > previous_output_.size()) {
+    return false;
+  }
+  const uint8_t *cen_start =
+      previous_output_.address(cen_offset + section.cen_start);
+  const uint8_t *cen_end =
+      previous_output_.address(cen_offset + section.cen_end);
+  uint64_t entry_count = 0;
+  for (const uint8_t *p = cen_start; p < cen_end; ++entry_count) {
+    const CDH *cdh = reinterpret_cast<const CDH *>(p);
+    size_t left = cen_end - p;
+    if (left < sizeof(CDH) || !cdh->is() || left < cdh->size() ||
+        cdh->local_header_offset32() < section.start ||
+        cdh->local_header_offset32() >= section.end) {
+      return false;
+    }
+    p += cdh->size();
+  }
+  if (entry_count != section.entry_count) {
+    return false;
+  }
+
+  // Copy the entries, then their Central Directory Headers, pointing them to
+  // the new location of the entries.
+  off_t start = Position();
+  size_t size = section.end - section.start;
+  if (AppendFile(previous_output_.fd(), section.start, size) !=
+      static_cast<ssize_t>(size)) {
+    diag_err(1, "%s:%d: Cannot copy %ld bytes from %s", __FILE__, __LINE__,
+             size, options_->previous_output.c_str());
+  }
+  profiler_.AddBytes(Profiler::kBytesReused, size);
+  uint8_t *cen = ReserveCdr(cen_end - cen_start);
+  memcpy(cen, cen_start, cen_end - cen_start);
+  for (uint8_t *p = cen; p < cen + (cen_end - cen_start);) {
+    CDH *cdh = reinterpret_cast<CDH *>(p);
+    off_t output_position =
+        start + (cdh->local_header_offset32() - section.start);
+    TODO(output_position < 0xFFFFFFFF, "Handle Zip64");
+    cdh->local_header_offset32(output_position);
+    p += cdh->size();
+  }
+  entries_ += entry_count;
+  return true;
 }
 
 off_t OutputJar::Position() {
-  if (file_ == nullptr) {
+  if (fd_ < 0) {
     diag_err(1, "%s:%d: output file is not open", __FILE__, __LINE__);
   }
   // You'd think this could be "return ftell(file_);", but that
@@ -556,7 +1433,21 @@ void OutputJar::WriteEntry(void *buffer) {
 
   uint8_t *data = reinterpret_cast<uint8_t *>(entry);
   off_t output_position = Position();
-  if (!WriteBytes(data, entry->data() + entry->in_zip_size() - data)) {
+  size_t padding = entry->compression_method() == Z_NO_COMPRESSION
+                       ? AlignmentPadding(entry, output_position + entry->size())
+                       : 0;
+  if (padding) {
+    // The padding goes between the local header and the data, so the header
+    // is written from a copy.
+    size_t lh_size = entry->size();
+    std::unique_ptr<uint8_t[]> lh_padded(new uint8_t[lh_size + padding]);
+    memcpy(lh_padded.get(), entry, lh_size);
+    PadLocalHeader(reinterpret_cast<LH *>(lh_padded.get()), padding);
+    if (!WriteBytes(lh_padded.get(), lh_size + padding) ||
+        !WriteBytes(entry->data(), entry->in_zip_size())) {
+      diag_err(1, "%s:%d: write", __FILE__, __LINE__);
+    }
+  } else if (!WriteBytes(data, entry->data() + entry->in_zip_size() - data)) {
     diag_err(1, "%s:%d: write", __FILE__, __LINE__);
   }
   // Data written, allocate CDH space and populate CDH.
@@ -587,6 +1478,44 @@ void OutputJar::WriteEntry(void *buffer) {
   free(reinterpret_cast<void *>(entry));
 }
 
+int OutputJar::StoredAlignment(const char *file_name,
+                               size_t file_name_length) const {
+  if (file_name_length == 0 || file_name[file_name_length - 1] == '/') {
+    return 0;
+  }
+  // Android maps the uncompressed native libraries straight from the APK
+  // (extractNativeLibs=false), which requires them to be page aligned.
+  if (options_->page_align_native_libs &&
+      ends_with(file_name, file_name_length, ".so")) {
+    return 4096;
+  }
+  return options_->stored_alignment;
+}
+
+size_t OutputJar::AlignmentPadding(const LH *lh, off_t data_position) const {
+  int alignment = StoredAlignment(lh->file_name(), lh->file_name_length());
+  if (alignment == 0 || data_position % alignment == 0) {
+    return 0;
+  }
+  // The padding is at least as large as an empty Alignment Extra Field.
+  size_t padding = alignment - data_position % alignment;
+  while (padding < sizeof(AlignmentExtraField)) {
+    padding += alignment;
+  }
+  return lh->extra_fields_length() + padding > 0xFFFF ? 0 : padding;
+}
+
+void OutputJar::PadLocalHeader(LH *lh, size_t padding) const {
+  AlignmentExtraField *field =
+      reinterpret_cast<AlignmentExtraField *>(lh->data());
+  field->signature();
+  field->payload_size(padding - sizeof(ExtraField));
+  field->alignment(StoredAlignment(lh->file_name(), lh->file_name_length()));
+  memset(reinterpret_cast<uint8_t *>(field) + sizeof(AlignmentExtraField), 0,
+         padding - sizeof(AlignmentExtraField));
+  lh->extra_fields(lh->extra_fields(), lh->extra_fields_length() + padding);
+}
+
 void OutputJar::WriteMetaInf() {
   const char path[] = "META-INF/";
   size_t n_path = strlen(path);
@@ -609,10 +1538,49 @@ void OutputJar::WriteMetaInf() {
   lh->uncompressed_file_size32(0);
   lh->file_name(path, n_path);
   lh->extra_fields(extra_fields, n_extra_fields);
-  known_members_.emplace(path, EntryInfo{&null_combiner_});
+  known_members_.Insert(path, EntryInfo{&null_combiner_});
   WriteEntry(lh);
 }
 
+// Like `jar -i`, lists the directory of every entry but META-INF/ itself
+// and the manifest, or the name of the entry if it is at the top. It is
+// written last, so that it covers all the other entries; the class loaders
+// look it up by name. A JDK class loader then only opens the jars the
+// index lists, so the Class-Path of the manifest is not followed.
+void OutputJar::WriteIndexList() {
+  std::set<std::string> directories;
+  std::string last_directory;
+  for (const auto &chunk : cen_chunks_) {
+    for (size_t offset = 0; offset < chunk.size;) {
+      const CDH *cdh = reinterpret_cast<const CDH *>(chunk.data + offset);
+      offset += cdh->size();
+      std::string name = cdh->file_name_string();
+      if (name == "META-INF/" || name == manifest_.filename()) {
+        continue;
+      }
+      size_t slash = name.rfind('/');
+      if (slash != std::string::npos) {
+        name.resize(slash);
+      }
+      // The entries of a directory mostly come together.
+      if (name != last_directory) {
+        directories.insert(name);
+        last_directory = name;
+      }
+    }
+  }
+  Concatenator index_list(kIndexListName);
+  index_list.Append("JarIndex-Version: 1.0\n\n");
+  index_list.Append(Basename(options_->output_jar));
+  index_list.Append("\n");
+  for (const auto &directory : directories) {
+    index_list.Append(directory);
+    index_list.Append("\n");
+  }
+  index_list.Append("\n");
+  WriteCombinedEntry(&index_list, options_->force_compression);
+}
+
 // Appends a Central Directory Entry to the directory buffer.
 CDH *OutputJar::AppendToDirectoryBuffer(const CDH *cdh) {
   size_t cdh_size = cdh->size();
@@ -620,16 +1588,30 @@ CDH *OutputJar::AppendToDirectoryBuffer(const CDH *cdh) {
       memcpy(reinterpret_cast<CDH *>(ReserveCdr(cdh_size)), cdh, cdh_size));
 }
 
-uint8_t *OutputJar::ReserveCdr(size_t chunk_size) {
-  if (cen_size_ + chunk_size > cen_capacity_) {
-    cen_capacity_ += 1000000;
-    cen_ = reinterpret_cast<uint8_t *>(realloc(cen_, cen_capacity_));
-    if (!cen_) {
-      diag_errx(1, "%s:%d: Cannot allocate %ld bytes for the directory",
-                __FILE__, __LINE__, cen_capacity_);
-    }
+// The size of a CEN buffer chunk, unless more is needed at once.
+static const size_t kCenChunkSize = 1 << 20;
+
+void OutputJar::PreallocateCdr(size_t size) {
+  if (!cen_chunks_.empty() &&
+      cen_chunks_.back().size + size <= cen_chunks_.back().capacity) {
+    return;
+  }
+  CenChunk chunk;
+  chunk.capacity = std::max(size, kCenChunkSize);
+  chunk.size = 0;
+  chunk.data = reinterpret_cast<uint8_t *>(malloc(chunk.capacity));
+  if (!chunk.data) {
+    diag_errx(1, "%s:%d: Cannot allocate %ld bytes for the directory",
+              __FILE__, __LINE__, chunk.capacity);
   }
-  uint8_t *entry = cen_ + cen_size_;
+  cen_chunks_.push_back(chunk);
+}
+
+uint8_t *OutputJar::ReserveCdr(size_t chunk_size) {
+  PreallocateCdr(chunk_size);
+  CenChunk &chunk = cen_chunks_.back();
+  uint8_t *entry = chunk.data + chunk.size;
+  chunk.size += chunk_size;
   cen_size_ += chunk_size;
   return entry;
 }
@@ -640,19 +1622,22 @@ uint8_t *OutputJar::ReserveCdh(size_t size) {
 
 // Write out combined jar.
 bool OutputJar::Close() {
-  if (file_ == nullptr) {
+  if (fd_ < 0) {
     return true;
   }
 
   for (auto &service_handler : service_handlers_) {
-    WriteEntry(service_handler->OutputEntry(options_->force_compression));
+    WriteCombinedEntry(service_handler.get(), options_->force_compression);
   }
   for (auto &extra_combiner : extra_combiners_) {
-    WriteEntry(extra_combiner->OutputEntry(options_->force_compression));
+    WriteCombinedEntry(extra_combiner.get(), options_->force_compression);
+  }
+  WriteCombinedEntry(&spring_handlers_, options_->force_compression);
+  WriteCombinedEntry(&spring_schemas_, options_->force_compression);
+  WriteCombinedEntry(&protobuf_meta_handler_, options_->force_compression);
+  if (options_->emit_index_list) {
+    WriteIndexList();
   }
-  WriteEntry(spring_handlers_.OutputEntry(options_->force_compression));
-  WriteEntry(spring_schemas_.OutputEntry(options_->force_compression));
-  WriteEntry(protobuf_meta_handler_.OutputEntry(options_->force_compression));
   // TODO(asmundak): handle manifest;
   off_t output_position = Position();
   bool write_zip64_ecd = output_position >= 0xFFFFFFFF || entries_ >= 0xFFFF ||
@@ -698,24 +1683,82 @@ bool OutputJar::Close() {
     ecd->cen_offset32(output_position);
   }
 
+  if (!options_->output_index.empty()) {
+    output_index_.set_options_digest(OptionsDigest(*options_));
+    output_index_.set_cen_offset(output_position);
+  }
+
   // Save Central Directory and wrap up.
-  if (!WriteBytes(cen_, cen_size_)) {
-    diag_err(1, "%s:%d: Cannot write central directory", __FILE__, __LINE__);
+  for (auto &chunk : cen_chunks_) {
+    if (!WriteBytes(chunk.data, chunk.size, Profiler::kCentralDirectory)) {
+      diag_err(1, "%s:%d: Cannot write central directory", __FILE__,
+               __LINE__);
+    }
+    free(chunk.data);
   }
-  free(cen_);
+  cen_chunks_.clear();
 
-  if (fclose(file_)) {
+  if (mapped_output_ != nullptr) {
+    if (munmap(mapped_output_, mapped_size_) || ftruncate(fd_, outpos_) ||
+        close(fd_)) {
+      diag_err(1, "%s:%d: %s", __FILE__, __LINE__, path());
+    }
+    mapped_output_ = nullptr;
+    mapped_size_ = 0;
+  } else if (fclose(file_)) {
     diag_err(1, "%s:%d: %s", __FILE__, __LINE__, path());
   }
+  // Only now are the size and mtime of the output final. Not every output
+  // can keep the digest, Bazel reads those.
+  if (digest_ != nullptr && !digest_->Store(options_->output_jar) &&
+      options_->verbose) {
+    fprintf(stderr, "Cannot store the digest of %s: %s\n", path(),
+            strerror(errno));
+  }
+  if (duplicates_report_ != nullptr) {
+    if (fclose(duplicates_report_)) {
+      diag_err(1, "%s:%d: %s", __FILE__, __LINE__,
+               options_->duplicates_report.c_str());
+    }
+    duplicates_report_ = nullptr;
+  }
+  fd_ = -1;
   file_ = nullptr;
   // Free the buffer only after fclose(); stdio may flush data from the
   // buffer on close.
   buffer_.reset();
+  previous_output_.Close();
+  if (!options_->output_index.empty() &&
+      !output_index_.Write(options_->output_index)) {
+    exit(1);
+  }
+  if (options_->emit_index) {
+    InputJar output_jar;
+    if (!output_jar.Open(options_->output_jar)) {
+      diag_errx(1, "%s:%d: Cannot index %s", __FILE__, __LINE__, path());
+    }
+    JarIndex jar_index;
+    jar_index.Build(&output_jar);
+    output_jar.Close();
+    if (!jar_index.Write(options_->output_jar + JarIndex::kSuffix)) {
+      exit(1);
+    }
+  }
+  if (profiler_.enabled() &&
+      !profiler_.Write(options_->profile, options_->output_jar,
+                       options_->jobs)) {
+    exit(1);
+  }
 
   if (options_->verbose) {
     fprintf(stderr, "Wrote %s with %d entries", path(), entries_);
     if (duplicate_entries_) {
-      fprintf(stderr, ", skipped %d entries", duplicate_entries_);
+      fprintf(stderr, ", skipped %d entries (%d conflicting)",
+              duplicate_entries_, conflicting_entries_);
+    }
+    if (reused_jars_) {
+      fprintf(stderr, ", reused the output of %d source files from %s",
+              reused_jars_, options_->previous_output.c_str());
     }
     fprintf(stderr, "\n");
   }
@@ -724,7 +1767,7 @@ bool OutputJar::Close() {
 
 void OutputJar::ClasspathResource(const std::string &resource_name,
                                   const std::string &resource_path) {
-  if (known_members_.count(resource_name)) {
+  if (known_members_.Find(resource_name)) {
     if (options_->warn_duplicate_resources) {
       diag_warnx(
           "%s:%d: Duplicate resource name %s in the --classpath_resource or "
@@ -744,18 +1787,125 @@ void OutputJar::ClasspathResource(const std::string &resource_name,
   classpath_resource->Append(
       reinterpret_cast<const char *>(mapped_file.start()), mapped_file.size());
   classpath_resources_.emplace_back(classpath_resource);
-  known_members_.emplace(resource_name, EntryInfo{classpath_resource});
+  known_members_.Insert(resource_name, EntryInfo{classpath_resource});
+}
+
+bool OutputJar::CloneFile(int in_fd, size_t count) {
+#if defined(__linux)
+  Profiler::Timer timer(&profiler_, Profiler::kWrite);
+// Same as BTRFS_IOC_CLONE, supported by Btrfs and XFS since Linux 4.5.
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+  // The clone replaces the contents of the output file, so it is only
+  // possible while nothing has been written yet. The cloned bytes would
+  // not be digested.
+  if (outpos_ != 0 || digest_ != nullptr ||
+      (file_ != nullptr && fflush(file_))) {
+    return false;
+  }
+  if (ioctl(fd_, FICLONE, in_fd) != 0) {
+    return false;
+  }
+  if (mapped_output_ != nullptr) {
+    // The clone truncates the output to 'count' bytes, restore the size
+    // of the mapped part.
+    if (count < mapped_size_ && ftruncate(fd_, mapped_size_)) {
+      diag_err(1, "%s:%d: ftruncate", __FILE__, __LINE__);
+    }
+  } else if (lseek(fd_, count, SEEK_SET) != static_cast<off_t>(count)) {
+    diag_err(1, "%s:%d: lseek", __FILE__, __LINE__);
+  }
+  outpos_ = count;
+  return true;
+#else
+  return false;
+#endif
 }
 
 ssize_t OutputJar::AppendFile(int in_fd, off_t offset, size_t count) {
   if (count == 0) {
     return 0;
   }
+  Profiler::Timer timer(&profiler_, Profiler::kWrite);
+  size_t total_written = 0;
+
+#if defined(__linux)
+  // Try to have the kernel move the bytes, first with copy_file_range (which
+  // may share the blocks on filesystems supporting that), then with
+  // sendfile. Either call writes at the output file position, so flush what
+  // stdio has buffered first, or, if the output is mapped, seek to the
+  // current position within the preallocated part of the file. Once a call
+  // is found to be unsupported for the given pair of files, it is not tried
+  // again.
+  if (mapped_output_ != nullptr) {
+    if (!ReserveOutput(count) || lseek(fd_, outpos_, SEEK_SET) != outpos_) {
+      return -1;
+    }
+  } else if (fflush(file_)) {
+    return -1;
+  }
+  int out_fd = fd_;
+#if defined(__NR_copy_file_range)
+  while (use_copy_file_range_ && total_written < count) {
+    loff_t in_offset = offset + total_written;
+    ssize_t n_copied = syscall(__NR_copy_file_range, in_fd, &in_offset, out_fd,
+                               nullptr, count - total_written, 0);
+    if (n_copied > 0) {
+      total_written += n_copied;
+      outpos_ += n_copied;
+    } else if (n_copied == 0) {
+      return total_written;
+    } else if (errno != EINTR) {
+      use_copy_file_range_ = false;
+    }
+  }
+#endif
+  while (use_sendfile_ && total_written < count) {
+    off_t in_offset = offset + total_written;
+    ssize_t n_copied =
+        sendfile(out_fd, in_fd, &in_offset, count - total_written);
+    if (n_copied > 0) {
+      total_written += n_copied;
+      outpos_ += n_copied;
+    } else if (n_copied == 0) {
+      return total_written;
+    } else if (errno != EINTR) {
+      use_sendfile_ = false;
+    }
+  }
+  if (total_written == count) {
+    return total_written;
+  }
+#endif
+
+  // The mapped output is read into directly.
+  if (mapped_output_ != nullptr) {
+    if (!ReserveOutput(count - total_written)) {
+      return -1;
+    }
+    while (total_written < count) {
+      ssize_t n_read = pread(in_fd, mapped_output_ + outpos_,
+                             count - total_written, offset + total_written);
+      if (n_read > 0) {
+        if (digest_ != nullptr) {
+          digest_->Update(mapped_output_ + outpos_, n_read);
+        }
+        total_written += n_read;
+        outpos_ += n_read;
+      } else if (n_read == 0) {
+        break;
+      } else if (errno != EINTR) {
+        return -1;
+      }
+    }
+    return total_written;
+  }
+
   std::unique_ptr<void, decltype(free)*> buffer(malloc(kBufferSize), free);
   if (buffer == nullptr) {
     diag_err(1, "%s:%d: malloc", __FILE__, __LINE__);
   }
-  ssize_t total_written = 0;
 
   while (total_written < count) {
     size_t len = std::min(kBufferSize, count - total_written);
@@ -778,13 +1928,84 @@ ssize_t OutputJar::AppendFile(int in_fd, off_t offset, size_t count) {
 void OutputJar::ExtraCombiner(const std::string &entry_name,
                               Combiner *combiner) {
   extra_combiners_.emplace_back(combiner);
-  known_members_.emplace(entry_name, EntryInfo{combiner});
+  known_members_.Insert(entry_name, EntryInfo{combiner});
 }
 
-bool OutputJar::WriteBytes(const void *buffer, size_t count) {
+bool OutputJar::WriteBytes(const void *buffer, size_t count,
+                           Profiler::Phase phase) {
+  Profiler::Timer timer(&profiler_, phase);
+  if (digest_ != nullptr) {
+    digest_->Update(buffer, count);
+  }
+  if (mapped_output_ != nullptr) {
+    if (!ReserveOutput(count)) {
+      return false;
+    }
+    memcpy(mapped_output_ + outpos_, buffer, count);
+    outpos_ += count;
+    return true;
+  }
   size_t written = fwrite(buffer, 1, count, file_);
   outpos_ += written;
   return written == count;
 }
 
+bool OutputJar::ReserveOutput(size_t count) {
+  if (outpos_ + count <= mapped_size_) {
+    return true;
+  }
+  // The estimate was too low (e.g., the entries are decompressed on output),
+  // grow geometrically.
+  return ResizeMappedOutput(
+      std::max(outpos_ + count, mapped_size_ + mapped_size_ / 2));
+}
+
+bool OutputJar::ResizeMappedOutput(size_t size) {
+  // Extend the file first: accessing the mapped pages past its end faults.
+  // Preallocating the blocks keeps the file contiguous where possible.
+  // Do not fall back to a sparse file when the disk is full, as writing
+  // to its pages would then fail with SIGBUS.
+#if defined(__linux)
+  bool resized = fallocate(fd_, 0, mapped_size_, size - mapped_size_) == 0 ||
+                 (errno != ENOSPC && ftruncate(fd_, size) == 0);
+#else
+  bool resized = ftruncate(fd_, size) == 0;
+#endif
+  if (!resized) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path());
+    return false;
+  }
+  void *mapped;
+  if (mapped_output_ == nullptr) {
+    mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  } else {
+#if defined(__linux)
+    mapped = mremap(mapped_output_, mapped_size_, size, MREMAP_MAYMOVE);
+#else
+    mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapped != MAP_FAILED) {
+      munmap(mapped_output_, mapped_size_);
+    }
+#endif
+  }
+  if (mapped == MAP_FAILED) {
+    diag_warn("%s:%d: cannot map %s", __FILE__, __LINE__, path());
+    return false;
+  }
+  mapped_output_ = static_cast<uint8_t *>(mapped);
+  mapped_size_ = size;
+  return true;
+}
+
+void OutputJar::WriteCombinedEntry(Combiner *combiner, bool compress) {
+  void *entry;
+  {
+    Profiler::Timer timer(&profiler_, Profiler::kDeflate);
+    entry = combiner->OutputEntry(compress);
+  }
+  off_t entry_start = outpos_;
+  WriteEntry(entry);
+  profiler_.AddBytes(Profiler::kBytesCombined, outpos_ - entry_start);
+}
+
 void OutputJar::ExtraHandler(const CDH *) {}
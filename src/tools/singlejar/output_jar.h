@@ -19,11 +19,19 @@
 #include <stdio.h>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+#include "src/main/cpp/util/output_digest.h"
 #include "src/tools/singlejar/combiners.h"
+#include "src/tools/singlejar/entry_index.h"
+#include "src/tools/singlejar/mapped_file.h"
+#include "src/tools/singlejar/name_filter.h"
 #include "src/tools/singlejar/options.h"
+#include "src/tools/singlejar/profiler.h"
+#include "src/tools/singlejar/relink_index.h"
+
+class JarPrefetcher;
+struct PreparedJar;
 
 /*
  * Jar file we are writing.
@@ -59,54 +67,190 @@ class OutputJar {
   }
   // True if an entry with given name have not been added to this archive.
   bool NewEntry(const std::string& entry_name) {
-    return known_members_.count(entry_name) == 0;
+    return known_members_.Find(entry_name) == nullptr;
   }
 
  private:
+  friend class JarPrefetcher;
+
+  // Returns true if the input entry with given name should not be copied
+  // to the output at all.
+  bool IgnoredEntry(const char *file_name, size_t file_name_length) const;
+  // Returns true if the plain file entry with given name should not be
+  // compressed on output even if the compression is requested.
+  bool NoCompress(const char *file_name, size_t file_name_length) const {
+    return nocompress_suffixes_.Matches(file_name, file_name_length);
+  }
+  // Returns true if the plain file input entry should be compressed on output.
+  bool OutputCompressed(const CDH *jar_entry) const;
+  // Returns the alignment the data of the entry with given name should have
+  // on output if the entry is stored, 0 if none.
+  int StoredAlignment(const char *file_name, size_t file_name_length) const;
+  // Returns the size of the Alignment Extra Field to append to the local
+  // header of the stored entry to align its data, which would otherwise start
+  // at 'data_position' on output. Returns 0 if no padding is needed.
+  size_t AlignmentPadding(const LH *lh, off_t data_position) const;
+  // Appends the Alignment Extra Field of 'padding' bytes to the extra fields
+  // of the local header. The header should have room for it.
+  void PadLocalHeader(LH *lh, size_t padding) const;
+  // Decompresses or compresses the contents of the given plain file entry,
+  // returns the output entry (see Combiner::OutputEntry).
+  static void *Recompress(const CDH *jar_entry, const LH *lh,
+                          bool output_compressed, Profiler *profiler);
+  // Set up the filters and combiners, open the output jar and write the
+  // launcher, the first steps of Doit().
+  void Begin();
+  // Write the entries which precede those of the input jars: META-INF/, the
+  // manifest, the build properties and the classpath resources.
+  void WriteLeadingEntries();
+  // Open the --also_output jars, and write their leading entries.
+  void BeginAlsoOutputs();
   // Open output jar.
   bool Open();
+  // Map the previous output and read its relink index, returns true if its
+  // sections can be reused.
+  bool OpenPrevious();
+  // Copy the entries of the given section of the previous output and their
+  // Central Directory Headers. Returns false if the section is not valid.
+  bool ReuseSection(const RelinkIndex::JarSection &section);
+  // Copy the --java_launcher to the output.
+  void AppendLauncher();
+  // Write the --launcher_descriptor for the --java_launcher.
+  void WriteLauncherDescriptor();
+  // Copy the input jar after the --java_launcher to the output, and the
+  // Central Directory Headers of the jar, adjusting their offsets.
+  void Assemble();
+  // An input jar entry to be copied to the output.
+  struct KeptEntry {
+    const CDH *cdh;
+    const LH *lh;
+    size_t index;  // The position of the entry in the Central Directory.
+  };
   // Add the contents of the given input jar.
   bool AddJar(int jar_path_index);
+  // Same, for the input jar that has been already opened (and possibly
+  // had some of its entries recompressed) by a JarPrefetcher thread. The
+  // contents are added to the --also_output jars, too, and the input jar is
+  // closed.
+  bool AddJar(int jar_path_index, PreparedJar *prepared_jar);
+  // Add the contents of the given open input jar to this output only.
+  void CopyJar(int jar_path_index, PreparedJar *prepared_jar);
+  // Add the contents of all input jars, in the --entry_order other than the
+  // input one.
+  void AddJarsInEntryOrder();
+  // Decide which entries of the given input jar are to be copied to the
+  // output, feeding the rest to the combiners (first entry with given name
+  // wins).
+  void ScanJar(int jar_path_index, PreparedJar *prepared_jar,
+               std::vector<KeptEntry> *kept_entries);
+  // Copy given entries of the input jar to the output, adding their Central
+  // Directory Headers.
+  void WriteEntries(int jar_path_index, PreparedJar *prepared_jar,
+                    const KeptEntry *begin, const KeptEntry *end);
   // Returns the current output position.
   off_t Position();
   // Write Jar entry.
   void WriteEntry(void *local_header_and_payload);
+  // Write the entry created by the combiner.
+  void WriteCombinedEntry(Combiner *combiner, bool compress);
   // Write META_INF/ entry (the first entry on output).
   void WriteMetaInf();
+  // Write META-INF/INDEX.LIST, listing the directories of the entries
+  // written so far.
+  void WriteIndexList();
   // Append given Central Directory Header to CEN (Central Directory) buffer.
   CDH *AppendToDirectoryBuffer(const CDH *cdh);
   // Reserve space in CEN buffer.
   uint8_t *ReserveCdr(size_t chunk_size);
   // Reserve space for the Central Directory Header in CEN buffer.
   uint8_t *ReserveCdh(size_t size);
+  // Make sure the next 'size' bytes of the CEN buffer are reserved in a
+  // single chunk.
+  void PreallocateCdr(size_t size);
   // Close output.
   bool Close();
+  // Close(), as a span of the trace, followed by the entry counts.
+  void TracedClose();
   // Set classpath resource with given resource name and path.
   void ClasspathResource(const std::string& resource_name,
                          const std::string& resource_path);
   // Copy 'count' bytes starting at 'offset' from the given file.
   ssize_t AppendFile(int in_fd, off_t offset, size_t count);
-  // Write bytes to the output file, return true on success.
-  bool WriteBytes(const void *buffer, size_t count);
+  // Make the output file share the blocks of the given file of 'count' bytes
+  // (reflink). Possible only at the beginning of the output, and only if the
+  // filesystem supports it. Returns true on success.
+  bool CloneFile(int in_fd, size_t count);
+  // Write bytes to the output file, return true on success. The time it takes
+  // is counted as the given phase.
+  bool WriteBytes(const void *buffer, size_t count,
+                  Profiler::Phase phase = Profiler::kWrite);
+  // Make sure the mapped output has room for 'count' more bytes at the
+  // current position, extending the file and the mapping if necessary.
+  bool ReserveOutput(size_t count);
+  // Extend the output file and its mapping to 'size' bytes.
+  bool ResizeMappedOutput(size_t size);
 
 
   Options *options_;
   struct EntryInfo {
-    EntryInfo(Combiner *combiner, int index = -1)
-        : combiner_(combiner), input_jar_index_(index) {}
+    EntryInfo(Combiner *combiner = nullptr, int index = -1, uint32_t crc32 = 0,
+              uint64_t size = 0)
+        : combiner_(combiner),
+          input_jar_index_(index),
+          crc32_(crc32),
+          size_(size) {}
     Combiner *combiner_;
     int input_jar_index_;  // Input jar index for the plain entry or -1.
+    // The checksum and the uncompressed size of the plain entry.
+    uint32_t crc32_;
+    uint64_t size_;
   };
 
-  std::unordered_map<std::string, struct EntryInfo> known_members_;
+  EntryIndex<struct EntryInfo> known_members_;
+  // The signature files, which are never copied.
+  NameFilter signature_suffixes_;
+  // Compiled --include_prefixes and --nocompress_suffixes.
+  NameFilter include_prefixes_;
+  NameFilter nocompress_suffixes_;
+  // The output file descriptor. A regular output file is mapped at
+  // mapped_output_ and written to directly (the file is preallocated and
+  // trimmed to the actual size on Close()), any other file is written to
+  // through file_.
+  int fd_;
   FILE *file_;
+  uint8_t *mapped_output_;
+  size_t mapped_size_;
   off_t outpos_;
   std::unique_ptr<char[]> buffer_;
   int entries_;
   int duplicate_entries_;
-  uint8_t *cen_;
+  // The duplicates which differ from the first entry with the same name.
+  int conflicting_entries_;
+  // CEN buffer. It is a list of chunks which are never reallocated, so that
+  // a Central Directory Header stays where it has been written, and is
+  // written out chunk by chunk.
+  struct CenChunk {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+  };
+  std::vector<CenChunk> cen_chunks_;
   size_t cen_size_;
-  size_t cen_capacity_;
+  // Whether AppendFile should try copy_file_range() and sendfile().
+  bool use_copy_file_range_;
+  bool use_sendfile_;
+  // The digest of the bytes written so far, with --output_digest. Every
+  // byte then goes through WriteBytes() or the pread() of AppendFile(), never
+  // straight from file to file in the kernel.
+  std::unique_ptr<blaze_util::OutputDigest> digest_;
+  FILE *duplicates_report_;
+  // Whether the input jars sections are tracked (see RelinkIndex).
+  bool relink_;
+  RelinkIndex output_index_;
+  RelinkIndex previous_index_;
+  MappedFile previous_output_;
+  int reused_jars_;
+  Profiler profiler_;
   Concatenator spring_handlers_;
   Concatenator spring_schemas_;
   Concatenator protobuf_meta_handler_;
@@ -116,6 +260,10 @@ class OutputJar {
   std::vector<std::unique_ptr<Concatenator> > service_handlers_;
   std::vector<std::unique_ptr<Concatenator> > classpath_resources_;
   std::vector<std::unique_ptr<Combiner> > extra_combiners_;
+  // The --also_output jars and their options. They are plain OutputJars,
+  // without the ExtraHandler() of a subclass.
+  std::vector<std::unique_ptr<Options> > also_options_;
+  std::vector<std::unique_ptr<OutputJar> > also_outputs_;
 };
 
 #endif  //   SRC_TOOLS_SINGLEJAR_COMBINED_JAR_H_
@@ -13,12 +13,17 @@
 // limitations under the License.
 
 #include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <thread>
 
 #include "src/main/cpp/blaze_util.h"
 #include "src/main/cpp/util/file.h"
 #include "src/main/cpp/util/port.h"
 #include "src/main/cpp/util/strings.h"
 #include "src/tools/singlejar/input_jar.h"
+#include "src/tools/singlejar/jar_index.h"
 #include "src/tools/singlejar/options.h"
 #include "src/tools/singlejar/output_jar.h"
 #include "src/tools/singlejar/test_util.h"
@@ -30,6 +35,7 @@
 
 namespace {
 
+using singlejar_test_util::AllocateFile;
 using singlejar_test_util::CreateTextFile;
 using singlejar_test_util::GetEntryContents;
 using singlejar_test_util::GetEntryContents;
@@ -241,6 +247,93 @@ TEST_F(OutputJarSimpleTest, JavaLauncher) {
   input_jar.Close();
 }
 
+// Verify --java_launcher argument with the launcher too large to be copied
+// in a single chunk.
+TEST_F(OutputJarSimpleTest, LargeJavaLauncher) {
+  string out_path = OutputFilePath("out.jar");
+  string launcher_path = OutputFilePath("launcher");
+  const size_t kLauncherSize = 5 * 1024 * 1024 + 17;
+  ASSERT_TRUE(AllocateFile(launcher_path, kLauncherSize));
+  CreateOutput(out_path, {"--java_launcher", launcher_path, "--sources",
+                          DATA_DIR_TOP "src/tools/singlejar/libtest1.jar"});
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(out_path.c_str()));
+  const LH *lh;
+  const CDH *cdh;
+  cdh = input_jar.NextEntry(&lh);
+  ASSERT_NE(nullptr, cdh);
+  EXPECT_TRUE(cdh->is());
+  EXPECT_TRUE(lh->is());
+  EXPECT_EQ(kLauncherSize, cdh->local_header_offset());
+  input_jar.Close();
+}
+
+// Verify that with --launcher_descriptor the launcher is only described, and
+// that --assemble then produces the same executable as --java_launcher alone.
+TEST_F(OutputJarSimpleTest, LauncherDescriptor) {
+  string jar_path = OutputFilePath("out.jar");
+  string descriptor_path = OutputFilePath("out.launcher");
+  string launcher_path = OutputFilePath("launcher");
+  const size_t kLauncherSize = 1024 * 1024 + 17;
+  ASSERT_TRUE(AllocateFile(launcher_path, kLauncherSize));
+  CreateOutput(jar_path, {"--java_launcher", launcher_path,
+                          "--launcher_descriptor", descriptor_path,
+                          "--exclude_build_data", "--normalize", "--sources",
+                          DATA_DIR_TOP "src/tools/singlejar/libtest1.jar"});
+  string descriptor;
+  ASSERT_TRUE(blaze::ReadFile(descriptor_path, &descriptor));
+  EXPECT_EQ("java_launcher=" + launcher_path + "\njava_launcher_size=" +
+                std::to_string(kLauncherSize) + "\n",
+            descriptor);
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(jar_path));
+  const LH *lh;
+  ASSERT_NE(nullptr, input_jar.NextEntry(&lh));
+  EXPECT_EQ(0, input_jar.LocalHeaderOffset(lh));
+  input_jar.Close();
+
+  string assembled_path = OutputFilePath("assembled.jar");
+  {
+    Options options;
+    OutputJar output_jar;
+    const char *option_list[] = {"--output", assembled_path.c_str(),
+                                 "--java_launcher", launcher_path.c_str(),
+                                 "--assemble", "--sources", jar_path.c_str()};
+    options.ParseCommandLine(arraysize(option_list), option_list);
+    ASSERT_EQ(0, output_jar.Doit(&options));
+  }
+  string expected_path = OutputFilePath("expected.jar");
+  {
+    Options options;
+    OutputJar output_jar;
+    const char *option_list[] = {
+        "--output", expected_path.c_str(), "--java_launcher",
+        launcher_path.c_str(), "--exclude_build_data", "--normalize",
+        "--sources", DATA_DIR_TOP "src/tools/singlejar/libtest1.jar"};
+    options.ParseCommandLine(arraysize(option_list), option_list);
+    ASSERT_EQ(0, output_jar.Doit(&options));
+  }
+  string assembled, expected;
+  ASSERT_TRUE(blaze::ReadFile(assembled_path, &assembled));
+  ASSERT_TRUE(blaze::ReadFile(expected_path, &expected));
+  EXPECT_TRUE(assembled == expected);
+  EXPECT_EQ(0, VerifyZip(assembled_path));
+}
+
+// The entries of the input jar with a preamble whose offsets have not been
+// adjusted (i.e., a launcher concatenated with a jar) are copied correctly.
+TEST_F(OutputJarSimpleTest, PreambledSource) {
+  string preamble_path = CreateTextFile("preamble", "#!/bin/sh\nexit 0\n");
+  string preambled_path = OutputFilePath("preambled.jar");
+  ASSERT_EQ(0, RunCommand("cat", preamble_path.c_str(), kPathLibData1, ">",
+                          preambled_path.c_str(), nullptr));
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path, {"--sources", preambled_path});
+  const char kEntry[] = "tools/singlejar/data/extra_file1";
+  EXPECT_EQ(GetEntryContents(kPathLibData1, kEntry),
+            GetEntryContents(out_path, kEntry));
+}
+
 // --main_class option.
 TEST_F(OutputJarSimpleTest, MainClass) {
   string out_path = OutputFilePath("out.jar");
@@ -273,10 +366,31 @@ TEST_F(OutputJarSimpleTest, DeployManifestLines) {
 TEST_F(OutputJarSimpleTest, ExtraBuildInfo) {
   string out_path = OutputFilePath("out.jar");
   CreateOutput(out_path, {"--extra_build_info", "property1=value1",
-                          "--extra_build_info", "property2=value2"});
+                          "--extra_build_info", "property2=value2",
+                          "--extra_build_info", "property1=value3"});
   string build_properties = GetEntryContents(out_path, "build-data.properties");
-  EXPECT_PRED2(HasSubstr, build_properties, "\nproperty1=value1\n");
+  EXPECT_PRED2(HasSubstr, build_properties, "\nproperty1=value3\n");
   EXPECT_PRED2(HasSubstr, build_properties, "\nproperty2=value2\n");
+  // The duplicate property takes the last value.
+  EXPECT_FALSE(HasSubstr(build_properties, "property1=value1"));
+}
+
+// A property set again by --extra_build_info or --build_info_file is written
+// once, with its last value.
+TEST_F(OutputJarSimpleTest, BuildInfoOverride) {
+  string build_info_path = CreateTextFile(
+      "buildinfo", "# comment\nproperty=value2\nbuild.target=target2\n");
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path, {"--extra_build_info", "build.target=target1",
+                          "--extra_build_info", "property=value1",
+                          "--build_info_file", build_info_path});
+  string build_properties = GetEntryContents(out_path, "build-data.properties");
+  EXPECT_PRED2(HasSubstr, build_properties, "# comment\n");
+  EXPECT_PRED2(HasSubstr, build_properties, "\nproperty=value2\n");
+  // build.target stays the first property.
+  EXPECT_EQ(0, build_properties.find("build.target=target2\n"));
+  EXPECT_FALSE(HasSubstr(build_properties, "value1")) << build_properties;
+  EXPECT_FALSE(HasSubstr(build_properties, "target1")) << build_properties;
 }
 
 // --build_info_file and --extra_build_info options.
@@ -534,6 +648,41 @@ TEST_F(OutputJarSimpleTest, Services) {
             GetEntryContents(out_path, "META-INF/spring.handlers"));
 }
 
+// --duplicates_report lists the duplicates which differ from the first entry.
+TEST_F(OutputJarSimpleTest, DuplicatesReport) {
+  string out_dir = OutputFilePath("");
+  CreateTextFile("dup/same", "same\n");
+  CreateTextFile("dup/different", "first\n");
+  ASSERT_EQ(0, RunCommand("cd", out_dir.c_str(), ";", "zip", "-mr",
+                          "dups1.zip", "dup", nullptr));
+  CreateTextFile("dup/same", "same\n");
+  CreateTextFile("dup/different", "second\n");
+  ASSERT_EQ(0, RunCommand("cd", out_dir.c_str(), ";", "zip", "-mr",
+                          "dups2.zip", "dup", nullptr));
+  string zip1_path = OutputFilePath("dups1.zip");
+  string zip2_path = OutputFilePath("dups2.zip");
+  string report_path = OutputFilePath("duplicates");
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path, {"--duplicates_report", report_path, "--sources",
+                          zip1_path, zip2_path});
+  EXPECT_EQ("first\n", GetEntryContents(out_path, "dup/different"));
+  string report;
+  ASSERT_TRUE(blaze::ReadFile(report_path, &report));
+  EXPECT_EQ(0, report.find("dup/different\t" + zip1_path + "\t"));
+  EXPECT_TRUE(HasSubstr(report, "\t" + zip2_path + "\t"));
+  EXPECT_EQ(report.size() - 1, report.find('\n'));
+}
+
+// --allow_identical_duplicates makes --no_duplicates accept the duplicates
+// identical to the first entry.
+TEST_F(OutputJarSimpleTest, AllowIdenticalDuplicates) {
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path, {"--no_duplicates", "--allow_identical_duplicates",
+                          "--sources", kPathLibData1, kPathLibData2});
+  EXPECT_FALSE(
+      GetEntryContents(out_path, "tools/singlejar/data/extra_file1").empty());
+}
+
 // Test that in the absence of the compression option all the plain files in
 // the output archive are not compressed but just stored.
 TEST_F(OutputJarSimpleTest, NoCompressionOption) {
@@ -675,4 +824,333 @@ TEST_F(OutputJarSimpleTest, Nocompress) {
   input_jar.Close();
 }
 
+// Test that --stored_alignment aligns the data of the stored entries, both
+// the copied and the decompressed ones, and that --page_align_native_libs
+// aligns the data of the stored .so entries to 4096.
+TEST_F(OutputJarSimpleTest, StoredAlignment) {
+  string res1_path = CreateTextFile("resource.foo", "line1\nline2\n");
+  string res2_path = CreateTextFile("libfoo.so", "line1\nline2\n");
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path,
+               {"--normalize", "--sources",
+                DATA_DIR_TOP "src/tools/singlejar/stored.jar",
+                DATA_DIR_TOP "src/tools/singlejar/libtest1.jar", "--resources",
+                res1_path, res2_path, "--nocompress_suffixes", ".foo", ".so",
+                ".h", "--compression", "--stored_alignment", "4",
+                "--page_align_native_libs"});
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(out_path));
+  const LH *lh;
+  const CDH *cdh;
+  int stored_entries = 0;
+  while ((cdh = input_jar.NextEntry(&lh))) {
+    if (cdh->compression_method() != Z_NO_COMPRESSION ||
+        lh->file_name()[lh->file_name_length() - 1] == '/') {
+      continue;
+    }
+    ++stored_entries;
+    uint64_t data_offset = input_jar.LocalHeaderOffset(lh) + lh->size();
+    string name = lh->file_name_string();
+    if (name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0) {
+      EXPECT_EQ(0, data_offset % 4096) << name;
+    } else {
+      EXPECT_EQ(0, data_offset % 4) << name;
+    }
+  }
+  input_jar.Close();
+  EXPECT_LT(2, stored_entries);
+}
+
+// Test that --jobs produces exactly the same output as the serial run.
+TEST_F(OutputJarSimpleTest, Jobs) {
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path,
+               {"--normalize", "--compression", "--sources",
+                DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                DATA_DIR_TOP "src/tools/singlejar/stored.jar", kPathLibData1,
+                kPathLibData2});
+  string serial_output;
+  ASSERT_TRUE(blaze::ReadFile(out_path, &serial_output));
+
+  Options parallel_options;
+  OutputJar parallel_output_jar;
+  const char *option_list[] = {"--output", out_path.c_str(),
+                               "--normalize", "--compression",
+                               "--jobs", "4",
+                               "--sources",
+                               DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                               DATA_DIR_TOP "src/tools/singlejar/stored.jar",
+                               kPathLibData1, kPathLibData2};
+  parallel_options.ParseCommandLine(arraysize(option_list), option_list);
+  ASSERT_EQ(0, parallel_output_jar.Doit(&parallel_options));
+  EXPECT_EQ(0, VerifyZip(out_path));
+  string parallel_output;
+  ASSERT_TRUE(blaze::ReadFile(out_path, &parallel_output));
+  EXPECT_TRUE(serial_output == parallel_output);
+}
+
+// Test that with --entry_order name the entries copied from the input jars
+// are sorted by name, and that they are the same entries as in the input
+// order.
+TEST_F(OutputJarSimpleTest, EntryOrder) {
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path,
+               {"--exclude_build_data", "--entry_order", "name", "--jobs", "2",
+                "--sources", DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                DATA_DIR_TOP "src/tools/singlejar/stored.jar",
+                DATA_DIR_TOP "src/tools/singlejar/libtest1.jar"});
+  std::vector<string> names;
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(out_path));
+  const LH *lh;
+  const CDH *cdh;
+  while ((cdh = input_jar.NextEntry(&lh))) {
+    names.push_back(cdh->file_name_string());
+  }
+  input_jar.Close();
+  // META-INF/ and the manifest come first.
+  ASSERT_LT(2, names.size());
+  EXPECT_EQ("META-INF/", names[0]);
+  EXPECT_EQ("META-INF/MANIFEST.MF", names[1]);
+  EXPECT_TRUE(std::is_sorted(names.begin() + 2, names.end()));
+
+  string input_order_path = OutputFilePath("input_order.jar");
+  Options options;
+  OutputJar output_jar;
+  const char *option_list[] = {
+      "--output", input_order_path.c_str(), "--exclude_build_data",
+      "--sources", DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+      DATA_DIR_TOP "src/tools/singlejar/stored.jar",
+      DATA_DIR_TOP "src/tools/singlejar/libtest1.jar"};
+  options.ParseCommandLine(arraysize(option_list), option_list);
+  ASSERT_EQ(0, output_jar.Doit(&options));
+  std::vector<string> input_order_names;
+  ASSERT_TRUE(input_jar.Open(input_order_path));
+  while ((cdh = input_jar.NextEntry(&lh))) {
+    input_order_names.push_back(cdh->file_name_string());
+  }
+  input_jar.Close();
+  std::sort(names.begin() + 2, names.end());
+  std::sort(input_order_names.begin() + 2, input_order_names.end());
+  EXPECT_EQ(input_order_names, names);
+}
+
+// --previous_output reuses the output of the unchanged inputs, and the result
+// is the same as the output of the full run.
+TEST_F(OutputJarSimpleTest, Relink) {
+  string out_path = OutputFilePath("out.jar");
+  string index_path = OutputFilePath("out.index");
+  string previous_path = OutputFilePath("previous.jar");
+  string previous_index_path = OutputFilePath("previous.index");
+  CreateOutput(out_path,
+               {"--normalize", "--output_index", index_path, "--sources",
+                DATA_DIR_TOP "src/tools/singlejar/libtest1.jar", kPathLibData1,
+                DATA_DIR_TOP "src/tools/singlejar/stored.jar"});
+  ASSERT_EQ(0, rename(out_path.c_str(), previous_path.c_str()));
+  ASSERT_EQ(0, rename(index_path.c_str(), previous_index_path.c_str()));
+
+  // Replace the second input.
+  Options relink_options;
+  OutputJar relink_output_jar;
+  const char *option_list[] = {"--output", out_path.c_str(),
+                               "--normalize",
+                               "--output_index", index_path.c_str(),
+                               "--previous_output", previous_path.c_str(),
+                               "--previous_index", previous_index_path.c_str(),
+                               "--sources",
+                               DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                               kPathLibData2,
+                               DATA_DIR_TOP "src/tools/singlejar/stored.jar"};
+  relink_options.ParseCommandLine(arraysize(option_list), option_list);
+  ASSERT_EQ(0, relink_output_jar.Doit(&relink_options));
+  EXPECT_EQ(0, VerifyZip(out_path));
+  string relinked_output;
+  ASSERT_TRUE(blaze::ReadFile(out_path, &relinked_output));
+  string relinked_index;
+  ASSERT_TRUE(blaze::ReadFile(index_path, &relinked_index));
+
+  Options full_options;
+  OutputJar full_output_jar;
+  // Same as above, without --previous_output and --previous_index.
+  const char *full_option_list[] = {
+      "--output", out_path.c_str(), "--normalize", "--output_index",
+      index_path.c_str(), "--sources",
+      DATA_DIR_TOP "src/tools/singlejar/libtest1.jar", kPathLibData2,
+      DATA_DIR_TOP "src/tools/singlejar/stored.jar"};
+  full_options.ParseCommandLine(arraysize(full_option_list), full_option_list);
+  ASSERT_EQ(0, full_output_jar.Doit(&full_options));
+  string full_output;
+  ASSERT_TRUE(blaze::ReadFile(out_path, &full_output));
+  string full_index;
+  ASSERT_TRUE(blaze::ReadFile(index_path, &full_index));
+  EXPECT_TRUE(relinked_output == full_output);
+  EXPECT_EQ(full_index, relinked_index);
+}
+
+// The output which is not a regular file (and hence cannot be mapped) is
+// written through stdio, with the same result.
+// --emit_index writes the jar index, which then provides the digest of the
+// jar as an input.
+TEST_F(OutputJarSimpleTest, EmitIndex) {
+  string lib_path = OutputFilePath("lib.jar");
+  CreateOutput(lib_path,
+               {"--emit_index", "--sources",
+                DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                kPathLibData1});
+  JarIndex jar_index;
+  ASSERT_TRUE(jar_index.Read(lib_path + JarIndex::kSuffix));
+  InputJar input_jar;
+  ASSERT_TRUE(input_jar.Open(lib_path));
+  EXPECT_TRUE(jar_index.Describes(&input_jar));
+  EXPECT_EQ(JarIndex::Digest(input_jar.mapped_start(), input_jar.mapped_size()),
+            jar_index.digest());
+  input_jar.Close();
+
+  Options relink_options;
+  OutputJar relink_output_jar;
+  string out_path = OutputFilePath("out.jar");
+  string index_path = OutputFilePath("out.index");
+  const char *option_list[] = {"--output", out_path.c_str(),
+                               "--output_index", index_path.c_str(),
+                               "--sources", lib_path.c_str()};
+  relink_options.ParseCommandLine(arraysize(option_list), option_list);
+  ASSERT_EQ(0, relink_output_jar.Doit(&relink_options));
+  string relink_index;
+  ASSERT_TRUE(blaze::ReadFile(index_path, &relink_index));
+  EXPECT_TRUE(HasSubstr(relink_index, "jar " + jar_index.digest() + " "));
+}
+
+// --emit_index_list writes META-INF/INDEX.LIST, listing the directories of
+// the entries, and drops that of the input jars.
+TEST_F(OutputJarSimpleTest, EmitIndexList) {
+  string res1_path = CreateTextFile("res1", "res1\n");
+  string res2_path = CreateTextFile("res2", "res2\n");
+  string res3_path = CreateTextFile("res3", "res3\n");
+  string lib_path = OutputFilePath("lib.jar");
+  CreateOutput(lib_path,
+               {"--emit_index_list", "--exclude_build_data", "--resources",
+                res1_path + ":com/foo/bar/B.txt", res2_path + ":top.txt",
+                res3_path + ":com/foo/A.txt"});
+  EXPECT_EQ(
+      "JarIndex-Version: 1.0\n\n"
+      "lib.jar\ncom/foo\ncom/foo/bar\ntop.txt\n\n",
+      GetEntryContents(lib_path, "META-INF/INDEX.LIST"));
+
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path, {"--emit_index_list", "--exclude_build_data",
+                          "--sources", lib_path});
+  EXPECT_EQ(
+      "JarIndex-Version: 1.0\n\n"
+      "out.jar\ncom/foo\ncom/foo/bar\ntop.txt\n\n",
+      GetEntryContents(out_path, "META-INF/INDEX.LIST"));
+}
+
+// --verify_crc accepts the intact entries and rejects the corrupted ones.
+TEST_F(OutputJarSimpleTest, VerifyCrc) {
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path,
+               {"--verify_crc", "--sources",
+                DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                DATA_DIR_TOP "src/tools/singlejar/stored.jar"});
+
+  string out_dir = OutputFilePath("");
+  string zip_path = OutputFilePath("corrupted.zip");
+  unlink(zip_path.c_str());
+  CreateTextFile("crc/entry", "checksummed contents\n");
+  ASSERT_EQ(0, RunCommand("cd", out_dir.c_str(), ";", "zip", "-0mr",
+                          "corrupted.zip", "crc", nullptr));
+  string zip_contents;
+  ASSERT_TRUE(blaze::ReadFile(zip_path, &zip_contents));
+  size_t pos = zip_contents.find("checksummed");
+  ASSERT_NE(string::npos, pos);
+  zip_contents[pos] = 'C';
+  ASSERT_TRUE(blaze::WriteFile(zip_contents, zip_path));
+  Options corrupted_options;
+  OutputJar corrupted_output_jar;
+  const char *option_list[] = {"--output", out_path.c_str(), "--verify_crc",
+                               "--sources", zip_path.c_str()};
+  corrupted_options.ParseCommandLine(arraysize(option_list), option_list);
+  EXPECT_EXIT(corrupted_output_jar.Doit(&corrupted_options),
+              ::testing::ExitedWithCode(1), "Checksum mismatch for crc/entry");
+}
+
+// Test that each --also_output written in the same pass is the same as the
+// output of a separate run with its options.
+TEST_F(OutputJarSimpleTest, AlsoOutput) {
+  string out_path = OutputFilePath("out.jar");
+  string classes_path = OutputFilePath("classes.jar");
+  string resources_path = OutputFilePath("resources.jar");
+  CreateOutput(out_path,
+               {"--normalize", "--compression", "--jobs", "2", "--sources",
+                DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                DATA_DIR_TOP "src/tools/singlejar/stored.jar", kPathLibData1,
+                kPathLibData2, "--also_output", classes_path,
+                "--include_prefixes", "com", "--compression", "--also_output",
+                resources_path, "--include_prefixes", "tools/singlejar/data",
+                "--dont_change_compression"});
+  EXPECT_EQ(0, VerifyZip(classes_path));
+  EXPECT_EQ(0, VerifyZip(resources_path));
+  std::vector<std::pair<string, std::vector<string>>> separate_runs = {
+      {out_path, {"--compression"}},
+      {classes_path, {"--include_prefixes", "com", "--compression"}},
+      {resources_path,
+       {"--include_prefixes", "tools/singlejar/data",
+        "--dont_change_compression"}}};
+  for (auto &run : separate_runs) {
+    string also_output;
+    ASSERT_TRUE(blaze::ReadFile(run.first, &also_output));
+    Options separate_options;
+    OutputJar separate_output_jar;
+    std::vector<const char *> option_list = {
+        "--output", run.first.c_str(), "--normalize", "--sources",
+        DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+        DATA_DIR_TOP "src/tools/singlejar/stored.jar", kPathLibData1,
+        kPathLibData2};
+    for (auto &arg : run.second) {
+      option_list.push_back(arg.c_str());
+    }
+    separate_options.ParseCommandLine(option_list.size(), option_list.data());
+    ASSERT_EQ(0, separate_output_jar.Doit(&separate_options));
+    string separate_output;
+    ASSERT_TRUE(blaze::ReadFile(run.first, &separate_output));
+    EXPECT_TRUE(also_output == separate_output) << run.first;
+  }
+}
+
+TEST_F(OutputJarSimpleTest, OutputToPipe) {
+  string out_path = OutputFilePath("out.jar");
+  CreateOutput(out_path,
+               {"--exclude_build_data", "--sources",
+                DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                kPathLibData1});
+  string mapped_output;
+  ASSERT_TRUE(blaze::ReadFile(out_path, &mapped_output));
+
+  string pipe_path = OutputFilePath("out.pipe");
+  unlink(pipe_path.c_str());
+  ASSERT_EQ(0, mkfifo(pipe_path.c_str(), 0600));
+  string piped_output;
+  std::thread reader([&pipe_path, &piped_output]() {
+    FILE *fp = fopen(pipe_path.c_str(), "r");
+    char buffer[4096];
+    size_t n;
+    while (fp != nullptr && (n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+      piped_output.append(buffer, n);
+    }
+    if (fp != nullptr) {
+      fclose(fp);
+    }
+  });
+  Options pipe_options;
+  OutputJar pipe_output_jar;
+  const char *option_list[] = {"--output", pipe_path.c_str(),
+                               "--exclude_build_data", "--sources",
+                               DATA_DIR_TOP "src/tools/singlejar/libtest1.jar",
+                               kPathLibData1};
+  pipe_options.ParseCommandLine(arraysize(option_list), option_list);
+  EXPECT_EQ(0, pipe_output_jar.Doit(&pipe_options));
+  reader.join();
+  EXPECT_TRUE(mapped_output == piped_output);
+}
+
 }  // namespace
@@ -0,0 +1,100 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/profiler.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "src/main/cpp/util/strings.h"
+#include "src/tools/singlejar/diag.h"
+
+using blaze_util::AppendJsonString;
+
+static const char *const kPhaseNames[] = {
+    "open",  "scan",  "hash", "merge", "inflate", "deflate",
+    "write", "central_directory"};
+
+static const char *const kCounterNames[] = {"copied", "reused", "recompressed",
+                                            "combined"};
+
+static double Milliseconds(uint64_t ns) { return ns / 1e6; }
+
+Profiler::Profiler() : enabled_(false), start_(0) {
+  for (auto &phase_ns : phase_ns_) {
+    phase_ns = 0;
+  }
+  for (auto &counter : counters_) {
+    counter = 0;
+  }
+}
+
+void Profiler::AddJar(const std::string &path, uint64_t start,
+                      uint64_t entries, uint64_t bytes) {
+  if (enabled_) {
+    jars_.push_back(JarProfile{path, Now() - start, entries, bytes});
+  }
+}
+
+bool Profiler::Write(const std::string &path, const std::string &output_jar,
+                     int threads) const {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    usage.ru_maxrss = 0;
+  }
+#if defined(__APPLE__)
+  // It is in bytes on macOS.
+  usage.ru_maxrss /= 1024;
+#endif
+
+  FILE *fp = fopen(path.c_str(), "w");
+  if (fp == nullptr) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path.c_str());
+    return false;
+  }
+  std::string literal;
+  AppendJsonString(&literal, output_jar);
+  fprintf(fp, "{\n  \"output\": %s,\n", literal.c_str());
+  fprintf(fp, "  \"threads\": %d,\n", threads);
+  fprintf(fp, "  \"wall_time_ms\": %.3f,\n", Milliseconds(Now() - start_));
+  fprintf(fp, "  \"peak_rss_kb\": %ld,\n", static_cast<long>(usage.ru_maxrss));
+  fprintf(fp, "  \"phases_ms\": {");
+  for (int phase = 0; phase < kPhaseCount; ++phase) {
+    fprintf(fp, "%s\"%s\": %.3f", phase ? ", " : "", kPhaseNames[phase],
+            Milliseconds(phase_ns_[phase]));
+  }
+  fprintf(fp, "},\n  \"bytes\": {");
+  for (int counter = 0; counter < kCounterCount; ++counter) {
+    fprintf(fp, "%s\"%s\": %" PRIu64, counter ? ", " : "",
+            kCounterNames[counter], counters_[counter].load());
+  }
+  fprintf(fp, "},\n  \"jars\": [");
+  for (size_t i = 0; i < jars_.size(); ++i) {
+    const JarProfile &jar = jars_[i];
+    literal.clear();
+    AppendJsonString(&literal, jar.path);
+    fprintf(fp, "%s\n    {\"path\": %s", i ? "," : "", literal.c_str());
+    fprintf(fp,
+            ", \"time_ms\": %.3f, \"entries\": %" PRIu64 ", \"bytes\": %" PRIu64
+            "}",
+            Milliseconds(jar.time_ns), jar.entries, jar.bytes);
+  }
+  fprintf(fp, "%s]\n}\n", jars_.empty() ? "" : "\n  ");
+  if (ferror(fp) | fclose(fp)) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path.c_str());
+    return false;
+  }
+  return true;
+}
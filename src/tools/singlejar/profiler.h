@@ -0,0 +1,133 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_TOOLS_SINGLEJAR_PROFILER_H_
+#define BAZEL_SRC_TOOLS_SINGLEJAR_PROFILER_H_ 1
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/*
+ * Collects the time spent in each phase of creating the output jar, the
+ * number of bytes written in each way and the time spent on each input jar,
+ * and writes them as a JSON report:
+ *   {
+ *     "output": "<OUTPUT JAR>",
+ *     "threads": <N>,
+ *     "wall_time_ms": <MS>,
+ *     "peak_rss_kb": <KB>,
+ *     "phases_ms": {"open": <MS>, "scan": <MS>, ...},
+ *     "bytes": {"copied": <N>, "reused": <N>, ...},
+ *     "jars": [{"path": "<PATH>", "time_ms": <MS>, "entries": <N>,
+ *               "bytes": <N>}, ...]
+ *   }
+ * The phase times are summed over all threads, the input jar times are the
+ * times the main thread spent adding each jar to the output.
+ * All the methods do nothing until the profiler is enabled. The methods
+ * updating phases and byte counters can be called from any thread.
+ */
+class Profiler {
+ public:
+  enum Phase {
+    kOpen,              // Opening and mapping input jars.
+    kScan,              // Scanning the Central Directory of input jars.
+    kHash,              // Computing input jar digests for the relink index.
+    kMerge,             // Merging the input entries into the combiners.
+    kInflate,           // Reading the entries being recompressed.
+    kDeflate,           // Compressing the recompressed and combined entries.
+    kWrite,             // Writing the entries.
+    kCentralDirectory,  // Writing the Central Directory.
+    kPhaseCount
+  };
+
+  enum Counter {
+    kBytesCopied,        // Entries copied verbatim from input jars.
+    kBytesReused,        // Entries copied from the previous output.
+    kBytesRecompressed,  // Recompressed entries.
+    kBytesCombined,      // Entries created by the combiners.
+    kCounterCount
+  };
+
+  // Measures the time from its creation to its destruction.
+  class Timer {
+   public:
+    Timer(Profiler *profiler, Phase phase)
+        : profiler_(profiler), phase_(phase), start_(profiler->Now()) {}
+    ~Timer() { profiler_->AddTime(phase_, start_); }
+
+   private:
+    Profiler *profiler_;
+    Phase phase_;
+    uint64_t start_;
+  };
+
+  Profiler();
+
+  void Enable() {
+    enabled_ = true;
+    start_ = Now();
+  }
+
+  bool enabled() const { return enabled_; }
+
+  // Returns the current time in nanoseconds, or 0 if not enabled.
+  uint64_t Now() const {
+    return enabled_ ? std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count()
+                    : 0;
+  }
+
+  // Adds the time since 'start' (obtained from Now()) to the phase.
+  void AddTime(Phase phase, uint64_t start) {
+    if (enabled_) {
+      phase_ns_[phase] += Now() - start;
+    }
+  }
+
+  void AddBytes(Counter counter, uint64_t bytes) {
+    if (enabled_) {
+      counters_[counter] += bytes;
+    }
+  }
+
+  // Records an input jar, the time since 'start' (obtained from Now()) is
+  // the time spent on it.
+  void AddJar(const std::string &path, uint64_t start, uint64_t entries,
+              uint64_t bytes);
+
+  // Writes the report, returns false on error.
+  bool Write(const std::string &path, const std::string &output_jar,
+             int threads) const;
+
+ private:
+  struct JarProfile {
+    std::string path;
+    uint64_t time_ns;
+    uint64_t entries;
+    uint64_t bytes;
+  };
+
+  bool enabled_;
+  uint64_t start_;
+  std::atomic<uint64_t> phase_ns_[kPhaseCount];
+  std::atomic<uint64_t> counters_[kCounterCount];
+  std::vector<JarProfile> jars_;
+};
+
+#endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_PROFILER_H_
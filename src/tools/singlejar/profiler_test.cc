@@ -0,0 +1,63 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/profiler.h"
+
+#include "src/main/cpp/blaze_util.h"
+#include "src/tools/singlejar/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using singlejar_test_util::OutputFilePath;
+
+using std::string;
+
+static bool HasSubstr(const string &s, const string &what) {
+  return string::npos != s.find(what);
+}
+
+// Disabled profiler does not measure anything.
+TEST(ProfilerTest, Disabled) {
+  Profiler profiler;
+  EXPECT_FALSE(profiler.enabled());
+  EXPECT_EQ(0, profiler.Now());
+}
+
+TEST(ProfilerTest, Report) {
+  Profiler profiler;
+  profiler.Enable();
+  EXPECT_TRUE(profiler.enabled());
+  {
+    Profiler::Timer timer(&profiler, Profiler::kDeflate);
+  }
+  profiler.AddBytes(Profiler::kBytesCopied, 1234);
+  profiler.AddBytes(Profiler::kBytesCopied, 1000);
+  profiler.AddJar("lib/a\"b.jar", profiler.Now(), 5, 100);
+  string report_path = OutputFilePath("profile.json");
+  ASSERT_TRUE(profiler.Write(report_path, "out.jar", 4));
+
+  string report;
+  ASSERT_TRUE(blaze::ReadFile(report_path, &report));
+  EXPECT_TRUE(HasSubstr(report, "\"output\": \"out.jar\"")) << report;
+  EXPECT_TRUE(HasSubstr(report, "\"threads\": 4")) << report;
+  EXPECT_TRUE(HasSubstr(report, "\"deflate\": ")) << report;
+  EXPECT_TRUE(HasSubstr(report, "\"central_directory\": ")) << report;
+  EXPECT_TRUE(HasSubstr(report, "\"copied\": 2234")) << report;
+  EXPECT_TRUE(HasSubstr(report, "{\"path\": \"lib/a\\\"b.jar\", \"time_ms\": "))
+      << report;
+  EXPECT_TRUE(HasSubstr(report, "\"entries\": 5, \"bytes\": 100}")) << report;
+}
+
+}  // namespace
@@ -0,0 +1,115 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/relink_index.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "src/tools/singlejar/diag.h"
+
+static const char kHeader[] = "singlejar-relink-index 1";
+
+bool RelinkIndex::Read(const std::string &path) {
+  FILE *fp = fopen(path.c_str(), "r");
+  if (fp == nullptr) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path.c_str());
+    return false;
+  }
+  options_digest_.clear();
+  cen_offset_ = 0;
+  sections_.clear();
+  by_path_.clear();
+
+  // The lines are short except for the paths, which cannot exceed PATH_MAX.
+  char line[8192];
+  char digest[100];
+  char entries_digest[100];
+  bool ok = fgets(line, sizeof(line), fp) &&
+            !strncmp(line, kHeader, strlen(kHeader)) &&
+            line[strlen(kHeader)] == '\n';
+  while (ok && fgets(line, sizeof(line), fp)) {
+    size_t line_length = strlen(line);
+    if (line_length == 0 || line[line_length - 1] != '\n') {
+      ok = false;
+      break;
+    }
+    line[--line_length] = '\0';
+    JarSection section;
+    int path_start = 0;
+    if (1 == sscanf(line, "options %99s", digest)) {
+      options_digest_ = digest;
+    } else if (1 == sscanf(line, "cen %" SCNu64, &cen_offset_)) {
+    } else if (7 == sscanf(line,
+                           "jar %99s %99s %" SCNu64 " %" SCNu64 " %" SCNu64
+                           " %" SCNu64 " %" SCNu64 " %n",
+                           digest, entries_digest, &section.start,
+                           &section.end, &section.cen_start, &section.cen_end,
+                           &section.entry_count, &path_start) &&
+               path_start > 0 && line[path_start] != '\0') {
+      section.path = line + path_start;
+      section.digest = digest;
+      section.entries_digest = entries_digest;
+      Add(section);
+    } else {
+      ok = false;
+    }
+  }
+  fclose(fp);
+  if (!ok) {
+    diag_warnx("%s:%d: %s is not a valid relink index", __FILE__, __LINE__,
+               path.c_str());
+    sections_.clear();
+    by_path_.clear();
+  }
+  return ok;
+}
+
+bool RelinkIndex::Write(const std::string &path) const {
+  FILE *fp = fopen(path.c_str(), "w");
+  if (fp == nullptr) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path.c_str());
+    return false;
+  }
+  fprintf(fp, "%s\n", kHeader);
+  fprintf(fp, "options %s\n", options_digest_.c_str());
+  fprintf(fp, "cen %" PRIu64 "\n", cen_offset_);
+  for (auto &section : sections_) {
+    fprintf(fp,
+            "jar %s %s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+            " %" PRIu64 " %s\n",
+            section.digest.c_str(), section.entries_digest.c_str(),
+            section.start, section.end, section.cen_start, section.cen_end,
+            section.entry_count, section.path.c_str());
+  }
+  if (ferror(fp) | fclose(fp)) {
+    diag_warn("%s:%d: %s", __FILE__, __LINE__, path.c_str());
+    return false;
+  }
+  return true;
+}
+
+const RelinkIndex::JarSection *RelinkIndex::Find(
+    const std::string &path, const std::string &digest,
+    const std::string &entries_digest) const {
+  auto range = by_path_.equal_range(path);
+  for (auto it = range.first; it != range.second; ++it) {
+    const JarSection &section = sections_[it->second];
+    if (section.digest == digest && section.entries_digest == entries_digest) {
+      return &section;
+    }
+  }
+  return nullptr;
+}
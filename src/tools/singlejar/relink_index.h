@@ -0,0 +1,95 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_TOOLS_SINGLEJAR_RELINK_INDEX_H_
+#define BAZEL_SRC_TOOLS_SINGLEJAR_RELINK_INDEX_H_ 1
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * The sidecar index of an output jar, allowing the next run to reuse the
+ * parts of this output produced from the unchanged inputs.
+ *
+ * For each input jar, the index records its digest, the digest of the list
+ * of its entries that have been copied to the output (which depends on the
+ * entries copied from the jars preceding it), the range of the output jar
+ * holding these entries and the range of the output Central Directory
+ * holding their headers. If an input jar has the same digest and ends up
+ * with the same list of copied entries in the next run, the bytes of both
+ * ranges are the same, save for the local header offsets in the Central
+ * Directory Headers.
+ *
+ * The index is a text file:
+ *   singlejar-relink-index 1
+ *   options <DIGEST>
+ *   cen <OFFSET>
+ *   jar <DIGEST> <DIGEST> <START> <END> <CEN_START> <CEN_END> <COUNT> <PATH>
+ *   ...
+ */
+class RelinkIndex {
+ public:
+  struct JarSection {
+    JarSection()
+        : start(0), end(0), cen_start(0), cen_end(0), entry_count(0) {}
+    std::string path;
+    std::string digest;          // The digest of the input jar.
+    std::string entries_digest;  // The digest of the copied entries list.
+    uint64_t start;              // The output range [start, end).
+    uint64_t end;
+    uint64_t cen_start;  // The Central Directory range [cen_start, cen_end),
+    uint64_t cen_end;    // relative to the start of the Central Directory.
+    uint64_t entry_count;
+  };
+
+  RelinkIndex() : cen_offset_(0) {}
+
+  // Reads the index from the file, returns false on error.
+  bool Read(const std::string &path);
+
+  // Writes the index to the file, returns false on error.
+  bool Write(const std::string &path) const;
+
+  // Returns the section for the jar with given path and digests or nullptr.
+  const JarSection *Find(const std::string &path, const std::string &digest,
+                         const std::string &entries_digest) const;
+
+  void Add(const JarSection &section) {
+    by_path_.emplace(section.path, sections_.size());
+    sections_.push_back(section);
+  }
+
+  // The digest of the options affecting the contents of the sections.
+  const std::string &options_digest() const { return options_digest_; }
+  void set_options_digest(const std::string &options_digest) {
+    options_digest_ = options_digest;
+  }
+
+  // The offset of the Central Directory in the output jar.
+  uint64_t cen_offset() const { return cen_offset_; }
+  void set_cen_offset(uint64_t cen_offset) { cen_offset_ = cen_offset; }
+
+  const std::vector<JarSection> &sections() const { return sections_; }
+
+ private:
+  std::string options_digest_;
+  uint64_t cen_offset_;
+  std::vector<JarSection> sections_;
+  std::unordered_multimap<std::string, size_t> by_path_;
+};
+
+#endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_RELINK_INDEX_H_
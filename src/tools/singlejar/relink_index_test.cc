@@ -0,0 +1,90 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tools/singlejar/relink_index.h"
+#include "src/tools/singlejar/test_util.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using singlejar_test_util::CreateTextFile;
+using singlejar_test_util::OutputFilePath;
+
+using std::string;
+
+static RelinkIndex::JarSection Section(const std::string &path,
+                                       const std::string &digest,
+                                       uint64_t start) {
+  RelinkIndex::JarSection section;
+  section.path = path;
+  section.digest = digest;
+  section.entries_digest = "e" + digest;
+  section.start = start;
+  section.end = start + 1000;
+  section.cen_start = start / 10;
+  section.cen_end = section.cen_start + 100;
+  section.entry_count = 2;
+  return section;
+}
+
+// Written index is read back.
+TEST(RelinkIndexTest, WriteRead) {
+  RelinkIndex index;
+  index.set_options_digest("options");
+  index.set_cen_offset(12345678901ULL);
+  index.Add(Section("lib/a.jar", "aaaa", 100));
+  index.Add(Section("lib/path with spaces.jar", "bbbb", 1100));
+  string path = OutputFilePath("index");
+  ASSERT_TRUE(index.Write(path));
+
+  RelinkIndex read_index;
+  ASSERT_TRUE(read_index.Read(path));
+  EXPECT_EQ("options", read_index.options_digest());
+  EXPECT_EQ(12345678901ULL, read_index.cen_offset());
+  ASSERT_EQ(2, read_index.sections().size());
+  const RelinkIndex::JarSection *section =
+      read_index.Find("lib/path with spaces.jar", "bbbb", "ebbbb");
+  ASSERT_NE(nullptr, section);
+  EXPECT_EQ(1100, section->start);
+  EXPECT_EQ(2100, section->end);
+  EXPECT_EQ(110, section->cen_start);
+  EXPECT_EQ(210, section->cen_end);
+  EXPECT_EQ(2, section->entry_count);
+}
+
+// Find() matches the path and both digests.
+TEST(RelinkIndexTest, Find) {
+  RelinkIndex index;
+  index.Add(Section("a.jar", "1111", 0));
+  index.Add(Section("a.jar", "2222", 1000));
+  EXPECT_EQ(nullptr, index.Find("b.jar", "1111", "e1111"));
+  EXPECT_EQ(nullptr, index.Find("a.jar", "3333", "e3333"));
+  EXPECT_EQ(nullptr, index.Find("a.jar", "1111", "e2222"));
+  const RelinkIndex::JarSection *section = index.Find("a.jar", "2222", "e2222");
+  ASSERT_NE(nullptr, section);
+  EXPECT_EQ(1000, section->start);
+}
+
+// Malformed index is rejected.
+TEST(RelinkIndexTest, BadIndex) {
+  RelinkIndex index;
+  EXPECT_FALSE(index.Read(OutputFilePath("no_such_index")));
+  EXPECT_FALSE(index.Read(CreateTextFile("bad_header", "index 1\n")));
+  EXPECT_FALSE(index.Read(CreateTextFile(
+      "bad_line", "singlejar-relink-index 1\noptions x\njar 1 2 3\n")));
+  EXPECT_TRUE(index.sections().empty());
+}
+
+}  // namespace
@@ -0,0 +1,478 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the time and the peak memory of OutputJar::Doit() on the inputs
+// of several typical shapes, generated reproducibly:
+//   classes   many small class files
+//   resources a few huge resources, recompressed on output
+//   services  META-INF/services entries merged from many jars
+//   zip64     a jar with more than 64K entries
+//   launcher  a big launcher preamble
+// in several modes:
+//   serial    default options
+//   jobs      --jobs with the number of CPUs
+//   relink    --previous_output, with one input changed since the previous
+//             output was created
+// Usage:
+//   singlejar_benchmark [--dir DIR] [--runs N] [--scale X]
+//                       [--shapes SHAPE,...] [--modes MODE,...]
+// prints a line per shape and mode: the best wall time out of N runs, the
+// throughput (output bytes per second) and the peak RSS of the run.
+// Each run is done in a child process, so that its peak RSS is its own.
+// The inputs are generated into DIR (the default is $TEST_TMPDIR or /tmp).
+// --scale multiplies the sizes of the inputs.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/tools/singlejar/combiners.h"
+#include "src/tools/singlejar/diag.h"
+#include "src/tools/singlejar/options.h"
+#include "src/tools/singlejar/output_jar.h"
+#include "src/tools/singlejar/zip_headers.h"
+
+namespace {
+
+// A minimal writer of the jars to benchmark on. The entries are created
+// by a Concatenator, so they look like the entries singlejar writes.
+class JarWriter {
+ public:
+  explicit JarWriter(const std::string &path)
+      : path_(path), fp_(fopen(path.c_str(), "wb")), position_(0),
+        entries_(0) {
+    if (fp_ == nullptr) {
+      diag_err(1, "%s:%d: %s", __FILE__, __LINE__, path.c_str());
+    }
+  }
+
+  void AddEntry(const std::string &name, const std::string &contents,
+                bool compress) {
+    Concatenator concatenator(name);
+    concatenator.Append(contents.data(), contents.size());
+    LH *lh = reinterpret_cast<LH *>(concatenator.OutputEntry(compress));
+    if (lh == nullptr) {
+      diag_errx(1, "%s:%d: cannot create %s", __FILE__, __LINE__,
+                name.c_str());
+    }
+    size_t lh_size = lh->size();
+    size_t cdh_size = sizeof(CDH) + lh->file_name_length();
+    cen_.resize(cen_.size() + cdh_size);
+    CDH *cdh = reinterpret_cast<CDH *>(&cen_[cen_.size() - cdh_size]);
+    memset(cdh, 0, cdh_size);
+    cdh->signature();
+    cdh->version(20);
+    cdh->version_to_extract(20);
+    cdh->compression_method(lh->compression_method());
+    cdh->last_mod_file_time(lh->last_mod_file_time());
+    cdh->last_mod_file_date(lh->last_mod_file_date());
+    cdh->crc32(lh->crc32());
+    cdh->compressed_file_size32(lh->compressed_file_size32());
+    cdh->uncompressed_file_size32(lh->uncompressed_file_size32());
+    cdh->file_name(lh->file_name(), lh->file_name_length());
+    cdh->extra_fields(nullptr, 0);
+    cdh->local_header_offset32(position_);
+    Write(lh, lh_size + lh->in_zip_size());
+    free(lh);
+    ++entries_;
+  }
+
+  void Close() {
+    uint64_t cen_offset = position_;
+    Write(cen_.data(), cen_.size());
+    if (entries_ >= 0xFFFF) {
+      ECD64 ecd64;
+      memset(&ecd64, 0, sizeof(ecd64));
+      ecd64.signature();
+      ecd64.remaining_size(sizeof(ECD64) - 12);
+      ecd64.version(0x031E);
+      ecd64.version_to_extract(45);
+      ecd64.this_disk_entries(entries_);
+      ecd64.total_entries(entries_);
+      ecd64.cen_size(cen_.size());
+      ecd64.cen_offset(cen_offset);
+      ECD64Locator locator;
+      memset(&locator, 0, sizeof(locator));
+      locator.signature();
+      locator.ecd64_offset(position_);
+      locator.total_disks(1);
+      Write(&ecd64, sizeof(ecd64));
+      Write(&locator, sizeof(locator));
+    }
+    ECD ecd;
+    memset(&ecd, 0, sizeof(ecd));
+    ecd.signature();
+    ecd.this_disk_entries16(entries_ < 0xFFFF ? entries_ : 0xFFFF);
+    ecd.total_entries16(entries_ < 0xFFFF ? entries_ : 0xFFFF);
+    ecd.cen_size32(cen_.size());
+    ecd.cen_offset32(cen_offset);
+    Write(&ecd, sizeof(ecd));
+    if (fclose(fp_)) {
+      diag_err(1, "%s:%d: %s", __FILE__, __LINE__, path_.c_str());
+    }
+    fp_ = nullptr;
+  }
+
+ private:
+  void Write(const void *data, size_t size) {
+    if (fwrite(data, 1, size, fp_) != size) {
+      diag_err(1, "%s:%d: %s", __FILE__, __LINE__, path_.c_str());
+    }
+    position_ += size;
+  }
+
+  std::string path_;
+  FILE *fp_;
+  uint64_t position_;
+  uint64_t entries_;
+  std::vector<uint8_t> cen_;
+};
+
+// A deterministic pseudo-random generator (xorshift64*).
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed * 2654435761ULL + 1) {}
+
+  uint64_t Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 2685821657736338717ULL;
+  }
+
+  size_t Uniform(size_t from, size_t to) {
+    return from + Next() % (to - from + 1);
+  }
+
+  // Returns the content compressing roughly as well as the class files:
+  // the words from a small vocabulary interspersed with random bytes.
+  std::string Content(size_t size) {
+    static const char *const kWords[] = {
+        "java/lang/Object", "<init>", "()V", "Code", "LineNumberTable",
+        "java/lang/String", "toString", "SourceFile", "StackMapTable",
+        "com/google/devtools/build", "Ljava/util/List;", "getValue"};
+    std::string content;
+    content.reserve(size + 32);
+    while (content.size() < size) {
+      uint64_t r = Next();
+      if (r & 1) {
+        content += kWords[(r >> 1) % (sizeof(kWords) / sizeof(kWords[0]))];
+      } else {
+        content += static_cast<char>(r >> 8);
+      }
+    }
+    content.resize(size);
+    return content;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+struct Shape {
+  const char *name;
+  // Creates the inputs, generation 1 differs from generation 0 in one input.
+  void (*create)(const std::string &dir, double scale, int generation,
+                 std::vector<std::string> *args);
+};
+
+static size_t Scaled(size_t n, double scale) {
+  size_t scaled = static_cast<size_t>(n * scale);
+  return scaled ? scaled : 1;
+}
+
+static std::string JarPath(const std::string &dir, const char *shape, int i,
+                           int generation) {
+  return dir + "/" + shape + "_" + std::to_string(i) +
+         (generation ? "_changed.jar" : ".jar");
+}
+
+// The inputs are created once per generation, each generation has its own
+// copy of the changed input (the first one).
+static void CreateClasses(const std::string &dir, double scale,
+                          int generation, std::vector<std::string> *args) {
+  args->push_back("--sources");
+  for (int i = 0; i < 50; ++i) {
+    int input_generation = i == 0 ? generation : 0;
+    std::string path = JarPath(dir, "classes", i, input_generation);
+    args->push_back(path);
+    if (access(path.c_str(), R_OK) == 0) {
+      continue;
+    }
+    Random random(i * 2 + input_generation);
+    JarWriter jar(path);
+    for (size_t j = 0; j < Scaled(1000, scale); ++j) {
+      jar.AddEntry("com/example/p" + std::to_string(i) + "/C" +
+                       std::to_string(j) + ".class",
+                   random.Content(random.Uniform(200, 4000)), true);
+    }
+    jar.Close();
+  }
+}
+
+static void CreateResources(const std::string &dir, double scale,
+                            int generation, std::vector<std::string> *args) {
+  args->push_back("--compression");
+  args->push_back("--sources");
+  for (int i = 0; i < 4; ++i) {
+    int input_generation = i == 0 ? generation : 0;
+    std::string path = JarPath(dir, "resources", i, input_generation);
+    args->push_back(path);
+    if (access(path.c_str(), R_OK) == 0) {
+      continue;
+    }
+    Random random(i * 2 + input_generation);
+    JarWriter jar(path);
+    for (int j = 0; j < 2; ++j) {
+      jar.AddEntry("assets/r" + std::to_string(i) + "_" + std::to_string(j),
+                   random.Content(Scaled(32 << 20, scale)), false);
+    }
+    jar.Close();
+  }
+}
+
+static void CreateServices(const std::string &dir, double scale,
+                           int generation, std::vector<std::string> *args) {
+  args->push_back("--sources");
+  for (size_t i = 0; i < Scaled(500, scale); ++i) {
+    int input_generation = i == 0 ? generation : 0;
+    std::string path = JarPath(dir, "services", i, input_generation);
+    args->push_back(path);
+    if (access(path.c_str(), R_OK) == 0) {
+      continue;
+    }
+    Random random(i * 2 + input_generation);
+    JarWriter jar(path);
+    for (int j = 0; j < 20; ++j) {
+      jar.AddEntry("META-INF/services/com.example.Service" + std::to_string(j),
+                   "com.example.impl" + std::to_string(i) + ".ServiceImpl" +
+                       std::to_string(j) + "\n",
+                   true);
+    }
+    for (int j = 0; j < 10; ++j) {
+      jar.AddEntry("com/example/impl" + std::to_string(i) + "/ServiceImpl" +
+                       std::to_string(j) + ".class",
+                   random.Content(1000), true);
+    }
+    jar.Close();
+  }
+}
+
+static void CreateZip64(const std::string &dir, double scale, int generation,
+                        std::vector<std::string> *args) {
+  args->push_back("--sources");
+  for (int i = 0; i < 2; ++i) {
+    int input_generation = i == 0 ? generation : 0;
+    std::string path = JarPath(dir, "zip64", i, input_generation);
+    args->push_back(path);
+    if (access(path.c_str(), R_OK) == 0) {
+      continue;
+    }
+    Random random(i * 2 + input_generation);
+    JarWriter jar(path);
+    size_t entry_count = i == 0 ? std::max(Scaled(70000, scale),
+                                           static_cast<size_t>(0xFFFF))
+                                : Scaled(1000, scale);
+    for (size_t j = 0; j < entry_count; ++j) {
+      jar.AddEntry("z" + std::to_string(i) + "/E" + std::to_string(j) +
+                       ".class",
+                   random.Content(random.Uniform(50, 200)), true);
+    }
+    jar.Close();
+  }
+}
+
+static void CreateLauncher(const std::string &dir, double scale,
+                           int generation, std::vector<std::string> *args) {
+  std::string launcher_path = dir + "/launcher";
+  if (access(launcher_path.c_str(), R_OK) != 0) {
+    FILE *fp = fopen(launcher_path.c_str(), "wb");
+    if (fp == nullptr) {
+      diag_err(1, "%s:%d: %s", __FILE__, __LINE__, launcher_path.c_str());
+    }
+    Random random(0);
+    std::string chunk = random.Content(1 << 20);
+    for (size_t i = 0; i < Scaled(64, scale); ++i) {
+      if (fwrite(chunk.data(), chunk.size(), 1, fp) != 1) {
+        diag_err(1, "%s:%d: %s", __FILE__, __LINE__, launcher_path.c_str());
+      }
+    }
+    fclose(fp);
+  }
+  args->push_back("--java_launcher");
+  args->push_back(launcher_path);
+  CreateClasses(dir, scale / 10, generation, args);
+}
+
+const Shape kShapes[] = {
+    {"classes", CreateClasses},   {"resources", CreateResources},
+    {"services", CreateServices}, {"zip64", CreateZip64},
+    {"launcher", CreateLauncher},
+};
+
+const char *const kModes[] = {"serial", "jobs", "relink"};
+
+struct Result {
+  double seconds;
+  long peak_rss_kb;
+  off_t output_size;
+};
+
+// Runs singlejar with given arguments in a child process.
+static Result Run(const std::vector<std::string> &args) {
+  Result result = {0, 0, 0};
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid < 0) {
+    diag_err(1, "%s:%d: fork", __FILE__, __LINE__);
+  }
+  if (pid == 0) {
+    std::vector<const char *> argv;
+    for (auto &arg : args) {
+      argv.push_back(arg.c_str());
+    }
+    Options options;
+    options.ParseCommandLine(argv.size(), argv.data());
+    OutputJar output_jar;
+    _exit(output_jar.Doit(&options));
+  }
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    diag_errx(1, "%s:%d: singlejar failed", __FILE__, __LINE__);
+  }
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result.peak_rss_kb = usage.ru_maxrss;
+#if defined(__APPLE__)
+  result.peak_rss_kb /= 1024;
+#endif
+  for (size_t i = 0; i + 1 < args.size(); ++i) {
+    if (args[i] == "--output") {
+      struct stat st;
+      if (stat(args[i + 1].c_str(), &st) == 0) {
+        result.output_size = st.st_size;
+      }
+    }
+  }
+  return result;
+}
+
+static bool Selected(const std::string &list, const char *name) {
+  if (list.empty()) {
+    return true;
+  }
+  std::string padded = "," + list + ",";
+  return padded.find("," + std::string(name) + ",") != std::string::npos;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  std::string dir = tmpdir ? tmpdir : "/tmp";
+  int runs = 3;
+  double scale = 1.0;
+  std::string shapes;
+  std::string modes;
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 < argc && !strcmp(argv[i], "--dir")) {
+      dir = argv[++i];
+    } else if (i + 1 < argc && !strcmp(argv[i], "--runs")) {
+      runs = atoi(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--scale")) {
+      scale = atof(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--shapes")) {
+      shapes = argv[++i];
+    } else if (i + 1 < argc && !strcmp(argv[i], "--modes")) {
+      modes = argv[++i];
+    } else {
+      diag_errx(1, "Bad command line argument %s", argv[i]);
+    }
+  }
+  if (runs < 1 || scale <= 0) {
+    diag_errx(1, "--runs and --scale should be positive");
+  }
+  unsigned int jobs = std::thread::hardware_concurrency();
+  if (jobs < 2) {
+    jobs = 2;
+  }
+
+  printf("%-10s %-7s %10s %10s %12s\n", "shape", "mode", "time_ms", "MB/s",
+         "peak_rss_kb");
+  for (auto &shape : kShapes) {
+    if (!Selected(shapes, shape.name)) {
+      continue;
+    }
+    std::string output = dir + "/" + shape.name + "_out.jar";
+    std::string index = dir + "/" + shape.name + "_out.index";
+    std::string previous_output = dir + "/" + shape.name + "_previous.jar";
+    std::string previous_index = dir + "/" + shape.name + "_previous.index";
+    for (auto mode : kModes) {
+      if (!Selected(modes, mode)) {
+        continue;
+      }
+      std::vector<std::string> args = {"--output", output, "--normalize"};
+      bool relink = !strcmp(mode, "relink");
+      if (!strcmp(mode, "jobs")) {
+        args.push_back("--jobs");
+        args.push_back(std::to_string(jobs));
+      } else if (relink) {
+        // The previous output is created from the original inputs.
+        std::vector<std::string> previous_args = args;
+        previous_args.insert(previous_args.end(), {"--output_index", index});
+        shape.create(dir, scale, 0, &previous_args);
+        Run(previous_args);
+        if (rename(output.c_str(), previous_output.c_str()) ||
+            rename(index.c_str(), previous_index.c_str())) {
+          diag_err(1, "%s:%d: rename", __FILE__, __LINE__);
+        }
+        args.insert(args.end(),
+                    {"--previous_output", previous_output, "--previous_index",
+                     previous_index});
+      }
+      shape.create(dir, scale, relink ? 1 : 0, &args);
+      Result best = {0, 0, 0};
+      for (int run = 0; run < runs; ++run) {
+        Result result = Run(args);
+        if (run == 0 || result.seconds < best.seconds) {
+          best.seconds = result.seconds;
+        }
+        if (result.peak_rss_kb > best.peak_rss_kb) {
+          best.peak_rss_kb = result.peak_rss_kb;
+        }
+        best.output_size = result.output_size;
+      }
+      printf("%-10s %-7s %10.1f %10.1f %12ld\n", shape.name, mode,
+             best.seconds * 1000, best.output_size / best.seconds / (1 << 20),
+             best.peak_rss_kb);
+      fflush(stdout);
+    }
+    unlink(output.c_str());
+  }
+  return 0;
+}
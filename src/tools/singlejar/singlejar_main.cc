@@ -12,12 +12,14 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include "src/tools/singlejar/options.h"
-#include "src/tools/singlejar/output_jar.h"
+#include "src/tools/singlejar/worker.h"
+#include "src/tools/worker/worker.h"
 
 int main(int argc, char *argv[]) {
-  Options options;
-  options.ParseCommandLine(argc - 1, argv + 1);
-  OutputJar output_jar;
-  return output_jar.Doit(&options);
+  int exit_code;
+  if (blaze_worker::RunIfRequested(argc, argv, "singlejar", SingleJarMain,
+                                   &exit_code)) {
+    return exit_code;
+  }
+  return SingleJarMain(argc, argv);
 }
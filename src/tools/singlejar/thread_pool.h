@@ -0,0 +1,138 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_TOOLS_SINGLEJAR_THREAD_POOL_H_
+#define BAZEL_SRC_TOOLS_SINGLEJAR_THREAD_POOL_H_ 1
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+ * The threads shared by the parallel stages of singlejar, i.e. the
+ * preparation of the input jars and the compression of the large entries,
+ * which may run inside it. A stage only hands a task to a thread which is
+ * idle, and does the rest of the work on the calling thread, so that there
+ * are never more than SetSize() threads in the pool however the stages nest,
+ * and a task never waits for a thread.
+ *
+ * The threads are started on demand and kept for the life of the process.
+ */
+class ThreadPool {
+ public:
+  // Returns the pool of the process.
+  static ThreadPool &Shared() {
+    // Never destroyed, as its threads may still wait for tasks on exit.
+    static ThreadPool *pool = new ThreadPool();
+    return *pool;
+  }
+
+  // Sets the number of tasks that may run on the pool at the same time.
+  void SetSize(int size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_ = size < 0 ? 0 : size;
+  }
+
+  // The tasks started by a stage, which have to finish before the stage
+  // returns.
+  class Group {
+   public:
+    explicit Group(ThreadPool *pool) : pool_(pool), running_(0) {}
+
+    ~Group() { Wait(); }
+
+    // Runs the task on a thread of the pool if there is room for it there,
+    // returns false otherwise.
+    bool TryStart(std::function<void()> task) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++running_;
+      }
+      if (pool_->TryStart([this, task]() {
+            task();
+            Finished();
+          })) {
+        return true;
+      }
+      Finished();
+      return false;
+    }
+
+    // Waits for the started tasks to finish.
+    void Wait() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      finished_.wait(lock, [this] { return running_ == 0; });
+    }
+
+   private:
+    void Finished() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--running_ == 0) {
+        finished_.notify_all();
+      }
+    }
+
+    ThreadPool *pool_;
+    std::mutex mutex_;
+    std::condition_variable finished_;
+    int running_;
+  };
+
+ private:
+  ThreadPool() : size_(0), busy_(0), idle_(0) {}
+
+  bool TryStart(std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (busy_ >= size_) {
+      return false;
+    }
+    ++busy_;
+    if (idle_ > 0) {
+      // Dequeued by an idle thread, which is thus not counted as idle any
+      // longer, so that every queued task has a thread of its own.
+      --idle_;
+      tasks_.push_back(std::move(task));
+      has_task_.notify_one();
+    } else {
+      std::thread(&ThreadPool::Run, this, std::move(task)).detach();
+    }
+    return true;
+  }
+
+  void Run(std::function<void()> task) {
+    for (;;) {
+      task();
+      task = nullptr;
+      std::unique_lock<std::mutex> lock(mutex_);
+      --busy_;
+      ++idle_;
+      has_task_.wait(lock, [this] { return !tasks_.empty(); });
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable has_task_;
+  std::deque<std::function<void()> > tasks_;
+  // The maximum number of running tasks, the number of running tasks and
+  // the number of the threads waiting for one.
+  int size_;
+  int busy_;
+  int idle_;
+};
+
+#endif  // BAZEL_SRC_TOOLS_SINGLEJAR_THREAD_POOL_H_
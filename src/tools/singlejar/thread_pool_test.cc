@@ -0,0 +1,113 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "src/tools/singlejar/thread_pool.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Counts the tasks running on the pool, and the most seen at a time.
+class Running {
+ public:
+  Running() : count_(0), max_(0) {}
+
+  void Enter() {
+    int count = ++count_;
+    int max = max_;
+    while (count > max && !max_.compare_exchange_weak(max, count)) {
+    }
+  }
+
+  void Leave() { --count_; }
+
+  int max() const { return max_; }
+
+ private:
+  std::atomic<int> count_;
+  std::atomic<int> max_;
+};
+
+TEST(ThreadPoolTest, TryStartFailsWhenPoolIsFull) {
+  ThreadPool::Shared().SetSize(2);
+  std::mutex mutex;
+  std::condition_variable released;
+  bool release = false;
+  auto wait_for_release = [&mutex, &released, &release] {
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [&release] { return release; });
+  };
+  {
+    ThreadPool::Group group(&ThreadPool::Shared());
+    EXPECT_TRUE(group.TryStart(wait_for_release));
+    EXPECT_TRUE(group.TryStart(wait_for_release));
+    EXPECT_FALSE(group.TryStart([] {}));
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      release = true;
+    }
+    released.notify_all();
+    group.Wait();
+
+    // The threads are free again.
+    std::atomic<int> done(0);
+    EXPECT_TRUE(group.TryStart([&done] { ++done; }));
+    EXPECT_TRUE(group.TryStart([&done] { ++done; }));
+    group.Wait();
+    EXPECT_EQ(2, done);
+  }
+  ThreadPool::Shared().SetSize(0);
+}
+
+// The stages nested in the tasks share the threads of the outer stage,
+// rather than starting threads of their own.
+TEST(ThreadPoolTest, NestedGroupsShareThePool) {
+  const int kSize = 4;
+  ThreadPool::Shared().SetSize(kSize);
+  Running running;
+  std::atomic<int> done(0);
+  auto inner = [&running, &done] {
+    running.Enter();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    ++done;
+    running.Leave();
+  };
+  auto outer = [&inner] {
+    ThreadPool::Group group(&ThreadPool::Shared());
+    for (int i = 0; i < kSize; ++i) {
+      if (!group.TryStart(inner)) {
+        inner();
+      }
+    }
+  };
+  {
+    ThreadPool::Group group(&ThreadPool::Shared());
+    for (int i = 0; i < kSize; ++i) {
+      if (!group.TryStart(outer)) {
+        outer();
+      }
+    }
+  }
+  EXPECT_EQ(kSize * kSize, done);
+  // The calling thread runs tasks too.
+  EXPECT_LE(running.max(), kSize + 1);
+  ThreadPool::Shared().SetSize(0);
+}
+
+}  // namespace
@@ -15,9 +15,16 @@
 #ifndef THIRD_PARTY_BAZEL_SRC_TOOLS_SINGLEJAR_TOKEN_STREAM_H_
 #define THIRD_PARTY_BAZEL_SRC_TOOLS_SINGLEJAR_TOKEN_STREAM_H_ 1
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <memory>
 #include <string>
 #include <vector>
@@ -52,13 +59,30 @@ class ArgTokenStream {
    */
 
  private:
-  // Internal class to handle indirect command files.
+  // Internal class to handle indirect command files. The file is mapped into
+  // memory and scanned in place: the runs of characters that need no
+  // unquoting, which is what most tokens consist of, are appended to the
+  // token at once.
   class FileTokenStream {
    public:
-    FileTokenStream(const char *filename) {
-      if (!(fp_ = fopen(filename, "r"))) {
+    FileTokenStream(const char *filename)
+        : start_(nullptr), pos_(nullptr), end_(nullptr), size_(0) {
+      int fd = open(filename, O_RDONLY);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st)) {
         diag_err(1, "%s", filename);
       }
+      size_ = st.st_size;
+      if (size_) {
+        void *mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+          diag_err(1, "%s", filename);
+        }
+        start_ = pos_ = static_cast<const char *>(mapped);
+        end_ = start_ + size_;
+        madvise(mapped, size_, MADV_SEQUENTIAL);
+      }
+      ::close(fd);
       filename_ = filename;
       next_char();
     }
@@ -67,10 +91,10 @@ class ArgTokenStream {
 
     // Assign next token to TOKEN, return true on success, false on EOF.
     bool next_token(std::string *token) {
-      if (!fp_) {
+      if (filename_.empty()) {
         return false;
       }
-      *token = "";
+      token->clear();
       while (current_char_ != EOF && isspace(current_char_)) {
         next_char();
       }
@@ -81,12 +105,7 @@ class ArgTokenStream {
       for (;;) {
         if (current_char_ == '\'' || current_char_ == '"') {
           process_quoted(token);
-          if (isspace(current_char_)) {
-            next_char();
-            return true;
-          } else {
-            next_char();
-          }
+          next_char();
         } else if (current_char_ == '\\') {
           next_char();
           if ((current_char_ != EOF)) {
@@ -100,7 +119,15 @@ class ArgTokenStream {
           next_char();
           return true;
         } else {
+          // The current character has been consumed already, the rest of the
+          // run is still in the buffer.
           token->push_back(current_char_);
+          const char *run_end = pos_;
+          while (run_end < end_ && !special(*run_end)) {
+            ++run_end;
+          }
+          token->append(pos_, run_end - pos_);
+          pos_ = run_end;
           next_char();
         }
       }
@@ -108,13 +135,19 @@ class ArgTokenStream {
 
    private:
     void close() {
-      if (fp_) {
-        fclose(fp_);
-        fp_ = nullptr;
+      if (start_) {
+        munmap(const_cast<char *>(start_), size_);
+        start_ = pos_ = end_ = nullptr;
       }
       filename_.clear();
     }
 
+    // Returns true if the character cannot be appended to the token as is.
+    static bool special(char c) {
+      return c == '\'' || c == '"' || c == '\\' ||
+             isspace(static_cast<unsigned char>(c));
+    }
+
     // Append the quoted string to the TOKEN. The quote character (which can be
     // single or double quote) is in the current character. Everything up to the
     // matching quote character is appended.
@@ -145,29 +178,25 @@ class ArgTokenStream {
       }
     }
 
-    // Get the next character from the input stream. Skip backslash followed
+    // Get the next character from the buffer. Skip backslash followed
     // by the newline.
     void next_char() {
-      if (feof(fp_)) {
+      if (pos_ >= end_) {
         current_char_ = EOF;
         return;
       }
-      current_char_ = getc(fp_);
+      current_char_ = static_cast<unsigned char>(*pos_++);
       // Eat "\\\n" sequence.
-      while (current_char_ == '\\') {
-        int c = getc(fp_);
-        if (c == '\n') {
-          current_char_ = getc(fp_);
-        } else {
-          if (c != EOF) {
-            ungetc(c, fp_);
-          }
-          break;
-        }
+      while (current_char_ == '\\' && pos_ < end_ && *pos_ == '\n') {
+        ++pos_;
+        current_char_ = pos_ < end_ ? static_cast<unsigned char>(*pos_++) : EOF;
       }
     }
 
-    FILE *fp_;
+    const char *start_;
+    const char *pos_;
+    const char *end_;
+    size_t size_;
     std::string filename_;
     int current_char_;
   };
@@ -207,6 +236,27 @@ class ArgTokenStream {
     return true;
   }
 
+  // Process --OPTION NUMBER
+  // If the current token is --OPTION, parse the next token as a decimal
+  // integer, assign it to VALUE, proceed to the next token after it and
+  // return true.
+  bool MatchAndSet(const char *option, int *value) {
+    std::string optarg;
+    if (!MatchAndSet(option, &optarg)) {
+      return false;
+    }
+    char *end;
+    errno = 0;
+    long number = strtol(optarg.c_str(), &end, 10);
+    if (optarg.empty() || *end != '\0' || errno || number < INT_MIN ||
+        number > INT_MAX) {
+      diag_errx(1, "%s requires integer argument, got %s", option,
+                optarg.c_str());
+    }
+    *value = static_cast<int>(number);
+    return true;
+  }
+
   // Process --OPTION OPTARG1 OPTARG2 ...
   // If a current token is --OPTION, push_back all subsequent tokens up to the
   // next option to the OPTARGS array, proceed to the next option and return
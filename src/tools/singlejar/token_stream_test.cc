@@ -79,6 +79,41 @@ TEST(TokenStreamTest, CommandFile) {
   EXPECT_TRUE(token_stream.AtEnd());
 }
 
+// A command file with many long tokens, the last one without the trailing
+// newline, followed by an empty command file.
+TEST(TokenStreamTest, LargeCommandFile) {
+  std::string command_file_path =
+      singlejar_test_util::OutputFilePath("large_tokens");
+  std::string empty_file_path =
+      singlejar_test_util::OutputFilePath("no_tokens");
+  FILE *fp = fopen(command_file_path.c_str(), "w");
+  ASSERT_NE(nullptr, fp);
+  std::string long_token(10000, 'x');
+  fprintf(fp, "--sources");
+  for (int i = 0; i < 1000; ++i) {
+    fprintf(fp, "\n%s/%d.jar", long_token.c_str(), i);
+  }
+  fclose(fp);
+  fp = fopen(empty_file_path.c_str(), "w");
+  ASSERT_NE(nullptr, fp);
+  fclose(fp);
+
+  std::string command_file_arg = std::string("@") + command_file_path;
+  std::string empty_file_arg = std::string("@") + empty_file_path;
+  const char *args[] = {command_file_arg.c_str(), empty_file_arg.c_str(),
+                        "--after_file"};
+  ArgTokenStream token_stream(ARRAY_SIZE(args), args);
+  std::vector<std::string> optvals;
+  ASSERT_TRUE(token_stream.MatchAndSet("--sources", &optvals));
+  ASSERT_EQ(1000, optvals.size());
+  EXPECT_EQ(long_token + "/0.jar", optvals[0]);
+  EXPECT_EQ(long_token + "/999.jar", optvals[999]);
+  bool flag = false;
+  ASSERT_TRUE(token_stream.MatchAndSet("--after_file", &flag));
+  EXPECT_TRUE(flag);
+  EXPECT_TRUE(token_stream.AtEnd());
+}
+
 // '--arg1 optval1 --arg2' command line.
 TEST(TokenStreamTest, OptargOne) {
   const char *args[] = {"--arg1", "optval1", "--arg2", "--arg3", "optval3"};
@@ -95,6 +130,19 @@ TEST(TokenStreamTest, OptargOne) {
   EXPECT_TRUE(token_stream.AtEnd());
 }
 
+// '--arg1 42 --arg2 -7' command line.
+TEST(TokenStreamTest, OptargInt) {
+  const char *args[] = {"--arg1", "42", "--arg2", "-7"};
+  ArgTokenStream token_stream(ARRAY_SIZE(args), args);
+  int value = 0;
+  EXPECT_FALSE(token_stream.MatchAndSet("--foo", &value));
+  ASSERT_TRUE(token_stream.MatchAndSet("--arg1", &value));
+  EXPECT_EQ(42, value);
+  ASSERT_TRUE(token_stream.MatchAndSet("--arg2", &value));
+  EXPECT_EQ(-7, value);
+  EXPECT_TRUE(token_stream.AtEnd());
+}
+
 // '--arg1 value1 value2 --arg2' command line.
 TEST(TokenStreamTest, OptargMulti) {
   const char *args[] = {"--arg1", "value11", "value12",
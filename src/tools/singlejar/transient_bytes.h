@@ -15,10 +15,21 @@
 #define SRC_TOOLS_SINGLEJAR_TRANSIENT_BYTES_H_
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <ostream>
+#include <string>
+#include <vector>
 
+#include "src/tools/singlejar/crc32.h"
 #include "src/tools/singlejar/diag.h"
+#include "src/tools/singlejar/thread_pool.h"
 #include "src/tools/singlejar/zip_headers.h"
 #include "src/tools/singlejar/zlib_interface.h"
 
@@ -40,12 +51,10 @@ class TransientBytes {
         last_block_(nullptr) {}
 
   ~TransientBytes() {
-    while (first_block_) {
-      auto block = first_block_;
-      first_block_ = first_block_->next_block_;
-      delete block;
+    if (first_block_) {
+      blocks().Release(first_block_);
     }
-    last_block_ = nullptr;
+    first_block_ = last_block_ = nullptr;
   }
 
   // Appends raw bytes.
@@ -86,6 +95,18 @@ class TransientBytes {
       out_bytes = lh->uncompressed_file_size();
     }
 
+    // If the inflated data fits into the current data block, inflate it
+    // in one go.
+    if (out_bytes <= ensure_space() && in_bytes < 0xFFFFFFFF) {
+      if (!inflater->InflateBuffer(data, in_bytes, append_position(),
+                                   out_bytes)) {
+        diag_errx(2, "%s:%d: Internal error inflating %.*s", __FILE__,
+                  __LINE__, lh->file_name_length(), lh->file_name());
+      }
+      advance(out_bytes);
+      return;
+    }
+
     while (in_bytes > 0) {
       // A single region to inflate cannot exceed 4GB-1.
       uint32_t in_bytes_chunk = 0xFFFFFFFF;
@@ -152,8 +173,30 @@ class TransientBytes {
       return Z_NO_COMPRESSION;
     }
 
-    Deflater deflater;
-    deflater.next_out = buffer;
+    if (to_compress >= kParallelCompressionThreshold) {
+      if (ParallelCompressOut(buffer, checksum, bytes_written)) {
+        return Z_DEFLATED;
+      }
+      CopyOut(buffer, checksum);
+      *bytes_written = data_size();
+      return Z_NO_COMPRESSION;
+    }
+
+    ZStreamPool<Deflater>::Ptr deflater = ZStreamPool<Deflater>::Acquire();
+    // The contents of a single data block are compressed in one go.
+    if (to_compress <= sizeof(first_block_->data_)) {
+      *checksum = Crc32(0, first_block_->data_, to_compress);
+      *bytes_written = deflater->DeflateBuffer(first_block_->data_, to_compress,
+                                               buffer, to_compress);
+      if (*bytes_written) {
+        return Z_DEFLATED;
+      }
+      CopyOut(buffer, checksum);
+      *bytes_written = data_size();
+      return Z_NO_COMPRESSION;
+    }
+
+    deflater->next_out = buffer;
     uint16_t compression_method = Z_DEFLATED;
 
     // Feed data blocks to the deflater one by one, but break if the compressed
@@ -163,25 +206,25 @@ class TransientBytes {
          data_block = data_block->next_block_) {
       // The compressed size should not exceed the original size less the number
       // of bytes already compressed. And, it should not exceed 4GB-1.
-      deflater.avail_out = std::min(data_size() - deflater.total_out,
-                                    static_cast<uint64_t>(0xFFFFFFFF));
+      deflater->avail_out = std::min(data_size() - deflater->total_out,
+                                     static_cast<uint64_t>(0xFFFFFFFF));
       // Out of the total number of bytes that remain to be compressed, we
       // can compress no more than this block.
       uint32_t chunk_size = static_cast<uint32_t>(std::min(
           static_cast<uint64_t>(sizeof(data_block->data_)), to_compress));
-      *checksum = crc32(*checksum, data_block->data_, chunk_size);
-      deflater.avail_in = chunk_size;
+      *checksum = Crc32(*checksum, data_block->data_, chunk_size);
+      deflater->avail_in = chunk_size;
       to_compress -= chunk_size;
-      int ret = deflater.Deflate(data_block->data_, chunk_size,
-                                 to_compress ? Z_NO_FLUSH : Z_FINISH);
+      int ret = deflater->Deflate(data_block->data_, chunk_size,
+                                  to_compress ? Z_NO_FLUSH : Z_FINISH);
       if (ret == Z_OK) {
-        if (!deflater.avail_out) {
+        if (!deflater->avail_out) {
           // We ran out of space in the output buffer, which means
           // that deflated size exceeds original size. Leave the loop
           // and just copy the data.
           compression_method = Z_NO_COMPRESSION;
         }
-      } else if (ret == Z_BUF_ERROR && !deflater.avail_in) {
+      } else if (ret == Z_BUF_ERROR && !deflater->avail_in) {
         // We ran out of data block, this is not a error.
       } else if (ret == Z_STREAM_END) {
         if (data_block->next_block_ || to_compress) {
@@ -192,11 +235,11 @@ class TransientBytes {
         }
       } else {
         diag_errx(2, "%s:%d: deflate error %d(%s)", __FILE__, __LINE__, ret,
-                  deflater.msg);
+                  deflater->msg);
       }
     }
     if (compression_method != Z_NO_COMPRESSION) {
-      *bytes_written = deflater.total_out;
+      *bytes_written = deflater->total_out;
       return compression_method;
     }
 
@@ -206,6 +249,13 @@ class TransientBytes {
     return Z_NO_COMPRESSION;
   }
 
+  // Limits the memory taken by the data blocks of all instances to about
+  // given number of bytes (0 means no limit). Past it, the data blocks are
+  // allocated in a temporary file (see BlockPool).
+  static void SetMemoryBudget(uint64_t bytes) {
+    blocks().SetMemoryBudget(bytes);
+  }
+
   // Copies the bytes to the buffer and sets the checksum.
   void CopyOut(uint8_t *buffer, uint32_t *checksum) {
     uint64_t to_copy = data_size();
@@ -215,7 +265,7 @@ class TransientBytes {
          data_block = data_block->next_block_) {
       size_t chunk_size =
           std::min(static_cast<uint64_t>(sizeof(data_block->data_)), to_copy);
-      *checksum = crc32(*checksum, data_block->data_, chunk_size);
+      *checksum = Crc32(*checksum, data_block->data_, chunk_size);
       memcpy(buffer_end - to_copy, data_block->data_, chunk_size);
       to_copy -= chunk_size;
     }
@@ -255,10 +305,99 @@ class TransientBytes {
   }
 
  private:
+  // The contents at least this large are compressed in parallel.
+  static const uint64_t kParallelCompressionThreshold = 1 << 20;
+
+  // Compresses each data block separately, pigz-style: the deflater for a
+  // block is primed with the last 32KB of the preceding block, and its output
+  // ends with a sync flush (unless it is the last block), so that the outputs
+  // concatenated together are a single deflate stream. The blocks are
+  // compressed on the calling thread and on the idle threads of the shared
+  // ThreadPool, the result does not depend on the number of threads. Returns
+  // false if compressed data is not smaller than the original.
+  bool ParallelCompressOut(uint8_t *buffer, uint32_t *checksum,
+                           uint64_t *bytes_written) {
+    struct Chunk {
+      const uint8_t *data;
+      uint32_t size;
+      std::unique_ptr<uint8_t[]> deflated;
+      uint64_t deflated_size;
+      uint32_t checksum;
+    };
+    std::vector<Chunk> chunks;
+    uint64_t to_compress = data_size();
+    for (auto data_block = first_block_; data_block && to_compress;
+         data_block = data_block->next_block_) {
+      uint32_t chunk_size = static_cast<uint32_t>(std::min(
+          static_cast<uint64_t>(sizeof(data_block->data_)), to_compress));
+      chunks.push_back(Chunk{data_block->data_, chunk_size, nullptr, 0, 0});
+      to_compress -= chunk_size;
+    }
+
+    std::atomic<size_t> next_chunk(0);
+    auto compress_chunks = [&chunks, &next_chunk]() {
+      size_t index;
+      while ((index = next_chunk++) < chunks.size()) {
+        Chunk &chunk = chunks[index];
+        bool last_chunk = index + 1 == chunks.size();
+        ZStreamPool<Deflater>::Ptr deflater = ZStreamPool<Deflater>::Acquire();
+        if (index > 0) {
+          const Chunk &previous_chunk = chunks[index - 1];
+          uint32_t dictionary_size =
+              std::min(previous_chunk.size, static_cast<uint32_t>(32 << 10));
+          deflateSetDictionary(
+              deflater.get(),
+              previous_chunk.data + previous_chunk.size - dictionary_size,
+              dictionary_size);
+        }
+        // deflateBound() does not count the sync flush marker.
+        uint32_t deflated_capacity =
+            deflateBound(deflater.get(), chunk.size) + 16;
+        chunk.deflated.reset(new uint8_t[deflated_capacity]);
+        deflater->next_out = chunk.deflated.get();
+        deflater->avail_out = deflated_capacity;
+        int ret = deflater->Deflate(chunk.data, chunk.size,
+                                    last_chunk ? Z_FINISH : Z_SYNC_FLUSH);
+        if (ret != (last_chunk ? Z_STREAM_END : Z_OK) || deflater->avail_in ||
+            !deflater->avail_out) {
+          diag_errx(2, "%s:%d: deflate error %d(%s)", __FILE__, __LINE__, ret,
+                    deflater->msg);
+        }
+        chunk.deflated_size = deflater->total_out;
+        chunk.checksum = Crc32(0, chunk.data, chunk.size);
+      }
+    };
+    {
+      ThreadPool::Group helpers(&ThreadPool::Shared());
+      for (size_t i = 1; i < chunks.size(); ++i) {
+        if (!helpers.TryStart(compress_chunks)) {
+          break;
+        }
+      }
+      compress_chunks();
+    }
+
+    uint64_t deflated_size = 0;
+    for (auto &chunk : chunks) {
+      deflated_size += chunk.deflated_size;
+    }
+    if (deflated_size >= data_size()) {
+      return false;
+    }
+    *checksum = 0;
+    for (auto &chunk : chunks) {
+      memcpy(buffer, chunk.deflated.get(), chunk.deflated_size);
+      buffer += chunk.deflated_size;
+      *checksum = crc32_combine(*checksum, chunk.checksum, chunk.size);
+    }
+    *bytes_written = deflated_size;
+    return true;
+  }
+
   // Ensures there is some space to write to, returns the amount available.
   uint64_t ensure_space() {
     if (!free_size()) {
-      auto *data_block = new DataBlock();
+      auto *data_block = blocks().Allocate();
       if (last_block_) {
         last_block_->next_block_ = data_block;
       }
@@ -299,11 +438,148 @@ class TransientBytes {
   // TODO(asmundak): perhaps use mmap to allocate these?
   struct DataBlock {
     struct DataBlock *next_block_;
-    uint8_t data_[0x40000 - 8];
-    DataBlock() : next_block_(nullptr) {}
+    // Whether the block lives in the spill file of the BlockPool rather
+    // than on the heap.
+    bool spilled_;
+    uint8_t data_[0x40000 - 16];
+    explicit DataBlock(bool spilled)
+        : next_block_(nullptr), spilled_(spilled) {}
     uint8_t *End() { return data_ + sizeof(data_); }
   };
 
+  // The data blocks released by the TransientBytes instances are kept for
+  // reuse, so that each combiner or recompressed entry does not cost a new
+  // 256KB allocation (which malloc usually serves by mmap()/munmap()).
+  // The pool is shared by all threads and keeps up to kMaxFreeBlocks blocks.
+  //
+  // Once the blocks allocated on the heap reach the memory budget, the pool
+  // spills: the new blocks are carved out of the shared mappings of an
+  // unlinked temporary file in $TMPDIR. Under memory pressure the kernel can
+  // write such pages out and reclaim them rather than fail, so TMPDIR should
+  // be on a disk-backed filesystem. Spilled blocks are never unmapped, the
+  // released ones are reused before the file is grown.
+  class BlockPool {
+   public:
+    BlockPool()
+        : free_blocks_(nullptr),
+          free_count_(0),
+          heap_blocks_(0),
+          budget_blocks_(0),
+          spilled_free_blocks_(nullptr),
+          spill_fd_(-1),
+          spill_size_(0) {}
+
+    void SetMemoryBudget(uint64_t bytes) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      budget_blocks_ = (bytes + sizeof(DataBlock) - 1) / sizeof(DataBlock);
+    }
+
+    DataBlock *Allocate() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      DataBlock **free_list = nullptr;
+      if (free_blocks_) {
+        free_list = &free_blocks_;
+        --free_count_;
+      } else if (budget_blocks_ == 0 || heap_blocks_ < budget_blocks_) {
+        ++heap_blocks_;
+        lock.unlock();
+        return new DataBlock(false);
+      } else {
+        if (!spilled_free_blocks_) {
+          Spill();
+        }
+        free_list = &spilled_free_blocks_;
+      }
+      auto block = *free_list;
+      *free_list = block->next_block_;
+      block->next_block_ = nullptr;
+      return block;
+    }
+
+    // Releases the linked list of blocks.
+    void Release(DataBlock *first) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      DataBlock *excess_blocks = nullptr;
+      while (first) {
+        auto block = first;
+        first = first->next_block_;
+        DataBlock **free_list = &free_blocks_;
+        if (block->spilled_) {
+          free_list = &spilled_free_blocks_;
+        } else if (free_count_ < kMaxFreeBlocks) {
+          ++free_count_;
+        } else {
+          --heap_blocks_;
+          free_list = &excess_blocks;
+        }
+        block->next_block_ = *free_list;
+        *free_list = block;
+      }
+      lock.unlock();
+      while (excess_blocks) {
+        auto block = excess_blocks;
+        excess_blocks = excess_blocks->next_block_;
+        delete block;
+      }
+    }
+
+   private:
+    static const size_t kMaxFreeBlocks = 64;
+    // The temporary file grows by this many blocks at a time.
+    static const size_t kSpillBlocks = 64;
+
+    // Maps the next kSpillBlocks blocks of the temporary file and adds them
+    // to the spilled free list. Called with the mutex locked.
+    void Spill() {
+      if (spill_fd_ < 0) {
+        const char *tmpdir = getenv("TMPDIR");
+        std::string path = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") +
+                           "/singlejar.XXXXXX";
+        if ((spill_fd_ = mkstemp(&path[0])) < 0) {
+          diag_err(2, "%s:%d: Cannot create %s", __FILE__, __LINE__,
+                   path.c_str());
+        }
+        unlink(path.c_str());
+      }
+      size_t region_size = kSpillBlocks * sizeof(DataBlock);
+      if (ftruncate(spill_fd_, spill_size_ + region_size)) {
+        diag_err(2, "%s:%d: Cannot grow the spill file to %" PRIu64 " bytes",
+                 __FILE__, __LINE__, spill_size_ + region_size);
+      }
+      void *region = mmap(nullptr, region_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, spill_fd_, spill_size_);
+      if (region == MAP_FAILED) {
+        diag_err(2, "%s:%d: Cannot map the spill file", __FILE__, __LINE__);
+      }
+      spill_size_ += region_size;
+      auto region_start = static_cast<uint8_t *>(region);
+      for (size_t i = kSpillBlocks; i-- > 0;) {
+        auto block =
+            new (region_start + i * sizeof(DataBlock)) DataBlock(true);
+        block->next_block_ = spilled_free_blocks_;
+        spilled_free_blocks_ = block;
+      }
+    }
+
+    std::mutex mutex_;
+    DataBlock *free_blocks_;
+    size_t free_count_;
+    // The number of blocks allocated on the heap (in use or free), and
+    // their limit.
+    size_t heap_blocks_;
+    size_t budget_blocks_;
+    DataBlock *spilled_free_blocks_;
+    int spill_fd_;
+    uint64_t spill_size_;
+  };
+
+  // The pool is never destroyed, as it may be used by other threads when
+  // the program exits.
+  static BlockPool &blocks() {
+    static BlockPool *pool = new BlockPool();
+    return *pool;
+  }
+
   uint64_t allocated_;
   uint64_t data_size_;
   struct DataBlock *first_block_;
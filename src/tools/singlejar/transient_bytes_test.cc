@@ -18,6 +18,7 @@
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <string>
 
 #include "src/tools/singlejar/input_jar.h"
 #include "src/tools/singlejar/test_util.h"
@@ -146,6 +147,48 @@ TEST_F(TransientBytesTest, AppendBytes) {
   }
 }
 
+// The data blocks released by an instance are reused by the next one.
+TEST_F(TransientBytesTest, ReuseBlocks) {
+  std::string contents;
+  for (int i = 0; contents.size() < (1 << 20); ++i) {
+    contents += std::to_string(i) + "\n";
+  }
+  for (int round = 0; round < 3; ++round) {
+    transient_bytes_.reset(new TransientBytes);
+    transient_bytes_->Append(contents.c_str());
+    std::ostringstream out;
+    out << *transient_bytes_.get();
+    ASSERT_EQ(contents, out.str()) << "round " << round;
+    contents = contents.substr(round + 1);
+  }
+}
+
+// Past the memory budget the blocks are kept in a temporary file, which is
+// transparent to the users.
+TEST_F(TransientBytesTest, MemoryBudget) {
+  std::string contents;
+  for (int i = 0; contents.size() < (20 << 20); ++i) {
+    contents += std::to_string(i * 7) + "\n";
+  }
+  TransientBytes::SetMemoryBudget(1);
+  for (int round = 0; round < 2; ++round) {
+    transient_bytes_.reset(new TransientBytes);
+    transient_bytes_->Append(contents.c_str());
+    std::ostringstream out;
+    out << *transient_bytes_.get();
+    ASSERT_EQ(contents, out.str()) << "round " << round;
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[contents.size()]);
+    uint32_t checksum;
+    transient_bytes_->CopyOut(buffer.get(), &checksum);
+    EXPECT_EQ(crc32(0, reinterpret_cast<const uint8_t *>(contents.c_str()),
+                    contents.size()),
+              checksum);
+    EXPECT_EQ(0, memcmp(contents.data(), buffer.get(), contents.size()));
+  }
+  transient_bytes_.reset(new TransientBytes);
+  TransientBytes::SetMemoryBudget(0);
+}
+
 TEST_F(TransientBytesTest, ReadEntryContents) {
   ASSERT_EQ(0, chdir(getenv("TEST_TMPDIR")));
   CreateStoredJar();
@@ -325,6 +368,46 @@ TEST_F(TransientBytesTest, CompressZero) {
   ASSERT_EQ(0, crc32);
 }
 
+// Verify CompressOut of the large contents: it is compressed in blocks, and
+// the result does not depend on the number of threads.
+TEST_F(TransientBytesTest, ParallelCompressOut) {
+  std::string contents;
+  for (int i = 0; contents.size() < (5 << 20) + 1234; ++i) {
+    contents += std::to_string(i * i) + (i % 7 ? " " : "\n");
+  }
+  transient_bytes_->Append(contents.c_str());
+  std::unique_ptr<uint8_t[]> serial_buffer(new uint8_t[contents.size()]);
+  uint32_t serial_crc32 = 0;
+  uint64_t serial_bytes_written;
+  ASSERT_EQ(Z_DEFLATED,
+            transient_bytes_->CompressOut(serial_buffer.get(), &serial_crc32,
+                                          &serial_bytes_written));
+  EXPECT_EQ(crc32(0, reinterpret_cast<const uint8_t *>(contents.c_str()),
+                  contents.size()),
+            serial_crc32);
+
+  ThreadPool::Shared().SetSize(3);
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[contents.size()]);
+  uint32_t crc32 = 0;
+  uint64_t bytes_written;
+  ASSERT_EQ(Z_DEFLATED,
+            transient_bytes_->CompressOut(buffer.get(), &crc32,
+                                          &bytes_written));
+  ThreadPool::Shared().SetSize(0);
+  EXPECT_EQ(serial_crc32, crc32);
+  ASSERT_EQ(serial_bytes_written, bytes_written);
+  EXPECT_EQ(0, memcmp(serial_buffer.get(), buffer.get(), bytes_written));
+
+  // Verify contents.
+  std::unique_ptr<uint8_t[]> inflated(new uint8_t[contents.size() + 1]);
+  Inflater inflater;
+  inflater.DataToInflate(buffer.get(), bytes_written);
+  ASSERT_EQ(Z_STREAM_END,
+            inflater.Inflate(inflated.get(), contents.size() + 1));
+  ASSERT_EQ(contents.size(), inflater.total_out());
+  EXPECT_EQ(0, memcmp(contents.c_str(), inflated.get(), contents.size()));
+}
+
 // Verify CopyOut.
 TEST_F(TransientBytesTest, CopyOut) {
   transient_bytes_->Append("a");
@@ -0,0 +1,25 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BAZEL_SRC_TOOLS_SINGLEJAR_WORKER_H_
+#define BAZEL_SRC_TOOLS_SINGLEJAR_WORKER_H_ 1
+
+/*
+ * Runs singlejar with the command line, argv[0] being the program name.
+ * It is what main() does, and what the persistent worker mode (see
+ * src/tools/worker/worker.h) does for each request.
+ */
+int SingleJarMain(int argc, char *argv[]);
+
+#endif  //  BAZEL_SRC_TOOLS_SINGLEJAR_WORKER_H_
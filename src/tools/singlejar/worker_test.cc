@@ -0,0 +1,128 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "src/tools/singlejar/test_util.h"
+#include "src/tools/singlejar/worker.h"
+#include "src/tools/worker/worker.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using singlejar_test_util::OutputFilePath;
+using singlejar_test_util::VerifyZip;
+
+// Encodes a WorkRequest with given arguments and an input, preceded by its
+// length.
+std::string DelimitedRequest(const std::vector<std::string> &arguments) {
+  std::string message;
+  for (auto &argument : arguments) {
+    EXPECT_GT(128, argument.size());
+    message += '\x0A';
+    message += static_cast<char>(argument.size());
+    message += argument;
+  }
+  // inputs { path: "x" digest: "y" }
+  message += std::string("\x12\x06\x0A\x01x\x12\x01y", 8);
+  EXPECT_GT(128, message.size());
+  return static_cast<char>(message.size()) + message;
+}
+
+uint64_t ReadVarint(const std::string &in, size_t *pos) {
+  uint64_t value = 0;
+  for (int shift = 0; *pos < in.size(); shift += 7) {
+    uint8_t byte = in[(*pos)++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  return value;
+}
+
+// Decodes the length-delimited WorkResponse messages.
+struct Response {
+  int exit_code;
+  std::string output;
+};
+
+std::vector<Response> DecodeResponses(const std::string &in) {
+  std::vector<Response> responses;
+  size_t pos = 0;
+  while (pos < in.size()) {
+    size_t size = ReadVarint(in, &pos);
+    size_t end = pos + size;
+    Response response = {0, ""};
+    while (pos < end) {
+      uint64_t key = ReadVarint(in, &pos);
+      if (key == 0x08) {
+        response.exit_code = ReadVarint(in, &pos);
+      } else if (key == 0x12) {
+        size_t output_size = ReadVarint(in, &pos);
+        response.output.assign(in, pos, output_size);
+        pos += output_size;
+      } else {
+        ADD_FAILURE() << "Unexpected key " << key;
+        return responses;
+      }
+    }
+    responses.push_back(response);
+  }
+  return responses;
+}
+
+// A failed request does not affect the subsequent ones.
+TEST(WorkerTest, Requests) {
+  std::string out_path1 = OutputFilePath("out1.jar");
+  std::string out_path2 = OutputFilePath("out2.jar");
+  std::string requests =
+      DelimitedRequest({"--output", out_path1}) +
+      DelimitedRequest({"--output", out_path2, "--sources", "nonexistent"}) +
+      DelimitedRequest({"--output", out_path2});
+  int in_fds[2];
+  int out_fds[2];
+  ASSERT_EQ(0, pipe(in_fds));
+  ASSERT_EQ(0, pipe(out_fds));
+  ASSERT_EQ(requests.size(),
+            write(in_fds[1], requests.data(), requests.size()));
+  close(in_fds[1]);
+  blaze_worker::Worker worker(in_fds[0], out_fds[1], "singlejar",
+                              SingleJarMain);
+  EXPECT_EQ(0, worker.Run());
+  close(in_fds[0]);
+  close(out_fds[1]);
+
+  std::string responses;
+  char buffer[4096];
+  ssize_t n_read;
+  while ((n_read = read(out_fds[0], buffer, sizeof(buffer))) > 0) {
+    responses.append(buffer, n_read);
+  }
+  close(out_fds[0]);
+  auto decoded = DecodeResponses(responses);
+  ASSERT_EQ(3, decoded.size());
+  EXPECT_EQ(0, decoded[0].exit_code);
+  EXPECT_NE(0, decoded[1].exit_code);
+  EXPECT_NE(std::string::npos, decoded[1].output.find("nonexistent"))
+      << decoded[1].output;
+  EXPECT_EQ(0, decoded[2].exit_code);
+  EXPECT_EQ(0, VerifyZip(out_path1));
+  EXPECT_EQ(0, VerifyZip(out_path2));
+}
+
+}  // namespace
@@ -165,6 +165,31 @@ class UnixTimeExtraField : public ExtraField {
 static_assert(5 == sizeof(UnixTimeExtraField),
               "UnixTimeExtraField layout is incorrect");
 
+/* Alignment Extra Field, the one Android's zipalign pads local headers with.
+ * Its payload is the alignment the data of the entry has been aligned to,
+ * followed by as many zero bytes as needed to make the entry data start at
+ * the offset that is a multiple of it.
+ */
+class AlignmentExtraField : public ExtraField {
+ public:
+  static const AlignmentExtraField *find(const uint8_t *start,
+                                         const uint8_t *end) {
+    return reinterpret_cast<const AlignmentExtraField *>(
+        ExtraField::find(0xD935, start, end));
+  }
+  bool is() const { return ExtraField::is(0xD935); }
+  void signature() { ExtraField::signature(0xD935); }
+
+  uint16_t alignment() const { return le16toh(alignment_); }
+  void alignment(uint16_t v) { alignment_ = htole16(v); }
+
+ private:
+  uint16_t alignment_;
+  uint8_t padding_[];
+} __attribute__((packed));
+static_assert(6 == sizeof(AlignmentExtraField),
+              "AlignmentExtraField layout is incorrect");
+
 /* Local Header precedes each archive file data (section 4.3.7).  */
 class LH {
  public:
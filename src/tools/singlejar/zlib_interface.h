@@ -17,9 +17,20 @@
 
 #include <stdint.h>
 
+#include <memory>
+#include <vector>
+
 #include "src/tools/singlejar/diag.h"
 #include <zlib.h>
 
+// With SINGLEJAR_LIBDEFLATE defined, InflateBuffer() and DeflateBuffer()
+// below use libdeflate, which is considerably faster than zlib when the whole
+// input and output are in memory. Either way the output is a standard deflate
+// stream, but the compressed bytes are not the same.
+#if defined(SINGLEJAR_LIBDEFLATE)
+#include <libdeflate.h>
+#endif
+
 // An interface to zlib's inflater. Usage:
 //   Inflater inflater;
 //   inflater.DataToInflate(data, data_size);
@@ -37,6 +48,9 @@
 class Inflater {
  public:
   Inflater() {
+#if defined(SINGLEJAR_LIBDEFLATE)
+    decompressor_ = nullptr;
+#endif
     zstream_.zalloc = Z_NULL;
     zstream_.zfree = Z_NULL;
     zstream_.opaque = Z_NULL;
@@ -48,10 +62,42 @@ class Inflater {
     }
   }
 
-  ~Inflater() { inflateEnd(&zstream_); }
+  ~Inflater() {
+#if defined(SINGLEJAR_LIBDEFLATE)
+    if (decompressor_ != nullptr) {
+      libdeflate_free_decompressor(decompressor_);
+    }
+#endif
+    inflateEnd(&zstream_);
+  }
 
   void reset() { inflateReset(&zstream_); }
 
+  // Inflates the whole of the given data to the buffer, which should be
+  // exactly as large as the inflated data. Returns false on error.
+  bool InflateBuffer(const uint8_t *in_buffer, uint32_t in_buffer_length,
+                     uint8_t *out_buffer, uint32_t out_buffer_length) {
+#if defined(SINGLEJAR_LIBDEFLATE)
+    if (decompressor_ == nullptr &&
+        (decompressor_ = libdeflate_alloc_decompressor()) == nullptr) {
+      diag_errx(2, "libdeflate_alloc_decompressor failed");
+    }
+    return LIBDEFLATE_SUCCESS ==
+           libdeflate_deflate_decompress(decompressor_, in_buffer,
+                                         in_buffer_length, out_buffer,
+                                         out_buffer_length, nullptr);
+#else
+    reset();
+    DataToInflate(in_buffer, in_buffer_length);
+    zstream_.next_out = out_buffer;
+    zstream_.avail_out = out_buffer_length;
+    bool ok = Z_STREAM_END == inflate(&zstream_, Z_FINISH) &&
+              zstream_.total_out == out_buffer_length;
+    reset();
+    return ok;
+#endif
+  }
+
   void DataToInflate(const uint8_t *in_buffer, uint32_t in_buffer_length) {
     zstream_.next_in = const_cast<uint8_t *>(in_buffer);
     zstream_.avail_in = in_buffer_length;
@@ -64,6 +110,7 @@ class Inflater {
   }
 
   const uint8_t *next_in() const { return zstream_.next_in; }
+  uint32_t available_in() const { return zstream_.avail_in; }
   uint64_t total_in() const { return zstream_.total_in; }
 
   uint32_t available_out() const { return zstream_.avail_out; }
@@ -73,6 +120,9 @@ class Inflater {
 
  private:
   z_stream zstream_;
+#if defined(SINGLEJAR_LIBDEFLATE)
+  struct libdeflate_decompressor *decompressor_;
+#endif
 };
 
 // A little wrapper around zlib's deflater.
@@ -87,6 +137,9 @@ struct Deflater : z_stream {
     avail_in = 0;
     next_out = nullptr;
     avail_out = 0;
+#if defined(SINGLEJAR_LIBDEFLATE)
+    compressor_ = nullptr;
+#endif
     int ret = deflateInit2(this, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
                            8, Z_DEFAULT_STRATEGY);
     if (ret != Z_OK) {
@@ -94,13 +147,99 @@ struct Deflater : z_stream {
     }
   }
 
-  ~Deflater() { deflateEnd(this); }
+  ~Deflater() {
+#if defined(SINGLEJAR_LIBDEFLATE)
+    if (compressor_ != nullptr) {
+      libdeflate_free_compressor(compressor_);
+    }
+#endif
+    deflateEnd(this);
+  }
+
+  void reset() { deflateReset(this); }
 
   int Deflate(const uint8_t *data, uint32_t data_size, int flag) {
     next_in = const_cast<uint8_t *>(data);
     avail_in = data_size;
     return deflate(this, flag);
   }
+
+  // Deflates the whole of the given data to the buffer. Returns the size of
+  // the deflated data, or 0 if it does not fit into the buffer. Can be called
+  // only once between resets.
+  uint32_t DeflateBuffer(const uint8_t *data, uint32_t data_size,
+                         uint8_t *out_buffer, uint32_t out_buffer_length) {
+#if defined(SINGLEJAR_LIBDEFLATE)
+    // Level 6 is the same as Z_DEFAULT_COMPRESSION.
+    if (compressor_ == nullptr &&
+        (compressor_ = libdeflate_alloc_compressor(6)) == nullptr) {
+      diag_errx(2, "libdeflate_alloc_compressor failed");
+    }
+    return libdeflate_deflate_compress(compressor_, data, data_size,
+                                       out_buffer, out_buffer_length);
+#else
+    next_out = out_buffer;
+    avail_out = out_buffer_length;
+    int ret = Deflate(data, data_size, Z_FINISH);
+    if (ret == Z_STREAM_END) {
+      return total_out;
+    } else if (ret != Z_OK) {
+      diag_errx(2, "%s:%d: deflate error %d(%s)", __FILE__, __LINE__, ret, msg);
+    }
+    return 0;
+#endif
+  }
+
+#if defined(SINGLEJAR_LIBDEFLATE)
+ private:
+  struct libdeflate_compressor *compressor_;
+#endif
+};
+
+// The Inflaters or Deflaters released on a thread, kept for the next Acquire()
+// on it. Setting up a zlib stream allocates its window and, for a deflater,
+// about 256KB of hash tables, which costs more than compressing a small entry;
+// a pooled stream is only reset. Usage:
+//   ZStreamPool<Deflater>::Ptr deflater = ZStreamPool<Deflater>::Acquire();
+//   deflater->DeflateBuffer(...);
+// The stream goes back to the pool of the releasing thread when the pointer
+// is destroyed, which must happen before that thread exits.
+template <typename Stream>
+class ZStreamPool {
+ public:
+  struct Releaser {
+    void operator()(Stream *stream) const { Release(stream); }
+  };
+  typedef std::unique_ptr<Stream, Releaser> Ptr;
+
+  static Ptr Acquire() {
+    std::vector<std::unique_ptr<Stream>> &pool = Pool();
+    if (pool.empty()) {
+      return Ptr(new Stream());
+    }
+    Stream *stream = pool.back().release();
+    pool.pop_back();
+    return Ptr(stream);
+  }
+
+ private:
+  // Enough for the streams a thread uses at the same time.
+  static const size_t kMaxPooled = 4;
+
+  static void Release(Stream *stream) {
+    std::vector<std::unique_ptr<Stream>> &pool = Pool();
+    if (pool.size() < kMaxPooled) {
+      stream->reset();
+      pool.emplace_back(stream);
+    } else {
+      delete stream;
+    }
+  }
+
+  static std::vector<std::unique_ptr<Stream>> &Pool() {
+    static thread_local std::vector<std::unique_ptr<Stream>> pool;
+    return pool;
+  }
 };
 
 #endif  // BAZEL_SRC_TOOLS_SINGLEJAR_ZLIB_INTERFACE_H_
@@ -91,4 +91,64 @@ TEST(ZlibInterfaceTest, InflateToChunks) {
   EXPECT_EQ(0, memcmp(bytes, uncompressed, sizeof(bytes)));
 }
 
+TEST(ZlibInterfaceTest, Buffers) {
+  uint8_t compressed[256];
+  Deflater deflater;
+  uint32_t compressed_size =
+      deflater.DeflateBuffer(bytes, sizeof(bytes), compressed,
+                             sizeof(compressed));
+  ASSERT_LT(0, compressed_size);
+
+  Inflater inflater;
+  uint8_t uncompressed[sizeof(bytes)];
+  memset(uncompressed, 0, sizeof(uncompressed));
+  EXPECT_TRUE(inflater.InflateBuffer(compressed, compressed_size,
+                                     uncompressed, sizeof(uncompressed)));
+  EXPECT_EQ(0, memcmp(bytes, uncompressed, sizeof(bytes)));
+  // The output buffer size should be exact.
+  EXPECT_FALSE(inflater.InflateBuffer(compressed, compressed_size,
+                                      uncompressed, sizeof(uncompressed) - 1));
+}
+
+TEST(ZlibInterfaceTest, DeflateBufferOverflow) {
+  uint8_t compressed[2];
+  Deflater deflater;
+  EXPECT_EQ(0, deflater.DeflateBuffer(bytes, sizeof(bytes), compressed,
+                                      sizeof(compressed)));
+}
+
+TEST(ZlibInterfaceTest, Pool) {
+  uint8_t compressed[256];
+  uint32_t compressed_size;
+  Deflater *first;
+  {
+    ZStreamPool<Deflater>::Ptr deflater = ZStreamPool<Deflater>::Acquire();
+    first = deflater.get();
+    // Leave the stream unfinished.
+    EXPECT_EQ(0, deflater->DeflateBuffer(bytes, sizeof(bytes), compressed, 2));
+  }
+  {
+    // The released stream is reused, reset.
+    ZStreamPool<Deflater>::Ptr deflater = ZStreamPool<Deflater>::Acquire();
+    EXPECT_EQ(first, deflater.get());
+    EXPECT_EQ(0, deflater->total_in);
+    compressed_size = deflater->DeflateBuffer(bytes, sizeof(bytes), compressed,
+                                              sizeof(compressed));
+    ASSERT_LT(0, compressed_size);
+    // Streams in use at the same time are different ones.
+    ZStreamPool<Deflater>::Ptr other = ZStreamPool<Deflater>::Acquire();
+    EXPECT_NE(deflater.get(), other.get());
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    ZStreamPool<Inflater>::Ptr inflater = ZStreamPool<Inflater>::Acquire();
+    uint8_t uncompressed[sizeof(bytes)];
+    memset(uncompressed, 0, sizeof(uncompressed));
+    inflater->DataToInflate(compressed, compressed_size);
+    EXPECT_EQ(Z_STREAM_END,
+              inflater->Inflate(uncompressed, sizeof(uncompressed)));
+    EXPECT_EQ(0, memcmp(bytes, uncompressed, sizeof(bytes)));
+  }
+}
+
 }  //  namespace
@@ -0,0 +1,608 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// worker.cc -- the persistent worker mode of the C++ tools.
+//
+
+#include "src/tools/worker/worker.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace blaze_worker {
+
+// The protobuf wire format.
+static const int kVarint = 0;
+static const int kFixed64 = 1;
+static const int kLengthDelimited = 2;
+static const int kFixed32 = 5;
+
+// WorkRequest.arguments and request_id, WorkResponse.exit_code, output and
+// request_id.
+static const int kArgumentsField = 1;
+static const int kRequestIdField = 3;
+static const int kExitCodeField = 1;
+static const int kOutputField = 2;
+
+static void AppendVarint(uint64_t value, std::string *out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+static void AppendInt32(int field, int32_t value, std::string *out) {
+  if (value != 0) {
+    AppendVarint(field << 3 | kVarint, out);
+    // Negative int32 values are sign-extended to 64 bits.
+    AppendVarint(static_cast<uint64_t>(static_cast<int64_t>(value)), out);
+  }
+}
+
+static bool ParseVarint(const char *in, size_t size, size_t *pos,
+                        uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *pos < size; shift += 7) {
+    uint8_t byte = in[(*pos)++];
+    *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DecodeRequest(const std::string &message, Request *request) {
+  return DecodeRequest(message.data(), message.size(), request);
+}
+
+bool DecodeRequest(const char *message, size_t size, Request *request) {
+  request->arguments.clear();
+  request->request_id = 0;
+  size_t pos = 0;
+  while (pos < size) {
+    uint64_t key;
+    uint64_t value;
+    if (!ParseVarint(message, size, &pos, &key)) {
+      return false;
+    }
+    switch (key & 7) {
+      case kVarint:
+        if (!ParseVarint(message, size, &pos, &value)) {
+          return false;
+        }
+        if ((key >> 3) == kRequestIdField) {
+          request->request_id = static_cast<int32_t>(value);
+        }
+        break;
+      case kFixed64:
+        pos += 8;
+        break;
+      case kLengthDelimited:
+        if (!ParseVarint(message, size, &pos, &value) || value > size - pos) {
+          return false;
+        }
+        if ((key >> 3) == kArgumentsField) {
+          request->arguments.emplace_back(message + pos, value);
+        }
+        // Skip anything else, e.g., the inputs.
+        pos += value;
+        break;
+      case kFixed32:
+        pos += 4;
+        break;
+      default:
+        return false;
+    }
+  }
+  return pos == size;
+}
+
+std::string EncodeResponse(int exit_code, const std::string &output,
+                           int32_t request_id) {
+  std::string message;
+  AppendInt32(kExitCodeField, exit_code, &message);
+  if (!output.empty()) {
+    AppendVarint(kOutputField << 3 | kLengthDelimited, &message);
+    AppendVarint(output.size(), &message);
+    message += output;
+  }
+  AppendInt32(kRequestIdField, request_id, &message);
+  return message;
+}
+
+static bool IsUnixSocket(int fd) {
+  struct sockaddr_storage address;
+  socklen_t length = sizeof(address);
+  return getsockname(fd, reinterpret_cast<struct sockaddr *>(&address),
+                     &length) == 0 &&
+         address.ss_family == AF_UNIX;
+}
+
+static bool WriteAll(int fd, const char *data, size_t size) {
+  for (size_t pos = 0; pos < size;) {
+    ssize_t n_written = write(fd, data + pos, size - pos);
+    if (n_written > 0) {
+      pos += n_written;
+    } else if (n_written < 0 && errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Writes the data to the socket, passing the descriptor with its first byte.
+static bool SendWithDescriptor(int socket, const std::string &data, int fd) {
+  struct iovec iov = {const_cast<char *>(data.data()), data.size()};
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  ssize_t n_sent;
+  while ((n_sent = sendmsg(socket, &msg, 0)) < 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return WriteAll(socket, data.data() + n_sent, data.size() - n_sent);
+}
+
+// Returns a descriptor of a new file without a name, or -1.
+static int CreateAnonymousFile() {
+  int fd;
+#if defined(__linux__) && defined(SYS_memfd_create)
+  fd = syscall(SYS_memfd_create, "WorkResponse", 0);
+  if (fd >= 0) {
+    return fd;
+  }
+#endif
+  const char *tmpdir = getenv("TMPDIR");
+  std::string path = std::string(tmpdir != NULL && *tmpdir ? tmpdir : "/tmp") +
+                     "/worker-XXXXXX";
+  fd = mkstemp(&path[0]);
+  if (fd >= 0) {
+    unlink(path.c_str());
+  }
+  return fd;
+}
+
+Worker::Worker(int in_fd, int out_fd, const char *program_name, Main main,
+               const Options &options)
+    : in_fd_(in_fd),
+      out_fd_(out_fd),
+      program_name_(program_name),
+      main_(main),
+      options_(options),
+      fd_passing_(options.fd_passing && IsUnixSocket(in_fd) &&
+                  IsUnixSocket(out_fd)),
+      mapped_message_(NULL),
+      mapped_size_(0),
+      passed_fd_(-1),
+      running_(0),
+      end_of_input_(false),
+      too_large_(false),
+      write_failed_(false) {}
+
+Worker::~Worker() {
+  ReleaseMessage();
+  if (passed_fd_ >= 0) {
+    close(passed_fd_);
+  }
+}
+
+int Worker::Run() {
+  // A response to a client which went away should not kill the worker
+  // before it notices the end of the input.
+  signal(SIGPIPE, SIG_IGN);
+  if (options_.fd_passing && !fd_passing_) {
+    fprintf(stderr,
+            "%s: not passing messages as files: the input and output are "
+            "not a Unix domain socket\n",
+            program_name_);
+  }
+  int threads = options_.max_threads > 0 ? options_.max_threads : 1;
+  for (int i = 0; i < threads; ++i) {
+    threads_.emplace_back(&Worker::ServeRequests, this);
+  }
+
+  const char *message;
+  size_t message_size;
+  Request request;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      // Every thread has at most one request waiting for it.
+      while (static_cast<int>(queue_.size()) >= threads && !write_failed_) {
+        changed_.wait(lock);
+      }
+      if (write_failed_) {
+        break;
+      }
+      if (too_large_) {
+        WaitUntilIdle(&lock);
+        ExecuteItself();
+      }
+    }
+    if (!ReadMessage(&message, &message_size)) {
+      break;
+    }
+    if (!DecodeRequest(message, message_size, &request)) {
+      Respond(1, std::string(program_name_) + ": malformed WorkRequest\n", 0);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool in_order = request.request_id == 0;
+    if (in_order) {
+      WaitUntilIdle(&lock);
+    }
+    queue_.push_back(request);
+    changed_.notify_all();
+    if (in_order) {
+      WaitUntilIdle(&lock);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    end_of_input_ = true;
+    changed_.notify_all();
+  }
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+  return write_failed_ ? 1 : 0;
+}
+
+void Worker::WaitUntilIdle(std::unique_lock<std::mutex> *lock) {
+  while (!queue_.empty() || running_ > 0) {
+    changed_.wait(*lock);
+  }
+}
+
+void Worker::ServeRequests() {
+  for (;;) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (queue_.empty() && !end_of_input_) {
+        changed_.wait(lock);
+      }
+      if (queue_.empty()) {
+        return;
+      }
+      request = queue_.front();
+      queue_.pop_front();
+      ++running_;
+      changed_.notify_all();
+    }
+    std::string output;
+    int exit_code = Execute(request.arguments, &output);
+    Respond(exit_code, output, request.request_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    --running_;
+    too_large_ = too_large_ || IsTooLarge();
+    changed_.notify_all();
+  }
+}
+
+void Worker::Respond(int exit_code, const std::string &output,
+                     int32_t request_id) {
+  std::lock_guard<std::mutex> write_lock(write_mutex_);
+  if (!WriteMessage(EncodeResponse(exit_code, output, request_id))) {
+    fprintf(stderr, "%s: cannot write WorkResponse: %s\n", program_name_,
+            strerror(errno));
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_failed_ = true;
+    changed_.notify_all();
+  }
+}
+
+bool Worker::IsTooLarge() const {
+  if (options_.max_rss_bytes == 0 || options_.argv == NULL) {
+    return false;
+  }
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) < 0) {
+    return false;
+  }
+#ifdef __APPLE__
+  uint64_t rss_bytes = usage.ru_maxrss;
+#else
+  uint64_t rss_bytes = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+  return rss_bytes > options_.max_rss_bytes;
+}
+
+void Worker::ExecuteItself() {
+  // No request is running, and the input is at the start of the next
+  // message, as it is read without buffering: the new process goes on
+  // where this one stopped, and the client does not notice.
+  fflush(NULL);
+#ifdef __linux__
+  execv("/proc/self/exe", options_.argv);
+#endif
+  execvp(options_.argv[0], options_.argv);
+  // Go on as we are.
+  fprintf(stderr, "%s: cannot execute %s: %s\n", program_name_,
+          options_.argv[0], strerror(errno));
+  too_large_ = false;
+}
+
+int Worker::ReadByte() {
+  uint8_t byte;
+  for (;;) {
+    ssize_t n_read;
+    if (fd_passing_) {
+      struct iovec iov = {&byte, 1};
+      union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+      } control;
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.buffer;
+      msg.msg_controllen = sizeof(control.buffer);
+      n_read = recvmsg(in_fd_, &msg, 0);
+      if (n_read == 1) {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+          if (cmsg->cmsg_level == SOL_SOCKET &&
+              cmsg->cmsg_type == SCM_RIGHTS) {
+            if (passed_fd_ >= 0) {
+              close(passed_fd_);
+            }
+            memcpy(&passed_fd_, CMSG_DATA(cmsg), sizeof(int));
+          }
+        }
+      }
+    } else {
+      n_read = read(in_fd_, &byte, 1);
+    }
+    if (n_read == 1) {
+      return byte;
+    } else if (n_read == 0 || errno != EINTR) {
+      return -1;
+    }
+  }
+}
+
+bool Worker::ReadMessage(const char **data, size_t *data_size) {
+  ReleaseMessage();
+  uint64_t size = 0;
+  for (int shift = 0;; shift += 7) {
+    int byte = ReadByte();
+    if (byte < 0 || shift >= 64) {
+      return false;
+    }
+    size |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  if (passed_fd_ >= 0) {
+    if (!MapPassedMessage(size)) {
+      return false;
+    }
+    *data = static_cast<const char *>(mapped_message_);
+    *data_size = size;
+    return true;
+  }
+  message_.resize(size);
+  for (size_t pos = 0; pos < size;) {
+    ssize_t n_read = read(in_fd_, &message_[pos], size - pos);
+    if (n_read > 0) {
+      pos += n_read;
+    } else if (n_read == 0 || errno != EINTR) {
+      fprintf(stderr, "%s: truncated WorkRequest\n", program_name_);
+      return false;
+    }
+  }
+  *data = message_.data();
+  *data_size = size;
+  return true;
+}
+
+bool Worker::MapPassedMessage(size_t size) {
+  int fd = passed_fd_;
+  passed_fd_ = -1;
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) < 0 ||
+      static_cast<uint64_t>(statbuf.st_size) < size) {
+    fprintf(stderr, "%s: the file of a passed WorkRequest is too short\n",
+            program_name_);
+    close(fd);
+    return false;
+  }
+  if (size > 0) {
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      fprintf(stderr, "%s: cannot map a passed WorkRequest: %s\n",
+              program_name_, strerror(errno));
+      close(fd);
+      return false;
+    }
+    mapped_message_ = mapped;
+    mapped_size_ = size;
+  } else {
+    mapped_message_ = const_cast<char *>("");
+  }
+  close(fd);
+  return true;
+}
+
+void Worker::ReleaseMessage() {
+  if (mapped_size_ > 0) {
+    munmap(mapped_message_, mapped_size_);
+  }
+  mapped_message_ = NULL;
+  mapped_size_ = 0;
+}
+
+bool Worker::WriteMessage(const std::string &message) {
+  std::string out;
+  AppendVarint(message.size(), &out);
+  if (fd_passing_ && message.size() >= kPassedMessageSize) {
+    int fd = CreateAnonymousFile();
+    if (fd >= 0 && WriteAll(fd, message.data(), message.size())) {
+      bool sent = SendWithDescriptor(out_fd_, out, fd);
+      close(fd);
+      return sent;
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    // Send it inline.
+  }
+  out += message;
+  return WriteAll(out_fd_, out.data(), out.size());
+}
+
+int Worker::Execute(const std::vector<std::string> &arguments,
+                    std::string *output) {
+  output->clear();
+  // Everything the child needs is allocated before fork().
+  std::vector<char *> argv;
+  argv.push_back(const_cast<char *>(program_name_));
+  for (auto &argument : arguments) {
+    argv.push_back(const_cast<char *>(argument.c_str()));
+  }
+  argv.push_back(NULL);
+
+  int pipe_fds[2];
+  pid_t pid;
+  {
+    std::lock_guard<std::mutex> fork_lock(fork_mutex_);
+    if (pipe(pipe_fds)) {
+      *output = std::string(program_name_) + ": cannot create a pipe\n";
+      return 1;
+    }
+    // Flush the buffers so that the child does not write them again.
+    fflush(NULL);
+    pid = fork();
+    if (pid == 0) {
+      // Anything printed goes to the response. The responses are written by
+      // the parent only, and the requests are read by it only.
+      close(pipe_fds[0]);
+      int null_fd = open("/dev/null", O_RDONLY);
+      if (null_fd < 0 || dup2(null_fd, STDIN_FILENO) < 0 ||
+          dup2(pipe_fds[1], STDOUT_FILENO) < 0 ||
+          dup2(pipe_fds[1], STDERR_FILENO) < 0) {
+        _exit(1);
+      }
+      close(pipe_fds[1]);
+      // Keep the lines of stdout and stderr in order, as on a terminal. glibc
+      // ignores the mode unless it gets a buffer.
+      static char stdout_buffer[BUFSIZ];
+      setvbuf(stdout, stdout_buffer, _IOLBF, sizeof(stdout_buffer));
+      signal(SIGPIPE, SIG_DFL);
+      int exit_code = main_(argv.size() - 1, argv.data());
+      fflush(NULL);
+      _exit(exit_code);
+    }
+    // Closed under the lock, so that no other child inherits the write end
+    // and keeps the output of this one open.
+    close(pipe_fds[1]);
+  }
+  if (pid < 0) {
+    close(pipe_fds[0]);
+    *output = std::string(program_name_) + ": cannot fork\n";
+    return 1;
+  }
+
+  char buffer[4096];
+  for (;;) {
+    ssize_t n_read = read(pipe_fds[0], buffer, sizeof(buffer));
+    if (n_read > 0) {
+      output->append(buffer, n_read);
+    } else if (n_read == 0 || errno != EINTR) {
+      break;
+    }
+  }
+  close(pipe_fds[0]);
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      *output += std::string(program_name_) + ": waitpid failed\n";
+      return 1;
+    }
+  }
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  if (WIFSIGNALED(status)) {
+    char message[100];
+    snprintf(message, sizeof(message), "%s: killed by signal %d\n",
+             program_name_, WTERMSIG(status));
+    *output += message;
+    return 128 + WTERMSIG(status);
+  }
+  return 1;
+}
+
+bool RunIfRequested(int argc, char **argv, const char *program_name,
+                    Main main, int *exit_code) {
+  bool requested = false;
+  Worker::Options options;
+  options.argv = argv;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--persistent_worker") == 0) {
+      requested = true;
+    } else if (strncmp(arg, "--worker_max_threads=", 21) == 0) {
+      options.max_threads = atoi(arg + 21);
+    } else if (strncmp(arg, "--worker_max_rss_mb=", 20) == 0) {
+      options.max_rss_bytes = strtoull(arg + 20, NULL, 10) << 20;
+    } else if (strcmp(arg, "--worker_fd_passing") == 0) {
+      options.fd_passing = true;
+    }
+  }
+  if (!requested) {
+    return false;
+  }
+  Worker worker(STDIN_FILENO, STDOUT_FILENO, program_name, main, options);
+  *exit_code = worker.Run();
+  return true;
+}
+
+}  // namespace blaze_worker
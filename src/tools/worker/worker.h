@@ -0,0 +1,185 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// worker.h -- the persistent worker mode of the C++ tools.
+//
+// A tool whose main() is a function of its command line becomes a worker
+// with a few lines:
+//
+//   int main(int argc, char **argv) {
+//     int exit_code;
+//     if (blaze_worker::RunIfRequested(argc, argv, "tool", ToolMain,
+//                                      &exit_code)) {
+//       return exit_code;
+//     }
+//     return ToolMain(argc, argv);
+//   }
+//
+
+#ifndef BAZEL_SRC_TOOLS_WORKER_WORKER_H_
+#define BAZEL_SRC_TOOLS_WORKER_WORKER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+namespace blaze_worker {
+
+// The function a request is run with: argv[0] is the program name, the
+// request arguments follow.
+typedef int (*Main)(int argc, char **argv);
+
+// The fields of a WorkRequest the worker uses.
+struct Request {
+  std::vector<std::string> arguments;
+  // 0 unless the client multiplexes requests.
+  int32_t request_id;
+};
+
+// Decodes a WorkRequest message, returns false if it is malformed.
+bool DecodeRequest(const std::string &message, Request *request);
+bool DecodeRequest(const char *message, size_t size, Request *request);
+
+// Encodes a WorkResponse message.
+std::string EncodeResponse(int exit_code, const std::string &output,
+                           int32_t request_id);
+
+// The persistent worker mode (see src/main/protobuf/worker_protocol.proto).
+// The worker reads WorkRequest messages, each preceded by its varint length,
+// from the input, and for each of them writes back the WorkResponse message
+// in the same format. The response carries the exit code and whatever the
+// request printed on the standard output and error.
+//
+// Each request is run in a child process forked from the worker: the tools
+// exit on errors, and the worker has to outlive a failed request. That also
+// gives every request a fresh heap, released when it ends. This still saves
+// the program startup and dynamic loading for each action.
+//
+// Requests with a request_id of 0 are run one at a time, in order. Requests
+// with other ids are run on up to max_threads threads at the same time; their
+// responses are written as they finish.
+//
+// With Options::fd_passing, on a Unix domain socket, e.g. one end of a
+// socketpair the client started the worker with as its standard input and
+// output, a message can also be passed as a file: its varint length is sent
+// alone, together with a descriptor (SCM_RIGHTS) of a file holding the
+// message from offset 0. Such requests are mapped rather than read into the
+// worker, and responses of kPassedMessageSize bytes or more are sent that
+// way. As the descriptor comes with the first byte of the length, either
+// side reads the length byte by byte and no further than the message at
+// hand. A client asks for this with --worker_fd_passing, and only when it
+// knows the tool supports it; on pipes the worker sticks to plain messages.
+//
+// Only the few fields the tools use are handled, so the messages are encoded
+// and decoded here rather than with the generated protobuf code.
+class Worker {
+ public:
+  // The size from which responses are passed as files with fd passing.
+  static const size_t kPassedMessageSize = 64 << 10;
+
+  struct Options {
+    Options()
+        : max_threads(1), max_rss_bytes(0), argv(NULL), fd_passing(false) {}
+
+    // How many multiplexed requests run at the same time.
+    int max_threads;
+    // When the worker itself has grown to this size, e.g. with the
+    // messages of large requests, it executes itself again between two
+    // requests, with the same input and output. 0 for no limit.
+    uint64_t max_rss_bytes;
+    // The command line it executes itself with; required for max_rss_bytes.
+    char **argv;
+    // Whether messages can be passed as files, see above.
+    bool fd_passing;
+  };
+
+  Worker(int in_fd, int out_fd, const char *program_name, Main main,
+         const Options &options = Options());
+  ~Worker();
+
+  // Serves the requests until the end of the input. Returns the exit code
+  // for the worker process.
+  int Run();
+
+ private:
+  // Reads the next length-delimited message, returns false at the end of
+  // the input or on error. *data and *size are valid until the next call.
+  bool ReadMessage(const char **data, size_t *size);
+  // Maps the message passed with passed_fd_, and closes that.
+  bool MapPassedMessage(size_t size);
+  void ReleaseMessage();
+  // Writes a length-delimited message, or with fd passing, a large one as
+  // a file. Returns false on error.
+  bool WriteMessage(const std::string &message);
+  // Reads next byte of the input, returns -1 at the end or on error. With
+  // fd passing, a descriptor sent with it is kept in passed_fd_.
+  int ReadByte();
+  // Runs the requests of the queue until the end of the input.
+  void ServeRequests();
+  void Respond(int exit_code, const std::string &output, int32_t request_id);
+  // Runs a request in a child process, returns its exit code and saves its
+  // output.
+  int Execute(const std::vector<std::string> &arguments, std::string *output);
+  // Blocks until no request is queued or running; mutex_ is held.
+  void WaitUntilIdle(std::unique_lock<std::mutex> *lock);
+  bool IsTooLarge() const;
+  void ExecuteItself();
+
+  const int in_fd_;
+  const int out_fd_;
+  const char *const program_name_;
+  const Main main_;
+  const Options options_;
+  const bool fd_passing_;
+
+  // Used by the thread reading the requests only: the message last read,
+  // either in message_ or mapped, and the descriptor passed with the length
+  // of the message being read, or -1.
+  std::string message_;
+  void *mapped_message_;
+  size_t mapped_size_;
+  int passed_fd_;
+
+  // Guards the fields below it.
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<Request> queue_;
+  int running_;
+  bool end_of_input_;
+  bool too_large_;
+  bool write_failed_;
+
+  // Held while writing a response, and while forking, so that the children
+  // do not inherit the locks of the other threads in a random state.
+  std::mutex write_mutex_;
+  std::mutex fork_mutex_;
+  std::vector<std::thread> threads_;
+};
+
+// Runs a worker on the standard input and output and returns true, with
+// its exit code in *exit_code, if argv has --persistent_worker. The worker
+// also takes --worker_max_threads=<n>, --worker_max_rss_mb=<n> and
+// --worker_fd_passing.
+bool RunIfRequested(int argc, char **argv, const char *program_name,
+                    Main main, int *exit_code);
+
+}  // namespace blaze_worker
+
+#endif  // BAZEL_SRC_TOOLS_WORKER_WORKER_H_
@@ -0,0 +1,357 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>  // NOLINT
+#include <map>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "src/tools/worker/worker.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using blaze_worker::Request;
+using blaze_worker::Worker;
+
+// Prints its arguments to stdout and stderr. The first one says how it
+// ends: "ok", "exit" with code 3, "abort", "sleep" for 200 ms, or "large"
+// after printing 100000 more bytes.
+int TestMain(int argc, char **argv) {
+  if (argc < 2) {
+    return 2;
+  }
+  printf("%s:", argv[0]);
+  for (int i = 1; i < argc; ++i) {
+    printf(" %s", argv[i]);
+  }
+  printf("\n");
+  fprintf(stderr, "to stderr\n");
+  if (strcmp(argv[1], "exit") == 0) {
+    exit(3);
+  } else if (strcmp(argv[1], "abort") == 0) {
+    fflush(NULL);
+    abort();
+  } else if (strcmp(argv[1], "sleep") == 0) {
+    usleep(200 * 1000);
+  } else if (strcmp(argv[1], "large") == 0) {
+    printf("%s", std::string(100000, 'x').c_str());
+  }
+  return 0;
+}
+
+// Encodes a WorkRequest with given arguments, request id and an input,
+// preceded by its length.
+std::string DelimitedRequest(const std::vector<std::string> &arguments,
+                             int request_id = 0) {
+  std::string message;
+  for (auto &argument : arguments) {
+    EXPECT_GT(128, argument.size());
+    message += '\x0A';
+    message += static_cast<char>(argument.size());
+    message += argument;
+  }
+  // inputs { path: "x" digest: "y" }
+  message += std::string("\x12\x06\x0A\x01x\x12\x01y", 8);
+  if (request_id != 0) {
+    EXPECT_GT(128, request_id);
+    message += '\x18';
+    message += static_cast<char>(request_id);
+  }
+  EXPECT_GT(128, message.size());
+  return static_cast<char>(message.size()) + message;
+}
+
+uint64_t ReadVarint(const std::string &in, size_t *pos) {
+  uint64_t value = 0;
+  for (int shift = 0; *pos < in.size(); shift += 7) {
+    uint8_t byte = in[(*pos)++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  return value;
+}
+
+// Decodes the length-delimited WorkResponse messages.
+struct Response {
+  int exit_code;
+  std::string output;
+  int request_id;
+};
+
+std::vector<Response> DecodeResponses(const std::string &in) {
+  std::vector<Response> responses;
+  size_t pos = 0;
+  while (pos < in.size()) {
+    size_t size = ReadVarint(in, &pos);
+    size_t end = pos + size;
+    Response response = {0, "", 0};
+    while (pos < end) {
+      uint64_t key = ReadVarint(in, &pos);
+      if (key == 0x08) {
+        response.exit_code = ReadVarint(in, &pos);
+      } else if (key == 0x12) {
+        size_t output_size = ReadVarint(in, &pos);
+        response.output.assign(in, pos, output_size);
+        pos += output_size;
+      } else if (key == 0x18) {
+        response.request_id = ReadVarint(in, &pos);
+      } else {
+        ADD_FAILURE() << "Unexpected key " << key;
+        return responses;
+      }
+    }
+    responses.push_back(response);
+  }
+  return responses;
+}
+
+// Runs a worker on the requests, returns its responses. They are read as
+// they come, so that the large ones do not fill the pipe.
+std::vector<Response> Serve(const std::string &requests,
+                            const Worker::Options &options = Worker::Options()) {
+  int in_fds[2];
+  int out_fds[2];
+  EXPECT_EQ(0, pipe(in_fds));
+  EXPECT_EQ(0, pipe(out_fds));
+  EXPECT_EQ(requests.size(),
+            write(in_fds[1], requests.data(), requests.size()));
+  close(in_fds[1]);
+  std::string responses;
+  std::thread reader([&responses, &out_fds]() {
+    char buffer[4096];
+    ssize_t n_read;
+    while ((n_read = read(out_fds[0], buffer, sizeof(buffer))) > 0) {
+      responses.append(buffer, n_read);
+    }
+  });
+  Worker worker(in_fds[0], out_fds[1], "test", TestMain, options);
+  EXPECT_EQ(0, worker.Run());
+  close(in_fds[0]);
+  close(out_fds[1]);
+  reader.join();
+  close(out_fds[0]);
+  return DecodeResponses(responses);
+}
+
+// Sends the data on the socket with a descriptor.
+void SendWithDescriptor(int socket, const std::string &data, int fd) {
+  struct iovec iov = {const_cast<char *>(data.data()), data.size()};
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  EXPECT_EQ(static_cast<ssize_t>(data.size()), sendmsg(socket, &msg, 0));
+}
+
+// Reads the responses on the socket as a client has to, the length byte by
+// byte and the message exactly, so that a descriptor comes with the message
+// it belongs to. Returns them as plain length-delimited messages, and the
+// number of them passed as files.
+std::string ReceiveResponses(int socket, int *passed) {
+  *passed = 0;
+  std::string responses;
+  for (;;) {
+    std::string length;
+    int fd = -1;
+    char byte;
+    do {
+      struct iovec iov = {&byte, 1};
+      char control[CMSG_SPACE(sizeof(int))];
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (recvmsg(socket, &msg, 0) != 1) {
+        return responses;
+      }
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+      }
+      length += byte;
+    } while (byte & 0x80);
+    size_t pos = 0;
+    size_t size = ReadVarint(length, &pos);
+    std::string message(size, '\0');
+    if (fd >= 0) {
+      EXPECT_EQ(static_cast<ssize_t>(size), pread(fd, &message[0], size, 0));
+      close(fd);
+      ++*passed;
+    } else {
+      EXPECT_EQ(static_cast<ssize_t>(size),
+                recv(socket, &message[0], size, MSG_WAITALL));
+    }
+    responses += length + message;
+  }
+}
+
+TEST(WorkerTest, DecodeRequest) {
+  Request request;
+  std::string message = DelimitedRequest({"--output", "out.jar"}, 5).substr(1);
+  ASSERT_TRUE(blaze_worker::DecodeRequest(message, &request));
+  ASSERT_EQ(2, request.arguments.size());
+  EXPECT_EQ("--output", request.arguments[0]);
+  EXPECT_EQ("out.jar", request.arguments[1]);
+  EXPECT_EQ(5, request.request_id);
+  EXPECT_TRUE(blaze_worker::DecodeRequest("", &request));
+  EXPECT_TRUE(request.arguments.empty());
+  EXPECT_EQ(0, request.request_id);
+  // Truncated.
+  EXPECT_FALSE(blaze_worker::DecodeRequest(message.substr(0, 5), &request));
+}
+
+TEST(WorkerTest, EncodeResponse) {
+  EXPECT_EQ("", blaze_worker::EncodeResponse(0, "", 0));
+  EXPECT_EQ(std::string("\x08\x01\x12\x02ok", 6),
+            blaze_worker::EncodeResponse(1, "ok", 0));
+  EXPECT_EQ(std::string("\x12\x02ok\x18\x07", 6),
+            blaze_worker::EncodeResponse(0, "ok", 7));
+}
+
+// A failed request does not affect the subsequent ones.
+TEST(WorkerTest, Requests) {
+  auto responses = Serve(DelimitedRequest({"ok", "a"}) +
+                         DelimitedRequest({"exit"}) +
+                         DelimitedRequest({"abort"}) +
+                         DelimitedRequest({"ok", "b"}));
+  ASSERT_EQ(4, responses.size());
+  EXPECT_EQ(0, responses[0].exit_code);
+  EXPECT_EQ("test: ok a\nto stderr\n", responses[0].output);
+  EXPECT_EQ(3, responses[1].exit_code);
+  EXPECT_EQ("test: exit\nto stderr\n", responses[1].output);
+  EXPECT_EQ(128 + SIGABRT, responses[2].exit_code);
+  EXPECT_NE(std::string::npos,
+            responses[2].output.find("test: killed by signal"));
+  EXPECT_EQ(0, responses[3].exit_code);
+  EXPECT_EQ("test: ok b\nto stderr\n", responses[3].output);
+}
+
+TEST(WorkerTest, MalformedRequest) {
+  auto responses = Serve(std::string("\x02\x0A\x05", 3) +
+                         DelimitedRequest({"ok"}));
+  ASSERT_EQ(2, responses.size());
+  EXPECT_EQ(1, responses[0].exit_code);
+  EXPECT_EQ("test: malformed WorkRequest\n", responses[0].output);
+  EXPECT_EQ(0, responses[1].exit_code);
+}
+
+// Multiplexed requests run at the same time, and each response has the id
+// of its request.
+TEST(WorkerTest, MultiplexedRequests) {
+  Worker::Options options;
+  options.max_threads = 4;
+  std::string requests;
+  for (int id = 1; id <= 4; ++id) {
+    requests += DelimitedRequest({"sleep", std::to_string(id)}, id);
+  }
+  auto start = std::chrono::steady_clock::now();
+  auto responses = Serve(requests, options);
+  // Sequentially, it would take 800 ms.
+  EXPECT_GT(std::chrono::milliseconds(600),
+            std::chrono::steady_clock::now() - start);
+  ASSERT_EQ(4, responses.size());
+  std::map<int, std::string> outputs;
+  for (auto &response : responses) {
+    EXPECT_EQ(0, response.exit_code);
+    outputs[response.request_id] = response.output;
+  }
+  ASSERT_EQ(4, outputs.size());
+  for (int id = 1; id <= 4; ++id) {
+    EXPECT_EQ("test: sleep " + std::to_string(id) + "\nto stderr\n",
+              outputs[id]);
+  }
+}
+
+// Requests without an id are answered in order even with many threads.
+TEST(WorkerTest, UnmultiplexedRequestsKeepTheirOrder) {
+  Worker::Options options;
+  options.max_threads = 4;
+  auto responses = Serve(DelimitedRequest({"sleep", "a"}) +
+                         DelimitedRequest({"ok", "b"}), options);
+  ASSERT_EQ(2, responses.size());
+  EXPECT_EQ("test: sleep a\nto stderr\n", responses[0].output);
+  EXPECT_EQ("test: ok b\nto stderr\n", responses[1].output);
+}
+
+// With fd passing, requests can come as files, and large responses go as
+// files.
+TEST(WorkerTest, PassedMessages) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  std::string inline_request = DelimitedRequest({"ok", "a"});
+  ASSERT_EQ(static_cast<ssize_t>(inline_request.size()),
+            write(fds[1], inline_request.data(), inline_request.size()));
+  std::string passed_request = DelimitedRequest({"large", "b"});
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  std::string path =
+      std::string(tmpdir != NULL ? tmpdir : "/tmp") + "/worker_test_request";
+  FILE *file = fopen(path.c_str(), "w+");
+  ASSERT_NE(nullptr, file);
+  unlink(path.c_str());
+  // The length byte goes on the socket, the message in the file.
+  fwrite(passed_request.data() + 1, 1, passed_request.size() - 1, file);
+  fflush(file);
+  SendWithDescriptor(fds[1], passed_request.substr(0, 1), fileno(file));
+  fclose(file);
+  shutdown(fds[1], SHUT_WR);
+
+  Worker::Options options;
+  options.fd_passing = true;
+  Worker worker(fds[0], fds[0], "test", TestMain, options);
+  EXPECT_EQ(0, worker.Run());
+  close(fds[0]);
+  int passed;
+  auto responses = DecodeResponses(ReceiveResponses(fds[1], &passed));
+  close(fds[1]);
+  EXPECT_EQ(1, passed);
+  ASSERT_EQ(2, responses.size());
+  EXPECT_EQ("test: ok a\nto stderr\n", responses[0].output);
+  EXPECT_EQ("test: large b\nto stderr\n" + std::string(100000, 'x'),
+            responses[1].output);
+}
+
+// On pipes, fd passing is not used.
+TEST(WorkerTest, NoPassedMessagesOnPipes) {
+  Worker::Options options;
+  options.fd_passing = true;
+  auto responses = Serve(DelimitedRequest({"large"}), options);
+  ASSERT_EQ(1, responses.size());
+  EXPECT_EQ("test: large\nto stderr\n" + std::string(100000, 'x'),
+            responses[0].output);
+}
+
+}  // namespace
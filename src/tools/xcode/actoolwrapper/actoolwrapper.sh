@@ -25,32 +25,45 @@ MY_LOCATION=${MY_LOCATION:-"$0.runfiles/bazel_tools/tools/objc"}
 REALPATH="${MY_LOCATION}/realpath"
 WRAPPER="${MY_LOCATION}/xcrunwrapper.sh"
 
-OUTZIP=$("${REALPATH}" "$1")
+OUTZIP="$1"
 shift 1
 TEMPDIR=$(mktemp -d "${TMPDIR:-/tmp}/actoolZippingOutput.XXXXXX")
 trap "rm -rf \"$TEMPDIR\"" EXIT
 
-# actool needs to have absolute paths sent to it, so we call realpaths on
-# on all arguments seeing if we can expand them.
+# actool needs to have absolute paths sent to it, so we call realpath on
+# all arguments seeing if we can expand them, in a single process together
+# with the output zip.
 # The argument for --output-partial-info-plist doesn't actually exist at the
 # time of flag parsing, so we create it so that we can call realpaths on it
 # to make the path absolute.
 # actool and ibtool appear to depend on the same code base.
 # Radar 21045660 ibtool has difficulty dealing with relative paths.
 
-TOOLARGS=()
+ARGS=()
+EXISTING=()
 LASTARG=""
 for i in $@; do
   if [ "$LASTARG" = "--output-partial-info-plist" ]; then
     touch "$i"
   fi
+  ARGS+=("$i")
   if [ -e "$i" ]; then
-    ARG=$("${REALPATH}" "$i")
-    TOOLARGS+=("$ARG")
+    EXISTING+=("$i")
+  fi
+  LASTARG="$i"
+done
+RESOLVED=$("${REALPATH}" "$OUTZIP" ${EXISTING[@]+"${EXISTING[@]}"})
+IFS=$'\n' read -d '' -r -a REALPATHS <<< "$RESOLVED" || true
+OUTZIP="${REALPATHS[0]}"
+TOOLARGS=()
+NEXT=1
+for i in ${ARGS[@]+"${ARGS[@]}"}; do
+  if [ -e "$i" ]; then
+    TOOLARGS+=("${REALPATHS[$NEXT]}")
+    NEXT=$((NEXT + 1))
   else
     TOOLARGS+=("$i")
   fi
-  LASTARG="$i"
 done
 
 # If we are running into problems figuring out actool issues, there are a couple
@@ -29,7 +29,7 @@ MY_LOCATION=${MY_LOCATION:-"$0.runfiles/bazel_tools/tools/objc"}
 REALPATH="${MY_LOCATION}/realpath"
 WRAPPER="${MY_LOCATION}/xcrunwrapper.sh"
 
-OUTZIP=$("${REALPATH}" "$1")
+OUTZIP="$1"
 ARCHIVEROOT="$2"
 shift 2
 TEMPDIR=$(mktemp -d "${TMPDIR:-/tmp}/ibtoolZippingOutput.XXXXXX")
@@ -38,16 +38,30 @@ trap "rm -rf \"$TEMPDIR\"" EXIT
 FULLPATH="$TEMPDIR/$ARCHIVEROOT"
 PARENTDIR=$(dirname "$FULLPATH")
 mkdir -p "$PARENTDIR"
-FULLPATH=$("${REALPATH}" "$FULLPATH")
 
-# IBTool needs to have absolute paths sent to it, so we call realpaths on
-# on all arguments seeing if we can expand them.
+# IBTool needs to have absolute paths sent to it, so we call realpath on
+# all arguments seeing if we can expand them, in a single process together
+# with the output paths.
 # Radar 21045660 ibtool has difficulty dealing with relative paths.
-TOOLARGS=()
+ARGS=()
+EXISTING=()
 for i in $@; do
+  ARGS+=("$i")
+  if [ -e "$i" ]; then
+    EXISTING+=("$i")
+  fi
+done
+RESOLVED=$("${REALPATH}" "$OUTZIP" "$FULLPATH" \
+    ${EXISTING[@]+"${EXISTING[@]}"})
+IFS=$'\n' read -d '' -r -a REALPATHS <<< "$RESOLVED" || true
+OUTZIP="${REALPATHS[0]}"
+FULLPATH="${REALPATHS[1]}"
+TOOLARGS=()
+NEXT=2
+for i in ${ARGS[@]+"${ARGS[@]}"}; do
   if [ -e "$i" ]; then
-    ARG=$("${REALPATH}" "$i")
-    TOOLARGS+=("$ARG")
+    TOOLARGS+=("${REALPATHS[$NEXT]}")
+    NEXT=$((NEXT + 1))
   else
     TOOLARGS+=("$i")
   fi
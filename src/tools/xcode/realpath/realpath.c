@@ -30,8 +30,8 @@
 #include <unistd.h>
 
 // Print a simple error message and exit.
-static void PrintError(const char *argv[]) {
-  fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+static void PrintError(const char *path) {
+  fprintf(stderr, "%s: %s\n", path, strerror(errno));
   exit(1);
 }
 
@@ -56,48 +56,77 @@ static char *JoinPaths(const char *path1, const char* path2) {
   return outPath;
 }
 
+// Returns the real path of the given path, allowing the last component to
+// not exist, or NULL with errno set.
+static char *ResolvePath(const char *path) {
+  char *goodPath = realpath(path, NULL);
+  if (goodPath != NULL) {
+    return goodPath;
+  }
+  if ((errno != ENOENT) || (strlen(path) == 0)) {
+    return NULL;
+  }
+
+  // If only the last element is missing, then call realpath on the parent
+  // dir and append the basename back onto it.
+
+  // Technically the strdup is not required on Mac OS X, but this
+  // keeps things compatible with other basename/dirname implementations
+  // that do require a string they can modify.
+  char *dirCopy = strdup(path);
+  char *baseCopy = strdup(path);
+  if (dirCopy == NULL || baseCopy == NULL) {
+    return NULL;
+  }
+  char *dir = dirname(dirCopy);
+  if (dir == NULL) {
+    return NULL;
+  }
+  char *base = basename(baseCopy);
+  if (base == NULL) {
+    return NULL;
+  }
+  char *realdir = realpath(dir, NULL);
+  if (realdir == NULL) {
+    return NULL;
+  }
+  return JoinPaths(realdir, base);
+}
+
+// Prints the real path of the given path, or exits with an error.
+static void PrintRealPath(const char *path) {
+  char *goodPath = ResolvePath(path);
+  if (goodPath == NULL) {
+    PrintError(path);
+  }
+  fprintf(stdout, "%s\n", goodPath);
+  free(goodPath);
+}
+
 // Since this is a simple utility that quits immediately, we are not worrying
 // about making the code more complex by freeing up any memory allocations.
 int main(int argc, const char *argv[]) {
-  if (argc != 2) {
-    fprintf(stderr, "realpath <path>\n");
+  if (argc < 2) {
+    fprintf(stderr, "realpath <path>...\n"
+                    "realpath --stdin\n");
     return 1;
   }
-  const char *path = argv[1];
-  char *goodPath = realpath(path, NULL);
-  if (goodPath == NULL) {
-    if ((errno != ENOENT) || (strlen(path) == 0)) {
-      PrintError(argv);
-    }
-
-    // If only the last element is missing, then call realpath on the parent
-    // dir and append the basename back onto it.
-
-    // Technically the strdup is not required on Mac OS X, but this
-    // keeps things compatible with other basename/dirname implementations
-    // that do require a string they can modify.
-    char *dirCopy = strdup(path);
-    char *baseCopy = strdup(path);
-    if (dirCopy == NULL || baseCopy == NULL) {
-      PrintError(argv);
-    }
-    char *dir = dirname(dirCopy);
-    if (dir == NULL) {
-      PrintError(argv);
-    }
-    char *base = basename(baseCopy);
-    if (base == NULL) {
-      PrintError(argv);
-    }
-    char *realdir = realpath(dir, NULL);
-    if (realdir == NULL) {
-      PrintError(argv);
-    }
-    goodPath = JoinPaths(realdir, base);
-    if (goodPath == NULL) {
-      PrintError(argv);
+  if (argc == 2 && strcmp(argv[1], "--stdin") == 0) {
+    // One path per line, so that scripts resolve any number of paths with a
+    // single process.
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, stdin)) > 0) {
+      if (line[length - 1] == '\n') {
+        line[length - 1] = '\0';
+      }
+      PrintRealPath(line);
     }
+    return 0;
+  }
+  for (int i = 1; i < argc; ++i) {
+    PrintRealPath(argv[i]);
   }
-  fprintf(stdout, "%s\n", goodPath);
   return 0;
 }
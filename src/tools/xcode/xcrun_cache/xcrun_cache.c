@@ -0,0 +1,322 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//
+//  xcrun_cache.c
+//
+//  Answers the xcrun queries whose answer only depends on the installed
+//  Xcode, such as `xcrun --find ibtool` or `xcrun --sdk iphoneos
+//  --show-sdk-path`, from a cache file. Each of them costs xcrun 100ms or
+//  more, and xcrun's own cache lives in $TMPDIR, which is new for every
+//  sandboxed action.
+//
+//  The answers are keyed by the query, DEVELOPER_DIR, SDKROOT, TOOLCHAINS
+//  and the identity of the version.plist of the Xcode, so that installing
+//  another Xcode, or updating it, starts over. DEVELOPER_DIR has to be set.
+//  Anything else, and anything when the cache cannot be used, is passed to
+//  xcrun as it is.
+//
+//  The cache file is $BAZEL_XCRUN_CACHE, or /var/tmp/bazel_xcrun_cache.<uid>.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char kXcrun[] = "/usr/bin/xcrun";
+
+// The cache starts over when it grows beyond this.
+static const off_t kMaxCacheSize = 1 << 20;
+
+// A growable string; the client frees `data`.
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+} Buffer;
+
+static int Append(Buffer *buffer, const char *data, size_t size) {
+  if (buffer->size + size + 1 > buffer->capacity) {
+    size_t capacity = (buffer->size + size + 1) * 2;
+    char *grown = realloc(buffer->data, capacity);
+    if (grown == NULL) {
+      return 0;
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+  buffer->data[buffer->size] = '\0';
+  return 1;
+}
+
+static int AppendString(Buffer *buffer, const char *s) {
+  return Append(buffer, s, strlen(s));
+}
+
+// Runs xcrun with the given arguments, in place of this process.
+static void ExecXcrun(char *argv[]) {
+  argv[0] = (char *)kXcrun;
+  execv(kXcrun, argv);
+  fprintf(stderr, "xcrun_cache: cannot execute %s: %s\n", kXcrun,
+          strerror(errno));
+  exit(1);
+}
+
+// Returns whether the arguments are a query that can be cached.
+static int IsCacheable(int argc, char *argv[]) {
+  int query = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--find") == 0 || strcmp(argv[i], "-f") == 0) {
+      if (++i == argc) {
+        return 0;
+      }
+      query = 1;
+    } else if (strcmp(argv[i], "--sdk") == 0 ||
+               strcmp(argv[i], "--toolchain") == 0) {
+      if (++i == argc) {
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--show-sdk-path") == 0 ||
+               strcmp(argv[i], "--show-sdk-version") == 0 ||
+               strcmp(argv[i], "--show-sdk-build-version") == 0 ||
+               strcmp(argv[i], "--show-sdk-platform-path") == 0 ||
+               strcmp(argv[i], "--show-sdk-platform-version") == 0) {
+      query = 1;
+    } else {
+      return 0;
+    }
+  }
+  return query;
+}
+
+// Appends the key of the query to the buffer. Returns 0 if it cannot be
+// cached.
+static int AppendKey(Buffer *key, int argc, char *argv[]) {
+  const char *developerDir = getenv("DEVELOPER_DIR");
+  if (developerDir == NULL || developerDir[0] == '\0') {
+    return 0;
+  }
+  // The version.plist of Xcode.app/Contents/Developer is in Contents; the
+  // command line tools do not have one.
+  Buffer plist = {NULL, 0, 0};
+  struct stat statbuf;
+  if (!AppendString(&plist, developerDir) ||
+      !AppendString(&plist, "/../version.plist")) {
+    free(plist.data);
+    return 0;
+  }
+  int found = stat(plist.data, &statbuf) == 0 ||
+              stat(developerDir, &statbuf) == 0;
+  free(plist.data);
+  if (!found) {
+    return 0;
+  }
+  char stamp[128];
+  snprintf(stamp, sizeof(stamp), "%lld.%lld.%lld",
+           (long long)statbuf.st_mtime, (long long)statbuf.st_ino,
+           (long long)statbuf.st_size);
+
+  const char *sdkroot = getenv("SDKROOT");
+  const char *toolchains = getenv("TOOLCHAINS");
+  if (!AppendString(key, developerDir) || !AppendString(key, "\x1f") ||
+      !AppendString(key, stamp) || !AppendString(key, "\x1f") ||
+      !AppendString(key, sdkroot != NULL ? sdkroot : "") ||
+      !AppendString(key, "\x1f") ||
+      !AppendString(key, toolchains != NULL ? toolchains : "")) {
+    return 0;
+  }
+  for (int i = 1; i < argc; ++i) {
+    if (!AppendString(key, "\x1f") || !AppendString(key, argv[i])) {
+      return 0;
+    }
+  }
+  // The entries are lines of the key and the answer separated by a tab.
+  return strpbrk(key->data, "\t\n") == NULL;
+}
+
+// Opens the cache file of this user, or returns -1.
+static int OpenCache(int flags) {
+  const char *path = getenv("BAZEL_XCRUN_CACHE");
+  char defaultPath[64];
+  if (path == NULL || path[0] == '\0') {
+    snprintf(defaultPath, sizeof(defaultPath), "/var/tmp/bazel_xcrun_cache.%d",
+             (int)getuid());
+    path = defaultPath;
+  }
+  int fd = open(path, flags | O_NOFOLLOW, 0600);
+  if (fd < 0) {
+    return -1;
+  }
+  // Do not trust a file another user may have planted.
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) < 0 || statbuf.st_uid != getuid() ||
+      !S_ISREG(statbuf.st_mode)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Returns the answer cached for the key, or NULL. The client frees it.
+static char *Lookup(const char *key) {
+  int fd = OpenCache(O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  Buffer contents = {NULL, 0, 0};
+  char chunk[16384];
+  ssize_t n_read;
+  while ((n_read = read(fd, chunk, sizeof(chunk))) > 0) {
+    if (!Append(&contents, chunk, n_read)) {
+      break;
+    }
+  }
+  close(fd);
+  if (contents.data == NULL) {
+    return NULL;
+  }
+
+  // The last entry wins.
+  char *answer = NULL;
+  size_t keyLength = strlen(key);
+  char *line = contents.data;
+  char *end;
+  while ((end = strchr(line, '\n')) != NULL) {
+    if ((size_t)(end - line) > keyLength && line[keyLength] == '\t' &&
+        memcmp(line, key, keyLength) == 0) {
+      free(answer);
+      answer = strndup(line + keyLength + 1, end - line - keyLength - 1);
+    }
+    line = end + 1;
+  }
+  free(contents.data);
+  return answer;
+}
+
+// Adds an entry to the cache, if it can.
+static void Store(const char *key, const char *answer) {
+  int fd = OpenCache(O_WRONLY | O_CREAT | O_APPEND);
+  if (fd < 0) {
+    return;
+  }
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) == 0 && statbuf.st_size > kMaxCacheSize) {
+    if (ftruncate(fd, 0) < 0) {
+      close(fd);
+      return;
+    }
+  }
+  Buffer entry = {NULL, 0, 0};
+  if (AppendString(&entry, key) && AppendString(&entry, "\t") &&
+      AppendString(&entry, answer) && AppendString(&entry, "\n")) {
+    // A single write, so that the entries of concurrent actions do not mix.
+    // If it fails, the entry is just not cached: lookups need a whole line.
+    ssize_t written = write(fd, entry.data, entry.size);
+    (void)written;
+  }
+  free(entry.data);
+  close(fd);
+}
+
+// Runs xcrun and returns what it printed, or NULL if it failed; its exit code
+// is in *exitCode.
+static char *RunXcrun(int argc, char *argv[], int *exitCode) {
+  *exitCode = 1;
+  int fds[2];
+  if (pipe(fds) < 0) {
+    return NULL;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    if (dup2(fds[1], STDOUT_FILENO) < 0) {
+      _exit(1);
+    }
+    close(fds[1]);
+    argv[0] = (char *)kXcrun;
+    execv(kXcrun, argv);
+    _exit(127);
+  }
+  close(fds[1]);
+  Buffer output = {NULL, 0, 0};
+  char chunk[4096];
+  ssize_t n_read;
+  while ((n_read = read(fds[0], chunk, sizeof(chunk))) != 0) {
+    if (n_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    Append(&output, chunk, n_read);
+  }
+  close(fds[0]);
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      free(output.data);
+      return NULL;
+    }
+  }
+  *exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  if (*exitCode != 0 || output.data == NULL) {
+    // Pass on whatever it printed.
+    if (output.data != NULL) {
+      fputs(output.data, stdout);
+    }
+    free(output.data);
+    return NULL;
+  }
+  return output.data;
+}
+
+int main(int argc, char *argv[]) {
+  Buffer key = {NULL, 0, 0};
+  if (!IsCacheable(argc, argv) || !AppendKey(&key, argc, argv)) {
+    ExecXcrun(argv);
+  }
+  char *answer = Lookup(key.data);
+  if (answer != NULL) {
+    fprintf(stdout, "%s\n", answer);
+    return 0;
+  }
+
+  int exitCode;
+  char *output = RunXcrun(argc, argv, &exitCode);
+  if (output == NULL) {
+    return exitCode;
+  }
+  fputs(output, stdout);
+  // Only single line answers are cached.
+  size_t length = strlen(output);
+  if (length > 1 && output[length - 1] == '\n' &&
+      memchr(output, '\n', length - 1) == NULL) {
+    output[length - 1] = '\0';
+    Store(key.data, output);
+  }
+  return 0;
+}
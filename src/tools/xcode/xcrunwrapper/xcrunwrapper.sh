@@ -27,6 +27,18 @@ set -eu
 TOOLNAME=$1
 shift
 
+# xcrun_cache answers the lookups of xcrun from a cache (see its README). It
+# is in the runfiles of this script, or next to it in the runfiles of the
+# wrapper running it. Without it, xcrun does the lookups.
+XCRUN_CACHE=""
+for CANDIDATE in "$0.runfiles/bazel_tools/tools/objc/xcrun_cache" \
+    "$(dirname "$0")/xcrun_cache" ; do
+  if [[ -x "${CANDIDATE}" ]] ; then
+    XCRUN_CACHE="${CANDIDATE}"
+    break
+  fi
+done
+
 # Pick values for DEVELOPER_DIR and SDKROOT as appropriate (if they weren't set)
 WRAPPER_DEVDIR="${DEVELOPER_DIR:-}"
 if [[ -z "${WRAPPER_DEVDIR}" ]] ; then
@@ -48,7 +60,12 @@ if [[ -z "${WRAPPER_SDKROOT:-}" ]] ; then
         ;;
     esac
   done
-  WRAPPER_SDKROOT="$(/usr/bin/xcrun --show-sdk-path --sdk ${WRAPPER_SDK})"
+  if [[ -n "${XCRUN_CACHE}" ]] ; then
+    WRAPPER_SDKROOT="$(DEVELOPER_DIR="${WRAPPER_DEVDIR}" "${XCRUN_CACHE}" \
+        --show-sdk-path --sdk ${WRAPPER_SDK})"
+  else
+    WRAPPER_SDKROOT="$(/usr/bin/xcrun --show-sdk-path --sdk ${WRAPPER_SDK})"
+  fi
 fi
 
 # Subsitute toolkit path placeholders.
@@ -59,4 +76,14 @@ for ARG in "$@" ; do
   UPDATEDARGS+=("${ARG}")
 done
 
+if [[ -n "${XCRUN_CACHE}" ]] ; then
+  # Run the tool xcrun would run, with the environment it would set.
+  export DEVELOPER_DIR="${WRAPPER_DEVDIR}"
+  TOOLPATH="$("${XCRUN_CACHE}" --find "${TOOLNAME}")"
+  if [[ -z "${SDKROOT:-}" ]] ; then
+    export SDKROOT="$("${XCRUN_CACHE}" --show-sdk-path)"
+  fi
+  exec "${TOOLPATH}" "${UPDATEDARGS[@]}"
+fi
+
 /usr/bin/xcrun "${TOOLNAME}" "${UPDATEDARGS[@]}"
@@ -0,0 +1,38 @@
+// Copyright 2016 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A protoc with the C++ and the cpp gRPC generators linked in: --grpc_out
+// generates the services from the descriptors protoc already has in memory,
+// instead of serializing them to a protoc-gen-grpc plugin process that
+// parses them again. Other plugins can still be used with --plugin.
+
+#include <google/protobuf/compiler/command_line_interface.h>
+#include <google/protobuf/compiler/cpp/cpp_generator.h>
+
+#include "src/compiler/cpp_plugin.h"
+
+int main(int argc, char *argv[]) {
+  google::protobuf::compiler::CommandLineInterface cli;
+  cli.AllowPlugins("protoc-");
+
+  google::protobuf::compiler::cpp::CppGenerator cpp_generator;
+  cli.RegisterGenerator("--cpp_out", "--cpp_opt", &cpp_generator,
+                        "Generate C++ header and source.");
+
+  CppGrpcGenerator grpc_generator;
+  cli.RegisterGenerator("--grpc_out", &grpc_generator,
+                        "Generate C++ gRPC services.");
+
+  return cli.Run(argc, argv);
+}
@@ -31,10 +31,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+#include <algorithm>
+#include <deque>
 #include <set>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "third_party/ijar/common.h"
@@ -108,13 +114,99 @@ enum TARGET_TYPE {
   // blocks. Ijar doesn't need to know about these.
 };
 
+// A bump-pointer allocator for the objects describing a class, which are
+// numerous, small, and all released together once the class is written.
+class Arena {
+ public:
+  Arena() : next_(NULL), end_(NULL) {}
+
+  ~Arena() {
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+      free(blocks_[i]);
+    }
+  }
+
+  void *Allocate(size_t size) {
+    size = (size + kAlignment - 1) & ~(kAlignment - 1);
+    if (size > static_cast<size_t>(end_ - next_)) {
+      size_t block_size = std::max(size, kBlockSize);
+      u1 *block = reinterpret_cast<u1 *>(malloc(block_size));
+      if (block == NULL) {
+        fprintf(stderr, "Out of memory allocating %zu bytes.\n", block_size);
+        abort();
+      }
+      blocks_.push_back(block);
+      next_ = block;
+      end_ = block + block_size;
+    }
+    void *result = next_;
+    next_ += size;
+    return result;
+  }
+
+  // Makes all the memory allocated so far available again. The first
+  // block is kept, so that small classes do not call malloc() at all.
+  void Reset() {
+    for (size_t i = 1; i < blocks_.size(); ++i) {
+      free(blocks_[i]);
+    }
+    if (blocks_.size() > 1) {
+      blocks_.resize(1);
+    }
+    next_ = blocks_.empty() ? NULL : blocks_[0];
+    end_ = blocks_.empty() ? NULL : blocks_[0] + kBlockSize;
+  }
+
+ private:
+  static const size_t kAlignment = 16;
+  static const size_t kBlockSize = 64 * 1024;
+
+  std::vector<u1 *> blocks_;
+  u1 *next_;
+  u1 *end_;
+};
+
+// Like the constant pools below, the arena is per thread.
+static thread_local Arena arena;
+
+// Base of the objects allocated from the arena. Deleting them runs their
+// destructors, which release what the members own, but the memory itself
+// is only reclaimed by Arena::Reset().
+struct ArenaAllocated {
+  static void *operator new(size_t size) { return arena.Allocate(size); }
+  static void operator delete(void *) {}
+};
+
 struct Constant;
 
+// The bytes of a UTF-8 constant, or of a part of it. They stay valid until
+// the class is done.
+struct Utf8Span {
+  Utf8Span() : data(NULL), size(0) {}
+  Utf8Span(const char *data, size_t size) : data(data), size(size) {}
+
+  // Returns the byte at "i", or NUL at or after the end (as std::string
+  // does at its end), which the signature parser below relies on.
+  char operator[](size_t i) const { return i < size ? data[i] : '\0'; }
+
+  bool operator<(const Utf8Span &other) const {
+    int result = memcmp(data, other.data, std::min(size, other.size));
+    return result < 0 || (result == 0 && size < other.size);
+  }
+
+  const char *data;
+  size_t size;
+};
+
 // TODO(adonovan) these globals are unfortunate
-static std::vector<Constant*>        const_pool_in; // input constant pool
-static std::vector<Constant*>        const_pool_out; // output constant_pool
-static std::set<std::string>         used_class_names;
-static Constant *                    class_name;
+// They are per thread, so that the classes can be stripped in parallel.
+static thread_local std::vector<Constant*> const_pool_in;   // input pool
+static thread_local std::vector<Constant*> const_pool_out;  // output pool
+static thread_local std::set<Utf8Span>     used_class_names;
+// The strings Constant::Utf8() had to make for the constants which are not
+// UTF-8 constants. Like the above, they are cleared after each class.
+static thread_local std::deque<std::string> utf8_strings;
+static thread_local Constant *             class_name;
 
 // Returns the Constant object, given an index into the input constant pool.
 // Note: constant(0) == NULL; this invariant is exploited by the
@@ -134,7 +226,7 @@ inline Constant *constant(int idx) {
  **********************************************************************/
 
 // See sec.4.4 of JVM spec.
-struct Constant {
+struct Constant : ArenaAllocated {
 
   Constant(u1 tag) :
       slot_(0),
@@ -146,6 +238,13 @@ struct Constant {
   // Otherwise, returns an undefined string value suitable for debugging.
   virtual std::string Display() = 0;
 
+  // Like Display(), but returns the bytes without copying them if the
+  // constant is a UTF-8 string constant (or refers to one).
+  virtual Utf8Span Utf8() {
+    utf8_strings.push_back(Display());
+    return Utf8Span(utf8_strings.back().data(), utf8_strings.back().size());
+  }
+
   virtual void Write(u1 *&p) = 0;
 
   // Called by slot() when a constant has been identified as required
@@ -188,7 +287,7 @@ struct Constant {
 //
 // desc: the descriptor class names should be extracted from.
 // p: the position where the extraction should tart.
-void ExtractClassNames(const std::string& desc, size_t* p);
+void ExtractClassNames(const Utf8Span& desc, size_t* p);
 
 // See sec.4.4.1 of JVM spec.
 struct Constant_Class : Constant
@@ -206,6 +305,10 @@ struct Constant_Class : Constant
     return constant(name_index_)->Display();
   }
 
+  Utf8Span Utf8() {
+    return constant(name_index_)->Utf8();
+  }
+
   void Keep() { constant(name_index_)->slot(); }
 
   u2 name_index_;
@@ -343,6 +446,10 @@ struct Constant_Utf8 : Constant
     return std::string((const char*) utf8_, length_);
   }
 
+  Utf8Span Utf8() {
+    return Utf8Span(reinterpret_cast<const char *>(utf8_), length_);
+  }
+
   u4 length_;
   const u1 *utf8_;
 };
@@ -420,7 +527,7 @@ struct Constant_InvokeDynamic : Constant
  **********************************************************************/
 
 // See sec.4.7 of JVM spec.
-struct Attribute {
+struct Attribute : ArenaAllocated {
 
   virtual ~Attribute() {}
   virtual void Write(u1 *&p) = 0;
@@ -461,7 +568,7 @@ struct ExceptionsAttribute : Attribute {
 // See sec.4.7.6 of JVM spec.
 struct InnerClassesAttribute : Attribute {
 
-  struct Entry {
+  struct Entry : ArenaAllocated {
     Constant *inner_class_info;
     Constant *outer_class_info;
     Constant *inner_name;
@@ -505,13 +612,22 @@ struct InnerClassesAttribute : Attribute {
            ++i_entry) {
         Entry* entry = entries_[i_entry];
         if (entry->inner_class_info->Kept() ||
-            used_class_names.find(entry->inner_class_info->Display()) !=
+            used_class_names.find(entry->inner_class_info->Utf8()) !=
                 used_class_names.end() ||
             entry->outer_class_info == class_name) {
           if (entry->inner_name == NULL) {
             // JVMS 4.7.6: inner_name_index is zero iff the class is anonymous
             continue;
           }
+          if (strip_private_nested && IsHidden(entry) &&
+              !entry->inner_class_info->Kept() &&
+              used_class_names.find(entry->inner_class_info->Utf8()) ==
+                  used_class_names.end()) {
+            // a private or synthetic member class this class does not
+            // refer to; it is only in the interface jar if another class
+            // refers to it
+            continue;
+          }
 
           kept_entries.insert(i_entry);
 
@@ -550,6 +666,14 @@ struct InnerClassesAttribute : Attribute {
     }
   }
 
+  // Whether the entry describes a private, synthetic or anonymous class,
+  // which is not part of the interface of its outer class.
+  static bool IsHidden(const Entry *entry) {
+    return entry->inner_name == NULL ||
+           (entry->inner_class_access_flags & (ACC_PRIVATE | ACC_SYNTHETIC)) !=
+               0;
+  }
+
   std::vector<Entry*> entries_;
 };
 
@@ -580,396 +704,150 @@ struct EnclosingMethodAttribute : Attribute {
   Constant *method_;
 };
 
-// See sec.4.7.16.1 of JVM spec.
-// Used by AnnotationDefault and other attributes.
-struct ElementValue {
-  virtual ~ElementValue() {}
-  virtual void Write(u1 *&p) = 0;
-  virtual void ExtractClassNames() {}
-  static ElementValue* Read(const u1 *&p);
-  u1 tag_;
-  u4 length_;
-};
-
-struct BaseTypeElementValue : ElementValue {
-  void Write(u1 *&p) {
-    put_u1(p, tag_);
-    put_u2be(p, const_value_->slot());
-  }
-  static BaseTypeElementValue *Read(const u1 *&p) {
-    BaseTypeElementValue *value = new BaseTypeElementValue;
-    value->const_value_ = constant(get_u2be(p));
-    return value;
-  }
-  Constant *const_value_;
-};
-
-struct EnumTypeElementValue : ElementValue {
-  void Write(u1 *&p) {
-    put_u1(p, tag_);
-    put_u2be(p, type_name_->slot());
-    put_u2be(p, const_name_->slot());
-  }
-  static EnumTypeElementValue *Read(const u1 *&p) {
-    EnumTypeElementValue *value = new EnumTypeElementValue;
-    value->type_name_ = constant(get_u2be(p));
-    value->const_name_ = constant(get_u2be(p));
-    return value;
-  }
-  Constant *type_name_;
-  Constant *const_name_;
-};
-
-struct ClassTypeElementValue : ElementValue {
-  void Write(u1 *&p) {
-    put_u1(p, tag_);
-    put_u2be(p, class_info_->slot());
-  }
-
-  virtual void ExtractClassNames() {
-    size_t idx = 0;
-    devtools_ijar::ExtractClassNames(class_info_->Display(), &idx);
-  }
-
-  static ClassTypeElementValue *Read(const u1 *&p) {
-    ClassTypeElementValue *value = new ClassTypeElementValue;
-    value->class_info_ = constant(get_u2be(p));
-    return value;
-  }
-  Constant *class_info_;
-};
-
-struct ArrayTypeElementValue : ElementValue {
-  virtual ~ArrayTypeElementValue() {
-    for (const auto *value : values_) {
-      delete value;
-    }
-  }
-
-  virtual void ExtractClassNames() {
-    for (auto *value : values_) {
-      value->ExtractClassNames();
-    }
-  }
-
-  void Write(u1 *&p) {
-    put_u1(p, tag_);
-    put_u2be(p, values_.size());
-    for (auto *value : values_) {
-      value->Write(p);
-    }
-  }
-  static ArrayTypeElementValue *Read(const u1 *&p) {
-    ArrayTypeElementValue *value = new ArrayTypeElementValue;
-    u2 num_values = get_u2be(p);
-    for (int ii = 0; ii < num_values; ++ii) {
-      value->values_.push_back(ElementValue::Read(p));
-    }
-    return value;
-  }
-  std::vector<ElementValue*> values_;
-};
-
-// See sec.4.7.16 of JVM spec.
-struct Annotation {
-  virtual ~Annotation() {
-    for (size_t i = 0; i < element_value_pairs_.size(); i++) {
-      delete element_value_pairs_[i]->element_value_;
-      delete element_value_pairs_[i];
-    }
-  }
-
-  void ExtractClassNames() {
-    for (size_t i = 0; i < element_value_pairs_.size(); i++) {
-      element_value_pairs_[i]->element_value_->ExtractClassNames();
+// See sec.4.7.16-20 of JVM spec.
+//
+// The annotations are copied as they are, except for the constant pool
+// indices in them, which are renumbered. Rather than building a tree of
+// annotations and element values, the data are scanned once for those
+// indices, and are then written out by copying the input bytes and
+// patching them.
+class AnnotationData {
+ public:
+  AnnotationData() : start_(NULL), length_(0) {}
+
+  // Marks the beginning and the end of the data at "p".
+  void Begin(const u1 *p) { start_ = p; }
+  void End(const u1 *p) { length_ = p - start_; }
+
+  u4 length() const { return length_; }
+
+  // See sec.4.7.16.1 of JVM spec.
+  void ReadElementValue(const u1 *&p) {
+    u1 tag = get_u1(p);
+    if (tag != 0 && strchr("BCDFIJSZs", (char) tag) != NULL) {
+      ReadConstant(p);  // const_value_index
+    } else if ((char) tag == 'e') {
+      ReadConstant(p);  // type_name_index
+      ReadConstant(p);  // const_name_index
+    } else if ((char) tag == 'c') {
+      class_infos_.push_back(ReadConstant(p));
+    } else if ((char) tag == '[') {
+      u2 num_values = get_u2be(p);
+      for (int ii = 0; ii < num_values; ++ii) {
+        ReadElementValue(p);
+      }
+    } else if ((char) tag == '@') {
+      ReadAnnotation(p);
+    } else {
+      fprintf(stderr, "Illegal element_value::tag: %d\n", tag);
+      abort();
     }
   }
 
-  void Write(u1 *&p) {
-    put_u2be(p, type_->slot());
-    put_u2be(p, element_value_pairs_.size());
-    for (size_t ii = 0; ii < element_value_pairs_.size(); ++ii) {
-      put_u2be(p, element_value_pairs_[ii]->element_name_->slot());
-      element_value_pairs_[ii]->element_value_->Write(p);
-    }
-  }
-  static Annotation *Read(const u1 *&p) {
-    Annotation *value = new Annotation;
-    value->type_ = constant(get_u2be(p));
+  // See sec.4.7.16 of JVM spec.
+  void ReadAnnotation(const u1 *&p) {
+    ReadConstant(p);  // type_index
     u2 num_element_value_pairs = get_u2be(p);
     for (int ii = 0; ii < num_element_value_pairs; ++ii) {
-      ElementValuePair *pair = new ElementValuePair;
-      pair->element_name_ = constant(get_u2be(p));
-      pair->element_value_ = ElementValue::Read(p);
-      value->element_value_pairs_.push_back(pair);
+      ReadConstant(p);  // element_name_index
+      ReadElementValue(p);
     }
-    return value;
-  }
-  Constant *type_;
-  struct ElementValuePair {
-    Constant *element_name_;
-    ElementValue *element_value_;
-  };
-  std::vector<ElementValuePair*> element_value_pairs_;
-};
-
-// See sec 4.7.20 of Java 8 JVM Spec
-//
-// Each entry in the annotations table represents a single run-time visible
-// annotation on a type used in a declaration or expression. The type_annotation
-// structure has the following format:
-//
-// type_annotation {
-//   u1 target_type;
-//   union {
-//     type_parameter_target;
-//     supertype_target;
-//     type_parameter_bound_target;
-//     empty_target;
-//     method_formal_parameter_target;
-//     throws_target;
-//     localvar_target;
-//     catch_target;
-//     offset_target;
-//     type_argument_target;
-//   } target_info;
-//   type_path target_path;
-//   u2        type_index;
-//   u2        num_element_value_pairs;
-//   {
-//     u2            element_name_index;
-//     element_value value;
-//   }
-//   element_value_pairs[num_element_value_pairs];
-// }
-//
-struct TypeAnnotation {
-  virtual ~TypeAnnotation() {
-    delete target_info_;
-    delete type_path_;
-    delete annotation_;
-  }
-
-  void ExtractClassNames() {
-    annotation_->ExtractClassNames();
   }
 
-  void Write(u1 *&p) {
-    put_u1(p, target_type_);
-    target_info_->Write(p);
-    type_path_->Write(p);
-    annotation_->Write(p);
-  }
-
-  static TypeAnnotation *Read(const u1 *&p) {
-    TypeAnnotation *value = new TypeAnnotation;
-    value->target_type_ = get_u1(p);
-    value->target_info_ = ReadTargetInfo(p, value->target_type_);
-    value->type_path_ = TypePath::Read(p);
-    value->annotation_ = Annotation::Read(p);
-    return value;
-  }
-
-  struct TargetInfo {
-    virtual ~TargetInfo() {}
-    virtual void Write(u1 *&p) = 0;
-  };
-
-  struct TypeParameterTargetInfo : TargetInfo {
-    void Write(u1 *&p) {
-      put_u1(p, type_parameter_index_);
-    }
-    static TypeParameterTargetInfo *Read(const u1 *&p) {
-      TypeParameterTargetInfo *value = new TypeParameterTargetInfo;
-      value->type_parameter_index_ = get_u1(p);
-      return value;
-    }
-    u1 type_parameter_index_;
-  };
-
-  struct ClassExtendsInfo : TargetInfo {
-    void Write(u1 *&p) {
-      put_u2be(p, supertype_index_);
-    }
-    static ClassExtendsInfo *Read(const u1 *&p) {
-      ClassExtendsInfo *value = new ClassExtendsInfo;
-      value->supertype_index_ = get_u2be(p);
-      return value;
-    }
-    u2 supertype_index_;
-  };
-
-  struct TypeParameterBoundInfo : TargetInfo {
-    void Write(u1 *&p) {
-      put_u1(p, type_parameter_index_);
-      put_u1(p, bound_index_);
-    }
-    static TypeParameterBoundInfo *Read(const u1 *&p) {
-      TypeParameterBoundInfo *value = new TypeParameterBoundInfo;
-      value->type_parameter_index_ = get_u1(p);
-      value->bound_index_ = get_u1(p);
-      return value;
-    }
-    u1 type_parameter_index_;
-    u1 bound_index_;
-  };
-
-  struct EmptyInfo : TargetInfo {
-    void Write(u1 *&p) {}
-    static EmptyInfo *Read(const u1 *&p) {
-      return new EmptyInfo;
-    }
-  };
-
-  struct MethodFormalParameterInfo : TargetInfo {
-    void Write(u1 *&p) {
-      put_u1(p, method_formal_parameter_index_);
-    }
-    static MethodFormalParameterInfo *Read(const u1 *&p) {
-      MethodFormalParameterInfo *value = new MethodFormalParameterInfo;
-      value->method_formal_parameter_index_ = get_u1(p);
-      return value;
-    }
-    u1 method_formal_parameter_index_;
-  };
-
-  struct ThrowsTypeInfo : TargetInfo {
-    void Write(u1 *&p) {
-      put_u2be(p, throws_type_index_);
-    }
-    static ThrowsTypeInfo *Read(const u1 *&p) {
-      ThrowsTypeInfo *value = new ThrowsTypeInfo;
-      value->throws_type_index_ = get_u2be(p);
-      return value;
-    }
-    u2 throws_type_index_;
-  };
-
-  static TargetInfo *ReadTargetInfo(const u1 *&p, u1 target_type) {
+  // See sec 4.7.20 of Java 8 JVM Spec
+  //
+  // Each entry in the annotations table represents a single run-time visible
+  // annotation on a type used in a declaration or expression. The type_annotation
+  // structure has the following format:
+  //
+  // type_annotation {
+  //   u1 target_type;
+  //   union {
+  //     type_parameter_target;
+  //     supertype_target;
+  //     type_parameter_bound_target;
+  //     empty_target;
+  //     method_formal_parameter_target;
+  //     throws_target;
+  //     localvar_target;
+  //     catch_target;
+  //     offset_target;
+  //     type_argument_target;
+  //   } target_info;
+  //   type_path target_path;
+  //   u2        type_index;
+  //   u2        num_element_value_pairs;
+  //   {
+  //     u2            element_name_index;
+  //     element_value value;
+  //   }
+  //   element_value_pairs[num_element_value_pairs];
+  // }
+  //
+  // Of the target_info variants, only the ones that may appear outside of
+  // code are expected.
+  void ReadTypeAnnotation(const u1 *&p) {
+    u1 target_type = get_u1(p);
     switch (target_type) {
       case CLASS_TYPE_PARAMETER:
       case METHOD_TYPE_PARAMETER:
-        return TypeParameterTargetInfo::Read(p);
-      case CLASS_EXTENDS:
-        return ClassExtendsInfo::Read(p);
+      case METHOD_FORMAL_PARAMETER:
+        p += 1;
+        break;
+      case CLASS_EXTENDS:  // an index into the interfaces, not the pool
       case CLASS_TYPE_PARAMETER_BOUND:
       case METHOD_TYPE_PARAMETER_BOUND:
-        return TypeParameterBoundInfo::Read(p);
+      case THROWS:  // an index into the exception_index_table
+        p += 2;
+        break;
       case FIELD:
       case METHOD_RETURN:
       case METHOD_RECEIVER:
-        return new EmptyInfo;
-      case METHOD_FORMAL_PARAMETER:
-        return MethodFormalParameterInfo::Read(p);
-      case THROWS:
-        return ThrowsTypeInfo::Read(p);
+        break;
       default:
         fprintf(stderr, "Illegal type annotation target type: %d\n",
                 target_type);
         abort();
     }
+    u1 path_length = get_u1(p);
+    p += 2 * path_length;
+    ReadAnnotation(p);
   }
 
-  struct TypePath {
-    void Write(u1 *&p) {
-      put_u1(p, path_.size());
-      for (TypePathEntry entry : path_) {
-        put_u1(p, entry.type_path_kind_);
-        put_u1(p, entry.type_argument_index_);
-      }
-    }
-    static TypePath *Read(const u1 *&p) {
-      TypePath *value = new TypePath;
-      u1 path_length = get_u1(p);
-      for (int ii = 0; ii < path_length; ++ii) {
-        TypePathEntry entry;
-        entry.type_path_kind_ = get_u1(p);
-        entry.type_argument_index_ = get_u1(p);
-        value->path_.push_back(entry);
-      }
-      return value;
+  void ExtractClassNames() {
+    for (auto *class_info : class_infos_) {
+      size_t idx = 0;
+      devtools_ijar::ExtractClassNames(class_info->Utf8(), &idx);
     }
-
-    struct TypePathEntry {
-      u1 type_path_kind_;
-      u1 type_argument_index_;
-    };
-    std::vector<TypePathEntry> path_;
-  };
-
-  u1 target_type_;
-  TargetInfo *target_info_;
-  TypePath *type_path_;
-  Annotation *annotation_;
-};
-
-struct AnnotationTypeElementValue : ElementValue {
-  virtual ~AnnotationTypeElementValue() {
-    delete annotation_;
-  }
-
-  void Write(u1 *&p) {
-    put_u1(p, tag_);
-    annotation_->Write(p);
-  }
-  static AnnotationTypeElementValue *Read(const u1 *&p) {
-    AnnotationTypeElementValue *value = new AnnotationTypeElementValue;
-    value->annotation_ = Annotation::Read(p);
-    return value;
-  }
-
-  Annotation *annotation_;
-};
-
-ElementValue* ElementValue::Read(const u1 *&p) {
-  const u1* start = p;
-  ElementValue *result;
-  u1 tag = get_u1(p);
-  if (tag != 0 && strchr("BCDFIJSZs", (char) tag) != NULL) {
-    result = BaseTypeElementValue::Read(p);
-  } else if ((char) tag == 'e') {
-    result = EnumTypeElementValue::Read(p);
-  } else if ((char) tag == 'c') {
-    result = ClassTypeElementValue::Read(p);
-  } else if ((char) tag == '[') {
-    result = ArrayTypeElementValue::Read(p);
-  } else if ((char) tag == '@') {
-    result = AnnotationTypeElementValue::Read(p);
-  } else {
-    fprintf(stderr, "Illegal element_value::tag: %d\n", tag);
-    abort();
-  }
-  result->tag_ = tag;
-  result->length_ = p - start;
-  return result;
-}
-
-// See sec.4.7.20 of JVM spec.
-// We preserve AnnotationDefault attributes because they are required
-// in order to make use of an annotation in new code.
-struct AnnotationDefaultAttribute : Attribute {
-  virtual ~AnnotationDefaultAttribute() {
-    delete default_value_;
-  }
-
-  static AnnotationDefaultAttribute* Read(const u1 *&p,
-                                          Constant *attribute_name) {
-    AnnotationDefaultAttribute *attr = new AnnotationDefaultAttribute;
-    attr->attribute_name_ = attribute_name;
-    attr->default_value_ = ElementValue::Read(p);
-    return attr;
   }
 
+  // Writes the data with the constant pool indices renumbered. They are
+  // patched in the order they appear, so the output constant pool is
+  // the same as if the data were written field by field.
   void Write(u1 *&p) {
-    WriteProlog(p, default_value_->length_);
-    default_value_->Write(p);
+    u1 *data = p;
+    put_n(p, start_, length_);
+    for (const auto &reference : constants_) {
+      u1 *q = data + reference.first;
+      put_u2be(q, reference.second->slot());
+    }
   }
 
-  virtual void ExtractClassNames() {
-    default_value_->ExtractClassNames();
+ private:
+  Constant *ReadConstant(const u1 *&p) {
+    u4 offset = p - start_;
+    Constant *result = constant(get_u2be(p));
+    constants_.push_back(std::make_pair(offset, result));
+    return result;
   }
 
-  ElementValue *default_value_;
+  const u1 *start_;
+  u4 length_;
+  // The constant pool references: their offset in the data, and the
+  // constant they refer to.
+  std::vector<std::pair<u4, Constant *> > constants_;
+  // The class_info_index of the class element values.
+  std::vector<Constant *> class_infos_;
 };
 
 // See sec.4.7.2 of JVM spec.
@@ -1011,7 +889,7 @@ struct SignatureAttribute : Attribute {
 
   virtual void ExtractClassNames() {
     size_t signature_idx = 0;
-    devtools_ijar::ExtractClassNames(signature_->Display(), &signature_idx);
+    devtools_ijar::ExtractClassNames(signature_->Utf8(), &signature_idx);
   }
 
   Constant *signature_;
@@ -1033,128 +911,69 @@ struct DeprecatedAttribute : Attribute {
   }
 };
 
-// See sec.4.7.16-17 of JVM spec v3.  Includes RuntimeVisible and
-// RuntimeInvisible.
+// See sec.4.7.16-20 of JVM spec. Includes RuntimeVisible and
+// RuntimeInvisible (Parameter and Type) Annotations, and AnnotationDefault.
 //
-// We preserve all annotations.
+// We preserve all annotations, and AnnotationDefault attributes because
+// they are required in order to make use of an annotation in new code.
 struct AnnotationsAttribute : Attribute {
-  virtual ~AnnotationsAttribute() {
-    for (size_t i = 0; i < annotations_.size(); i++) {
-      delete annotations_[i];
-    }
-  }
+  enum Kind {
+    ANNOTATIONS,
+    PARAMETER_ANNOTATIONS,
+    TYPE_ANNOTATIONS,
+    ANNOTATION_DEFAULT,
+  };
 
-  static AnnotationsAttribute* Read(const u1 *&p, Constant *attribute_name) {
+  static AnnotationsAttribute* Read(const u1 *&p, Constant *attribute_name,
+                                    Kind kind) {
     AnnotationsAttribute *attr = new AnnotationsAttribute;
     attr->attribute_name_ = attribute_name;
-    u2 num_annotations = get_u2be(p);
-    for (int ii = 0; ii < num_annotations; ++ii) {
-      Annotation *annotation = Annotation::Read(p);
-      attr->annotations_.push_back(annotation);
-    }
-    return attr;
-  }
-
-  virtual void ExtractClassNames() {
-    for (auto *annotation : annotations_) {
-      annotation->ExtractClassNames();
-    }
-  }
-
-  void Write(u1 *&p) {
-    WriteProlog(p, -1);
-    u1 *payload_start = p - 4;
-    put_u2be(p, annotations_.size());
-    for (auto *annotation : annotations_) {
-      annotation->Write(p);
-    }
-    put_u4be(payload_start, p - 4 - payload_start);  // backpatch length
-  }
-
-  std::vector<Annotation*> annotations_;
-};
-
-// See sec.4.7.18-19 of JVM spec.  Includes RuntimeVisible and
-// RuntimeInvisible.
-//
-// We preserve all annotations.
-struct ParameterAnnotationsAttribute : Attribute {
-
-  static ParameterAnnotationsAttribute* Read(const u1 *&p,
-                                             Constant *attribute_name) {
-    ParameterAnnotationsAttribute *attr = new ParameterAnnotationsAttribute;
-    attr->attribute_name_ = attribute_name;
-    u1 num_parameters = get_u1(p);
-    for (int ii = 0; ii < num_parameters; ++ii) {
-      std::vector<Annotation*> annotations;
-      u2 num_annotations = get_u2be(p);
-      for (int ii = 0; ii < num_annotations; ++ii) {
-        Annotation *annotation = Annotation::Read(p);
-        annotations.push_back(annotation);
+    AnnotationData &data = attr->data_;
+    data.Begin(p);
+    switch (kind) {
+      case ANNOTATIONS: {
+        u2 num_annotations = get_u2be(p);
+        for (int ii = 0; ii < num_annotations; ++ii) {
+          data.ReadAnnotation(p);
+        }
+        break;
       }
-      attr->parameter_annotations_.push_back(annotations);
-    }
-    return attr;
-  }
-
-  virtual void ExtractClassNames() {
-    for (size_t i = 0; i < parameter_annotations_.size(); i++) {
-      const std::vector<Annotation*>& annotations = parameter_annotations_[i];
-      for (size_t j = 0; j < annotations.size(); j++) {
-        annotations[j]->ExtractClassNames();
+      case PARAMETER_ANNOTATIONS: {
+        u1 num_parameters = get_u1(p);
+        for (int ii = 0; ii < num_parameters; ++ii) {
+          u2 num_annotations = get_u2be(p);
+          for (int jj = 0; jj < num_annotations; ++jj) {
+            data.ReadAnnotation(p);
+          }
+        }
+        break;
       }
-    }
-  }
-
-  void Write(u1 *&p) {
-    WriteProlog(p, -1);
-    u1 *payload_start = p - 4;
-    put_u1(p, parameter_annotations_.size());
-    for (size_t ii = 0; ii < parameter_annotations_.size(); ++ii) {
-      std::vector<Annotation *> &annotations = parameter_annotations_[ii];
-      put_u2be(p, annotations.size());
-      for (size_t jj = 0; jj < annotations.size(); ++jj) {
-        annotations[jj]->Write(p);
+      case TYPE_ANNOTATIONS: {
+        u2 num_annotations = get_u2be(p);
+        for (int ii = 0; ii < num_annotations; ++ii) {
+          data.ReadTypeAnnotation(p);
+        }
+        break;
       }
+      case ANNOTATION_DEFAULT:
+        data.ReadElementValue(p);
+        break;
     }
-    put_u4be(payload_start, p - 4 - payload_start);  // backpatch length
-  }
-
-  std::vector<std::vector<Annotation*> > parameter_annotations_;
-};
-
-// See sec.4.7.20 of Java 8 JVM spec. Includes RuntimeVisibleTypeAnnotations
-// and RuntimeInvisibleTypeAnnotations.
-struct TypeAnnotationsAttribute : Attribute {
-  static TypeAnnotationsAttribute* Read(const u1 *&p, Constant *attribute_name,
-                                        u4 attribute_length) {
-    auto attr = new TypeAnnotationsAttribute;
-    attr->attribute_name_ = attribute_name;
-    u2 num_annotations = get_u2be(p);
-    for (int ii = 0; ii < num_annotations; ++ii) {
-      TypeAnnotation *annotation = TypeAnnotation::Read(p);
-      attr->type_annotations_.push_back(annotation);
-    }
+    data.End(p);
     return attr;
   }
 
   virtual void ExtractClassNames() {
-    for (auto *type_annotation : type_annotations_) {
-      type_annotation->ExtractClassNames();
-    }
+    data_.ExtractClassNames();
   }
 
   void Write(u1 *&p) {
-    WriteProlog(p, -1);
-    u1 *payload_start = p - 4;
-    put_u2be(p, type_annotations_.size());
-    for (TypeAnnotation *annotation : type_annotations_) {
-      annotation->Write(p);
-    }
-    put_u4be(payload_start, p - 4 - payload_start);  // backpatch length
+    put_u2be(p, attribute_name_->slot());
+    put_u4be(p, data_.length());
+    data_.Write(p);
   }
 
-  std::vector<TypeAnnotation*> type_annotations_;
+  AnnotationData data_;
 };
 
 // See JVMS §4.7.24
@@ -1184,7 +1003,7 @@ struct MethodParametersAttribute : Attribute {
     put_u4be(payload_start, p - 4 - payload_start);  // backpatch length
   }
 
-  struct MethodParameter {
+  struct MethodParameter : ArenaAllocated {
     Constant *name_;
     u2 access_flags_;
   };
@@ -1218,7 +1037,7 @@ struct GeneralAttribute : Attribute {
  *                                                                    *
  **********************************************************************/
 
-struct HasAttrs {
+struct HasAttrs : ArenaAllocated {
   std::vector<Attribute*> attributes;
 
   void WriteAttrs(u1 *&p);
@@ -1297,6 +1116,10 @@ struct ClassFile : HasAttrs {
 
   bool IsLocalOrAnonymous();
 
+  // Whether the class is a private, synthetic or anonymous nested class,
+  // according to its own InnerClasses entry.
+  bool IsHidden();
+
   void WriteHeader(u1 *&p) {
     put_u4be(p, magic);
     put_u2be(p, major);
@@ -1377,16 +1200,18 @@ void HasAttrs::ReadAttrs(const u1 *&p) {
       // TODO(bazel-team): omit private inner classes
       attributes.push_back(InnerClassesAttribute::Read(p, attribute_name));
     } else if (attr_name == "AnnotationDefault") {
-      attributes.push_back(AnnotationDefaultAttribute::Read(p, attribute_name));
+      attributes.push_back(AnnotationsAttribute::Read(
+          p, attribute_name, AnnotationsAttribute::ANNOTATION_DEFAULT));
     } else if (attr_name == "ConstantValue") {
       attributes.push_back(ConstantValueAttribute::Read(p, attribute_name));
     } else if (attr_name == "RuntimeVisibleAnnotations" ||
                attr_name == "RuntimeInvisibleAnnotations") {
-      attributes.push_back(AnnotationsAttribute::Read(p, attribute_name));
+      attributes.push_back(AnnotationsAttribute::Read(
+          p, attribute_name, AnnotationsAttribute::ANNOTATIONS));
     } else if (attr_name == "RuntimeVisibleParameterAnnotations" ||
                attr_name == "RuntimeInvisibleParameterAnnotations") {
-      attributes.push_back(
-          ParameterAnnotationsAttribute::Read(p, attribute_name));
+      attributes.push_back(AnnotationsAttribute::Read(
+          p, attribute_name, AnnotationsAttribute::PARAMETER_ANNOTATIONS));
     } else if (attr_name == "Scala" ||
                attr_name == "ScalaSig" ||
                attr_name == "ScalaInlineInfo") {
@@ -1396,8 +1221,8 @@ void HasAttrs::ReadAttrs(const u1 *&p) {
                                                   attribute_length));
     } else if (attr_name == "RuntimeVisibleTypeAnnotations" ||
                attr_name == "RuntimeInvisibleTypeAnnotations") {
-      attributes.push_back(TypeAnnotationsAttribute::Read(p, attribute_name,
-                                                          attribute_length));
+      attributes.push_back(AnnotationsAttribute::Read(
+          p, attribute_name, AnnotationsAttribute::TYPE_ANNOTATIONS));
     } else if (attr_name == "MethodParameters") {
       attributes.push_back(
           MethodParametersAttribute::Read(p, attribute_name, attribute_length));
@@ -1538,6 +1363,24 @@ bool ClassFile::IsLocalOrAnonymous() {
   return false;
 }
 
+bool ClassFile::IsHidden() {
+  if ((access_flags & ACC_SYNTHETIC) != 0) {
+    return true;
+  }
+  for (const Attribute *attribute : attributes) {
+    if (attribute->attribute_name_->Display() != "InnerClasses") {
+      continue;
+    }
+    for (const auto *entry :
+         static_cast<const InnerClassesAttribute *>(attribute)->entries_) {
+      if (entry->inner_class_info == this_class) {
+        return InnerClassesAttribute::IsHidden(entry);
+      }
+    }
+  }
+  return false;
+}
+
 static ClassFile *ReadClass(const void *classdata, size_t length) {
   const u1 *p = (u1*) classdata;
 
@@ -1612,10 +1455,48 @@ static ClassFile *ReadClass(const void *classdata, size_t length) {
 // this works just as well as in plain ASCII.
 static const char *SIGNATURE_NON_IDENTIFIER_CHARS = ".;[<>:";
 
-void Expect(const std::string& desc, size_t* p, char expected) {
+// Returns the position of the first SIGNATURE_NON_IDENTIFIER_CHARS byte at
+// or after "from", or desc.size if there is none. Class names are long, so
+// they are scanned 16 bytes at a time where SSE2 is available.
+static size_t FindNonIdentifierChar(const Utf8Span& desc, size_t from) {
+  size_t pos = from;
+#ifdef __SSE2__
+  const __m128i dot = _mm_set1_epi8('.');
+  const __m128i semicolon = _mm_set1_epi8(';');
+  const __m128i bracket = _mm_set1_epi8('[');
+  const __m128i less = _mm_set1_epi8('<');
+  const __m128i greater = _mm_set1_epi8('>');
+  const __m128i colon = _mm_set1_epi8(':');
+  for (; pos + 16 <= desc.size; pos += 16) {
+    __m128i chunk = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(desc.data + pos));
+    __m128i found = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, dot),
+                                  _mm_cmpeq_epi8(chunk, semicolon)),
+                     _mm_or_si128(_mm_cmpeq_epi8(chunk, bracket),
+                                  _mm_cmpeq_epi8(chunk, less))),
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, greater),
+                     _mm_cmpeq_epi8(chunk, colon)));
+    int mask = _mm_movemask_epi8(found);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; pos < desc.size; ++pos) {
+    if (strchr(SIGNATURE_NON_IDENTIFIER_CHARS, desc.data[pos]) != NULL &&
+        desc.data[pos] != '\0') {
+      return pos;
+    }
+  }
+  return desc.size;
+}
+
+void Expect(const Utf8Span& desc, size_t* p, char expected) {
   if (desc[*p] != expected) {
-    fprintf(stderr, "Expected '%c' in '%s' at %zd in signature\n",
-            expected, desc.substr(*p).c_str(), *p);
+    fprintf(stderr, "Expected '%c' in '%.*s' at %zd in signature\n",
+            expected, static_cast<int>(desc.size - std::min(*p, desc.size)),
+            desc.data + std::min(*p, desc.size), *p);
     exit(1);
   }
 
@@ -1627,40 +1508,39 @@ void Expect(const std::string& desc, size_t* p, char expected) {
 //
 // This parser is a bit more liberal than the spec, but this should be fine,
 // because it accepts all valid class files and croaks only on invalid ones.
-void ParseFromClassTypeSignature(const std::string& desc, size_t* p);
-void ParseSimpleClassTypeSignature(const std::string& desc, size_t* p);
-void ParseClassTypeSignatureSuffix(const std::string& desc, size_t* p);
-void ParseIdentifier(const std::string& desc, size_t* p);
-void ParseTypeArgumentsOpt(const std::string& desc, size_t* p);
-void ParseMethodDescriptor(const std::string& desc, size_t* p);
-
-void ParseClassTypeSignature(const std::string& desc, size_t* p) {
+void ParseFromClassTypeSignature(const Utf8Span& desc, size_t* p);
+void ParseSimpleClassTypeSignature(const Utf8Span& desc, size_t* p);
+void ParseClassTypeSignatureSuffix(const Utf8Span& desc, size_t* p);
+void ParseIdentifier(const Utf8Span& desc, size_t* p);
+void ParseTypeArgumentsOpt(const Utf8Span& desc, size_t* p);
+void ParseMethodDescriptor(const Utf8Span& desc, size_t* p);
+
+void ParseClassTypeSignature(const Utf8Span& desc, size_t* p) {
   Expect(desc, p, 'L');
   ParseSimpleClassTypeSignature(desc, p);
   ParseClassTypeSignatureSuffix(desc, p);
   Expect(desc, p, ';');
 }
 
-void ParseSimpleClassTypeSignature(const std::string& desc, size_t* p) {
+void ParseSimpleClassTypeSignature(const Utf8Span& desc, size_t* p) {
   ParseIdentifier(desc, p);
   ParseTypeArgumentsOpt(desc, p);
 }
 
-void ParseClassTypeSignatureSuffix(const std::string& desc, size_t* p) {
+void ParseClassTypeSignatureSuffix(const Utf8Span& desc, size_t* p) {
   while (desc[*p] == '.') {
     *p += 1;
     ParseSimpleClassTypeSignature(desc, p);
   }
 }
 
-void ParseIdentifier(const std::string& desc, size_t* p) {
-  size_t next = desc.find_first_of(SIGNATURE_NON_IDENTIFIER_CHARS, *p);
-  std::string id = desc.substr(*p, next - *p);
-  used_class_names.insert(id);
+void ParseIdentifier(const Utf8Span& desc, size_t* p) {
+  size_t next = FindNonIdentifierChar(desc, *p);
+  used_class_names.insert(Utf8Span(desc.data + *p, next - *p));
   *p = next;
 }
 
-void ParseTypeArgumentsOpt(const std::string& desc, size_t* p) {
+void ParseTypeArgumentsOpt(const Utf8Span& desc, size_t* p) {
   if (desc[*p] != '<') {
     return;
   }
@@ -1687,7 +1567,7 @@ void ParseTypeArgumentsOpt(const std::string& desc, size_t* p) {
   *p += 1;
 }
 
-void ParseMethodDescriptor(const std::string& desc, size_t* p) {
+void ParseMethodDescriptor(const Utf8Span& desc, size_t* p) {
   Expect(desc, p, '(');
   while (desc[*p] != ')') {
     ExtractClassNames(desc, p);
@@ -1697,7 +1577,7 @@ void ParseMethodDescriptor(const std::string& desc, size_t* p) {
   ExtractClassNames(desc, p);
 }
 
-void ParseFormalTypeParameters(const std::string& desc, size_t* p) {
+void ParseFormalTypeParameters(const Utf8Span& desc, size_t* p) {
   Expect(desc, p, '<');
   while (desc[*p] != '>') {
     ParseIdentifier(desc, p);
@@ -1715,7 +1595,7 @@ void ParseFormalTypeParameters(const std::string& desc, size_t* p) {
   Expect(desc, p, '>');
 }
 
-void ExtractClassNames(const std::string& desc, size_t* p) {
+void ExtractClassNames(const Utf8Span& desc, size_t* p) {
   switch (desc[*p]) {
     case '<':
       ParseFormalTypeParameters(desc, p);
@@ -1754,11 +1634,41 @@ void ExtractClassNames(const std::string& desc, size_t* p) {
       break;
 
     default:
-      fprintf(stderr, "Invalid signature %s\n", desc.substr(*p).c_str());
+      fprintf(stderr, "Invalid signature %.*s\n",
+              static_cast<int>(desc.size - std::min(*p, desc.size)),
+              desc.data + std::min(*p, desc.size));
+  }
+}
+
+// Orders members by name and then descriptor.
+static bool MemberLess(const Member *a, const Member *b) {
+  Utf8Span a_name = a->name->Utf8(), b_name = b->name->Utf8();
+  if (a_name < b_name || b_name < a_name) {
+    return a_name < b_name;
   }
+  return a->descriptor->Utf8() < b->descriptor->Utf8();
+}
+
+// Orders attributes by name.
+static bool AttributeLess(const Attribute *a, const Attribute *b) {
+  return a->attribute_name_->Utf8() < b->attribute_name_->Utf8();
 }
 
 void ClassFile::WriteClass(u1 *&p) {
+  if (sort_members) {
+    // The output constant pool is in the order of first use, so it follows.
+    std::stable_sort(fields.begin(), fields.end(), MemberLess);
+    std::stable_sort(methods.begin(), methods.end(), MemberLess);
+    std::stable_sort(attributes.begin(), attributes.end(), AttributeLess);
+    for (auto *member : fields) {
+      std::stable_sort(member->attributes.begin(), member->attributes.end(),
+                       AttributeLess);
+    }
+    for (auto *member : methods) {
+      std::stable_sort(member->attributes.begin(), member->attributes.end(),
+                       AttributeLess);
+    }
+  }
   used_class_names.clear();
   std::vector<Member *> members;
   members.insert(members.end(), fields.begin(), fields.end());
@@ -1766,7 +1676,7 @@ void ClassFile::WriteClass(u1 *&p) {
   ExtractClassNames();
   for (auto *member : members) {
     size_t idx = 0;
-    devtools_ijar::ExtractClassNames(member->descriptor->Display(), &idx);
+    devtools_ijar::ExtractClassNames(member->descriptor->Utf8(), &idx);
     member->ExtractClassNames();
   }
 
@@ -1782,9 +1692,52 @@ void ClassFile::WriteClass(u1 *&p) {
   delete[] body;
 }
 
-bool StripClass(u1 *&classdata_out, const u1 *classdata_in, size_t in_length) {
+// Adds to "references" the names of the classes the constants of the output
+// constant pool may refer to: the UTF-8 constants themselves, which include
+// the names of the class constants, and the "L<name>;" class names in the
+// descriptors and signatures. Extra names only make it keep more classes.
+static void AddReferences(std::vector<std::string> *references) {
+  for (size_t i = 1; i < const_pool_out.size(); ++i) {
+    Constant *constant = const_pool_out[i];
+    if (constant == NULL || constant->tag_ != CONSTANT_Utf8) {
+      continue;
+    }
+    Utf8Span utf8 = constant->Utf8();
+    references->push_back(std::string(utf8.data, utf8.size));
+    for (size_t start = 0; start < utf8.size; ++start) {
+      if (utf8[start] != 'L') {
+        continue;
+      }
+      size_t end = start + 1;
+      while (end < utf8.size && utf8[end] != ';' && utf8[end] != '<') {
+        ++end;
+      }
+      if (end < utf8.size) {
+        references->push_back(
+            std::string(utf8.data + start + 1, end - start - 1));
+      }
+    }
+  }
+}
+
+// Forgets the constants and the other state of the class last read.
+static void ResetClassState() {
+  for (size_t i = 0; i < const_pool_in.size(); i++) {
+    delete const_pool_in[i];
+  }
+
+  const_pool_in.clear();
+  const_pool_out.clear();
+  used_class_names.clear();
+  utf8_strings.clear();
+  arena.Reset();
+}
+
+bool StripClass(u1 *&classdata_out, const u1 *classdata_in, size_t in_length,
+                bool *hidden, std::vector<std::string> *references) {
   ClassFile *clazz = ReadClass(classdata_in, in_length);
   bool keep = true;
+  *hidden = false;
   if (clazz == NULL) {
     // Class is invalid. Simply copy it to the output and call it a day.
     put_n(classdata_out, classdata_in, in_length);
@@ -1797,19 +1750,92 @@ bool StripClass(u1 *&classdata_out, const u1 *classdata_in, size_t in_length) {
     // fail if called prior to this.
     const_pool_out.push_back(NULL);
     clazz->WriteClass(classdata_out);
+    if (strip_private_nested) {
+      *hidden = clazz->IsHidden();
+      AddReferences(references);
+    }
 
     delete clazz;
   }
 
   // Now clean up all the mess we left behind.
+  ResetClassState();
+  return keep;
+}
 
-  for (size_t i = 0; i < const_pool_in.size(); i++) {
-    delete const_pool_in[i];
+// Adds to "names" the classes the descriptor or signature "desc" names as
+// types. Unlike ExtractClassNames(), it neither stops at nor reports the
+// parts it cannot parse, so that it can be given any UTF-8 constant.
+static void AddSignatureClassNames(const Utf8Span &desc,
+                                   std::set<std::string> *names) {
+  // Whether a type may start at "i", rather than an identifier go on.
+  bool at_type = true;
+  size_t i = 0;
+  while (i < desc.size) {
+    char c = desc[i];
+    if (at_type && (c == 'L' || c == 'T')) {
+      // A class type, a type variable, or a formal type parameter "Name:".
+      size_t end = i + 1;
+      while (end < desc.size && desc[end] != ';' && desc[end] != '<' &&
+             desc[end] != ':') {
+        ++end;
+      }
+      if (c == 'L' && end < desc.size && desc[end] != ':' && end > i + 1) {
+        names->insert(std::string(desc.data + i + 1, end - i - 1));
+      }
+      i = end;
+    } else if (c == '.') {
+      // The inner class suffix of a parameterized class type; its outer
+      // class is named already.
+      do {
+        ++i;
+      } while (i < desc.size && desc[i] != ';' && desc[i] != '<' &&
+               desc[i] != '.');
+    } else {
+      at_type = c != '\0' && (strchr("()[<>;:+-^*", c) != NULL ||
+                               (at_type && strchr("BCDFIJSZV", c) != NULL));
+      ++i;
+    }
   }
+}
 
-  const_pool_in.clear();
-  const_pool_out.clear();
-  return keep;
+bool ListClassReferences(const u1 *classdata, size_t length, std::string *name,
+                         std::vector<std::string> *references) {
+  ClassFile *clazz = ReadClass(classdata, length);
+  if (clazz == NULL) {
+    ResetClassState();
+    return false;
+  }
+  Utf8Span this_name = clazz->this_class->Utf8();
+  name->assign(this_name.data, this_name.size);
+  std::set<std::string> names;
+  for (size_t i = 1; i < const_pool_in.size(); ++i) {
+    Constant *constant = const_pool_in[i];
+    if (constant == NULL) {
+      continue;
+    }
+    if (constant->tag_ == CONSTANT_Class) {
+      Utf8Span class_name = constant->Utf8();
+      if (class_name[0] == '[') {
+        AddSignatureClassNames(class_name, &names);
+      } else {
+        names.insert(std::string(class_name.data, class_name.size));
+      }
+    } else if (constant->tag_ == CONSTANT_Utf8) {
+      // Member names cannot have these, but descriptors and signatures
+      // start with them, or are a single class type.
+      Utf8Span utf8 = constant->Utf8();
+      if ((utf8.size > 0 && strchr("(<[", utf8[0]) != NULL) ||
+          (utf8[0] == 'L' && utf8[utf8.size - 1] == ';')) {
+        AddSignatureClassNames(utf8, &names);
+      }
+    }
+  }
+  names.erase(*name);
+  references->assign(names.begin(), names.end());
+  delete clazz;
+  ResetClassState();
+  return true;
 }
 
 }  // namespace devtools_ijar
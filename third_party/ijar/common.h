@@ -112,6 +112,17 @@ inline void put_n(u1 *&p, const u1 *src, size_t n) {
 
 extern bool verbose;
 
+// Whether StripClass() sorts the members and attributes of the classes, so
+// that classes with the same interface produce the same bytes whatever
+// order the compiler wrote them in.
+extern bool sort_members;
+
+// Whether the private, synthetic and anonymous nested classes are left out
+// of the interface jar unless another class of it refers to them, and
+// StripClass() drops the InnerClasses entries of those it does not refer
+// to.
+extern bool strip_private_nested;
+
 }  // namespace devtools_ijar
 
 #endif // INCLUDED_DEVTOOLS_IJAR_COMMON_H
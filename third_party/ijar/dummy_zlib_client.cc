@@ -23,7 +23,7 @@ u4 ComputeCrcChecksum(u1* buf, size_t length) { return 0; }
 
 size_t TryDeflate(u1* buf, size_t length) { return 0; }
 
-Decompressor::Decompressor() {}
+Decompressor::Decompressor() : stream_(NULL) {}
 Decompressor::~Decompressor() {}
 
 DecompressedFile* Decompressor::UncompressFile(const u1* buffer,
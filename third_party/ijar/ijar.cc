@@ -20,38 +20,173 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <errno.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "third_party/ijar/mapped_file.h"
 #include "third_party/ijar/zip.h"
+#include "third_party/ijar/zlib_client.h"
+#include "src/main/cpp/util/trace_events.h"
+#ifndef _WIN32
+#include "src/tools/worker/worker.h"
+#endif
 
 namespace devtools_ijar {
 
 bool verbose = false;
+bool sort_members = false;
+bool strip_private_nested = false;
+
+// Interface jars are read by javac on every compile and rarely leave the
+// machine, so their classes are stored unless they have at least this many
+// bytes (and deflating them saves space). Zero stores them all.
+size_t compress_threshold = 0;
+
+// With --output_digest, the "<function>:<xattr>" to store the digest of
+// every interface jar in (see ZipBuilder::SetOutputDigest()).
+const char *output_digest = NULL;
 
 // Reads a JVM class from classdata_in (of the specified length), and
 // writes out a simplified class to classdata_out, advancing the
-// pointer. Returns true if the class should be kept.
-bool StripClass(u1*& classdata_out, const u1* classdata_in, size_t in_length);
+// pointer. Returns true if the class should be kept. With
+// strip_private_nested, "hidden" tells whether the class should only be
+// kept if another class refers to it, and the names of the classes the
+// stripped class refers to are added to "references".
+bool StripClass(u1*& classdata_out, const u1* classdata_in, size_t in_length,
+                bool* hidden, std::vector<std::string>* references);
+
+// Reads a class of an interface jar, and sets "name" to the name of the
+// class and "references" to the sorted names of the other classes its
+// constant pool refers to: its class constants, and the class types of its
+// descriptors and signatures. Returns false if the class cannot be parsed.
+bool ListClassReferences(const u1* classdata, size_t length, std::string* name,
+                         std::vector<std::string>* references);
 
 const char* CLASS_EXTENSION = ".class";
 const size_t CLASS_EXTENSION_LENGTH = strlen(CLASS_EXTENSION);
 
+// The interface classes made from an earlier version of a jar, and the
+// CRC32 of each class of that version (see WriteInputCrcs()).
+struct PreviousJar {
+  std::map<std::string, u4> input_crcs;
+  std::map<std::string, std::string> classes;
+};
+
 // ZipExtractorProcessor that select only .class file and use
 // StripClass to generate an interface class, storing as a new file
 // in the specified ZipBuilder.
 class JarStripperProcessor : public ZipExtractorProcessor {
  public:
-  JarStripperProcessor() {}
+  JarStripperProcessor()
+      : extractor_(NULL), previous_(NULL), reused_classes_(0) {}
   virtual ~JarStripperProcessor() {}
 
   virtual void Process(const char* filename, const u4 attr,
                        const u1* data, const size_t size);
+  virtual void ProcessStored(const char* filename, const u4 attr,
+                             const u1* data, const size_t compressed_size,
+                             const size_t uncompressed_size,
+                             const bool compressed);
   virtual bool Accept(const char* filename, const u4 attr);
 
+  // Strips the classes collected by ProcessStored() on the given number of
+  // threads and adds them to the output in their original order.
+  void StripStoredClasses(int threads);
+
+  // Adds the hidden classes held back by AddClass() that the classes of
+  // the output refer to, directly or through other hidden classes.
+  void AddReferencedHiddenClasses();
+
+  // Makes the classes whose CRC32 in "extractor" is the one recorded in
+  // "previous" be copied from its interface classes instead of stripped.
+  // Neither is owned; both should outlive the processing. Not for use with
+  // strip_private_nested, which needs the references of every class.
+  void SetPreviousJar(ZipExtractor* extractor, const PreviousJar* previous) {
+    extractor_ = extractor;
+    previous_ = previous;
+  }
+
+  size_t reused_classes() const { return reused_classes_; }
+
  private:
+  // A class file as stored in the input, and the result of stripping it.
+  struct StoredClass {
+    std::string filename;
+    const u1* data;
+    size_t compressed_size;
+    size_t uncompressed_size;
+    bool compressed;
+    const std::string* previous;  // The interface class to copy, or NULL.
+    bool done;
+    u1* stripped;  // NULL if the class should not be kept.
+    size_t stripped_length;
+    bool hidden;
+    std::vector<std::string> references;
+  };
+
+  // A class held back until it is known whether it is referred to.
+  struct HiddenClass {
+    std::string filename;
+    std::string data;
+    std::vector<std::string> references;
+  };
+
+  // Strips the classes from the next_class_ (waiting for the writer if it
+  // is too far behind) until the end.
+  void StripWorker();
+
+  // Adds the class contents to the output, or holds it back if it is
+  // hidden.
+  void AddClass(const char* filename, const u1* data, size_t length,
+                bool hidden, const std::vector<std::string>& references);
+
+  // Writes the class contents to the output.
+  void WriteClass(const char* filename, const u1* data, size_t length);
+
+  // Returns the interface class of the previous jar for the file being
+  // processed if its input did not change, and NULL otherwise.
+  const std::string* FindPreviousClass(const char* filename);
+
+  // Writes out a class found by FindPreviousClass().
+  void WritePreviousClass(const char* filename, const std::string& data);
+
   // Not owned by JarStripperProcessor, see SetZipBuilder().
   ZipBuilder* builder;
 
+  // Not owned by JarStripperProcessor, see SetPreviousJar().
+  ZipExtractor* extractor_;
+  const PreviousJar* previous_;
+  size_t reused_classes_;
+
+  std::vector<StoredClass> stored_classes_;
+  // Guards the following and the StoredClass::done fields.
+  std::mutex mutex_;
+  // Signalled when a class is done and when a class is written out.
+  std::condition_variable class_done_;
+  std::condition_variable class_written_;
+  size_t next_class_;
+  size_t written_classes_;
+
+  // The classes the classes written so far refer to, and the hidden
+  // classes none of them did refer to yet.
+  std::set<std::string> referenced_classes_;
+  std::vector<HiddenClass> hidden_classes_;
+
  public:
   // Set the ZipBuilder to add the ijar class to the output zip file.
   // This pointer should not be deleted while this class is still in use and
@@ -71,25 +206,217 @@ bool JarStripperProcessor::Accept(const char* filename, const u4 attr) {
 
 void JarStripperProcessor::Process(const char* filename, const u4 attr,
                                    const u1* data, const size_t size) {
+  const std::string* previous = FindPreviousClass(filename);
+  if (previous != NULL) {
+    WritePreviousClass(filename, *previous);
+    return;
+  }
   if (verbose) {
     fprintf(stderr, "INFO: StripClass: %s\n", filename);
   }
   u1* buf = reinterpret_cast<u1*>(malloc(size));
   u1* classdata_out = buf;
-  if (!StripClass(buf, data, size)) {
+  bool hidden;
+  std::vector<std::string> references;
+  if (!StripClass(buf, data, size, &hidden, &references)) {
     free(classdata_out);
     return;
   }
-  u1* q = builder->NewFile(filename, 0);
-  size_t out_length = buf - classdata_out;
-  memcpy(q, classdata_out, out_length);
-  builder->FinishFile(out_length);
+  AddClass(filename, classdata_out, buf - classdata_out, hidden, references);
   free(classdata_out);
 }
 
+void JarStripperProcessor::AddClass(
+    const char* filename, const u1* data, size_t length, bool hidden,
+    const std::vector<std::string>& references) {
+  if (hidden) {
+    HiddenClass hidden_class = {
+        filename, std::string(reinterpret_cast<const char*>(data), length),
+        references};
+    hidden_classes_.push_back(hidden_class);
+    return;
+  }
+  referenced_classes_.insert(references.begin(), references.end());
+  WriteClass(filename, data, length);
+}
+
+void JarStripperProcessor::WriteClass(const char* filename, const u1* data,
+                                      size_t length) {
+  u1* q = builder->NewFile(filename, 0);
+  memcpy(q, data, length);
+  // Readers check the CRC of the deflated entries.
+  bool compress = compress_threshold > 0 && length >= compress_threshold;
+  builder->FinishFile(length, compress, compress);
+}
+
+const std::string* JarStripperProcessor::FindPreviousClass(
+    const char* filename) {
+  if (previous_ == NULL) {
+    return NULL;
+  }
+  auto crc = previous_->input_crcs.find(filename);
+  if (crc == previous_->input_crcs.end() ||
+      crc->second != extractor_->GetCrc32()) {
+    return NULL;
+  }
+  // A class StripClass() did not keep is not in the previous interface jar,
+  // and is stripped again.
+  auto previous = previous_->classes.find(filename);
+  return previous != previous_->classes.end() ? &previous->second : NULL;
+}
+
+void JarStripperProcessor::WritePreviousClass(const char* filename,
+                                              const std::string& data) {
+  if (verbose) {
+    fprintf(stderr, "INFO: reused %s\n", filename);
+  }
+  ++reused_classes_;
+  WriteClass(filename, reinterpret_cast<const u1*>(data.data()), data.size());
+}
+
+void JarStripperProcessor::AddReferencedHiddenClasses() {
+  // Writing out a class may make others referenced, so repeat until none is.
+  bool added;
+  do {
+    added = false;
+    for (size_t i = 0; i < hidden_classes_.size(); ++i) {
+      HiddenClass& hidden_class = hidden_classes_[i];
+      const std::string& filename = hidden_class.filename;
+      std::string name =
+          filename.substr(0, filename.size() - CLASS_EXTENSION_LENGTH);
+      if (referenced_classes_.find(name) == referenced_classes_.end()) {
+        continue;
+      }
+      referenced_classes_.insert(hidden_class.references.begin(),
+                                 hidden_class.references.end());
+      WriteClass(filename.c_str(),
+                 reinterpret_cast<const u1*>(hidden_class.data.data()),
+                 hidden_class.data.size());
+      hidden_classes_.erase(hidden_classes_.begin() + i--);
+      added = true;
+    }
+  } while (added);
+  if (verbose) {
+    for (const auto& hidden_class : hidden_classes_) {
+      fprintf(stderr, "INFO: dropped unreferenced class %s\n",
+              hidden_class.filename.c_str());
+    }
+  }
+  hidden_classes_.clear();
+  referenced_classes_.clear();
+}
+
+void JarStripperProcessor::ProcessStored(const char* filename, const u4 attr,
+                                         const u1* data,
+                                         const size_t compressed_size,
+                                         const size_t uncompressed_size,
+                                         const bool compressed) {
+  // The classes to copy need no worker.
+  const std::string* previous = FindPreviousClass(filename);
+  StoredClass stored_class = {filename, data,  compressed_size,
+                              uncompressed_size, compressed, previous,
+                              previous != NULL, NULL, 0, false,
+                              std::vector<std::string>()};
+  stored_classes_.push_back(stored_class);
+}
+
+// The workers stay at most this many classes ahead of the writer, so that
+// the stripped classes waiting to be written out do not pile up.
+static const size_t kMaxClassesAhead = 1024;
+
+void JarStripperProcessor::StripWorker() {
+  Decompressor decompressor;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    class_written_.wait(lock, [this]() {
+      return next_class_ >= stored_classes_.size() ||
+             next_class_ < written_classes_ + kMaxClassesAhead;
+    });
+    if (next_class_ >= stored_classes_.size()) {
+      return;
+    }
+    StoredClass& stored_class = stored_classes_[next_class_++];
+    if (stored_class.done) {
+      continue;
+    }
+    lock.unlock();
+
+    const u1* data = stored_class.data;
+    size_t size = stored_class.uncompressed_size;
+    if (stored_class.compressed) {
+      DecompressedFile* decompressed_file =
+          decompressor.UncompressFile(data, stored_class.compressed_size);
+      if (decompressed_file == NULL) {
+        fprintf(stderr, "Cannot decompress %s: %s\n",
+                stored_class.filename.c_str(), decompressor.GetError());
+        abort();
+      }
+      data = decompressed_file->uncompressed_data;
+      size = decompressed_file->uncompressed_size;
+      free(decompressed_file);
+    }
+    u1* buf = reinterpret_cast<u1*>(malloc(size));
+    u1* classdata_out = buf;
+    if (StripClass(buf, data, size, &stored_class.hidden,
+                   &stored_class.references)) {
+      stored_class.stripped = classdata_out;
+      stored_class.stripped_length = buf - classdata_out;
+    } else {
+      free(classdata_out);
+    }
+
+    lock.lock();
+    stored_class.done = true;
+    class_done_.notify_all();
+  }
+}
+
+void JarStripperProcessor::StripStoredClasses(int threads) {
+  next_class_ = 0;
+  written_classes_ = 0;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back(&JarStripperProcessor::StripWorker, this);
+  }
+  for (auto& stored_class : stored_classes_) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      class_done_.wait(lock, [&stored_class]() { return stored_class.done; });
+    }
+    if (stored_class.previous != NULL) {
+      WritePreviousClass(stored_class.filename.c_str(),
+                         *stored_class.previous);
+    } else {
+      if (verbose) {
+        fprintf(stderr, "INFO: StripClass: %s\n",
+                stored_class.filename.c_str());
+      }
+      if (stored_class.stripped != NULL) {
+        AddClass(stored_class.filename.c_str(), stored_class.stripped,
+                 stored_class.stripped_length, stored_class.hidden,
+                 stored_class.references);
+        free(stored_class.stripped);
+        stored_class.stripped = NULL;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++written_classes_;
+    class_written_.notify_all();
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  stored_classes_.clear();
+}
+
 // Opens "file_in" (a .jar file) for reading, and writes an interface
-// .jar to "file_out".
-void OpenFilesAndProcessJar(const char *file_out, const char *file_in) {
+// .jar to "file_out". With more than one thread, the classes are
+// decompressed and stripped in parallel. With "previous", the classes that
+// did not change since the previous jar are copied from it.
+void OpenFilesAndProcessJar(const char *file_out, const char *file_in,
+                            int threads, const PreviousJar *previous) {
+  blaze_util::TraceSpan jar_span("process jar", file_in);
+  uint64_t phase_start = BlazeTraceNow();
   JarStripperProcessor processor;
   std::unique_ptr<ZipExtractor> in(ZipExtractor::Create(file_in, &processor));
   if (in.get() == NULL) {
@@ -104,13 +431,32 @@ void OpenFilesAndProcessJar(const char *file_out, const char *file_in) {
             strerror(errno));
     abort();
   }
+  if (output_digest != NULL) {
+    out->SetOutputDigest(blaze_util::OutputDigest::Parse(output_digest));
+  }
   processor.SetZipBuilder(out.get());
+  if (previous != NULL) {
+    processor.SetPreviousJar(in.get(), previous);
+  }
+  BlazeTraceSpan("open", file_in, phase_start);
+  phase_start = BlazeTraceNow();
 
-  // Process all files in the zip
-  if (in->ProcessAll() < 0) {
+  // Process all files in the zip. The classes that are copied are not even
+  // decompressed on the ProcessNextStored() path.
+  if (threads > 1 || previous != NULL) {
+    while (in->ProcessNextStored()) {}
+    if (in->GetError() != NULL) {
+      fprintf(stderr, "%s\n", in->GetError());
+      abort();
+    }
+    processor.StripStoredClasses(threads);
+  } else if (in->ProcessAll() < 0) {
     fprintf(stderr, "%s\n", in->GetError());
     abort();
   }
+  processor.AddReferencedHiddenClasses();
+  BlazeTraceSpan("strip classes", file_in, phase_start);
+  phase_start = BlazeTraceNow();
 
   // Add dummy file, since javac doesn't like truly empty jars.
   if (out->GetNumberFiles() == 0) {
@@ -121,14 +467,514 @@ void OpenFilesAndProcessJar(const char *file_out, const char *file_in) {
     fprintf(stderr, "%s\n", out->GetError());
     abort();
   }
+  BlazeTraceSpan("write", file_out, phase_start);
   // Get all file size
   size_t in_length = in->GetSize();
   size_t out_length = out->GetSize();
+  BlazeTraceCounter("input bytes", in_length);
+  BlazeTraceCounter("output bytes", out_length);
+  if (previous != NULL) {
+    BlazeTraceCounter("reused classes", processor.reused_classes());
+  }
   if (verbose) {
     fprintf(stderr, "INFO: produced interface jar: %s -> %s (%d%%).\n",
             file_in, file_out,
             static_cast<int>(100.0 * out_length / in_length));
+    if (previous != NULL) {
+      fprintf(stderr, "INFO: reused %zu classes of the previous jar.\n",
+              processor.reused_classes());
+    }
+  }
+}
+
+// Bump whenever a change to ijar changes the interface jars it produces,
+// so that the cache entries written by older versions are not used.
+static const int kCacheVersion = 1;
+
+// Names the version of ijar and the options that change the interface
+// classes it makes, for the cache entries and the input CRC files.
+static std::string OptionsKey() {
+  char threshold[32] = "";
+  if (compress_threshold > 0) {
+    snprintf(threshold, sizeof(threshold), "z%zu", compress_threshold);
+  }
+  char key[64];
+  snprintf(key, sizeof(key), "ijar%d%s%s%s", kCacheVersion,
+           sort_members ? "s" : "", strip_private_nested ? "p" : "",
+           threshold);
+  return key;
+}
+
+static inline u8 Rotl64(u8 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline u8 Fmix64(u8 k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// Computes the 128-bit MurmurHash3 (x64 variant) of the data as a hex
+// string. It is not a cryptographic hash, but it runs at memory speed, and
+// accidental collisions are out of the question.
+static std::string Digest(const u1 *data, size_t length) {
+  const u8 c1 = 0x87c37b91114253d5ULL;
+  const u8 c2 = 0x4cf5ad432745937fULL;
+  u8 h1 = 0;
+  u8 h2 = 0;
+  size_t pos = 0;
+  for (; pos + 16 <= length; pos += 16) {
+    u8 k1, k2;
+    memcpy(&k1, data + pos, 8);
+    memcpy(&k2, data + pos + 8, 8);
+    k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  }
+  u8 k1 = 0;
+  u8 k2 = 0;
+  for (size_t i = length - pos; i > 8; --i) {
+    k2 = (k2 << 8) | data[pos + i - 1];
+  }
+  for (size_t i = std::min<size_t>(length - pos, 8); i > 0; --i) {
+    k1 = (k1 << 8) | data[pos + i - 1];
+  }
+  if (k2 != 0) {
+    k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+  }
+  if (k1 != 0) {
+    k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+  }
+  h1 ^= length;
+  h2 ^= length;
+  h1 += h2;
+  h2 += h1;
+  h1 = Fmix64(h1);
+  h2 = Fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+
+  char hex[33];
+  snprintf(hex, sizeof(hex), "%016llx%016llx",
+           static_cast<unsigned long long>(h1),
+           static_cast<unsigned long long>(h2));
+  return hex;
+}
+
+// Computes the Digest() of the contents of "filename".
+static bool DigestFile(const char *filename, std::string *digest) {
+  MappedInputFile file(filename);
+  if (!file.Opened()) {
+    return false;
+  }
+  *digest = Digest(file.Buffer(), file.Length());
+  file.Close();
+  return true;
+}
+
+// Makes "to" (which should not exist) have the contents of "from",
+// hard linking it if possible and copying it otherwise.
+static bool LinkOrCopy(const char *from, const char *to) {
+#ifndef _WIN32
+  if (link(from, to) == 0) {
+    return true;
+  }
+#endif
+  FILE *in = fopen(from, "rb");
+  if (in == NULL) {
+    return false;
+  }
+  FILE *out = fopen(to, "wb");
+  if (out == NULL) {
+    fclose(in);
+    return false;
+  }
+  char buffer[65536];
+  size_t n_read;
+  bool ok = true;
+  while (ok && (n_read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    ok = fwrite(buffer, 1, n_read, out) == n_read;
+  }
+  ok = !ferror(in) && ok;
+  fclose(in);
+  ok = fclose(out) == 0 && ok;
+  if (!ok) {
+    remove(to);
+  }
+  return ok;
+}
+
+// Moves "from" over "to".
+static bool Replace(const char *from, const char *to) {
+#ifdef _WIN32
+  remove(to);
+#endif
+  return rename(from, to) == 0;
+}
+
+// Like OpenFilesAndProcessJar, but first looks the interface jar up in
+// "cache_dir" by the digest of the contents of "file_in", and adds it
+// there if it is not found. Cache entries are only ever created by
+// renaming a complete file, so the directory can be shared by concurrent
+// ijar runs.
+//
+// The output is usually a hard link to the cache entry, so the entries are
+// made read-only: an output must be replaced (as ZipBuilder does), never
+// modified in place, or the cache entry changes with it.
+void ProcessJarWithCache(const char *file_out, const char *file_in,
+                         int threads, const char *cache_dir,
+                         const PreviousJar *previous) {
+  std::string digest;
+  uint64_t digest_start = BlazeTraceNow();
+  bool digested = DigestFile(file_in, &digest);
+  BlazeTraceSpan("digest", file_in, digest_start);
+  if (!digested) {
+    // Let OpenFilesAndProcessJar report the problem.
+    OpenFilesAndProcessJar(file_out, file_in, threads, previous);
+    return;
+  }
+  // Jars of a batch may share the cache entry, too.
+  static std::atomic<int> temp_files(0);
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".tmp%d-%d", static_cast<int>(getpid()),
+           temp_files++);
+  std::string entry =
+      std::string(cache_dir) + "/" + OptionsKey() + "-" + digest + ".jar";
+
+  std::string temp_out = std::string(file_out) + suffix;
+  remove(temp_out.c_str());
+  if (LinkOrCopy(entry.c_str(), temp_out.c_str())) {
+    if (!Replace(temp_out.c_str(), file_out)) {
+      fprintf(stderr, "Unable to rename %s to %s: %s\n", temp_out.c_str(),
+              file_out, strerror(errno));
+      abort();
+    }
+    if (verbose) {
+      fprintf(stderr, "INFO: %s found in cache as %s.\n", file_in,
+              entry.c_str());
+    }
+    BlazeTraceSpan("cache hit", entry.c_str(), digest_start);
+    return;
+  }
+
+  OpenFilesAndProcessJar(file_out, file_in, threads, previous);
+  // A failure to add the entry only costs the next run a cache miss.
+  std::string temp_entry = entry + suffix;
+  if (!LinkOrCopy(file_out, temp_entry.c_str()) ||
+#ifndef _WIN32
+      chmod(temp_entry.c_str(), 0444) < 0 ||
+#endif
+      !Replace(temp_entry.c_str(), entry.c_str())) {
+    remove(temp_entry.c_str());
+    if (verbose) {
+      fprintf(stderr, "INFO: unable to add %s to cache: %s\n", file_out,
+              strerror(errno));
+    }
+  }
+}
+
+// Reads the jars of a batch from "batch_file" into "jars": each jar is on a
+// line, followed by its interface jar on the next one.
+bool ReadBatchFile(const char *batch_file,
+                   std::vector<std::pair<std::string, std::string> > *jars) {
+  FILE *in = fopen(batch_file, "rb");
+  if (in == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", batch_file, strerror(errno));
+    return false;
+  }
+  std::vector<std::string> lines;
+  std::string line;
+  int c;
+  while ((c = getc(in)) != EOF) {
+    if (c == '\n') {
+      lines.push_back(line);
+      line.clear();
+    } else if (c != '\r') {
+      line += static_cast<char>(c);
+    }
+  }
+  fclose(in);
+  if (!line.empty()) {
+    lines.push_back(line);
+  }
+  if (lines.size() % 2 != 0) {
+    fprintf(stderr, "%s: the last jar has no interface jar\n", batch_file);
+    return false;
+  }
+  for (size_t i = 0; i < lines.size(); i += 2) {
+    jars->push_back(std::make_pair(lines[i], lines[i + 1]));
   }
+  return true;
+}
+
+// Makes the interface jars of the (jar, interface jar) pairs in "jars",
+// one jar at a time on each of the given number of threads. The state that
+// StripClass() keeps per thread is then reused from one jar to the next.
+void ProcessJars(const std::vector<std::pair<std::string, std::string> > &jars,
+                 int threads, const char *cache_dir) {
+  std::atomic<size_t> next_jar(0);
+  auto process_jars = [&jars, &next_jar, cache_dir]() {
+    size_t i;
+    while ((i = next_jar++) < jars.size()) {
+      const char *file_in = jars[i].first.c_str();
+      const char *file_out = jars[i].second.c_str();
+      if (verbose) {
+        fprintf(stderr, "INFO: writing to '%s'.\n", file_out);
+      }
+      if (cache_dir != NULL) {
+        ProcessJarWithCache(file_out, file_in, 1, cache_dir, NULL);
+      } else {
+        OpenFilesAndProcessJar(file_out, file_in, 1, NULL);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads && static_cast<size_t>(i) < jars.size(); ++i) {
+    workers.emplace_back(process_jars);
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+// ZipExtractorProcessor that lists the Digest() of every class of an
+// interface jar. A stripped class only changes when the interface of the
+// class does (its output constant pool is ordered by first use), so
+// comparing the digests tells which classes had their interface changed.
+class ClassDigestProcessor : public ZipExtractorProcessor {
+ public:
+  virtual bool Accept(const char* filename, const u4 attr) {
+    ssize_t offset = strlen(filename) - CLASS_EXTENSION_LENGTH;
+    return offset >= 0 && strcmp(filename + offset, CLASS_EXTENSION) == 0;
+  }
+
+  virtual void Process(const char* filename, const u4 attr,
+                       const u1* data, const size_t size) {
+    lines_ += Digest(data, size) + " " + filename + "\n";
+  }
+
+  const std::string& lines() const { return lines_; }
+
+ private:
+  std::string lines_;
+};
+
+// Writes to "file_out" a "<digest> <class file>" line for each class in
+// the interface jar "jar", in the order they are stored in it.
+void WriteClassDigests(const char *file_out, const char *jar) {
+  ClassDigestProcessor processor;
+  std::unique_ptr<ZipExtractor> in(ZipExtractor::Create(jar, &processor));
+  if (in.get() == NULL) {
+    fprintf(stderr, "Unable to open Zip file %s: %s\n", jar,
+            strerror(errno));
+    abort();
+  }
+  if (in->ProcessAll() < 0) {
+    fprintf(stderr, "%s\n", in->GetError());
+    abort();
+  }
+  FILE *out = fopen(file_out, "wb");
+  if (out == NULL ||
+      fwrite(processor.lines().data(), 1, processor.lines().size(), out) !=
+          processor.lines().size() ||
+      fclose(out) != 0) {
+    fprintf(stderr, "Unable to write %s: %s\n", file_out, strerror(errno));
+    abort();
+  }
+}
+
+// ZipExtractorProcessor that lists the CRC32 of every class of a jar, from
+// its central directory alone.
+class InputCrcProcessor : public ZipExtractorProcessor {
+ public:
+  InputCrcProcessor() : extractor_(NULL) {}
+
+  void SetZipExtractor(ZipExtractor* extractor) { extractor_ = extractor; }
+
+  virtual bool Accept(const char* filename, const u4 attr) {
+    ssize_t offset = strlen(filename) - CLASS_EXTENSION_LENGTH;
+    if (offset >= 0 && strcmp(filename + offset, CLASS_EXTENSION) == 0) {
+      char crc[16];
+      snprintf(crc, sizeof(crc), "%08x ", extractor_->GetCrc32());
+      lines_ += std::string(crc) + filename + "\n";
+    }
+    return false;
+  }
+
+  virtual void Process(const char* filename, const u4 attr,
+                       const u1* data, const size_t size) {}
+
+  const std::string& lines() const { return lines_; }
+
+ private:
+  ZipExtractor* extractor_;
+  std::string lines_;
+};
+
+// Writes to "file_out" the OptionsKey() on the first line, then a
+// "<crc32> <class file>" line for each class of "jar". With the interface
+// jar made from "jar", this is what --previous reuses the classes from.
+void WriteInputCrcs(const char *file_out, const char *jar) {
+  InputCrcProcessor processor;
+  std::unique_ptr<ZipExtractor> in(ZipExtractor::Create(jar, &processor));
+  if (in.get() == NULL) {
+    fprintf(stderr, "Unable to open Zip file %s: %s\n", jar,
+            strerror(errno));
+    abort();
+  }
+  processor.SetZipExtractor(in.get());
+  if (in->ProcessAll() < 0) {
+    fprintf(stderr, "%s\n", in->GetError());
+    abort();
+  }
+  std::string contents = OptionsKey() + "\n" + processor.lines();
+  FILE *out = fopen(file_out, "wb");
+  if (out == NULL ||
+      fwrite(contents.data(), 1, contents.size(), out) != contents.size() ||
+      fclose(out) != 0) {
+    fprintf(stderr, "Unable to write %s: %s\n", file_out, strerror(errno));
+    abort();
+  }
+}
+
+// ZipExtractorProcessor that keeps the contents of every class of a jar.
+class ClassContentsProcessor : public ZipExtractorProcessor {
+ public:
+  explicit ClassContentsProcessor(std::map<std::string, std::string>* classes)
+      : classes_(classes) {}
+
+  virtual bool Accept(const char* filename, const u4 attr) {
+    ssize_t offset = strlen(filename) - CLASS_EXTENSION_LENGTH;
+    return offset >= 0 && strcmp(filename + offset, CLASS_EXTENSION) == 0;
+  }
+
+  virtual void Process(const char* filename, const u4 attr,
+                       const u1* data, const size_t size) {
+    (*classes_)[filename].assign(reinterpret_cast<const char*>(data), size);
+  }
+
+ private:
+  std::map<std::string, std::string>* classes_;
+};
+
+// ZipExtractorProcessor that lists the classes each class of an interface
+// jar refers to, by class name.
+class ClassSummaryProcessor : public ZipExtractorProcessor {
+ public:
+  virtual bool Accept(const char* filename, const u4 attr) {
+    ssize_t offset = strlen(filename) - CLASS_EXTENSION_LENGTH;
+    return offset >= 0 && strcmp(filename + offset, CLASS_EXTENSION) == 0;
+  }
+
+  virtual void Process(const char* filename, const u4 attr,
+                       const u1* data, const size_t size) {
+    std::string name;
+    std::vector<std::string> references;
+    if (!ListClassReferences(data, size, &name, &references)) {
+      // The class was passed through unstripped; only its name is known.
+      name.assign(filename, strlen(filename) - CLASS_EXTENSION_LENGTH);
+    }
+    std::string& line = lines_[name];
+    line = name;
+    for (const auto& reference : references) {
+      line += " " + reference;
+    }
+    line += "\n";
+  }
+
+  // The lines of the classes, sorted by class name.
+  const std::map<std::string, std::string>& lines() const { return lines_; }
+
+ private:
+  std::map<std::string, std::string> lines_;
+};
+
+// Writes to "file_out" a "<class> <referenced class>..." line for each
+// class of the interface jar "jar", sorted by class name, with the classes
+// it refers to sorted, too. The classes a jar defines and needs to compile
+// against it can then be told without reading the jar again.
+void WriteClassSummary(const char *file_out, const char *jar) {
+  ClassSummaryProcessor processor;
+  std::unique_ptr<ZipExtractor> in(ZipExtractor::Create(jar, &processor));
+  if (in.get() == NULL) {
+    fprintf(stderr, "Unable to open Zip file %s: %s\n", jar,
+            strerror(errno));
+    abort();
+  }
+  if (in->ProcessAll() < 0) {
+    fprintf(stderr, "%s\n", in->GetError());
+    abort();
+  }
+  FILE *out = fopen(file_out, "wb");
+  bool ok = out != NULL;
+  for (const auto &line : processor.lines()) {
+    ok = ok && fwrite(line.second.data(), 1, line.second.size(), out) ==
+                   line.second.size();
+  }
+  if (!ok || fclose(out) != 0) {
+    fprintf(stderr, "Unable to write %s: %s\n", file_out, strerror(errno));
+    abort();
+  }
+}
+
+// Reads the interface jar "jar" and the "input_crcs" that WriteInputCrcs()
+// wrote for the jar it was made from into "previous". Returns false if
+// either cannot be read, or if they were made by another version of ijar or
+// with other options; the classes are then all stripped.
+bool ReadPreviousJar(const char *jar, const char *input_crcs,
+                     PreviousJar *previous) {
+  FILE *in = fopen(input_crcs, "rb");
+  if (in == NULL) {
+    if (verbose) {
+      fprintf(stderr, "INFO: unable to open %s: %s\n", input_crcs,
+              strerror(errno));
+    }
+    return false;
+  }
+  std::vector<std::string> lines;
+  std::string line;
+  int c;
+  while ((c = getc(in)) != EOF) {
+    if (c == '\n') {
+      lines.push_back(line);
+      line.clear();
+    } else {
+      line += static_cast<char>(c);
+    }
+  }
+  fclose(in);
+  if (lines.empty() || lines[0] != OptionsKey()) {
+    if (verbose) {
+      fprintf(stderr, "INFO: %s was made with other options\n", input_crcs);
+    }
+    return false;
+  }
+  for (size_t i = 1; i < lines.size(); ++i) {
+    const std::string &entry = lines[i];
+    char *end;
+    unsigned long crc = strtoul(entry.c_str(), &end, 16);
+    if (end != entry.c_str() + 8 || *end != ' ') {
+      fprintf(stderr, "%s:%zu: malformed line\n", input_crcs, i + 1);
+      return false;
+    }
+    previous->input_crcs[entry.substr(9)] = static_cast<u4>(crc);
+  }
+
+  ClassContentsProcessor processor(&previous->classes);
+  std::unique_ptr<ZipExtractor> zip(ZipExtractor::Create(jar, &processor));
+  if (zip.get() == NULL || zip->ProcessAll() < 0) {
+    if (verbose) {
+      fprintf(stderr, "INFO: unable to read %s: %s\n", jar,
+              zip.get() == NULL ? strerror(errno) : zip->GetError());
+    }
+    previous->input_crcs.clear();
+    previous->classes.clear();
+    return false;
+  }
+  return true;
 }
 
 }  // namespace devtools_ijar
@@ -137,18 +983,126 @@ void OpenFilesAndProcessJar(const char *file_out, const char *file_in) {
 // main method
 //
 static void usage() {
-  fprintf(stderr, "Usage: ijar [-v] x.jar [x_interface.jar>]\n");
+  fprintf(stderr, "Usage: ijar [-v] [-s] [-p] [-j threads] [-c cache_dir] "
+          "[--compress_threshold bytes]\n"
+          "            [--output_digest function:xattr]\n"
+          "            [-d class_digests] [--class_summary class_summary]\n"
+          "            [--input_crcs input_crcs]\n"
+          "            [--previous previous_interface.jar previous_crcs]\n"
+          "            x.jar [x_interface.jar>]\n");
+  fprintf(stderr, "       ijar [-v] [-s] [-p] [-j threads] [-c cache_dir] "
+          "[--compress_threshold bytes]\n"
+          "            [--output_digest function:xattr] -b batch_file\n");
   fprintf(stderr, "Creates an interface jar from the specified jar file.\n");
+  fprintf(stderr, "With -b, creates the interface jars of the jars listed "
+          "in batch_file,\none per line and each followed by its interface "
+          "jar, -j of them at once.\n");
+  fprintf(stderr, "With -s, the fields, methods and attributes of the "
+          "classes are sorted,\nso that equal interfaces produce equal "
+          "interface classes.\n");
+  fprintf(stderr, "With -p, the private, synthetic and anonymous nested "
+          "classes are left out\nunless another interface class refers to "
+          "them.\n");
+  fprintf(stderr, "With -c, interface jars are reused from and added to "
+          "cache_dir. The\noutputs may then be read-only hard links to the "
+          "entries of cache_dir, to be\nreplaced rather than modified in "
+          "place.\n");
+  fprintf(stderr, "The classes are stored uncompressed; with "
+          "--compress_threshold, those of at\nleast the given number of "
+          "bytes are deflated.\n");
+  fprintf(stderr, "With --output_digest, the md5 or sha256 digest of each "
+          "interface jar is\ncomputed as it is written and stored in the "
+          "extended attribute xattr,\nwhere Bazel started with "
+          "-Dbazel.DigestXattr=xattr finds it.\n");
+  fprintf(stderr, "With -d, the digest of each interface class is written "
+          "to class_digests.\n");
+  fprintf(stderr, "With --class_summary, each interface class is written "
+          "to class_summary,\nfollowed by the classes it refers to.\n");
+  fprintf(stderr, "With --input_crcs, the CRC32 of each class of x.jar is "
+          "written to input_crcs.\n");
+  fprintf(stderr, "With --previous, the classes whose CRC32 is the same as "
+          "in previous_crcs,\nas --input_crcs wrote it for an earlier "
+          "x.jar, are copied from\nprevious_interface.jar, its interface "
+          "jar, instead of stripped again.\nIt has no effect with -p.\n");
+  fprintf(stderr, "With --persistent_worker, the command lines are read as "
+          "worker requests\nfrom the standard input.\n");
   exit(1);
 }
 
-int main(int argc, char **argv) {
+static int IjarMain(int argc, char **argv) {
+  BlazeTraceInit("ijar", NULL);
   const char *filename_in = NULL;
   const char *filename_out = NULL;
+  const char *cache_dir = NULL;
+  const char *class_digests = NULL;
+  const char *batch_file = NULL;
+  const char *class_summary = NULL;
+  const char *input_crcs = NULL;
+  const char *previous_jar = NULL;
+  const char *previous_crcs = NULL;
+  int threads = 1;
+  // A persistent worker runs this for every request, and the argument does
+  // not outlive the request.
+  devtools_ijar::output_digest = NULL;
 
   for (int ii = 1; ii < argc; ++ii) {
     if (strcmp(argv[ii], "-v") == 0) {
       devtools_ijar::verbose = true;
+    } else if (strcmp(argv[ii], "-s") == 0) {
+      devtools_ijar::sort_members = true;
+    } else if (strcmp(argv[ii], "-p") == 0) {
+      devtools_ijar::strip_private_nested = true;
+    } else if (strcmp(argv[ii], "-j") == 0) {
+      if (++ii == argc || (threads = atoi(argv[ii])) < 1) {
+        usage();
+      }
+    } else if (strcmp(argv[ii], "--compress_threshold") == 0) {
+      int threshold;
+      if (++ii == argc || (threshold = atoi(argv[ii])) < 1) {
+        usage();
+      }
+      devtools_ijar::compress_threshold = threshold;
+    } else if (strcmp(argv[ii], "--output_digest") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      std::unique_ptr<blaze_util::OutputDigest> digest(
+          blaze_util::OutputDigest::Parse(argv[ii]));
+      if (digest == NULL) {
+        usage();
+      }
+      devtools_ijar::output_digest = argv[ii];
+    } else if (strcmp(argv[ii], "-c") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      cache_dir = argv[ii];
+    } else if (strcmp(argv[ii], "-d") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      class_digests = argv[ii];
+    } else if (strcmp(argv[ii], "--class_summary") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      class_summary = argv[ii];
+    } else if (strcmp(argv[ii], "--input_crcs") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      input_crcs = argv[ii];
+    } else if (strcmp(argv[ii], "--previous") == 0) {
+      if (ii + 2 >= argc) {
+        usage();
+      }
+      previous_jar = argv[++ii];
+      previous_crcs = argv[++ii];
+    } else if (strcmp(argv[ii], "-b") == 0) {
+      if (++ii == argc) {
+        usage();
+      }
+      batch_file = argv[ii];
     } else if (filename_in == NULL) {
       filename_in = argv[ii];
     } else if (filename_out == NULL) {
@@ -158,6 +1112,19 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (batch_file != NULL) {
+    if (filename_in != NULL || class_digests != NULL ||
+        class_summary != NULL || input_crcs != NULL || previous_jar != NULL) {
+      usage();
+    }
+    std::vector<std::pair<std::string, std::string> > jars;
+    if (!devtools_ijar::ReadBatchFile(batch_file, &jars)) {
+      return 1;
+    }
+    devtools_ijar::ProcessJars(jars, threads, cache_dir);
+    return 0;
+  }
+
   if (filename_in == NULL) {
     usage();
   }
@@ -181,6 +1148,45 @@ int main(int argc, char **argv) {
     fprintf(stderr, "INFO: writing to '%s'.\n", filename_out);
   }
 
-  devtools_ijar::OpenFilesAndProcessJar(filename_out, filename_in);
+  // With -p, whether a nested class is kept depends on the other classes,
+  // which the previous jar does not record.
+  devtools_ijar::PreviousJar previous_classes;
+  const devtools_ijar::PreviousJar *previous = NULL;
+  if (previous_jar != NULL && !devtools_ijar::strip_private_nested) {
+    uint64_t read_start = BlazeTraceNow();
+    if (devtools_ijar::ReadPreviousJar(previous_jar, previous_crcs,
+                                       &previous_classes)) {
+      previous = &previous_classes;
+    }
+    BlazeTraceSpan("read previous jar", previous_jar, read_start);
+  }
+
+  if (cache_dir != NULL) {
+    devtools_ijar::ProcessJarWithCache(filename_out, filename_in, threads,
+                                       cache_dir, previous);
+  } else {
+    devtools_ijar::OpenFilesAndProcessJar(filename_out, filename_in, threads,
+                                          previous);
+  }
+  if (class_digests != NULL) {
+    devtools_ijar::WriteClassDigests(class_digests, filename_out);
+  }
+  if (class_summary != NULL) {
+    devtools_ijar::WriteClassSummary(class_summary, filename_out);
+  }
+  if (input_crcs != NULL) {
+    devtools_ijar::WriteInputCrcs(input_crcs, filename_in);
+  }
   return 0;
 }
+
+int main(int argc, char **argv) {
+#ifndef _WIN32
+  int exit_code;
+  if (blaze_worker::RunIfRequested(argc, argv, "ijar", IjarMain,
+                                   &exit_code)) {
+    return exit_code;
+  }
+#endif
+  return IjarMain(argc, argv);
+}
@@ -24,6 +24,10 @@
 
 #define MAX_ERROR 2048
 
+// Outputs this big are mapped with transparent huge pages where the system
+// lets programs ask for them.
+#define HUGE_PAGE_OUTPUT_SIZE (32 << 20)
+
 namespace devtools_ijar {
 
 static char errmsg[MAX_ERROR];
@@ -58,6 +62,12 @@ MappedInputFile::MappedInputFile(const char* name) {
     return;
   }
 
+  // The entries are read in order, from the start of the file to the end.
+  // Have the kernel read it in ahead of us rather than a page at a time. The
+  // whole file is not asked for (MADV_WILLNEED): the pages of the entries
+  // ijar drops are never read.
+  madvise(buffer, length, MADV_SEQUENTIAL);
+
   impl_ = new MappedInputFileImpl();
   impl_->fd_ = fd;
   impl_->discarded_ = 0;
@@ -116,6 +126,11 @@ MappedOutputFile::MappedOutputFile(const char* name, u8 estimated_size) {
     errmsg_ = errmsg;
     return;
   }
+#ifdef MADV_HUGEPAGE
+  if (estimated_size >= HUGE_PAGE_OUTPUT_SIZE) {
+    madvise(mapped, mmap_length, MADV_HUGEPAGE);
+  }
+#endif
 
   impl_ = new MappedOutputFileImpl();
   impl_->fd_ = fd;
@@ -0,0 +1,262 @@
+// Copyright 2017 The Bazel Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the throughput of ijar:
+//
+//   ijar_benchmark --ijar=<path> [--runs=N] [--scratch=<dir>]
+//       [--ijar_flags="<flags>"] <jar>...
+//
+// For every jar it runs "ijar <jar> <interface jar>" --runs times, and prints
+// the median wall time, the MB and the classes it reads per second at that
+// time, and the largest resident set and number of minor page faults of the
+// runs, which grow with the memory ijar allocates. The BUILD file runs it over
+// jars of different shapes: generics-heavy, annotation-heavy, with a lot of
+// classes, and with a huge class. Run it before and after a change to ijar.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using std::string;
+using std::vector;
+
+struct Options {
+  string ijar;
+  string scratch;
+  vector<string> ijar_flags;
+  vector<string> jars;
+  int runs = 10;
+};
+
+// The wall time and resource usage of one run.
+struct Run {
+  double wall_ms;
+  long max_rss_kb;
+  long minor_faults;
+};
+
+void Die(const char *format, const string &arg) {
+  fprintf(stderr, "ijar_benchmark: ");
+  fprintf(stderr, format, arg.c_str());
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+vector<string> Split(const string &s, char separator) {
+  vector<string> result;
+  std::istringstream stream(s);
+  string part;
+  while (std::getline(stream, part, separator)) {
+    if (!part.empty()) {
+      result.push_back(part);
+    }
+  }
+  return result;
+}
+
+string ReadFile(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    Die("cannot open %s", path);
+  }
+  string content;
+  char buf[65536];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n > 0) {
+      content.append(buf, n);
+    } else if (errno != EINTR) {
+      Die("cannot read %s", path);
+    }
+  }
+  close(fd);
+  return content;
+}
+
+uint32_t Get16(const string &data, size_t offset) {
+  return static_cast<uint8_t>(data[offset]) |
+         static_cast<uint8_t>(data[offset + 1]) << 8;
+}
+
+uint32_t Get32(const string &data, size_t offset) {
+  return Get16(data, offset) | Get16(data, offset + 2) << 16;
+}
+
+// Counts the .class entries in the central directory of the zip 'data'.
+int CountClasses(const string &path, const string &data) {
+  // The end of central directory record is at least 22 bytes, followed by a
+  // comment of up to 64k.
+  size_t end = string::npos;
+  if (data.size() >= 22) {
+    size_t lowest = data.size() > 22 + 65535 ? data.size() - 22 - 65535 : 0;
+    for (size_t i = data.size() - 22; end == string::npos; --i) {
+      if (Get32(data, i) == 0x06054b50) {
+        end = i;
+      } else if (i == lowest) {
+        break;
+      }
+    }
+  }
+  if (end == string::npos) {
+    Die("%s is not a zip file", path);
+  }
+  int entries = Get16(data, end + 10);
+  size_t offset = Get32(data, end + 16);
+  int classes = 0;
+  for (int i = 0; i < entries; ++i) {
+    if (offset + 46 > data.size() || Get32(data, offset) != 0x02014b50) {
+      Die("cannot read the central directory of %s", path);
+    }
+    size_t name_length = Get16(data, offset + 28);
+    string name = data.substr(offset + 46, name_length);
+    if (name.size() > 6 && name.compare(name.size() - 6, 6, ".class") == 0) {
+      ++classes;
+    }
+    offset += 46 + name_length + Get16(data, offset + 30) +
+              Get16(data, offset + 32);
+  }
+  return classes;
+}
+
+// Runs argv with the standard output and error discarded, and returns how
+// long it took and the resources it used.
+Run TimeProcess(const vector<string> &args) {
+  vector<const char *> argv;
+  for (const string &arg : args) {
+    argv.push_back(arg.c_str());
+  }
+  argv.push_back(NULL);
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t child = fork();
+  if (child == -1) {
+    Die("fork: %s", strerror(errno));
+  }
+  if (child == 0) {
+    int devnull = open("/dev/null", O_RDWR);
+    dup2(devnull, STDIN_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    execv(argv[0], const_cast<char **>(argv.data()));
+    _exit(127);
+  }
+  int status;
+  struct rusage usage;
+  while (wait4(child, &status, 0, &usage) == -1) {
+    if (errno != EINTR) {
+      Die("wait4: %s", strerror(errno));
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    Die("%s failed", args[0]);
+  }
+  Run run;
+  run.wall_ms = std::chrono::duration<double, std::milli>(end - start).count();
+  run.max_rss_kb = usage.ru_maxrss;
+  run.minor_faults = usage.ru_minflt;
+  return run;
+}
+
+void Report(const string &jar, size_t bytes, int classes,
+            const vector<Run> &runs) {
+  vector<double> wall;
+  long max_rss_kb = 0;
+  long minor_faults = 0;
+  for (const Run &run : runs) {
+    wall.push_back(run.wall_ms);
+    max_rss_kb = std::max(max_rss_kb, run.max_rss_kb);
+    minor_faults = std::max(minor_faults, run.minor_faults);
+  }
+  std::sort(wall.begin(), wall.end());
+  double p50_ms = wall[(wall.size() - 1) / 2];
+  double mb = bytes / (1024.0 * 1024.0);
+  string name = jar.substr(jar.rfind('/') + 1);
+  printf("%-40s %8.2f %8d %9.1f %9.1f %10.0f %9ld %9ld\n", name.c_str(), mb,
+         classes, p50_ms, mb * 1000 / p50_ms, classes * 1000 / p50_ms,
+         max_rss_kb / 1024, minor_faults);
+}
+
+bool Flag(const string &arg, const string &name, string *value) {
+  string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  *value = arg.substr(prefix.size());
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  const char *tmp_dir = getenv("TEST_TMPDIR");
+  options.scratch = tmp_dir != NULL ? tmp_dir : "/tmp";
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (Flag(argv[i], "ijar", &options.ijar)) {
+    } else if (Flag(argv[i], "scratch", &options.scratch)) {
+    } else if (Flag(argv[i], "runs", &value)) {
+      options.runs = atoi(value.c_str());
+    } else if (Flag(argv[i], "ijar_flags", &value)) {
+      options.ijar_flags = Split(value, ' ');
+    } else if (strncmp(argv[i], "--", 2) == 0) {
+      Die("unknown argument %s", argv[i]);
+    } else {
+      options.jars.push_back(argv[i]);
+    }
+  }
+  if (options.ijar.empty() || options.jars.empty() || options.runs < 1) {
+    Die("usage: %s --ijar=<path> [--runs=N] ... <jar>...", argv[0]);
+  }
+
+  string interface_jar =
+      options.scratch + "/ijar_benchmark." + std::to_string(getpid()) + ".jar";
+  printf("%-40s %8s %8s %9s %9s %10s %9s %9s\n", "", "MB", "classes",
+         "p50 ms", "MB/s", "classes/s", "RSS MB", "minflt");
+  for (const string &jar : options.jars) {
+    string data = ReadFile(jar);
+    int classes = CountClasses(jar, data);
+    vector<string> args = {options.ijar};
+    args.insert(args.end(), options.ijar_flags.begin(),
+                options.ijar_flags.end());
+    args.push_back(jar);
+    args.push_back(interface_jar);
+    // Warm up the page cache.
+    TimeProcess(args);
+    vector<Run> runs;
+    for (int i = 0; i < options.runs; ++i) {
+      runs.push_back(TimeProcess(args));
+    }
+    Report(jar, data.size(), classes, runs);
+  }
+  unlink(interface_jar.c_str());
+  return 0;
+}
@@ -136,6 +136,24 @@ function test_output_bigger_than_input() {
   [[ $W_INTERFACE_JAR_SIZE -gt $W_JAR_SIZE ]] || fail "interface jar should be bigger"
 }
 
+function test_compress_threshold() {
+  # Tests that the classes are only deflated with --compress_threshold
+  $JAVAC -g -d $TEST_TMPDIR/classes \
+    $IJAR_SRCDIR/test/WellCompressed*.java ||
+    fail "javac failed"
+  $JAR cf $W_JAR -C $TEST_TMPDIR/classes . || fail "jar failed"
+
+  W_INTERFACE_JAR=$TEST_TMPDIR/W-interface.jar
+  W_COMPRESSED_JAR=$TEST_TMPDIR/W-compressed.jar
+  $IJAR $W_JAR $W_INTERFACE_JAR || fail "ijar failed"
+  $IJAR --compress_threshold 1 $W_JAR $W_COMPRESSED_JAR ||
+    fail "ijar --compress_threshold failed"
+  [[ $(statfmt $W_COMPRESSED_JAR) -lt $(statfmt $W_INTERFACE_JAR) ]] ||
+    fail "compressed interface jar should be smaller"
+  $JAR tf $W_COMPRESSED_JAR > $TEST_LOG || fail "jar tf failed"
+  expect_log "WellCompressed1.class"
+}
+
 function test_class_more_64k() {
   # Tests that ijar can handle class bodies longer than 64K
   # First, generate the input file
@@ -254,6 +272,281 @@ function test_ijar_output() {
     fail "ijars from jar and zip are different"
 }
 
+function test_parallel_output() {
+  # Check that stripping the classes on several threads gives the same
+  # interface jar as stripping them serially.
+  $IJAR $LANGTOOLS8 $TEST_TMPDIR/langtools_interface.jar ||
+    fail "ijar failed"
+  $IJAR -j 4 $LANGTOOLS8 $TEST_TMPDIR/langtools_parallel_interface.jar ||
+    fail "ijar -j 4 failed"
+  cmp $TEST_TMPDIR/langtools_interface.jar \
+    $TEST_TMPDIR/langtools_parallel_interface.jar || \
+    fail "ijars from serial and parallel runs are different"
+}
+
+function test_concurrent_output() {
+  # Check that concurrent runs writing the same interface jar do not write
+  # into each other's temporary file.
+  $IJAR $LANGTOOLS8 $TEST_TMPDIR/langtools_interface.jar ||
+    fail "ijar failed"
+  mkdir -p $TEST_TMPDIR/concurrent
+  for i in 1 2 3 4; do
+    $IJAR $LANGTOOLS8 $TEST_TMPDIR/concurrent/interface.jar &
+  done
+  wait
+  [ $(ls $TEST_TMPDIR/concurrent | wc -l) -eq 1 ] ||
+    fail "temporary files were left next to the output"
+  cmp $TEST_TMPDIR/langtools_interface.jar \
+    $TEST_TMPDIR/concurrent/interface.jar ||
+    fail "concurrent runs produced a different interface jar"
+}
+
+function test_preamble() {
+  # Check that the entries are found through the central directory when
+  # the jar has a preamble its offsets do not account for.
+  $IJAR $LANGTOOLS8 $TEST_TMPDIR/langtools_interface.jar ||
+    fail "ijar failed"
+  { echo '#!/bin/sh'; echo 'exit 0'; cat $LANGTOOLS8; } \
+    > $TEST_TMPDIR/preamble.jar
+  $IJAR $TEST_TMPDIR/preamble.jar $TEST_TMPDIR/preamble_interface.jar ||
+    fail "ijar failed on a jar with a preamble"
+  cmp $TEST_TMPDIR/langtools_interface.jar \
+    $TEST_TMPDIR/preamble_interface.jar ||
+    fail "the preamble changed the interface jar"
+}
+
+function test_cache() {
+  # Check that the interface jar found in the cache is the one ijar makes,
+  # and that overwriting an output does not touch the cache.
+  CACHE_DIR=$TEST_TMPDIR/ijar_cache
+  mkdir -p $CACHE_DIR
+  $IJAR $LANGTOOLS8 $TEST_TMPDIR/langtools_interface.jar ||
+    fail "ijar failed"
+  $IJAR -c $CACHE_DIR $LANGTOOLS8 $TEST_TMPDIR/langtools_miss.jar ||
+    fail "ijar -c failed"
+  $IJAR -c $CACHE_DIR $LANGTOOLS8 $TEST_TMPDIR/langtools_hit.jar ||
+    fail "ijar -c failed"
+  [ $(ls $CACHE_DIR | wc -l) -eq 1 ] || fail "expected one cache entry"
+  ls -l $CACHE_DIR | grep -q '^-r--r--r--' ||
+    fail "the cache entry is not read-only"
+  cmp $TEST_TMPDIR/langtools_interface.jar $TEST_TMPDIR/langtools_miss.jar ||
+    fail "ijar with an empty cache produced a different interface jar"
+  cmp $TEST_TMPDIR/langtools_interface.jar $TEST_TMPDIR/langtools_hit.jar ||
+    fail "ijar with a cache hit produced a different interface jar"
+  touch $TEST_TMPDIR/empty
+  $ZIP $TEST_TMPDIR/other.jar $TEST_TMPDIR/empty >/dev/null 2>&1
+  $IJAR $TEST_TMPDIR/other.jar $TEST_TMPDIR/langtools_hit.jar ||
+    fail "ijar failed"
+  cmp $TEST_TMPDIR/langtools_interface.jar $CACHE_DIR/* ||
+    fail "overwriting an output changed the cache entry"
+}
+
+function test_batch() {
+  # Check that a batch makes the same interface jars as separate runs.
+  $IJAR $LANGTOOLS8 $TEST_TMPDIR/langtools_interface.jar ||
+    fail "ijar failed"
+  for i in 1 2 3; do
+    echo $LANGTOOLS8
+    echo $TEST_TMPDIR/langtools_batch$i.jar
+  done > $TEST_TMPDIR/batch
+  $IJAR -j 2 -b $TEST_TMPDIR/batch || fail "ijar -b failed"
+  for i in 1 2 3; do
+    cmp $TEST_TMPDIR/langtools_interface.jar \
+      $TEST_TMPDIR/langtools_batch$i.jar ||
+      fail "ijar -b produced a different interface jar"
+  done
+  echo $LANGTOOLS8 > $TEST_TMPDIR/batch
+  $IJAR -b $TEST_TMPDIR/batch && fail "expected ijar -b to fail"
+  return 0
+}
+
+function test_previous_jar() {
+  # Check that the classes copied from the previous interface jar give the
+  # same interface jar as stripping them again, and that a changed class
+  # is stripped again.
+  mkdir -p $TEST_TMPDIR/previous
+  $IJAR $LANGTOOLS8 $TEST_TMPDIR/langtools_interface.jar ||
+    fail "ijar failed"
+  $IJAR --input_crcs $TEST_TMPDIR/previous/crcs.txt $LANGTOOLS8 \
+    $TEST_TMPDIR/previous/interface.jar || fail "ijar --input_crcs failed"
+  for threads in 1 4; do
+    $IJAR -v -j $threads --previous $TEST_TMPDIR/previous/interface.jar \
+      $TEST_TMPDIR/previous/crcs.txt $LANGTOOLS8 \
+      $TEST_TMPDIR/previous/reused.jar 2> $TEST_TMPDIR/previous/log ||
+      fail "ijar --previous failed"
+    cmp $TEST_TMPDIR/langtools_interface.jar \
+      $TEST_TMPDIR/previous/reused.jar ||
+      fail "ijar --previous produced a different interface jar"
+    grep -q "^INFO: reused .*\.class$" $TEST_TMPDIR/previous/log ||
+      fail "expected classes to be reused"
+  done
+
+  for body in 'return 1;' 'return 2;} public void m() {'; do
+    echo "public class D { private int f() { $body } }" \
+      > $TEST_TMPDIR/previous/D.java
+    $JAVAC -d $TEST_TMPDIR/previous/classes $TEST_TMPDIR/previous/D.java ||
+      fail "javac failed"
+    $JAR cf $TEST_TMPDIR/previous/D.jar \
+      -C $TEST_TMPDIR/previous/classes D.class || fail "jar failed"
+    $IJAR -v --input_crcs $TEST_TMPDIR/previous/D-crcs.txt \
+      --previous $TEST_TMPDIR/previous/D-interface.jar \
+      $TEST_TMPDIR/previous/D-crcs.txt $TEST_TMPDIR/previous/D.jar \
+      $TEST_TMPDIR/previous/D-interface.jar 2> $TEST_TMPDIR/previous/log ||
+      fail "ijar --previous failed"
+    grep -q "^INFO: StripClass: D.class$" $TEST_TMPDIR/previous/log ||
+      fail "expected the changed class to be stripped"
+  done
+  $JAVAP -classpath $TEST_TMPDIR/previous/D-interface.jar D | grep -q "m()" ||
+    fail "expected the interface of the changed class"
+}
+
+function test_class_digests() {
+  # Check that the digest of a class only changes with its interface.
+  mkdir -p $TEST_TMPDIR/digests
+  for body in 'return 1;' 'return 2;' 'return 2;} public void m() {'; do
+    echo "public class D { private int f() { $body } }" \
+      > $TEST_TMPDIR/digests/D.java
+    $JAVAC -d $TEST_TMPDIR/classes $TEST_TMPDIR/digests/D.java ||
+      fail "javac failed"
+    $JAR cf $TEST_TMPDIR/digests/D.jar -C $TEST_TMPDIR/classes D.class ||
+      fail "jar failed"
+    $IJAR -d $TEST_TMPDIR/digests/digests.txt $TEST_TMPDIR/digests/D.jar \
+      $TEST_TMPDIR/digests/D-interface.jar || fail "ijar failed"
+    cat $TEST_TMPDIR/digests/digests.txt >> $TEST_TMPDIR/digests/all.txt
+  done
+  [ $(grep -c ' D.class$' $TEST_TMPDIR/digests/all.txt) -eq 3 ] ||
+    fail "expected a digest of D.class in each run"
+  [ $(sort -u $TEST_TMPDIR/digests/all.txt | wc -l) -eq 2 ] ||
+    fail "expected only the interface change to change the digest"
+}
+
+function test_class_summary() {
+  # Check that the summary lists the classes of the interface, and only the
+  # classes the interface refers to.
+  mkdir -p $TEST_TMPDIR/summary
+  cat > $TEST_TMPDIR/summary/C.java <<EOF
+import java.util.List;
+import java.util.Map;
+public class C<T extends Comparable<T>> implements Runnable {
+  public List<Map<String, T>> f;
+  public Integer[] g(java.io.File file) { return null; }
+  public void run() { new StringBuilder(); }
+}
+EOF
+  $JAVAC -d $TEST_TMPDIR/summary/classes $TEST_TMPDIR/summary/C.java ||
+    fail "javac failed"
+  $JAR cf $TEST_TMPDIR/summary/C.jar -C $TEST_TMPDIR/summary/classes C.class ||
+    fail "jar failed"
+  $IJAR --class_summary $TEST_TMPDIR/summary/summary.txt \
+    $TEST_TMPDIR/summary/C.jar $TEST_TMPDIR/summary/C-interface.jar ||
+    fail "ijar --class_summary failed"
+  [ "$(cat $TEST_TMPDIR/summary/summary.txt)" = "C java/io/File \
+java/lang/Comparable java/lang/Integer java/lang/Object java/lang/Runnable \
+java/lang/String java/util/List java/util/Map" ] ||
+    fail "unexpected summary: $(cat $TEST_TMPDIR/summary/summary.txt)"
+}
+
+function test_sort_members() {
+  # Check that with -s, the order of the members in the source does not
+  # change the interface class.
+  mkdir -p $TEST_TMPDIR/sorted
+  for members in 'int a; public void m() {} public int b;' \
+      'public int b; public void m() {} int a;'; do
+    echo "public class S { $members }" > $TEST_TMPDIR/sorted/S.java
+    $JAVAC -d $TEST_TMPDIR/sorted_classes $TEST_TMPDIR/sorted/S.java ||
+      fail "javac failed"
+    $JAR cf $TEST_TMPDIR/sorted/S.jar -C $TEST_TMPDIR/sorted_classes S.class ||
+      fail "jar failed"
+    $IJAR -d $TEST_TMPDIR/sorted/digests.txt $TEST_TMPDIR/sorted/S.jar \
+      $TEST_TMPDIR/sorted/S-interface.jar || fail "ijar failed"
+    cat $TEST_TMPDIR/sorted/digests.txt >> $TEST_TMPDIR/sorted/unsorted.txt
+    $IJAR -s -d $TEST_TMPDIR/sorted/digests.txt $TEST_TMPDIR/sorted/S.jar \
+      $TEST_TMPDIR/sorted/S-interface.jar || fail "ijar -s failed"
+    cat $TEST_TMPDIR/sorted/digests.txt >> $TEST_TMPDIR/sorted/sorted.txt
+  done
+  [ $(sort -u $TEST_TMPDIR/sorted/unsorted.txt | wc -l) -eq 2 ] ||
+    fail "expected the member order to change the digest"
+  [ $(sort -u $TEST_TMPDIR/sorted/sorted.txt | wc -l) -eq 1 ] ||
+    fail "expected the member order not to change the digest with -s"
+}
+
+function test_strip_private_nested() {
+  # Check that with -p, only the private nested classes that the interface
+  # refers to are kept, and that clients still compile against it.
+  mkdir -p $TEST_TMPDIR/nested/classes
+  cat > $TEST_TMPDIR/nested/N.java <<EOF
+public class N {
+  private static class Unused {}
+  private static class Base { public void m() {} }
+  public static class Sub extends Base {}
+  private static class Returned {}
+  public Returned returned() { return null; }
+}
+EOF
+  echo 'class U { void f() { new N.Sub().m(); } }' > $TEST_TMPDIR/nested/U.java
+  $JAVAC -d $TEST_TMPDIR/nested/classes $TEST_TMPDIR/nested/N.java ||
+    fail "javac failed"
+  $JAR cf $TEST_TMPDIR/nested/N.jar -C $TEST_TMPDIR/nested/classes . ||
+    fail "jar failed"
+  $IJAR $TEST_TMPDIR/nested/N.jar $TEST_TMPDIR/nested/N-interface.jar ||
+    fail "ijar failed"
+  $JAR tf $TEST_TMPDIR/nested/N-interface.jar > $TEST_LOG
+  expect_log 'N\$Unused.class' "private nested class dropped without -p"
+  $IJAR -p $TEST_TMPDIR/nested/N.jar $TEST_TMPDIR/nested/N-interface.jar ||
+    fail "ijar -p failed"
+  $JAR tf $TEST_TMPDIR/nested/N-interface.jar > $TEST_LOG
+  expect_not_log 'N\$Unused.class' "unreferenced private nested class kept"
+  expect_log 'N\$Base.class' "private superclass of a nested class dropped"
+  expect_log 'N\$Returned.class' "private nested return type dropped"
+  $JAVAC -cp $TEST_TMPDIR/nested/N-interface.jar \
+    -d $TEST_TMPDIR/nested $TEST_TMPDIR/nested/U.java ||
+    fail "javac failed against the interface jar"
+}
+
+# Prints a varint.
+function varint() {
+  local n=$1
+  while (( n >= 128 )); do
+    printf "\\x$(printf %02x $(( (n & 127) | 128 )))"
+    n=$(( n >> 7 ))
+  done
+  printf "\\x$(printf %02x $n)"
+}
+
+# Prints a length-delimited WorkRequest with the given arguments.
+function work_request() {
+  local LC_ALL=C
+  local message="" arg
+  for arg in "$@"; do
+    message+=$(printf '\x0a'; varint ${#arg}; printf '%s' "$arg")
+  done
+  varint ${#message}
+  printf '%s' "$message"
+}
+
+function test_persistent_worker() {
+  # Check that the worker serves several requests, and survives a failed one.
+  $IJAR $LANGTOOLS8 $TEST_TMPDIR/langtools_interface.jar ||
+    fail "ijar failed"
+  { work_request $LANGTOOLS8 $TEST_TMPDIR/worker1.jar
+    work_request $TEST_TMPDIR/nonexistent.jar $TEST_TMPDIR/worker2.jar
+    work_request $LANGTOOLS8 $TEST_TMPDIR/worker3.jar
+  } | $IJAR --persistent_worker > $TEST_TMPDIR/responses ||
+    fail "ijar --persistent_worker failed"
+  cmp $TEST_TMPDIR/langtools_interface.jar $TEST_TMPDIR/worker1.jar ||
+    fail "the first request produced a different interface jar"
+  cmp $TEST_TMPDIR/langtools_interface.jar $TEST_TMPDIR/worker3.jar ||
+    fail "the last request produced a different interface jar"
+  # The successful requests have empty responses, the failed one has an
+  # exit code and the error message.
+  [ $(head -c 1 $TEST_TMPDIR/responses | od -An -tx1) == 00 ] ||
+    fail "unexpected first response"
+  grep -q "nonexistent.jar" $TEST_TMPDIR/responses ||
+    fail "the error is missing from the responses"
+  [ $(tail -c 1 $TEST_TMPDIR/responses | od -An -tx1) == 00 ] ||
+    fail "unexpected last response"
+}
+
 function do_test_large_file() {
   # Compiles A.java, builds A.jar and A-interface.jar
   $JAVAC -g -d $TEST_TMPDIR/classes $IJAR_SRCDIR/test/A.java ||
@@ -168,4 +168,61 @@ function test_zipper_specify_path() {
       || fail "Unzip after zipper output is not expected"
 }
 
+function test_zipper_parallel() {
+  mkdir -p ${TEST_TMPDIR}/test/path/to/some
+  mkdir -p ${TEST_TMPDIR}/test/some/other/path
+  touch ${TEST_TMPDIR}/test/path/to/some/empty_file
+  echo "toto" > ${TEST_TMPDIR}/test/path/to/some/file
+  echo "titi" > ${TEST_TMPDIR}/test/path/to/some/other_file
+  chmod +x ${TEST_TMPDIR}/test/path/to/some/other_file
+  seq 1 10000 > ${TEST_TMPDIR}/test/file
+  filelist="$(cd ${TEST_TMPDIR}/test && find . | sed 's|^./||' | grep -v '^.$')"
+
+  (cd ${TEST_TMPDIR}/test && $ZIPPER cC ${TEST_TMPDIR}/serial.zip ${filelist})
+  (cd ${TEST_TMPDIR}/test && \
+      $ZIPPER cC ${TEST_TMPDIR}/parallel.zip -j 4 ${filelist})
+  cmp ${TEST_TMPDIR}/serial.zip ${TEST_TMPDIR}/parallel.zip \
+      || fail "Parallel zipper output differs from the serial one"
+  assert_unzip_same_as_zipper ${TEST_TMPDIR}/parallel.zip
+}
+
+function test_zipper_parallel_extract() {
+  mkdir -p ${TEST_TMPDIR}/test/path/to/some
+  mkdir -p ${TEST_TMPDIR}/test/some/other/path
+  touch ${TEST_TMPDIR}/test/path/to/some/empty_file
+  echo "toto" > ${TEST_TMPDIR}/test/path/to/some/file
+  echo "titi" > ${TEST_TMPDIR}/test/path/to/some/other_file
+  chmod +x ${TEST_TMPDIR}/test/path/to/some/other_file
+  seq 1 10000 > ${TEST_TMPDIR}/test/file
+  filelist="$(cd ${TEST_TMPDIR}/test && find . | sed 's|^./||' | grep -v '^.$')"
+  (cd ${TEST_TMPDIR}/test && $ZIPPER cC ${TEST_TMPDIR}/output.zip ${filelist})
+
+  local folder1=$(mktemp -d ${TEST_TMPDIR}/output.XXXXXXXX)
+  local folder2=$(mktemp -d ${TEST_TMPDIR}/output.XXXXXXXX)
+  (cd $folder1 && $ZIPPER x ${TEST_TMPDIR}/output.zip -d out)
+  (cd $folder2 && $ZIPPER x ${TEST_TMPDIR}/output.zip -j 4 -d out)
+  diff -r ${TEST_TMPDIR}/test $folder2/out &> $TEST_log \
+      || fail "Parallel zipper extraction differs from the input"
+  [[ "$(cd $folder1 && find . -printf '%m %p\n' | sort)" \
+      == "$(cd $folder2 && find . -printf '%m %p\n' | sort)" ]] \
+      || fail "Parallel zipper extraction differs from the serial one"
+}
+
+function test_zipper_extract_stored_with_preamble() {
+  mkdir -p ${TEST_TMPDIR}/stored/path/to/some
+  seq 1 10000 > ${TEST_TMPDIR}/stored/path/to/some/file
+  echo "tata" > ${TEST_TMPDIR}/stored/file
+  (cd ${TEST_TMPDIR}/stored && \
+      $ZIPPER c ${TEST_TMPDIR}/output.zip path/to/some/file file)
+  # Stored files are copied from the zip file at their actual offset.
+  echo "abcdefghi" >${TEST_TMPDIR}/test.zip
+  cat ${TEST_TMPDIR}/output.zip >>${TEST_TMPDIR}/test.zip
+
+  rm -fr ${TEST_TMPDIR}/out
+  mkdir -p ${TEST_TMPDIR}/out
+  (cd ${TEST_TMPDIR}/out && $ZIPPER x ${TEST_TMPDIR}/test.zip)
+  diff -r ${TEST_TMPDIR}/stored ${TEST_TMPDIR}/out &> $TEST_log \
+      || fail "Unzip using zipper after zipper output differ"
+}
+
 run_suite "zipper tests"
@@ -31,7 +31,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
 #include <limits>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "third_party/ijar/mapped_file.h"
@@ -56,6 +65,12 @@
 // version to extract: 1.0 - default value from APPNOTE.TXT.
 // Output JAR files contain no extra ZIP features, so this is enough.
 #define ZIP_VERSION_TO_EXTRACT                10
+// version to extract: 4.5 - for the Zip64 records of outputs over 4GB.
+#define ZIP64_VERSION_TO_EXTRACT              45
+
+// Zip64 extended information extra field, with the local header offset only.
+#define ZIP64_EXTRA_FIELD_TAG                 0x0001
+#define ZIP64_EXTRA_FIELD_OFFSET_SIZE         12
 #define COMPRESSION_METHOD_STORED             0   // no compression
 #define COMPRESSION_METHOD_DEFLATED           8
 
@@ -68,9 +83,17 @@
   | GENERAL_PURPOSE_BIT_FLAG_COMPRESSION_SPEED)
 
 namespace devtools_ijar {
-// In the absence of ZIP64 support, zip files are limited to 4GB.
-// http://www.info-zip.org/FAQ.html#limits
-static const u8 kMaximumOutputSize = std::numeric_limits<uint32_t>::max();
+// Outputs estimated to be larger than this are not mapped into memory as a
+// whole, but written out entry by entry (see OutputZipFile::Open()).
+static const u8 kMaximumMappedOutputSize = 256 * 1024 * 1024;
+
+// The size of the largest entry the streaming OutputZipFile accepts, which
+// is the largest one whose sizes fit in the headers without Zip64 fields.
+static const u8 kMaximumEntrySize = std::numeric_limits<uint32_t>::max();
+
+// How much output the streaming OutputZipFile buffers while writing the
+// central directory.
+static const size_t kOutputFlushSize = 1024 * 1024;
 
 //
 // A class representing a ZipFile for reading. Its public API is exposed
@@ -90,13 +113,24 @@ class InputZipFile : public ZipExtractor {
 
   bool Open();
   virtual bool ProcessNext();
+  virtual bool ProcessNextStored();
   virtual void Reset();
   virtual size_t GetSize() {
     return input_file_->Length();
   }
 
+  virtual bool GetOffset(const u1* data, u8* offset) {
+    if (data < zipdata_in_ || data >= zipdata_in_ + input_file_->Length()) {
+      return false;
+    }
+    *offset = data - zipdata_in_;
+    return true;
+  }
+
   virtual u8 CalculateOutputLength();
 
+  virtual u4 GetCrc32() { return crc32_; }
+
   virtual bool ProcessCentralDirEntry(const u1 *&p, size_t *compressed_size,
                                       size_t *uncompressed_size, char *filename,
                                       size_t filename_size, u4 *attr,
@@ -120,6 +154,14 @@ class InputZipFile : public ZipExtractor {
 
   const u1* central_dir_current_;  // central dir input cursor
 
+  // Whether the accepted files go to ProcessStored() and the mapping should
+  // be kept (see ProcessNextStored()).
+  bool process_stored_;
+
+  // Whether entries were skipped since p was last positioned, so that it
+  // has to be set from the central directory for the next entry.
+  bool skipped_entries_;
+
   // Buffer size is initially INITIAL_BUFFER_SIZE. It doubles in size every
   // time it is found too small, until it reaches MAX_BUFFER_SIZE. If that is
   // not enough, we bail out. We only decompress class files, so they should
@@ -154,6 +196,8 @@ class InputZipFile : public ZipExtractor {
   char filename[PATH_MAX];
   // The external file attribute field
   u4 attr;
+  // The CRC32 of the last entry read from the central directory.
+  u4 crc32_;
 
   // last error
   char errmsg[4*PATH_MAX];
@@ -182,8 +226,10 @@ class InputZipFile : public ZipExtractor {
     return 0;
   }
 
-  // Read one entry from input zip file
-  int ProcessLocalFileEntry(size_t compressed_size, size_t uncompressed_size);
+  // Read one entry from input zip file, "accept" tells whether to process
+  // or to skip it.
+  int ProcessLocalFileEntry(size_t compressed_size, size_t uncompressed_size,
+                            bool accept);
 
   // Uncompress a file from the archive using zlib. The pointer returned
   // is owned by InputZipFile, so it must not be freed. Advances the input
@@ -204,9 +250,12 @@ class OutputZipFile : public ZipBuilder {
  public:
   OutputZipFile(const char* filename, u8 estimated_size) :
       output_file_(NULL),
+      stream_(NULL),
+      flushed_size_(0),
       filename_(filename),
       estimated_size_(estimated_size),
-      finished_(false) {
+      finished_(false),
+      digested_(NULL) {
     errmsg[0] = 0;
   }
 
@@ -221,20 +270,25 @@ class OutputZipFile : public ZipBuilder {
   virtual u1* NewFile(const char* filename, const u4 attr);
   virtual int FinishFile(size_t filelength, bool compress = false,
                          bool compute_crc = false);
+  virtual int FinishCompressedFile(size_t filelength, size_t compressed_length,
+                                   u4 crc);
   virtual int WriteEmptyFile(const char *filename);
   virtual size_t GetSize() {
-    return Offset(q);
+    return static_cast<size_t>(Offset(q));
   }
   virtual int GetNumberFiles() {
     return entries_.size();
   }
+  virtual void SetOutputDigest(blaze_util::OutputDigest* digest) {
+    digest_.reset(digest);
+  }
   virtual int Finish();
   bool Open();
 
  private:
   struct LocalFileEntry {
-    // Start of the local header (in the output buffer).
-    size_t local_header_offset;
+    // Start of the local header (in the output file).
+    u8 local_header_offset;
 
     // Sizes of the file entry
     size_t uncompressed_length;
@@ -258,19 +312,32 @@ class OutputZipFile : public ZipBuilder {
     u2 extra_field_length;
   };
 
+  // The output is either mapped into memory as a whole (output_file_), or
+  // built an entry at a time in a buffer that is then appended to stream_.
   MappedOutputFile* output_file_;
+  FILE* stream_;
+  // The number of bytes written to stream_ so far.
+  u8 flushed_size_;
   const char* filename_;
+  // The file actually written; it is renamed to filename_ once complete,
+  // so that an existing output (which may be a hard link to a file
+  // elsewhere) is replaced rather than overwritten in place.
+  std::string temp_filename_;
   u8 estimated_size_;
   bool finished_;
 
   // OutputZipFile is responsible for maintaining the following
   // pointers. They are allocated by the Create() method before
   // the object is actually created using mmap.
-  u1 *zipdata_out_;        // start of output file mmap
+  u1 *zipdata_out_;        // start of output file mmap, or of the buffer
   u1 *q;  // output cursor
 
   u1 *header_ptr;  // Current pointer to "compression method" entry.
 
+  // The digest of the output up to digested_, with SetOutputDigest().
+  std::unique_ptr<blaze_util::OutputDigest> digest_;
+  u1 *digested_;
+
   // List of entries to write the central directory
   std::vector<LocalFileEntry*> entries_;
 
@@ -287,14 +354,19 @@ class OutputZipFile : public ZipBuilder {
 
   // Write the ZIP central directory structure for each local file
   // entry in "entries".
-  void WriteCentralDirectory();
+  int WriteCentralDirectory();
 
   // Returns the offset of the pointer relative to the start of the
   // output zip file.
-  size_t Offset(const u1 *const x) {
-    return x - zipdata_out_;
+  u8 Offset(const u1 *const x) {
+    return flushed_size_ + (x - zipdata_out_);
   }
 
+  // When streaming, appends the buffered output to the file and empties
+  // the buffer if it holds at least "min_size" bytes. Pointers into the
+  // buffer are invalid afterwards. Returns -1 on error.
+  int Flush(size_t min_size = 0);
+
   // Write ZIP file header in the output. Since the compressed size is not
   // known in advance, it must be recorded later. This method returns a pointer
   // to "compressed size" in the file header that should be passed to
@@ -303,10 +375,10 @@ class OutputZipFile : public ZipBuilder {
 
   // Fill in the "compressed size" and "uncompressed size" fields in a local
   // file header previously written by WriteLocalFileHeader().
-  size_t WriteFileSizeInLocalFileHeader(u1 *header_ptr,
-                                        size_t out_length,
-                                        bool compress = false,
-                                        const u4 crc = 0);
+  void WriteFileSizeInLocalFileHeader(u1 *header_ptr,
+                                      size_t out_length,
+                                      size_t compressed_size,
+                                      const u4 crc = 0);
 };
 
 //
@@ -322,9 +394,21 @@ bool InputZipFile::ProcessNext() {
     return false;
   }
 
-  // There might be an offset specified in the central directory that does
-  // not match the file offset, if so, correct the pointer.
-  if (offset != 0 && (p != (zipdata_in_ + in_offset_ + offset))) {
+  // The entries the processor does not want are skipped using their central
+  // directory entry alone, so that their pages are never read. Only an
+  // offset of zero is not trusted, as some tools write nothing else; such
+  // entries are skipped by walking their local header and data instead.
+  bool accept = processor->Accept(filename, attr);
+  if (!accept && offset != 0) {
+    skipped_entries_ = true;
+    return true;
+  }
+  if (skipped_entries_) {
+    p = zipdata_in_ + in_offset_ + offset;
+    skipped_entries_ = false;
+  } else if (offset != 0 && (p != (zipdata_in_ + in_offset_ + offset))) {
+    // There might be an offset specified in the central directory that does
+    // not match the file offset, if so, correct the pointer.
     p = zipdata_in_ + offset;
   }
 
@@ -333,7 +417,7 @@ bool InputZipFile::ProcessNext() {
   }
   u4 signature = get_u4le(p);
   if (signature == LOCAL_FILE_HEADER_SIGNATURE) {
-    if (ProcessLocalFileEntry(compressed, uncompressed) < 0) {
+    if (ProcessLocalFileEntry(compressed, uncompressed, accept) < 0) {
       return false;
     }
   } else {
@@ -345,7 +429,7 @@ bool InputZipFile::ProcessNext() {
 }
 
 int InputZipFile::ProcessLocalFileEntry(
-    size_t compressed_size, size_t uncompressed_size) {
+    size_t compressed_size, size_t uncompressed_size, bool accept) {
   if (EnsureRemaining(26, "extract_version") < 0) {
     return -1;
   }
@@ -406,7 +490,7 @@ int InputZipFile::ProcessLocalFileEntry(
     }
   }
 
-  if (processor->Accept(filename, attr)) {
+  if (accept) {
     if (ProcessFile(is_compressed) < 0) {
       return -1;
     }
@@ -430,7 +514,8 @@ int InputZipFile::ProcessLocalFileEntry(
   }
 
   size_t bytes_processed = p - zipdata_in_;
-  if (bytes_processed > bytes_unmapped_ + MAX_MAPPED_REGION) {
+  if (!process_stored_ &&
+      bytes_processed > bytes_unmapped_ + MAX_MAPPED_REGION) {
     input_file_->Discard(MAX_MAPPED_REGION);
     bytes_unmapped_ += MAX_MAPPED_REGION;
   }
@@ -477,6 +562,19 @@ u1* InputZipFile::UncompressFile() {
 
 int InputZipFile::ProcessFile(const bool compressed) {
   const u1 *file_data;
+  if (process_stored_) {
+    if (!compressed && compressed_size_ != uncompressed_size_) {
+      return error("compressed size != uncompressed size, although the file "
+                   "is uncompressed.\n");
+    }
+    if (EnsureRemaining(compressed_size_, "file_data") < 0) {
+      return -1;
+    }
+    processor->ProcessStored(filename, attr, p, compressed_size_,
+                             uncompressed_size_, compressed);
+    p += compressed_size_;
+    return 0;
+  }
   if (compressed) {
     file_data = UncompressFile();
     if (file_data == NULL) {
@@ -525,7 +623,8 @@ bool InputZipFile::ProcessCentralDirEntry(const u1 *&p, size_t *compressed_size,
     return false;
   }
 
-  p += 16;  // skip to 'compressed size' field
+  p += 12;  // skip to 'crc-32' field
+  crc32_ = get_u4le(p);
   *compressed_size = get_u4le(p);
   *uncompressed_size = get_u4le(p);
   u2 file_name_length = get_u2le(p);
@@ -776,10 +875,18 @@ bool FindZipCentralDirectory(const u1 *bytes, size_t in_length, u4 *offset,
 
 void InputZipFile::Reset() {
   central_dir_current_ = central_dir_;
+  skipped_entries_ = false;
   bytes_unmapped_ = 0;
   p = zipdata_in_ + in_offset_;
 }
 
+bool InputZipFile::ProcessNextStored() {
+  process_stored_ = true;
+  bool result = ProcessNext();
+  process_stored_ = false;
+  return result;
+}
+
 int ZipExtractor::ProcessAll() {
   while (ProcessNext()) {}
   if (GetError() != NULL) {
@@ -805,7 +912,8 @@ ZipExtractor* ZipExtractor::Create(const char* filename,
 InputZipFile::InputZipFile(ZipExtractorProcessor *processor,
                            const char* filename)
     : processor(processor), filename_(filename), input_file_(NULL),
-      bytes_unmapped_(0) {
+      bytes_unmapped_(0), process_stored_(false), skipped_entries_(false),
+      crc32_(0) {
   decompressor_ = new Decompressor();
   errmsg[0] = 0;
 }
@@ -888,18 +996,22 @@ int OutputZipFile::WriteEmptyFile(const char *filename) {
   entry->file_name = (u1*) strdup((const char *) file_name);
   entries_.push_back(entry);
 
-  return 0;
+  return Flush();
 }
 
-void OutputZipFile::WriteCentralDirectory() {
+int OutputZipFile::WriteCentralDirectory() {
   // central directory:
-  const u1 *central_directory_start = q;
+  u8 central_directory_offset = Offset(q);
   for (size_t ii = 0; ii < entries_.size(); ++ii) {
     LocalFileEntry *entry = entries_[ii];
+    // Past 4GB, the local header offset goes to a Zip64 extended
+    // information extra field.
+    bool zip64 = entry->local_header_offset > U4_MAX;
     put_u4le(q, CENTRAL_FILE_HEADER_SIGNATURE);
     put_u2le(q, 0);  // version made by
 
-    put_u2le(q, ZIP_VERSION_TO_EXTRACT);  // version to extract
+    // version to extract
+    put_u2le(q, zip64 ? ZIP64_VERSION_TO_EXTRACT : ZIP_VERSION_TO_EXTRACT);
     put_u2le(q, 0);  // general purpose bit flag
     put_u2le(q, entry->compression_method);  // compression method:
     put_u2le(q, 0);                          // last_mod_file_time
@@ -908,23 +1020,32 @@ void OutputZipFile::WriteCentralDirectory() {
     put_u4le(q, entry->compressed_length);    // compressed_size
     put_u4le(q, entry->uncompressed_length);  // uncompressed_size
     put_u2le(q, entry->file_name_length);
-    put_u2le(q, entry->extra_field_length);
+    put_u2le(q, entry->extra_field_length +
+                    (zip64 ? ZIP64_EXTRA_FIELD_OFFSET_SIZE : 0));
 
     put_u2le(q, 0);  // file comment length
     put_u2le(q, 0);  // disk number start
     put_u2le(q, 0);  // internal file attributes
     put_u4le(q, entry->external_attr);  // external file attributes
     // relative offset of local header:
-    put_u4le(q, entry->local_header_offset);
+    put_u4le(q, zip64 ? U4_MAX : entry->local_header_offset);
 
     put_n(q, entry->file_name, entry->file_name_length);
     put_n(q, entry->extra_field, entry->extra_field_length);
+    if (zip64) {
+      put_u2le(q, ZIP64_EXTRA_FIELD_TAG);
+      put_u2le(q, ZIP64_EXTRA_FIELD_OFFSET_SIZE - 4);
+      put_u8le(q, entry->local_header_offset);
+    }
+    if (Flush(kOutputFlushSize) < 0) {
+      return -1;
+    }
   }
-  u8 central_directory_size = q - central_directory_start;
+  u8 central_directory_size = Offset(q) - central_directory_offset;
 
   if (entries_.size() > U2_MAX || central_directory_size > U4_MAX ||
-      Offset(central_directory_start) > U4_MAX) {
-    u1 *zip64_end_of_central_directory_start = q;
+      central_directory_offset > U4_MAX) {
+    u8 zip64_end_of_central_directory_offset = Offset(q);
 
     put_u4le(q, ZIP64_EOCD_SIGNATURE);
     // signature and size field doesn't count towards size
@@ -937,13 +1058,13 @@ void OutputZipFile::WriteCentralDirectory() {
     put_u8le(q, entries_.size());  // total # entries in the central directory
     put_u8le(q, central_directory_size);  // size of the central directory
     // offset of start of central directory wrt starting disk
-    put_u8le(q, Offset(central_directory_start));
+    put_u8le(q, central_directory_offset);
 
     put_u4le(q, ZIP64_EOCD_LOCATOR_SIGNATURE);
     // number of the disk with the start of the zip64 end of central directory
     put_u4le(q, 0);
     // relative offset of the zip64 end of central directory record
-    put_u8le(q, Offset(zip64_end_of_central_directory_start));
+    put_u8le(q, zip64_end_of_central_directory_offset);
     // total number of disks
     put_u4le(q, 1);
 
@@ -958,9 +1079,8 @@ void OutputZipFile::WriteCentralDirectory() {
     put_u4le(q,
              central_directory_size > U4_MAX ? U4_MAX : central_directory_size);
     // offset of start of central
-    put_u4le(q, Offset(central_directory_start) > U4_MAX
-                    ? U4_MAX
-                    : Offset(central_directory_start));
+    put_u4le(q, central_directory_offset > U4_MAX ? U4_MAX
+                                                  : central_directory_offset);
     put_u2le(q, 0);  // .ZIP file comment length
 
   } else {
@@ -971,9 +1091,10 @@ void OutputZipFile::WriteCentralDirectory() {
     put_u2le(q, entries_.size());  // total # entries in the central directory
     put_u4le(q, central_directory_size);  // size of the central directory
     // offset of start of central directory wrt starting disk
-    put_u4le(q, Offset(central_directory_start));
+    put_u4le(q, central_directory_offset);
     put_u2le(q, 0);  // .ZIP file comment length
   }
+  return Flush();
 }
 
 u1* OutputZipFile::WriteLocalFileHeader(const char* filename, const u4 attr) {
@@ -1009,14 +1130,10 @@ u1* OutputZipFile::WriteLocalFileHeader(const char* filename, const u4 attr) {
   return header_ptr;
 }
 
-size_t OutputZipFile::WriteFileSizeInLocalFileHeader(u1 *header_ptr,
-                                                     size_t out_length,
-                                                     bool compress,
-                                                     const u4 crc) {
-  size_t compressed_size = out_length;
-  if (compress) {
-    compressed_size = TryDeflate(q, out_length);
-  }
+void OutputZipFile::WriteFileSizeInLocalFileHeader(u1 *header_ptr,
+                                                   size_t out_length,
+                                                   size_t compressed_size,
+                                                   const u4 crc) {
   // compression method
   if (compressed_size < out_length) {
     put_u2le(header_ptr, COMPRESSION_METHOD_DEFLATED);
@@ -1027,7 +1144,6 @@ size_t OutputZipFile::WriteFileSizeInLocalFileHeader(u1 *header_ptr,
   put_u4le(header_ptr, crc);              // crc32
   put_u4le(header_ptr, compressed_size);  // compressed_size
   put_u4le(header_ptr, out_length);       // uncompressed_size
-  return compressed_size;
 }
 
 int OutputZipFile::Finish() {
@@ -1036,12 +1152,34 @@ int OutputZipFile::Finish() {
   }
 
   finished_ = true;
-  WriteCentralDirectory();
-  if (output_file_->Close(GetSize()) < 0) {
-    return error("%s", output_file_->Error());
+  if (WriteCentralDirectory() < 0) {
+    return -1;
+  }
+  if (stream_ != NULL) {
+    free(zipdata_out_);
+    zipdata_out_ = NULL;
+    if (fclose(stream_) != 0) {
+      stream_ = NULL;
+      return error("fclose(): %s", strerror(errno));
+    }
+    stream_ = NULL;
+  } else {
+    if (output_file_->Close(GetSize()) < 0) {
+      return error("%s", output_file_->Error());
+    }
+    delete output_file_;
+    output_file_ = NULL;
+  }
+  // A file system without extended attributes just cannot keep the digest.
+  if (digest_ != NULL) {
+    digest_->Store(temp_filename_);
+  }
+#ifdef _WIN32
+  remove(filename_);
+#endif
+  if (rename(temp_filename_.c_str(), filename_) < 0) {
+    return error("rename(): %s", strerror(errno));
   }
-  delete output_file_;
-  output_file_ = NULL;
   return 0;
 }
 
@@ -1061,13 +1199,20 @@ int OutputZipFile::FinishFile(size_t filelength, bool compress,
       return -1;
     }
   }
-  size_t compressed_size =
-      WriteFileSizeInLocalFileHeader(header_ptr, filelength, compress, crc);
+  size_t compressed_size = filelength;
+  if (compress) {
+    compressed_size = TryDeflate(q, filelength);
+  }
+  return FinishCompressedFile(filelength, compressed_size, crc);
+}
 
+int OutputZipFile::FinishCompressedFile(size_t filelength,
+                                        size_t compressed_size, u4 crc) {
   if (compressed_size == 0 && filelength > 0) {
     fprintf(stderr, "Error compressing files.\n");
     return -1;
   }
+  WriteFileSizeInLocalFileHeader(header_ptr, filelength, compressed_size, crc);
 
   entries_.back()->crc32 = crc;
   entries_.back()->compressed_length = compressed_size;
@@ -1078,30 +1223,99 @@ int OutputZipFile::FinishFile(size_t filelength, bool compress,
     entries_.back()->compression_method = COMPRESSION_METHOD_STORED;
   }
   q += compressed_size;
+  return Flush();
+}
+
+int OutputZipFile::Flush(size_t min_size) {
+  // The output up to q is final: the sizes in the local header of the last
+  // entry are filled in. Digest it while it is still in the CPU cache.
+  if (digest_ != NULL) {
+    digest_->Update(digested_, q - digested_);
+    digested_ = q;
+  }
+  size_t size = q - zipdata_out_;
+  if (stream_ == NULL || size < min_size || size == 0) {
+    return 0;
+  }
+  if (fwrite(zipdata_out_, 1, size, stream_) != size) {
+    return error("fwrite(): %s", strerror(errno));
+  }
+  flushed_size_ += size;
+  q = zipdata_out_;
+  digested_ = q;
   return 0;
 }
 
+// Creates an empty file with a name of its own next to "filename", so that
+// it can be renamed over it and concurrent runs writing the same output do
+// not write into each other's file. Stores its name in "temp_filename".
+static bool CreateTempFile(const char* filename, std::string* temp_filename) {
+  *temp_filename = std::string(filename) + ".XXXXXX";
+#ifdef _WIN32
+  // Only picks the name, the file is created by the caller.
+  return _mktemp_s(&(*temp_filename)[0], temp_filename->size() + 1) == 0;
+#else
+  int fd = mkstemp(&(*temp_filename)[0]);
+  if (fd < 0) {
+    return false;
+  }
+  // mkstemp() creates the file with mode 0600.
+  bool ok = fchmod(fd, 0644) == 0;
+  close(fd);
+  if (!ok) {
+    remove(temp_filename->c_str());
+  }
+  return ok;
+#endif
+}
+
 bool OutputZipFile::Open() {
-  if (estimated_size_ > kMaximumOutputSize) {
-    fprintf(stderr,
-            "Uncompressed input jar has size %llu, "
-            "which exceeds the maximum supported output size %llu.\n"
-            "Assuming that ijar will be smaller and hoping for the best.\n",
-            estimated_size_, kMaximumOutputSize);
-    estimated_size_ = kMaximumOutputSize;
+  if (!CreateTempFile(filename_, &temp_filename_)) {
+    snprintf(errmsg, sizeof(errmsg),
+             "Cannot create a temporary file for %s: %s", filename_,
+             strerror(errno));
+    return false;
+  }
+  if (estimated_size_ > kMaximumMappedOutputSize) {
+    // Only one entry at a time is in memory, so the buffer only needs to
+    // hold the largest one (with its local header). As the buffer is only
+    // touched as far as the entries reach, this costs address space only.
+    size_t buffer_size = static_cast<size_t>(
+        std::min(estimated_size_, kMaximumEntrySize + 2 * PATH_MAX) +
+        kOutputFlushSize);
+    stream_ = fopen(temp_filename_.c_str(), "wb");
+    if (stream_ == NULL) {
+      snprintf(errmsg, sizeof(errmsg), "fopen(): %s", strerror(errno));
+      remove(temp_filename_.c_str());
+      return false;
+    }
+    zipdata_out_ = reinterpret_cast<u1*>(malloc(buffer_size));
+    if (zipdata_out_ == NULL) {
+      snprintf(errmsg, sizeof(errmsg),
+               "Cannot allocate %zu bytes of output buffer", buffer_size);
+      fclose(stream_);
+      stream_ = NULL;
+      remove(temp_filename_.c_str());
+      return false;
+    }
+    q = zipdata_out_;
+    digested_ = q;
+    return true;
   }
 
   MappedOutputFile* output_file = new MappedOutputFile(
-      filename_, estimated_size_);
+      temp_filename_.c_str(), estimated_size_);
   if (!output_file->Opened()) {
     snprintf(errmsg, sizeof(errmsg), "%s", output_file->Error());
     delete output_file;
+    remove(temp_filename_.c_str());
     return false;
   }
 
   output_file_ = output_file;
   q = output_file->Buffer();
   zipdata_out_ = output_file->Buffer();
+  digested_ = q;
   return true;
 }
 
@@ -1120,17 +1334,28 @@ u8 ZipBuilder::EstimateSize(char const* const* files,
                             char const* const* zip_paths,
                             int nb_entries) {
   struct stat statst;
-  // Digital signature field size = 6, End of central directory = 22, Total = 28
-  u8 size = 28;
-  // Count the size of all the files in the input to estimate the size of the
-  // output.
+  std::vector<const char*> paths(nb_entries);
+  std::vector<size_t> sizes(nb_entries);
   for (int i = 0; i < nb_entries; i++) {
     statst.st_size = 0;
     if (files[i] != NULL && stat(files[i], &statst) != 0) {
       fprintf(stderr, "File %s does not seem to exist.", files[i]);
       return 0;
     }
-    size += statst.st_size;
+    paths[i] = (zip_paths[i] != NULL) ? zip_paths[i] : files[i];
+    sizes[i] = statst.st_size;
+  }
+  return EstimateSize(paths.data(), sizes.data(), nb_entries);
+}
+
+u8 ZipBuilder::EstimateSize(char const* const* zip_paths, const size_t* sizes,
+                            int nb_entries) {
+  // Digital signature field size = 6, End of central directory = 22, Total = 28
+  u8 size = 28;
+  // Count the size of all the files in the input to estimate the size of the
+  // output.
+  for (int i = 0; i < nb_entries; i++) {
+    size += sizes[i];
     // Add sizes of Zip meta data
     // local file header = 30 bytes
     // data descriptor = 12 bytes
@@ -1139,7 +1364,7 @@ u8 ZipBuilder::EstimateSize(char const* const* files,
     size += 88;
     // The filename is stored twice (once in the central directory
     // and once in the local file header).
-    size += strlen((zip_paths[i] != NULL) ? zip_paths[i] : files[i]) * 2;
+    size += strlen(zip_paths[i]) * 2;
   }
   return size;
 }
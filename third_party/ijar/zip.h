@@ -22,6 +22,7 @@
 
 #include <sys/stat.h>
 
+#include "src/main/cpp/util/output_digest.h"
 #include "third_party/ijar/common.h"
 
 namespace devtools_ijar {
@@ -70,6 +71,15 @@ class ZipBuilder {
                          bool compress = false,
                          bool compute_crc = false) = 0;
 
+  // Like FinishFile(), but the data written to the buffer given by NewFile
+  // were already prepared, e.g. on another thread: they are the
+  // "compressed_length" bytes produced by TryDeflate() from "filelength"
+  // bytes (stored as is if compressed_length is not smaller than filelength)
+  // whose CRC32 is "crc".
+  // On failure, returns -1 and GetError() will return an non-empty message.
+  virtual int FinishCompressedFile(size_t filelength, size_t compressed_length,
+                                   u4 crc) = 0;
+
   // Write an empty file, it is equivalent to:
   //   NewFile(filename, 0);
   //   FinishFile(0);
@@ -93,6 +103,12 @@ class ZipBuilder {
   // Returns the current number of files stored in the ZIP.
   virtual int GetNumberFiles() = 0;
 
+  // Digests the ZIP file as it is written, an entry at a time, and stores
+  // the digest in an extended attribute of the file once Finish() has
+  // written it (see blaze_util::OutputDigest), so that Bazel need not read
+  // it again. Takes ownership of "digest". Call it before adding any file.
+  virtual void SetOutputDigest(blaze_util::OutputDigest* digest) = 0;
+
   // Create a new ZipBuilder writing the file zip_file and the size of the
   // output will be at most estimated_size. Use ZipBuilder::EstimateSize() or
   // ZipExtractor::CalculateOuputLength() to have an estimated_size depending on
@@ -105,6 +121,11 @@ class ZipBuilder {
   // Returns 0 on error.
   static u8 EstimateSize(char const* const* files, char const* const* zip_paths,
                          int nb_entries);
+
+  // Same as above, for files already stat'ed: the files stored at the
+  // "zip_paths" have the given "sizes".
+  static u8 EstimateSize(char const* const* zip_paths, const size_t* sizes,
+                         int nb_entries);
 };
 
 //
@@ -126,6 +147,15 @@ class ZipExtractorProcessor {
   // in the buffer pointed by "data".
   virtual void Process(const char* filename, const u4 attr,
                        const u1* data, const size_t size) = 0;
+
+  // Process a file accepted by Accept as it is stored in the ZIP, see
+  // ZipExtractor::ProcessNextStored(). The "compressed_size" bytes pointed
+  // by "data" are deflated if "compressed" is true and inflate to
+  // "uncompressed_size" bytes.
+  virtual void ProcessStored(const char* filename, const u4 attr,
+                             const u1* data, const size_t compressed_size,
+                             const size_t uncompressed_size,
+                             const bool compressed) {}
 };
 
 //
@@ -148,12 +178,24 @@ class ZipExtractor {
   // on error).
   virtual int ProcessAll();
 
+  // Same as ProcessNext(), but an accepted file is not decompressed: it is
+  // passed to the ProcessStored() method of the processor instead of
+  // Process(). The data remain valid while the ZipExtractor exists, so that
+  // they can be decompressed later and on any thread.
+  virtual bool ProcessNextStored() = 0;
+
   // Reset the file pointer to the beginning.
   virtual void Reset() = 0;
 
   // Return the size of the ZIP file.
   virtual size_t GetSize() = 0;
 
+  // Tells whether data given to the processor are in the ZIP file as they
+  // are (that is, the file is stored rather than deflated), and if so, sets
+  // "offset" to their offset in the ZIP file, so that they can be copied from
+  // it directly.
+  virtual bool GetOffset(const u1* data, u8* offset) = 0;
+
   // Return the size of the resulting zip file by keeping only file
   // accepted by the processor and storing them uncompressed. This
   // method can be used to create a ZipBuilder for storing a subset
@@ -161,6 +203,11 @@ class ZipExtractor {
   // On error, 0 is returned and GetError() returns a non-empty message.
   virtual u8 CalculateOutputLength() = 0;
 
+  // Returns the CRC32 of the uncompressed contents of the file last passed
+  // to the Accept() method of the processor, as the central directory
+  // records it.
+  virtual u4 GetCrc32() = 0;
+
   // Create a ZipExtractor that extract the zip file "filename" and process
   // it with "processor".
   // On error, a null pointer is returned and the value of errno should be
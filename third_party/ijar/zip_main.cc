@@ -28,11 +28,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <condition_variable>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "third_party/ijar/zip.h"
+#include "third_party/ijar/zlib_client.h"
+#include "src/main/cpp/util/trace_events.h"
+#ifndef _WIN32
+#include "src/tools/worker/worker.h"
+#endif
 
 namespace devtools_ijar {
 
@@ -54,7 +65,9 @@ class UnzipProcessor : public ZipExtractorProcessor {
   UnzipProcessor(const char *output_root, char **files, bool verbose,
                  bool extract) : output_root_(output_root),
                                  verbose_(verbose),
-                                 extract_(extract) {
+                                 extract_(extract),
+                                 extractor_(NULL),
+                                 input_fd_(-1) {
     if (files != NULL) {
       for (int i = 0; files[i] != NULL; i++) {
         file_names.insert(std::string(files[i]));
@@ -64,8 +77,20 @@ class UnzipProcessor : public ZipExtractorProcessor {
 
   virtual ~UnzipProcessor() {}
 
+  // Set the ZIP file being extracted, and a file descriptor to read it
+  // from, so that stored files can be copied from it without going through
+  // memory. It should be set before any call to the Process() method.
+  void SetInput(ZipExtractor* extractor, int fd) {
+    extractor_ = extractor;
+    input_fd_ = fd;
+  }
+
   virtual void Process(const char* filename, const u4 attr,
                        const u1* data, const size_t size);
+  virtual void ProcessStored(const char* filename, const u4 attr,
+                             const u1* data, const size_t compressed_size,
+                             const size_t uncompressed_size,
+                             const bool compressed);
   virtual bool Accept(const char* filename, const u4 attr) {
     // All entry files are accepted by default.
     if (file_names.empty()) {
@@ -76,11 +101,45 @@ class UnzipProcessor : public ZipExtractorProcessor {
     }
   }
 
+  // Creates the folders of the files collected by ProcessStored(), then
+  // inflates and writes the files on the given number of threads.
+  void ExtractStoredFiles(int threads);
+
  private:
+  // A file as stored in the zip file.
+  struct StoredFile {
+    std::string path;
+    mode_t perm;
+    const u1* data;
+    size_t compressed_size;
+    size_t uncompressed_size;
+    bool compressed;
+  };
+
+  // Computes the path of the entry "filename" in output_root_ into "path"
+  // (of size PATH_MAX), and its permissions. Prints the entry if verbose.
+  // Returns whether the entry is a directory.
+  bool PrepareEntry(const char* filename, const u4 attr, char* path,
+                    mode_t* perm);
+
+  // Writes the files from next_file_ until the end.
+  void ExtractWorker();
+
   const char *output_root_;
   const bool verbose_;
   const bool extract_;
   std::set<std::string> file_names;
+  // Not owned, see SetInput().
+  ZipExtractor* extractor_;
+  int input_fd_;
+
+  // Folders to create before extracting stored_files_, with the mode of the
+  // first entry in them (as mkdirs() would create them).
+  std::map<std::string, mode_t> folders_;
+  std::vector<StoredFile> stored_files_;
+  // Guards next_file_.
+  std::mutex mutex_;
+  size_t next_file_;
 };
 
 // Concatene 2 path, path1 and path2, using / as a directory separator and
@@ -126,8 +185,8 @@ void mkdirs(const char *path, mode_t mode) {
   }
 }
 
-void UnzipProcessor::Process(const char* filename, const u4 attr,
-                             const u1* data, const size_t size) {
+bool UnzipProcessor::PrepareEntry(const char* filename, const u4 attr,
+                                  char* path, mode_t* perm_ptr) {
   mode_t mode = zipattr_to_mode(attr);
   mode_t perm = mode & 0777;
   bool isdir = (mode & S_IFDIR) != 0;
@@ -139,24 +198,149 @@ void UnzipProcessor::Process(const char* filename, const u4 attr,
   if (verbose_) {
     printf("%c %o %s\n", isdir ? 'd' : 'f', perm, filename);
   }
+  concat_path(path, PATH_MAX, output_root_, filename);
+  *perm_ptr = perm;
+  return isdir;
+}
+
+// Write size bytes of data to the file at path, created with mode perm.
+// If in_fd is not negative, data are also found at in_offset of the file
+// in_fd, and they are copied from there by the kernel where it can, which
+// spares reading them into memory (and may even share the blocks on
+// filesystems that support it).
+void write_file(const char *path, mode_t perm, const u1 *data, size_t size,
+                int in_fd = -1, u8 in_offset = 0) {
+  int fd = open(path, O_CREAT | O_WRONLY, perm);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open file %s for writing: %s\n",
+            path, strerror(errno));
+    abort();
+  }
+  size_t copied = 0;
+#ifdef __linux__
+  if (in_fd >= 0) {
+    loff_t offset = in_offset;
+    while (copied < size) {
+      ssize_t n = copy_file_range(in_fd, &offset, fd, NULL, size - copied, 0);
+      if (n <= 0) {
+        // Not supported here (or failed): write the rest from memory.
+        break;
+      }
+      copied += n;
+    }
+  }
+#endif
+  if (copied < size) {
+    SYSCALL(write(fd, data + copied, size - copied));
+  }
+  SYSCALL(close(fd));
+}
+
+void UnzipProcessor::Process(const char* filename, const u4 attr,
+                             const u1* data, const size_t size) {
+  char path[PATH_MAX];
+  mode_t perm;
+  bool isdir = PrepareEntry(filename, attr, path, &perm);
   if (extract_) {
-    char path[PATH_MAX];
-    int fd;
-    concat_path(path, PATH_MAX, output_root_, filename);
     // Directories created must have executable bit set and be owner writeable.
     // Otherwise, we cannot write or create any file inside.
     mkdirs(path, perm | S_IWUSR | S_IXUSR);
-    if (!isdir) {
-      fd = open(path, O_CREAT | O_WRONLY, perm);
-      if (fd < 0) {
-        fprintf(stderr, "Cannot open file %s for writing: %s\n",
-                path, strerror(errno));
+    if (isdir) {
+      return;
+    }
+    u8 offset;
+    if (extractor_ != NULL && extractor_->GetOffset(data, &offset)) {
+      write_file(path, perm, data, size, input_fd_, offset);
+    } else {
+      write_file(path, perm, data, size);
+    }
+  }
+}
+
+void UnzipProcessor::ProcessStored(const char* filename, const u4 attr,
+                                   const u1* data,
+                                   const size_t compressed_size,
+                                   const size_t uncompressed_size,
+                                   const bool compressed) {
+  char path[PATH_MAX];
+  mode_t perm;
+  bool isdir = PrepareEntry(filename, attr, path, &perm);
+  if (!extract_) {
+    return;
+  }
+  // Record the folders mkdirs() would create, see Process().
+  for (char *pointer = path; (pointer = strchr(pointer, '/')) != NULL;
+       pointer++) {
+    if (pointer != path) {  // skip leading slash
+      folders_.insert(std::make_pair(std::string(path, pointer - path),
+                                     perm | S_IWUSR | S_IXUSR));
+    }
+  }
+  if (!isdir) {
+    StoredFile stored_file = {path, perm, data, compressed_size,
+                              uncompressed_size, compressed};
+    stored_files_.push_back(stored_file);
+  }
+}
+
+void UnzipProcessor::ExtractWorker() {
+  Decompressor decompressor;
+  for (;;) {
+    size_t index;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (next_file_ >= stored_files_.size()) {
+        return;
+      }
+      index = next_file_++;
+    }
+    const StoredFile &stored_file = stored_files_[index];
+    const u1 *data = stored_file.data;
+    size_t size = stored_file.uncompressed_size;
+    u8 offset;
+    if (!stored_file.compressed && extractor_ != NULL &&
+        extractor_->GetOffset(data, &offset)) {
+      write_file(stored_file.path.c_str(), stored_file.perm, data, size,
+                 input_fd_, offset);
+      continue;
+    }
+    if (stored_file.compressed) {
+      DecompressedFile *decompressed_file =
+          decompressor.UncompressFile(data, stored_file.compressed_size);
+      if (decompressed_file == NULL) {
+        fprintf(stderr, "Cannot decompress %s: %s\n",
+                stored_file.path.c_str(), decompressor.GetError());
         abort();
       }
-      SYSCALL(write(fd, data, size));
-      SYSCALL(close(fd));
+      data = decompressed_file->uncompressed_data;
+      size = decompressed_file->uncompressed_size;
+      free(decompressed_file);
+    }
+    write_file(stored_file.path.c_str(), stored_file.perm, data, size);
+  }
+}
+
+void UnzipProcessor::ExtractStoredFiles(int threads) {
+  // A folder sorts before the folders in it, so it is created first.
+  struct stat statst;
+  for (auto &folder : folders_) {
+    if (stat(folder.first.c_str(), &statst) != 0 &&
+        mkdir(folder.first.c_str(), folder.second) < 0) {
+      fprintf(stderr, "Cannot create folder %s: %s\n",
+              folder.first.c_str(), strerror(errno));
+      abort();
     }
   }
+  next_file_ = 0;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back(&UnzipProcessor::ExtractWorker, this);
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  folders_.clear();
+  stored_files_.clear();
 }
 
 // Get the basename of path and store it in output. output_size
@@ -189,9 +373,10 @@ int copy_file_to_buffer(int fd, size_t size, void *buffer) {
   return 0;
 }
 
-// Execute the extraction (or just listing if just v is provided)
+// Execute the extraction (or just listing if just v is provided). With more
+// than one thread, the files are inflated and written in parallel.
 int extract(char *zipfile, char* exdir, char **files, bool verbose,
-            bool extract) {
+            bool extract, int threads) {
   char cwd[PATH_MAX];
   if (getcwd(cwd, PATH_MAX) == NULL) {
     fprintf(stderr, "getcwd() failed: %s.\n", strerror(errno));
@@ -213,36 +398,120 @@ int extract(char *zipfile, char* exdir, char **files, bool verbose,
             strerror(errno));
     return -1;
   }
+  // Without it, the stored files are written out from memory.
+  int fd = open(zipfile, O_RDONLY);
+  processor.SetInput(extractor.get(), fd);
 
-  if (extractor->ProcessAll() < 0) {
+  blaze_util::TraceSpan span(extract ? "extract" : "list", zipfile);
+  int result = 0;
+  if (extract && threads > 1) {
+    while (extractor->ProcessNextStored()) {}
+    if (extractor->GetError() != NULL) {
+      fprintf(stderr, "%s.\n", extractor->GetError());
+      result = -1;
+    } else {
+      processor.ExtractStoredFiles(threads);
+    }
+  } else if (extractor->ProcessAll() < 0) {
     fprintf(stderr, "%s.\n", extractor->GetError());
-    return -1;
+    result = -1;
   }
-  return 0;
+  if (fd >= 0) {
+    close(fd);
+  }
+  return result;
 }
 
-// add a file to the zip
-int add_file(std::unique_ptr<ZipBuilder> const &builder, char *file,
-             char *zip_path, bool flatten, bool verbose, bool compress) {
-  struct stat statst;
-  statst.st_size = 0;
-  statst.st_mode = 0666;
+//
+// Resolves paths relative to the file descriptors of the folders they are
+// in, which are kept open for the last few folders used. Files from the same
+// folder then cost a single path walk, not one per file and system call.
+//
+class FolderCache {
+ public:
+  FolderCache() {}
+  ~FolderCache() {
+    for (auto &folder : folders_) {
+      close(folder.second);
+    }
+  }
+
+  // Same as stat(path, statst).
+  int Stat(const char *path, struct stat *statst) {
+    const char *name;
+    int dirfd = Folder(path, &name);
+    return fstatat(dirfd, name, statst, 0);
+  }
+
+  // Same as open(path, O_RDONLY).
+  int Open(const char *path) {
+    const char *name;
+    int dirfd = Folder(path, &name);
+    return openat(dirfd, name, O_RDONLY);
+  }
+
+ private:
+  // Returns the file descriptor of the folder of path and sets name to the
+  // path relative to it. If the folder cannot be opened, returns AT_FDCWD
+  // and path itself.
+  int Folder(const char *path, const char **name);
+
+  // The most recently used first.
+  std::list<std::pair<std::string, int> > folders_;
+  static const size_t kMaxFolders = 16;
+};
+
+int FolderCache::Folder(const char *path, const char **name) {
+  *name = path;
+  const char *slash = strrchr(path, '/');
+  if (slash == NULL || slash[1] == 0) {
+    return AT_FDCWD;
+  }
+  size_t length = slash == path ? 1 : slash - path;  // Keep the root's slash.
+  for (auto it = folders_.begin(); it != folders_.end(); ++it) {
+    if (it->first.size() == length &&
+        memcmp(it->first.data(), path, length) == 0) {
+      folders_.splice(folders_.begin(), folders_, it);
+      *name = slash + 1;
+      return it->second;
+    }
+  }
+  std::string folder(path, length);
+  int fd = open(folder.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return AT_FDCWD;
+  }
+  folders_.push_front(std::make_pair(folder, fd));
+  if (folders_.size() > kMaxFolders) {
+    close(folders_.back().second);
+    folders_.pop_back();
+  }
+  *name = slash + 1;
+  return fd;
+}
+
+// Compute the path of a file in the zip (flattening it if requested) into
+// "path", and stat the file into "statst". Returns -1 on error and 0 if the
+// file should not be added (a directory when flattening), 1 otherwise.
+int prepare_file(FolderCache *folders, char *file, char *zip_path,
+                 bool flatten, bool verbose, char *path, struct stat *statst) {
+  statst->st_size = 0;
+  statst->st_mode = 0666;
   if (file != NULL) {
-    if (stat(file, &statst) < 0) {
+    if (folders->Stat(file, statst) < 0) {
       fprintf(stderr, "Cannot stat file %s: %s.\n", file, strerror(errno));
       return -1;
     }
   }
   char *final_path = zip_path != NULL ? zip_path : file;
 
-  bool isdir = (statst.st_mode & S_IFDIR) != 0;
+  bool isdir = (statst->st_mode & S_IFDIR) != 0;
 
   if (flatten && isdir) {
     return 0;
   }
 
   // Compute the path, flattening it if requested
-  char path[PATH_MAX];
   size_t len = strlen(final_path);
   if (len > PATH_MAX) {
     fprintf(stderr, "Path too long: %s.\n", final_path);
@@ -261,30 +530,212 @@ int add_file(std::unique_ptr<ZipBuilder> const &builder, char *file,
   }
 
   if (verbose) {
-    mode_t perm = statst.st_mode & 0777;
+    mode_t perm = statst->st_mode & 0777;
     printf("%c %o %s\n", isdir ? 'd' : 'f', perm, path);
   }
+  return 1;
+}
+
+// Read the "size" bytes of the file into buffer.
+int read_file(FolderCache *folders, const char *file, size_t size,
+              void *buffer) {
+  int fd = folders->Open(file);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open file %s for reading: %s.\n", file,
+            strerror(errno));
+    return -1;
+  }
+  if (copy_file_to_buffer(fd, size, buffer) < 0) {
+    fprintf(stderr, "Can't read file %s: %s.\n", file, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+//
+// Adds files to a ZipBuilder. The files are all stat'ed first, which sizes
+// the output, and then read (and compressed) in the order they were added
+// in, possibly on several threads: the output is the same either way.
+//
+class FileAdder {
+ public:
+  explicit FileAdder(bool compress) : compress_(compress) {}
+
+  // Queue a file. Returns -1 if it cannot be stat'ed.
+  int Add(char *file, char *zip_path, bool flatten, bool verbose);
 
-  u1 *buffer = builder->NewFile(path, mode_to_zipattr(statst.st_mode));
+  // The estimated size of a ZIP file holding the queued files.
+  u8 EstimateSize();
+
+  // Read, compress and add the queued files on the given number of threads.
+  // Returns -1 if a file cannot be read.
+  int Run(ZipBuilder *builder, int threads);
+
+ private:
+  struct PendingFile {
+    std::string path;  // in the zip
+    const char *file;  // NULL if it has no content
+    u4 attr;
+    size_t size;
+    bool done;
+    bool failed;
+    u1 *data;
+    size_t compressed_size;
+    u4 crc;
+  };
+
+  // Reads the files from next_file_ (waiting for the writer if it is too far
+  // behind) until the end.
+  void ReadWorker();
+
+  const bool compress_;
+  // For the files being queued (workers have their own).
+  FolderCache folders_;
+  std::vector<PendingFile> files_;
+  // Guards the following and the PendingFile::done fields.
+  std::mutex mutex_;
+  // Signalled when a file is done and when a file is written out.
+  std::condition_variable file_done_;
+  std::condition_variable file_written_;
+  size_t next_file_;
+  size_t written_files_;
+};
+
+// The workers stay at most this many files ahead of the writer, so that
+// the file contents waiting to be written out do not pile up.
+static const size_t kMaxFilesAhead = 256;
+
+int FileAdder::Add(char *file, char *zip_path, bool flatten, bool verbose) {
+  struct stat statst;
+  char path[PATH_MAX];
+  int prepared = prepare_file(&folders_, file, zip_path, flatten, verbose,
+                              path, &statst);
+  if (prepared <= 0) {
+    return prepared;
+  }
+  bool isdir = (statst.st_mode & S_IFDIR) != 0;
+  PendingFile pending_file = {path, file, mode_to_zipattr(statst.st_mode),
+                              static_cast<size_t>(statst.st_size), false,
+                              false, NULL, 0, 0};
   if (isdir || statst.st_size == 0) {
-    builder->FinishFile(0);
-  } else {
-    // read the input file
-    int fd = open(file, O_RDONLY);
-    if (fd < 0) {
-      fprintf(stderr, "Can't open file %s for reading: %s.\n", file,
-              strerror(errno));
-      return -1;
+    pending_file.file = NULL;
+    pending_file.size = 0;
+  }
+  files_.push_back(pending_file);
+  return 0;
+}
+
+u8 FileAdder::EstimateSize() {
+  std::vector<const char *> paths;
+  std::vector<size_t> sizes;
+  for (auto &pending_file : files_) {
+    paths.push_back(pending_file.path.c_str());
+    sizes.push_back(pending_file.size);
+  }
+  return ZipBuilder::EstimateSize(paths.data(), sizes.data(), files_.size());
+}
+
+void FileAdder::ReadWorker() {
+  FolderCache folders;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    file_written_.wait(lock, [this]() {
+      return next_file_ >= files_.size() ||
+             next_file_ < written_files_ + kMaxFilesAhead;
+    });
+    if (next_file_ >= files_.size()) {
+      return;
     }
-    if (copy_file_to_buffer(fd, statst.st_size, buffer) < 0) {
-      fprintf(stderr, "Can't read file %s: %s.\n", file, strerror(errno));
-      close(fd);
-      return -1;
+    PendingFile &pending_file = files_[next_file_++];
+    lock.unlock();
+
+    if (pending_file.file != NULL) {
+      u1 *data = static_cast<u1 *>(malloc(pending_file.size));
+      if (data == NULL || read_file(&folders, pending_file.file,
+                                    pending_file.size, data) < 0) {
+        free(data);
+        pending_file.failed = true;
+      } else {
+        pending_file.crc = ComputeCrcChecksum(data, pending_file.size);
+        pending_file.compressed_size =
+            compress_ ? TryDeflate(data, pending_file.size)
+                      : pending_file.size;
+        pending_file.data = data;
+      }
     }
-    close(fd);
-    builder->FinishFile(statst.st_size, compress, true);
+
+    lock.lock();
+    pending_file.done = true;
+    file_done_.notify_all();
   }
-  return 0;
+}
+
+int FileAdder::Run(ZipBuilder *builder, int threads) {
+  if (threads <= 1) {
+    // Read the files right into the output.
+    for (auto &pending_file : files_) {
+      u1 *buffer = builder->NewFile(pending_file.path.c_str(),
+                                    pending_file.attr);
+      if (pending_file.file == NULL) {
+        builder->FinishFile(0);
+      } else {
+        if (read_file(&folders_, pending_file.file, pending_file.size,
+                      buffer) < 0) {
+          return -1;
+        }
+        builder->FinishFile(pending_file.size, compress_, true);
+      }
+    }
+    files_.clear();
+    return 0;
+  }
+
+  next_file_ = 0;
+  written_files_ = 0;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back(&FileAdder::ReadWorker, this);
+  }
+  int result = 0;
+  for (auto &pending_file : files_) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      file_done_.wait(lock, [&pending_file]() { return pending_file.done; });
+    }
+    if (pending_file.failed) {
+      // Let the workers run out of files.
+      result = -1;
+      std::lock_guard<std::mutex> lock(mutex_);
+      next_file_ = files_.size();
+      file_written_.notify_all();
+      break;
+    }
+    u1 *buffer = builder->NewFile(pending_file.path.c_str(),
+                                  pending_file.attr);
+    if (pending_file.data == NULL) {
+      builder->FinishFile(0);
+    } else {
+      memcpy(buffer, pending_file.data, pending_file.compressed_size);
+      free(pending_file.data);
+      pending_file.data = NULL;
+      builder->FinishCompressedFile(pending_file.size,
+                                    pending_file.compressed_size,
+                                    pending_file.crc);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++written_files_;
+    file_written_.notify_all();
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  for (auto &pending_file : files_) {
+    free(pending_file.data);
+  }
+  files_.clear();
+  return result;
 }
 
 // Read a list of files separated by newlines. The resulting array can be
@@ -375,9 +826,11 @@ char **parse_filelist(char *zipfile, char **file_entries, int nb_entries,
   return files;
 }
 
-// Execute the create operation
+// Execute the create operation. With more than one thread, the files are
+// read and compressed in parallel. With "output_digest", the digest of the
+// zip file is stored as ZipBuilder::SetOutputDigest() describes.
 int create(char *zipfile, char **file_entries, bool flatten, bool verbose,
-           bool compress) {
+           bool compress, int threads, const char *output_digest) {
   int nb_entries = 0;
   while (file_entries[nb_entries] != NULL) {
     nb_entries++;
@@ -388,27 +841,38 @@ int create(char *zipfile, char **file_entries, bool flatten, bool verbose,
     return -1;
   }
 
-  u8 size = ZipBuilder::EstimateSize(files, zip_paths, nb_entries);
-  if (size == 0) {
-    return -1;
+  // Every file is stat'ed once, for both the size of the output and its
+  // entry.
+  FileAdder adder(compress);
+  uint64_t phase_start = BlazeTraceNow();
+  for (int i = 0; i < nb_entries; i++) {
+    if (adder.Add(files[i], zip_paths[i], flatten, verbose) < 0) {
+      return -1;
+    }
   }
-  std::unique_ptr<ZipBuilder> builder(ZipBuilder::Create(zipfile, size));
+  BlazeTraceSpan("stat inputs", zipfile, phase_start);
+  BlazeTraceCounter("input files", nb_entries);
+  std::unique_ptr<ZipBuilder> builder(
+      ZipBuilder::Create(zipfile, adder.EstimateSize()));
   if (builder.get() == NULL) {
     fprintf(stderr, "Unable to create zip file %s: %s.\n",
             zipfile, strerror(errno));
     return -1;
   }
-
-  for (int i = 0; i < nb_entries; i++) {
-    if (add_file(builder, files[i], zip_paths[i], flatten, verbose, compress) <
-        0) {
-      return -1;
-    }
+  if (output_digest != NULL) {
+    builder->SetOutputDigest(blaze_util::OutputDigest::Parse(output_digest));
   }
+  phase_start = BlazeTraceNow();
+  if (adder.Run(builder.get(), threads) < 0) {
+    return -1;
+  }
+  BlazeTraceSpan("add files", zipfile, phase_start);
+  phase_start = BlazeTraceNow();
   if (builder->Finish() < 0) {
     fprintf(stderr, "%s\n", builder->GetError());
     return -1;
   }
+  BlazeTraceSpan("write", zipfile, phase_start);
   return 0;
 }
 
@@ -419,8 +883,9 @@ int create(char *zipfile, char **file_entries, bool flatten, bool verbose,
 //
 static void usage(char *progname) {
   fprintf(stderr,
-          "Usage: %s [vxc[fC]] x.zip [-d exdir] [[zip_path1=]file1 ... "
-          "[zip_pathn=]filen]\n",
+          "Usage: %s [vxc[fC]] x.zip [-j threads] [-d exdir] "
+          "[--output_digest function:xattr] "
+          "[[zip_path1=]file1 ... [zip_pathn=]filen]\n",
           progname);
   fprintf(stderr, "  v verbose - list all file in x.zip\n");
   fprintf(stderr,
@@ -432,6 +897,14 @@ static void usage(char *progname) {
   fprintf(stderr,
           "  C compress - compress files when using the create operation\n");
   fprintf(stderr, "x and c cannot be used in the same command-line.\n");
+  fprintf(stderr,
+          "\n-j gives the number of threads the files are compressed (when "
+          "creating)\n  or inflated (when extracting) on (default 1).\n");
+  fprintf(stderr,
+          "\n--output_digest computes the md5 or sha256 digest of x.zip as "
+          "it is created,\n  and stores it in the extended attribute xattr, "
+          "where Bazel started with\n  -Dbazel.DigestXattr=xattr finds "
+          "it.\n");
   fprintf(stderr,
           "\nFor every file, a path in the zip can be specified. Examples:\n");
   fprintf(stderr,
@@ -446,7 +919,8 @@ static void usage(char *progname) {
   exit(1);
 }
 
-int main(int argc, char **argv) {
+static int ZipperMain(int argc, char **argv) {
+  BlazeTraceInit("zipper", NULL);
   bool extract = false;
   bool verbose = false;
   bool create = false;
@@ -485,11 +959,32 @@ int main(int argc, char **argv) {
   }
 
   // Calculate the argument index of the first entry file.
-  int filelist_start_index;
-  if (argc > 3 && strcmp(argv[3], "-d") == 0) {
-    filelist_start_index = 5;
-  } else {
-    filelist_start_index = 3;
+  int filelist_start_index = 3;
+  int threads = 1;
+  if (argc > filelist_start_index + 1 &&
+      strcmp(argv[filelist_start_index], "-j") == 0) {
+    threads = atoi(argv[filelist_start_index + 1]);
+    if (threads < 1) {
+      usage(argv[0]);
+    }
+    filelist_start_index += 2;
+  }
+  char* exdir = NULL;
+  if (argc > filelist_start_index &&
+      strcmp(argv[filelist_start_index], "-d") == 0) {
+    exdir = argv[filelist_start_index + 1];
+    filelist_start_index += 2;
+  }
+  const char* output_digest = NULL;
+  if (argc > filelist_start_index + 1 &&
+      strcmp(argv[filelist_start_index], "--output_digest") == 0) {
+    output_digest = argv[filelist_start_index + 1];
+    std::unique_ptr<blaze_util::OutputDigest> digest(
+        blaze_util::OutputDigest::Parse(output_digest));
+    if (digest == NULL) {
+      usage(argv[0]);
+    }
+    filelist_start_index += 2;
   }
 
   char** filelist = NULL;
@@ -518,18 +1013,26 @@ int main(int argc, char **argv) {
 
   if (create) {
     // Create a zip
-    return devtools_ijar::create(argv[2], filelist, flatten, verbose, compress);
+    return devtools_ijar::create(argv[2], filelist, flatten, verbose, compress,
+                                 threads, output_digest);
   } else {
     if (flatten) {
       usage(argv[0]);
     }
 
-    char* exdir = NULL;
-    if (argc > 3 && strcmp(argv[3], "-d") == 0) {
-      exdir = argv[4];
-    }
-
     // Extraction / list mode
-    return devtools_ijar::extract(argv[2], exdir, filelist, verbose, extract);
+    return devtools_ijar::extract(argv[2], exdir, filelist, verbose, extract,
+                                  threads);
+  }
+}
+
+int main(int argc, char **argv) {
+#ifndef _WIN32
+  int exit_code;
+  if (blaze_worker::RunIfRequested(argc, argv, "zipper", ZipperMain,
+                                   &exit_code)) {
+    return exit_code;
   }
+#endif
+  return ZipperMain(argc, argv);
 }
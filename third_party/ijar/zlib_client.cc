@@ -26,65 +26,102 @@ u4 ComputeCrcChecksum(u1 *buf, size_t length) {
   return crc32(0, buf, length);
 }
 
-size_t TryDeflate(u1 *buf, size_t length) {
-  u1 *outbuf = reinterpret_cast<u1 *>(malloc(length));
+namespace {
+// A deflater kept per thread and reset for every file: setting one up
+// allocates about 256KB of window and hash tables, which costs more than
+// compressing a small class file.
+struct ThreadDeflater {
+  ThreadDeflater() : initialized(false) {}
+  ~ThreadDeflater() {
+    if (initialized) {
+      deflateEnd(&stream);
+    }
+  }
+
   z_stream stream;
+  bool initialized;
+};
+
+thread_local ThreadDeflater thread_deflater;
+}  // namespace
 
-  // Initialize the z_stream strcut for reading from buf and wrinting in outbuf.
-  stream.zalloc = Z_NULL;
-  stream.zfree = Z_NULL;
-  stream.opaque = Z_NULL;
-  stream.total_in = length;
+size_t TryDeflate(u1 *buf, size_t length) {
+  z_stream &stream = thread_deflater.stream;
+  if (thread_deflater.initialized) {
+    deflateReset(&stream);
+  } else {
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.avail_in = 0;
+    stream.next_in = Z_NULL;
+    // deflateInit2 negative windows size prevent the zlib wrapper to be used.
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      // Failure to compress => return the buffer uncompressed
+      return length;
+    }
+    thread_deflater.initialized = true;
+  }
+
+  u1 *outbuf = reinterpret_cast<u1 *>(malloc(length));
+  // Read from buf and write in outbuf.
   stream.avail_in = length;
-  stream.total_out = length;
   stream.avail_out = length;
   stream.next_in = buf;
   stream.next_out = outbuf;
 
-  // deflateInit2 negative windows size prevent the zlib wrapper to be used.
-  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
-                   Z_DEFAULT_STRATEGY) != Z_OK) {
-    // Failure to compress => return the buffer uncompressed
-    free(outbuf);
-    return length;
-  }
-
   if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
     // Compression successful and fits in outbuf, let's copy the result in buf.
     length = stream.total_out;
     memcpy(buf, outbuf, length);
   }
 
-  deflateEnd(&stream);
   free(outbuf);
 
   // Return the length of the resulting buffer
   return length;
 }
 
-Decompressor::Decompressor() {
+Decompressor::Decompressor() : stream_(NULL) {
   uncompressed_data_allocated_ = INITIAL_BUFFER_SIZE;
   uncompressed_data_ =
       reinterpret_cast<u1 *>(malloc(uncompressed_data_allocated_));
 }
 
-Decompressor::~Decompressor() { free(uncompressed_data_); }
+Decompressor::~Decompressor() {
+  if (stream_ != NULL) {
+    inflateEnd(stream_);
+    delete stream_;
+  }
+  free(uncompressed_data_);
+}
 
 DecompressedFile *Decompressor::UncompressFile(const u1 *buffer,
                                                size_t bytes_avail) {
-  z_stream stream;
-
-  stream.zalloc = Z_NULL;
-  stream.zfree = Z_NULL;
-  stream.opaque = Z_NULL;
-  stream.avail_in = bytes_avail;
-  stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(buffer));
-
-  int ret = inflateInit2(&stream, -MAX_WBITS);
+  int ret;
+  if (stream_ != NULL) {
+    ret = inflateReset(stream_);
+  } else {
+    stream_ = new z_stream();
+    stream_->zalloc = Z_NULL;
+    stream_->zfree = Z_NULL;
+    stream_->opaque = Z_NULL;
+    stream_->avail_in = 0;
+    stream_->next_in = Z_NULL;
+    ret = inflateInit2(stream_, -MAX_WBITS);
+    if (ret != Z_OK) {
+      delete stream_;
+      stream_ = NULL;
+    }
+  }
   if (ret != Z_OK) {
     error("inflateInit: %d\n", ret);
     return NULL;
   }
+  z_stream &stream = *stream_;
+  stream.avail_in = bytes_avail;
+  stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(buffer));
 
   int uncompressed_until_now = 0;
 
@@ -107,7 +144,6 @@ DecompressedFile *Decompressor::UncompressFile(const u1 *buffer,
         decompressedFile->compressed_size = new_p - buffer;
         decompressedFile->uncompressed_size = uncompressed_until_now;
         decompressedFile->uncompressed_data = uncompressed_data_;
-        inflateEnd(&stream);
         return decompressedFile;
       }
 
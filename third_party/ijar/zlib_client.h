@@ -17,8 +17,13 @@
 
 #include <limits.h>
 
+#include <limits>
+
 #include "third_party/ijar/common.h"
 
+// zlib's z_stream, left opaque so that the header does not need zlib.
+struct z_stream_s;
+
 namespace devtools_ijar {
 // Try to compress a file entry in memory using the deflate algorithm.
 // It will compress buf (of size length) unless the compressed size is bigger
@@ -42,6 +47,9 @@ class Decompressor {
   char* GetError();
 
  private:
+  // The inflater, set up by the first UncompressFile() and reset by the
+  // next ones.
+  struct z_stream_s* stream_;
   // Administration of memory reserved for decompressed data. We use the same
   // buffer for each file to avoid some malloc()/free() calls and free the
   // memory only in the dtor. C-style memory management is used so that we
@@ -48,6 +48,7 @@
 #include <errno.h>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <ctype.h>
 
 #include <limits.h> //For PATH_MAX
@@ -69,11 +70,14 @@
 #include <google/protobuf/compiler/subprocess.h>
 #include <google/protobuf/compiler/zip_writer.h>
 #include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor_database.h>
 #include <google/protobuf/text_format.h>
 #include <google/protobuf/dynamic_message.h>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/io/printer.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <google/protobuf/wire_format_lite_inl.h>
 #include <google/protobuf/stubs/logging.h>
 #include <google/protobuf/stubs/strutil.h>
 #include <google/protobuf/stubs/substitute.h>
@@ -334,6 +338,132 @@ class CommandLineInterface::ErrorPrinter : public MultiFileErrorCollector,
 
 // -------------------------------------------------------------------
 
+// The files a persistent worker parsed, with the contents they were parsed
+// from.  The contents themselves rather than a digest of them are compared:
+// that costs about as much as hashing them, and cannot collide.
+class CommandLineInterface::ParsedFileCache {
+ public:
+  ParsedFileCache() {}
+  ~ParsedFileCache() {}
+
+  // Copies the file parsed from filename into *output and returns true if it
+  // was parsed from the same contents.
+  bool Find(const string& filename, const string& contents,
+            FileDescriptorProto* output) const {
+    map<string, Entry>::const_iterator it = entries_.find(filename);
+    if (it == entries_.end() || it->second.contents != contents) {
+      return false;
+    }
+    output->CopyFrom(it->second.file);
+    return true;
+  }
+
+  // Remembers the file parsed from filename, replacing what was parsed from
+  // it before.
+  void Insert(const string& filename, const string& contents,
+              const FileDescriptorProto& file) {
+    Entry* entry = &entries_[filename];
+    entry->contents = contents;
+    entry->file.CopyFrom(file);
+  }
+
+ private:
+  struct Entry {
+    string contents;
+    FileDescriptorProto file;
+  };
+  map<string, Entry> entries_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ParsedFileCache);
+};
+
+// A DescriptorDatabase that looks up the files in a ParsedFileCache before
+// it has the SourceTreeDescriptorDatabase parse them, and takes the files
+// that are not in the source tree from the precompiled database of
+// --descriptor_set_in.  Without a cache or a precompiled database, it only
+// forwards to the SourceTreeDescriptorDatabase.
+class CommandLineInterface::CachingDescriptorDatabase
+    : public DescriptorDatabase {
+ public:
+  CachingDescriptorDatabase(SourceTree* source_tree,
+                            SourceTreeDescriptorDatabase* parser,
+                            ParsedFileCache* cache,
+                            DescriptorDatabase* precompiled)
+    : source_tree_(source_tree), parser_(parser), cache_(cache),
+      precompiled_(precompiled), used_cache_(false) {}
+  ~CachingDescriptorDatabase() {}
+
+  // Returns true if some file came from the cache.
+  bool used_cache() const { return used_cache_; }
+
+  // implements DescriptorDatabase -----------------------------------
+  bool FindFileByName(const string& filename, FileDescriptorProto* output) {
+    if (cache_ == NULL && precompiled_ == NULL) {
+      return parser_->FindFileByName(filename, output);
+    }
+    string contents;
+    if (!ReadContents(filename, cache_ != NULL ? &contents : NULL)) {
+      if (precompiled_ != NULL &&
+          precompiled_->FindFileByName(filename, output)) {
+        return true;
+      }
+      // Let the parser report the missing file.
+      return parser_->FindFileByName(filename, output);
+    }
+    if (cache_ == NULL) {
+      return parser_->FindFileByName(filename, output);
+    }
+    if (cache_->Find(filename, contents, output)) {
+      used_cache_ = true;
+      return true;
+    }
+    if (!parser_->FindFileByName(filename, output)) {
+      return false;
+    }
+    cache_->Insert(filename, contents, *output);
+    return true;
+  }
+  bool FindFileContainingSymbol(const string& symbol_name,
+                                FileDescriptorProto* output) {
+    return false;
+  }
+  bool FindFileContainingExtension(const string& containing_type,
+                                   int field_number,
+                                   FileDescriptorProto* output) {
+    return false;
+  }
+
+ private:
+  // Returns false if filename is not in the source tree.  Only checks that
+  // it is if contents is NULL.
+  bool ReadContents(const string& filename, string* contents) {
+    google::protobuf::scoped_ptr<io::ZeroCopyInputStream> input(
+        source_tree_->Open(filename));
+    if (input == NULL) {
+      return false;
+    }
+    if (contents == NULL) {
+      return true;
+    }
+    const void* data;
+    int size;
+    while (input->Next(&data, &size)) {
+      contents->append(static_cast<const char*>(data), size);
+    }
+    return true;
+  }
+
+  SourceTree* source_tree_;
+  SourceTreeDescriptorDatabase* parser_;
+  ParsedFileCache* cache_;
+  DescriptorDatabase* precompiled_;
+  bool used_cache_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(CachingDescriptorDatabase);
+};
+
+// -------------------------------------------------------------------
+
 // A GeneratorContext implementation that buffers files in memory, then dumps
 // them all to disk on demand.
 class CommandLineInterface::GeneratorContextImpl : public GeneratorContext {
@@ -707,7 +837,9 @@ CommandLineInterface::CommandLineInterface()
     imports_in_descriptor_set_(false),
     source_info_in_descriptor_set_(false),
     disallow_services_(false),
-    inputs_are_proto_path_relative_(false) {}
+    inputs_are_proto_path_relative_(false),
+    use_parsed_file_cache_(false),
+    import_failed_with_cached_files_(false) {}
 CommandLineInterface::~CommandLineInterface() {}
 
 void CommandLineInterface::RegisterGenerator(const string& flag_name,
@@ -738,6 +870,123 @@ void CommandLineInterface::AllowPlugins(const string& exe_name_prefix) {
 }
 
 int CommandLineInterface::Run(int argc, const char* const argv[]) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--persistent_worker") == 0) {
+      return RunWorker(argc, argv);
+    }
+  }
+  return Compile(argc, argv);
+}
+
+namespace {
+
+// Reads a length-delimited WorkRequest and appends its arguments.  Returns
+// false at the end of the input, or if it is not a WorkRequest.
+bool ReadWorkRequest(io::ZeroCopyInputStream* input,
+                     vector<string>* arguments) {
+  using internal::WireFormatLite;
+  io::CodedInputStream coded_input(input);
+  uint32 size;
+  if (!coded_input.ReadVarint32(&size)) {
+    return false;
+  }
+  io::CodedInputStream::Limit limit = coded_input.PushLimit(size);
+  while (uint32 tag = coded_input.ReadTag()) {
+    // repeated string arguments = 1; the inputs are not needed.
+    if (tag == WireFormatLite::MakeTag(
+                   1, WireFormatLite::WIRETYPE_LENGTH_DELIMITED)) {
+      string argument;
+      if (!WireFormatLite::ReadString(&coded_input, &argument)) {
+        return false;
+      }
+      arguments->push_back(argument);
+    } else if (!WireFormatLite::SkipField(&coded_input, tag)) {
+      return false;
+    }
+  }
+  if (coded_input.BytesUntilLimit() != 0) {
+    return false;
+  }
+  coded_input.PopLimit(limit);
+  return true;
+}
+
+// Writes a length-delimited WorkResponse.
+void WriteWorkResponse(io::ZeroCopyOutputStream* output, int exit_code,
+                       const string& text) {
+  using internal::WireFormatLite;
+  // As in proto3, the default values are left out.
+  int size = 0;
+  if (exit_code != 0) {
+    size += 1 + WireFormatLite::Int32Size(exit_code);
+  }
+  if (!text.empty()) {
+    size += 1 + WireFormatLite::StringSize(text);
+  }
+  io::CodedOutputStream coded_output(output);
+  coded_output.WriteVarint32(size);
+  if (exit_code != 0) {
+    WireFormatLite::WriteInt32(1, exit_code, &coded_output);
+  }
+  if (!text.empty()) {
+    WireFormatLite::WriteString(2, text, &coded_output);
+  }
+}
+
+}  // namespace
+
+int CommandLineInterface::RunWorker(int argc, const char* const argv[]) {
+  // The arguments other than --persistent_worker come before those of each
+  // request.
+  vector<string> startup_arguments;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--persistent_worker") != 0) {
+      startup_arguments.push_back(argv[i]);
+    }
+  }
+
+  parsed_file_cache_.reset(new ParsedFileCache);
+  SetFdToBinaryMode(STDIN_FILENO);
+  SetFdToBinaryMode(STDOUT_FILENO);
+  io::FileInputStream input(STDIN_FILENO);
+  io::FileOutputStream output(STDOUT_FILENO);
+  while (true) {
+    vector<string> arguments = startup_arguments;
+    if (!ReadWorkRequest(&input, &arguments)) {
+      break;
+    }
+    vector<const char*> request_argv;
+    for (int i = 0; i < arguments.size(); i++) {
+      request_argv.push_back(arguments[i].c_str());
+    }
+
+    // stdout is the channel to Bazel: what the compiler prints goes into the
+    // response instead.
+    std::ostringstream messages;
+    std::streambuf* cout_buffer = std::cout.rdbuf(messages.rdbuf());
+    std::streambuf* cerr_buffer = std::cerr.rdbuf(messages.rdbuf());
+    std::streambuf* clog_buffer = std::clog.rdbuf(messages.rdbuf());
+    use_parsed_file_cache_ = true;
+    int exit_code = Compile(request_argv.size(), &request_argv[0]);
+    if (import_failed_with_cached_files_) {
+      messages.str("");
+      use_parsed_file_cache_ = false;
+      exit_code = Compile(request_argv.size(), &request_argv[0]);
+    }
+    std::cout.rdbuf(cout_buffer);
+    std::cerr.rdbuf(cerr_buffer);
+    std::clog.rdbuf(clog_buffer);
+
+    WriteWorkResponse(&output, exit_code, messages.str());
+    if (!output.Flush()) {
+      return 1;
+    }
+  }
+  parsed_file_cache_.reset();
+  return 0;
+}
+
+int CommandLineInterface::Compile(int argc, const char* const argv[]) {
   Clear();
   switch (ParseArguments(argc, argv)) {
     case PARSE_ARGUMENT_DONE_AND_EXIT:
@@ -748,6 +997,13 @@ int CommandLineInterface::Run(int argc, const char* const argv[]) {
       break;
   }
 
+  if (parsed_file_cache_ != NULL &&
+      (mode_ == MODE_ENCODE || mode_ == MODE_DECODE)) {
+    std::cerr << "--encode and --decode cannot be used with "
+                 "--persistent_worker." << std::endl;
+    return 1;
+  }
+
   AddDefaultProtoPaths(&proto_path_);
 
   // Set up the source tree.
@@ -756,26 +1012,46 @@ int CommandLineInterface::Run(int argc, const char* const argv[]) {
     source_tree.MapPath(proto_path_[i].first, proto_path_[i].second);
   }
 
+  // Load the precompiled imports.
+  SimpleDescriptorDatabase descriptor_set_in_database;
+  if (!PopulateSimpleDescriptorDatabase(&descriptor_set_in_database)) {
+    return 1;
+  }
+  DescriptorDatabase* precompiled =
+      descriptor_set_in_names_.empty() ? NULL : &descriptor_set_in_database;
+
   // Map input files to virtual paths if necessary.
   if (!inputs_are_proto_path_relative_) {
-    if (!MakeInputsBeProtoPathRelative(&source_tree)) {
+    if (!MakeInputsBeProtoPathRelative(&source_tree, precompiled)) {
       return 1;
     }
   }
 
-  // Allocate the Importer.
+  // Set up the pool the way Importer does, except that a persistent worker
+  // takes the files it parsed before from the cache, and that the files
+  // which are not in the source tree may come from --descriptor_set_in.
   ErrorPrinter error_collector(error_format_, &source_tree);
-  Importer importer(&source_tree, &error_collector);
+  SourceTreeDescriptorDatabase source_tree_database(&source_tree);
+  CachingDescriptorDatabase database(
+      &source_tree, &source_tree_database,
+      use_parsed_file_cache_ ? parsed_file_cache_.get() : NULL, precompiled);
+  DescriptorPool pool(&database,
+                      source_tree_database.GetValidationErrorCollector());
+  pool.EnforceWeakDependencies(true);
+  source_tree_database.RecordErrorsTo(&error_collector);
 
   vector<const FileDescriptor*> parsed_files;
 
   // Parse each file.
   for (int i = 0; i < input_files_.size(); i++) {
     // Import the file.
-    importer.AddUnusedImportTrackFile(input_files_[i]);
-    const FileDescriptor* parsed_file = importer.Import(input_files_[i]);
-    importer.ClearUnusedImportTrackFiles();
-    if (parsed_file == NULL) return 1;
+    pool.AddUnusedImportTrackFile(input_files_[i]);
+    const FileDescriptor* parsed_file = pool.FindFileByName(input_files_[i]);
+    pool.ClearUnusedImportTrackFiles();
+    if (parsed_file == NULL) {
+      import_failed_with_cached_files_ = database.used_cache();
+      return 1;
+    }
     parsed_files.push_back(parsed_file);
 
     // Enforce --disallow_services.
@@ -791,8 +1067,15 @@ int CommandLineInterface::Run(int argc, const char* const argv[]) {
   // they should share a single GeneratorContext so that OpenForInsert() works.
   GeneratorContextMap output_directories;
 
-  // Generate output.
+  // Generate output.  The plugins all run at the same time, but their output
+  // is written in the order of the output directives, like the output of the
+  // built-in generators, so that it does not depend on which plugin finishes
+  // first, and insertions into the files of earlier directives work.
   if (mode_ == MODE_COMPILE) {
+    vector<CodeGeneratorResponse> plugin_responses;
+    vector<string> plugin_errors;
+    RunPlugins(parsed_files, &plugin_responses, &plugin_errors);
+
     for (int i = 0; i < output_directives_.size(); i++) {
       string output_location = output_directives_[i].output_location;
       if (!HasSuffixString(output_location, ".zip") &&
@@ -806,7 +1089,8 @@ int CommandLineInterface::Run(int argc, const char* const argv[]) {
         *map_slot = new GeneratorContextImpl(parsed_files);
       }
 
-      if (!GenerateOutput(parsed_files, output_directives_[i], *map_slot)) {
+      if (!GenerateOutput(parsed_files, output_directives_[i],
+                          plugin_responses[i], plugin_errors[i], *map_slot)) {
         STLDeleteValues(&output_directories);
         return 1;
       }
@@ -863,7 +1147,7 @@ int CommandLineInterface::Run(int argc, const char* const argv[]) {
         return 1;
       }
     } else {
-      if (!EncodeOrDecode(importer.pool())) {
+      if (!EncodeOrDecode(&pool)) {
         return 1;
       }
     }
@@ -895,11 +1179,13 @@ void CommandLineInterface::Clear() {
   // Clear all members that are set by Run().  Note that we must not clear
   // members which are set by other methods before Run() is called.
   executable_name_.clear();
+  import_failed_with_cached_files_ = false;
   proto_path_.clear();
   input_files_.clear();
   output_directives_.clear();
   codec_type_.clear();
   descriptor_set_name_.clear();
+  descriptor_set_in_names_.clear();
   dependency_out_name_.clear();
 
   mode_ = MODE_COMPILE;
@@ -910,8 +1196,14 @@ void CommandLineInterface::Clear() {
 }
 
 bool CommandLineInterface::MakeInputsBeProtoPathRelative(
-    DiskSourceTree* source_tree) {
+    DiskSourceTree* source_tree, DescriptorDatabase* precompiled) {
   for (int i = 0; i < input_files_.size(); i++) {
+    FileDescriptorProto precompiled_file;
+    if (precompiled != NULL &&
+        precompiled->FindFileByName(input_files_[i], &precompiled_file)) {
+      // Already the name the file has in the pool.
+      continue;
+    }
     string virtual_file, shadowing_disk_file;
     switch (source_tree->DiskFileToVirtualFile(
         input_files_[i], &virtual_file, &shadowing_disk_file)) {
@@ -1171,6 +1463,19 @@ CommandLineInterface::InterpretArgument(const string& name,
     }
     descriptor_set_name_ = value;
 
+  } else if (name == "--descriptor_set_in") {
+    if (!descriptor_set_in_names_.empty()) {
+      std::cerr << name << " may only be passed once.  To specify multiple "
+                   "descriptor sets, pass them all as a single parameter "
+                   "separated by '" << kPathSeparator << "'." << std::endl;
+      return PARSE_ARGUMENT_FAIL;
+    }
+    if (value.empty()) {
+      std::cerr << name << " requires a non-empty value." << std::endl;
+      return PARSE_ARGUMENT_FAIL;
+    }
+    descriptor_set_in_names_ = Split(value, kPathSeparator, true);
+
   } else if (name == "--dependency_out") {
     if (!dependency_out_name_.empty()) {
       std::cerr << name << " may only be passed once." << std::endl;
@@ -1369,6 +1674,15 @@ void CommandLineInterface::PrintHelpText() {
 "                              pairs in text format to standard output.  No\n"
 "                              PROTO_FILES should be given when using this\n"
 "                              flag.\n"
+"  --descriptor_set_in=FILES   Specifies a delimited list of FILES each\n"
+"                              containing a FileDescriptorSet (a protocol\n"
+"                              buffer defined in descriptor.proto).  Imports\n"
+"                              that are not found in the --proto_path are\n"
+"                              taken from these sets instead of being\n"
+"                              parsed; if a file is in several, the first\n"
+"                              one is used.  Inputs that are in a set need\n"
+"                              not be in the --proto_path.  On Windows, use\n"
+"                              ';' as the delimiter.\n"
 "  -oFILE,                     Writes a FileDescriptorSet (a protocol buffer,\n"
 "    --descriptor_set_out=FILE defined in descriptor.proto) containing all of\n"
 "                              the input files to FILE.\n"
@@ -1416,25 +1730,103 @@ void CommandLineInterface::PrintHelpText() {
   }
 }
 
+string CommandLineInterface::PluginName(
+    const OutputDirective& output_directive) {
+  GOOGLE_CHECK(HasPrefixString(output_directive.name, "--") &&
+        HasSuffixString(output_directive.name, "_out"))
+      << "Bad name for plugin generator: " << output_directive.name;
+
+  // Strip the "--" and "_out" and add the plugin prefix.
+  return plugin_prefix_ + "gen-" +
+      output_directive.name.substr(2, output_directive.name.size() - 6);
+}
+
+void CommandLineInterface::RunPlugins(
+    const vector<const FileDescriptor*>& parsed_files,
+    vector<CodeGeneratorResponse>* responses,
+    vector<string>* errors) {
+  responses->clear();
+  responses->resize(output_directives_.size());
+  errors->clear();
+  errors->resize(output_directives_.size());
+
+  // Every plugin gets the same files.
+  CodeGeneratorRequest files;
+  set<const FileDescriptor*> already_seen;
+  for (int i = 0; i < parsed_files.size(); i++) {
+    files.add_file_to_generate(parsed_files[i]->name());
+    GetTransitiveDependencies(parsed_files[i],
+                              true,  // Include json_name for plugins.
+                              true,  // Include source code info.
+                              &already_seen, files.mutable_proto_file());
+  }
+
+  vector<int> directive_indexes;
+  vector<CodeGeneratorRequest*> requests;
+  vector<Subprocess*> subprocesses;
+  for (int i = 0; i < output_directives_.size(); i++) {
+    const OutputDirective& output_directive = output_directives_[i];
+    if (output_directive.generator != NULL) {
+      continue;
+    }
+    CodeGeneratorRequest* request = new CodeGeneratorRequest(files);
+    if (!output_directive.parameter.empty()) {
+      request->set_parameter(output_directive.parameter);
+    }
+
+    // Invoke the plugin.
+    string plugin_name = PluginName(output_directive);
+    Subprocess* subprocess = new Subprocess;
+    if (plugins_.count(plugin_name) > 0) {
+      subprocess->Start(plugins_[plugin_name], Subprocess::EXACT_NAME);
+    } else {
+      subprocess->Start(plugin_name, Subprocess::SEARCH_PATH);
+    }
+
+    directive_indexes.push_back(i);
+    requests.push_back(request);
+    subprocesses.push_back(subprocess);
+  }
+  if (subprocesses.empty()) {
+    return;
+  }
+
+  vector<const Message*> inputs(requests.begin(), requests.end());
+  vector<Message*> outputs;
+  for (int i = 0; i < directive_indexes.size(); i++) {
+    outputs.push_back(&(*responses)[directive_indexes[i]]);
+  }
+  vector<string> communicate_errors;
+  Subprocess::CommunicateAll(subprocesses, inputs, outputs,
+                             &communicate_errors);
+  for (int i = 0; i < directive_indexes.size(); i++) {
+    if (!communicate_errors[i].empty()) {
+      (*errors)[directive_indexes[i]] = strings::Substitute(
+          "$0: $1", PluginName(output_directives_[directive_indexes[i]]),
+          communicate_errors[i]);
+    }
+  }
+
+  STLDeleteElements(&subprocesses);
+  STLDeleteElements(&requests);
+}
+
 bool CommandLineInterface::GenerateOutput(
     const vector<const FileDescriptor*>& parsed_files,
     const OutputDirective& output_directive,
+    const CodeGeneratorResponse& plugin_response,
+    const string& plugin_error,
     GeneratorContext* generator_context) {
   // Call the generator.
   string error;
   if (output_directive.generator == NULL) {
-    // This is a plugin.
-    GOOGLE_CHECK(HasPrefixString(output_directive.name, "--") &&
-          HasSuffixString(output_directive.name, "_out"))
-        << "Bad name for plugin generator: " << output_directive.name;
-
-    // Strip the "--" and "_out" and add the plugin prefix.
-    string plugin_name = plugin_prefix_ + "gen-" +
-        output_directive.name.substr(2, output_directive.name.size() - 6);
-
-    if (!GeneratePluginOutput(parsed_files, plugin_name,
-                              output_directive.parameter,
-                              generator_context, &error)) {
+    // This is a plugin, which RunPlugins() already ran.
+    if (!plugin_error.empty()) {
+      std::cerr << output_directive.name << ": " << plugin_error << std::endl;
+      return false;
+    }
+    if (!WritePluginOutput(plugin_response, PluginName(output_directive),
+                           generator_context, &error)) {
       std::cerr << output_directive.name << ": " << error << std::endl;
       return false;
     }
@@ -1471,6 +1863,46 @@ bool CommandLineInterface::GenerateOutput(
   return true;
 }
 
+bool CommandLineInterface::PopulateSimpleDescriptorDatabase(
+    SimpleDescriptorDatabase* database) {
+  for (int i = 0; i < descriptor_set_in_names_.size(); i++) {
+    const string& name = descriptor_set_in_names_[i];
+    int fd;
+    do {
+      fd = open(name.c_str(), O_RDONLY | O_BINARY);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+      std::cerr << name << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+
+    FileDescriptorSet file_descriptor_set;
+    bool parsed = file_descriptor_set.ParseFromFileDescriptor(fd);
+    if (close(fd) != 0) {
+      std::cerr << name << ": close: " << strerror(errno) << std::endl;
+      return false;
+    }
+    if (!parsed) {
+      std::cerr << name << ": Unable to parse." << std::endl;
+      return false;
+    }
+
+    // The first set that has a file wins, the way the first --proto_path
+    // that has a file does.
+    for (int j = 0; j < file_descriptor_set.file_size(); j++) {
+      const FileDescriptorProto& file = file_descriptor_set.file(j);
+      FileDescriptorProto previously_added;
+      if (database->FindFileByName(file.name(), &previously_added)) {
+        continue;
+      }
+      if (!database->Add(file)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 bool CommandLineInterface::GenerateDependencyManifestFile(
     const vector<const FileDescriptor*>& parsed_files,
     const GeneratorContextMap& output_directories,
@@ -1525,62 +1957,37 @@ bool CommandLineInterface::GenerateDependencyManifestFile(
     }
   }
 
+  // The files that did not come from the source tree came from the
+  // --descriptor_set_in files, which are the dependencies instead.
+  vector<string> disk_files;
   for (int i = 0; i < file_set.file_size(); i++) {
     const FileDescriptorProto& file = file_set.file(i);
     const string& virtual_file = file.name();
     string disk_file;
     if (source_tree &&
         source_tree->VirtualFileToDiskFile(virtual_file, &disk_file)) {
-      printer.Print(" $disk_file$", "disk_file", disk_file);
-      if (i < file_set.file_size() - 1) printer.Print("\\\n");
-    } else {
+      disk_files.push_back(disk_file);
+    } else if (descriptor_set_in_names_.empty()) {
       std::cerr << "Unable to identify path for file " << virtual_file
                 << std::endl;
       return false;
     }
   }
+  disk_files.insert(disk_files.end(), descriptor_set_in_names_.begin(),
+                    descriptor_set_in_names_.end());
+  for (int i = 0; i < disk_files.size(); i++) {
+    printer.Print(" $disk_file$", "disk_file", disk_files[i]);
+    if (i < disk_files.size() - 1) printer.Print("\\\n");
+  }
 
   return true;
 }
 
-bool CommandLineInterface::GeneratePluginOutput(
-    const vector<const FileDescriptor*>& parsed_files,
+bool CommandLineInterface::WritePluginOutput(
+    const CodeGeneratorResponse& response,
     const string& plugin_name,
-    const string& parameter,
     GeneratorContext* generator_context,
     string* error) {
-  CodeGeneratorRequest request;
-  CodeGeneratorResponse response;
-
-  // Build the request.
-  if (!parameter.empty()) {
-    request.set_parameter(parameter);
-  }
-
-  set<const FileDescriptor*> already_seen;
-  for (int i = 0; i < parsed_files.size(); i++) {
-    request.add_file_to_generate(parsed_files[i]->name());
-    GetTransitiveDependencies(parsed_files[i],
-                              true,  // Include json_name for plugins.
-                              true,  // Include source code info.
-                              &already_seen, request.mutable_proto_file());
-  }
-
-  // Invoke the plugin.
-  Subprocess subprocess;
-
-  if (plugins_.count(plugin_name) > 0) {
-    subprocess.Start(plugins_[plugin_name], Subprocess::EXACT_NAME);
-  } else {
-    subprocess.Start(plugin_name, Subprocess::SEARCH_PATH);
-  }
-
-  string communicate_error;
-  if (!subprocess.Communicate(request, &response, &communicate_error)) {
-    *error = strings::Substitute("$0: $1", plugin_name, communicate_error);
-    return false;
-  }
-
   // Write the files.  We do this even if there was a generator error in order
   // to match the behavior of a compiled-in generator.
   google::protobuf::scoped_ptr<io::ZeroCopyOutputStream> current_output;
@@ -53,12 +53,15 @@ class Descriptor;            // descriptor.h
 class DescriptorPool;        // descriptor.h
 class FileDescriptor;        // descriptor.h
 class FileDescriptorProto;   // descriptor.pb.h
+class DescriptorDatabase;    // descriptor_database.h
+class SimpleDescriptorDatabase;  // descriptor_database.h
 template<typename T> class RepeatedPtrField;  // repeated_field.h
 
 namespace compiler {
 
 class CodeGenerator;        // code_generator.h
 class GeneratorContext;      // code_generator.h
+class CodeGeneratorResponse;  // plugin.pb.h
 class DiskSourceTree;       // importer.h
 
 // This class implements the command-line interface to the protocol compiler.
@@ -161,6 +164,15 @@ class LIBPROTOC_EXPORT CommandLineInterface {
   // Run the Protocol Compiler with the given command-line parameters.
   // Returns the error code which should be returned by main().
   //
+  // If --persistent_worker is one of the parameters, the compiler runs as a
+  // Bazel persistent worker instead: it reads length-delimited WorkRequests
+  // (see Bazel's worker_protocol.proto) from stdin until it is closed, runs
+  // each with the other parameters followed by the arguments of the request,
+  // and writes a WorkResponse with the exit code and the error messages to
+  // stdout.  The files a request parsed are used again by the later requests
+  // for as long as their contents do not change.  --encode and --decode,
+  // which read stdin, are not available to the requests.
+  //
   // It may not be safe to call Run() in a multi-threaded environment because
   // it calls strerror().  I'm not sure why you'd want to do this anyway.
   int Run(int argc, const char* const argv[]);
@@ -191,16 +203,29 @@ class LIBPROTOC_EXPORT CommandLineInterface {
   class ErrorPrinter;
   class GeneratorContextImpl;
   class MemoryOutputStream;
+  class ParsedFileCache;
+  class CachingDescriptorDatabase;
   typedef hash_map<string, GeneratorContextImpl*> GeneratorContextMap;
 
+  // Does the work of Run() for one compilation.
+  int Compile(int argc, const char* const argv[]);
+
+  // Implements --persistent_worker.
+  int RunWorker(int argc, const char* const argv[]);
+
   // Clear state from previous Run().
   void Clear();
 
   // Remaps each file in input_files_ so that it is relative to one of the
   // directories in proto_path_.  Returns false if an error occurred.  This
-  // is only used if inputs_are_proto_path_relative_ is false.
+  // is only used if inputs_are_proto_path_relative_ is false.  Inputs that
+  // are in precompiled, the files of --descriptor_set_in, are left alone.
   bool MakeInputsBeProtoPathRelative(
-    DiskSourceTree* source_tree);
+    DiskSourceTree* source_tree, DescriptorDatabase* precompiled);
+
+  // Adds the files of the FileDescriptorSets named by --descriptor_set_in to
+  // database.  Returns false if one could not be read.
+  bool PopulateSimpleDescriptorDatabase(SimpleDescriptorDatabase* database);
 
   // Return status for ParseArguments() and InterpretArgument().
   enum ParseArgumentStatus {
@@ -233,16 +258,29 @@ class LIBPROTOC_EXPORT CommandLineInterface {
   // Print the --help text to stderr.
   void PrintHelpText();
 
-  // Generate the given output file from the given input.
+  // Runs the plugins of all output directives at the same time.  Sets
+  // (*responses)[i] to what the plugin of output_directives_[i] returned, or
+  // (*errors)[i] to why it failed.
+  void RunPlugins(const vector<const FileDescriptor*>& parsed_files,
+                  vector<CodeGeneratorResponse>* responses,
+                  vector<string>* errors);
+
+  // Generate the given output file from the given input.  For a plugin, this
+  // writes plugin_response, which RunPlugins() got, or reports plugin_error.
   struct OutputDirective;  // see below
   bool GenerateOutput(const vector<const FileDescriptor*>& parsed_files,
                       const OutputDirective& output_directive,
+                      const CodeGeneratorResponse& plugin_response,
+                      const string& plugin_error,
                       GeneratorContext* generator_context);
-  bool GeneratePluginOutput(const vector<const FileDescriptor*>& parsed_files,
-                            const string& plugin_name,
-                            const string& parameter,
-                            GeneratorContext* generator_context,
-                            string* error);
+  bool WritePluginOutput(const CodeGeneratorResponse& response,
+                         const string& plugin_name,
+                         GeneratorContext* generator_context,
+                         string* error);
+
+  // Returns the name of the plugin program for an output directive without
+  // a generator.
+  string PluginName(const OutputDirective& output_directive);
 
   // Implements --encode and --decode.
   bool EncodeOrDecode(const DescriptorPool* pool);
@@ -365,6 +403,10 @@ class LIBPROTOC_EXPORT CommandLineInterface {
   // FileDescriptorSet should be written.  Otherwise, empty.
   string descriptor_set_name_;
 
+  // The FileDescriptorSets given with --descriptor_set_in.  Imports that are
+  // not in the --proto_path are taken from them instead of being parsed.
+  vector<string> descriptor_set_in_names_;
+
   // If --dependency_out was given, this is the path to the file where the
   // dependency file will be written. Otherwise, empty.
   string dependency_out_name_;
@@ -384,6 +426,17 @@ class LIBPROTOC_EXPORT CommandLineInterface {
   // See SetInputsAreProtoPathRelative().
   bool inputs_are_proto_path_relative_;
 
+  // Set while running as a persistent worker: the files parsed by the
+  // previous requests.  Compile() does not use it if
+  // use_parsed_file_cache_ is false.
+  google::protobuf::scoped_ptr<ParsedFileCache> parsed_file_cache_;
+  bool use_parsed_file_cache_;
+
+  // Set by Compile() if importing the input files failed while files from
+  // parsed_file_cache_ were used.  The errors can then lack line numbers,
+  // so that the worker compiles again without the cache to report them.
+  bool import_failed_with_cached_files_;
+
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(CommandLineInterface);
 };
 
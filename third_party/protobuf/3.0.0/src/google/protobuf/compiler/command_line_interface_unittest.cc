@@ -117,6 +117,11 @@ class CommandLineInterfaceTest : public testing::Test {
   // Create a subdirectory within temp_directory_.
   void CreateTempDir(const string& name);
 
+  // Write a FileDescriptorSet with the given files to a temp file within
+  // temp_directory_, for --descriptor_set_in.
+  void WriteDescriptorSet(const string& name,
+                          const FileDescriptorSet& descriptor_set);
+
 #ifdef PROTOBUF_OPENSOURCE
   // Change working directory to temp directory.
   void SwitchToTempDirectory() {
@@ -388,6 +393,12 @@ void CommandLineInterfaceTest::CreateTempDir(const string& name) {
                                       0777));
 }
 
+void CommandLineInterfaceTest::WriteDescriptorSet(
+    const string& name, const FileDescriptorSet& descriptor_set) {
+  GOOGLE_CHECK_OK(File::SetContents(temp_directory_ + "/" + name,
+                             descriptor_set.SerializeAsString(), true));
+}
+
 // -------------------------------------------------------------------
 
 void CommandLineInterfaceTest::ExpectNoErrors() {
@@ -653,6 +664,27 @@ TEST_F(CommandLineInterfaceTest, ExtraGeneratorParameters) {
       "test_generator", "baz,foo1,foo2,foo3", "foo.proto", "Foo", "b");
 }
 
+TEST_F(CommandLineInterfaceTest, MultiplePlugins) {
+  // Test that plugins which run at the same time each get their own request.
+
+  CreateTempFile("foo.proto",
+    "syntax = \"proto2\";\n"
+    "message Foo {}\n");
+  CreateTempDir("a");
+  CreateTempDir("b");
+
+  Run("protocol_compiler "
+      "--plug_out=bar:$tmpdir/a "
+      "--test_out=$tmpdir "
+      "--plug_out=baz:$tmpdir/b "
+      "--proto_path=$tmpdir foo.proto");
+
+  ExpectNoErrors();
+  ExpectGenerated("test_plugin", "bar", "foo.proto", "Foo", "a");
+  ExpectGenerated("test_generator", "", "foo.proto", "Foo");
+  ExpectGenerated("test_plugin", "baz", "foo.proto", "Foo", "b");
+}
+
 TEST_F(CommandLineInterfaceTest, Insert) {
   // Test running a generator that inserts code into another's output.
 
@@ -911,6 +943,92 @@ TEST_F(CommandLineInterfaceTest, WriteDescriptorSet) {
   EXPECT_TRUE(descriptor_set.file(0).message_type(0).field(0).has_json_name());
 }
 
+TEST_F(CommandLineInterfaceTest, DescriptorSetInputForImports) {
+  FileDescriptorSet descriptor_set;
+  FileDescriptorProto* file = descriptor_set.add_file();
+  file->set_name("foo.proto");
+  file->add_message_type()->set_name("Foo");
+  WriteDescriptorSet("foo.bin", descriptor_set);
+  CreateTempFile("bar.proto",
+    "syntax = \"proto2\";\n"
+    "import \"foo.proto\";\n"
+    "message Bar {\n"
+    "  optional Foo foo = 1;\n"
+    "}\n");
+
+  // foo.proto is not in the --proto_path, so it comes from the set.
+  Run("protocol_compiler --test_out=$tmpdir --proto_path=$tmpdir "
+      "--descriptor_set_in=$tmpdir/foo.bin bar.proto");
+
+  ExpectNoErrors();
+  ExpectGenerated("test_generator", "", "bar.proto", "Bar");
+}
+
+TEST_F(CommandLineInterfaceTest, DescriptorSetInputForInputs) {
+  FileDescriptorSet descriptor_set;
+  FileDescriptorProto* file = descriptor_set.add_file();
+  file->set_name("foo.proto");
+  file->add_message_type()->set_name("Foo");
+  WriteDescriptorSet("foo.bin", descriptor_set);
+  file->set_name("bar.proto");
+  file->mutable_message_type(0)->set_name("Bar");
+  WriteDescriptorSet("bar.bin", descriptor_set);
+
+  Run("protocol_compiler --test_out=$tmpdir --proto_path=$tmpdir "
+      "--descriptor_set_in=$tmpdir/foo.bin:$tmpdir/bar.bin "
+      "foo.proto bar.proto");
+
+  ExpectNoErrors();
+  ExpectGeneratedWithMultipleInputs("test_generator", "foo.proto,bar.proto",
+                                    "foo.proto", "Foo");
+  ExpectGeneratedWithMultipleInputs("test_generator", "foo.proto,bar.proto",
+                                    "bar.proto", "Bar");
+}
+
+TEST_F(CommandLineInterfaceTest, DescriptorSetInputFirstSetWins) {
+  FileDescriptorSet descriptor_set;
+  FileDescriptorProto* file = descriptor_set.add_file();
+  file->set_name("foo.proto");
+  file->add_message_type()->set_name("Foo");
+  WriteDescriptorSet("foo.bin", descriptor_set);
+  file->mutable_message_type(0)->set_name("Bar");
+  WriteDescriptorSet("bar.bin", descriptor_set);
+
+  Run("protocol_compiler --test_out=$tmpdir --proto_path=$tmpdir "
+      "--descriptor_set_in=$tmpdir/foo.bin:$tmpdir/bar.bin foo.proto");
+
+  ExpectNoErrors();
+  ExpectGenerated("test_generator", "", "foo.proto", "Foo");
+}
+
+TEST_F(CommandLineInterfaceTest, DescriptorSetInputSourceTreeWins) {
+  FileDescriptorSet descriptor_set;
+  FileDescriptorProto* file = descriptor_set.add_file();
+  file->set_name("foo.proto");
+  file->add_message_type()->set_name("Bar");
+  WriteDescriptorSet("foo.bin", descriptor_set);
+  CreateTempFile("foo.proto",
+    "syntax = \"proto2\";\n"
+    "message Foo {}\n");
+
+  Run("protocol_compiler --test_out=$tmpdir --proto_path=$tmpdir "
+      "--descriptor_set_in=$tmpdir/foo.bin foo.proto");
+
+  ExpectNoErrors();
+  ExpectGenerated("test_generator", "", "foo.proto", "Foo");
+}
+
+TEST_F(CommandLineInterfaceTest, DescriptorSetInputMissing) {
+  CreateTempFile("foo.proto",
+    "syntax = \"proto2\";\n"
+    "message Foo {}\n");
+
+  Run("protocol_compiler --test_out=$tmpdir --proto_path=$tmpdir "
+      "--descriptor_set_in=$tmpdir/missing.bin foo.proto");
+
+  ExpectErrorText("$tmpdir/missing.bin: No such file or directory\n");
+}
+
 TEST_F(CommandLineInterfaceTest, WriteDescriptorSetWithDuplicates) {
   CreateTempFile("foo.proto",
     "syntax = \"proto2\";\n"
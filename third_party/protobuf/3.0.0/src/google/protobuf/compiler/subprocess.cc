@@ -37,6 +37,7 @@
 
 #ifndef _WIN32
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/select.h>
 #include <sys/wait.h>
 #include <signal.h>
@@ -257,6 +258,18 @@ bool Subprocess::Communicate(const Message& input, Message* output,
   return true;
 }
 
+void Subprocess::CommunicateAll(const vector<Subprocess*>& subprocesses,
+                                const vector<const Message*>& inputs,
+                                const vector<Message*>& outputs,
+                                vector<string>* errors) {
+  // The children were all started, but one at a time talks to us.
+  errors->clear();
+  errors->resize(subprocesses.size());
+  for (int i = 0; i < subprocesses.size(); i++) {
+    subprocesses[i]->Communicate(*inputs[i], outputs[i], &(*errors)[i]);
+  }
+}
+
 string Subprocess::Win32ErrorMessage(DWORD error_code) {
   char* message;
 
@@ -343,13 +356,34 @@ void Subprocess::Start(const string& program, SearchMode search_mode) {
 
     child_stdin_ = stdin_pipe[1];
     child_stdout_ = stdout_pipe[0];
+
+    // Keep the subprocesses started later from inheriting our end of the
+    // pipes, or this one would not see the end of its input while they run.
+    fcntl(child_stdin_, F_SETFD, FD_CLOEXEC);
+    fcntl(child_stdout_, F_SETFD, FD_CLOEXEC);
   }
 }
 
 bool Subprocess::Communicate(const Message& input, Message* output,
                              string* error) {
+  vector<Subprocess*> subprocesses(1, this);
+  vector<const Message*> inputs(1, &input);
+  vector<Message*> outputs(1, output);
+  vector<string> errors;
+  CommunicateAll(subprocesses, inputs, outputs, &errors);
+  *error = errors[0];
+  return error->empty();
+}
 
-  GOOGLE_CHECK_NE(child_stdin_, -1) << "Must call Start() first.";
+void Subprocess::CommunicateAll(const vector<Subprocess*>& subprocesses,
+                                const vector<const Message*>& inputs,
+                                const vector<Message*>& outputs,
+                                vector<string>* errors) {
+  const int count = subprocesses.size();
+  for (int i = 0; i < count; i++) {
+    GOOGLE_CHECK_NE(subprocesses[i]->child_stdin_, -1)
+        << "Must call Start() first.";
+  }
 
   // The "sighandler_t" typedef is GNU-specific, so define our own.
   typedef void SignalHandler(int);
@@ -357,22 +391,30 @@ bool Subprocess::Communicate(const Message& input, Message* output,
   // Make sure SIGPIPE is disabled so that if the child dies it doesn't kill us.
   SignalHandler* old_pipe_handler = signal(SIGPIPE, SIG_IGN);
 
-  string input_data = input.SerializeAsString();
-  string output_data;
-
-  int input_pos = 0;
-  int max_fd = std::max(child_stdin_, child_stdout_);
+  vector<string> input_data(count);
+  vector<int> input_pos(count, 0);
+  vector<string> output_data(count);
+  for (int i = 0; i < count; i++) {
+    input_data[i] = inputs[i]->SerializeAsString();
+  }
 
-  while (child_stdout_ != -1) {
+  int open_outputs = count;
+  while (open_outputs > 0) {
     fd_set read_fds;
     fd_set write_fds;
     FD_ZERO(&read_fds);
     FD_ZERO(&write_fds);
-    if (child_stdout_ != -1) {
-      FD_SET(child_stdout_, &read_fds);
-    }
-    if (child_stdin_ != -1) {
-      FD_SET(child_stdin_, &write_fds);
+    int max_fd = -1;
+    for (int i = 0; i < count; i++) {
+      const Subprocess* subprocess = subprocesses[i];
+      if (subprocess->child_stdout_ != -1) {
+        FD_SET(subprocess->child_stdout_, &read_fds);
+        max_fd = std::max(max_fd, subprocess->child_stdout_);
+      }
+      if (subprocess->child_stdin_ != -1) {
+        FD_SET(subprocess->child_stdin_, &write_fds);
+        max_fd = std::max(max_fd, subprocess->child_stdin_);
+      }
     }
 
     if (select(max_fd + 1, &read_fds, &write_fds, NULL, NULL) < 0) {
@@ -384,78 +426,85 @@ bool Subprocess::Communicate(const Message& input, Message* output,
       }
     }
 
-    if (child_stdin_ != -1 && FD_ISSET(child_stdin_, &write_fds)) {
-      int n = write(child_stdin_, input_data.data() + input_pos,
-                                  input_data.size() - input_pos);
-      if (n < 0) {
-        // Child closed pipe.  Presumably it will report an error later.
-        // Pretend we're done for now.
-        input_pos = input_data.size();
-      } else {
-        input_pos += n;
+    for (int i = 0; i < count; i++) {
+      Subprocess* subprocess = subprocesses[i];
+      if (subprocess->child_stdin_ != -1 &&
+          FD_ISSET(subprocess->child_stdin_, &write_fds)) {
+        int n = write(subprocess->child_stdin_,
+                      input_data[i].data() + input_pos[i],
+                      input_data[i].size() - input_pos[i]);
+        if (n < 0) {
+          // Child closed pipe.  Presumably it will report an error later.
+          // Pretend we're done for now.
+          input_pos[i] = input_data[i].size();
+        } else {
+          input_pos[i] += n;
+        }
+
+        if (input_pos[i] == input_data[i].size()) {
+          // We're done writing.  Close.
+          close(subprocess->child_stdin_);
+          subprocess->child_stdin_ = -1;
+        }
       }
 
-      if (input_pos == input_data.size()) {
-        // We're done writing.  Close.
-        close(child_stdin_);
-        child_stdin_ = -1;
+      if (subprocess->child_stdout_ != -1 &&
+          FD_ISSET(subprocess->child_stdout_, &read_fds)) {
+        char buffer[4096];
+        int n = read(subprocess->child_stdout_, buffer, sizeof(buffer));
+
+        if (n > 0) {
+          output_data[i].append(buffer, n);
+        } else {
+          // We're done reading.  Close.
+          close(subprocess->child_stdout_);
+          subprocess->child_stdout_ = -1;
+          open_outputs--;
+        }
       }
     }
+  }
 
-    if (child_stdout_ != -1 && FD_ISSET(child_stdout_, &read_fds)) {
-      char buffer[4096];
-      int n = read(child_stdout_, buffer, sizeof(buffer));
+  errors->clear();
+  errors->resize(count);
+  for (int i = 0; i < count; i++) {
+    Subprocess* subprocess = subprocesses[i];
+    if (subprocess->child_stdin_ != -1) {
+      // Child did not finish reading input before it closed the output.
+      // Presumably it exited with an error.
+      close(subprocess->child_stdin_);
+      subprocess->child_stdin_ = -1;
+    }
 
-      if (n > 0) {
-        output_data.append(buffer, n);
-      } else {
-        // We're done reading.  Close.
-        close(child_stdout_);
-        child_stdout_ = -1;
+    int status;
+    while (waitpid(subprocess->child_pid_, &status, 0) == -1) {
+      if (errno != EINTR) {
+        GOOGLE_LOG(FATAL) << "waitpid: " << strerror(errno);
       }
     }
-  }
 
-  if (child_stdin_ != -1) {
-    // Child did not finish reading input before it closed the output.
-    // Presumably it exited with an error.
-    close(child_stdin_);
-    child_stdin_ = -1;
-  }
+    string* error = &(*errors)[i];
+    if (WIFEXITED(status)) {
+      if (WEXITSTATUS(status) != 0) {
+        int error_code = WEXITSTATUS(status);
+        *error = strings::Substitute(
+            "Plugin failed with status code $0.", error_code);
+      }
+    } else if (WIFSIGNALED(status)) {
+      int signal = WTERMSIG(status);
+      *error = strings::Substitute(
+          "Plugin killed by signal $0.", signal);
+    } else {
+      *error = "Neither WEXITSTATUS nor WTERMSIG is true?";
+    }
 
-  int status;
-  while (waitpid(child_pid_, &status, 0) == -1) {
-    if (errno != EINTR) {
-      GOOGLE_LOG(FATAL) << "waitpid: " << strerror(errno);
+    if (error->empty() && !outputs[i]->ParseFromString(output_data[i])) {
+      *error = "Plugin output is unparseable: " + CEscape(output_data[i]);
     }
   }
 
   // Restore SIGPIPE handling.
   signal(SIGPIPE, old_pipe_handler);
-
-  if (WIFEXITED(status)) {
-    if (WEXITSTATUS(status) != 0) {
-      int error_code = WEXITSTATUS(status);
-      *error = strings::Substitute(
-          "Plugin failed with status code $0.", error_code);
-      return false;
-    }
-  } else if (WIFSIGNALED(status)) {
-    int signal = WTERMSIG(status);
-    *error = strings::Substitute(
-        "Plugin killed by signal $0.", signal);
-    return false;
-  } else {
-    *error = "Neither WEXITSTATUS nor WTERMSIG is true?";
-    return false;
-  }
-
-  if (!output->ParseFromString(output_data)) {
-    *error = "Plugin output is unparseable: " + CEscape(output_data);
-    return false;
-  }
-
-  return true;
 }
 
 #endif  // !_WIN32
@@ -43,6 +43,7 @@
 #include <google/protobuf/stubs/common.h>
 
 #include <string>
+#include <vector>
 
 
 namespace google {
@@ -74,6 +75,16 @@ class LIBPROTOC_EXPORT Subprocess {
   // *error to a description of the problem.
   bool Communicate(const Message& input, Message* output, string* error);
 
+  // Like Communicate(), for several started subprocesses at once: pipes
+  // inputs[i] to subprocesses[i] and parses what it writes into *outputs[i],
+  // for all of them at the same time, so that they run in parallel.  Sets
+  // (*errors)[i] to the description of the problem with subprocesses[i], or
+  // to an empty string if it succeeded.
+  static void CommunicateAll(const vector<Subprocess*>& subprocesses,
+                             const vector<const Message*>& inputs,
+                             const vector<Message*>& outputs,
+                             vector<string>* errors);
+
 #ifdef _WIN32
   // Given an error code, returns a human-readable error message.  This is
   // defined here so that CommandLineInterface can share it.
@@ -35,6 +35,7 @@
 #include <google/protobuf/stubs/hash.h>
 #include <map>
 #include <memory>
+#include <new>
 #ifndef _SHARED_PTR_H
 #include <google/protobuf/stubs/shared_ptr.h>
 #endif
@@ -515,7 +516,12 @@ class DescriptorPool::Tables {
   vector<string*> strings_;    // All strings in the pool.
   vector<Message*> messages_;  // All messages in the pool.
   vector<FileDescriptorTables*> file_tables_;  // All file tables in the pool.
-  vector<void*> allocations_;  // All other memory allocated in the pool.
+  vector<void*> allocations_;  // Allocations too large for blocks_.
+
+  // The blocks that AllocateBytes() carves the descriptors and strings of the
+  // pool out of.  Only the last block has room left, from block_used_ on.
+  vector<char*> blocks_;
+  int block_used_;
 
   SymbolsByNameMap      symbols_by_name_;
   FilesByNameMap        files_by_name_;
@@ -527,6 +533,8 @@ class DescriptorPool::Tables {
         messages_before_checkpoint(tables->messages_.size()),
         file_tables_before_checkpoint(tables->file_tables_.size()),
         allocations_before_checkpoint(tables->allocations_.size()),
+        blocks_before_checkpoint(tables->blocks_.size()),
+        block_used_before_checkpoint(tables->block_used_),
         pending_symbols_before_checkpoint(
             tables->symbols_after_checkpoint_.size()),
         pending_files_before_checkpoint(
@@ -538,6 +546,8 @@ class DescriptorPool::Tables {
     int messages_before_checkpoint;
     int file_tables_before_checkpoint;
     int allocations_before_checkpoint;
+    int blocks_before_checkpoint;
+    int block_used_before_checkpoint;
     int pending_symbols_before_checkpoint;
     int pending_files_before_checkpoint;
     int pending_extensions_before_checkpoint;
@@ -550,6 +560,10 @@ class DescriptorPool::Tables {
   // Allocate some bytes which will be reclaimed when the pool is
   // destroyed.
   void* AllocateBytes(int size);
+
+  // The size of blocks_, and the alignment of what is allocated in them.
+  static const int kBlockSize = 64 * 1024;
+  static const int kAlignment = 8;
 };
 
 // Contains tables specific to a particular file.  These tables are not
@@ -644,6 +658,7 @@ DescriptorPool::Tables::Tables()
     : known_bad_files_(3),
       known_bad_symbols_(3),
       extensions_loaded_from_db_(3),
+      block_used_(kBlockSize),
       symbols_by_name_(3),
       files_by_name_(3) {}
 
@@ -651,12 +666,18 @@ DescriptorPool::Tables::Tables()
 DescriptorPool::Tables::~Tables() {
   GOOGLE_DCHECK(checkpoints_.empty());
   // Note that the deletion order is important, since the destructors of some
-  // messages may refer to objects in allocations_.
+  // messages may refer to objects in allocations_ and blocks_, which also hold
+  // the strings.
   STLDeleteElements(&messages_);
+  for (int i = 0; i < strings_.size(); i++) {
+    strings_[i]->~string();
+  }
   for (int i = 0; i < allocations_.size(); i++) {
     operator delete(allocations_[i]);
   }
-  STLDeleteElements(&strings_);
+  for (int i = 0; i < blocks_.size(); i++) {
+    operator delete(blocks_[i]);
+  }
   STLDeleteElements(&file_tables_);
 }
 
@@ -741,11 +762,14 @@ void DescriptorPool::Tables::RollbackToLastCheckpoint() {
   extensions_after_checkpoint_.resize(
       checkpoint.pending_extensions_before_checkpoint);
 
-  STLDeleteContainerPointers(
-      strings_.begin() + checkpoint.strings_before_checkpoint, strings_.end());
   STLDeleteContainerPointers(
       messages_.begin() + checkpoint.messages_before_checkpoint,
       messages_.end());
+  for (int i = checkpoint.strings_before_checkpoint;
+       i < strings_.size();
+       i++) {
+    strings_[i]->~string();
+  }
   STLDeleteContainerPointers(
       file_tables_.begin() + checkpoint.file_tables_before_checkpoint,
       file_tables_.end());
@@ -754,11 +778,18 @@ void DescriptorPool::Tables::RollbackToLastCheckpoint() {
        i++) {
     operator delete(allocations_[i]);
   }
+  for (int i = checkpoint.blocks_before_checkpoint;
+       i < blocks_.size();
+       i++) {
+    operator delete(blocks_[i]);
+  }
 
   strings_.resize(checkpoint.strings_before_checkpoint);
   messages_.resize(checkpoint.messages_before_checkpoint);
   file_tables_.resize(checkpoint.file_tables_before_checkpoint);
   allocations_.resize(checkpoint.allocations_before_checkpoint);
+  blocks_.resize(checkpoint.blocks_before_checkpoint);
+  block_used_ = checkpoint.block_used_before_checkpoint;
   checkpoints_.pop_back();
 }
 
@@ -989,7 +1020,7 @@ Type* DescriptorPool::Tables::AllocateArray(int count) {
 }
 
 string* DescriptorPool::Tables::AllocateString(const string& value) {
-  string* result = new string(value);
+  string* result = new(AllocateBytes(sizeof(string))) string(value);
   strings_.push_back(result);
   return result;
 }
@@ -1008,14 +1039,23 @@ FileDescriptorTables* DescriptorPool::Tables::AllocateFileTables() {
 }
 
 void* DescriptorPool::Tables::AllocateBytes(int size) {
-  // TODO(kenton):  Would it be worthwhile to implement this in some more
-  // sophisticated way?  Probably not for the open source release, but for
-  // internal use we could easily plug in one of our existing memory pool
-  // allocators...
+  // A pool built from large .proto files holds hundreds of thousands of
+  // descriptors and strings, which are only freed together, so they are
+  // carved out of large blocks rather than allocated one by one.
   if (size == 0) return NULL;
 
-  void* result = operator new(size);
-  allocations_.push_back(result);
+  size = (size + kAlignment - 1) & ~(kAlignment - 1);
+  if (size > kBlockSize / 4) {
+    void* result = operator new(size);
+    allocations_.push_back(result);
+    return result;
+  }
+  if (block_used_ + size > kBlockSize) {
+    blocks_.push_back(static_cast<char*>(operator new(kBlockSize)));
+    block_used_ = 0;
+  }
+  void* result = blocks_.back() + block_used_;
+  block_used_ += size;
   return result;
 }
 
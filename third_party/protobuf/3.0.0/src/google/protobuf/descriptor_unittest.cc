@@ -5148,6 +5148,46 @@ TEST_F(ValidationErrorTest, RollbackAfterError) {
     "}");
 }
 
+TEST_F(ValidationErrorTest, RollbackOfLargeFile) {
+  // Like above, but with enough descriptors to take many of the blocks the
+  // pool allocates them in, and a message whose fields do not fit in one.
+  FileDescriptorProto file_proto;
+  file_proto.set_name("foo.proto");
+  for (int i = 0; i < 1000; i++) {
+    DescriptorProto* message = AddMessage(&file_proto, StrCat("Message", i));
+    AddField(message, "foo", 1, FieldDescriptorProto::LABEL_OPTIONAL,
+             FieldDescriptorProto::TYPE_STRING);
+  }
+  DescriptorProto* large = AddMessage(&file_proto, "LargeMessage");
+  for (int i = 1; i <= 1000; i++) {
+    AddField(large, StrCat("field", i), i, FieldDescriptorProto::LABEL_OPTIONAL,
+             FieldDescriptorProto::TYPE_INT32);
+  }
+  FieldDescriptorProto* bad = AddField(
+      large, "bad", 1001, FieldDescriptorProto::LABEL_OPTIONAL,
+      FieldDescriptorProto::TYPE_MESSAGE);
+  bad->set_type_name("NoSuchType");
+
+  MockErrorCollector error_collector;
+  EXPECT_TRUE(
+      pool_.BuildFileCollectingErrors(file_proto, &error_collector) == NULL);
+  EXPECT_EQ("foo.proto: LargeMessage.bad: TYPE: \"NoSuchType\" is not "
+            "defined.\n", error_collector.text_);
+
+  bad->set_type_name("Message999");
+  const FileDescriptor* file = pool_.BuildFile(file_proto);
+  ASSERT_TRUE(file != NULL);
+  ASSERT_EQ(1001, file->message_type_count());
+  EXPECT_EQ("Message999", file->message_type(999)->name());
+  EXPECT_EQ("Message999.foo", file->message_type(999)->field(0)->full_name());
+  const Descriptor* message = pool_.FindMessageTypeByName("LargeMessage");
+  ASSERT_TRUE(message != NULL);
+  ASSERT_EQ(1001, message->field_count());
+  EXPECT_EQ("field1000", message->FindFieldByNumber(1000)->name());
+  EXPECT_EQ(file->message_type(999),
+            message->FindFieldByName("bad")->message_type());
+}
+
 TEST_F(ValidationErrorTest, ErrorsReportedToLogError) {
   // Test that errors are reported to GOOGLE_LOG(ERROR) if no error collector is
   // provided.
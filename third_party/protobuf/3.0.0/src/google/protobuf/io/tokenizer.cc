@@ -128,6 +128,8 @@ CHARACTER_CLASS(WhitespaceNoNewline, c == ' ' || c == '\t' ||
 
 CHARACTER_CLASS(Unprintable, c < ' ' && c > '\0');
 
+CHARACTER_CLASS(LineCommentText, c != '\n' && c != '\0');
+
 CHARACTER_CLASS(Digit, '0' <= c && c <= '9');
 CHARACTER_CLASS(OctalDigit, '0' <= c && c <= '7');
 CHARACTER_CLASS(HexDigit, ('0' <= c && c <= '9') ||
@@ -330,8 +332,30 @@ inline bool Tokenizer::TryConsume(char c) {
 
 template<typename CharacterClass>
 inline void Tokenizer::ConsumeZeroOrMore() {
+  // Same as calling NextChar() for each character, but scans the buffer
+  // directly: identifiers, indentation and comments make up most of the
+  // input of large .proto files.
   while (CharacterClass::InClass(current_char_)) {
-    NextChar();
+    const char* p = buffer_ + buffer_pos_;
+    const char* end = buffer_ + buffer_size_;
+    do {
+      if (*p == '\n') {
+        ++line_;
+        column_ = 0;
+      } else if (*p == '\t') {
+        column_ += kTabWidth - column_ % kTabWidth;
+      } else {
+        ++column_;
+      }
+      ++p;
+    } while (p < end && CharacterClass::InClass(*p));
+
+    buffer_pos_ = p - buffer_;
+    if (p < end) {
+      current_char_ = *p;
+      return;
+    }
+    Refresh();
   }
 }
 
@@ -477,9 +501,7 @@ Tokenizer::TokenType Tokenizer::ConsumeNumber(bool started_with_zero,
 void Tokenizer::ConsumeLineComment(string* content) {
   if (content != NULL) RecordTo(content);
 
-  while (current_char_ != '\0' && current_char_ != '\n') {
-    NextChar();
-  }
+  ConsumeZeroOrMore<LineCommentText>();
   TryConsume('\n');
 
   if (content != NULL) StopRecording();
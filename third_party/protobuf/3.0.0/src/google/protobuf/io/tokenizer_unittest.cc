@@ -418,6 +418,19 @@ MultiTokenCase kMultiTokenCases[] = {
     { Tokenizer::TYPE_IDENTIFIER, "bar", 1, 11, 14 },
     { Tokenizer::TYPE_END       , ""   , 1, 14, 14 },
   }},
+
+  // Test that runs of identifier characters and whitespace, which are
+  // scanned a buffer at a time, keep track of lines and columns.
+  { "  message_with_a_long_name_1  {\n"
+    "    \t  // A comment\n"
+    "\n"
+    "\t  optional_field_2 \t}", {
+    { Tokenizer::TYPE_IDENTIFIER, "message_with_a_long_name_1", 0,  2, 28 },
+    { Tokenizer::TYPE_SYMBOL    , "{"                         , 0, 30, 31 },
+    { Tokenizer::TYPE_IDENTIFIER, "optional_field_2"          , 3, 10, 26 },
+    { Tokenizer::TYPE_SYMBOL    , "}"                         , 3, 32, 33 },
+    { Tokenizer::TYPE_END       , ""                          , 3, 33, 33 },
+  }},
 };
 
 TEST_2D(TokenizerTest, MultipleTokens, kMultiTokenCases, kBlockSizes) {
@@ -86,15 +86,15 @@ gensrcjar = rule(
 
 def cc_grpc_library(name, src):
   basename = src[:-len(".proto")]
-  protoc_label = str(Label("//third_party/protobuf:protoc"))
-  cpp_plugin_label = str(Label("//third_party/grpc:cpp_plugin"))
+  # A protoc with the gRPC generator linked in, so that no plugin process has
+  # to parse the descriptors again.
+  protoc_label = str(Label("//third_party/grpc:cpp_protoc"))
   native.genrule(
       name = name + "_codegen",
       srcs = [src],
-      tools = [protoc_label, cpp_plugin_label],
+      tools = [protoc_label],
       cmd = "\\\n".join([
           "$(location " + protoc_label + ")",
-          "    --plugin=protoc-gen-grpc=$(location " + cpp_plugin_label + ")",
           "    --cpp_out=$(GENDIR)",
           "    --grpc_out=$(GENDIR)",
           "    $(location " + src + ")"]),